@@ -256,6 +256,13 @@ man_pages = [
         [author],
         1,
     ),
+    (
+        "ref/pg_autoctl_show_failovers",
+        "pg_autoctl show failovers",
+        "pg_autoctl show failovers",
+        [author],
+        1,
+    ),
     (
         "ref/pg_autoctl_show_state",
         "pg_autoctl show state",
@@ -375,6 +382,13 @@ man_pages = [
         [author],
         1,
     ),
+    (
+        "ref/pg_autoctl_set_formation_target_recovery_seconds",
+        "pg_autoctl set formation target-recovery-seconds",
+        "pg_autoctl set formation target-recovery-seconds",
+        [author],
+        1,
+    ),
     (
         "ref/pg_autoctl_set_node_replication_quorum",
         "pg_autoctl set node replication-quorum",
@@ -410,6 +424,20 @@ man_pages = [
         [author],
         1,
     ),
+    (
+        "ref/pg_autoctl_perform_rolling_restart",
+        "pg_autoctl perform rolling-restart",
+        "pg_autoctl perform rolling-restart",
+        [author],
+        1,
+    ),
+    (
+        "ref/pg_autoctl_perform_move_formation",
+        "pg_autoctl perform move-formation",
+        "pg_autoctl perform move-formation",
+        [author],
+        1,
+    ),
     (
         "ref/pg_autoctl_run",
         "pg_autoctl run",
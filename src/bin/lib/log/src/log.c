@@ -20,10 +20,13 @@
  * IN THE SOFTWARE.
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <sys/time.h>
+#include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -38,8 +41,35 @@ static struct {
   int level;
   int quiet;
   int useColors;
+  int buffered;
+  int format;
+  char correlationId[LOG_CORRELATION_ID_SIZE];
+  char traceId[LOG_CORRELATION_ID_SIZE];
 } L;
 
+/* the macros in log.h read this copy of L.level */
+int log_min_level = LOG_TRACE;
+
+/*
+ * Log lines are formatted in a stack buffer and then written to stderr in a
+ * single call. Longer messages are written piece by piece as before.
+ */
+#define LOG_LINE_SIZE 2048
+
+/*
+ * When buffered, the log lines of a process accumulate here and are written
+ * out when the buffer is full, at WARN level and above, and when log_flush()
+ * is called. The buffer is per-process: after fork() the child discards the
+ * lines that it inherited, which its parent is responsible for.
+ */
+#define LOG_BUFFER_SIZE (64 * 1024)
+
+static struct {
+  pid_t pid;
+  size_t len;
+  char data[LOG_BUFFER_SIZE];
+} B;
+
 
 static const char *level_names[] = {
   "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"
@@ -81,6 +111,7 @@ void log_set_fp(FILE *fp) {
 
 void log_set_level(int level) {
   L.level = level;
+  log_min_level = level;
 }
 
 int log_get_level(void) {
@@ -97,77 +128,562 @@ void log_use_colors(int enable) {
   L.useColors = enable ? 1 : 0;
 }
 
-void log_log(int level, const char *file, int line, const char *fmt, ...)
-{
-	time_t t;
-	struct tm *lt;
 
-  if (level < L.level) {
+void log_set_format(int format) {
+  L.format = format;
+}
+
+
+int log_get_format(void) {
+  return L.format;
+}
+
+
+/*
+ * log_set_correlation_id sets an identifier that is added to every JSON log
+ * line until it is changed again, NULL or an empty string to reset it.
+ */
+void log_set_correlation_id(const char *id) {
+  if (id == NULL) {
+    L.correlationId[0] = '\0';
     return;
   }
+  strncpy(L.correlationId, id, sizeof(L.correlationId) - 1);
+  L.correlationId[sizeof(L.correlationId) - 1] = '\0';
+}
 
-  if (fmt == NULL)
+
+/*
+ * log_set_trace_id sets the trace id of the monitor decision being carried
+ * out, which is added to every log line until it is changed again, NULL or an
+ * empty string to reset it.
+ */
+void log_set_trace_id(const char *id) {
+  if (id == NULL) {
+    L.traceId[0] = '\0';
+    return;
+  }
+  strncpy(L.traceId, id, sizeof(L.traceId) - 1);
+  L.traceId[sizeof(L.traceId) - 1] = '\0';
+}
+
+void log_set_buffered(int enable) {
+  if (!enable) {
+    log_flush();
+  }
+  L.buffered = enable ? 1 : 0;
+}
+
+
+/*
+ * log_flush writes the buffered log lines of the current process, if any.
+ */
+void log_flush(void)
+{
+  if (B.len == 0)
   {
 	  return;
   }
 
-  /* Acquire lock */
-  lock();
+  if (B.pid == getpid())
+  {
+	  lock();
+	  fwrite(B.data, 1, B.len, stderr);
+	  unlock();
+  }
+
+  B.len = 0;
+}
 
-  /* Get current time */
-  t = time(NULL);
-  lt = localtime(&t);
 
-  /* Log to stderr */
-  if (!L.quiet) {
-    va_list args;
-    char buf[16];
-	int showLineNumber = L.level <= 1;
+static void log_buffer_lines(int level, const char *line, size_t len)
+{
+  pid_t pid = getpid();
 
-    buf[strftime(buf, sizeof(buf), "%H:%M:%S", lt)] = '\0';
+  if (B.pid != pid)
+  {
+	  B.pid = pid;
+	  B.len = 0;
+  }
 
-	if (L.useColors)
+  if (B.len + len > sizeof(B.data))
+  {
+	  log_flush();
+  }
+
+  memcpy(B.data + B.len, line, len);
+  B.len += len;
+
+  if (level >= LOG_WARN)
+  {
+	  log_flush();
+  }
+}
+
+
+/*
+ * A growable buffer for JSON log lines, which starts on the stack.
+ */
+typedef struct {
+  char *data;
+  size_t len;
+  size_t size;
+  char stack[LOG_LINE_SIZE];
+} LogBuffer;
+
+
+static void log_buffer_init(LogBuffer *b)
+{
+	b->data = b->stack;
+	b->len = 0;
+	b->size = sizeof(b->stack);
+}
+
+
+static int log_buffer_reserve(LogBuffer *b, size_t n)
+{
+	if (b->len + n < b->size)
+	{
+		return 1;
+	}
+
+	size_t size = b->size;
+
+	while (b->len + n >= size)
+	{
+		size *= 2;
+	}
+
+	char *data = b->data == b->stack ? malloc(size) : realloc(b->data, size);
+
+	if (data == NULL)
+	{
+		return 0;
+	}
+
+	if (b->data == b->stack)
+	{
+		memcpy(data, b->stack, b->len);
+	}
+
+	b->data = data;
+	b->size = size;
+
+	return 1;
+}
+
+
+static void log_buffer_append(LogBuffer *b, const char *str, size_t n)
+{
+	if (log_buffer_reserve(b, n))
+	{
+		memcpy(b->data + b->len, str, n);
+		b->len += n;
+	}
+}
+
+
+static void log_buffer_append_char(LogBuffer *b, char c)
+{
+	log_buffer_append(b, &c, 1);
+}
+
+
+/* appends a JSON string, with quotes and escapes */
+static void log_buffer_append_json(LogBuffer *b, const char *str)
+{
+	if (str == NULL)
+	{
+		log_buffer_append(b, "null", 4);
+		return;
+	}
+
+	log_buffer_append_char(b, '"');
+
+	for (const unsigned char *p = (const unsigned char *) str; *p; p++)
 	{
-		pg_fprintf(stderr, "%s %d %s%-5s\x1b[0m ",
-				   buf,
-				   getpid(),
-				   level_colors[level],
-				   level_names[level]);
+		switch (*p)
+		{
+			case '"':  log_buffer_append(b, "\\\"", 2); break;
+			case '\\': log_buffer_append(b, "\\\\", 2); break;
+			case '\n': log_buffer_append(b, "\\n", 2); break;
+			case '\r': log_buffer_append(b, "\\r", 2); break;
+			case '\t': log_buffer_append(b, "\\t", 2); break;
+
+			default:
+			{
+				if (*p < 0x20)
+				{
+					char escape[8];
+					int n = pg_snprintf(escape, sizeof(escape), "\\u%04x", *p);
+
+					log_buffer_append(b, escape, n);
+				}
+				else
+				{
+					log_buffer_append_char(b, (char) *p);
+				}
+				break;
+			}
+		}
+	}
+
+	log_buffer_append_char(b, '"');
+}
+
+
+/* appends ,"key":value with a JSON string value */
+static void log_buffer_append_field(LogBuffer *b, const char *key,
+									const char *value)
+{
+	log_buffer_append_char(b, ',');
+	log_buffer_append_json(b, key);
+	log_buffer_append_char(b, ':');
+	log_buffer_append_json(b, value);
+}
+
+
+/* appends ,"key":value with a number value */
+static void log_buffer_append_number(LogBuffer *b, const char *key,
+									 long long value)
+{
+	char number[32];
+	int n = pg_snprintf(number, sizeof(number), "%lld", value);
+
+	log_buffer_append_char(b, ',');
+	log_buffer_append_json(b, key);
+	log_buffer_append_char(b, ':');
+	log_buffer_append(b, number, n);
+}
+
+
+static void log_buffer_free(LogBuffer *b)
+{
+	if (b->data != b->stack)
+	{
+		free(b->data);
+	}
+}
+
+
+/*
+ * log_format_prefix formats the time, pid, and level of a log line, the
+ * source file and line number when in DEBUG or TRACE, and the trace id when
+ * one is set.
+ */
+static int log_format_prefix(char *str, size_t size, const char *timestr,
+							 int level, const char *file, int line)
+{
+	int showLineNumber = L.level <= 1;
+	int len = 0;
 
+	if (L.useColors)
+	{
 		if (showLineNumber)
 		{
-			pg_fprintf(stderr, "\x1b[90m%s:%d:\x1b[0m ", file, line);
+			len = pg_snprintf(str, size,
+							  "%s %d %s%-5s\x1b[0m \x1b[90m%s:%d:\x1b[0m ",
+							  timestr, getpid(),
+							  level_colors[level], level_names[level],
+							  file, line);
+		}
+		else
+		{
+			len = pg_snprintf(str, size, "%s %d %s%-5s\x1b[0m ",
+							  timestr, getpid(),
+							  level_colors[level], level_names[level]);
 		}
 	}
+	else if (showLineNumber)
+	{
+		len = pg_snprintf(str, size, "%s %d %-5s %s:%d ",
+						  timestr, getpid(), level_names[level], file, line);
+	}
 	else
 	{
-		pg_fprintf(stderr, "%s %d %-5s ", buf, getpid(), level_names[level]);
+		len = pg_snprintf(str, size, "%s %d %-5s ",
+						  timestr, getpid(), level_names[level]);
+	}
 
-		if (showLineNumber)
+	if (L.traceId[0] != '\0' && len >= 0 && len < (int) size)
+	{
+		int tracelen = pg_snprintf(str + len, size - len, "[trace %s] ",
+								   L.traceId);
+
+		len = tracelen < 0 ? -1 : len + tracelen;
+	}
+
+	return len;
+}
+
+
+static void log_write(int level, const char *data, size_t len)
+{
+	if (L.buffered)
+	{
+		log_buffer_lines(level, data, len);
+	}
+	else
+	{
+		lock();
+		fwrite(data, 1, len, stderr);
+		unlock();
+	}
+}
+
+
+/*
+ * log_text_stderr writes a log line in the usual human readable format.
+ */
+static void log_text_stderr(int level, const char *file, int line,
+							struct tm *lt, int savedErrno,
+							const char *fmt, va_list args)
+{
+	char buf[16];
+	char logLine[LOG_LINE_SIZE];
+	va_list copy;
+
+	buf[strftime(buf, sizeof(buf), "%H:%M:%S", lt)] = '\0';
+
+	int len = log_format_prefix(logLine, sizeof(logLine), buf, level, file, line);
+
+	if (len >= 0 && len < (int) sizeof(logLine))
+	{
+		errno = savedErrno;
+		va_copy(copy, args);
+		int msglen = pg_vsnprintf(logLine + len, sizeof(logLine) - len, fmt, copy);
+		va_end(copy);
+
+		len = msglen < 0 ? -1 : len + msglen;
+	}
+
+	if (len >= 0 && len < (int) sizeof(logLine) - 1)
+	{
+		logLine[len++] = '\n';
+		log_write(level, logLine, len);
+		return;
+	}
+
+	/* the message does not fit in our buffer, write it in pieces */
+	log_flush();
+	lock();
+
+	if (len > 0)
+	{
+		int prefixlen = log_format_prefix(logLine, sizeof(logLine),
+										  buf, level, file, line);
+
+		fwrite(logLine, 1, prefixlen, stderr);
+	}
+
+	errno = savedErrno;
+	va_copy(copy, args);
+	pg_vfprintf(stderr, fmt, copy);
+	va_end(copy);
+	pg_fprintf(stderr, "\n");
+
+	unlock();
+}
+
+
+/*
+ * log_json_stderr writes a log line as a JSON object on a single line. The
+ * message is optional, event records only carry their name, duration, and
+ * fields.
+ */
+static void log_json_stderr(int level, const char *file, int line,
+							struct timeval *tv, struct tm *lt, int savedErrno,
+							const char *event, long long durationUs,
+							const char **fields,
+							const char *fmt, va_list args)
+{
+	LogBuffer b;
+	char timestr[64];
+	char zone[8];
+
+	log_buffer_init(&b);
+
+	size_t n = strftime(timestr, sizeof(timestr), "%Y-%m-%dT%H:%M:%S", lt);
+	zone[strftime(zone, sizeof(zone), "%z", lt)] = '\0';
+	pg_snprintf(timestr + n, sizeof(timestr) - n, ".%06ld%s",
+				(long) tv->tv_usec, zone);
+
+	log_buffer_append(&b, "{\"time\":", 8);
+	log_buffer_append_json(&b, timestr);
+	log_buffer_append_number(&b, "pid", (long long) getpid());
+	log_buffer_append_field(&b, "level", level_names[level]);
+	log_buffer_append_field(&b, "file", file);
+	log_buffer_append_number(&b, "line", line);
+
+	if (L.correlationId[0] != '\0')
+	{
+		log_buffer_append_field(&b, "id", L.correlationId);
+	}
+
+	if (L.traceId[0] != '\0')
+	{
+		log_buffer_append_field(&b, "trace", L.traceId);
+	}
+
+	if (event != NULL)
+	{
+		log_buffer_append_field(&b, "event", event);
+	}
+
+	if (durationUs >= 0)
+	{
+		log_buffer_append_number(&b, "duration_us", durationUs);
+	}
+
+	for (int i = 0; fields != NULL && fields[i] != NULL; i += 2)
+	{
+		log_buffer_append_field(&b, fields[i], fields[i + 1]);
+	}
+
+	if (fmt != NULL)
+	{
+		char msg[LOG_LINE_SIZE];
+		char *message = msg;
+		va_list copy;
+
+		errno = savedErrno;
+		va_copy(copy, args);
+		int msglen = pg_vsnprintf(msg, sizeof(msg), fmt, copy);
+		va_end(copy);
+
+		if (msglen >= (int) sizeof(msg) && (message = malloc(msglen + 1)) != NULL)
+		{
+			errno = savedErrno;
+			va_copy(copy, args);
+			pg_vsnprintf(message, msglen + 1, fmt, copy);
+			va_end(copy);
+		}
+		else if (msglen < 0 || message == NULL)
+		{
+			message = msg;
+			msg[0] = '\0';
+		}
+
+		log_buffer_append_field(&b, "message", message);
+
+		if (message != msg)
 		{
-			pg_fprintf(stderr, "%s:%d ", file, line);
+			free(message);
 		}
 	}
 
-    va_start(args, fmt);
-    pg_vfprintf(stderr, fmt, args);
-    va_end(args);
-    pg_fprintf(stderr, "\n");
+	log_buffer_append(&b, "}\n", 2);
+
+	log_write(level, b.data, b.len);
+
+	log_buffer_free(&b);
+}
+
+
+static void log_vlog(int level, const char *file, int line,
+					 const char *event, long long durationUs,
+					 const char **fields,
+					 const char *fmt, va_list args)
+{
+  /* %m in fmt refers to the errno of the caller */
+  int savedErrno = errno;
+  struct timeval tv;
+  struct tm lt;
+
+  if (level < L.level) {
+    return;
+  }
+
+  /* Get current time, before waiting for the lock */
+  gettimeofday(&tv, NULL);
+  localtime_r(&tv.tv_sec, &lt);
+
+  /* Log to stderr */
+  if (!L.quiet) {
+	  if (L.format == LOG_FORMAT_JSON)
+	  {
+		  log_json_stderr(level, file, line, &tv, &lt, savedErrno,
+						  event, durationUs, fields, fmt, args);
+	  }
+	  else if (fmt != NULL)
+	  {
+		  log_text_stderr(level, file, line, &lt, savedErrno, fmt, args);
+	  }
   }
 
   /* Log to file */
-  if (L.fp) {
-    va_list args;
+  if (L.fp && fmt != NULL) {
+    va_list copy;
     char buf[32];
-    buf[strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", lt)] = '\0';
+    lock();
+    buf[strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &lt)] = '\0';
     pg_fprintf(L.fp, "%s %d %-5s %s:%d: ",
 			   buf, getpid(), level_names[level], file, line);
-    va_start(args, fmt);
-    pg_vfprintf(L.fp, fmt, args);
-    va_end(args);
+    if (L.traceId[0] != '\0') {
+      pg_fprintf(L.fp, "[trace %s] ", L.traceId);
+    }
+    errno = savedErrno;
+    va_copy(copy, args);
+    pg_vfprintf(L.fp, fmt, copy);
+    va_end(copy);
     pg_fprintf(L.fp, "\n");
+    unlock();
+  }
+}
+
+
+void log_log(int level, const char *file, int line, const char *fmt, ...)
+{
+  va_list args;
+
+  if (fmt == NULL)
+  {
+	  return;
+  }
+
+  va_start(args, fmt);
+  log_vlog(level, file, line, NULL, -1, NULL, fmt, args);
+  va_end(args);
+}
+
+
+void log_log_event(int level, const char *file, int line,
+				   const char *event, long long durationUs, const char **fields,
+				   const char *fmt, ...)
+{
+  va_list args;
+
+  if (fmt == NULL)
+  {
+	  return;
+  }
+
+  va_start(args, fmt);
+  log_vlog(level, file, line, event, durationUs, fields, fmt, args);
+  va_end(args);
+}
+
+
+/* a dummy va_list argument for records, which have no message */
+static void log_log_record_va(int level, const char *file, int line,
+							  const char *event, long long durationUs,
+							  const char **fields, ...)
+{
+  va_list args;
+
+  va_start(args, fields);
+  log_vlog(level, file, line, event, durationUs, fields, NULL, args);
+  va_end(args);
+}
+
+
+void log_log_record(int level, const char *file, int line,
+					const char *event, long long durationUs, const char **fields)
+{
+  if (L.format != LOG_FORMAT_JSON)
+  {
+	  return;
   }
 
-  /* Release lock */
-  unlock();
+  log_log_record_va(level, file, line, event, durationUs, fields);
 }
@@ -17,14 +17,46 @@ typedef void (*log_LockFn)(void *udata, int lock);
 
 enum { LOG_TRACE, LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR, LOG_FATAL };
 
-#define log_trace(...) log_log(LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__)
-#define log_debug(...) log_log(LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
-#define log_info(...)  log_log(LOG_INFO,  __FILE__, __LINE__, __VA_ARGS__)
-#define log_warn(...)  log_log(LOG_WARN,  __FILE__, __LINE__, __VA_ARGS__)
-#define log_error(...) log_log(LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__)
-#define log_fatal(...) log_log(LOG_FATAL, __FILE__, __LINE__, __VA_ARGS__)
+enum { LOG_FORMAT_TEXT, LOG_FORMAT_JSON };
 
-#define log_level(level, ...) log_log(level, __FILE__, __LINE__, __VA_ARGS__)
+#define LOG_CORRELATION_ID_SIZE 64
+
+/*
+ * The macros compare the level before calling log_log(), so that disabled
+ * levels skip evaluating their arguments as well as formatting the message.
+ */
+extern int log_min_level;
+
+#define log_enabled(level) ((level) >= log_min_level)
+
+#define log_log_if(level, ...) \
+	(log_enabled(level) ? log_log(level, __FILE__, __LINE__, __VA_ARGS__) : (void) 0)
+
+#define log_trace(...) log_log_if(LOG_TRACE, __VA_ARGS__)
+#define log_debug(...) log_log_if(LOG_DEBUG, __VA_ARGS__)
+#define log_info(...)  log_log_if(LOG_INFO,  __VA_ARGS__)
+#define log_warn(...)  log_log_if(LOG_WARN,  __VA_ARGS__)
+#define log_error(...) log_log_if(LOG_ERROR, __VA_ARGS__)
+#define log_fatal(...) log_log_if(LOG_FATAL, __VA_ARGS__)
+
+#define log_level(level, ...) log_log_if(level, __VA_ARGS__)
+
+/*
+ * Structured events add a name, a duration in microseconds (-1 when there is
+ * none), and a NULL terminated array of key/value string pairs to the JSON
+ * log lines. In the text format log_event is the same as log_level, and
+ * log_record, which has no message, outputs nothing.
+ */
+#define log_event(level, event, durationUs, fields, ...) \
+	(log_enabled(level) \
+	 ? log_log_event(level, __FILE__, __LINE__, event, durationUs, fields, \
+					 __VA_ARGS__) \
+	 : (void) 0)
+
+#define log_record(level, event, durationUs, fields) \
+	(log_enabled(level) && log_get_format() == LOG_FORMAT_JSON \
+	 ? log_log_record(level, __FILE__, __LINE__, event, durationUs, fields) \
+	 : (void) 0)
 
 void log_set_udata(void *udata);
 void log_set_lock(log_LockFn fn);
@@ -33,8 +65,22 @@ void log_set_level(int level);
 int log_get_level(void);
 void log_set_quiet(int enable);
 void log_use_colors(int enable);
+void log_set_buffered(int enable);
+void log_set_format(int format);
+int log_get_format(void);
+void log_set_correlation_id(const char *id);
+void log_set_trace_id(const char *id);
+void log_flush(void);
 
 void log_log(int level, const char *file, int line, const char *fmt, ...)
  	__attribute__((format(printf, 4, 5)));
 
+void log_log_event(int level, const char *file, int line,
+				   const char *event, long long durationUs, const char **fields,
+				   const char *fmt, ...)
+	__attribute__((format(printf, 7, 8)));
+
+void log_log_record(int level, const char *file, int line,
+					const char *event, long long durationUs, const char **fields);
+
 #endif
@@ -7,6 +7,7 @@
  */
 
 #include <fcntl.h>
+#include <spawn.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -51,6 +52,14 @@ typedef struct
 	char *stdErr;
 } Program;
 
+/*
+ * Sub-programs are started with posix_spawn() by default, which avoids
+ * copying the page tables of our process like fork() does. Setting this to
+ * true forces using the fork() and exec() path, which is useful to compare
+ * both approaches.
+ */
+extern bool runProgramUseFork;
+
 Program run_program(const char *program, ...);
 void initialize_program(Program *prog, char **args, bool setsid);
 void execute_subprogram(Program *prog);
@@ -61,6 +70,14 @@ int snprintf_program_command_line(Program *prog, char *buffer, int size);
 #ifdef RUN_PROGRAM_IMPLEMENTATION
 #undef RUN_PROGRAM_IMPLEMENTATION
 
+extern char **environ;
+
+bool runProgramUseFork = false;
+
+static bool can_spawn_subprogram(Program *prog);
+static bool spawn_subprogram(Program *prog,
+							 int *outpipe, int *errpipe, pid_t *childPid);
+static void close_pipes(int *outpipe, int *errpipe);
 static void exit_internal_error(void);
 static void dup2_or_exit(int fildes, int fildes2);
 static void close_or_exit(int fildes);
@@ -217,6 +234,29 @@ execute_subprogram(Program *prog)
 		}
 	}
 
+	if (can_spawn_subprogram(prog))
+	{
+		if (!spawn_subprogram(prog, outpipe, errpipe, &pid))
+		{
+			/* spawn_subprogram sets prog->returnCode and prog->error */
+			if (prog->capture)
+			{
+				(void) close_pipes(outpipe, errpipe);
+			}
+			return;
+		}
+
+		if (prog->capture)
+		{
+			read_from_pipes(prog, pid, outpipe, errpipe);
+		}
+		else
+		{
+			(void) waitprogram(prog, pid);
+		}
+		return;
+	}
+
 	pid = fork();
 
 	switch (pid)
@@ -316,6 +356,149 @@ execute_subprogram(Program *prog)
 }
 
 
+/*
+ * can_spawn_subprogram returns true when the given program can be started
+ * using posix_spawn() rather than fork() and exec(). Creating a new session
+ * with setsid() is only possible with posix_spawn() when the libc offers the
+ * POSIX_SPAWN_SETSID extension (glibc 2.26 and later, macOS).
+ */
+static bool
+can_spawn_subprogram(Program *prog)
+{
+	if (runProgramUseFork)
+	{
+		return false;
+	}
+
+#ifndef POSIX_SPAWN_SETSID
+	if (prog->setsid)
+	{
+		return false;
+	}
+#endif
+
+	return true;
+}
+
+
+/*
+ * spawn_subprogram starts the given program using posix_spawn(), with the
+ * same redirections as the fork() code path in execute_subprogram: stdin is
+ * read from /dev/null, and stdout and stderr are either sent to the capture
+ * pipes or to the given file descriptors, unless prog->tty is true.
+ */
+static bool
+spawn_subprogram(Program *prog, int *outpipe, int *errpipe, pid_t *childPid)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	int err = 0;
+
+	if ((err = posix_spawn_file_actions_init(&actions)) != 0)
+	{
+		prog->returnCode = -1;
+		prog->error = err;
+		return false;
+	}
+
+	if ((err = posix_spawnattr_init(&attr)) != 0)
+	{
+		posix_spawn_file_actions_destroy(&actions);
+
+		prog->returnCode = -1;
+		prog->error = err;
+		return false;
+	}
+
+	if (prog->tty == false)
+	{
+		err = posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+											   DEV_NULL, O_RDONLY, 0);
+
+		if (prog->capture)
+		{
+			if (err == 0)
+			{
+				err = posix_spawn_file_actions_adddup2(&actions, outpipe[1],
+													   STDOUT_FILENO);
+			}
+
+			if (err == 0)
+			{
+				err = posix_spawn_file_actions_adddup2(&actions, errpipe[1],
+													   STDERR_FILENO);
+			}
+
+			for (int i = 0; err == 0 && i < 2; i++)
+			{
+				err = posix_spawn_file_actions_addclose(&actions, outpipe[i]);
+
+				if (err == 0)
+				{
+					err = posix_spawn_file_actions_addclose(&actions, errpipe[i]);
+				}
+			}
+		}
+		else
+		{
+			if (err == 0)
+			{
+				err = posix_spawn_file_actions_adddup2(&actions, prog->stdOutFd,
+													   STDOUT_FILENO);
+			}
+
+			if (err == 0)
+			{
+				err = posix_spawn_file_actions_adddup2(&actions, prog->stdErrFd,
+													   STDERR_FILENO);
+			}
+		}
+	}
+
+#ifdef POSIX_SPAWN_SETSID
+	if (err == 0 && prog->setsid)
+	{
+		err = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID);
+	}
+#endif
+
+	if (err == 0)
+	{
+		err = posix_spawn(childPid, prog->program,
+						  &actions, &attr, prog->args, environ);
+	}
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+
+	if (err != 0)
+	{
+		fprintf(stderr, "Failed to run program \"%s\": %s\n",
+				prog->program,
+				strerror(err));
+
+		prog->returnCode = -1;
+		prog->error = err;
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * close_pipes closes both ends of our output capture pipes.
+ */
+static void
+close_pipes(int *outpipe, int *errpipe)
+{
+	close(outpipe[0]);
+	close(outpipe[1]);
+	close(errpipe[0]);
+	close(errpipe[1]);
+}
+
+
 /*
  * Run given program with its args, by using exec().
  *
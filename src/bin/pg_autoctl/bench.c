@@ -0,0 +1,2616 @@
+/*
+ * src/bin/pg_autoctl/bench.c
+ *	 Load generator that simulates many keepers against a monitor
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "postgres_fe.h"
+#include "portability/instr_time.h"
+
+#include "bench.h"
+#include "cli_root.h"
+#include "defaults.h"
+#include "file_utils.h"
+#include "fsm.h"
+#include "keeper.h"
+#include "keeper_config.h"
+#include "lock_utils.h"
+#include "log.h"
+#include "monitor.h"
+#include "nodestate_utils.h"
+#include "pghba.h"
+#include "pgsql.h"
+#include "runprogram.h"
+#include "signals.h"
+#include "state.h"
+#include "string_utils.h"
+
+
+/*
+ * A BenchNode is a simulated keeper. It registers to the monitor, and then
+ * reports its goal state as its current state, as if every transition was
+ * instantaneous.
+ *
+ * The simulated primary writes --wal-rate kB of WAL per second, and the
+ * standby nodes report the LSN of their primary, so that the monitor sees
+ * LSN progress. Promoted nodes switch to a new timeline. A crashed node
+ * stops calling the monitor until the failover that it caused is done.
+ */
+typedef struct BenchNode
+{
+	char formation[NAMEDATALEN];
+	char name[NAMEDATALEN];
+	int nodeIndex;              /* in its formation */
+	int port;
+	uint64_t systemIdentifier;
+
+	bool registered;
+	int64_t nodeId;
+	int groupId;
+	NodeState state;
+	int reports;
+
+	uint64_t lsn;
+	int timeline;
+	bool crashed;
+	double crashTime;           /* ms since the client started */
+
+	double nextCallTime;        /* ms since the client started */
+} BenchNode;
+
+typedef struct BenchServerStatsContext
+{
+	char sqlstate[SQLSTATE_LENGTH];
+	BenchServerStats *serverStats;
+	bool parsedOk;
+} BenchServerStatsContext;
+
+/* in the same order as the BenchCall enum */
+static const char *BenchCallNames[BENCH_CALL_COUNT] = {
+	"register_node",
+	"node_active",
+	"get_other_nodes"
+};
+
+
+static void bench_formation_name(BenchOptions *options, int formationIndex,
+								 char *name, size_t size);
+static void bench_start_client(BenchOptions *options, int clientId,
+							   BenchStats *stats);
+static void bench_node_call(Monitor *monitor, BenchOptions *options,
+							BenchNode *nodes, int index, BenchStats *stats,
+							double now);
+static bool bench_node_may_register(BenchNode *nodes, int index);
+static bool bench_state_is_primary(NodeState state);
+static BenchNode * bench_formation_primary(BenchOptions *options,
+										   BenchNode *nodes, int index);
+static bool bench_crash_primary(BenchOptions *options, BenchNode *nodes,
+								int formationIndex, double now);
+static void bench_node_update_lsn(BenchOptions *options,
+								  BenchNode *nodes, int index);
+static void bench_node_promoted(BenchOptions *options, BenchNode *nodes,
+								int index, BenchStats *stats, double now);
+static void bench_start_listener(BenchOptions *options, BenchStats *stats);
+static double bench_elapsed_time(instr_time startTime);
+static bool bench_wait_for_clients(pid_t clientsPidArray[],
+								   int startedClientsCount);
+static void bench_terminate_clients(pid_t clientsPidArray[],
+									int startedClientsCount);
+static void parseBenchServerStats(void *ctx, PGresult *result);
+
+
+/*
+ * bench_monitor_cleanup removes the nodes and the formations that a previous
+ * run of the benchmark might have left behind on the monitor.
+ */
+bool
+bench_monitor_cleanup(BenchOptions *options)
+{
+	Monitor monitor = { 0 };
+
+	const char *removeNodesSQL =
+		"select pgautofailover.remove_node(nodeid, true) "
+		"  from pgautofailover.node "
+		" where left(formationid, length($1) + 1) = $1 || '_'";
+
+	const char *dropFormationsSQL =
+		"select pgautofailover.drop_formation(formationid) "
+		"  from pgautofailover.formation "
+		" where left(formationid, length($1) + 1) = $1 || '_'";
+
+	const Oid paramTypes[1] = { TEXTOID };
+	const char *paramValues[1] = { options->formationPrefix };
+
+	if (!monitor_init(&monitor, options->monitor_pguri))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (!pgsql_execute_with_params(&(monitor.pgsql), removeNodesSQL,
+								   1, paramTypes, paramValues,
+								   NULL, NULL))
+	{
+		log_error("Failed to remove the benchmark nodes from the monitor");
+		return false;
+	}
+
+	if (!pgsql_execute_with_params(&(monitor.pgsql), dropFormationsSQL,
+								   1, paramTypes, paramValues,
+								   NULL, NULL))
+	{
+		log_error("Failed to drop the benchmark formations from the monitor");
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * bench_monitor_prepare creates the formations that the simulated nodes
+ * register in, after having cleaned-up the leftovers of a previous run.
+ */
+bool
+bench_monitor_prepare(BenchOptions *options)
+{
+	Monitor monitor = { 0 };
+
+	if (!bench_monitor_cleanup(options))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (!monitor_init(&monitor, options->monitor_pguri))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	for (int index = 0; index < options->formationsCount; index++)
+	{
+		char formation[NAMEDATALEN] = { 0 };
+
+		(void) bench_formation_name(options, index,
+									formation, sizeof(formation));
+
+		if (!monitor_create_formation(&monitor, formation, "pgsql",
+									  DEFAULT_DATABASE_NAME, true, 0))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+	}
+
+	log_info("Created %d formations \"%s_0\" to \"%s_%d\"",
+			 options->formationsCount,
+			 options->formationPrefix,
+			 options->formationPrefix,
+			 options->formationsCount - 1);
+
+	return true;
+}
+
+
+/*
+ * bench_monitor_run starts the client sub-processes that simulate the
+ * keepers, and the sub-process that holds the LISTEN sessions if any, waits
+ * until they are done, and then collects their statistics.
+ */
+bool
+bench_monitor_run(BenchOptions *options, BenchStats *stats)
+{
+	int processCount = options->clientsCount + (options->listenCount > 0);
+	int startedClientsCount = 0;
+	pid_t clientsPidArray[MAX_BENCH_CLIENTS_COUNT + 1] = { 0 };
+	int pipesArray[MAX_BENCH_CLIENTS_COUNT + 1] = { 0 };
+
+	bool success = true;
+
+	log_info("Starting %d clients to simulate %d nodes in %d formations, "
+			 "for %ds",
+			 options->clientsCount,
+			 options->formationsCount * options->nodesCount,
+			 options->formationsCount,
+			 options->duration);
+
+	/* Flush stdio channels just before fork, to avoid double-output problems */
+	fflush(stdout);
+	fflush(stderr);
+
+	for (int index = 0; index < processCount; index++)
+	{
+		int pipeFd[2] = { 0 };
+
+		if (pipe(pipeFd) != 0)
+		{
+			log_error("Failed to create a pipe for client %d: %m", index);
+
+			(void) bench_terminate_clients(clientsPidArray,
+										   startedClientsCount);
+			return false;
+		}
+
+		pid_t fpid = fork();
+
+		switch (fpid)
+		{
+			case -1:
+			{
+				log_error("Failed to fork client %d", index);
+
+				(void) bench_terminate_clients(clientsPidArray,
+											   startedClientsCount);
+
+				return false;
+			}
+
+			case 0:
+			{
+				BenchStats clientStats = { 0 };
+
+				close(pipeFd[0]);
+
+				/* initialize the semaphore used for locking log output */
+				if (!semaphore_init(&log_semaphore))
+				{
+					exit(EXIT_CODE_INTERNAL_ERROR);
+				}
+
+				/* set our logging facility to use our semaphore as a lock */
+				(void) log_set_udata(&log_semaphore);
+				(void) log_set_lock(&semaphore_log_lock_function);
+
+				if (index < options->clientsCount)
+				{
+					(void) bench_start_client(options, index, &clientStats);
+				}
+				else
+				{
+					(void) bench_start_listener(options, &clientStats);
+				}
+
+				bool sent = bench_write_buffer(pipeFd[1], &clientStats,
+											   sizeof(clientStats));
+
+				close(pipeFd[1]);
+
+				(void) semaphore_finish(&log_semaphore);
+				exit(sent ? EXIT_CODE_QUIT : EXIT_CODE_INTERNAL_ERROR);
+			}
+
+			default:
+			{
+				/* fork succeeded, in parent */
+				close(pipeFd[1]);
+
+				clientsPidArray[index] = fpid;
+				pipesArray[index] = pipeFd[0];
+				++startedClientsCount;
+			}
+		}
+	}
+
+	/*
+	 * Each client sends its statistics when it's done, reading them blocks
+	 * until then, or until the client exits without sending them.
+	 */
+	for (int index = 0; index < startedClientsCount; index++)
+	{
+		BenchStats clientStats = { 0 };
+
+		if (bench_read_buffer(pipesArray[index], &clientStats,
+							  sizeof(clientStats)))
+		{
+			for (int call = 0; call < BENCH_CALL_COUNT; call++)
+			{
+				(void) bench_histogram_merge(&(stats->calls[call]),
+											 &(clientStats.calls[call]));
+			}
+
+			(void) bench_histogram_merge(&(stats->failovers),
+										 &(clientStats.failovers));
+
+			stats->notifications += clientStats.notifications;
+		}
+		else
+		{
+			log_error("Failed to receive statistics from client %d", index);
+			success = false;
+		}
+
+		close(pipesArray[index]);
+	}
+
+	return bench_wait_for_clients(clientsPidArray, startedClientsCount) &&
+		   success;
+}
+
+
+/*
+ * bench_formation_name computes the name of the formation with the given
+ * index.
+ */
+static void
+bench_formation_name(BenchOptions *options, int formationIndex,
+					 char *name, size_t size)
+{
+	sformat(name, size, "%s_%d", options->formationPrefix, formationIndex);
+}
+
+
+/*
+ * bench_start_client simulates the nodes of the formations assigned to the
+ * given client: formations are distributed to the clients in a round-robin
+ * fashion. Each node calls node_active, then sleeps for --interval
+ * milliseconds, as the keeper main loop does.
+ */
+static void
+bench_start_client(BenchOptions *options, int clientId, BenchStats *stats)
+{
+	Monitor monitor = { 0 };
+	instr_time startTime;
+
+	int formationsCount =
+		(options->formationsCount - clientId + options->clientsCount - 1) /
+		options->clientsCount;
+	int nodesCount = formationsCount * options->nodesCount;
+
+	if (nodesCount == 0)
+	{
+		log_info("Client %d has no formation to simulate", clientId);
+		return;
+	}
+
+	if (!monitor_init(&monitor, options->monitor_pguri))
+	{
+		/* errors have already been logged */
+		return;
+	}
+
+	if (options->persistent)
+	{
+		monitor.pgsql.connectionStatementType = PGSQL_CONNECTION_PERSISTENT;
+	}
+
+	BenchNode *nodes = (BenchNode *) calloc(nodesCount, sizeof(BenchNode));
+
+	if (nodes == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return;
+	}
+
+	/* nodes of the same formation are contiguous in the nodes array */
+	for (int index = 0; index < nodesCount; index++)
+	{
+		BenchNode *node = &(nodes[index]);
+
+		int formationIndex =
+			clientId + (index / options->nodesCount) * options->clientsCount;
+		int globalIndex =
+			formationIndex * options->nodesCount + index % options->nodesCount;
+
+		(void) bench_formation_name(options, formationIndex,
+									node->formation, sizeof(node->formation));
+
+		sformat(node->name, sizeof(node->name), "%s_%d",
+				node->formation, index % options->nodesCount);
+
+		node->nodeIndex = index % options->nodesCount;
+		node->port = BENCH_FIRST_PORT + globalIndex;
+		node->systemIdentifier = UINT64_C(7000000000000000000) + formationIndex;
+		node->nodeId = -1;
+		node->groupId = 0;
+		node->state = INIT_STATE;
+		node->lsn = UINT64_C(0x3000000);
+		node->timeline = 1;
+
+		/* spread the calls of our nodes over the interval */
+		node->nextCallTime =
+			(double) options->interval * index / nodesCount;
+	}
+
+	log_info("Client %d simulates %d nodes in %d formations",
+			 clientId, nodesCount, formationsCount);
+
+	/* crash the primary of our formations in turn, when asked to */
+	double nextFailoverTime = options->failoverInterval * 1000.0;
+	int nextFailoverFormation = 0;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	while (!(asked_to_stop || asked_to_stop_fast || asked_to_quit))
+	{
+		double now = bench_elapsed_time(startTime);
+
+		if (now >= options->duration * 1000.0)
+		{
+			break;
+		}
+
+		if (options->failoverInterval > 0 && now >= nextFailoverTime)
+		{
+			(void) bench_crash_primary(options, nodes,
+									   nextFailoverFormation, now);
+
+			nextFailoverFormation =
+				(nextFailoverFormation + 1) % formationsCount;
+			nextFailoverTime = now + options->failoverInterval * 1000.0;
+		}
+
+		/* wake-up at least every 100ms to check for signals */
+		double nextWakeUpTime = now + 100.0;
+
+		for (int index = 0; index < nodesCount; index++)
+		{
+			BenchNode *node = &(nodes[index]);
+
+			if (node->nextCallTime <= now)
+			{
+				(void) bench_node_call(&monitor, options, nodes, index, stats,
+									   now);
+
+				now = bench_elapsed_time(startTime);
+				node->nextCallTime = now + options->interval;
+			}
+
+			if (node->nextCallTime < nextWakeUpTime)
+			{
+				nextWakeUpTime = node->nextCallTime;
+			}
+		}
+
+		now = bench_elapsed_time(startTime);
+
+		if (nextWakeUpTime > now)
+		{
+			pg_usleep((long) ((nextWakeUpTime - now) * 1000));
+		}
+	}
+
+	free(nodes);
+	pgsql_finish(&(monitor.pgsql));
+}
+
+
+/*
+ * bench_node_call makes the next monitor call of the node at the given index
+ * in the nodes array: register_node until it succeeds, and then node_active,
+ * and get_other_nodes every --other-nodes-freq reports.
+ */
+static void
+bench_node_call(Monitor *monitor, BenchOptions *options,
+				BenchNode *nodes, int index, BenchStats *stats,
+				double now)
+{
+	BenchNode *node = &(nodes[index]);
+	MonitorAssignedState assignedState = { 0 };
+
+	instr_time callStartTime;
+	bool success = false;
+
+	char lsn[PG_LSN_MAXLENGTH] = { 0 };
+
+	if (node->crashed)
+	{
+		return;
+	}
+
+	if (!node->registered)
+	{
+		bool mayRetry = false;
+
+		if (!bench_node_may_register(nodes, index))
+		{
+			return;
+		}
+
+		INSTR_TIME_SET_CURRENT(callStartTime);
+
+		success = monitor_register_node(monitor,
+										node->formation,
+										node->name,
+										BENCH_NODE_HOST,
+										node->port,
+										node->systemIdentifier,
+										DEFAULT_DATABASE_NAME,
+										node->nodeId,
+										node->groupId,
+										INIT_STATE,
+										NODE_KIND_STANDALONE,
+										FAILOVER_NODE_CANDIDATE_PRIORITY,
+										FAILOVER_NODE_REPLICATION_QUORUM,
+										DEFAULT_CITUS_CLUSTER_NAME,
+										&mayRetry,
+										&assignedState);
+
+		(void) bench_histogram_add(&(stats->calls[BENCH_CALL_REGISTER_NODE]),
+								   bench_elapsed_time(callStartTime),
+								   success);
+
+		if (success)
+		{
+			node->registered = true;
+			node->nodeId = assignedState.nodeId;
+			node->groupId = assignedState.groupId;
+			node->state = assignedState.state;
+		}
+
+		return;
+	}
+
+	(void) bench_node_update_lsn(options, nodes, index);
+
+	sformat(lsn, sizeof(lsn), "%X/%X",
+			(uint32_t) (node->lsn >> 32), (uint32_t) node->lsn);
+
+	INSTR_TIME_SET_CURRENT(callStartTime);
+
+	success = monitor_node_active(monitor,
+								  node->formation,
+								  node->nodeId,
+								  node->groupId,
+								  node->state,
+								  true,
+								  node->timeline,
+								  lsn,
+								  lsn,
+								  "",
+								  NULL,
+								  &assignedState);
+
+	(void) bench_histogram_add(&(stats->calls[BENCH_CALL_NODE_ACTIVE]),
+							   bench_elapsed_time(callStartTime),
+							   success);
+
+	if (!success)
+	{
+		return;
+	}
+
+	bool wasPrimary = bench_state_is_primary(node->state);
+
+	node->state = assignedState.state;
+	++(node->reports);
+
+	if (!wasPrimary && bench_state_is_primary(node->state))
+	{
+		(void) bench_node_promoted(options, nodes, index, stats, now);
+	}
+
+	if (options->otherNodesFreq > 0 &&
+		node->reports % options->otherNodesFreq == 0)
+	{
+		NodeAddressArray otherNodesArray = { 0 };
+
+		INSTR_TIME_SET_CURRENT(callStartTime);
+
+		success = monitor_get_other_nodes(monitor,
+										  node->nodeId,
+										  ANY_STATE,
+										  &otherNodesArray);
+
+		(void) bench_histogram_add(&(stats->calls[BENCH_CALL_GET_OTHER_NODES]),
+								   bench_elapsed_time(callStartTime),
+								   success);
+
+		(void) nodeAddressArrayFree(&otherNodesArray);
+	}
+}
+
+
+/*
+ * bench_node_may_register returns true when the node at the given index can
+ * register. The nodes of a formation register one after the other, as it
+ * happens when setting up a formation: the second node once the first one is
+ * single, and the next ones once the previous one is a secondary.
+ */
+static bool
+bench_node_may_register(BenchNode *nodes, int index)
+{
+	BenchNode *node = &(nodes[index]);
+
+	if (node->nodeIndex == 0)
+	{
+		return true;
+	}
+
+	BenchNode *previousNode = &(nodes[index - 1]);
+
+	if (!previousNode->registered)
+	{
+		return false;
+	}
+
+	if (node->nodeIndex == 1)
+	{
+		return previousNode->state == SINGLE_STATE ||
+			   previousNode->state == PRIMARY_STATE;
+	}
+
+	return previousNode->state == SECONDARY_STATE;
+}
+
+
+/*
+ * bench_state_is_primary returns true when a node in the given state accepts
+ * writes, and so writes WAL.
+ */
+static bool
+bench_state_is_primary(NodeState state)
+{
+	return state == SINGLE_STATE ||
+		   state == WAIT_PRIMARY_STATE ||
+		   state == PRIMARY_STATE ||
+		   state == JOIN_PRIMARY_STATE ||
+		   state == APPLY_SETTINGS_STATE;
+}
+
+
+/*
+ * bench_formation_primary returns the node that is currently the primary of
+ * the formation of the node at the given index, or NULL when there is none.
+ * The nodes of a formation are contiguous in the nodes array.
+ */
+static BenchNode *
+bench_formation_primary(BenchOptions *options, BenchNode *nodes, int index)
+{
+	int first = index - nodes[index].nodeIndex;
+
+	for (int i = first; i < first + options->nodesCount; i++)
+	{
+		if (!nodes[i].crashed && bench_state_is_primary(nodes[i].state))
+		{
+			return &(nodes[i]);
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * bench_crash_primary simulates the crash of the primary node of the given
+ * formation of this client: the node stops reporting to the monitor. We only
+ * crash a primary when all the nodes of the formation are in a stable state.
+ */
+static bool
+bench_crash_primary(BenchOptions *options, BenchNode *nodes,
+					int formationIndex, double now)
+{
+	int first = formationIndex * options->nodesCount;
+	BenchNode *primary = NULL;
+
+	for (int i = first; i < first + options->nodesCount; i++)
+	{
+		BenchNode *node = &(nodes[i]);
+
+		if (!node->registered || node->crashed)
+		{
+			return false;
+		}
+
+		if (node->state == PRIMARY_STATE)
+		{
+			primary = node;
+		}
+		else if (node->state != SECONDARY_STATE)
+		{
+			return false;
+		}
+	}
+
+	if (primary == NULL)
+	{
+		return false;
+	}
+
+	log_info("Simulating a crash of node %" PRId64 " \"%s\" in formation \"%s\"",
+			 primary->nodeId, primary->name, primary->formation);
+
+	primary->crashed = true;
+	primary->crashTime = now;
+
+	return true;
+}
+
+
+/*
+ * bench_node_update_lsn moves the LSN of the node at the given index forward:
+ * a primary writes --wal-rate kB per second, and the other nodes catch-up
+ * with the primary of their formation.
+ */
+static void
+bench_node_update_lsn(BenchOptions *options, BenchNode *nodes, int index)
+{
+	BenchNode *node = &(nodes[index]);
+
+	if (bench_state_is_primary(node->state))
+	{
+		node->lsn += (uint64_t) options->walRate * 1024 * options->interval / 1000;
+		return;
+	}
+
+	BenchNode *primary = bench_formation_primary(options, nodes, index);
+
+	if (primary != NULL)
+	{
+		node->lsn = primary->lsn;
+		node->timeline = primary->timeline;
+	}
+}
+
+
+/*
+ * bench_node_promoted is called when the node at the given index has been
+ * assigned a primary state: it switches to a new timeline, and the crashed
+ * node of the formation, if any, may now come back.
+ */
+static void
+bench_node_promoted(BenchOptions *options, BenchNode *nodes, int index,
+					BenchStats *stats, double now)
+{
+	BenchNode *node = &(nodes[index]);
+	int first = index - node->nodeIndex;
+
+	for (int i = first; i < first + options->nodesCount; i++)
+	{
+		BenchNode *crashedNode = &(nodes[i]);
+
+		if (crashedNode->timeline > node->timeline)
+		{
+			node->timeline = crashedNode->timeline;
+		}
+
+		if (crashedNode->crashed)
+		{
+			double elapsed = now - crashedNode->crashTime;
+
+			log_info("Node %" PRId64 " \"%s\" is the new primary of "
+					 "formation \"%s\", %.0fms after the crash of "
+					 "node %" PRId64 " \"%s\"",
+					 node->nodeId, node->name, node->formation, elapsed,
+					 crashedNode->nodeId, crashedNode->name);
+
+			(void) bench_histogram_add(&(stats->failovers), elapsed, true);
+
+			crashedNode->crashed = false;
+		}
+	}
+
+	++(node->timeline);
+}
+
+
+/*
+ * bench_start_listener opens --listen sessions to the monitor that LISTEN to
+ * the state notifications, as the pg_autoctl watch and show state --watch
+ * commands do, and counts the notifications they receive.
+ */
+static void
+bench_start_listener(BenchOptions *options, BenchStats *stats)
+{
+	char *channels[] = { "state", NULL };
+	instr_time startTime;
+
+	int sessionsCount = options->listenCount;
+
+	PGSQL *sessions = (PGSQL *) calloc(sessionsCount, sizeof(PGSQL));
+	struct pollfd *pollFds =
+		(struct pollfd *) calloc(sessionsCount, sizeof(struct pollfd));
+
+	if (sessions == NULL || pollFds == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return;
+	}
+
+	for (int index = 0; index < sessionsCount; index++)
+	{
+		PGSQL *pgsql = &(sessions[index]);
+
+		if (!pgsql_init(pgsql, options->monitor_pguri, PGSQL_CONN_MONITOR) ||
+			!pgsql_listen(pgsql, channels))
+		{
+			log_error("Failed to open LISTEN session %d", index);
+			pollFds[index].fd = -1;
+			continue;
+		}
+
+		pollFds[index].fd = PQsocket(pgsql->connection);
+		pollFds[index].events = POLLIN;
+	}
+
+	log_info("Listening to state notifications in %d sessions", sessionsCount);
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	while (!(asked_to_stop || asked_to_stop_fast || asked_to_quit))
+	{
+		if (bench_elapsed_time(startTime) >= options->duration * 1000.0)
+		{
+			break;
+		}
+
+		int ret = poll(pollFds, sessionsCount, 100);
+
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			log_error("Failed to wait for notifications: poll(): %m");
+			break;
+		}
+
+		for (int index = 0; ret > 0 && index < sessionsCount; index++)
+		{
+			PGconn *connection = sessions[index].connection;
+			PGnotify *notify = NULL;
+
+			if (pollFds[index].fd < 0 || pollFds[index].revents == 0)
+			{
+				continue;
+			}
+
+			if (!PQconsumeInput(connection))
+			{
+				log_warn("Lost LISTEN session %d: %s",
+						 index, PQerrorMessage(connection));
+				pollFds[index].fd = -1;
+				continue;
+			}
+
+			while ((notify = PQnotifies(connection)) != NULL)
+			{
+				++(stats->notifications);
+
+				PQfreemem(notify);
+				PQconsumeInput(connection);
+			}
+		}
+	}
+
+	for (int index = 0; index < sessionsCount; index++)
+	{
+		pgsql_finish(&(sessions[index]));
+	}
+
+	free(sessions);
+	free(pollFds);
+}
+
+
+/*
+ * bench_elapsed_time returns how many milliseconds have elapsed since the
+ * given start time.
+ */
+static double
+bench_elapsed_time(instr_time startTime)
+{
+	instr_time duration;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	return INSTR_TIME_GET_MILLISEC(duration);
+}
+
+
+/*
+ * bench_wait_for_clients waits until all the subprocess are finished.
+ */
+static bool
+bench_wait_for_clients(pid_t clientsPidArray[], int startedClientsCount)
+{
+	int subProcessCount = startedClientsCount;
+	bool allReturnCodeAreZero = true;
+
+	while (subProcessCount > 0)
+	{
+		int status;
+
+		pid_t pid = waitpid(-1, &status, 0);
+
+		if (pid == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			/* no more childrens */
+			break;
+		}
+
+		int returnCode = WEXITSTATUS(status);
+
+		for (int index = 0; index < startedClientsCount; index++)
+		{
+			if (clientsPidArray[index] == pid && returnCode != 0)
+			{
+				log_error("Client %d (pid %d) exited with code %d",
+						  index, pid, returnCode);
+				allReturnCodeAreZero = false;
+			}
+		}
+
+		--subProcessCount;
+	}
+
+	return allReturnCodeAreZero;
+}
+
+
+/*
+ * bench_terminate_clients sends a SIGQUIT signal to known-running client
+ * processes.
+ */
+static void
+bench_terminate_clients(pid_t clientsPidArray[], int startedClientsCount)
+{
+	for (int index = 0; index < startedClientsCount; index++)
+	{
+		int pid = clientsPidArray[index];
+
+		if (kill(pid, SIGQUIT) != 0)
+		{
+			log_error("Failed to send SIGQUIT to client %d pid %d: %m",
+					  index, pid);
+		}
+	}
+}
+
+
+/*
+ * bench_write_buffer writes the given buffer to a pipe, such as when a
+ * sub-process sends its statistics to the main process.
+ */
+bool
+bench_write_buffer(int fd, void *buffer, size_t size)
+{
+	char *data = (char *) buffer;
+	size_t written = 0;
+
+	while (written < size)
+	{
+		ssize_t bytes = write(fd, data + written, size - written);
+
+		if (bytes < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			log_error("Failed to send statistics: %m");
+			return false;
+		}
+
+		written += bytes;
+	}
+
+	return true;
+}
+
+
+/*
+ * bench_read_buffer reads size bytes from a pipe into the given buffer. It
+ * returns false when the writer closed the pipe before sending them all.
+ */
+bool
+bench_read_buffer(int fd, void *buffer, size_t size)
+{
+	char *data = (char *) buffer;
+	size_t received = 0;
+
+	while (received < size)
+	{
+		ssize_t bytes = read(fd, data + received, size - received);
+
+		if (bytes < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			log_error("Failed to receive statistics: %m");
+			return false;
+		}
+
+		if (bytes == 0)
+		{
+			return false;
+		}
+
+		received += bytes;
+	}
+
+	return true;
+}
+
+
+/*
+ * bench_histogram_add counts a call that took elapsedTime milliseconds. Only
+ * the latency of successful calls is counted.
+ */
+void
+bench_histogram_add(BenchHistogram *histogram, double elapsedTime, bool success)
+{
+	if (!success)
+	{
+		++(histogram->errors);
+		return;
+	}
+
+	double us = elapsedTime * 1000.0;
+	int bucket = 0;
+
+	if (us >= 1.0)
+	{
+		bucket = 1 + (int) (log2(us) * BENCH_HISTOGRAM_RESOLUTION);
+
+		if (bucket >= BENCH_HISTOGRAM_BUCKETS)
+		{
+			bucket = BENCH_HISTOGRAM_BUCKETS - 1;
+		}
+	}
+
+	++(histogram->count);
+	++(histogram->buckets[bucket]);
+
+	histogram->totalTime += elapsedTime;
+
+	if (elapsedTime > histogram->maxTime)
+	{
+		histogram->maxTime = elapsedTime;
+	}
+}
+
+
+/*
+ * bench_histogram_merge adds the counts of the source histogram to the target
+ * histogram.
+ */
+void
+bench_histogram_merge(BenchHistogram *target, BenchHistogram *source)
+{
+	target->count += source->count;
+	target->errors += source->errors;
+	target->totalTime += source->totalTime;
+
+	if (source->maxTime > target->maxTime)
+	{
+		target->maxTime = source->maxTime;
+	}
+
+	for (int bucket = 0; bucket < BENCH_HISTOGRAM_BUCKETS; bucket++)
+	{
+		target->buckets[bucket] += source->buckets[bucket];
+	}
+}
+
+
+/*
+ * bench_histogram_percentile returns the upper bound of the bucket where the
+ * given percentile of the calls falls, in milliseconds.
+ */
+double
+bench_histogram_percentile(BenchHistogram *histogram, double percentile)
+{
+	int64_t rank = (int64_t) ceil(percentile * histogram->count);
+	int64_t count = 0;
+
+	if (histogram->count == 0)
+	{
+		return 0;
+	}
+
+	for (int bucket = 0; bucket < BENCH_HISTOGRAM_BUCKETS; bucket++)
+	{
+		count += histogram->buckets[bucket];
+
+		if (count >= rank)
+		{
+			double upperBound =
+				pow(2.0, (double) bucket / BENCH_HISTOGRAM_RESOLUTION) / 1000.0;
+
+			return upperBound < histogram->maxTime
+				   ? upperBound
+				   : histogram->maxTime;
+		}
+	}
+
+	return histogram->maxTime;
+}
+
+
+/*
+ * bench_monitor_server_stats fetches the statistics that the monitor keeps
+ * about the calls to the protocol functions, including the time spent
+ * waiting for the formation and group locks. Monitors that do not have the
+ * pgautofailover.stat_functions view are benchmarked without them.
+ */
+bool
+bench_monitor_server_stats(BenchOptions *options, BenchServerStats *serverStats)
+{
+	Monitor monitor = { 0 };
+	BenchServerStatsContext context = { { 0 }, serverStats, false };
+
+	const char *sql =
+		"select funcname, calls, total_time, lock_wait_time "
+		"  from pgautofailover.stat_functions "
+		" where funcname in ('register_node', 'node_active', 'get_other_nodes')";
+
+	serverStats->valid = false;
+
+	if (!monitor_init(&monitor, options->monitor_pguri))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (!pgsql_execute_with_params(&(monitor.pgsql), sql, 0, NULL, NULL,
+								   &context, parseBenchServerStats))
+	{
+		log_warn("Failed to get the function statistics from the monitor, "
+				 "lock waits are not reported");
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		log_error("Failed to parse the function statistics from the monitor");
+		return false;
+	}
+
+	serverStats->valid = true;
+
+	return true;
+}
+
+
+/*
+ * parseBenchServerStats parses the rows of pgautofailover.stat_functions.
+ */
+static void
+parseBenchServerStats(void *ctx, PGresult *result)
+{
+	BenchServerStatsContext *context = (BenchServerStatsContext *) ctx;
+	BenchServerStats *serverStats = context->serverStats;
+
+	if (PQnfields(result) != 4)
+	{
+		log_error("Query returned %d columns, expected 4", PQnfields(result));
+		context->parsedOk = false;
+		return;
+	}
+
+	for (int rowNumber = 0; rowNumber < PQntuples(result); rowNumber++)
+	{
+		char *funcname = PQgetvalue(result, rowNumber, 0);
+
+		for (int call = 0; call < BENCH_CALL_COUNT; call++)
+		{
+			if (strcmp(funcname, BenchCallNames[call]) != 0)
+			{
+				continue;
+			}
+
+			if (!stringToInt64(PQgetvalue(result, rowNumber, 1),
+							   &(serverStats->calls[call])) ||
+				!stringToDouble(PQgetvalue(result, rowNumber, 2),
+								&(serverStats->totalTime[call])) ||
+				!stringToDouble(PQgetvalue(result, rowNumber, 3),
+								&(serverStats->lockWaitTime[call])))
+			{
+				log_error("Invalid statistics for function \"%s\"", funcname);
+				context->parsedOk = false;
+				return;
+			}
+		}
+	}
+
+	context->parsedOk = true;
+}
+
+
+/*
+ * bench_monitor_print_report prints the throughput and the latencies of each
+ * kind of monitor call, as measured by the clients. When the monitor
+ * statistics are available, the time spent in the function on the monitor
+ * and waiting for the formation and group locks is printed too.
+ */
+void
+bench_monitor_print_report(BenchOptions *options, BenchStats *stats,
+						   BenchServerStats *before, BenchServerStats *after)
+{
+	bool serverStats = before->valid && after->valid;
+
+	fformat(stdout,
+			"\nMonitor benchmark: %d nodes in %d formations, %d clients, "
+			"%dms interval, %ds\n\n",
+			options->formationsCount * options->nodesCount,
+			options->formationsCount,
+			options->clientsCount,
+			options->interval,
+			options->duration);
+
+	fformat(stdout, "%15s | %8s | %6s | %8s | %8s | %8s | %8s | %8s | %8s "
+					"| %9s | %12s\n",
+			"Call", "Calls", "Errors", "Calls/s",
+			"Avg ms", "p50 ms", "p90 ms", "p99 ms", "Max ms",
+			"Server ms", "Lock wait ms");
+
+	fformat(stdout, "%15s-+-%8s-+-%6s-+-%8s-+-%8s-+-%8s-+-%8s-+-%8s-+-%8s"
+					"-+-%9s-+-%12s\n",
+			"---------------", "--------", "------", "--------",
+			"--------", "--------", "--------", "--------", "--------",
+			"---------", "------------");
+
+	for (int call = 0; call < BENCH_CALL_COUNT; call++)
+	{
+		BenchHistogram *histogram = &(stats->calls[call]);
+
+		char serverTime[BUFSIZE] = "-";
+		char lockWaitTime[BUFSIZE] = "-";
+
+		double avgTime =
+			histogram->count > 0 ? histogram->totalTime / histogram->count : 0;
+
+		if (serverStats)
+		{
+			int64_t calls = after->calls[call] - before->calls[call];
+			double totalTime = after->totalTime[call] - before->totalTime[call];
+			double lockWait =
+				after->lockWaitTime[call] - before->lockWaitTime[call];
+
+			sformat(serverTime, sizeof(serverTime), "%.3f",
+					calls > 0 ? totalTime / calls : 0);
+			sformat(lockWaitTime, sizeof(lockWaitTime), "%.3f", lockWait);
+		}
+
+		fformat(stdout,
+				"%15s | %8" PRId64 " | %6" PRId64 " | %8.1f "
+				"| %8.3f | %8.3f | %8.3f | %8.3f | %8.3f | %9s | %12s\n",
+				BenchCallNames[call],
+				histogram->count,
+				histogram->errors,
+				(double) histogram->count / options->duration,
+				avgTime,
+				bench_histogram_percentile(histogram, 0.50),
+				bench_histogram_percentile(histogram, 0.90),
+				bench_histogram_percentile(histogram, 0.99),
+				histogram->maxTime,
+				serverTime,
+				lockWaitTime);
+	}
+
+	if (stats->failovers.count > 0)
+	{
+		BenchHistogram *histogram = &(stats->failovers);
+
+		fformat(stdout,
+				"\nSimulated %" PRId64 " failovers, time to a new primary: "
+				"p50 %.0fms, p90 %.0fms, max %.0fms\n",
+				histogram->count,
+				bench_histogram_percentile(histogram, 0.50),
+				bench_histogram_percentile(histogram, 0.90),
+				histogram->maxTime);
+	}
+
+	if (options->listenCount > 0)
+	{
+		fformat(stdout,
+				"\nReceived %" PRId64 " notifications in %d LISTEN sessions "
+				"(%.1f/s)\n",
+				stats->notifications,
+				options->listenCount,
+				(double) stats->notifications / options->duration);
+	}
+
+	fformat(stdout, "\n");
+}
+
+
+/*
+ * bench_spawn_run runs the benchmark program options->count times, either
+ * with fork() and exec() or with posix_spawn(), and counts the time it takes
+ * to run the program and capture its output in the given histogram.
+ */
+bool
+bench_spawn_run(BenchSpawnOptions *options, bool useFork,
+				BenchHistogram *histogram)
+{
+	bool success = true;
+
+	runProgramUseFork = useFork;
+
+	for (int i = 0; i < options->count; i++)
+	{
+		instr_time startTime;
+
+		if (asked_to_stop || asked_to_stop_fast || asked_to_quit)
+		{
+			success = false;
+			break;
+		}
+
+		INSTR_TIME_SET_CURRENT(startTime);
+
+		Program prog = run_program(options->program, NULL);
+
+		double elapsedTime = bench_elapsed_time(startTime);
+		bool ok = prog.returnCode == 0;
+
+		(void) bench_histogram_add(histogram, elapsedTime, ok);
+
+		if (!ok && histogram->errors == 1)
+		{
+			log_warn("Program \"%s\" exited with code %d",
+					 options->program, prog.returnCode);
+		}
+
+		free_program(&prog);
+	}
+
+	runProgramUseFork = false;
+
+	return success;
+}
+
+
+/*
+ * bench_spawn_print_report prints the latencies of running the benchmark
+ * program with fork() and exec() and with posix_spawn().
+ */
+void
+bench_spawn_print_report(BenchSpawnOptions *options,
+						 BenchHistogram *forkHistogram,
+						 BenchHistogram *spawnHistogram)
+{
+	const char *names[] = { "fork+exec", "posix_spawn" };
+	BenchHistogram *histograms[] = { forkHistogram, spawnHistogram };
+
+	fformat(stdout,
+			"\nSpawn benchmark: %d runs of \"%s\", %d MB resident\n\n",
+			options->count,
+			options->program,
+			options->rss);
+
+	fformat(stdout, "%12s | %8s | %6s | %8s | %8s | %8s | %8s | %8s\n",
+			"Method", "Runs", "Errors",
+			"Avg ms", "p50 ms", "p90 ms", "p99 ms", "Max ms");
+
+	fformat(stdout, "%12s-+-%8s-+-%6s-+-%8s-+-%8s-+-%8s-+-%8s-+-%8s\n",
+			"------------", "--------", "------",
+			"--------", "--------", "--------", "--------", "--------");
+
+	for (int i = 0; i < 2; i++)
+	{
+		BenchHistogram *histogram = histograms[i];
+
+		double avgTime =
+			histogram->count > 0 ? histogram->totalTime / histogram->count : 0;
+
+		fformat(stdout,
+				"%12s | %8" PRId64 " | %6" PRId64 " "
+				"| %8.3f | %8.3f | %8.3f | %8.3f | %8.3f\n",
+				names[i],
+				histogram->count,
+				histogram->errors,
+				avgTime,
+				bench_histogram_percentile(histogram, 0.50),
+				bench_histogram_percentile(histogram, 0.90),
+				bench_histogram_percentile(histogram, 0.99),
+				histogram->maxTime);
+	}
+
+	fformat(stdout, "\n");
+}
+
+
+/*
+ * bench_state_from_string_scan parses a state name with a strcmp() call per
+ * known state, as NodeStateFromString used to do.
+ */
+static NodeState
+bench_state_from_string_scan(const char *str)
+{
+	for (int state = NO_STATE; state < NODE_STATE_COUNT; state++)
+	{
+		if (strcmp(str, NodeStateToString((NodeState) state)) == 0)
+		{
+			return (NodeState) state;
+		}
+	}
+
+	return NO_STATE;
+}
+
+
+/*
+ * bench_fsm_lookups runs options->count rounds of FSM transition lookups,
+ * using either the KeeperFSM index or a linear scan of the array, and returns
+ * how many lookups found a transition.
+ */
+static int64_t
+bench_fsm_lookups(BenchFSMOptions *options, bool indexed, int64_t *calls)
+{
+	PgInstanceKind kinds[] = {
+		NODE_KIND_STANDALONE,
+		NODE_KIND_CITUS_COORDINATOR,
+		NODE_KIND_CITUS_WORKER
+	};
+	int kindsCount = sizeof(kinds) / sizeof(kinds[0]);
+	int64_t found = 0;
+
+	for (int i = 0; i < options->count; i++)
+	{
+		for (int current = NO_STATE; current < NODE_STATE_COUNT; current++)
+		{
+			for (int assigned = NO_STATE; assigned < NODE_STATE_COUNT; assigned++)
+			{
+				for (int k = 0; k < kindsCount; k++)
+				{
+					KeeperFSMTransition *transition =
+						indexed
+						? keeper_fsm_find_transition(current, assigned, kinds[k])
+						: keeper_fsm_scan_transition(current, assigned, kinds[k]);
+
+					found += transition != NULL;
+					++(*calls);
+				}
+			}
+		}
+	}
+
+	return found;
+}
+
+
+/*
+ * bench_fsm_parse_names runs options->count rounds of parsing every state
+ * name, using either NodeStateFromString or a strcmp() scan.
+ */
+static int64_t
+bench_fsm_parse_names(BenchFSMOptions *options, bool hashed, int64_t *calls)
+{
+	int64_t sum = 0;
+
+	for (int i = 0; i < options->count; i++)
+	{
+		for (int state = NO_STATE; state < NODE_STATE_COUNT; state++)
+		{
+			const char *name = NodeStateToString((NodeState) state);
+
+			sum += hashed
+				   ? NodeStateFromString(name)
+				   : bench_state_from_string_scan(name);
+			++(*calls);
+		}
+	}
+
+	return sum;
+}
+
+
+/*
+ * bench_fsm_run compares the KeeperFSM index to a linear scan of the array,
+ * and the hashed parsing of state names to a strcmp() scan, and prints the
+ * average time per call of each method.
+ */
+void
+bench_fsm_run(BenchFSMOptions *options)
+{
+	const char *names[] = {
+		"fsm scan", "fsm index", "state strcmp", "state hash"
+	};
+	int64_t calls[4] = { 0 };
+	int64_t results[4] = { 0 };
+	double elapsed[4] = { 0 };
+
+	/* build the index and the hash table before taking timings */
+	(void) keeper_fsm_find_transition(INIT_STATE, SINGLE_STATE,
+									  NODE_KIND_STANDALONE);
+	(void) NodeStateFromString("init");
+
+	for (int i = 0; i < 4; i++)
+	{
+		instr_time startTime;
+
+		INSTR_TIME_SET_CURRENT(startTime);
+
+		results[i] =
+			i < 2
+			? bench_fsm_lookups(options, i == 1, &(calls[i]))
+			: bench_fsm_parse_names(options, i == 3, &(calls[i]));
+
+		elapsed[i] = bench_elapsed_time(startTime);
+	}
+
+	fformat(stdout,
+			"\nFSM benchmark: %d rounds, %d transitions, %d states\n\n",
+			options->count,
+			keeper_fsm_transitions_count(),
+			NODE_STATE_COUNT);
+
+	fformat(stdout, "%12s | %10s | %10s | %10s | %8s\n",
+			"Method", "Calls", "Result", "Total ms", "ns/call");
+
+	fformat(stdout, "%12s-+-%10s-+-%10s-+-%10s-+-%8s\n",
+			"------------", "----------", "----------",
+			"----------", "--------");
+
+	for (int i = 0; i < 4; i++)
+	{
+		fformat(stdout,
+				"%12s | %10" PRId64 " | %10" PRId64 " | %10.3f | %8.1f\n",
+				names[i],
+				calls[i],
+				results[i],
+				elapsed[i],
+				calls[i] > 0 ? elapsed[i] * 1000000.0 / calls[i] : 0);
+	}
+
+	if (results[0] != results[1] || results[2] != results[3])
+	{
+		log_error("FSM benchmark methods disagree, "
+				  "see pg_autoctl do fsm check");
+	}
+
+	fformat(stdout, "\n");
+}
+
+
+/*
+ * The inputs of the internals benchmark are prepared once, so that the
+ * timings only cover the code that the keeper runs in its main loop.
+ */
+typedef struct BenchInternalsData
+{
+	int nodesCount;
+	char directory[MAXPGPATH];
+
+	PGresult *nodesResult;
+	PGresult *statesResult;
+
+	NodeAddressArray previousNodes;
+	NodeAddressArray currentNodes;
+
+	char hbaFilePath[MAXPGPATH];
+
+	KeeperConfig *config;
+	Keeper *keeper;
+
+	IdentifySystem *system;
+	char *history;
+	char *historyCopy;
+	size_t historySize;
+} BenchInternalsData;
+
+typedef bool (*BenchInternalsFunction)(BenchInternalsData *data);
+
+typedef struct BenchInternalsCase
+{
+	const char *name;
+	BenchInternalsFunction function;
+} BenchInternalsCase;
+
+
+/*
+ * bench_internals_make_result builds a PGresult in memory, as if we had
+ * received it from the monitor, with rowsCount rows of the given columns.
+ * The values of each row are computed by formatting the row number with the
+ * given value templates.
+ */
+static PGresult *
+bench_internals_make_result(const char **columns, const char **values,
+							int columnsCount, int rowsCount)
+{
+	PGresult *result = PQmakeEmptyPGresult(NULL, PGRES_TUPLES_OK);
+	PGresAttDesc attributes[16] = { 0 };
+
+	if (result == NULL || columnsCount > 16)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return NULL;
+	}
+
+	for (int col = 0; col < columnsCount; col++)
+	{
+		attributes[col].name = (char *) columns[col];
+		attributes[col].typid = TEXTOID;
+		attributes[col].typlen = -1;
+		attributes[col].atttypmod = -1;
+	}
+
+	if (!PQsetResultAttrs(result, columnsCount, attributes))
+	{
+		log_error("Failed to prepare the benchmark result set: %s",
+				  PQresultErrorMessage(result));
+		PQclear(result);
+		return NULL;
+	}
+
+	for (int row = 0; row < rowsCount; row++)
+	{
+		for (int col = 0; col < columnsCount; col++)
+		{
+			char value[BUFSIZE] = { 0 };
+
+			/* templates have at most one directive, for the row number */
+			sformat(value, sizeof(value), values[col], row + 1);
+
+			if (!PQsetvalue(result, row, col, value, strlen(value)))
+			{
+				log_error("Failed to prepare the benchmark result set: %s",
+						  PQresultErrorMessage(result));
+				PQclear(result);
+				return NULL;
+			}
+		}
+	}
+
+	return result;
+}
+
+
+/*
+ * bench_internals_parse_nodes parses the result of get_other_nodes.
+ */
+static bool
+bench_internals_parse_nodes(BenchInternalsData *data)
+{
+	NodeAddressArray nodesArray = { 0 };
+
+	bool success = monitor_parse_nodes_result(data->nodesResult, &nodesArray);
+
+	nodeAddressArrayFree(&nodesArray);
+
+	return success;
+}
+
+
+/*
+ * bench_internals_parse_states parses the result of current_state.
+ */
+static bool
+bench_internals_parse_states(BenchInternalsData *data)
+{
+	CurrentNodeStateArray nodesArray = { 0 };
+
+	bool success =
+		monitor_parse_current_state_result(data->statesResult, &nodesArray);
+
+	currentNodeStateArrayFree(&nodesArray);
+
+	return success;
+}
+
+
+/*
+ * bench_internals_diff_nodes computes the nodes to add to the HBA file when
+ * a tenth of the nodes are new or have a new hostname.
+ */
+static bool
+bench_internals_diff_nodes(BenchInternalsData *data)
+{
+	NodeAddressArray diffNodesArray = { 0 };
+
+	bool success = keeper_diff_nodes_array(&(data->previousNodes),
+										   &(data->currentNodes),
+										   &diffNodesArray);
+
+	nodeAddressArrayFree(&diffNodesArray);
+
+	return success;
+}
+
+
+/*
+ * bench_internals_hba_rules checks that the HBA file contains the rules for
+ * all the nodes, which is what the keeper does when the list of nodes has not
+ * changed.
+ */
+static bool
+bench_internals_hba_rules(BenchInternalsData *data)
+{
+	bool hbaChanged = false;
+
+	return pghba_ensure_host_rules_exist(data->hbaFilePath,
+										 &(data->currentNodes),
+										 false,
+										 "postgres",
+										 PG_AUTOCTL_REPLICA_USERNAME,
+										 "trust",
+										 HBA_EDIT_MINIMAL,
+										 &hbaChanged);
+}
+
+
+/*
+ * bench_internals_read_ini reads the keeper configuration file.
+ */
+static bool
+bench_internals_read_ini(BenchInternalsData *data)
+{
+	return keeper_config_read_file_skip_pgsetup(data->config, true);
+}
+
+
+/*
+ * bench_internals_state_json serializes the keeper state to JSON.
+ */
+static bool
+bench_internals_state_json(BenchInternalsData *data)
+{
+	char json[BUFSIZE * 8] = { 0 };
+
+	return keeper_state_as_json(data->keeper, json, sizeof(json));
+}
+
+
+/*
+ * bench_internals_timelines parses a timeline history file. The parser edits
+ * its input in place, so the timing includes copying the file contents.
+ */
+static bool
+bench_internals_timelines(BenchInternalsData *data)
+{
+	memcpy(data->historyCopy, data->history, data->historySize + 1);
+
+	return parseTimeLineHistory("bench.history", data->historyCopy,
+								data->system);
+}
+
+
+/*
+ * bench_internals_prepare builds the inputs of every case of the benchmark:
+ * the result sets, the nodes arrays, and the files in a temporary directory.
+ */
+static bool
+bench_internals_prepare(BenchInternalsOptions *options,
+						BenchInternalsData *data)
+{
+	const char *nodesColumns[] = {
+		"node_id", "node_name", "node_host", "node_port",
+		"node_lsn", "node_is_primary"
+	};
+	const char *nodesValues[] = {
+		"%d", "node_%d", "fd00::%x", "5432", "0/3000060", "f"
+	};
+
+	const char *statesColumns[] = {
+		"formation_kind", "nodename", "nodehost", "nodeport", "group_id",
+		"node_id", "current_group_state", "assigned_group_state",
+		"candidate_priority", "replication_quorum", "reported_tli",
+		"reported_lsn", "health", "nodecluster", "healthlag", "reportlag"
+	};
+	const char *statesValues[] = {
+		"pgsql", "node_%d", "fd00::%x", "5432", "0",
+		"%d", "secondary", "secondary",
+		"50", "t", "1",
+		"0/3000060", "1", "default", "0", "0"
+	};
+
+	data->nodesCount = options->nodes;
+
+	const char *tmpdir = getenv("TMPDIR");
+
+	sformat(data->directory, sizeof(data->directory),
+			"%s/pg_autoctl.bench.XXXXXX",
+			tmpdir != NULL ? tmpdir : "/tmp");
+
+	if (mkdtemp(data->directory) == NULL)
+	{
+		log_error("Failed to create a temporary directory \"%s\": %m",
+				  data->directory);
+		return false;
+	}
+
+	data->nodesResult =
+		bench_internals_make_result(nodesColumns, nodesValues,
+									6, data->nodesCount);
+
+	data->statesResult =
+		bench_internals_make_result(statesColumns, statesValues,
+									16, data->nodesCount);
+
+	if (data->nodesResult == NULL || data->statesResult == NULL)
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	/* the current nodes have one new node or new hostname out of ten */
+	if (!monitor_parse_nodes_result(data->nodesResult, &(data->previousNodes)) ||
+		!nodeAddressArrayCopy(&(data->currentNodes), &(data->previousNodes)))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	for (int i = 0; i < data->currentNodes.count; i += 10)
+	{
+		NodeAddress *node = &(data->currentNodes.nodes[i]);
+
+		if (i % 20 == 0)
+		{
+			node->nodeId += data->nodesCount;
+		}
+		else
+		{
+			sformat(node->host, sizeof(node->host), "fd00::1:%x", i + 1);
+		}
+	}
+
+	/* the HBA file begins with the default rules of initdb */
+	sformat(data->hbaFilePath, sizeof(data->hbaFilePath),
+			"%s/pg_hba.conf", data->directory);
+
+	const char *hbaContents =
+		"local   all             all                     trust\n"
+		"host    all             all     127.0.0.1/32    trust\n"
+		"host    all             all     ::1/128         trust\n";
+
+	if (!write_file((char *) hbaContents, strlen(hbaContents),
+					data->hbaFilePath))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	/* the keeper configuration file, as pg_autoctl create postgres does */
+	data->config = (KeeperConfig *) calloc(1, sizeof(KeeperConfig));
+	data->keeper = (Keeper *) calloc(1, sizeof(Keeper));
+	data->system = (IdentifySystem *) calloc(1, sizeof(IdentifySystem));
+
+	if (data->config == NULL || data->keeper == NULL || data->system == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return false;
+	}
+
+	KeeperConfig *config = data->config;
+
+	sformat(config->pathnames.config, sizeof(config->pathnames.config),
+			"%s/pg_autoctl.cfg", data->directory);
+
+	strlcpy(config->role, KEEPER_ROLE, sizeof(config->role));
+	strlcpy(config->monitor_pguri,
+			"postgres://autoctl_node@10.0.0.1:5432/pg_auto_failover",
+			sizeof(config->monitor_pguri));
+	strlcpy(config->formation, "default", sizeof(config->formation));
+	strlcpy(config->name, "node_1", sizeof(config->name));
+	strlcpy(config->hostname, "10.0.0.1", sizeof(config->hostname));
+	strlcpy(config->nodeKind, "standalone", sizeof(config->nodeKind));
+
+	sformat(config->pgSetup.pgdata, sizeof(config->pgSetup.pgdata),
+			"%s/pgdata", data->directory);
+	strlcpy(config->pgSetup.dbname, "postgres",
+			sizeof(config->pgSetup.dbname));
+	config->pgSetup.pgport = 5432;
+
+	if (!keeper_config_write_file(config))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	/* the keeper state that pg_autoctl do fsm state prints */
+	Keeper *keeper = data->keeper;
+
+	keeper->postgres.postgresSetup = config->pgSetup;
+	(void) keeper_state_init(&(keeper->state));
+
+	keeper->state.current_node_id = 1;
+	keeper->state.current_role = SECONDARY_STATE;
+	keeper->state.assigned_role = SECONDARY_STATE;
+
+	/* a timeline history with a line per node, as after that many failovers */
+	int timelines = Min(data->nodesCount, PG_AUTOCTL_MAX_TIMELINES - 2);
+	PQExpBuffer history = createPQExpBuffer();
+
+	for (int tli = 1; tli <= timelines; tli++)
+	{
+		appendPQExpBuffer(history,
+						  "%d\t%X/%X\tno recovery target specified\n",
+						  tli, tli, 0x3000060);
+	}
+
+	if (PQExpBufferBroken(history))
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		destroyPQExpBuffer(history);
+		return false;
+	}
+
+	data->system->identifier = UINT64_C(7000000000000000000);
+	data->system->timeline = timelines + 1;
+
+	data->historySize = history->len;
+	data->history = strdup(history->data);
+	data->historyCopy = (char *) malloc(data->historySize + 1);
+
+	destroyPQExpBuffer(history);
+
+	if (data->history == NULL || data->historyCopy == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * bench_internals_cleanup releases the inputs of the benchmark, and removes
+ * the files that it created.
+ */
+static void
+bench_internals_cleanup(BenchInternalsData *data)
+{
+	if (data->nodesResult != NULL)
+	{
+		PQclear(data->nodesResult);
+	}
+
+	if (data->statesResult != NULL)
+	{
+		PQclear(data->statesResult);
+	}
+
+	nodeAddressArrayFree(&(data->previousNodes));
+	nodeAddressArrayFree(&(data->currentNodes));
+
+	free(data->config);
+	free(data->keeper);
+	free(data->system);
+	free(data->history);
+	free(data->historyCopy);
+
+	if (!IS_EMPTY_STRING_BUFFER(data->directory))
+	{
+		char path[MAXPGPATH] = { 0 };
+
+		(void) unlink_file(data->hbaFilePath);
+
+		sformat(path, sizeof(path), "%s/pg_autoctl.cfg", data->directory);
+		(void) unlink_file(path);
+
+		if (rmdir(data->directory) != 0)
+		{
+			log_warn("Failed to remove directory \"%s\": %m",
+					 data->directory);
+		}
+	}
+}
+
+
+/*
+ * bench_internals_run times the code paths that the keeper runs in its main
+ * loop, on inputs sized after --nodes. Each case first runs once to warm up
+ * the caches, which also adds the HBA rules to the file, and then --count
+ * times. As the distribution of the timings of such small functions has a
+ * long tail, we report percentiles rather than an average.
+ */
+bool
+bench_internals_run(BenchInternalsOptions *options)
+{
+	BenchInternalsCase cases[] = {
+		{ "parse nodes", &bench_internals_parse_nodes },
+		{ "parse states", &bench_internals_parse_states },
+		{ "diff nodes", &bench_internals_diff_nodes },
+		{ "hba rules", &bench_internals_hba_rules },
+		{ "read config", &bench_internals_read_ini },
+		{ "state json", &bench_internals_state_json },
+		{ "timelines", &bench_internals_timelines }
+	};
+	int casesCount = sizeof(cases) / sizeof(cases[0]);
+
+	BenchHistogram histograms[sizeof(cases) / sizeof(cases[0])] = { 0 };
+	BenchInternalsData data = { 0 };
+	bool success = true;
+
+	/* the code we time logs every HBA rule at the INFO level */
+	int logLevel = log_get_level();
+
+	if (logLevel < LOG_WARN)
+	{
+		(void) log_set_level(LOG_WARN);
+	}
+
+	if (!bench_internals_prepare(options, &data))
+	{
+		log_error("Failed to prepare the inputs of the benchmark");
+		(void) bench_internals_cleanup(&data);
+		(void) log_set_level(logLevel);
+		return false;
+	}
+
+	for (int c = 0; c < casesCount; c++)
+	{
+		if (!(cases[c].function)(&data))
+		{
+			log_error("Failed to run the \"%s\" benchmark", cases[c].name);
+			success = false;
+			continue;
+		}
+
+		for (int i = 0; i < options->count; i++)
+		{
+			instr_time startTime;
+
+			INSTR_TIME_SET_CURRENT(startTime);
+
+			bool ok = (cases[c].function)(&data);
+
+			(void) bench_histogram_add(&(histograms[c]),
+									   bench_elapsed_time(startTime),
+									   ok);
+		}
+	}
+
+	(void) log_set_level(logLevel);
+
+	fformat(stdout,
+			"\nInternals benchmark: %d rounds, %d nodes\n\n",
+			options->count,
+			options->nodes);
+
+	fformat(stdout, "%12s | %8s | %6s | %9s | %9s | %9s | %9s\n",
+			"Case", "Count", "Errors",
+			"p50 us", "p90 us", "p99 us", "Max us");
+
+	fformat(stdout, "%12s-+-%8s-+-%6s-+-%9s-+-%9s-+-%9s-+-%9s\n",
+			"------------", "--------", "------",
+			"---------", "---------", "---------", "---------");
+
+	for (int c = 0; c < casesCount; c++)
+	{
+		BenchHistogram *histogram = &(histograms[c]);
+
+		fformat(stdout,
+				"%12s | %8" PRId64 " | %6" PRId64 " | %9.1f | %9.1f "
+				"| %9.1f | %9.1f\n",
+				cases[c].name,
+				histogram->count,
+				histogram->errors,
+				bench_histogram_percentile(histogram, 0.50) * 1000.0,
+				bench_histogram_percentile(histogram, 0.90) * 1000.0,
+				bench_histogram_percentile(histogram, 0.99) * 1000.0,
+				histogram->maxTime * 1000.0);
+
+		if (histogram->errors > 0)
+		{
+			success = false;
+		}
+	}
+
+	fformat(stdout, "\n");
+
+	(void) bench_internals_cleanup(&data);
+
+	return success;
+}
+
+
+/*
+ * A listener sub-process of the notification benchmark sends the number of
+ * LISTEN sessions it could open once they are ready, and then these
+ * statistics, followed by, for each notification of the round, how many of
+ * its sessions received it and the latency of the last one.
+ */
+typedef struct BenchNotifyListenerStats
+{
+	int sessions;
+	BenchHistogram deliveries;
+} BenchNotifyListenerStats;
+
+
+/*
+ * bench_monotonic_us returns the current time of the monotonic clock, in
+ * microseconds. The clock is the same in every process of the system, so
+ * that the listener sub-processes can compute the latency of a notification
+ * from the time it was sent at, which it contains.
+ */
+static uint64_t
+bench_monotonic_us(void)
+{
+	struct timespec ts = { 0 };
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+
+/*
+ * bench_notify_listener opens sessionsCount LISTEN sessions to the monitor,
+ * the same way as the keeper does with pgsql_listen(), tells the main
+ * process that they are ready, and then receives the notifications until
+ * each session got --count of them, or until the round should be over.
+ */
+static bool
+bench_notify_listener(BenchNotifyOptions *options, int sessionsCount, int fd)
+{
+	char *channels[] = { BENCH_NOTIFY_CHANNEL, NULL };
+	BenchNotifyListenerStats stats = { 0 };
+
+	PGSQL *sessions = (PGSQL *) calloc(sessionsCount, sizeof(PGSQL));
+	struct pollfd *pollFds =
+		(struct pollfd *) calloc(sessionsCount, sizeof(struct pollfd));
+	int *received = (int *) calloc(sessionsCount, sizeof(int));
+	int64_t *delivered = (int64_t *) calloc(options->count, sizeof(int64_t));
+	double *fanout = (double *) calloc(options->count, sizeof(double));
+
+	if (sessions == NULL || pollFds == NULL || received == NULL ||
+		delivered == NULL || fanout == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return false;
+	}
+
+	for (int index = 0; index < sessionsCount; index++)
+	{
+		PGSQL *pgsql = &(sessions[index]);
+
+		if (!pgsql_init(pgsql, options->monitor_pguri, PGSQL_CONN_MONITOR) ||
+			!pgsql_listen(pgsql, channels))
+		{
+			log_error("Failed to open LISTEN session %d", index);
+			pollFds[index].fd = -1;
+			continue;
+		}
+
+		pollFds[index].fd = PQsocket(pgsql->connection);
+		pollFds[index].events = POLLIN;
+		++stats.sessions;
+	}
+
+	if (!bench_write_buffer(fd, &(stats.sessions), sizeof(stats.sessions)))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	int pending = stats.sessions;
+	uint64_t deadline =
+		bench_monotonic_us() +
+		((uint64_t) options->count * options->interval +
+		 BENCH_NOTIFY_TIMEOUT * 1000) * 1000;
+
+	while (pending > 0 && !(asked_to_stop || asked_to_stop_fast || asked_to_quit))
+	{
+		if (bench_monotonic_us() >= deadline)
+		{
+			break;
+		}
+
+		int ret = poll(pollFds, sessionsCount, 100);
+
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			log_error("Failed to wait for notifications: poll(): %m");
+			break;
+		}
+
+		for (int index = 0; ret > 0 && index < sessionsCount; index++)
+		{
+			PGconn *connection = sessions[index].connection;
+			PGnotify *notify = NULL;
+
+			if (pollFds[index].fd < 0 || pollFds[index].revents == 0)
+			{
+				continue;
+			}
+
+			if (!PQconsumeInput(connection))
+			{
+				log_warn("Lost LISTEN session %d: %s",
+						 index, PQerrorMessage(connection));
+				pollFds[index].fd = -1;
+
+				if (received[index] < options->count)
+				{
+					--pending;
+				}
+				continue;
+			}
+
+			while ((notify = PQnotifies(connection)) != NULL)
+			{
+				uint64_t now = bench_monotonic_us();
+				uint64_t sentTime = 0;
+				int seq = -1;
+
+				if (sscanf(notify->extra, "%d:%" SCNu64 ":",
+						   &seq, &sentTime) == 2 &&
+					seq >= 0 && seq < options->count)
+				{
+					double latency =
+						now > sentTime ? (now - sentTime) / 1000.0 : 0;
+
+					(void) bench_histogram_add(&(stats.deliveries),
+											   latency, true);
+
+					++(delivered[seq]);
+
+					if (latency > fanout[seq])
+					{
+						fanout[seq] = latency;
+					}
+
+					if (++(received[index]) == options->count)
+					{
+						--pending;
+					}
+				}
+
+				PQfreemem(notify);
+			}
+		}
+	}
+
+	for (int index = 0; index < sessionsCount; index++)
+	{
+		pgsql_finish(&(sessions[index]));
+	}
+
+	bool sent =
+		bench_write_buffer(fd, &stats, sizeof(stats)) &&
+		bench_write_buffer(fd, delivered, options->count * sizeof(int64_t)) &&
+		bench_write_buffer(fd, fanout, options->count * sizeof(double));
+
+	free(sessions);
+	free(pollFds);
+	free(received);
+	free(delivered);
+	free(fanout);
+
+	return sent;
+}
+
+
+/*
+ * bench_notify_send sends --count notifications of the given payload size on
+ * the benchmark channel, every --interval milliseconds. Each notification
+ * begins with its sequence number and the time it was sent at, and is
+ * padded to the payload size.
+ */
+static bool
+bench_notify_send(BenchNotifyOptions *options, int payload)
+{
+	PGSQL pgsql = { 0 };
+	const char *sql = "SELECT pg_notify($1, $2)";
+	const Oid paramTypes[2] = { TEXTOID, TEXTOID };
+	const char *paramValues[2] = { BENCH_NOTIFY_CHANNEL, NULL };
+
+	char *message = (char *) malloc(payload + 1);
+
+	if (message == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return false;
+	}
+
+	if (!pgsql_init(&pgsql, options->monitor_pguri, PGSQL_CONN_MONITOR))
+	{
+		/* errors have already been logged */
+		free(message);
+		return false;
+	}
+
+	pgsql.connectionStatementType = PGSQL_CONNECTION_PERSISTENT;
+	paramValues[1] = message;
+
+	bool success = true;
+
+	for (int seq = 0; seq < options->count; seq++)
+	{
+		if (asked_to_stop || asked_to_stop_fast || asked_to_quit)
+		{
+			success = false;
+			break;
+		}
+
+		int len = sformat(message, payload + 1, "%d:%" PRIu64 ":",
+						  seq, bench_monotonic_us());
+
+		memset(message + len, 'x', payload - len);
+		message[payload] = '\0';
+
+		if (!pgsql_execute_with_params(&pgsql, sql,
+									   2, paramTypes, paramValues,
+									   NULL, NULL))
+		{
+			log_error("Failed to send notification %d", seq);
+			success = false;
+			break;
+		}
+
+		if (options->interval > 0)
+		{
+			pg_usleep((long) options->interval * 1000);
+		}
+	}
+
+	pgsql_finish(&pgsql);
+	free(message);
+
+	return success;
+}
+
+
+/*
+ * bench_notify_run runs a round of the notification benchmark: it starts the
+ * sub-processes that hold the given number of LISTEN sessions, waits until
+ * they are all listening, sends the notifications, and then collects the
+ * latency of their delivery to every session.
+ */
+bool
+bench_notify_run(BenchNotifyOptions *options, int listeners, int payload,
+				 BenchNotifyResult *result)
+{
+	int processCount =
+		listeners < options->clientsCount ? listeners : options->clientsCount;
+	int startedClientsCount = 0;
+	pid_t clientsPidArray[MAX_BENCH_CLIENTS_COUNT] = { 0 };
+	int pipesArray[MAX_BENCH_CLIENTS_COUNT] = { 0 };
+
+	int64_t *delivered = (int64_t *) calloc(options->count, sizeof(int64_t));
+	double *fanout = (double *) calloc(options->count, sizeof(double));
+	int64_t *clientDelivered =
+		(int64_t *) calloc(options->count, sizeof(int64_t));
+	double *clientFanout = (double *) calloc(options->count, sizeof(double));
+
+	bool success = true;
+
+	if (delivered == NULL || fanout == NULL ||
+		clientDelivered == NULL || clientFanout == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return false;
+	}
+
+	result->listeners = listeners;
+	result->payload = payload;
+
+	log_info("Sending %d notifications of %d bytes to %d LISTEN sessions "
+			 "in %d clients",
+			 options->count, payload, listeners, processCount);
+
+	/* Flush stdio channels just before fork, to avoid double-output problems */
+	fflush(stdout);
+	fflush(stderr);
+
+	for (int index = 0; index < processCount; index++)
+	{
+		int sessionsCount =
+			listeners / processCount + (index < listeners % processCount);
+		int pipeFd[2] = { 0 };
+
+		if (pipe(pipeFd) != 0)
+		{
+			log_error("Failed to create a pipe for client %d: %m", index);
+			success = false;
+			break;
+		}
+
+		pid_t fpid = fork();
+
+		switch (fpid)
+		{
+			case -1:
+			{
+				log_error("Failed to fork client %d", index);
+				close(pipeFd[0]);
+				close(pipeFd[1]);
+				success = false;
+				break;
+			}
+
+			case 0:
+			{
+				close(pipeFd[0]);
+
+				/* initialize the semaphore used for locking log output */
+				if (!semaphore_init(&log_semaphore))
+				{
+					exit(EXIT_CODE_INTERNAL_ERROR);
+				}
+
+				/* set our logging facility to use our semaphore as a lock */
+				(void) log_set_udata(&log_semaphore);
+				(void) log_set_lock(&semaphore_log_lock_function);
+
+				bool sent =
+					bench_notify_listener(options, sessionsCount, pipeFd[1]);
+
+				close(pipeFd[1]);
+
+				(void) semaphore_finish(&log_semaphore);
+				exit(sent ? EXIT_CODE_QUIT : EXIT_CODE_INTERNAL_ERROR);
+			}
+
+			default:
+			{
+				/* fork succeeded, in parent */
+				close(pipeFd[1]);
+
+				clientsPidArray[index] = fpid;
+				pipesArray[index] = pipeFd[0];
+				++startedClientsCount;
+			}
+		}
+
+		if (!success)
+		{
+			break;
+		}
+	}
+
+	/* each client sends how many sessions it opened once they all LISTEN */
+	for (int index = 0; success && index < startedClientsCount; index++)
+	{
+		int sessions = 0;
+
+		if (!bench_read_buffer(pipesArray[index], &sessions, sizeof(sessions)))
+		{
+			log_error("Failed to receive the LISTEN sessions count "
+					  "from client %d", index);
+			success = false;
+			break;
+		}
+
+		result->sessions += sessions;
+	}
+
+	if (success && !bench_notify_send(options, payload))
+	{
+		/* errors have already been logged */
+		success = false;
+	}
+
+	if (!success)
+	{
+		(void) bench_terminate_clients(clientsPidArray, startedClientsCount);
+	}
+
+	for (int index = 0; index < startedClientsCount; index++)
+	{
+		BenchNotifyListenerStats clientStats = { 0 };
+
+		if (success &&
+			bench_read_buffer(pipesArray[index],
+							  &clientStats, sizeof(clientStats)) &&
+			bench_read_buffer(pipesArray[index],
+							  clientDelivered,
+							  options->count * sizeof(int64_t)) &&
+			bench_read_buffer(pipesArray[index],
+							  clientFanout,
+							  options->count * sizeof(double)))
+		{
+			(void) bench_histogram_merge(&(result->deliveries),
+										 &(clientStats.deliveries));
+
+			for (int seq = 0; seq < options->count; seq++)
+			{
+				delivered[seq] += clientDelivered[seq];
+
+				if (clientFanout[seq] > fanout[seq])
+				{
+					fanout[seq] = clientFanout[seq];
+				}
+			}
+		}
+		else if (success)
+		{
+			log_error("Failed to receive statistics from client %d", index);
+			success = false;
+		}
+
+		close(pipesArray[index]);
+	}
+
+	/* a notification has fanned out once every session received it */
+	for (int seq = 0; success && seq < options->count; seq++)
+	{
+		if (delivered[seq] >= result->sessions)
+		{
+			(void) bench_histogram_add(&(result->fanout), fanout[seq], true);
+		}
+		else
+		{
+			result->lost += result->sessions - delivered[seq];
+		}
+	}
+
+	free(delivered);
+	free(fanout);
+	free(clientDelivered);
+	free(clientFanout);
+
+	return bench_wait_for_clients(clientsPidArray, startedClientsCount) &&
+		   success;
+}
+
+
+/*
+ * bench_notify_print_report prints the latency percentiles of the delivery
+ * of the notifications to each session, and of their fan-out to all the
+ * sessions, for every round of the notification benchmark.
+ */
+void
+bench_notify_print_report(BenchNotifyOptions *options,
+						  BenchNotifyResult *results, int count)
+{
+	fformat(stdout,
+			"\nNotification benchmark: %d notifications per round, "
+			"%dms interval, %d clients\n\n",
+			options->count,
+			options->interval,
+			options->clientsCount);
+
+	fformat(stdout, "%9s | %7s | %8s | %10s | %6s | %8s | %8s | %8s | %8s "
+					"| %11s | %11s | %11s\n",
+			"Listeners", "Payload", "Sessions", "Deliveries", "Lost",
+			"p50 ms", "p90 ms", "p99 ms", "Max ms",
+			"Fan-out p50", "Fan-out p99", "Fan-out max");
+
+	fformat(stdout, "%9s-+-%7s-+-%8s-+-%10s-+-%6s-+-%8s-+-%8s-+-%8s-+-%8s"
+					"-+-%11s-+-%11s-+-%11s\n",
+			"---------", "-------", "--------", "----------", "------",
+			"--------", "--------", "--------", "--------",
+			"-----------", "-----------", "-----------");
+
+	for (int index = 0; index < count; index++)
+	{
+		BenchNotifyResult *result = &(results[index]);
+		BenchHistogram *deliveries = &(result->deliveries);
+		BenchHistogram *fanout = &(result->fanout);
+
+		fformat(stdout,
+				"%9d | %7d | %8d | %10" PRId64 " | %6" PRId64 " "
+				"| %8.3f | %8.3f | %8.3f | %8.3f "
+				"| %11.3f | %11.3f | %11.3f\n",
+				result->listeners,
+				result->payload,
+				result->sessions,
+				deliveries->count,
+				result->lost,
+				bench_histogram_percentile(deliveries, 0.50),
+				bench_histogram_percentile(deliveries, 0.90),
+				bench_histogram_percentile(deliveries, 0.99),
+				deliveries->maxTime,
+				bench_histogram_percentile(fanout, 0.50),
+				bench_histogram_percentile(fanout, 0.99),
+				fanout->maxTime);
+	}
+
+	fformat(stdout, "\n");
+}
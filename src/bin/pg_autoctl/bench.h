@@ -0,0 +1,234 @@
+/*
+ * src/bin/pg_autoctl/bench.h
+ *	 Load generator that simulates many keepers against a monitor
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "postgres_fe.h"
+
+#include "pgsql.h"
+
+#define MAX_BENCH_CLIENTS_COUNT 128
+
+#define BENCH_DEFAULT_FORMATION_PREFIX "bench"
+#define BENCH_DEFAULT_FORMATIONS 10
+#define BENCH_DEFAULT_NODES 3
+#define BENCH_DEFAULT_CLIENTS 4
+#define BENCH_DEFAULT_INTERVAL 1000     /* ms, as the keeper main loop */
+#define BENCH_DEFAULT_OTHER_NODES_FREQ 10
+#define BENCH_DEFAULT_DURATION 30
+#define BENCH_DEFAULT_WAL_RATE 1024     /* kB/s written by each primary */
+#define BENCH_DEFAULT_FAILOVER_INTERVAL 0
+
+#define BENCH_SPAWN_DEFAULT_PROGRAM "/bin/true"
+#define BENCH_SPAWN_DEFAULT_COUNT 1000
+#define BENCH_FSM_DEFAULT_COUNT 1000
+#define BENCH_INTERNALS_DEFAULT_COUNT 200
+#define BENCH_INTERNALS_DEFAULT_NODES 100
+
+/*
+ * The notification benchmark sends --count notifications on its own channel
+ * for every combination of listener count and payload size. A NOTIFY payload
+ * must be shorter than 8000 bytes, and ours begins with a sequence number and
+ * the time it was sent at.
+ */
+#define BENCH_NOTIFY_CHANNEL "pgautofailover_bench"
+#define BENCH_NOTIFY_MAX_STEPS 8
+#define BENCH_NOTIFY_DEFAULT_LISTENERS "1,10,100"
+#define BENCH_NOTIFY_DEFAULT_PAYLOADS "128,1024,7680"
+#define BENCH_NOTIFY_DEFAULT_COUNT 100
+#define BENCH_NOTIFY_DEFAULT_INTERVAL 10    /* ms */
+#define BENCH_NOTIFY_DEFAULT_CLIENTS 4
+#define BENCH_NOTIFY_MIN_PAYLOAD 32
+#define BENCH_NOTIFY_MAX_PAYLOAD 7999
+#define BENCH_NOTIFY_MAX_LISTENERS 10000
+#define BENCH_NOTIFY_TIMEOUT 10             /* s, to receive the last one */
+
+/*
+ * The simulated nodes are registered on the loopback address, each with its
+ * own port number starting at BENCH_FIRST_PORT.
+ */
+#define BENCH_NODE_HOST "127.0.0.1"
+#define BENCH_FIRST_PORT 20000
+#define BENCH_MAX_NODES (65535 - BENCH_FIRST_PORT)
+
+/*
+ * Latencies are counted in a histogram with BENCH_HISTOGRAM_RESOLUTION
+ * buckets per power of two microseconds, which gives percentiles within 10%
+ * of the measured values.
+ */
+#define BENCH_HISTOGRAM_RESOLUTION 8
+#define BENCH_HISTOGRAM_BUCKETS 256
+
+typedef struct BenchOptions
+{
+	char monitor_pguri[MAXCONNINFO];
+	char formationPrefix[NAMEDATALEN];
+
+	int formationsCount;
+	int nodesCount;
+	int clientsCount;
+	int interval;
+	int otherNodesFreq;
+	int listenCount;
+	int duration;
+	int walRate;                /* kB/s */
+	int failoverInterval;       /* s, 0 to never fail */
+	bool persistent;
+} BenchOptions;
+
+/*
+ * Options for the sub-process spawning benchmark. The --rss option allocates
+ * and touches that many MB of memory before running the programs, as the cost
+ * of fork() grows with the size of the parent process.
+ */
+typedef struct BenchSpawnOptions
+{
+	char program[MAXPGPATH];
+	int count;
+	int rss;                    /* MB */
+} BenchSpawnOptions;
+
+/*
+ * Options for the FSM lookups benchmark: each of the --count rounds looks up
+ * every (current, assigned) pair of states for every kind of node, and parses
+ * every state name.
+ */
+typedef struct BenchFSMOptions
+{
+	int count;
+} BenchFSMOptions;
+
+/*
+ * Options for the benchmark of the keeper internal hot paths: each case runs
+ * --count times on inputs sized after --nodes, such as a result set with that
+ * many nodes, or an HBA file with the rules for that many nodes.
+ */
+typedef struct BenchInternalsOptions
+{
+	int count;
+	int nodes;
+} BenchInternalsOptions;
+
+/*
+ * Options for the notification fan-out benchmark: --listeners and --payloads
+ * are comma separated lists of LISTEN sessions counts and payload sizes, and
+ * the sessions are distributed over --clients sub-processes.
+ */
+typedef struct BenchNotifyOptions
+{
+	char monitor_pguri[MAXCONNINFO];
+
+	int listenersCount;
+	int listeners[BENCH_NOTIFY_MAX_STEPS];
+	int payloadsCount;
+	int payloads[BENCH_NOTIFY_MAX_STEPS];
+
+	int count;
+	int interval;               /* ms */
+	int clientsCount;
+} BenchNotifyOptions;
+
+/* the monitor calls that the simulated keepers make */
+typedef enum
+{
+	BENCH_CALL_REGISTER_NODE = 0,
+	BENCH_CALL_NODE_ACTIVE,
+	BENCH_CALL_GET_OTHER_NODES,
+
+	BENCH_CALL_COUNT
+} BenchCall;
+
+typedef struct BenchHistogram
+{
+	int64_t count;
+	int64_t errors;
+	double totalTime;           /* ms */
+	double maxTime;             /* ms */
+	int64_t buckets[BENCH_HISTOGRAM_BUCKETS];
+} BenchHistogram;
+
+/*
+ * Statistics that each sub-process sends to the main process when done. The
+ * failovers histogram counts the time from a simulated crash of a primary
+ * node until another node of its formation is assigned a primary state.
+ */
+typedef struct BenchStats
+{
+	BenchHistogram calls[BENCH_CALL_COUNT];
+	BenchHistogram failovers;
+	int64_t notifications;
+} BenchStats;
+
+/*
+ * Results of a round of the notification benchmark. The deliveries histogram
+ * counts the time from NOTIFY until each session receives the notification,
+ * and the fan-out histogram the time until the last session receives it.
+ * Notifications that did not reach every session are counted as lost.
+ */
+typedef struct BenchNotifyResult
+{
+	int listeners;
+	int payload;
+	int sessions;               /* LISTEN sessions that could be opened */
+	BenchHistogram deliveries;
+	BenchHistogram fanout;
+	int64_t lost;
+} BenchNotifyResult;
+
+/* statistics taken on the monitor from pgautofailover.stat_functions */
+typedef struct BenchServerStats
+{
+	bool valid;
+	int64_t calls[BENCH_CALL_COUNT];
+	double totalTime[BENCH_CALL_COUNT];
+	double lockWaitTime[BENCH_CALL_COUNT];
+} BenchServerStats;
+
+extern BenchOptions benchOptions;
+extern BenchSpawnOptions benchSpawnOptions;
+extern BenchFSMOptions benchFSMOptions;
+extern BenchInternalsOptions benchInternalsOptions;
+extern BenchNotifyOptions benchNotifyOptions;
+
+bool bench_monitor_cleanup(BenchOptions *options);
+bool bench_monitor_prepare(BenchOptions *options);
+bool bench_monitor_run(BenchOptions *options, BenchStats *stats);
+bool bench_monitor_server_stats(BenchOptions *options,
+								BenchServerStats *serverStats);
+void bench_monitor_print_report(BenchOptions *options, BenchStats *stats,
+								BenchServerStats *before,
+								BenchServerStats *after);
+
+bool bench_spawn_run(BenchSpawnOptions *options, bool useFork,
+					 BenchHistogram *histogram);
+void bench_spawn_print_report(BenchSpawnOptions *options,
+							  BenchHistogram *forkHistogram,
+							  BenchHistogram *spawnHistogram);
+
+void bench_fsm_run(BenchFSMOptions *options);
+bool bench_internals_run(BenchInternalsOptions *options);
+
+bool bench_notify_run(BenchNotifyOptions *options, int listeners, int payload,
+					  BenchNotifyResult *result);
+void bench_notify_print_report(BenchNotifyOptions *options,
+							   BenchNotifyResult *results, int count);
+
+void bench_histogram_add(BenchHistogram *histogram,
+						 double elapsedTime, bool success);
+void bench_histogram_merge(BenchHistogram *target, BenchHistogram *source);
+double bench_histogram_percentile(BenchHistogram *histogram, double percentile);
+
+bool bench_write_buffer(int fd, void *buffer, size_t size);
+bool bench_read_buffer(int fd, void *buffer, size_t size);
+
+#endif /* BENCH_H */
@@ -35,12 +35,19 @@
 KeeperConfig keeperOptions;
 bool createAndRun = false;
 bool outputJSON = false;
+bool allFormations = false;
 bool openAppHBAonLAN = false;
 int ssl_flag = 0;
 
 /* stores --node-id, only used with --disable-monitor */
 int monitorDisabledNodeId = -1;
 
+/* --monitor-ro, a read-only monitor endpoint for the show commands */
+char monitorReadOnlyURI[MAXCONNINFO] = { 0 };
+
+static void cli_monitor_follow_formation_directory(Monitor *monitor,
+												   KeeperConfig *kconfig);
+
 /*
  * cli_common_keeper_getopts parses the CLI options for the pg_autoctl create
  * postgres command, and others such as pg_autoctl do discover. An example of a
@@ -57,6 +64,7 @@ int monitorDisabledNodeId = -1;
  *		{ "auth", required_argument, NULL, 'A' },
  *		{ "skip-pg-hba", no_argument, NULL, 'S' },
  *		{ "pg-hba-lan", no_argument, NULL, 'L' },
+ *		{ "tuning-profile", required_argument, NULL, 'T' },
  *		{ "dbname", required_argument, NULL, 'd' },
  *		{ "name", required_argument, NULL, 'a' },
  *		{ "hostname", required_argument, NULL, 'n' },
@@ -74,6 +82,7 @@ int monitorDisabledNodeId = -1;
  *		{ "candidate-priority", required_argument, NULL, 'P'},
  *		{ "replication-quorum", required_argument, NULL, 'r'},
  *		{ "maximum-backup-rate", required_argument, NULL, 'R' },
+ *		{ "clone-from", required_argument, NULL, 'F' },
  *		{ "help", no_argument, NULL, 0 },
  *		{ "run", no_argument, NULL, 'x' },
  *      { "ssl-self-signed", no_argument, NULL, 's' },
@@ -284,6 +293,25 @@ cli_common_keeper_getopts(int argc, char **argv,
 				break;
 			}
 
+			case 'T':
+			{
+				/* { "tuning-profile", required_argument, NULL, 'T' } */
+				if (pgsetup_parse_tuning_profile(optarg) ==
+					PG_TUNING_PROFILE_UNKNOWN)
+				{
+					log_fatal("--tuning-profile argument is not valid."
+							  " Valid values are \"oltp\", \"olap\", "
+							  "or \"mixed\".");
+					exit(EXIT_CODE_BAD_ARGS);
+				}
+
+				strlcpy(LocalOptionConfig.pgSetup.tuningProfile, optarg,
+						NAMEDATALEN);
+				log_trace("--tuning-profile %s",
+						  LocalOptionConfig.pgSetup.tuningProfile);
+				break;
+			}
+
 			case 'd':
 			{
 				/* { "dbname", required_argument, NULL, 'd' } */
@@ -407,6 +435,15 @@ cli_common_keeper_getopts(int argc, char **argv,
 				break;
 			}
 
+			case 'F':
+			{
+				/* { "clone-from", required_argument, NULL, 'F' } */
+				strlcpy(LocalOptionConfig.clone_from, optarg,
+						sizeof(LocalOptionConfig.clone_from));
+				log_trace("--clone-from %s", LocalOptionConfig.clone_from);
+				break;
+			}
+
 			case 'V':
 			{
 				/* keeper_cli_print_version prints version and exits. */
@@ -542,9 +579,13 @@ cli_common_keeper_getopts(int argc, char **argv,
 		exit(EXIT_CODE_BAD_ARGS);
 	}
 
-	if (!LocalOptionConfig.monitorDisabled && monitorDisabledNodeId != -1)
+	/*
+	 * With a monitor, --node-id adopts a node that has been registered in
+	 * advance with pgautofailover.register_nodes().
+	 */
+	if (!LocalOptionConfig.monitorDisabled && monitorDisabledNodeId == 0)
 	{
-		log_fatal("Option --node-id is only accepted with --disable-monitor");
+		log_fatal("Option --node-id expects a node id greater than zero");
 		exit(EXIT_CODE_BAD_ARGS);
 	}
 
@@ -1735,6 +1776,35 @@ cli_common_ensure_formation(KeeperConfig *options)
 }
 
 
+/*
+ * cli_set_log_format sets the log format from the --log-format option or
+ * the PG_AUTOCTL_LOG_FORMAT environment variable, which we set so that the
+ * pg_autoctl sub-processes use the same format.
+ */
+bool
+cli_set_log_format(const char *format)
+{
+	if (strcmp(format, "text") == 0)
+	{
+		log_set_format(LOG_FORMAT_TEXT);
+	}
+	else if (strcmp(format, "json") == 0)
+	{
+		log_set_format(LOG_FORMAT_JSON);
+	}
+	else
+	{
+		log_error("Unknown log format \"%s\", expected either "
+				  "\"text\" or \"json\"", format);
+		return false;
+	}
+
+	setenv(PG_AUTOCTL_LOG_FORMAT, format, 1);
+
+	return true;
+}
+
+
 /*
  * cli_pg_autoctl_reload signals the pg_autoctl process to reload its
  * configuration by sending it the SIGHUP signal.
@@ -1783,6 +1853,7 @@ cli_node_metadata_getopts(int argc, char **argv)
 		{ "hostname", required_argument, NULL, 'H' },
 		{ "pgport", required_argument, NULL, 'p' },
 		{ "json", no_argument, NULL, 'J' },
+		{ "log-format", required_argument, NULL, 'L' },
 		{ "version", no_argument, NULL, 'V' },
 		{ "verbose", no_argument, NULL, 'v' },
 		{ "quiet", no_argument, NULL, 'q' },
@@ -1802,7 +1873,7 @@ cli_node_metadata_getopts(int argc, char **argv)
 
 	optind = 0;
 
-	while ((c = getopt_long(argc, argv, "D:n:H:p:JVvqh",
+	while ((c = getopt_long(argc, argv, "D:n:H:p:JL:Vvqh",
 							long_options, &option_index)) != -1)
 	{
 		switch (c)
@@ -1814,6 +1885,18 @@ cli_node_metadata_getopts(int argc, char **argv)
 				break;
 			}
 
+			case 'L':
+			{
+				/* { "log-format", required_argument, NULL, 'L' } */
+				if (!cli_set_log_format(optarg))
+				{
+					/* errors have already been logged */
+					errors++;
+				}
+				log_trace("--log-format %s", optarg);
+				break;
+			}
+
 			case 'H':
 			{
 				/* { "hostname", required_argument, NULL, 'h' } */
@@ -1944,6 +2027,7 @@ cli_get_name_getopts(int argc, char **argv)
 		{ "monitor", required_argument, NULL, 'm' },
 		{ "formation", required_argument, NULL, 'f' },
 		{ "name", required_argument, NULL, 'a' },
+		{ "all-formations", no_argument, NULL, 'A' },
 		{ "json", no_argument, NULL, 'J' },
 		{ "version", no_argument, NULL, 'V' },
 		{ "verbose", no_argument, NULL, 'v' },
@@ -2012,6 +2096,13 @@ cli_get_name_getopts(int argc, char **argv)
 				break;
 			}
 
+			case 'A':
+			{
+				allFormations = true;
+				log_trace("--all-formations");
+				break;
+			}
+
 			case 'V':
 			{
 				/* keeper_cli_print_version prints version and exits. */
@@ -2183,6 +2274,85 @@ cli_monitor_init_from_option_or_config(Monitor *monitor, KeeperConfig *kconfig)
 			exit(EXIT_CODE_BAD_ARGS);
 		}
 	}
+
+	(void) cli_monitor_follow_formation_directory(monitor, kconfig);
+}
+
+
+/*
+ * cli_monitor_follow_formation_directory connects to the monitor that manages
+ * the target formation when it has moved away from the given monitor, see
+ * pg_autoctl perform move-formation.
+ */
+static void
+cli_monitor_follow_formation_directory(Monitor *monitor, KeeperConfig *kconfig)
+{
+	char monitorURI[MAXCONNINFO] = { 0 };
+
+	if (IS_EMPTY_STRING_BUFFER(kconfig->formation))
+	{
+		return;
+	}
+
+	if (!monitor_get_formation_monitor(monitor,
+									   kconfig->formation,
+									   monitorURI,
+									   sizeof(monitorURI)))
+	{
+		/* errors have already been logged, the next query fails too */
+		return;
+	}
+
+	if (IS_EMPTY_STRING_BUFFER(monitorURI))
+	{
+		return;
+	}
+
+	log_info("Formation \"%s\" is managed by the monitor at \"%s\"",
+			 kconfig->formation, monitorURI);
+
+	pgsql_finish(&(monitor->pgsql));
+	pgsql_finish(&(monitor->notificationClient));
+
+	if (!monitor_init(monitor, monitorURI))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_BAD_CONFIG);
+	}
+}
+
+
+/*
+ * cli_monitor_init_read_client sets up the read-only monitor endpoint from
+ * the --monitor-ro option, or the PG_AUTOCTL_MONITOR_RO environment variable,
+ * when either is given. Only the commands that just read from the monitor use
+ * it.
+ */
+void
+cli_monitor_init_read_client(Monitor *monitor)
+{
+	if (IS_EMPTY_STRING_BUFFER(monitorReadOnlyURI) &&
+		env_exists(PG_AUTOCTL_MONITOR_RO))
+	{
+		if (!get_env_copy(PG_AUTOCTL_MONITOR_RO,
+						  monitorReadOnlyURI,
+						  sizeof(monitorReadOnlyURI)))
+		{
+			/* errors have already been logged */
+			exit(EXIT_CODE_BAD_ARGS);
+		}
+	}
+
+	if (IS_EMPTY_STRING_BUFFER(monitorReadOnlyURI))
+	{
+		return;
+	}
+
+	if (!monitor_init_read_client(monitor, monitorReadOnlyURI))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_BAD_ARGS);
+	}
 }
 
 
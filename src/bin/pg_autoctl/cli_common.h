@@ -22,6 +22,7 @@ extern MonitorConfig monitorOptions;
 extern KeeperConfig keeperOptions;
 extern bool createAndRun;
 extern bool outputJSON;
+extern bool allFormations;
 extern bool openAppHBAonLAN;
 extern bool dropAndDestroy;
 
@@ -34,6 +35,7 @@ extern bool dropAndDestroy;
 extern int ssl_flag;
 
 extern int monitorDisabledNodeId;
+extern char monitorReadOnlyURI[MAXCONNINFO];
 
 #define KEEPER_CLI_SSL_OPTIONS \
 	"  --ssl-self-signed setup network encryption using self signed certificates (does NOT protect against MITM)\n" \
@@ -127,9 +129,11 @@ extern CommandLine service_status_command;
 /* cli_show.c */
 extern CommandLine show_uri_command;
 extern CommandLine show_events_command;
+extern CommandLine show_failovers_command;
 extern CommandLine show_state_command;
 extern CommandLine show_settings_command;
 extern CommandLine show_file_command;
+extern CommandLine show_transitions_command;
 extern CommandLine show_standby_names_command;
 
 /* cli_watch.c */
@@ -206,12 +210,14 @@ bool cli_common_pgsetup_init(ConfigFilePaths *pathnames, PostgresSetup *pgSetup)
 bool cli_common_ensure_formation(KeeperConfig *options);
 
 bool cli_pg_autoctl_reload(const char *pidfile);
+bool cli_set_log_format(const char *format);
 
 int cli_node_metadata_getopts(int argc, char **argv);
 int cli_get_name_getopts(int argc, char **argv);
 bool cli_use_monitor_option(KeeperConfig *options);
 void cli_monitor_init_from_option_or_config(Monitor *monitor,
 											KeeperConfig *kconfig);
+void cli_monitor_init_read_client(Monitor *monitor);
 void cli_ensure_node_name(Keeper *keeper);
 
 bool discover_hostname(char *hostname, int size,
@@ -99,10 +99,13 @@ CommandLine create_postgres_command =
 		"  --auth            authentication method for connections from monitor\n"
 		"  --skip-pg-hba     skip editing pg_hba.conf rules\n"
 		"  --pg-hba-lan      edit pg_hba.conf rules for --dbname in detected LAN\n"
+		"  --tuning-profile  tune Postgres for an oltp, olap, or mixed workload\n"
 		KEEPER_CLI_SSL_OPTIONS
 		"  --candidate-priority    priority of the node to be promoted to become primary\n"
 		"  --replication-quorum    true if node participates in write quorum\n"
-		"  --maximum-backup-rate   maximum transfer rate of data transferred from the server during initial sync\n",
+		"  --maximum-backup-rate   maximum transfer rate of data transferred from the server during initial sync\n"
+		"  --clone-from            node to clone from: primary, secondary, or a node name\n"
+		"  --citus-cluster         node cluster, used for cascading replication\n",
 		cli_create_postgres_getopts,
 		cli_create_postgres);
 
@@ -124,6 +127,7 @@ CommandLine create_coordinator_command =
 		"  --monitor         pg_auto_failover Monitor Postgres URL\n"
 		"  --auth            authentication method for connections from monitor\n"
 		"  --skip-pg-hba     skip editing pg_hba.conf rules\n"
+		"  --tuning-profile  tune Postgres for an oltp, olap, or mixed workload\n"
 		"  --citus-secondary when used, this worker node is a citus secondary\n"
 		"  --citus-cluster   name of the Citus Cluster for read-replicas\n"
 		KEEPER_CLI_SSL_OPTIONS,
@@ -150,6 +154,7 @@ CommandLine create_worker_command =
 		"  --monitor         pg_auto_failover Monitor Postgres URL\n"
 		"  --auth            authentication method for connections from monitor\n"
 		"  --skip-pg-hba     skip editing pg_hba.conf rules\n"
+		"  --tuning-profile  tune Postgres for an oltp, olap, or mixed workload\n"
 		"  --citus-secondary when used, this worker node is a citus secondary\n"
 		"  --citus-cluster   name of the Citus Cluster for read-replicas\n"
 		KEEPER_CLI_SSL_OPTIONS,
@@ -327,6 +332,7 @@ cli_create_postgres_getopts(int argc, char **argv)
 		{ "auth", required_argument, NULL, 'A' },
 		{ "skip-pg-hba", no_argument, NULL, 'S' },
 		{ "pg-hba-lan", no_argument, NULL, 'L' },
+		{ "tuning-profile", required_argument, NULL, 'T' },
 		{ "dbname", required_argument, NULL, 'd' },
 		{ "name", required_argument, NULL, 'a' },
 		{ "hostname", required_argument, NULL, 'n' },
@@ -341,6 +347,8 @@ cli_create_postgres_getopts(int argc, char **argv)
 		{ "candidate-priority", required_argument, NULL, 'P' },
 		{ "replication-quorum", required_argument, NULL, 'r' },
 		{ "maximum-backup-rate", required_argument, NULL, 'R' },
+		{ "clone-from", required_argument, NULL, 'F' },
+		{ "citus-cluster", required_argument, NULL, 'Z' },
 		{ "run", no_argument, NULL, 'x' },
 		{ "no-ssl", no_argument, NULL, 'N' },
 		{ "ssl-self-signed", no_argument, NULL, 's' },
@@ -354,7 +362,7 @@ cli_create_postgres_getopts(int argc, char **argv)
 
 	int optind =
 		cli_create_node_getopts(argc, argv, long_options,
-								"C:D:H:p:l:U:A:SLd:a:n:f:m:MI:RVvqhP:r:xsN",
+								"C:D:H:p:l:U:A:SLT:d:a:n:f:m:MI:RF:Z:VvqhP:r:xsN",
 								&options);
 
 	/* publish our option parsing in the global variable */
@@ -425,6 +433,7 @@ cli_create_coordinator_getopts(int argc, char **argv)
 		{ "auth", required_argument, NULL, 'A' },
 		{ "skip-pg-hba", no_argument, NULL, 'S' },
 		{ "pg-hba-lan", no_argument, NULL, 'L' },
+		{ "tuning-profile", required_argument, NULL, 'T' },
 		{ "dbname", required_argument, NULL, 'd' },
 		{ "name", required_argument, NULL, 'a' },
 		{ "hostname", required_argument, NULL, 'n' },
@@ -452,7 +461,7 @@ cli_create_coordinator_getopts(int argc, char **argv)
 
 	int optind =
 		cli_create_node_getopts(argc, argv, long_options,
-								"C:D:H:p:l:U:A:SLd:a:n:f:m:MRVvqhzZ:P:r:xsN",
+								"C:D:H:p:l:U:A:SLT:d:a:n:f:m:MRVvqhzZ:P:r:xsN",
 								&options);
 
 	options.groupId = 0;
@@ -534,6 +543,7 @@ cli_create_worker_getopts(int argc, char **argv)
 		{ "auth", required_argument, NULL, 'A' },
 		{ "skip-pg-hba", no_argument, NULL, 'S' },
 		{ "pg-hba-lan", no_argument, NULL, 'L' },
+		{ "tuning-profile", required_argument, NULL, 'T' },
 		{ "dbname", required_argument, NULL, 'd' },
 		{ "name", required_argument, NULL, 'a' },
 		{ "hostname", required_argument, NULL, 'n' },
@@ -562,7 +572,7 @@ cli_create_worker_getopts(int argc, char **argv)
 
 	int optind =
 		cli_create_node_getopts(argc, argv, long_options,
-								"C:D:H:p:l:y:zZ:U:A:SLd:a:n:f:m:MRVvqhzP:r:xsN",
+								"C:D:H:p:l:y:zZ:U:A:SLT:d:a:n:f:m:MRVvqhzP:r:xsN",
 								&options);
 
 	if (options.groupId == 0)
@@ -0,0 +1,1271 @@
+/*
+ * src/bin/pg_autoctl/cli_do_bench.c
+ *     Implementation of a benchmark of the monitor, that simulates many
+ *     keepers registering and reporting to the monitor.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include "postgres_fe.h"
+
+#include "bench.h"
+#include "cli_common.h"
+#include "cli_do_root.h"
+#include "cli_root.h"
+#include "commandline.h"
+#include "defaults.h"
+#include "env_utils.h"
+#include "log.h"
+#include "monitor.h"
+#include "string_utils.h"
+
+BenchOptions benchOptions = { 0 };
+BenchSpawnOptions benchSpawnOptions = { 0 };
+BenchFSMOptions benchFSMOptions = { 0 };
+BenchInternalsOptions benchInternalsOptions = { 0 };
+BenchNotifyOptions benchNotifyOptions = { 0 };
+
+static int cli_do_bench_getopts(int argc, char **argv);
+static void cli_bench_monitor(int argc, char **argv);
+
+static int cli_do_bench_spawn_getopts(int argc, char **argv);
+static void cli_bench_spawn(int argc, char **argv);
+
+static int cli_do_bench_fsm_getopts(int argc, char **argv);
+static void cli_bench_fsm(int argc, char **argv);
+
+static int cli_do_bench_internals_getopts(int argc, char **argv);
+static void cli_bench_internals(int argc, char **argv);
+
+static int cli_do_bench_notify_getopts(int argc, char **argv);
+static void cli_bench_notify(int argc, char **argv);
+static bool cli_bench_parse_list(const char *str, int *array, int size,
+								 int *count);
+
+static CommandLine do_bench_monitor_command =
+	make_command("monitor",
+				 "Simulate many keepers against a monitor",
+				 "[option ...]",
+				 "  --monitor          Postgres URI of the pg_auto_failover monitor\n"
+				 "  --formation        Prefix of the benchmark formations (bench)\n"
+				 "  --formations       How many formations to simulate (10)\n"
+				 "  --nodes            How many nodes per formation (3)\n"
+				 "  --clients          How many client processes to use (4)\n"
+				 "  --interval         Milliseconds between node_active calls (1000)\n"
+				 "  --other-nodes-freq Call get_other_nodes every n reports (10)\n"
+				 "  --listen           How many LISTEN sessions to open (0)\n"
+				 "  --duration         Duration of the benchmark, in seconds (30)\n"
+				 "  --wal-rate         kB of WAL written per second by primaries (1024)\n"
+				 "  --failover-interval  Seconds between primary crashes per client (0)\n"
+				 "  --persistent       Keep the client connections open\n",
+				 cli_do_bench_getopts, cli_bench_monitor);
+
+static CommandLine do_bench_spawn_command =
+	make_command("spawn",
+				 "Compare fork+exec and posix_spawn to run sub-programs",
+				 "[option ...]",
+				 "  --program          Program to run, without arguments (/bin/true)\n"
+				 "  --count            How many times to run the program (1000)\n"
+				 "  --rss              MB of memory to allocate first (0)\n",
+				 cli_do_bench_spawn_getopts, cli_bench_spawn);
+
+static CommandLine do_bench_fsm_command =
+	make_command("fsm",
+				 "Time FSM transition lookups and state names parsing",
+				 "[option ...]",
+				 "  --count            How many rounds of lookups to run (1000)\n",
+				 cli_do_bench_fsm_getopts, cli_bench_fsm);
+
+static CommandLine do_bench_internals_command =
+	make_command("internals",
+				 "Time the keeper internal hot paths on synthetic inputs",
+				 "[option ...]",
+				 "  --count            How many times to run each case (200)\n"
+				 "  --nodes            How many nodes in the inputs (100)\n",
+				 cli_do_bench_internals_getopts, cli_bench_internals);
+
+static CommandLine do_bench_notify_command =
+	make_command("notify",
+				 "Time the delivery of notifications to many LISTEN sessions",
+				 "[option ...]",
+				 "  --monitor          Postgres URI of the pg_auto_failover monitor\n"
+				 "  --listeners        LISTEN sessions counts (" BENCH_NOTIFY_DEFAULT_LISTENERS ")\n"
+				 "  --payloads         Payload sizes in bytes (" BENCH_NOTIFY_DEFAULT_PAYLOADS ")\n"
+				 "  --count            Notifications sent per round (100)\n"
+				 "  --interval         Milliseconds between notifications (10)\n"
+				 "  --clients          How many client processes to use (4)\n",
+				 cli_do_bench_notify_getopts, cli_bench_notify);
+
+CommandLine *do_bench_subcommands[] = {
+	&do_bench_monitor_command,
+	&do_bench_spawn_command,
+	&do_bench_fsm_command,
+	&do_bench_internals_command,
+	&do_bench_notify_command,
+	NULL
+};
+
+CommandLine do_bench_commands =
+	make_command_set("bench",
+					 "Benchmark pg_auto_failover components", NULL, NULL,
+					 NULL, do_bench_subcommands);
+
+
+/*
+ * cli_do_bench_getopts parses the command line options for the bench
+ * sub-commands.
+ */
+static int
+cli_do_bench_getopts(int argc, char **argv)
+{
+	int c, option_index = 0, errors = 0;
+	int verboseCount = 0;
+	bool printVersion = false;
+
+	BenchOptions options = { 0 };
+
+	static struct option long_options[] = {
+		{ "monitor", required_argument, NULL, 'm' },
+		{ "formation", required_argument, NULL, 'f' },
+		{ "formations", required_argument, NULL, 'F' },
+		{ "nodes", required_argument, NULL, 'n' },
+		{ "clients", required_argument, NULL, 'c' },
+		{ "interval", required_argument, NULL, 'i' },
+		{ "other-nodes-freq", required_argument, NULL, 'o' },
+		{ "listen", required_argument, NULL, 'l' },
+		{ "duration", required_argument, NULL, 't' },
+		{ "wal-rate", required_argument, NULL, 'w' },
+		{ "failover-interval", required_argument, NULL, 'x' },
+		{ "persistent", no_argument, NULL, 'P' },
+		{ "version", no_argument, NULL, 'V' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "quiet", no_argument, NULL, 'q' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	optind = 0;
+
+	/* set our defaults */
+	options.formationsCount = BENCH_DEFAULT_FORMATIONS;
+	options.nodesCount = BENCH_DEFAULT_NODES;
+	options.clientsCount = BENCH_DEFAULT_CLIENTS;
+	options.interval = BENCH_DEFAULT_INTERVAL;
+	options.otherNodesFreq = BENCH_DEFAULT_OTHER_NODES_FREQ;
+	options.listenCount = 0;
+	options.duration = BENCH_DEFAULT_DURATION;
+	options.walRate = BENCH_DEFAULT_WAL_RATE;
+	options.failoverInterval = BENCH_DEFAULT_FAILOVER_INTERVAL;
+	options.persistent = false;
+	strlcpy(options.formationPrefix,
+			BENCH_DEFAULT_FORMATION_PREFIX,
+			sizeof(options.formationPrefix));
+
+	/*
+	 * The only command lines that are using cli_do_bench_getopts are
+	 * terminal ones: they don't accept subcommands. In that case our option
+	 * parsing can happen in any order and we don't need getopt_long to behave
+	 * in a POSIXLY_CORRECT way.
+	 *
+	 * The unsetenv() call allows getopt_long() to reorder arguments for us.
+	 */
+	unsetenv("POSIXLY_CORRECT");
+
+	while ((c = getopt_long(argc, argv, "m:f:F:n:c:i:o:l:t:w:x:PVvqh",
+							long_options, &option_index)) != -1)
+	{
+		switch (c)
+		{
+			case 'm':
+			{
+				/* { "monitor", required_argument, NULL, 'm' } */
+				if (!validate_connection_string(optarg))
+				{
+					log_fatal("Failed to parse --monitor connection string, "
+							  "see above for details.");
+					exit(EXIT_CODE_BAD_ARGS);
+				}
+				strlcpy(options.monitor_pguri, optarg, MAXCONNINFO);
+				log_trace("--monitor %s", options.monitor_pguri);
+				break;
+			}
+
+			case 'f':
+			{
+				/* { "formation", required_argument, NULL, 'f' } */
+				strlcpy(options.formationPrefix, optarg, NAMEDATALEN);
+				log_trace("--formation %s", options.formationPrefix);
+				break;
+			}
+
+			case 'F':
+			{
+				/* { "formations", required_argument, NULL, 'F' } */
+				if (!stringToInt(optarg, &options.formationsCount) ||
+					options.formationsCount < 1)
+				{
+					log_error("Failed to parse --formations number \"%s\"",
+							  optarg);
+					errors++;
+				}
+				log_trace("--formations %d", options.formationsCount);
+				break;
+			}
+
+			case 'n':
+			{
+				/* { "nodes", required_argument, NULL, 'n' } */
+				if (!stringToInt(optarg, &options.nodesCount) ||
+					options.nodesCount < 1)
+				{
+					log_error("Failed to parse --nodes number \"%s\"", optarg);
+					errors++;
+				}
+				log_trace("--nodes %d", options.nodesCount);
+				break;
+			}
+
+			case 'c':
+			{
+				/* { "clients", required_argument, NULL, 'c' } */
+				if (!stringToInt(optarg, &options.clientsCount))
+				{
+					log_error("Failed to parse --clients number \"%s\"",
+							  optarg);
+					errors++;
+				}
+
+				if (options.clientsCount < 1 ||
+					options.clientsCount > MAX_BENCH_CLIENTS_COUNT)
+				{
+					log_error("Unsupported value for --clients: %d must be "
+							  "at least 1 and maximum %d",
+							  options.clientsCount,
+							  MAX_BENCH_CLIENTS_COUNT);
+					errors++;
+				}
+
+				log_trace("--clients %d", options.clientsCount);
+				break;
+			}
+
+			case 'i':
+			{
+				/* { "interval", required_argument, NULL, 'i' } */
+				if (!stringToInt(optarg, &options.interval) ||
+					options.interval < 0)
+				{
+					log_error("Failed to parse --interval number \"%s\"",
+							  optarg);
+					errors++;
+				}
+				log_trace("--interval %d", options.interval);
+				break;
+			}
+
+			case 'o':
+			{
+				/* { "other-nodes-freq", required_argument, NULL, 'o' } */
+				if (!stringToInt(optarg, &options.otherNodesFreq) ||
+					options.otherNodesFreq < 0)
+				{
+					log_error("Failed to parse --other-nodes-freq number \"%s\"",
+							  optarg);
+					errors++;
+				}
+				log_trace("--other-nodes-freq %d", options.otherNodesFreq);
+				break;
+			}
+
+			case 'l':
+			{
+				/* { "listen", required_argument, NULL, 'l' } */
+				if (!stringToInt(optarg, &options.listenCount) ||
+					options.listenCount < 0)
+				{
+					log_error("Failed to parse --listen number \"%s\"", optarg);
+					errors++;
+				}
+				log_trace("--listen %d", options.listenCount);
+				break;
+			}
+
+			case 't':
+			{
+				/* { "duration", required_argument, NULL, 't' } */
+				if (!stringToInt(optarg, &options.duration) ||
+					options.duration < 1)
+				{
+					log_error("Failed to parse --duration number \"%s\"",
+							  optarg);
+					errors++;
+				}
+				log_trace("--duration %d", options.duration);
+				break;
+			}
+
+			case 'w':
+			{
+				/* { "wal-rate", required_argument, NULL, 'w' } */
+				if (!stringToInt(optarg, &options.walRate) ||
+					options.walRate < 0)
+				{
+					log_error("Failed to parse --wal-rate number \"%s\"",
+							  optarg);
+					errors++;
+				}
+				log_trace("--wal-rate %d", options.walRate);
+				break;
+			}
+
+			case 'x':
+			{
+				/* { "failover-interval", required_argument, NULL, 'x' } */
+				if (!stringToInt(optarg, &options.failoverInterval) ||
+					options.failoverInterval < 0)
+				{
+					log_error("Failed to parse --failover-interval number \"%s\"",
+							  optarg);
+					errors++;
+				}
+				log_trace("--failover-interval %d", options.failoverInterval);
+				break;
+			}
+
+			case 'P':
+			{
+				/* { "persistent", no_argument, NULL, 'P' } */
+				options.persistent = true;
+				log_trace("--persistent");
+				break;
+			}
+
+			case 'h':
+			{
+				commandline_help(stderr);
+				exit(EXIT_CODE_QUIT);
+				break;
+			}
+
+			case 'V':
+			{
+				/* keeper_cli_print_version prints version and exits. */
+				printVersion = true;
+				break;
+			}
+
+			case 'v':
+			{
+				++verboseCount;
+				switch (verboseCount)
+				{
+					case 1:
+					{
+						log_set_level(LOG_INFO);
+						break;
+					}
+
+					case 2:
+					{
+						log_set_level(LOG_DEBUG);
+						break;
+					}
+
+					default:
+					{
+						log_set_level(LOG_TRACE);
+						break;
+					}
+				}
+				break;
+			}
+
+			case 'q':
+			{
+				log_set_level(LOG_ERROR);
+				break;
+			}
+
+			default:
+			{
+				/* getopt_long already wrote an error message */
+				errors++;
+				break;
+			}
+		}
+	}
+
+	if (IS_EMPTY_STRING_BUFFER(options.monitor_pguri))
+	{
+		if (env_exists(PG_AUTOCTL_MONITOR) &&
+			get_env_copy(PG_AUTOCTL_MONITOR,
+						 options.monitor_pguri,
+						 sizeof(options.monitor_pguri)))
+		{
+			log_debug("Using environment PG_AUTOCTL_MONITOR \"%s\"",
+					  options.monitor_pguri);
+		}
+		else
+		{
+			log_fatal("Please provide --monitor");
+			errors++;
+		}
+	}
+
+	if ((int64_t) options.formationsCount * options.nodesCount > BENCH_MAX_NODES)
+	{
+		log_error("Unsupported number of nodes: %d formations of %d nodes "
+				  "is more than the maximum of %d simulated nodes",
+				  options.formationsCount,
+				  options.nodesCount,
+				  BENCH_MAX_NODES);
+		errors++;
+	}
+
+	if (errors > 0)
+	{
+		commandline_help(stderr);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	if (printVersion)
+	{
+		keeper_cli_print_version(argc, argv);
+	}
+
+	/* publish parsed options */
+	benchOptions = options;
+
+	return optind;
+}
+
+
+/*
+ * cli_bench_monitor runs a benchmark of the monitor: it registers the
+ * simulated nodes and has them report to the monitor for --duration seconds,
+ * then prints the throughput and the latencies of the monitor calls, and
+ * removes the simulated nodes and formations.
+ */
+static void
+cli_bench_monitor(int argc, char **argv)
+{
+	BenchStats stats = { 0 };
+	BenchServerStats before = { 0 };
+	BenchServerStats after = { 0 };
+
+	if (!bench_monitor_prepare(&benchOptions))
+	{
+		log_fatal("Failed to prepare the monitor for the benchmark");
+		exit(EXIT_CODE_MONITOR);
+	}
+
+	(void) bench_monitor_server_stats(&benchOptions, &before);
+
+	bool success = bench_monitor_run(&benchOptions, &stats);
+
+	(void) bench_monitor_server_stats(&benchOptions, &after);
+
+	(void) bench_monitor_print_report(&benchOptions, &stats, &before, &after);
+
+	if (!bench_monitor_cleanup(&benchOptions))
+	{
+		log_error("Failed to remove the benchmark formations, "
+				  "see above for details");
+		success = false;
+	}
+
+	if (!success)
+	{
+		log_fatal("Failed to run the monitor benchmark");
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+}
+
+
+/*
+ * cli_do_bench_spawn_getopts parses the command line options for the
+ * pg_autoctl do bench spawn command.
+ */
+static int
+cli_do_bench_spawn_getopts(int argc, char **argv)
+{
+	int c, option_index = 0, errors = 0;
+	int verboseCount = 0;
+
+	BenchSpawnOptions options = { 0 };
+
+	static struct option long_options[] = {
+		{ "program", required_argument, NULL, 'p' },
+		{ "count", required_argument, NULL, 'n' },
+		{ "rss", required_argument, NULL, 'r' },
+		{ "version", no_argument, NULL, 'V' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "quiet", no_argument, NULL, 'q' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	optind = 0;
+
+	/* set our defaults */
+	strlcpy(options.program, BENCH_SPAWN_DEFAULT_PROGRAM,
+			sizeof(options.program));
+	options.count = BENCH_SPAWN_DEFAULT_COUNT;
+	options.rss = 0;
+
+	unsetenv("POSIXLY_CORRECT");
+
+	while ((c = getopt_long(argc, argv, "p:n:r:Vvqh",
+							long_options, &option_index)) != -1)
+	{
+		switch (c)
+		{
+			case 'p':
+			{
+				/* { "program", required_argument, NULL, 'p' } */
+				strlcpy(options.program, optarg, sizeof(options.program));
+				log_trace("--program %s", options.program);
+				break;
+			}
+
+			case 'n':
+			{
+				/* { "count", required_argument, NULL, 'n' } */
+				if (!stringToInt(optarg, &options.count) || options.count < 1)
+				{
+					log_error("Failed to parse --count number \"%s\"", optarg);
+					errors++;
+				}
+				log_trace("--count %d", options.count);
+				break;
+			}
+
+			case 'r':
+			{
+				/* { "rss", required_argument, NULL, 'r' } */
+				if (!stringToInt(optarg, &options.rss) || options.rss < 0)
+				{
+					log_error("Failed to parse --rss number \"%s\"", optarg);
+					errors++;
+				}
+				log_trace("--rss %d", options.rss);
+				break;
+			}
+
+			case 'h':
+			{
+				commandline_help(stderr);
+				exit(EXIT_CODE_QUIT);
+				break;
+			}
+
+			case 'V':
+			{
+				/* keeper_cli_print_version prints version and exits. */
+				keeper_cli_print_version(argc, argv);
+				break;
+			}
+
+			case 'v':
+			{
+				++verboseCount;
+				switch (verboseCount)
+				{
+					case 1:
+					{
+						log_set_level(LOG_INFO);
+						break;
+					}
+
+					case 2:
+					{
+						log_set_level(LOG_DEBUG);
+						break;
+					}
+
+					default:
+					{
+						log_set_level(LOG_TRACE);
+						break;
+					}
+				}
+				break;
+			}
+
+			case 'q':
+			{
+				log_set_level(LOG_ERROR);
+				break;
+			}
+
+			default:
+			{
+				/* getopt_long already wrote an error message */
+				errors++;
+				break;
+			}
+		}
+	}
+
+	if (errors > 0)
+	{
+		commandline_help(stderr);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	/* publish parsed options */
+	benchSpawnOptions = options;
+
+	return optind;
+}
+
+
+/*
+ * cli_bench_spawn runs the given program --count times using fork() and
+ * exec(), then the same number of times using posix_spawn(), and prints the
+ * latencies of both methods.
+ */
+static void
+cli_bench_spawn(int argc, char **argv)
+{
+	BenchSpawnOptions *options = &benchSpawnOptions;
+	BenchHistogram forkHistogram = { 0 };
+	BenchHistogram spawnHistogram = { 0 };
+	char *memory = NULL;
+
+	if (options->rss > 0)
+	{
+		size_t size = (size_t) options->rss * 1024 * 1024;
+
+		memory = (char *) malloc(size);
+
+		if (memory == NULL)
+		{
+			log_fatal(ALLOCATION_FAILED_ERROR);
+			exit(EXIT_CODE_INTERNAL_ERROR);
+		}
+
+		/* touch every page so that it is part of our resident set */
+		memset(memory, 1, size);
+	}
+
+	if (!bench_spawn_run(options, true, &forkHistogram) ||
+		!bench_spawn_run(options, false, &spawnHistogram))
+	{
+		log_fatal("Spawn benchmark interrupted");
+		exit(EXIT_CODE_QUIT);
+	}
+
+	(void) bench_spawn_print_report(options, &forkHistogram, &spawnHistogram);
+
+	if (memory != NULL)
+	{
+		free(memory);
+	}
+}
+
+
+/*
+ * cli_do_bench_fsm_getopts parses the command line options for the
+ * pg_autoctl do bench fsm command.
+ */
+static int
+cli_do_bench_fsm_getopts(int argc, char **argv)
+{
+	int c, option_index = 0, errors = 0;
+	int verboseCount = 0;
+
+	BenchFSMOptions options = { 0 };
+
+	static struct option long_options[] = {
+		{ "count", required_argument, NULL, 'n' },
+		{ "version", no_argument, NULL, 'V' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "quiet", no_argument, NULL, 'q' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	optind = 0;
+
+	/* set our defaults */
+	options.count = BENCH_FSM_DEFAULT_COUNT;
+
+	unsetenv("POSIXLY_CORRECT");
+
+	while ((c = getopt_long(argc, argv, "n:Vvqh",
+							long_options, &option_index)) != -1)
+	{
+		switch (c)
+		{
+			case 'n':
+			{
+				/* { "count", required_argument, NULL, 'n' } */
+				if (!stringToInt(optarg, &options.count) || options.count < 1)
+				{
+					log_error("Failed to parse --count number \"%s\"", optarg);
+					errors++;
+				}
+				log_trace("--count %d", options.count);
+				break;
+			}
+
+			case 'h':
+			{
+				commandline_help(stderr);
+				exit(EXIT_CODE_QUIT);
+				break;
+			}
+
+			case 'V':
+			{
+				/* keeper_cli_print_version prints version and exits. */
+				keeper_cli_print_version(argc, argv);
+				break;
+			}
+
+			case 'v':
+			{
+				++verboseCount;
+				switch (verboseCount)
+				{
+					case 1:
+					{
+						log_set_level(LOG_INFO);
+						break;
+					}
+
+					case 2:
+					{
+						log_set_level(LOG_DEBUG);
+						break;
+					}
+
+					default:
+					{
+						log_set_level(LOG_TRACE);
+						break;
+					}
+				}
+				break;
+			}
+
+			case 'q':
+			{
+				log_set_level(LOG_ERROR);
+				break;
+			}
+
+			default:
+			{
+				/* getopt_long already wrote an error message */
+				errors++;
+				break;
+			}
+		}
+	}
+
+	if (errors > 0)
+	{
+		commandline_help(stderr);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	/* publish parsed options */
+	benchFSMOptions = options;
+
+	return optind;
+}
+
+
+/*
+ * cli_bench_fsm times the FSM transition lookups and the parsing of state
+ * names, comparing the indexed methods to linear scans.
+ */
+static void
+cli_bench_fsm(int argc, char **argv)
+{
+	(void) bench_fsm_run(&benchFSMOptions);
+}
+
+
+/*
+ * cli_do_bench_internals_getopts parses the command line options for the
+ * pg_autoctl do bench internals command.
+ */
+static int
+cli_do_bench_internals_getopts(int argc, char **argv)
+{
+	int c, option_index = 0, errors = 0;
+	int verboseCount = 0;
+
+	BenchInternalsOptions options = { 0 };
+
+	static struct option long_options[] = {
+		{ "count", required_argument, NULL, 'n' },
+		{ "nodes", required_argument, NULL, 'N' },
+		{ "version", no_argument, NULL, 'V' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "quiet", no_argument, NULL, 'q' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	optind = 0;
+
+	/* set our defaults */
+	options.count = BENCH_INTERNALS_DEFAULT_COUNT;
+	options.nodes = BENCH_INTERNALS_DEFAULT_NODES;
+
+	unsetenv("POSIXLY_CORRECT");
+
+	while ((c = getopt_long(argc, argv, "n:N:Vvqh",
+							long_options, &option_index)) != -1)
+	{
+		switch (c)
+		{
+			case 'n':
+			{
+				/* { "count", required_argument, NULL, 'n' } */
+				if (!stringToInt(optarg, &options.count) || options.count < 1)
+				{
+					log_error("Failed to parse --count number \"%s\"", optarg);
+					errors++;
+				}
+				log_trace("--count %d", options.count);
+				break;
+			}
+
+			case 'N':
+			{
+				/* { "nodes", required_argument, NULL, 'N' } */
+				if (!stringToInt(optarg, &options.nodes) ||
+					options.nodes < 1 || options.nodes > 65535)
+				{
+					log_error("Failed to parse --nodes number \"%s\", "
+							  "expected a number between 1 and 65535",
+							  optarg);
+					errors++;
+				}
+				log_trace("--nodes %d", options.nodes);
+				break;
+			}
+
+			case 'h':
+			{
+				commandline_help(stderr);
+				exit(EXIT_CODE_QUIT);
+				break;
+			}
+
+			case 'V':
+			{
+				/* keeper_cli_print_version prints version and exits. */
+				keeper_cli_print_version(argc, argv);
+				break;
+			}
+
+			case 'v':
+			{
+				++verboseCount;
+				switch (verboseCount)
+				{
+					case 1:
+					{
+						log_set_level(LOG_INFO);
+						break;
+					}
+
+					case 2:
+					{
+						log_set_level(LOG_DEBUG);
+						break;
+					}
+
+					default:
+					{
+						log_set_level(LOG_TRACE);
+						break;
+					}
+				}
+				break;
+			}
+
+			case 'q':
+			{
+				log_set_level(LOG_ERROR);
+				break;
+			}
+
+			default:
+			{
+				/* getopt_long already wrote an error message */
+				errors++;
+				break;
+			}
+		}
+	}
+
+	if (errors > 0)
+	{
+		commandline_help(stderr);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	/* publish parsed options */
+	benchInternalsOptions = options;
+
+	return optind;
+}
+
+
+/*
+ * cli_bench_internals times the parsing of the monitor results, the diff of
+ * the nodes arrays, the HBA rules checks, the configuration file parsing,
+ * the state JSON serialization, and the timeline history parsing.
+ */
+static void
+cli_bench_internals(int argc, char **argv)
+{
+	if (!bench_internals_run(&benchInternalsOptions))
+	{
+		log_fatal("Failed to run the internals benchmark");
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+}
+
+
+/*
+ * cli_bench_parse_list parses a comma separated list of positive integers,
+ * such as the --listeners and --payloads options of pg_autoctl do bench
+ * notify.
+ */
+static bool
+cli_bench_parse_list(const char *str, int *array, int size, int *count)
+{
+	char buffer[BUFSIZE] = { 0 };
+	char *saveptr = NULL;
+
+	strlcpy(buffer, str, sizeof(buffer));
+
+	*count = 0;
+
+	for (char *item = strtok_r(buffer, ",", &saveptr);
+		 item != NULL;
+		 item = strtok_r(NULL, ",", &saveptr))
+	{
+		if (*count >= size)
+		{
+			log_error("Failed to parse \"%s\": more than %d values",
+					  str, size);
+			return false;
+		}
+
+		if (!stringToInt(item, &(array[*count])) || array[*count] < 1)
+		{
+			log_error("Failed to parse \"%s\": \"%s\" is not a positive "
+					  "number",
+					  str, item);
+			return false;
+		}
+
+		++(*count);
+	}
+
+	return *count > 0;
+}
+
+
+/*
+ * cli_do_bench_notify_getopts parses the command line options for the
+ * pg_autoctl do bench notify command.
+ */
+static int
+cli_do_bench_notify_getopts(int argc, char **argv)
+{
+	int c, option_index = 0, errors = 0;
+	int verboseCount = 0;
+
+	BenchNotifyOptions options = { 0 };
+
+	static struct option long_options[] = {
+		{ "monitor", required_argument, NULL, 'm' },
+		{ "listeners", required_argument, NULL, 'l' },
+		{ "payloads", required_argument, NULL, 'p' },
+		{ "count", required_argument, NULL, 'n' },
+		{ "interval", required_argument, NULL, 'i' },
+		{ "clients", required_argument, NULL, 'c' },
+		{ "version", no_argument, NULL, 'V' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "quiet", no_argument, NULL, 'q' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	optind = 0;
+
+	/* set our defaults */
+	(void) cli_bench_parse_list(BENCH_NOTIFY_DEFAULT_LISTENERS,
+								options.listeners,
+								BENCH_NOTIFY_MAX_STEPS,
+								&options.listenersCount);
+	(void) cli_bench_parse_list(BENCH_NOTIFY_DEFAULT_PAYLOADS,
+								options.payloads,
+								BENCH_NOTIFY_MAX_STEPS,
+								&options.payloadsCount);
+	options.count = BENCH_NOTIFY_DEFAULT_COUNT;
+	options.interval = BENCH_NOTIFY_DEFAULT_INTERVAL;
+	options.clientsCount = BENCH_NOTIFY_DEFAULT_CLIENTS;
+
+	unsetenv("POSIXLY_CORRECT");
+
+	while ((c = getopt_long(argc, argv, "m:l:p:n:i:c:Vvqh",
+							long_options, &option_index)) != -1)
+	{
+		switch (c)
+		{
+			case 'm':
+			{
+				/* { "monitor", required_argument, NULL, 'm' } */
+				if (!validate_connection_string(optarg))
+				{
+					log_fatal("Failed to parse --monitor connection string, "
+							  "see above for details.");
+					exit(EXIT_CODE_BAD_ARGS);
+				}
+				strlcpy(options.monitor_pguri, optarg, MAXCONNINFO);
+				log_trace("--monitor %s", options.monitor_pguri);
+				break;
+			}
+
+			case 'l':
+			{
+				/* { "listeners", required_argument, NULL, 'l' } */
+				if (!cli_bench_parse_list(optarg,
+										  options.listeners,
+										  BENCH_NOTIFY_MAX_STEPS,
+										  &options.listenersCount))
+				{
+					log_error("Failed to parse --listeners \"%s\"", optarg);
+					errors++;
+				}
+
+				for (int i = 0; i < options.listenersCount; i++)
+				{
+					if (options.listeners[i] > BENCH_NOTIFY_MAX_LISTENERS)
+					{
+						log_error("Unsupported value for --listeners: %d is "
+								  "more than the maximum of %d sessions",
+								  options.listeners[i],
+								  BENCH_NOTIFY_MAX_LISTENERS);
+						errors++;
+					}
+				}
+
+				log_trace("--listeners %s", optarg);
+				break;
+			}
+
+			case 'p':
+			{
+				/* { "payloads", required_argument, NULL, 'p' } */
+				if (!cli_bench_parse_list(optarg,
+										  options.payloads,
+										  BENCH_NOTIFY_MAX_STEPS,
+										  &options.payloadsCount))
+				{
+					log_error("Failed to parse --payloads \"%s\"", optarg);
+					errors++;
+				}
+
+				for (int i = 0; i < options.payloadsCount; i++)
+				{
+					if (options.payloads[i] < BENCH_NOTIFY_MIN_PAYLOAD ||
+						options.payloads[i] > BENCH_NOTIFY_MAX_PAYLOAD)
+					{
+						log_error("Unsupported value for --payloads: %d must "
+								  "be at least %d and maximum %d bytes",
+								  options.payloads[i],
+								  BENCH_NOTIFY_MIN_PAYLOAD,
+								  BENCH_NOTIFY_MAX_PAYLOAD);
+						errors++;
+					}
+				}
+
+				log_trace("--payloads %s", optarg);
+				break;
+			}
+
+			case 'n':
+			{
+				/* { "count", required_argument, NULL, 'n' } */
+				if (!stringToInt(optarg, &options.count) || options.count < 1)
+				{
+					log_error("Failed to parse --count number \"%s\"", optarg);
+					errors++;
+				}
+				log_trace("--count %d", options.count);
+				break;
+			}
+
+			case 'i':
+			{
+				/* { "interval", required_argument, NULL, 'i' } */
+				if (!stringToInt(optarg, &options.interval) ||
+					options.interval < 0)
+				{
+					log_error("Failed to parse --interval number \"%s\"",
+							  optarg);
+					errors++;
+				}
+				log_trace("--interval %d", options.interval);
+				break;
+			}
+
+			case 'c':
+			{
+				/* { "clients", required_argument, NULL, 'c' } */
+				if (!stringToInt(optarg, &options.clientsCount))
+				{
+					log_error("Failed to parse --clients number \"%s\"",
+							  optarg);
+					errors++;
+				}
+
+				if (options.clientsCount < 1 ||
+					options.clientsCount > MAX_BENCH_CLIENTS_COUNT)
+				{
+					log_error("Unsupported value for --clients: %d must be "
+							  "at least 1 and maximum %d",
+							  options.clientsCount,
+							  MAX_BENCH_CLIENTS_COUNT);
+					errors++;
+				}
+
+				log_trace("--clients %d", options.clientsCount);
+				break;
+			}
+
+			case 'h':
+			{
+				commandline_help(stderr);
+				exit(EXIT_CODE_QUIT);
+				break;
+			}
+
+			case 'V':
+			{
+				/* keeper_cli_print_version prints version and exits. */
+				keeper_cli_print_version(argc, argv);
+				break;
+			}
+
+			case 'v':
+			{
+				++verboseCount;
+				switch (verboseCount)
+				{
+					case 1:
+					{
+						log_set_level(LOG_INFO);
+						break;
+					}
+
+					case 2:
+					{
+						log_set_level(LOG_DEBUG);
+						break;
+					}
+
+					default:
+					{
+						log_set_level(LOG_TRACE);
+						break;
+					}
+				}
+				break;
+			}
+
+			case 'q':
+			{
+				log_set_level(LOG_ERROR);
+				break;
+			}
+
+			default:
+			{
+				/* getopt_long already wrote an error message */
+				errors++;
+				break;
+			}
+		}
+	}
+
+	if (IS_EMPTY_STRING_BUFFER(options.monitor_pguri))
+	{
+		if (env_exists(PG_AUTOCTL_MONITOR) &&
+			get_env_copy(PG_AUTOCTL_MONITOR,
+						 options.monitor_pguri,
+						 sizeof(options.monitor_pguri)))
+		{
+			log_debug("Using environment PG_AUTOCTL_MONITOR \"%s\"",
+					  options.monitor_pguri);
+		}
+		else
+		{
+			log_fatal("Please provide --monitor");
+			errors++;
+		}
+	}
+
+	if (errors > 0)
+	{
+		commandline_help(stderr);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	/* publish parsed options */
+	benchNotifyOptions = options;
+
+	return optind;
+}
+
+
+/*
+ * cli_bench_notify runs a round of the notification benchmark for every
+ * combination of --listeners and --payloads, and then prints the latencies
+ * of the delivery of the notifications in each round.
+ */
+static void
+cli_bench_notify(int argc, char **argv)
+{
+	BenchNotifyOptions *options = &benchNotifyOptions;
+	BenchNotifyResult results[BENCH_NOTIFY_MAX_STEPS * BENCH_NOTIFY_MAX_STEPS] = { 0 };
+	int count = 0;
+	bool success = true;
+
+	for (int l = 0; success && l < options->listenersCount; l++)
+	{
+		for (int p = 0; success && p < options->payloadsCount; p++)
+		{
+			success = bench_notify_run(options,
+									   options->listeners[l],
+									   options->payloads[p],
+									   &(results[count++]));
+		}
+	}
+
+	(void) bench_notify_print_report(options, results, count);
+
+	if (!success)
+	{
+		log_fatal("Failed to run the notification benchmark");
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+}
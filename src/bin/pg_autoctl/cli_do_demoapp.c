@@ -33,7 +33,9 @@ DemoAppOptions demoAppOptions = { 0 };
 
 static int cli_do_demoapp_getopts(int argc, char **argv);
 
+static void cli_demo_grab_formation_uri(char *pguri, size_t size);
 static void cli_demo_run(int argc, char **argv);
+static void cli_demo_bench(int argc, char **argv);
 static void cli_demo_uri(int argc, char **argv);
 static void cli_demo_ping(int argc, char **argv);
 static void cli_demo_summary(int argc, char **argv);
@@ -52,6 +54,25 @@ static CommandLine do_demo_run_command =
 				 "  --failover-freq  Seconds between subsequent failovers (45)\n",
 				 cli_do_demoapp_getopts, cli_demo_run);
 
+static CommandLine do_demo_bench_command =
+	make_command("bench",
+				 "Measure the downtime of repeated failovers",
+				 "[option ...]",
+				 "  --monitor        Postgres URI of the pg_auto_failover monitor\n"
+				 "  --formation      Formation to use (default)\n"
+				 "  --group          Group Id to failover (0)\n"
+				 "  --username       PostgreSQL's username\n"
+				 "  --clients        How many client processes to use (1)\n"
+				 "  --duration       Duration of the benchmark, in seconds (30)\n"
+				 "  --first-failover Timing of the first failover (10)\n"
+				 "  --failover-freq  Seconds between subsequent failovers (45)\n"
+				 "  --rate           Transactions per second per client (10)\n"
+				 "  --mix            Reads and writes per transaction (1:1)\n"
+				 "  --events         switchover, kill, or mixed (switchover)\n"
+				 "  --kill-command   Shell command that kills the primary\n"
+				 "  --format         Output format: text, csv, or json (text)\n",
+				 cli_do_demoapp_getopts, cli_demo_bench);
+
 static CommandLine do_demo_uri_command =
 	make_command("uri",
 				 "Grab the application connection string from the monitor",
@@ -90,6 +111,7 @@ static CommandLine do_demo_summary_command =
 
 CommandLine *do_demo_subcommands[] = {
 	&do_demo_run_command,
+	&do_demo_bench_command,
 	&do_demo_uri_command,
 	&do_demo_ping_command,
 	&do_demo_summary_command,
@@ -125,6 +147,11 @@ cli_do_demoapp_getopts(int argc, char **argv)
 		{ "no-failover", no_argument, NULL, 'N' },
 		{ "first-failover", required_argument, NULL, 'F' },
 		{ "failover-freq", required_argument, NULL, 'Q' },
+		{ "rate", required_argument, NULL, 'R' },
+		{ "mix", required_argument, NULL, 'X' },
+		{ "events", required_argument, NULL, 'E' },
+		{ "kill-command", required_argument, NULL, 'K' },
+		{ "format", required_argument, NULL, 'O' },
 		{ "version", no_argument, NULL, 'V' },
 		{ "verbose", no_argument, NULL, 'v' },
 		{ "quiet", no_argument, NULL, 'q' },
@@ -141,6 +168,11 @@ cli_do_demoapp_getopts(int argc, char **argv)
 	options.firstFailover = 10;
 	options.failoverFreq = 45;
 	options.doFailover = true;
+	options.rate = 10;
+	options.mixReads = 1;
+	options.mixWrites = 1;
+	options.events = DEMO_EVENTS_SWITCHOVER;
+	options.format = DEMO_FORMAT_TEXT;
 	strlcpy(options.formation, "default", sizeof(options.formation));
 
 	/*
@@ -350,6 +382,106 @@ cli_do_demoapp_getopts(int argc, char **argv)
 				break;
 			}
 
+			case 'R':
+			{
+				/* { "rate", required_argument, NULL, 'R' }, */
+				if (!stringToInt(optarg, &options.rate) || options.rate < 1)
+				{
+					log_error("Failed to parse --rate number \"%s\"", optarg);
+					errors++;
+				}
+				log_trace("--rate %d", options.rate);
+				break;
+			}
+
+			case 'X':
+			{
+				/* { "mix", required_argument, NULL, 'X' }, */
+				char reads[BUFSIZE] = { 0 };
+				char *writes = strchr(optarg, ':');
+
+				if (writes != NULL)
+				{
+					strlcpy(reads, optarg,
+							Min(sizeof(reads), (size_t) (writes - optarg) + 1));
+					++writes;
+				}
+
+				if (writes == NULL ||
+					!stringToInt(reads, &options.mixReads) ||
+					!stringToInt(writes, &options.mixWrites) ||
+					options.mixReads < 0 ||
+					options.mixWrites < 0 ||
+					options.mixReads + options.mixWrites == 0)
+				{
+					log_error("Failed to parse --mix \"%s\", expected "
+							  "read:write, such as 4:1", optarg);
+					errors++;
+				}
+				log_trace("--mix %d:%d", options.mixReads, options.mixWrites);
+				break;
+			}
+
+			case 'E':
+			{
+				/* { "events", required_argument, NULL, 'E' }, */
+				if (strcmp(optarg, "switchover") == 0)
+				{
+					options.events = DEMO_EVENTS_SWITCHOVER;
+				}
+				else if (strcmp(optarg, "kill") == 0)
+				{
+					options.events = DEMO_EVENTS_KILL;
+				}
+				else if (strcmp(optarg, "mixed") == 0)
+				{
+					options.events = DEMO_EVENTS_MIXED;
+				}
+				else
+				{
+					log_error("Unsupported value for --events: \"%s\", "
+							  "expected switchover, kill, or mixed",
+							  optarg);
+					errors++;
+				}
+				log_trace("--events %s", optarg);
+				break;
+			}
+
+			case 'K':
+			{
+				/* { "kill-command", required_argument, NULL, 'K' }, */
+				strlcpy(options.killCommand, optarg, sizeof(options.killCommand));
+				log_trace("--kill-command %s", options.killCommand);
+				break;
+			}
+
+			case 'O':
+			{
+				/* { "format", required_argument, NULL, 'O' }, */
+				if (strcmp(optarg, "text") == 0)
+				{
+					options.format = DEMO_FORMAT_TEXT;
+				}
+				else if (strcmp(optarg, "csv") == 0)
+				{
+					options.format = DEMO_FORMAT_CSV;
+				}
+				else if (strcmp(optarg, "json") == 0)
+				{
+					options.format = DEMO_FORMAT_JSON;
+				}
+				else
+				{
+					log_error("Unsupported value for --format: \"%s\", "
+							  "expected text, csv, or json",
+							  optarg);
+					errors++;
+				}
+				log_trace("--format %s", optarg);
+				break;
+			}
+
 
 			case 'h':
 			{
@@ -437,6 +569,13 @@ cli_do_demoapp_getopts(int argc, char **argv)
 		}
 	}
 
+	if (options.events != DEMO_EVENTS_SWITCHOVER &&
+		IS_EMPTY_STRING_BUFFER(options.killCommand))
+	{
+		log_error("Please provide --kill-command to use --events kill or mixed");
+		errors++;
+	}
+
 	/* set our Postgres username as the PGUSER environment variable now */
 	setenv("PGUSER", options.username, 1);
 
@@ -459,13 +598,12 @@ cli_do_demoapp_getopts(int argc, char **argv)
 
 
 /*
- * cli_demo_run runs a demo application.
+ * cli_demo_grab_formation_uri grabs the application connection string from
+ * the monitor, retrying when the monitor is not available yet.
  */
 static void
-cli_demo_run(int argc, char **argv)
+cli_demo_grab_formation_uri(char *pguri, size_t size)
 {
-	char pguri[MAXCONNINFO] = { 0 };
-
 	ConnectionRetryPolicy retryPolicy = { 0 };
 
 	/* retry connecting to the monitor when it's not available */
@@ -475,7 +613,7 @@ cli_demo_run(int argc, char **argv)
 	{
 		bool mayRetry = false;
 
-		if (demoapp_grab_formation_uri(&demoAppOptions, pguri, sizeof(pguri),
+		if (demoapp_grab_formation_uri(&demoAppOptions, pguri, size,
 									   &mayRetry))
 		{
 			/* success: break out of the retry loop */
@@ -501,6 +639,18 @@ cli_demo_run(int argc, char **argv)
 
 	log_info("Using application connection string \"%s\"", pguri);
 	log_info("Using Postgres user PGUSER \"%s\"", demoAppOptions.username);
+}
+
+
+/*
+ * cli_demo_run runs a demo application.
+ */
+static void
+cli_demo_run(int argc, char **argv)
+{
+	char pguri[MAXCONNINFO] = { 0 };
+
+	(void) cli_demo_grab_formation_uri(pguri, sizeof(pguri));
 
 	if (!demoapp_prepare_schema(pguri))
 	{
@@ -519,6 +669,31 @@ cli_demo_run(int argc, char **argv)
 }
 
 
+/*
+ * cli_demo_bench runs a fixed rate workload while injecting failovers, and
+ * reports how long writes and reads were unavailable for each failover.
+ */
+static void
+cli_demo_bench(int argc, char **argv)
+{
+	char pguri[MAXCONNINFO] = { 0 };
+
+	(void) cli_demo_grab_formation_uri(pguri, sizeof(pguri));
+
+	if (!demoapp_prepare_schema(pguri))
+	{
+		log_fatal("Failed to install the demo application schema");
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+
+	if (!demoapp_bench(pguri, &demoAppOptions))
+	{
+		log_fatal("Failed to run the demo benchmark");
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+}
+
+
 /*
  * cli_demo_uri returns the Postgres connection string (URI) to use in the demo
  * application, grabbed from a running monitor node by using the SQL API.
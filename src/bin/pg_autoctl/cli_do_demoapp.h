@@ -28,6 +28,22 @@
 
 #define MAX_CLIENTS_COUNT 128
 
+/* the events that the demo bench injects while the clients are running */
+typedef enum
+{
+	DEMO_EVENTS_SWITCHOVER = 0,
+	DEMO_EVENTS_KILL,
+	DEMO_EVENTS_MIXED
+} DemoAppEvents;
+
+/* the output formats of the demo bench results */
+typedef enum
+{
+	DEMO_FORMAT_TEXT = 0,
+	DEMO_FORMAT_CSV,
+	DEMO_FORMAT_JSON
+} DemoAppFormat;
+
 typedef struct DemoAppOptions
 {
 	char monitor_pguri[MAXCONNINFO];
@@ -40,6 +56,14 @@ typedef struct DemoAppOptions
 	int firstFailover;
 	int failoverFreq;
 	bool doFailover;
+
+	/* options that are only used by pg_autoctl do demo bench */
+	int rate;
+	int mixReads;               /* read queries per tick of the schedule */
+	int mixWrites;              /* write transactions per tick */
+	DemoAppEvents events;
+	char killCommand[BUFSIZE];
+	DemoAppFormat format;
 } DemoAppOptions;
 
 extern DemoAppOptions demoAppOptions;
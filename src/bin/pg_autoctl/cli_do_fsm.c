@@ -31,6 +31,7 @@ static void cli_do_fsm_init(int argc, char **argv);
 static void cli_do_fsm_state(int argc, char **argv);
 static void cli_do_fsm_list(int argc, char **argv);
 static void cli_do_fsm_gv(int argc, char **argv);
+static void cli_do_fsm_check(int argc, char **argv);
 static void cli_do_fsm_assign(int argc, char **argv);
 static void cli_do_fsm_step(int argc, char **argv);
 
@@ -66,6 +67,11 @@ static CommandLine fsm_gv =
 				 "Output the FSM as a .gv program suitable for graphviz/dot",
 				 "", NULL, NULL, cli_do_fsm_gv);
 
+static CommandLine fsm_check =
+	make_command("check",
+				 "Check the FSM transitions for duplicates and unreachable states",
+				 "", NULL, NULL, cli_do_fsm_check);
+
 static CommandLine fsm_assign =
 	make_command("assign",
 				 "Assign a new goal state to the keeper",
@@ -115,6 +121,7 @@ static CommandLine *fsm[] = {
 	&fsm_state,
 	&fsm_list,
 	&fsm_gv,
+	&fsm_check,
 	&fsm_assign,
 	&fsm_step,
 	&fsm_nodes,
@@ -277,6 +284,21 @@ cli_do_fsm_gv(int argc, char **argv)
 }
 
 
+/*
+ * cli_do_fsm_check validates the FSM transitions table, and is run at build
+ * time by "make check-fsm".
+ */
+static void
+cli_do_fsm_check(int argc, char **argv)
+{
+	if (!keeper_fsm_check())
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+}
+
+
 /*
  * cli_do_fsm_assigns a reachable state from the current one.
  */
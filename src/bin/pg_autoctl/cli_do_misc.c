@@ -124,9 +124,10 @@ keeper_cli_create_monitor_user(int argc, char **argv)
 	LocalPostgresServer postgres = { 0 };
 	bool missingPgdataOk = false;
 	bool postgresNotRunningOk = false;
-	char monitorHostname[_POSIX_HOST_NAME_MAX];
-	int monitorPort = 0;
-	int connlimit = 1;
+	URIHostArray monitorHosts = { 0 };
+
+	/* keep-alive health checks hold a connection, see fsm_init_primary */
+	int connlimit = -1;
 
 	keeper_config_init(&config, missingPgdataOk, postgresNotRunningOk);
 	local_postgres_init(&postgres, &(config.pgSetup));
@@ -140,25 +141,27 @@ keeper_cli_create_monitor_user(int argc, char **argv)
 		exit(EXIT_CODE_BAD_ARGS);
 	}
 
-	if (!hostname_from_uri(config.monitor_pguri,
-						   monitorHostname, _POSIX_HOST_NAME_MAX,
-						   &monitorPort))
+	if (!hostnames_from_uri(config.monitor_pguri, &monitorHosts))
 	{
 		log_fatal("Failed to determine monitor hostname");
 		exit(EXIT_CODE_BAD_ARGS);
 	}
 
-	if (!primary_create_user_with_hba(&postgres,
-									  PG_AUTOCTL_HEALTH_USERNAME,
-									  PG_AUTOCTL_HEALTH_PASSWORD,
-									  monitorHostname,
-									  "trust",
-									  HBA_EDIT_MINIMAL,
-									  connlimit))
+	for (int i = 0; i < monitorHosts.count; i++)
 	{
-		log_fatal("Failed to create the database user that the pg_auto_failover "
-				  " monitor uses for health checks, see above for details");
-		exit(EXIT_CODE_PGSQL);
+		if (!primary_create_user_with_hba(&postgres,
+										  PG_AUTOCTL_HEALTH_USERNAME,
+										  PG_AUTOCTL_HEALTH_PASSWORD,
+										  monitorHosts.hosts[i],
+										  "trust",
+										  HBA_EDIT_MINIMAL,
+										  connlimit))
+		{
+			log_fatal("Failed to create the database user that the "
+					  "pg_auto_failover monitor uses for health checks, "
+					  "see above for details");
+			exit(EXIT_CODE_PGSQL);
+		}
 	}
 }
 
@@ -384,7 +387,10 @@ keeper_cli_pgsetup_tune(int argc, char **argv)
 {
 	char config[BUFSIZE] = { 0 };
 
-	if (!pgtuning_prepare_guc_settings(postgres_tuning, config, BUFSIZE))
+	if (!pgtuning_prepare_guc_settings(postgres_tuning,
+									   &(keeperOptions.pgSetup),
+									   config,
+									   BUFSIZE))
 	{
 		exit(EXIT_CODE_INTERNAL_ERROR);
 	}
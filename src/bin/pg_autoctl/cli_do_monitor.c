@@ -36,16 +36,32 @@
 #include "pgctl.h"
 #include "pgsetup.h"
 #include "pgsql.h"
+#include "signals.h"
 #include "state.h"
 
+/*
+ * pg_autoctl do monitor stream-events reads the replication slot again as
+ * soon as a state change is notified, and every STREAM_EVENTS_INTERVAL_MS in
+ * case the notification connection fails.
+ */
+#define STREAM_EVENTS_INTERVAL_MS 5000
+
+static char streamEventsSlotName[NAMEDATALEN] = { 0 };
+static bool streamEventsDropSlot = false;
+
 static void cli_do_monitor_get_primary_node(int argc, char **argv);
 static void cli_do_monitor_get_other_nodes(int argc, char **argv);
 static void cli_do_monitor_get_candidate_count(int argc, char **argv);
 static void cli_do_monitor_get_coordinator(int argc, char **argv);
 static void cli_do_monitor_register_node(int argc, char **argv);
+static void cli_do_monitor_register_batch(int argc, char **argv);
 static void cli_do_monitor_node_active(int argc, char **argv);
 static void cli_do_monitor_version(int argc, char **argv);
 static void cli_do_monitor_parse_notification(int argc, char **argv);
+static int cli_do_monitor_stream_events_getopts(int argc, char **argv);
+static void cli_do_monitor_stream_events(int argc, char **argv);
+static void cli_do_monitor_stream_events_notification(void *context,
+													  CurrentNodeState *nodeState);
 
 
 static CommandLine monitor_get_primary_command =
@@ -101,6 +117,14 @@ static CommandLine monitor_register_command =
 				 cli_getopt_pgdata,
 				 cli_do_monitor_register_node);
 
+static CommandLine monitor_register_batch_command =
+	make_command("register-batch",
+				 "Register a batch of nodes with the monitor in one transaction",
+				 CLI_PGDATA_USAGE "<nodes.json>",
+				 CLI_PGDATA_OPTION,
+				 cli_getopt_pgdata,
+				 cli_do_monitor_register_batch);
+
 static CommandLine monitor_node_active_command =
 	make_command("active",
 				 "Call in the pg_auto_failover Node Active protocol",
@@ -127,12 +151,25 @@ static CommandLine monitor_parse_notification_command =
 				 NULL,
 				 cli_do_monitor_parse_notification);
 
+static CommandLine monitor_stream_events_command =
+	make_command("stream-events",
+				 "Stream the monitor events from a logical replication slot",
+				 " [ --pgdata --monitor ] --slot [ --drop ] ",
+				 "  --pgdata      path to data directory\n"
+				 "  --monitor     pg_auto_failover Monitor Postgres URL\n"
+				 "  --slot        name of the replication slot to stream from\n"
+				 "  --drop        drop the replication slot and exit\n",
+				 cli_do_monitor_stream_events_getopts,
+				 cli_do_monitor_stream_events);
+
 static CommandLine *monitor_subcommands[] = {
 	&monitor_get_command,
 	&monitor_register_command,
+	&monitor_register_batch_command,
 	&monitor_node_active_command,
 	&monitor_version_command,
 	&monitor_parse_notification_command,
+	&monitor_stream_events_command,
 	NULL
 };
 
@@ -527,6 +564,78 @@ cli_do_monitor_register_node(int argc, char **argv)
 }
 
 
+/*
+ * cli_do_monitor_register_batch registers the nodes listed in a JSON file
+ * with the monitor, using the formation and dbname of the local keeper
+ * configuration. Each entry of the JSON array is an object with at least the
+ * "host" and "port" keys, and optionally "name", "group", "kind",
+ * "candidate_priority", "replication_quorum" and "cluster".
+ */
+static void
+cli_do_monitor_register_batch(int argc, char **argv)
+{
+	KeeperConfig config = keeperOptions;
+	Monitor monitor = { 0 };
+	char *nodesJSON = NULL;
+	long size = 0L;
+
+	bool missingPgdataIsOk = true;
+	bool pgIsNotRunningIsOk = true;
+	bool monitorDisabledIsOk = false;
+
+	if (argc != 1)
+	{
+		log_error("Missing argument: <nodes.json>");
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	if (!keeper_config_read_file(&config,
+								 missingPgdataIsOk,
+								 pgIsNotRunningIsOk,
+								 monitorDisabledIsOk))
+	{
+		/* errors have already been logged. */
+		exit(EXIT_CODE_BAD_CONFIG);
+	}
+
+	if (!read_file(argv[0], &nodesJSON, &size))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	JSON_Value *js = json_parse_string(nodesJSON);
+
+	if (js == NULL || json_value_get_type(js) != JSONArray)
+	{
+		log_fatal("Failed to parse JSON nodes file \"%s\": "
+				  "expected a JSON array of nodes", argv[0]);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	json_value_free(js);
+
+	if (!monitor_init(&monitor, config.monitor_pguri))
+	{
+		log_fatal("Failed to contact the monitor because its URL is invalid, "
+				  "see above for details");
+		exit(EXIT_CODE_BAD_CONFIG);
+	}
+
+	if (!monitor_register_nodes(&monitor,
+								config.formation,
+								config.pgSetup.dbname,
+								nodesJSON,
+								outputJSON))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_MONITOR);
+	}
+
+	free(nodesJSON);
+}
+
+
 /*
  * keeper_cli_monitor_node_active contacts the monitor with the current state
  * of the keeper and get an assigned state from there.
@@ -574,7 +683,9 @@ cli_do_monitor_node_active(int argc, char **argv)
 							 keeper.postgres.pgIsRunning,
 							 keeper.postgres.postgresSetup.control.timeline_id,
 							 keeper.postgres.currentLSN,
+							 keeper.postgres.replayLSN,
 							 keeper.postgres.pgsrSyncState,
+							 NULL,
 							 &assignedState))
 	{
 		log_fatal("Failed to get the goal state from the node with the monitor, "
@@ -663,7 +774,8 @@ cli_do_monitor_version(int argc, char **argv)
  * by the monitor LISTEN/NOTIFY protocol on the state channel, such as:
  *
  *   {
- *     "type": "state", "formation": "default", "groupId": 0, "nodeId": 1,
+ *     "type": "state", "eventId": 42,
+ *     "formation": "default", "groupId": 0, "nodeId": 1,
  *     "name": "node_1", "host": "localhost", "port": 5001,
  *     "reportedState": "maintenance", "goalState": "maintenance"
  *   }
@@ -696,6 +808,7 @@ cli_do_monitor_parse_notification(int argc, char **argv)
 	json_object_set_string(root, "hostname", nodeState.node.host);
 	json_object_set_number(root, "port", (double) nodeState.node.port);
 	json_object_set_string(root, "formationid", nodeState.formation);
+	json_object_set_number(root, "eventId", (double) nodeState.eventId);
 	json_object_set_string(root, "reportedState",
 						   NodeStateToString(nodeState.reportedState));
 	json_object_set_string(root, "goalState",
@@ -703,3 +816,258 @@ cli_do_monitor_parse_notification(int argc, char **argv)
 
 	(void) cli_pprint_json(js);
 }
+
+
+/*
+ * cli_do_monitor_stream_events_getopts parses the command line options for
+ * the command `pg_autoctl do monitor stream-events`.
+ */
+static int
+cli_do_monitor_stream_events_getopts(int argc, char **argv)
+{
+	KeeperConfig options = { 0 };
+	int c, option_index = 0, errors = 0;
+	int verboseCount = 0;
+
+	static struct option long_options[] = {
+		{ "pgdata", required_argument, NULL, 'D' },
+		{ "monitor", required_argument, NULL, 'm' },
+		{ "slot", required_argument, NULL, 's' },
+		{ "drop", no_argument, NULL, 'd' },
+		{ "version", no_argument, NULL, 'V' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "quiet", no_argument, NULL, 'q' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	optind = 0;
+
+	while ((c = getopt_long(argc, argv, "D:m:s:dVvqh",
+							long_options, &option_index)) != -1)
+	{
+		switch (c)
+		{
+			case 'D':
+			{
+				strlcpy(options.pgSetup.pgdata, optarg, MAXPGPATH);
+				log_trace("--pgdata %s", options.pgSetup.pgdata);
+				break;
+			}
+
+			case 'm':
+			{
+				if (!validate_connection_string(optarg))
+				{
+					log_fatal("Failed to parse --monitor connection string, "
+							  "see above for details.");
+					exit(EXIT_CODE_BAD_ARGS);
+				}
+				strlcpy(options.monitor_pguri, optarg, MAXCONNINFO);
+				log_trace("--monitor %s", options.monitor_pguri);
+				break;
+			}
+
+			case 's':
+			{
+				strlcpy(streamEventsSlotName, optarg, NAMEDATALEN);
+				log_trace("--slot %s", streamEventsSlotName);
+				break;
+			}
+
+			case 'd':
+			{
+				streamEventsDropSlot = true;
+				log_trace("--drop");
+				break;
+			}
+
+			case 'V':
+			{
+				/* keeper_cli_print_version prints version and exits. */
+				keeper_cli_print_version(argc, argv);
+				break;
+			}
+
+			case 'v':
+			{
+				++verboseCount;
+				switch (verboseCount)
+				{
+					case 1:
+					{
+						log_set_level(LOG_INFO);
+						break;
+					}
+
+					case 2:
+					{
+						log_set_level(LOG_DEBUG);
+						break;
+					}
+
+					default:
+					{
+						log_set_level(LOG_TRACE);
+						break;
+					}
+				}
+				break;
+			}
+
+			case 'q':
+			{
+				log_set_level(LOG_ERROR);
+				break;
+			}
+
+			case 'h':
+			{
+				commandline_help(stderr);
+				exit(EXIT_CODE_QUIT);
+				break;
+			}
+
+			default:
+			{
+				/* getopt_long already wrote an error message */
+				errors++;
+			}
+		}
+	}
+
+	if (IS_EMPTY_STRING_BUFFER(streamEventsSlotName))
+	{
+		log_error("Option --slot is mandatory");
+		errors++;
+	}
+
+	if (errors > 0)
+	{
+		commandline_help(stderr);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	/* when we have a monitor URI we don't need PGDATA */
+	if (cli_use_monitor_option(&options))
+	{
+		if (!IS_EMPTY_STRING_BUFFER(options.pgSetup.pgdata))
+		{
+			log_warn("Given --monitor URI, the --pgdata option is ignored");
+			log_info("Connecting to monitor at \"%s\"", options.monitor_pguri);
+		}
+	}
+	else
+	{
+		cli_common_get_set_pgdata_or_exit(&(options.pgSetup));
+	}
+
+	keeperOptions = options;
+
+	return optind;
+}
+
+
+/*
+ * cli_do_monitor_stream_events prints the monitor events as JSON lines, from
+ * a logical replication slot that the monitor keeps for us, which is created
+ * the first time. Events are printed in commit order, and acknowledged once
+ * printed, so that the next run of the command starts where this one stopped.
+ *
+ * Every event on the monitor comes with a state change notification, so once
+ * we have printed the events that were pending, we only read the replication
+ * slot again when we receive one, and every STREAM_EVENTS_INTERVAL_MS.
+ */
+static void
+cli_do_monitor_stream_events(int argc, char **argv)
+{
+	KeeperConfig config = keeperOptions;
+	Monitor monitor = { 0 };
+
+	char *slotName = streamEventsSlotName;
+
+	(void) cli_monitor_init_from_option_or_config(&monitor, &config);
+
+	if (streamEventsDropSlot)
+	{
+		if (!monitor_drop_event_stream(&monitor, slotName))
+		{
+			/* errors have already been logged */
+			exit(EXIT_CODE_MONITOR);
+		}
+
+		log_info("Dropped the event stream replication slot \"%s\"", slotName);
+		exit(EXIT_CODE_QUIT);
+	}
+
+	if (!monitor_create_event_stream(&monitor, slotName))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_MONITOR);
+	}
+
+	/* only stop in between reading events and acknowledging them */
+	(void) set_signal_handlers(false);
+
+	bool listening = true;
+	bool eventsNeedUpdate = true;
+	instr_time updateTime;
+
+	INSTR_TIME_SET_ZERO(updateTime);
+
+	while (!(asked_to_stop || asked_to_stop_fast || asked_to_quit))
+	{
+		instr_time elapsed;
+
+		if (listening)
+		{
+			listening =
+				monitor_poll_state_notifications(
+					&monitor,
+					config.formation,
+					-1,
+					(void *) &eventsNeedUpdate,
+					&cli_do_monitor_stream_events_notification);
+		}
+
+		INSTR_TIME_SET_CURRENT(elapsed);
+		INSTR_TIME_SUBTRACT(elapsed, updateTime);
+
+		if (eventsNeedUpdate ||
+			INSTR_TIME_GET_MILLISEC(elapsed) >= STREAM_EVENTS_INTERVAL_MS)
+		{
+			int eventCount = 0;
+
+			eventsNeedUpdate = false;
+			INSTR_TIME_SET_CURRENT(updateTime);
+
+			/* errors have already been logged, try again later */
+			if (monitor_stream_slot_events(&monitor, slotName, &eventCount))
+			{
+				log_debug("Streamed %d events from replication slot \"%s\"",
+						  eventCount, slotName);
+			}
+
+			/* LISTEN again when the notification connection failed */
+			listening = true;
+		}
+
+		pg_usleep(100 * 1000);
+	}
+
+	pgsql_finish(&(monitor.notificationClient));
+}
+
+
+/*
+ * cli_do_monitor_stream_events_notification is a Notification Processing
+ * Function that registers that new events are available on the monitor.
+ */
+static void
+cli_do_monitor_stream_events_notification(void *context,
+										  CurrentNodeState *nodeState)
+{
+	bool *eventsNeedUpdate = (bool *) context;
+
+	*eventsNeedUpdate = true;
+}
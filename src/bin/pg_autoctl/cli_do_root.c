@@ -575,9 +575,12 @@ CommandLine *do_subcommands[] = {
 	&do_pgsetup_commands,
 	&do_service_postgres_ctl_commands,
 	&do_service_commands,
+	&do_profile_command,
 	&do_tmux_commands,
 	&do_azure_commands,
 	&do_demo_commands,
+	&do_bench_commands,
+	&do_selftest_command,
 	NULL
 };
 
@@ -607,6 +610,7 @@ keeper_cli_keeper_setup_getopts(int argc, char **argv)
 		{ "username", required_argument, NULL, 'U' },
 		{ "auth", required_argument, NULL, 'A' },
 		{ "skip-pg-hba", no_argument, NULL, 'S' },
+		{ "tuning-profile", required_argument, NULL, 'T' },
 		{ "dbname", required_argument, NULL, 'd' },
 		{ "hostname", required_argument, NULL, 'n' },
 		{ "formation", required_argument, NULL, 'f' },
@@ -642,7 +646,7 @@ keeper_cli_keeper_setup_getopts(int argc, char **argv)
 
 	int optind = cli_common_keeper_getopts(argc, argv,
 										   long_options,
-										   "C:D:H:p:l:U:A:SLd:n:f:m:MRVvqhP:r:xsN",
+										   "C:D:H:p:l:U:A:SLT:d:n:f:m:MRVvqhP:r:xsN",
 										   &options,
 										   &sslCommandLineOptions);
 
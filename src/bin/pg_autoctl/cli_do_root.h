@@ -22,6 +22,7 @@ extern CommandLine do_monitor_commands;
 /* src/bin/pg_autoctl/cli_do_service.c */
 extern CommandLine do_service_commands;
 extern CommandLine do_service_postgres_ctl_commands;
+extern CommandLine do_profile_command;
 
 /* src/bin/pg_autoctl/cli_do_show.c */
 extern CommandLine do_show_commands;
@@ -32,6 +33,12 @@ extern CommandLine do_service_commands;
 /* src/bin/pg_autoctl/cli_do_demo.c */
 extern CommandLine do_demo_commands;
 
+/* src/bin/pg_autoctl/cli_do_bench.c */
+extern CommandLine do_bench_commands;
+
+/* src/bin/pg_autoctl/cli_do_selftest.c */
+extern CommandLine do_selftest_command;
+
 /* src/bin/pg_autoctl/cli_do_root.c */
 extern CommandLine do_primary_adduser;
 extern CommandLine *do_primary_adduser_subcommands[];
@@ -0,0 +1,1491 @@
+/*
+ * src/bin/pg_autoctl/cli_do_selftest.c
+ *     Implementation of unit tests of pg_autoctl internal functions, that
+ *     don't need a Postgres instance or a monitor.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "postgres_fe.h"
+#include "pqexpbuffer.h"
+
+#include "cli_common.h"
+#include "cli_do_root.h"
+#include "commandline.h"
+#include "controlfile.h"
+#include "defaults.h"
+#include "env_utils.h"
+#include "file_utils.h"
+#include "ini_file.h"
+#include "keeper_metrics.h"
+#include "keeper_profile.h"
+#include "log.h"
+#include "parallel_clone.h"
+#include "parsing.h"
+#include "pgsetup.h"
+#include "pgsql.h"
+#include "prewarm.h"
+#include "signals.h"
+#include "string_utils.h"
+
+
+/*
+ * A self test suite returns false when any of its checks failed, after having
+ * logged the failed checks.
+ */
+typedef bool (*SelfTestFunction)(const char *tmpdir);
+
+typedef struct SelfTestSuite
+{
+	const char *name;
+	SelfTestFunction function;
+} SelfTestSuite;
+
+/* count the failed checks of the current suite */
+static int selfTestFailures = 0;
+
+#define SELFTEST_CHECK(condition) \
+	selftest_check((condition), #condition, __FILE__, __LINE__)
+
+static void cli_do_selftest(int argc, char **argv);
+static bool selftest_run_suite(SelfTestSuite *suite);
+static bool selftest_check(bool condition, const char *text,
+						   const char *file, int line);
+
+static bool selftest_pgsetup(const char *tmpdir);
+static bool selftest_controlfile(const char *tmpdir);
+static bool selftest_filetail(const char *tmpdir);
+static bool selftest_uri(const char *tmpdir);
+static bool selftest_ini(const char *tmpdir);
+static bool selftest_metrics(const char *tmpdir);
+static bool selftest_prewarm(const char *tmpdir);
+static bool selftest_clone(const char *tmpdir);
+static bool selftest_profile(const char *tmpdir);
+
+static void selftest_controlfile_contents(char *contents, uint32_t version,
+										  size_t crcOffset);
+static bool selftest_read_file_tail(const char *filePath,
+								   long maxBytes, int maxLines,
+								   const char *expected, bool expectedTruncated);
+static bool selftest_hostnames_from_uri(const char *pguri, const char *expected);
+static bool selftest_build_uri(const char *pguri, const char *expected);
+
+/* a configuration with many options, to check our INI options index */
+#define SELFTEST_INI_OPTIONS 100
+
+typedef struct SelfTestIniConfig
+{
+	char sections[8][NAMEDATALEN];
+	char names[SELFTEST_INI_OPTIONS][NAMEDATALEN];
+	char values[SELFTEST_INI_OPTIONS][NAMEDATALEN];
+	IniOption options[SELFTEST_INI_OPTIONS + 1];
+} SelfTestIniConfig;
+
+static void selftest_ini_config(SelfTestIniConfig *config);
+static bool selftest_ini_same_index(SelfTestIniConfig *a, IniOptionIndex *indexA,
+									SelfTestIniConfig *b, IniOptionIndex *indexB);
+static bool selftest_metrics_contains(KeeperMetrics *metrics, const char *line);
+static bool selftest_prewarm_block(PrewarmBlock *block, uint32_t database,
+								   uint32_t filenode, uint32_t forknum,
+								   uint32_t blocknum);
+static bool selftest_backup_rate(const char *rate, uint64_t expected);
+static bool selftest_profile_calls(const char *report, const char *phase,
+								   long expected);
+
+static SelfTestSuite selfTestSuites[] = {
+	{ "pgsetup", &selftest_pgsetup },
+	{ "controlfile", &selftest_controlfile },
+	{ "filetail", &selftest_filetail },
+	{ "uri", &selftest_uri },
+	{ "ini", &selftest_ini },
+	{ "metrics", &selftest_metrics },
+	{ "prewarm", &selftest_prewarm },
+	{ "clone", &selftest_clone },
+	{ "profile", &selftest_profile },
+	{ NULL, NULL }
+};
+
+CommandLine do_selftest_command =
+	make_command("selftest",
+				 "Run unit tests of pg_autoctl internal functions",
+				 "[ suite ... ]",
+				 "  suite      pgsetup, controlfile, filetail, uri, ini,\n"
+				 "             metrics, prewarm, clone, profile,\n"
+				 "             defaults to all of them\n",
+				 NULL, cli_do_selftest);
+
+
+/*
+ * cli_do_selftest runs the given self test suites, or all of them, and exits
+ * with a non-zero code when any of them failed.
+ */
+static void
+cli_do_selftest(int argc, char **argv)
+{
+	int failedCount = 0;
+
+	for (int arg = 0; arg < argc; arg++)
+	{
+		bool found = false;
+
+		for (SelfTestSuite *suite = selfTestSuites; suite->name; suite++)
+		{
+			if (strcmp(suite->name, argv[arg]) == 0)
+			{
+				found = true;
+				break;
+			}
+		}
+
+		if (!found)
+		{
+			log_error("Unknown self test suite \"%s\"", argv[arg]);
+			commandline_print_usage(&do_selftest_command, stderr);
+			exit(EXIT_CODE_BAD_ARGS);
+		}
+	}
+
+	for (SelfTestSuite *suite = selfTestSuites; suite->name; suite++)
+	{
+		bool selected = argc == 0;
+
+		for (int arg = 0; arg < argc && !selected; arg++)
+		{
+			selected = strcmp(suite->name, argv[arg]) == 0;
+		}
+
+		if (selected && !selftest_run_suite(suite))
+		{
+			++failedCount;
+		}
+	}
+
+	if (failedCount > 0)
+	{
+		log_fatal("%d self test suite(s) failed, see above for details",
+				  failedCount);
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+}
+
+
+/*
+ * selftest_run_suite runs a self test suite in its own temporary directory,
+ * and prints its result.
+ */
+static bool
+selftest_run_suite(SelfTestSuite *suite)
+{
+	char tmpdir[MAXPGPATH] = { 0 };
+
+	sformat(tmpdir, sizeof(tmpdir), "/tmp/pg_autoctl.selftest.XXXXXX");
+
+	if (mkdtemp(tmpdir) == NULL)
+	{
+		log_error("Failed to create a temporary directory: %m");
+		return false;
+	}
+
+	selfTestFailures = 0;
+
+	bool success = (*suite->function)(tmpdir) && selfTestFailures == 0;
+
+	if (!rmtree(tmpdir, true))
+	{
+		log_warn("Failed to remove temporary directory \"%s\"", tmpdir);
+	}
+
+	fformat(stdout, "%-12s %s\n", suite->name, success ? "ok" : "FAILED");
+
+	return success;
+}
+
+
+/*
+ * selftest_check logs a failed check, and returns the condition.
+ */
+static bool
+selftest_check(bool condition, const char *text, const char *file, int line)
+{
+	if (!condition)
+	{
+		log_error("%s:%d: check failed: %s", file, line, text);
+		++selfTestFailures;
+	}
+
+	return condition;
+}
+
+
+/*
+ * selftest_pgsetup checks which host pg_setup_get_local_host() picks for the
+ * local connections, depending on our pghost setting and the socket
+ * directory found in the Postgres pidfile.
+ */
+static bool
+selftest_pgsetup(const char *tmpdir)
+{
+	PostgresSetup pgSetup = { 0 };
+	char host[MAXPGPATH] = { 0 };
+	char socketPath[MAXPGPATH] = { 0 };
+	bool unixSocket = false;
+
+	char regressSockDir[MAXPGPATH] = { 0 };
+	bool hadRegressSockDir = env_exists("PG_REGRESS_SOCK_DIR");
+
+	if (hadRegressSockDir &&
+		!get_env_copy("PG_REGRESS_SOCK_DIR", regressSockDir, MAXPGPATH))
+	{
+		return false;
+	}
+
+	unsetenv("PG_REGRESS_SOCK_DIR");
+
+	pgSetup.pgport = 5432;
+	strlcpy(pgSetup.pidFile.socketDir, tmpdir, MAXPGPATH);
+	sformat(socketPath, sizeof(socketPath), "%s/.s.PGSQL.%d",
+			tmpdir, pgSetup.pgport);
+
+	/* no pghost: libpq default socket directory */
+	(void) pg_setup_get_local_host(&pgSetup, host, sizeof(host), &unixSocket);
+	SELFTEST_CHECK(unixSocket && IS_EMPTY_STRING_BUFFER(host));
+
+	/* a socket directory is used as is */
+	strlcpy(pgSetup.pghost, "/var/run/postgresql", _POSIX_HOST_NAME_MAX);
+	(void) pg_setup_get_local_host(&pgSetup, host, sizeof(host), &unixSocket);
+	SELFTEST_CHECK(unixSocket && strcmp(host, "/var/run/postgresql") == 0);
+	SELFTEST_CHECK(!pg_setup_local_socket_preferred(&pgSetup));
+
+	/* a TCP hostname, and Postgres has no socket for our port */
+	strlcpy(pgSetup.pghost, "localhost", _POSIX_HOST_NAME_MAX);
+	(void) pg_setup_get_local_host(&pgSetup, host, sizeof(host), &unixSocket);
+	SELFTEST_CHECK(!unixSocket && strcmp(host, "localhost") == 0);
+	SELFTEST_CHECK(!pg_setup_local_socket_preferred(&pgSetup));
+
+	/* a TCP hostname, and Postgres has a socket for our port */
+	if (!write_file("", 0, socketPath))
+	{
+		return false;
+	}
+
+	(void) pg_setup_get_local_host(&pgSetup, host, sizeof(host), &unixSocket);
+	SELFTEST_CHECK(unixSocket && strcmp(host, tmpdir) == 0);
+	SELFTEST_CHECK(pg_setup_local_socket_preferred(&pgSetup));
+
+	/* another port */
+	pgSetup.pgport = 5433;
+	(void) pg_setup_get_local_host(&pgSetup, host, sizeof(host), &unixSocket);
+	SELFTEST_CHECK(!unixSocket && strcmp(host, "localhost") == 0);
+	pgSetup.pgport = 5432;
+
+	/* the connection through the socket failed: back to TCP */
+	(void) pg_setup_reject_local_socket(&pgSetup, true);
+	(void) pg_setup_get_local_host(&pgSetup, host, sizeof(host), &unixSocket);
+	SELFTEST_CHECK(!unixSocket && strcmp(host, "localhost") == 0);
+	SELFTEST_CHECK(!pg_setup_local_socket_preferred(&pgSetup));
+
+	(void) pg_setup_reject_local_socket(&pgSetup, false);
+	(void) pg_setup_get_local_host(&pgSetup, host, sizeof(host), &unixSocket);
+	SELFTEST_CHECK(unixSocket && strcmp(host, tmpdir) == 0);
+
+	/* PG_REGRESS_SOCK_DIR set to an empty value forces TCP */
+	setenv("PG_REGRESS_SOCK_DIR", "", 1);
+
+	(void) pg_setup_get_local_host(&pgSetup, host, sizeof(host), &unixSocket);
+	SELFTEST_CHECK(!unixSocket && strcmp(host, "localhost") == 0);
+
+	memset(pgSetup.pghost, 0, sizeof(pgSetup.pghost));
+	(void) pg_setup_get_local_host(&pgSetup, host, sizeof(host), &unixSocket);
+	SELFTEST_CHECK(!unixSocket && strcmp(host, "localhost") == 0);
+
+	if (hadRegressSockDir)
+	{
+		setenv("PG_REGRESS_SOCK_DIR", regressSockDir, 1);
+	}
+	else
+	{
+		unsetenv("PG_REGRESS_SOCK_DIR");
+	}
+
+	return true;
+}
+
+
+/*
+ * selftest_controlfile checks that controlfile_read() finds the CRC of a
+ * Postgres control file where it is stored, and refuses truncated or
+ * corrupted files.
+ */
+static bool
+selftest_controlfile(const char *tmpdir)
+{
+	char globalDir[MAXPGPATH] = { 0 };
+	char controlPath[MAXPGPATH] = { 0 };
+	char contents[PG_CONTROL_FILE_SIZE] = { 0 };
+	PostgresControlData control = { 0 };
+
+	join_path_components(globalDir, tmpdir, "global");
+	join_path_components(controlPath, globalDir, "pg_control");
+
+	if (!ensure_empty_dir(globalDir, 0700))
+	{
+		return false;
+	}
+
+	/* the CRC-32C check value, see the crc catalogue */
+	SELFTEST_CHECK(controlfile_crc32c("123456789", 9) == 0xE3069283);
+
+	/* a Postgres 13 control file, crc field at offset 296 */
+	selftest_controlfile_contents(contents, 1300, 296);
+
+	if (!write_file(contents, sizeof(contents), controlPath))
+	{
+		return false;
+	}
+
+	SELFTEST_CHECK(controlfile_read(tmpdir, &control) == CONTROL_FILE_OK);
+	SELFTEST_CHECK(control.system_identifier == 7200000000000000042);
+	SELFTEST_CHECK(control.pg_control_version == 1300);
+	SELFTEST_CHECK(control.catalog_version_no == 202007201);
+	SELFTEST_CHECK(control.state == DB_IN_PRODUCTION);
+	SELFTEST_CHECK(control.timeline_id == 3);
+	SELFTEST_CHECK(strcmp(control.latestCheckpointLSN, "1/5000028") == 0);
+
+	/* the crc field is found wherever it is, before the safe size */
+	selftest_controlfile_contents(contents, 1700, 504);
+
+	if (!write_file(contents, sizeof(contents), controlPath))
+	{
+		return false;
+	}
+
+	SELFTEST_CHECK(controlfile_read(tmpdir, &control) == CONTROL_FILE_OK);
+	SELFTEST_CHECK(control.pg_control_version == 1700);
+
+	/* a Postgres 10 control file has the prevCheckPoint field */
+	selftest_controlfile_contents(contents, 1002, 296);
+
+	if (!write_file(contents, sizeof(contents), controlPath))
+	{
+		return false;
+	}
+
+	SELFTEST_CHECK(controlfile_read(tmpdir, &control) == CONTROL_FILE_OK);
+	SELFTEST_CHECK(control.timeline_id == 3);
+	SELFTEST_CHECK(strcmp(control.latestCheckpointLSN, "1/5000028") == 0);
+
+	/* a truncated file */
+	selftest_controlfile_contents(contents, 1300, 296);
+
+	if (!write_file(contents, 300, controlPath))
+	{
+		return false;
+	}
+
+	SELFTEST_CHECK(controlfile_read(tmpdir, &control) == CONTROL_FILE_ERROR);
+
+	/* a corrupted byte in the fields covered by the CRC */
+	contents[100] ^= 0x01;
+
+	if (!write_file(contents, sizeof(contents), controlPath))
+	{
+		return false;
+	}
+
+	SELFTEST_CHECK(controlfile_read(tmpdir, &control) == CONTROL_FILE_ERROR);
+
+	/* a corrupted CRC */
+	selftest_controlfile_contents(contents, 1300, 296);
+	contents[296] ^= 0x01;
+
+	if (!write_file(contents, sizeof(contents), controlPath))
+	{
+		return false;
+	}
+
+	SELFTEST_CHECK(controlfile_read(tmpdir, &control) == CONTROL_FILE_ERROR);
+
+	/* a control file version we don't know about */
+	selftest_controlfile_contents(contents, 1900, 296);
+
+	if (!write_file(contents, sizeof(contents), controlPath))
+	{
+		return false;
+	}
+
+	SELFTEST_CHECK(controlfile_read(tmpdir, &control) ==
+				   CONTROL_FILE_UNKNOWN_VERSION);
+
+	/* no control file at all */
+	(void) unlink(controlPath);
+
+	SELFTEST_CHECK(controlfile_read(tmpdir, &control) == CONTROL_FILE_ERROR);
+
+	return true;
+}
+
+
+/*
+ * selftest_controlfile_contents prepares the contents of a control file with
+ * the layout of the given pg_control_version, and its CRC stored at the given
+ * offset.
+ */
+static void
+selftest_controlfile_contents(char *contents, uint32_t version,
+							  size_t crcOffset)
+{
+	uint64_t systemIdentifier = 7200000000000000042;
+	uint32_t catalogVersion = 202007201;
+	int32_t state = DB_IN_PRODUCTION;
+	int64_t time = 1700000000;
+	uint64_t checkPoint = UINT64_C(0x105000028);
+	uint64_t redo = UINT64_C(0x105000028);
+	uint32_t timeline = 3;
+
+	/* Postgres 10 and earlier have the prevCheckPoint field */
+	size_t checkPointCopyOffset = version < 1100 ? 48 : 40;
+
+	memset(contents, 0, PG_CONTROL_FILE_SIZE);
+
+	memcpy(contents + 0, &systemIdentifier, sizeof(uint64_t));
+	memcpy(contents + 8, &version, sizeof(uint32_t));
+	memcpy(contents + 12, &catalogVersion, sizeof(uint32_t));
+	memcpy(contents + 16, &state, sizeof(int32_t));
+	memcpy(contents + 24, &time, sizeof(int64_t));
+	memcpy(contents + 32, &checkPoint, sizeof(uint64_t));
+	memcpy(contents + checkPointCopyOffset, &redo, sizeof(uint64_t));
+	memcpy(contents + checkPointCopyOffset + 8, &timeline, sizeof(uint32_t));
+
+	/* some non-zero data after the fields that controlfile_read() uses */
+	for (size_t offset = checkPointCopyOffset + 16; offset < crcOffset; offset++)
+	{
+		contents[offset] = (char) (offset * 7);
+	}
+
+	uint32_t crc = controlfile_crc32c(contents, crcOffset);
+
+	memcpy(contents + crcOffset, &crc, sizeof(uint32_t));
+}
+
+
+/*
+ * selftest_filetail checks that read_file_tail() returns the last lines of a
+ * file, beginning with a whole line, within the given limits.
+ */
+static bool
+selftest_filetail(const char *tmpdir)
+{
+	char filePath[MAXPGPATH] = { 0 };
+	char lines[] = "line 1\nline 2\nline 3\n";
+
+	join_path_components(filePath, tmpdir, "tail.log");
+
+	if (!write_file(lines, strlen(lines), filePath))
+	{
+		return false;
+	}
+
+	/* the file is smaller than the tail */
+	SELFTEST_CHECK(selftest_read_file_tail(filePath, 1024, 10, lines, false));
+
+	/* maxLines stops the tail */
+	SELFTEST_CHECK(selftest_read_file_tail(filePath, 1024, 2,
+										   "line 2\nline 3\n", true));
+	SELFTEST_CHECK(selftest_read_file_tail(filePath, 1024, 3, lines, false));
+
+	/* maxBytes lands in the middle of a line, which is skipped */
+	SELFTEST_CHECK(selftest_read_file_tail(filePath, 10, 10, "line 3\n", true));
+	SELFTEST_CHECK(selftest_read_file_tail(filePath, 20, 10,
+										   "line 2\nline 3\n", true));
+	SELFTEST_CHECK(selftest_read_file_tail(filePath, 5, 10, "", true));
+
+	/* maxBytes lands at the beginning of a line, which is kept */
+	SELFTEST_CHECK(selftest_read_file_tail(filePath, 14, 10,
+										   "line 2\nline 3\n", true));
+
+	/* the last line has no newline */
+	char noNewLine[] = "line 1\nline 2";
+
+	if (!write_file(noNewLine, strlen(noNewLine), filePath))
+	{
+		return false;
+	}
+
+	SELFTEST_CHECK(selftest_read_file_tail(filePath, 1024, 1, "line 2", true));
+	SELFTEST_CHECK(selftest_read_file_tail(filePath, 1024, 2, noNewLine, false));
+
+	/* an empty file */
+	if (!write_file("", 0, filePath))
+	{
+		return false;
+	}
+
+	SELFTEST_CHECK(selftest_read_file_tail(filePath, 1024, 10, "", false));
+
+	/* a file that is read backwards in several blocks */
+	PQExpBuffer buffer = createPQExpBuffer();
+
+	for (int i = 1; i <= 1000; i++)
+	{
+		appendPQExpBuffer(buffer, "line %04d\n", i);
+	}
+
+	if (PQExpBufferBroken(buffer) ||
+		!write_file(buffer->data, buffer->len, filePath))
+	{
+		destroyPQExpBuffer(buffer);
+		return false;
+	}
+
+	SELFTEST_CHECK(selftest_read_file_tail(filePath, 1024 * 1024, 1000,
+										   buffer->data, false));
+	SELFTEST_CHECK(selftest_read_file_tail(filePath, 1024 * 1024, 2,
+										   "line 0999\nline 1000\n", true));
+
+	/* 3005 bytes are the last 300 lines and a half: 10 bytes per line */
+	SELFTEST_CHECK(selftest_read_file_tail(filePath, 3005, 1000,
+										   buffer->data + 7000, true));
+
+	destroyPQExpBuffer(buffer);
+
+	/* a file that does not exist */
+	char *contents = NULL;
+	long fileSize = 0;
+	bool truncated = false;
+
+	(void) unlink(filePath);
+
+	SELFTEST_CHECK(!read_file_tail(filePath, 1024, 10,
+								   &contents, &fileSize, &truncated));
+
+	return true;
+}
+
+
+/*
+ * selftest_read_file_tail calls read_file_tail() and compares its result with
+ * the expected contents and truncated flag.
+ */
+static bool
+selftest_read_file_tail(const char *filePath, long maxBytes, int maxLines,
+						const char *expected, bool expectedTruncated)
+{
+	char *contents = NULL;
+	long fileSize = 0;
+	bool truncated = false;
+
+	if (!read_file_tail(filePath, maxBytes, maxLines,
+						&contents, &fileSize, &truncated))
+	{
+		return false;
+	}
+
+	bool success = fileSize == (long) strlen(expected) &&
+				   strcmp(contents, expected) == 0 &&
+				   truncated == expectedTruncated;
+
+	if (!success)
+	{
+		log_error("read_file_tail(%ld, %d) returned %ld bytes%s: \"%s\"",
+				  maxBytes, maxLines, fileSize,
+				  truncated ? ", truncated" : "",
+				  contents);
+	}
+
+	free(contents);
+
+	return success;
+}
+
+
+/*
+ * selftest_uri checks how the hosts and ports of a connection string are
+ * parsed with hostnames_from_uri(), and how buildPostgresURIfromPieces()
+ * writes a connection string back from its parsed pieces.
+ */
+static bool
+selftest_uri(const char *tmpdir)
+{
+	/* one host, several hosts, with one port or a port per host */
+	SELFTEST_CHECK(selftest_hostnames_from_uri(
+					   "postgres://autoctl_node@monitor:6000/pg_auto_failover",
+					   "monitor 6000"));
+	SELFTEST_CHECK(selftest_hostnames_from_uri(
+					   "postgres://autoctl_node@m1:6000,m2:6001,m3/db",
+					   "m1 6000,m2 6001,m3 5432"));
+	SELFTEST_CHECK(selftest_hostnames_from_uri(
+					   "postgres://autoctl_node@m1,m2:6001/db",
+					   "m1 5432,m2 6001"));
+	SELFTEST_CHECK(selftest_hostnames_from_uri(
+					   "host=m1,m2,m3 port=6000 dbname=db",
+					   "m1 6000,m2 6000,m3 6000"));
+	SELFTEST_CHECK(selftest_hostnames_from_uri(
+					   "host=m1 hostaddr=10.0.0.1 dbname=db",
+					   "m1 5432"));
+
+	/* IPv6 addresses */
+	SELFTEST_CHECK(selftest_hostnames_from_uri(
+					   "postgres://autoctl_node@[::1]:6000,[2001:db8::1]/db",
+					   "::1 6000,2001:db8::1 5432"));
+
+	/* escaped hosts: a Unix socket directory */
+	SELFTEST_CHECK(selftest_hostnames_from_uri(
+					   "postgres://autoctl_node@%2Fvar%2Frun%2Fpostgresql:6000/db",
+					   "/var/run/postgresql 6000"));
+
+	/* invalid connection strings */
+	SELFTEST_CHECK(!selftest_hostnames_from_uri("host=m1 port=6000,6001", ""));
+	SELFTEST_CHECK(!selftest_hostnames_from_uri(
+					   "host=m1,m2,m3 port=6000,6001", ""));
+	SELFTEST_CHECK(!selftest_hostnames_from_uri("host=m1 port=abc", ""));
+	SELFTEST_CHECK(!selftest_hostnames_from_uri(
+					   "postgres://autoctl_node@[::1:6000/db", ""));
+	SELFTEST_CHECK(!selftest_hostnames_from_uri(
+					   "host=m1,m2,m3,m4,m5,m6,m7,m8,m9", ""));
+
+	/* one host, several hosts, with one port or a port per host */
+	SELFTEST_CHECK(selftest_build_uri(
+					   "postgres://autoctl_node@monitor:6000/pg_auto_failover"
+					   "?sslmode=require",
+					   "postgres://autoctl_node@monitor:6000/pg_auto_failover"
+					   "?sslmode=require"));
+	SELFTEST_CHECK(selftest_build_uri(
+					   "postgres://autoctl_node@m1:6000,m2:6001/db",
+					   "postgres://autoctl_node@m1:6000,m2:6001/db?"));
+	SELFTEST_CHECK(selftest_build_uri(
+					   "host=m1,m2 port=6000 user=autoctl_node dbname=db",
+					   "postgres://autoctl_node@m1:6000,m2:6000/db?"));
+
+	/* IPv6 addresses */
+	SELFTEST_CHECK(selftest_build_uri(
+					   "postgres://autoctl_node@[::1]:6000,[2001:db8::1]:6001/db",
+					   "postgres://autoctl_node@[::1]:6000,[2001:db8::1]:6001/db?"));
+
+	/* escaped pieces */
+	SELFTEST_CHECK(selftest_build_uri(
+					   "host=/var/run/postgresql port=6000 user=a@b "
+					   "dbname='my db' application_name='a&b=c' "
+					   "sslrootcert=/etc/ssl/root.crt",
+					   "postgres://a%40b@%2Fvar%2Frun%2Fpostgresql:6000/my%20db"
+					   "?application_name=a%26b%3Dc"
+					   "&sslrootcert=/etc/ssl/root.crt"));
+
+	return true;
+}
+
+
+/*
+ * selftest_hostnames_from_uri calls hostnames_from_uri() and compares the
+ * hosts and ports it found with the expected list, formatted as a comma
+ * separated list of "host port" items.
+ */
+static bool
+selftest_hostnames_from_uri(const char *pguri, const char *expected)
+{
+	URIHostArray hostArray = { 0 };
+	char hosts[BUFSIZE] = { 0 };
+
+	if (!hostnames_from_uri(pguri, &hostArray))
+	{
+		return false;
+	}
+
+	for (int i = 0; i < hostArray.count; i++)
+	{
+		sformat(hosts, sizeof(hosts), "%s%s%s %d",
+				hosts,
+				i == 0 ? "" : ",",
+				hostArray.hosts[i],
+				hostArray.ports[i]);
+	}
+
+	if (strcmp(hosts, expected) != 0)
+	{
+		log_error("hostnames_from_uri(\"%s\") returned \"%s\"", pguri, hosts);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * selftest_build_uri parses the given connection string and builds it back
+ * with buildPostgresURIfromPieces(), then checks that we get the expected
+ * URI, and that libpq parses it back to the same pieces.
+ */
+static bool
+selftest_build_uri(const char *pguri, const char *expected)
+{
+	URIParams params = { 0 };
+	URIParams builtParams = { 0 };
+	KeyVal overrides = { 0 };
+	char builtURI[MAXCONNINFO] = { 0 };
+
+	bool checkForCompleteURI = false;
+
+	if (!parse_pguri_info_key_vals(pguri, &overrides, &params,
+								   checkForCompleteURI) ||
+		!buildPostgresURIfromPieces(&params, builtURI))
+	{
+		return false;
+	}
+
+	if (strcmp(builtURI, expected) != 0)
+	{
+		log_error("buildPostgresURIfromPieces(\"%s\") returned \"%s\"",
+				  pguri, builtURI);
+		return false;
+	}
+
+	if (!parse_pguri_info_key_vals(builtURI, &overrides, &builtParams,
+								   checkForCompleteURI))
+	{
+		return false;
+	}
+
+	bool samePieces =
+		strcmp(params.hostname, builtParams.hostname) == 0 &&
+		strcmp(params.username, builtParams.username) == 0 &&
+		strcmp(params.dbname, builtParams.dbname) == 0 &&
+		params.parameters.count == builtParams.parameters.count;
+
+	for (int i = 0; samePieces && i < params.parameters.count; i++)
+	{
+		samePieces =
+			strcmp(params.parameters.keywords[i],
+				   builtParams.parameters.keywords[i]) == 0 &&
+			strcmp(params.parameters.values[i],
+				   builtParams.parameters.values[i]) == 0;
+	}
+
+	if (!samePieces)
+	{
+		log_error("Failed to parse \"%s\" back to the pieces of \"%s\"",
+				  builtURI, pguri);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * selftest_ini checks the hash table index of the INI options: identical
+ * configurations are indexed the same way, every option is found at its
+ * "section.name" path, and changed or unknown paths are not found.
+ */
+static bool
+selftest_ini(const char *tmpdir)
+{
+	SelfTestIniConfig *config = calloc(1, sizeof(SelfTestIniConfig));
+	SelfTestIniConfig *same = calloc(1, sizeof(SelfTestIniConfig));
+	IniOptionIndex index = { 0 };
+	IniOptionIndex sameIndex = { 0 };
+
+	if (config == NULL || same == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		free(config);
+		free(same);
+		return false;
+	}
+
+	selftest_ini_config(config);
+	selftest_ini_config(same);
+
+	SELFTEST_CHECK(ini_build_option_index(&index, config->options));
+	SELFTEST_CHECK(index.count == SELFTEST_INI_OPTIONS);
+
+	/* identical configurations have their options at the same buckets */
+	SELFTEST_CHECK(ini_build_option_index(&sameIndex, same->options));
+	SELFTEST_CHECK(selftest_ini_same_index(config, &index, same, &sameIndex));
+
+	/* every option is found, by section and name, and by path */
+	int foundCount = 0;
+
+	for (int i = 0; i < SELFTEST_INI_OPTIONS; i++)
+	{
+		IniOption *option = &(config->options[i]);
+		char path[BUFSIZE] = { 0 };
+
+		sformat(path, sizeof(path), "%s.%s", option->section, option->name);
+
+		if (ini_index_lookup_option(&index,
+									option->section, option->name) == option &&
+			ini_index_lookup_path(&index, path) == option &&
+			lookup_ini_option(config->options,
+							  option->section, option->name) == option &&
+			lookup_ini_path_value(config->options, path) == option)
+		{
+			++foundCount;
+		}
+	}
+
+	SELFTEST_CHECK(foundCount == SELFTEST_INI_OPTIONS);
+
+	/* paths that are close to an existing path are not found */
+	SELFTEST_CHECK(ini_index_lookup_path(&index, "section_0.option_000") != NULL);
+	SELFTEST_CHECK(ini_index_lookup_path(&index, "section_0.option_00") == NULL);
+	SELFTEST_CHECK(ini_index_lookup_path(&index, "section_0.option_0000") == NULL);
+	SELFTEST_CHECK(ini_index_lookup_path(&index, "section_1.option_000") == NULL);
+	SELFTEST_CHECK(ini_index_lookup_path(&index, "section_0option_000") == NULL);
+	SELFTEST_CHECK(ini_index_lookup_path(&index, "section_0") == NULL);
+	SELFTEST_CHECK(ini_index_lookup_path(&index, "") == NULL);
+	SELFTEST_CHECK(ini_index_lookup_option(&index,
+										   "section_0", "option_00") == NULL);
+	SELFTEST_CHECK(ini_index_lookup_option(&index,
+										   "section_0.option", "000") == NULL);
+
+	/* a changed configuration is indexed with its new option name */
+	strlcpy(same->names[42], "changed_042", NAMEDATALEN);
+
+	SELFTEST_CHECK(ini_build_option_index(&sameIndex, same->options));
+	SELFTEST_CHECK(!selftest_ini_same_index(config, &index, same, &sameIndex));
+	SELFTEST_CHECK(ini_index_lookup_option(&sameIndex,
+										   same->options[42].section,
+										   "option_042") == NULL);
+	SELFTEST_CHECK(ini_index_lookup_option(&sameIndex,
+										   same->options[42].section,
+										   "changed_042") == &(same->options[42]));
+	SELFTEST_CHECK(ini_index_lookup_option(&index,
+										   config->options[42].section,
+										   "option_042") == &(config->options[42]));
+
+	/* ini_merge finds the options to merge with the index */
+	strlcpy(same->names[42], "option_042", NAMEDATALEN);
+	strlcpy(same->values[42], "merged", NAMEDATALEN);
+	memset(same->values[7], 0, NAMEDATALEN);
+
+	SELFTEST_CHECK(ini_merge(config->options, same->options));
+	SELFTEST_CHECK(strcmp(config->values[42], "merged") == 0);
+	SELFTEST_CHECK(strcmp(config->values[7], "value_007") == 0);
+
+	/* the index has room for half of its buckets */
+	IniOption tooMany[INI_OPTION_INDEX_SIZE / 2 + 2] = { 0 };
+
+	for (int i = 0; i <= INI_OPTION_INDEX_SIZE / 2; i++)
+	{
+		tooMany[i] = config->options[i % SELFTEST_INI_OPTIONS];
+	}
+	tooMany[INI_OPTION_INDEX_SIZE / 2 + 1] =
+		(IniOption) INI_OPTION_LAST;
+
+	SELFTEST_CHECK(!ini_build_option_index(&sameIndex, tooMany));
+
+	free(config);
+	free(same);
+
+	return true;
+}
+
+
+/*
+ * selftest_ini_config prepares a configuration of SELFTEST_INI_OPTIONS string
+ * buffer options spread over a few sections.
+ */
+static void
+selftest_ini_config(SelfTestIniConfig *config)
+{
+	int sectionCount = sizeof(config->sections) / sizeof(config->sections[0]);
+
+	for (int s = 0; s < sectionCount; s++)
+	{
+		sformat(config->sections[s], NAMEDATALEN, "section_%d", s);
+	}
+
+	for (int i = 0; i < SELFTEST_INI_OPTIONS; i++)
+	{
+		sformat(config->names[i], NAMEDATALEN, "option_%03d", i);
+		sformat(config->values[i], NAMEDATALEN, "value_%03d", i);
+
+		config->options[i] = (IniOption)
+							 make_strbuf_option(config->sections[i % sectionCount],
+												config->names[i],
+												NULL, false, NAMEDATALEN,
+												config->values[i]);
+	}
+
+	config->options[SELFTEST_INI_OPTIONS] = (IniOption) INI_OPTION_LAST;
+}
+
+
+/*
+ * selftest_ini_same_index returns true when both indexes have the options of
+ * the same rank in their configuration at the same buckets.
+ */
+static bool
+selftest_ini_same_index(SelfTestIniConfig *a, IniOptionIndex *indexA,
+						SelfTestIniConfig *b, IniOptionIndex *indexB)
+{
+	if (indexA->count != indexB->count)
+	{
+		return false;
+	}
+
+	for (int bucket = 0; bucket < INI_OPTION_INDEX_SIZE; bucket++)
+	{
+		IniOption *optionA = indexA->buckets[bucket];
+		IniOption *optionB = indexB->buckets[bucket];
+
+		if ((optionA == NULL) != (optionB == NULL))
+		{
+			return false;
+		}
+
+		if (optionA != NULL && (optionA - a->options) != (optionB - b->options))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * selftest_metrics checks the keeper metrics file: the recorded metrics are
+ * found in a snapshot and in the Prometheus text that the metrics service
+ * sends, and the metrics are disabled when the file is missing or does not
+ * have the expected size.
+ */
+static bool
+selftest_metrics(const char *tmpdir)
+{
+	char filename[MAXPGPATH] = { 0 };
+	KeeperMetrics metrics = { 0 };
+
+	join_path_components(filename, tmpdir, KEEPER_METRICS_FILENAME);
+
+	/* without a metrics file, recording metrics does nothing */
+	SELFTEST_CHECK(!keeper_metrics_attach(filename));
+	SELFTEST_CHECK(!keeper_metrics_snapshot(&metrics));
+
+	(void) keeper_metrics_record_settings(true);
+
+	if (!keeper_metrics_create(filename) || !keeper_metrics_attach(filename))
+	{
+		return false;
+	}
+
+	SELFTEST_CHECK(keeper_metrics_snapshot(&metrics));
+	SELFTEST_CHECK(metrics.version == KEEPER_METRICS_VERSION);
+	SELFTEST_CHECK(metrics.settingsApplied == 0);
+	SELFTEST_CHECK(metrics.transitionCount == 0);
+
+	instr_time startTime;
+	KeeperTransition history = {
+		.current = INIT_STATE,
+		.assigned = SINGLE_STATE,
+		.startTime = 1000,
+		.endTime = 1002,
+		.retries = 2
+	};
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	(void) keeper_metrics_record_service_start(KEEPER_METRICS_SERVICE_NODE_ACTIVE);
+	(void) keeper_metrics_record_service_start(KEEPER_METRICS_SERVICE_NODE_ACTIVE);
+	(void) keeper_metrics_record_settings(true);
+	(void) keeper_metrics_record_settings(false);
+	(void) keeper_metrics_record_settings(false);
+	(void) keeper_metrics_record_state_write_skipped();
+
+	/* the same transition twice is one entry, then another transition */
+	(void) keeper_metrics_record_transition(INIT_STATE, SINGLE_STATE,
+											startTime, false, NULL);
+	(void) keeper_metrics_record_transition(INIT_STATE, SINGLE_STATE,
+											startTime, true, &history);
+	(void) keeper_metrics_record_transition(SINGLE_STATE, WAIT_PRIMARY_STATE,
+											startTime, true, NULL);
+
+	SELFTEST_CHECK(keeper_metrics_snapshot(&metrics));
+	SELFTEST_CHECK(metrics.changeCount % 2 == 0);
+	SELFTEST_CHECK(metrics.serviceStarts[KEEPER_METRICS_SERVICE_NODE_ACTIVE] == 2);
+	SELFTEST_CHECK(metrics.serviceStarts[KEEPER_METRICS_SERVICE_POSTGRES] == 0);
+	SELFTEST_CHECK(metrics.settingsApplied == 1);
+	SELFTEST_CHECK(metrics.settingsSkipped == 2);
+	SELFTEST_CHECK(metrics.stateWritesSkipped == 1);
+	SELFTEST_CHECK(metrics.transitionCount == 2);
+	SELFTEST_CHECK(metrics.transitions[0].duration.count == 2);
+	SELFTEST_CHECK(metrics.transitions[0].failures == 1);
+	SELFTEST_CHECK(metrics.transitions[0].lastRetries == 2);
+	SELFTEST_CHECK(metrics.transitions[1].duration.count == 1);
+	SELFTEST_CHECK(metrics.transitions[1].failures == 0);
+
+	metrics.currentRole = SINGLE_STATE;
+	metrics.assignedRole = SINGLE_STATE;
+	metrics.currentLSN = 2000;
+	metrics.replayLSN = 1500;
+
+	SELFTEST_CHECK(selftest_metrics_contains(&metrics,
+											 "pg_autoctl_keeper_state{state=\"single\"} 1"));
+	SELFTEST_CHECK(selftest_metrics_contains(&metrics,
+											 "pg_autoctl_keeper_settings_skipped_total 2"));
+	SELFTEST_CHECK(selftest_metrics_contains(&metrics,
+											 "pg_autoctl_keeper_postgres_replay_lag_bytes 500"));
+	SELFTEST_CHECK(selftest_metrics_contains(&metrics,
+											 "pg_autoctl_keeper_transition_duration_seconds_count"
+											 "{from=\"init\",to=\"single\"} 2"));
+	SELFTEST_CHECK(selftest_metrics_contains(&metrics,
+											 "pg_autoctl_keeper_transition_failures_total"
+											 "{from=\"init\",to=\"single\"} 1"));
+	SELFTEST_CHECK(selftest_metrics_contains(&metrics,
+											 "pg_autoctl_keeper_transition_last_retries"
+											 "{from=\"init\",to=\"single\"} 2"));
+	SELFTEST_CHECK(selftest_metrics_contains(&metrics,
+											 "pg_autoctl_keeper_service_starts_total"
+											 "{service=\"node-active\"} 2"));
+
+	/* a transition without history has no last start time */
+	SELFTEST_CHECK(!selftest_metrics_contains(&metrics,
+											  "pg_autoctl_keeper_transition_last_retries"
+											  "{from=\"single\",to=\"wait_primary\"}"));
+
+	/* the replay lag is not computed before Postgres reports a replay LSN */
+	metrics.replayLSN = 0;
+
+	SELFTEST_CHECK(selftest_metrics_contains(&metrics,
+											 "pg_autoctl_keeper_postgres_replay_lag_bytes 0"));
+
+	(void) keeper_metrics_detach();
+
+	SELFTEST_CHECK(!keeper_metrics_snapshot(&metrics));
+
+	/* a file that does not have the size of our metrics is not used */
+	if (!write_file("0", 1, filename))
+	{
+		return false;
+	}
+
+	SELFTEST_CHECK(!keeper_metrics_attach(filename));
+
+	return true;
+}
+
+
+/*
+ * selftest_metrics_contains returns true when the Prometheus text of the given
+ * metrics contains the given line.
+ */
+static bool
+selftest_metrics_contains(KeeperMetrics *metrics, const char *line)
+{
+	PQExpBuffer out = createPQExpBuffer();
+
+	if (out == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return false;
+	}
+
+	(void) keeper_metrics_format(metrics, "default", out);
+
+	bool found = false;
+	size_t length = strlen(line);
+
+	for (char *ptr = out->data; ptr != NULL && *ptr != '\0';)
+	{
+		char *next = strchr(ptr, '\n');
+
+		if (strncmp(ptr, line, length) == 0 &&
+			(ptr[length] == '\n' || ptr[length] == ' ' || ptr[length] == '\0'))
+		{
+			found = true;
+			break;
+		}
+
+		ptr = next == NULL ? NULL : next + 1;
+	}
+
+	destroyPQExpBuffer(out);
+
+	return found;
+}
+
+
+/*
+ * selftest_prewarm checks how we read the autoprewarm.blocks file of the
+ * primary: the blocks are sorted so that they can be loaded by ranges, the
+ * blocks of unknown relation forks are skipped, and a file that is not a
+ * block list is refused.
+ */
+static bool
+selftest_prewarm(const char *tmpdir)
+{
+	char filename[MAXPGPATH] = { 0 };
+	PrewarmBlockList list = { 0 };
+
+	join_path_components(filename, tmpdir, KEEPER_PREWARM_FILENAME);
+
+	/* fork number 7 is not known and skipped */
+	char blocks[] =
+		"<<6>>\n"
+		"16384,1663,16390,0,2\n"
+		"5,1663,1259,0,0\n"
+		"16384,1663,16390,7,0\n"
+		"16384,1663,16390,0,1\n"
+		"16384,1663,16385,1,0\n"
+		"16384,1663,16390,2,0\n";
+
+	if (!write_file(blocks, strlen(blocks), filename))
+	{
+		return false;
+	}
+
+	SELFTEST_CHECK(prewarm_read_block_list(filename, &list));
+	SELFTEST_CHECK(list.count == 5);
+	SELFTEST_CHECK(list.done == 0);
+
+	if (list.count == 5)
+	{
+		SELFTEST_CHECK(selftest_prewarm_block(&(list.blocks[0]), 5, 1259, 0, 0));
+		SELFTEST_CHECK(selftest_prewarm_block(&(list.blocks[1]),
+											  16384, 16385, 1, 0));
+		SELFTEST_CHECK(selftest_prewarm_block(&(list.blocks[2]),
+											  16384, 16390, 0, 1));
+		SELFTEST_CHECK(selftest_prewarm_block(&(list.blocks[3]),
+											  16384, 16390, 0, 2));
+		SELFTEST_CHECK(selftest_prewarm_block(&(list.blocks[4]),
+											  16384, 16390, 2, 0));
+	}
+
+	/* a new block list replaces the previous one, loaded or not */
+	char shorter[] =
+		"<<3>>\n"
+		"16384,1663,16390,0,4\n";
+
+	list.done = list.count;
+
+	if (!write_file(shorter, strlen(shorter), filename))
+	{
+		prewarm_free_block_list(&list);
+		return false;
+	}
+
+	SELFTEST_CHECK(prewarm_read_block_list(filename, &list));
+	SELFTEST_CHECK(list.count == 1);
+	SELFTEST_CHECK(list.done == 0);
+
+	/* lines past the count of the header are ignored */
+	char longer[] =
+		"<<1>>\n"
+		"16384,1663,16390,0,4\n"
+		"16384,1663,16390,0,5\n";
+
+	if (!write_file(longer, strlen(longer), filename))
+	{
+		prewarm_free_block_list(&list);
+		return false;
+	}
+
+	SELFTEST_CHECK(prewarm_read_block_list(filename, &list));
+	SELFTEST_CHECK(list.count == 1);
+
+	/* an empty dump is a valid block list */
+	if (!write_file("<<0>>\n", 6, filename))
+	{
+		prewarm_free_block_list(&list);
+		return false;
+	}
+
+	SELFTEST_CHECK(prewarm_read_block_list(filename, &list));
+	SELFTEST_CHECK(list.count == 0);
+
+	/* files that are not block lists keep the previous list */
+	char *invalid[] = {
+		"16384,1663,16390,0,4\n",
+		"<<2>>\n16384,1663,16390,0,4\n16384,1663\n",
+		""
+	};
+
+	if (!write_file(shorter, strlen(shorter), filename) ||
+		!prewarm_read_block_list(filename, &list))
+	{
+		prewarm_free_block_list(&list);
+		return false;
+	}
+
+	for (int i = 0; i < 3; i++)
+	{
+		if (!write_file(invalid[i], strlen(invalid[i]), filename))
+		{
+			prewarm_free_block_list(&list);
+			return false;
+		}
+
+		SELFTEST_CHECK(!prewarm_read_block_list(filename, &list));
+		SELFTEST_CHECK(list.count == 1);
+	}
+
+	prewarm_free_block_list(&list);
+
+	SELFTEST_CHECK(list.blocks == NULL);
+
+	return true;
+}
+
+
+/*
+ * selftest_prewarm_block returns true when the given block is the expected
+ * one, in the default tablespace.
+ */
+static bool
+selftest_prewarm_block(PrewarmBlock *block, uint32_t database,
+					   uint32_t filenode, uint32_t forknum, uint32_t blocknum)
+{
+	return block->database == database &&
+		   block->tablespace == 1663 &&
+		   block->filenode == filenode &&
+		   block->forknum == forknum &&
+		   block->blocknum == blocknum;
+}
+
+
+/*
+ * selftest_clone checks how a parallel clone shares the files of the upstream
+ * data directory among its jobs, and how the rate limit of the jobs is
+ * parsed.
+ */
+static bool
+selftest_clone(const char *tmpdir)
+{
+	CloneFile files[] = {
+		{ "base", 0, true, -1 },
+		{ "base/1/10", 40, false, -1 },
+		{ "base/1/11", 100, false, -1 },
+		{ "global/pg_control", 8192, false, -1 },
+		{ "base/1/12", 10, false, -1 },
+		{ "base/1/13", 60, false, -1 },
+		{ "base/1/14", 50, false, -1 }
+	};
+	CloneFileList list = { 7, 8452, files };
+	CloneJob jobs[3] = { 0 };
+
+	for (int i = 0; i < 3; i++)
+	{
+		jobs[i].index = i;
+	}
+
+	/* the biggest files go first, each to the job that has the least bytes */
+	parallel_clone_assign_jobs(&list, jobs, 3);
+
+	SELFTEST_CHECK(files[0].job == -1);
+	SELFTEST_CHECK(files[3].job == -1);
+
+	SELFTEST_CHECK(files[2].job == 0);
+	SELFTEST_CHECK(files[5].job == 1);
+	SELFTEST_CHECK(files[6].job == 2);
+	SELFTEST_CHECK(files[1].job == 2);
+	SELFTEST_CHECK(files[4].job == 1);
+
+	SELFTEST_CHECK(jobs[0].assignedBytes == 100);
+	SELFTEST_CHECK(jobs[1].assignedBytes == 70);
+	SELFTEST_CHECK(jobs[2].assignedBytes == 90);
+
+	/* a single job copies every file */
+	CloneJob job = { 0 };
+
+	parallel_clone_assign_jobs(&list, &job, 1);
+
+	SELFTEST_CHECK(files[1].job == 0 && files[4].job == 0);
+	SELFTEST_CHECK(files[3].job == -1);
+	SELFTEST_CHECK(job.assignedBytes == 260);
+
+	/* the rate is in kB per second unless a unit is given */
+	SELFTEST_CHECK(selftest_backup_rate("", 0));
+	SELFTEST_CHECK(selftest_backup_rate("100", 100 * 1024));
+	SELFTEST_CHECK(selftest_backup_rate("100k", 100 * 1024));
+	SELFTEST_CHECK(selftest_backup_rate("2M", 2 * 1024 * 1024));
+	SELFTEST_CHECK(selftest_backup_rate("1.5 k", 1536));
+
+	uint64_t rate = 0;
+
+	SELFTEST_CHECK(!parse_backup_rate("10G", &rate));
+	SELFTEST_CHECK(!parse_backup_rate("abc", &rate));
+	SELFTEST_CHECK(!parse_backup_rate("-1", &rate));
+	SELFTEST_CHECK(!parse_backup_rate("2 MB", &rate));
+
+	return true;
+}
+
+
+/*
+ * selftest_backup_rate returns true when the given rate is parsed to the
+ * expected count of bytes per second.
+ */
+static bool
+selftest_backup_rate(const char *rate, uint64_t expected)
+{
+	uint64_t bytesPerSecond = 1;
+
+	return parse_backup_rate(rate, &bytesPerSecond) &&
+		   bytesPerSecond == expected;
+}
+
+
+/*
+ * selftest_profile goes through a whole profile of the keeper main loop, as
+ * the node-active service does when pg_autoctl do profile signals it, and
+ * checks the report.
+ */
+static bool
+selftest_profile(const char *tmpdir)
+{
+	char pidfile[MAXPGPATH] = { 0 };
+	char requestFile[MAXPGPATH] = { 0 };
+	char reportFile[MAXPGPATH] = { 0 };
+
+	join_path_components(pidfile, tmpdir, "pg_autoctl.pid");
+
+	(void) keeper_profile_path(pidfile,
+							   KEEPER_PROFILE_REQUEST_FILENAME,
+							   requestFile);
+	(void) keeper_profile_path(pidfile,
+							   KEEPER_PROFILE_REPORT_FILENAME,
+							   reportFile);
+
+	/* profiling has not been asked for */
+	KeeperProfileMark mark = { 0 };
+
+	(void) keeper_profile_maintain(pidfile);
+	(void) keeper_profile_begin(&mark);
+
+	SELFTEST_CHECK(!keeper_profile_is_active());
+	SELFTEST_CHECK(!mark.active);
+
+	/* an invalid duration starts a profile of the default duration */
+	if (!write_file("abc\n", 4, requestFile))
+	{
+		return false;
+	}
+
+	asked_to_profile = 1;
+	(void) keeper_profile_maintain(pidfile);
+
+	SELFTEST_CHECK(keeper_profile_is_active());
+	SELFTEST_CHECK(!file_exists(requestFile));
+
+	/* a new request starts the profile again */
+	if (!write_file("1\n", 2, requestFile))
+	{
+		return false;
+	}
+
+	asked_to_profile = 1;
+	(void) keeper_profile_maintain(pidfile);
+
+	SELFTEST_CHECK(keeper_profile_is_active());
+
+	/* one loop iteration with two phases, one of them nested */
+	KeeperProfileMark loop = { 0 };
+	KeeperProfileMark nested = { 0 };
+
+	(void) keeper_profile_begin(&loop);
+	(void) keeper_profile_begin(&mark);
+	(void) keeper_profile_begin(&nested);
+	(void) keeper_profile_end(KEEPER_PROFILE_PHASE_REFRESH_HOOKS, &nested);
+	(void) keeper_profile_end(KEEPER_PROFILE_PHASE_NODE_ACTIVE, &mark);
+	(void) keeper_profile_begin(&mark);
+	(void) keeper_profile_end(KEEPER_PROFILE_PHASE_STATE_WRITE, &mark);
+	(void) keeper_profile_loop_end(&loop);
+
+	/* the report is written at the first loop after the duration */
+	(void) keeper_profile_maintain(pidfile);
+
+	SELFTEST_CHECK(keeper_profile_is_active());
+	SELFTEST_CHECK(!file_exists(reportFile));
+
+	pg_usleep(1100 * 1000);
+
+	(void) keeper_profile_maintain(pidfile);
+
+	SELFTEST_CHECK(!keeper_profile_is_active());
+
+	char *report = NULL;
+	long size = 0L;
+
+	if (!read_file(reportFile, &report, &size))
+	{
+		SELFTEST_CHECK(false);
+		return true;
+	}
+
+	SELFTEST_CHECK(strncmp(report, "pg_autoctl node-active service, pid ",
+						   36) == 0);
+
+	SELFTEST_CHECK(selftest_profile_calls(report, "node_active", 1));
+	SELFTEST_CHECK(selftest_profile_calls(report, "refresh hooks", 1));
+	SELFTEST_CHECK(selftest_profile_calls(report, "state write", 1));
+	SELFTEST_CHECK(selftest_profile_calls(report, "transition", 0));
+	SELFTEST_CHECK(selftest_profile_calls(report, "loop iterations", 1));
+
+	SELFTEST_CHECK(strstr(report,
+						  "\nChild processes exited:       0\n") != NULL);
+	SELFTEST_CHECK(strstr(report, "\nBlocks written:") != NULL);
+
+	free(report);
+
+	/* phases that began before the profile started are skipped */
+	if (!write_file("1\n", 2, requestFile))
+	{
+		return false;
+	}
+
+	(void) keeper_profile_begin(&mark);
+
+	asked_to_profile = 1;
+	(void) keeper_profile_maintain(pidfile);
+
+	(void) keeper_profile_end(KEEPER_PROFILE_PHASE_RELOAD, &mark);
+
+	pg_usleep(1100 * 1000);
+
+	(void) keeper_profile_maintain(pidfile);
+
+	if (!read_file(reportFile, &report, &size))
+	{
+		SELFTEST_CHECK(false);
+		return true;
+	}
+
+	SELFTEST_CHECK(selftest_profile_calls(report, "reload", 0));
+	SELFTEST_CHECK(selftest_profile_calls(report, "node_active", 0));
+
+	free(report);
+
+	return true;
+}
+
+
+/*
+ * selftest_profile_calls returns true when the given profile report counts
+ * the expected number of calls for the given phase.
+ */
+static bool
+selftest_profile_calls(const char *report, const char *phase, long expected)
+{
+	size_t length = strlen(phase);
+
+	for (const char *ptr = report; ptr != NULL && *ptr != '\0';)
+	{
+		const char *next = strchr(ptr, '\n');
+
+		/* the phase names are padded to 18 characters */
+		if (strncmp(ptr, phase, length) == 0 && ptr[length] == ' ')
+		{
+			return strtol(ptr + 18, NULL, 10) == expected;
+		}
+
+		ptr = next == NULL ? NULL : next + 1;
+	}
+
+	return false;
+}
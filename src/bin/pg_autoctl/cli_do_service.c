@@ -19,15 +19,20 @@
 #include "cli_common.h"
 #include "commandline.h"
 #include "defaults.h"
+#include "file_utils.h"
 #include "keeper_config.h"
 #include "keeper.h"
+#include "keeper_metrics.h"
+#include "keeper_profile.h"
 #include "monitor.h"
 #include "monitor_config.h"
 #include "pidfile.h"
 #include "service_keeper.h"
+#include "service_metrics.h"
 #include "service_monitor.h"
 #include "service_postgres_ctl.h"
 #include "signals.h"
+#include "string_utils.h"
 #include "supervisor.h"
 
 static void cli_do_service_postgres(int argc, char **argv);
@@ -47,6 +52,12 @@ static void cli_do_service_restart_node_active(int argc, char **argv);
 
 static void cli_do_service_monitor_listener(int argc, char **argv);
 static void cli_do_service_node_active(int argc, char **argv);
+static void cli_do_service_metrics(int argc, char **argv);
+
+static int cli_do_profile_getopts(int argc, char **argv);
+static void cli_do_profile(int argc, char **argv);
+
+static int profileDuration = KEEPER_PROFILE_DEFAULT_DURATION;
 
 CommandLine service_pgcontroller =
 	make_command("pgcontroller",
@@ -80,6 +91,14 @@ CommandLine service_node_active =
 				 cli_getopt_pgdata,
 				 cli_do_service_node_active);
 
+CommandLine service_metrics =
+	make_command("metrics",
+				 "pg_autoctl service that serves the keeper metrics over HTTP",
+				 CLI_PGDATA_USAGE,
+				 CLI_PGDATA_OPTION,
+				 cli_getopt_pgdata,
+				 cli_do_service_metrics);
+
 CommandLine service_getpid_postgres =
 	make_command("postgres",
 				 "Get the pid of the pg_autoctl postgres controller service",
@@ -160,6 +179,7 @@ static CommandLine *service[] = {
 	&service_postgres,
 	&service_monitor_listener,
 	&service_node_active,
+	&service_metrics,
 	NULL
 };
 
@@ -168,6 +188,15 @@ CommandLine do_service_commands =
 					 "Run pg_autoctl sub-processes (services)", NULL, NULL,
 					 NULL, service);
 
+CommandLine do_profile_command =
+	make_command("profile",
+				 "Profile the main loop of the running node-active service",
+				 " [ --pgdata ] [ --duration ] ",
+				 "  --pgdata      path to data directory\n"
+				 "  --duration    how long to profile, in seconds (60)\n",
+				 cli_do_profile_getopts,
+				 cli_do_profile);
+
 
 CommandLine service_postgres_ctl_on =
 	make_command("on",
@@ -432,6 +461,13 @@ cli_do_service_postgres(int argc, char **argv)
 		exit(EXIT_CODE_INTERNAL_ERROR);
 	}
 
+	/* when the metrics service is enabled, count our starts */
+	if (keeper_metrics_attach(pathnames.metrics))
+	{
+		(void) keeper_metrics_record_service_start(
+			KEEPER_METRICS_SERVICE_POSTGRES);
+	}
+
 	(void) service_postgres_ctl_loop(&postgres);
 }
 
@@ -588,3 +624,273 @@ cli_do_service_node_active(int argc, char **argv)
 	/* Start the node_active() protocol client */
 	(void) keeper_node_active_loop(&keeper, ppid);
 }
+
+
+/*
+ * cli_do_service_metrics starts the metrics service, that serves the keeper
+ * metrics over HTTP.
+ */
+static void
+cli_do_service_metrics(int argc, char **argv)
+{
+	KeeperConfig config = keeperOptions;
+
+	bool missingPgdataIsOk = true;
+	bool pgIsNotRunningIsOk = true;
+	bool monitorDisabledIsOk = true;
+
+	pid_t ppid = getppid();
+
+	bool exitOnQuit = true;
+
+	/* Establish a handler for signals. */
+	(void) set_signal_handlers(exitOnQuit);
+
+	if (!keeper_config_read_file(&config,
+								 missingPgdataIsOk,
+								 pgIsNotRunningIsOk,
+								 monitorDisabledIsOk))
+	{
+		/* errors have already been logged. */
+		exit(EXIT_CODE_BAD_CONFIG);
+	}
+
+	if (config.metrics_port <= 0)
+	{
+		log_fatal("Failed to start the metrics service: "
+				  "metrics.port is not set in \"%s\"",
+				  config.pathnames.config);
+		exit(EXIT_CODE_BAD_CONFIG);
+	}
+
+	/* display a user-friendly process name */
+	(void) set_ps_title("pg_autoctl: metrics");
+
+	/* create the service pidfile */
+	if (!create_service_pidfile(config.pathnames.pid, SERVICE_NAME_METRICS))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+
+	if (keeper_metrics_attach(config.pathnames.metrics))
+	{
+		(void) keeper_metrics_record_service_start(
+			KEEPER_METRICS_SERVICE_METRICS);
+	}
+
+	if (!service_metrics_loop(&config, ppid))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+}
+
+
+/*
+ * cli_do_profile_getopts parses the command line options of the command
+ * pg_autoctl do profile.
+ */
+static int
+cli_do_profile_getopts(int argc, char **argv)
+{
+	KeeperConfig options = { 0 };
+	int c, option_index = 0, errors = 0;
+	int verboseCount = 0;
+	bool printVersion = false;
+
+	static struct option long_options[] = {
+		{ "pgdata", required_argument, NULL, 'D' },
+		{ "duration", required_argument, NULL, 'd' },
+		{ "version", no_argument, NULL, 'V' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "quiet", no_argument, NULL, 'q' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	optind = 0;
+
+	/* the command is terminal, let getopt_long() reorder arguments */
+	unsetenv("POSIXLY_CORRECT");
+
+	while ((c = getopt_long(argc, argv, "D:d:Vvqh",
+							long_options, &option_index)) != -1)
+	{
+		switch (c)
+		{
+			case 'D':
+			{
+				strlcpy(options.pgSetup.pgdata, optarg, MAXPGPATH);
+				log_trace("--pgdata %s", options.pgSetup.pgdata);
+				break;
+			}
+
+			case 'd':
+			{
+				if (!stringToInt(optarg, &profileDuration) ||
+					profileDuration <= 0 ||
+					profileDuration > KEEPER_PROFILE_MAX_DURATION)
+				{
+					log_fatal("--duration argument is not a valid duration "
+							  "between 1 and %d seconds: \"%s\"",
+							  KEEPER_PROFILE_MAX_DURATION, optarg);
+					errors++;
+				}
+				log_trace("--duration %d", profileDuration);
+				break;
+			}
+
+			case 'V':
+			{
+				/* keeper_cli_print_version prints version and exits. */
+				printVersion = true;
+				break;
+			}
+
+			case 'v':
+			{
+				++verboseCount;
+				switch (verboseCount)
+				{
+					case 1:
+					{
+						log_set_level(LOG_INFO);
+						break;
+					}
+
+					case 2:
+					{
+						log_set_level(LOG_DEBUG);
+						break;
+					}
+
+					default:
+					{
+						log_set_level(LOG_TRACE);
+						break;
+					}
+				}
+				break;
+			}
+
+			case 'q':
+			{
+				log_set_level(LOG_ERROR);
+				break;
+			}
+
+			case 'h':
+			{
+				commandline_help(stderr);
+				exit(EXIT_CODE_QUIT);
+				break;
+			}
+
+			default:
+			{
+				/* getopt_long already wrote an error message */
+				errors++;
+				break;
+			}
+		}
+	}
+
+	if (errors > 0)
+	{
+		commandline_help(stderr);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	if (printVersion)
+	{
+		keeper_cli_print_version(argc, argv);
+	}
+
+	/* now that we have the command line parameters, prepare the options */
+	(void) prepare_keeper_options(&options);
+
+	/* publish our option parsing in the global variable */
+	keeperOptions = options;
+
+	return optind;
+}
+
+
+/*
+ * cli_do_profile asks the running node-active service to profile its main
+ * loop for the given duration, waits for the report, and prints it out.
+ */
+static void
+cli_do_profile(int argc, char **argv)
+{
+	KeeperConfig config = keeperOptions;
+
+	char requestFile[MAXPGPATH] = { 0 };
+	char reportFile[MAXPGPATH] = { 0 };
+	char request[BUFSIZE] = { 0 };
+	char *report = NULL;
+	long reportSize = 0L;
+	pid_t pid = -1;
+
+	if (!supervisor_find_service_pid(config.pathnames.pid,
+									 SERVICE_NAME_KEEPER,
+									 &pid))
+	{
+		log_fatal("Failed to find the pid of the pg_autoctl node-active "
+				  "service, is pg_autoctl running?");
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+
+	(void) keeper_profile_path(config.pathnames.pid,
+							   KEEPER_PROFILE_REQUEST_FILENAME,
+							   requestFile);
+
+	(void) keeper_profile_path(config.pathnames.pid,
+							   KEEPER_PROFILE_REPORT_FILENAME,
+							   reportFile);
+
+	sformat(request, sizeof(request), "%d\n", profileDuration);
+
+	if (!unlink_file(reportFile) ||
+		!write_file_atomic(request, strlen(request), requestFile))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+
+	if (kill(pid, SIGUSR1) != 0)
+	{
+		log_fatal("Failed to send SIGUSR1 to the node-active service "
+				  "with pid %d: %m", pid);
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+
+	log_info("Profiling the node-active service with pid %d for %ds",
+			 pid, profileDuration);
+
+	/* the service writes the report at its first loop after the duration */
+	int timeout = profileDuration + KEEPER_PROFILE_REPORT_GRACE_TIME;
+
+	for (int elapsed = 0; !file_exists(reportFile); elapsed++)
+	{
+		if (elapsed >= timeout)
+		{
+			log_fatal("Failed to get the profile report \"%s\" "
+					  "after %ds, see the node-active service logs",
+					  reportFile, timeout);
+			exit(EXIT_CODE_INTERNAL_ERROR);
+		}
+
+		pg_usleep(1000 * 1000);
+	}
+
+	if (!read_file(reportFile, &report, &reportSize))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+
+	fformat(stdout, "%s", report);
+
+	free(report);
+}
@@ -336,12 +336,12 @@ prepareTmuxNodeArray(TmuxOptions *options, TmuxNodeArray *nodeArray)
 
 	int totalNodesCount = compute_node_count(options);
 
-	if (NODE_ARRAY_MAX_COUNT < totalNodesCount)
+	if (MAX_NODES < totalNodesCount)
 	{
-		log_fatal("This setup requires %d nodes and pg_autoctl is limited "
-				  "to %d nodes",
+		log_fatal("This setup requires %d nodes and pg_autoctl do tmux is "
+				  "limited to %d nodes",
 				  totalNodesCount,
-				  NODE_ARRAY_MAX_COUNT);
+				  MAX_NODES);
 		return false;
 	}
 
@@ -793,6 +793,18 @@ cli_drop_node_files_and_directories(KeeperConfig *config)
 				  config->pathnames.state);
 	}
 
+	if (!unlink_file(config->pathnames.transitions))
+	{
+		log_error("Failed to remove transition history file \"%s\"",
+				  config->pathnames.transitions);
+	}
+
+	if (!unlink_file(config->pathnames.startup))
+	{
+		log_error("Failed to remove startup cache file \"%s\"",
+				  config->pathnames.startup);
+	}
+
 	(void) stop_postgres_and_remove_pgdata_and_config(
 		&config->pathnames,
 		&config->pgSetup);
@@ -951,6 +963,12 @@ cli_drop_node_from_monitor_and_wait(KeeperConfig *config)
 			 (long long) nodeId, groupId, config->listen_notifications_timeout);
 
 	uint64_t start = time(NULL);
+	int queryCount = 0;
+
+	instr_time startTime;
+	instr_time duration;
+
+	INSTR_TIME_SET_CURRENT(startTime);
 
 	/* establish a connection for notifications if none present */
 	(void) pgsql_prepare_to_wait(&(monitor.notificationClient));
@@ -990,12 +1008,20 @@ cli_drop_node_from_monitor_and_wait(KeeperConfig *config)
 		}
 
 		dropped = nodesArray.count == 0;
+		++queryCount;
+
+		nodeAddressArrayFree(&nodesArray);
 
 		if (dropped)
 		{
+			INSTR_TIME_SET_CURRENT(duration);
+			INSTR_TIME_SUBTRACT(duration, startTime);
+
 			log_info("Node with id %lld in group %d has been successfully "
-					 "dropped from the monitor",
-					 (long long) nodeId, groupId);
+					 "dropped from the monitor in %.0f ms, after %d queries",
+					 (long long) nodeId, groupId,
+					 INSTR_TIME_GET_MILLISEC(duration),
+					 queryCount);
 		}
 	}
 }
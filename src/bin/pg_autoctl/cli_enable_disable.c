@@ -462,8 +462,6 @@ cli_enable_maintenance(int argc, char **argv)
 	bool pgIsNotRunningIsOk = true;
 	bool monitorDisabledIsOk = false;
 
-	char *channels[] = { "state", NULL };
-
 	ConnectionRetryPolicy retryPolicy = { 0 };
 
 	keeper.config = keeperOptions;
@@ -505,7 +503,9 @@ cli_enable_maintenance(int argc, char **argv)
 	 */
 	if (keeper.state.current_role != MAINTENANCE_STATE)
 	{
-		if (!pgsql_listen(&(keeper.monitor.notificationClient), channels))
+		if (!monitor_listen_state_changes(&(keeper.monitor),
+										  keeper.config.formation,
+										  keeper.config.groupId))
 		{
 			log_error("Failed to listen to state changes from the monitor");
 			exit(EXIT_CODE_MONITOR);
@@ -582,8 +582,6 @@ cli_disable_maintenance(int argc, char **argv)
 	bool pgIsNotRunningIsOk = true;
 	bool monitorDisabledIsOk = false;
 
-	char *channels[] = { "state", NULL };
-
 	ConnectionRetryPolicy retryPolicy = { 0 };
 
 	keeper.config = keeperOptions;
@@ -612,7 +610,9 @@ cli_disable_maintenance(int argc, char **argv)
 		exit(EXIT_CODE_MONITOR);
 	}
 
-	if (!pgsql_listen(&(keeper.monitor.notificationClient), channels))
+	if (!monitor_listen_state_changes(&(keeper.monitor),
+									  keeper.config.formation,
+									  keeper.config.groupId))
 	{
 		log_error("Failed to listen to state changes from the monitor");
 		exit(EXIT_CODE_MONITOR);
@@ -17,11 +17,22 @@ static bool get_node_replication_settings(NodeReplicationSettings *settings);
 static void cli_get_node_replication_quorum(int argc, char **argv);
 static void cli_get_node_candidate_priority(int argc, char **argv);
 static void cli_get_formation_number_sync_standbys(int argc, char **argv);
+static void cli_get_formation_target_recovery_seconds(int argc, char **argv);
 
 static void cli_set_node_replication_quorum(int argc, char **argv);
 static void cli_set_node_candidate_priority(int argc, char **argv);
 static void cli_set_node_metadata(int argc, char **argv);
 static void cli_set_formation_number_sync_standbys(int arc, char **argv);
+static void cli_set_formation_target_recovery_seconds(int argc, char **argv);
+static void cli_set_formation_slot_retention_budget(int argc, char **argv);
+static void cli_set_formation_remote_wal_compression(int argc, char **argv);
+static void cli_set_formation_health_check_period(int argc, char **argv);
+static void cli_set_formation_health_check_timeout(int argc, char **argv);
+static void cli_set_formation_node_considered_unhealthy_timeout(int argc, char **argv);
+static void cli_set_formation_primary_demote_timeout(int argc, char **argv);
+static void cli_set_formation_health_policy(int argc, char **argv,
+											 const char *option,
+											 const char *setting);
 
 static bool set_node_candidate_priority(Keeper *keeper, int candidatePriority);
 static bool set_node_replication_quorum(Keeper *keeper, bool replicationQuorum);
@@ -85,9 +96,20 @@ static CommandLine get_formation_number_sync_standbys =
 				 cli_get_name_getopts,
 				 cli_get_formation_number_sync_standbys);
 
+static CommandLine get_formation_target_recovery_seconds =
+	make_command("target-recovery-seconds",
+				 "get target_recovery_seconds for a formation from the monitor",
+				 " [ --pgdata ] [ --json ] [ --formation ] ",
+				 "  --pgdata      path to data directory\n"
+				 "  --json        output data in the JSON format\n"
+				 "  --formation   pg_auto_failover formation\n",
+				 cli_get_name_getopts,
+				 cli_get_formation_target_recovery_seconds);
+
 static CommandLine *get_formation_subcommands[] = {
 	&get_formation_settings,
 	&get_formation_number_sync_standbys,
+	&get_formation_target_recovery_seconds,
 	NULL
 };
 
@@ -169,8 +191,86 @@ static CommandLine set_formation_number_sync_standby_command =
 				 cli_get_name_getopts,
 				 cli_set_formation_number_sync_standbys);
 
+static CommandLine set_formation_target_recovery_seconds_command =
+	make_command("target-recovery-seconds",
+				 "set target-recovery-seconds for a formation on the monitor",
+				 " [ --pgdata ] [ --json ] [ --formation ] "
+				 "<target_recovery_seconds>",
+				 "  --pgdata      path to data directory\n"
+				 "  --formation   pg_auto_failover formation\n"
+				 "  --json        output data in the JSON format\n",
+				 cli_get_name_getopts,
+				 cli_set_formation_target_recovery_seconds);
+
+static CommandLine set_formation_slot_retention_budget_command =
+	make_command("slot-retention-budget",
+				 "set the WAL a replication slot may retain in a formation, in MB",
+				 " [ --pgdata ] [ --json ] [ --formation ] <megabytes>",
+				 "  --pgdata      path to data directory\n"
+				 "  --formation   pg_auto_failover formation\n"
+				 "  --json        output data in the JSON format\n",
+				 cli_get_name_getopts,
+				 cli_set_formation_slot_retention_budget);
+
+static CommandLine set_formation_remote_wal_compression_command =
+	make_command("remote-wal-compression",
+				 "set the wal_compression used when streaming to another cluster",
+				 " [ --pgdata ] [ --json ] [ --formation ] <off|pglz|lz4|zstd>",
+				 "  --pgdata      path to data directory\n"
+				 "  --formation   pg_auto_failover formation\n"
+				 "  --json        output data in the JSON format\n",
+				 cli_get_name_getopts,
+				 cli_set_formation_remote_wal_compression);
+
+static CommandLine set_formation_health_check_period_command =
+	make_command("health-check-period",
+				 "set the period of the health checks of a formation, in ms",
+				 " [ --pgdata ] [ --json ] [ --formation ] <milliseconds>",
+				 "  --pgdata      path to data directory\n"
+				 "  --formation   pg_auto_failover formation\n"
+				 "  --json        output data in the JSON format\n",
+				 cli_get_name_getopts,
+				 cli_set_formation_health_check_period);
+
+static CommandLine set_formation_health_check_timeout_command =
+	make_command("health-check-timeout",
+				 "set the timeout of the health checks of a formation, in ms",
+				 " [ --pgdata ] [ --json ] [ --formation ] <milliseconds>",
+				 "  --pgdata      path to data directory\n"
+				 "  --formation   pg_auto_failover formation\n"
+				 "  --json        output data in the JSON format\n",
+				 cli_get_name_getopts,
+				 cli_set_formation_health_check_timeout);
+
+static CommandLine set_formation_node_considered_unhealthy_timeout_command =
+	make_command("node-considered-unhealthy-timeout",
+				 "set the time after which a node of a formation is unhealthy, in ms",
+				 " [ --pgdata ] [ --json ] [ --formation ] <milliseconds>",
+				 "  --pgdata      path to data directory\n"
+				 "  --formation   pg_auto_failover formation\n"
+				 "  --json        output data in the JSON format\n",
+				 cli_get_name_getopts,
+				 cli_set_formation_node_considered_unhealthy_timeout);
+
+static CommandLine set_formation_primary_demote_timeout_command =
+	make_command("primary-demote-timeout",
+				 "set the time given to a primary of a formation to demote, in ms",
+				 " [ --pgdata ] [ --json ] [ --formation ] <milliseconds>",
+				 "  --pgdata      path to data directory\n"
+				 "  --formation   pg_auto_failover formation\n"
+				 "  --json        output data in the JSON format\n",
+				 cli_get_name_getopts,
+				 cli_set_formation_primary_demote_timeout);
+
 static CommandLine *set_formation_subcommands[] = {
 	&set_formation_number_sync_standby_command,
+	&set_formation_target_recovery_seconds_command,
+	&set_formation_slot_retention_budget_command,
+	&set_formation_remote_wal_compression_command,
+	&set_formation_health_check_period_command,
+	&set_formation_health_check_timeout_command,
+	&set_formation_node_considered_unhealthy_timeout_command,
+	&set_formation_primary_demote_timeout_command,
 	NULL
 };
 
@@ -299,6 +399,20 @@ cli_get_formation_settings(int argc, char **argv)
 
 	(void) cli_monitor_init_from_option_or_config(&monitor, &config);
 
+	if (allFormations)
+	{
+		bool success = outputJSON
+					   ? monitor_print_every_formation_settings_as_json(&monitor)
+					   : monitor_print_every_formation_settings(&monitor);
+
+		if (!success)
+		{
+			exit(EXIT_CODE_MONITOR);
+		}
+
+		return;
+	}
+
 	if (outputJSON)
 	{
 		if (!monitor_print_formation_settings_as_json(&monitor, config.formation))
@@ -356,6 +470,45 @@ cli_get_formation_number_sync_standbys(int argc, char **argv)
 }
 
 
+/*
+ * cli_get_formation_target_recovery_seconds function prints the
+ * target_recovery_seconds property of this formation to standard output.
+ */
+static void
+cli_get_formation_target_recovery_seconds(int argc, char **argv)
+{
+	KeeperConfig config = keeperOptions;
+	Monitor monitor = { 0 };
+	int targetRecoverySeconds = 0;
+
+	(void) cli_monitor_init_from_option_or_config(&monitor, &config);
+
+	if (!monitor_get_formation_target_recovery_seconds(&monitor,
+													   config.formation,
+													   &targetRecoverySeconds))
+	{
+		log_error("Failed to get target-recovery-seconds for formation \"%s\"",
+				  config.formation);
+		exit(EXIT_CODE_MONITOR);
+	}
+
+	if (outputJSON)
+	{
+		JSON_Value *js = json_value_init_object();
+		JSON_Object *jsObj = json_value_get_object(js);
+
+		json_object_set_number(jsObj,
+							   "target-recovery-seconds",
+							   (double) targetRecoverySeconds);
+
+		(void) cli_pprint_json(js);
+	}
+	else
+	{
+		fformat(stdout, "%d\n", targetRecoverySeconds);
+	}
+}
+
 /*
  * cli_set_node_replication_quorum sets the replication quorum property on the
  * monitor for current pg_autoctl node.
@@ -659,6 +812,287 @@ cli_set_formation_number_sync_standbys(int argc, char **argv)
 }
 
 
+/*
+ * cli_set_formation_target_recovery_seconds sets the target recovery time of
+ * the formation on the monitor. The keepers then tune their checkpoint
+ * settings to it, see keeper_maintain_recovery_target().
+ */
+static void
+cli_set_formation_target_recovery_seconds(int argc, char **argv)
+{
+	KeeperConfig config = keeperOptions;
+	Monitor monitor = { 0 };
+
+	if (argc != 1)
+	{
+		log_error("Failed to parse command line arguments: "
+				  "got %d when 1 is expected",
+				  argc);
+		commandline_help(stderr);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	int targetRecoverySeconds = 0;
+
+	if (!stringToInt(argv[0], &targetRecoverySeconds) ||
+		targetRecoverySeconds < 0)
+	{
+		log_error("target-recovery-seconds value %s is not valid."
+				  " Expected a non-negative integer value. ", argv[0]);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	(void) cli_monitor_init_from_option_or_config(&monitor, &config);
+
+	if (!monitor_set_formation_target_recovery_seconds(&monitor,
+													   config.formation,
+													   targetRecoverySeconds))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_MONITOR);
+	}
+
+	if (outputJSON)
+	{
+		JSON_Value *js = json_value_init_object();
+		JSON_Object *jsObj = json_value_get_object(js);
+
+		json_object_set_number(jsObj,
+							   "target-recovery-seconds",
+							   (double) targetRecoverySeconds);
+
+		(void) cli_pprint_json(js);
+	}
+	else
+	{
+		fformat(stdout, "%d\n", targetRecoverySeconds);
+	}
+}
+
+
+/*
+ * cli_set_formation_slot_retention_budget sets how much WAL the replication
+ * slot of a node of the formation may retain before the node is cloned
+ * again, see keeper_maintain_slot_retention().
+ */
+static void
+cli_set_formation_slot_retention_budget(int argc, char **argv)
+{
+	KeeperConfig config = keeperOptions;
+	Monitor monitor = { 0 };
+
+	if (argc != 1)
+	{
+		log_error("Failed to parse command line arguments: "
+				  "got %d when 1 is expected",
+				  argc);
+		commandline_help(stderr);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	int budgetMB = 0;
+
+	if (!stringToInt(argv[0], &budgetMB) || budgetMB < 0)
+	{
+		log_error("slot-retention-budget value %s is not valid."
+				  " Expected a non-negative integer value. ", argv[0]);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	(void) cli_monitor_init_from_option_or_config(&monitor, &config);
+
+	if (!monitor_set_formation_slot_retention_budget(&monitor,
+													 config.formation,
+													 budgetMB))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_MONITOR);
+	}
+
+	if (outputJSON)
+	{
+		JSON_Value *js = json_value_init_object();
+		JSON_Object *jsObj = json_value_get_object(js);
+
+		json_object_set_number(jsObj, "slot-retention-budget", (double) budgetMB);
+
+		(void) cli_pprint_json(js);
+	}
+	else
+	{
+		fformat(stdout, "%d\n", budgetMB);
+	}
+}
+
+
+/*
+ * cli_set_formation_remote_wal_compression sets the wal_compression method
+ * that the primary nodes of the formation use when their group has nodes in
+ * another cluster.
+ */
+static void
+cli_set_formation_remote_wal_compression(int argc, char **argv)
+{
+	KeeperConfig config = keeperOptions;
+	Monitor monitor = { 0 };
+
+	if (argc != 1)
+	{
+		log_error("Failed to parse command line arguments: "
+				  "got %d when 1 is expected",
+				  argc);
+		commandline_help(stderr);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	char *method = argv[0];
+
+	if (!streq(method, "off") &&
+		!streq(method, "pglz") &&
+		!streq(method, "lz4") &&
+		!streq(method, "zstd"))
+	{
+		log_error("remote-wal-compression value %s is not valid."
+				  " Expected one of off, pglz, lz4, or zstd. ", method);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	(void) cli_monitor_init_from_option_or_config(&monitor, &config);
+
+	if (!monitor_set_formation_remote_wal_compression(&monitor,
+													  config.formation,
+													  method))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_MONITOR);
+	}
+
+	if (outputJSON)
+	{
+		JSON_Value *js = json_value_init_object();
+		JSON_Object *jsObj = json_value_get_object(js);
+
+		json_object_set_string(jsObj, "remote-wal-compression", method);
+
+		(void) cli_pprint_json(js);
+	}
+	else
+	{
+		fformat(stdout, "%s\n", method);
+	}
+}
+
+
+/*
+ * cli_set_formation_health_check_period sets the health_check_period of the
+ * formation on the monitor, see cli_set_formation_health_policy().
+ */
+static void
+cli_set_formation_health_check_period(int argc, char **argv)
+{
+	(void) cli_set_formation_health_policy(argc, argv,
+										   "health-check-period",
+										   "health_check_period");
+}
+
+
+/*
+ * cli_set_formation_health_check_timeout sets the health_check_timeout of the
+ * formation on the monitor, see cli_set_formation_health_policy().
+ */
+static void
+cli_set_formation_health_check_timeout(int argc, char **argv)
+{
+	(void) cli_set_formation_health_policy(argc, argv,
+										   "health-check-timeout",
+										   "health_check_timeout");
+}
+
+
+/*
+ * cli_set_formation_node_considered_unhealthy_timeout sets the
+ * node_considered_unhealthy_timeout of the formation on the monitor, see
+ * cli_set_formation_health_policy().
+ */
+static void
+cli_set_formation_node_considered_unhealthy_timeout(int argc, char **argv)
+{
+	(void) cli_set_formation_health_policy(argc, argv,
+										   "node-considered-unhealthy-timeout",
+										   "node_considered_unhealthy_timeout");
+}
+
+
+/*
+ * cli_set_formation_primary_demote_timeout sets the primary_demote_timeout of
+ * the formation on the monitor, see cli_set_formation_health_policy().
+ */
+static void
+cli_set_formation_primary_demote_timeout(int argc, char **argv)
+{
+	(void) cli_set_formation_health_policy(argc, argv,
+										   "primary-demote-timeout",
+										   "primary_demote_timeout");
+}
+
+
+/*
+ * cli_set_formation_health_policy sets one of the health check and failover
+ * timeouts of the formation on the monitor, in milliseconds. Zero resets the
+ * formation to the value of the monitor setting of the same name.
+ */
+static void
+cli_set_formation_health_policy(int argc, char **argv,
+								const char *option, const char *setting)
+{
+	KeeperConfig config = keeperOptions;
+	Monitor monitor = { 0 };
+
+	if (argc != 1)
+	{
+		log_error("Failed to parse command line arguments: "
+				  "got %d when 1 is expected",
+				  argc);
+		commandline_help(stderr);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	int value = 0;
+
+	if (!stringToInt(argv[0], &value) || value < 0)
+	{
+		log_error("%s value %s is not valid."
+				  " Expected a non-negative integer value. ", option, argv[0]);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	(void) cli_monitor_init_from_option_or_config(&monitor, &config);
+
+	if (!monitor_set_formation_health_policy(&monitor,
+											 config.formation,
+											 (char *) setting,
+											 value))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_MONITOR);
+	}
+
+	if (outputJSON)
+	{
+		JSON_Value *js = json_value_init_object();
+		JSON_Object *jsObj = json_value_get_object(js);
+
+		json_object_set_number(jsObj, option, (double) value);
+
+		(void) cli_pprint_json(js);
+	}
+	else
+	{
+		fformat(stdout, "%d\n", value);
+	}
+}
+
+
 /*
  * set_node_candidate_priority sets the candidate priority on the monitor, and
  * if we have more than one node registered, waits until the primary has
@@ -8,6 +8,11 @@
  *
  */
 
+#include <inttypes.h>
+
+#include "postgres_fe.h"
+#include "portability/instr_time.h"
+
 #include "cli_common.h"
 #include "commandline.h"
 #include "defaults.h"
@@ -17,33 +22,89 @@
 #include "keeper.h"
 #include "monitor.h"
 #include "monitor_config.h"
+#include "nodestate_utils.h"
+#include "parsing.h"
 #include "string_utils.h"
+#include "system_utils.h"
+
+/*
+ * SwitchoverProgress tracks a switchover started by pg_autoctl perform
+ * switchover --away-from-cluster, until the monitor notifies that its target
+ * node is the primary of the group.
+ */
+typedef struct SwitchoverProgress
+{
+	SwitchoverGroup group;
+	instr_time startTime;
+	double durationMs;
+	bool done;
+	bool timedOut;
+} SwitchoverProgress;
+
+typedef struct SwitchoverTracker
+{
+	char formation[NAMEDATALEN];
+	int count;
+	int inFlight;
+	SwitchoverProgress switchovers[SWITCHOVER_GROUPS_MAX_COUNT];
+} SwitchoverTracker;
 
 static int cli_perform_failover_getopts(int argc, char **argv);
 static void cli_perform_failover(int argc, char **argv);
+static void cli_perform_switchover_away_from_cluster(Monitor *monitor,
+													 KeeperConfig *config);
+static bool cli_perform_switchover_start_groups(Monitor *monitor,
+												KeeperConfig *config,
+												SwitchoverTracker *tracker,
+												bool *moreGroups);
+static void cli_perform_switchover_check_timeouts(SwitchoverTracker *tracker,
+												  int timeout);
+static void cli_perform_switchover_notification(void *context,
+												CurrentNodeState *nodeState);
+static bool cli_perform_checkpoint(Monitor *monitor, KeeperConfig *config);
+static bool cli_perform_checkpoint_connect(NodeAddress *node,
+										   PostgresSetup *pgSetup,
+										   PGSQL *pgsql);
 
 static int cli_perform_promotion_getopts(int argc, char **argv);
 static void cli_perform_promotion(int argc, char **argv);
 
+static void cli_perform_rolling_restart(int argc, char **argv);
+static bool cli_perform_rolling_restart_group(Monitor *monitor,
+											  KeeperConfig *config,
+											  uint64_t *writeUnavailableMs);
+static void cli_perform_move_formation(int argc, char **argv);
+static bool cli_perform_restart_standby(Monitor *monitor,
+										KeeperConfig *config,
+										CurrentNodeState *nodeState);
+
 CommandLine perform_failover_command =
 	make_command("failover",
 				 "Perform a failover for given formation and group",
-				 " [ --pgdata --formation --group ] ",
-				 "  --pgdata      path to data directory\n"
-				 "  --formation   formation to target, defaults to 'default'\n"
-				 "  --group       group to target, defaults to 0\n"
-				 "  --wait        how many seconds to wait, default to 60 \n",
+				 " [ --pgdata --formation --group --checkpoint ] "
+				 "[ --away-from-cluster --concurrency ] ",
+				 "  --pgdata             path to data directory\n"
+				 "  --formation          formation to target, defaults to 'default'\n"
+				 "  --group              group to target, defaults to 0\n"
+				 "  --wait               how many seconds to wait, default to 60 \n"
+				 "  --checkpoint         checkpoint the nodes first, either spread or fast\n"
+				 "  --away-from-cluster  move every primary of this cluster elsewhere\n"
+				 "  --concurrency        groups to switch over at a time, defaults to 4\n",
 				 cli_perform_failover_getopts,
 				 cli_perform_failover);
 
 CommandLine perform_switchover_command =
 	make_command("switchover",
 				 "Perform a switchover for given formation and group",
-				 " [ --pgdata --formation --group ] ",
-				 "  --pgdata      path to data directory\n"
-				 "  --formation   formation to target, defaults to 'default'\n"
-				 "  --group       group to target, defaults to 0\n"
-				 "  --wait        how many seconds to wait, default to 60 \n",
+				 " [ --pgdata --formation --group --checkpoint ] "
+				 "[ --away-from-cluster --concurrency ] ",
+				 "  --pgdata             path to data directory\n"
+				 "  --formation          formation to target, defaults to 'default'\n"
+				 "  --group              group to target, defaults to 0\n"
+				 "  --wait               how many seconds to wait, default to 60 \n"
+				 "  --checkpoint         checkpoint the nodes first, either spread or fast\n"
+				 "  --away-from-cluster  move every primary of this cluster elsewhere\n"
+				 "  --concurrency        groups to switch over at a time, defaults to 4\n",
 				 cli_perform_failover_getopts,
 				 cli_perform_failover);
 
@@ -58,10 +119,52 @@ CommandLine perform_promotion_command =
 				 cli_perform_promotion_getopts,
 				 cli_perform_promotion);
 
+CommandLine perform_rolling_restart_command =
+	make_command("rolling-restart",
+				 "Restart every node of a formation with a single switchover",
+				 " [ --pgdata --formation --group --checkpoint ] ",
+				 "  --pgdata      path to data directory\n"
+				 "  --formation   formation to target, defaults to 'default'\n"
+				 "  --group       group to target, defaults to all groups\n"
+				 "  --wait        how many seconds to wait, default to 60 \n"
+				 "  --checkpoint  checkpoint the nodes first, either spread or fast\n",
+				 cli_perform_failover_getopts,
+				 cli_perform_rolling_restart);
+
+CommandLine perform_move_formation_command =
+	make_command("move-formation",
+				 "Move a formation and its nodes to another monitor",
+				 " [ --pgdata --monitor --formation ] <monitor uri>",
+				 "  --pgdata      path to data directory\n"
+				 "  --monitor     pg_auto_failover monitor that manages the formation\n"
+				 "  --formation   formation to move, defaults to 'default'\n",
+				 cli_get_name_getopts,
+				 cli_perform_move_formation);
+
+/*
+ * With --checkpoint, pg_autoctl perform switchover runs a checkpoint on the
+ * primary and a restartpoint on the standby nodes before calling
+ * perform_failover, so that the checkpoint that follows promotion has less
+ * work to do.
+ */
+static bool performCheckpoint = false;
+static bool performFastCheckpoint = false;
+
+/*
+ * With --away-from-cluster, pg_autoctl perform switchover promotes a standby
+ * node of another cluster in every group of the formation that has its
+ * primary node in the given cluster, such as before evacuating an
+ * availability zone. Up to --concurrency switchovers run at the same time.
+ */
+static char awayFromCluster[NAMEDATALEN] = { 0 };
+static int switchoverConcurrency = PG_AUTOCTL_SWITCHOVER_CONCURRENCY;
+
 CommandLine *perform_subcommands[] = {
 	&perform_failover_command,
 	&perform_switchover_command,
 	&perform_promotion_command,
+	&perform_rolling_restart_command,
+	&perform_move_formation_command,
 	NULL,
 };
 
@@ -87,6 +190,9 @@ cli_perform_failover_getopts(int argc, char **argv)
 		{ "formation", required_argument, NULL, 'f' },
 		{ "group", required_argument, NULL, 'g' },
 		{ "wait", required_argument, NULL, 'w' },
+		{ "checkpoint", required_argument, NULL, 'C' },
+		{ "away-from-cluster", required_argument, NULL, 'A' },
+		{ "concurrency", required_argument, NULL, 'c' },
 		{ "version", no_argument, NULL, 'V' },
 		{ "verbose", no_argument, NULL, 'v' },
 		{ "quiet", no_argument, NULL, 'q' },
@@ -164,6 +270,49 @@ cli_perform_failover_getopts(int argc, char **argv)
 				break;
 			}
 
+			case 'C':
+			{
+				if (strcmp(optarg, "spread") == 0)
+				{
+					performFastCheckpoint = false;
+				}
+				else if (strcmp(optarg, "fast") == 0)
+				{
+					performFastCheckpoint = true;
+				}
+				else
+				{
+					log_fatal("--checkpoint argument must be either "
+							  "\"spread\" or \"fast\", not \"%s\"",
+							  optarg);
+					exit(EXIT_CODE_BAD_ARGS);
+				}
+				performCheckpoint = true;
+				log_trace("--checkpoint %s", optarg);
+				break;
+			}
+
+			case 'A':
+			{
+				strlcpy(awayFromCluster, optarg, NAMEDATALEN);
+				log_trace("--away-from-cluster %s", awayFromCluster);
+				break;
+			}
+
+			case 'c':
+			{
+				if (!stringToInt(optarg, &switchoverConcurrency) ||
+					switchoverConcurrency < 1)
+				{
+					log_fatal("--concurrency argument is not a valid "
+							  "number of groups: \"%s\"",
+							  optarg);
+					exit(EXIT_CODE_BAD_ARGS);
+				}
+				log_trace("--concurrency %d", switchoverConcurrency);
+				break;
+			}
+
 			case 'V':
 			{
 				/* keeper_cli_print_version prints version and exits. */
@@ -224,6 +373,15 @@ cli_perform_failover_getopts(int argc, char **argv)
 		exit(EXIT_CODE_BAD_ARGS);
 	}
 
+	/* --away-from-cluster targets many groups, that the monitor selects */
+	if (!IS_EMPTY_STRING_BUFFER(awayFromCluster) &&
+		(options.groupId != -1 || performCheckpoint))
+	{
+		log_fatal("Options --group and --checkpoint can not be used "
+				  "with --away-from-cluster");
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
 	/* when we have a monitor URI we don't need PGDATA */
 	if (cli_use_monitor_option(&options))
 	{
@@ -271,14 +429,25 @@ cli_perform_failover(int argc, char **argv)
 	KeeperConfig config = keeperOptions;
 	Monitor monitor = { 0 };
 
-	char *channels[] = { "state", NULL };
-
 	(void) cli_monitor_init_from_option_or_config(&monitor, &config);
 
+	if (!IS_EMPTY_STRING_BUFFER(awayFromCluster))
+	{
+		(void) cli_perform_switchover_away_from_cluster(&monitor, &config);
+		return;
+	}
+
 	(void) cli_set_groupId(&monitor, &config);
 
+	if (performCheckpoint && !cli_perform_checkpoint(&monitor, &config))
+	{
+		log_fatal("Failed to checkpoint the nodes before switchover, "
+				  "see above for details");
+		exit(EXIT_CODE_PGSQL);
+	}
+
 	/* start listening to the state changes before we call perform_failover */
-	if (!pgsql_listen(&(monitor.notificationClient), channels))
+	if (!monitor_listen_state_changes(&monitor, config.formation, config.groupId))
 	{
 		log_error("Failed to listen to state changes from the monitor");
 		exit(EXIT_CODE_MONITOR);
@@ -306,6 +475,513 @@ cli_perform_failover(int argc, char **argv)
 }
 
 
+/*
+ * cli_perform_switchover_away_from_cluster moves the primary node of every
+ * group that has it in the --away-from-cluster cluster to a standby node of
+ * another cluster. The monitor picks the groups and their target node, and
+ * we keep up to --concurrency switchovers running: each time the target node
+ * of a group is notified to be the primary, we ask the monitor to start the
+ * next ones. We then report the time each switchover took, and the total.
+ */
+static void
+cli_perform_switchover_away_from_cluster(Monitor *monitor, KeeperConfig *config)
+{
+	SwitchoverTracker *tracker =
+		(SwitchoverTracker *) calloc(1, sizeof(SwitchoverTracker));
+
+	if (tracker == NULL)
+	{
+		log_fatal(ALLOCATION_FAILED_ERROR);
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+
+	strlcpy(tracker->formation, config->formation, NAMEDATALEN);
+
+	instr_time startTime;
+	instr_time duration;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	/* start listening to the state changes before we start switchovers */
+	if (!monitor_listen_state_changes(monitor, config->formation, -1))
+	{
+		log_error("Failed to listen to state changes from the monitor");
+		exit(EXIT_CODE_MONITOR);
+	}
+
+	bool moreGroups = true;
+	bool lostNotifications = false;
+
+	while (moreGroups || tracker->inFlight > 0)
+	{
+		if (moreGroups && tracker->inFlight < switchoverConcurrency)
+		{
+			if (!cli_perform_switchover_start_groups(monitor, config,
+													 tracker, &moreGroups))
+			{
+				log_fatal("Failed to perform switchover away from cluster "
+						  "\"%s\", see above for details",
+						  awayFromCluster);
+				exit(EXIT_CODE_MONITOR);
+			}
+
+			continue;
+		}
+
+		if (!monitor_wait_state_notifications(monitor,
+											  PG_AUTOCTL_KEEPER_SLEEP_TIME * 1000,
+											  (void *) tracker,
+											  &cli_perform_switchover_notification))
+		{
+			/* errors have already been logged */
+			lostNotifications = true;
+			break;
+		}
+
+		(void) cli_perform_switchover_check_timeouts(
+			tracker,
+			config->listen_notifications_timeout);
+	}
+
+	/* disconnect from monitor */
+	pgsql_finish(&monitor->notificationClient);
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	if (tracker->count == 0)
+	{
+		log_info("No group in formation \"%s\" has a primary node in "
+				 "cluster \"%s\" and a candidate node in another cluster",
+				 config->formation, awayFromCluster);
+		free(tracker);
+		return;
+	}
+
+	int doneCount = 0;
+
+	for (int i = 0; i < tracker->count; i++)
+	{
+		SwitchoverProgress *progress = &(tracker->switchovers[i]);
+
+		if (progress->done)
+		{
+			++doneCount;
+			log_info("Group %d switched over to node %" PRId64 " \"%s\" "
+					 "in %.0f ms",
+					 progress->group.groupId,
+					 progress->group.nodeId,
+					 progress->group.nodeName,
+					 progress->durationMs);
+		}
+		else
+		{
+			log_error("Group %d did not switch over to node %" PRId64 " \"%s\"%s",
+					  progress->group.groupId,
+					  progress->group.nodeId,
+					  progress->group.nodeName,
+					  progress->timedOut ? " before the timeout" : "");
+		}
+	}
+
+	log_info("Switched over %d of %d group(s) away from cluster \"%s\" "
+			 "in formation \"%s\" in %.0f ms",
+			 doneCount, tracker->count, awayFromCluster, config->formation,
+			 INSTR_TIME_GET_MILLISEC(duration));
+
+	bool success = !lostNotifications && doneCount == tracker->count;
+
+	free(tracker);
+
+	if (!success)
+	{
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+}
+
+
+/*
+ * cli_perform_switchover_start_groups asks the monitor to start as many
+ * switchovers as our concurrency allows, and adds them to the tracker.
+ * moreGroups is set to false once the monitor has found fewer groups to
+ * switch over than we asked for.
+ */
+static bool
+cli_perform_switchover_start_groups(Monitor *monitor,
+									KeeperConfig *config,
+									SwitchoverTracker *tracker,
+									bool *moreGroups)
+{
+	SwitchoverGroupArray *groupsArray =
+		(SwitchoverGroupArray *) calloc(1, sizeof(SwitchoverGroupArray));
+
+	if (groupsArray == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return false;
+	}
+
+	int maxGroups = switchoverConcurrency - tracker->inFlight;
+
+	if (!monitor_perform_switchover_away_from_cluster(monitor,
+													  config->formation,
+													  awayFromCluster,
+													  maxGroups,
+													  groupsArray))
+	{
+		/* errors have already been logged */
+		free(groupsArray);
+		return false;
+	}
+
+	if (tracker->count + groupsArray->count > SWITCHOVER_GROUPS_MAX_COUNT)
+	{
+		log_error("pg_autoctl only supports switching over up to %d groups",
+				  SWITCHOVER_GROUPS_MAX_COUNT);
+		free(groupsArray);
+		return false;
+	}
+
+	for (int i = 0; i < groupsArray->count; i++)
+	{
+		SwitchoverProgress *progress =
+			&(tracker->switchovers[tracker->count++]);
+
+		progress->group = groupsArray->groups[i];
+		INSTR_TIME_SET_CURRENT(progress->startTime);
+
+		++(tracker->inFlight);
+
+		log_info("Started switchover of group %d to node %" PRId64 " \"%s\"",
+				 progress->group.groupId,
+				 progress->group.nodeId,
+				 progress->group.nodeName);
+	}
+
+	*moreGroups = groupsArray->count == maxGroups;
+
+	free(groupsArray);
+
+	return true;
+}
+
+
+/*
+ * cli_perform_switchover_check_timeouts stops waiting for the switchovers
+ * that have been running for more than timeout seconds, so that we may start
+ * the next ones. When timeout <= 0 we just never stop waiting.
+ */
+static void
+cli_perform_switchover_check_timeouts(SwitchoverTracker *tracker, int timeout)
+{
+	if (timeout <= 0)
+	{
+		return;
+	}
+
+	for (int i = 0; i < tracker->count; i++)
+	{
+		SwitchoverProgress *progress = &(tracker->switchovers[i]);
+
+		if (progress->done || progress->timedOut)
+		{
+			continue;
+		}
+
+		instr_time duration;
+
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, progress->startTime);
+
+		if (INSTR_TIME_GET_DOUBLE(duration) > timeout)
+		{
+			progress->timedOut = true;
+			--(tracker->inFlight);
+
+			log_error("Failed to receive a notification that node %" PRId64
+					  " \"%s\" is the primary of group %d after %d secs",
+					  progress->group.nodeId,
+					  progress->group.nodeName,
+					  progress->group.groupId,
+					  timeout);
+		}
+	}
+}
+
+
+/*
+ * cli_perform_switchover_notification is a Notification Processing Function
+ * that marks a switchover done when its target node has reached the primary
+ * state.
+ */
+static void
+cli_perform_switchover_notification(void *context, CurrentNodeState *nodeState)
+{
+	SwitchoverTracker *tracker = (SwitchoverTracker *) context;
+
+	if (strcmp(nodeState->formation, tracker->formation) != 0 ||
+		nodeState->reportedState != PRIMARY_STATE ||
+		nodeState->goalState != PRIMARY_STATE)
+	{
+		return;
+	}
+
+	for (int i = 0; i < tracker->count; i++)
+	{
+		SwitchoverProgress *progress = &(tracker->switchovers[i]);
+
+		if (progress->done || progress->timedOut ||
+			progress->group.groupId != nodeState->groupId ||
+			progress->group.nodeId != nodeState->node.nodeId)
+		{
+			continue;
+		}
+
+		instr_time duration;
+
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, progress->startTime);
+
+		progress->done = true;
+		progress->durationMs = INSTR_TIME_GET_MILLISEC(duration);
+		--(tracker->inFlight);
+
+		log_info("Node %" PRId64 " \"%s\" is now the primary of group %d, "
+				 "%d switchover(s) in progress",
+				 progress->group.nodeId,
+				 progress->group.nodeName,
+				 progress->group.groupId,
+				 tracker->inFlight);
+	}
+}
+
+
+/*
+ * cli_perform_checkpoint prepares the nodes of the target group for a planned
+ * promotion. The checkpoint after promotion and the crash recovery that would
+ * follow a failed switchover both have to replay all the WAL written since the
+ * last checkpoint, so we make that distance as short as possible before the
+ * primary stops accepting writes:
+ *
+ *  1. report the redo distance of every node, as a pre-flight estimate,
+ *  2. run a checkpoint on the primary, spread as per its
+ *     checkpoint_completion_target unless --checkpoint fast is used,
+ *  3. wait until each standby has replayed the checkpoint record, and run a
+ *     restartpoint there.
+ *
+ * The connections use the pg_autoctl replication user, which the HBA rules of
+ * every node in the group already allow. Failing to checkpoint a standby only
+ * makes its promotion longer, so we only warn about it.
+ */
+static bool
+cli_perform_checkpoint(Monitor *monitor, KeeperConfig *config)
+{
+	NodeAddressArray nodesArray = { 0 };
+	NodeAddress *primaryNode = NULL;
+	PostgresSetup pgSetup = { 0 };
+
+	PGSQL primaryClient = { 0 };
+	uint64_t redoBytes = 0;
+	char redoBytesStr[BUFSIZE] = { 0 };
+
+	bool pgIsInRecovery = false;
+	char pgsrSyncState[PGSR_SYNC_STATE_MAXLENGTH] = { 0 };
+	char primaryLSN[PG_LSN_MAXLENGTH] = { 0 };
+	char replayLSN[PG_LSN_MAXLENGTH] = { 0 };
+	PostgresControlData control = { 0 };
+
+	/* the database name and SSL settings are found in the keeper setup */
+	strlcpy(pgSetup.dbname, DEFAULT_DATABASE_NAME, NAMEDATALEN);
+
+	if (!IS_EMPTY_STRING_BUFFER(config->pgSetup.pgdata) &&
+		ProbeConfigurationFileRole(config->pathnames.config) ==
+		PG_AUTOCTL_ROLE_KEEPER)
+	{
+		KeeperConfig kconfig = { 0 };
+		bool monitorDisabledIsOk = true;
+
+		kconfig.pgSetup = config->pgSetup;
+		kconfig.pathnames = config->pathnames;
+
+		if (!keeper_config_read_file_skip_pgsetup(&kconfig,
+												  monitorDisabledIsOk))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+
+		strlcpy(pgSetup.dbname, kconfig.pgSetup.dbname, NAMEDATALEN);
+		pgSetup.ssl = kconfig.pgSetup.ssl;
+	}
+
+	if (!monitor_get_nodes(monitor,
+						   config->formation,
+						   config->groupId,
+						   &nodesArray))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	for (int i = 0; i < nodesArray.count; i++)
+	{
+		if (nodesArray.nodes[i].isPrimary)
+		{
+			primaryNode = &(nodesArray.nodes[i]);
+			break;
+		}
+	}
+
+	if (primaryNode == NULL)
+	{
+		log_error("Failed to find the primary node of formation \"%s\" "
+				  "group %d on the monitor",
+				  config->formation, config->groupId);
+		nodeAddressArrayFree(&nodesArray);
+		return false;
+	}
+
+	if (!cli_perform_checkpoint_connect(primaryNode, &pgSetup, &primaryClient) ||
+		!pgsql_get_redo_distance(&primaryClient, &redoBytes))
+	{
+		/* errors have already been logged */
+		nodeAddressArrayFree(&nodesArray);
+		return false;
+	}
+
+	(void) pretty_print_bytes(redoBytesStr, sizeof(redoBytesStr), redoBytes);
+
+	log_info("Primary node %lld \"%s\" (%s:%d) has %s of WAL "
+			 "to replay from its last checkpoint",
+			 (long long) primaryNode->nodeId,
+			 primaryNode->name,
+			 primaryNode->host,
+			 primaryNode->port,
+			 redoBytesStr);
+
+	log_info("Running a %s checkpoint on primary node %lld \"%s\"",
+			 performFastCheckpoint ? "fast" : "spread",
+			 (long long) primaryNode->nodeId,
+			 primaryNode->name);
+
+	if (!pgsql_spread_checkpoint(&primaryClient, performFastCheckpoint) ||
+		!pgsql_get_postgres_metadata(&primaryClient,
+									 &pgIsInRecovery,
+									 pgsrSyncState,
+									 primaryLSN,
+									 replayLSN,
+									 &control))
+	{
+		/* errors have already been logged */
+		pgsql_finish(&primaryClient);
+		nodeAddressArrayFree(&nodesArray);
+		return false;
+	}
+
+	pgsql_finish(&primaryClient);
+
+	for (int i = 0; i < nodesArray.count; i++)
+	{
+		NodeAddress *node = &(nodesArray.nodes[i]);
+		PGSQL standbyClient = { 0 };
+
+		char currentLSN[PG_LSN_MAXLENGTH] = { 0 };
+		bool hasReachedLSN = false;
+
+		if (node->isPrimary)
+		{
+			continue;
+		}
+
+		/* a restartpoint can only happen at a replayed checkpoint record */
+		if (!cli_perform_checkpoint_connect(node, &pgSetup, &standbyClient) ||
+			!pgsql_has_reached_target_lsn(&standbyClient,
+										  primaryLSN,
+										  config->listen_notifications_timeout
+										  * 1000,
+										  currentLSN,
+										  &hasReachedLSN))
+		{
+			log_warn("Skipping restartpoint on node %lld \"%s\" (%s:%d)",
+					 (long long) node->nodeId,
+					 node->name,
+					 node->host,
+					 node->port);
+			pgsql_finish(&standbyClient);
+			continue;
+		}
+
+		if (!hasReachedLSN)
+		{
+			log_warn("Node %lld \"%s\" has replayed WAL up to %s only, "
+					 "the primary checkpoint is at %s",
+					 (long long) node->nodeId,
+					 node->name,
+					 currentLSN,
+					 primaryLSN);
+		}
+
+		log_info("Running a restartpoint on node %lld \"%s\"",
+				 (long long) node->nodeId,
+				 node->name);
+
+		if (!pgsql_checkpoint(&standbyClient) ||
+			!pgsql_get_redo_distance(&standbyClient, &redoBytes))
+		{
+			log_warn("Failed to run a restartpoint on node %lld \"%s\"",
+					 (long long) node->nodeId,
+					 node->name);
+			pgsql_finish(&standbyClient);
+			continue;
+		}
+
+		(void) pretty_print_bytes(redoBytesStr, sizeof(redoBytesStr), redoBytes);
+
+		log_info("Node %lld \"%s\" (%s:%d) has %s of WAL to replay "
+				 "from its last restartpoint",
+				 (long long) node->nodeId,
+				 node->name,
+				 node->host,
+				 node->port,
+				 redoBytesStr);
+
+		pgsql_finish(&standbyClient);
+	}
+
+	nodeAddressArrayFree(&nodesArray);
+
+	return true;
+}
+
+
+/*
+ * cli_perform_checkpoint_connect prepares a connection to the given node
+ * using the pg_autoctl replication user.
+ */
+static bool
+cli_perform_checkpoint_connect(NodeAddress *node,
+							   PostgresSetup *pgSetup,
+							   PGSQL *pgsql)
+{
+	PostgresSetup nodeSetup = { 0 };
+	char connectionString[MAXCONNINFO] = { 0 };
+
+	strlcpy(nodeSetup.username, PG_AUTOCTL_REPLICA_USERNAME, NAMEDATALEN);
+	strlcpy(nodeSetup.dbname, pgSetup->dbname, NAMEDATALEN);
+	strlcpy(nodeSetup.pghost, node->host, _POSIX_HOST_NAME_MAX);
+	nodeSetup.pgport = node->port;
+	nodeSetup.ssl = pgSetup->ssl;
+
+	/*
+	 * Build the connection string as if to a local node, but we tweaked the
+	 * pgsetup to target the given node by changing its pghost and pgport.
+	 */
+	pg_setup_get_local_connection_string(&nodeSetup, connectionString);
+
+	return pgsql_init(pgsql, connectionString, PGSQL_CONN_UPSTREAM);
+}
+
+
 /*
  * cli_perform_promotion_getopts parses the command line options for the
  * command `pg_autoctl perform promotion` command.
@@ -521,8 +1197,6 @@ cli_perform_promotion(int argc, char **argv)
 
 	PgInstanceKind nodeKind = NODE_KIND_UNKNOWN;
 
-	char *channels[] = { "state", NULL };
-
 	keeper.config = keeperOptions;
 
 	(void) cli_monitor_init_from_option_or_config(monitor, config);
@@ -540,7 +1214,7 @@ cli_perform_promotion(int argc, char **argv)
 	}
 
 	/* start listening to the state changes before we call perform_promotion */
-	if (!pgsql_listen(&(monitor->notificationClient), channels))
+	if (!monitor_listen_state_changes(monitor, config->formation, groupId))
 	{
 		log_error("Failed to listen to state changes from the monitor");
 		exit(EXIT_CODE_MONITOR);
@@ -567,3 +1241,477 @@ cli_perform_promotion(int argc, char **argv)
 		}
 	}
 }
+
+
+/*
+ * cli_perform_rolling_restart restarts every Postgres node of a formation, or
+ * of the given group, with a single planned switchover per group:
+ *
+ *  1. each secondary node is restarted in turn, by a maintenance cycle, and
+ *     we wait until the monitor assigns it the secondary state again, which
+ *     only happens once it has caught up with the primary,
+ *  2. the most advanced restarted candidate is then promoted,
+ *  3. the old primary restarts as a standby on its way to the secondary
+ *     state, which completes the restart of the group.
+ *
+ * Writes are only unavailable during the promotion at step 2, and we report
+ * that duration at the end.
+ */
+static void
+cli_perform_rolling_restart(int argc, char **argv)
+{
+	KeeperConfig config = keeperOptions;
+	Monitor monitor = { 0 };
+	CurrentNodeStateArray nodesArray = { 0 };
+
+	int *groupIds = NULL;
+	int groupCount = 0;
+
+	uint64_t writeUnavailableMs = 0;
+
+	(void) cli_monitor_init_from_option_or_config(&monitor, &config);
+
+	if (!monitor_get_current_state(&monitor,
+								   config.formation,
+								   config.groupId,
+								   &nodesArray))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_MONITOR);
+	}
+
+	groupIds = (int *) calloc(nodesArray.count + 1, sizeof(int));
+
+	if (groupIds == NULL)
+	{
+		log_fatal(ALLOCATION_FAILED_ERROR);
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+
+	/* the current state is sorted by group id */
+	for (int i = 0; i < nodesArray.count; i++)
+	{
+		int groupId = nodesArray.nodes[i].groupId;
+
+		if (groupCount == 0 || groupIds[groupCount - 1] != groupId)
+		{
+			groupIds[groupCount++] = groupId;
+		}
+	}
+
+	currentNodeStateArrayFree(&nodesArray);
+
+	if (groupCount == 0)
+	{
+		log_fatal("The monitor currently has no Postgres nodes "
+				  "registered in formation \"%s\"",
+				  config.formation);
+		exit(EXIT_CODE_BAD_STATE);
+	}
+
+	for (int i = 0; i < groupCount; i++)
+	{
+		config.groupId = groupIds[i];
+
+		if (!cli_perform_rolling_restart_group(&monitor,
+											   &config,
+											   &writeUnavailableMs))
+		{
+			log_fatal("Failed to restart the nodes of group %d "
+					  "in formation \"%s\", see above for details",
+					  config.groupId, config.formation);
+			exit(EXIT_CODE_MONITOR);
+		}
+	}
+
+	free(groupIds);
+
+	log_info("Restarted %d group(s) in formation \"%s\", "
+			 "writes were unavailable for %" PRIu64 " ms in total",
+			 groupCount, config.formation, writeUnavailableMs);
+}
+
+
+/*
+ * cli_perform_rolling_restart_group restarts the nodes of the group
+ * config->groupId, and adds the duration of the switchover, if any, to
+ * writeUnavailableMs.
+ */
+static bool
+cli_perform_rolling_restart_group(Monitor *monitor,
+								  KeeperConfig *config,
+								  uint64_t *writeUnavailableMs)
+{
+	CurrentNodeStateArray nodesArray = { 0 };
+	CurrentNodeState *primaryNode = NULL;
+	int standbyCount = 0;
+
+	/* start listening to the state changes before we make any change */
+	if (!monitor_listen_state_changes(monitor, config->formation, config->groupId))
+	{
+		log_error("Failed to listen to state changes from the monitor");
+		return false;
+	}
+
+	if (!monitor_get_current_state(monitor,
+								   config->formation,
+								   config->groupId,
+								   &nodesArray))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	for (int i = 0; i < nodesArray.count; i++)
+	{
+		CurrentNodeState *nodeState = &(nodesArray.nodes[i]);
+
+		if (nodeState->reportedState == PRIMARY_STATE &&
+			nodeState->goalState == PRIMARY_STATE)
+		{
+			primaryNode = nodeState;
+		}
+		else if (nodeState->reportedState != SECONDARY_STATE ||
+				 nodeState->goalState != SECONDARY_STATE)
+		{
+			log_error("Node " NODE_FORMAT " in group %d is in state "
+											"\"%s\" (assigned \"%s\"), "
+											"a rolling restart needs a "
+											"stable group",
+					  nodeState->node.nodeId,
+					  nodeState->node.name,
+					  nodeState->node.host,
+					  nodeState->node.port,
+					  config->groupId,
+					  NodeStateToString(nodeState->reportedState),
+					  NodeStateToString(nodeState->goalState));
+			currentNodeStateArrayFree(&nodesArray);
+			return false;
+		}
+	}
+
+	if (primaryNode == NULL)
+	{
+		log_error("Group %d has no primary node, "
+				  "a rolling restart needs a stable group",
+				  config->groupId);
+		currentNodeStateArrayFree(&nodesArray);
+		return false;
+	}
+
+	/* first, restart the standby nodes one at a time */
+	for (int i = 0; i < nodesArray.count; i++)
+	{
+		CurrentNodeState *nodeState = &(nodesArray.nodes[i]);
+
+		if (nodeState == primaryNode)
+		{
+			continue;
+		}
+
+		if (!cli_perform_restart_standby(monitor, config, nodeState))
+		{
+			/* errors have already been logged */
+			currentNodeStateArrayFree(&nodesArray);
+			return false;
+		}
+
+		++standbyCount;
+	}
+
+	currentNodeStateArrayFree(&nodesArray);
+
+	if (standbyCount == 0)
+	{
+		log_warn("Group %d has no standby node, skipping the restart of its "
+				 "primary node, which would make writes unavailable",
+				 config->groupId);
+		return true;
+	}
+
+	/* now pick the most advanced restarted candidate for the switchover */
+	if (!monitor_get_current_state(monitor,
+								   config->formation,
+								   config->groupId,
+								   &nodesArray))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	CurrentNodeState *candidate = NULL;
+	uint64_t candidateLSN = 0;
+
+	for (int i = 0; i < nodesArray.count; i++)
+	{
+		CurrentNodeState *nodeState = &(nodesArray.nodes[i]);
+		uint64_t lsn = 0;
+
+		if (nodeState->reportedState != SECONDARY_STATE ||
+			nodeState->candidatePriority == 0 ||
+			!parseLSN(nodeState->node.lsn, &lsn))
+		{
+			continue;
+		}
+
+		if (candidate == NULL || lsn > candidateLSN)
+		{
+			candidate = nodeState;
+			candidateLSN = lsn;
+		}
+	}
+
+	if (candidate == NULL)
+	{
+		log_warn("Group %d has no candidate for failover, skipping the "
+				 "restart of its primary node, which would make writes "
+				 "unavailable",
+				 config->groupId);
+		currentNodeStateArrayFree(&nodesArray);
+		return true;
+	}
+
+	if (performCheckpoint && !cli_perform_checkpoint(monitor, config))
+	{
+		log_warn("Failed to checkpoint the nodes of group %d before "
+				 "switchover, see above for details",
+				 config->groupId);
+	}
+
+	NodeAddress newPrimary = candidate->node;
+	PgInstanceKind nodeKind = candidate->pgKind;
+	int64_t oldPrimaryNodeId = primaryNode->node.nodeId;
+
+	currentNodeStateArrayFree(&nodesArray);
+
+	log_info("Switching over group %d to node " NODE_FORMAT " at LSN %s",
+			 config->groupId,
+			 newPrimary.nodeId, newPrimary.name,
+			 newPrimary.host, newPrimary.port,
+			 newPrimary.lsn);
+
+	instr_time startTime;
+	instr_time duration;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	if (!monitor_perform_promotion(monitor, config->formation, newPrimary.name))
+	{
+		log_error("Failed to promote node " NODE_FORMAT,
+				  newPrimary.nodeId, newPrimary.name,
+				  newPrimary.host, newPrimary.port);
+		return false;
+	}
+
+	if (!monitor_wait_until_some_node_reported_state(
+			monitor,
+			config->formation,
+			config->groupId,
+			nodeKind,
+			PRIMARY_STATE,
+			config->listen_notifications_timeout))
+	{
+		log_error("Failed to wait until a new primary has been notified");
+		return false;
+	}
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	*writeUnavailableMs += (uint64_t) INSTR_TIME_GET_MILLISEC(duration);
+
+	log_info("Group %d switched over in %.0f ms",
+			 config->groupId, INSTR_TIME_GET_MILLISEC(duration));
+
+	/* the old primary restarts as a standby on its way to secondary */
+	NodeState targetStates[] = { SECONDARY_STATE };
+
+	if (!monitor_wait_until_node_reported_state(monitor,
+												config->formation,
+												config->groupId,
+												oldPrimaryNodeId,
+												nodeKind,
+												targetStates,
+												lengthof(targetStates)))
+	{
+		log_error("Failed to wait until the old primary node %" PRId64
+				  " reached the secondary state",
+				  oldPrimaryNodeId);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * cli_perform_restart_standby restarts a secondary node with a maintenance
+ * cycle: the keeper restarts Postgres when the node leaves maintenance, and
+ * the monitor assigns the secondary state back once the node has caught up.
+ */
+static bool
+cli_perform_restart_standby(Monitor *monitor,
+							KeeperConfig *config,
+							CurrentNodeState *nodeState)
+{
+	int64_t nodeId = nodeState->node.nodeId;
+	bool mayRetry = false;
+
+	log_info("Restarting node " NODE_FORMAT " in group %d",
+			 nodeId, nodeState->node.name,
+			 nodeState->node.host, nodeState->node.port,
+			 config->groupId);
+
+	if (!monitor_start_maintenance(monitor, nodeId, &mayRetry))
+	{
+		log_error("Failed to enable maintenance of node %" PRId64
+				  " on the monitor, see above for details",
+				  nodeId);
+		return false;
+	}
+
+	NodeState maintenanceStates[] = { MAINTENANCE_STATE };
+
+	if (!monitor_wait_until_node_reported_state(monitor,
+												config->formation,
+												config->groupId,
+												nodeId,
+												nodeState->pgKind,
+												maintenanceStates,
+												lengthof(maintenanceStates)))
+	{
+		log_error("Failed to wait until node %" PRId64
+				  " reached the maintenance state",
+				  nodeId);
+		return false;
+	}
+
+	if (!monitor_stop_maintenance(monitor, nodeId, &mayRetry))
+	{
+		log_error("Failed to disable maintenance of node %" PRId64
+				  " on the monitor, see above for details",
+				  nodeId);
+		return false;
+	}
+
+	NodeState secondaryStates[] = { SECONDARY_STATE };
+
+	if (!monitor_wait_until_node_reported_state(monitor,
+												config->formation,
+												config->groupId,
+												nodeId,
+												nodeState->pgKind,
+												secondaryStates,
+												lengthof(secondaryStates)))
+	{
+		log_error("Failed to wait until node %" PRId64
+				  " reached the secondary state",
+				  nodeId);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * cli_perform_move_formation moves a formation and its nodes from the
+ * monitor that manages it to the monitor at the given connection string:
+ *
+ *  1. the formation and its nodes are exported from the current monitor,
+ *  2. and imported on the target monitor, with the same node ids and states,
+ *  3. then removed from the current monitor, which registers the target
+ *     monitor in its formation directory.
+ *
+ * The keepers of the nodes then fail to call node_active on the current
+ * monitor, find the target monitor in its formation directory, and edit
+ * their configuration to use it from then on: the nodes don't register
+ * again.
+ */
+static void
+cli_perform_move_formation(int argc, char **argv)
+{
+	KeeperConfig config = keeperOptions;
+	Monitor monitor = { 0 };
+	Monitor targetMonitor = { 0 };
+
+	char *export = NULL;
+	int importedCount = 0;
+	int forwardedCount = 0;
+
+	if (argc != 1)
+	{
+		commandline_help(stderr);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	char *targetURI = argv[0];
+
+	if (!validate_connection_string(targetURI))
+	{
+		log_fatal("Failed to parse the target monitor connection string, "
+				  "see above for details.");
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	(void) cli_monitor_init_from_option_or_config(&monitor, &config);
+
+	if (streq(monitor.pgsql.connectionString, targetURI))
+	{
+		log_fatal("Formation \"%s\" is already managed by the monitor at "
+				  "\"%s\"",
+				  config.formation, targetURI);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	if (!monitor_init(&targetMonitor, targetURI))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	if (!monitor_export_formation(&monitor, config.formation, &export))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_MONITOR);
+	}
+
+	if (!monitor_import_formation(&targetMonitor, export, &importedCount))
+	{
+		log_fatal("Failed to move formation \"%s\", "
+				  "the current monitor still manages it",
+				  config.formation);
+		free(export);
+		exit(EXIT_CODE_MONITOR);
+	}
+
+	free(export);
+
+	log_info("Imported formation \"%s\" with %d node(s) on the monitor "
+			 "at \"%s\"",
+			 config.formation, importedCount, targetURI);
+
+	if (!monitor_forward_formation(&monitor,
+								   config.formation,
+								   targetURI,
+								   &forwardedCount))
+	{
+		log_fatal("Failed to remove formation \"%s\" from the current "
+				  "monitor, which now is registered on both monitors",
+				  config.formation);
+		log_info("Call pgautofailover.forward_formation() on the current "
+				 "monitor so that the nodes follow the formation");
+		exit(EXIT_CODE_MONITOR);
+	}
+
+	if (forwardedCount != importedCount)
+	{
+		log_warn("Removed %d node(s) from the current monitor, "
+				 "but imported %d node(s) on the target monitor",
+				 forwardedCount, importedCount);
+	}
+
+	log_info("Formation \"%s\" is now managed by the monitor at \"%s\", "
+			 "its nodes are going to follow at their next call to the monitor",
+			 config.formation, targetURI);
+}
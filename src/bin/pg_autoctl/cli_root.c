@@ -39,10 +39,12 @@ CommandLine create_commands =
 CommandLine *show_subcommands_with_debug[] = {
 	&show_uri_command,
 	&show_events_command,
+	&show_failovers_command,
 	&show_state_command,
 	&show_settings_command,
 	&show_standby_names_command,
 	&show_file_command,
+	&show_transitions_command,
 	&systemd_cat_service_file_command,
 	NULL
 };
@@ -55,10 +57,12 @@ CommandLine show_commands_with_debug =
 CommandLine *show_subcommands[] = {
 	&show_uri_command,
 	&show_events_command,
+	&show_failovers_command,
 	&show_state_command,
 	&show_settings_command,
 	&show_standby_names_command,
 	&show_file_command,
+	&show_transitions_command,
 	&systemd_cat_service_file_command,
 	NULL
 };
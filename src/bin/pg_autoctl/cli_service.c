@@ -23,6 +23,7 @@
 #include "fsm.h"
 #include "keeper_config.h"
 #include "keeper.h"
+#include "keeper_metrics.h"
 #include "monitor.h"
 #include "monitor_config.h"
 #include "pidfile.h"
@@ -31,6 +32,7 @@
 #include "signals.h"
 
 static int stop_signal = SIGTERM;
+static bool statusFast = false;
 
 static void cli_service_run(int argc, char **argv);
 static void cli_keeper_run(int argc, char **argv);
@@ -40,16 +42,19 @@ static int cli_getopt_pgdata_and_mode(int argc, char **argv);
 
 static void cli_service_stop(int argc, char **argv);
 static void cli_service_reload(int argc, char **argv);
+static int cli_getopt_status(int argc, char **argv);
 static void cli_service_status(int argc, char **argv);
+static void cli_service_status_fast(ConfigFilePaths *pathnames);
 
 CommandLine service_run_command =
 	make_command("run",
 				 "Run the pg_autoctl service (monitor or keeper)",
-				 " [ --pgdata --nodename --hostname --pgport ] ",
+				 " [ --pgdata --nodename --hostname --pgport --log-format ] ",
 				 "  --pgdata      path to data directory\n"
 				 "  --nodename    pg_auto_failover node name\n"
 				 "  --hostname    hostname used to connect from other nodes\n"
-				 "  --pgport      PostgreSQL's port number\n",
+				 "  --pgport      PostgreSQL's port number\n"
+				 "  --log-format  log format, either text (default) or json\n",
 				 cli_node_metadata_getopts,
 				 cli_service_run);
 
@@ -74,9 +79,11 @@ CommandLine service_reload_command =
 CommandLine service_status_command =
 	make_command("status",
 				 "Display the current status of the pg_autoctl service",
-				 CLI_PGDATA_USAGE,
-				 CLI_PGDATA_OPTION,
-				 cli_getopt_pgdata,
+				 " [ --pgdata --fast --json ] ",
+				 "  --pgdata      path to data directory \n"
+				 "  --fast        only read the keeper shared status \n"
+				 "  --json        output data in the JSON format\n",
+				 cli_getopt_status,
 				 cli_service_status);
 
 
@@ -417,6 +424,120 @@ cli_getopt_pgdata_and_mode(int argc, char **argv)
 }
 
 
+/*
+ * cli_getopt_status gets the --pgdata, --fast and --json options from the
+ * command line.
+ */
+static int
+cli_getopt_status(int argc, char **argv)
+{
+	KeeperConfig options = { 0 };
+	int c, option_index = 0;
+	int verboseCount = 0;
+
+	static struct option long_options[] = {
+		{ "pgdata", required_argument, NULL, 'D' },
+		{ "fast", no_argument, NULL, 'f' },
+		{ "json", no_argument, NULL, 'J' },
+		{ "version", no_argument, NULL, 'V' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "quiet", no_argument, NULL, 'q' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	optind = 0;
+
+	while ((c = getopt_long(argc, argv, "D:fJVvqh",
+							long_options, &option_index)) != -1)
+	{
+		switch (c)
+		{
+			case 'D':
+			{
+				strlcpy(options.pgSetup.pgdata, optarg, MAXPGPATH);
+				log_trace("--pgdata %s", options.pgSetup.pgdata);
+				break;
+			}
+
+			case 'f':
+			{
+				statusFast = true;
+				log_trace("--fast");
+				break;
+			}
+
+			case 'J':
+			{
+				outputJSON = true;
+				log_trace("--json");
+				break;
+			}
+
+			case 'V':
+			{
+				/* keeper_cli_print_version prints version and exits. */
+				keeper_cli_print_version(argc, argv);
+				break;
+			}
+
+			case 'v':
+			{
+				++verboseCount;
+				switch (verboseCount)
+				{
+					case 1:
+					{
+						log_set_level(LOG_INFO);
+						break;
+					}
+
+					case 2:
+					{
+						log_set_level(LOG_DEBUG);
+						break;
+					}
+
+					default:
+					{
+						log_set_level(LOG_TRACE);
+						break;
+					}
+				}
+				break;
+			}
+
+			case 'q':
+			{
+				log_set_level(LOG_ERROR);
+				break;
+			}
+
+			case 'h':
+			{
+				commandline_help(stderr);
+				exit(EXIT_CODE_QUIT);
+				break;
+			}
+
+			default:
+			{
+				commandline_help(stderr);
+				exit(EXIT_CODE_BAD_ARGS);
+				break;
+			}
+		}
+	}
+
+	/* now that we have the command line parameters, prepare the options */
+	(void) prepare_keeper_options(&options);
+
+	keeperOptions = options;
+
+	return optind;
+}
+
+
 /*
  * cli_service_stop sends a SIGTERM signal to the keeper.
  */
@@ -478,6 +599,13 @@ cli_service_status(int argc, char **argv)
 
 	keeper.config = keeperOptions;
 
+	/* skip reading the configuration and probing Postgres entirely */
+	if (statusFast)
+	{
+		(void) cli_service_status_fast(pathnames);
+		return;
+	}
+
 	if (!cli_common_pgsetup_init(pathnames, pgSetup))
 	{
 		/* errors have already been logged */
@@ -553,3 +681,90 @@ cli_service_status(int argc, char **argv)
 		(void) cli_pprint_json(js);
 	}
 }
+
+
+/*
+ * cli_service_status_fast displays the status of the pg_autoctl service as
+ * published by the keeper node-active process in the shared keeper metrics
+ * file, in the same way as the metrics service reads it. We only read the
+ * pidfile and map the metrics file: no configuration file parsing, no
+ * pg_ctl, no connection to either Postgres or the monitor. That makes it
+ * cheap enough for liveness and readiness probes that run every few seconds.
+ */
+static void
+cli_service_status_fast(ConfigFilePaths *pathnames)
+{
+	pid_t pid = 0;
+	KeeperMetrics metrics = { 0 };
+
+	if (!read_pidfile(pathnames->pid, &pid))
+	{
+		log_info("pg_autoctl is not running");
+		exit(PG_CTL_STATUS_NOT_RUNNING);
+	}
+
+	if (!keeper_metrics_attach(pathnames->metrics) ||
+		!keeper_metrics_snapshot(&metrics))
+	{
+		log_error("Failed to read the keeper shared status in \"%s\", "
+				  "which is only maintained on keeper nodes",
+				  pathnames->metrics);
+		exit(EXIT_CODE_BAD_STATE);
+	}
+
+	(void) keeper_metrics_detach();
+
+	char lastLoop[MAXCTIMESIZE] = { 0 };
+	char lastMonitorContact[MAXCTIMESIZE] = { 0 };
+
+	(void) epoch_to_string(metrics.lastLoopTime, lastLoop);
+	(void) epoch_to_string(metrics.lastMonitorContact, lastMonitorContact);
+
+	if (outputJSON)
+	{
+		JSON_Value *js = json_value_init_object();
+		JSON_Object *root = json_value_get_object(js);
+
+		json_object_set_number(root, "pid", (double) pid);
+		json_object_set_string(root, "status", "running");
+		json_object_set_number(root, "nodeId", (double) metrics.nodeId);
+		json_object_set_number(root, "groupId", (double) metrics.groupId);
+		json_object_set_string(root, "current_role",
+							   NodeStateToString(metrics.currentRole));
+		json_object_set_string(root, "assigned_role",
+							   NodeStateToString(metrics.assignedRole));
+		json_object_set_string(root, "last_loop", lastLoop);
+		json_object_set_string(root, "last_monitor_contact",
+							   lastMonitorContact);
+		json_object_set_boolean(root, "pg_is_running", metrics.pgIsRunning);
+
+		(void) cli_pprint_json(js);
+	}
+	else
+	{
+		log_info("pg_autoctl is running with pid %d", pid);
+
+		if (metrics.lastLoopTime == 0)
+		{
+			log_info("pg_autoctl is starting");
+		}
+		else
+		{
+			log_info("Node %lld in group %d: current state \"%s\", "
+					 "assigned state \"%s\"",
+					 (long long) metrics.nodeId,
+					 metrics.groupId,
+					 NodeStateToString(metrics.currentRole),
+					 NodeStateToString(metrics.assignedRole));
+			log_info("Last keeper loop at %s, last monitor contact at %s",
+					 lastLoop, lastMonitorContact);
+			log_info("Postgres %s running",
+					 metrics.pgIsRunning ? "is" : "is not");
+		}
+	}
+
+	if (!metrics.pgIsRunning)
+	{
+		exit(EXIT_CODE_PGCTL);
+	}
+}
@@ -32,16 +32,27 @@
 #include "pidfile.h"
 #include "state.h"
 #include "string_utils.h"
+#include "system_utils.h"
 #include "watch.h"
 
 static int eventCount = 10;
+static int64_t sinceEventId = -1;
+static char sinceTime[BUFSIZE] = { 0 };
+static char eventType[NAMEDATALEN] = { 0 };
+static bool follow = false;
 static bool localState = false;
 static bool watch = false;
 
 static int cli_show_state_getopts(int argc, char **argv);
 static void cli_show_state(int argc, char **argv);
 static void cli_show_local_state(void);
+static void cli_show_basebackup_progress(const char *filename);
+static void cli_show_crash_recovery_progress(const char *filename);
 static void cli_show_events(int argc, char **argv);
+static void cli_show_events_stream(Monitor *monitor, KeeperConfig *config);
+static void cli_show_events_notification(void *context,
+										 CurrentNodeState *nodeState);
+static void cli_show_failovers(int argc, char **argv);
 
 static int cli_show_standby_names_getopts(int argc, char **argv);
 static void cli_show_standby_names(int argc, char **argv);
@@ -50,6 +61,8 @@ static int cli_show_file_getopts(int argc, char **argv);
 static void cli_show_file(int argc, char **argv);
 static bool fprint_file_contents(const char *filename);
 
+static void cli_show_transitions(int argc, char **argv);
+
 static int cli_show_uri_getopts(int argc, char **argv);
 static void cli_show_uri(int argc, char **argv);
 
@@ -67,61 +80,87 @@ static void print_all_uri(SSLOptions *ssl,
 CommandLine show_uri_command =
 	make_command("uri",
 				 "Show the postgres uri to use to connect to pg_auto_failover nodes",
-				 " [ --pgdata --formation --json ] ",
-				 "  --pgdata      path to data directory\n"
-				 "  --formation   show the coordinator uri of given formation\n"
-				 "  --json        output data in the JSON format\n",
+				 " [ --pgdata --formation --readonly --prefer-standby --max-lag --json ] ",
+				 "  --pgdata          path to data directory\n"
+				 "  --monitor-ro      read-only Monitor Postgres URL, such as a standby\n"
+				 "  --formation       show the coordinator uri of given formation\n"
+				 "  --readonly        show the uri of the secondary nodes, by lag\n"
+				 "  --prefer-standby  same as --readonly, then the primary node\n"
+				 "  --max-lag         skip secondary nodes lagging more (bytes)\n"
+				 "  --json            output data in the JSON format\n",
 				 cli_show_uri_getopts,
 				 cli_show_uri);
 
 CommandLine show_events_command =
 	make_command("events",
 				 "Prints monitor's state of nodes in a given formation and group",
-				 " [ --pgdata --formation --group --count ] ",
+				 " [ --pgdata --formation --group --count --type --since-eventid --since-time --follow ] ",
+				 "  --pgdata         path to data directory	 \n"
+				 "  --monitor        pg_auto_failover Monitor Postgres URL\n"
+				 "  --monitor-ro     read-only Monitor Postgres URL, such as a standby\n" \
+				 "  --formation      formation to query, defaults to 'default' \n"
+				 "  --group          group to query formation, defaults to all \n"
+				 "  --count          how many events to fetch, defaults to 10 \n"
+				 "  --type           only fetch events of this type, such as failover\n"
+				 "  --since-eventid  print all the events after this event id\n"
+				 "  --since-time     print all the events since this timestamp\n"
+				 "  --follow         keep printing new events as they happen\n"
+				 "  --watch          display an auto-updating dashboard\n"
+				 "  --json           output data in the JSON format\n",
+				 cli_show_state_getopts,
+				 cli_show_events);
+
+CommandLine show_failovers_command =
+	make_command("failovers",
+				 "Prints the phases of the last failovers of a formation",
+				 " [ --pgdata --formation --count ] ",
 				 "  --pgdata      path to data directory	 \n"
-				 "  --monitor     pg_auto_failover Monitor Postgres URL\n" \
+				 "  --monitor     pg_auto_failover Monitor Postgres URL\n"
+				 "  --monitor-ro  read-only Monitor Postgres URL, such as a standby\n"
 				 "  --formation   formation to query, defaults to 'default' \n"
-				 "  --group       group to query formation, defaults to all \n"
-				 "  --count       how many events to fetch, defaults to 10 \n"
-				 "  --watch       display an auto-updating dashboard\n"
+				 "  --count       how many failovers to fetch, defaults to 10 \n"
 				 "  --json        output data in the JSON format\n",
 				 cli_show_state_getopts,
-				 cli_show_events);
+				 cli_show_failovers);
 
 CommandLine show_state_command =
 	make_command("state",
 				 "Prints monitor's state of nodes in a given formation and group",
-				 " [ --pgdata --formation --group ] ",
-				 "  --pgdata      path to data directory	 \n"
-				 "  --monitor     pg_auto_failover Monitor Postgres URL\n"
-				 "  --formation   formation to query, defaults to 'default' \n"
-				 "  --group       group to query formation, defaults to all \n"
-				 "  --local       show local data, do not connect to the monitor\n"
-				 "  --watch       display an auto-updating dashboard\n"
-				 "  --json        output data in the JSON format\n",
+				 " [ --pgdata --formation --group --all-formations ] ",
+				 "  --pgdata          path to data directory	 \n"
+				 "  --monitor         pg_auto_failover Monitor Postgres URL\n"
+				 "  --monitor-ro      read-only Monitor Postgres URL, such as a standby\n"
+				 "  --formation       formation to query, defaults to 'default' \n"
+				 "  --group           group to query formation, defaults to all \n"
+				 "  --all-formations  show the state of every formation\n"
+				 "  --local           show local data, do not connect to the monitor\n"
+				 "  --watch           display an auto-updating dashboard\n"
+				 "  --json            output data in the JSON format\n",
 				 cli_show_state_getopts,
 				 cli_show_state);
 
 CommandLine show_settings_command =
 	make_command("settings",
 				 "Print replication settings for a formation from the monitor",
-				 " [ --pgdata ] [ --json ] [ --formation ] ",
-				 "  --pgdata      path to data directory\n"
-				 "  --monitor     pg_auto_failover Monitor Postgres URL\n"
-				 "  --json        output data in the JSON format\n"
-				 "  --formation   pg_auto_failover formation\n",
+				 " [ --pgdata ] [ --json ] [ --formation | --all-formations ] ",
+				 "  --pgdata          path to data directory\n"
+				 "  --monitor         pg_auto_failover Monitor Postgres URL\n"
+				 "  --json            output data in the JSON format\n"
+				 "  --formation       pg_auto_failover formation\n"
+				 "  --all-formations  show the settings of every formation\n",
 				 cli_get_name_getopts,
 				 cli_get_formation_settings);
 
 CommandLine show_standby_names_command =
 	make_command("standby-names",
 				 "Prints synchronous_standby_names for a given group",
-				 " [ --pgdata ] --formation --group",
-				 "  --pgdata      path to data directory	 \n"
-				 "  --monitor     show the monitor uri\n"
-				 "  --formation   formation to query, defaults to 'default'\n"
-				 "  --group       group to query formation, defaults to all\n"
-				 "  --json        output data in the JSON format\n",
+				 " [ --pgdata ] --formation --group | --all-formations",
+				 "  --pgdata          path to data directory	 \n"
+				 "  --monitor         show the monitor uri\n"
+				 "  --formation       formation to query, defaults to 'default'\n"
+				 "  --group           group to query formation, defaults to all\n"
+				 "  --all-formations  show every group of every formation\n"
+				 "  --json            output data in the JSON format\n",
 				 cli_show_standby_names_getopts,
 				 cli_show_standby_names);
 
@@ -139,6 +178,15 @@ CommandLine show_file_command =
 				 cli_show_file_getopts,
 				 cli_show_file);
 
+CommandLine show_transitions_command =
+	make_command("transitions",
+				 "Prints the last state machine transitions of this node",
+				 " [ --pgdata --json ] ",
+				 "  --pgdata      path to data directory \n"
+				 "  --json        output data in the JSON format\n",
+				 cli_getopt_pgdata,
+				 cli_show_transitions);
+
 typedef enum
 {
 	SHOW_FILE_UNKNOWN = 0,      /* no option selected yet */
@@ -160,6 +208,9 @@ static ShowFileOptions showFileOptions;
 typedef struct ShowUriOptions
 {
 	bool monitorOnly;
+	bool readOnly;
+	bool preferStandby;
+	int64_t maxLag;
 	char formation[NAMEDATALEN];
 	char citusClusterName[NAMEDATALEN];
 } ShowUriOptions;
@@ -181,9 +232,15 @@ cli_show_state_getopts(int argc, char **argv)
 	static struct option long_options[] = {
 		{ "pgdata", required_argument, NULL, 'D' },
 		{ "monitor", required_argument, NULL, 'm' },
+		{ "monitor-ro", required_argument, NULL, 'R' },
 		{ "formation", required_argument, NULL, 'f' },
 		{ "group", required_argument, NULL, 'g' },
+		{ "all-formations", no_argument, NULL, 'A' },
 		{ "count", required_argument, NULL, 'n' },
+		{ "type", required_argument, NULL, 't' },
+		{ "since-eventid", required_argument, NULL, 'I' },
+		{ "since-time", required_argument, NULL, 'T' },
+		{ "follow", no_argument, NULL, 'F' },
 		{ "local", no_argument, NULL, 'L' },
 		{ "watch", no_argument, NULL, 'W' },
 		{ "json", no_argument, NULL, 'J' },
@@ -229,6 +286,19 @@ cli_show_state_getopts(int argc, char **argv)
 				break;
 			}
 
+			case 'R':
+			{
+				if (!validate_connection_string(optarg))
+				{
+					log_fatal("Failed to parse --monitor-ro connection string, "
+							  "see above for details.");
+					exit(EXIT_CODE_BAD_ARGS);
+				}
+				strlcpy(monitorReadOnlyURI, optarg, MAXCONNINFO);
+				log_trace("--monitor-ro %s", monitorReadOnlyURI);
+				break;
+			}
+
 			case 'f':
 			{
 				strlcpy(options.formation, optarg, NAMEDATALEN);
@@ -248,6 +318,13 @@ cli_show_state_getopts(int argc, char **argv)
 				break;
 			}
 
+			case 'A':
+			{
+				allFormations = true;
+				log_trace("--all-formations");
+				break;
+			}
+
 			case 'n':
 			{
 				if (!stringToInt(optarg, &eventCount))
@@ -260,6 +337,40 @@ cli_show_state_getopts(int argc, char **argv)
 				break;
 			}
 
+			case 't':
+			{
+				strlcpy(eventType, optarg, sizeof(eventType));
+				log_trace("--type %s", eventType);
+				break;
+			}
+
+			case 'I':
+			{
+				if (!stringToInt64(optarg, &sinceEventId) || sinceEventId < 0)
+				{
+					log_fatal("--since-eventid argument is not a valid "
+							  "event id: \"%s\"",
+							  optarg);
+					exit(EXIT_CODE_BAD_ARGS);
+				}
+				log_trace("--since-eventid %lld", (long long) sinceEventId);
+				break;
+			}
+
+			case 'T':
+			{
+				strlcpy(sinceTime, optarg, sizeof(sinceTime));
+				log_trace("--since-time %s", sinceTime);
+				break;
+			}
+
+			case 'F':
+			{
+				follow = true;
+				log_trace("--follow");
+				break;
+			}
+
 			case 'V':
 			{
 				/* keeper_cli_print_version prints version and exits. */
@@ -347,12 +458,36 @@ cli_show_state_getopts(int argc, char **argv)
 		exit(EXIT_CODE_BAD_ARGS);
 	}
 
+	if (watch &&
+		(follow || sinceEventId >= 0 || !IS_EMPTY_STRING_BUFFER(sinceTime)))
+	{
+		log_error("Please use either --watch or --follow and --since-eventid "
+				  "or --since-time, but not both");
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	if (!IS_EMPTY_STRING_BUFFER(eventType) &&
+		(watch || follow ||
+		 sinceEventId >= 0 || !IS_EMPTY_STRING_BUFFER(sinceTime)))
+	{
+		log_error("Please use either --type or --watch, --follow, "
+				  "--since-eventid or --since-time, but not both");
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
 	if (watch && outputJSON)
 	{
 		log_error("Please use either --json or --watch, but not both");
 		exit(EXIT_CODE_BAD_ARGS);
 	}
 
+	if (allFormations && (watch || localState))
+	{
+		log_error("Please use either --all-formations or --watch or --local, "
+				  "but not both");
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
 	if (localState)
 	{
 		cli_common_get_set_pgdata_or_exit(&(options.pgSetup));
@@ -413,6 +548,7 @@ cli_show_events(int argc, char **argv)
 		WatchContext context = { 0 };
 
 		(void) cli_monitor_init_from_option_or_config(&(context.monitor), &config);
+		(void) cli_monitor_init_read_client(&(context.monitor));
 
 		strlcpy(context.formation, config.formation, sizeof(context.formation));
 		context.groupId = config.groupId;
@@ -423,12 +559,22 @@ cli_show_events(int argc, char **argv)
 	}
 
 	(void) cli_monitor_init_from_option_or_config(&monitor, &config);
+	(void) cli_monitor_init_read_client(&monitor);
+
+	if (follow || sinceEventId >= 0 || !IS_EMPTY_STRING_BUFFER(sinceTime))
+	{
+		(void) cli_show_events_stream(&monitor, &config);
+		exit(EXIT_CODE_QUIT);
+	}
+
+	char *typeFilter = IS_EMPTY_STRING_BUFFER(eventType) ? NULL : eventType;
 
 	if (outputJSON)
 	{
 		if (!monitor_print_last_events_as_json(&monitor,
 											   config.formation,
 											   config.groupId,
+											   typeFilter,
 											   eventCount,
 											   stdout))
 		{
@@ -441,6 +587,7 @@ cli_show_events(int argc, char **argv)
 		if (!monitor_print_last_events(&monitor,
 									   config.formation,
 									   config.groupId,
+									   typeFilter,
 									   eventCount))
 		{
 			/* errors have already been logged */
@@ -450,6 +597,168 @@ cli_show_events(int argc, char **argv)
 }
 
 
+/*
+ * cli_show_events_stream prints all the events since --since-eventid or
+ * --since-time, and then when using --follow keeps printing new events as
+ * they are inserted on the monitor, until interrupted. With --follow alone we
+ * start with the last --count events, as in tail -f.
+ *
+ * The JSON output uses a JSON object per line, so that it can be streamed.
+ */
+static void
+cli_show_events_stream(Monitor *monitor, KeeperConfig *config)
+{
+	int64_t lastEventId = sinceEventId >= 0 ? sinceEventId : 0;
+
+	if (sinceEventId < 0 && IS_EMPTY_STRING_BUFFER(sinceTime) && eventCount > 0)
+	{
+		static MonitorEventsArray eventsArray = { 0 };
+
+		if (!monitor_get_last_events(monitor,
+									 config->formation,
+									 config->groupId,
+									 Min(eventCount, EVENTS_ARRAY_MAX_COUNT),
+									 &eventsArray))
+		{
+			/* errors have already been logged */
+			exit(EXIT_CODE_MONITOR);
+		}
+
+		if (eventsArray.count > 0)
+		{
+			lastEventId = eventsArray.events[0].eventId - 1;
+		}
+		else
+		{
+			/* no events yet, only print the ones that come next */
+			lastEventId = 0;
+		}
+	}
+
+	if (!outputJSON)
+	{
+		(void) monitor_print_events_header();
+	}
+
+	if (!monitor_stream_events(monitor,
+							   config->formation,
+							   config->groupId,
+							   sinceTime,
+							   outputJSON,
+							   &lastEventId))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_MONITOR);
+	}
+
+	if (!follow)
+	{
+		return;
+	}
+
+	/*
+	 * Now wait for new events. Every event on the monitor comes with a state
+	 * change notification, so we only query the monitor when we receive one,
+	 * and now and then in case the notification connection fails, or when
+	 * using --monitor-ro and the standby had not replayed the events yet.
+	 */
+	bool listening = true;
+	bool eventsNeedUpdate = false;
+	instr_time updateTime;
+
+	INSTR_TIME_SET_CURRENT(updateTime);
+
+	for (;;)
+	{
+		instr_time elapsed;
+
+		if (listening)
+		{
+			listening =
+				monitor_poll_state_notifications(monitor,
+												 config->formation,
+												 config->groupId,
+												 (void *) &eventsNeedUpdate,
+												 &cli_show_events_notification);
+		}
+
+		INSTR_TIME_SET_CURRENT(elapsed);
+		INSTR_TIME_SUBTRACT(elapsed, updateTime);
+
+		int interval =
+			listening
+			? WATCH_LISTEN_UPDATE_INTERVAL_MS
+			: WATCH_UPDATE_INTERVAL_MS;
+
+		if (eventsNeedUpdate || INSTR_TIME_GET_MILLISEC(elapsed) >= interval)
+		{
+			eventsNeedUpdate = false;
+			INSTR_TIME_SET_CURRENT(updateTime);
+
+			/* errors have already been logged, try again later */
+			(void) monitor_stream_events(monitor,
+										 config->formation,
+										 config->groupId,
+										 sinceTime,
+										 outputJSON,
+										 &lastEventId);
+		}
+
+		pg_usleep(100 * 1000);
+	}
+}
+
+
+/*
+ * cli_show_events_notification is a Notification Processing Function that
+ * registers that new events are available on the monitor.
+ */
+static void
+cli_show_events_notification(void *context, CurrentNodeState *nodeState)
+{
+	bool *eventsNeedUpdate = (bool *) context;
+
+	*eventsNeedUpdate = true;
+}
+
+
+/*
+ * cli_show_failovers prints the phases of the most recent failovers known to
+ * the monitor, with their durations.
+ */
+static void
+cli_show_failovers(int argc, char **argv)
+{
+	KeeperConfig config = keeperOptions;
+	Monitor monitor = { 0 };
+
+	(void) cli_monitor_init_from_option_or_config(&monitor, &config);
+	(void) cli_monitor_init_read_client(&monitor);
+
+	if (outputJSON)
+	{
+		if (!monitor_print_last_failovers_as_json(&monitor,
+												  config.formation,
+												  eventCount,
+												  stdout))
+		{
+			/* errors have already been logged */
+			exit(EXIT_CODE_MONITOR);
+		}
+	}
+	else
+	{
+		if (!monitor_print_last_failovers(&monitor,
+										  config.formation,
+										  eventCount))
+		{
+			/* errors have already been logged */
+			exit(EXIT_CODE_MONITOR);
+		}
+	}
+}
+
+
 /*
  * keeper_cli_monitor_print_state prints the current state of given formation
  * and port from the monitor's point of view.
@@ -499,6 +808,7 @@ cli_show_state(int argc, char **argv)
 		WatchContext context = { 0 };
 
 		(void) cli_monitor_init_from_option_or_config(&(context.monitor), &config);
+		(void) cli_monitor_init_read_client(&(context.monitor));
 
 		strlcpy(context.formation, config.formation, sizeof(context.formation));
 		context.groupId = config.groupId;
@@ -509,6 +819,22 @@ cli_show_state(int argc, char **argv)
 	}
 
 	(void) cli_monitor_init_from_option_or_config(&monitor, &config);
+	(void) cli_monitor_init_read_client(&monitor);
+
+	if (allFormations)
+	{
+		bool success = outputJSON
+					   ? monitor_print_every_formation_state_as_json(&monitor)
+					   : monitor_print_every_formation_state(&monitor);
+
+		if (!success)
+		{
+			/* errors have already been logged */
+			exit(EXIT_CODE_MONITOR);
+		}
+
+		return;
+	}
 
 	if (outputJSON)
 	{
@@ -526,10 +852,113 @@ cli_show_state(int argc, char **argv)
 			/* errors have already been logged */
 			exit(EXIT_CODE_MONITOR);
 		}
+
+		if (!IS_EMPTY_STRING_BUFFER(config.pgSetup.pgdata))
+		{
+			(void) cli_show_basebackup_progress(config.pathnames.basebackup);
+			(void) cli_show_crash_recovery_progress(config.pathnames.state);
+		}
 	}
 }
 
 
+/*
+ * cli_show_basebackup_progress prints the progress of the pg_basebackup that
+ * the local keeper is running, if any, as found in the given progress file.
+ */
+static void
+cli_show_basebackup_progress(const char *filename)
+{
+	BaseBackupProgress progress = { 0 };
+
+	char done[BUFSIZE] = { 0 };
+	char total[BUFSIZE] = { 0 };
+
+	if (!pg_basebackup_read_progress(filename, &progress))
+	{
+		/* no pg_basebackup in progress */
+		return;
+	}
+
+	(void) pretty_print_bytes(done, sizeof(done), progress.doneBytes);
+	(void) pretty_print_bytes(total, sizeof(total), progress.totalBytes);
+
+	double percent =
+		progress.totalBytes > 0
+		? 100.0 * (double) progress.doneBytes / (double) progress.totalBytes
+		: 0.0;
+
+	fformat(stdout, "pg_basebackup in progress: %s / %s (%.1f%%)",
+			done, total, percent);
+
+	uint64_t elapsed = progress.updateTime - progress.startTime;
+
+	if (progress.updateTime > progress.startTime && progress.doneBytes > 0)
+	{
+		char rate[BUFSIZE] = { 0 };
+		uint64_t bytesPerSecond = progress.doneBytes / elapsed;
+
+		(void) pretty_print_bytes(rate, sizeof(rate), bytesPerSecond);
+
+		fformat(stdout, ", %s/s", rate);
+
+		if (bytesPerSecond > 0 && progress.totalBytes > progress.doneBytes)
+		{
+			uint64_t eta =
+				(progress.totalBytes - progress.doneBytes) / bytesPerSecond;
+
+			fformat(stdout, ", about %" PRIu64 "s remaining", eta);
+		}
+	}
+
+	fformat(stdout, "\n");
+}
+
+
+/*
+ * cli_show_crash_recovery_progress prints the progress of the crash recovery
+ * that the local keeper is waiting for, if any, as found in its state file.
+ */
+static void
+cli_show_crash_recovery_progress(const char *filename)
+{
+	KeeperStateData keeperState = { 0 };
+
+	if (IS_EMPTY_STRING_BUFFER(filename) || !file_exists(filename))
+	{
+		return;
+	}
+
+	if (!keeper_state_read(&keeperState, filename) ||
+		keeperState.crash_recovery_start_time == 0)
+	{
+		/* no crash recovery in progress */
+		return;
+	}
+
+	uint64_t start = keeperState.crash_recovery_start_lsn;
+	uint64_t replay = keeperState.crash_recovery_replay_lsn;
+	uint64_t end = keeperState.crash_recovery_end_lsn;
+
+	double percent =
+		end > start && replay > start
+		? 100.0 * (double) (replay - start) / (double) (end - start)
+		: 0.0;
+
+	fformat(stdout, "crash recovery in progress: %X/%X of %X/%X (%.1f%%)",
+			(uint32_t) (replay >> 32), (uint32_t) replay,
+			(uint32_t) (end >> 32), (uint32_t) end,
+			percent);
+
+	if (keeperState.crash_recovery_eta >= 0)
+	{
+		fformat(stdout, ", about %" PRId64 "s remaining",
+				keeperState.crash_recovery_eta);
+	}
+
+	fformat(stdout, "\n");
+}
+
 /*
  * cli_show_local_state implements pg_autoctl show state --local, which
  * composes the state from what we have in the configuration file and the state
@@ -601,6 +1030,7 @@ cli_show_local_state()
 						&(keeper.postgres.postgresSetup.is_in_recovery),
 						keeper.postgres.pgsrSyncState,
 						keeper.postgres.currentLSN,
+						keeper.postgres.replayLSN,
 						&(keeper.postgres.postgresSetup.control)))
 				{
 					log_warn("Failed to update the local Postgres metadata");
@@ -660,6 +1090,8 @@ cli_show_local_state()
 				(void) nodestatePrintNodeState(&headers, &nodeState);
 
 				fformat(stdout, "\n");
+
+				(void) cli_show_basebackup_progress(config.pathnames.basebackup);
 			}
 
 			break;
@@ -691,6 +1123,7 @@ cli_show_standby_names_getopts(int argc, char **argv)
 		{ "monitor", required_argument, NULL, 'm' },
 		{ "formation", required_argument, NULL, 'f' },
 		{ "group", required_argument, NULL, 'g' },
+		{ "all-formations", no_argument, NULL, 'A' },
 		{ "json", no_argument, NULL, 'J' },
 		{ "version", no_argument, NULL, 'V' },
 		{ "verbose", no_argument, NULL, 'v' },
@@ -755,6 +1188,13 @@ cli_show_standby_names_getopts(int argc, char **argv)
 				break;
 			}
 
+			case 'A':
+			{
+				allFormations = true;
+				log_trace("--all-formations");
+				break;
+			}
+
 			case 'V':
 			{
 				/* keeper_cli_print_version prints version and exits. */
@@ -873,6 +1313,17 @@ cli_show_standby_names(int argc, char **argv)
 
 	(void) cli_monitor_init_from_option_or_config(&monitor, &config);
 
+	if (allFormations)
+	{
+		if (!monitor_print_every_synchronous_standby_names(&monitor, outputJSON))
+		{
+			/* errors have already been logged */
+			exit(EXIT_CODE_MONITOR);
+		}
+
+		return;
+	}
+
 	(void) cli_set_groupId(&monitor, &config);
 
 	if (!monitor_synchronous_standby_names(
@@ -922,8 +1373,12 @@ cli_show_uri_getopts(int argc, char **argv)
 	static struct option long_options[] = {
 		{ "pgdata", required_argument, NULL, 'D' },
 		{ "monitor", required_argument, NULL, 'm' },
+		{ "monitor-ro", required_argument, NULL, 'R' },
 		{ "formation", required_argument, NULL, 'f' },
 		{ "citus-cluster", required_argument, NULL, 'Z' },
+		{ "readonly", no_argument, NULL, 'O' },
+		{ "prefer-standby", no_argument, NULL, 'P' },
+		{ "max-lag", required_argument, NULL, 'L' },
 		{ "json", no_argument, NULL, 'J' },
 		{ "version", no_argument, NULL, 'V' },
 		{ "verbose", no_argument, NULL, 'v' },
@@ -940,6 +1395,8 @@ cli_show_uri_getopts(int argc, char **argv)
 	options.postgresql_restart_failure_timeout = -1;
 	options.postgresql_restart_failure_max_retries = -1;
 
+	showUriOptions.maxLag = FORMATION_URI_DEFAULT_MAX_LAG;
+
 	optind = 0;
 
 	while ((c = getopt_long(argc, argv, "D:Vvqh",
@@ -967,6 +1424,19 @@ cli_show_uri_getopts(int argc, char **argv)
 				break;
 			}
 
+			case 'R':
+			{
+				if (!validate_connection_string(optarg))
+				{
+					log_fatal("Failed to parse --monitor-ro connection string, "
+							  "see above for details.");
+					exit(EXIT_CODE_BAD_ARGS);
+				}
+				strlcpy(monitorReadOnlyURI, optarg, MAXCONNINFO);
+				log_trace("--monitor-ro %s", monitorReadOnlyURI);
+				break;
+			}
+
 			case 'f':
 			{
 				strlcpy(showUriOptions.formation, optarg, NAMEDATALEN);
@@ -987,6 +1457,35 @@ cli_show_uri_getopts(int argc, char **argv)
 				break;
 			}
 
+			case 'O':
+			{
+				showUriOptions.readOnly = true;
+				log_trace("--readonly");
+				break;
+			}
+
+			case 'P':
+			{
+				/* --prefer-standby is --readonly with the primary node last */
+				showUriOptions.readOnly = true;
+				showUriOptions.preferStandby = true;
+				log_trace("--prefer-standby");
+				break;
+			}
+
+			case 'L':
+			{
+				if (!stringToInt64(optarg, &showUriOptions.maxLag) ||
+					showUriOptions.maxLag < 0)
+				{
+					log_fatal("--max-lag argument is not a valid "
+							  "number of bytes: \"%s\"", optarg);
+					exit(EXIT_CODE_BAD_ARGS);
+				}
+				log_trace("--max-lag %" PRId64, showUriOptions.maxLag);
+				break;
+			}
+
 			case 'V':
 			{
 				/* keeper_cli_print_version prints version and exits. */
@@ -1085,6 +1584,20 @@ cli_show_uri_getopts(int argc, char **argv)
 		strlcpy(showUriOptions.formation, FORMATION_DEFAULT, NAMEDATALEN);
 	}
 
+	/* --readonly is about the secondary nodes of a given formation */
+	if (showUriOptions.readOnly &&
+		IS_EMPTY_STRING_BUFFER(showUriOptions.formation))
+	{
+		strlcpy(showUriOptions.formation, FORMATION_DEFAULT, NAMEDATALEN);
+	}
+
+	if (showUriOptions.readOnly && showUriOptions.monitorOnly)
+	{
+		log_fatal("Options --readonly or --prefer-standby and "
+				  "--formation monitor can not be used together");
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
 	/* use "default" citus cluster name when user didn't provide it */
 	if (IS_EMPTY_STRING_BUFFER(showUriOptions.citusClusterName))
 	{
@@ -1212,6 +1725,8 @@ cli_show_uri(int argc, char **argv)
 		(void) cli_show_uri_monitor_init_from_config(&kconfig, &monitor, &ssl);
 	}
 
+	(void) cli_monitor_init_read_client(&monitor);
+
 	if (showUriOptions.monitorOnly)
 	{
 		(void) print_monitor_uri(&monitor, stdout);
@@ -1271,12 +1786,24 @@ print_formation_uri(SSLOptions *ssl,
 {
 	char postgresUri[MAXCONNINFO];
 
-	if (!monitor_formation_uri(monitor,
-							   formation,
-							   citusClusterName,
-							   ssl,
-							   postgresUri,
-							   MAXCONNINFO))
+	bool success =
+		showUriOptions.readOnly
+		? monitor_formation_readonly_uri(monitor,
+										 formation,
+										 citusClusterName,
+										 ssl,
+										 showUriOptions.maxLag,
+										 showUriOptions.preferStandby,
+										 postgresUri,
+										 MAXCONNINFO)
+		: monitor_formation_uri(monitor,
+								formation,
+								citusClusterName,
+								ssl,
+								postgresUri,
+								MAXCONNINFO);
+
+	if (!success)
 	{
 		/* errors have already been logged */
 		exit(EXIT_CODE_MONITOR);
@@ -1807,3 +2334,52 @@ fprint_file_contents(const char *filename)
 		return false;
 	}
 }
+
+
+/*
+ * cli_show_transitions prints the history of the FSM transitions of this
+ * node, with their durations, from the local transition history file.
+ */
+static void
+cli_show_transitions(int argc, char **argv)
+{
+	KeeperConfig config = keeperOptions;
+	KeeperTransitionHistory history = { 0 };
+
+	if (ProbeConfigurationFileRole(config.pathnames.config) !=
+		PG_AUTOCTL_ROLE_KEEPER)
+	{
+		log_error("pg_autoctl show transitions is only supported on a "
+				  "Postgres node");
+		exit(EXIT_CODE_BAD_CONFIG);
+	}
+
+	if (!keeper_transition_history_read(&history,
+										config.pathnames.transitions))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_BAD_STATE);
+	}
+
+	if (outputJSON)
+	{
+		JSON_Value *js = json_value_init_array();
+
+		if (!keeperTransitionHistoryAsJSON(&history, js))
+		{
+			/* can't happen */
+			exit(EXIT_CODE_INTERNAL_ERROR);
+		}
+
+		char *serialized_string = json_serialize_to_string_pretty(js);
+
+		fformat(stdout, "%s\n", serialized_string);
+
+		json_free_serialized_string(serialized_string);
+		json_value_free(js);
+	}
+	else
+	{
+		(void) print_keeper_transition_history(&history, stdout);
+	}
+}
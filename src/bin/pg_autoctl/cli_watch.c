@@ -49,6 +49,7 @@ CommandLine watch_command =
 				 " [ --pgdata --formation --group ] ",
 				 "  --pgdata      path to data directory	 \n"
 				 "  --monitor     show the monitor uri\n"
+				 "  --monitor-ro  read-only Monitor Postgres URL, such as a standby\n"
 				 "  --formation   formation to query, defaults to 'default' \n"
 				 "  --group       group to query formation, defaults to all \n"
 				 "  --json        output data in the JSON format\n",
@@ -65,6 +66,7 @@ cli_watch_getopts(int argc, char **argv)
 	static struct option long_options[] = {
 		{ "pgdata", required_argument, NULL, 'D' },
 		{ "monitor", required_argument, NULL, 'm' },
+		{ "monitor-ro", required_argument, NULL, 'R' },
 		{ "formation", required_argument, NULL, 'f' },
 		{ "group", required_argument, NULL, 'g' },
 		{ "version", no_argument, NULL, 'V' },
@@ -109,6 +111,19 @@ cli_watch_getopts(int argc, char **argv)
 				break;
 			}
 
+			case 'R':
+			{
+				if (!validate_connection_string(optarg))
+				{
+					log_fatal("Failed to parse --monitor-ro connection string, "
+							  "see above for details.");
+					exit(EXIT_CODE_BAD_ARGS);
+				}
+				strlcpy(monitorReadOnlyURI, optarg, MAXCONNINFO);
+				log_trace("--monitor-ro %s", monitorReadOnlyURI);
+				break;
+			}
+
 			case 'f':
 			{
 				strlcpy(options.formation, optarg, NAMEDATALEN);
@@ -237,6 +252,7 @@ cli_watch(int argc, char **argv)
 	KeeperConfig config = keeperOptions;
 
 	(void) cli_monitor_init_from_option_or_config(&(context.monitor), &config);
+	(void) cli_monitor_init_read_client(&(context.monitor));
 
 	strlcpy(context.formation, config.formation, sizeof(context.formation));
 	context.groupId = config.groupId;
@@ -208,6 +208,36 @@ SetStateFilePath(ConfigFilePaths *pathnames, const char *pgdata)
 	}
 	log_trace("SetKeeperStateFilePath: \"%s\"", pathnames->init);
 
+	/* and the history of the FSM transitions of this node */
+	if (IS_EMPTY_STRING_BUFFER(pathnames->transitions))
+	{
+		if (!build_xdg_path(pathnames->transitions,
+							XDG_DATA,
+							pgdata,
+							KEEPER_TRANSITIONS_FILENAME))
+		{
+			log_error("Failed to build pg_autoctl transition history file "
+					  "pathname, see above.");
+			return false;
+		}
+	}
+	log_trace("SetStateFilePath: \"%s\"", pathnames->transitions);
+
+	/* and the startup checks that passed in our previous run */
+	if (IS_EMPTY_STRING_BUFFER(pathnames->startup))
+	{
+		if (!build_xdg_path(pathnames->startup,
+							XDG_DATA,
+							pgdata,
+							KEEPER_STARTUP_CACHE_FILENAME))
+		{
+			log_error("Failed to build pg_autoctl startup cache file "
+					  "pathname, see above.");
+			return false;
+		}
+	}
+	log_trace("SetStateFilePath: \"%s\"", pathnames->startup);
+
 	return true;
 }
 
@@ -236,6 +266,36 @@ SetNodesFilePath(ConfigFilePaths *pathnames, const char *pgdata)
 	}
 	log_trace("SetNodesFilePath: \"%s\"", pathnames->nodes);
 
+	/* now the copy of the primary's block list, see prewarm.c */
+	if (IS_EMPTY_STRING_BUFFER(pathnames->prewarm))
+	{
+		if (!build_xdg_path(pathnames->prewarm,
+							XDG_DATA,
+							pgdata,
+							KEEPER_PREWARM_FILENAME))
+		{
+			log_error("Failed to build pg_autoctl prewarm file pathname, "
+					  "see above.");
+			return false;
+		}
+	}
+	log_trace("SetNodesFilePath: \"%s\"", pathnames->prewarm);
+
+	/* and the cache of the upstream timeline history, see pgctl.c */
+	if (IS_EMPTY_STRING_BUFFER(pathnames->timelines))
+	{
+		if (!build_xdg_path(pathnames->timelines,
+							XDG_DATA,
+							pgdata,
+							KEEPER_TIMELINES_FILENAME))
+		{
+			log_error("Failed to build pg_autoctl timeline history file "
+					  "pathname, see above.");
+			return false;
+		}
+	}
+	log_trace("SetNodesFilePath: \"%s\"", pathnames->timelines);
+
 	return true;
 }
 
@@ -262,6 +322,69 @@ SetPidFilePath(ConfigFilePaths *pathnames, const char *pgdata)
 
 	log_trace("SetPidFilePath: \"%s\"", pathnames->pid);
 
+	/* now the metrics file, shared by the pg_autoctl services */
+	if (IS_EMPTY_STRING_BUFFER(pathnames->metrics))
+	{
+		if (!build_xdg_path(pathnames->metrics,
+							XDG_RUNTIME,
+							pgdata,
+							KEEPER_METRICS_FILENAME))
+		{
+			log_error("Failed to build pg_autoctl metrics file pathname, "
+					  "see above.");
+			return false;
+		}
+	}
+
+	log_trace("SetPidFilePath: \"%s\"", pathnames->metrics);
+
+	/* and the pg_basebackup progress file, see pg_basebackup() */
+	if (IS_EMPTY_STRING_BUFFER(pathnames->basebackup))
+	{
+		if (!build_xdg_path(pathnames->basebackup,
+							XDG_RUNTIME,
+							pgdata,
+							KEEPER_BASEBACKUP_FILENAME))
+		{
+			log_error("Failed to build pg_autoctl basebackup file pathname, "
+					  "see above.");
+			return false;
+		}
+	}
+
+	log_trace("SetPidFilePath: \"%s\"", pathnames->basebackup);
+
+	/* and the topology snapshot files, see keeper_write_topology() */
+	if (IS_EMPTY_STRING_BUFFER(pathnames->topology))
+	{
+		if (!build_xdg_path(pathnames->topology,
+							XDG_RUNTIME,
+							pgdata,
+							KEEPER_TOPOLOGY_FILENAME))
+		{
+			log_error("Failed to build pg_autoctl topology file pathname, "
+					  "see above.");
+			return false;
+		}
+	}
+
+	log_trace("SetPidFilePath: \"%s\"", pathnames->topology);
+
+	if (IS_EMPTY_STRING_BUFFER(pathnames->topologyService))
+	{
+		if (!build_xdg_path(pathnames->topologyService,
+							XDG_RUNTIME,
+							pgdata,
+							KEEPER_TOPOLOGY_SERVICE_FILENAME))
+		{
+			log_error("Failed to build pg_autoctl service file pathname, "
+					  "see above.");
+			return false;
+		}
+	}
+
+	log_trace("SetPidFilePath: \"%s\"", pathnames->topologyService);
+
 	return true;
 }
 
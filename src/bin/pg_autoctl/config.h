@@ -38,6 +38,14 @@ typedef struct ConfigFilePaths
 	char pid[MAXPGPATH];    /* /tmp/${PGDATA}/pg_autoctl.pid */
 	char init[MAXPGPATH];   /* /tmp/${PGDATA}/pg_autoctl.init */
 	char nodes[MAXPGPATH];  /* ~/.local/share/pg_autoctl/${PGDATA}/nodes.json */
+	char metrics[MAXPGPATH];    /* /tmp/${PGDATA}/pg_autoctl.metrics */
+	char prewarm[MAXPGPATH];    /* ~/.local/share/pg_autoctl/${PGDATA}/prewarm.blocks */
+	char timelines[MAXPGPATH];  /* ~/.local/share/pg_autoctl/${PGDATA}/timelines.history */
+	char transitions[MAXPGPATH];    /* ~/.local/share/pg_autoctl/${PGDATA}/transitions.history */
+	char startup[MAXPGPATH];    /* ~/.local/share/pg_autoctl/${PGDATA}/startup.cache */
+	char basebackup[MAXPGPATH]; /* /tmp/${PGDATA}/pg_autoctl.basebackup */
+	char topology[MAXPGPATH];   /* /tmp/${PGDATA}/topology.json */
+	char topologyService[MAXPGPATH];    /* /tmp/${PGDATA}/pg_service.conf */
 	char systemd[MAXPGPATH];    /* ~/.config/systemd/user/pgautofailover.service */
 } ConfigFilePaths;
 
@@ -0,0 +1,245 @@
+/*
+ * src/bin/pg_autoctl/controlfile.c
+ *     Read the Postgres control file without running pg_controldata.
+ *
+ * The keeper needs the system identifier, the timeline and the checkpoint
+ * LSN of the local Postgres instance often, including on failover code
+ * paths. Rather than running pg_controldata and parsing its output, we read
+ * the few fields we need from $PGDATA/global/pg_control directly.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "postgres_fe.h"
+
+#include "controlfile.h"
+#include "file_utils.h"
+#include "log.h"
+#include "pgsetup.h"
+
+/*
+ * The first fields of the ControlFileData struct have kept the same layout
+ * from Postgres 9.6 to Postgres 17, except for the prevCheckPoint field that
+ * has been removed in Postgres 11. We mirror that part of the struct here,
+ * using the same C types, so that the compiler picks the same alignment as
+ * it does when compiling Postgres.
+ *
+ * The CheckPoint struct (checkPointCopy) begins with the redo LSN and the
+ * timeline of the last checkpoint.
+ */
+typedef struct ControlFileHeader
+{
+	uint64_t system_identifier;
+	uint32_t pg_control_version;
+	uint32_t catalog_version_no;
+	int32_t state;                    /* enum DBState */
+	int64_t time;                     /* pg_time_t */
+	uint64_t checkPoint;              /* XLogRecPtr */
+	uint64_t checkPointCopyRedo;      /* checkPointCopy.redo */
+	uint32_t checkPointCopyTimeLine;  /* checkPointCopy.ThisTimeLineID */
+} ControlFileHeader;
+
+typedef struct ControlFileHeaderPre11
+{
+	uint64_t system_identifier;
+	uint32_t pg_control_version;
+	uint32_t catalog_version_no;
+	int32_t state;                    /* enum DBState */
+	int64_t time;                     /* pg_time_t */
+	uint64_t checkPoint;              /* XLogRecPtr */
+	uint64_t prevCheckPoint;          /* XLogRecPtr, removed in Postgres 11 */
+	uint64_t checkPointCopyRedo;      /* checkPointCopy.redo */
+	uint32_t checkPointCopyTimeLine;  /* checkPointCopy.ThisTimeLineID */
+} ControlFileHeaderPre11;
+
+static bool controlfile_check_crc(const char *contents, size_t headerSize);
+static uint32_t crc32c_update(uint32_t crc, const char *data, size_t len);
+
+
+/*
+ * controlfile_read reads $PGDATA/global/pg_control and fills-in the given
+ * PostgresControlData. When the control file version is not one that we know
+ * about, CONTROL_FILE_UNKNOWN_VERSION is returned and the caller should run
+ * pg_controldata instead.
+ */
+ControlFileReadStatus
+controlfile_read(const char *pgdata, PostgresControlData *control)
+{
+	char globalControlPath[MAXPGPATH] = { 0 };
+	char *contents = NULL;
+	long fileSize = 0;
+
+	uint64_t checkPoint = 0;
+	size_t headerSize = 0;
+
+	join_path_components(globalControlPath, pgdata, "global/pg_control");
+
+	if (!read_file(globalControlPath, &contents, &fileSize))
+	{
+		/* errors have already been logged */
+		return CONTROL_FILE_ERROR;
+	}
+
+	if (fileSize < PG_CONTROL_MAX_SAFE_SIZE)
+	{
+		log_error("Failed to read control file \"%s\": file size is %ld, "
+				  "expected %d bytes",
+				  globalControlPath, fileSize, PG_CONTROL_FILE_SIZE);
+		free(contents);
+		return CONTROL_FILE_ERROR;
+	}
+
+	ControlFileHeader header = { 0 };
+	ControlFileHeaderPre11 headerPre11 = { 0 };
+
+	memcpy(&header, contents, sizeof(ControlFileHeader));
+
+	switch (header.pg_control_version)
+	{
+		case 960:               /* Postgres 9.6 */
+		case 1002:              /* Postgres 10 */
+		{
+			memcpy(&headerPre11, contents, sizeof(ControlFileHeaderPre11));
+
+			headerSize = sizeof(ControlFileHeaderPre11);
+			checkPoint = headerPre11.checkPoint;
+
+			header.checkPointCopyRedo = headerPre11.checkPointCopyRedo;
+			header.checkPointCopyTimeLine = headerPre11.checkPointCopyTimeLine;
+			break;
+		}
+
+		case 1100:              /* Postgres 11 */
+		case 1201:              /* Postgres 12 */
+		case 1300:              /* Postgres 13 to 16 */
+		case 1700:              /* Postgres 17 */
+		{
+			headerSize = sizeof(ControlFileHeader);
+			checkPoint = header.checkPoint;
+			break;
+		}
+
+		default:
+		{
+			log_debug("Unknown pg_control version %u in \"%s\"",
+					  header.pg_control_version, globalControlPath);
+			free(contents);
+			return CONTROL_FILE_UNKNOWN_VERSION;
+		}
+	}
+
+	if (!controlfile_check_crc(contents, headerSize))
+	{
+		log_error("Failed to read control file \"%s\": "
+				  "calculated CRC checksum does not match value stored in file",
+				  globalControlPath);
+		free(contents);
+		return CONTROL_FILE_ERROR;
+	}
+
+	free(contents);
+
+	if (header.state < DB_STARTUP || header.state > DB_IN_PRODUCTION)
+	{
+		log_error("Failed to read control file \"%s\": "
+				  "unknown database cluster state %d",
+				  globalControlPath, header.state);
+		return CONTROL_FILE_ERROR;
+	}
+
+	control->system_identifier = header.system_identifier;
+	control->pg_control_version = header.pg_control_version;
+	control->catalog_version_no = header.catalog_version_no;
+	control->state = (DBState) header.state;
+	control->timeline_id = header.checkPointCopyTimeLine;
+
+	sformat(control->latestCheckpointLSN, PG_LSN_MAXLENGTH, "%X/%X",
+			(uint32_t) (checkPoint >> 32), (uint32_t) checkPoint);
+
+	return CONTROL_FILE_OK;
+}
+
+
+/*
+ * controlfile_check_crc checks the CRC of the control file contents.
+ *
+ * The CRC covers the ControlFileData struct up to its last field, crc
+ * itself, and the offset of that field changes with each major version of
+ * Postgres and with the platform alignment rules. Rather than maintaining a
+ * table of offsets, we compute the CRC of the contents incrementally and
+ * look for the first 4-bytes aligned position after the fields we use where
+ * the stored value matches. A random match has a probability of 2^-32 at
+ * each of the positions we look at.
+ */
+static bool
+controlfile_check_crc(const char *contents, size_t headerSize)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	size_t offset = 0;
+
+	/* the crc field is 4-bytes aligned */
+	headerSize = (headerSize + 3) & ~((size_t) 3);
+
+	crc = crc32c_update(crc, contents, headerSize);
+
+	for (offset = headerSize;
+		 offset + sizeof(uint32_t) <= PG_CONTROL_MAX_SAFE_SIZE;
+		 offset += sizeof(uint32_t))
+	{
+		uint32_t stored = 0;
+
+		memcpy(&stored, contents + offset, sizeof(uint32_t));
+
+		if ((crc ^ 0xFFFFFFFF) == stored)
+		{
+			return true;
+		}
+
+		crc = crc32c_update(crc, contents + offset, sizeof(uint32_t));
+	}
+
+	return false;
+}
+
+
+/*
+ * controlfile_crc32c computes the CRC-32C of the given data, as stored in the
+ * crc field of the Postgres control file.
+ */
+uint32_t
+controlfile_crc32c(const char *data, size_t len)
+{
+	return crc32c_update(0xFFFFFFFF, data, len) ^ 0xFFFFFFFF;
+}
+
+
+/*
+ * crc32c_update adds the given data to a CRC-32C (Castagnoli) computation,
+ * as done in postgres:src/port/pg_crc32c_sb8.c, one bit at a time. The
+ * control file is small enough that we don't need a lookup table.
+ */
+static uint32_t
+crc32c_update(uint32_t crc, const char *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *) data;
+
+	while (len-- > 0)
+	{
+		crc ^= *p++;
+
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+		}
+	}
+
+	return crc;
+}
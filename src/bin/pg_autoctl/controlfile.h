@@ -0,0 +1,37 @@
+/*
+ * src/bin/pg_autoctl/controlfile.h
+ *     Read the Postgres control file without running pg_controldata.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#ifndef CONTROLFILE_H
+#define CONTROLFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pgsetup.h"
+
+/*
+ * From postgres:src/include/catalog/pg_control.h, the size of the control
+ * file on-disk, and the part of it that is read and written atomically.
+ */
+#define PG_CONTROL_FILE_SIZE 8192
+#define PG_CONTROL_MAX_SAFE_SIZE 512
+
+typedef enum
+{
+	CONTROL_FILE_OK = 0,
+	CONTROL_FILE_ERROR,             /* could not read, or corrupted */
+	CONTROL_FILE_UNKNOWN_VERSION    /* use pg_controldata instead */
+} ControlFileReadStatus;
+
+ControlFileReadStatus controlfile_read(const char *pgdata,
+									   PostgresControlData *control);
+uint32_t controlfile_crc32c(const char *data, size_t len);
+
+#endif /* CONTROLFILE_H */
@@ -24,6 +24,7 @@ static bool coordinator_master_activate_node_returns_record(PGSQL *pgsql,
 															bool *returnsRecord);
 
 static void parseRemovedNodeIds(void *ctx, PGresult *result);
+static void parseUpdatedNodes(void *ctx, PGresult *result);
 
 
 /*
@@ -901,10 +902,6 @@ coordinator_remove_dropped_nodes(Coordinator *coordinator,
 	/* *INDENT-ON* */
 
 	int paramCount = 0;
-	Oid paramTypes[2 * NODE_ARRAY_MAX_COUNT] = { 0 };
-
-	const char *paramValues[2 * NODE_ARRAY_MAX_COUNT] = { 0 };
-	IntString groupIdStrings[NODE_ARRAY_MAX_COUNT] = { 0 };
 
 	RemovedNodeIdsContext context = { { 0 }, false };
 
@@ -914,6 +911,25 @@ coordinator_remove_dropped_nodes(Coordinator *coordinator,
 		return true;
 	}
 
+	Oid *paramTypes = (Oid *) calloc(2 * nodesArray->count, sizeof(Oid));
+	const char **paramValues =
+		(const char **) calloc(2 * nodesArray->count, sizeof(char *));
+	IntString *groupIdStrings =
+		(IntString *) calloc(nodesArray->count, sizeof(IntString));
+
+	if (paramTypes == NULL || paramValues == NULL || groupIdStrings == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+
+		free(paramTypes);
+		free(paramValues);
+		free(groupIdStrings);
+		PQfreemem(query);
+		PQfreemem(values);
+
+		return false;
+	}
+
 	/* prepare the VALUES string */
 	for (int i = 0; i < nodesArray->count; i++)
 	{
@@ -947,22 +963,24 @@ coordinator_remove_dropped_nodes(Coordinator *coordinator,
 
 	PGSQL *pgsql = &coordinator->pgsql;
 
-	if (!pgsql_execute_with_params(pgsql, query->data,
-								   paramCount, paramTypes, paramValues,
-								   &context, parseRemovedNodeIds))
+	bool success =
+		pgsql_execute_with_params(pgsql, query->data,
+								  paramCount, paramTypes, paramValues,
+								  &context, parseRemovedNodeIds);
+
+	free(paramTypes);
+	free(paramValues);
+	free(groupIdStrings);
+	PQfreemem(query);
+	PQfreemem(values);
+
+	if (!success)
 	{
 		log_error("Failed to check if pg_dist_node contains entries for nodes "
 				  "that have been deleted from the monitor");
-
-		PQfreemem(query);
-		PQfreemem(values);
-
 		return false;
 	}
 
-	PQfreemem(query);
-	PQfreemem(values);
-
 	return context.parsedOK;
 }
 
@@ -976,15 +994,6 @@ parseRemovedNodeIds(void *ctx, PGresult *result)
 {
 	RemovedNodeIdsContext *context = (RemovedNodeIdsContext *) ctx;
 
-	if (PQntuples(result) > NODE_ARRAY_MAX_COUNT)
-	{
-		log_error("Query returned %d rows, pg_auto_failover supports only up "
-				  "to %d nodes at the moment",
-				  PQntuples(result), NODE_ARRAY_MAX_COUNT);
-		context->parsedOK = false;
-		return;
-	}
-
 	/* our query returns 4 columns */
 	if (PQnfields(result) != 4)
 	{
@@ -1016,3 +1025,246 @@ parseRemovedNodeIds(void *ctx, PGresult *result)
 
 	context->parsedOK = true;
 }
+
+
+/*
+ * coordinator_node_is_stable_primary returns true when the monitor reports the
+ * given node as the current primary of a Citus worker group, with the
+ * failover (if any) completed already.
+ */
+bool
+coordinator_node_is_stable_primary(CurrentNodeState *nodeState)
+{
+	if (nodeState->groupId == 0 ||
+		nodeState->reportedState != nodeState->goalState)
+	{
+		return false;
+	}
+
+	switch (nodeState->reportedState)
+	{
+		case SINGLE_STATE:
+		case WAIT_PRIMARY_STATE:
+		case JOIN_PRIMARY_STATE:
+		case PRIMARY_STATE:
+		case APPLY_SETTINGS_STATE:
+		{
+			return true;
+		}
+
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+
+/*
+ * coordinator_update_primary_nodes calls Citus function master_update_node on
+ * every worker group where pg_dist_node still lists another host:port than
+ * the primary node registered on the monitor, all in a single statement.
+ *
+ * Each worker keeper updates its own group in a prepared transaction around
+ * its promotion, and owns the COMMIT PREPARED decision. When many groups fail
+ * over together those prepared transactions wait for each other on the
+ * coordinator, and the groups whose keeper lost its connection to the
+ * coordinator are only fixed at the keeper's next retry. Here the Citus
+ * coordinator fixes all the stale entries at once, in groupid order so that
+ * concurrent runs take the Citus locks in the same order, and skips the
+ * groups that still have their own prepared transaction in flight.
+ */
+bool
+coordinator_update_primary_nodes(Coordinator *coordinator, Keeper *keeper,
+								 CurrentNodeStateArray *nodesArray)
+{
+	PGSQL *pgsql = &coordinator->pgsql;
+	PQExpBuffer query = createPQExpBuffer();
+	PQExpBuffer values = createPQExpBuffer();
+	bool supportForForce = false;
+
+	/* *INDENT-OFF* */
+	char *sqlTemplate =
+		/*
+		 * PostgreSQL evaluates volatile functions of the target list after
+		 * the sort, so master_update_node() is called in groupid order.
+		 */
+		" WITH nodes(groupid, nodecluster, nodename, nodeport) as "
+		" ( "
+		"     VALUES %s "
+		" ) "
+		"  SELECT pg_dist_node.groupid, nodes.nodename, nodes.nodeport, "
+		"         master_update_node(pg_dist_node.nodeid, "
+		"                            nodes.nodename, nodes.nodeport%s) "
+		"    FROM pg_dist_node "
+		"         JOIN nodes "
+		"           ON pg_dist_node.groupid = nodes.groupid "
+		"          AND pg_dist_node.nodecluster = nodes.nodecluster "
+		"   WHERE pg_dist_node.noderole = 'primary' "
+		"     AND (pg_dist_node.nodename, pg_dist_node.nodeport) "
+		"         <> (nodes.nodename, nodes.nodeport) "
+		"     AND not exists "
+		"          (select 1 from pg_prepared_xacts "
+		"            where gid = 'master_update_node ' || pg_dist_node.groupid) "
+		"ORDER BY pg_dist_node.groupid";
+	/* *INDENT-ON* */
+
+	int paramCount = 0;
+	int nodeCount = 0;
+
+	RemovedNodeIdsContext context = { { 0 }, false };
+
+	for (int i = 0; i < nodesArray->count; i++)
+	{
+		if (coordinator_node_is_stable_primary(&(nodesArray->nodes[i])))
+		{
+			++nodeCount;
+		}
+	}
+
+	/* when we have no worker primary node, we're done already */
+	if (nodeCount == 0)
+	{
+		PQfreemem(query);
+		PQfreemem(values);
+
+		return true;
+	}
+
+	if (!coordinator_supports_force_master_update_node(pgsql, &supportForForce))
+	{
+		/* errors have already been logged */
+		PQfreemem(query);
+		PQfreemem(values);
+
+		return false;
+	}
+
+	Oid *paramTypes = (Oid *) calloc(4 * nodeCount + 1, sizeof(Oid));
+	const char **paramValues =
+		(const char **) calloc(4 * nodeCount + 1, sizeof(char *));
+	IntString *intStrings = (IntString *) calloc(2 * nodeCount, sizeof(IntString));
+
+	if (paramTypes == NULL || paramValues == NULL || intStrings == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+
+		free(paramTypes);
+		free(paramValues);
+		free(intStrings);
+		PQfreemem(query);
+		PQfreemem(values);
+
+		return false;
+	}
+
+	int intCount = 0;
+
+	for (int i = 0; i < nodesArray->count; i++)
+	{
+		CurrentNodeState *nodeState = &(nodesArray->nodes[i]);
+
+		if (!coordinator_node_is_stable_primary(nodeState))
+		{
+			continue;
+		}
+
+		/* VALUES ($1::int, $2::text, $3::text, $4::int), ($5, $6, $7, $8) ... */
+		appendPQExpBuffer(values,
+						  "%s($%d%s, $%d%s, $%d%s, $%d%s)",
+						  paramCount == 0 ? "" : ", ",
+						  paramCount + 1,
+						  paramCount == 0 ? "::int" : "",
+						  paramCount + 2,
+						  paramCount == 0 ? "::text" : "",
+						  paramCount + 3,
+						  paramCount == 0 ? "::text" : "",
+						  paramCount + 4,
+						  paramCount == 0 ? "::int" : "");
+
+		paramTypes[paramCount] = INT4OID;
+		paramTypes[paramCount + 1] = TEXTOID;
+		paramTypes[paramCount + 2] = TEXTOID;
+		paramTypes[paramCount + 3] = INT4OID;
+
+		intStrings[intCount] = intToString(nodeState->groupId);
+		intStrings[intCount + 1] = intToString(nodeState->node.port);
+
+		paramValues[paramCount++] = intStrings[intCount].strValue;
+		paramValues[paramCount++] = nodeState->citusClusterName;
+		paramValues[paramCount++] = nodeState->node.host;
+		paramValues[paramCount++] = intStrings[intCount + 1].strValue;
+
+		intCount += 2;
+	}
+
+	/* the lock cooldown is the last parameter of the query */
+	IntString lockCooldownString =
+		intToString(keeper->config.citus_master_update_node_lock_cooldown);
+
+	char forceArgs[BUFSIZE] = { 0 };
+
+	if (supportForForce)
+	{
+		sformat(forceArgs, sizeof(forceArgs),
+				", force => true, lock_cooldown => $%d",
+				paramCount + 1);
+
+		paramTypes[paramCount] = INT4OID;
+		paramValues[paramCount++] = lockCooldownString.strValue;
+	}
+
+	appendPQExpBuffer(query, sqlTemplate, values->data, forceArgs);
+
+	bool success =
+		pgsql_execute_with_params(pgsql, query->data,
+								  paramCount, paramTypes, paramValues,
+								  &context, parseUpdatedNodes);
+
+	free(paramTypes);
+	free(paramValues);
+	free(intStrings);
+	PQfreemem(query);
+	PQfreemem(values);
+
+	if (!success)
+	{
+		log_error("Failed to update pg_dist_node entries to the current "
+				  "primary nodes registered on the monitor");
+		return false;
+	}
+
+	return context.parsedOK;
+}
+
+
+/*
+ * parseUpdatedNodes displays a log entry for each pg_dist_node entry that
+ * coordinator_update_primary_nodes has updated.
+ */
+static void
+parseUpdatedNodes(void *ctx, PGresult *result)
+{
+	RemovedNodeIdsContext *context = (RemovedNodeIdsContext *) ctx;
+
+	/* our query returns 4 columns */
+	if (PQnfields(result) != 4)
+	{
+		log_error("Query returned %d columns, expected 4", PQnfields(result));
+		context->parsedOK = false;
+		return;
+	}
+
+	for (int rowNumber = 0; rowNumber < PQntuples(result); rowNumber++)
+	{
+		char *groupId = PQgetvalue(result, rowNumber, 0);
+		char *nodehost = PQgetvalue(result, rowNumber, 1);
+		char *nodeport = PQgetvalue(result, rowNumber, 2);
+
+		log_info("Citus worker node in group %s has been updated to %s:%s "
+				 "in pg_dist_node after a failover",
+				 groupId, nodehost, nodeport);
+	}
+
+	context->parsedOK = true;
+}
@@ -64,5 +64,8 @@ bool coordinator_node_is_registered(Coordinator *coordinator, bool *isRegistered
 
 bool coordinator_remove_dropped_nodes(Coordinator *coordinator,
 									  CurrentNodeStateArray *nodesArray);
+bool coordinator_node_is_stable_primary(CurrentNodeState *nodeState);
+bool coordinator_update_primary_nodes(Coordinator *coordinator, Keeper *keeper,
+									  CurrentNodeStateArray *nodesArray);
 
 #endif /* COORDINATOR_H */
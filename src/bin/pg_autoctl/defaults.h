@@ -19,7 +19,7 @@
 #define PG_AUTOCTL_VERSION GIT_VERSION
 
 /* version of the extension that we requite to talk to on the monitor */
-#define PG_AUTOCTL_EXTENSION_VERSION "2.0"
+#define PG_AUTOCTL_EXTENSION_VERSION "2.1"
 
 /* environment variable to use to make DEBUG facilities available */
 #define PG_AUTOCTL_DEBUG "PG_AUTOCTL_DEBUG"
@@ -28,9 +28,18 @@
 /* environment variable for containing the id of the logging semaphore */
 #define PG_AUTOCTL_LOG_SEMAPHORE "PG_AUTOCTL_LOG_SEMAPHORE"
 
+/* environment variable to buffer log lines in each pg_autoctl process */
+#define PG_AUTOCTL_LOG_BUFFERED "PG_AUTOCTL_LOG_BUFFERED"
+
+/* environment variable for --log-format, inherited by our sub-processes */
+#define PG_AUTOCTL_LOG_FORMAT "PG_AUTOCTL_LOG_FORMAT"
+
 /* environment variable for --monitor, when used instead of --pgdata */
 #define PG_AUTOCTL_MONITOR "PG_AUTOCTL_MONITOR"
 
+/* environment variable for --monitor-ro, a read-only monitor endpoint */
+#define PG_AUTOCTL_MONITOR_RO "PG_AUTOCTL_MONITOR_RO"
+
 /* environment variable for --candidate-priority and --replication-quorum */
 #define PG_AUTOCTL_NODE_NAME "PG_AUTOCTL_NODE_NAME"
 #define PG_AUTOCTL_CANDIDATE_PRIORITY "PG_AUTOCTL_CANDIDATE_PRIORITY"
@@ -56,11 +65,24 @@
 #define REPLICATION_PASSWORD_DEFAULT NULL
 #define REPLICATION_APPLICATION_NAME_PREFIX "pgautofailover_standby_"
 #define FORMATION_DEFAULT "default"
+
+/* pg_autoctl show uri --readonly skips standby nodes lagging more (bytes) */
+#define FORMATION_URI_DEFAULT_MAX_LAG (16 * 1024 * 1024)
 #define GROUP_ID_DEFAULT 0
 #define POSTGRES_CONNECT_TIMEOUT "2"
 #define MAXIMUM_BACKUP_RATE "100M"
 #define MAXIMUM_BACKUP_RATE_LEN 32
 
+/* replication.clone_from is either primary, secondary, or a node name */
+#define REPLICATION_CLONE_FROM_PRIMARY "primary"
+#define REPLICATION_CLONE_FROM_SECONDARY "secondary"
+
+/* in bytes, 0 means advance replication slots on standby nodes every round */
+#define REPLICATION_SLOT_ADVANCE_THRESHOLD 0
+
+/* connections used to copy PGDATA when cloning, 1 means pg_basebackup */
+#define REPLICATION_CLONE_JOBS 1
+
 
 /*
  * Microsoft approved cipher string.
@@ -86,16 +108,120 @@
 #define PG_AUTOCTL_MONITOR_DISABLED "PG_AUTOCTL_DISABLED"
 
 #define NETWORK_PARTITION_TIMEOUT 20
+
+/* a partition confirmed by probing our peers doesn't shorten the wait unless set */
+#define NETWORK_PARTITION_CONFIRMED_TIMEOUT 0   /* seconds */
+#define NETWORK_PARTITION_PROBE_TIMEOUT_MS 1000
 #define PREPARE_PROMOTION_CATCHUP_TIMEOUT 30
 #define PREPARE_PROMOTION_WALRECEIVER_TIMEOUT 5
 
+/* a standby restarts at once unless asked to drain its read sessions first */
+#define STANDBY_DRAIN_TIMEOUT 0                 /* seconds */
+#define STANDBY_DRAIN_POLL_INTERVAL_MS 500      /* milliseconds */
+
+/*
+ * The supervisor restarts a crashed service at once, and then backs off when
+ * the service keeps crashing. Each service type has its own defaults.
+ */
+#define SUPERVISOR_RESTART_STABLE_TIME 60                    /* seconds */
+#define SUPERVISOR_RESTART_DELAY_MS 500                      /* milliseconds */
+#define SUPERVISOR_RESTART_MULTIPLIER 2
+#define SUPERVISOR_RESTART_MAX_DELAY_MS (10 * 1000)          /* milliseconds */
+
+#define SUPERVISOR_POSTGRES_RESTART_DELAY_MS 1000            /* milliseconds */
+#define SUPERVISOR_POSTGRES_RESTART_MULTIPLIER 2
+#define SUPERVISOR_POSTGRES_RESTART_MAX_DELAY_MS (30 * 1000) /* milliseconds */
+
+/* the node-active service is scheduled as forked unless asked otherwise */
+#define SUPERVISOR_NODE_ACTIVE_SCHED_POLICY "other"
+#define SUPERVISOR_NODE_ACTIVE_NICE 0
+#define SUPERVISOR_LOCK_MEMORY 0
+
 #define PG_AUTOCTL_KEEPER_SLEEP_TIME 1      /* seconds */
 #define PG_AUTOCTL_KEEPER_RETRY_TIME_MS 350 /* milliseconds */
+
+/*
+ * The keeper polls the monitor every PG_AUTOCTL_KEEPER_SLEEP_TIME, faster
+ * while a node of the group is in a transition, and backs off up to the max
+ * sleep time once the group has been stable for a while.
+ */
+#define PG_AUTOCTL_KEEPER_FAST_SLEEP_TIME_MS 100        /* milliseconds */
+#define PG_AUTOCTL_KEEPER_MAX_SLEEP_TIME_MS (5 * 1000)  /* milliseconds */
+#define PG_AUTOCTL_KEEPER_STABLE_TIME 30                /* seconds */
+#define PG_AUTOCTL_KEEPER_TRANSITION_EXPIRY 120         /* seconds */
+
 #define PG_AUTOCTL_MONITOR_SLEEP_TIME 10 /* seconds */
 #define PG_AUTOCTL_MONITOR_RETRY_TIME 1  /* seconds */
 
+/* a read-only monitor endpoint is only used when that fresh */
+#define PG_AUTOCTL_MONITOR_READ_MAX_LAG 5            /* seconds */
+#define PG_AUTOCTL_MONITOR_READ_CHECK_INTERVAL 10    /* seconds */
+
+/* after failing to contact the monitor, the keeper waits up to 5s */
+#define PG_AUTOCTL_MONITOR_BACKOFF_CAP_SLEEP_TIME (5 * 1000) /* milliseconds */
+
 #define PG_AUTOCTL_LISTEN_NOTIFICATIONS_TIMEOUT 60
 
+/* groups that perform switchover --away-from-cluster moves at a time */
+#define PG_AUTOCTL_SWITCHOVER_CONCURRENCY 4
+
+/* the keeper metrics HTTP endpoint is disabled unless a port is set */
+#define DEFAULT_METRICS_PORT 0
+#define DEFAULT_METRICS_LISTEN_ADDRESS "127.0.0.1"
+
+/* standby nodes don't fetch the primary's block list unless set */
+#define DEFAULT_PREWARM_INTERVAL 0          /* seconds */
+#define PREWARM_BLOCKS_PER_ROUND 16384
+
+/* nodes don't measure the network latency to their peers unless set */
+#define DEFAULT_LATENCY_INTERVAL 0          /* seconds */
+#define LATENCY_CONNECT_TIMEOUT_MS 1000
+
+/* HBA hostname checks are cached, and a slow DNS server must not block us */
+#define DNS_CACHE_POSITIVE_TTL 60           /* seconds */
+#define DNS_CACHE_NEGATIVE_TTL 10           /* seconds */
+#define DNS_RESOLVE_TIMEOUT_MS 2000
+
+/* primary nodes don't measure their health signals unless set */
+#define DEFAULT_HEALTH_SIGNALS_INTERVAL 0   /* seconds */
+
+/* standby nodes don't report their load unless set */
+#define DEFAULT_LOAD_INTERVAL 0             /* seconds */
+
+/* checkpoint tuning for the formation's target_recovery_seconds */
+#define RECOVERY_TUNING_INTERVAL 60         /* seconds */
+#define REPLAY_RATE_MIN_SAMPLE_BYTES (16 * 1024 * 1024)
+#define REPLAY_RATE_MAX_SAMPLE_SECS 60
+#define RECOVERY_TUNING_MIN_MAX_WAL_SIZE_MB 128
+#define RECOVERY_TUNING_MIN_CHECKPOINT_TIMEOUT 30     /* seconds */
+#define RECOVERY_TUNING_MAX_CHECKPOINT_TIMEOUT 86400  /* seconds */
+
+/* how often we report the WAL retained by our replication slots */
+#define SLOT_RETENTION_INTERVAL 60          /* seconds */
+
+/* how often we check the wal_compression policy of our formation */
+#define WAL_COMPRESSION_INTERVAL 60         /* seconds */
+
+/* how often we check whether our inventory changed, see node_inventory */
+#define NODE_INVENTORY_INTERVAL 60          /* seconds */
+
+/* how often we report progress while Postgres is in crash recovery */
+#define CRASH_RECOVERY_PROGRESS_INTERVAL 5  /* seconds */
+
+/* the keeper connects to the monitor for each call unless set */
+#define DEFAULT_MONITOR_KEEPALIVE 0
+#define DEFAULT_MONITOR_SINGLE_CONNECTION 0
+
+/* the keeper stops waiting for a call to the monitor after that long */
+#define DEFAULT_MONITOR_CALL_TIMEOUT 5  /* seconds */
+
+/* the keeper runs all its startup checks before calling the monitor */
+#define DEFAULT_STARTUP_FAST_START 0
+
+/* the keeper doesn't maintain a local topology snapshot unless set */
+#define DEFAULT_TOPOLOGY_SNAPSHOT 0
+#define DEFAULT_TOPOLOGY_SERVICE_FILE 0
+
 #define COORDINATOR_IS_READY_TIMEOUT 300
 
 #define POSTGRESQL_FAILS_TO_START_TIMEOUT 20
@@ -128,6 +254,15 @@
 #define MAXCTIMESIZE 26
 
 #define AWAIT_PROMOTION_SLEEP_TIME_MS 1000
+#define AWAIT_PROMOTION_POLL_INTERVAL_MS 10
+
+/*
+ * When the synchronous_standby_names value to apply changes, we wait that
+ * long and fetch it again from the monitor, so that several changes made in
+ * a row are applied with a single reload.
+ */
+#define APPLY_SETTINGS_SETTLE_TIME_MS 200
+#define APPLY_SETTINGS_SETTLE_MAX_ROUNDS 5
 
 #define KEEPER_CONFIGURATION_FILENAME "pg_autoctl.cfg"
 #define KEEPER_STATE_FILENAME "pg_autoctl.state"
@@ -135,6 +270,14 @@
 #define KEEPER_INIT_STATE_FILENAME "pg_autoctl.init"
 #define KEEPER_POSTGRES_STATE_FILENAME "pg_autoctl.pg"
 #define KEEPER_NODES_FILENAME "nodes.json"
+#define KEEPER_METRICS_FILENAME "pg_autoctl.metrics"
+#define KEEPER_PREWARM_FILENAME "prewarm.blocks"
+#define KEEPER_TIMELINES_FILENAME "timelines.history"
+#define KEEPER_TRANSITIONS_FILENAME "transitions.history"
+#define KEEPER_STARTUP_CACHE_FILENAME "startup.cache"
+#define KEEPER_BASEBACKUP_FILENAME "pg_autoctl.basebackup"
+#define KEEPER_TOPOLOGY_FILENAME "topology.json"
+#define KEEPER_TOPOLOGY_SERVICE_FILENAME "pg_service.conf"
 
 #define KEEPER_SYSTEMD_SERVICE "pgautofailover"
 #define KEEPER_SYSTEMD_FILENAME "pgautofailover.service"
@@ -159,6 +159,9 @@ demoapp_prepare_schema(const char *pguri)
 		"client integer, loop integer, retries integer, us bigint, recovery bool,"
 		"primary key(client, ts),"
 		"foreign key (client) references demo.client(client))",
+
+		"create table demo.bench(client integer, seq bigint, "
+		"ts timestamptz default now(), primary key(client, seq))",
 		NULL
 	};
 
@@ -22,6 +22,7 @@ bool demoapp_grab_formation_uri(DemoAppOptions *options,
 								bool *mayRetry);
 bool demoapp_prepare_schema(const char *pguri);
 bool demoapp_run(const char *pguri, DemoAppOptions *demoAppOptions);
+bool demoapp_bench(const char *pguri, DemoAppOptions *demoAppOptions);
 
 void demoapp_print_histogram(const char *pguri, DemoAppOptions *demoAppOptions);
 void demoapp_print_summary(const char *pguri, DemoAppOptions *demoAppOptions);
@@ -0,0 +1,1543 @@
+/*
+ * src/bin/pg_autoctl/demoapp_bench.c
+ *	 Failover downtime benchmark built on the demo application
+ *
+ * The benchmark runs a fixed rate workload against the formation URI, and
+ * injects switchovers or hard kills of the primary node while the clients are
+ * running. For each of those events, it measures how long writes and reads
+ * were unavailable, and how many acknowledged commits have been lost.
+ *
+ * The other way around, a commit that the client saw failing might still have
+ * made it to the new primary: an application that retries it would then
+ * apply it twice. Those unacknowledged commits are counted too, and the
+ * replication settings of the group are reported with the results, so that
+ * runs with different synchronous replication settings can be compared.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "postgres_fe.h"
+#include "portability/instr_time.h"
+
+#include "bench.h"
+#include "cli_common.h"
+#include "cli_do_demoapp.h"
+#include "cli_root.h"
+#include "defaults.h"
+#include "demoapp.h"
+#include "lock_utils.h"
+#include "log.h"
+#include "monitor.h"
+#include "parson.h"
+#include "pgsql.h"
+#include "runprogram.h"
+#include "signals.h"
+#include "string_utils.h"
+
+/* how many unavailability windows a client keeps track of */
+#define DEMO_BENCH_MAX_OUTAGES 1024
+
+/* how many events the failover process keeps track of */
+#define DEMO_BENCH_MAX_EVENTS 256
+
+typedef enum
+{
+	DEMO_BENCH_WRITE = 0,
+	DEMO_BENCH_READ
+} DemoBenchQuery;
+
+typedef enum
+{
+	DEMO_BENCH_EVENT_SWITCHOVER = 0,
+	DEMO_BENCH_EVENT_KILL
+} DemoBenchEventKind;
+
+/*
+ * A window of time during which a client could not write (or read), from
+ * its last successful query to the first successful query after failures.
+ * Times are in microseconds since the benchmark started.
+ */
+typedef struct DemoBenchOutage
+{
+	DemoBenchQuery query;
+	int64_t startTime;
+	int64_t endTime;
+} DemoBenchOutage;
+
+typedef struct DemoBenchEvent
+{
+	DemoBenchEventKind kind;
+	int64_t startTime;
+	int64_t endTime;
+	bool newPrimary;            /* did a node report primary after the event? */
+} DemoBenchEvent;
+
+/*
+ * Each client sends its statistics to the main process when done: this header,
+ * then outageCount outages, then the commit time of each of its transactions,
+ * or minus the time of the failure when the transaction failed, and then a
+ * latency histogram of the writes and of the reads for each second of the
+ * run.
+ */
+typedef struct DemoBenchClientStats
+{
+	BenchHistogram writes;
+	BenchHistogram reads;
+	int outageCount;
+	int64_t transactionCount;
+} DemoBenchClientStats;
+
+typedef struct DemoBenchClient
+{
+	DemoBenchClientStats stats;
+	BenchHistogram *series;     /* 2 histograms per second of the run */
+	DemoBenchOutage *outages;
+	int64_t *commitTimes;
+	bool *found;                /* transaction found at the end of the run */
+} DemoBenchClient;
+
+/* what we measured for each event, after the run */
+typedef struct DemoBenchResult
+{
+	double writeUnavailable;    /* ms */
+	double readUnavailable;     /* ms */
+	int64_t lostCommits;        /* acknowledged, and then missing */
+	int64_t unackedCommits;     /* failed on the client, and then found */
+} DemoBenchResult;
+
+/* replication settings of the group, fetched from the monitor */
+typedef struct DemoBenchSyncSettings
+{
+	bool fetched;
+	int numberSyncStandbys;
+	int quorumCount;            /* nodes that participate in the quorum */
+	int nodesCount;
+} DemoBenchSyncSettings;
+
+typedef struct DemoBenchFoundContext
+{
+	char sqlstate[SQLSTATE_LENGTH];
+	DemoBenchClient *clients;
+	int clientsCount;
+	bool parsedOk;
+} DemoBenchFoundContext;
+
+
+static const char *DemoBenchEventNames[] = { "switchover", "kill" };
+static const char *DemoBenchQueryNames[] = { "write", "read" };
+
+
+static int64_t demoapp_bench_now(instr_time benchStartTime);
+static void demoapp_bench_read_uri(const char *pguri, char *readUri, size_t size);
+static void demoapp_bench_client(const char *pguri, int clientId,
+								 DemoAppOptions *options,
+								 instr_time benchStartTime, int fd);
+static void demoapp_bench_failovers(DemoAppOptions *options,
+									instr_time benchStartTime, int fd);
+static bool demoapp_bench_switchover(Monitor *monitor, DemoAppOptions *options);
+static bool demoapp_bench_kill(Monitor *monitor, DemoAppOptions *options);
+static bool demoapp_bench_receive_client(int fd, DemoBenchClient *client,
+										 int seriesLength);
+static bool demoapp_bench_fetch_commits(const char *pguri,
+										DemoBenchClient *clients,
+										int clientsCount);
+static void parseDemoBenchCommits(void *ctx, PGresult *result);
+static bool demoapp_bench_fetch_sync_settings(DemoAppOptions *options,
+											  DemoBenchSyncSettings *settings);
+static int demoapp_bench_event_at(DemoBenchEvent *events, int eventCount,
+								  int64_t time);
+static int demoapp_bench_event_after(DemoBenchEvent *events, int eventCount,
+									 int64_t time);
+static void demoapp_bench_compute_results(DemoBenchClient *clients,
+										  int clientsCount,
+										  bool commitsFetched,
+										  DemoBenchEvent *events,
+										  int eventCount,
+										  DemoBenchResult *results);
+static void demoapp_bench_print_series(DemoAppOptions *options,
+									   BenchHistogram *series,
+									   DemoBenchEvent *events,
+									   int eventCount);
+static void demoapp_bench_print_text(DemoAppOptions *options,
+									 DemoBenchSyncSettings *settings,
+									 BenchHistogram *histograms,
+									 DemoBenchEvent *events,
+									 DemoBenchResult *results,
+									 int eventCount);
+static void demoapp_bench_print_csv(DemoBenchEvent *events,
+									DemoBenchResult *results,
+									int eventCount);
+static void demoapp_bench_print_json(DemoAppOptions *options,
+									 DemoBenchSyncSettings *settings,
+									 BenchHistogram *histograms,
+									 BenchHistogram *series,
+									 DemoBenchEvent *events,
+									 DemoBenchResult *results,
+									 int eventCount);
+
+
+/*
+ * demoapp_bench runs clientsCount sub-processes that each run a transaction
+ * every 1/rate seconds for the given duration, and a sub-process that
+ * injects the failover events. Then it collects the statistics of all the
+ * sub-processes and prints the results.
+ */
+bool
+demoapp_bench(const char *pguri, DemoAppOptions *demoAppOptions)
+{
+	int clientsCount = demoAppOptions->clientsCount;
+	int startedClientsCount = 0;
+	pid_t clientsPidArray[MAX_CLIENTS_COUNT + 1] = { 0 };
+	int pipesArray[MAX_CLIENTS_COUNT + 1] = { 0 };
+
+	DemoBenchEvent events[DEMO_BENCH_MAX_EVENTS] = { 0 };
+	int eventCount = 0;
+
+	BenchHistogram histograms[2] = { 0 };
+	DemoBenchSyncSettings settings = { 0 };
+	bool success = true;
+
+	instr_time benchStartTime;
+
+	int seriesLength = demoAppOptions->duration;
+
+	DemoBenchClient *clients =
+		(DemoBenchClient *) calloc(clientsCount, sizeof(DemoBenchClient));
+	BenchHistogram *series =
+		(BenchHistogram *) calloc(2 * seriesLength, sizeof(BenchHistogram));
+
+	if (clients == NULL || series == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return false;
+	}
+
+	log_info("Starting %d clients at %d transactions per second each "
+			 "with %d reads and %d writes per transaction, for %ds",
+			 clientsCount,
+			 demoAppOptions->rate,
+			 demoAppOptions->mixReads,
+			 demoAppOptions->mixWrites,
+			 demoAppOptions->duration);
+
+	if (!demoapp_bench_fetch_sync_settings(demoAppOptions, &settings))
+	{
+		log_warn("Failed to fetch the replication settings from the monitor");
+	}
+
+	INSTR_TIME_SET_CURRENT(benchStartTime);
+
+	/* Flush stdio channels just before fork, to avoid double-output problems */
+	fflush(stdout);
+	fflush(stderr);
+
+	/* index 0 is the failover process, as in demoapp_run */
+	for (int index = 0; index <= clientsCount; index++)
+	{
+		int pipeFd[2] = { 0 };
+
+		if (pipe(pipeFd) != 0)
+		{
+			log_error("Failed to create a pipe for client %d: %m", index);
+			return false;
+		}
+
+		pid_t fpid = fork();
+
+		switch (fpid)
+		{
+			case -1:
+			{
+				log_error("Failed to fork client %d", index);
+
+				for (int i = 0; i < startedClientsCount; i++)
+				{
+					(void) kill(clientsPidArray[i], SIGQUIT);
+				}
+
+				return false;
+			}
+
+			case 0:
+			{
+				close(pipeFd[0]);
+
+				/* initialize the semaphore used for locking log output */
+				if (!semaphore_init(&log_semaphore))
+				{
+					exit(EXIT_CODE_INTERNAL_ERROR);
+				}
+
+				/* set our logging facility to use our semaphore as a lock */
+				(void) log_set_udata(&log_semaphore);
+				(void) log_set_lock(&semaphore_log_lock_function);
+
+				if (index == 0)
+				{
+					(void) demoapp_bench_failovers(demoAppOptions,
+												   benchStartTime,
+												   pipeFd[1]);
+				}
+				else
+				{
+					(void) demoapp_bench_client(pguri, index, demoAppOptions,
+												benchStartTime, pipeFd[1]);
+				}
+
+				close(pipeFd[1]);
+
+				(void) semaphore_finish(&log_semaphore);
+				exit(EXIT_CODE_QUIT);
+			}
+
+			default:
+			{
+				/* fork succeeded, in parent */
+				close(pipeFd[1]);
+
+				clientsPidArray[index] = fpid;
+				pipesArray[index] = pipeFd[0];
+				++startedClientsCount;
+			}
+		}
+	}
+
+	/* the failover process sends its events count and then its events */
+	if (!bench_read_buffer(pipesArray[0], &eventCount, sizeof(eventCount)) ||
+		!bench_read_buffer(pipesArray[0], events,
+						   eventCount * sizeof(DemoBenchEvent)))
+	{
+		log_error("Failed to receive the failover events");
+		eventCount = 0;
+		success = false;
+	}
+
+	close(pipesArray[0]);
+
+	for (int index = 1; index <= clientsCount; index++)
+	{
+		DemoBenchClient *client = &(clients[index - 1]);
+
+		if (!demoapp_bench_receive_client(pipesArray[index], client,
+										  seriesLength))
+		{
+			log_error("Failed to receive statistics from client %d", index);
+			success = false;
+		}
+
+		(void) bench_histogram_merge(&(histograms[DEMO_BENCH_WRITE]),
+									 &(client->stats.writes));
+		(void) bench_histogram_merge(&(histograms[DEMO_BENCH_READ]),
+									 &(client->stats.reads));
+
+		/* the time series of all the clients are merged as they arrive */
+		for (int i = 0; i < 2 * seriesLength && client->series != NULL; i++)
+		{
+			(void) bench_histogram_merge(&(series[i]), &(client->series[i]));
+		}
+
+		free(client->series);
+		client->series = NULL;
+
+		close(pipesArray[index]);
+	}
+
+	for (int index = 0; index < startedClientsCount; index++)
+	{
+		int status = 0;
+
+		if (waitpid(clientsPidArray[index], &status, 0) == clientsPidArray[index] &&
+			WEXITSTATUS(status) != 0)
+		{
+			log_error("Client %d (pid %d) exited with code %d",
+					  index, clientsPidArray[index], WEXITSTATUS(status));
+			success = false;
+		}
+	}
+
+	/* now count the acknowledged commits that are missing */
+	bool commitsFetched =
+		demoapp_bench_fetch_commits(pguri, clients, clientsCount);
+
+	if (!commitsFetched)
+	{
+		log_warn("Failed to fetch the committed transactions, "
+				 "lost commits are not reported");
+	}
+
+	DemoBenchResult *results =
+		(DemoBenchResult *) calloc(eventCount + 1, sizeof(DemoBenchResult));
+
+	if (results == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return false;
+	}
+
+	(void) demoapp_bench_compute_results(clients, clientsCount, commitsFetched,
+										 events, eventCount, results);
+
+	switch (demoAppOptions->format)
+	{
+		case DEMO_FORMAT_CSV:
+		{
+			(void) demoapp_bench_print_csv(events, results, eventCount);
+			break;
+		}
+
+		case DEMO_FORMAT_JSON:
+		{
+			(void) demoapp_bench_print_json(demoAppOptions, &settings,
+											histograms, series,
+											events, results, eventCount);
+			break;
+		}
+
+		default:
+		{
+			(void) demoapp_bench_print_text(demoAppOptions, &settings,
+											histograms,
+											events, results, eventCount);
+			(void) demoapp_bench_print_series(demoAppOptions, series,
+											  events, eventCount);
+			break;
+		}
+	}
+
+	for (int index = 0; index < clientsCount; index++)
+	{
+		free(clients[index].outages);
+		free(clients[index].commitTimes);
+		free(clients[index].found);
+	}
+
+	free(clients);
+	free(results);
+	free(series);
+
+	return success;
+}
+
+
+/*
+ * demoapp_bench_now returns how many microseconds elapsed since the benchmark
+ * started. The monotonic clock is shared by all the processes of the
+ * benchmark, so the times measured in every sub-process can be compared.
+ */
+static int64_t
+demoapp_bench_now(instr_time benchStartTime)
+{
+	instr_time now;
+
+	INSTR_TIME_SET_CURRENT(now);
+	INSTR_TIME_SUBTRACT(now, benchStartTime);
+
+	return (int64_t) INSTR_TIME_GET_MICROSEC(now);
+}
+
+
+/*
+ * demoapp_bench_read_uri computes the connection string used for reads from
+ * the formation URI: reads may connect to any node.
+ */
+static void
+demoapp_bench_read_uri(const char *pguri, char *readUri, size_t size)
+{
+	const char *readWrite = "target_session_attrs=read-write";
+	const char *any = "target_session_attrs=any";
+
+	char *match = strstr(pguri, readWrite);
+
+	if (match == NULL)
+	{
+		strlcpy(readUri, pguri, size);
+		return;
+	}
+
+	sformat(readUri, size, "%.*s%s%s",
+			(int) (match - pguri), pguri,
+			any,
+			match + strlen(readWrite));
+}
+
+
+/*
+ * demoapp_bench_client runs the workload of a client: --rate transactions per
+ * second, each made of --mix write transactions and read queries, evenly
+ * spread on a fixed schedule. The schedule does not depend on how long the
+ * queries take, and latencies are measured from the time when the query was
+ * scheduled, so that the time spent waiting for the database to be available
+ * again is part of the measure, rather than lowering the offered load.
+ */
+static void
+demoapp_bench_client(const char *pguri, int clientId,
+					 DemoAppOptions *options,
+					 instr_time benchStartTime, int fd)
+{
+	PGSQL writer = { 0 };
+	PGSQL reader = { 0 };
+	char readUri[MAXCONNINFO] = { 0 };
+
+	DemoBenchClientStats stats = { 0 };
+	DemoBenchOutage *outages =
+		(DemoBenchOutage *) calloc(DEMO_BENCH_MAX_OUTAGES,
+								   sizeof(DemoBenchOutage));
+
+	int queriesPerTick = options->mixReads + options->mixWrites;
+	int64_t tickCount = (int64_t) options->rate * options->duration;
+	int64_t writesCount = tickCount * options->mixWrites;
+	int64_t *commitTimes = (int64_t *) calloc(writesCount + 1, sizeof(int64_t));
+
+	int seriesLength = options->duration;
+	BenchHistogram *series =
+		(BenchHistogram *) calloc(2 * seriesLength, sizeof(BenchHistogram));
+
+	if (outages == NULL || commitTimes == NULL || series == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return;
+	}
+
+	/* each failed query is a single attempt, the schedule is the retry */
+	(void) demoapp_bench_read_uri(pguri, readUri, sizeof(readUri));
+
+	pgsql_init(&writer, (char *) pguri, PGSQL_CONN_APP);
+	pgsql_init(&reader, readUri, PGSQL_CONN_APP);
+
+	writer.connectionStatementType = PGSQL_CONNECTION_PERSISTENT;
+	reader.connectionStatementType = PGSQL_CONNECTION_PERSISTENT;
+
+	(void) pgsql_set_retry_policy(&(writer.retryPolicy), 0, 0, 0, 0);
+	(void) pgsql_set_retry_policy(&(reader.retryPolicy), 0, 0, 0, 0);
+
+	/* time of the last successful query, and are we in an outage? */
+	int64_t lastSuccess[2] = { 0, 0 };
+	bool unavailable[2] = { false, false };
+
+	const char *sql[2] = {
+		"insert into demo.bench(client, seq) values($1, $2)",
+		"select max(seq) from demo.bench where client = $1"
+	};
+
+	const Oid paramTypes[2] = { INT4OID, INT8OID };
+	const char *paramValues[2] = { 0 };
+
+	char clientIdString[BUFSIZE] = { 0 };
+	char seqString[BUFSIZE] = { 0 };
+
+	sformat(clientIdString, sizeof(clientIdString), "%d", clientId);
+
+	paramValues[0] = clientIdString;
+	paramValues[1] = seqString;
+
+	/* seq numbers the write transactions */
+	int64_t seq = 0;
+
+	for (int64_t slot = 0; slot < tickCount * queriesPerTick; slot++)
+	{
+		if (asked_to_stop || asked_to_stop_fast || asked_to_quit)
+		{
+			break;
+		}
+
+		int query =
+			slot % queriesPerTick < options->mixWrites
+			? DEMO_BENCH_WRITE
+			: DEMO_BENCH_READ;
+
+		int64_t scheduledTime =
+			slot * 1000000 / ((int64_t) options->rate * queriesPerTick);
+		int64_t now = demoapp_bench_now(benchStartTime);
+
+		if (now < scheduledTime)
+		{
+			pg_usleep(scheduledTime - now);
+		}
+
+		if (query == DEMO_BENCH_WRITE)
+		{
+			sformat(seqString, sizeof(seqString), "%" PRId64, seq);
+		}
+
+		PGSQL *pgsql = query == DEMO_BENCH_WRITE ? &writer : &reader;
+		BenchHistogram *histogram =
+			query == DEMO_BENCH_WRITE ? &(stats.writes) : &(stats.reads);
+
+		/* the second during which the query was scheduled */
+		int second = scheduledTime / 1000000;
+
+		bool success =
+			pgsql_execute_with_params(pgsql, sql[query],
+									  query == DEMO_BENCH_WRITE ? 2 : 1,
+									  paramTypes, paramValues,
+									  NULL, NULL);
+
+		now = demoapp_bench_now(benchStartTime);
+
+		(void) bench_histogram_add(histogram,
+								   (now - scheduledTime) / 1000.0,
+								   success);
+
+		if (second < seriesLength)
+		{
+			(void) bench_histogram_add(&(series[2 * second + query]),
+									   (now - scheduledTime) / 1000.0,
+									   success);
+		}
+
+		if (success)
+		{
+			if (query == DEMO_BENCH_WRITE)
+			{
+				commitTimes[seq] = now;
+			}
+
+			if (unavailable[query] &&
+				stats.outageCount < DEMO_BENCH_MAX_OUTAGES)
+			{
+				DemoBenchOutage *outage = &(outages[stats.outageCount++]);
+
+				outage->query = query;
+				outage->startTime = lastSuccess[query];
+				outage->endTime = now;
+			}
+
+			unavailable[query] = false;
+			lastSuccess[query] = now;
+		}
+		else
+		{
+			unavailable[query] = true;
+
+			/* the write might still have been committed, see compute_results */
+			if (query == DEMO_BENCH_WRITE)
+			{
+				commitTimes[seq] = -now;
+			}
+
+			/* connect again next time, maybe to another node */
+			pgsql_finish(pgsql);
+		}
+
+		if (query == DEMO_BENCH_WRITE)
+		{
+			++seq;
+		}
+	}
+
+	/* outages that are still running at the end of the benchmark */
+	for (int query = DEMO_BENCH_WRITE; query <= DEMO_BENCH_READ; query++)
+	{
+		if (unavailable[query] && stats.outageCount < DEMO_BENCH_MAX_OUTAGES)
+		{
+			DemoBenchOutage *outage = &(outages[stats.outageCount++]);
+
+			outage->query = query;
+			outage->startTime = lastSuccess[query];
+			outage->endTime = demoapp_bench_now(benchStartTime);
+		}
+	}
+
+	pgsql_finish(&writer);
+	pgsql_finish(&reader);
+
+	stats.transactionCount = seq;
+
+	int64_t failedWrites = stats.writes.errors;
+
+	log_info("Client %d ran %" PRId64 " write transactions, %" PRId64 " failed, "
+			 "with %d outages",
+			 clientId, seq, failedWrites, stats.outageCount);
+
+	if (!bench_write_buffer(fd, &stats, sizeof(stats)) ||
+		!bench_write_buffer(fd, outages,
+							stats.outageCount * sizeof(DemoBenchOutage)) ||
+		!bench_write_buffer(fd, commitTimes, seq * sizeof(int64_t)) ||
+		!bench_write_buffer(fd, series,
+							2 * seriesLength * sizeof(BenchHistogram)))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+
+	free(outages);
+	free(commitTimes);
+	free(series);
+}
+
+
+/*
+ * demoapp_bench_failovers injects an event at --first-failover seconds, and
+ * then every --failover-freq seconds. An event is either a switchover
+ * orchestrated by the monitor, or a hard kill of the primary node using the
+ * --kill-command.
+ */
+static void
+demoapp_bench_failovers(DemoAppOptions *options,
+						instr_time benchStartTime, int fd)
+{
+	Monitor monitor = { 0 };
+
+	DemoBenchEvent events[DEMO_BENCH_MAX_EVENTS] = { 0 };
+	int eventCount = 0;
+
+	int64_t nextEventTime = (int64_t) options->firstFailover * 1000000;
+	int64_t duration = (int64_t) options->duration * 1000000;
+
+	if (!monitor_init(&monitor, options->monitor_pguri))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+
+	pgsql_set_monitor_interactive_retry_policy(&(monitor.pgsql.retryPolicy));
+
+	while (!(asked_to_stop || asked_to_stop_fast || asked_to_quit) &&
+		   nextEventTime < duration &&
+		   eventCount < DEMO_BENCH_MAX_EVENTS)
+	{
+		int64_t now = demoapp_bench_now(benchStartTime);
+
+		if (now < nextEventTime)
+		{
+			/* sleep at most 100ms at a time to check for signals */
+			pg_usleep(Min(nextEventTime - now, 100 * 1000));
+			continue;
+		}
+
+		DemoBenchEvent *event = &(events[eventCount++]);
+
+		switch (options->events)
+		{
+			case DEMO_EVENTS_KILL:
+			{
+				event->kind = DEMO_BENCH_EVENT_KILL;
+				break;
+			}
+
+			case DEMO_EVENTS_MIXED:
+			{
+				event->kind = eventCount % 2 == 1
+							  ? DEMO_BENCH_EVENT_SWITCHOVER
+							  : DEMO_BENCH_EVENT_KILL;
+				break;
+			}
+
+			default:
+			{
+				event->kind = DEMO_BENCH_EVENT_SWITCHOVER;
+				break;
+			}
+		}
+
+		log_info("Injecting event %d: %s",
+				 eventCount, DemoBenchEventNames[event->kind]);
+
+		event->startTime = demoapp_bench_now(benchStartTime);
+
+		event->newPrimary =
+			event->kind == DEMO_BENCH_EVENT_SWITCHOVER
+			? demoapp_bench_switchover(&monitor, options)
+			: demoapp_bench_kill(&monitor, options);
+
+		event->endTime = demoapp_bench_now(benchStartTime);
+
+		pgsql_finish(&(monitor.pgsql));
+
+		log_info("Event %d: %s %s after %.3f ms",
+				 eventCount,
+				 DemoBenchEventNames[event->kind],
+				 event->newPrimary ? "done" : "failed",
+				 (event->endTime - event->startTime) / 1000.0);
+
+		nextEventTime += (int64_t) options->failoverFreq * 1000000;
+	}
+
+	if (!bench_write_buffer(fd, &eventCount, sizeof(eventCount)) ||
+		!bench_write_buffer(fd, events, eventCount * sizeof(DemoBenchEvent)))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+}
+
+
+/*
+ * demoapp_bench_switchover performs a switchover and waits until a node has
+ * reported the primary state.
+ */
+static bool
+demoapp_bench_switchover(Monitor *monitor, DemoAppOptions *options)
+{
+	char *channels[] = { "state", NULL };
+
+	/* start listening to the state changes before we perform_failover */
+	if (!pgsql_listen(&(monitor->pgsql), channels))
+	{
+		log_error("Failed to listen to state changes from the monitor");
+		return false;
+	}
+
+	if (!monitor_perform_failover(monitor, options->formation, options->groupId))
+	{
+		log_error("Failed to perform switchover, see above for details");
+		return false;
+	}
+
+	return monitor_wait_until_some_node_reported_state(
+		monitor,
+		options->formation,
+		options->groupId,
+		NODE_KIND_UNKNOWN,
+		PRIMARY_STATE,
+		PG_AUTOCTL_LISTEN_NOTIFICATIONS_TIMEOUT);
+}
+
+
+/*
+ * demoapp_bench_kill runs the --kill-command to kill the current primary node
+ * and waits until a node has reported the primary state. The command finds
+ * the name, host, and port of the primary node in the environment variables
+ * PG_AUTOCTL_DEMO_PRIMARY_NAME, PG_AUTOCTL_DEMO_PRIMARY_HOST, and
+ * PG_AUTOCTL_DEMO_PRIMARY_PORT.
+ */
+static bool
+demoapp_bench_kill(Monitor *monitor, DemoAppOptions *options)
+{
+	char *channels[] = { "state", NULL };
+	NodeAddress primaryNode = { 0 };
+	char port[BUFSIZE] = { 0 };
+
+	if (!monitor_get_primary(monitor, options->formation, options->groupId,
+							 &primaryNode))
+	{
+		log_error("Failed to get the primary node from the monitor");
+		return false;
+	}
+
+	sformat(port, sizeof(port), "%d", primaryNode.port);
+
+	setenv("PG_AUTOCTL_DEMO_PRIMARY_NAME", primaryNode.name, 1);
+	setenv("PG_AUTOCTL_DEMO_PRIMARY_HOST", primaryNode.host, 1);
+	setenv("PG_AUTOCTL_DEMO_PRIMARY_PORT", port, 1);
+
+	/* start listening to the state changes before we kill the primary */
+	if (!pgsql_listen(&(monitor->pgsql), channels))
+	{
+		log_error("Failed to listen to state changes from the monitor");
+		return false;
+	}
+
+	log_info("Killing primary node " NODE_FORMAT ": %s",
+			 primaryNode.nodeId, primaryNode.name,
+			 primaryNode.host, primaryNode.port,
+			 options->killCommand);
+
+	Program program = run_program("/bin/sh", "-c", options->killCommand, NULL);
+
+	if (program.returnCode != 0)
+	{
+		log_error("Failed to kill the primary node, "
+				  "command exited with code %d: %s",
+				  program.returnCode,
+				  program.stdErr != NULL ? program.stdErr : "");
+		free_program(&program);
+		return false;
+	}
+
+	free_program(&program);
+
+	return monitor_wait_until_some_node_reported_state(
+		monitor,
+		options->formation,
+		options->groupId,
+		NODE_KIND_UNKNOWN,
+		PRIMARY_STATE,
+		PG_AUTOCTL_LISTEN_NOTIFICATIONS_TIMEOUT);
+}
+
+
+/*
+ * demoapp_bench_receive_client reads the statistics of a client from the
+ * given pipe.
+ */
+static bool
+demoapp_bench_receive_client(int fd, DemoBenchClient *client, int seriesLength)
+{
+	if (!bench_read_buffer(fd, &(client->stats), sizeof(client->stats)))
+	{
+		return false;
+	}
+
+	client->outages =
+		(DemoBenchOutage *) calloc(client->stats.outageCount + 1,
+								   sizeof(DemoBenchOutage));
+	client->commitTimes =
+		(int64_t *) calloc(client->stats.transactionCount + 1, sizeof(int64_t));
+	client->found =
+		(bool *) calloc(client->stats.transactionCount + 1, sizeof(bool));
+	client->series =
+		(BenchHistogram *) calloc(2 * seriesLength, sizeof(BenchHistogram));
+
+	if (client->outages == NULL ||
+		client->commitTimes == NULL ||
+		client->found == NULL ||
+		client->series == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return false;
+	}
+
+	return bench_read_buffer(fd, client->outages,
+							 client->stats.outageCount *
+							 sizeof(DemoBenchOutage)) &&
+		   bench_read_buffer(fd, client->commitTimes,
+							 client->stats.transactionCount * sizeof(int64_t)) &&
+		   bench_read_buffer(fd, client->series,
+							 2 * seriesLength * sizeof(BenchHistogram));
+}
+
+
+/*
+ * demoapp_bench_fetch_commits fetches the transactions that are in the
+ * database at the end of the benchmark, so that we can count the transactions
+ * that have been acknowledged to a client and then lost.
+ */
+static bool
+demoapp_bench_fetch_commits(const char *pguri,
+							DemoBenchClient *clients, int clientsCount)
+{
+	PGSQL pgsql = { 0 };
+	DemoBenchFoundContext context = { { 0 }, clients, clientsCount, false };
+
+	const char *sql = "select client, seq from demo.bench";
+
+	pgsql_init(&pgsql, (char *) pguri, PGSQL_CONN_APP);
+
+	if (!pgsql_execute_with_params(&pgsql, sql, 0, NULL, NULL,
+								   &context, parseDemoBenchCommits))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	return context.parsedOk;
+}
+
+
+/*
+ * parseDemoBenchCommits marks the transactions found in the database.
+ */
+static void
+parseDemoBenchCommits(void *ctx, PGresult *result)
+{
+	DemoBenchFoundContext *context = (DemoBenchFoundContext *) ctx;
+
+	if (PQnfields(result) != 2)
+	{
+		log_error("Query returned %d columns, expected 2", PQnfields(result));
+		context->parsedOk = false;
+		return;
+	}
+
+	for (int rowNumber = 0; rowNumber < PQntuples(result); rowNumber++)
+	{
+		int clientId = 0;
+		int64_t seq = 0;
+
+		if (!stringToInt(PQgetvalue(result, rowNumber, 0), &clientId) ||
+			!stringToInt64(PQgetvalue(result, rowNumber, 1), &seq))
+		{
+			log_error("Invalid transaction in demo.bench: %s, %s",
+					  PQgetvalue(result, rowNumber, 0),
+					  PQgetvalue(result, rowNumber, 1));
+			context->parsedOk = false;
+			return;
+		}
+
+		/* clients are numbered from 1, see demoapp_bench */
+		if (clientId < 1 || clientId > context->clientsCount)
+		{
+			continue;
+		}
+
+		DemoBenchClient *client = &(context->clients[clientId - 1]);
+
+		if (client->found != NULL &&
+			seq >= 0 && seq < client->stats.transactionCount)
+		{
+			client->found[seq] = true;
+		}
+	}
+
+	context->parsedOk = true;
+}
+
+
+/*
+ * demoapp_bench_fetch_sync_settings fetches the number-sync-standbys of the
+ * formation, and how many nodes of the group participate in the replication
+ * quorum, so that the results can be related to those settings.
+ */
+static bool
+demoapp_bench_fetch_sync_settings(DemoAppOptions *options,
+								  DemoBenchSyncSettings *settings)
+{
+	Monitor monitor = { 0 };
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_INT, false };
+	const char *sql[2] = {
+		"select count(*) filter (where replicationquorum) "
+		"from pgautofailover.node where formationid = $1 and groupid = $2",
+		"select count(*) "
+		"from pgautofailover.node where formationid = $1 and groupid = $2"
+	};
+	int *counts[2] = { &(settings->quorumCount), &(settings->nodesCount) };
+
+	char groupIdStr[BUFSIZE] = { 0 };
+	Oid paramTypes[2] = { TEXTOID, INT4OID };
+	const char *paramValues[2] = { options->formation, groupIdStr };
+
+	sformat(groupIdStr, sizeof(groupIdStr), "%d", options->groupId);
+
+	if (!monitor_init(&monitor, options->monitor_pguri))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (!monitor_get_formation_number_sync_standbys(&monitor,
+													options->formation,
+													&(settings->numberSyncStandbys)))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		context.parsedOk = false;
+
+		if (!pgsql_execute_with_params(&(monitor.pgsql), sql[i],
+									   2, paramTypes, paramValues,
+									   &context, &parseSingleValueResult) ||
+			!context.parsedOk)
+		{
+			pgsql_finish(&(monitor.pgsql));
+			return false;
+		}
+
+		*(counts[i]) = context.intVal;
+	}
+
+	pgsql_finish(&(monitor.pgsql));
+
+	settings->fetched = true;
+
+	return true;
+}
+
+
+/*
+ * demoapp_bench_event_at returns the index of the last event that started
+ * before the given time, or -1 when there is none.
+ */
+static int
+demoapp_bench_event_at(DemoBenchEvent *events, int eventCount, int64_t time)
+{
+	int eventIndex = -1;
+
+	for (int index = 0; index < eventCount; index++)
+	{
+		if (events[index].startTime <= time)
+		{
+			eventIndex = index;
+		}
+	}
+
+	return eventIndex;
+}
+
+
+/*
+ * demoapp_bench_event_after returns the index of the first event that was
+ * not done yet at the given time, or -1 when there is none.
+ */
+static int
+demoapp_bench_event_after(DemoBenchEvent *events, int eventCount, int64_t time)
+{
+	for (int index = 0; index < eventCount; index++)
+	{
+		if (events[index].endTime >= time)
+		{
+			return index;
+		}
+	}
+
+	return -1;
+}
+
+
+/*
+ * demoapp_bench_compute_results computes the unavailable time of writes and
+ * reads, and the count of lost commits, caused by each event.
+ *
+ * An outage is caused by the last event that started before the outage ended.
+ * As clients run concurrently, the unavailable time of an event is the
+ * longest time any of the clients spent in the outages that it caused.
+ *
+ * A commit that has been acknowledged and then lost belongs to the first
+ * event that was not done yet when the commit was acknowledged. Outages and
+ * lost commits that are not caused by any event are counted in the extra
+ * result at index eventCount.
+ *
+ * A commit that failed on the client and is found in the database anyway
+ * belongs to the first event that was not done yet when the client saw it
+ * failing: the commit reached the new primary, but its acknowledgement did
+ * not reach the client.
+ */
+static void
+demoapp_bench_compute_results(DemoBenchClient *clients, int clientsCount,
+							  bool commitsFetched,
+							  DemoBenchEvent *events, int eventCount,
+							  DemoBenchResult *results)
+{
+	double *clientTime = (double *) calloc(2 * (eventCount + 1), sizeof(double));
+
+	if (clientTime == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return;
+	}
+
+	for (int c = 0; c < clientsCount; c++)
+	{
+		DemoBenchClient *client = &(clients[c]);
+
+		memset(clientTime, 0, 2 * (eventCount + 1) * sizeof(double));
+
+		for (int o = 0; o < client->stats.outageCount && client->outages; o++)
+		{
+			DemoBenchOutage *outage = &(client->outages[o]);
+			int eventIndex =
+				demoapp_bench_event_at(events, eventCount, outage->endTime);
+
+			if (eventIndex < 0)
+			{
+				eventIndex = eventCount;
+			}
+
+			clientTime[2 * eventIndex + outage->query] +=
+				(outage->endTime - outage->startTime) / 1000.0;
+		}
+
+		for (int e = 0; e <= eventCount; e++)
+		{
+			DemoBenchResult *result = &(results[e]);
+
+			double writeTime = clientTime[2 * e + DEMO_BENCH_WRITE];
+			double readTime = clientTime[2 * e + DEMO_BENCH_READ];
+
+			if (writeTime > result->writeUnavailable)
+			{
+				result->writeUnavailable = writeTime;
+			}
+
+			if (readTime > result->readUnavailable)
+			{
+				result->readUnavailable = readTime;
+			}
+		}
+
+		for (int64_t seq = 0; seq < client->stats.transactionCount; seq++)
+		{
+			if (!commitsFetched || client->commitTimes == NULL)
+			{
+				break;
+			}
+
+			int64_t commitTime = client->commitTimes[seq];
+			bool acknowledged = commitTime > 0;
+
+			/* only count the outcomes that the client got wrong */
+			if (commitTime == 0 || acknowledged == client->found[seq])
+			{
+				continue;
+			}
+
+			int eventIndex =
+				demoapp_bench_event_after(events, eventCount,
+										  acknowledged ? commitTime : -commitTime);
+			DemoBenchResult *result =
+				&(results[eventIndex < 0 ? eventCount : eventIndex]);
+
+			if (acknowledged)
+			{
+				++(result->lostCommits);
+			}
+			else
+			{
+				++(result->unackedCommits);
+			}
+		}
+	}
+
+	if (!commitsFetched)
+	{
+		for (int e = 0; e <= eventCount; e++)
+		{
+			results[e].lostCommits = -1;
+			results[e].unackedCommits = -1;
+		}
+	}
+
+	free(clientTime);
+}
+
+
+/*
+ * demoapp_bench_print_text prints the latencies of the queries and the
+ * results of each event as tables.
+ */
+static void
+demoapp_bench_print_text(DemoAppOptions *options,
+						 DemoBenchSyncSettings *settings,
+						 BenchHistogram *histograms,
+						 DemoBenchEvent *events, DemoBenchResult *results,
+						 int eventCount)
+{
+	fformat(stdout,
+			"\nDemo bench: %d clients at %d transactions per second "
+			"(%d reads, %d writes), %ds\n",
+			options->clientsCount, options->rate,
+			options->mixReads, options->mixWrites,
+			options->duration);
+
+	if (settings->fetched)
+	{
+		fformat(stdout,
+				"Replication: number-sync-standbys %d, "
+				"%d of %d nodes in the replication quorum\n",
+				settings->numberSyncStandbys,
+				settings->quorumCount,
+				settings->nodesCount);
+	}
+
+	fformat(stdout, "\n");
+
+	fformat(stdout, "%5s | %8s | %6s | %8s | %8s | %8s | %8s | %9s\n",
+			"Query", "Count", "Errors",
+			"p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "Max ms");
+
+	fformat(stdout, "%5s-+-%8s-+-%6s-+-%8s-+-%8s-+-%8s-+-%8s-+-%9s\n",
+			"-----", "--------", "------",
+			"--------", "--------", "--------", "--------", "---------");
+
+	for (int query = DEMO_BENCH_WRITE; query <= DEMO_BENCH_READ; query++)
+	{
+		BenchHistogram *histogram = &(histograms[query]);
+
+		fformat(stdout,
+				"%5s | %8" PRId64 " | %6" PRId64 " | %8.3f | %8.3f | %8.3f "
+				"| %8.3f | %9.3f\n",
+				DemoBenchQueryNames[query],
+				histogram->count,
+				histogram->errors,
+				bench_histogram_percentile(histogram, 0.50),
+				bench_histogram_percentile(histogram, 0.90),
+				bench_histogram_percentile(histogram, 0.99),
+				bench_histogram_percentile(histogram, 0.999),
+				histogram->maxTime);
+	}
+
+	fformat(stdout, "\n%5s | %10s | %9s | %11s | %14s | %13s | %12s | %7s\n",
+			"Event", "Kind", "Start (s)", "Failover ms",
+			"Write unavail.", "Read unavail.", "Lost commits", "Unacked");
+
+	fformat(stdout, "%5s-+-%10s-+-%9s-+-%11s-+-%14s-+-%13s-+-%12s-+-%7s\n",
+			"-----", "----------", "---------", "-----------",
+			"--------------", "-------------", "------------", "-------");
+
+	for (int e = 0; e <= eventCount; e++)
+	{
+		DemoBenchResult *result = &(results[e]);
+
+		if (e == eventCount)
+		{
+			/* only show the outages not caused by any event when we have some */
+			if (result->writeUnavailable == 0 &&
+				result->readUnavailable == 0 &&
+				result->lostCommits <= 0 &&
+				result->unackedCommits <= 0)
+			{
+				break;
+			}
+
+			fformat(stdout, "%5s | %10s | %9s | %11s | %14.3f | %13.3f "
+							"| %12" PRId64 " | %7" PRId64 "\n",
+					"-", "none", "-", "-",
+					result->writeUnavailable,
+					result->readUnavailable,
+					result->lostCommits,
+					result->unackedCommits);
+			break;
+		}
+
+		DemoBenchEvent *event = &(events[e]);
+		char failoverTime[BUFSIZE] = "-";
+
+		if (event->newPrimary)
+		{
+			sformat(failoverTime, sizeof(failoverTime), "%.3f",
+					(event->endTime - event->startTime) / 1000.0);
+		}
+
+		fformat(stdout, "%5d | %10s | %9.3f | %11s | %14.3f | %13.3f "
+						"| %12" PRId64 " | %7" PRId64 "\n",
+				e + 1,
+				DemoBenchEventNames[event->kind],
+				event->startTime / 1000000.0,
+				failoverTime,
+				result->writeUnavailable,
+				result->readUnavailable,
+				result->lostCommits,
+				result->unackedCommits);
+	}
+
+	fformat(stdout, "\n");
+}
+
+
+/*
+ * demoapp_bench_print_series prints, for each second of the run, how many
+ * queries were scheduled, how many of them failed, and their p99 latency,
+ * for the writes and the reads. The queries are counted in the second when
+ * they were scheduled to start, so a failover shows as seconds with a high
+ * latency or errors rather than as seconds with fewer queries. Seconds during
+ * an event are marked with the event number.
+ */
+static void
+demoapp_bench_print_series(DemoAppOptions *options, BenchHistogram *series,
+						   DemoBenchEvent *events, int eventCount)
+{
+	fformat(stdout, "%6s | %5s | %7s | %6s | %9s | %7s | %6s | %9s\n",
+			"Second", "Event",
+			"Writes", "Errors", "p99 ms",
+			"Reads", "Errors", "p99 ms");
+
+	fformat(stdout, "%6s-+-%5s-+-%7s-+-%6s-+-%9s-+-%7s-+-%6s-+-%9s\n",
+			"------", "-----",
+			"-------", "------", "---------",
+			"-------", "------", "---------");
+
+	for (int second = 0; second < options->duration; second++)
+	{
+		BenchHistogram *writes = &(series[2 * second + DEMO_BENCH_WRITE]);
+		BenchHistogram *reads = &(series[2 * second + DEMO_BENCH_READ]);
+
+		char event[BUFSIZE] = "";
+
+		/* an event is in progress at any time during that second? */
+		int eventIndex =
+			demoapp_bench_event_after(events, eventCount,
+									  (int64_t) second * 1000000);
+
+		if (eventIndex >= 0 &&
+			events[eventIndex].startTime < (int64_t) (second + 1) * 1000000)
+		{
+			sformat(event, sizeof(event), "%d", eventIndex + 1);
+		}
+
+		fformat(stdout,
+				"%6d | %5s | %7" PRId64 " | %6" PRId64 " | %9.3f "
+				"| %7" PRId64 " | %6" PRId64 " | %9.3f\n",
+				second,
+				event,
+				writes->count,
+				writes->errors,
+				bench_histogram_percentile(writes, 0.99),
+				reads->count,
+				reads->errors,
+				bench_histogram_percentile(reads, 0.99));
+	}
+
+	fformat(stdout, "\n");
+}
+
+
+/*
+ * demoapp_bench_print_csv prints the results of each event in CSV format.
+ */
+static void
+demoapp_bench_print_csv(DemoBenchEvent *events, DemoBenchResult *results,
+						int eventCount)
+{
+	fformat(stdout,
+			"event,kind,start_s,failover_ms,new_primary,"
+			"write_unavailable_ms,read_unavailable_ms,lost_commits,"
+			"unacked_commits\n");
+
+	for (int e = 0; e < eventCount; e++)
+	{
+		DemoBenchEvent *event = &(events[e]);
+		DemoBenchResult *result = &(results[e]);
+
+		fformat(stdout, "%d,%s,%.3f,%.3f,%s,%.3f,%.3f,%" PRId64 ",%" PRId64 "\n",
+				e + 1,
+				DemoBenchEventNames[event->kind],
+				event->startTime / 1000000.0,
+				(event->endTime - event->startTime) / 1000.0,
+				event->newPrimary ? "true" : "false",
+				result->writeUnavailable,
+				result->readUnavailable,
+				result->lostCommits,
+				result->unackedCommits);
+	}
+}
+
+
+/*
+ * demoapp_bench_print_json prints the settings of the benchmark, the
+ * latencies of the queries, and the results of each event in JSON format.
+ */
+static void
+demoapp_bench_print_json(DemoAppOptions *options,
+						 DemoBenchSyncSettings *settings,
+						 BenchHistogram *histograms,
+						 BenchHistogram *series,
+						 DemoBenchEvent *events, DemoBenchResult *results,
+						 int eventCount)
+{
+	JSON_Value *js = json_value_init_object();
+	JSON_Object *jsObj = json_value_get_object(js);
+
+	json_object_dotset_number(jsObj, "settings.clients",
+							  (double) options->clientsCount);
+	json_object_dotset_number(jsObj, "settings.rate", (double) options->rate);
+	json_object_dotset_number(jsObj, "settings.mix_reads",
+							  (double) options->mixReads);
+	json_object_dotset_number(jsObj, "settings.mix_writes",
+							  (double) options->mixWrites);
+	json_object_dotset_number(jsObj, "settings.duration",
+							  (double) options->duration);
+	json_object_dotset_number(jsObj, "settings.first_failover",
+							  (double) options->firstFailover);
+	json_object_dotset_number(jsObj, "settings.failover_freq",
+							  (double) options->failoverFreq);
+
+	if (settings->fetched)
+	{
+		json_object_dotset_number(jsObj, "settings.number_sync_standbys",
+								  (double) settings->numberSyncStandbys);
+		json_object_dotset_number(jsObj, "settings.replication_quorum_nodes",
+								  (double) settings->quorumCount);
+		json_object_dotset_number(jsObj, "settings.nodes",
+								  (double) settings->nodesCount);
+	}
+
+	JSON_Value *jsLatencies = json_value_init_object();
+	JSON_Object *jsLatenciesObj = json_value_get_object(jsLatencies);
+
+	for (int query = DEMO_BENCH_WRITE; query <= DEMO_BENCH_READ; query++)
+	{
+		BenchHistogram *histogram = &(histograms[query]);
+
+		JSON_Value *jsQuery = json_value_init_object();
+		JSON_Object *jsQueryObj = json_value_get_object(jsQuery);
+
+		json_object_set_number(jsQueryObj, "count", (double) histogram->count);
+		json_object_set_number(jsQueryObj, "errors", (double) histogram->errors);
+		json_object_set_number(jsQueryObj, "p50_ms",
+							   bench_histogram_percentile(histogram, 0.50));
+		json_object_set_number(jsQueryObj, "p90_ms",
+							   bench_histogram_percentile(histogram, 0.90));
+		json_object_set_number(jsQueryObj, "p99_ms",
+							   bench_histogram_percentile(histogram, 0.99));
+		json_object_set_number(jsQueryObj, "p999_ms",
+							   bench_histogram_percentile(histogram, 0.999));
+		json_object_set_number(jsQueryObj, "max_ms", histogram->maxTime);
+
+		json_object_set_value(jsLatenciesObj,
+							  DemoBenchQueryNames[query],
+							  jsQuery);
+	}
+
+	json_object_set_value(jsObj, "latencies", jsLatencies);
+
+	JSON_Value *jsEvents = json_value_init_array();
+	JSON_Array *jsEventsArray = json_value_get_array(jsEvents);
+
+	for (int e = 0; e < eventCount; e++)
+	{
+		DemoBenchEvent *event = &(events[e]);
+		DemoBenchResult *result = &(results[e]);
+
+		JSON_Value *jsEvent = json_value_init_object();
+		JSON_Object *jsEventObj = json_value_get_object(jsEvent);
+
+		json_object_set_number(jsEventObj, "event", (double) (e + 1));
+		json_object_set_string(jsEventObj, "kind",
+							   DemoBenchEventNames[event->kind]);
+		json_object_set_number(jsEventObj, "start_s",
+							   event->startTime / 1000000.0);
+		json_object_set_number(jsEventObj, "failover_ms",
+							   (event->endTime - event->startTime) / 1000.0);
+		json_object_set_boolean(jsEventObj, "new_primary", event->newPrimary);
+		json_object_set_number(jsEventObj, "write_unavailable_ms",
+							   result->writeUnavailable);
+		json_object_set_number(jsEventObj, "read_unavailable_ms",
+							   result->readUnavailable);
+		json_object_set_number(jsEventObj, "lost_commits",
+							   (double) result->lostCommits);
+		json_object_set_number(jsEventObj, "unacked_commits",
+							   (double) result->unackedCommits);
+
+		json_array_append_value(jsEventsArray, jsEvent);
+	}
+
+	json_object_set_value(jsObj, "events", jsEvents);
+
+	JSON_Value *jsSeries = json_value_init_array();
+	JSON_Array *jsSeriesArray = json_value_get_array(jsSeries);
+
+	for (int second = 0; second < options->duration; second++)
+	{
+		JSON_Value *jsSecond = json_value_init_object();
+		JSON_Object *jsSecondObj = json_value_get_object(jsSecond);
+
+		json_object_set_number(jsSecondObj, "second", (double) second);
+
+		for (int query = DEMO_BENCH_WRITE; query <= DEMO_BENCH_READ; query++)
+		{
+			BenchHistogram *histogram = &(series[2 * second + query]);
+
+			JSON_Value *jsQuery = json_value_init_object();
+			JSON_Object *jsQueryObj = json_value_get_object(jsQuery);
+
+			json_object_set_number(jsQueryObj, "count",
+								   (double) histogram->count);
+			json_object_set_number(jsQueryObj, "errors",
+								   (double) histogram->errors);
+			json_object_set_number(jsQueryObj, "p99_ms",
+								   bench_histogram_percentile(histogram, 0.99));
+			json_object_set_number(jsQueryObj, "max_ms", histogram->maxTime);
+
+			json_object_set_value(jsSecondObj,
+								  DemoBenchQueryNames[query],
+								  jsQuery);
+		}
+
+		json_array_append_value(jsSeriesArray, jsSecond);
+	}
+
+	json_object_set_value(jsObj, "timeseries", jsSeries);
+
+	(void) cli_pprint_json(js);
+}
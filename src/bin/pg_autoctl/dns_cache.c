@@ -0,0 +1,311 @@
+/*
+ * src/bin/pg_autoctl/dns_cache.c
+ *     Cache the DNS checks done when editing the HBA file, and run them with
+ *     a hard timeout.
+ *
+ * Each time the keeper refreshes the list of the other nodes, it checks that
+ * every hostname resolves forward and back to itself before using it in an
+ * HBA rule. The system resolver calls are synchronous, and a single slow DNS
+ * server would then stall the keeper main loop, and its reaction to state
+ * transitions.
+ *
+ * We keep the results in a process-wide cache, with a shorter time-to-live
+ * for failed lookups than for successful ones. On a cache miss, the lookups
+ * run in a child process that we wait for at most DNS_RESOLVE_TIMEOUT_MS:
+ * getaddrinfo() can not be interrupted, but a process can be killed.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "postgres_fe.h"
+#include "portability/instr_time.h"
+
+#include "defaults.h"
+#include "dns_cache.h"
+#include "ipaddr.h"
+#include "log.h"
+
+/* what the child process sends back to us */
+typedef struct DNSResolution
+{
+	bool success;
+	bool foundHostnameFromAddress;
+	char ipaddr[BUFSIZE];
+} DNSResolution;
+
+typedef struct DNSCacheEntry
+{
+	char hostname[_POSIX_HOST_NAME_MAX];
+	uint64_t expiresAt;
+	DNSResolution resolution;
+} DNSCacheEntry;
+
+static DNSCacheEntry dnsCache[DNS_CACHE_MAX_ENTRIES] = { 0 };
+
+static DNSCacheEntry * dns_cache_lookup(const char *hostname, uint64_t now);
+static void dns_cache_store(const char *hostname, uint64_t now,
+							DNSResolution *resolution);
+static bool dns_resolve_with_timeout(const char *hostname,
+									 DNSResolution *resolution);
+
+
+/*
+ * dns_cache_resolve_forward_and_reverse implements the same API as
+ * resolveHostnameForwardAndReverse, using the cache when possible, and
+ * otherwise with a hard timeout on the DNS lookups.
+ */
+bool
+dns_cache_resolve_forward_and_reverse(const char *hostname,
+									  char *ipaddr, int size,
+									  bool *foundHostnameFromAddress)
+{
+	uint64_t now = time(NULL);
+	DNSResolution resolution = { 0 };
+
+	DNSCacheEntry *entry = dns_cache_lookup(hostname, now);
+
+	if (entry != NULL)
+	{
+		log_debug("Using cached DNS lookups for \"%s\", valid for %" PRIu64
+				  "s more",
+				  hostname, entry->expiresAt - now);
+
+		resolution = entry->resolution;
+	}
+	else
+	{
+		/* a timeout is cached as a failure, for the negative TTL */
+		(void) dns_resolve_with_timeout(hostname, &resolution);
+		(void) dns_cache_store(hostname, now, &resolution);
+	}
+
+	strlcpy(ipaddr, resolution.ipaddr, size);
+	*foundHostnameFromAddress = resolution.foundHostnameFromAddress;
+
+	return resolution.success;
+}
+
+
+/*
+ * dns_cache_reset forgets about all the cached DNS lookups.
+ */
+void
+dns_cache_reset(void)
+{
+	memset(dnsCache, 0, sizeof(dnsCache));
+}
+
+
+/*
+ * dns_cache_lookup returns the cache entry for the given hostname, or NULL
+ * when we don't have one or it has expired.
+ */
+static DNSCacheEntry *
+dns_cache_lookup(const char *hostname, uint64_t now)
+{
+	for (int i = 0; i < DNS_CACHE_MAX_ENTRIES; i++)
+	{
+		DNSCacheEntry *entry = &(dnsCache[i]);
+
+		if (entry->expiresAt > now && strcmp(entry->hostname, hostname) == 0)
+		{
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * dns_cache_store adds the given resolution to the cache, replacing the
+ * previous entry for the same hostname, or an expired entry, or else the one
+ * that expires first.
+ */
+static void
+dns_cache_store(const char *hostname, uint64_t now, DNSResolution *resolution)
+{
+	DNSCacheEntry *target = &(dnsCache[0]);
+
+	if (strlen(hostname) >= sizeof(target->hostname))
+	{
+		/* we would never find it again */
+		return;
+	}
+
+	for (int i = 0; i < DNS_CACHE_MAX_ENTRIES; i++)
+	{
+		DNSCacheEntry *entry = &(dnsCache[i]);
+
+		if (strcmp(entry->hostname, hostname) == 0)
+		{
+			target = entry;
+			break;
+		}
+
+		if (entry->expiresAt <= now)
+		{
+			target = entry;
+		}
+		else if (target->expiresAt > now &&
+				 entry->expiresAt < target->expiresAt)
+		{
+			target = entry;
+		}
+	}
+
+	strlcpy(target->hostname, hostname, sizeof(target->hostname));
+	target->resolution = *resolution;
+	target->expiresAt =
+		now + (resolution->success && resolution->foundHostnameFromAddress
+			   ? DNS_CACHE_POSITIVE_TTL
+			   : DNS_CACHE_NEGATIVE_TTL);
+}
+
+
+/*
+ * dns_resolve_with_timeout runs resolveHostnameForwardAndReverse in a child
+ * process, and waits for its result for at most DNS_RESOLVE_TIMEOUT_MS. When
+ * the child takes longer than that, it's killed, and resolution is left
+ * zeroed, as a failed lookup.
+ */
+static bool
+dns_resolve_with_timeout(const char *hostname, DNSResolution *resolution)
+{
+	int fds[2] = { 0 };
+
+	if (pipe(fds) != 0)
+	{
+		log_warn("Failed to create a pipe to resolve \"%s\": %m", hostname);
+		return false;
+	}
+
+	/* flush stdio channels just before fork, to avoid double-output problems */
+	fflush(stdout);
+	fflush(stderr);
+
+	pid_t fpid = fork();
+
+	switch (fpid)
+	{
+		case -1:
+		{
+			log_warn("Failed to fork a process to resolve \"%s\": %m",
+					 hostname);
+			close(fds[0]);
+			close(fds[1]);
+			return false;
+		}
+
+		case 0:
+		{
+			/* child process runs the DNS lookups and reports */
+			DNSResolution childResolution = { 0 };
+
+			close(fds[0]);
+
+			childResolution.success =
+				resolveHostnameForwardAndReverse(
+					hostname,
+					childResolution.ipaddr,
+					sizeof(childResolution.ipaddr),
+					&(childResolution.foundHostnameFromAddress));
+
+			ssize_t written =
+				write(fds[1], &childResolution, sizeof(childResolution));
+
+			/* don't run the parent's atexit() handlers in the child */
+			_exit(written == sizeof(childResolution) ? 0 : 1);
+		}
+
+		default:
+		{
+			break;
+		}
+	}
+
+	/* parent process reads the child's result, or gives up */
+	close(fds[1]);
+
+	instr_time startTime;
+	instr_time duration;
+	size_t received = 0;
+	char *buffer = (char *) resolution;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	while (received < sizeof(DNSResolution))
+	{
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, startTime);
+
+		int remainingMs =
+			DNS_RESOLVE_TIMEOUT_MS - (int) INSTR_TIME_GET_MILLISEC(duration);
+
+		if (remainingMs <= 0)
+		{
+			break;
+		}
+
+		struct pollfd pfd = { .fd = fds[0], .events = POLLIN };
+		int ret = poll(&pfd, 1, remainingMs);
+
+		if (ret < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		else if (ret <= 0)
+		{
+			break;
+		}
+
+		ssize_t bytes =
+			read(fds[0], buffer + received, sizeof(DNSResolution) - received);
+
+		if (bytes < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		else if (bytes <= 0)
+		{
+			/* the child exited without sending its result */
+			break;
+		}
+
+		received += bytes;
+	}
+
+	close(fds[0]);
+
+	bool success = received == sizeof(DNSResolution);
+
+	if (!success)
+	{
+		log_warn("Failed to resolve \"%s\" forward and reverse within %dms",
+				 hostname, DNS_RESOLVE_TIMEOUT_MS);
+
+		memset(resolution, 0, sizeof(DNSResolution));
+
+		(void) kill(fpid, SIGKILL);
+	}
+
+	/* reap the child process, it has either exited or been killed */
+	while (waitpid(fpid, NULL, 0) < 0 && errno == EINTR)
+	{ }
+
+	return success;
+}
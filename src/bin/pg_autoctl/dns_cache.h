@@ -0,0 +1,23 @@
+/*
+ * src/bin/pg_autoctl/dns_cache.h
+ *     Cache the DNS checks done when editing the HBA file, and run them with
+ *     a hard timeout.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+#include <stdbool.h>
+
+#define DNS_CACHE_MAX_ENTRIES 64
+
+bool dns_cache_resolve_forward_and_reverse(const char *hostname,
+										   char *ipaddr, int size,
+										   bool *foundHostnameFromAddress);
+void dns_cache_reset(void);
+
+#endif /* DNS_CACHE_H */
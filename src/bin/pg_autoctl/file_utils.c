@@ -7,6 +7,7 @@
  *
  */
 
+#include <fcntl.h>
 #include <limits.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -200,6 +201,72 @@ write_file(char *data, long fileSize, const char *filePath)
 }
 
 
+/*
+ * write_file_atomic writes the given data to a temporary file next to the
+ * given filePath, and then renames it in place, so that readers of filePath
+ * either see its previous contents or the new ones, never a partial write.
+ * The permissions of an existing file at filePath are kept.
+ */
+bool
+write_file_atomic(char *data, long fileSize, const char *filePath)
+{
+	char tempFileName[MAXPGPATH] = { 0 };
+	struct stat buf;
+	mode_t mode = 0644;
+
+	if (stat(filePath, &buf) == 0)
+	{
+		mode = buf.st_mode & 0777;
+	}
+
+	sformat(tempFileName, MAXPGPATH, "%s.new", filePath);
+
+	/* clean-up a stale temporary file, if any */
+	if (!unlink_file(tempFileName))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	FILE *fileStream = fopen_with_umask(tempFileName, "wb", FOPEN_FLAGS_W, mode);
+
+	if (fileStream == NULL)
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (fwrite(data, sizeof(char), fileSize, fileStream) < fileSize)
+	{
+		log_error("Failed to write file \"%s\": %m", tempFileName);
+		fclose(fileStream);
+		return false;
+	}
+
+	if (fflush(fileStream) != 0 || fsync(fileno(fileStream)) != 0)
+	{
+		log_error("Failed to sync file \"%s\": %m", tempFileName);
+		fclose(fileStream);
+		return false;
+	}
+
+	if (fclose(fileStream) == EOF)
+	{
+		log_error("Failed to write file \"%s\"", tempFileName);
+		return false;
+	}
+
+	if (rename(tempFileName, filePath) != 0)
+	{
+		log_error("Failed to rename \"%s\" to \"%s\": %m",
+				  tempFileName, filePath);
+		return false;
+	}
+
+	return true;
+}
+
+
 /*
  * append_to_file writes the given data to the end of the file given by
  * filePath using our logging library to report errors. If succesful, the
@@ -284,6 +351,122 @@ read_file(const char *filePath, char **contents, long *fileSize)
 }
 
 
+/*
+ * read_file_tail reads at most the last maxBytes bytes, and the last maxLines
+ * lines, of a file. We read the file backwards by blocks with pread(), so that
+ * the cost only depends on the tail that we want, which matters for log files
+ * that may have grown very large, such as after a crash loop.
+ *
+ * The tail starts at the beginning of a line: when maxBytes cuts a line in
+ * two, its first part is skipped. The truncated flag is set when the tail is
+ * not the whole file. As with read_file, contents is a NUL-terminated buffer
+ * of fileSize bytes that should be freed by the caller.
+ */
+bool
+read_file_tail(const char *filePath, long maxBytes, int maxLines,
+			   char **contents, long *fileSize, bool *truncated)
+{
+	struct stat fileStat;
+
+	int fd = open(filePath, O_RDONLY);
+
+	if (fd < 0)
+	{
+		log_error("Failed to open file \"%s\": %m", filePath);
+		return false;
+	}
+
+	if (fstat(fd, &fileStat) != 0)
+	{
+		log_error("Failed to get file information for \"%s\": %m", filePath);
+		close(fd);
+		return false;
+	}
+
+	off_t size = fileStat.st_size;
+	long capacity = size < maxBytes ? (long) size : maxBytes;
+
+	char *data = malloc(capacity + 1);
+
+	if (data == NULL)
+	{
+		log_error("Failed to allocate %ld bytes", capacity);
+		log_error(ALLOCATION_FAILED_ERROR);
+		close(fd);
+		return false;
+	}
+
+	/* data is filled from its end, where the end of the file goes */
+	off_t offset = size;
+	long start = capacity;
+	int newLines = 0;
+	bool foundStart = false;
+
+	while (start > 0 && !foundStart)
+	{
+		long blockSize = start < BUFSIZE ? start : BUFSIZE;
+
+		start -= blockSize;
+		offset -= blockSize;
+
+		if (pread(fd, data + start, blockSize, offset) != blockSize)
+		{
+			log_error("Failed to read file \"%s\": %m", filePath);
+			close(fd);
+			free(data);
+			return false;
+		}
+
+		/* count the newlines, skipping the one that ends the last line */
+		for (long i = start + blockSize - 1; i >= start; i--)
+		{
+			if (data[i] == '\n' && i < (capacity - 1) && ++newLines >= maxLines)
+			{
+				start = i + 1;
+				foundStart = true;
+				break;
+			}
+		}
+	}
+
+	/*
+	 * When maxBytes cut a line in two, skip its first part. The tail begins
+	 * with a whole line when the byte before it is a newline.
+	 */
+	if (!foundStart && offset > 0)
+	{
+		char previous = '\0';
+
+		if (pread(fd, &previous, 1, offset - 1) != 1)
+		{
+			log_error("Failed to read file \"%s\": %m", filePath);
+			close(fd);
+			free(data);
+			return false;
+		}
+
+		if (previous != '\n')
+		{
+			char *newLine = memchr(data, '\n', capacity);
+
+			start = newLine == NULL ? capacity : (newLine - data) + 1;
+		}
+	}
+
+	close(fd);
+
+	*fileSize = capacity - start;
+	*truncated = offset > 0 || start > 0;
+
+	memmove(data, data + start, *fileSize);
+	data[*fileSize] = '\0';
+
+	*contents = data;
+
+	return true;
+}
+
+
 /*
  * read_file_internal is shared by both read_file and read_file_if_exists
  * functions.
@@ -13,11 +13,13 @@
  */
 
 #include <inttypes.h>
+#include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "defaults.h"
 #include "keeper.h"
+#include "keeper_metrics.h"
 #include "pgctl.h"
 #include "fsm.h"
 #include "log.h"
@@ -243,6 +245,10 @@ KeeperFSMTransition KeeperFSM[] = {
 	/*
 	 * failover occurred, primary -> draining/demoted
 	 */
+	{ PRIMARY_STATE, DRAINING_STATE, NODE_KIND_CITUS_WORKER,
+	  COMMENT_PRIMARY_TO_DRAINING,
+	  &fsm_citus_worker_drain },
+
 	{ PRIMARY_STATE, DRAINING_STATE, NODE_KIND_ANY,
 	  COMMENT_PRIMARY_TO_DRAINING,
 	  &fsm_stop_postgres },
@@ -259,6 +265,10 @@ KeeperFSMTransition KeeperFSM[] = {
 	  COMMENT_PRIMARY_TO_DEMOTED,
 	  &fsm_stop_postgres },
 
+	{ JOIN_PRIMARY_STATE, DRAINING_STATE, NODE_KIND_CITUS_WORKER,
+	  COMMENT_PRIMARY_TO_DRAINING,
+	  &fsm_citus_worker_drain },
+
 	{ JOIN_PRIMARY_STATE, DRAINING_STATE, NODE_KIND_ANY,
 	  COMMENT_PRIMARY_TO_DRAINING,
 	  &fsm_stop_postgres },
@@ -271,6 +281,10 @@ KeeperFSMTransition KeeperFSM[] = {
 	  COMMENT_PRIMARY_TO_DEMOTED,
 	  &fsm_stop_postgres },
 
+	{ APPLY_SETTINGS_STATE, DRAINING_STATE, NODE_KIND_CITUS_WORKER,
+	  COMMENT_PRIMARY_TO_DRAINING,
+	  &fsm_citus_worker_drain },
+
 	{ APPLY_SETTINGS_STATE, DRAINING_STATE, NODE_KIND_ANY,
 	  COMMENT_PRIMARY_TO_DRAINING,
 	  &fsm_stop_postgres },
@@ -690,6 +704,354 @@ KeeperFSMTransition KeeperFSM[] = {
 };
 
 
+/*
+ * Looking up a transition used to be a linear scan of the KeeperFSM array. We
+ * now index the array by (current, assigned) state. Within each cell we keep
+ * the array order, so the first match still wins and kind-specific entries
+ * still take precedence over NODE_KIND_ANY ones.
+ *
+ * C99 has no way to expand the ANY_STATE wildcards at compile time, so the
+ * index is built from the KeeperFSM array once per process, at first use.
+ */
+#define KEEPER_FSM_MAX_CELL_ENTRIES 8
+#define KEEPER_FSM_MAX_STATE_ENTRIES 32
+
+/* the Postgres instance kinds a transition can be selected for */
+#define NODE_KIND_ALL (NODE_KIND_STANDALONE | NODE_KIND_CITUS_ANY)
+
+typedef struct KeeperFSMIndexCell
+{
+	int count;
+	int entries[KEEPER_FSM_MAX_CELL_ENTRIES];
+} KeeperFSMIndexCell;
+
+typedef struct KeeperFSMIndex
+{
+	bool built;
+	bool valid;
+	int transitionsCount;
+
+	/* transitions from current state to assigned state */
+	KeeperFSMIndexCell cells[NODE_STATE_COUNT][NODE_STATE_COUNT];
+
+	/* transitions from current state, used by print_reachable_states */
+	int fromCount[NODE_STATE_COUNT];
+	int from[NODE_STATE_COUNT][KEEPER_FSM_MAX_STATE_ENTRIES];
+} KeeperFSMIndex;
+
+static KeeperFSMIndex FSMIndex = { 0 };
+
+static bool keeper_fsm_build_index(void);
+static bool keeper_fsm_index_transition(int transitionIndex);
+
+
+/*
+ * keeper_fsm_build_index builds the FSMIndex from the KeeperFSM array, unless
+ * that's been done already. When the index can't be built we return false,
+ * and callers fall back to scanning the KeeperFSM array.
+ */
+static bool
+keeper_fsm_build_index()
+{
+	if (FSMIndex.built)
+	{
+		return FSMIndex.valid;
+	}
+
+	FSMIndex.built = true;
+	FSMIndex.valid = true;
+
+	for (int i = 0; KeeperFSM[i].current != NO_STATE; i++)
+	{
+		++FSMIndex.transitionsCount;
+
+		if (!keeper_fsm_index_transition(i))
+		{
+			/* keep going to report every problem in the table */
+			FSMIndex.valid = false;
+		}
+	}
+
+	return FSMIndex.valid;
+}
+
+
+/*
+ * keeper_fsm_index_transition adds the given KeeperFSM entry to each cell of
+ * the index it matches.
+ */
+static bool
+keeper_fsm_index_transition(int transitionIndex)
+{
+	KeeperFSMTransition *transition = &(KeeperFSM[transitionIndex]);
+
+	if ((transition->current != ANY_STATE &&
+		 transition->current >= NODE_STATE_COUNT) ||
+		(transition->assigned != ANY_STATE &&
+		 transition->assigned >= NODE_STATE_COUNT))
+	{
+		log_error("FSM transition %d from \"%s\" to \"%s\" "
+				  "uses an unknown state",
+				  transitionIndex,
+				  NodeStateToString(transition->current),
+				  NodeStateToString(transition->assigned));
+		return false;
+	}
+
+	for (int current = NO_STATE; current < NODE_STATE_COUNT; current++)
+	{
+		if (!state_matches(transition->current, current))
+		{
+			continue;
+		}
+
+		if (FSMIndex.fromCount[current] >= KEEPER_FSM_MAX_STATE_ENTRIES)
+		{
+			log_error("FSM has more than %d transitions from state \"%s\"",
+					  KEEPER_FSM_MAX_STATE_ENTRIES,
+					  NodeStateToString(current));
+			return false;
+		}
+
+		FSMIndex.from[current][FSMIndex.fromCount[current]++] = transitionIndex;
+
+		for (int assigned = NO_STATE; assigned < NODE_STATE_COUNT; assigned++)
+		{
+			KeeperFSMIndexCell *cell = &(FSMIndex.cells[current][assigned]);
+
+			if (!state_matches(transition->assigned, assigned))
+			{
+				continue;
+			}
+
+			if (cell->count >= KEEPER_FSM_MAX_CELL_ENTRIES)
+			{
+				log_error("FSM has more than %d transitions "
+						  "from state \"%s\" to state \"%s\"",
+						  KEEPER_FSM_MAX_CELL_ENTRIES,
+						  NodeStateToString(current),
+						  NodeStateToString(assigned));
+				return false;
+			}
+
+			cell->entries[cell->count++] = transitionIndex;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * keeper_fsm_scan_transition is the linear scan of the KeeperFSM array, used
+ * when the index is not available or the given states are out of its range,
+ * and by "pg_autoctl do bench fsm".
+ */
+KeeperFSMTransition *
+keeper_fsm_scan_transition(NodeState current,
+						   NodeState assigned,
+						   PgInstanceKind pgKind)
+{
+	for (int i = 0; KeeperFSM[i].current != NO_STATE; i++)
+	{
+		KeeperFSMTransition *transition = &(KeeperFSM[i]);
+
+		if (state_matches(transition->current, current) &&
+			state_matches(transition->assigned, assigned) &&
+			pgKind_matches(transition->pgKind, pgKind))
+		{
+			return transition;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * keeper_fsm_find_transition returns the KeeperFSM entry to use to reach the
+ * assigned state from the current state for the given kind of Postgres
+ * instance, or NULL when the FSM doesn't know how to do that.
+ */
+KeeperFSMTransition *
+keeper_fsm_find_transition(NodeState current,
+						   NodeState assigned,
+						   PgInstanceKind pgKind)
+{
+	if (!keeper_fsm_build_index() ||
+		current >= NODE_STATE_COUNT ||
+		assigned >= NODE_STATE_COUNT)
+	{
+		return keeper_fsm_scan_transition(current, assigned, pgKind);
+	}
+
+	KeeperFSMIndexCell *cell = &(FSMIndex.cells[current][assigned]);
+
+	for (int i = 0; i < cell->count; i++)
+	{
+		KeeperFSMTransition *transition = &(KeeperFSM[cell->entries[i]]);
+
+		if (pgKind_matches(transition->pgKind, pgKind))
+		{
+			return transition;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * keeper_fsm_transitions_count returns how many transitions the KeeperFSM
+ * array contains.
+ */
+int
+keeper_fsm_transitions_count()
+{
+	int count = 0;
+
+	while (KeeperFSM[count].current != NO_STATE)
+	{
+		++count;
+	}
+
+	return count;
+}
+
+
+/*
+ * keeper_fsm_check validates the KeeperFSM array. It's run at build time with
+ * "pg_autoctl do fsm check", and reports the following problems:
+ *
+ *  - the index can't be built (unknown states, too many transitions),
+ *  - entries that are never selected because earlier entries for the same
+ *    states already cover every kind of Postgres instance they apply to,
+ *  - states that can't be reached from the init state,
+ *  - state names that NodeStateFromString can't parse back.
+ */
+bool
+keeper_fsm_check()
+{
+	bool success = true;
+
+	if (!keeper_fsm_build_index())
+	{
+		log_error("Failed to build the FSM transitions index, see above");
+		return false;
+	}
+
+	/*
+	 * Duplicate or shadowed transitions: walk each cell in the array order and
+	 * track the instance kinds that earlier entries already match.
+	 */
+	bool *selectable = calloc(FSMIndex.transitionsCount + 1, sizeof(bool));
+
+	if (selectable == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return false;
+	}
+
+	for (int current = NO_STATE; current < NODE_STATE_COUNT; current++)
+	{
+		for (int assigned = NO_STATE; assigned < NODE_STATE_COUNT; assigned++)
+		{
+			KeeperFSMIndexCell *cell = &(FSMIndex.cells[current][assigned]);
+			int coveredKinds = 0;
+
+			for (int i = 0; i < cell->count; i++)
+			{
+				KeeperFSMTransition *transition = &(KeeperFSM[cell->entries[i]]);
+
+				if ((transition->pgKind & NODE_KIND_ALL & ~coveredKinds) != 0)
+				{
+					selectable[cell->entries[i]] = true;
+				}
+
+				coveredKinds |= transition->pgKind;
+			}
+		}
+	}
+
+	for (int i = 0; i < FSMIndex.transitionsCount; i++)
+	{
+		if (!selectable[i])
+		{
+			log_error("FSM transition %d from \"%s\" to \"%s\" is never used: "
+					  "earlier transitions match the same states",
+					  i,
+					  NodeStateToString(KeeperFSM[i].current),
+					  NodeStateToString(KeeperFSM[i].assigned));
+			success = false;
+		}
+	}
+
+	free(selectable);
+
+	/* now check that every state can be reached from the init state */
+	bool reachable[NODE_STATE_COUNT] = { 0 };
+	NodeState queue[NODE_STATE_COUNT] = { 0 };
+	int queueHead = 0;
+	int queueTail = 0;
+
+	reachable[INIT_STATE] = true;
+	queue[queueTail++] = INIT_STATE;
+
+	while (queueHead < queueTail)
+	{
+		NodeState current = queue[queueHead++];
+
+		for (int assigned = NO_STATE; assigned < NODE_STATE_COUNT; assigned++)
+		{
+			if (FSMIndex.cells[current][assigned].count > 0 &&
+				!reachable[assigned])
+			{
+				reachable[assigned] = true;
+				queue[queueTail++] = (NodeState) assigned;
+			}
+		}
+	}
+
+	for (int state = INIT_STATE; state < NODE_STATE_COUNT; state++)
+	{
+		if (!reachable[state])
+		{
+			log_error("FSM state \"%s\" can not be reached from state \"%s\"",
+					  NodeStateToString((NodeState) state),
+					  NodeStateToString(INIT_STATE));
+			success = false;
+		}
+	}
+
+	/* finally check that we can parse back all our state names */
+	if (!NodeStateHashIsPerfect())
+	{
+		log_warn("State names hash with collisions, "
+				 "see NODE_STATE_HASH_SEED in src/bin/pg_autoctl/state.c");
+	}
+
+	for (int state = NO_STATE; state < NODE_STATE_COUNT; state++)
+	{
+		const char *name = NodeStateToString((NodeState) state);
+
+		if (NodeStateFromString(name) != (NodeState) state)
+		{
+			log_error("Failed to parse back state name \"%s\"", name);
+			success = false;
+		}
+	}
+
+	if (success)
+	{
+		log_info("FSM check: %d transitions between %d states are valid",
+				 FSMIndex.transitionsCount,
+				 NODE_STATE_COUNT);
+	}
+
+	return success;
+}
+
+
 /*
  * keeper_fsm_step implements the logic to perform a single step
  * of the state machine according to the goal state returned by
@@ -730,7 +1092,9 @@ keeper_fsm_step(Keeper *keeper)
 							 postgres->pgIsRunning,
 							 postgres->postgresSetup.control.timeline_id,
 							 postgres->currentLSN,
+							 postgres->replayLSN,
 							 postgres->pgsrSyncState,
+							 NULL,
 							 &assignedState))
 	{
 		log_fatal("Failed to get the goal state from the monitor, "
@@ -743,6 +1107,7 @@ keeper_fsm_step(Keeper *keeper)
 	 * (and should) always get the assigned state from the monitor.
 	 */
 	keeperState->assigned_role = assignedState.state;
+	keeper->goalTraceId = assignedState.traceId;
 
 	/* roll the state machine forward */
 	if (keeperState->assigned_role != keeperState->current_role)
@@ -788,9 +1153,7 @@ keeper_fsm_step(Keeper *keeper)
 bool
 keeper_fsm_reach_assigned_state(Keeper *keeper)
 {
-	int transitionIndex = 0;
 	KeeperStateData *keeperState = &(keeper->state);
-	KeeperFSMTransition transition = KeeperFSM[0];
 
 	if (keeperState->current_role == keeperState->assigned_role)
 	{
@@ -800,81 +1163,133 @@ keeper_fsm_reach_assigned_state(Keeper *keeper)
 		return true;
 	}
 
-	while (transition.current != NO_STATE)
+	KeeperFSMTransition *found =
+		keeper_fsm_find_transition(keeperState->current_role,
+								   keeperState->assigned_role,
+								   keeper->config.pgSetup.pgKind);
+
+	if (found == NULL)
 	{
-		if (state_matches(transition.current, keeperState->current_role) &&
-			state_matches(transition.assigned, keeperState->assigned_role) &&
-			pgKind_matches(transition.pgKind, keeper->config.pgSetup.pgKind))
-		{
-			bool ret = false;
+		log_fatal("pg_autoctl does not know how to reach state \"%s\" from \"%s\"",
+				  NodeStateToString(keeperState->assigned_role),
+				  NodeStateToString(keeperState->current_role));
 
-			/* avoid logging "#any state#" to the user */
-			if (transition.current != ANY_STATE)
-			{
-				log_info("FSM transition from \"%s\" to \"%s\"%s%s",
-						 NodeStateToString(transition.current),
-						 NodeStateToString(transition.assigned),
-						 transition.comment ? ": " : "",
-						 transition.comment ? transition.comment : "");
-			}
-			else
-			{
-				log_info("FSM transition to \"%s\"%s%s",
-						 NodeStateToString(transition.assigned),
-						 transition.comment ? ": " : "",
-						 transition.comment ? transition.comment : "");
-			}
+		return false;
+	}
 
-			if (transition.transitionFunction)
-			{
-				ret = (*transition.transitionFunction)(keeper);
+	KeeperFSMTransition transition = *found;
+	bool ret = false;
 
-				log_debug("Transition function returned: %s",
-						  ret ? "true" : "false");
-			}
-			else
-			{
-				ret = true;
-				log_debug("No transition function, assigning new state");
-			}
+	NodeState currentRole = keeperState->current_role;
+	NodeState assignedRole = keeperState->assigned_role;
 
-			if (ret)
-			{
-				keeperState->current_role = keeperState->assigned_role;
+	instr_time startTime;
+	uint64_t startEpoch = time(NULL);
 
-				log_info("Transition complete: current state is now \"%s\"",
-						 NodeStateToString(keeperState->current_role));
-			}
-			else
-			{
-				/* avoid logging "#any state#" to the user */
-				if (transition.current != ANY_STATE)
-				{
-					log_error("Failed to transition from state \"%s\" "
-							  "to state \"%s\", see above.",
-							  NodeStateToString(transition.current),
-							  NodeStateToString(transition.assigned));
-				}
-				else
-				{
-					log_error("Failed to transition to state \"%s\", see above.",
-							  NodeStateToString(transition.assigned));
-				}
-			}
+	INSTR_TIME_SET_CURRENT(startTime);
 
-			return ret;
-		}
-		transition = KeeperFSM[++transitionIndex];
+	/* structured fields for the JSON log format */
+	const char *fields[] = {
+		"current_state", NodeStateToString(currentRole),
+		"assigned_state", NodeStateToString(assignedRole),
+		NULL
+	};
+
+	/* avoid logging "#any state#" to the user */
+	if (transition.current != ANY_STATE)
+	{
+		log_event(LOG_INFO, "fsm.transition.start", -1, fields,
+				  "FSM transition from \"%s\" to \"%s\"%s%s",
+				  NodeStateToString(transition.current),
+				  NodeStateToString(transition.assigned),
+				  transition.comment ? ": " : "",
+				  transition.comment ? transition.comment : "");
+	}
+	else
+	{
+		log_event(LOG_INFO, "fsm.transition.start", -1, fields,
+				  "FSM transition to \"%s\"%s%s",
+				  NodeStateToString(transition.assigned),
+				  transition.comment ? ": " : "",
+				  transition.comment ? transition.comment : "");
 	}
 
-	/*
-	 * we didn't find a transition
-	 */
-	log_fatal("pg_autoctl does not know how to reach state \"%s\" from \"%s\"",
-			  NodeStateToString(keeperState->assigned_role),
-			  NodeStateToString(keeperState->current_role));
+	if (transition.transitionFunction)
+	{
+		ret = (*transition.transitionFunction)(keeper);
+
+		log_debug("Transition function returned: %s",
+				  ret ? "true" : "false");
+	}
+	else
+	{
+		ret = true;
+		log_debug("No transition function, assigning new state");
+	}
+
+	instr_time duration;
 
-	return false;
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	long long durationUs = (long long) INSTR_TIME_GET_MICROSEC(duration);
+
+	if (ret)
+	{
+		keeperState->current_role = keeperState->assigned_role;
+
+		/* transitions setup replication from the primary again */
+		keeper->upstreamVersionKnown = false;
+
+		/* a new primary creates or upgrades the LSN token functions */
+		keeper->lsnTokenFunctionsReady = false;
+
+		log_event(LOG_INFO, "fsm.transition.finish", durationUs, fields,
+				  "Transition complete: current state is now \"%s\"",
+				  NodeStateToString(keeperState->current_role));
+	}
+	else
+	{
+		/* avoid logging "#any state#" to the user */
+		if (transition.current != ANY_STATE)
+		{
+			log_event(LOG_ERROR, "fsm.transition.failed",
+					  durationUs, fields,
+					  "Failed to transition from state \"%s\" "
+					  "to state \"%s\", see above.",
+					  NodeStateToString(transition.current),
+					  NodeStateToString(transition.assigned));
+		}
+		else
+		{
+			log_event(LOG_ERROR, "fsm.transition.failed",
+					  durationUs, fields,
+					  "Failed to transition to state \"%s\", "
+					  "see above.",
+					  NodeStateToString(transition.assigned));
+		}
+	}
+
+	/* keep track of the transition in our on-disk history */
+	KeeperTransition history = { 0 };
+	bool recorded =
+		keeper_transition_history_record(keeper->config.pathnames.transitions,
+										 currentRole,
+										 assignedRole,
+										 startEpoch,
+										 (uint64_t) (durationUs / 1000),
+										 ret,
+										 keeper->goalTraceId,
+										 &history);
+
+	(void) keeper_metrics_record_transition(currentRole, assignedRole,
+											startTime, ret,
+											recorded ? &history : NULL);
+
+	/* once the assigned state is reached, we're done with its trace id */
+	(void) keeper_update_trace_id(keeper);
+
+	return ret;
 }
 
 
@@ -885,34 +1300,37 @@ keeper_fsm_reach_assigned_state(Keeper *keeper)
 void
 print_reachable_states(KeeperStateData *keeperState)
 {
-	int transitionIndex = 0;
 	bool header = false;
-	KeeperFSMTransition transition = KeeperFSM[0];
+	NodeState currentRole = keeperState->current_role;
 
-	log_debug("print_reachable_states: %s",
-			  NodeStateToString(keeperState->current_role));
+	log_debug("print_reachable_states: %s", NodeStateToString(currentRole));
 
-	while (transition.current != NO_STATE)
+	if (!keeper_fsm_build_index() || currentRole >= NODE_STATE_COUNT)
 	{
-		if (state_matches(transition.current, keeperState->current_role))
+		log_error("Failed to list reachable states from state \"%s\"",
+				  NodeStateToString(currentRole));
+		return;
+	}
+
+	for (int i = 0; i < FSMIndex.fromCount[currentRole]; i++)
+	{
+		KeeperFSMTransition transition = KeeperFSM[FSMIndex.from[currentRole][i]];
+
+		if (!header)
 		{
-			if (!header)
-			{
-				fformat(stdout, "%20s | %20s | %s\n",
-						"Current", "Reachable", "Comment");
-				fformat(stdout, "%20s-+-%20s-+-%s\n",
-						"--------------------",
-						"--------------------",
-						"--------------------");
-				header = true;
-			}
-			fformat(stdout,
-					"%20s | %20s | %s\n",
-					NodeStateToString(transition.current),
-					NodeStateToString(transition.assigned),
-					transition.comment);
+			fformat(stdout, "%20s | %20s | %s\n",
+					"Current", "Reachable", "Comment");
+			fformat(stdout, "%20s-+-%20s-+-%s\n",
+					"--------------------",
+					"--------------------",
+					"--------------------");
+			header = true;
 		}
-		transition = KeeperFSM[++transitionIndex];
+		fformat(stdout,
+				"%20s | %20s | %s\n",
+				NodeStateToString(transition.current),
+				NodeStateToString(transition.assigned),
+				transition.comment);
 	}
 }
 
@@ -86,6 +86,7 @@ bool fsm_citus_worker_promote_standby(Keeper *keeper);
 bool fsm_citus_coordinator_master_update_itself(Keeper *keeper);
 bool fsm_citus_cleanup_and_resume_as_primary(Keeper *keeper);
 
+bool fsm_citus_worker_drain(Keeper *keeper);
 bool fsm_citus_worker_stop_replication(Keeper *keeper);
 bool fsm_citus_coordinator_promote_standby_to_primary(Keeper *keeper);
 bool fsm_citus_worker_promote_standby_to_primary(Keeper *keeper);
@@ -108,6 +109,14 @@ void print_reachable_states(KeeperStateData *keeperState);
 void print_fsm_for_graphviz(void);
 bool keeper_fsm_step(Keeper *keeper);
 bool keeper_fsm_reach_assigned_state(Keeper *keeper);
+KeeperFSMTransition * keeper_fsm_find_transition(NodeState current,
+												 NodeState assigned,
+												 PgInstanceKind pgKind);
+KeeperFSMTransition * keeper_fsm_scan_transition(NodeState current,
+												 NodeState assigned,
+												 PgInstanceKind pgKind);
+int keeper_fsm_transitions_count(void);
+bool keeper_fsm_check(void);
 
 
 #endif /* KEEPER_FSM_H */
@@ -33,6 +33,7 @@
 #include "pgctl.h"
 #include "fsm.h"
 #include "keeper.h"
+#include "keeper_metrics.h"
 #include "keeper_pg_init.h"
 #include "log.h"
 #include "monitor.h"
@@ -258,13 +259,16 @@ fsm_init_primary(Keeper *keeper)
 	 */
 	if (!config->monitorDisabled)
 	{
-		char monitorHostname[_POSIX_HOST_NAME_MAX];
-		int monitorPort = 0;
-		int connlimit = 1;
+		URIHostArray monitorHosts = { 0 };
 
-		if (!hostname_from_uri(config->monitor_pguri,
-							   monitorHostname, _POSIX_HOST_NAME_MAX,
-							   &monitorPort))
+		/*
+		 * The health check user has no connection limit: with keep-alive
+		 * health checks the monitor holds a connection to the node, and
+		 * probing a node again or from a standby monitor needs another one.
+		 */
+		int connlimit = -1;
+
+		if (!hostnames_from_uri(config->monitor_pguri, &monitorHosts))
 		{
 			/* developer error, this should never happen */
 			log_fatal("BUG: monitor_pguri should be validated before calling "
@@ -274,7 +278,9 @@ fsm_init_primary(Keeper *keeper)
 
 		/*
 		 * We need to add the monitor host:port in the HBA settings for the
-		 * node to enable the health checks.
+		 * node to enable the health checks. When the monitor URI lists a
+		 * primary monitor and its standby monitors, each of them runs the
+		 * health checks once promoted, so we add a rule for every host.
 		 *
 		 * Node that we forcibly use the authentication method "trust" for the
 		 * pgautofailover_monitor user, which from the monitor also uses the
@@ -282,19 +288,23 @@ fsm_init_primary(Keeper *keeper)
 		 * leaking information from the passfile, environment variable, or
 		 * other places.
 		 */
-		if (!primary_create_user_with_hba(postgres,
-										  PG_AUTOCTL_HEALTH_USERNAME,
-										  PG_AUTOCTL_HEALTH_PASSWORD,
-										  monitorHostname,
-										  "trust",
-										  pgSetup->hbaLevel,
-										  connlimit))
+		for (int i = 0; i < monitorHosts.count; i++)
 		{
-			log_error(
-				"Failed to initialise postgres as primary because "
-				"creating the database user that the pg_auto_failover monitor "
-				"uses for health checks failed, see above for details");
-			return false;
+			if (!primary_create_user_with_hba(postgres,
+											  PG_AUTOCTL_HEALTH_USERNAME,
+											  PG_AUTOCTL_HEALTH_PASSWORD,
+											  monitorHosts.hosts[i],
+											  "trust",
+											  pgSetup->hbaLevel,
+											  connlimit))
+			{
+				log_error(
+					"Failed to initialise postgres as primary because "
+					"creating the database user that the pg_auto_failover "
+					"monitor uses for health checks failed, "
+					"see above for details");
+				return false;
+			}
 		}
 	}
 
@@ -588,6 +598,7 @@ fsm_enable_sync_rep(Keeper *keeper)
 										 &pgSetup->is_in_recovery,
 										 postgres->pgsrSyncState,
 										 postgres->currentLSN,
+										 postgres->replayLSN,
 										 &(postgres->postgresSetup.control)))
 		{
 			log_error("Failed to update the local Postgres metadata");
@@ -645,18 +656,68 @@ fsm_apply_settings(Keeper *keeper)
 	/* get synchronous_standby_names value from the monitor */
 	if (!config->monitorDisabled)
 	{
-		if (!monitor_synchronous_standby_names(
-				monitor,
-				config->formation,
-				keeper->state.current_group,
-				postgres->synchronousStandbyNames,
-				sizeof(postgres->synchronousStandbyNames)))
+		char previousNames[BUFSIZE] = { 0 };
+
+		strlcpy(previousNames, postgres->synchronousStandbyNames, BUFSIZE);
+
+		/* the node_active call that assigned apply_settings returned it */
+		if (keeper->groupSettings.hasSynchronousStandbyNames)
+		{
+			strlcpy(postgres->synchronousStandbyNames,
+					keeper->groupSettings.synchronousStandbyNames,
+					sizeof(postgres->synchronousStandbyNames));
+			keeper->groupSettings.hasSynchronousStandbyNames = false;
+		}
+		else if (!monitor_synchronous_standby_names(
+					 monitor,
+					 config->formation,
+					 keeper->state.current_group,
+					 postgres->synchronousStandbyNames,
+					 sizeof(postgres->synchronousStandbyNames)))
 		{
 			log_error("Failed to enable synchronous replication because "
 					  "we failed to get the synchronous_standby_names value "
 					  "from the monitor, see above for details");
 			return false;
 		}
+
+		/*
+		 * Standby nodes joining together, or a few settings changed in a
+		 * row, bring several changes of the value in a short time: wait
+		 * until the value settles, and then apply only the last one.
+		 */
+		for (int round = 0;
+			 round < APPLY_SETTINGS_SETTLE_MAX_ROUNDS &&
+			 !streq(previousNames, postgres->synchronousStandbyNames);
+			 round++)
+		{
+			char settledNames[BUFSIZE] = { 0 };
+
+			pg_usleep(APPLY_SETTINGS_SETTLE_TIME_MS * 1000);
+
+			if (!monitor_synchronous_standby_names(
+					monitor,
+					config->formation,
+					keeper->state.current_group,
+					settledNames,
+					sizeof(settledNames)))
+			{
+				/* apply the value we have already, we'll be back */
+				break;
+			}
+
+			if (streq(settledNames, postgres->synchronousStandbyNames))
+			{
+				break;
+			}
+
+			log_info("synchronous_standby_names changed to '%s' "
+					 "on the monitor, waiting until it settles",
+					 settledNames);
+
+			strlcpy(postgres->synchronousStandbyNames, settledNames,
+					sizeof(postgres->synchronousStandbyNames));
+		}
 	}
 	else
 	{
@@ -665,7 +726,37 @@ fsm_apply_settings(Keeper *keeper)
 				sizeof(postgres->synchronousStandbyNames));
 	}
 
-	return primary_set_synchronous_standby_names(postgres);
+	/*
+	 * When we applied the same value already and the settings files have not
+	 * changed since, Postgres uses that value: skip the round trips.
+	 */
+	if (keeper->appliedSynchronousStandbyNamesKnown &&
+		streq(keeper->appliedSynchronousStandbyNames,
+			  postgres->synchronousStandbyNames) &&
+		keeper_settings_unchanged(keeper))
+	{
+		log_info("synchronous_standby_names is already set to '%s'",
+				 postgres->synchronousStandbyNames);
+
+		(void) keeper_metrics_record_settings(false);
+		return true;
+	}
+
+	if (!primary_set_synchronous_standby_names(postgres))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	strlcpy(keeper->appliedSynchronousStandbyNames,
+			postgres->synchronousStandbyNames,
+			sizeof(keeper->appliedSynchronousStandbyNames));
+	keeper->appliedSynchronousStandbyNamesKnown = true;
+
+	(void) keeper_settings_applied(keeper);
+	(void) keeper_metrics_record_settings(true);
+
+	return true;
 }
 
 
@@ -916,9 +1007,13 @@ fsm_init_standby(Keeper *keeper)
 {
 	KeeperConfig *config = &(keeper->config);
 	LocalPostgresServer *postgres = &(keeper->postgres);
+	PostgresSetup *pgSetup = &(postgres->postgresSetup);
 
 	NodeAddress *primaryNode = NULL;
 
+	NodeAddress primary = { 0 };
+	NodeAddress cloneNode = { 0 };
+	bool cloneFromSecondary = false;
 
 	/* get the primary node to follow */
 	if (!keeper_get_primary(keeper, &(postgres->replicationSource.primaryNode)))
@@ -928,6 +1023,82 @@ fsm_init_standby(Keeper *keeper)
 		return false;
 	}
 
+	/* we might want to pg_basebackup from a secondary node instead */
+	primary = postgres->replicationSource.primaryNode;
+
+	if (!keeper_get_clone_source(keeper, &primary,
+								 &cloneNode, &cloneFromSecondary))
+	{
+		log_warn("Failed to select a secondary node to clone from, "
+				 "using the primary node instead");
+		cloneFromSecondary = false;
+	}
+
+	if (cloneFromSecondary)
+	{
+		log_info("Cloning from secondary node " NODE_FORMAT
+				 " rather than from the primary node",
+				 cloneNode.nodeId,
+				 cloneNode.name,
+				 cloneNode.host,
+				 cloneNode.port);
+
+		/* secondary nodes do not maintain a replication slot for us */
+		if (!standby_init_replication_source(postgres,
+											 &cloneNode,
+											 PG_AUTOCTL_REPLICA_USERNAME,
+											 config->replication_password,
+											 "", /* no replication slot */
+											 config->maximum_backup_rate,
+											 config->backupDirectory,
+											 NULL, /* no targetLSN */
+											 config->pgSetup.ssl,
+											 keeper->state.current_node_id))
+		{
+			/* can't happen at the moment */
+			return false;
+		}
+
+		if (!fsm_init_standby_from_upstream(keeper))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+
+		/*
+		 * Now follow the primary node, using our replication slot there.
+		 * The primary creates our slot as soon as we are registered, with
+		 * its WAL reserved, so the WAL position where the base backup ends
+		 * is still available on the primary.
+		 */
+		if (!standby_init_replication_source(postgres,
+											 &primary,
+											 PG_AUTOCTL_REPLICA_USERNAME,
+											 config->replication_password,
+											 config->replication_slot_name,
+											 config->maximum_backup_rate,
+											 config->backupDirectory,
+											 NULL, /* no targetLSN */
+											 config->pgSetup.ssl,
+											 keeper->state.current_node_id))
+		{
+			/* can't happen at the moment */
+			return false;
+		}
+
+		if (!pg_setup_standby_mode(pgSetup->control.pg_control_version,
+								   pgSetup->pgdata,
+								   pgSetup->pg_ctl,
+								   &(postgres->replicationSource)))
+		{
+			log_error("Failed to setup Postgres to follow the primary node "
+					  "after cloning from a secondary node");
+			return false;
+		}
+
+		return true;
+	}
+
 	if (!standby_init_replication_source(postgres,
 										 primaryNode,
 										 PG_AUTOCTL_REPLICA_USERNAME,
@@ -1273,6 +1444,7 @@ fsm_report_lsn(Keeper *keeper)
 									 &pgSetup->is_in_recovery,
 									 postgres->pgsrSyncState,
 									 postgres->currentLSN,
+									 postgres->replayLSN,
 									 &(postgres->postgresSetup.control)))
 	{
 		log_error("Failed to update the local Postgres metadata");
@@ -1427,7 +1599,13 @@ fsm_follow_new_primary(Keeper *keeper)
 		return false;
 	}
 
-	if (!standby_follow_new_primary(postgres))
+	(void) keeper_drain_standby(keeper);
+
+	bool followed = standby_follow_new_primary(postgres);
+
+	(void) keeper_drain_standby_done(keeper);
+
+	if (!followed)
 	{
 		log_error("Failed to change standby setup to follow new primary "
 				  "node " NODE_FORMAT ", see above for details",
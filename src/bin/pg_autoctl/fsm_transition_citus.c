@@ -34,11 +34,13 @@
 #include "log.h"
 #include "monitor.h"
 #include "primary_standby.h"
+#include "signals.h"
 #include "state.h"
 
 #define PLACEHOLDER_FOR_COMMENT ""
 
 static bool ensure_hostname_is_current_on_coordinator(Keeper *keeper);
+static bool wait_for_writes_blocked_on_coordinator(Keeper *keeper);
 
 
 /*
@@ -641,6 +643,108 @@ fsm_citus_coordinator_master_update_itself(Keeper *keeper)
 }
 
 
+/*
+ * fsm_citus_worker_drain is used when the primary worker is asked to drain
+ * during a failover. The standby blocks the writes to our group on the
+ * coordinator when it prepares its promotion, and the monitor asks it to do
+ * so at the same time as it asks us to drain.
+ *
+ * If we stop Postgres right away, the distributed queries that the
+ * coordinator sends us in between fail, and the transactions in flight that
+ * master_update_node() waits for can't finish. So we keep serving them until
+ * the writes are blocked, and wait for the queries to be queued on the
+ * coordinator rather than error out. When the primary has failed, nothing is
+ * routed to us anyway, so we only wait for a bounded time.
+ */
+bool
+fsm_citus_worker_drain(Keeper *keeper)
+{
+	/* errors are not fatal to draining: we must stop Postgres anyway */
+	(void) wait_for_writes_blocked_on_coordinator(keeper);
+
+	return fsm_stop_postgres(keeper);
+}
+
+
+/*
+ * wait_for_writes_blocked_on_coordinator waits until the master_update_node()
+ * transaction of our group has been prepared on the coordinator, for as long
+ * as the coordinator waits for the transactions in flight before forcing the
+ * update, citus_master_update_node_lock_cooldown.
+ */
+static bool
+wait_for_writes_blocked_on_coordinator(Keeper *keeper)
+{
+	KeeperConfig *config = &(keeper->config);
+	Coordinator coordinator = { 0 };
+	char transactionName[PREPARED_TRANSACTION_NAMELEN] = { 0 };
+
+	if (!coordinator_init_from_monitor(&coordinator, keeper))
+	{
+		log_warn("Failed to connect to the coordinator to check that writes "
+				 "to group %d are blocked, draining now",
+				 keeper->state.current_group);
+		return false;
+	}
+
+	GetPreparedTransactionName(keeper->state.current_group, transactionName);
+
+	log_info("Waiting until the coordinator %s:%d blocks writes to group %d "
+			 "with prepared transaction \"%s\"",
+			 coordinator.node.host, coordinator.node.port,
+			 keeper->state.current_group,
+			 transactionName);
+
+	instr_time startTime;
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	bool writesBlocked = false;
+
+	while (!writesBlocked &&
+		   !(asked_to_stop || asked_to_stop_fast || asked_to_quit))
+	{
+		if (!coordinator_udpate_node_transaction_is_prepared(&coordinator,
+															 keeper,
+															 &writesBlocked))
+		{
+			/* errors have already been logged */
+			break;
+		}
+
+		if (writesBlocked)
+		{
+			break;
+		}
+
+		instr_time duration;
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, startTime);
+
+		if (INSTR_TIME_GET_MILLISEC(duration) >=
+			config->citus_master_update_node_lock_cooldown)
+		{
+			log_warn("The coordinator is not blocking writes to group %d "
+					 "after %dms, draining now",
+					 keeper->state.current_group,
+					 config->citus_master_update_node_lock_cooldown);
+			break;
+		}
+
+		pg_usleep(100 * 1000); /* 100 ms */
+	}
+
+	pgsql_finish(&(coordinator.pgsql));
+
+	if (writesBlocked)
+	{
+		log_info("Coordinator is now blocking writes to groupId %d, "
+				 "draining", keeper->state.current_group);
+	}
+
+	return writesBlocked;
+}
+
+
 /*
  * fsm_citus_worker_stop_replication is used to forcefully stop replication, in
  * case the primary is on the other side of a network split.
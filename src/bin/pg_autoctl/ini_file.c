@@ -539,9 +539,142 @@ ini_to_json(JSON_Object *jsRoot, IniOption *optionList)
 }
 
 
+/*
+ * ini_option_hash computes the FNV-1a hash of the "section.name" path of an
+ * option, given either as separate section and name strings, or as a path
+ * when name is NULL.
+ */
+static uint32_t
+ini_option_hash(const char *section, const char *name)
+{
+	uint32_t hash = 2166136261U;
+
+	for (const char *ptr = section; *ptr != '\0'; ptr++)
+	{
+		hash = (hash ^ (unsigned char) *ptr) * 16777619U;
+	}
+
+	if (name != NULL)
+	{
+		hash = (hash ^ (unsigned char) '.') * 16777619U;
+
+		for (const char *ptr = name; *ptr != '\0'; ptr++)
+		{
+			hash = (hash ^ (unsigned char) *ptr) * 16777619U;
+		}
+	}
+
+	return hash;
+}
+
+
+/*
+ * ini_option_matches_path returns true when the given option is the one
+ * at the given "section.name" path, without having to split the path.
+ */
+static bool
+ini_option_matches_path(IniOption *option, const char *path)
+{
+	size_t sectionLength = strlen(option->section);
+
+	return strncmp(option->section, path, sectionLength) == 0 &&
+		   path[sectionLength] == '.' &&
+		   streq(option->name, path + sectionLength + 1);
+}
+
+
+/*
+ * ini_build_option_index builds a hash table of the given optionList, so that
+ * looking up many options in the same list is done in constant time for each
+ * option rather than with a scan of the whole list.
+ */
+bool
+ini_build_option_index(IniOptionIndex *index, IniOption *optionList)
+{
+	memset(index, 0, sizeof(IniOptionIndex));
+
+	for (IniOption *option = optionList; option->type != INI_END_T; option++)
+	{
+		uint32_t hash = ini_option_hash(option->section, option->name);
+		int bucket = hash & (INI_OPTION_INDEX_SIZE - 1);
+
+		/* keep room so that lookups of missing keys always terminate */
+		if (index->count >= INI_OPTION_INDEX_SIZE / 2)
+		{
+			/* should never happen, or it's a development bug */
+			log_error("BUG: ini_build_option_index: more than %d options",
+					  INI_OPTION_INDEX_SIZE / 2);
+			return false;
+		}
+
+		while (index->buckets[bucket] != NULL)
+		{
+			bucket = (bucket + 1) & (INI_OPTION_INDEX_SIZE - 1);
+		}
+
+		index->buckets[bucket] = option;
+		++index->count;
+	}
+
+	return true;
+}
+
+
+/*
+ * ini_index_lookup_option finds an option in the index given its section name
+ * and option name.
+ */
+IniOption *
+ini_index_lookup_option(IniOptionIndex *index,
+						const char *section, const char *name)
+{
+	uint32_t hash = ini_option_hash(section, name);
+	int bucket = hash & (INI_OPTION_INDEX_SIZE - 1);
+
+	for (; index->buckets[bucket] != NULL;
+		 bucket = (bucket + 1) & (INI_OPTION_INDEX_SIZE - 1))
+	{
+		IniOption *option = index->buckets[bucket];
+
+		if (streq(option->section, section) && streq(option->name, name))
+		{
+			return option;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * ini_index_lookup_path finds an option in the index given its path, as in
+ * "section.name".
+ */
+IniOption *
+ini_index_lookup_path(IniOptionIndex *index, const char *path)
+{
+	uint32_t hash = ini_option_hash(path, NULL);
+	int bucket = hash & (INI_OPTION_INDEX_SIZE - 1);
+
+	for (; index->buckets[bucket] != NULL;
+		 bucket = (bucket + 1) & (INI_OPTION_INDEX_SIZE - 1))
+	{
+		IniOption *option = index->buckets[bucket];
+
+		if (ini_option_matches_path(option, path))
+		{
+			return option;
+		}
+	}
+
+	return NULL;
+}
+
+
 /*
  * lookup_ini_option implements an option lookup given a section name and an
- * option name.
+ * option name. For a single lookup a scan of the list is as fast as building
+ * an index first, see ini_build_option_index() for repeated lookups.
  */
 IniOption *
 lookup_ini_option(IniOption *optionList, const char *section, const char *name)
@@ -566,38 +699,23 @@ lookup_ini_option(IniOption *optionList, const char *section, const char *name)
 IniOption *
 lookup_ini_path_value(IniOption *optionList, const char *path)
 {
-	char *section_name, *option_name, *ptr;
-
-	/*
-	 * Split path into section/option.
-	 */
-	ptr = strchr(path, '.');
-
-	if (ptr == NULL)
+	if (strchr(path, '.') == NULL)
 	{
 		log_error("Failed to find a dot separator in option path \"%s\"", path);
 		return NULL;
 	}
 
-	section_name = strdup(path);                   /* don't scribble on path */
-	if (section_name == NULL)
+	for (IniOption *option = optionList; option->type != INI_END_T; option++)
 	{
-		log_error(ALLOCATION_FAILED_ERROR);
-		return NULL;
-	}
-	option_name = section_name + (ptr - path) + 1; /* apply same offset */
-	*(option_name - 1) = '\0';                     /* split string at the dot */
-
-	IniOption *option = lookup_ini_option(optionList, section_name, option_name);
-
-	if (option == NULL)
-	{
-		log_error("Failed to find configuration option for path \"%s\"", path);
+		if (ini_option_matches_path(option, path))
+		{
+			return option;
+		}
 	}
 
-	free(section_name);
+	log_error("Failed to find configuration option for path \"%s\"", path);
 
-	return option;
+	return NULL;
 }
 
 
@@ -609,11 +727,18 @@ bool
 ini_merge(IniOption *dstOptionList, IniOption *overrideOptionList)
 {
 	IniOption *option;
+	IniOptionIndex dstIndex = { 0 };
+
+	if (!ini_build_option_index(&dstIndex, dstOptionList))
+	{
+		/* errors have already been logged */
+		return false;
+	}
 
 	for (option = overrideOptionList; option->type != INI_END_T; option++)
 	{
 		IniOption *dstOption =
-			lookup_ini_option(dstOptionList, option->section, option->name);
+			ini_index_lookup_option(&dstIndex, option->section, option->name);
 
 		if (dstOption == NULL)
 		{
@@ -92,6 +92,23 @@ typedef struct IniOption
 #define INI_OPTION_LAST \
 	{ INI_END_T, NULL, NULL, NULL, false, false, NULL, -1, -1, NULL, NULL, NULL }
 
+/*
+ * IniOptionIndex is a hash table of the options of an IniOption array, keyed
+ * on the "section.name" path of the options. Our option arrays are built at
+ * run-time from pointers into a configuration structure, so the index is
+ * built in a single pass over the array each time we need it.
+ *
+ * The table size must be a power of two and at least twice as large as our
+ * largest option array, which keeps the linear probing chains short.
+ */
+#define INI_OPTION_INDEX_SIZE 256
+
+typedef struct IniOptionIndex
+{
+	int count;
+	IniOption *buckets[INI_OPTION_INDEX_SIZE];
+} IniOptionIndex;
+
 bool read_ini_file(const char *filename, IniOption *opts);
 bool parse_ini_buffer(const char *filename,
 					  char *fileContents,
@@ -104,6 +121,10 @@ bool ini_to_json(JSON_Object *jsRoot, IniOption *optionList);
 IniOption * lookup_ini_option(IniOption *optionList,
 							  const char *section, const char *name);
 IniOption * lookup_ini_path_value(IniOption *optionList, const char *path);
+bool ini_build_option_index(IniOptionIndex *index, IniOption *optionList);
+IniOption * ini_index_lookup_option(IniOptionIndex *index,
+									const char *section, const char *name);
+IniOption * ini_index_lookup_path(IniOptionIndex *index, const char *path);
 bool ini_merge(IniOption *dstOptionList, IniOption *overrideOptionList);
 
 bool ini_set_option(IniOption *optionList, const char *path, char *value);
@@ -10,11 +10,13 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <ifaddrs.h>
 #include <limits.h>
 #include <netdb.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <netdb.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -25,6 +27,7 @@
 #include <unistd.h>
 
 #include "postgres_fe.h"
+#include "portability/instr_time.h"
 
 #include "defaults.h"
 #include "env_utils.h"
@@ -865,6 +868,273 @@ ipaddrGetLocalHostname(char *hostname, size_t size)
 }
 
 
+/*
+ * ipaddrMeasureConnectTime measures how long it takes to establish a TCP
+ * connection to the given host and port, which is the cost of about one
+ * network round trip. Name resolution is not part of the measurement, and we
+ * give up after timeoutMs milliseconds.
+ */
+bool
+ipaddrMeasureConnectTime(const char *hostname, int port, int timeoutMs,
+						 double *elapsedMs)
+{
+	struct addrinfo *lookup;
+	struct addrinfo hints;
+
+	instr_time startTime;
+	instr_time duration;
+
+	/* prepare getaddrinfo hints for name resolution or IP address parsing */
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = PF_UNSPEC;     /* accept any family as supported by OS */
+	hints.ai_socktype = SOCK_STREAM; /* we only want TCP sockets */
+	hints.ai_protocol = IPPROTO_TCP; /* we only want TCP sockets */
+
+	/* no retry policy here, we will measure again next time */
+	int error = getaddrinfo(hostname, intToString(port).strValue,
+							&hints, &lookup);
+
+	if (error != 0)
+	{
+		log_warn("Failed to resolve DNS name \"%s\": %s",
+				 hostname, gai_strerror(error));
+		return false;
+	}
+
+	int sock = socket(lookup->ai_family, lookup->ai_socktype,
+					  lookup->ai_protocol);
+
+	if (sock < 0)
+	{
+		log_warn("Failed to create a socket: %m");
+		freeaddrinfo(lookup);
+		return false;
+	}
+
+	if (fcntl(sock, F_SETFL, O_NONBLOCK) < 0)
+	{
+		log_warn("Failed to set socket in non-blocking mode: %m");
+		freeaddrinfo(lookup);
+		close(sock);
+		return false;
+	}
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	int err = connect(sock, lookup->ai_addr, lookup->ai_addrlen);
+
+	freeaddrinfo(lookup);
+
+	if (err < 0 && errno != EINPROGRESS)
+	{
+		log_debug("Failed to connect to %s:%d: %m", hostname, port);
+		close(sock);
+		return false;
+	}
+
+	if (err < 0)
+	{
+		struct pollfd pfd = { .fd = sock, .events = POLLOUT };
+		int sockError = 0;
+		socklen_t len = sizeof(sockError);
+
+		int ready = poll(&pfd, 1, timeoutMs);
+
+		if (ready <= 0)
+		{
+			log_debug("Failed to connect to %s:%d within %dms",
+					  hostname, port, timeoutMs);
+			close(sock);
+			return false;
+		}
+
+		if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &sockError, &len) < 0 ||
+			sockError != 0)
+		{
+			errno = sockError;
+			log_debug("Failed to connect to %s:%d: %m", hostname, port);
+			close(sock);
+			return false;
+		}
+	}
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	*elapsedMs = INSTR_TIME_GET_MILLISEC(duration);
+
+	close(sock);
+
+	return true;
+}
+
+
+/*
+ * ipaddrProbeConnect tries to establish a TCP connection to each of the given
+ * host and port pairs, all at the same time, and waits for at most timeoutMs
+ * milliseconds overall. The reachable array is filled with whether each
+ * target accepted our connection, and the function returns how many did.
+ *
+ * A target that actively refuses our connection is reachable over the
+ * network, so we count it as reachable too: we are interested in the network
+ * path here, not in the service behind it.
+ */
+int
+ipaddrProbeConnect(int count, const char **hostnames, const int *ports,
+				   int timeoutMs, bool *reachable)
+{
+	int reachableCount = 0;
+	int pendingCount = 0;
+
+	struct pollfd *pfds = (struct pollfd *) calloc(count, sizeof(struct pollfd));
+
+	if (pfds == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return 0;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		struct addrinfo *lookup;
+		struct addrinfo hints;
+
+		reachable[i] = false;
+		pfds[i].fd = -1;
+
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = PF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_protocol = IPPROTO_TCP;
+
+		IntString portString = intToString(ports[i]);
+
+		int error = getaddrinfo(hostnames[i], portString.strValue,
+								&hints, &lookup);
+
+		if (error != 0)
+		{
+			log_debug("Failed to resolve DNS name \"%s\": %s",
+					  hostnames[i], gai_strerror(error));
+			continue;
+		}
+
+		int sock = socket(lookup->ai_family, lookup->ai_socktype,
+						  lookup->ai_protocol);
+
+		if (sock < 0 || fcntl(sock, F_SETFL, O_NONBLOCK) < 0)
+		{
+			log_debug("Failed to prepare a socket to %s:%d: %m",
+					  hostnames[i], ports[i]);
+			if (sock >= 0)
+			{
+				close(sock);
+			}
+			freeaddrinfo(lookup);
+			continue;
+		}
+
+		int err = connect(sock, lookup->ai_addr, lookup->ai_addrlen);
+		int connectErrno = errno;
+
+		freeaddrinfo(lookup);
+
+		if (err == 0 || connectErrno == ECONNREFUSED)
+		{
+			reachable[i] = true;
+			++reachableCount;
+			close(sock);
+		}
+		else if (connectErrno == EINPROGRESS)
+		{
+			pfds[i].fd = sock;
+			pfds[i].events = POLLOUT;
+			++pendingCount;
+		}
+		else
+		{
+			errno = connectErrno;
+			log_debug("Failed to connect to %s:%d: %m", hostnames[i], ports[i]);
+			close(sock);
+		}
+	}
+
+	instr_time startTime;
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	while (pendingCount > 0)
+	{
+		instr_time duration;
+
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, startTime);
+
+		int remainingMs = timeoutMs - (int) INSTR_TIME_GET_MILLISEC(duration);
+
+		if (remainingMs <= 0)
+		{
+			break;
+		}
+
+		/* poll() ignores the entries with a negative fd */
+		int ready = poll(pfds, count, remainingMs);
+
+		if (ready < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (ready <= 0)
+		{
+			break;
+		}
+
+		for (int i = 0; i < count; i++)
+		{
+			if (pfds[i].fd < 0 || pfds[i].revents == 0)
+			{
+				continue;
+			}
+
+			int sockError = 0;
+			socklen_t len = sizeof(sockError);
+
+			if (getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR,
+						   &sockError, &len) == 0 &&
+				(sockError == 0 || sockError == ECONNREFUSED))
+			{
+				reachable[i] = true;
+				++reachableCount;
+			}
+			else
+			{
+				errno = sockError;
+				log_debug("Failed to connect to %s:%d: %m",
+						  hostnames[i], ports[i]);
+			}
+
+			close(pfds[i].fd);
+			pfds[i].fd = -1;
+			--pendingCount;
+		}
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		if (pfds[i].fd >= 0)
+		{
+			log_debug("Failed to connect to %s:%d within %dms",
+					  hostnames[i], ports[i], timeoutMs);
+			close(pfds[i].fd);
+		}
+	}
+
+	free(pfds);
+
+	return reachableCount;
+}
+
+
 /*
  * GetAddrInfo calls getaddrinfo and implement a retry policy in case we get a
  * transient failure from the system. And for kubernetes compatibility, we also
@@ -35,6 +35,10 @@ bool resolveHostnameForwardAndReverse(const char *hostname,
 									  bool *foundHostnameFromAddress);
 
 bool ipaddrGetLocalHostname(char *hostname, size_t size);
+bool ipaddrMeasureConnectTime(const char *hostname, int port, int timeoutMs,
+							  double *elapsedMs);
+int ipaddrProbeConnect(int count, const char **hostnames, const int *ports,
+					   int timeoutMs, bool *reachable);
 
 
 #endif /* __IPADDRH__ */
@@ -0,0 +1,291 @@
+/*
+ * src/bin/pg_autoctl/json_stream.c
+ *     Streaming JSON output of query results
+ *
+ * Our bulk listing commands output a JSON array of objects, one object per
+ * row of a query result. Rather than having the monitor aggregate the whole
+ * result in a single jsonb value, or building a parson tree of it, we write
+ * the JSON text directly to the output stream from the PGresult rows, using
+ * the column types to decide how to represent each value.
+ *
+ * The output mimics the format of Postgres row_to_json() and jsonb_pretty()
+ * so that it is the same as when the monitor was doing the work.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "postgres_fe.h"
+
+#include "json_stream.h"
+#include "pgsql.h"
+
+
+static void json_stream_print_value(FILE *stream, Oid type, const char *value);
+static void json_stream_print_timestamp(FILE *stream, const char *value);
+
+
+/*
+ * json_stream_print_result prints the given query result as a JSON array of
+ * objects, using the column names as the object keys.
+ */
+void
+json_stream_print_result(FILE *stream, PGresult *result)
+{
+	int nTuples = PQntuples(result);
+
+	if (nTuples == 0)
+	{
+		fputs("[]\n", stream);
+		return;
+	}
+
+	fputs("[\n", stream);
+
+	for (int rowNumber = 0; rowNumber < nTuples; rowNumber++)
+	{
+		(void) json_stream_print_row(stream, result, rowNumber, "    ");
+
+		fputs(rowNumber < (nTuples - 1) ? ",\n" : "\n", stream);
+	}
+
+	fputs("]\n", stream);
+}
+
+
+/*
+ * json_stream_print_row prints the given row of the query result as a JSON
+ * object. When indent is NULL, the object is printed on a single line.
+ */
+void
+json_stream_print_row(FILE *stream, PGresult *result,
+					  int rowNumber, const char *indent)
+{
+	int nFields = PQnfields(result);
+
+	if (indent == NULL)
+	{
+		fputs("{", stream);
+	}
+	else
+	{
+		fprintf(stream, "%s{\n", indent);
+	}
+
+	for (int fieldNumber = 0; fieldNumber < nFields; fieldNumber++)
+	{
+		if (indent != NULL)
+		{
+			fprintf(stream, "%s    ", indent);
+		}
+
+		(void) json_stream_print_string(stream, PQfname(result, fieldNumber));
+		fputs(": ", stream);
+
+		if (PQgetisnull(result, rowNumber, fieldNumber))
+		{
+			fputs("null", stream);
+		}
+		else
+		{
+			(void) json_stream_print_value(stream,
+										   PQftype(result, fieldNumber),
+										   PQgetvalue(result,
+													  rowNumber,
+													  fieldNumber));
+		}
+
+		if (fieldNumber < (nFields - 1))
+		{
+			fputs(indent == NULL ? ", " : ",\n", stream);
+		}
+		else if (indent != NULL)
+		{
+			fputs("\n", stream);
+		}
+	}
+
+	if (indent != NULL)
+	{
+		fputs(indent, stream);
+	}
+
+	fputs("}", stream);
+}
+
+
+/*
+ * json_stream_print_string prints the given string as a JSON string, with
+ * double quotes around it and the needed escaping.
+ */
+void
+json_stream_print_string(FILE *stream, const char *str)
+{
+	fputc('"', stream);
+
+	for (const char *ptr = str; *ptr != '\0'; ptr++)
+	{
+		switch (*ptr)
+		{
+			case '"':
+			{
+				fputs("\\\"", stream);
+				break;
+			}
+
+			case '\\':
+			{
+				fputs("\\\\", stream);
+				break;
+			}
+
+			case '\b':
+			{
+				fputs("\\b", stream);
+				break;
+			}
+
+			case '\f':
+			{
+				fputs("\\f", stream);
+				break;
+			}
+
+			case '\n':
+			{
+				fputs("\\n", stream);
+				break;
+			}
+
+			case '\r':
+			{
+				fputs("\\r", stream);
+				break;
+			}
+
+			case '\t':
+			{
+				fputs("\\t", stream);
+				break;
+			}
+
+			default:
+			{
+				if ((unsigned char) *ptr < ' ')
+				{
+					fprintf(stream, "\\u%04x", (unsigned char) *ptr);
+				}
+				else
+				{
+					fputc(*ptr, stream);
+				}
+				break;
+			}
+		}
+	}
+
+	fputc('"', stream);
+}
+
+
+/*
+ * json_stream_print_value prints the given value, in its Postgres text
+ * representation, as a JSON value of the matching type.
+ */
+static void
+json_stream_print_value(FILE *stream, Oid type, const char *value)
+{
+	switch (type)
+	{
+		case BOOLOID:
+		{
+			fputs(value[0] == 't' ? "true" : "false", stream);
+			break;
+		}
+
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case OIDOID:
+		{
+			fputs(value, stream);
+			break;
+		}
+
+		case FLOAT4OID:
+		case FLOAT8OID:
+		case NUMERICOID:
+		{
+			/* NaN and Infinity are not valid JSON numbers */
+			if (isdigit((unsigned char) value[0]) ||
+				(value[0] == '-' && isdigit((unsigned char) value[1])))
+			{
+				fputs(value, stream);
+			}
+			else
+			{
+				(void) json_stream_print_string(stream, value);
+			}
+			break;
+		}
+
+		case JSONOID:
+		case JSONBOID:
+		{
+			fputs(value, stream);
+			break;
+		}
+
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+		{
+			(void) json_stream_print_timestamp(stream, value);
+			break;
+		}
+
+		default:
+		{
+			(void) json_stream_print_string(stream, value);
+			break;
+		}
+	}
+}
+
+
+/*
+ * json_stream_print_timestamp prints a timestamp in the ISO 8601 format that
+ * Postgres uses in JSON, from its text representation with DateStyle ISO:
+ * "2021-03-18 12:32:36.103467+01" is printed "2021-03-18T12:32:36.103467+01:00".
+ * Other DateStyle representations are printed as-is.
+ */
+static void
+json_stream_print_timestamp(FILE *stream, const char *value)
+{
+	char buffer[BUFSIZE] = { 0 };
+	size_t len = strlcpy(buffer, value, sizeof(buffer));
+
+	if (len >= sizeof(buffer) - 4 ||
+		len < 19 || buffer[4] != '-' || buffer[10] != ' ')
+	{
+		(void) json_stream_print_string(stream, value);
+		return;
+	}
+
+	buffer[10] = 'T';
+
+	/* the time zone offset is +HH or +HH:MM or +HH:MM:SS */
+	if (len > 3 &&
+		(buffer[len - 3] == '+' || buffer[len - 3] == '-') &&
+		isdigit((unsigned char) buffer[len - 2]) &&
+		isdigit((unsigned char) buffer[len - 1]))
+	{
+		strlcpy(buffer + len, ":00", sizeof(buffer) - len);
+	}
+
+	(void) json_stream_print_string(stream, buffer);
+}
@@ -0,0 +1,23 @@
+/*
+ * src/bin/pg_autoctl/json_stream.h
+ *     Streaming JSON output of query results
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "libpq-fe.h"
+
+void json_stream_print_result(FILE *stream, PGresult *result);
+void json_stream_print_row(FILE *stream, PGresult *result,
+						   int rowNumber, const char *indent);
+void json_stream_print_string(FILE *stream, const char *str);
+
+#endif /* JSON_STREAM_H */
@@ -18,27 +18,47 @@
 #include "cli_common.h"
 #include "cli_root.h"
 #include "coordinator.h"
+#include "dns_cache.h"
 #include "env_utils.h"
 #include "file_utils.h"
 #include "fsm.h"
+#include "ipaddr.h"
 #include "keeper.h"
 #include "keeper_config.h"
+#include "keeper_metrics.h"
 #include "keeper_pg_init.h"
+#include "keeper_profile.h"
 #include "parsing.h"
 #include "pghba.h"
 #include "pgsetup.h"
+#include "prewarm.h"
 #include "primary_standby.h"
 #include "signals.h"
 #include "state.h"
+#include "string_utils.h"
+#include "topology.h"
 
 #include "runprogram.h"
 
 static bool keeper_state_check_postgres(Keeper *keeper,
 										PostgresControlData *control);
 
-static void diff_nodesArray(NodeAddressArray *previousNodesArray,
-							NodeAddressArray *currentNodesArray,
-							NodeAddressArray *diffNodesArray);
+static bool keeper_node_active_internal(Keeper *keeper, bool doInit,
+										MonitorAssignedState *assignedState,
+										NodeAddressArray *otherNodesArray,
+										bool *otherNodesOK);
+
+static bool keeper_replication_slots_need_maintenance(Keeper *keeper);
+static uint64_t keeper_citus_topology_version(CurrentNodeStateArray *nodesArray);
+static void keeper_sample_replay_rate(Keeper *keeper);
+static bool keeper_crash_recovery_progress(void *context,
+										   CrashRecoveryProgress *progress,
+										   bool *stopRecovery);
+static bool keeper_rewind_progress(void *context,
+								   RewindProgress *progress,
+								   bool *cloneRather);
+static bool keeper_drain_standby_run_command(Keeper *keeper, const char *step);
+static void keeper_fingerprint_add_string(uint64_t *fingerprint, const char *str);
 
 
 /*
@@ -55,6 +75,50 @@ keeper_init(Keeper *keeper, KeeperConfig *config)
 
 	local_postgres_init(&keeper->postgres, pgSetup);
 
+	/* keep track of crash recovery in our state, and tell the monitor */
+	keeper->postgres.crashRecoveryHook = &keeper_crash_recovery_progress;
+	keeper->postgres.crashRecoveryHookContext = (void *) keeper;
+
+	/* same for the estimate and progress of pg_rewind */
+	keeper->postgres.rewindHook = &keeper_rewind_progress;
+	keeper->postgres.rewindHookContext = (void *) keeper;
+
+	if (config->prewarm_interval > 0)
+	{
+		strlcpy(keeper->postgres.prewarmPath,
+				config->pathnames.prewarm,
+				MAXPGPATH);
+	}
+
+	/* pg_basebackup settings that standby_init_replication_source keeps */
+	strlcpy(keeper->postgres.replicationSource.backupCompression,
+			config->backup_compression,
+			NAMEDATALEN);
+
+	strlcpy(keeper->postgres.replicationSource.incrementalBaseDir,
+			config->incremental_base_directory,
+			MAXPGPATH);
+
+	strlcpy(keeper->postgres.replicationSource.cloneCommand,
+			config->clone_command,
+			MAXCONNINFO);
+
+	keeper->postgres.replicationSource.cloneJobs = config->clone_jobs;
+
+	strlcpy(keeper->postgres.replicationSource.backupProgressFile,
+			config->pathnames.basebackup,
+			MAXPGPATH);
+
+	/* the upstream timeline history is cached across transitions */
+	strlcpy(keeper->postgres.replicationSource.timelinesFile,
+			config->pathnames.timelines,
+			MAXPGPATH);
+
+	/* and so is the restore_command used to fetch WAL from the archives */
+	strlcpy(keeper->postgres.replicationSource.restoreCommand,
+			config->restore_command,
+			MAXCONNINFO);
+
 	if (!config->monitorDisabled)
 	{
 		if (!monitor_init(&keeper->monitor, config->monitor_pguri))
@@ -83,13 +147,27 @@ keeper_load_state(Keeper *keeper)
 	KeeperStateData *keeperState = &(keeper->state);
 	KeeperConfig *config = &(keeper->config);
 
-	return keeper_state_read(keeperState, config->pathnames.state);
+	if (!keeper_state_read(keeperState, config->pathnames.state))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	/* what we just read is what we have on-disk */
+	keeper->storedState = *keeperState;
+
+	return true;
 }
 
 
 /*
  * keeper_store_state stores the current state of the keeper in the configured
  * state file.
+ *
+ * Each write of the state file is durable, with an fsync() before the file is
+ * renamed in place. We keep a copy of what we last read or wrote, and skip the
+ * write entirely when the state did not change since then: the file on-disk
+ * already has the same contents, so the durability guarantee holds.
  */
 bool
 keeper_store_state(Keeper *keeper)
@@ -97,7 +175,23 @@ keeper_store_state(Keeper *keeper)
 	KeeperStateData *keeperState = &(keeper->state);
 	KeeperConfig *config = &(keeper->config);
 
-	return keeper_state_write(keeperState, config->pathnames.state);
+	if (memcmp(keeperState, &(keeper->storedState),
+			   sizeof(KeeperStateData)) == 0)
+	{
+		log_trace("keeper_store_state: state has not changed, skip writing");
+		(void) keeper_metrics_record_state_write_skipped();
+		return true;
+	}
+
+	if (!keeper_state_write(keeperState, config->pathnames.state))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	keeper->storedState = *keeperState;
+
+	return true;
 }
 
 
@@ -250,7 +344,33 @@ keeper_ensure_current_state(Keeper *keeper)
 			}
 
 			/* when a standby has been removed, remove its replication slot */
-			return keeper_create_and_drop_replication_slots(keeper);
+			if (!keeper_create_and_drop_replication_slots(keeper))
+			{
+				/* errors have already been logged */
+				return false;
+			}
+
+			/*
+			 * Standby nodes that stream from another standby node, see
+			 * pgautofailover.cascade_by_cluster, don't use their slot here.
+			 * Advance those inactive slots to the LSN the nodes report so
+			 * that they don't retain WAL on the primary.
+			 */
+			if (keeperState->current_role == PRIMARY_STATE &&
+				!keeper_maintain_replication_slots(keeper))
+			{
+				log_warn("Failed to advance inactive replication slots, "
+						 "see above for details");
+			}
+
+			/* applications read their own writes with the LSN tokens */
+			if (!keeper_ensure_lsn_token_functions(keeper))
+			{
+				log_warn("Failed to create the LSN token functions, "
+						 "see above for details");
+			}
+
+			return true;
 		}
 
 		/*
@@ -276,8 +396,29 @@ keeper_ensure_current_state(Keeper *keeper)
 				return false;
 			}
 
+			/* stream from the node the monitor assigns us */
+			if (keeperState->current_role == SECONDARY_STATE &&
+				!keeper_maintain_upstream(keeper))
+			{
+				log_warn("Failed to update our upstream node, "
+						 "see above for details");
+			}
+
 			/* now ensure progress is made on the replication slots */
-			return keeper_maintain_replication_slots(keeper);
+			if (!keeper_maintain_replication_slots(keeper))
+			{
+				/* errors have already been logged */
+				return false;
+			}
+
+			/* failing to warm-up our shared buffers is not critical */
+			if (!keeper_maintain_prewarm(keeper))
+			{
+				log_warn("Failed to warm-up shared buffers, "
+						 "retrying in %ds", keeper->config.prewarm_interval);
+			}
+
+			return true;
 		}
 
 		/*
@@ -440,6 +581,7 @@ keeper_update_pg_state(Keeper *keeper, int logLevel)
 	postgres->pgIsRunning = false;
 	memset(postgres->pgsrSyncState, 0, PGSR_SYNC_STATE_MAXLENGTH);
 	strlcpy(postgres->currentLSN, "0/0", sizeof(postgres->currentLSN));
+	strlcpy(postgres->replayLSN, "0/0", sizeof(postgres->replayLSN));
 
 	/* when running with --disable-monitor, we might get here early */
 	if (keeperState->current_role == INIT_STATE)
@@ -470,10 +612,54 @@ keeper_update_pg_state(Keeper *keeper, int logLevel)
 
 		/*
 		 * Reinitialize connection string in case host changed or was first
-		 * discovered.
+		 * discovered. When it did not change, keep the connection that we
+		 * opened in a previous round, along with its prepared statements.
 		 */
 		pg_setup_get_local_connection_string(pgSetup, connInfo);
-		pgsql_init(pgsql, connInfo, PGSQL_CONN_LOCAL);
+
+		/* say which path we use for local connections, and when it changes */
+		char localHost[MAXPGPATH] = { 0 };
+		bool unixSocket = false;
+
+		(void) pg_setup_get_local_host(pgSetup,
+									   localHost, sizeof(localHost),
+									   &unixSocket);
+
+		if (!keeper->localHostKnown ||
+			strcmp(keeper->localHost, localHost) != 0)
+		{
+			if (unixSocket && IS_EMPTY_STRING_BUFFER(localHost))
+			{
+				log_info("Connecting to the local Postgres through the "
+						 "default unix socket directory");
+			}
+			else if (unixSocket)
+			{
+				log_info("Connecting to the local Postgres through the unix "
+						 "socket directory \"%s\"",
+						 localHost);
+			}
+			else
+			{
+				log_info("Connecting to the local Postgres over TCP "
+						 "to \"%s\" port %d",
+						 localHost, pgSetup->pgport);
+			}
+
+			strlcpy(keeper->localHost, localHost, sizeof(keeper->localHost));
+			keeper->localHostKnown = true;
+		}
+
+		if (pgsql->connection == NULL ||
+			pgsql->connectionStatementType != PGSQL_CONNECTION_PERSISTENT ||
+			strcmp(pgsql->connectionString, connInfo) != 0)
+		{
+			pgsql_finish(pgsql);
+			pgsql_init(pgsql, connInfo, PGSQL_CONN_LOCAL);
+		}
+
+		/* the keeper main loop keeps its local connection open */
+		pgsql->connectionStatementType = PGSQL_CONNECTION_PERSISTENT;
 
 		/*
 		 * Update our Postgres metadata now.
@@ -490,16 +676,70 @@ keeper_update_pg_state(Keeper *keeper, int logLevel)
 		 * values (pg_control_version, catalog_version_no, and
 		 * system_identifier).
 		 */
-		if (!pgsql_get_postgres_metadata(pgsql,
-										 &pgSetup->is_in_recovery,
-										 postgres->pgsrSyncState,
-										 postgres->currentLSN,
-										 &(pgSetup->control)))
+		bool gotMetadata =
+			pgsql_get_postgres_metadata(pgsql,
+										&pgSetup->is_in_recovery,
+										postgres->pgsrSyncState,
+										postgres->currentLSN,
+										postgres->replayLSN,
+										&(pgSetup->control));
+
+		/*
+		 * When we could not connect through the unix socket that we use
+		 * instead of our TCP hostname, try again with the TCP hostname. When
+		 * that fails too, the socket was not the problem.
+		 */
+		if (!gotMetadata &&
+			pgsql->connection == NULL &&
+			pg_setup_local_socket_preferred(pgSetup))
+		{
+			char socketDir[MAXPGPATH] = { 0 };
+
+			strlcpy(socketDir, pgSetup->pidFile.socketDir, sizeof(socketDir));
+
+			(void) pg_setup_reject_local_socket(pgSetup, true);
+
+			pg_setup_get_local_connection_string(pgSetup, connInfo);
+
+			pgsql_finish(pgsql);
+			pgsql_init(pgsql, connInfo, PGSQL_CONN_LOCAL);
+			pgsql->connectionStatementType = PGSQL_CONNECTION_PERSISTENT;
+
+			(void) pg_setup_get_local_host(pgSetup,
+										   keeper->localHost,
+										   sizeof(keeper->localHost),
+										   &unixSocket);
+
+			gotMetadata =
+				pgsql_get_postgres_metadata(pgsql,
+											&pgSetup->is_in_recovery,
+											postgres->pgsrSyncState,
+											postgres->currentLSN,
+											postgres->replayLSN,
+											&(pgSetup->control));
+
+			if (gotMetadata)
+			{
+				log_warn("Failed to connect to the local Postgres through "
+						 "the unix socket directory \"%s\", using TCP to "
+						 "\"%s\" port %d instead",
+						 socketDir, pgSetup->pghost, pgSetup->pgport);
+			}
+			else
+			{
+				(void) pg_setup_reject_local_socket(pgSetup, false);
+			}
+		}
+
+		if (!gotMetadata)
 		{
 			log_level(logLevel, "Failed to update the local Postgres metadata");
 			return false;
 		}
 
+		/* see keeper_node_active_loop() about this connection */
+		(void) pgsql_continue_connection(&(keeper->monitor.pgsql));
+
 		if (!keeper_state_check_postgres(keeper, &(pgSetup->control)))
 		{
 			log_level(logLevel,
@@ -512,11 +752,37 @@ keeper_update_pg_state(Keeper *keeper, int logLevel)
 		keeperState->pg_control_version = pgSetup->control.pg_control_version;
 		keeperState->catalog_version_no = pgSetup->control.catalog_version_no;
 		keeperState->system_identifier = pgSetup->control.system_identifier;
+
+		if (pgSetup->is_in_recovery)
+		{
+			(void) keeper_sample_replay_rate(keeper);
+		}
+
+		/*
+		 * On a primary, also report where our standby nodes are, as seen in
+		 * pg_stat_replication. That's only extra information for the monitor,
+		 * so failing to get it is not an error.
+		 */
+		postgres->standbyLSNs.count = 0;
+
+		if (!pgSetup->is_in_recovery &&
+			!pgsql_get_standby_lsns(pgsql, &(postgres->standbyLSNs)))
+		{
+			log_warn("Failed to get the LSN positions of the standby nodes, "
+					 "see above for details");
+			postgres->standbyLSNs.count = 0;
+		}
+
+		(void) pgsql_continue_connection(&(keeper->monitor.pgsql));
 	}
 	else
 	{
 		/* Postgres is not running. */
 		postgres->pgIsRunning = false;
+		postgres->standbyLSNs.count = 0;
+
+		/* a connection kept from a previous round is now useless */
+		pgsql_finish(pgsql);
 
 		/*
 		 * Cache invalidation: keep the current values we have for the Postgres
@@ -840,7 +1106,14 @@ keeper_ensure_configuration(Keeper *keeper, bool postgresNotRunningIsOk)
 	 * function pg_reload_conf() because Postgres is not running yet, it will
 	 * start with the new setup already.
 	 */
-	if (pg_setup_is_running(pgSetup))
+	if (pg_setup_is_running(pgSetup) && keeper_settings_unchanged(keeper))
+	{
+		log_debug("Postgres settings have not changed since our last "
+				  "configuration reload, skipping");
+
+		(void) keeper_metrics_record_settings(false);
+	}
+	else if (pg_setup_is_running(pgSetup))
 	{
 		if (state->pg_control_version >= 1200)
 		{
@@ -855,6 +1128,9 @@ keeper_ensure_configuration(Keeper *keeper, bool postgresNotRunningIsOk)
 					 "see above for details");
 			return false;
 		}
+
+		(void) keeper_settings_applied(keeper);
+		(void) keeper_metrics_record_settings(true);
 	}
 
 	if (!config->monitorDisabled)
@@ -1012,22 +1288,40 @@ keeper_ensure_configuration(Keeper *keeper, bool postgresNotRunningIsOk)
  * with the command `pg_autoctl drop node [ --destroy ]`); and creates
  * replication slots for nodes that have been recently registered on the
  * monitor.
+ *
+ * When we have created replication slots, we notify the standby nodes of our
+ * group through the monitor: new standby nodes wait for their slot before
+ * running pg_basebackup.
  */
 bool
 keeper_create_and_drop_replication_slots(Keeper *keeper)
 {
+	KeeperConfig *config = &(keeper->config);
 	LocalPostgresServer *postgres = &(keeper->postgres);
 	NodeAddressArray *otherNodesArray = &(keeper->otherNodes);
+	int createdCount = 0;
 
 	log_trace("keeper_create_and_drop_replication_slots");
 
-	if (!postgres_replication_slot_create_and_drop(postgres, otherNodesArray))
+	if (!postgres_replication_slot_create_and_drop(postgres,
+												   otherNodesArray,
+												   &createdCount))
 	{
 		log_error("Failed to maintain replication slots on the local Postgres "
 				  "instance, see above for details");
 		return false;
 	}
 
+	if (createdCount > 0 && !config->monitorDisabled)
+	{
+		/* standby nodes still check for their slot when we fail here */
+		(void) monitor_notify_replication_slots_created(
+			&(keeper->monitor),
+			config->formation,
+			keeper->state.current_group,
+			keeper->state.current_node_id);
+	}
+
 	return true;
 }
 
@@ -1124,115 +1418,1469 @@ keeper_maintain_replication_slots(Keeper *keeper)
 		return false;
 	}
 
-	if (!postgres_replication_slot_maintain(postgres, &(keeper->otherNodes)))
+	if (!keeper_replication_slots_need_maintenance(keeper))
+	{
+		log_trace("Skipping replication slots maintenance: no other node "
+				  "moved past replication.slot_advance_threshold of %d bytes",
+				  keeper->config.slot_advance_threshold);
+		return true;
+	}
+
+	KeeperProfileMark mark = { 0 };
+
+	(void) keeper_profile_begin(&mark);
+
+	bool maintained =
+		postgres_replication_slot_maintain(postgres, &(keeper->otherNodes));
+
+	(void) keeper_profile_end(KEEPER_PROFILE_PHASE_REPLICATION_SLOTS, &mark);
+
+	if (!maintained)
 	{
 		log_error("Failed to maintain replication slots on the local Postgres "
 				  "instance, see above for details");
+
+		/* make sure we try again next time */
+		nodeAddressArrayFree(&(keeper->slotsNodes));
 		return false;
 	}
 
+	/* remember the LSN positions that our replication slots now use */
+	if (!nodeAddressArrayCopy(&(keeper->slotsNodes), &(keeper->otherNodes)))
+	{
+		/* errors have already been logged */
+		nodeAddressArrayFree(&(keeper->slotsNodes));
+	}
+
 	return true;
 }
 
 
 /*
- * keeper_node_active calls pgautofailover.node_active on the monitor.
+ * keeper_replication_slots_need_maintenance returns true when the replication
+ * slots on this standby node should be maintained again: when the
+ * replication.slot_advance_threshold setting is zero, when the list of other
+ * nodes has changed since the last maintenance, or when one of the other
+ * nodes reported an LSN that moved by at least the threshold since then.
+ */
+static bool
+keeper_replication_slots_need_maintenance(Keeper *keeper)
+{
+	NodeAddressArray *otherNodesArray = &(keeper->otherNodes);
+	NodeAddressArray *slotsNodesArray = &(keeper->slotsNodes);
+
+	uint64_t threshold = (uint64_t) keeper->config.slot_advance_threshold;
+
+	if (threshold == 0 || slotsNodesArray->count != otherNodesArray->count)
+	{
+		return true;
+	}
+
+	for (int index = 0; index < otherNodesArray->count; index++)
+	{
+		NodeAddress *node = &(otherNodesArray->nodes[index]);
+		NodeAddress *slotNode = &(slotsNodesArray->nodes[index]);
+
+		uint64_t lsn = 0;
+		uint64_t slotLSN = 0;
+
+		/* both arrays are sorted by nodeId */
+		if (node->nodeId != slotNode->nodeId)
+		{
+			return true;
+		}
+
+		if (!parseLSN(node->lsn, &lsn) || !parseLSN(slotNode->lsn, &slotLSN))
+		{
+			return true;
+		}
+
+		/* a node that went backward (rewind, rebuild) is a change too */
+		if (lsn < slotLSN || (lsn - slotLSN) >= threshold)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * keeper_maintain_prewarm warms-up the shared buffers of a secondary node
+ * with the blocks that are in the shared buffers of the primary node, so that
+ * we don't start with a cold cache when we are promoted.
+ *
+ * Every prewarm.interval seconds we fetch a new copy of the primary's block
+ * list, and then load it a chunk of PREWARM_BLOCKS_PER_ROUND blocks at a time
+ * so that our main loop is not blocked for long.
  */
 bool
-keeper_node_active(Keeper *keeper, bool doInit,
-				   MonitorAssignedState *assignedState)
+keeper_maintain_prewarm(Keeper *keeper)
 {
-	Monitor *monitor = &(keeper->monitor);
 	KeeperConfig *config = &(keeper->config);
-	KeeperStateData *keeperState = &(keeper->state);
 	LocalPostgresServer *postgres = &(keeper->postgres);
+	PrewarmBlockList *prewarm = &(postgres->prewarm);
 
-	bool reportPgIsRunning = ReportPgIsRunning(keeper);
+	uint64_t now = time(NULL);
 
-	/*
-	 * First, connect to the monitor and check we're compatible with the
-	 * extension there. An upgrade on the monitor might have happened in
-	 * between loops here.
-	 *
-	 * Note that we don't need a very strong a guarantee about the version
-	 * number of the monitor extension, as we have other places in the code
-	 * that are protected against "suprises". The worst case would be a race
-	 * condition where the extension check passes, and then the monitor is
-	 * upgraded, and then we call node_active().
-	 *
-	 *  - The extension on the monitor is protected against running a version
-	 *    of the node_active (or any other) function that does not match with
-	 *    the SQL level version.
-	 *
-	 *  - Then, if we changed the API without changing the arguments, that
-	 *    means we changed what we may return. We are protected against changes
-	 *    in number of return values, so we're left with changes within the
-	 *    columns themselves. Basically that's a new state that we don't know
-	 *    how to handle. In that case we're going to fail to parse it, and at
-	 *    next attempt we're going to catch up with the new version number.
-	 *
-	 * All in all, the worst case is going to be one extra call before we
-	 * restart node active process, and an extra error message in the logs
-	 * during the live upgrade of pg_auto_failover.
-	 */
-	MonitorExtensionVersion monitorVersion = { 0 };
+	if (config->prewarm_interval <= 0 ||
+		keeper->state.current_role != SECONDARY_STATE)
+	{
+		return true;
+	}
 
-	if (!keeper_check_monitor_extension_version(keeper, &monitorVersion))
+	if (prewarm->done >= prewarm->count)
 	{
-		/*
-		 * We could fail here for two different reasons:
-		 *
-		 * - if we failed to connect to the monitor (network split, monitor is
-		 *   in maintenance or being restarted, etc): in that case just return
-		 *   false and have the main loop handle the situation
-		 *
-		 * - if we could connect to the monitor and then failed to check that
-		 *   the version of the monitor is the one we expect, then we're not
-		 *   compatible with this monitor and that's a different story.
-		 */
-		if (monitor->pgsql.status != PG_CONNECTION_OK)
+		NodeAddress *primaryNode = NULL;
+
+		if ((now - prewarm->fetchTime) < config->prewarm_interval)
 		{
-			return false;
+			return true;
 		}
 
-		/*
-		 * Okay we're not compatible with the current version of the
-		 * pgautofailover extension on the monitor. The most plausible scenario
-		 * is that the monitor got update: we're still running e.g. 1.4 and the
-		 * monitor is running 1.5.
-		 *
-		 * In that case we exit, and because the keeper node-active service is
-		 * RP_PERMANENT the supervisor is going to restart this process. The
-		 * restart happens with fork() and exec(), so it uses the current
-		 * version of pg_autoctl binary on disk, which has been updated to e.g.
-		 * 1.5 too.
-		 *
-		 * TL;DR: just exit now, have the service restarted by the supervisor
-		 * with the expected version of pg_autoctl that matches the monitor's
-		 * extension version.
-		 */
-		KeeperVersion keeperVersion = { 0 };
+		prewarm->fetchTime = now;
 
-		if (!keeper_pg_autoctl_get_version_from_disk(keeper, &keeperVersion))
+		for (int i = 0; i < keeper->otherNodes.count; i++)
 		{
-			/* errors have already been logged */
-			return false;
+			if (keeper->otherNodes.nodes[i].isPrimary)
+			{
+				primaryNode = &(keeper->otherNodes.nodes[i]);
+				break;
+			}
 		}
 
-		/*
-		 * Only call exit() when the on-disk pg_autoctl required extension
-		 * version matches the current monitor extension version, ensuring that
-		 * the restart is going to be effective.
-		 */
-		if (strcmp(monitorVersion.installedVersion,
-				   keeperVersion.required_extension_version) == 0)
+		if (primaryNode == NULL)
 		{
-			log_info("pg_autoctl version \"%s\" with compatibility with "
-					 "monitor extension \"%s\" has been found on-disk, "
-					 "exiting for a restart of the node-active process.",
-					 keeperVersion.pg_autoctl_version,
-					 keeperVersion.required_extension_version);
-			exit(EXIT_CODE_MONITOR);
+			log_debug("Skipping prewarm: the primary node is not known yet");
+			return true;
+		}
+
+		if (!prewarm_fetch_block_list(primaryNode,
+									  &(postgres->postgresSetup),
+									  postgres->prewarmPath) ||
+			!prewarm_read_block_list(postgres->prewarmPath, prewarm))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+
+		log_info("Warming up shared buffers with the %d blocks of "
+				 "primary node %" PRId64 " \"%s\" (%s:%d)",
+				 prewarm->count,
+				 primaryNode->nodeId,
+				 primaryNode->name,
+				 primaryNode->host,
+				 primaryNode->port);
+	}
+
+	bool success = prewarm_load_blocks(&(postgres->postgresSetup),
+									   prewarm,
+									   "buffer",
+									   PREWARM_BLOCKS_PER_ROUND);
+
+	if (prewarm->done >= prewarm->count)
+	{
+		log_info("Warmed up shared buffers with the primary's block list");
+	}
+
+	return success;
+}
+
+
+/*
+ * keeper_maintain_latency measures the round-trip time to each of the other
+ * nodes of our group every latency.interval seconds, and reports it to the
+ * monitor, where it is used to pick a failover candidate that is close to the
+ * other nodes when pgautofailover.prefer_low_latency_candidates is on.
+ *
+ * We time a TCP connection to the Postgres port of the other nodes, which
+ * costs about one network round trip and doesn't require any credentials.
+ */
+bool
+keeper_maintain_latency(Keeper *keeper)
+{
+	KeeperConfig *config = &(keeper->config);
+	NodeAddressArray *otherNodes = &(keeper->otherNodes);
+
+	uint64_t now = time(NULL);
+	int count = 0;
+
+	if (config->latency_interval <= 0 ||
+		config->monitorDisabled ||
+		otherNodes->count == 0 ||
+		(now - keeper->latencyReportTime) < config->latency_interval)
+	{
+		return true;
+	}
+
+	keeper->latencyReportTime = now;
+
+	int64_t *peerNodeIds = (int64_t *) calloc(otherNodes->count,
+											  sizeof(int64_t));
+	double *rtt = (double *) calloc(otherNodes->count, sizeof(double));
+
+	if (peerNodeIds == NULL || rtt == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		free(peerNodeIds);
+		free(rtt);
+		return false;
+	}
+
+	for (int i = 0; i < otherNodes->count; i++)
+	{
+		NodeAddress *node = &(otherNodes->nodes[i]);
+
+		if (!ipaddrMeasureConnectTime(node->host, node->port,
+									  LATENCY_CONNECT_TIMEOUT_MS,
+									  &(rtt[count])))
+		{
+			log_debug("Failed to measure latency to node %" PRId64
+					  " \"%s\" (%s:%d)",
+					  node->nodeId, node->name, node->host, node->port);
+			continue;
+		}
+
+		log_trace("keeper_maintain_latency: node %" PRId64 " \"%s\": %.3fms",
+				  node->nodeId, node->name, rtt[count]);
+
+		peerNodeIds[count++] = node->nodeId;
+	}
+
+	bool success = true;
+
+	if (count > 0)
+	{
+		success = monitor_report_latency(&(keeper->monitor),
+										 keeper->state.current_node_id,
+										 count, peerNodeIds, rtt);
+	}
+
+	free(peerNodeIds);
+	free(rtt);
+
+	return success;
+}
+
+
+/*
+ * keeper_probe_network_peers tries to open a TCP connection to the monitor
+ * and to the Postgres port of each of the other nodes, all in parallel, and
+ * returns how many of them could be reached. The number of probed peers is
+ * set in probedCount.
+ *
+ * When the monitor can't be contacted and none of our peers are reachable
+ * either, we have positive evidence that we are alone on our side of a
+ * network partition, rather than a monitor failure.
+ */
+int
+keeper_probe_network_peers(Keeper *keeper, int *probedCount)
+{
+	KeeperConfig *config = &(keeper->config);
+	NodeAddressArray *otherNodes = &(keeper->otherNodes);
+
+	char monitorHostname[_POSIX_HOST_NAME_MAX] = { 0 };
+	int monitorPort = 0;
+
+	int count = 0;
+	int capacity = otherNodes->count + 1;
+
+	const char **hostnames = (const char **) calloc(capacity, sizeof(char *));
+	int *ports = (int *) calloc(capacity, sizeof(int));
+	bool *reachable = (bool *) calloc(capacity, sizeof(bool));
+
+	*probedCount = 0;
+
+	if (hostnames == NULL || ports == NULL || reachable == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		free(hostnames);
+		free(ports);
+		free(reachable);
+		return 0;
+	}
+
+	if (!config->monitorDisabled &&
+		hostname_from_uri(config->monitor_pguri,
+						  monitorHostname, _POSIX_HOST_NAME_MAX,
+						  &monitorPort))
+	{
+		hostnames[count] = monitorHostname;
+		ports[count] = monitorPort;
+		++count;
+	}
+
+	for (int i = 0; i < otherNodes->count; i++)
+	{
+		hostnames[count] = otherNodes->nodes[i].host;
+		ports[count] = otherNodes->nodes[i].port;
+		++count;
+	}
+
+	*probedCount = count;
+
+	int reachableCount =
+		count == 0
+		? 0
+		: ipaddrProbeConnect(count, hostnames, ports,
+							 NETWORK_PARTITION_PROBE_TIMEOUT_MS, reachable);
+
+	free(hostnames);
+	free(ports);
+	free(reachable);
+
+	log_debug("keeper_probe_network_peers: %d of %d peers are reachable",
+			  reachableCount, count);
+
+	return reachableCount;
+}
+
+
+/*
+ * keeper_maintain_health_signals measures the health signals of the primary
+ * node every health.signals_interval seconds, and reports them to the
+ * monitor. When pgautofailover.degraded_primary_threshold is set on the
+ * monitor, signals that stay over the threshold start a switchover while the
+ * primary is still reachable, rather than a failover once it's not.
+ *
+ * The checkpointer statistics are cumulative, we report the time spent in
+ * fsync calls since our previous measurement.
+ */
+bool
+keeper_maintain_health_signals(Keeper *keeper)
+{
+	KeeperConfig *config = &(keeper->config);
+	KeeperStateData *state = &(keeper->state);
+	LocalPostgresServer *postgres = &(keeper->postgres);
+	PostgresSetup *pgSetup = &(postgres->postgresSetup);
+
+	PostgresHealthSignals signals = { 0 };
+	double checkpointSyncMs = 0;
+
+	uint64_t now = time(NULL);
+
+	if (config->health_signals_interval <= 0 ||
+		config->monitorDisabled ||
+		state->current_role != PRIMARY_STATE ||
+		!postgres->pgIsRunning ||
+		(now - keeper->healthSignalsReportTime) <
+		config->health_signals_interval)
+	{
+		return true;
+	}
+
+	keeper->healthSignalsReportTime = now;
+
+	if (!pgsql_measure_health_signals(&(postgres->sqlClient),
+									  pgSetup->control.pg_control_version,
+									  &signals))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (keeper->checkpointSyncTimeKnown &&
+		signals.checkpointSyncTime >= keeper->checkpointSyncTime)
+	{
+		checkpointSyncMs =
+			(double) (signals.checkpointSyncTime - keeper->checkpointSyncTime);
+	}
+
+	keeper->checkpointSyncTime = signals.checkpointSyncTime;
+	keeper->checkpointSyncTimeKnown = true;
+
+	log_trace("keeper_maintain_health_signals: "
+			  "canary %.3fms, WAL flush %.3fms, checkpoint sync %.0fms",
+			  signals.canaryMs, signals.walFlushMs, checkpointSyncMs);
+
+	bool switchover = false;
+
+	if (!monitor_report_health_signals(&(keeper->monitor),
+									   state->current_node_id,
+									   signals.canaryMs,
+									   signals.walFlushMs,
+									   checkpointSyncMs,
+									   &switchover))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (switchover)
+	{
+		log_warn("The monitor started a switchover after our health signals "
+				 "have been degraded: canary %.3fms, WAL flush %.3fms, "
+				 "checkpoint sync %.0fms",
+				 signals.canaryMs, signals.walFlushMs, checkpointSyncMs);
+	}
+
+	return true;
+}
+
+
+/*
+ * keeper_maintain_load measures the load of our standby node every
+ * load.interval seconds, and reports it to the monitor: the percentage of
+ * CPU time spent working and waiting for I/O since our previous sample, the
+ * count of active client connections, and the replay lag. Formations with
+ * prefer_least_loaded then promote the least loaded of the equally advanced
+ * failover candidates.
+ *
+ * The CPU times are cumulative, the first sample is only used as a starting
+ * point, and we report the load from the next one on.
+ */
+bool
+keeper_maintain_load(Keeper *keeper)
+{
+	KeeperConfig *config = &(keeper->config);
+	KeeperStateData *state = &(keeper->state);
+	LocalPostgresServer *postgres = &(keeper->postgres);
+
+	PostgresLoad load = { 0 };
+	CPUTimes cpuTimes = { 0 };
+	double cpu = 0;
+	double iowait = 0;
+
+	uint64_t now = time(NULL);
+
+	if (config->load_interval <= 0 ||
+		config->monitorDisabled ||
+		state->current_role != SECONDARY_STATE ||
+		!postgres->pgIsRunning ||
+		(now - keeper->loadReportTime) < config->load_interval)
+	{
+		return true;
+	}
+
+	keeper->loadReportTime = now;
+
+	if (!get_cpu_times(&cpuTimes))
+	{
+		/* we still report the load that Postgres knows about */
+		keeper->cpuTimesKnown = false;
+	}
+	else if (!keeper->cpuTimesKnown)
+	{
+		keeper->cpuTimes = cpuTimes;
+		keeper->cpuTimesKnown = true;
+
+		return true;
+	}
+	else
+	{
+		uint64_t total = cpuTimes.total - keeper->cpuTimes.total;
+		uint64_t idle = cpuTimes.idle - keeper->cpuTimes.idle;
+		uint64_t waiting = cpuTimes.iowait - keeper->cpuTimes.iowait;
+
+		if (cpuTimes.total > keeper->cpuTimes.total && total >= idle + waiting)
+		{
+			cpu = 100.0 * (double) (total - idle - waiting) / (double) total;
+			iowait = 100.0 * (double) waiting / (double) total;
+		}
+
+		keeper->cpuTimes = cpuTimes;
+	}
+
+	if (!pgsql_measure_load(&(postgres->sqlClient), &load))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	log_trace("keeper_maintain_load: cpu %.1f%%, iowait %.1f%%, "
+			  "%d active connections, replay lag %" PRId64 " bytes",
+			  cpu, iowait, load.activeConnections, load.replayLag);
+
+	return monitor_report_load(&(keeper->monitor),
+							   state->current_node_id,
+							   cpu, iowait,
+							   load.activeConnections,
+							   load.replayLag);
+}
+
+
+/*
+ * keeper_sample_replay_rate measures how fast our standby replays WAL from
+ * the replay LSN that keeper_update_pg_state() fetches, and keeps a moving
+ * average of the rate in keeper->replayRate.
+ *
+ * A standby replays WAL only as fast as the primary writes it, so we only use
+ * samples with at least REPLAY_RATE_MIN_SAMPLE_BYTES of WAL, and discard idle
+ * periods: the rate is a lower bound of the replay throughput.
+ */
+static void
+keeper_sample_replay_rate(Keeper *keeper)
+{
+	LocalPostgresServer *postgres = &(keeper->postgres);
+
+	uint64_t replayLSN = 0;
+	instr_time now;
+
+	if (!parseLSN(postgres->replayLSN, &replayLSN) || replayLSN == 0)
+	{
+		return;
+	}
+
+	INSTR_TIME_SET_CURRENT(now);
+
+	/* first sample or a new timeline after a rewind, start again */
+	if (keeper->replaySampleLSN == 0 || replayLSN < keeper->replaySampleLSN)
+	{
+		keeper->replaySampleLSN = replayLSN;
+		keeper->replaySampleTime = now;
+		return;
+	}
+
+	instr_time elapsed = now;
+	INSTR_TIME_SUBTRACT(elapsed, keeper->replaySampleTime);
+
+	double elapsedSecs = INSTR_TIME_GET_DOUBLE(elapsed);
+	uint64_t replayed = replayLSN - keeper->replaySampleLSN;
+
+	if (replayed < REPLAY_RATE_MIN_SAMPLE_BYTES)
+	{
+		if (elapsedSecs > REPLAY_RATE_MAX_SAMPLE_SECS)
+		{
+			keeper->replaySampleLSN = replayLSN;
+			keeper->replaySampleTime = now;
+		}
+		return;
+	}
+
+	if (elapsedSecs > 0)
+	{
+		double rate = (double) replayed / elapsedSecs;
+
+		keeper->replayRate =
+			keeper->replayRate == 0
+			? rate
+			: 0.8 * keeper->replayRate + 0.2 * rate;
+
+		log_trace("keeper_sample_replay_rate: %.0f bytes/s, average %.0f bytes/s",
+				  rate, keeper->replayRate);
+	}
+
+	keeper->replaySampleLSN = replayLSN;
+	keeper->replaySampleTime = now;
+}
+
+
+/*
+ * keeper_maintain_recovery_target adjusts max_wal_size and checkpoint_timeout
+ * so that crash recovery of the local node stays within the formation's
+ * target_recovery_seconds, given the replay throughput that we measured.
+ *
+ * Crash recovery replays the WAL written since the redo point of the last
+ * checkpoint. A checkpoint happens when max_wal_size worth of WAL has been
+ * written, so that is replayed in max_wal_size / replayRate seconds. A
+ * checkpoint also spreads its writes over up to checkpoint_timeout, so the
+ * WAL to replay may have been written in twice checkpoint_timeout, and a
+ * standby that keeps up replays it in no more time than that.
+ *
+ * A primary keeps the replay rate it measured while it was a standby.
+ */
+bool
+keeper_maintain_recovery_target(Keeper *keeper)
+{
+	KeeperConfig *config = &(keeper->config);
+	KeeperStateData *state = &(keeper->state);
+	LocalPostgresServer *postgres = &(keeper->postgres);
+	PGSQL *pgsql = &(postgres->sqlClient);
+
+	int targetRecoverySeconds = 0;
+
+	uint64_t now = time(NULL);
+
+	if (config->monitorDisabled ||
+		!postgres->pgIsRunning ||
+		(state->current_role != PRIMARY_STATE &&
+		 state->current_role != SECONDARY_STATE) ||
+		(now - keeper->recoveryTuningTime) < RECOVERY_TUNING_INTERVAL)
+	{
+		return true;
+	}
+
+	keeper->recoveryTuningTime = now;
+
+	if (!monitor_get_formation_target_recovery_seconds(&(keeper->monitor),
+													   config->formation,
+													   &targetRecoverySeconds))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (targetRecoverySeconds <= 0)
+	{
+		/* the target has been disabled, undo our settings */
+		if (keeper->appliedMaxWalSizeMB > 0)
+		{
+			log_info("Resetting max_wal_size and checkpoint_timeout, the "
+					 "formation \"%s\" has no recovery target anymore",
+					 config->formation);
+
+			if (!pgsql_reset_checkpoint_settings(pgsql))
+			{
+				/* errors have already been logged */
+				return false;
+			}
+
+			keeper->appliedMaxWalSizeMB = 0;
+			keeper->appliedCheckpointTimeout = 0;
+		}
+
+		return true;
+	}
+
+	if (keeper->replayRate <= 0)
+	{
+		log_debug("Not tuning checkpoints for a %ds recovery target yet: "
+				  "the WAL replay rate has not been measured",
+				  targetRecoverySeconds);
+		return true;
+	}
+
+	uint64_t maxWalSizeMB =
+		(uint64_t) (keeper->replayRate * targetRecoverySeconds) / (1024 * 1024);
+
+	if (maxWalSizeMB < RECOVERY_TUNING_MIN_MAX_WAL_SIZE_MB)
+	{
+		maxWalSizeMB = RECOVERY_TUNING_MIN_MAX_WAL_SIZE_MB;
+	}
+
+	int checkpointTimeout = targetRecoverySeconds / 2;
+
+	if (checkpointTimeout < RECOVERY_TUNING_MIN_CHECKPOINT_TIMEOUT)
+	{
+		checkpointTimeout = RECOVERY_TUNING_MIN_CHECKPOINT_TIMEOUT;
+	}
+	else if (checkpointTimeout > RECOVERY_TUNING_MAX_CHECKPOINT_TIMEOUT)
+	{
+		checkpointTimeout = RECOVERY_TUNING_MAX_CHECKPOINT_TIMEOUT;
+	}
+
+	/* avoid reloading Postgres for small changes of the measured rate */
+	uint64_t applied = keeper->appliedMaxWalSizeMB;
+	uint64_t delta =
+		maxWalSizeMB > applied ? maxWalSizeMB - applied : applied - maxWalSizeMB;
+
+	if (applied > 0 &&
+		delta * 10 < applied &&
+		checkpointTimeout == keeper->appliedCheckpointTimeout)
+	{
+		return true;
+	}
+
+	log_info("Setting max_wal_size to %lluMB and checkpoint_timeout to %ds "
+			 "for a recovery target of %ds at %.1f MB/s of WAL replay",
+			 (unsigned long long) maxWalSizeMB,
+			 checkpointTimeout,
+			 targetRecoverySeconds,
+			 keeper->replayRate / (1024 * 1024));
+
+	if (!pgsql_set_checkpoint_settings(pgsql, maxWalSizeMB, checkpointTimeout))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	keeper->appliedMaxWalSizeMB = maxWalSizeMB;
+	keeper->appliedCheckpointTimeout = checkpointTimeout;
+
+	return true;
+}
+
+
+/*
+ * keeper_maintain_slot_retention reports to the monitor how much WAL each of
+ * our replication slots retains, when the formation has a
+ * slot_retention_budget_mb. The monitor assigns wait_standby to a node that
+ * makes the primary retain more WAL than that, so that the node is cloned
+ * again, and then asks us to drop its slot.
+ *
+ * We only drop inactive slots: a node that streams from its slot is going to
+ * stop doing so to be cloned again. The primary creates the slot again at the
+ * current WAL position in its next keeper loop, so that the node has a slot
+ * for its clone, and the slot never retains more than the budget.
+ */
+bool
+keeper_maintain_slot_retention(Keeper *keeper)
+{
+	KeeperConfig *config = &(keeper->config);
+	KeeperStateData *state = &(keeper->state);
+	LocalPostgresServer *postgres = &(keeper->postgres);
+	PGSQL *pgsql = &(postgres->sqlClient);
+
+	ReplicationSlotRetentionArray slotsArray = { 0 };
+	int budgetMB = 0;
+
+	uint64_t now = time(NULL);
+
+	if (config->monitorDisabled ||
+		!postgres->pgIsRunning ||
+		(state->current_role != PRIMARY_STATE &&
+		 state->current_role != SECONDARY_STATE) ||
+		(now - keeper->slotRetentionTime) < SLOT_RETENTION_INTERVAL)
+	{
+		return true;
+	}
+
+	keeper->slotRetentionTime = now;
+
+	if (!monitor_get_formation_slot_retention_budget(&(keeper->monitor),
+													 config->formation,
+													 &budgetMB))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (budgetMB <= 0)
+	{
+		return true;
+	}
+
+	if (!pgsql_replication_slot_retention(pgsql, &slotsArray))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	for (int index = 0; index < slotsArray.count; index++)
+	{
+		ReplicationSlotRetention *slot = &(slotsArray.slots[index]);
+		bool dropSlot = false;
+
+		if (!monitor_report_slot_retention(&(keeper->monitor),
+										   state->current_node_id,
+										   slot->nodeId,
+										   slot->retainedBytes,
+										   &dropSlot))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+
+		if (!dropSlot)
+		{
+			continue;
+		}
+
+		if (slot->active)
+		{
+			log_warn("The replication slot of node %" PRId64 " retains "
+					 "%" PRId64 " MB of WAL, over the budget of %d MB of "
+					 "formation \"%s\", and is still in use",
+					 slot->nodeId,
+					 slot->retainedBytes / (1024 * 1024),
+					 budgetMB,
+					 config->formation);
+			continue;
+		}
+
+		char slotName[BUFSIZE] = { 0 };
+
+		(void) postgres_sprintf_replicationSlotName(slot->nodeId,
+													slotName,
+													sizeof(slotName));
+
+		log_warn("The replication slot of node %" PRId64 " retains "
+				 "%" PRId64 " MB of WAL, over the budget of %d MB of "
+				 "formation \"%s\": the node is going to be cloned again",
+				 slot->nodeId,
+				 slot->retainedBytes / (1024 * 1024),
+				 budgetMB,
+				 config->formation);
+
+		if (!pgsql_drop_replication_slot(pgsql, slotName))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * keeper_maintain_wal_compression applies the wal_compression method that the
+ * monitor assigns to our node: the remote-wal-compression of the formation
+ * when our group has nodes in another cluster, where the WAL stream crosses a
+ * slower and costlier network link, and "off" otherwise.
+ *
+ * Before Postgres 15 wal_compression is a boolean that compresses full page
+ * images with pglz, and a Postgres build might not support lz4 or zstd: in
+ * both cases we fall back to the method that we can use. We only reset the
+ * setting when we applied it ourselves, so that a wal_compression set by the
+ * user in postgresql.conf is left alone.
+ */
+bool
+keeper_maintain_wal_compression(Keeper *keeper)
+{
+	KeeperConfig *config = &(keeper->config);
+	KeeperStateData *state = &(keeper->state);
+	LocalPostgresServer *postgres = &(keeper->postgres);
+	PostgresSetup *pgSetup = &(postgres->postgresSetup);
+	PGSQL *pgsql = &(postgres->sqlClient);
+
+	char method[NAMEDATALEN] = { 0 };
+	char policy[NAMEDATALEN] = { 0 };
+	int pg_version = 0;
+
+	uint64_t now = time(NULL);
+
+	if (config->monitorDisabled ||
+		!postgres->pgIsRunning ||
+		(state->current_role != PRIMARY_STATE &&
+		 state->current_role != SECONDARY_STATE) ||
+		(now - keeper->walCompressionTime) < WAL_COMPRESSION_INTERVAL)
+	{
+		return true;
+	}
+
+	keeper->walCompressionTime = now;
+
+	if (!monitor_get_node_wal_compression(&(keeper->monitor),
+										  state->current_node_id,
+										  method,
+										  sizeof(method)))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (streq(method, "off"))
+	{
+		if (IS_EMPTY_STRING_BUFFER(keeper->appliedWalCompression))
+		{
+			return true;
+		}
+
+		log_info("Resetting wal_compression, no node of group %d "
+				 "is in another cluster",
+				 state->current_group);
+
+		if (!pgsql_reset_wal_compression(pgsql))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+
+		keeper->appliedWalCompression[0] = '\0';
+
+		return true;
+	}
+
+	/* we remember the policy rather than the fallback we might have used */
+	if (streq(method, keeper->appliedWalCompression))
+	{
+		return true;
+	}
+
+	strlcpy(policy, method, sizeof(policy));
+
+	if (parse_pg_version_string(pgSetup->pg_version, &pg_version) &&
+		pg_version < 150000)
+	{
+		strlcpy(method, "on", sizeof(method));
+	}
+
+	log_info("Setting wal_compression to %s, group %d streams WAL "
+			 "to another cluster",
+			 method,
+			 state->current_group);
+
+	if (!pgsql_set_wal_compression(pgsql, method))
+	{
+		if (streq(method, "on") || streq(method, "pglz"))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+
+		log_warn("Postgres does not support wal_compression %s, "
+				 "using pglz instead",
+				 method);
+
+		strlcpy(method, "pglz", sizeof(method));
+
+		if (!pgsql_set_wal_compression(pgsql, method))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+	}
+
+	strlcpy(keeper->appliedWalCompression, policy,
+			sizeof(keeper->appliedWalCompression));
+
+	return true;
+}
+
+
+
+/*
+ * keeper_maintain_inventory reports to the monitor the versions and the key
+ * settings of the node, so that pgautofailover.node_inventory answers fleet
+ * wide questions with a single query. We compute the inventory every
+ * NODE_INVENTORY_INTERVAL seconds, and only send it when it changed since our
+ * last report.
+ *
+ * Hooks commands and connection strings might contain secrets, we only report
+ * whether they are set.
+ */
+bool
+keeper_maintain_inventory(Keeper *keeper)
+{
+	KeeperConfig *config = &(keeper->config);
+	KeeperStateData *state = &(keeper->state);
+	LocalPostgresServer *postgres = &(keeper->postgres);
+	PostgresSetup *pgSetup = &(postgres->postgresSetup);
+
+	char settingsHash[BUFSIZE] = { 0 };
+	uint64_t fingerprint = UINT64_C(0xcbf29ce484222325);
+
+	uint64_t now = time(NULL);
+
+	if (config->monitorDisabled ||
+		!postgres->pgIsRunning ||
+		(now - keeper->inventoryTime) < NODE_INVENTORY_INTERVAL)
+	{
+		return true;
+	}
+
+	keeper->inventoryTime = now;
+
+	if (!pgsql_get_settings_hash(&(postgres->sqlClient),
+								 settingsHash,
+								 sizeof(settingsHash)))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	JSON_Value *js = json_value_init_object();
+	JSON_Object *jsObj = json_value_get_object(js);
+
+	json_object_set_string(jsObj, "postgresql.hba_level",
+						   config->pgSetup.hbaLevelStr);
+	json_object_set_string(jsObj, "ssl.sslmode",
+						   config->pgSetup.ssl.sslModeStr);
+	json_object_set_string(jsObj, "citus.role", config->citusRoleStr);
+	json_object_set_string(jsObj, "replication.maximum_backup_rate",
+						   config->maximum_backup_rate);
+	json_object_set_number(jsObj, "timeout.network_partition_timeout",
+						   (double) config->network_partition_timeout);
+	json_object_set_number(jsObj, "timeout.standby_drain_timeout",
+						   (double) config->standby_drain_timeout);
+	json_object_set_number(jsObj, "monitor.call_timeout",
+						   (double) config->monitor_call_timeout);
+	json_object_set_number(jsObj, "monitor.keepalive",
+						   (double) config->monitor_keepalive);
+	json_object_set_number(jsObj, "topology.snapshot",
+						   (double) config->topology_snapshot);
+	json_object_set_boolean(jsObj, "hooks.on_primary",
+							!IS_EMPTY_STRING_BUFFER(config->hooks_on_primary));
+	json_object_set_boolean(jsObj, "hooks.on_demote",
+							!IS_EMPTY_STRING_BUFFER(config->hooks_on_demote));
+	json_object_set_boolean(jsObj, "hooks.pgbouncer",
+							!IS_EMPTY_STRING_BUFFER(config->hooks_pgbouncer));
+
+	char *settings = json_serialize_to_string(js);
+
+	(void) keeper_fingerprint_add_string(&fingerprint, PG_AUTOCTL_VERSION);
+	(void) keeper_fingerprint_add_string(&fingerprint, pgSetup->pg_version);
+	(void) keeper_fingerprint_add_string(&fingerprint,
+										 config->pgSetup.tuningProfile);
+	(void) keeper_fingerprint_add_string(&fingerprint, settingsHash);
+	(void) keeper_fingerprint_add_string(&fingerprint, settings);
+
+	if (keeper->inventoryFingerprintKnown &&
+		keeper->inventoryFingerprint == fingerprint)
+	{
+		json_free_serialized_string(settings);
+		json_value_free(js);
+
+		return true;
+	}
+
+	bool success =
+		monitor_report_node_inventory(&(keeper->monitor),
+									  state->current_node_id,
+									  PG_AUTOCTL_VERSION,
+									  pgSetup->pg_version,
+									  config->pgSetup.tuningProfile,
+									  settingsHash,
+									  settings);
+
+	json_free_serialized_string(settings);
+	json_value_free(js);
+
+	if (success)
+	{
+		log_debug("Reported node inventory to the monitor, "
+				  "Postgres settings hash %s",
+				  settingsHash);
+
+		keeper->inventoryFingerprint = fingerprint;
+		keeper->inventoryFingerprintKnown = true;
+	}
+
+	return success;
+}
+
+
+/*
+ * keeper_crash_recovery_progress is called by postgres_maybe_do_crash_recovery
+ * while Postgres is in crash recovery. We keep the progress in our state file,
+ * where pg_autoctl show state finds it, and report it to the monitor, which
+ * may ask us to stop recovery and clone the node again instead.
+ */
+static bool
+keeper_crash_recovery_progress(void *context,
+							   CrashRecoveryProgress *progress,
+							   bool *stopRecovery)
+{
+	Keeper *keeper = (Keeper *) context;
+	KeeperConfig *config = &(keeper->config);
+	KeeperStateData *state = &(keeper->state);
+
+	if (progress->done)
+	{
+		state->crash_recovery_start_time = 0;
+		state->crash_recovery_update_time = 0;
+		state->crash_recovery_start_lsn = 0;
+		state->crash_recovery_replay_lsn = 0;
+		state->crash_recovery_end_lsn = 0;
+		state->crash_recovery_eta = 0;
+	}
+	else
+	{
+		state->crash_recovery_start_time = progress->startTime;
+		state->crash_recovery_update_time = progress->updateTime;
+		state->crash_recovery_start_lsn = progress->startLSN;
+		state->crash_recovery_replay_lsn = progress->replayLSN;
+		state->crash_recovery_end_lsn = progress->endLSN;
+		state->crash_recovery_eta = progress->eta;
+	}
+
+	if (!keeper_store_state(keeper))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (config->monitorDisabled)
+	{
+		return true;
+	}
+
+	/* once done, a stop request from the monitor is moot */
+	bool stop = false;
+
+	if (!monitor_report_crash_recovery(&(keeper->monitor),
+									   state->current_node_id,
+									   progress->startLSN,
+									   progress->replayLSN,
+									   progress->endLSN,
+									   progress->eta,
+									   &stop))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (!progress->done)
+	{
+		*stopRecovery = stop;
+	}
+
+	return true;
+}
+
+
+/*
+ * keeper_rewind_progress is the rewind hook of our LocalPostgresServer. We
+ * keep the estimate and progress of pg_rewind in our state file, where
+ * pg_autoctl show state finds it, and report it to the monitor, which may ask
+ * us to clone the node again rather than running pg_rewind.
+ */
+static bool
+keeper_rewind_progress(void *context, RewindProgress *progress,
+					   bool *cloneRather)
+{
+	Keeper *keeper = (Keeper *) context;
+	KeeperConfig *config = &(keeper->config);
+	KeeperStateData *state = &(keeper->state);
+
+	if (progress->done)
+	{
+		state->rewind_start_time = 0;
+		state->rewind_update_time = 0;
+		state->rewind_divergence_bytes = 0;
+		state->rewind_database_bytes = 0;
+		state->rewind_done_bytes = 0;
+		state->rewind_total_bytes = 0;
+	}
+	else
+	{
+		state->rewind_start_time = progress->startTime;
+		state->rewind_update_time = progress->updateTime;
+		state->rewind_divergence_bytes = progress->divergenceBytes;
+		state->rewind_database_bytes = progress->databaseBytes;
+		state->rewind_done_bytes = progress->doneBytes;
+		state->rewind_total_bytes = progress->totalBytes;
+	}
+
+	if (!keeper_store_state(keeper))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (config->monitorDisabled)
+	{
+		return true;
+	}
+
+	/* pg_rewind reports every second, we tell the monitor every 5s */
+	bool estimate = progress->totalBytes == 0 && !progress->done;
+
+	if (!estimate && !progress->done &&
+		progress->updateTime < keeper->rewindReportTime + 5)
+	{
+		return true;
+	}
+
+	keeper->rewindReportTime = progress->updateTime;
+
+	return monitor_report_rewind(&(keeper->monitor),
+								 state->current_node_id,
+								 progress->divergenceBytes,
+								 progress->databaseBytes,
+								 progress->doneBytes,
+								 progress->totalBytes,
+								 cloneRather);
+}
+
+
+/*
+ * keeper_ensure_lsn_token_functions creates or upgrades the functions that
+ * applications use to read their own writes from a standby node, see
+ * pgsql_create_lsn_token_functions(). We do that once each time the keeper
+ * reaches a primary state, which also covers the nodes that were initialized
+ * with a previous version of pg_autoctl, and the standby nodes get the
+ * functions through replication.
+ */
+bool
+keeper_ensure_lsn_token_functions(Keeper *keeper)
+{
+	LocalPostgresServer *postgres = &(keeper->postgres);
+
+	if (keeper->lsnTokenFunctionsReady || !postgres->pgIsRunning)
+	{
+		return true;
+	}
+
+	log_info("CREATE FUNCTION pgautofailover.lsn_token(), "
+			 "pgautofailover.wait_for_lsn();");
+
+	if (!pgsql_create_lsn_token_functions(&(postgres->sqlClient)))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	keeper->lsnTokenFunctionsReady = true;
+
+	return true;
+}
+
+
+/*
+ * keeper_maintain_upstream makes sure that a secondary node streams WAL from
+ * the upstream node that the monitor assigns: the primary node, or a
+ * secondary node of the same node cluster when the monitor has
+ * pgautofailover.cascade_by_cluster enabled.
+ *
+ * The upstream node of each node is part of the group topology, so we only
+ * ask the monitor again when the topology version has changed.
+ */
+bool
+keeper_maintain_upstream(Keeper *keeper)
+{
+	KeeperConfig *config = &(keeper->config);
+	KeeperStateData *state = &(keeper->state);
+	LocalPostgresServer *postgres = &(keeper->postgres);
+	PostgresSetup *pgSetup = &(postgres->postgresSetup);
+	ReplicationSource *upstream = &(postgres->replicationSource);
+
+	NodeAddress upstreamNode = { 0 };
+
+	if (config->monitorDisabled || !keeper->otherNodesVersionKnown)
+	{
+		return true;
+	}
+
+	if (keeper->upstreamVersionKnown &&
+		keeper->upstreamVersion == keeper->otherNodesVersion)
+	{
+		return true;
+	}
+
+	if (!monitor_get_upstream(&(keeper->monitor),
+							  state->current_node_id,
+							  &upstreamNode))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (upstreamNode.nodeId == upstream->primaryNode.nodeId &&
+		streq(upstreamNode.host, upstream->primaryNode.host) &&
+		upstreamNode.port == upstream->primaryNode.port)
+	{
+		keeper->upstreamVersion = keeper->otherNodesVersion;
+		keeper->upstreamVersionKnown = true;
+
+		return true;
+	}
+
+	/* either recovery.conf or AUTOCTL_STANDBY_CONF_FILENAME */
+	char *relativeConfPathName =
+		state->pg_control_version < 1200
+		? "recovery.conf"
+		: AUTOCTL_STANDBY_CONF_FILENAME;
+
+	char upstreamConfPath[MAXPGPATH] = { 0 };
+
+	char *currentConfContents = NULL;
+	long currentConfSize = 0L;
+
+	char *newConfContents = NULL;
+	long newConfSize = 0L;
+
+	join_path_components(upstreamConfPath,
+						 pgSetup->pgdata,
+						 relativeConfPathName);
+
+	if (file_exists(upstreamConfPath))
+	{
+		if (!read_file(upstreamConfPath,
+					   &currentConfContents,
+					   &currentConfSize))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+	}
+
+	if (!standby_init_replication_source(postgres,
+										 &upstreamNode,
+										 PG_AUTOCTL_REPLICA_USERNAME,
+										 config->replication_password,
+										 config->replication_slot_name,
+										 config->maximum_backup_rate,
+										 config->backupDirectory,
+										 NULL, /* no targetLSN */
+										 config->pgSetup.ssl,
+										 state->current_node_id))
+	{
+		/* can't happen at the moment */
+		free(currentConfContents);
+		return false;
+	}
+
+	if (!pg_setup_standby_mode(state->pg_control_version,
+							   pgSetup->pgdata,
+							   pgSetup->pg_ctl,
+							   upstream))
+	{
+		log_error("Failed to setup Postgres to stream from node " NODE_FORMAT,
+				  upstreamNode.nodeId, upstreamNode.name,
+				  upstreamNode.host, upstreamNode.port);
+		free(currentConfContents);
+		return false;
+	}
+
+	if (!read_file(upstreamConfPath, &newConfContents, &newConfSize))
+	{
+		/* errors have already been logged */
+		free(currentConfContents);
+		return false;
+	}
+
+	/* when the keeper restarts, Postgres might already use that upstream */
+	bool replicationSettingsHaveChanged =
+		currentConfContents == NULL ||
+		strcmp(newConfContents, currentConfContents) != 0;
+
+	free(currentConfContents);
+	free(newConfContents);
+
+	if (replicationSettingsHaveChanged)
+	{
+		log_info("Streaming from node " NODE_FORMAT " as assigned by "
+				 "the monitor",
+				 upstreamNode.nodeId, upstreamNode.name,
+				 upstreamNode.host, upstreamNode.port);
+
+		(void) keeper_drain_standby(keeper);
+
+		bool restarted =
+			standby_restart_with_current_replication_source(postgres);
+
+		(void) keeper_drain_standby_done(keeper);
+
+		if (!restarted)
+		{
+			log_error("Failed to stream from node " NODE_FORMAT
+					  ", see above for details",
+					  upstreamNode.nodeId, upstreamNode.name,
+					  upstreamNode.host, upstreamNode.port);
+			return false;
+		}
+	}
+
+	keeper->upstreamVersion = keeper->otherNodesVersion;
+	keeper->upstreamVersionKnown = true;
+
+	return true;
+}
+
+
+/*
+ * keeper_node_active calls pgautofailover.node_active on the monitor.
+ */
+bool
+keeper_node_active(Keeper *keeper, bool doInit,
+				   MonitorAssignedState *assignedState)
+{
+	return keeper_node_active_internal(keeper, doInit, assignedState,
+									   NULL, NULL);
+}
+
+
+/*
+ * keeper_node_active_get_other_nodes calls pgautofailover.node_active on the
+ * monitor, and fetches the list of other nodes in the same network round
+ * trip. When the list of other nodes could not be fetched, *otherNodesOK is
+ * set to false.
+ */
+bool
+keeper_node_active_get_other_nodes(Keeper *keeper, bool doInit,
+								   MonitorAssignedState *assignedState,
+								   NodeAddressArray *otherNodesArray,
+								   bool *otherNodesOK)
+{
+	return keeper_node_active_internal(keeper, doInit, assignedState,
+									   otherNodesArray, otherNodesOK);
+}
+
+
+/*
+ * keeper_node_active_internal implements keeper_node_active, and also fetches
+ * the other nodes from the monitor when otherNodesArray is not NULL.
+ */
+static bool
+keeper_node_active_internal(Keeper *keeper, bool doInit,
+							MonitorAssignedState *assignedState,
+							NodeAddressArray *otherNodesArray,
+							bool *otherNodesOK)
+{
+	Monitor *monitor = &(keeper->monitor);
+	KeeperConfig *config = &(keeper->config);
+	KeeperStateData *keeperState = &(keeper->state);
+	LocalPostgresServer *postgres = &(keeper->postgres);
+
+	bool reportPgIsRunning = ReportPgIsRunning(keeper);
+
+	/*
+	 * First, connect to the monitor and check we're compatible with the
+	 * extension there. An upgrade on the monitor might have happened in
+	 * between loops here.
+	 *
+	 * Note that we don't need a very strong a guarantee about the version
+	 * number of the monitor extension, as we have other places in the code
+	 * that are protected against "suprises". The worst case would be a race
+	 * condition where the extension check passes, and then the monitor is
+	 * upgraded, and then we call node_active().
+	 *
+	 *  - The extension on the monitor is protected against running a version
+	 *    of the node_active (or any other) function that does not match with
+	 *    the SQL level version.
+	 *
+	 *  - Then, if we changed the API without changing the arguments, that
+	 *    means we changed what we may return. We are protected against changes
+	 *    in number of return values, so we're left with changes within the
+	 *    columns themselves. Basically that's a new state that we don't know
+	 *    how to handle. In that case we're going to fail to parse it, and at
+	 *    next attempt we're going to catch up with the new version number.
+	 *
+	 * All in all, the worst case is going to be one extra call before we
+	 * restart node active process, and an extra error message in the logs
+	 * during the live upgrade of pg_auto_failover.
+	 */
+	MonitorExtensionVersion monitorVersion = { 0 };
+
+	if (!keeper_check_monitor_extension_version(keeper, &monitorVersion))
+	{
+		/*
+		 * We could fail here for two different reasons:
+		 *
+		 * - if we failed to connect to the monitor (network split, monitor is
+		 *   in maintenance or being restarted, etc): in that case just return
+		 *   false and have the main loop handle the situation
+		 *
+		 * - if we could connect to the monitor and then failed to check that
+		 *   the version of the monitor is the one we expect, then we're not
+		 *   compatible with this monitor and that's a different story.
+		 */
+		if (monitor->pgsql.status != PG_CONNECTION_OK)
+		{
+			return false;
+		}
+
+		/*
+		 * Okay we're not compatible with the current version of the
+		 * pgautofailover extension on the monitor. The most plausible scenario
+		 * is that the monitor got update: we're still running e.g. 1.4 and the
+		 * monitor is running 1.5.
+		 *
+		 * In that case we exit, and because the keeper node-active service is
+		 * RP_PERMANENT the supervisor is going to restart this process. The
+		 * restart happens with fork() and exec(), so it uses the current
+		 * version of pg_autoctl binary on disk, which has been updated to e.g.
+		 * 1.5 too.
+		 *
+		 * TL;DR: just exit now, have the service restarted by the supervisor
+		 * with the expected version of pg_autoctl that matches the monitor's
+		 * extension version.
+		 */
+		KeeperVersion keeperVersion = { 0 };
+
+		if (!keeper_pg_autoctl_get_version_from_disk(keeper, &keeperVersion))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+
+		/*
+		 * Only call exit() when the on-disk pg_autoctl required extension
+		 * version matches the current monitor extension version, ensuring that
+		 * the restart is going to be effective.
+		 */
+		if (strcmp(monitorVersion.installedVersion,
+				   keeperVersion.required_extension_version) == 0)
+		{
+			log_info("pg_autoctl version \"%s\" with compatibility with "
+					 "monitor extension \"%s\" has been found on-disk, "
+					 "exiting for a restart of the node-active process.",
+					 keeperVersion.pg_autoctl_version,
+					 keeperVersion.required_extension_version);
+			exit(EXIT_CODE_MONITOR);
 		}
 
 		/*
@@ -1301,19 +2949,55 @@ keeper_node_active(Keeper *keeper, bool doInit,
 	/* ensure we use the correct retry policy with the monitor */
 	(void) pgsql_set_main_loop_retry_policy(&(monitor->pgsql.retryPolicy));
 
+	/* only use the group settings from a successful call */
+	keeper->groupSettings.hasPrimary = false;
+	keeper->groupSettings.hasSynchronousStandbyNames = false;
+
 	/*
 	 * Report the current state to the monitor and get the assigned state.
 	 */
-	return monitor_node_active(monitor,
-							   config->formation,
-							   keeperState->current_node_id,
-							   keeperState->current_group,
-							   keeperState->current_role,
-							   reportPgIsRunning,
-							   postgres->postgresSetup.control.timeline_id,
-							   postgres->currentLSN,
-							   postgres->pgsrSyncState,
-							   assignedState);
+	bool success = false;
+
+	if (otherNodesArray != NULL)
+	{
+		success = monitor_node_active_get_other_nodes(
+			monitor,
+			config->formation,
+			keeperState->current_node_id,
+			keeperState->current_group,
+			keeperState->current_role,
+			reportPgIsRunning,
+			postgres->postgresSetup.control.timeline_id,
+			postgres->currentLSN,
+			postgres->replayLSN,
+			postgres->pgsrSyncState,
+			&(postgres->standbyLSNs),
+			assignedState,
+			otherNodesArray,
+			otherNodesOK);
+	}
+	else
+	{
+		success = monitor_node_active(monitor,
+									  config->formation,
+									  keeperState->current_node_id,
+									  keeperState->current_group,
+									  keeperState->current_role,
+									  reportPgIsRunning,
+									  postgres->postgresSetup.control.timeline_id,
+									  postgres->currentLSN,
+									  postgres->replayLSN,
+									  postgres->pgsrSyncState,
+									  &(postgres->standbyLSNs),
+									  assignedState);
+	}
+
+	if (success)
+	{
+		keeper->groupSettings = assignedState->groupSettings;
+	}
+
+	return success;
 }
 
 
@@ -1332,7 +3016,7 @@ keeper_ensure_node_has_been_dropped(Keeper *keeper, bool *dropped)
 
 	*dropped = false;
 
-	if (!keeper_state_read(keeperState, config->pathnames.state))
+	if (!keeper_load_state(keeper))
 	{
 		/* errors have already been logged */
 		return false;
@@ -1353,14 +3037,20 @@ keeper_ensure_node_has_been_dropped(Keeper *keeper, bool *dropped)
 		log_error("Failed to query monitor to see if node id %d "
 				  "has been dropped already",
 				  keeperState->current_node_id);
+		nodeAddressArrayFree(&nodesArray);
 		return false;
 	}
 
+	/* we only need to know how many nodes have been found */
+	int nodesCount = nodesArray.count;
+
+	nodeAddressArrayFree(&nodesArray);
+
 	log_debug("keeper_node_has_been_dropped: found %d node by id %d",
-			  nodesArray.count,
+			  nodesCount,
 			  keeperState->current_node_id);
 
-	if (nodesArray.count == 0)
+	if (nodesCount == 0)
 	{
 		/* no node found with our nodeid, the drop has been successfull */
 		*dropped = true;
@@ -1374,7 +3064,7 @@ keeper_ensure_node_has_been_dropped(Keeper *keeper, bool *dropped)
 
 		return keeper_store_state(keeper);
 	}
-	else if (nodesArray.count == 1)
+	else if (nodesCount == 1)
 	{
 		bool doInit = false;
 		MonitorAssignedState assignedState = { 0 };
@@ -1418,33 +3108,104 @@ keeper_ensure_node_has_been_dropped(Keeper *keeper, bool *dropped)
 			{
 				*dropped = true;
 
-				/*
-				 * Call node_active one last time now: after being assigned
-				 * DROPPED, we need to report we reached the state for the
-				 * monitor to actually drop this node.
-				 */
-				(void) keeper_update_pg_state(keeper, LOG_DEBUG);
+				/*
+				 * Call node_active one last time now: after being assigned
+				 * DROPPED, we need to report we reached the state for the
+				 * monitor to actually drop this node.
+				 */
+				(void) keeper_update_pg_state(keeper, LOG_DEBUG);
+
+				if (!keeper_node_active(keeper, doInit, &assignedState))
+				{
+					/* errors have already been logged */
+					return false;
+				}
+			}
+			return true;
+		}
+
+		/* we did all the checks we're supposed to, dropped is false */
+		return true;
+	}
+	else
+	{
+		log_error("BUG: monitor_find_node_by_nodeid returned %d nodes",
+				  nodesCount);
+		return false;
+	}
+
+	return false;
+}
+
+
+/*
+ * keeper_follow_formation_directory checks whether our formation has been
+ * moved to another monitor, as registered in the formation directory of our
+ * monitor by pg_autoctl perform move-formation. When that's the case, we
+ * connect to the new monitor from now on, and edit our configuration file so
+ * that we keep doing so after a restart. It returns true when we changed
+ * monitor.
+ */
+bool
+keeper_follow_formation_directory(Keeper *keeper)
+{
+	KeeperConfig *config = &(keeper->config);
+	char monitorURI[MAXCONNINFO] = { 0 };
+
+	if (config->monitorDisabled)
+	{
+		return false;
+	}
+
+	if (!monitor_get_formation_monitor(&(keeper->monitor),
+									   config->formation,
+									   monitorURI,
+									   sizeof(monitorURI)))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (IS_EMPTY_STRING_BUFFER(monitorURI) ||
+		streq(monitorURI, config->monitor_pguri))
+	{
+		return false;
+	}
 
-				if (!keeper_node_active(keeper, doInit, &assignedState))
-				{
-					/* errors have already been logged */
-					return false;
-				}
-			}
-			return true;
-		}
+	Monitor monitor = { 0 };
 
-		/* we did all the checks we're supposed to, dropped is false */
-		return true;
+	if (!monitor_init(&monitor, monitorURI))
+	{
+		log_warn("Formation \"%s\" has moved to another monitor, "
+				 "but its connection string is invalid, "
+				 "see above for details",
+				 config->formation);
+		return false;
 	}
-	else
+
+	log_info("Formation \"%s\" is now managed by the monitor at \"%s\"",
+			 config->formation, monitorURI);
+
+	pgsql_finish(&(keeper->monitor.pgsql));
+	pgsql_finish(&(keeper->monitor.notificationClient));
+
+	if (!monitor_init(&(keeper->monitor), monitorURI))
 	{
-		log_error("BUG: monitor_find_node_by_nodeid returned %d nodes",
-				  nodesArray.count);
+		/* we just checked the connection string, but... */
 		return false;
 	}
 
-	return false;
+	strlcpy(config->monitor_pguri, monitorURI, sizeof(config->monitor_pguri));
+
+	if (!keeper_config_write_file(config))
+	{
+		log_warn("Failed to write the new monitor connection string to "
+				 "the configuration file \"%s\", pg_autoctl is going to "
+				 "connect to the previous monitor again after a restart",
+				 config->pathnames.config);
+	}
+
+	return true;
 }
 
 
@@ -1620,6 +3381,16 @@ keeper_register_and_init(Keeper *keeper, NodeState initialState)
 		return false;
 	}
 
+	/*
+	 * When the node has been registered in advance on the monitor, with
+	 * pgautofailover.register_nodes(), pg_autoctl create --node-id adopts the
+	 * existing registration rather than adding a new node.
+	 */
+	if (monitorDisabledNodeId > 0)
+	{
+		keeper->state.current_node_id = monitorDisabledNodeId;
+	}
+
 	/*
 	 * We implement a specific retry policy for cases where we have a transient
 	 * error on the monitor, such as OBJECT_IN_USE which indicates that another
@@ -1839,6 +3610,7 @@ keeper_register_again(Keeper *keeper)
 									 &pgSetup->is_in_recovery,
 									 keeper->postgres.pgsrSyncState,
 									 keeper->postgres.currentLSN,
+									 keeper->postgres.replayLSN,
 									 &(pgSetup->control)))
 	{
 		log_error("Failed to get the local Postgres metadata");
@@ -1957,6 +3729,7 @@ keeper_register_again(Keeper *keeper)
 										 &pgSetup->is_in_recovery,
 										 keeper->postgres.pgsrSyncState,
 										 keeper->postgres.currentLSN,
+										 keeper->postgres.replayLSN,
 										 &(pgSetup->control)))
 		{
 			log_error("Failed to get the local Postgres metadata");
@@ -1973,7 +3746,9 @@ keeper_register_again(Keeper *keeper)
 								 ReportPgIsRunning(keeper),
 								 currentTLI,
 								 keeper->postgres.currentLSN,
+								 keeper->postgres.replayLSN,
 								 keeper->postgres.pgsrSyncState,
+								 NULL,
 								 &assignedState))
 		{
 			++errors;
@@ -2062,6 +3837,7 @@ keeper_update_group_hba(Keeper *keeper, NodeAddressArray *diffNodesArray)
 
 	char hbaFilePath[MAXPGPATH] = { 0 };
 	char *authMethod = pg_setup_get_auth_method(postgresSetup);
+	bool hbaChanged = false;
 
 	/* early exit when we're alone in the group */
 	if (diffNodesArray->count == 0)
@@ -2083,7 +3859,8 @@ keeper_update_group_hba(Keeper *keeper, NodeAddressArray *diffNodesArray)
 									   postgresSetup->dbname,
 									   PG_AUTOCTL_REPLICA_USERNAME,
 									   authMethod,
-									   keeper->config.pgSetup.hbaLevel))
+									   keeper->config.pgSetup.hbaLevel,
+									   &hbaChanged))
 	{
 		log_error("Failed to edit HBA file \"%s\" to update rules to current "
 				  "list of nodes registered on the monitor",
@@ -2092,12 +3869,11 @@ keeper_update_group_hba(Keeper *keeper, NodeAddressArray *diffNodesArray)
 	}
 
 	/*
-	 * Only reload if Postgres is known to be running. If it's not running, we
-	 * edited the HBA and it's going to take effect at next restart of
-	 * Postgres, so we're good here.
+	 * Only reload if we changed the HBA file and Postgres is known to be
+	 * running. If it's not running, we edited the HBA and it's going to take
+	 * effect at next restart of Postgres, so we're good here.
 	 */
-	if (keeper->config.pgSetup.hbaLevel >= HBA_EDIT_MINIMAL &&
-		pg_setup_is_running(postgresSetup))
+	if (hbaChanged && pg_setup_is_running(postgresSetup))
 	{
 		if (!pgsql_reload_conf(pgsql))
 		{
@@ -2159,9 +3935,11 @@ keeper_refresh_other_nodes(Keeper *keeper, bool forceCacheInvalidation)
 
 	if (success)
 	{
-		keeper->otherNodes = newNodesArray;
+		(void) nodeAddressArrayMove(&(keeper->otherNodes), &newNodesArray);
 	}
 
+	nodeAddressArrayFree(&newNodesArray);
+
 	return success;
 }
 
@@ -2177,6 +3955,9 @@ keeper_call_refresh_hooks(Keeper *keeper,
 						  bool forceCacheInvalidation)
 {
 	bool success = true;
+	KeeperProfileMark mark = { 0 };
+
+	(void) keeper_profile_begin(&mark);
 
 	for (int index = 0; KeeperRefreshHooks[index]; index++)
 	{
@@ -2187,6 +3968,8 @@ keeper_call_refresh_hooks(Keeper *keeper,
 		success = success && ret;
 	}
 
+	(void) keeper_profile_end(KEEPER_PROFILE_PHASE_REFRESH_HOOKS, &mark);
+
 	return success;
 }
 
@@ -2207,11 +3990,18 @@ keeper_refresh_hba(Keeper *keeper,
 	/* compute nodes that need an HBA change (new ones, new hostnames) */
 	if (forceCacheInvalidation)
 	{
-		diffNodesArray = *newNodesArray;
+		if (!nodeAddressArrayCopy(&diffNodesArray, newNodesArray))
+		{
+			/* errors have already been logged */
+			return false;
+		}
 	}
-	else
+	else if (!keeper_diff_nodes_array(otherNodesArray, newNodesArray,
+										 &diffNodesArray))
 	{
-		(void) diff_nodesArray(otherNodesArray, newNodesArray, &diffNodesArray);
+		/* errors have already been logged */
+		nodeAddressArrayFree(&diffNodesArray);
+		return false;
 	}
 
 	/*
@@ -2220,9 +4010,10 @@ keeper_refresh_hba(Keeper *keeper,
 	 */
 	if (newNodesArray->count == 0 || diffNodesArray.count == 0)
 	{
+		nodeAddressArrayFree(&diffNodesArray);
+
 		/* refresh the keeper's cache with the current other nodes array */
-		keeper->otherNodes = *newNodesArray;
-		return true;
+		return nodeAddressArrayCopy(otherNodesArray, newNodesArray);
 	}
 
 	log_info("Fetched current list of %d other nodes from the monitor "
@@ -2233,7 +4024,11 @@ keeper_refresh_hba(Keeper *keeper,
 	 * We have a new list of other nodes, update the HBA file. We only update
 	 * the nodes that we didn't know before, or that have a new host property.
 	 */
-	if (!keeper_update_group_hba(keeper, &diffNodesArray))
+	bool success = keeper_update_group_hba(keeper, &diffNodesArray);
+
+	nodeAddressArrayFree(&diffNodesArray);
+
+	if (!success)
 	{
 		log_error("Failed to update the HBA entries for the new "
 				  "elements in the our formation \"%s\" and group %d",
@@ -2248,83 +4043,134 @@ keeper_refresh_hba(Keeper *keeper,
 
 
 /*
- * diff_nodesArray computes the array of nodes entries that should be added in
- * the HBA file in the given pre-allocated diffNodesArray parameter. The diff
- * is computed from the keeper's otherNodesArray on the previous round, and the
- * one we just got from the monitor.
+ * keeper_diff_nodes_array computes the array of nodes entries that should be added in
+ * the HBA file in the given diffNodesArray parameter. The diff is computed
+ * from the keeper's otherNodesArray on the previous round, and the one we just
+ * got from the monitor.
+ *
+ * The previous nodes are indexed by nodeId in a small open addressing hash
+ * table, so that the diff costs a single pass over each array. Entries of
+ * previousNodesArray that are not found in currentNodesArray anymore are
+ * skipped: we don't know how to clean-up the HBA file entries at the moment
+ * anyway.
  */
-static void
-diff_nodesArray(NodeAddressArray *previousNodesArray,
-				NodeAddressArray *currentNodesArray,
-				NodeAddressArray *diffNodesArray)
+bool
+keeper_diff_nodes_array(NodeAddressArray *previousNodesArray,
+						NodeAddressArray *currentNodesArray,
+						NodeAddressArray *diffNodesArray)
 {
-	int prevIndex = 0;
-	int currIndex = 0;
-	int diffIndex = 0;
+	diffNodesArray->count = 0;
 
 	if (previousNodesArray->count == 0)
 	{
 		/* all the entries are new and we want them in diffNodesArray */
-		*diffNodesArray = *currentNodesArray;
-		return;
+		return nodeAddressArrayCopy(diffNodesArray, currentNodesArray);
 	}
 
-	/* we only care about the nodes in the current nodes array */
-	for (currIndex = 0; currIndex < currentNodesArray->count; currIndex++)
+	/* size the table as a power of two at least twice the entries count */
+	int size = 16;
+
+	while (size < 2 * previousNodesArray->count)
+	{
+		size *= 2;
+	}
+
+	NodeAddress **index = (NodeAddress **) calloc(size, sizeof(NodeAddress *));
+
+	if (index == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return false;
+	}
+
+	for (int prevIndex = 0; prevIndex < previousNodesArray->count; prevIndex++)
 	{
-		NodeAddress *currNode = &(currentNodesArray->nodes[currIndex]);
 		NodeAddress *prevNode = &(previousNodesArray->nodes[prevIndex]);
+		int slot = (int) ((uint64_t) prevNode->nodeId & (size - 1));
 
-		/* remember, the input arrays are sorted on nodeId */
-		if (currNode->nodeId < prevNode->nodeId)
+		while (index[slot] != NULL)
 		{
-			diffNodesArray->count++;
-			diffNodesArray->nodes[diffIndex++] = *currNode;
+			slot = (slot + 1) & (size - 1);
 		}
-		else if (currNode->nodeId == prevNode->nodeId)
-		{
-			/*
-			 * We still have to update our HBA file when the host of a node
-			 * that we already have has changed on the monitor.
-			 */
-			if (!streq(currNode->host, prevNode->host))
-			{
-				log_debug("Node %" PRId64 " has a new hostname \"%s\"",
-						  currNode->nodeId, currNode->host);
 
-				diffNodesArray->count++;
-				diffNodesArray->nodes[diffIndex++] = *currNode;
-			}
+		index[slot] = prevNode;
+	}
 
-			/*
-			 * In any case, if we have more elements in previousNodesArray,
-			 * advance our position there.
-			 */
-			if (prevIndex < previousNodesArray->count)
+	for (int currIndex = 0; currIndex < currentNodesArray->count; currIndex++)
+	{
+		NodeAddress *currNode = &(currentNodesArray->nodes[currIndex]);
+		NodeAddress *prevNode = NULL;
+		int slot = (int) ((uint64_t) currNode->nodeId & (size - 1));
+
+		for (; index[slot] != NULL; slot = (slot + 1) & (size - 1))
+		{
+			if (index[slot]->nodeId == currNode->nodeId)
 			{
-				prevIndex++;
+				prevNode = index[slot];
+				break;
 			}
 		}
-		else if (currNode->nodeId > prevNode->nodeId)
+
+		/*
+		 * We have to update our HBA file for new nodes, and also when the
+		 * host of a node that we already have has changed on the monitor.
+		 */
+		if (prevNode != NULL && streq(currNode->host, prevNode->host))
 		{
-			/*
-			 * All the remaining entries of currentNodesArray are new.
-			 *
-			 * We might have entries in previousNodesArray that are not found
-			 * in currentNodesArray anymore, but we don't know how to clean-up
-			 * the HBA file entries at the moment anyway, so we just skip them.
-			 */
-			diffNodesArray->count++;
-			diffNodesArray->nodes[diffIndex++] = *currNode;
+			continue;
+		}
 
-			break;
+		if (prevNode != NULL)
+		{
+			log_debug("Node %" PRId64 " has a new hostname \"%s\"",
+					  currNode->nodeId, currNode->host);
 		}
-		else
+
+		if (!nodeAddressArrayAppend(diffNodesArray, currNode))
+		{
+			/* errors have already been logged */
+			free(index);
+			return false;
+		}
+	}
+
+	free(index);
+
+	return true;
+}
+
+
+/*
+ * keeper_citus_topology_version returns a 64-bit FNV-1a hash of the
+ * properties of the formation nodes that pg_dist_node depends on: the group,
+ * the node cluster, the address, and whether the node is the stable primary of
+ * its group.
+ */
+static uint64_t
+keeper_citus_topology_version(CurrentNodeStateArray *nodesArray)
+{
+	uint64_t version = UINT64_C(0xcbf29ce484222325);
+
+	for (int i = 0; i < nodesArray->count; i++)
+	{
+		CurrentNodeState *nodeState = &(nodesArray->nodes[i]);
+		char topology[BUFSIZE] = { 0 };
+
+		sformat(topology, sizeof(topology), "%d|%s|%s|%d|%c\n",
+				nodeState->groupId,
+				nodeState->citusClusterName,
+				nodeState->node.host,
+				nodeState->node.port,
+				coordinator_node_is_stable_primary(nodeState) ? 't' : 'f');
+
+		for (char *ptr = topology; *ptr != '\0'; ptr++)
 		{
-			log_error("BUG in diff_nodesArray!");
-			return;
+			version ^= (unsigned char) *ptr;
+			version *= UINT64_C(0x100000001b3);
 		}
 	}
+
+	return version;
 }
 
 
@@ -2335,6 +4181,12 @@ diff_nodesArray(NodeAddressArray *previousNodesArray,
  * That's a "cache invalidation" mechanism that's useful when dropping a node
  * from the monitor while the node itself is not running anymore, and thus
  * won't be able to call citus.master_remove_node() for itself on its way out.
+ *
+ * The same pass also updates the pg_dist_node entries of worker groups that
+ * have completed a failover, batching the master_update_node() calls of many
+ * groups that failed over together in a single statement. Both statements
+ * diff pg_dist_node against the monitor on the coordinator itself, and we
+ * only run them when the formation topology has changed.
  */
 bool
 keeper_refresh_citus_remove_dropped_nodes(Keeper *keeper,
@@ -2375,29 +4227,54 @@ keeper_refresh_citus_remove_dropped_nodes(Keeper *keeper,
 		log_fatal("Failed to get the list of all the nodes in formation \"%s\" "
 				  "from the monitor, see above for details",
 				  keeper->config.formation);
+		currentNodeStateArrayFree(&nodesArray);
 		return false;
 	}
 
+	/*
+	 * Only reconcile pg_dist_node when the formation topology changed since
+	 * our last successful run: the refresh hooks run at every change in our
+	 * own group, and this is catalog work on the coordinator.
+	 */
+	uint64_t version = keeper_citus_topology_version(&nodesArray);
+
+	if (!forceCacheInvalidation &&
+		keeper->citusTopologyVersionKnown &&
+		keeper->citusTopologyVersion == version)
+	{
+		currentNodeStateArrayFree(&nodesArray);
+		return true;
+	}
+
 	/* Now, implement cache invalidation for pg_dist_node */
 	if (!coordinator_init_from_keeper(&coordinator, keeper))
 	{
 		/* errors have already been logged */
+		currentNodeStateArrayFree(&nodesArray);
 		return false;
 	}
 
 	/* skip cache invalidation altogether if Postgres is not running (yet) */
 	if (!pg_setup_is_running(&(keeper->postgres.postgresSetup)))
 	{
+		currentNodeStateArrayFree(&nodesArray);
 		return true;
 	}
 
-	if (!coordinator_remove_dropped_nodes(&coordinator, &nodesArray))
+	bool success =
+		coordinator_remove_dropped_nodes(&coordinator, &nodesArray) &&
+		coordinator_update_primary_nodes(&coordinator, keeper, &nodesArray);
+
+	if (success)
 	{
-		/* errors have already been logged */
-		return false;
+		keeper->citusTopologyVersion = version;
+		keeper->citusTopologyVersionKnown = true;
 	}
 
-	return true;
+	currentNodeStateArrayFree(&nodesArray);
+
+	/* errors have already been logged */
+	return success;
 }
 
 
@@ -2529,6 +4406,7 @@ keeper_update_nodename_from_monitor(Keeper *keeper)
 			if (!keeper_config_write_file(config))
 			{
 				/* errors have already been logged */
+				nodeAddressArrayFree(&nodesArray);
 				return false;
 			}
 
@@ -2536,6 +4414,8 @@ keeper_update_nodename_from_monitor(Keeper *keeper)
 		}
 	}
 
+	nodeAddressArrayFree(&nodesArray);
+
 	return true;
 }
 
@@ -2682,11 +4562,267 @@ keeper_config_accept_new(Keeper *keeper, KeeperConfig *newConfig)
 		log_info("Reloading configuration: "
 				 "replication.maximum_backup_rate is now \"%s\"; "
 				 "used to be \"%s\"",
-				 newConfig->maximum_backup_rate, config->maximum_backup_rate);
+				 newConfig->maximum_backup_rate, config->maximum_backup_rate);
+
+		strlcpy(config->maximum_backup_rate,
+				newConfig->maximum_backup_rate,
+				MAXIMUM_BACKUP_RATE_LEN);
+	}
+
+	/*
+	 * Changing replication.clone_from.
+	 */
+	if (strneq(newConfig->clone_from, config->clone_from))
+	{
+		log_info("Reloading configuration: "
+				 "replication.clone_from is now \"%s\"; "
+				 "used to be \"%s\"",
+				 newConfig->clone_from, config->clone_from);
+
+		strlcpy(config->clone_from,
+				newConfig->clone_from,
+				sizeof(config->clone_from));
+	}
+
+	/*
+	 * Changing replication.backup_compression.
+	 */
+	if (strneq(newConfig->backup_compression, config->backup_compression))
+	{
+		log_info("Reloading configuration: "
+				 "replication.backup_compression is now \"%s\"; "
+				 "used to be \"%s\"",
+				 newConfig->backup_compression, config->backup_compression);
+
+		strlcpy(config->backup_compression,
+				newConfig->backup_compression,
+				NAMEDATALEN);
+
+		strlcpy(keeper->postgres.replicationSource.backupCompression,
+				newConfig->backup_compression,
+				NAMEDATALEN);
+	}
+
+	/*
+	 * Changing replication.incremental_base_directory.
+	 */
+	if (strneq(newConfig->incremental_base_directory,
+			   config->incremental_base_directory))
+	{
+		log_info("Reloading configuration: "
+				 "replication.incremental_base_directory is now \"%s\"; "
+				 "used to be \"%s\"",
+				 newConfig->incremental_base_directory,
+				 config->incremental_base_directory);
+
+		strlcpy(config->incremental_base_directory,
+				newConfig->incremental_base_directory,
+				MAXPGPATH);
+
+		strlcpy(keeper->postgres.replicationSource.incrementalBaseDir,
+				newConfig->incremental_base_directory,
+				MAXPGPATH);
+	}
+
+	/*
+	 * Changing replication.clone_command.
+	 */
+	if (strneq(newConfig->clone_command, config->clone_command))
+	{
+		log_info("Reloading configuration: "
+				 "replication.clone_command is now \"%s\"; "
+				 "used to be \"%s\"",
+				 newConfig->clone_command, config->clone_command);
+
+		strlcpy(config->clone_command,
+				newConfig->clone_command,
+				MAXCONNINFO);
+
+		strlcpy(keeper->postgres.replicationSource.cloneCommand,
+				newConfig->clone_command,
+				MAXCONNINFO);
+	}
+
+	/*
+	 * Changing replication.clone_jobs.
+	 */
+	if (newConfig->clone_jobs != config->clone_jobs)
+	{
+		log_info("Reloading configuration: "
+				 "replication.clone_jobs is now %d; used to be %d",
+				 newConfig->clone_jobs, config->clone_jobs);
+
+		config->clone_jobs = newConfig->clone_jobs;
+		keeper->postgres.replicationSource.cloneJobs = newConfig->clone_jobs;
+	}
+
+	/*
+	 * Changing replication.restore_command only takes effect the next time
+	 * we setup the standby configuration of Postgres.
+	 */
+	if (strneq(newConfig->restore_command, config->restore_command))
+	{
+		log_info("Reloading configuration: "
+				 "replication.restore_command is now \"%s\"; "
+				 "used to be \"%s\"",
+				 newConfig->restore_command, config->restore_command);
+
+		strlcpy(config->restore_command,
+				newConfig->restore_command,
+				MAXCONNINFO);
+
+		strlcpy(keeper->postgres.replicationSource.restoreCommand,
+				newConfig->restore_command,
+				MAXCONNINFO);
+	}
+
+	if (newConfig->slot_advance_threshold != config->slot_advance_threshold)
+	{
+		log_info("Reloading configuration: "
+				 "replication.slot_advance_threshold is now %d; "
+				 "used to be %d",
+				 newConfig->slot_advance_threshold,
+				 config->slot_advance_threshold);
+
+		config->slot_advance_threshold = newConfig->slot_advance_threshold;
+	}
+
+	if (newConfig->latency_interval != config->latency_interval)
+	{
+		log_info("Reloading configuration: "
+				 "latency.interval is now %d; "
+				 "used to be %d",
+				 newConfig->latency_interval,
+				 config->latency_interval);
+
+		config->latency_interval = newConfig->latency_interval;
+	}
+
+	if (newConfig->health_signals_interval != config->health_signals_interval)
+	{
+		log_info("Reloading configuration: "
+				 "health.signals_interval is now %d; "
+				 "used to be %d",
+				 newConfig->health_signals_interval,
+				 config->health_signals_interval);
+
+		config->health_signals_interval = newConfig->health_signals_interval;
+	}
+
+	if (newConfig->load_interval != config->load_interval)
+	{
+		log_info("Reloading configuration: "
+				 "load.interval is now %d; "
+				 "used to be %d",
+				 newConfig->load_interval,
+				 config->load_interval);
+
+		config->load_interval = newConfig->load_interval;
+	}
+
+	if (newConfig->monitor_keepalive != config->monitor_keepalive)
+	{
+		log_info("Reloading configuration: "
+				 "monitor.keepalive is now %d; "
+				 "used to be %d",
+				 newConfig->monitor_keepalive,
+				 config->monitor_keepalive);
+
+		config->monitor_keepalive = newConfig->monitor_keepalive;
+	}
+
+	if (newConfig->monitor_single_connection !=
+		config->monitor_single_connection)
+	{
+		log_info("Reloading configuration: "
+				 "monitor.single_connection is now %d; "
+				 "used to be %d",
+				 newConfig->monitor_single_connection,
+				 config->monitor_single_connection);
+
+		config->monitor_single_connection =
+			newConfig->monitor_single_connection;
+	}
+
+	if (newConfig->monitor_call_timeout != config->monitor_call_timeout)
+	{
+		log_info("Reloading configuration: "
+				 "monitor.call_timeout is now %d; "
+				 "used to be %d",
+				 newConfig->monitor_call_timeout,
+				 config->monitor_call_timeout);
+
+		config->monitor_call_timeout = newConfig->monitor_call_timeout;
+	}
+
+	if (newConfig->topology_snapshot != config->topology_snapshot)
+	{
+		log_info("Reloading configuration: "
+				 "topology.snapshot is now %d; "
+				 "used to be %d",
+				 newConfig->topology_snapshot,
+				 config->topology_snapshot);
+
+		config->topology_snapshot = newConfig->topology_snapshot;
+	}
+
+	if (newConfig->topology_service_file != config->topology_service_file)
+	{
+		log_info("Reloading configuration: "
+				 "topology.service_file is now %d; "
+				 "used to be %d",
+				 newConfig->topology_service_file,
+				 config->topology_service_file);
+
+		config->topology_service_file = newConfig->topology_service_file;
+	}
+
+	if (strneq(newConfig->hooks_on_primary, config->hooks_on_primary))
+	{
+		log_info("Reloading configuration: "
+				 "hooks.on_primary is now \"%s\"; "
+				 "used to be \"%s\"",
+				 newConfig->hooks_on_primary, config->hooks_on_primary);
+
+		strlcpy(config->hooks_on_primary,
+				newConfig->hooks_on_primary,
+				MAXCONNINFO);
+	}
+
+	if (strneq(newConfig->hooks_on_demote, config->hooks_on_demote))
+	{
+		log_info("Reloading configuration: "
+				 "hooks.on_demote is now \"%s\"; "
+				 "used to be \"%s\"",
+				 newConfig->hooks_on_demote, config->hooks_on_demote);
+
+		strlcpy(config->hooks_on_demote,
+				newConfig->hooks_on_demote,
+				MAXCONNINFO);
+	}
+
+	if (strneq(newConfig->hooks_pgbouncer, config->hooks_pgbouncer))
+	{
+		/* the connection string might contain a password */
+		log_info("Reloading configuration: hooks.pgbouncer has changed");
+
+		strlcpy(config->hooks_pgbouncer,
+				newConfig->hooks_pgbouncer,
+				MAXCONNINFO);
+	}
+
+	if (strneq(newConfig->hooks_on_standby_drain,
+			   config->hooks_on_standby_drain))
+	{
+		log_info("Reloading configuration: "
+				 "hooks.on_standby_drain is now \"%s\"; "
+				 "used to be \"%s\"",
+				 newConfig->hooks_on_standby_drain,
+				 config->hooks_on_standby_drain);
 
-		strlcpy(config->maximum_backup_rate,
-				newConfig->maximum_backup_rate,
-				MAXIMUM_BACKUP_RATE_LEN);
+		strlcpy(config->hooks_on_standby_drain,
+				newConfig->hooks_on_standby_drain,
+				MAXCONNINFO);
 	}
 
 	/*
@@ -2716,6 +4852,19 @@ keeper_config_accept_new(Keeper *keeper, KeeperConfig *newConfig)
 			newConfig->network_partition_timeout;
 	}
 
+	if (newConfig->network_partition_confirmed_timeout !=
+		config->network_partition_confirmed_timeout)
+	{
+		log_info("Reloading configuration: "
+				 "timeout.network_partition_confirmed_timeout "
+				 "is now %d; used to be %d",
+				 newConfig->network_partition_confirmed_timeout,
+				 config->network_partition_confirmed_timeout);
+
+		config->network_partition_confirmed_timeout =
+			newConfig->network_partition_confirmed_timeout;
+	}
+
 	if (newConfig->prepare_promotion_catchup != config->prepare_promotion_catchup)
 	{
 		log_info("Reloading configuration: timeout.prepare_promotion_catchup "
@@ -2765,6 +4914,17 @@ keeper_config_accept_new(Keeper *keeper, KeeperConfig *newConfig)
 			newConfig->postgresql_restart_failure_max_retries;
 	}
 
+	if (newConfig->standby_drain_timeout != config->standby_drain_timeout)
+	{
+		log_info(
+			"Reloading configuration: timeout.standby_drain_timeout "
+			"is now %d; used to be %d",
+			newConfig->standby_drain_timeout,
+			config->standby_drain_timeout);
+
+		config->standby_drain_timeout = newConfig->standby_drain_timeout;
+	}
+
 	/* we can change any SSL related setup options at runtime */
 	return config_accept_new_ssloptions(&(config->pgSetup),
 										&(newConfig->pgSetup));
@@ -2793,6 +4953,9 @@ keeper_reload_configuration(Keeper *keeper, bool firstLoop, bool doInit)
 		return true;
 	}
 
+	/* a reload is also how to forget about the cached DNS lookups */
+	(void) dns_cache_reset();
+
 	if (file_exists(config->pathnames.config))
 	{
 		KeeperConfig newConfig = { 0 };
@@ -2807,15 +4970,59 @@ keeper_reload_configuration(Keeper *keeper, bool firstLoop, bool doInit)
 		strlcpy(newConfig.pathnames.config, config->pathnames.config, MAXPGPATH);
 		strlcpy(newConfig.pathnames.state, config->pathnames.state, MAXPGPATH);
 
-		/* disconnect to the current monitor if we're connected */
-		(void) pgsql_finish(&(keeper->monitor.pgsql));
-		(void) pgsql_finish(&(keeper->monitor.notificationClient));
+		if (!keeper_config_read_file(&newConfig,
+									 missingPgdataIsOk,
+									 pgIsNotRunningIsOk,
+									 monitorDisabledIsOk))
+		{
+			log_warn("Failed to read configuration file \"%s\", "
+					 "continuing with the same configuration.",
+					 config->pathnames.config);
+			return true;
+		}
+
+		/*
+		 * Compute what changed in the configuration file, so that we only
+		 * run the handlers that are needed. At start-up (doInit) we always
+		 * ensure our configuration, the in-memory copy has just been read
+		 * from the same file and the diff is expected to be empty.
+		 */
+		int changes = keeper_config_diff(config, &newConfig);
+
+		if (changes == KEEPER_CONFIG_CHANGED_NONE && !doInit)
+		{
+			log_info("Configuration file \"%s\" has not changed, "
+					 "nothing to reload",
+					 config->pathnames.config);
+			return true;
+		}
+
+		char changedSections[BUFSIZE] = { 0 };
+
+		(void) keeper_config_changes_to_string(changes,
+											   changedSections,
+											   sizeof(changedSections));
+
+		log_debug("keeper_reload_configuration: changed sections: %s",
+				  changes == KEEPER_CONFIG_CHANGED_NONE
+				  ? "none"
+				  : changedSections);
+
+		bool ensureConfiguration =
+			doInit || (changes & KEEPER_CONFIG_CHANGES_NEED_ENSURE) != 0;
+
+		/*
+		 * Disconnect from the current monitor if we're connected, as
+		 * keeper_ensure_configuration() is going to init a new monitor
+		 * connection from the new setup.
+		 */
+		if (ensureConfiguration)
+		{
+			(void) pgsql_finish(&(keeper->monitor.pgsql));
+			(void) pgsql_finish(&(keeper->monitor.notificationClient));
+		}
 
-		if (keeper_config_read_file(&newConfig,
-									missingPgdataIsOk,
-									pgIsNotRunningIsOk,
-									monitorDisabledIsOk) &&
-			keeper_config_accept_new(keeper, &newConfig))
+		if (keeper_config_accept_new(keeper, &newConfig))
 		{
 			/*
 			 * The keeper->config changed, not the keeper->postgres, but the
@@ -2829,11 +5036,17 @@ keeper_reload_configuration(Keeper *keeper, bool firstLoop, bool doInit)
 			 * The new configuration might impact the Postgres setup, such as
 			 * when changing the SSL file paths.
 			 */
-			if (!keeper_ensure_configuration(keeper, postgresNotRunningIsOk))
+			if (ensureConfiguration &&
+				!keeper_ensure_configuration(keeper, postgresNotRunningIsOk))
 			{
 				log_warn("Failed to reload pg_autoctl configuration, "
 						 "see above for details");
 			}
+			else if (doInit)
+			{
+				/* the next start can defer the checks that just passed */
+				(void) keeper_startup_cache_update(keeper);
+			}
 		}
 		else
 		{
@@ -2939,41 +5152,399 @@ keeper_reload_citus_node_update_hostname_port(Keeper *keeper,
 				 firstLoop ? "startup" : "reload",
 				 keeper->config.hostname, keeper->config.pgSetup.pgport);
 
-		if (!coordinator_update_node_prepare(&coordinator, keeper))
-		{
-			/* errors have already been logged */
-			return false;
-		}
+		if (!coordinator_update_node_prepare(&coordinator, keeper))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+
+		if (!coordinator_update_node_commit(&coordinator, keeper))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+
+		log_info("Done updating this node host:port (%s:%d) on the coordinator",
+				 keeper->config.hostname, keeper->config.pgSetup.pgport);
+	}
+
+	return true;
+}
+
+
+/*
+ * keeper_call_reload_hooks loops over the KeeperReloadHooks
+ * reloadFunctionArray and calls each hook in turn.
+ */
+void
+keeper_call_reload_hooks(Keeper *keeper, bool firstLoop, bool doInit)
+{
+	for (int index = 0; KeeperReloadHooks[index]; index++)
+	{
+		/* at the moment we ignore the return values from the reload hooks */
+		(void) (*KeeperReloadHooks[index])(keeper, firstLoop, doInit);
+	}
+
+	/* we're done reloading now. */
+	asked_to_reload = 0;
+}
+
+
+/*
+ * keeper_refresh_topology is a KeeperNodesArrayRefreshFunction that maintains
+ * the local topology snapshot files, when topology.snapshot is set. Failing
+ * to write those files is not critical to the keeper, so we only warn.
+ */
+bool
+keeper_refresh_topology(Keeper *keeper,
+						NodeAddressArray *newNodesArray,
+						bool forceCacheInvalidation)
+{
+	KeeperConfig *config = &(keeper->config);
+
+	if (!config->topology_snapshot)
+	{
+		return true;
+	}
+
+	if (!topology_write_snapshot(keeper, newNodesArray))
+	{
+		log_warn("Failed to write the topology file \"%s\", "
+				 "see above for details",
+				 config->pathnames.topology);
+	}
+
+	return true;
+}
+
+
+/*
+ * keeper_drain_standby gives the read sessions of a standby a chance to finish
+ * before Postgres is restarted to follow a new upstream node. When
+ * timeout.standby_drain_timeout is set, we mark the local node as not ready in
+ * the topology snapshot, run the hooks.on_standby_drain command with "start"
+ * so that a connection pooler stops sending new sessions our way, and then
+ * wait until no query is active anymore, or until the timeout.
+ *
+ * When the new replication source can be applied with a reload, Postgres is
+ * not restarted and there is nothing to drain. Failing to drain is never a
+ * reason not to restart, so the return value is informational only.
+ */
+bool
+keeper_drain_standby(Keeper *keeper)
+{
+	KeeperConfig *config = &(keeper->config);
+	LocalPostgresServer *postgres = &(keeper->postgres);
+	PGSQL *pgsql = &(postgres->sqlClient);
+
+	int activeCount = 0;
+	instr_time startTime;
+	instr_time duration;
+
+	if (config->standby_drain_timeout <= 0 ||
+		!pg_setup_is_running(&(postgres->postgresSetup)) ||
+		standby_can_reload_replication_source(postgres))
+	{
+		return true;
+	}
+
+	keeper->standbyDraining = true;
+
+	if (config->topology_snapshot)
+	{
+		(void) keeper_refresh_topology(keeper, &(keeper->otherNodes), false);
+	}
+
+	(void) keeper_drain_standby_run_command(keeper, "start");
+
+	log_info("Draining the read sessions of this standby for up to %ds "
+			 "before restarting Postgres",
+			 config->standby_drain_timeout);
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	for (;;)
+	{
+		if (!pgsql_count_active_queries(pgsql, &activeCount))
+		{
+			log_warn("Failed to count active queries, restarting Postgres "
+					 "without waiting any further");
+			return false;
+		}
+
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, startTime);
+
+		if (activeCount == 0)
+		{
+			log_info("Drained the read sessions of this standby in %.3f ms",
+					 INSTR_TIME_GET_MILLISEC(duration));
+			return true;
+		}
+
+		if (asked_to_stop || asked_to_stop_fast || asked_to_quit ||
+			INSTR_TIME_GET_MILLISEC(duration) >=
+			config->standby_drain_timeout * 1000.0)
+		{
+			break;
+		}
+
+		pg_usleep(STANDBY_DRAIN_POLL_INTERVAL_MS * 1000);
+	}
+
+	log_warn("Restarting Postgres with %d active queries still running "
+			 "after %.3f ms of draining",
+			 activeCount,
+			 INSTR_TIME_GET_MILLISEC(duration));
+
+	return false;
+}
+
+
+/*
+ * keeper_drain_standby_done marks the local node as ready again in the
+ * topology snapshot and runs the hooks.on_standby_drain command with "done",
+ * once Postgres has been restarted after keeper_drain_standby().
+ */
+bool
+keeper_drain_standby_done(Keeper *keeper)
+{
+	KeeperConfig *config = &(keeper->config);
+
+	if (!keeper->standbyDraining)
+	{
+		return true;
+	}
+
+	keeper->standbyDraining = false;
+
+	if (config->topology_snapshot)
+	{
+		(void) keeper_refresh_topology(keeper, &(keeper->otherNodes), false);
+	}
+
+	return keeper_drain_standby_run_command(keeper, "done");
+}
+
+
+/*
+ * keeper_drain_standby_run_command runs the hooks.on_standby_drain command,
+ * when set, with /bin/sh and the given step ("start" or "done") as $1.
+ */
+static bool
+keeper_drain_standby_run_command(Keeper *keeper, const char *step)
+{
+	KeeperConfig *config = &(keeper->config);
+	char *command = config->hooks_on_standby_drain;
+
+	if (IS_EMPTY_STRING_BUFFER(command))
+	{
+		return true;
+	}
+
+	Program program = run_program("/bin/sh", "-c", command, "pg_autoctl",
+								  step, NULL);
+
+	if (program.returnCode != 0)
+	{
+		if (program.stdErr != NULL)
+		{
+			log_error("%s", program.stdErr);
+		}
+
+		log_warn("Failed to run hooks.on_standby_drain command \"%s\" %s, "
+				 "exit code %d",
+				 command, step, program.returnCode);
+
+		free_program(&program);
+		return false;
+	}
+
+	log_info("Ran hooks.on_standby_drain command \"%s\" %s", command, step);
+
+	free_program(&program);
+
+	return true;
+}
+
+
+/*
+ * keeper_call_role_change_hooks loops over the KeeperRoleChangeHooks array
+ * and calls each hook in turn, when the node just became a primary or just
+ * stopped being one. Those hooks make client connections follow the primary,
+ * and failing to run them is not a reason to stop the keeper, so we only
+ * warn about it.
+ */
+void
+keeper_call_role_change_hooks(Keeper *keeper, NodeState previousRole)
+{
+	NodeState newRole = keeper->state.current_role;
+
+	if (NodeStateIsPrimary(previousRole) == NodeStateIsPrimary(newRole))
+	{
+		return;
+	}
+
+	for (int index = 0; KeeperRoleChangeHooks[index]; index++)
+	{
+		KeeperRoleChangeFunction hookFun = KeeperRoleChangeHooks[index];
+
+		instr_time startTime;
+		instr_time duration;
+
+		INSTR_TIME_SET_CURRENT(startTime);
+
+		bool success = (*hookFun)(keeper, previousRole, newRole);
+
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, startTime);
+
+		if (!success)
+		{
+			log_warn("Failed to run a role change hook (%s ➜ %s) after %.3f ms, "
+					 "see above for details",
+					 NodeStateToString(previousRole),
+					 NodeStateToString(newRole),
+					 INSTR_TIME_GET_MILLISEC(duration));
+		}
+	}
+}
+
+
+/*
+ * keeper_role_change_run_command is a KeeperRoleChangeFunction that runs the
+ * hooks.on_primary command when the node becomes a primary, and the
+ * hooks.on_demote command when it stops being one. The command is run with
+ * /bin/sh, and is given the previous and new state of the node as $1 and $2.
+ */
+bool
+keeper_role_change_run_command(Keeper *keeper,
+							   NodeState previousRole,
+							   NodeState newRole)
+{
+	KeeperConfig *config = &(keeper->config);
+
+	bool isPrimary = NodeStateIsPrimary(newRole);
+	char *command = isPrimary ? config->hooks_on_primary : config->hooks_on_demote;
+	char *setting = isPrimary ? "hooks.on_primary" : "hooks.on_demote";
+
+	instr_time startTime;
+	instr_time duration;
+
+	if (IS_EMPTY_STRING_BUFFER(command))
+	{
+		return true;
+	}
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	Program program = run_program("/bin/sh", "-c", command, "pg_autoctl",
+								  NodeStateToString(previousRole),
+								  NodeStateToString(newRole),
+								  NULL);
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	if (program.returnCode != 0)
+	{
+		if (program.stdErr != NULL)
+		{
+			log_error("%s", program.stdErr);
+		}
+
+		log_error("Failed to run %s command \"%s\", exit code %d",
+				  setting, command, program.returnCode);
+
+		free_program(&program);
+		return false;
+	}
+
+	log_info("Ran %s command \"%s\" in %.3f ms",
+			 setting, command, INSTR_TIME_GET_MILLISEC(duration));
+
+	free_program(&program);
+
+	return true;
+}
+
+
+/*
+ * keeper_role_change_pgbouncer is a KeeperRoleChangeFunction that drives a
+ * pgbouncer instance through its admin console, as given in hooks.pgbouncer.
+ * When the node stops being a primary, we PAUSE pgbouncer so that client
+ * connections wait for the new primary rather than fail. When the node
+ * becomes a primary, we have pgbouncer RELOAD its configuration, which the
+ * hooks.on_primary command might have just edited, and then RESUME.
+ *
+ * RESUME fails when pgbouncer is not paused, such as when the previous
+ * primary could not run its own hook, and we only warn about that.
+ */
+bool
+keeper_role_change_pgbouncer(Keeper *keeper,
+							 NodeState previousRole,
+							 NodeState newRole)
+{
+	KeeperConfig *config = &(keeper->config);
+	PGSQL pgbouncer = { 0 };
+
+	bool isPrimary = NodeStateIsPrimary(newRole);
+	bool success = true;
+
+	instr_time startTime;
+	instr_time duration;
+
+	if (IS_EMPTY_STRING_BUFFER(config->hooks_pgbouncer))
+	{
+		return true;
+	}
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	if (!pgsql_init(&pgbouncer, config->hooks_pgbouncer, PGSQL_CONN_APP))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	/* the keeper is in the middle of a failover, don't wait for pgbouncer */
+	(void) pgsql_set_main_loop_retry_policy(&(pgbouncer.retryPolicy));
 
-		if (!coordinator_update_node_commit(&coordinator, keeper))
+	/* the pgbouncer admin console only supports the simple query protocol */
+	pgbouncer.connectionStatementType = PGSQL_CONNECTION_MULTI_STATEMENT;
+
+	if (isPrimary)
+	{
+		success = pgsql_execute(&pgbouncer, "RELOAD");
+
+		if (success && !pgsql_execute(&pgbouncer, "RESUME"))
 		{
-			/* errors have already been logged */
-			return false;
+			log_warn("Failed to RESUME pgbouncer, it might not have been "
+					 "paused by the previous primary");
 		}
-
-		log_info("Done updating this node host:port (%s:%d) on the coordinator",
-				 keeper->config.hostname, keeper->config.pgSetup.pgport);
+	}
+	else
+	{
+		success = pgsql_execute(&pgbouncer, "PAUSE");
 	}
 
-	return true;
-}
+	pgsql_finish(&pgbouncer);
 
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
 
-/*
- * keeper_call_reload_hooks loops over the KeeperReloadHooks
- * reloadFunctionArray and calls each hook in turn.
- */
-void
-keeper_call_reload_hooks(Keeper *keeper, bool firstLoop, bool doInit)
-{
-	for (int index = 0; KeeperReloadHooks[index]; index++)
+	if (!success)
 	{
-		/* at the moment we ignore the return values from the reload hooks */
-		(void) (*KeeperReloadHooks[index])(keeper, firstLoop, doInit);
+		log_error("Failed to %s pgbouncer through hooks.pgbouncer",
+				  isPrimary ? "RELOAD" : "PAUSE");
+		return false;
 	}
 
-	/* we're done reloading now. */
-	asked_to_reload = 0;
+	log_info("Sent %s to pgbouncer in %.3f ms",
+			 isPrimary ? "RELOAD and RESUME" : "PAUSE",
+			 INSTR_TIME_GET_MILLISEC(duration));
+
+	return true;
 }
 
 
@@ -3044,6 +5615,26 @@ keeper_get_primary(Keeper *keeper, NodeAddress *primaryNode)
 	{
 		Monitor *monitor = &(keeper->monitor);
 
+		/*
+		 * The transition that needs the primary node runs right after the
+		 * node_active call that assigned it, which already returned the
+		 * primary node: use it once, and ask the monitor again otherwise.
+		 */
+		if (keeper->groupSettings.hasPrimary)
+		{
+			*primaryNode = keeper->groupSettings.primaryNode;
+			keeper->groupSettings.hasPrimary = false;
+
+			log_debug("Using primary node %" PRId64 " \"%s\" (%s:%d) "
+					  "returned by node_active",
+					  primaryNode->nodeId,
+					  primaryNode->name,
+					  primaryNode->host,
+					  primaryNode->port);
+
+			return true;
+		}
+
 		if (!monitor_get_primary(monitor,
 								 config->formation,
 								 keeper->state.current_group,
@@ -3151,6 +5742,132 @@ keeper_get_most_advanced_standby(Keeper *keeper, NodeAddress *upstreamNode)
 }
 
 
+/*
+ * keeper_get_clone_source selects the node to pg_basebackup from when
+ * initializing a new standby, as per the replication.clone_from setting:
+ *
+ *  - "primary" (the default) always uses the primary node,
+ *  - "secondary" uses the healthy secondary node with the most advanced LSN,
+ *  - any other value is the name of the secondary node to use.
+ *
+ * Only nodes that are known healthy, have reached the secondary state, and
+ * are on the same timeline as the primary are considered.
+ *
+ * When no such node is found, foundSecondary is set to false and the caller
+ * is expected to use the primary node instead.
+ */
+bool
+keeper_get_clone_source(Keeper *keeper,
+						NodeAddress *primaryNode,
+						NodeAddress *cloneNode,
+						bool *foundSecondary)
+{
+	KeeperConfig *config = &(keeper->config);
+	Monitor *monitor = &(keeper->monitor);
+
+	CurrentNodeStateArray nodesArray = { 0 };
+	CurrentNodeState *sourceNode = NULL;
+	uint64_t sourceLSN = 0;
+	int primaryTimeline = 0;
+
+	bool anySecondary =
+		strcmp(config->clone_from, REPLICATION_CLONE_FROM_SECONDARY) == 0;
+
+	*foundSecondary = false;
+
+	if (IS_EMPTY_STRING_BUFFER(config->clone_from) ||
+		strcmp(config->clone_from, REPLICATION_CLONE_FROM_PRIMARY) == 0 ||
+		config->monitorDisabled)
+	{
+		return true;
+	}
+
+	if (!monitor_get_current_state(monitor,
+								   config->formation,
+								   keeper->state.current_group,
+								   &nodesArray))
+	{
+		/* errors have already been logged */
+		currentNodeStateArrayFree(&nodesArray);
+		return false;
+	}
+
+	for (int i = 0; i < nodesArray.count; i++)
+	{
+		if (nodesArray.nodes[i].node.nodeId == primaryNode->nodeId)
+		{
+			primaryTimeline = nodesArray.nodes[i].node.tli;
+		}
+	}
+
+	for (int i = 0; i < nodesArray.count; i++)
+	{
+		CurrentNodeState *nodeState = &(nodesArray.nodes[i]);
+		uint64_t nodeLSN = 0;
+
+		if (nodeState->node.nodeId == keeper->state.current_node_id ||
+			nodeState->node.nodeId == primaryNode->nodeId)
+		{
+			continue;
+		}
+
+		if (!anySecondary && strcmp(nodeState->node.name, config->clone_from) != 0)
+		{
+			continue;
+		}
+
+		if (nodeState->reportedState != SECONDARY_STATE ||
+			nodeState->goalState != SECONDARY_STATE ||
+			nodeState->health != 1 ||
+			nodeState->node.tli != primaryTimeline)
+		{
+			log_info("Skipping node " NODE_FORMAT " as a clone source: "
+					 "it is not a healthy secondary on timeline %d",
+					 nodeState->node.nodeId,
+					 nodeState->node.name,
+					 nodeState->node.host,
+					 nodeState->node.port,
+					 primaryTimeline);
+			continue;
+		}
+
+		if (!parseLSN(nodeState->node.lsn, &nodeLSN))
+		{
+			log_error("Failed to parse node %" PRId64
+					  " \"%s\" LSN position \"%s\"",
+					  nodeState->node.nodeId,
+					  nodeState->node.name,
+					  nodeState->node.lsn);
+			currentNodeStateArrayFree(&nodesArray);
+			return false;
+		}
+
+		if (sourceNode == NULL || nodeLSN > sourceLSN)
+		{
+			sourceNode = nodeState;
+			sourceLSN = nodeLSN;
+		}
+	}
+
+	if (sourceNode == NULL)
+	{
+		log_warn("Failed to find a healthy secondary node to clone from "
+				 "(replication.clone_from is \"%s\"), "
+				 "using the primary node instead",
+				 config->clone_from);
+	}
+	else
+	{
+		*cloneNode = sourceNode->node;
+		*foundSecondary = true;
+	}
+
+	currentNodeStateArrayFree(&nodesArray);
+
+	return true;
+}
+
+
 /*
  * keeper_pg_autoctl_get_version_from_disk calls pg_autoctl version --json and
  * parses the output to fill-in the keeper version.
@@ -3220,3 +5937,301 @@ keeper_pg_autoctl_get_version_from_disk(Keeper *keeper, KeeperVersion *version)
 
 	return true;
 }
+
+
+/*
+ * keeper_fingerprint_add_string adds the given string to a 64-bit FNV-1a
+ * hash.
+ */
+static void
+keeper_fingerprint_add_string(uint64_t *fingerprint, const char *str)
+{
+	for (const char *ptr = str; *ptr != '\0'; ptr++)
+	{
+		*fingerprint ^= (unsigned char) *ptr;
+		*fingerprint *= UINT64_C(0x100000001b3);
+	}
+}
+
+
+/*
+ * keeper_fingerprint_add_file adds the path, modification time and size of
+ * the given file to a 64-bit FNV-1a hash. A missing file is part of the
+ * fingerprint too.
+ */
+static void
+keeper_fingerprint_add_file(uint64_t *fingerprint, const char *filename)
+{
+	struct stat fileStat = { 0 };
+	char entry[BUFSIZE] = { 0 };
+
+	if (stat(filename, &fileStat) != 0)
+	{
+		sformat(entry, sizeof(entry), "%s|missing\n", filename);
+	}
+	else
+	{
+		sformat(entry, sizeof(entry), "%s|%lld|%lld\n",
+				filename,
+				(long long) fileStat.st_mtime,
+				(long long) fileStat.st_size);
+	}
+
+	(void) keeper_fingerprint_add_string(fingerprint, entry);
+}
+
+
+/*
+ * keeper_fingerprint_add_file_contents adds the path and contents of the given
+ * file to a 64-bit FNV-1a hash. Postgres rewrites postgresql.auto.conf at
+ * each ALTER SYSTEM, so modification times are not precise enough there.
+ */
+static void
+keeper_fingerprint_add_file_contents(uint64_t *fingerprint, const char *filename)
+{
+	char *contents = NULL;
+	long size = 0L;
+
+	(void) keeper_fingerprint_add_string(fingerprint, filename);
+
+	if (!read_file_if_exists(filename, &contents, &size))
+	{
+		(void) keeper_fingerprint_add_string(fingerprint, "|missing\n");
+		return;
+	}
+
+	(void) keeper_fingerprint_add_string(fingerprint, "|");
+	(void) keeper_fingerprint_add_string(fingerprint, contents);
+
+	free(contents);
+}
+
+
+/*
+ * keeper_settings_fingerprint computes the fingerprint of the files where the
+ * Postgres settings that we manage live: the files we write and that ALTER
+ * SYSTEM writes, and the files that pg_autoctl reload is expected to apply,
+ * including the SSL certificates that could be renewed in place.
+ */
+static uint64_t
+keeper_settings_fingerprint(Keeper *keeper)
+{
+	PostgresSetup *pgSetup = &(keeper->postgres.postgresSetup);
+	SSLOptions *ssl = &(pgSetup->ssl);
+
+	const char *settingsFiles[] = {
+		AUTOCTL_DEFAULTS_CONF_FILENAME,
+		"postgresql.auto.conf",
+		NULL
+	};
+
+	const char *userFiles[] = {
+		"postgresql.conf",
+		"pg_hba.conf",
+		NULL
+	};
+
+	const char *sslFiles[] = {
+		ssl->serverCert,
+		ssl->serverKey,
+		ssl->caFile,
+		ssl->crlFile,
+		NULL
+	};
+
+	uint64_t fingerprint = UINT64_C(0xcbf29ce484222325);
+
+	for (int i = 0; settingsFiles[i] != NULL; i++)
+	{
+		char filename[MAXPGPATH] = { 0 };
+
+		join_path_components(filename, pgSetup->pgdata, settingsFiles[i]);
+
+		(void) keeper_fingerprint_add_file_contents(&fingerprint, filename);
+	}
+
+	for (int i = 0; userFiles[i] != NULL; i++)
+	{
+		char filename[MAXPGPATH] = { 0 };
+
+		join_path_components(filename, pgSetup->pgdata, userFiles[i]);
+
+		(void) keeper_fingerprint_add_file(&fingerprint, filename);
+	}
+
+	for (int i = 0; sslFiles[i] != NULL; i++)
+	{
+		if (!IS_EMPTY_STRING_BUFFER(sslFiles[i]))
+		{
+			(void) keeper_fingerprint_add_file(&fingerprint, sslFiles[i]);
+		}
+	}
+
+	return fingerprint;
+}
+
+
+/*
+ * keeper_settings_unchanged returns true when the Postgres settings files
+ * have the same fingerprint as when we last reloaded the Postgres
+ * configuration: Postgres already uses those settings, and another reload
+ * would only make each backend read its configuration again.
+ */
+bool
+keeper_settings_unchanged(Keeper *keeper)
+{
+	return keeper->settingsFingerprintKnown &&
+		   keeper->settingsFingerprint == keeper_settings_fingerprint(keeper);
+}
+
+
+/*
+ * keeper_settings_applied records the fingerprint of the Postgres settings
+ * files right after we reloaded the Postgres configuration.
+ */
+void
+keeper_settings_applied(Keeper *keeper)
+{
+	keeper->settingsFingerprint = keeper_settings_fingerprint(keeper);
+	keeper->settingsFingerprintKnown = true;
+}
+
+
+/*
+ * keeper_update_trace_id stamps our log lines, and the connections that we
+ * open, with the trace id of the monitor decision that assigned our goal
+ * state, as long as we have not reached that state. Once the transition is
+ * done, or when we assigned ourselves a state, the trace id is reset.
+ */
+void
+keeper_update_trace_id(Keeper *keeper)
+{
+	KeeperStateData *keeperState = &(keeper->state);
+
+	if (keeperState->assigned_role != keeperState->current_role &&
+		keeper->goalTraceId > 0)
+	{
+		IntString traceIdString = intToString(keeper->goalTraceId);
+		char applicationName[BUFSIZE] = { 0 };
+
+		sformat(applicationName, sizeof(applicationName),
+				"pg_autoctl trace %s", traceIdString.strValue);
+
+		(void) log_set_trace_id(traceIdString.strValue);
+		(void) pgsql_set_application_name(applicationName);
+	}
+	else
+	{
+		(void) log_set_trace_id(NULL);
+		(void) pgsql_set_application_name(NULL);
+	}
+}
+
+
+/*
+ * keeper_startup_fingerprints computes the fingerprints that our startup
+ * cache is keyed on: one of the pg_autoctl and Postgres binaries that we
+ * run, and one of the configuration files that keeper_ensure_configuration
+ * reads and maintains, and of the Postgres instance they apply to. The HBA
+ * file is edited each time the nodes of the group change, and is maintained
+ * from the list of other nodes anyway, so it's not part of it.
+ */
+static void
+keeper_startup_fingerprints(Keeper *keeper,
+							uint64_t *binariesFingerprint,
+							uint64_t *configurationFingerprint)
+{
+	KeeperConfig *config = &(keeper->config);
+	PostgresSetup *pgSetup = &(config->pgSetup);
+
+	const char *postgresFiles[] = {
+		"postgresql.conf",
+		AUTOCTL_DEFAULTS_CONF_FILENAME,
+		NULL
+	};
+
+	char systemIdentifier[BUFSIZE] = { 0 };
+
+	*binariesFingerprint = UINT64_C(0xcbf29ce484222325);
+	*configurationFingerprint = UINT64_C(0xcbf29ce484222325);
+
+	(void) keeper_fingerprint_add_string(binariesFingerprint,
+										 PG_AUTOCTL_VERSION);
+	(void) keeper_fingerprint_add_file(binariesFingerprint, pg_autoctl_program);
+	(void) keeper_fingerprint_add_file(binariesFingerprint, pgSetup->pg_ctl);
+
+	sformat(systemIdentifier, sizeof(systemIdentifier), "%" PRIu64 "\n",
+			pgSetup->control.system_identifier);
+
+	(void) keeper_fingerprint_add_string(configurationFingerprint,
+										 systemIdentifier);
+	(void) keeper_fingerprint_add_file(configurationFingerprint,
+									   config->pathnames.config);
+
+	for (int i = 0; postgresFiles[i] != NULL; i++)
+	{
+		char filename[MAXPGPATH] = { 0 };
+
+		join_path_components(filename, pgSetup->pgdata, postgresFiles[i]);
+
+		(void) keeper_fingerprint_add_file(configurationFingerprint, filename);
+	}
+}
+
+
+/*
+ * keeper_startup_cache_is_valid returns true when the startup checks passed
+ * in our previous run with the same binaries and configuration files as we
+ * have now: in that case, the node-active service can report to the monitor
+ * first, and then run the checks again.
+ */
+bool
+keeper_startup_cache_is_valid(Keeper *keeper)
+{
+	KeeperStartupCache cache = { 0 };
+	uint64_t binariesFingerprint = 0;
+	uint64_t configurationFingerprint = 0;
+
+	if (!keeper_startup_cache_read(&cache, keeper->config.pathnames.startup))
+	{
+		return false;
+	}
+
+	(void) keeper_startup_fingerprints(keeper,
+									   &binariesFingerprint,
+									   &configurationFingerprint);
+
+	if (cache.binariesFingerprint != binariesFingerprint)
+	{
+		log_debug("The pg_autoctl or Postgres binaries changed "
+				  "since the previous run");
+		return false;
+	}
+
+	if (cache.configurationFingerprint != configurationFingerprint)
+	{
+		log_debug("The configuration changed since the previous run");
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * keeper_startup_cache_update records that our startup checks passed with
+ * the current binaries and configuration files.
+ */
+bool
+keeper_startup_cache_update(Keeper *keeper)
+{
+	KeeperStartupCache cache = { 0 };
+
+	(void) keeper_startup_fingerprints(keeper,
+									   &(cache.binariesFingerprint),
+									   &(cache.configurationFingerprint));
+
+	cache.validatedTime = time(NULL);
+
+	return keeper_startup_cache_write(&cache, keeper->config.pathnames.startup);
+}
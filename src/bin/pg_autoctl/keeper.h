@@ -16,6 +16,27 @@
 #include "monitor.h"
 #include "primary_standby.h"
 #include "state.h"
+#include "system_utils.h"
+
+/*
+ * How long each phase of the node-active service startup took, until the
+ * first successful call to the monitor, see service_keeper_startup_phase().
+ */
+#define KEEPER_STARTUP_MAX_PHASES 8
+
+typedef struct KeeperStartupPhase
+{
+	const char *name;
+	int durationMs;
+} KeeperStartupPhase;
+
+typedef struct KeeperStartupProfile
+{
+	instr_time startTime;
+	int phaseCount;
+	KeeperStartupPhase phases[KEEPER_STARTUP_MAX_PHASES];
+	bool reported;
+} KeeperStartupProfile;
 
 /* the keeper manages a postgres server according to the given configuration */
 typedef struct Keeper
@@ -23,6 +44,7 @@ typedef struct Keeper
 	KeeperConfig config;
 	LocalPostgresServer postgres;
 	KeeperStateData state;
+	KeeperStateData storedState;    /* last state read from or written to disk */
 	Monitor monitor;
 
 	/*
@@ -31,6 +53,99 @@ typedef struct Keeper
 	 */
 	NodeAddressArray otherNodes;
 
+	/* topology version of our group when we last fetched otherNodes */
+	int64_t otherNodesVersion;
+	bool otherNodesVersionKnown;
+
+	/* topology version of our group when we last checked our upstream */
+	int64_t upstreamVersion;
+	bool upstreamVersionKnown;
+
+	/* formation topology when the Citus coordinator last synced pg_dist_node */
+	uint64_t citusTopologyVersion;
+	bool citusTopologyVersionKnown;
+
+	/* other nodes and their LSN when we last maintained replication slots */
+	NodeAddressArray slotsNodes;
+
+	/* when we last reported our network latency to the other nodes */
+	uint64_t latencyReportTime;
+
+	/* when we last reported our health signals, and the checkpointer's */
+	uint64_t healthSignalsReportTime;
+	uint64_t checkpointSyncTime;
+	bool checkpointSyncTimeKnown;
+
+	/* when we last reported our load, and the CPU times we sampled then */
+	uint64_t loadReportTime;
+	CPUTimes cpuTimes;
+	bool cpuTimesKnown;
+
+	/* replay throughput, and the checkpoint settings we derived from it */
+	uint64_t replaySampleLSN;
+	instr_time replaySampleTime;
+	double replayRate;                  /* bytes per second */
+	uint64_t recoveryTuningTime;
+	uint64_t appliedMaxWalSizeMB;
+	int appliedCheckpointTimeout;
+
+	/* when we last reported the WAL retained by our replication slots */
+	uint64_t slotRetentionTime;
+
+	/* when we last checked our wal_compression policy, and what we applied */
+	uint64_t walCompressionTime;
+	char appliedWalCompression[NAMEDATALEN];
+
+	/* when we last checked our inventory, and what we reported then */
+	uint64_t inventoryTime;
+	uint64_t inventoryFingerprint;
+	bool inventoryFingerprintKnown;
+
+	/* how we connect to the local Postgres, see keeper_update_pg_state() */
+	char localHost[MAXPGPATH];
+	bool localHostKnown;
+
+	/* set while draining the read sessions before a restart of the standby */
+	bool standbyDraining;
+
+	/* when we last reported pg_rewind progress to the monitor */
+	uint64_t rewindReportTime;
+
+	/* set once we created the LSN token functions as the primary node */
+	bool lsnTokenFunctionsReady;
+
+	/* trace id of the monitor decision that assigned our goal state */
+	int64_t goalTraceId;
+
+	/* primary lease granted with our last node_active call, and fencing */
+	int leaseDurationMs;
+	instr_time leaseStartTime;
+	bool leaseFenced;
+
+	/*
+	 * Fingerprint of the Postgres settings files as of our last reload, and
+	 * the synchronous_standby_names we applied then, see
+	 * keeper_settings_unchanged().
+	 */
+	uint64_t settingsFingerprint;
+	bool settingsFingerprintKnown;
+	char appliedSynchronousStandbyNames[BUFSIZE];
+	bool appliedSynchronousStandbyNamesKnown;
+
+	/* group settings piggybacked on our last node_active call */
+	MonitorGroupSettings groupSettings;
+
+	/* jittered backoff of the calls to the monitor after a failure */
+	ConnectionRetryPolicy monitorBackoff;
+	instr_time monitorBackoffTime;
+
+	/* adaptive polling of the monitor, see service_keeper_polling_interval */
+	GroupTransitions groupTransitions;
+	int pollingIntervalMs;
+
+	/* timed phases of the startup of the node-active service */
+	KeeperStartupProfile startupProfile;
+
 	/* Only useful during the initialization of the Keeper */
 	KeeperStateInit initState;
 } Keeper;
@@ -57,23 +172,47 @@ bool keeper_should_ensure_current_state_before_transition(Keeper *keeper);
 bool keeper_ensure_postgres_is_running(Keeper *keeper, bool updateRetries);
 bool keeper_create_and_drop_replication_slots(Keeper *keeper);
 bool keeper_maintain_replication_slots(Keeper *keeper);
+bool keeper_maintain_prewarm(Keeper *keeper);
+bool keeper_ensure_lsn_token_functions(Keeper *keeper);
+bool keeper_maintain_upstream(Keeper *keeper);
+bool keeper_maintain_latency(Keeper *keeper);
+bool keeper_maintain_health_signals(Keeper *keeper);
+bool keeper_maintain_load(Keeper *keeper);
+int keeper_probe_network_peers(Keeper *keeper, int *probedCount);
+bool keeper_maintain_recovery_target(Keeper *keeper);
+bool keeper_maintain_slot_retention(Keeper *keeper);
+bool keeper_maintain_wal_compression(Keeper *keeper);
+bool keeper_maintain_inventory(Keeper *keeper);
 bool keeper_ensure_current_state(Keeper *keeper);
 bool keeper_create_self_signed_cert(Keeper *keeper);
 bool keeper_ensure_configuration(Keeper *keeper, bool postgresNotRunningIsOk);
 bool keeper_update_pg_state(Keeper *keeper, int logLevel);
+bool keeper_settings_unchanged(Keeper *keeper);
+void keeper_settings_applied(Keeper *keeper);
+void keeper_update_trace_id(Keeper *keeper);
 bool keeper_node_active(Keeper *keeper, bool doInit,
 						MonitorAssignedState *assignedState);
+bool keeper_node_active_get_other_nodes(Keeper *keeper, bool doInit,
+										MonitorAssignedState *assignedState,
+										NodeAddressArray *otherNodesArray,
+										bool *otherNodesOK);
 bool keeper_ensure_node_has_been_dropped(Keeper *keeper, bool *dropped);
+bool keeper_follow_formation_directory(Keeper *keeper);
 bool ReportPgIsRunning(Keeper *keeper);
 bool keeper_remove(Keeper *keeper, KeeperConfig *config);
 bool keeper_check_monitor_extension_version(Keeper *keeper,
 											MonitorExtensionVersion *version);
 bool keeper_state_as_json(Keeper *keeper, char *json, int size);
 bool keeper_update_group_hba(Keeper *keeper, NodeAddressArray *diffNodesArray);
+bool keeper_diff_nodes_array(NodeAddressArray *previousNodesArray,
+							 NodeAddressArray *currentNodesArray,
+							 NodeAddressArray *diffNodesArray);
 bool keeper_refresh_other_nodes(Keeper *keeper, bool forceCacheInvalidation);
 
 bool keeper_set_node_metadata(Keeper *keeper, KeeperConfig *oldConfig);
 bool keeper_update_nodename_from_monitor(Keeper *keeper);
+bool keeper_drain_standby(Keeper *keeper);
+bool keeper_drain_standby_done(Keeper *keeper);
 bool keeper_config_accept_new(Keeper *keeper, KeeperConfig *newConfig);
 
 
@@ -98,9 +237,19 @@ typedef bool (*KeeperNodesArrayRefreshFunction)(Keeper *keeper,
 												NodeAddressArray *newNodesArray,
 												bool forceCacheInvalidation);
 
+/*
+ * When the node becomes a primary, or stops being one, the keeper runs the
+ * actions that make client connections follow the primary, such as
+ * reconfiguring a connection pooler.
+ */
+typedef bool (*KeeperRoleChangeFunction)(Keeper *keeper,
+										 NodeState previousRole,
+										 NodeState newRole);
+
 /* src/bin/pg_autoctl/service_keeper.c */
 extern KeeperReloadFunction *KeeperReloadHooks;
 extern KeeperNodesArrayRefreshFunction *KeeperRefreshHooks;
+extern KeeperRoleChangeFunction *KeeperRoleChangeHooks;
 
 void keeper_call_reload_hooks(Keeper *keeper, bool firstLoop, bool doInit);
 bool keeper_reload_configuration(Keeper *keeper, bool firstLoop, bool doInit);
@@ -117,14 +266,32 @@ bool keeper_refresh_hba(Keeper *keeper,
 bool keeper_refresh_citus_remove_dropped_nodes(Keeper *keeper,
 											   NodeAddressArray *newNodesArray,
 											   bool forceCacheInvalidation);
+bool keeper_refresh_topology(Keeper *keeper,
+							 NodeAddressArray *newNodesArray,
+							 bool forceCacheInvalidation);
+
+void keeper_call_role_change_hooks(Keeper *keeper, NodeState previousRole);
+bool keeper_role_change_run_command(Keeper *keeper,
+									NodeState previousRole,
+									NodeState newRole);
+bool keeper_role_change_pgbouncer(Keeper *keeper,
+								  NodeState previousRole,
+								  NodeState newRole);
 
 bool keeper_read_nodes_from_file(Keeper *keeper, NodeAddressArray *nodesArray);
 bool keeper_get_primary(Keeper *keeper, NodeAddress *primaryNode);
 bool keeper_get_most_advanced_standby(Keeper *keeper, NodeAddress *primaryNode);
+bool keeper_get_clone_source(Keeper *keeper,
+							 NodeAddress *primaryNode,
+							 NodeAddress *cloneNode,
+							 bool *foundSecondary);
 
 
 bool keeper_pg_autoctl_get_version_from_disk(Keeper *keeper,
 											 KeeperVersion *version);
 
+bool keeper_startup_cache_is_valid(Keeper *keeper);
+bool keeper_startup_cache_update(Keeper *keeper);
+
 
 #endif /* KEEPER_H */
@@ -103,6 +103,10 @@
 	make_strbuf_option("postgresql", "hba_level", NULL, \
 					   false, MAXPGPATH, config->pgSetup.hbaLevelStr)
 
+#define OPTION_POSTGRESQL_TUNING_PROFILE(config) \
+	make_strbuf_option("postgresql", "tuning_profile", "tuning-profile", \
+					   false, NAMEDATALEN, config->pgSetup.tuningProfile)
+
 #define OPTION_SSL_ACTIVE(config) \
 	make_int_option_default("ssl", "active", NULL, \
 							false, &(config->pgSetup.ssl.active), 0)
@@ -139,16 +143,54 @@
 							   config->maximum_backup_rate, \
 							   MAXIMUM_BACKUP_RATE)
 
+#define OPTION_REPLICATION_SLOT_ADVANCE_THRESHOLD(config) \
+	make_int_option_default("replication", "slot_advance_threshold", NULL, \
+							false, &(config->slot_advance_threshold), \
+							REPLICATION_SLOT_ADVANCE_THRESHOLD)
+
 #define OPTION_REPLICATION_BACKUP_DIR(config) \
 	make_strbuf_option("replication", "backup_directory", NULL, \
 					   false, MAXPGPATH, config->backupDirectory)
 
+#define OPTION_REPLICATION_BACKUP_COMPRESSION(config) \
+	make_strbuf_option("replication", "backup_compression", NULL, \
+					   false, NAMEDATALEN, config->backup_compression)
+
+#define OPTION_REPLICATION_INCREMENTAL_BASE_DIR(config) \
+	make_strbuf_option("replication", "incremental_base_directory", NULL, \
+					   false, MAXPGPATH, config->incremental_base_directory)
+
+#define OPTION_REPLICATION_CLONE_COMMAND(config) \
+	make_strbuf_option("replication", "clone_command", NULL, \
+					   false, MAXCONNINFO, config->clone_command)
+
+#define OPTION_REPLICATION_CLONE_JOBS(config) \
+	make_int_option_default("replication", "clone_jobs", NULL, \
+							false, &(config->clone_jobs), \
+							REPLICATION_CLONE_JOBS)
+
+#define OPTION_REPLICATION_RESTORE_COMMAND(config) \
+	make_strbuf_option("replication", "restore_command", NULL, \
+					   false, MAXCONNINFO, config->restore_command)
+
+#define OPTION_REPLICATION_CLONE_FROM(config) \
+	make_strbuf_option_default("replication", "clone_from", "clone-from", \
+							   false, _POSIX_HOST_NAME_MAX, \
+							   config->clone_from, \
+							   REPLICATION_CLONE_FROM_PRIMARY)
+
 #define OPTION_TIMEOUT_NETWORK_PARTITION(config) \
 	make_int_option_default("timeout", "network_partition_timeout", \
 							NULL, false, \
 							&(config->network_partition_timeout), \
 							NETWORK_PARTITION_TIMEOUT)
 
+#define OPTION_TIMEOUT_NETWORK_PARTITION_CONFIRMED(config) \
+	make_int_option_default("timeout", "network_partition_confirmed_timeout", \
+							NULL, false, \
+							&(config->network_partition_confirmed_timeout), \
+							NETWORK_PARTITION_CONFIRMED_TIMEOUT)
+
 #define OPTION_TIMEOUT_PREPARE_PROMOTION_CATCHUP(config) \
 	make_int_option_default("timeout", "prepare_promotion_catchup", \
 							NULL, \
@@ -177,6 +219,13 @@
 							&(config->postgresql_restart_failure_max_retries), \
 							POSTGRESQL_FAILS_TO_START_RETRIES)
 
+#define OPTION_TIMEOUT_STANDBY_DRAIN_TIMEOUT(config) \
+	make_int_option_default("timeout", "standby_drain_timeout", \
+							NULL, \
+							false, \
+							&(config->standby_drain_timeout), \
+							STANDBY_DRAIN_TIMEOUT)
+
 #define OPTION_TIMEOUT_CITUS_MASTER_UPDATE_NODE_LOCK_COOLDOWN(config) \
 	make_int_option_default("timeout", "citus_master_update_node_lock_cooldown", \
 							NULL, \
@@ -204,6 +253,142 @@
 							&(config->listen_notifications_timeout), \
 							PG_AUTOCTL_LISTEN_NOTIFICATIONS_TIMEOUT)
 
+#define OPTION_SUPERVISOR_POSTGRES_RESTART_DELAY(config) \
+	make_int_option_default("supervisor", "postgres_restart_delay", \
+							NULL, false, \
+							&(config->postgres_restart.delayMs), \
+							SUPERVISOR_POSTGRES_RESTART_DELAY_MS)
+
+#define OPTION_SUPERVISOR_POSTGRES_RESTART_MULTIPLIER(config) \
+	make_int_option_default("supervisor", "postgres_restart_multiplier", \
+							NULL, false, \
+							&(config->postgres_restart.multiplier), \
+							SUPERVISOR_POSTGRES_RESTART_MULTIPLIER)
+
+#define OPTION_SUPERVISOR_POSTGRES_RESTART_MAX_DELAY(config) \
+	make_int_option_default("supervisor", "postgres_restart_max_delay", \
+							NULL, false, \
+							&(config->postgres_restart.maxDelayMs), \
+							SUPERVISOR_POSTGRES_RESTART_MAX_DELAY_MS)
+
+#define OPTION_SUPERVISOR_NODE_ACTIVE_RESTART_DELAY(config) \
+	make_int_option_default("supervisor", "node_active_restart_delay", \
+							NULL, false, \
+							&(config->node_active_restart.delayMs), \
+							SUPERVISOR_RESTART_DELAY_MS)
+
+#define OPTION_SUPERVISOR_NODE_ACTIVE_RESTART_MULTIPLIER(config) \
+	make_int_option_default("supervisor", "node_active_restart_multiplier", \
+							NULL, false, \
+							&(config->node_active_restart.multiplier), \
+							SUPERVISOR_RESTART_MULTIPLIER)
+
+#define OPTION_SUPERVISOR_NODE_ACTIVE_RESTART_MAX_DELAY(config) \
+	make_int_option_default("supervisor", "node_active_restart_max_delay", \
+							NULL, false, \
+							&(config->node_active_restart.maxDelayMs), \
+							SUPERVISOR_RESTART_MAX_DELAY_MS)
+
+#define OPTION_SUPERVISOR_NODE_ACTIVE_SCHED_POLICY(config) \
+	make_strbuf_option_default("supervisor", "node_active_sched_policy", \
+							   NULL, false, NAMEDATALEN, \
+							   config->node_active_scheduling.policy, \
+							   SUPERVISOR_NODE_ACTIVE_SCHED_POLICY)
+
+#define OPTION_SUPERVISOR_NODE_ACTIVE_NICE(config) \
+	make_int_option_default("supervisor", "node_active_nice", \
+							NULL, false, \
+							&(config->node_active_scheduling.nice), \
+							SUPERVISOR_NODE_ACTIVE_NICE)
+
+#define OPTION_SUPERVISOR_NODE_ACTIVE_CPU_AFFINITY(config) \
+	make_strbuf_option("supervisor", "node_active_cpu_affinity", NULL, \
+					   false, BUFSIZE, \
+					   config->node_active_scheduling.cpuList)
+
+#define OPTION_SUPERVISOR_LOCK_MEMORY(config) \
+	make_int_option_default("supervisor", "lock_memory", \
+							NULL, false, \
+							&(config->node_active_scheduling.lockMemory), \
+							SUPERVISOR_LOCK_MEMORY)
+
+#define OPTION_METRICS_PORT(config) \
+	make_int_option_default("metrics", "port", NULL, false, \
+							&(config->metrics_port), \
+							DEFAULT_METRICS_PORT)
+
+#define OPTION_METRICS_LISTEN_ADDRESS(config) \
+	make_strbuf_option_default("metrics", "listen_address", NULL, \
+							   false, MAXCONNINFO, \
+							   config->metrics_listen_address, \
+							   DEFAULT_METRICS_LISTEN_ADDRESS)
+
+#define OPTION_PREWARM_INTERVAL(config) \
+	make_int_option_default("prewarm", "interval", NULL, false, \
+							&(config->prewarm_interval), \
+							DEFAULT_PREWARM_INTERVAL)
+
+#define OPTION_LATENCY_INTERVAL(config) \
+	make_int_option_default("latency", "interval", NULL, false, \
+							&(config->latency_interval), \
+							DEFAULT_LATENCY_INTERVAL)
+
+#define OPTION_HEALTH_SIGNALS_INTERVAL(config) \
+	make_int_option_default("health", "signals_interval", NULL, false, \
+							&(config->health_signals_interval), \
+							DEFAULT_HEALTH_SIGNALS_INTERVAL)
+
+#define OPTION_LOAD_INTERVAL(config) \
+	make_int_option_default("load", "interval", NULL, false, \
+							&(config->load_interval), \
+							DEFAULT_LOAD_INTERVAL)
+
+#define OPTION_MONITOR_KEEPALIVE(config) \
+	make_int_option_default("monitor", "keepalive", NULL, false, \
+							&(config->monitor_keepalive), \
+							DEFAULT_MONITOR_KEEPALIVE)
+
+#define OPTION_MONITOR_SINGLE_CONNECTION(config) \
+	make_int_option_default("monitor", "single_connection", NULL, false, \
+							&(config->monitor_single_connection), \
+							DEFAULT_MONITOR_SINGLE_CONNECTION)
+
+#define OPTION_MONITOR_CALL_TIMEOUT(config) \
+	make_int_option_default("monitor", "call_timeout", NULL, false, \
+							&(config->monitor_call_timeout), \
+							DEFAULT_MONITOR_CALL_TIMEOUT)
+
+#define OPTION_STARTUP_FAST_START(config) \
+	make_int_option_default("startup", "fast_start", NULL, false, \
+							&(config->startup_fast_start), \
+							DEFAULT_STARTUP_FAST_START)
+
+#define OPTION_TOPOLOGY_SNAPSHOT(config) \
+	make_int_option_default("topology", "snapshot", NULL, false, \
+							&(config->topology_snapshot), \
+							DEFAULT_TOPOLOGY_SNAPSHOT)
+
+#define OPTION_TOPOLOGY_SERVICE_FILE(config) \
+	make_int_option_default("topology", "service_file", NULL, false, \
+							&(config->topology_service_file), \
+							DEFAULT_TOPOLOGY_SERVICE_FILE)
+
+#define OPTION_HOOKS_ON_PRIMARY(config) \
+	make_strbuf_option("hooks", "on_primary", NULL, \
+					   false, MAXCONNINFO, config->hooks_on_primary)
+
+#define OPTION_HOOKS_ON_DEMOTE(config) \
+	make_strbuf_option("hooks", "on_demote", NULL, \
+					   false, MAXCONNINFO, config->hooks_on_demote)
+
+#define OPTION_HOOKS_PGBOUNCER(config) \
+	make_strbuf_option("hooks", "pgbouncer", NULL, \
+					   false, MAXCONNINFO, config->hooks_pgbouncer)
+
+#define OPTION_HOOKS_ON_STANDBY_DRAIN(config) \
+	make_strbuf_option("hooks", "on_standby_drain", NULL, \
+					   false, MAXCONNINFO, config->hooks_on_standby_drain)
+
 #define OPTION_CITUS_ROLE(config) \
 	make_strbuf_option_default("citus", "role", NULL, false, NAMEDATALEN, \
 							   config->citusRoleStr, DEFAULT_CITUS_ROLE)
@@ -232,6 +417,7 @@
 		OPTION_POSTGRESQL_LISTEN_ADDRESSES(config), \
 		OPTION_POSTGRESQL_AUTH_METHOD(config), \
 		OPTION_POSTGRESQL_HBA_LEVEL(config), \
+		OPTION_POSTGRESQL_TUNING_PROFILE(config), \
 		OPTION_SSL_ACTIVE(config), \
 		OPTION_SSL_MODE(config), \
 		OPTION_SSL_CA_FILE(config), \
@@ -239,13 +425,22 @@
 		OPTION_SSL_SERVER_CERT(config), \
 		OPTION_SSL_SERVER_KEY(config), \
 		OPTION_REPLICATION_MAXIMUM_BACKUP_RATE(config), \
+		OPTION_REPLICATION_SLOT_ADVANCE_THRESHOLD(config), \
 		OPTION_REPLICATION_BACKUP_DIR(config), \
+		OPTION_REPLICATION_CLONE_FROM(config), \
+		OPTION_REPLICATION_BACKUP_COMPRESSION(config), \
+		OPTION_REPLICATION_INCREMENTAL_BASE_DIR(config), \
+		OPTION_REPLICATION_CLONE_COMMAND(config), \
+		OPTION_REPLICATION_CLONE_JOBS(config), \
+		OPTION_REPLICATION_RESTORE_COMMAND(config), \
 		OPTION_REPLICATION_PASSWORD(config), \
 		OPTION_TIMEOUT_NETWORK_PARTITION(config), \
+		OPTION_TIMEOUT_NETWORK_PARTITION_CONFIRMED(config), \
 		OPTION_TIMEOUT_PREPARE_PROMOTION_CATCHUP(config), \
 		OPTION_TIMEOUT_PREPARE_PROMOTION_WALRECEIVER(config), \
 		OPTION_TIMEOUT_POSTGRESQL_RESTART_FAILURE_TIMEOUT(config), \
 		OPTION_TIMEOUT_POSTGRESQL_RESTART_FAILURE_MAX_RETRIES(config), \
+		OPTION_TIMEOUT_STANDBY_DRAIN_TIMEOUT(config), \
 		OPTION_TIMEOUT_LISTEN_NOTIFICATIONS(config), \
  \
 		OPTION_TIMEOUT_CITUS_MASTER_UPDATE_NODE_LOCK_COOLDOWN(config), \
@@ -254,6 +449,33 @@
  \
 		OPTION_CITUS_ROLE(config), \
 		OPTION_CITUS_CLUSTER_NAME(config), \
+ \
+		OPTION_SUPERVISOR_POSTGRES_RESTART_DELAY(config), \
+		OPTION_SUPERVISOR_POSTGRES_RESTART_MULTIPLIER(config), \
+		OPTION_SUPERVISOR_POSTGRES_RESTART_MAX_DELAY(config), \
+		OPTION_SUPERVISOR_NODE_ACTIVE_RESTART_DELAY(config), \
+		OPTION_SUPERVISOR_NODE_ACTIVE_RESTART_MULTIPLIER(config), \
+		OPTION_SUPERVISOR_NODE_ACTIVE_RESTART_MAX_DELAY(config), \
+		OPTION_SUPERVISOR_NODE_ACTIVE_SCHED_POLICY(config), \
+		OPTION_SUPERVISOR_NODE_ACTIVE_NICE(config), \
+		OPTION_SUPERVISOR_NODE_ACTIVE_CPU_AFFINITY(config), \
+		OPTION_SUPERVISOR_LOCK_MEMORY(config), \
+		OPTION_METRICS_PORT(config), \
+		OPTION_METRICS_LISTEN_ADDRESS(config), \
+		OPTION_PREWARM_INTERVAL(config), \
+		OPTION_LATENCY_INTERVAL(config), \
+		OPTION_HEALTH_SIGNALS_INTERVAL(config), \
+		OPTION_LOAD_INTERVAL(config), \
+		OPTION_MONITOR_KEEPALIVE(config), \
+		OPTION_MONITOR_SINGLE_CONNECTION(config), \
+		OPTION_MONITOR_CALL_TIMEOUT(config), \
+		OPTION_STARTUP_FAST_START(config), \
+		OPTION_TOPOLOGY_SNAPSHOT(config), \
+		OPTION_TOPOLOGY_SERVICE_FILE(config), \
+		OPTION_HOOKS_ON_PRIMARY(config), \
+		OPTION_HOOKS_ON_DEMOTE(config), \
+		OPTION_HOOKS_PGBOUNCER(config), \
+		OPTION_HOOKS_ON_STANDBY_DRAIN(config), \
 		INI_OPTION_LAST \
 	}
 
@@ -627,6 +849,15 @@ keeper_config_log_settings(KeeperConfig config)
 			  config.replication_password);
 	log_debug("replication.maximum_backup_rate: %s",
 			  config.maximum_backup_rate);
+	log_debug("replication.slot_advance_threshold: %d",
+			  config.slot_advance_threshold);
+	log_debug("replication.clone_from: %s", config.clone_from);
+	log_debug("replication.backup_compression: %s", config.backup_compression);
+	log_debug("replication.incremental_base_directory: %s",
+			  config.incremental_base_directory);
+	log_debug("replication.clone_command: %s", config.clone_command);
+	log_debug("replication.clone_jobs: %d", config.clone_jobs);
+	log_debug("replication.restore_command: %s", config.restore_command);
 }
 
 
@@ -925,3 +1156,163 @@ keeper_config_update_with_absolute_pgdata(KeeperConfig *config)
 	}
 	return true;
 }
+
+
+/*
+ * keeper_config_diff compares the current configuration with a new one, as
+ * read from the configuration file when reloading, and returns a bitmask of
+ * the KeeperConfigChanges sections that differ. Only the settings that may be
+ * changed at run-time, or that we refuse to change, are compared here.
+ */
+int
+keeper_config_diff(KeeperConfig *config, KeeperConfig *newConfig)
+{
+	int changes = KEEPER_CONFIG_CHANGED_NONE;
+
+	SSLOptions *ssl = &(config->pgSetup.ssl);
+	SSLOptions *newSSL = &(newConfig->pgSetup.ssl);
+
+	if (strneq(config->pgSetup.pgdata, newConfig->pgSetup.pgdata))
+	{
+		changes |= KEEPER_CONFIG_CHANGED_PGDATA;
+	}
+
+	if (strneq(config->monitor_pguri, newConfig->monitor_pguri))
+	{
+		changes |= KEEPER_CONFIG_CHANGED_MONITOR;
+	}
+
+	if (config->monitor_keepalive != newConfig->monitor_keepalive ||
+		config->monitor_single_connection !=
+		newConfig->monitor_single_connection ||
+		config->monitor_call_timeout != newConfig->monitor_call_timeout)
+	{
+		changes |= KEEPER_CONFIG_CHANGED_MONITOR_CONNECTION;
+	}
+
+	if (strneq(config->formation, newConfig->formation))
+	{
+		changes |= KEEPER_CONFIG_CHANGED_FORMATION;
+	}
+
+	if (strneq(config->name, newConfig->name) ||
+		strneq(config->hostname, newConfig->hostname))
+	{
+		changes |= KEEPER_CONFIG_CHANGED_NODE_METADATA;
+	}
+
+	if (ssl->active != newSSL->active ||
+		ssl->sslMode != newSSL->sslMode ||
+		strneq(ssl->caFile, newSSL->caFile) ||
+		strneq(ssl->crlFile, newSSL->crlFile) ||
+		strneq(ssl->serverCert, newSSL->serverCert) ||
+		strneq(ssl->serverKey, newSSL->serverKey))
+	{
+		changes |= KEEPER_CONFIG_CHANGED_SSL;
+	}
+
+	if (strneq(config->replication_password,
+			   newConfig->replication_password) ||
+		strneq(config->restore_command, newConfig->restore_command))
+	{
+		changes |= KEEPER_CONFIG_CHANGED_REPLICATION;
+	}
+
+	if (strneq(config->maximum_backup_rate, newConfig->maximum_backup_rate) ||
+		strneq(config->clone_from, newConfig->clone_from) ||
+		strneq(config->backup_compression, newConfig->backup_compression) ||
+		strneq(config->incremental_base_directory,
+			   newConfig->incremental_base_directory) ||
+		strneq(config->clone_command, newConfig->clone_command) ||
+		config->clone_jobs != newConfig->clone_jobs ||
+		strneq(config->backupDirectory, newConfig->backupDirectory) ||
+		config->slot_advance_threshold != newConfig->slot_advance_threshold)
+	{
+		changes |= KEEPER_CONFIG_CHANGED_BACKUP;
+	}
+
+	if (config->latency_interval != newConfig->latency_interval ||
+		config->health_signals_interval != newConfig->health_signals_interval ||
+		config->load_interval != newConfig->load_interval)
+	{
+		changes |= KEEPER_CONFIG_CHANGED_MEASUREMENTS;
+	}
+
+	if (config->topology_snapshot != newConfig->topology_snapshot ||
+		config->topology_service_file != newConfig->topology_service_file)
+	{
+		changes |= KEEPER_CONFIG_CHANGED_TOPOLOGY;
+	}
+
+	if (strneq(config->hooks_on_primary, newConfig->hooks_on_primary) ||
+		strneq(config->hooks_on_demote, newConfig->hooks_on_demote) ||
+		strneq(config->hooks_pgbouncer, newConfig->hooks_pgbouncer) ||
+		strneq(config->hooks_on_standby_drain,
+			   newConfig->hooks_on_standby_drain))
+	{
+		changes |= KEEPER_CONFIG_CHANGED_HOOKS;
+	}
+
+	if (config->network_partition_timeout !=
+		newConfig->network_partition_timeout ||
+		config->network_partition_confirmed_timeout !=
+		newConfig->network_partition_confirmed_timeout ||
+		config->prepare_promotion_catchup !=
+		newConfig->prepare_promotion_catchup ||
+		config->prepare_promotion_walreceiver !=
+		newConfig->prepare_promotion_walreceiver ||
+		config->postgresql_restart_failure_timeout !=
+		newConfig->postgresql_restart_failure_timeout ||
+		config->postgresql_restart_failure_max_retries !=
+		newConfig->postgresql_restart_failure_max_retries ||
+		config->standby_drain_timeout != newConfig->standby_drain_timeout)
+	{
+		changes |= KEEPER_CONFIG_CHANGED_TIMEOUTS;
+	}
+
+	return changes;
+}
+
+
+/*
+ * keeper_config_changes_to_string writes a comma separated list of the
+ * section names found in the given KeeperConfigChanges bitmask.
+ */
+void
+keeper_config_changes_to_string(int changes, char *buffer, size_t size)
+{
+	struct
+	{
+		KeeperConfigChanges flag;
+		char *name;
+	}
+	sections[] = {
+		{ KEEPER_CONFIG_CHANGED_PGDATA, "pgdata" },
+		{ KEEPER_CONFIG_CHANGED_MONITOR, "monitor" },
+		{ KEEPER_CONFIG_CHANGED_MONITOR_CONNECTION, "monitor connection" },
+		{ KEEPER_CONFIG_CHANGED_FORMATION, "formation" },
+		{ KEEPER_CONFIG_CHANGED_NODE_METADATA, "node metadata" },
+		{ KEEPER_CONFIG_CHANGED_SSL, "ssl" },
+		{ KEEPER_CONFIG_CHANGED_REPLICATION, "replication" },
+		{ KEEPER_CONFIG_CHANGED_BACKUP, "backup" },
+		{ KEEPER_CONFIG_CHANGED_MEASUREMENTS, "measurements" },
+		{ KEEPER_CONFIG_CHANGED_TOPOLOGY, "topology" },
+		{ KEEPER_CONFIG_CHANGED_HOOKS, "hooks" },
+		{ KEEPER_CONFIG_CHANGED_TIMEOUTS, "timeouts" },
+		{ KEEPER_CONFIG_CHANGED_NONE, NULL }
+	};
+
+	int len = 0;
+
+	buffer[0] = '\0';
+
+	for (int i = 0; sections[i].name != NULL && (size_t) len < size; i++)
+	{
+		if (changes & sections[i].flag)
+		{
+			len += sformat(buffer + len, size - len, "%s%s",
+						   len == 0 ? "" : ", ",
+						   sections[i].name);
+		}
+	}
+}
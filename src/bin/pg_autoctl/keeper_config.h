@@ -17,6 +17,7 @@
 #include "defaults.h"
 #include "pgctl.h"
 #include "pgsql.h"
+#include "supervisor.h"
 
 /*
  * We support "primary" and "secondary" roles in Citus, when Citus support is
@@ -55,6 +56,13 @@ typedef struct KeeperConfig
 	char replication_password[MAXCONNINFO];
 	char maximum_backup_rate[MAXIMUM_BACKUP_RATE_LEN];
 	char backupDirectory[MAXPGPATH];
+	int slot_advance_threshold;
+	char clone_from[_POSIX_HOST_NAME_MAX];
+	char backup_compression[NAMEDATALEN];
+	char incremental_base_directory[MAXPGPATH];
+	char clone_command[MAXCONNINFO];
+	int clone_jobs;
+	char restore_command[MAXCONNINFO];
 
 	/* Citus specific options and settings */
 	char citusRoleStr[NAMEDATALEN];
@@ -62,17 +70,97 @@ typedef struct KeeperConfig
 
 	/* pg_autoctl timeouts */
 	int network_partition_timeout;
+	int network_partition_confirmed_timeout;
 	int prepare_promotion_catchup;
 	int prepare_promotion_walreceiver;
 	int postgresql_restart_failure_timeout;
 	int postgresql_restart_failure_max_retries;
+	int standby_drain_timeout;
 
 	int citus_master_update_node_lock_cooldown;
 	int citus_coordinator_wait_timeout;
 	int citus_coordinator_wait_max_retries;
 	int listen_notifications_timeout;
+
+	/* restart backoff of the supervised services */
+	RestartBackoff postgres_restart;
+	RestartBackoff node_active_restart;
+
+	/* scheduling of the node-active service, and memory locking */
+	ServiceScheduling node_active_scheduling;
+
+	/* pg_autoctl metrics HTTP endpoint */
+	int metrics_port;
+	char metrics_listen_address[MAXCONNINFO];
+
+	/* shared buffers warm-up of the standby nodes */
+	int prewarm_interval;
+
+	/* network latency measurements to the other nodes */
+	int latency_interval;
+
+	/* health signals measurements of the primary node */
+	int health_signals_interval;
+
+	/* load measurements of the standby nodes */
+	int load_interval;
+
+	/* keep the connection to the monitor open between calls */
+	int monitor_keepalive;
+
+	/* use the same monitor connection for queries and notifications */
+	int monitor_single_connection;
+
+	/* deadline of each call to the monitor, in seconds */
+	int monitor_call_timeout;
+
+	/* defer the startup checks that passed in the previous run */
+	int startup_fast_start;
+
+	/* local snapshot of our group topology, for client discovery */
+	int topology_snapshot;
+	int topology_service_file;
+
+	/* actions to run when the node becomes primary or stops being one */
+	char hooks_on_primary[MAXCONNINFO];
+	char hooks_on_demote[MAXCONNINFO];
+	char hooks_pgbouncer[MAXCONNINFO];
+
+	/* action to run when a standby drains its read sessions before a restart */
+	char hooks_on_standby_drain[MAXCONNINFO];
 } KeeperConfig;
 
+/*
+ * When reloading the configuration we compute the set of sections that have
+ * changed, so that we run only the handlers that are needed. Some changes are
+ * only applied in memory, others need the monitor connection to be reset, the
+ * node metadata sent to the monitor, or the Postgres setup to be ensured
+ * again.
+ */
+typedef enum
+{
+	KEEPER_CONFIG_CHANGED_NONE = 0,
+	KEEPER_CONFIG_CHANGED_PGDATA = 1 << 0,
+	KEEPER_CONFIG_CHANGED_MONITOR = 1 << 1,
+	KEEPER_CONFIG_CHANGED_MONITOR_CONNECTION = 1 << 2,
+	KEEPER_CONFIG_CHANGED_FORMATION = 1 << 3,
+	KEEPER_CONFIG_CHANGED_NODE_METADATA = 1 << 4,
+	KEEPER_CONFIG_CHANGED_SSL = 1 << 5,
+	KEEPER_CONFIG_CHANGED_REPLICATION = 1 << 6,
+	KEEPER_CONFIG_CHANGED_BACKUP = 1 << 7,
+	KEEPER_CONFIG_CHANGED_MEASUREMENTS = 1 << 8,
+	KEEPER_CONFIG_CHANGED_TOPOLOGY = 1 << 9,
+	KEEPER_CONFIG_CHANGED_HOOKS = 1 << 10,
+	KEEPER_CONFIG_CHANGED_TIMEOUTS = 1 << 11
+} KeeperConfigChanges;
+
+/* changes that need keeper_ensure_configuration() to be called again */
+#define KEEPER_CONFIG_CHANGES_NEED_ENSURE \
+	(KEEPER_CONFIG_CHANGED_MONITOR | \
+	 KEEPER_CONFIG_CHANGED_NODE_METADATA | \
+	 KEEPER_CONFIG_CHANGED_SSL | \
+	 KEEPER_CONFIG_CHANGED_REPLICATION)
+
 #define PG_AUTOCTL_MONITOR_IS_DISABLED(config) \
 	(strcmp(config->monitor_pguri, PG_AUTOCTL_MONITOR_DISABLED) == 0)
 
@@ -108,4 +196,7 @@ bool keeper_config_merge_options(KeeperConfig *config, KeeperConfig *options);
 bool keeper_config_update(KeeperConfig *config, int64_t nodeId, int groupId);
 bool keeper_config_update_with_absolute_pgdata(KeeperConfig *config);
 
+int keeper_config_diff(KeeperConfig *config, KeeperConfig *newConfig);
+void keeper_config_changes_to_string(int changes, char *buffer, size_t size);
+
 #endif /* KEEPER_CONFIG_H */
@@ -0,0 +1,868 @@
+/*
+ * src/bin/pg_autoctl/keeper_metrics.c
+ *     Metrics of the keeper, shared between the pg_autoctl services
+ *
+ * The node-active process maps the pg_autoctl.metrics file in memory and
+ * updates the metrics there at each round of its main loop. The metrics
+ * service maps the same file and serves the metrics over HTTP. Updating the
+ * metrics is a few memory writes, and serving them requires no SQL query and
+ * no connection to the monitor.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "postgres_fe.h"
+
+#include "defaults.h"
+#include "file_utils.h"
+#include "keeper_metrics.h"
+#include "log.h"
+#include "parsing.h"
+#include "supervisor.h"
+
+/* the metrics of this process, when the metrics file exists */
+static KeeperMetrics *keeperMetrics = NULL;
+
+/* in the same order as the KeeperMetricsService enum */
+static const char *KeeperMetricsServiceNames[] = {
+	SERVICE_NAME_POSTGRES,
+	SERVICE_NAME_KEEPER,
+	SERVICE_NAME_METRICS
+};
+
+static double keeper_metrics_elapsed(instr_time startTime);
+static void keeper_metrics_summary_add(KeeperMetricsSummary *summary,
+									   double duration);
+static void keeper_metrics_begin_update(void);
+static void keeper_metrics_end_update(void);
+static KeeperMetricsTransition * keeper_metrics_get_transition(NodeState current,
+															   NodeState assigned);
+static void keeper_metrics_format_summary(PQExpBuffer out,
+										  const char *name,
+										  KeeperMetricsSummary *summary);
+
+
+/*
+ * keeper_metrics_create creates the metrics file, or resets its contents when
+ * it already exists. It is called from the supervisor before starting the
+ * services, so that the metrics start afresh with each pg_autoctl run.
+ */
+bool
+keeper_metrics_create(const char *filename)
+{
+	KeeperMetrics metrics = { 0 };
+
+	metrics.version = KEEPER_METRICS_VERSION;
+
+	int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+
+	if (fd < 0)
+	{
+		log_error("Failed to create keeper metrics file \"%s\": %m", filename);
+		return false;
+	}
+
+	errno = 0;
+	if (write(fd, &metrics, sizeof(KeeperMetrics)) != sizeof(KeeperMetrics))
+	{
+		/* if write didn't set errno, assume problem is no disk space */
+		if (errno == 0)
+		{
+			errno = ENOSPC;
+		}
+		log_error("Failed to write keeper metrics file \"%s\": %m", filename);
+		close(fd);
+		return false;
+	}
+
+	close(fd);
+
+	return true;
+}
+
+
+/*
+ * keeper_metrics_attach maps the metrics file in memory. When the file does
+ * not exist the metrics are disabled, and the keeper_metrics_record_*
+ * functions do nothing.
+ */
+bool
+keeper_metrics_attach(const char *filename)
+{
+	if (keeperMetrics != NULL)
+	{
+		return true;
+	}
+
+	if (IS_EMPTY_STRING_BUFFER(filename) || !file_exists(filename))
+	{
+		log_trace("keeper_metrics_attach: metrics are disabled");
+		return false;
+	}
+
+	int fd = open(filename, O_RDWR);
+
+	if (fd < 0)
+	{
+		log_warn("Failed to open keeper metrics file \"%s\": %m", filename);
+		return false;
+	}
+
+	struct stat st;
+
+	if (fstat(fd, &st) != 0 || st.st_size != sizeof(KeeperMetrics))
+	{
+		log_warn("Failed to use keeper metrics file \"%s\": "
+				 "file size is not %zu bytes",
+				 filename, sizeof(KeeperMetrics));
+		close(fd);
+		return false;
+	}
+
+	void *address = mmap(NULL, sizeof(KeeperMetrics),
+						 PROT_READ | PROT_WRITE, MAP_SHARED,
+						 fd, 0);
+
+	/* the mapping remains valid after closing the file */
+	close(fd);
+
+	if (address == MAP_FAILED)
+	{
+		log_warn("Failed to map keeper metrics file \"%s\": %m", filename);
+		return false;
+	}
+
+	KeeperMetrics *metrics = (KeeperMetrics *) address;
+
+	if (metrics->version != KEEPER_METRICS_VERSION)
+	{
+		log_warn("Failed to use keeper metrics file \"%s\": "
+				 "version is %d, expected %d",
+				 filename, metrics->version, KEEPER_METRICS_VERSION);
+		munmap(address, sizeof(KeeperMetrics));
+		return false;
+	}
+
+	keeperMetrics = metrics;
+
+	log_debug("Keeper metrics are available in \"%s\"", filename);
+
+	return true;
+}
+
+
+/*
+ * keeper_metrics_detach unmaps the metrics file.
+ */
+void
+keeper_metrics_detach()
+{
+	if (keeperMetrics != NULL)
+	{
+		munmap((void *) keeperMetrics, sizeof(KeeperMetrics));
+		keeperMetrics = NULL;
+	}
+}
+
+
+/*
+ * keeper_metrics_snapshot copies a consistent version of the shared metrics.
+ */
+bool
+keeper_metrics_snapshot(KeeperMetrics *metrics)
+{
+	if (keeperMetrics == NULL)
+	{
+		return false;
+	}
+
+	for (int attempt = 0; attempt < 1000; attempt++)
+	{
+		uint64_t before = keeperMetrics->changeCount;
+
+		__sync_synchronize();
+
+		/*
+		 * Explanation of IGNORE-BANNED:
+		 * memcpy is safe to use here: KeeperMetrics is a plain struct that
+		 * does not contain any pointers, and both sides have the same size.
+		 */
+		memcpy(metrics, (void *) keeperMetrics, sizeof(KeeperMetrics)); /* IGNORE-BANNED */
+
+		__sync_synchronize();
+
+		if (before % 2 == 0 && keeperMetrics->changeCount == before)
+		{
+			return true;
+		}
+
+		/* the node-active process is updating the metrics, try again */
+		pg_usleep(10);
+	}
+
+	log_warn("Failed to get a consistent copy of the keeper metrics");
+
+	return false;
+}
+
+
+/*
+ * keeper_metrics_record_service_start counts a start of the given service.
+ * Services start concurrently, so we use an atomic increment rather than an
+ * update of the metrics.
+ */
+void
+keeper_metrics_record_service_start(KeeperMetricsService service)
+{
+	if (keeperMetrics == NULL)
+	{
+		return;
+	}
+
+	(void) __sync_fetch_and_add(&(keeperMetrics->serviceStarts[service]), 1);
+}
+
+
+/*
+ * keeper_metrics_record_loop records the duration of a round of the keeper
+ * main loop, and the state of the keeper and its local Postgres instance at
+ * the end of this round.
+ */
+void
+keeper_metrics_record_loop(Keeper *keeper, instr_time startTime)
+{
+	KeeperStateData *keeperState = &(keeper->state);
+	LocalPostgresServer *postgres = &(keeper->postgres);
+
+	if (keeperMetrics == NULL)
+	{
+		return;
+	}
+
+	double duration = keeper_metrics_elapsed(startTime);
+
+	uint64_t currentLSN = 0;
+	uint64_t replayLSN = 0;
+
+	/* LSN values are kept as text, and might be empty */
+	if (!IS_EMPTY_STRING_BUFFER(postgres->currentLSN))
+	{
+		(void) parseLSN(postgres->currentLSN, &currentLSN);
+	}
+
+	if (!IS_EMPTY_STRING_BUFFER(postgres->replayLSN))
+	{
+		(void) parseLSN(postgres->replayLSN, &replayLSN);
+	}
+
+	keeper_metrics_begin_update();
+
+	keeperMetrics->nodeId = keeperState->current_node_id;
+	keeperMetrics->groupId = keeperState->current_group;
+	keeperMetrics->currentRole = keeperState->current_role;
+	keeperMetrics->assignedRole = keeperState->assigned_role;
+	keeperMetrics->lastLoopTime = (uint64_t) time(NULL);
+	keeperMetrics->lastMonitorContact = keeperState->last_monitor_contact;
+
+	keeperMetrics->pgIsRunning = postgres->pgIsRunning;
+	keeperMetrics->currentLSN = currentLSN;
+	keeperMetrics->replayLSN = replayLSN;
+	keeperMetrics->pgStartRetries = postgres->pgStartRetries;
+
+	keeper_metrics_summary_add(&(keeperMetrics->loop), duration);
+
+	keeper_metrics_end_update();
+}
+
+
+/*
+ * keeper_metrics_record_node_active records the duration of a node_active
+ * call to the monitor, and the time it took to connect to the monitor. With
+ * monitor.keepalive the call might have used the connection opened in a
+ * previous round, which we count separately.
+ */
+void
+keeper_metrics_record_node_active(Keeper *keeper, instr_time startTime,
+								  bool success)
+{
+	ConnectionRetryPolicy *retryPolicy = &(keeper->monitor.pgsql.retryPolicy);
+
+	if (keeperMetrics == NULL)
+	{
+		return;
+	}
+
+	double duration = keeper_metrics_elapsed(startTime);
+	double connectTime = 0.0;
+
+	/* the connection was opened in this call when it started after us */
+	instr_time sinceStart = retryPolicy->startTime;
+
+	INSTR_TIME_SUBTRACT(sinceStart, startTime);
+
+	bool reusedConnection = INSTR_TIME_GET_DOUBLE(sinceStart) < 0.0;
+
+	if (!INSTR_TIME_IS_ZERO(retryPolicy->connectTime))
+	{
+		instr_time elapsed = retryPolicy->connectTime;
+
+		INSTR_TIME_SUBTRACT(elapsed, retryPolicy->startTime);
+		connectTime = INSTR_TIME_GET_DOUBLE(elapsed);
+	}
+
+	keeper_metrics_begin_update();
+
+	if (success)
+	{
+		keeper_metrics_summary_add(&(keeperMetrics->nodeActive), duration);
+
+		if (reusedConnection)
+		{
+			++(keeperMetrics->monitorConnectionsReused);
+		}
+		else
+		{
+			++(keeperMetrics->monitorConnections);
+			keeperMetrics->monitorConnectTime = connectTime;
+		}
+	}
+	else
+	{
+		++(keeperMetrics->nodeActiveErrors);
+	}
+
+	keeper_metrics_end_update();
+}
+
+
+/*
+ * keeper_metrics_record_transition records the duration of a transition of
+ * the keeper state machine, and its entry in the transition history when we
+ * could record it there.
+ */
+void
+keeper_metrics_record_transition(NodeState current, NodeState assigned,
+								 instr_time startTime, bool success,
+								 KeeperTransition *history)
+{
+	if (keeperMetrics == NULL)
+	{
+		return;
+	}
+
+	double duration = keeper_metrics_elapsed(startTime);
+
+	keeper_metrics_begin_update();
+
+	KeeperMetricsTransition *transition =
+		keeper_metrics_get_transition(current, assigned);
+
+	if (transition != NULL)
+	{
+		keeper_metrics_summary_add(&(transition->duration), duration);
+
+		if (!success)
+		{
+			++(transition->failures);
+		}
+
+		if (history != NULL)
+		{
+			transition->lastStartTime = history->startTime;
+			transition->lastEndTime = history->endTime;
+			transition->lastRetries = history->retries;
+		}
+	}
+
+	keeper_metrics_end_update();
+}
+
+
+/*
+ * keeper_metrics_record_wakeup records how late the keeper main loop woke up
+ * from a sleep of sleepMs milliseconds that started at startTime, which is
+ * the scheduling latency of the node-active process. Sleeps that ended early,
+ * such as on a notification from the monitor, are skipped.
+ */
+void
+keeper_metrics_record_wakeup(instr_time startTime, int sleepMs)
+{
+	if (keeperMetrics == NULL)
+	{
+		return;
+	}
+
+	double latency = keeper_metrics_elapsed(startTime) - sleepMs / 1000.0;
+
+	if (latency < 0)
+	{
+		return;
+	}
+
+	keeper_metrics_begin_update();
+
+	keeper_metrics_summary_add(&(keeperMetrics->wakeupLatency), latency);
+
+	keeper_metrics_end_update();
+}
+
+
+/*
+ * keeper_metrics_record_state_fsync records how long it took to fsync one of
+ * our state files, which is most of the cost of a durable state write.
+ */
+void
+keeper_metrics_record_state_fsync(instr_time startTime)
+{
+	if (keeperMetrics == NULL)
+	{
+		return;
+	}
+
+	double duration = keeper_metrics_elapsed(startTime);
+
+	keeper_metrics_begin_update();
+
+	keeper_metrics_summary_add(&(keeperMetrics->stateFsync), duration);
+
+	keeper_metrics_end_update();
+}
+
+
+/*
+ * keeper_metrics_record_state_write_skipped counts a state write that we
+ * skipped because the file already has the same contents.
+ */
+void
+keeper_metrics_record_state_write_skipped()
+{
+	if (keeperMetrics == NULL)
+	{
+		return;
+	}
+
+	keeper_metrics_begin_update();
+
+	++(keeperMetrics->stateWritesSkipped);
+
+	keeper_metrics_end_update();
+}
+
+
+/*
+ * keeper_metrics_record_settings counts the Postgres settings that we applied,
+ * or that we skipped because their fingerprint did not change.
+ */
+void
+keeper_metrics_record_settings(bool applied)
+{
+	if (keeperMetrics == NULL)
+	{
+		return;
+	}
+
+	keeper_metrics_begin_update();
+
+	if (applied)
+	{
+		++(keeperMetrics->settingsApplied);
+	}
+	else
+	{
+		++(keeperMetrics->settingsSkipped);
+	}
+
+	keeper_metrics_end_update();
+}
+
+
+/*
+ * keeper_metrics_format appends the given metrics to the buffer, in the
+ * Prometheus text exposition format.
+ */
+void
+keeper_metrics_format(KeeperMetrics *metrics, const char *formation,
+					  PQExpBuffer out)
+{
+	char labels[BUFSIZE] = { 0 };
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_info Identity of this node.\n"
+					  "# TYPE pg_autoctl_keeper_info gauge\n"
+					  "pg_autoctl_keeper_info{formation=\"%s\",group=\"%d\","
+					  "node_id=\"%" PRId64 "\"} 1\n",
+					  formation, metrics->groupId, metrics->nodeId);
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_state Current state of this node.\n"
+					  "# TYPE pg_autoctl_keeper_state gauge\n"
+					  "pg_autoctl_keeper_state{state=\"%s\"} 1\n",
+					  NodeStateToString(metrics->currentRole));
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_assigned_state "
+					  "State assigned to this node.\n"
+					  "# TYPE pg_autoctl_keeper_assigned_state gauge\n"
+					  "pg_autoctl_keeper_assigned_state{state=\"%s\"} 1\n",
+					  NodeStateToString(metrics->assignedRole));
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_last_loop_timestamp_seconds "
+					  "Time of the last round of the keeper main loop.\n"
+					  "# TYPE pg_autoctl_keeper_last_loop_timestamp_seconds gauge\n"
+					  "pg_autoctl_keeper_last_loop_timestamp_seconds %" PRIu64 "\n",
+					  metrics->lastLoopTime);
+
+	(void) keeper_metrics_format_summary(out,
+										 "pg_autoctl_keeper_loop_duration_seconds",
+										 &(metrics->loop));
+
+	(void) keeper_metrics_format_summary(out,
+										 "pg_autoctl_keeper_wakeup_latency_seconds",
+										 &(metrics->wakeupLatency));
+
+	(void) keeper_metrics_format_summary(out,
+										 "pg_autoctl_keeper_node_active_duration_seconds",
+										 &(metrics->nodeActive));
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_node_active_errors_total "
+					  "Failed node_active calls to the monitor.\n"
+					  "# TYPE pg_autoctl_keeper_node_active_errors_total counter\n"
+					  "pg_autoctl_keeper_node_active_errors_total %" PRIu64 "\n",
+					  metrics->nodeActiveErrors);
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_monitor_connect_seconds "
+					  "Time it took to connect to the monitor.\n"
+					  "# TYPE pg_autoctl_keeper_monitor_connect_seconds gauge\n"
+					  "pg_autoctl_keeper_monitor_connect_seconds %g\n",
+					  metrics->monitorConnectTime);
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_monitor_connections_total "
+					  "node_active calls that opened a new connection.\n"
+					  "# TYPE pg_autoctl_keeper_monitor_connections_total counter\n"
+					  "pg_autoctl_keeper_monitor_connections_total %" PRIu64 "\n",
+					  metrics->monitorConnections);
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_monitor_connections_reused_total "
+					  "node_active calls that reused an open connection.\n"
+					  "# TYPE pg_autoctl_keeper_monitor_connections_reused_total "
+					  "counter\n"
+					  "pg_autoctl_keeper_monitor_connections_reused_total %"
+					  PRIu64 "\n",
+					  metrics->monitorConnectionsReused);
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_monitor_last_contact_timestamp_seconds "
+					  "Time of the last successful contact with the monitor.\n"
+					  "# TYPE pg_autoctl_keeper_monitor_last_contact_timestamp_seconds "
+					  "gauge\n"
+					  "pg_autoctl_keeper_monitor_last_contact_timestamp_seconds %"
+					  PRIu64 "\n",
+					  metrics->lastMonitorContact);
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_postgres_running "
+					  "Is the local Postgres instance running.\n"
+					  "# TYPE pg_autoctl_keeper_postgres_running gauge\n"
+					  "pg_autoctl_keeper_postgres_running %d\n",
+					  metrics->pgIsRunning ? 1 : 0);
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_postgres_lsn_bytes "
+					  "Current WAL position, received WAL on a standby.\n"
+					  "# TYPE pg_autoctl_keeper_postgres_lsn_bytes gauge\n"
+					  "pg_autoctl_keeper_postgres_lsn_bytes %" PRIu64 "\n",
+					  metrics->currentLSN);
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_postgres_replay_lag_bytes "
+					  "WAL received and not replayed yet.\n"
+					  "# TYPE pg_autoctl_keeper_postgres_replay_lag_bytes gauge\n"
+					  "pg_autoctl_keeper_postgres_replay_lag_bytes %" PRIu64 "\n",
+					  metrics->currentLSN > metrics->replayLSN &&
+					  metrics->replayLSN > 0
+					  ? metrics->currentLSN - metrics->replayLSN
+					  : 0);
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_postgres_start_retries "
+					  "Failed attempts at starting Postgres.\n"
+					  "# TYPE pg_autoctl_keeper_postgres_start_retries gauge\n"
+					  "pg_autoctl_keeper_postgres_start_retries %d\n",
+					  metrics->pgStartRetries);
+
+	(void) keeper_metrics_format_summary(out,
+										 "pg_autoctl_keeper_state_fsync_duration_seconds",
+										 &(metrics->stateFsync));
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_state_writes_skipped_total "
+					  "State file writes skipped as the contents did not change.\n"
+					  "# TYPE pg_autoctl_keeper_state_writes_skipped_total counter\n"
+					  "pg_autoctl_keeper_state_writes_skipped_total %" PRIu64 "\n",
+					  metrics->stateWritesSkipped);
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_settings_applied_total "
+					  "Postgres settings applied with a configuration reload.\n"
+					  "# TYPE pg_autoctl_keeper_settings_applied_total counter\n"
+					  "pg_autoctl_keeper_settings_applied_total %" PRIu64 "\n",
+					  metrics->settingsApplied);
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_settings_skipped_total "
+					  "Postgres settings not applied again as they did not change.\n"
+					  "# TYPE pg_autoctl_keeper_settings_skipped_total counter\n"
+					  "pg_autoctl_keeper_settings_skipped_total %" PRIu64 "\n",
+					  metrics->settingsSkipped);
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_transition_duration_seconds "
+					  "Duration of the state machine transitions.\n"
+					  "# TYPE pg_autoctl_keeper_transition_duration_seconds "
+					  "summary\n");
+
+	for (int i = 0; i < metrics->transitionCount; i++)
+	{
+		KeeperMetricsTransition *transition = &(metrics->transitions[i]);
+
+		sformat(labels, sizeof(labels), "from=\"%s\",to=\"%s\"",
+				NodeStateToString(transition->current),
+				NodeStateToString(transition->assigned));
+
+		appendPQExpBuffer(out,
+						  "pg_autoctl_keeper_transition_duration_seconds_sum{%s} "
+						  "%g\n"
+						  "pg_autoctl_keeper_transition_duration_seconds_count{%s} "
+						  "%" PRIu64 "\n",
+						  labels, transition->duration.sum,
+						  labels, transition->duration.count);
+	}
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_transition_failures_total "
+					  "Failed state machine transitions.\n"
+					  "# TYPE pg_autoctl_keeper_transition_failures_total counter\n");
+
+	for (int i = 0; i < metrics->transitionCount; i++)
+	{
+		KeeperMetricsTransition *transition = &(metrics->transitions[i]);
+
+		appendPQExpBuffer(out,
+						  "pg_autoctl_keeper_transition_failures_total"
+						  "{from=\"%s\",to=\"%s\"} %" PRIu64 "\n",
+						  NodeStateToString(transition->current),
+						  NodeStateToString(transition->assigned),
+						  transition->failures);
+	}
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_transition_last_start_timestamp_seconds "
+					  "Start of the last state machine transition, including "
+					  "its retries.\n"
+					  "# TYPE pg_autoctl_keeper_transition_last_start_timestamp_seconds "
+					  "gauge\n");
+
+	for (int i = 0; i < metrics->transitionCount; i++)
+	{
+		KeeperMetricsTransition *transition = &(metrics->transitions[i]);
+
+		if (transition->lastStartTime == 0)
+		{
+			continue;
+		}
+
+		appendPQExpBuffer(out,
+						  "pg_autoctl_keeper_transition_last_start_timestamp_seconds"
+						  "{from=\"%s\",to=\"%s\"} %" PRIu64 "\n",
+						  NodeStateToString(transition->current),
+						  NodeStateToString(transition->assigned),
+						  transition->lastStartTime);
+	}
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_transition_last_end_timestamp_seconds "
+					  "End of the last state machine transition.\n"
+					  "# TYPE pg_autoctl_keeper_transition_last_end_timestamp_seconds "
+					  "gauge\n");
+
+	for (int i = 0; i < metrics->transitionCount; i++)
+	{
+		KeeperMetricsTransition *transition = &(metrics->transitions[i]);
+
+		if (transition->lastStartTime == 0)
+		{
+			continue;
+		}
+
+		appendPQExpBuffer(out,
+						  "pg_autoctl_keeper_transition_last_end_timestamp_seconds"
+						  "{from=\"%s\",to=\"%s\"} %" PRIu64 "\n",
+						  NodeStateToString(transition->current),
+						  NodeStateToString(transition->assigned),
+						  transition->lastEndTime);
+	}
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_transition_last_retries "
+					  "Retries of the last state machine transition.\n"
+					  "# TYPE pg_autoctl_keeper_transition_last_retries gauge\n");
+
+	for (int i = 0; i < metrics->transitionCount; i++)
+	{
+		KeeperMetricsTransition *transition = &(metrics->transitions[i]);
+
+		if (transition->lastStartTime == 0)
+		{
+			continue;
+		}
+
+		appendPQExpBuffer(out,
+						  "pg_autoctl_keeper_transition_last_retries"
+						  "{from=\"%s\",to=\"%s\"} %d\n",
+						  NodeStateToString(transition->current),
+						  NodeStateToString(transition->assigned),
+						  transition->lastRetries);
+	}
+
+	appendPQExpBuffer(out,
+					  "# HELP pg_autoctl_keeper_service_starts_total "
+					  "Starts of the pg_autoctl services, including restarts.\n"
+					  "# TYPE pg_autoctl_keeper_service_starts_total counter\n");
+
+	for (int i = 0; i < KEEPER_METRICS_SERVICE_COUNT; i++)
+	{
+		appendPQExpBuffer(out,
+						  "pg_autoctl_keeper_service_starts_total"
+						  "{service=\"%s\"} %" PRIu64 "\n",
+						  KeeperMetricsServiceNames[i],
+						  metrics->serviceStarts[i]);
+	}
+}
+
+
+/*
+ * keeper_metrics_elapsed returns how many seconds elapsed since startTime.
+ */
+static double
+keeper_metrics_elapsed(instr_time startTime)
+{
+	instr_time duration;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	return INSTR_TIME_GET_DOUBLE(duration);
+}
+
+
+/*
+ * keeper_metrics_summary_add adds a measure to a summary.
+ */
+static void
+keeper_metrics_summary_add(KeeperMetricsSummary *summary, double duration)
+{
+	++(summary->count);
+	summary->sum += duration;
+	summary->last = duration;
+
+	if (duration > summary->max)
+	{
+		summary->max = duration;
+	}
+}
+
+
+/*
+ * keeper_metrics_begin_update marks the metrics as being updated, so that
+ * readers do not use a partially updated copy.
+ */
+static void
+keeper_metrics_begin_update()
+{
+	++(keeperMetrics->changeCount);
+	__sync_synchronize();
+}
+
+
+/*
+ * keeper_metrics_end_update marks the metrics as consistent again.
+ */
+static void
+keeper_metrics_end_update()
+{
+	__sync_synchronize();
+	++(keeperMetrics->changeCount);
+}
+
+
+/*
+ * keeper_metrics_get_transition returns the metrics entry for the given
+ * transition, adding it when needed, or NULL when the array is full.
+ */
+static KeeperMetricsTransition *
+keeper_metrics_get_transition(NodeState current, NodeState assigned)
+{
+	for (int i = 0; i < keeperMetrics->transitionCount; i++)
+	{
+		KeeperMetricsTransition *transition = &(keeperMetrics->transitions[i]);
+
+		if (transition->current == current && transition->assigned == assigned)
+		{
+			return transition;
+		}
+	}
+
+	if (keeperMetrics->transitionCount >= KEEPER_METRICS_MAX_TRANSITIONS)
+	{
+		return NULL;
+	}
+
+	KeeperMetricsTransition *transition =
+		&(keeperMetrics->transitions[keeperMetrics->transitionCount++]);
+
+	transition->current = current;
+	transition->assigned = assigned;
+
+	return transition;
+}
+
+
+/*
+ * keeper_metrics_format_summary appends a summary metric to the buffer, with
+ * the last and max values as separate gauges.
+ */
+static void
+keeper_metrics_format_summary(PQExpBuffer out, const char *name,
+							  KeeperMetricsSummary *summary)
+{
+	appendPQExpBuffer(out,
+					  "# TYPE %s summary\n"
+					  "%s_sum %g\n"
+					  "%s_count %" PRIu64 "\n"
+					  "# TYPE %s_last gauge\n"
+					  "%s_last %g\n"
+					  "# TYPE %s_max gauge\n"
+					  "%s_max %g\n",
+					  name,
+					  name, summary->sum,
+					  name, summary->count,
+					  name,
+					  name, summary->last,
+					  name,
+					  name, summary->max);
+}
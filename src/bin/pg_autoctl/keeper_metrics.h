@@ -0,0 +1,140 @@
+/*
+ * src/bin/pg_autoctl/keeper_metrics.h
+ *     Metrics of the keeper, shared between the pg_autoctl services
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#ifndef KEEPER_METRICS_H
+#define KEEPER_METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "postgres_fe.h"
+#include "pqexpbuffer.h"
+#include "portability/instr_time.h"
+
+#include "keeper.h"
+#include "state.h"
+
+#define KEEPER_METRICS_VERSION 6
+
+/* distinct (current, assigned) transitions that we keep track of */
+#define KEEPER_METRICS_MAX_TRANSITIONS 64
+
+/*
+ * The services of the keeper count their own starts in the metrics file, so
+ * that restarts from the supervisor are visible in the metrics.
+ */
+typedef enum
+{
+	KEEPER_METRICS_SERVICE_POSTGRES = 0,
+	KEEPER_METRICS_SERVICE_NODE_ACTIVE,
+	KEEPER_METRICS_SERVICE_METRICS,
+
+	KEEPER_METRICS_SERVICE_COUNT
+} KeeperMetricsService;
+
+/* durations are in seconds, as Prometheus expects */
+typedef struct KeeperMetricsSummary
+{
+	uint64_t count;
+	double sum;
+	double last;
+	double max;
+} KeeperMetricsSummary;
+
+typedef struct KeeperMetricsTransition
+{
+	NodeState current;
+	NodeState assigned;
+	uint64_t failures;
+	KeeperMetricsSummary duration;
+
+	/* the last entry of this transition in the transition history */
+	uint64_t lastStartTime;
+	uint64_t lastEndTime;
+	int lastRetries;
+} KeeperMetricsTransition;
+
+/*
+ * KeeperMetrics is mapped in shared memory from the pg_autoctl.metrics file
+ * by the node-active process, which updates it, and by the metrics service,
+ * which reads it. It must not contain any pointers.
+ *
+ * A single process writes the metrics, and changeCount is incremented before
+ * and after each update: readers retry copying the metrics until they get the
+ * same even changeCount before and after the copy.
+ */
+typedef struct KeeperMetrics
+{
+	int version;
+	volatile uint64_t changeCount;
+
+	/* node identity and state, as of the last keeper loop */
+	int64_t nodeId;
+	int groupId;
+	NodeState currentRole;
+	NodeState assignedRole;
+	uint64_t lastLoopTime;      /* epoch */
+
+	KeeperMetricsSummary loop;
+
+	/* how late the main loop wakes up after sleeping: scheduling latency */
+	KeeperMetricsSummary wakeupLatency;
+
+	/* communication with the monitor */
+	KeeperMetricsSummary nodeActive;
+	uint64_t nodeActiveErrors;
+	double monitorConnectTime;
+	uint64_t lastMonitorContact;        /* epoch */
+	uint64_t monitorConnections;
+	uint64_t monitorConnectionsReused;
+
+	/* local Postgres instance */
+	bool pgIsRunning;
+	uint64_t currentLSN;
+	uint64_t replayLSN;
+	int pgStartRetries;
+
+	/* durable writes of the state files, and writes skipped as unchanged */
+	KeeperMetricsSummary stateFsync;
+	uint64_t stateWritesSkipped;
+
+	/* Postgres settings applied with a reload, and skipped as unchanged */
+	uint64_t settingsApplied;
+	uint64_t settingsSkipped;
+
+	int transitionCount;
+	KeeperMetricsTransition transitions[KEEPER_METRICS_MAX_TRANSITIONS];
+
+	/* incremented atomically by each service process when it starts */
+	volatile uint64_t serviceStarts[KEEPER_METRICS_SERVICE_COUNT];
+} KeeperMetrics;
+
+
+bool keeper_metrics_create(const char *filename);
+bool keeper_metrics_attach(const char *filename);
+void keeper_metrics_detach(void);
+bool keeper_metrics_snapshot(KeeperMetrics *metrics);
+
+void keeper_metrics_record_service_start(KeeperMetricsService service);
+void keeper_metrics_record_loop(Keeper *keeper, instr_time startTime);
+void keeper_metrics_record_wakeup(instr_time startTime, int sleepMs);
+void keeper_metrics_record_node_active(Keeper *keeper, instr_time startTime,
+									   bool success);
+void keeper_metrics_record_transition(NodeState current, NodeState assigned,
+									  instr_time startTime, bool success,
+									  KeeperTransition *history);
+void keeper_metrics_record_state_fsync(instr_time startTime);
+void keeper_metrics_record_state_write_skipped(void);
+void keeper_metrics_record_settings(bool applied);
+
+void keeper_metrics_format(KeeperMetrics *metrics,
+						   const char *formation,
+						   PQExpBuffer out);
+
+#endif /* KEEPER_METRICS_H */
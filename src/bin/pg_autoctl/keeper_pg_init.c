@@ -677,7 +677,9 @@ wait_until_primary_is_ready(Keeper *keeper,
 								 pgIsRunning,
 								 currentTLI,
 								 currrentLSN,
+								 currrentLSN,
 								 pgsrSyncState,
+								 NULL,
 								 assignedState))
 		{
 			++errors;
@@ -741,6 +743,11 @@ wait_until_primary_is_ready(Keeper *keeper,
  * wait_until_primary_has_created_our_replication_slot loops over querying the
  * primary server until it has created our replication slot.
  *
+ * The primary keeper notifies the monitor when it creates replication slots,
+ * so between two checks we wait for that notification rather than sleeping.
+ * Primary nodes running an older pg_autoctl don't notify, in which case we
+ * check again after PG_AUTOCTL_KEEPER_SLEEP_TIME.
+ *
  * When assigned CATCHINGUP_STATE, in some cases the primary might not be ready
  * yet. That might happen when all the other standby nodes are in maintenance
  * and the primary is already in the WAIT_PRIMARY state.
@@ -755,6 +762,7 @@ wait_until_primary_has_created_our_replication_slot(Keeper *keeper,
 	KeeperConfig *config = &(keeper->config);
 	LocalPostgresServer *postgres = &(keeper->postgres);
 	ReplicationSource *upstream = &(postgres->replicationSource);
+	Monitor *monitor = &(keeper->monitor);
 	NodeAddress primaryNode = { 0 };
 
 	bool hasReplicationSlot = false;
@@ -780,9 +788,22 @@ wait_until_primary_has_created_our_replication_slot(Keeper *keeper,
 		return false;
 	}
 
+	/* listen before checking for the slot so that we can't miss the event */
+	if (!monitor_listen_replication_slots(monitor,
+										  config->formation,
+										  assignedState->groupId))
+	{
+		log_warn("Failed to listen to replication slot notifications, "
+				 "checking for our replication slot every %ds instead",
+				 PG_AUTOCTL_KEEPER_SLEEP_TIME);
+	}
+
 	do {
+		bool slotsCreated = false;
+
 		if (asked_to_stop || asked_to_stop_fast || asked_to_quit)
 		{
+			pgsql_finish(&(monitor->notificationClient));
 			return false;
 		}
 
@@ -790,6 +811,16 @@ wait_until_primary_has_created_our_replication_slot(Keeper *keeper,
 		{
 			firstLoop = false;
 		}
+		else if (monitor->notificationClient.connection != NULL)
+		{
+			int timeoutMs = PG_AUTOCTL_KEEPER_SLEEP_TIME * 1000;
+
+			(void) monitor_wait_for_replication_slots(monitor,
+													  config->formation,
+													  assignedState->groupId,
+													  timeoutMs,
+													  &slotsCreated);
+		}
 		else
 		{
 			sleep(PG_AUTOCTL_KEEPER_SLEEP_TIME);
@@ -812,11 +843,16 @@ wait_until_primary_has_created_our_replication_slot(Keeper *keeper,
 				log_error("Failed to contact the primary 5 times in a row now, "
 						  "so we stop trying. You can do `pg_autoctl create` "
 						  "to retry and finish the local setup");
+				pgsql_finish(&(monitor->notificationClient));
 				return false;
 			}
 		}
 
-		++tries;
+		/* if we have been notified, we didn't wait for a full timeout */
+		if (!slotsCreated)
+		{
+			++tries;
+		}
 
 		if (!hasReplicationSlot && tries == 3)
 		{
@@ -826,6 +862,9 @@ wait_until_primary_has_created_our_replication_slot(Keeper *keeper,
 		}
 	} while (!hasReplicationSlot);
 
+	/* stop listening to the replication slot notifications */
+	pgsql_finish(&(monitor->notificationClient));
+
 	return true;
 }
 
@@ -1197,7 +1236,9 @@ keeper_pg_init_node_active(Keeper *keeper)
 							 ReportPgIsRunning(keeper),
 							 keeper->postgres.postgresSetup.control.timeline_id,
 							 keeper->postgres.currentLSN,
+							 keeper->postgres.replayLSN,
 							 keeper->postgres.pgsrSyncState,
+							 NULL,
 							 &assignedState))
 	{
 		log_error("Failed to contact the monitor to publish our "
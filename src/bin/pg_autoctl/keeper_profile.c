@@ -0,0 +1,496 @@
+/*
+ * src/bin/pg_autoctl/keeper_profile.c
+ *     On-demand profiling of the node-active service main loop
+ *
+ * The command pg_autoctl do profile writes the duration of the profile in a
+ * request file next to the pidfile, and signals the node-active service with
+ * SIGUSR1. The service then records, for each phase of its main loop, how
+ * many times it ran and the wall clock and CPU time it used, and when the
+ * duration has elapsed it writes a summary report next to the pidfile.
+ *
+ * The report also includes the process wide counters that we can get
+ * without a debugger: the child processes that exited (pg_ctl, hooks), the
+ * read and write system calls from /proc/self/io when available, context
+ * switches and block I/O from getrusage(). When no profile is running, each
+ * instrumented phase only costs a test of a static variable.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "postgres_fe.h"
+#include "pqexpbuffer.h"
+
+#include "defaults.h"
+#include "file_utils.h"
+#include "keeper_profile.h"
+#include "log.h"
+#include "signals.h"
+#include "state.h"
+#include "string_utils.h"
+
+typedef struct KeeperProfileSummary
+{
+	uint64_t count;
+	double wallMs;
+	double maxWallMs;
+	double cpuMs;
+} KeeperProfileSummary;
+
+/* process wide counters, sampled at the beginning and at the end */
+typedef struct KeeperProfileCounters
+{
+	double cpuMs;
+	double childrenCpuMs;
+	int64_t voluntarySwitches;
+	int64_t involuntarySwitches;
+	int64_t blocksRead;
+	int64_t blocksWritten;
+	int64_t readSyscalls;
+	int64_t writeSyscalls;
+	bool syscallsKnown;
+} KeeperProfileCounters;
+
+typedef struct KeeperProfile
+{
+	bool active;
+	int duration;
+	uint64_t startTime;
+	instr_time startWallTime;
+	KeeperProfileCounters startCounters;
+
+	KeeperProfileSummary loops;
+	KeeperProfileSummary phases[KEEPER_PROFILE_PHASE_COUNT];
+} KeeperProfile;
+
+static KeeperProfile profile = { 0 };
+
+/* SIGCHLD is only counted while a profile is running */
+static volatile sig_atomic_t childExitCount = 0;
+
+static char *phaseNames[] = {
+	"reload",
+	"postgres",
+	"node_active",
+	"refresh hooks",
+	"transition",
+	"ensure state",
+	"replication slots",
+	"measurements",
+	"state write"
+};
+
+static void keeper_profile_start(const char *pidfile);
+static void keeper_profile_finish(const char *pidfile);
+static void keeper_profile_counters(KeeperProfileCounters *counters);
+static double keeper_profile_cpu_ms(void);
+static void keeper_profile_summary_add(KeeperProfileSummary *summary,
+									   double wallMs, double cpuMs);
+static void catch_child(int sig);
+
+
+/*
+ * keeper_profile_path computes the path of the given profile file, which is
+ * in the same directory as the pidfile.
+ */
+void
+keeper_profile_path(const char *pidfile, const char *filename, char *path)
+{
+	(void) path_in_same_directory(pidfile, filename, path);
+}
+
+
+/*
+ * keeper_profile_maintain is called at each iteration of the keeper main
+ * loop. It starts a new profile when we have been signaled with SIGUSR1,
+ * and finishes the current profile when its duration has elapsed.
+ */
+void
+keeper_profile_maintain(const char *pidfile)
+{
+	if (asked_to_profile)
+	{
+		asked_to_profile = 0;
+
+		(void) keeper_profile_start(pidfile);
+	}
+
+	if (!profile.active)
+	{
+		return;
+	}
+
+	instr_time duration;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, profile.startWallTime);
+
+	if (INSTR_TIME_GET_DOUBLE(duration) >= profile.duration)
+	{
+		(void) keeper_profile_finish(pidfile);
+	}
+}
+
+
+/*
+ * keeper_profile_is_active returns true when a profile is running.
+ */
+bool
+keeper_profile_is_active(void)
+{
+	return profile.active;
+}
+
+
+/*
+ * keeper_profile_begin marks the beginning of a phase of the main loop.
+ */
+void
+keeper_profile_begin(KeeperProfileMark *mark)
+{
+	mark->active = profile.active;
+
+	if (!mark->active)
+	{
+		return;
+	}
+
+	INSTR_TIME_SET_CURRENT(mark->wallTime);
+	mark->cpuMs = keeper_profile_cpu_ms();
+}
+
+
+/*
+ * keeper_profile_end accounts for the time spent in the given phase since
+ * the given mark. Phases that began before the profile started are skipped.
+ */
+void
+keeper_profile_end(KeeperProfilePhase phase, KeeperProfileMark *mark)
+{
+	if (!profile.active || !mark->active)
+	{
+		return;
+	}
+
+	instr_time duration;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, mark->wallTime);
+
+	(void) keeper_profile_summary_add(&(profile.phases[phase]),
+									  INSTR_TIME_GET_MILLISEC(duration),
+									  keeper_profile_cpu_ms() - mark->cpuMs);
+}
+
+
+/*
+ * keeper_profile_loop_end accounts for a whole iteration of the main loop,
+ * not counting the sleep at the beginning of the iteration.
+ */
+void
+keeper_profile_loop_end(KeeperProfileMark *mark)
+{
+	if (!profile.active || !mark->active)
+	{
+		return;
+	}
+
+	instr_time duration;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, mark->wallTime);
+
+	(void) keeper_profile_summary_add(&(profile.loops),
+									  INSTR_TIME_GET_MILLISEC(duration),
+									  keeper_profile_cpu_ms() - mark->cpuMs);
+}
+
+
+/*
+ * keeper_profile_start reads the duration of the profile from the request
+ * file, and starts a new profile. A request received while a profile is
+ * running starts the profile again.
+ */
+static void
+keeper_profile_start(const char *pidfile)
+{
+	char requestFile[MAXPGPATH] = { 0 };
+	char *contents = NULL;
+	long size = 0L;
+	int duration = KEEPER_PROFILE_DEFAULT_DURATION;
+
+	(void) keeper_profile_path(pidfile,
+							   KEEPER_PROFILE_REQUEST_FILENAME,
+							   requestFile);
+
+	if (read_file_if_exists(requestFile, &contents, &size))
+	{
+		char *newline = strchr(contents, '\n');
+
+		if (newline != NULL)
+		{
+			*newline = '\0';
+		}
+
+		if (!stringToInt(contents, &duration) ||
+			duration <= 0 ||
+			duration > KEEPER_PROFILE_MAX_DURATION)
+		{
+			log_warn("Failed to parse profile duration \"%s\" from \"%s\", "
+					 "using %ds",
+					 contents, requestFile, KEEPER_PROFILE_DEFAULT_DURATION);
+
+			duration = KEEPER_PROFILE_DEFAULT_DURATION;
+		}
+
+		free(contents);
+		(void) unlink_file(requestFile);
+	}
+
+	if (profile.active)
+	{
+		log_info("Profiling of the node-active service started again");
+	}
+
+	memset(&profile, 0, sizeof(KeeperProfile));
+
+	profile.active = true;
+	profile.duration = duration;
+	profile.startTime = time(NULL);
+	INSTR_TIME_SET_CURRENT(profile.startWallTime);
+
+	childExitCount = 0;
+	pqsignal(SIGCHLD, catch_child);
+
+	(void) keeper_profile_counters(&(profile.startCounters));
+
+	log_info("Profiling the node-active service for %ds", duration);
+}
+
+
+/*
+ * keeper_profile_finish writes the profile report next to the pidfile, and
+ * stops profiling.
+ */
+static void
+keeper_profile_finish(const char *pidfile)
+{
+	KeeperProfileCounters counters = { 0 };
+	KeeperProfileCounters *start = &(profile.startCounters);
+
+	char reportFile[MAXPGPATH] = { 0 };
+	char startTimeStr[MAXCTIMESIZE] = { 0 };
+
+	uint64_t now = time(NULL);
+
+	(void) keeper_profile_counters(&counters);
+
+	pqsignal(SIGCHLD, SIG_DFL);
+	profile.active = false;
+
+	PQExpBuffer report = createPQExpBuffer();
+
+	if (report == NULL)
+	{
+		log_error("Failed to allocate memory");
+		return;
+	}
+
+	(void) epoch_to_string(profile.startTime, startTimeStr);
+
+	appendPQExpBuffer(report,
+					  "pg_autoctl node-active service, pid %d\n"
+					  "Profiled for %" PRIu64 "s since %s\n\n",
+					  getpid(),
+					  now - profile.startTime,
+					  startTimeStr);
+
+	appendPQExpBuffer(report,
+					  "%-18s %8s %12s %10s %10s %12s\n",
+					  "Phase", "Calls", "Wall ms", "Avg ms", "Max ms", "CPU ms");
+
+	for (int i = 0; i < KEEPER_PROFILE_PHASE_COUNT + 1; i++)
+	{
+		bool isLoop = i == KEEPER_PROFILE_PHASE_COUNT;
+		KeeperProfileSummary *summary =
+			isLoop ? &(profile.loops) : &(profile.phases[i]);
+
+		if (isLoop)
+		{
+			appendPQExpBufferStr(report, "\n");
+		}
+
+		appendPQExpBuffer(report,
+						  "%-18s %8" PRIu64 " %12.3f %10.3f %10.3f %12.3f\n",
+						  isLoop ? "loop iterations" : phaseNames[i],
+						  summary->count,
+						  summary->wallMs,
+						  summary->count > 0 ?
+						  summary->wallMs / summary->count : 0.0,
+						  summary->maxWallMs,
+						  summary->cpuMs);
+	}
+
+	appendPQExpBuffer(report,
+					  "\n"
+					  "CPU time:                     %.3f ms\n"
+					  "CPU time of child processes:  %.3f ms\n"
+					  "Child processes exited:       %d\n",
+					  counters.cpuMs - start->cpuMs,
+					  counters.childrenCpuMs - start->childrenCpuMs,
+					  (int) childExitCount);
+
+	if (start->syscallsKnown && counters.syscallsKnown)
+	{
+		appendPQExpBuffer(report,
+						  "Read system calls:            %" PRId64 "\n"
+						  "Write system calls:           %" PRId64 "\n",
+						  counters.readSyscalls - start->readSyscalls,
+						  counters.writeSyscalls - start->writeSyscalls);
+	}
+
+	appendPQExpBuffer(report,
+					  "Voluntary context switches:   %" PRId64 "\n"
+					  "Involuntary context switches: %" PRId64 "\n"
+					  "Blocks read:                  %" PRId64 "\n"
+					  "Blocks written:               %" PRId64 "\n",
+					  counters.voluntarySwitches - start->voluntarySwitches,
+					  counters.involuntarySwitches - start->involuntarySwitches,
+					  counters.blocksRead - start->blocksRead,
+					  counters.blocksWritten - start->blocksWritten);
+
+	/* memory allocation could have failed while building string */
+	if (PQExpBufferBroken(report))
+	{
+		log_error("Failed to allocate memory");
+		destroyPQExpBuffer(report);
+		return;
+	}
+
+	(void) keeper_profile_path(pidfile,
+							   KEEPER_PROFILE_REPORT_FILENAME,
+							   reportFile);
+
+	if (write_file_atomic(report->data, report->len, reportFile))
+	{
+		log_info("Wrote the profile of the node-active service to \"%s\"",
+				 reportFile);
+	}
+
+	destroyPQExpBuffer(report);
+}
+
+
+/*
+ * keeper_profile_counters samples the process wide counters. The system calls
+ * counters are only known on Linux, from /proc/self/io.
+ */
+static void
+keeper_profile_counters(KeeperProfileCounters *counters)
+{
+	struct rusage self = { 0 };
+	struct rusage children = { 0 };
+
+	if (getrusage(RUSAGE_SELF, &self) == 0)
+	{
+		counters->cpuMs = keeper_profile_cpu_ms();
+		counters->voluntarySwitches = self.ru_nvcsw;
+		counters->involuntarySwitches = self.ru_nivcsw;
+		counters->blocksRead = self.ru_inblock;
+		counters->blocksWritten = self.ru_oublock;
+	}
+
+	if (getrusage(RUSAGE_CHILDREN, &children) == 0)
+	{
+		counters->childrenCpuMs =
+			(children.ru_utime.tv_sec + children.ru_stime.tv_sec) * 1000.0 +
+			(children.ru_utime.tv_usec + children.ru_stime.tv_usec) / 1000.0;
+	}
+
+	FILE *io = fopen("/proc/self/io", "r");
+
+	if (io != NULL)
+	{
+		char line[BUFSIZE] = { 0 };
+		int found = 0;
+
+		while (fgets(line, sizeof(line), io) != NULL)
+		{
+			long long value = 0;
+
+			if (sscanf(line, "syscr: %lld", &value) == 1)
+			{
+				counters->readSyscalls = value;
+				++found;
+			}
+			else if (sscanf(line, "syscw: %lld", &value) == 1)
+			{
+				counters->writeSyscalls = value;
+				++found;
+			}
+		}
+
+		fclose(io);
+
+		counters->syscallsKnown = found == 2;
+	}
+}
+
+
+/*
+ * keeper_profile_cpu_ms returns the user and system CPU time that our process
+ * has used so far, in milliseconds.
+ */
+static double
+keeper_profile_cpu_ms(void)
+{
+	struct rusage self = { 0 };
+
+	if (getrusage(RUSAGE_SELF, &self) != 0)
+	{
+		return 0.0;
+	}
+
+	return (self.ru_utime.tv_sec + self.ru_stime.tv_sec) * 1000.0 +
+		   (self.ru_utime.tv_usec + self.ru_stime.tv_usec) / 1000.0;
+}
+
+
+/*
+ * keeper_profile_summary_add adds a sample to the given summary.
+ */
+static void
+keeper_profile_summary_add(KeeperProfileSummary *summary,
+						   double wallMs, double cpuMs)
+{
+	++summary->count;
+	summary->wallMs += wallMs;
+	summary->cpuMs += cpuMs;
+
+	if (wallMs > summary->maxWallMs)
+	{
+		summary->maxWallMs = wallMs;
+	}
+}
+
+
+/*
+ * catch_child receives the SIGCHLD signal while a profile is running.
+ */
+static void
+catch_child(int sig)
+{
+	++childExitCount;
+	pqsignal(sig, catch_child);
+}
@@ -0,0 +1,66 @@
+/*
+ * src/bin/pg_autoctl/keeper_profile.h
+ *     On-demand profiling of the node-active service main loop
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#ifndef KEEPER_PROFILE_H
+#define KEEPER_PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "postgres_fe.h"
+#include "portability/instr_time.h"
+
+#define KEEPER_PROFILE_DEFAULT_DURATION 60      /* seconds */
+#define KEEPER_PROFILE_MAX_DURATION 3600        /* seconds */
+
+/* the node-active service finishes a profile at its next loop iteration */
+#define KEEPER_PROFILE_REPORT_GRACE_TIME 60     /* seconds */
+
+#define KEEPER_PROFILE_REQUEST_FILENAME "pg_autoctl_profile.request"
+#define KEEPER_PROFILE_REPORT_FILENAME "pg_autoctl_profile.txt"
+
+/*
+ * The phases of the keeper main loop that we time. Some phases happen within
+ * other ones: the refresh hooks run within node_active, and the replication
+ * slots maintenance within ensure state.
+ */
+typedef enum
+{
+	KEEPER_PROFILE_PHASE_RELOAD = 0,
+	KEEPER_PROFILE_PHASE_POSTGRES,
+	KEEPER_PROFILE_PHASE_NODE_ACTIVE,
+	KEEPER_PROFILE_PHASE_REFRESH_HOOKS,
+	KEEPER_PROFILE_PHASE_TRANSITION,
+	KEEPER_PROFILE_PHASE_ENSURE_STATE,
+	KEEPER_PROFILE_PHASE_REPLICATION_SLOTS,
+	KEEPER_PROFILE_PHASE_MEASUREMENTS,
+	KEEPER_PROFILE_PHASE_STATE_WRITE,
+
+	KEEPER_PROFILE_PHASE_COUNT
+} KeeperProfilePhase;
+
+/* wall clock and CPU time of our process at the beginning of a phase */
+typedef struct KeeperProfileMark
+{
+	bool active;
+	instr_time wallTime;
+	double cpuMs;
+} KeeperProfileMark;
+
+
+void keeper_profile_path(const char *pidfile, const char *filename,
+						 char *path);
+void keeper_profile_maintain(const char *pidfile);
+bool keeper_profile_is_active(void);
+
+void keeper_profile_begin(KeeperProfileMark *mark);
+void keeper_profile_end(KeeperProfilePhase phase, KeeperProfileMark *mark);
+void keeper_profile_loop_end(KeeperProfileMark *mark);
+
+#endif /* KEEPER_PROFILE_H */
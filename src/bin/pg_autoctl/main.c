@@ -12,6 +12,7 @@
 
 #include "postgres_fe.h"
 
+#include "cli_common.h"
 #include "cli_root.h"
 #include "env_utils.h"
 #include "keeper.h"
@@ -178,6 +179,23 @@ set_logger()
 	/* set our logging facility to use our semaphore as a lock mechanism */
 	(void) log_set_udata(&log_semaphore);
 	(void) log_set_lock(&semaphore_log_lock_function);
+
+	/* pg_autoctl run --log-format exports its value for sub-processes */
+	if (env_exists(PG_AUTOCTL_LOG_FORMAT))
+	{
+		char format[NAMEDATALEN] = { 0 };
+
+		if (get_env_copy(PG_AUTOCTL_LOG_FORMAT, format, sizeof(format)))
+		{
+			(void) cli_set_log_format(format);
+		}
+	}
+
+	/* buffered log lines are flushed in log_semaphore_unlink_atexit */
+	if (env_exists(PG_AUTOCTL_LOG_BUFFERED))
+	{
+		(void) log_set_buffered(true);
+	}
 }
 
 
@@ -187,5 +205,8 @@ set_logger()
 static void
 log_semaphore_unlink_atexit(void)
 {
+	/* we still need the semaphore to write out buffered log lines */
+	(void) log_flush();
+
 	(void) semaphore_finish(&log_semaphore);
 }
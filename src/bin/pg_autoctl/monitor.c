@@ -14,12 +14,14 @@
 
 #include "defaults.h"
 #include "env_utils.h"
+#include "json_stream.h"
 #include "log.h"
 #include "monitor.h"
 #include "monitor_config.h"
 #include "nodestate_utils.h"
 #include "parsing.h"
 #include "pgsql.h"
+#include "pqexpbuffer.h"
 #include "primary_standby.h"
 #include "signals.h"
 #include "string_utils.h"
@@ -33,6 +35,8 @@
 #define STR_ERRCODE_UNDEFINED_OBJECT "42704"
 
 #define STR_ERRCODE_CLASS_INSUFFICIENT_RESOURCES "53"
+#define STR_ERRCODE_MONITOR_BUSY "53Z01"
+#define STR_ERRCODE_LOCK_NOT_AVAILABLE "55P03"
 #define STR_ERRCODE_CLASS_PROGRAM_LIMIT_EXCEEDED "54"
 
 typedef struct NodeAddressParseContext
@@ -56,6 +60,31 @@ typedef struct MonitorEventsArrayParseContext
 	bool parsedOK;
 } MonitorEventsArrayParseContext;
 
+typedef struct MonitorJSONResultContext
+{
+	char sqlstate[SQLSTATE_LENGTH];
+	FILE *stream;
+	bool parsedOK;
+} MonitorJSONResultContext;
+
+typedef struct MonitorEventsStreamContext
+{
+	char sqlstate[SQLSTATE_LENGTH];
+	bool outputJSON;
+	int64_t lastEventId;
+	int rowCount;
+	bool parsedOK;
+} MonitorEventsStreamContext;
+
+typedef struct MonitorEventSlotContext
+{
+	char sqlstate[SQLSTATE_LENGTH];
+	char ackLSN[PG_LSN_MAXLENGTH];
+	int rowCount;
+	int eventCount;
+	bool parsedOK;
+} MonitorEventSlotContext;
+
 typedef struct MonitorAssignedStateParseContext
 {
 	char sqlstate[SQLSTATE_LENGTH];
@@ -90,6 +119,38 @@ typedef struct RemoveNodeContext
 /* either "monitor" or "formation" */
 #define CONNTYPE_LENGTH 10
 
+/*
+ * node_active parameters, the standby node positions are sent as array
+ * literals, the casts parse them on the monitor.
+ */
+/*
+ * The monitor grants the primary a lease of pgautofailover.primary_lease_duration
+ * with each call, which current_setting() shows with a unit.
+ *
+ * When the node is in a transition, we also get the primary node and the
+ * synchronous_standby_names of its group from the same query, see
+ * MonitorGroupSettings, and the trace id of the decision that assigned our
+ * goal state.
+ */
+#define NODE_ACTIVE_QUERY \
+	"SELECT *, coalesce(extract(epoch from current_setting(" \
+	"'pgautofailover.primary_lease_duration', true)::interval) * 1000, 0)" \
+	"::int AS primary_lease_duration, " \
+	"coalesce(pgautofailover.node_trace_id(na.assigned_node_id), 0) " \
+	"AS goal_trace_id " \
+	"FROM pgautofailover.node_active($1, $2, $3, " \
+	"$4::pgautofailover.replication_state, $5, $6, $7, $8, $9, " \
+	"$10::bigint[], $11::pg_lsn[], $12::pg_lsn[], $13::pg_lsn[]) AS na " \
+	"LEFT JOIN LATERAL pgautofailover.node_active_group_settings(" \
+	"na.assigned_node_id) AS settings ON true"
+
+#define NODE_ACTIVE_PARAM_TYPES \
+	{ \
+		TEXTOID, INT8OID, INT4OID, TEXTOID, \
+		BOOLOID, INT4OID, LSNOID, TEXTOID, LSNOID, \
+		TEXTOID, TEXTOID, TEXTOID, TEXTOID \
+	}
+
 typedef struct FormationURIParseContext
 {
 	char sqlstate[SQLSTATE_LENGTH];
@@ -99,6 +160,20 @@ typedef struct FormationURIParseContext
 	bool parsedOK;
 } FormationURIParseContext;
 
+typedef struct FormationNamesParseContext
+{
+	char sqlstate[SQLSTATE_LENGTH];
+	FormationNamesArray *formationsArray;
+	bool parsedOK;
+} FormationNamesParseContext;
+
+typedef struct SwitchoverGroupParseContext
+{
+	char sqlstate[SQLSTATE_LENGTH];
+	SwitchoverGroupArray *groupsArray;
+	bool parsedOK;
+} SwitchoverGroupParseContext;
+
 typedef struct MonitorExtensionVersionParseContext
 {
 	char sqlstate[SQLSTATE_LENGTH];
@@ -107,10 +182,14 @@ typedef struct MonitorExtensionVersionParseContext
 } MonitorExtensionVersionParseContext;
 
 
+static PGSQL * monitor_read_client(Monitor *monitor);
+static bool monitor_read_client_is_fresh(Monitor *monitor);
 static bool parseNode(PGresult *result, int rowNumber, NodeAddress *node);
 static void parseNodeResult(void *ctx, PGresult *result);
 static void parseNodeArray(void *ctx, PGresult *result);
 static void parseNodeState(void *ctx, PGresult *result);
+static bool parseNodeActiveGroupSettings(PGresult *result,
+										 MonitorGroupSettings *settings);
 static void parseNodeReplicationSettings(void *ctx, PGresult *result);
 static bool parseCurrentNodeState(PGresult *result, int rowNumber,
 								  CurrentNodeState *nodeState);
@@ -119,33 +198,26 @@ static bool parseCurrentNodeStateArray(CurrentNodeStateArray *nodesArray,
 static void parseRemoveNodeContext(void *ctx, PGresult *result);
 static void getCurrentState(void *ctx, PGresult *result);
 static void printLastEvents(void *ctx, PGresult *result);
+static void printEventsPage(void *ctx, PGresult *result);
+static void printEventSlotPage(void *ctx, PGresult *result);
+static void printResultAsJSON(void *ctx, PGresult *result);
+static void printRegisteredNodes(void *ctx, PGresult *result);
+static void printLastFailovers(void *ctx, PGresult *result);
 static void getLastEvents(void *ctx, PGresult *result);
 static void printFormationSettings(void *ctx, PGresult *result);
 static void printFormationURI(void *ctx, PGresult *result);
 static void parseCoordinatorNode(void *ctx, PGresult *result);
 static void parseExtensionVersion(void *ctx, PGresult *result);
+static void parseFormationNames(void *ctx, PGresult *result);
+static void parseSwitchoverGroups(void *ctx, PGresult *result);
+static void printStandbyNames(void *ctx, PGresult *result);
+static void monitor_standby_lsns_params(StandbyLSNs *standbyLSNs,
+										const char **paramValues);
 
 static bool prepare_connection_to_current_system_user(Monitor *source,
 													  Monitor *target);
 
 
-/*
- * We have several function that consume monitor notification in different
- * ways. They all have many things in common:
- *
- * - they need to call pselect() and take care of signal processing and race
- *   conditions
- *
- * - they need to filter out some of the notifications
- *
- * - they need to process the notifications that have not been filtered out.
- *
- * Both the filtering and the processing are specific to each top-level
- * function that needs to consumer monitor's notifications.
- */
-typedef void (*NotificationProcessingFunction)(void *context,
-											   CurrentNodeState *nodeState);
-
 typedef struct LogNotificationContext
 {
 	int logLevel;
@@ -160,6 +232,30 @@ typedef struct ApplySettingsNotificationContext
 } ApplySettingsNotificationContext;
 
 
+/*
+ * While waiting for a node to reach a target state, we keep track of the
+ * state changes of the group and when we received them, and log them as a
+ * per-step latency breakdown once the wait is over.
+ */
+#define WAIT_STEPS_MAX_COUNT 64
+
+typedef struct WaitStep
+{
+	double elapsedMs;
+	int64_t nodeId;
+	char name[_POSIX_HOST_NAME_MAX];
+	NodeState reportedState;
+	NodeState goalState;
+} WaitStep;
+
+typedef struct WaitSteps
+{
+	instr_time startTime;
+	int count;
+	WaitStep steps[WAIT_STEPS_MAX_COUNT];
+} WaitSteps;
+
+
 typedef struct WaitUntilStateNotificationContext
 {
 	char *formation;
@@ -168,6 +264,7 @@ typedef struct WaitUntilStateNotificationContext
 	NodeState targetState;
 	bool failoverIsDone;
 	bool firstLoop;
+	WaitSteps *steps;
 } WaitUntilStateNotificationContext;
 
 
@@ -181,6 +278,7 @@ typedef struct WaitUntilNodeStateNotificationContext
 	int targetStatesLength;
 	bool done;
 	bool firstLoop;
+	WaitSteps *steps;
 } WaitUntilNodeStateNotificationContext;
 
 
@@ -190,54 +288,297 @@ typedef struct WaitForStateChangeNotificationContext
 	int groupId;
 	int64_t nodeId;
 	bool stateHasChanged;
+	GroupTransitions *transitions;
 } WaitForStateChangeNotificationContext;
 
+
+typedef struct WaitForReplicationSlotNotificationContext
+{
+	char *formation;
+	int groupId;
+	bool slotsCreated;
+} WaitForReplicationSlotNotificationContext;
+
 static bool monitor_process_notifications(Monitor *monitor,
 										  int timeoutMs,
 										  char *channels[],
 										  void *NotificationContext,
 										  NotificationProcessingFunction processor);
+static bool monitor_parse_state_notification(CurrentNodeState *nodeState,
+											 const char *channel,
+											 const char *payload);
+static void monitor_get_state_channel(Monitor *monitor,
+									  const char *formation,
+									  int groupId,
+									  char *channel,
+									  size_t size);
+static bool monitor_get_slot_channel(const char *formation,
+									 int groupId,
+									 char *channel,
+									 size_t size);
+
+static bool monitor_url_target_read_write(const char *url,
+										  char *buffer,
+										  size_t size);
+static void wait_steps_init(WaitSteps *steps);
+static void wait_steps_record(WaitSteps *steps, CurrentNodeState *nodeState);
+static void wait_steps_log(WaitSteps *steps);
 
 
 /*
  * monitor_init initializes a Monitor struct to connect to the given
  * database URL.
+ *
+ * The URL may list a primary monitor and its standby monitors, in which case
+ * libpq tries the hosts in order. We then only want to connect to the one
+ * that accepts writes, so that the keepers follow a promoted standby monitor.
  */
 bool
 monitor_init(Monitor *monitor, char *url)
 {
+	char monitorURL[MAXCONNINFO] = { 0 };
+
 	log_trace("monitor_init: %s", url);
 
-	if (!pgsql_init(&monitor->pgsql, url, PGSQL_CONN_MONITOR))
+	if (!monitor_url_target_read_write(url, monitorURL, sizeof(monitorURL)))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (!pgsql_init(&monitor->pgsql, monitorURL, PGSQL_CONN_MONITOR))
+	{
+		/* URL must be invalid, pgsql_init logged an error */
+		return false;
+	}
+
+	if (!pgsql_init(&monitor->notificationClient, monitorURL,
+					PGSQL_CONN_MONITOR))
 	{
 		/* URL must be invalid, pgsql_init logged an error */
 		return false;
 	}
 
-	if (!pgsql_init(&monitor->notificationClient, url, PGSQL_CONN_MONITOR))
+	monitor->groupNotificationsChecked = false;
+	monitor->groupNotifications = false;
+	monitor->singleConnection = false;
+	monitor->hasReadClient = false;
+
+	return true;
+}
+
+
+/*
+ * monitor_url_target_read_write copies the given monitor URL into buffer,
+ * adding target_session_attrs=read-write when the URL lists several hosts
+ * and does not set target_session_attrs already.
+ */
+static bool
+monitor_url_target_read_write(const char *url, char *buffer, size_t size)
+{
+	URIHostArray hostArray = { 0 };
+	bool hasTargetSessionAttrs = false;
+	char *errmsg = NULL;
+
+	if (strlcpy(buffer, url, size) >= size)
+	{
+		log_error("Monitor URL \"%s\" is too long, the maximum supported "
+				  "by pg_autoctl is %zu characters", url, size - 1);
+		return false;
+	}
+
+	if (!hostnames_from_uri(url, &hostArray))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (hostArray.count < 2)
+	{
+		return true;
+	}
+
+	PQconninfoOption *conninfo = PQconninfoParse(url, &errmsg);
+	if (conninfo == NULL)
+	{
+		log_error("Failed to parse pguri \"%s\": %s", url, errmsg);
+		PQfreemem(errmsg);
+		return false;
+	}
+
+	for (PQconninfoOption *option = conninfo; option->keyword != NULL; option++)
+	{
+		if (strcmp(option->keyword, "target_session_attrs") == 0 &&
+			option->val != NULL)
+		{
+			hasTargetSessionAttrs = true;
+		}
+	}
+	PQconninfoFree(conninfo);
+
+	if (hasTargetSessionAttrs)
+	{
+		return true;
+	}
+
+	bool isURI = strncmp(url, "postgres://", 11) == 0 ||
+				 strncmp(url, "postgresql://", 13) == 0;
+	const char *separator = !isURI ? " " : strchr(url, '?') ? "&" : "?";
+
+	if (sformat(buffer, size, "%s%starget_session_attrs=read-write",
+				url, separator) >= size)
+	{
+		log_error("Monitor URL \"%s\" is too long, the maximum supported "
+				  "by pg_autoctl is %zu characters", url, size - 1);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * monitor_init_read_client sets up a read-only endpoint for the monitor,
+ * typically a hot standby of the monitor, where the show commands then send
+ * their queries, so that they don't compete with the keepers' node_active
+ * calls on the primary monitor. See monitor_read_client().
+ */
+bool
+monitor_init_read_client(Monitor *monitor, char *url)
+{
+	if (!pgsql_init(&monitor->readClient, url, PGSQL_CONN_MONITOR))
 	{
 		/* URL must be invalid, pgsql_init logged an error */
 		return false;
 	}
 
+	/* use the same retry policy as the primary monitor client */
+	monitor->readClient.retryPolicy = monitor->pgsql.retryPolicy;
+
+	monitor->hasReadClient = true;
+	monitor->readClientIsFresh = false;
+	monitor->readClientCheckTime = 0;
+
 	return true;
 }
 
 
 /*
- * monitor_setup_notifications sets the monitor Postgres client structure to
- * enable notification processing for a given groupId.
+ * monitor_read_client returns the client to use for read-only queries: the
+ * read-only endpoint when we have one and it is fresh enough, otherwise the
+ * primary monitor client. We check the replay lag of the read-only endpoint
+ * again every PG_AUTOCTL_MONITOR_READ_CHECK_INTERVAL seconds, for the sake of
+ * pg_autoctl watch.
+ */
+static PGSQL *
+monitor_read_client(Monitor *monitor)
+{
+	uint64_t now = time(NULL);
+
+	if (!monitor->hasReadClient)
+	{
+		return &(monitor->pgsql);
+	}
+
+	if ((now - monitor->readClientCheckTime) >=
+		PG_AUTOCTL_MONITOR_READ_CHECK_INTERVAL)
+	{
+		bool wasFresh = monitor->readClientIsFresh;
+		bool firstCheck = monitor->readClientCheckTime == 0;
+
+		monitor->readClientIsFresh = monitor_read_client_is_fresh(monitor);
+		monitor->readClientCheckTime = now;
+
+		if (!monitor->readClientIsFresh && (wasFresh || firstCheck))
+		{
+			log_warn("Using the primary monitor: the read-only monitor "
+					 "is not available or lags by more than %ds",
+					 PG_AUTOCTL_MONITOR_READ_MAX_LAG);
+		}
+		else if (monitor->readClientIsFresh && !wasFresh)
+		{
+			log_debug("Using the read-only monitor");
+		}
+	}
+
+	return monitor->readClientIsFresh
+		   ? &(monitor->readClient)
+		   : &(monitor->pgsql);
+}
+
+
+/*
+ * monitor_read_client_is_fresh returns true when the read-only endpoint has
+ * replayed the changes of the primary monitor up to a few seconds ago. The
+ * keepers call the primary monitor every second, so its WAL is never idle for
+ * long. A primary server is always fresh.
+ */
+static bool
+monitor_read_client_is_fresh(Monitor *monitor)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_INT, false };
+	const char *sql =
+		"SELECT CASE WHEN pg_is_in_recovery() "
+		"THEN coalesce(extract(epoch from now() "
+		"- pg_last_xact_replay_timestamp())::int, -1) "
+		"ELSE 0 END";
+
+	if (!pgsql_execute_with_params(&(monitor->readClient), sql, 0, NULL, NULL,
+								   &context, &parseSingleValueResult))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		log_error("Failed to get the replay lag of the read-only monitor");
+		return false;
+	}
+
+	return context.intVal >= 0 &&
+		   context.intVal <= PG_AUTOCTL_MONITOR_READ_MAX_LAG;
+}
+
+
+/*
+ * monitor_setup_notifications sets the monitor Postgres client structures to
+ * enable notification processing for a given groupId. The handler is also
+ * installed on the query client, which receives the notifications when the
+ * monitor singleConnection is set.
  */
 void
 monitor_setup_notifications(Monitor *monitor, int groupId, int64_t nodeId)
 {
-	monitor->notificationClient.notificationGroupId = groupId;
-	monitor->notificationClient.notificationNodeId = nodeId;
-	monitor->notificationClient.notificationReceived = false;
+	PGSQL *clients[] = { &(monitor->notificationClient), &(monitor->pgsql) };
+
+	for (int i = 0; i < 2; i++)
+	{
+		clients[i]->notificationGroupId = groupId;
+		clients[i]->notificationNodeId = nodeId;
+		clients[i]->notificationReceived = false;
+
+		/* install our notification handler */
+		clients[i]->notificationProcessFunction =
+			&monitor_process_state_notification;
+	}
+}
+
 
-	/* install our notification handler */
-	monitor->notificationClient.notificationProcessFunction =
-		&monitor_process_state_notification;
+/*
+ * monitor_notification_client returns the client on which we LISTEN and wait
+ * for notifications: the dedicated notificationClient by default, or the
+ * query client when the monitor singleConnection is set. A single connection
+ * halves the number of connections that the keepers open on the monitor: the
+ * notifications received during our queries are processed in between them,
+ * see pgsql_handle_notifications(), and the others when waiting.
+ */
+PGSQL *
+monitor_notification_client(Monitor *monitor)
+{
+	return monitor->singleConnection
+		   ? &(monitor->pgsql)
+		   : &(monitor->notificationClient);
 }
 
 
@@ -249,9 +590,12 @@ monitor_setup_notifications(Monitor *monitor, int groupId, int64_t nodeId)
 bool
 monitor_has_received_notifications(Monitor *monitor)
 {
-	bool ret = monitor->notificationClient.notificationReceived;
+	bool ret =
+		monitor->notificationClient.notificationReceived ||
+		monitor->pgsql.notificationReceived;
 
 	monitor->notificationClient.notificationReceived = false;
+	monitor->pgsql.notificationReceived = false;
 
 	return ret;
 }
@@ -259,7 +603,7 @@ monitor_has_received_notifications(Monitor *monitor)
 
 /*
  * monitor_process_state_notification processes a notification received on the
- * "state" channel from the monitor.
+ * "state" channel, or on a group channel, from the monitor.
  */
 bool
 monitor_process_state_notification(int notificationGroupId,
@@ -269,13 +613,8 @@ monitor_process_state_notification(int notificationGroupId,
 {
 	CurrentNodeState nodeState = { 0 };
 
-	if (strcmp(channel, "state") != 0)
-	{
-		return false;
-	}
-
-	/* errors are logged by parse_state_notification_message */
-	if (parse_state_notification_message(&nodeState, payload))
+	/* errors are logged by monitor_parse_state_notification */
+	if (monitor_parse_state_notification(&nodeState, channel, payload))
 	{
 		if (nodeState.groupId == notificationGroupId)
 		{
@@ -288,6 +627,139 @@ monitor_process_state_notification(int notificationGroupId,
 }
 
 
+/*
+ * monitor_parse_state_notification parses a state change notification, either
+ * received on the "state" channel or on a "state.<formation>.<group>" channel.
+ * Notifications received on other channels are ignored.
+ */
+static bool
+monitor_parse_state_notification(CurrentNodeState *nodeState,
+								 const char *channel,
+								 const char *payload)
+{
+	if (strcmp(channel, "state") == 0)
+	{
+		return parse_state_notification_message(nodeState, payload);
+	}
+	else if (strncmp(channel, "state.", 6) == 0)
+	{
+		return parse_group_state_notification_message(nodeState,
+													  channel,
+													  payload);
+	}
+
+	return false;
+}
+
+
+/*
+ * monitor_get_state_channel sets channel to the name of the channel where the
+ * monitor notifies about the state changes of the given group. That's the
+ * group's own channel when the monitor has pgautofailover.group_notifications
+ * enabled and the channel name fits in NAMEDATALEN, and the "state" channel
+ * otherwise.
+ */
+static void
+monitor_get_state_channel(Monitor *monitor,
+						  const char *formation,
+						  int groupId,
+						  char *channel,
+						  size_t size)
+{
+	if (!monitor->groupNotificationsChecked)
+	{
+		PGSQL *pgsql = &monitor->pgsql;
+		SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BOOL, false };
+		const char *sql =
+			"SELECT coalesce(current_setting("
+			"'pgautofailover.group_notifications', true), 'off')::bool";
+
+		if (pgsql_execute_with_params(pgsql, sql, 0, NULL, NULL,
+									  &context, &parseSingleValueResult) &&
+			context.parsedOk)
+		{
+			monitor->groupNotificationsChecked = true;
+			monitor->groupNotifications = context.boolVal;
+		}
+		else
+		{
+			log_warn("Failed to check whether the monitor notifies state "
+					 "changes on group channels, using channel \"state\"");
+		}
+	}
+
+	if (monitor->groupNotifications)
+	{
+		char groupChannel[BUFSIZE] = { 0 };
+
+		sformat(groupChannel, sizeof(groupChannel),
+				"state.%s.%d", formation, groupId);
+
+		/* the monitor uses the same rule for channels that don't fit */
+		if (strlen(groupChannel) < NAMEDATALEN)
+		{
+			strlcpy(channel, groupChannel, size);
+			return;
+		}
+	}
+
+	strlcpy(channel, "state", size);
+}
+
+
+/*
+ * monitor_listen_state_changes starts listening to the state changes of the
+ * given group on the monitor notification client. Call it before making a
+ * change that we then wait for, so that we don't miss any notification.
+ *
+ * When the monitor has pgautofailover.group_notifications enabled, we only
+ * receive the notifications of our own group. When groupId is -1 we listen to
+ * the state changes of the whole formation, on the "state" channel.
+ */
+bool
+monitor_listen_state_changes(Monitor *monitor, const char *formation, int groupId)
+{
+	char stateChannel[NAMEDATALEN] = "state";
+	char *channels[] = { stateChannel, NULL };
+
+	if (groupId >= 0)
+	{
+		(void) monitor_get_state_channel(monitor, formation, groupId,
+										 stateChannel, sizeof(stateChannel));
+	}
+
+	return pgsql_listen(&(monitor->notificationClient), channels);
+}
+
+
+/*
+ * monitor_get_slot_channel sets channel to the name of the channel where the
+ * primary keeper of the given group notifies that it has created replication
+ * slots for new standby nodes. Postgres refuses channel names that don't fit
+ * in NAMEDATALEN, in which case we return false and the standby nodes wait
+ * for their slot without being notified.
+ */
+static bool
+monitor_get_slot_channel(const char *formation,
+						 int groupId,
+						 char *channel,
+						 size_t size)
+{
+	char slotChannel[BUFSIZE] = { 0 };
+
+	sformat(slotChannel, sizeof(slotChannel), "slot.%s.%d", formation, groupId);
+
+	if (strlen(slotChannel) >= NAMEDATALEN)
+	{
+		return false;
+	}
+
+	strlcpy(channel, slotChannel, size);
+
+	return true;
+}
+
+
 /*
  * monitor_local_init initializes a Monitor struct to connect to the local
  * monitor postgres instance, for use from the pg_autoctl instance that manages
@@ -341,6 +813,18 @@ monitor_retryable_error(const char *sqlstate)
 		return true;
 	}
 
+	/* see pgautofailover.node_active_max_concurrency */
+	if (strcmp(sqlstate, STR_ERRCODE_MONITOR_BUSY) == 0)
+	{
+		return true;
+	}
+
+	/* lock_timeout, such as while the monitor extension is being updated */
+	if (strcmp(sqlstate, STR_ERRCODE_LOCK_NOT_AVAILABLE) == 0)
+	{
+		return true;
+	}
+
 	if (strncmp(sqlstate, STR_ERRCODE_CLASS_INSUFFICIENT_RESOURCES, 2) == 0)
 	{
 		return true;
@@ -363,7 +847,7 @@ bool
 monitor_get_nodes(Monitor *monitor, char *formation, int groupId,
 				  NodeAddressArray *nodeArray)
 {
-	PGSQL *pgsql = &monitor->pgsql;
+	PGSQL *pgsql = monitor_read_client(monitor);
 	const char *sql =
 		groupId == -1
 		? "SELECT * FROM pgautofailover.get_nodes($1) ORDER BY node_id"
@@ -414,63 +898,47 @@ monitor_get_nodes(Monitor *monitor, char *formation, int groupId,
 bool
 monitor_print_nodes_as_json(Monitor *monitor, char *formation, int groupId)
 {
-	PGSQL *pgsql = &monitor->pgsql;
-	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_STRING, false };
+	PGSQL *pgsql = monitor_read_client(monitor);
+	MonitorJSONResultContext context = { { 0 }, stdout, false };
 
 	const char *sql =
 		groupId == -1
-		?
-		"SELECT jsonb_pretty(coalesce(jsonb_agg(row_to_json(nodes)), '[]'))"
-		"  FROM pgautofailover.get_nodes($1) as nodes"
-		:
-		"SELECT jsonb_pretty(coalesce(jsonb_agg(row_to_json(nodes)), '[]'))"
-		"  FROM pgautofailover.get_nodes($1, $2) as nodes";
+		? "SELECT * FROM pgautofailover.get_nodes($1)"
+		: "SELECT * FROM pgautofailover.get_nodes($1, $2)";
 
 	int paramCount = 1;
 	Oid paramTypes[2] = { TEXTOID, INT4OID };
 	const char *paramValues[2] = { 0 };
+	IntString myGroupIdString = intToString(groupId);
 
 	paramValues[0] = formation;
 
 	if (groupId > -1)
 	{
-		IntString myGroupIdString = intToString(groupId);
-
 		++paramCount;
 		paramValues[1] = myGroupIdString.strValue;
 	}
 
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
-								   &context, &parseSingleValueResult))
+								   &context, &printResultAsJSON))
 	{
 		log_error("Failed to get the nodes from the monitor while running "
 				  "\"%s\" with formation %s and group %d",
 				  sql, formation, groupId);
-		if (context.strVal)
-		{
-			free(context.strVal);
-		}
 		return false;
 	}
 
-	if (!context.parsedOk)
+	if (!context.parsedOK)
 	{
 		log_error("Failed to get the other nodes from the monitor while "
 				  "running \"%s\" with formation %s and group %d because "
 				  "it returned an unexpected result. "
 				  "See previous line for details.",
 				  sql, formation, groupId);
-		if (context.strVal)
-		{
-			free(context.strVal);
-		}
 		return false;
 	}
 
-	fformat(stdout, "%s\n", context.strVal);
-	free(context.strVal);
-
 	return true;
 }
 
@@ -544,17 +1012,20 @@ bool
 monitor_print_other_nodes(Monitor *monitor,
 						  int64_t myNodeId, NodeState currentState)
 {
-	NodeAddressArray otherNodesArray;
+	NodeAddressArray otherNodesArray = { 0 };
 
 	if (!monitor_get_other_nodes(monitor, myNodeId, currentState,
 								 &otherNodesArray))
 	{
 		/* errors have already been logged */
+		nodeAddressArrayFree(&otherNodesArray);
 		return false;
 	}
 
 	(void) printNodeArray(&otherNodesArray);
 
+	nodeAddressArrayFree(&otherNodesArray);
+
 	return true;
 }
 
@@ -569,19 +1040,15 @@ monitor_print_other_nodes_as_json(Monitor *monitor,
 								  NodeState currentState)
 {
 	PGSQL *pgsql = &monitor->pgsql;
-	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_STRING, false };
+	MonitorJSONResultContext context = { { 0 }, stdout, false };
 
 	const char *sql =
 		currentState == ANY_STATE
-		?
-		"SELECT jsonb_pretty(coalesce(jsonb_agg(row_to_json(nodes)), '[]'))"
-		" FROM pgautofailover.get_other_nodes($1) as nodes"
-		:
-		"SELECT jsonb_pretty(coalesce(jsonb_agg(row_to_json(nodes)), '[]'))"
-		" FROM pgautofailover.get_other_nodes($1, "
-		"$3::pgautofailover.replication_state) as nodes";
+		? "SELECT * FROM pgautofailover.get_other_nodes($1)"
+		: "SELECT * FROM pgautofailover.get_other_nodes($1, "
+		  "$2::pgautofailover.replication_state)";
 
-	int paramCount = currentState == ANY_STATE ? 2 : 1;
+	int paramCount = currentState == ANY_STATE ? 1 : 2;
 	Oid paramTypes[2] = { INT8OID, TEXTOID };
 	const char *paramValues[2] = { 0 };
 	IntString myNodeIdString = intToString(myNodeId);
@@ -595,34 +1062,23 @@ monitor_print_other_nodes_as_json(Monitor *monitor,
 
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
-								   &context, &parseSingleValueResult))
+								   &context, &printResultAsJSON))
 	{
 		log_error("Failed to get the other nodes from the monitor while running "
 				  "\"%s\" with node id %" PRId64, sql, myNodeId);
-		if (context.strVal)
-		{
-			free(context.strVal);
-		}
 		return false;
 	}
 
-	if (!context.parsedOk)
+	if (!context.parsedOK)
 	{
 		log_error("Failed to get the other nodes from the monitor while running "
 				  "\"%s\" with node id %" PRId64
 				  " because it returned an unexpected result. "
 				  "See previous line for details.",
 				  sql, myNodeId);
-		if (context.strVal)
-		{
-			free(context.strVal);
-		}
 		return false;
 	}
 
-	fformat(stdout, "%s\n", context.strVal);
-	free(context.strVal);
-
 	return true;
 }
 
@@ -676,6 +1132,51 @@ monitor_get_primary(Monitor *monitor, char *formation, int groupId,
 }
 
 
+/*
+ * monitor_get_upstream gets the node that the given standby node should
+ * stream WAL from: the primary node, or a secondary node of the same node
+ * cluster when the monitor has pgautofailover.cascade_by_cluster enabled.
+ */
+bool
+monitor_get_upstream(Monitor *monitor, int64_t nodeId, NodeAddress *node)
+{
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql = "SELECT * FROM pgautofailover.get_upstream($1)";
+	int paramCount = 1;
+	Oid paramTypes[1] = { INT8OID };
+	const char *paramValues[1];
+	NodeAddressParseContext parseContext = { { 0 }, node, false };
+	IntString nodeIdString = intToString(nodeId);
+
+	paramValues[0] = nodeIdString.strValue;
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &parseContext, parseNodeResult))
+	{
+		log_error("Failed to get the upstream node of node %" PRId64
+				  " from the monitor while running \"%s\"",
+				  nodeId, sql);
+		return false;
+	}
+
+	if (!parseContext.parsedOK)
+	{
+		log_error("Failed to get the upstream node of node %" PRId64
+				  " from the monitor while running \"%s\" because it "
+				  "returned an unexpected result. "
+				  "See previous line for details.",
+				  nodeId, sql);
+		return false;
+	}
+
+	log_debug("The upstream node returned by the monitor is node " NODE_FORMAT,
+			  node->nodeId, node->name, node->host, node->port);
+
+	return true;
+}
+
+
 /*
  * monitor_get_coordinator gets the coordinator node in a given formation.
  */
@@ -771,6 +1272,7 @@ monitor_get_most_advanced_standby(Monitor *monitor,
 			"from the monitor while running \"%s\" with "
 			"formation \"%s\" and group ID %d",
 			sql, formation, groupId);
+		nodeAddressArrayFree(&nodeArray);
 		return false;
 	}
 
@@ -782,6 +1284,7 @@ monitor_get_most_advanced_standby(Monitor *monitor,
 			"because it returned an unexpected result. "
 			"See previous line for details.",
 			sql, formation, groupId);
+		nodeAddressArrayFree(&nodeArray);
 		return false;
 	}
 
@@ -793,6 +1296,8 @@ monitor_get_most_advanced_standby(Monitor *monitor,
 	strlcpy(node->lsn, nodeArray.nodes[0].lsn, PG_LSN_MAXLENGTH);
 	node->isPrimary = nodeArray.nodes[0].isPrimary;
 
+	nodeAddressArrayFree(&nodeArray);
+
 	log_debug("The most advanced standby node is node " NODE_FORMAT,
 			  node->nodeId, node->name, node->host, node->port);
 
@@ -919,29 +1424,105 @@ monitor_register_node(Monitor *monitor, char *formation,
 }
 
 
+/*
+ * monitor_register_nodes registers a batch of nodes, given as a JSON array,
+ * with the monitor in a single round-trip and a single transaction, and
+ * prints the assigned node ids and groups. The nodes are registered in the
+ * INIT state, then each pg_autoctl create --node-id adopts its registration.
+ */
+bool
+monitor_register_nodes(Monitor *monitor, char *formation, char *dbname,
+					   char *nodesJSON, bool outputJSON)
+{
+	PGSQL *pgsql = &monitor->pgsql;
+	MonitorJSONResultContext context = { { 0 }, stdout, false };
+	const char *sql =
+		"SELECT * FROM pgautofailover.register_nodes($1, $2, $3::jsonb)";
+	int paramCount = 3;
+	Oid paramTypes[3] = { TEXTOID, NAMEOID, TEXTOID };
+	const char *paramValues[3] = { formation, dbname, nodesJSON };
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context,
+								   outputJSON
+								   ? &printResultAsJSON
+								   : &printRegisteredNodes))
+	{
+		log_error("Failed to register nodes with the monitor in formation "
+				  "\"%s\", see above for details", formation);
+		return false;
+	}
+
+	if (!context.parsedOK)
+	{
+		log_error("Failed to register nodes with the monitor in formation "
+				  "\"%s\" because it returned an unexpected result. "
+				  "See previous line for details.",
+				  formation);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * printRegisteredNodes prints the result of pgautofailover.register_nodes,
+ * one line per registered node.
+ */
+static void
+printRegisteredNodes(void *ctx, PGresult *result)
+{
+	MonitorJSONResultContext *context = (MonitorJSONResultContext *) ctx;
+	int nTuples = PQntuples(result);
+
+	log_trace("printRegisteredNodes: %d tuples", nTuples);
+
+	if (PQnfields(result) != 8)
+	{
+		log_error("Query returned %d columns, expected 8", PQnfields(result));
+		context->parsedOK = false;
+		return;
+	}
+
+	fformat(context->stream, "%20s | %6s | %7s | %5s | %s\n",
+			"Node", "Port", "Node Id", "Group", "Name");
+
+	for (int index = 0; index < nTuples; index++)
+	{
+		fformat(context->stream, "%20s | %6s | %7s | %5s | %s\n",
+				PQgetvalue(result, index, 0),
+				PQgetvalue(result, index, 1),
+				PQgetvalue(result, index, 2),
+				PQgetvalue(result, index, 3),
+				PQgetvalue(result, index, 7));
+	}
+
+	context->parsedOK = true;
+}
+
+
 /*
  * monitor_node_active communicates the current state of the node to the
  * monitor and puts the new goal state to assignedState, which must not
- * be NULL.
+ * be NULL. When standbyLSNs is not NULL, the positions of the standby nodes
+ * as seen by this primary node are also sent.
  */
 bool
 monitor_node_active(Monitor *monitor,
 					char *formation, int64_t nodeId,
 					int groupId, NodeState currentState,
 					bool pgIsRunning, int currentTLI,
-					char *currentLSN, char *pgsrSyncState,
+					char *currentLSN, char *replayLSN, char *pgsrSyncState,
+					StandbyLSNs *standbyLSNs,
 					MonitorAssignedState *assignedState)
 {
 	PGSQL *pgsql = &monitor->pgsql;
-	const char *sql =
-		"SELECT * FROM pgautofailover.node_active($1, $2, $3, "
-		"$4::pgautofailover.replication_state, $5, $6, $7, $8)";
-	int paramCount = 8;
-	Oid paramTypes[8] = {
-		TEXTOID, INT8OID, INT4OID, TEXTOID,
-		BOOLOID, INT4OID, LSNOID, TEXTOID
-	};
-	const char *paramValues[8];
+	const char *sql = NODE_ACTIVE_QUERY;
+	int paramCount = 13;
+	Oid paramTypes[13] = NODE_ACTIVE_PARAM_TYPES;
+	const char *paramValues[13];
 	MonitorAssignedStateParseContext parseContext =
 	{ { 0 }, assignedState, false };
 	const char *nodeStateString = NodeStateToString(currentState);
@@ -954,11 +1535,32 @@ monitor_node_active(Monitor *monitor,
 	paramValues[5] = intToString(currentTLI).strValue;
 	paramValues[6] = currentLSN;
 	paramValues[7] = pgsrSyncState;
+	paramValues[8] = IS_EMPTY_STRING_BUFFER(replayLSN) ? "0/0" : replayLSN;
+
+	monitor_standby_lsns_params(standbyLSNs, paramValues + 9);
 
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
 								   &parseContext, parseNodeState))
 	{
+		if (strcmp(parseContext.sqlstate, STR_ERRCODE_LOCK_NOT_AVAILABLE) == 0)
+		{
+			log_warn("Failed to get node state for node %" PRId64
+					 " from the monitor: the monitor is busy with another "
+					 "operation, such as an update of its extension, "
+					 "retrying later",
+					 nodeId);
+			return false;
+		}
+
+		if (monitor_retryable_error(parseContext.sqlstate))
+		{
+			log_warn("Failed to get node state for node %" PRId64
+					 " from the monitor, retrying later",
+					 nodeId);
+			return false;
+		}
+
 		log_error("Failed to get node state for node %" PRId64
 				  " in group %d of formation \"%s\" with initial state "
 				  "\"%s\", replication state \"%s\", "
@@ -986,6 +1588,116 @@ monitor_node_active(Monitor *monitor,
 }
 
 
+/*
+ * monitor_standby_lsns_params sets the four node_active parameters for the
+ * positions of the standby nodes, as empty arrays when standbyLSNs is NULL or
+ * has not been filled-in.
+ */
+static void
+monitor_standby_lsns_params(StandbyLSNs *standbyLSNs, const char **paramValues)
+{
+	bool hasStandbyLSNs = standbyLSNs != NULL && standbyLSNs->count > 0;
+
+	paramValues[0] = hasStandbyLSNs ? standbyLSNs->nodeIds : "{}";
+	paramValues[1] = hasStandbyLSNs ? standbyLSNs->writeLSNs : "{}";
+	paramValues[2] = hasStandbyLSNs ? standbyLSNs->flushLSNs : "{}";
+	paramValues[3] = hasStandbyLSNs ? standbyLSNs->replayLSNs : "{}";
+}
+
+
+/*
+ * monitor_node_active_get_other_nodes calls node_active like
+ * monitor_node_active, and also fetches the list of the other nodes of the
+ * group like monitor_get_other_nodes does. Both queries are sent in a single
+ * pipeline, saving a network round trip with the monitor.
+ *
+ * When node_active fails the function returns false. When only the list of
+ * other nodes could not be fetched, the function still returns true with the
+ * assignedState filled-in, and sets *otherNodesOK to false.
+ */
+bool
+monitor_node_active_get_other_nodes(Monitor *monitor,
+									char *formation, int64_t nodeId,
+									int groupId, NodeState currentState,
+									bool pgIsRunning, int currentTLI,
+									char *currentLSN, char *replayLSN,
+									char *pgsrSyncState,
+									StandbyLSNs *standbyLSNs,
+									MonitorAssignedState *assignedState,
+									NodeAddressArray *nodeArray,
+									bool *otherNodesOK)
+{
+	PGSQL *pgsql = &monitor->pgsql;
+
+	Oid nodeActiveTypes[13] = NODE_ACTIVE_PARAM_TYPES;
+	const char *nodeActiveValues[13];
+	MonitorAssignedStateParseContext nodeActiveContext =
+	{ { 0 }, assignedState, false };
+	const char *nodeStateString = NodeStateToString(currentState);
+
+	IntString nodeIdString = intToString(nodeId);
+	IntString groupIdString = intToString(groupId);
+	IntString currentTLIString = intToString(currentTLI);
+
+	nodeActiveValues[0] = formation;
+	nodeActiveValues[1] = nodeIdString.strValue;
+	nodeActiveValues[2] = groupIdString.strValue;
+	nodeActiveValues[3] = nodeStateString;
+	nodeActiveValues[4] = pgIsRunning ? "true" : "false";
+	nodeActiveValues[5] = currentTLIString.strValue;
+	nodeActiveValues[6] = currentLSN;
+	nodeActiveValues[7] = pgsrSyncState;
+	nodeActiveValues[8] =
+		IS_EMPTY_STRING_BUFFER(replayLSN) ? "0/0" : replayLSN;
+
+	monitor_standby_lsns_params(standbyLSNs, nodeActiveValues + 9);
+
+	Oid otherNodesTypes[1] = { INT8OID };
+	const char *otherNodesValues[1] = { nodeIdString.strValue };
+	NodeAddressArrayParseContext otherNodesContext =
+	{ { 0 }, nodeArray, false };
+
+	PGSQLQuery queries[2] = {
+		{
+			NODE_ACTIVE_QUERY,
+			13, nodeActiveTypes, nodeActiveValues,
+			&nodeActiveContext, parseNodeState, false
+		},
+		{
+			"SELECT * FROM pgautofailover.get_other_nodes($1) "
+			"ORDER BY node_id",
+			1, otherNodesTypes, otherNodesValues,
+			&otherNodesContext, parseNodeArray, false
+		}
+	};
+
+	(void) pgsql_execute_pipeline(pgsql, queries, 2);
+
+	if (!queries[0].success || !nodeActiveContext.parsedOK)
+	{
+		log_error("Failed to get node state for node %" PRId64
+				  " in group %d of formation \"%s\" with initial state "
+				  "\"%s\", replication state \"%s\", "
+				  "and current lsn \"%s\", "
+				  "see previous lines for details",
+				  nodeId, groupId, formation, nodeStateString,
+				  pgsrSyncState, currentLSN);
+		return false;
+	}
+
+	*otherNodesOK = queries[1].success && otherNodesContext.parsedOK;
+
+	if (!*otherNodesOK)
+	{
+		log_error("Failed to get other nodes from the monitor "
+				  "with node id %" PRId64 ", see previous lines for details",
+				  nodeId);
+	}
+
+	return true;
+}
+
+
 /*
  * monitor_set_node_candidate_priority updates the monitor on the changes
  * in the node candidate priority.
@@ -1240,493 +1952,591 @@ monitor_set_formation_number_sync_standbys(Monitor *monitor, char *formation,
 
 
 /*
- * monitor_remove_by_hostname calls the pgautofailover.monitor_remove function
- * on the monitor.
+ * monitor_get_formation_target_recovery_seconds retrieves the worst-case
+ * crash recovery time that the keepers of the formation tune their checkpoint
+ * settings for, zero when disabled.
  */
 bool
-monitor_remove_by_hostname(Monitor *monitor, char *host, int port, bool force,
-						   int64_t *nodeId, int *groupId)
+monitor_get_formation_target_recovery_seconds(Monitor *monitor,
+											  char *formation,
+											  int *targetRecoverySeconds)
 {
-	RemoveNodeContext context = { 0 };
 	PGSQL *pgsql = &monitor->pgsql;
 	const char *sql =
-		"SELECT nodeid, groupid, pgautofailover.remove_node($1, $2, $3) "
-		"  FROM pgautofailover.node"
-		" WHERE nodehost = $1 and nodeport = $2";
-	int paramCount = 3;
-	Oid paramTypes[3] = { TEXTOID, INT4OID, BOOLOID };
-	const char *paramValues[3];
-
-	paramValues[0] = host;
-	paramValues[1] = intToString(port).strValue;
-	paramValues[2] = force ? "true" : "false";
+		"SELECT target_recovery_seconds FROM pgautofailover.formation "
+		"WHERE formationid = $1";
+	int paramCount = 1;
+	Oid paramTypes[1] = { TEXTOID };
+	const char *paramValues[1];
+	SingleValueResultContext parseContext = { { 0 }, PGSQL_RESULT_INT, false };
+	paramValues[0] = formation;
 
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
-								   &context, &parseRemoveNodeContext))
+								   &parseContext, parseSingleValueResult))
 	{
-		/* if we fail to find the node we want to remove, we're good */
-		if (strcmp(context.sqlstate, STR_ERRCODE_UNDEFINED_OBJECT) == 0)
-		{
-			return true;
-		}
-
-		log_error("Failed to remove node %s:%d from the monitor", host, port);
+		log_error("Failed to retrieve target-recovery-seconds for "
+				  "formation \"%s\".",
+				  formation);
 		return false;
 	}
 
-	if (!context.parsedOK)
+	if (!parseContext.parsedOk)
 	{
-		log_error("Failed to remove node %s:%d from the monitor: "
-				  "could not parse monitor's result.", host, port);
 		return false;
 	}
 
-	/*
-	 * We ignore the return value of pgautofailover.remove_node:
-	 *  - if it's true, then the node has been removed
-	 *  - if it's false, then the node didn't exist in the first place
-	 *
-	 * The only case where we return false here is when we failed to run the
-	 * pgautofailover.remove_node function on the monitor, see above.
-	 */
-	*nodeId = context.nodeId;
-	*groupId = context.groupId;
+	*targetRecoverySeconds = parseContext.intVal;
 
 	return true;
 }
 
 
 /*
- * monitor_remove_by_nodename calls the pgautofailover.monitor_remove function
- * on the monitor.
+ * monitor_set_formation_target_recovery_seconds sets target-recovery-seconds
+ * property for formation at the monitor. The function returns true upon
+ * success.
  */
 bool
-monitor_remove_by_nodename(Monitor *monitor,
-						   char *formation, char *name, bool force,
-						   int64_t *nodeId, int *groupId)
+monitor_set_formation_target_recovery_seconds(Monitor *monitor,
+											  char *formation,
+											  int targetRecoverySeconds)
 {
-	RemoveNodeContext context = { 0 };
 	PGSQL *pgsql = &monitor->pgsql;
 	const char *sql =
-		"SELECT nodeid, groupid, pgautofailover.remove_node(nodeid::int, $3) "
-		"  FROM pgautofailover.node"
-		" WHERE formationid = $1 and nodename = $2";
-
-	int paramCount = 3;
-	Oid paramTypes[3] = { TEXTOID, TEXTOID };
-	const char *paramValues[3] = { formation, name, force ? "true" : "false" };
+		"SELECT pgautofailover.set_formation_target_recovery_seconds($1, $2)";
+	int paramCount = 2;
+	Oid paramTypes[2] = { TEXTOID, INT4OID };
+	const char *paramValues[2];
+	SingleValueResultContext parseContext = { { 0 }, PGSQL_RESULT_BOOL, false };
+	paramValues[0] = formation;
+	paramValues[1] = intToString(targetRecoverySeconds).strValue;
 
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
-								   &context, &parseRemoveNodeContext))
+								   &parseContext, parseSingleValueResult))
 	{
-		log_error("Failed to remove node \"%s\" in formation \"%s\" "
-				  "from the monitor", name, formation);
+		log_error("Failed to update target-recovery-seconds for "
+				  "formation \"%s\".",
+				  formation);
 		return false;
 	}
 
-	if (!context.parsedOK)
+	if (!parseContext.parsedOk)
 	{
-		log_error("Failed to remove node \"%s\" in formation \"%s\" "
-				  "from the monitor: could not parse monitor's result.",
-				  name, formation);
+		log_error("Formation \"%s\" does not exist", formation);
 		return false;
 	}
 
-	/*
-	 * We ignore the return value of pgautofailover.remove_node:
-	 *  - if it's true, then the node has been removed
-	 *  - if it's false, then the node didn't exist in the first place
-	 *
-	 * The only case where we return false here is when we failed to run the
-	 * pgautofailover.remove_node function on the monitor, see above.
-	 */
-	*nodeId = context.nodeId;
-	*groupId = context.groupId;
-
-	return true;
+	return parseContext.boolVal;
 }
 
 
 /*
- * parseRemoveNodeContext parses a nodeid and groupid, and the result of the
- * monitor's function call pgautofailover.remove_node which is a boolean.
+ * monitor_get_formation_slot_retention_budget retrieves how much WAL, in MB,
+ * the replication slot of a node of the formation may retain before the node
+ * is cloned again, zero when disabled.
  */
-static void
-parseRemoveNodeContext(void *ctx, PGresult *result)
+bool
+monitor_get_formation_slot_retention_budget(Monitor *monitor,
+											char *formation,
+											int *budgetMB)
 {
-	int errors = 0;
-	RemoveNodeContext *context = (RemoveNodeContext *) ctx;
-
-	context->parsedOK = false;
-
-	if (PQntuples(result) == 0)
-	{
-		log_error("Failed to find the node to remove on the monitor");
-		context->parsedOK = false;
-		return;
-	}
-	else if (PQntuples(result) != 1)
-	{
-		log_error("Query returned %d rows, expected 1", PQntuples(result));
-		context->parsedOK = false;
-		return;
-	}
-
-	if (PQnfields(result) != 3)
-	{
-		log_error("Query returned %d columns, expected 3", PQnfields(result));
-		context->parsedOK = false;
-		return;
-	}
-
-	char *value = PQgetvalue(result, 0, 0);
-
-	if (!stringToInt64(value, &context->nodeId))
-	{
-		log_error("Invalid node ID \"%s\" returned by monitor", value);
-		++errors;
-	}
-
-	value = PQgetvalue(result, 0, 1);
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql =
+		"SELECT slot_retention_budget_mb FROM pgautofailover.formation "
+		"WHERE formationid = $1";
+	int paramCount = 1;
+	Oid paramTypes[1] = { TEXTOID };
+	const char *paramValues[1];
+	SingleValueResultContext parseContext = { { 0 }, PGSQL_RESULT_INT, false };
+	paramValues[0] = formation;
 
-	if (!stringToInt(value, &context->groupId))
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &parseContext, parseSingleValueResult))
 	{
-		log_error("Invalid group ID \"%s\" returned by monitor", value);
-		++errors;
+		log_error("Failed to retrieve slot-retention-budget for "
+				  "formation \"%s\".",
+				  formation);
+		return false;
 	}
 
-	value = PQgetvalue(result, 0, 2);
-	if (value == NULL || ((*value != 't') && (*value != 'f')))
-	{
-		log_error("Invalid boolean value \"%s\" returned by monitor", value);
-		++errors;
-	}
-	else
+	if (!parseContext.parsedOk)
 	{
-		context->removed = (*value) == 't';
+		return false;
 	}
 
-	if (errors > 0)
-	{
-		context->parsedOK = false;
-		return;
-	}
+	*budgetMB = parseContext.intVal;
 
-	/* if we reach this line, then we're good. */
-	context->parsedOK = true;
+	return true;
 }
 
 
 /*
- * monitor_count_groups counts how many groups we have in this formation, and
- * sets the obtained value in the groupsCount parameter.
+ * monitor_set_formation_slot_retention_budget sets slot-retention-budget
+ * property for formation at the monitor. The function returns true upon
+ * success.
  */
 bool
-monitor_count_groups(Monitor *monitor, char *formation, int *groupsCount)
+monitor_set_formation_slot_retention_budget(Monitor *monitor,
+											char *formation,
+											int budgetMB)
 {
-	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_INT, false };
 	PGSQL *pgsql = &monitor->pgsql;
 	const char *sql =
-		"SELECT count(distinct(groupid)) "
-		"FROM pgautofailover.node "
-		"WHERE formationid = $1";
-	int paramCount = 1;
-	Oid paramTypes[1] = { TEXTOID };
-	const char *paramValues[1] = { formation };
+		"SELECT pgautofailover.set_formation_slot_retention_budget($1, $2)";
+	int paramCount = 2;
+	Oid paramTypes[2] = { TEXTOID, INT4OID };
+	const char *paramValues[2];
+	SingleValueResultContext parseContext = { { 0 }, PGSQL_RESULT_BOOL, false };
+	paramValues[0] = formation;
+	paramValues[1] = intToString(budgetMB).strValue;
 
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
-								   &context, &parseSingleValueResult))
+								   &parseContext, parseSingleValueResult))
 	{
-		log_error("Failed to get how many groups are in formation %s",
+		log_error("Failed to update slot-retention-budget for "
+				  "formation \"%s\".",
 				  formation);
 		return false;
 	}
 
-	*groupsCount = context.intVal;
+	if (!parseContext.parsedOk)
+	{
+		log_error("Formation \"%s\" does not exist", formation);
+		return false;
+	}
 
-	return true;
+	return parseContext.boolVal;
 }
 
-
 /*
- * monitor_get_groupId_from_name returns the groupId that belongs to a node
- * identified by name.
+ * monitor_set_formation_remote_wal_compression sets remote-wal-compression
+ * property for formation at the monitor. The function returns true upon
+ * success.
  */
 bool
-monitor_get_groupId_from_name(Monitor *monitor, char *formation, char *name,
-							  int *groupId)
+monitor_set_formation_remote_wal_compression(Monitor *monitor,
+											 char *formation,
+											 char *method)
 {
-	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_INT, false };
 	PGSQL *pgsql = &monitor->pgsql;
 	const char *sql =
-		"SELECT groupid FROM pgautofailover.node "
-		"WHERE formationid = $1 and nodename = $2";
+		"SELECT pgautofailover.set_formation_remote_wal_compression($1, $2)";
 	int paramCount = 2;
 	Oid paramTypes[2] = { TEXTOID, TEXTOID };
-	const char *paramValues[2] = { formation, name };
+	const char *paramValues[2];
+	SingleValueResultContext parseContext = { { 0 }, PGSQL_RESULT_BOOL, false };
+	paramValues[0] = formation;
+	paramValues[1] = method;
 
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
-								   &context, &parseSingleValueResult))
+								   &parseContext, parseSingleValueResult))
 	{
-		log_error("Failed to retrieve groupId for node \"%s\" in formation \"%s\"",
-				  name, formation);
+		log_error("Failed to update remote-wal-compression for "
+				  "formation \"%s\".",
+				  formation);
 		return false;
 	}
 
-	*groupId = context.intVal;
+	if (!parseContext.parsedOk)
+	{
+		log_error("Formation \"%s\" does not exist", formation);
+		return false;
+	}
 
-	return true;
+	return parseContext.boolVal;
 }
 
 
 /*
- * monitor_perform_failover calls the pgautofailover.monitor_perform_failover
- * function on the monitor.
+ * monitor_get_node_wal_compression retrieves the wal_compression method that
+ * the given node should use: the remote-wal-compression of its formation when
+ * its group has nodes in another cluster, and "off" otherwise.
  */
 bool
-monitor_perform_failover(Monitor *monitor, char *formation, int group)
+monitor_get_node_wal_compression(Monitor *monitor, int64_t nodeId,
+								 char *method, size_t size)
 {
 	PGSQL *pgsql = &monitor->pgsql;
-	const char *sql = "SELECT pgautofailover.perform_failover($1, $2)";
-	int paramCount = 2;
-	Oid paramTypes[2] = { TEXTOID, INT4OID };
-	const char *paramValues[2];
+	const char *sql =
+		"SELECT coalesce(pgautofailover.node_wal_compression($1), 'off')";
+	int paramCount = 1;
+	Oid paramTypes[1] = { INT8OID };
+	const char *paramValues[1];
+	SingleValueResultContext parseContext = { { 0 }, PGSQL_RESULT_STRING, false };
+	IntString nodeIdString = intToString(nodeId);
 
-	paramValues[0] = formation;
-	paramValues[1] = intToString(group).strValue;
+	paramValues[0] = nodeIdString.strValue;
 
-	/*
-	 * pgautofailover.perform_failover() returns VOID.
-	 */
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
-								   NULL, NULL))
+								   &parseContext, parseSingleValueResult))
+	{
+		log_error("Failed to retrieve the wal_compression policy of "
+				  "node %" PRId64 ".",
+				  nodeId);
+		return false;
+	}
+
+	if (!parseContext.parsedOk)
 	{
-		log_error("Failed to perform failover for formation %s and group %d",
-				  formation, group);
 		return false;
 	}
 
+	strlcpy(method, parseContext.strVal, size);
+	free(parseContext.strVal);
+
 	return true;
 }
 
 
 /*
- * monitor_perform_promotion calls the pgautofailover.perform_promotion
- * function on the monitor.
+ * monitor_get_formation_monitor retrieves the connection string of the
+ * monitor that manages the formation when it has been moved away from this
+ * monitor, and an empty string otherwise.
  */
 bool
-monitor_perform_promotion(Monitor *monitor, char *formation, char *name)
+monitor_get_formation_monitor(Monitor *monitor, char *formation,
+							  char *monitorURI, size_t size)
 {
 	PGSQL *pgsql = &monitor->pgsql;
-	const char *sql = "SELECT pgautofailover.perform_promotion($1, $2)";
-	int paramCount = 2;
-	Oid paramTypes[2] = { TEXTOID, TEXTOID };
-	const char *paramValues[2] = { formation, name };
-
-	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BOOL, false };
+	const char *sql =
+		"SELECT coalesce(pgautofailover.formation_monitor($1), '')";
+	int paramCount = 1;
+	Oid paramTypes[1] = { TEXTOID };
+	const char *paramValues[1];
+	SingleValueResultContext parseContext = { { 0 }, PGSQL_RESULT_STRING, false };
+	paramValues[0] = formation;
 
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
-								   &context, &parseSingleValueResult))
+								   &parseContext, parseSingleValueResult))
 	{
-		log_error("Failed to perform failover for node %s in formation %s",
-				  name, formation);
+		log_error("Failed to retrieve the monitor of formation \"%s\".",
+				  formation);
 		return false;
 	}
 
-	if (!context.parsedOk)
+	if (!parseContext.parsedOk)
 	{
-		log_error(
-			"Failed to call pgautofailover.perform_promotion(\"%s\", \"%s\") "
-			"on the monitor: it returned an unexpected result. "
-			"See previous line for details.",
-			formation, name);
 		return false;
 	}
 
-	return context.boolVal;
+	strlcpy(monitorURI, parseContext.strVal, size);
+	free(parseContext.strVal);
+
+	return true;
 }
 
 
 /*
- * parseNode parses a hostname and a port from the libpq result and writes
- * it to the NodeAddressParseContext pointed to by ctx.
+ * monitor_export_formation retrieves the formation and its nodes as a JSON
+ * document for monitor_import_formation. The caller frees the returned
+ * string.
  */
-static bool
-parseNode(PGresult *result, int rowNumber, NodeAddress *node)
+bool
+monitor_export_formation(Monitor *monitor, char *formation, char **export)
 {
-	if (PQgetisnull(result, rowNumber, 0) ||
-		PQgetisnull(result, rowNumber, 1) ||
-		PQgetisnull(result, rowNumber, 2) ||
-		PQgetisnull(result, rowNumber, 3))
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql =
+		"SELECT coalesce(pgautofailover.export_formation($1)::text, '')";
+	int paramCount = 1;
+	Oid paramTypes[1] = { TEXTOID };
+	const char *paramValues[1];
+	SingleValueResultContext parseContext = { { 0 }, PGSQL_RESULT_STRING, false };
+	paramValues[0] = formation;
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &parseContext, parseSingleValueResult))
 	{
-		log_error("NodeId, nodename, hostname or port returned by monitor is NULL");
+		log_error("Failed to export formation \"%s\" from the monitor.",
+				  formation);
 		return false;
 	}
 
-	char *value = PQgetvalue(result, rowNumber, 0);
-	node->nodeId = strtol(value, NULL, 0);
-	if (node->nodeId == 0)
+	if (!parseContext.parsedOk)
 	{
-		log_error("Invalid nodeId \"%s\" returned by monitor", value);
 		return false;
 	}
 
-	value = PQgetvalue(result, rowNumber, 1);
-	int length = strlcpy(node->name, value, _POSIX_HOST_NAME_MAX);
-	if (length >= _POSIX_HOST_NAME_MAX)
+	if (IS_EMPTY_STRING_BUFFER(parseContext.strVal))
 	{
-		log_error("Node name \"%s\" returned by monitor is %d characters, "
-				  "the maximum supported by pg_autoctl is %d",
-				  value, length, _POSIX_HOST_NAME_MAX - 1);
+		log_error("Formation \"%s\" does not exist", formation);
+		free(parseContext.strVal);
 		return false;
 	}
 
-	value = PQgetvalue(result, rowNumber, 2);
+	*export = parseContext.strVal;
 
-	length = strlcpy(node->host, value, _POSIX_HOST_NAME_MAX);
-	if (length >= _POSIX_HOST_NAME_MAX)
-	{
-		log_error("Hostname \"%s\" returned by monitor is %d characters, "
-				  "the maximum supported by pg_autoctl is %d",
-				  value, length, _POSIX_HOST_NAME_MAX - 1);
-		return false;
-	}
+	return true;
+}
 
-	value = PQgetvalue(result, rowNumber, 3);
 
-	if (!stringToInt(value, &node->port) || node->port == 0)
+/*
+ * monitor_import_formation registers on the monitor a formation and its
+ * nodes, as returned by monitor_export_formation on another monitor, and
+ * sets nodeCount to how many nodes have been imported.
+ */
+bool
+monitor_import_formation(Monitor *monitor, const char *export, int *nodeCount)
+{
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql = "SELECT pgautofailover.import_formation($1::jsonb)";
+	int paramCount = 1;
+	Oid paramTypes[1] = { TEXTOID };
+	const char *paramValues[1];
+	SingleValueResultContext parseContext = { { 0 }, PGSQL_RESULT_INT, false };
+	paramValues[0] = export;
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &parseContext, parseSingleValueResult))
 	{
-		log_error("Invalid port number \"%s\" returned by monitor", value);
+		log_error("Failed to import the formation on the monitor.");
 		return false;
 	}
 
-	/*
-	 * pgautofailover.get_other_nodes also returns the LSN and is_primary bits
-	 * of information.
-	 */
-	if (PQnfields(result) == 6)
+	if (!parseContext.parsedOk)
 	{
-		/* we trust Postgres pg_lsn data type to fit in our PG_LSN_MAXLENGTH */
-		value = PQgetvalue(result, rowNumber, 4);
-		strlcpy(node->lsn, value, PG_LSN_MAXLENGTH);
-
-		value = PQgetvalue(result, rowNumber, 5);
-		node->isPrimary = strcmp(value, "t") == 0;
+		return false;
 	}
 
+	*nodeCount = parseContext.intVal;
+
 	return true;
 }
 
 
 /*
- * parseNode parses a hostname and a port from the libpq result and writes
- * it to the NodeAddressParseContext pointed to by ctx.
+ * monitor_forward_formation removes the formation and its nodes from the
+ * monitor, and registers the monitor at monitorURI as the one that manages
+ * the formation now. It sets nodeCount to how many nodes have been removed.
  */
-static void
-parseNodeResult(void *ctx, PGresult *result)
+bool
+monitor_forward_formation(Monitor *monitor, char *formation,
+						  char *monitorURI, int *nodeCount)
 {
-	NodeAddressParseContext *context = (NodeAddressParseContext *) ctx;
-
-	if (PQntuples(result) != 1)
-	{
-		log_error("Query returned %d rows, expected 1", PQntuples(result));
-		context->parsedOK = false;
-		return;
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql = "SELECT pgautofailover.forward_formation($1, $2)";
+	int paramCount = 2;
+	Oid paramTypes[2] = { TEXTOID, TEXTOID };
+	const char *paramValues[2];
+	SingleValueResultContext parseContext = { { 0 }, PGSQL_RESULT_INT, false };
+	paramValues[0] = formation;
+	paramValues[1] = monitorURI;
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &parseContext, parseSingleValueResult))
+	{
+		log_error("Failed to forward formation \"%s\" to its new monitor.",
+				  formation);
+		return false;
 	}
 
-	if (PQnfields(result) != 4)
+	if (!parseContext.parsedOk)
 	{
-		log_error("Query returned %d columns, expected 3", PQnfields(result));
-		context->parsedOK = false;
-		return;
+		return false;
 	}
 
-	context->parsedOK = parseNode(result, 0, context->node);
+	*nodeCount = parseContext.intVal;
+
+	return true;
 }
 
 
+
 /*
- * parseNode parses a hostname and a port from the libpq result and writes
- * it to the NodeAddressParseContext pointed to by ctx.
+ * monitor_set_formation_health_policy sets one of the health check and
+ * failover timeouts of the formation at the monitor, where zero stands for
+ * the monitor setting of the same name. The function returns true upon
+ * success.
  */
-static void
-parseNodeArray(void *ctx, PGresult *result)
+bool
+monitor_set_formation_health_policy(Monitor *monitor, char *formation,
+									char *setting, int value)
 {
-	bool parsedOk = true;
-	int rowNumber = 0;
-	NodeAddressArrayParseContext *context = (NodeAddressArrayParseContext *) ctx;
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql =
+		"SELECT pgautofailover.set_formation_health_policy($1, $2, $3)";
+	int paramCount = 3;
+	Oid paramTypes[3] = { TEXTOID, TEXTOID, INT4OID };
+	const char *paramValues[3];
+	SingleValueResultContext parseContext = { { 0 }, PGSQL_RESULT_BOOL, false };
+	IntString valueString = intToString(value);
 
-	log_debug("parseNodeArray: %d", PQntuples(result));
+	paramValues[0] = formation;
+	paramValues[1] = setting;
+	paramValues[2] = valueString.strValue;
 
-	/* keep a NULL entry to mark the end of the array */
-	if (PQntuples(result) > NODE_ARRAY_MAX_COUNT)
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &parseContext, parseSingleValueResult))
 	{
-		log_error("Query returned %d rows, pg_auto_failover supports only up "
-				  "to %d standby nodes at the moment",
-				  PQntuples(result), NODE_ARRAY_MAX_COUNT);
-		context->parsedOK = false;
-		return;
+		log_error("Failed to update %s for formation \"%s\".",
+				  setting, formation);
+		return false;
 	}
 
-	/* pgautofailover.get_other_nodes returns 6 columns */
-	if (PQnfields(result) != 6)
+	if (!parseContext.parsedOk)
 	{
-		log_error("Query returned %d columns, expected 6", PQnfields(result));
-		context->parsedOK = false;
-		return;
+		log_error("Formation \"%s\" does not exist", formation);
+		return false;
 	}
 
-	context->nodesArray->count = PQntuples(result);
+	return parseContext.boolVal;
+}
 
-	for (rowNumber = 0; rowNumber < PQntuples(result); rowNumber++)
+/*
+ * monitor_remove_by_hostname calls the pgautofailover.monitor_remove function
+ * on the monitor.
+ */
+bool
+monitor_remove_by_hostname(Monitor *monitor, char *host, int port, bool force,
+						   int64_t *nodeId, int *groupId)
+{
+	RemoveNodeContext context = { 0 };
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql =
+		"SELECT nodeid, groupid, pgautofailover.remove_node($1, $2, $3) "
+		"  FROM pgautofailover.node"
+		" WHERE nodehost = $1 and nodeport = $2";
+	int paramCount = 3;
+	Oid paramTypes[3] = { TEXTOID, INT4OID, BOOLOID };
+	const char *paramValues[3];
+
+	paramValues[0] = host;
+	paramValues[1] = intToString(port).strValue;
+	paramValues[2] = force ? "true" : "false";
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &parseRemoveNodeContext))
 	{
-		NodeAddress *node = &(context->nodesArray->nodes[rowNumber]);
+		/* if we fail to find the node we want to remove, we're good */
+		if (strcmp(context.sqlstate, STR_ERRCODE_UNDEFINED_OBJECT) == 0)
+		{
+			return true;
+		}
 
-		parsedOk = parsedOk && parseNode(result, rowNumber, node);
+		log_error("Failed to remove node %s:%d from the monitor", host, port);
+		return false;
 	}
 
-	context->parsedOK = parsedOk;
+	if (!context.parsedOK)
+	{
+		log_error("Failed to remove node %s:%d from the monitor: "
+				  "could not parse monitor's result.", host, port);
+		return false;
+	}
+
+	/*
+	 * We ignore the return value of pgautofailover.remove_node:
+	 *  - if it's true, then the node has been removed
+	 *  - if it's false, then the node didn't exist in the first place
+	 *
+	 * The only case where we return false here is when we failed to run the
+	 * pgautofailover.remove_node function on the monitor, see above.
+	 */
+	*nodeId = context.nodeId;
+	*groupId = context.groupId;
+
+	return true;
 }
 
 
 /*
- * parseNodeState parses a node state coming back from a call to
- * register_node or node_active.
+ * monitor_remove_by_nodename calls the pgautofailover.monitor_remove function
+ * on the monitor.
+ */
+bool
+monitor_remove_by_nodename(Monitor *monitor,
+						   char *formation, char *name, bool force,
+						   int64_t *nodeId, int *groupId)
+{
+	RemoveNodeContext context = { 0 };
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql =
+		"SELECT nodeid, groupid, pgautofailover.remove_node(nodeid::int, $3) "
+		"  FROM pgautofailover.node"
+		" WHERE formationid = $1 and nodename = $2";
+
+	int paramCount = 3;
+	Oid paramTypes[3] = { TEXTOID, TEXTOID };
+	const char *paramValues[3] = { formation, name, force ? "true" : "false" };
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &parseRemoveNodeContext))
+	{
+		log_error("Failed to remove node \"%s\" in formation \"%s\" "
+				  "from the monitor", name, formation);
+		return false;
+	}
+
+	if (!context.parsedOK)
+	{
+		log_error("Failed to remove node \"%s\" in formation \"%s\" "
+				  "from the monitor: could not parse monitor's result.",
+				  name, formation);
+		return false;
+	}
+
+	/*
+	 * We ignore the return value of pgautofailover.remove_node:
+	 *  - if it's true, then the node has been removed
+	 *  - if it's false, then the node didn't exist in the first place
+	 *
+	 * The only case where we return false here is when we failed to run the
+	 * pgautofailover.remove_node function on the monitor, see above.
+	 */
+	*nodeId = context.nodeId;
+	*groupId = context.groupId;
+
+	return true;
+}
+
+
+/*
+ * parseRemoveNodeContext parses a nodeid and groupid, and the result of the
+ * monitor's function call pgautofailover.remove_node which is a boolean.
  */
 static void
-parseNodeState(void *ctx, PGresult *result)
+parseRemoveNodeContext(void *ctx, PGresult *result)
 {
-	MonitorAssignedStateParseContext *context =
-		(MonitorAssignedStateParseContext *) ctx;
 	int errors = 0;
+	RemoveNodeContext *context = (RemoveNodeContext *) ctx;
 
-	if (PQntuples(result) != 1)
+	context->parsedOK = false;
+
+	if (PQntuples(result) == 0)
+	{
+		log_error("Failed to find the node to remove on the monitor");
+		context->parsedOK = false;
+		return;
+	}
+	else if (PQntuples(result) != 1)
 	{
 		log_error("Query returned %d rows, expected 1", PQntuples(result));
 		context->parsedOK = false;
 		return;
 	}
 
-	/*
-	 * We re-use the same data structure for register_node and node_active,
-	 * where the former adds the nodename to its result.
-	 */
-	if (PQnfields(result) != 5 && PQnfields(result) != 6)
+	if (PQnfields(result) != 3)
 	{
-		log_error("Query returned %d columns, expected 5 or 6", PQnfields(result));
+		log_error("Query returned %d columns, expected 3", PQnfields(result));
 		context->parsedOK = false;
 		return;
 	}
 
 	char *value = PQgetvalue(result, 0, 0);
 
-	if (!stringToInt64(value, &context->assignedState->nodeId))
+	if (!stringToInt64(value, &context->nodeId))
 	{
 		log_error("Invalid node ID \"%s\" returned by monitor", value);
 		++errors;
@@ -1734,38 +2544,21 @@ parseNodeState(void *ctx, PGresult *result)
 
 	value = PQgetvalue(result, 0, 1);
 
-	if (!stringToInt(value, &context->assignedState->groupId))
+	if (!stringToInt(value, &context->groupId))
 	{
 		log_error("Invalid group ID \"%s\" returned by monitor", value);
 		++errors;
 	}
 
 	value = PQgetvalue(result, 0, 2);
-	context->assignedState->state = NodeStateFromString(value);
-	if (context->assignedState->state == NO_STATE)
-	{
-		log_error("Invalid node state \"%s\" returned by monitor", value);
-		++errors;
-	}
-
-	value = PQgetvalue(result, 0, 3);
-	if (!stringToInt(value, &context->assignedState->candidatePriority))
-	{
-		log_error("Invalid failover candidate priority \"%s\" "
-				  "returned by monitor", value);
-		++errors;
-	}
-
-	value = PQgetvalue(result, 0, 4);
 	if (value == NULL || ((*value != 't') && (*value != 'f')))
 	{
-		log_error("Invalid replication quorum \"%s\" "
-				  "returned by monitor", value);
+		log_error("Invalid boolean value \"%s\" returned by monitor", value);
 		++errors;
 	}
 	else
 	{
-		context->assignedState->replicationQuorum = (*value) == 't';
+		context->removed = (*value) == 't';
 	}
 
 	if (errors > 0)
@@ -1774,289 +2567,469 @@ parseNodeState(void *ctx, PGresult *result)
 		return;
 	}
 
-	if (PQnfields(result) == 6)
-	{
-		value = PQgetvalue(result, 0, 5);
-		strlcpy(context->assignedState->name,
-				value,
-				sizeof(context->assignedState->name));
-	}
-
 	/* if we reach this line, then we're good. */
 	context->parsedOK = true;
 }
 
 
 /*
- * monitor_print_state calls the function pgautofailover.current_state on the
- * monitor, and prints a line of output per state record obtained.
+ * monitor_count_groups counts how many groups we have in this formation, and
+ * sets the obtained value in the groupsCount parameter.
  */
 bool
-monitor_print_state(Monitor *monitor, char *formation, int group)
+monitor_count_groups(Monitor *monitor, char *formation, int *groupsCount)
 {
-	CurrentNodeStateArray nodesArray = { 0 };
-	NodeAddressHeaders *headers = &(nodesArray.headers);
-	PgInstanceKind firstNodeKind = NODE_KIND_UNKNOWN;
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_INT, false };
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql =
+		"SELECT count(distinct(groupid)) "
+		"FROM pgautofailover.node "
+		"WHERE formationid = $1";
+	int paramCount = 1;
+	Oid paramTypes[1] = { TEXTOID };
+	const char *paramValues[1] = { formation };
 
-	if (!monitor_get_current_state(monitor, formation, group, &nodesArray))
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &parseSingleValueResult))
 	{
-		/* errors have already been logged */
+		log_error("Failed to get how many groups are in formation %s",
+				  formation);
 		return false;
 	}
 
-	if (nodesArray.count > 0)
-	{
-		firstNodeKind = nodesArray.nodes[0].pgKind;
-	}
-
-	(void) nodestatePrepareHeaders(&nodesArray, firstNodeKind);
-	(void) nodestatePrintHeader(headers);
+	*groupsCount = context.intVal;
 
-	for (int position = 0; position < nodesArray.count; position++)
-	{
-		CurrentNodeState *nodeState = &(nodesArray.nodes[position]);
+	return true;
+}
 
-		(void) nodestatePrintNodeState(headers, nodeState);
+
+/*
+ * monitor_get_groupId_from_name returns the groupId that belongs to a node
+ * identified by name.
+ */
+bool
+monitor_get_groupId_from_name(Monitor *monitor, char *formation, char *name,
+							  int *groupId)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_INT, false };
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql =
+		"SELECT groupid FROM pgautofailover.node "
+		"WHERE formationid = $1 and nodename = $2";
+	int paramCount = 2;
+	Oid paramTypes[2] = { TEXTOID, TEXTOID };
+	const char *paramValues[2] = { formation, name };
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &parseSingleValueResult))
+	{
+		log_error("Failed to retrieve groupId for node \"%s\" in formation \"%s\"",
+				  name, formation);
+		return false;
 	}
 
-	fformat(stdout, "\n");
+	*groupId = context.intVal;
 
 	return true;
 }
 
 
 /*
- * monitor_get_current_state gets the current state of a formation in the given
- * pre-allocated nodesArray. When group is -1, the state of all the nodes that
- * belong to the formation is retrieved. When group is 0 or more, the state for
- * only the nodes that belong to the given group in the given formation is
- * retrieved.
+ * monitor_perform_failover calls the pgautofailover.monitor_perform_failover
+ * function on the monitor.
  */
 bool
-monitor_get_current_state(Monitor *monitor, char *formation, int group,
-						  CurrentNodeStateArray *nodesArray)
+monitor_perform_failover(Monitor *monitor, char *formation, int group)
 {
-	CurrentNodeStateContext context = { { 0 }, nodesArray, false };
 	PGSQL *pgsql = &monitor->pgsql;
-	char *sql = NULL;
-	int paramCount = 0;
-	Oid paramTypes[2];
+	const char *sql = "SELECT pgautofailover.perform_failover($1, $2)";
+	int paramCount = 2;
+	Oid paramTypes[2] = { TEXTOID, INT4OID };
 	const char *paramValues[2];
-	IntString groupStr;
 
-	log_trace("monitor_print_state(%s, %d)", formation, group);
+	paramValues[0] = formation;
+	paramValues[1] = intToString(group).strValue;
 
-	switch (group)
+	/*
+	 * pgautofailover.perform_failover() returns VOID.
+	 */
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   NULL, NULL))
 	{
-		case -1:
-		{
-			sql =
-				"  SELECT formation_kind, nodename, nodehost, nodeport, "
-				"         group_id, node_id, "
-				"         current_group_state, assigned_group_state, "
-				"         candidate_priority, replication_quorum, "
-				"         reported_tli, reported_lsn, health, nodecluster, "
-				"         healthlag, reportlag"
-				"    FROM pgautofailover.current_state($1) cs "
-				"    JOIN ("
-				"          select nodeid, "
-				"                 extract(epoch from now() - healthchecktime), "
-				"                 extract(epoch from now() - reporttime) "
-				"            from pgautofailover.node "
-				"         ) as n(nodeid, healthlag, reportlag)"
-				"         on n.nodeid = cs.node_id "
-				"ORDER BY group_id, node_id";
+		log_error("Failed to perform failover for formation %s and group %d",
+				  formation, group);
+		return false;
+	}
 
-			paramCount = 1;
-			paramTypes[0] = TEXTOID;
-			paramValues[0] = formation;
+	return true;
+}
 
-			break;
-		}
 
-		default:
-		{
-			sql =
-				"  SELECT formation_kind, nodename, nodehost, nodeport, "
-				"         group_id, node_id, "
-				"         current_group_state, assigned_group_state, "
-				"         candidate_priority, replication_quorum, "
-				"         reported_tli, reported_lsn, health, nodecluster, "
-				"         healthlag, reportlag"
-				"    FROM pgautofailover.current_state($1, $2) cs "
-				"    JOIN ("
-				"          select nodeid, "
-				"                 extract(epoch from now() - healthchecktime), "
-				"                 extract(epoch from now() - reporttime) "
-				"            from pgautofailover.node "
-				"         ) as n(nodeid, healthlag, reportlag)"
-				"         on n.nodeid = cs.node_id "
-				"ORDER BY group_id, node_id";
+/*
+ * monitor_perform_switchover_away_from_cluster calls the function
+ * pgautofailover.perform_switchover_away_from_cluster on the monitor, which
+ * starts a switchover in up to maxGroups groups of the formation that have
+ * their primary node in the given cluster, and fills in groupsArray with the
+ * groups where a switchover has been started. A maxGroups of zero starts them
+ * all.
+ */
+bool
+monitor_perform_switchover_away_from_cluster(Monitor *monitor,
+											 char *formation,
+											 char *cluster,
+											 int maxGroups,
+											 SwitchoverGroupArray *groupsArray)
+{
+	SwitchoverGroupParseContext context = { { 0 }, groupsArray, false };
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql =
+		"SELECT group_id, node_id, node_name "
+		"FROM pgautofailover.perform_switchover_away_from_cluster($1, $2, $3)";
+	int paramCount = 3;
+	Oid paramTypes[3] = { TEXTOID, TEXTOID, INT4OID };
+	const char *paramValues[3];
+	IntString maxGroupsString = intToString(maxGroups);
 
-			groupStr = intToString(group);
+	paramValues[0] = formation;
+	paramValues[1] = cluster;
+	paramValues[2] = maxGroupsString.strValue;
 
-			paramCount = 2;
-			paramTypes[0] = TEXTOID;
-			paramValues[0] = formation;
-			paramTypes[1] = INT4OID;
-			paramValues[1] = groupStr.strValue;
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &parseSwitchoverGroups))
+	{
+		log_error("Failed to perform switchover away from cluster \"%s\" "
+				  "in formation \"%s\"",
+				  cluster, formation);
+		return false;
+	}
 
-			break;
+	if (!context.parsedOK)
+	{
+		log_error("Failed to parse the groups where the monitor started "
+				  "a switchover away from cluster \"%s\"",
+				  cluster);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * parseSwitchoverGroups parses the result of the SQL function
+ * pgautofailover.perform_switchover_away_from_cluster into a
+ * SwitchoverGroupArray.
+ */
+static void
+parseSwitchoverGroups(void *ctx, PGresult *result)
+{
+	SwitchoverGroupParseContext *context = (SwitchoverGroupParseContext *) ctx;
+	int nTuples = PQntuples(result);
+
+	if (PQnfields(result) != 3)
+	{
+		log_error("Query returned %d columns, expected 3", PQnfields(result));
+		context->parsedOK = false;
+		return;
+	}
+
+	if (nTuples > SWITCHOVER_GROUPS_MAX_COUNT)
+	{
+		log_error("Query returned %d groups, pg_autoctl only supports "
+				  "up to %d groups",
+				  nTuples, SWITCHOVER_GROUPS_MAX_COUNT);
+		context->parsedOK = false;
+		return;
+	}
+
+	context->groupsArray->count = nTuples;
+
+	for (int index = 0; index < nTuples; index++)
+	{
+		SwitchoverGroup *group = &(context->groupsArray->groups[index]);
+
+		if (!stringToInt(PQgetvalue(result, index, 0), &(group->groupId)) ||
+			!stringToInt64(PQgetvalue(result, index, 1), &(group->nodeId)))
+		{
+			log_error("Invalid group id \"%s\" or node id \"%s\" "
+					  "returned by monitor",
+					  PQgetvalue(result, index, 0),
+					  PQgetvalue(result, index, 1));
+			context->parsedOK = false;
+			return;
 		}
+
+		strlcpy(group->nodeName,
+				PQgetvalue(result, index, 2),
+				sizeof(group->nodeName));
 	}
 
+	context->parsedOK = true;
+}
+
+
+/*
+ * monitor_perform_promotion calls the pgautofailover.perform_promotion
+ * function on the monitor.
+ */
+bool
+monitor_perform_promotion(Monitor *monitor, char *formation, char *name)
+{
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql = "SELECT pgautofailover.perform_promotion($1, $2)";
+	int paramCount = 2;
+	Oid paramTypes[2] = { TEXTOID, TEXTOID };
+	const char *paramValues[2] = { formation, name };
+
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BOOL, false };
+
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
-								   &context, &getCurrentState))
+								   &context, &parseSingleValueResult))
 	{
-		log_error("Failed to retrieve current state from the monitor");
+		log_error("Failed to perform failover for node %s in formation %s",
+				  name, formation);
 		return false;
 	}
 
-	if (!context.parsedOK)
+	if (!context.parsedOk)
 	{
-		log_error("Failed to parse current state from the monitor");
+		log_error(
+			"Failed to call pgautofailover.perform_promotion(\"%s\", \"%s\") "
+			"on the monitor: it returned an unexpected result. "
+			"See previous line for details.",
+			formation, name);
 		return false;
 	}
 
-	return true;
+	return context.boolVal;
 }
 
 
 /*
- * parseCurrentNodeState parses the 11 columns returned by the API endpoint
- * pgautofailover.current_state.
+ * parseNode parses a hostname and a port from the libpq result and writes
+ * it to the NodeAddressParseContext pointed to by ctx.
  */
 static bool
-parseCurrentNodeState(PGresult *result, int rowNumber,
-					  CurrentNodeState *nodeState)
+parseNode(PGresult *result, int rowNumber, NodeAddress *node)
 {
-	int colNumber = 0;
-	int errors = 0;
+	if (PQgetisnull(result, rowNumber, 0) ||
+		PQgetisnull(result, rowNumber, 1) ||
+		PQgetisnull(result, rowNumber, 2) ||
+		PQgetisnull(result, rowNumber, 3))
+	{
+		log_error("NodeId, nodename, hostname or port returned by monitor is NULL");
+		return false;
+	}
 
-	/* we don't expect any of the column to be NULL */
-	for (colNumber = 0; colNumber < 16; colNumber++)
+	char *value = PQgetvalue(result, rowNumber, 0);
+	node->nodeId = strtol(value, NULL, 0);
+	if (node->nodeId == 0)
 	{
-		if (PQgetisnull(result, rowNumber, 0))
-		{
-			log_error("column %d in row %d returned by the monitor is NULL",
-					  colNumber, rowNumber);
-			return false;
-		}
+		log_error("Invalid nodeId \"%s\" returned by monitor", value);
+		return false;
 	}
 
-	/*
-	 *  0 - OUT formation_kind       text,
-	 *  1 - OUT nodename             text,
-	 *  2 - OUT nodehost             text,
-	 *  3 - OUT nodeport             int,
-	 *  4 - OUT group_id             int,
-	 *  5 - OUT node_id              bigint,
-	 *  6 - OUT current_group_state  pgautofailover.replication_state,
-	 *  7 - OUT assigned_group_state pgautofailover.replication_state,
-	 *  8 - OUT candidate_priority	 int,
-	 *  9 - OUT replication_quorum	 bool,
-	 * 10 - OUT reported_tli         int,
-	 * 11 - OUT reported_lsn         pg_lsn,
-	 * 12 - OUT health               integer
-	 * 13 - OUT nodecluster          text
-	 * 14 -     healthlag            int (extract epoch from interval)
-	 * 15 -     reportlag            int (extract epoch from interval)
-	 *
-	 * We need the groupId to parse the formation kind into a nodeKind, so we
-	 * begin at column 1 and get back to column 0 later, after column 4.
-	 */
-	char *value = PQgetvalue(result, rowNumber, 1);
-	int length = strlcpy(nodeState->node.name, value, _POSIX_HOST_NAME_MAX);
+	value = PQgetvalue(result, rowNumber, 1);
+	int length = strlcpy(node->name, value, _POSIX_HOST_NAME_MAX);
 	if (length >= _POSIX_HOST_NAME_MAX)
 	{
 		log_error("Node name \"%s\" returned by monitor is %d characters, "
 				  "the maximum supported by pg_autoctl is %d",
 				  value, length, _POSIX_HOST_NAME_MAX - 1);
-		++errors;
+		return false;
 	}
 
 	value = PQgetvalue(result, rowNumber, 2);
 
-	length = strlcpy(nodeState->node.host, value, _POSIX_HOST_NAME_MAX);
+	length = strlcpy(node->host, value, _POSIX_HOST_NAME_MAX);
 	if (length >= _POSIX_HOST_NAME_MAX)
 	{
 		log_error("Hostname \"%s\" returned by monitor is %d characters, "
 				  "the maximum supported by pg_autoctl is %d",
 				  value, length, _POSIX_HOST_NAME_MAX - 1);
-		++errors;
+		return false;
 	}
 
 	value = PQgetvalue(result, rowNumber, 3);
 
-	if (!stringToInt(value, &(nodeState->node.port)) ||
-		nodeState->node.port == 0)
+	if (!stringToInt(value, &node->port) || node->port == 0)
 	{
 		log_error("Invalid port number \"%s\" returned by monitor", value);
-		++errors;
+		return false;
 	}
 
-	value = PQgetvalue(result, rowNumber, 4);
-	if (!stringToInt(value, &(nodeState->groupId)))
+	/*
+	 * pgautofailover.get_other_nodes also returns the LSN and is_primary bits
+	 * of information.
+	 */
+	if (PQnfields(result) == 6)
 	{
-		log_error("Invalid groupId \"%s\" returned by monitor", value);
-		++errors;
+		/* we trust Postgres pg_lsn data type to fit in our PG_LSN_MAXLENGTH */
+		value = PQgetvalue(result, rowNumber, 4);
+		strlcpy(node->lsn, value, PG_LSN_MAXLENGTH);
+
+		value = PQgetvalue(result, rowNumber, 5);
+		node->isPrimary = strcmp(value, "t") == 0;
 	}
 
-	/* we need the groupId to parse the formation kind into a nodeKind */
-	value = PQgetvalue(result, rowNumber, 0);
+	return true;
+}
 
-	if (strcmp(value, "pgsql") == 0 && nodeState->groupId == 0)
+
+/*
+ * parseNode parses a hostname and a port from the libpq result and writes
+ * it to the NodeAddressParseContext pointed to by ctx.
+ */
+static void
+parseNodeResult(void *ctx, PGresult *result)
+{
+	NodeAddressParseContext *context = (NodeAddressParseContext *) ctx;
+
+	if (PQntuples(result) != 1)
 	{
-		nodeState->pgKind = NODE_KIND_STANDALONE;
+		log_error("Query returned %d rows, expected 1", PQntuples(result));
+		context->parsedOK = false;
+		return;
 	}
-	else if (strcmp(value, "citus") == 0 && nodeState->groupId == 0)
+
+	if (PQnfields(result) != 4)
 	{
-		nodeState->pgKind = NODE_KIND_CITUS_COORDINATOR;
+		log_error("Query returned %d columns, expected 3", PQnfields(result));
+		context->parsedOK = false;
+		return;
 	}
-	else if (strcmp(value, "citus") == 0 && nodeState->groupId > 0)
+
+	context->parsedOK = parseNode(result, 0, context->node);
+}
+
+
+/*
+ * parseNode parses a hostname and a port from the libpq result and writes
+ * it to the NodeAddressParseContext pointed to by ctx.
+ */
+static void
+parseNodeArray(void *ctx, PGresult *result)
+{
+	bool parsedOk = true;
+	int rowNumber = 0;
+	NodeAddressArrayParseContext *context = (NodeAddressArrayParseContext *) ctx;
+
+	log_debug("parseNodeArray: %d", PQntuples(result));
+
+	/* pgautofailover.get_other_nodes returns 6 columns */
+	if (PQnfields(result) != 6)
 	{
-		nodeState->pgKind = NODE_KIND_CITUS_WORKER;
+		log_error("Query returned %d columns, expected 6", PQnfields(result));
+		context->parsedOK = false;
+		return;
 	}
-	else
+
+	if (!nodeAddressArrayReserve(context->nodesArray, PQntuples(result)))
 	{
-		log_error("Invalid groupId %d with formation kind \"%s\"",
-				  nodeState->groupId, value);
-		++errors;
+		/* errors have already been logged */
+		context->parsedOK = false;
+		return;
 	}
 
-	value = PQgetvalue(result, rowNumber, 5);
-	if (!stringToInt64(value, &(nodeState->node.nodeId)))
+	context->nodesArray->count = PQntuples(result);
+
+	for (rowNumber = 0; rowNumber < PQntuples(result); rowNumber++)
 	{
-		log_error("Invalid nodeId \"%s\" returned by monitor", value);
+		NodeAddress *node = &(context->nodesArray->nodes[rowNumber]);
+
+		parsedOk = parsedOk && parseNode(result, rowNumber, node);
+	}
+
+	context->parsedOK = parsedOk;
+}
+
+
+/*
+ * monitor_parse_nodes_result parses a result that has the columns of
+ * pgautofailover.get_other_nodes into the given nodesArray. It allows timing
+ * our parsing code on a result built in memory, see pg_autoctl do bench
+ * internals.
+ */
+bool
+monitor_parse_nodes_result(PGresult *result, NodeAddressArray *nodesArray)
+{
+	NodeAddressArrayParseContext context = { { 0 }, nodesArray, false };
+
+	(void) parseNodeArray(&context, result);
+
+	return context.parsedOK;
+}
+
+
+/*
+ * parseNodeState parses a node state coming back from a call to
+ * register_node or node_active.
+ */
+static void
+parseNodeState(void *ctx, PGresult *result)
+{
+	MonitorAssignedStateParseContext *context =
+		(MonitorAssignedStateParseContext *) ctx;
+	int errors = 0;
+
+	if (PQntuples(result) != 1)
+	{
+		log_error("Query returned %d rows, expected 1", PQntuples(result));
+		context->parsedOK = false;
+		return;
+	}
+
+	/*
+	 * We re-use the same data structure for register_node and node_active,
+	 * where the former adds the nodename to its result, and the latter the
+	 * topology version of the group, the lease duration, the settings of the
+	 * group, and the trace id of our goal state.
+	 */
+	if (PQnfields(result) < 5 || PQnfields(result) > 13)
+	{
+		log_error("Query returned %d columns, expected 5 to 13", PQnfields(result));
+		context->parsedOK = false;
+		return;
+	}
+
+	char *value = PQgetvalue(result, 0, 0);
+
+	if (!stringToInt64(value, &context->assignedState->nodeId))
+	{
+		log_error("Invalid node ID \"%s\" returned by monitor", value);
 		++errors;
 	}
 
-	value = PQgetvalue(result, rowNumber, 6);
-	nodeState->reportedState = NodeStateFromString(value);
-	if (nodeState->reportedState == NO_STATE)
+	value = PQgetvalue(result, 0, 1);
+
+	if (!stringToInt(value, &context->assignedState->groupId))
 	{
-		log_error("Invalid node state \"%s\" returned by monitor", value);
+		log_error("Invalid group ID \"%s\" returned by monitor", value);
 		++errors;
 	}
 
-	value = PQgetvalue(result, rowNumber, 7);
-	nodeState->goalState = NodeStateFromString(value);
-	if (nodeState->goalState == NO_STATE)
+	value = PQgetvalue(result, 0, 2);
+	context->assignedState->state = NodeStateFromString(value);
+	if (context->assignedState->state == NO_STATE)
 	{
 		log_error("Invalid node state \"%s\" returned by monitor", value);
 		++errors;
 	}
 
-	value = PQgetvalue(result, rowNumber, 8);
-	if (!stringToInt(value, &(nodeState->candidatePriority)))
+	value = PQgetvalue(result, 0, 3);
+	if (!stringToInt(value, &context->assignedState->candidatePriority))
 	{
 		log_error("Invalid failover candidate priority \"%s\" "
 				  "returned by monitor", value);
 		++errors;
 	}
 
-	value = PQgetvalue(result, rowNumber, 9);
+	value = PQgetvalue(result, 0, 4);
 	if (value == NULL || ((*value != 't') && (*value != 'f')))
 	{
 		log_error("Invalid replication quorum \"%s\" "
@@ -2065,147 +3038,230 @@ parseCurrentNodeState(PGresult *result, int rowNumber,
 	}
 	else
 	{
-		nodeState->replicationQuorum = (*value) == 't';
+		context->assignedState->replicationQuorum = (*value) == 't';
 	}
 
-	value = PQgetvalue(result, rowNumber, 10);
-	if (!stringToInt(value, &(nodeState->node.tli)))
+	if (errors > 0)
 	{
-		log_error("Invalid timeline \"%s\" returned by monitor", value);
-		++errors;
+		context->parsedOK = false;
+		return;
 	}
 
-	/* we trust Postgres pg_lsn data type to fit in our PG_LSN_MAXLENGTH */
-	value = PQgetvalue(result, rowNumber, 11);
-	strlcpy(nodeState->node.lsn, value, PG_LSN_MAXLENGTH);
+	int nameColumn = PQfnumber(result, "assigned_node_name");
 
-	value = PQgetvalue(result, rowNumber, 12);
-	if (!stringToInt(value, &(nodeState->health)))
+	if (nameColumn >= 0)
 	{
-		log_error("Invalid node health \"%s\" returned by monitor", value);
-		++errors;
+		value = PQgetvalue(result, 0, nameColumn);
+		strlcpy(context->assignedState->name,
+				value,
+				sizeof(context->assignedState->name));
 	}
 
-	value = PQgetvalue(result, rowNumber, 13);
-	length = strlcpy(nodeState->citusClusterName, value, NAMEDATALEN);
-	if (length >= NAMEDATALEN)
+	int versionColumn = PQfnumber(result, "group_topology_version");
+
+	if (versionColumn >= 0)
 	{
-		log_error("Cluster name \"%s\" returned by monitor is %d characters, "
-				  "the maximum supported by pg_autoctl is %d",
-				  value, length, NAMEDATALEN - 1);
-		++errors;
+		value = PQgetvalue(result, 0, versionColumn);
+
+		if (!stringToInt64(value, &context->assignedState->topologyVersion))
+		{
+			log_error("Invalid topology version \"%s\" returned by monitor",
+					  value);
+			context->parsedOK = false;
+			return;
+		}
 	}
 
-	value = PQgetvalue(result, rowNumber, 14);
+	int leaseColumn = PQfnumber(result, "primary_lease_duration");
 
-	if (!stringToDouble(value, &(nodeState->healthLag)))
+	if (leaseColumn >= 0)
 	{
-		log_error("Invalid health lag \"%s\" returned by monitor", value);
-		++errors;
+		value = PQgetvalue(result, 0, leaseColumn);
+
+		if (!stringToInt(value, &context->assignedState->leaseDurationMs))
+		{
+			log_error("Invalid lease duration \"%s\" returned by monitor",
+					  value);
+			context->parsedOK = false;
+			return;
+		}
 	}
 
-	value = PQgetvalue(result, rowNumber, 15);
+	int traceColumn = PQfnumber(result, "goal_trace_id");
 
-	if (!stringToDouble(value, &(nodeState->reportLag)))
+	if (traceColumn >= 0)
 	{
-		log_error("Invalid report lag \"%s\" returned by monitor", value);
-		++errors;
+		value = PQgetvalue(result, 0, traceColumn);
+
+		if (!stringToInt64(value, &context->assignedState->traceId))
+		{
+			log_error("Invalid trace id \"%s\" returned by monitor", value);
+			context->parsedOK = false;
+			return;
+		}
 	}
 
-	return errors == 0;
+	if (!parseNodeActiveGroupSettings(result,
+									  &(context->assignedState->groupSettings)))
+	{
+		context->parsedOK = false;
+		return;
+	}
+
+	/* if we reach this line, then we're good. */
+	context->parsedOK = true;
 }
 
 
 /*
- * parseCurrentNodeStateArray parses an array of up to NODE_ARRAY_MAX_COUNT
- * nodeStates, one entry per node in a given formation.
+ * parseNodeActiveGroupSettings parses the columns of the result of
+ * pgautofailover.node_active_group_settings, which are NULL when the node is
+ * not in a transition.
  */
 static bool
-parseCurrentNodeStateArray(CurrentNodeStateArray *nodesArray, PGresult *result)
+parseNodeActiveGroupSettings(PGresult *result, MonitorGroupSettings *settings)
 {
-	bool parsedOk = true;
-	int rowNumber = 0;
+	int nodeIdColumn = PQfnumber(result, "primary_node_id");
+	int nameColumn = PQfnumber(result, "primary_name");
+	int hostColumn = PQfnumber(result, "primary_host");
+	int portColumn = PQfnumber(result, "primary_port");
+	int namesColumn = PQfnumber(result, "synchronous_standby_names");
 
-	log_trace("parseCurrentNodeStateArray: %d", PQntuples(result));
+	settings->hasPrimary = false;
+	settings->hasSynchronousStandbyNames = false;
 
-	/* keep a NULL entry to mark the end of the array */
-	if (PQntuples(result) > NODE_ARRAY_MAX_COUNT)
+	if (nodeIdColumn >= 0 && nameColumn >= 0 &&
+		hostColumn >= 0 && portColumn >= 0 &&
+		!PQgetisnull(result, 0, nodeIdColumn))
 	{
-		log_error("Query returned %d rows, pg_auto_failover supports only up "
-				  "to %d standby nodes at the moment",
-				  PQntuples(result), NODE_ARRAY_MAX_COUNT);
-		return false;
-	}
+		NodeAddress *primaryNode = &(settings->primaryNode);
+		char *value = PQgetvalue(result, 0, nodeIdColumn);
 
-	/* pgautofailover.current_state returns 11 columns */
-	if (PQnfields(result) != 16)
-	{
-		log_error("Query returned %d columns, expected 16", PQnfields(result));
-		return false;
-	}
+		if (!stringToInt64(value, &(primaryNode->nodeId)))
+		{
+			log_error("Invalid primary node ID \"%s\" returned by monitor",
+					  value);
+			return false;
+		}
 
-	nodesArray->count = PQntuples(result);
+		strlcpy(primaryNode->name, PQgetvalue(result, 0, nameColumn),
+				sizeof(primaryNode->name));
+		strlcpy(primaryNode->host, PQgetvalue(result, 0, hostColumn),
+				sizeof(primaryNode->host));
 
-	for (rowNumber = 0; rowNumber < PQntuples(result); rowNumber++)
-	{
-		CurrentNodeState *nodeState = &(nodesArray->nodes[rowNumber]);
+		value = PQgetvalue(result, 0, portColumn);
 
-		parsedOk = parsedOk &&
-				   parseCurrentNodeState(result, rowNumber, nodeState);
+		if (!stringToInt(value, &(primaryNode->port)))
+		{
+			log_error("Invalid primary port \"%s\" returned by monitor",
+					  value);
+			return false;
+		}
+
+		primaryNode->isPrimary = true;
+		settings->hasPrimary = true;
 	}
 
-	return parsedOk;
+	if (namesColumn >= 0 && !PQgetisnull(result, 0, namesColumn))
+	{
+		strlcpy(settings->synchronousStandbyNames,
+				PQgetvalue(result, 0, namesColumn),
+				sizeof(settings->synchronousStandbyNames));
+		settings->hasSynchronousStandbyNames = true;
+	}
+
+	return true;
 }
 
 
 /*
- * getCurrentState loops over pgautofailover.current_state() results and adds
- * them to the context's nodes array.
+ * monitor_print_state calls the function pgautofailover.current_state on the
+ * monitor, and prints a line of output per state record obtained.
  */
-static void
-getCurrentState(void *ctx, PGresult *result)
+bool
+monitor_print_state(Monitor *monitor, char *formation, int group)
 {
-	CurrentNodeStateContext *context = (CurrentNodeStateContext *) ctx;
-	CurrentNodeStateArray *nodesArray = context->nodesArray;
+	CurrentNodeStateArray nodesArray = { 0 };
+	NodeAddressHeaders *headers = &(nodesArray.headers);
+	PgInstanceKind firstNodeKind = NODE_KIND_UNKNOWN;
 
-	if (!parseCurrentNodeStateArray(nodesArray, result))
+	if (!monitor_get_current_state(monitor, formation, group, &nodesArray))
 	{
 		/* errors have already been logged */
-		context->parsedOK = false;
-		return;
+		currentNodeStateArrayFree(&nodesArray);
+		return false;
 	}
 
-	context->parsedOK = true;
+	if (nodesArray.count > 0)
+	{
+		firstNodeKind = nodesArray.nodes[0].pgKind;
+	}
+
+	(void) nodestatePrepareHeaders(&nodesArray, firstNodeKind);
+	(void) nodestatePrintHeader(headers);
+
+	for (int position = 0; position < nodesArray.count; position++)
+	{
+		CurrentNodeState *nodeState = &(nodesArray.nodes[position]);
+
+		(void) nodestatePrintNodeState(headers, nodeState);
+	}
+
+	fformat(stdout, "\n");
+
+	currentNodeStateArrayFree(&nodesArray);
+
+	return true;
 }
 
 
 /*
- * monitor_print_state_as_json prints to given stream a single string that
- * contains the JSON representation of the current state on the monitor.
+ * monitor_get_current_state gets the current state of a formation in the given
+ * pre-allocated nodesArray. When group is -1, the state of all the nodes that
+ * belong to the formation is retrieved. When group is 0 or more, the state for
+ * only the nodes that belong to the given group in the given formation is
+ * retrieved.
  */
 bool
-monitor_print_state_as_json(Monitor *monitor, char *formation, int group)
+monitor_get_current_state(Monitor *monitor, char *formation, int group,
+						  CurrentNodeStateArray *nodesArray)
 {
-	SingleValueResultContext context = { 0 };
-	PGSQL *pgsql = &monitor->pgsql;
+	CurrentNodeStateContext context = { { 0 }, nodesArray, false };
+	PGSQL *pgsql = monitor_read_client(monitor);
 	char *sql = NULL;
 	int paramCount = 0;
 	Oid paramTypes[2];
 	const char *paramValues[2];
 	IntString groupStr;
 
-	log_trace("monitor_get_state_as_json(%s, %d)", formation, group);
-
-	context.resultType = PGSQL_RESULT_STRING;
-	context.parsedOk = false;
+	log_trace("monitor_print_state(%s, %d)", formation, group);
 
 	switch (group)
 	{
 		case -1:
 		{
-			sql = "SELECT jsonb_pretty("
-				  "coalesce(jsonb_agg(row_to_json(state)), '[]'))"
-				  " FROM pgautofailover.current_state($1) as state";
+			sql =
+				"  SELECT formation_kind, nodename, nodehost, nodeport, "
+				"         group_id, node_id, "
+				"         current_group_state, assigned_group_state, "
+				"         candidate_priority, replication_quorum, "
+				"         reported_tli, reported_lsn, health, nodecluster, "
+				"         healthlag, reportlag"
+				"    FROM pgautofailover.current_state($1) cs "
+				"    JOIN ("
+				"          select nodeid, "
+				"                 extract(epoch from now() - "
+				"                   greatest(report.healthchecktime, "
+				"                            stats.last_check_time)), "
+				"                 extract(epoch from now() - report.reporttime) "
+				"            from pgautofailover.node "
+				"       left join pgautofailover.node_report as report "
+				"           using(nodeid) "
+				"       left join pgautofailover.health_check_stats() "
+				"              as stats on stats.node_id = node.nodeid "
+				"         ) as n(nodeid, healthlag, reportlag)"
+				"         on n.nodeid = cs.node_id "
+				"ORDER BY group_id, node_id";
 
 			paramCount = 1;
 			paramTypes[0] = TEXTOID;
@@ -2216,9 +3272,28 @@ monitor_print_state_as_json(Monitor *monitor, char *formation, int group)
 
 		default:
 		{
-			sql = "SELECT jsonb_pretty("
-				  "coalesce(jsonb_agg(row_to_json(state)), '[]'))"
-				  "FROM pgautofailover.current_state($1,$2) as state";
+			sql =
+				"  SELECT formation_kind, nodename, nodehost, nodeport, "
+				"         group_id, node_id, "
+				"         current_group_state, assigned_group_state, "
+				"         candidate_priority, replication_quorum, "
+				"         reported_tli, reported_lsn, health, nodecluster, "
+				"         healthlag, reportlag"
+				"    FROM pgautofailover.current_state($1, $2) cs "
+				"    JOIN ("
+				"          select nodeid, "
+				"                 extract(epoch from now() - "
+				"                   greatest(report.healthchecktime, "
+				"                            stats.last_check_time)), "
+				"                 extract(epoch from now() - report.reporttime) "
+				"            from pgautofailover.node "
+				"       left join pgautofailover.node_report as report "
+				"           using(nodeid) "
+				"       left join pgautofailover.health_check_stats() "
+				"              as stats on stats.node_id = node.nodeid "
+				"         ) as n(nodeid, healthlag, reportlag)"
+				"         on n.nodeid = cs.node_id "
+				"ORDER BY group_id, node_id";
 
 			groupStr = intToString(group);
 
@@ -2234,313 +3309,331 @@ monitor_print_state_as_json(Monitor *monitor, char *formation, int group)
 
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
-								   &context, &parseSingleValueResult))
+								   &context, &getCurrentState))
 	{
 		log_error("Failed to retrieve current state from the monitor");
 		return false;
 	}
 
-	if (!context.parsedOk)
+	if (!context.parsedOK)
 	{
 		log_error("Failed to parse current state from the monitor");
-		log_error("%s", context.strVal);
-		if (context.strVal)
-		{
-			free(context.strVal);
-		}
 		return false;
 	}
 
-	fformat(stdout, "%s\n", context.strVal);
-	free(context.strVal);
-
 	return true;
 }
 
 
 /*
- * monitor_print_last_events calls the function pgautofailover.last_events on
- * the monitor, and prints a line of output per event obtained.
+ * parseCurrentNodeState parses the 11 columns returned by the API endpoint
+ * pgautofailover.current_state.
  */
-bool
-monitor_print_last_events(Monitor *monitor, char *formation, int group, int count)
+static bool
+parseCurrentNodeState(PGresult *result, int rowNumber,
+					  CurrentNodeState *nodeState)
 {
-	MonitorAssignedStateParseContext context = { 0 };
-	PGSQL *pgsql = &monitor->pgsql;
-	char *sql = NULL;
-	int paramCount = 0;
-	Oid paramTypes[3];
-	const char *paramValues[3];
-	IntString countStr;
-	IntString groupStr;
+	int colNumber = 0;
+	int errors = 0;
 
-	log_trace("monitor_print_last_events(%s, %d, %d)", formation, group, count);
+	/* the current state is more recent than any event we applied before */
+	nodeState->eventId = 0;
 
-	switch (group)
+	/* we don't expect any of the column to be NULL */
+	for (colNumber = 0; colNumber < 16; colNumber++)
 	{
-		case -1:
+		if (PQgetisnull(result, rowNumber, 0))
 		{
-			sql =
-				"SELECT eventTime, nodeid, groupid, "
-				"       reportedstate, goalState, description "
-				"  FROM pgautofailover.last_events($1, count => $2)";
-
-			countStr = intToString(count);
-
-			paramCount = 2;
-			paramTypes[0] = TEXTOID;
-			paramValues[0] = formation;
-			paramTypes[1] = INT4OID;
-			paramValues[1] = countStr.strValue;
-
-			break;
+			log_error("column %d in row %d returned by the monitor is NULL",
+					  colNumber, rowNumber);
+			return false;
 		}
+	}
 
-		default:
-		{
-			sql =
-				"SELECT eventTime, nodeid, groupid, "
-				"       reportedstate, goalState, description "
-				"  FROM pgautofailover.last_events($1,$2,$3)";
-
-			countStr = intToString(count);
-			groupStr = intToString(group);
+	/*
+	 *  0 - OUT formation_kind       text,
+	 *  1 - OUT nodename             text,
+	 *  2 - OUT nodehost             text,
+	 *  3 - OUT nodeport             int,
+	 *  4 - OUT group_id             int,
+	 *  5 - OUT node_id              bigint,
+	 *  6 - OUT current_group_state  pgautofailover.replication_state,
+	 *  7 - OUT assigned_group_state pgautofailover.replication_state,
+	 *  8 - OUT candidate_priority	 int,
+	 *  9 - OUT replication_quorum	 bool,
+	 * 10 - OUT reported_tli         int,
+	 * 11 - OUT reported_lsn         pg_lsn,
+	 * 12 - OUT health               integer
+	 * 13 - OUT nodecluster          text
+	 * 14 -     healthlag            int (extract epoch from interval)
+	 * 15 -     reportlag            int (extract epoch from interval)
+	 *
+	 * We need the groupId to parse the formation kind into a nodeKind, so we
+	 * begin at column 1 and get back to column 0 later, after column 4.
+	 */
+	char *value = PQgetvalue(result, rowNumber, 1);
+	int length = strlcpy(nodeState->node.name, value, _POSIX_HOST_NAME_MAX);
+	if (length >= _POSIX_HOST_NAME_MAX)
+	{
+		log_error("Node name \"%s\" returned by monitor is %d characters, "
+				  "the maximum supported by pg_autoctl is %d",
+				  value, length, _POSIX_HOST_NAME_MAX - 1);
+		++errors;
+	}
 
-			paramCount = 3;
-			paramTypes[0] = TEXTOID;
-			paramValues[0] = formation;
-			paramTypes[1] = INT4OID;
-			paramValues[1] = groupStr.strValue;
-			paramTypes[2] = INT4OID;
-			paramValues[2] = countStr.strValue;
+	value = PQgetvalue(result, rowNumber, 2);
 
-			break;
-		}
+	length = strlcpy(nodeState->node.host, value, _POSIX_HOST_NAME_MAX);
+	if (length >= _POSIX_HOST_NAME_MAX)
+	{
+		log_error("Hostname \"%s\" returned by monitor is %d characters, "
+				  "the maximum supported by pg_autoctl is %d",
+				  value, length, _POSIX_HOST_NAME_MAX - 1);
+		++errors;
 	}
 
-	if (!pgsql_execute_with_params(pgsql, sql,
-								   paramCount, paramTypes, paramValues,
-								   &context, &printLastEvents))
+	value = PQgetvalue(result, rowNumber, 3);
+
+	if (!stringToInt(value, &(nodeState->node.port)) ||
+		nodeState->node.port == 0)
 	{
-		log_error("Failed to retrieve last events from the monitor");
-		return false;
+		log_error("Invalid port number \"%s\" returned by monitor", value);
+		++errors;
 	}
 
-	if (!context.parsedOK)
+	value = PQgetvalue(result, rowNumber, 4);
+	if (!stringToInt(value, &(nodeState->groupId)))
 	{
-		return false;
+		log_error("Invalid groupId \"%s\" returned by monitor", value);
+		++errors;
 	}
 
-	return true;
-}
+	/* we need the groupId to parse the formation kind into a nodeKind */
+	value = PQgetvalue(result, rowNumber, 0);
 
+	if (strcmp(value, "pgsql") == 0 && nodeState->groupId == 0)
+	{
+		nodeState->pgKind = NODE_KIND_STANDALONE;
+	}
+	else if (strcmp(value, "citus") == 0 && nodeState->groupId == 0)
+	{
+		nodeState->pgKind = NODE_KIND_CITUS_COORDINATOR;
+	}
+	else if (strcmp(value, "citus") == 0 && nodeState->groupId > 0)
+	{
+		nodeState->pgKind = NODE_KIND_CITUS_WORKER;
+	}
+	else
+	{
+		log_error("Invalid groupId %d with formation kind \"%s\"",
+				  nodeState->groupId, value);
+		++errors;
+	}
 
-/*
- * monitor_print_last_events_as_json calls the function
- * pgautofailover.last_events on the monitor, and prints the result as a JSON
- * array to the given stream (stdout, typically).
- */
-bool
-monitor_print_last_events_as_json(Monitor *monitor,
-								  char *formation, int group,
-								  int count,
-								  FILE *stream)
-{
-	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_STRING, false };
-	PGSQL *pgsql = &monitor->pgsql;
-	char *sql = NULL;
-	int paramCount = 0;
-	Oid paramTypes[3];
-	const char *paramValues[3];
-	IntString countStr;
-	IntString groupStr;
+	value = PQgetvalue(result, rowNumber, 5);
+	if (!stringToInt64(value, &(nodeState->node.nodeId)))
+	{
+		log_error("Invalid nodeId \"%s\" returned by monitor", value);
+		++errors;
+	}
 
-	switch (group)
+	value = PQgetvalue(result, rowNumber, 6);
+	nodeState->reportedState = NodeStateFromString(value);
+	if (nodeState->reportedState == NO_STATE)
 	{
-		case -1:
-		{
-			sql = "SELECT jsonb_pretty("
-				  "coalesce(jsonb_agg(row_to_json(event)), '[]'))"
-				  " FROM pgautofailover.last_events($1, count => $2) as event";
+		log_error("Invalid node state \"%s\" returned by monitor", value);
+		++errors;
+	}
 
-			countStr = intToString(count);
+	value = PQgetvalue(result, rowNumber, 7);
+	nodeState->goalState = NodeStateFromString(value);
+	if (nodeState->goalState == NO_STATE)
+	{
+		log_error("Invalid node state \"%s\" returned by monitor", value);
+		++errors;
+	}
 
-			paramCount = 2;
-			paramTypes[0] = TEXTOID;
-			paramValues[0] = formation;
-			paramTypes[1] = INT4OID;
-			paramValues[1] = countStr.strValue;
-
-			break;
-		}
+	value = PQgetvalue(result, rowNumber, 8);
+	if (!stringToInt(value, &(nodeState->candidatePriority)))
+	{
+		log_error("Invalid failover candidate priority \"%s\" "
+				  "returned by monitor", value);
+		++errors;
+	}
 
-		default:
-		{
-			sql = "SELECT jsonb_pretty("
-				  "coalesce(jsonb_agg(row_to_json(event)), '[]'))"
-				  " FROM * FROM pgautofailover.last_events($1,$2,$3) as event";
+	value = PQgetvalue(result, rowNumber, 9);
+	if (value == NULL || ((*value != 't') && (*value != 'f')))
+	{
+		log_error("Invalid replication quorum \"%s\" "
+				  "returned by monitor", value);
+		++errors;
+	}
+	else
+	{
+		nodeState->replicationQuorum = (*value) == 't';
+	}
 
-			countStr = intToString(count);
-			groupStr = intToString(group);
+	value = PQgetvalue(result, rowNumber, 10);
+	if (!stringToInt(value, &(nodeState->node.tli)))
+	{
+		log_error("Invalid timeline \"%s\" returned by monitor", value);
+		++errors;
+	}
 
-			paramCount = 3;
-			paramTypes[0] = TEXTOID;
-			paramValues[0] = formation;
-			paramTypes[1] = INT4OID;
-			paramValues[1] = groupStr.strValue;
-			paramTypes[2] = INT4OID;
-			paramValues[2] = countStr.strValue;
+	/* we trust Postgres pg_lsn data type to fit in our PG_LSN_MAXLENGTH */
+	value = PQgetvalue(result, rowNumber, 11);
+	strlcpy(nodeState->node.lsn, value, PG_LSN_MAXLENGTH);
 
-			break;
-		}
+	value = PQgetvalue(result, rowNumber, 12);
+	if (!stringToInt(value, &(nodeState->health)))
+	{
+		log_error("Invalid node health \"%s\" returned by monitor", value);
+		++errors;
 	}
 
-	if (!pgsql_execute_with_params(pgsql, sql,
-								   paramCount, paramTypes, paramValues,
-								   &context, &parseSingleValueResult))
+	value = PQgetvalue(result, rowNumber, 13);
+	length = strlcpy(nodeState->citusClusterName, value, NAMEDATALEN);
+	if (length >= NAMEDATALEN)
 	{
-		log_error("Failed to retrieve the last %d events from the monitor",
-				  count);
-		return false;
+		log_error("Cluster name \"%s\" returned by monitor is %d characters, "
+				  "the maximum supported by pg_autoctl is %d",
+				  value, length, NAMEDATALEN - 1);
+		++errors;
 	}
 
-	if (!context.parsedOk)
+	value = PQgetvalue(result, rowNumber, 14);
+
+	if (!stringToDouble(value, &(nodeState->healthLag)))
 	{
-		log_error("Failed to parse %d last events from the monitor", count);
-		log_error("%s", context.strVal);
-		if (context.strVal)
-		{
-			free(context.strVal);
-		}
-		return false;
+		log_error("Invalid health lag \"%s\" returned by monitor", value);
+		++errors;
 	}
 
-	fformat(stream, "%s\n", context.strVal);
-	free(context.strVal);
+	value = PQgetvalue(result, rowNumber, 15);
 
-	return true;
+	if (!stringToDouble(value, &(nodeState->reportLag)))
+	{
+		log_error("Invalid report lag \"%s\" returned by monitor", value);
+		++errors;
+	}
+
+	return errors == 0;
 }
 
 
 /*
- * printLastEcvents loops over pgautofailover.last_events() results and prints
- * them, one per line.
+ * parseCurrentNodeStateArray parses an array of nodeStates, one entry per
+ * node in a given formation.
  */
-static void
-printLastEvents(void *ctx, PGresult *result)
+static bool
+parseCurrentNodeStateArray(CurrentNodeStateArray *nodesArray, PGresult *result)
 {
-	MonitorAssignedStateParseContext *context =
-		(MonitorAssignedStateParseContext *) ctx;
-	int currentTupleIndex = 0;
-	int nTuples = PQntuples(result);
+	bool parsedOk = true;
+	int rowNumber = 0;
 
-	log_trace("printLastEvents: %d tuples", nTuples);
+	log_trace("parseCurrentNodeStateArray: %d", PQntuples(result));
 
-	if (PQnfields(result) != 6)
+	/* pgautofailover.current_state returns 11 columns */
+	if (PQnfields(result) != 16)
 	{
-		log_error("Query returned %d columns, expected 6", PQnfields(result));
-		context->parsedOK = false;
-		return;
+		log_error("Query returned %d columns, expected 16", PQnfields(result));
+		return false;
 	}
 
-	fformat(stdout, "%30s | %6s | %19s | %19s | %s\n",
-			"Event Time", "Node",
-			"Current State", "Assigned State", "Comment");
-	fformat(stdout, "%30s-+-%6s-+-%19s-+-%19s-+-%10s\n",
-			"------------------------------",
-			"------", "-------------------",
-			"-------------------", "----------");
+	if (!currentNodeStateArrayReserve(nodesArray, PQntuples(result)))
+	{
+		/* errors have already been logged */
+		return false;
+	}
 
-	for (currentTupleIndex = 0; currentTupleIndex < nTuples; currentTupleIndex++)
+	nodesArray->count = PQntuples(result);
+
+	for (rowNumber = 0; rowNumber < PQntuples(result); rowNumber++)
 	{
-		char *eventTime = PQgetvalue(result, currentTupleIndex, 0);
-		char *nodeId = PQgetvalue(result, currentTupleIndex, 1);
-		char *groupId = PQgetvalue(result, currentTupleIndex, 2);
-		char *currentState = PQgetvalue(result, currentTupleIndex, 3);
-		char *goalState = PQgetvalue(result, currentTupleIndex, 4);
-		char *description = PQgetvalue(result, currentTupleIndex, 5);
-		char node[BUFSIZE];
+		CurrentNodeState *nodeState = &(nodesArray->nodes[rowNumber]);
 
-		/* for our grid alignment output it's best to have a single col here */
-		sformat(node, BUFSIZE, "%s/%s", groupId, nodeId);
+		parsedOk = parsedOk &&
+				   parseCurrentNodeState(result, rowNumber, nodeState);
+	}
 
-		fformat(stdout, "%30s | %6s | %19s | %19s | %s\n",
-				eventTime, node,
-				currentState, goalState, description);
+	return parsedOk;
+}
+
+
+/*
+ * monitor_parse_current_state_result parses a result that has the columns of
+ * pgautofailover.current_state into the given nodesArray.
+ */
+bool
+monitor_parse_current_state_result(PGresult *result,
+								   CurrentNodeStateArray *nodesArray)
+{
+	return parseCurrentNodeStateArray(nodesArray, result);
+}
+
+
+/*
+ * getCurrentState loops over pgautofailover.current_state() results and adds
+ * them to the context's nodes array.
+ */
+static void
+getCurrentState(void *ctx, PGresult *result)
+{
+	CurrentNodeStateContext *context = (CurrentNodeStateContext *) ctx;
+	CurrentNodeStateArray *nodesArray = context->nodesArray;
+
+	if (!parseCurrentNodeStateArray(nodesArray, result))
+	{
+		/* errors have already been logged */
+		context->parsedOK = false;
+		return;
 	}
-	fformat(stdout, "\n");
 
 	context->parsedOK = true;
 }
 
 
 /*
- * monitor_get_last_events calls the function pgautofailover.last_events on
- * the monitor, and fills-in the given array of MonitorEvents.
+ * monitor_print_state_as_json prints to given stream a single string that
+ * contains the JSON representation of the current state on the monitor.
  */
 bool
-monitor_get_last_events(Monitor *monitor, char *formation, int group, int count,
-						MonitorEventsArray *monitorEventsArray)
+monitor_print_state_as_json(Monitor *monitor, char *formation, int group)
 {
-	MonitorEventsArrayParseContext context =
-	{ { 0 }, monitorEventsArray, false };
-
-	PGSQL *pgsql = &monitor->pgsql;
+	MonitorJSONResultContext context = { { 0 }, stdout, false };
+	PGSQL *pgsql = monitor_read_client(monitor);
 	char *sql = NULL;
 	int paramCount = 0;
-	Oid paramTypes[3];
-	const char *paramValues[3];
-	IntString countStr;
+	Oid paramTypes[2];
+	const char *paramValues[2];
 	IntString groupStr;
 
-	log_trace("monitor_print_last_events(%s, %d, %d)", formation, group, count);
+	log_trace("monitor_get_state_as_json(%s, %d)", formation, group);
 
 	switch (group)
 	{
 		case -1:
 		{
-			sql =
-				"SELECT eventId, to_char(eventTime, 'YYYY-MM-DD HH24:MI:SS'), "
-				"       formationId, nodeid, groupid, "
-				"       nodename, nodehost, nodeport, "
-				"       reportedstate, goalState, "
-				"       reportedrepstate, reportedtli, reportedlsn, "
-				"       candidatepriority, replicationquorum, "
-				"       description "
-				"  FROM pgautofailover.last_events($1, count => $2)";
-
-			countStr = intToString(count);
+			sql = "SELECT * FROM pgautofailover.current_state($1)";
 
-			paramCount = 2;
+			paramCount = 1;
 			paramTypes[0] = TEXTOID;
 			paramValues[0] = formation;
-			paramTypes[1] = INT4OID;
-			paramValues[1] = countStr.strValue;
 
 			break;
 		}
 
 		default:
 		{
-			sql =
-				"SELECT eventId, to_char(eventTime, 'YYYY-MM-DD HH24:MI:SS'), "
-				"       formationId, nodeid, groupid, "
-				"       reportedstate, goalState, "
-				"       reportedrepstate, reportedtli, reportedlsn, "
-				"       candidatepriority, replicationquorum, "
-				"       description "
-				"  FROM pgautofailover.last_events($1,$2,$3)";
+			sql = "SELECT * FROM pgautofailover.current_state($1,$2)";
 
-			countStr = intToString(count);
 			groupStr = intToString(group);
 
-			paramCount = 3;
+			paramCount = 2;
 			paramTypes[0] = TEXTOID;
 			paramValues[0] = formation;
 			paramTypes[1] = INT4OID;
 			paramValues[1] = groupStr.strValue;
-			paramTypes[2] = INT4OID;
-			paramValues[2] = countStr.strValue;
 
 			break;
 		}
@@ -2548,16 +3641,15 @@ monitor_get_last_events(Monitor *monitor, char *formation, int group, int count,
 
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
-								   &context, &getLastEvents))
+								   &context, &printResultAsJSON))
 	{
-		log_error("Failed to retrieve last events from the monitor");
+		log_error("Failed to retrieve current state from the monitor");
 		return false;
 	}
 
 	if (!context.parsedOK)
 	{
-		log_error("Failed to parse last events from the monitor, "
-				  "see above for details");
+		log_error("Failed to parse current state from the monitor");
 		return false;
 	}
 
@@ -2566,192 +3658,455 @@ monitor_get_last_events(Monitor *monitor, char *formation, int group, int count,
 
 
 /*
- * getLastEvents loops over pgautofailover.last_events() results and fills in
- * the given MonitorEventsArray.
+ * monitor_get_formation_names fetches the list of formations registered on
+ * the monitor, in alphabetical order.
  */
-static void
-getLastEvents(void *ctx, PGresult *result)
+bool
+monitor_get_formation_names(Monitor *monitor,
+							FormationNamesArray *formationsArray)
 {
-	MonitorEventsArrayParseContext *context =
-		(MonitorEventsArrayParseContext *) ctx;
+	FormationNamesParseContext context = { { 0 }, formationsArray, false };
+	PGSQL *pgsql = monitor_read_client(monitor);
+	const char *sql =
+		"SELECT formationid FROM pgautofailover.formation ORDER BY formationid";
 
-	MonitorEventsArray *eventsArray = context->eventsArray;
+	if (!pgsql_execute_with_params(pgsql, sql, 0, NULL, NULL,
+								   &context, &parseFormationNames))
+	{
+		log_error("Failed to list formations from the monitor");
+		return false;
+	}
 
-	int currentTupleIndex = 0;
-	int nTuples = PQntuples(result);
+	if (!context.parsedOK)
+	{
+		log_error("Failed to parse the list of formations from the monitor");
+		return false;
+	}
 
-	int errors = 0;
+	return true;
+}
 
-	log_trace("getLastEvents: %d tuples", nTuples);
 
-	if (nTuples > EVENTS_ARRAY_MAX_COUNT)
+/*
+ * parseFormationNames parses the formationid column of a query result into a
+ * FormationNamesArray.
+ */
+static void
+parseFormationNames(void *ctx, PGresult *result)
+{
+	FormationNamesParseContext *context = (FormationNamesParseContext *) ctx;
+	int nTuples = PQntuples(result);
+
+	if (PQnfields(result) != 1)
 	{
-		log_error("Query returned %d rows, pg_auto_failover supports only up "
-				  "to %d events at the moment",
-				  PQntuples(result), EVENTS_ARRAY_MAX_COUNT);
+		log_error("Query returned %d columns, expected 1", PQnfields(result));
 		context->parsedOK = false;
 		return;
 	}
 
-	if (PQnfields(result) != 16)
+	if (nTuples > FORMATION_ARRAY_MAX_COUNT)
 	{
-		log_error("Query returned %d columns, expected 16", PQnfields(result));
+		log_error("Query returned %d formations, pg_autoctl only supports "
+				  "up to %d formations",
+				  nTuples, FORMATION_ARRAY_MAX_COUNT);
 		context->parsedOK = false;
 		return;
 	}
 
-	eventsArray->count = nTuples;
+	context->formationsArray->count = nTuples;
 
-	for (currentTupleIndex = 0; currentTupleIndex < nTuples; currentTupleIndex++)
+	for (int index = 0; index < nTuples; index++)
 	{
-		MonitorEvent *event = &(eventsArray->events[currentTupleIndex]);
+		strlcpy(context->formationsArray->names[index],
+				PQgetvalue(result, index, 0),
+				NAMEDATALEN);
+	}
 
-		char *value = PQgetvalue(result, currentTupleIndex, 0);
+	context->parsedOK = true;
+}
 
-		/* eventId */
-		if (!stringToInt64(value, &(event->eventId)))
-		{
-			log_error("Invalid event ID \"%s\" returned by monitor", value);
-			++errors;
-		}
 
-		/* eventTime */
-		value = PQgetvalue(result, currentTupleIndex, 1);
-		strlcpy(event->eventTime, value, sizeof(event->eventTime));
+/*
+ * monitor_print_every_formation_state prints the current state of all the
+ * formations registered on the monitor, one table per formation, using the
+ * same monitor connection for all the queries.
+ */
+bool
+monitor_print_every_formation_state(Monitor *monitor)
+{
+	FormationNamesArray formationsArray = { 0 };
 
-		/* formationId */
-		value = PQgetvalue(result, currentTupleIndex, 2);
-		strlcpy(event->formationId, value, sizeof(event->formationId));
+	if (!monitor_get_formation_names(monitor, &formationsArray))
+	{
+		/* errors have already been logged */
+		return false;
+	}
 
-		/* nodeId */
-		value = PQgetvalue(result, currentTupleIndex, 3);
+	for (int index = 0; index < formationsArray.count; index++)
+	{
+		char *formation = formationsArray.names[index];
 
-		if (!stringToInt64(value, &(event->nodeId)))
+		fformat(stdout, "Formation: %s\n\n", formation);
+
+		if (!monitor_print_state(monitor, formation, -1))
 		{
-			log_error("Invalid node ID \"%s\" returned by monitor", value);
-			++errors;
+			/* errors have already been logged */
+			return false;
 		}
+	}
 
-		/* groupId */
-		value = PQgetvalue(result, currentTupleIndex, 4);
+	return true;
+}
 
-		if (!stringToInt(value, &(event->groupId)))
-		{
-			log_error("Invalid group ID \"%s\" returned by monitor", value);
-			++errors;
-		}
 
-		/* nodeName */
-		value = PQgetvalue(result, currentTupleIndex, 5);
-		strlcpy(event->nodeName, value, sizeof(event->nodeName));
+/*
+ * monitor_print_every_formation_state_as_json prints the current state of all
+ * the formations registered on the monitor as a single JSON array, obtained
+ * from a single query.
+ */
+bool
+monitor_print_every_formation_state_as_json(Monitor *monitor)
+{
+	MonitorJSONResultContext context = { { 0 }, stdout, false };
+	PGSQL *pgsql = monitor_read_client(monitor);
+	const char *sql =
+		"  SELECT f.formationid as formation, cs.* "
+		"    FROM pgautofailover.formation f, "
+		"         pgautofailover.current_state(f.formationid) cs "
+		"ORDER BY f.formationid, cs.group_id, cs.node_id";
 
-		/* nodeHost */
-		value = PQgetvalue(result, currentTupleIndex, 6);
-		strlcpy(event->nodeHost, value, sizeof(event->nodeHost));
+	if (!pgsql_execute_with_params(pgsql, sql, 0, NULL, NULL,
+								   &context, &printResultAsJSON))
+	{
+		log_error("Failed to retrieve current state from the monitor");
+		return false;
+	}
 
-		/* nodePort */
-		value = PQgetvalue(result, currentTupleIndex, 7);
+	if (!context.parsedOK)
+	{
+		log_error("Failed to parse current state from the monitor");
+		return false;
+	}
 
-		if (!stringToInt(value, &(event->nodePort)))
-		{
-			log_error("Invalid group ID \"%s\" returned by monitor", value);
-			++errors;
-		}
+	return true;
+}
 
-		/* reportedState */
-		value = PQgetvalue(result, currentTupleIndex, 8);
 
-		event->reportedState = NodeStateFromString(value);
-		if (event->reportedState == NO_STATE)
-		{
-			log_error("Invalid node state \"%s\" returned by monitor", value);
-			++errors;
-		}
+/*
+ * monitor_print_last_events calls the function pgautofailover.last_events on
+ * the monitor, and prints a line of output per event obtained. When eventType
+ * is not NULL, only the events of that type are printed.
+ */
+bool
+monitor_print_last_events(Monitor *monitor, char *formation, int group,
+						  char *eventType, int count)
+{
+	MonitorAssignedStateParseContext context = { 0 };
+	PGSQL *pgsql = monitor_read_client(monitor);
+	char *sql = NULL;
+	int paramCount = 0;
+	Oid paramTypes[4];
+	const char *paramValues[4];
+	IntString countStr;
+	IntString groupStr;
 
-		/* assignedState */
-		value = PQgetvalue(result, currentTupleIndex, 9);
+	log_trace("monitor_print_last_events(%s, %d, %s, %d)",
+			  formation, group, eventType ? eventType : "", count);
 
-		event->assignedState = NodeStateFromString(value);
-		if (event->assignedState == NO_STATE)
+	if (eventType != NULL)
+	{
+		sql =
+			"SELECT eventTime, nodeid, groupid, "
+			"       reportedstate, goalState, description "
+			"  FROM pgautofailover.last_events_of_type($1, $2, $3, $4)";
+
+		countStr = intToString(count);
+		groupStr = intToString(group);
+
+		paramCount = 4;
+		paramTypes[0] = TEXTOID;
+		paramValues[0] = formation;
+		paramTypes[1] = TEXTOID;
+		paramValues[1] = eventType;
+		paramTypes[2] = INT4OID;
+		paramValues[2] = group == -1 ? NULL : groupStr.strValue;
+		paramTypes[3] = INT4OID;
+		paramValues[3] = countStr.strValue;
+	}
+	else
+	{
+		switch (group)
 		{
-			log_error("Invalid node state \"%s\" returned by monitor", value);
-			++errors;
+			case -1:
+			{
+				sql =
+					"SELECT eventTime, nodeid, groupid, "
+					"       reportedstate, goalState, description "
+					"  FROM pgautofailover.last_events($1, count => $2)";
+
+				countStr = intToString(count);
+
+				paramCount = 2;
+				paramTypes[0] = TEXTOID;
+				paramValues[0] = formation;
+				paramTypes[1] = INT4OID;
+				paramValues[1] = countStr.strValue;
+
+				break;
+			}
+
+			default:
+			{
+				sql =
+					"SELECT eventTime, nodeid, groupid, "
+					"       reportedstate, goalState, description "
+					"  FROM pgautofailover.last_events($1,$2,$3)";
+
+				countStr = intToString(count);
+				groupStr = intToString(group);
+
+				paramCount = 3;
+				paramTypes[0] = TEXTOID;
+				paramValues[0] = formation;
+				paramTypes[1] = INT4OID;
+				paramValues[1] = groupStr.strValue;
+				paramTypes[2] = INT4OID;
+				paramValues[2] = countStr.strValue;
+
+				break;
+			}
 		}
+	}
 
-		/* repolicationState */
-		value = PQgetvalue(result, currentTupleIndex, 10);
-		strlcpy(event->replicationState, value, sizeof(event->replicationState));
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &printLastEvents))
+	{
+		log_error("Failed to retrieve last events from the monitor");
+		return false;
+	}
 
-		/* timeline */
-		value = PQgetvalue(result, currentTupleIndex, 11);
+	if (!context.parsedOK)
+	{
+		return false;
+	}
 
-		if (!stringToInt(value, &(event->timeline)))
+	return true;
+}
+
+
+/*
+ * monitor_print_last_events_as_json calls the function
+ * pgautofailover.last_events on the monitor, and prints the result as a JSON
+ * array to the given stream (stdout, typically).
+ */
+bool
+monitor_print_last_events_as_json(Monitor *monitor,
+								  char *formation, int group,
+								  char *eventType, int count,
+								  FILE *stream)
+{
+	MonitorJSONResultContext context = { { 0 }, stream, false };
+	PGSQL *pgsql = monitor_read_client(monitor);
+	char *sql = NULL;
+	int paramCount = 0;
+	Oid paramTypes[4];
+	const char *paramValues[4];
+	IntString countStr;
+	IntString groupStr;
+
+	if (eventType != NULL)
+	{
+		sql = "SELECT * "
+			  "  FROM pgautofailover.last_events_of_type($1, $2, $3, $4)";
+
+		countStr = intToString(count);
+		groupStr = intToString(group);
+
+		paramCount = 4;
+		paramTypes[0] = TEXTOID;
+		paramValues[0] = formation;
+		paramTypes[1] = TEXTOID;
+		paramValues[1] = eventType;
+		paramTypes[2] = INT4OID;
+		paramValues[2] = group == -1 ? NULL : groupStr.strValue;
+		paramTypes[3] = INT4OID;
+		paramValues[3] = countStr.strValue;
+	}
+	else
+	{
+		switch (group)
 		{
-			log_error("Invalid timeline \"%s\" returned by monitor", value);
-			++errors;
+			case -1:
+			{
+				sql = "SELECT * FROM pgautofailover.last_events($1, count => $2)";
+
+				countStr = intToString(count);
+
+				paramCount = 2;
+				paramTypes[0] = TEXTOID;
+				paramValues[0] = formation;
+				paramTypes[1] = INT4OID;
+				paramValues[1] = countStr.strValue;
+
+				break;
+			}
+
+			default:
+			{
+				sql = "SELECT * FROM pgautofailover.last_events($1,$2,$3)";
+
+				countStr = intToString(count);
+				groupStr = intToString(group);
+
+				paramCount = 3;
+				paramTypes[0] = TEXTOID;
+				paramValues[0] = formation;
+				paramTypes[1] = INT4OID;
+				paramValues[1] = groupStr.strValue;
+				paramTypes[2] = INT4OID;
+				paramValues[2] = countStr.strValue;
+
+				break;
+			}
 		}
+	}
 
-		/* LSN */
-		value = PQgetvalue(result, currentTupleIndex, 12);
-		strlcpy(event->lsn, value, PG_LSN_MAXLENGTH);
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &printResultAsJSON))
+	{
+		log_error("Failed to retrieve the last %d events from the monitor",
+				  count);
+		return false;
+	}
 
-		/* candidatePriority */
-		value = PQgetvalue(result, currentTupleIndex, 13);
+	if (!context.parsedOK)
+	{
+		log_error("Failed to parse %d last events from the monitor", count);
+		return false;
+	}
 
-		if (!stringToInt(value, &(event->candidatePriority)))
+	return true;
+}
+
+
+/*
+ * monitor_stream_events prints the events of the given formation and group
+ * (all groups when group is -1) that are more recent than *lastEventId, and
+ * not older than sinceTime when given. Events are fetched from the monitor
+ * function pgautofailover.events_since() in pages of EVENTS_STREAM_PAGE_SIZE
+ * rows using the event id as the key, and each page is printed before the
+ * next one is fetched, so that exporting the whole history of a formation
+ * only ever holds a single page in memory, here and on the monitor.
+ *
+ * When outputJSON is true, events are printed as a JSON object per line
+ * rather than as a JSON array, for the same reason.
+ *
+ * On return, *lastEventId is the id of the last event printed, so that the
+ * caller may call us again later to print only newer events.
+ */
+bool
+monitor_stream_events(Monitor *monitor, char *formation, int group,
+					  const char *sinceTime, bool outputJSON,
+					  int64_t *lastEventId)
+{
+	/*
+	 * Only the primary monitor knows which events are still to show up with
+	 * a smaller event id, see pgautofailover.event_watermark().
+	 */
+	PGSQL *pgsql = &(monitor->pgsql);
+	const char *sql =
+		"SELECT eventid, eventtime, nodeid, groupid, "
+		"       reportedstate, goalstate, description, "
+		"       row_to_json(event)::text "
+		"  FROM pgautofailover.events_since($1, $2, $3, $4::timestamptz, $5) "
+		"       AS event";
+
+	IntString groupStr = intToString(group);
+	IntString countStr = intToString(EVENTS_STREAM_PAGE_SIZE);
+
+	log_trace("monitor_stream_events(%s, %d, %s, %lld)",
+			  formation, group,
+			  IS_EMPTY_STRING_BUFFER(sinceTime) ? "" : sinceTime,
+			  (long long) *lastEventId);
+
+	/* re-use the same connection for all the pages */
+	pgsql->connectionStatementType = PGSQL_CONNECTION_MULTI_STATEMENT;
+
+	for (;;)
+	{
+		MonitorEventsStreamContext context = { 0 };
+		IntString eventIdStr = intToString(*lastEventId);
+
+		int paramCount = 5;
+		Oid paramTypes[5] = { TEXTOID, INT4OID, INT8OID, TEXTOID, INT4OID };
+		const char *paramValues[5] = {
+			formation,
+			group == -1 ? NULL : groupStr.strValue,
+			eventIdStr.strValue,
+			IS_EMPTY_STRING_BUFFER(sinceTime) ? NULL : sinceTime,
+			countStr.strValue
+		};
+
+		context.outputJSON = outputJSON;
+		context.lastEventId = *lastEventId;
+
+		if (!pgsql_execute_with_params(pgsql, sql,
+									   paramCount, paramTypes, paramValues,
+									   &context, &printEventsPage))
 		{
-			log_error("Invalid candidate priority \"%s\" returned by monitor", value);
-			++errors;
+			log_error("Failed to retrieve events from the monitor");
+			pgsql_finish(pgsql);
+			return false;
 		}
 
-		/* replicationQuorum */
-		value = PQgetvalue(result, currentTupleIndex, 14);
-		event->replicationQuorum = strcmp(value, "t") == 0;
+		if (!context.parsedOK)
+		{
+			/* errors have already been logged */
+			pgsql_finish(pgsql);
+			return false;
+		}
 
-		/* description */
-		value = PQgetvalue(result, currentTupleIndex, 15);
-		strlcpy(event->description, value, sizeof(event->description));
+		*lastEventId = context.lastEventId;
 
-		if (errors > 0)
+		/* let pipes and files get the events as soon as we have them */
+		fflush(stdout);
+
+		if (context.rowCount < EVENTS_STREAM_PAGE_SIZE)
 		{
-			context->parsedOK = false;
-			return;
+			break;
 		}
 	}
 
-	context->parsedOK = true;
+	pgsql_finish(pgsql);
+
+	return true;
 }
 
 
 /*
- * monitor_create_formation calls the SQL API on the monitor to create a new
- * formation of the given kind.
+ * monitor_create_event_stream creates the logical replication slot slotName
+ * that streams the monitor events, unless it exists already. The monitor
+ * must be running with wal_level = logical.
  */
 bool
-monitor_create_formation(Monitor *monitor,
-						 char *formation, char *kind, char *dbname,
-						 bool hasSecondary, int numberSyncStandbys)
+monitor_create_event_stream(Monitor *monitor, const char *slotName)
 {
 	PGSQL *pgsql = &monitor->pgsql;
-	const char *sql =
-		"SELECT * FROM pgautofailover.create_formation($1, $2, $3, $4, $5)";
-	int paramCount = 5;
-	Oid paramTypes[5] = { TEXTOID, TEXTOID, TEXTOID, BOOLOID, INT4OID };
-	const char *paramValues[5];
+	const char *sql = "SELECT pgautofailover.create_event_stream($1)";
 
-	paramValues[0] = formation;
-	paramValues[1] = kind;
-	paramValues[2] = dbname;
-	paramValues[3] = hasSecondary ? "true" : "false";
-	paramValues[4] = intToString(numberSyncStandbys).strValue;
+	int paramCount = 1;
+	Oid paramTypes[1] = { NAMEOID };
+	const char *paramValues[1] = { slotName };
 
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
 								   NULL, NULL))
 	{
-		log_error("Failed to create formation \"%s\" of kind \"%s\", "
-				  "see previous lines for details.",
-				  formation, kind);
+		log_error("Failed to create the event stream replication slot \"%s\" "
+				  "on the monitor, see above for details",
+				  slotName);
 		return false;
 	}
 
@@ -2760,62 +4115,1339 @@ monitor_create_formation(Monitor *monitor,
 
 
 /*
- * monitor_enable_secondary_for_formation enables secondaries for the given
- * formation
+ * monitor_drop_event_stream drops the logical replication slot slotName that
+ * streams the monitor events.
  */
 bool
-monitor_enable_secondary_for_formation(Monitor *monitor, const char *formation)
+monitor_drop_event_stream(Monitor *monitor, const char *slotName)
 {
 	PGSQL *pgsql = &monitor->pgsql;
-	const char *sql = "SELECT * FROM pgautofailover.enable_secondary($1)";
+	const char *sql = "SELECT pgautofailover.drop_event_stream($1)";
+
 	int paramCount = 1;
-	Oid paramTypes[1] = { TEXTOID };
-	const char *paramValues[1];
+	Oid paramTypes[1] = { NAMEOID };
+	const char *paramValues[1] = { slotName };
 
-	paramValues[0] = formation;
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   NULL, NULL))
+	{
+		log_error("Failed to drop the event stream replication slot \"%s\" "
+				  "on the monitor, see above for details",
+				  slotName);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * monitor_stream_slot_events prints the events of the replication slot
+ * slotName that have not been acknowledged yet, as a JSON object per line, in
+ * pages of EVENTS_STREAM_PAGE_SIZE changes. Once a page has been printed and
+ * flushed, we acknowledge its events on the monitor, so that the next call
+ * only prints the events committed since then.
+ *
+ * When we fail in between printing a page and acknowledging it, the same
+ * events are printed again next time: consumers can skip the events which
+ * eventid they have already processed.
+ */
+bool
+monitor_stream_slot_events(Monitor *monitor, const char *slotName,
+						   int *eventCount)
+{
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql =
+		"SELECT lsn, event IS NULL, "
+		"       json_build_object('lsn', lsn, 'xid', xid, 'event', event)"
+		"::text "
+		"  FROM pgautofailover.read_event_stream($1, $2)";
+
+	const char *ackSQL = "SELECT pgautofailover.ack_event_stream($1, $2)";
+
+	IntString countStr = intToString(EVENTS_STREAM_PAGE_SIZE);
+
+	log_trace("monitor_stream_slot_events(%s)", slotName);
+
+	*eventCount = 0;
+
+	/* re-use the same connection for all the pages */
+	pgsql->connectionStatementType = PGSQL_CONNECTION_MULTI_STATEMENT;
+
+	for (;;)
+	{
+		MonitorEventSlotContext context = { 0 };
+
+		int paramCount = 2;
+		Oid paramTypes[2] = { NAMEOID, INT4OID };
+		const char *paramValues[2] = { slotName, countStr.strValue };
+
+		if (!pgsql_execute_with_params(pgsql, sql,
+									   paramCount, paramTypes, paramValues,
+									   &context, &printEventSlotPage))
+		{
+			log_error("Failed to read events from the replication slot \"%s\" "
+					  "on the monitor",
+					  slotName);
+			pgsql_finish(pgsql);
+			return false;
+		}
+
+		if (!context.parsedOK)
+		{
+			/* errors have already been logged */
+			pgsql_finish(pgsql);
+			return false;
+		}
+
+		*eventCount += context.eventCount;
+
+		/* the events must have reached our consumer before we ack them */
+		if (fflush(stdout) != 0)
+		{
+			log_error("Failed to write events: %m");
+			pgsql_finish(pgsql);
+			return false;
+		}
+
+		if (!IS_EMPTY_STRING_BUFFER(context.ackLSN))
+		{
+			Oid ackTypes[2] = { NAMEOID, LSNOID };
+			const char *ackValues[2] = { slotName, context.ackLSN };
+
+			if (!pgsql_execute_with_params(pgsql, ackSQL,
+										   2, ackTypes, ackValues,
+										   NULL, NULL))
+			{
+				log_error("Failed to acknowledge events up to %s on the "
+						  "replication slot \"%s\"",
+						  context.ackLSN, slotName);
+				pgsql_finish(pgsql);
+				return false;
+			}
+		}
+
+		if (context.rowCount < EVENTS_STREAM_PAGE_SIZE)
+		{
+			break;
+		}
+	}
+
+	pgsql_finish(pgsql);
+
+	return true;
+}
+
+
+/*
+ * monitor_print_last_failovers calls the function
+ * pgautofailover.last_failovers on the monitor, and prints a line of output
+ * per failover phase obtained.
+ */
+bool
+monitor_print_last_failovers(Monitor *monitor, char *formation, int count)
+{
+	MonitorAssignedStateParseContext context = { 0 };
+	PGSQL *pgsql = monitor_read_client(monitor);
+	const char *sql =
+		"SELECT failover_id, group_id, node_id, phase, start_time, "
+		"       round(extract(epoch from duration) * 1000)::bigint "
+		"  FROM pgautofailover.last_failovers($1, $2)";
+	IntString countStr = intToString(count);
+
+	int paramCount = 2;
+	Oid paramTypes[2] = { TEXTOID, INT4OID };
+	const char *paramValues[2] = { formation, countStr.strValue };
+
+	log_trace("monitor_print_last_failovers(%s, %d)", formation, count);
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &printLastFailovers))
+	{
+		log_error("Failed to retrieve last failovers from the monitor");
+		return false;
+	}
+
+	if (!context.parsedOK)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * monitor_print_last_failovers_as_json calls the function
+ * pgautofailover.last_failovers on the monitor, and prints the result as a
+ * JSON array to the given stream (stdout, typically).
+ */
+bool
+monitor_print_last_failovers_as_json(Monitor *monitor,
+									 char *formation, int count,
+									 FILE *stream)
+{
+	MonitorJSONResultContext context = { { 0 }, stream, false };
+	PGSQL *pgsql = monitor_read_client(monitor);
+	const char *sql =
+		"SELECT * FROM pgautofailover.last_failovers($1, $2)";
+	IntString countStr = intToString(count);
+
+	int paramCount = 2;
+	Oid paramTypes[2] = { TEXTOID, INT4OID };
+	const char *paramValues[2] = { formation, countStr.strValue };
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &printResultAsJSON))
+	{
+		log_error("Failed to retrieve the last %d failovers from the monitor",
+				  count);
+		return false;
+	}
+
+	if (!context.parsedOK)
+	{
+		log_error("Failed to parse %d last failovers from the monitor", count);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * printLastFailovers loops over pgautofailover.last_failovers() results and
+ * prints them, one phase per line, with the duration of the phase in
+ * milliseconds. The duration of the last phase of a failover that is still
+ * in progress is unknown.
+ */
+static void
+printLastFailovers(void *ctx, PGresult *result)
+{
+	MonitorAssignedStateParseContext *context =
+		(MonitorAssignedStateParseContext *) ctx;
+	int currentTupleIndex = 0;
+	int nTuples = PQntuples(result);
+
+	log_trace("printLastFailovers: %d tuples", nTuples);
+
+	if (PQnfields(result) != 6)
+	{
+		log_error("Query returned %d columns, expected 6", PQnfields(result));
+		context->parsedOK = false;
+		return;
+	}
+
+	fformat(stdout, "%8s | %6s | %12s | %30s | %12s\n",
+			"Failover", "Node", "Phase", "Start Time", "Duration ms");
+	fformat(stdout, "%8s-+-%6s-+-%12s-+-%30s-+-%12s\n",
+			"--------", "------", "------------",
+			"------------------------------", "------------");
+
+	for (currentTupleIndex = 0; currentTupleIndex < nTuples; currentTupleIndex++)
+	{
+		char *failoverId = PQgetvalue(result, currentTupleIndex, 0);
+		char *groupId = PQgetvalue(result, currentTupleIndex, 1);
+		char *nodeId = PQgetvalue(result, currentTupleIndex, 2);
+		char *phase = PQgetvalue(result, currentTupleIndex, 3);
+		char *startTime = PQgetvalue(result, currentTupleIndex, 4);
+		char *duration =
+			PQgetisnull(result, currentTupleIndex, 5)
+			? "-"
+			: PQgetvalue(result, currentTupleIndex, 5);
+		char node[BUFSIZE];
+
+		/* for our grid alignment output it's best to have a single col here */
+		sformat(node, BUFSIZE, "%s/%s", groupId, nodeId);
+
+		fformat(stdout, "%8s | %6s | %12s | %30s | %12s\n",
+				failoverId, node, phase, startTime, duration);
+	}
+	fformat(stdout, "\n");
+
+	context->parsedOK = true;
+}
+
+
+/*
+ * printLastEcvents loops over pgautofailover.last_events() results and prints
+ * them, one per line.
+ */
+static void
+printLastEvents(void *ctx, PGresult *result)
+{
+	MonitorAssignedStateParseContext *context =
+		(MonitorAssignedStateParseContext *) ctx;
+	int currentTupleIndex = 0;
+	int nTuples = PQntuples(result);
+
+	log_trace("printLastEvents: %d tuples", nTuples);
+
+	if (PQnfields(result) != 6)
+	{
+		log_error("Query returned %d columns, expected 6", PQnfields(result));
+		context->parsedOK = false;
+		return;
+	}
+
+	(void) monitor_print_events_header();
+
+	for (currentTupleIndex = 0; currentTupleIndex < nTuples; currentTupleIndex++)
+	{
+		char *eventTime = PQgetvalue(result, currentTupleIndex, 0);
+		char *nodeId = PQgetvalue(result, currentTupleIndex, 1);
+		char *groupId = PQgetvalue(result, currentTupleIndex, 2);
+		char *currentState = PQgetvalue(result, currentTupleIndex, 3);
+		char *goalState = PQgetvalue(result, currentTupleIndex, 4);
+		char *description = PQgetvalue(result, currentTupleIndex, 5);
+		char node[BUFSIZE];
+
+		/* for our grid alignment output it's best to have a single col here */
+		sformat(node, BUFSIZE, "%s/%s", groupId, nodeId);
+
+		fformat(stdout, "%30s | %6s | %19s | %19s | %s\n",
+				eventTime, node,
+				currentState, goalState, description);
+	}
+	fformat(stdout, "\n");
+
+	context->parsedOK = true;
+}
+
+
+/*
+ * monitor_print_events_header prints the header of the events table, as used
+ * by pg_autoctl show events.
+ */
+void
+monitor_print_events_header(void)
+{
+	fformat(stdout, "%30s | %6s | %19s | %19s | %s\n",
+			"Event Time", "Node",
+			"Current State", "Assigned State", "Comment");
+	fformat(stdout, "%30s-+-%6s-+-%19s-+-%19s-+-%10s\n",
+			"------------------------------",
+			"------", "-------------------",
+			"-------------------", "----------");
+}
+
+
+/*
+ * printEventsPage prints a page of pgautofailover.events_since() results, one
+ * event per line, either in our table format or as a JSON object per line,
+ * and registers the last event id seen in the context.
+ */
+static void
+printEventsPage(void *ctx, PGresult *result)
+{
+	MonitorEventsStreamContext *context = (MonitorEventsStreamContext *) ctx;
+	int nTuples = PQntuples(result);
+
+	log_trace("printEventsPage: %d tuples", nTuples);
+
+	if (PQnfields(result) != 8)
+	{
+		log_error("Query returned %d columns, expected 8", PQnfields(result));
+		context->parsedOK = false;
+		return;
+	}
+
+	for (int rowNumber = 0; rowNumber < nTuples; rowNumber++)
+	{
+		char *eventId = PQgetvalue(result, rowNumber, 0);
+
+		if (!stringToInt64(eventId, &(context->lastEventId)))
+		{
+			log_error("Invalid event id \"%s\" returned by monitor", eventId);
+			context->parsedOK = false;
+			return;
+		}
+
+		if (context->outputJSON)
+		{
+			fformat(stdout, "%s\n", PQgetvalue(result, rowNumber, 7));
+		}
+		else
+		{
+			char *eventTime = PQgetvalue(result, rowNumber, 1);
+			char *nodeId = PQgetvalue(result, rowNumber, 2);
+			char *groupId = PQgetvalue(result, rowNumber, 3);
+			char *currentState = PQgetvalue(result, rowNumber, 4);
+			char *goalState = PQgetvalue(result, rowNumber, 5);
+			char *description = PQgetvalue(result, rowNumber, 6);
+			char node[BUFSIZE];
+
+			sformat(node, BUFSIZE, "%s/%s", groupId, nodeId);
+
+			fformat(stdout, "%30s | %6s | %19s | %19s | %s\n",
+					eventTime, node,
+					currentState, goalState, description);
+		}
+	}
+
+	context->rowCount = nTuples;
+	context->parsedOK = true;
+}
+
+
+/*
+ * printEventSlotPage prints a page of pgautofailover.read_event_stream()
+ * results, one JSON object per event, and registers the LSN of the last
+ * commit in the page, up to which the events can be acknowledged.
+ */
+static void
+printEventSlotPage(void *ctx, PGresult *result)
+{
+	MonitorEventSlotContext *context = (MonitorEventSlotContext *) ctx;
+	int nTuples = PQntuples(result);
+
+	log_trace("printEventSlotPage: %d tuples", nTuples);
+
+	if (PQnfields(result) != 3)
+	{
+		log_error("Query returned %d columns, expected 3", PQnfields(result));
+		context->parsedOK = false;
+		return;
+	}
+
+	for (int rowNumber = 0; rowNumber < nTuples; rowNumber++)
+	{
+		char *lsn = PQgetvalue(result, rowNumber, 0);
+		bool isCommit = strcmp(PQgetvalue(result, rowNumber, 1), "t") == 0;
+
+		if (isCommit)
+		{
+			strlcpy(context->ackLSN, lsn, sizeof(context->ackLSN));
+		}
+		else
+		{
+			fformat(stdout, "%s\n", PQgetvalue(result, rowNumber, 2));
+			++context->eventCount;
+		}
+	}
+
+	context->rowCount = nTuples;
+	context->parsedOK = true;
+}
+
+
+/*
+ * printResultAsJSON prints a query result as a JSON array of objects, one per
+ * row, without building the whole JSON document in memory first.
+ */
+static void
+printResultAsJSON(void *ctx, PGresult *result)
+{
+	MonitorJSONResultContext *context = (MonitorJSONResultContext *) ctx;
+
+	log_trace("printResultAsJSON: %d tuples", PQntuples(result));
+
+	(void) json_stream_print_result(context->stream, result);
+
+	context->parsedOK = true;
+}
+
+
+/*
+ * monitor_get_last_events calls the function pgautofailover.last_events on
+ * the monitor, and fills-in the given array of MonitorEvents.
+ */
+bool
+monitor_get_last_events(Monitor *monitor, char *formation, int group, int count,
+						MonitorEventsArray *monitorEventsArray)
+{
+	MonitorEventsArrayParseContext context =
+	{ { 0 }, monitorEventsArray, false };
+
+	PGSQL *pgsql = monitor_read_client(monitor);
+	char *sql = NULL;
+	int paramCount = 0;
+	Oid paramTypes[3];
+	const char *paramValues[3];
+	IntString countStr;
+	IntString groupStr;
+
+	log_trace("monitor_print_last_events(%s, %d, %d)", formation, group, count);
+
+	switch (group)
+	{
+		case -1:
+		{
+			sql =
+				"SELECT eventId, to_char(eventTime, 'YYYY-MM-DD HH24:MI:SS'), "
+				"       formationId, nodeid, groupid, "
+				"       nodename, nodehost, nodeport, "
+				"       reportedstate, goalState, "
+				"       reportedrepstate, reportedtli, reportedlsn, "
+				"       candidatepriority, replicationquorum, "
+				"       description "
+				"  FROM pgautofailover.last_events($1, count => $2)";
+
+			countStr = intToString(count);
+
+			paramCount = 2;
+			paramTypes[0] = TEXTOID;
+			paramValues[0] = formation;
+			paramTypes[1] = INT4OID;
+			paramValues[1] = countStr.strValue;
+
+			break;
+		}
+
+		default:
+		{
+			sql =
+				"SELECT eventId, to_char(eventTime, 'YYYY-MM-DD HH24:MI:SS'), "
+				"       formationId, nodeid, groupid, "
+				"       nodename, nodehost, nodeport, "
+				"       reportedstate, goalState, "
+				"       reportedrepstate, reportedtli, reportedlsn, "
+				"       candidatepriority, replicationquorum, "
+				"       description "
+				"  FROM pgautofailover.last_events($1,$2,$3)";
+
+			countStr = intToString(count);
+			groupStr = intToString(group);
+
+			paramCount = 3;
+			paramTypes[0] = TEXTOID;
+			paramValues[0] = formation;
+			paramTypes[1] = INT4OID;
+			paramValues[1] = groupStr.strValue;
+			paramTypes[2] = INT4OID;
+			paramValues[2] = countStr.strValue;
+
+			break;
+		}
+	}
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &getLastEvents))
+	{
+		log_error("Failed to retrieve last events from the monitor");
+		return false;
+	}
+
+	if (!context.parsedOK)
+	{
+		log_error("Failed to parse last events from the monitor, "
+				  "see above for details");
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * monitor_get_events_since fetches the events of the given formation and
+ * group (all groups when group is -1) that are more recent than the given
+ * eventId, up to count of them, the most recent ones. That allows callers to
+ * only fetch new events when they already have the previous ones.
+ *
+ * Events may show up after events with a greater id, so we only fetch the
+ * events up to pgautofailover.event_watermark(), which we get in a previous
+ * statement: the events that are not visible yet are fetched the next time,
+ * rather than being skipped forever. Only the primary monitor knows about
+ * the events that are still to show up, so we don't use the read client.
+ *
+ * The watermark we used is returned in *watermark.
+ */
+bool
+monitor_get_events_since(Monitor *monitor, char *formation, int group,
+						 int64_t eventId, int count,
+						 MonitorEventsArray *monitorEventsArray,
+						 int64_t *watermark)
+{
+	MonitorEventsArrayParseContext context =
+	{ { 0 }, monitorEventsArray, false };
+
+	SingleValueResultContext watermarkContext =
+	{ { 0 }, PGSQL_RESULT_BIGINT, false };
+
+	PGSQL *pgsql = &(monitor->pgsql);
+
+	if (!pgsql_execute_with_params(pgsql,
+								   "SELECT pgautofailover.event_watermark()",
+								   0, NULL, NULL,
+								   &watermarkContext, &parseSingleValueResult))
+	{
+		log_error("Failed to retrieve the event watermark from the monitor");
+		return false;
+	}
+
+	if (!watermarkContext.parsedOk)
+	{
+		log_error("Failed to parse the event watermark from the monitor");
+		return false;
+	}
+
+	*watermark = (int64_t) watermarkContext.bigint;
+
+	char *sql =
+		"SELECT eventId, to_char(eventTime, 'YYYY-MM-DD HH24:MI:SS'), "
+		"       formationId, nodeid, groupid, "
+		"       nodename, nodehost, nodeport, "
+		"       reportedstate, goalState, "
+		"       reportedrepstate, reportedtli, reportedlsn, "
+		"       candidatepriority, replicationquorum, "
+		"       description "
+		"  FROM ("
+		"         SELECT * "
+		"           FROM pgautofailover.event "
+		"          WHERE formationid = $1 "
+		"            AND ($2 = -1 OR groupid = $2) "
+		"            AND eventid > $3 "
+		"            AND eventid <= $5 "
+		"       ORDER BY eventid DESC "
+		"          LIMIT $4"
+		"       ) AS events "
+		"ORDER BY eventid";
+
+	IntString groupStr = intToString(group);
+	IntString eventIdStr = intToString(eventId);
+	IntString countStr = intToString(count);
+	IntString watermarkStr = intToString((int64_t) watermarkContext.bigint);
+
+	int paramCount = 5;
+	Oid paramTypes[5] = { TEXTOID, INT4OID, INT8OID, INT4OID, INT8OID };
+	const char *paramValues[5] = {
+		formation,
+		groupStr.strValue,
+		eventIdStr.strValue,
+		countStr.strValue,
+		watermarkStr.strValue
+	};
+
+	log_trace("monitor_get_events_since(%s, %d, %lld, %d, %lld)",
+			  formation, group, (long long) eventId, count,
+			  (long long) watermarkContext.bigint);
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &getLastEvents))
+	{
+		log_error("Failed to retrieve events from the monitor");
+		return false;
+	}
+
+	if (!context.parsedOK)
+	{
+		log_error("Failed to parse events from the monitor, "
+				  "see above for details");
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * getLastEvents loops over pgautofailover.last_events() results and fills in
+ * the given MonitorEventsArray.
+ */
+static void
+getLastEvents(void *ctx, PGresult *result)
+{
+	MonitorEventsArrayParseContext *context =
+		(MonitorEventsArrayParseContext *) ctx;
+
+	MonitorEventsArray *eventsArray = context->eventsArray;
+
+	int currentTupleIndex = 0;
+	int nTuples = PQntuples(result);
+
+	int errors = 0;
+
+	log_trace("getLastEvents: %d tuples", nTuples);
+
+	if (nTuples > EVENTS_ARRAY_MAX_COUNT)
+	{
+		log_error("Query returned %d rows, pg_auto_failover supports only up "
+				  "to %d events at the moment",
+				  PQntuples(result), EVENTS_ARRAY_MAX_COUNT);
+		context->parsedOK = false;
+		return;
+	}
+
+	if (PQnfields(result) != 16)
+	{
+		log_error("Query returned %d columns, expected 16", PQnfields(result));
+		context->parsedOK = false;
+		return;
+	}
+
+	eventsArray->count = nTuples;
+
+	for (currentTupleIndex = 0; currentTupleIndex < nTuples; currentTupleIndex++)
+	{
+		MonitorEvent *event = &(eventsArray->events[currentTupleIndex]);
+
+		char *value = PQgetvalue(result, currentTupleIndex, 0);
+
+		/* eventId */
+		if (!stringToInt64(value, &(event->eventId)))
+		{
+			log_error("Invalid event ID \"%s\" returned by monitor", value);
+			++errors;
+		}
+
+		/* eventTime */
+		value = PQgetvalue(result, currentTupleIndex, 1);
+		strlcpy(event->eventTime, value, sizeof(event->eventTime));
+
+		/* formationId */
+		value = PQgetvalue(result, currentTupleIndex, 2);
+		strlcpy(event->formationId, value, sizeof(event->formationId));
+
+		/* nodeId */
+		value = PQgetvalue(result, currentTupleIndex, 3);
+
+		if (!stringToInt64(value, &(event->nodeId)))
+		{
+			log_error("Invalid node ID \"%s\" returned by monitor", value);
+			++errors;
+		}
+
+		/* groupId */
+		value = PQgetvalue(result, currentTupleIndex, 4);
+
+		if (!stringToInt(value, &(event->groupId)))
+		{
+			log_error("Invalid group ID \"%s\" returned by monitor", value);
+			++errors;
+		}
+
+		/* nodeName */
+		value = PQgetvalue(result, currentTupleIndex, 5);
+		strlcpy(event->nodeName, value, sizeof(event->nodeName));
+
+		/* nodeHost */
+		value = PQgetvalue(result, currentTupleIndex, 6);
+		strlcpy(event->nodeHost, value, sizeof(event->nodeHost));
+
+		/* nodePort */
+		value = PQgetvalue(result, currentTupleIndex, 7);
+
+		if (!stringToInt(value, &(event->nodePort)))
+		{
+			log_error("Invalid group ID \"%s\" returned by monitor", value);
+			++errors;
+		}
+
+		/* reportedState */
+		value = PQgetvalue(result, currentTupleIndex, 8);
+
+		event->reportedState = NodeStateFromString(value);
+		if (event->reportedState == NO_STATE)
+		{
+			log_error("Invalid node state \"%s\" returned by monitor", value);
+			++errors;
+		}
+
+		/* assignedState */
+		value = PQgetvalue(result, currentTupleIndex, 9);
+
+		event->assignedState = NodeStateFromString(value);
+		if (event->assignedState == NO_STATE)
+		{
+			log_error("Invalid node state \"%s\" returned by monitor", value);
+			++errors;
+		}
+
+		/* repolicationState */
+		value = PQgetvalue(result, currentTupleIndex, 10);
+		strlcpy(event->replicationState, value, sizeof(event->replicationState));
+
+		/* timeline */
+		value = PQgetvalue(result, currentTupleIndex, 11);
+
+		if (!stringToInt(value, &(event->timeline)))
+		{
+			log_error("Invalid timeline \"%s\" returned by monitor", value);
+			++errors;
+		}
+
+		/* LSN */
+		value = PQgetvalue(result, currentTupleIndex, 12);
+		strlcpy(event->lsn, value, PG_LSN_MAXLENGTH);
+
+		/* candidatePriority */
+		value = PQgetvalue(result, currentTupleIndex, 13);
+
+		if (!stringToInt(value, &(event->candidatePriority)))
+		{
+			log_error("Invalid candidate priority \"%s\" returned by monitor", value);
+			++errors;
+		}
+
+		/* replicationQuorum */
+		value = PQgetvalue(result, currentTupleIndex, 14);
+		event->replicationQuorum = strcmp(value, "t") == 0;
+
+		/* description */
+		value = PQgetvalue(result, currentTupleIndex, 15);
+		strlcpy(event->description, value, sizeof(event->description));
+
+		if (errors > 0)
+		{
+			context->parsedOK = false;
+			return;
+		}
+	}
+
+	context->parsedOK = true;
+}
+
+
+/*
+ * monitor_create_formation calls the SQL API on the monitor to create a new
+ * formation of the given kind.
+ */
+bool
+monitor_create_formation(Monitor *monitor,
+						 char *formation, char *kind, char *dbname,
+						 bool hasSecondary, int numberSyncStandbys)
+{
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql =
+		"SELECT * FROM pgautofailover.create_formation($1, $2, $3, $4, $5)";
+	int paramCount = 5;
+	Oid paramTypes[5] = { TEXTOID, TEXTOID, TEXTOID, BOOLOID, INT4OID };
+	const char *paramValues[5];
+
+	paramValues[0] = formation;
+	paramValues[1] = kind;
+	paramValues[2] = dbname;
+	paramValues[3] = hasSecondary ? "true" : "false";
+	paramValues[4] = intToString(numberSyncStandbys).strValue;
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   NULL, NULL))
+	{
+		log_error("Failed to create formation \"%s\" of kind \"%s\", "
+				  "see previous lines for details.",
+				  formation, kind);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * monitor_enable_secondary_for_formation enables secondaries for the given
+ * formation
+ */
+bool
+monitor_enable_secondary_for_formation(Monitor *monitor, const char *formation)
+{
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql = "SELECT * FROM pgautofailover.enable_secondary($1)";
+	int paramCount = 1;
+	Oid paramTypes[1] = { TEXTOID };
+	const char *paramValues[1];
+
+	paramValues[0] = formation;
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   NULL, NULL))
+	{
+		log_error("Failed to enable secondaries on formation \"%s\", "
+				  "see previous lines for details.",
+				  formation);
+		return false;
+	}
+
+	/* disconnect from PostgreSQL now */
+	pgsql_finish(&monitor->pgsql);
+
+	return true;
+}
+
+
+/*
+ * monitor_disable_secondary_for_formation disables secondaries for the given
+ * formation. This requires no secondaries to be currently in the formation,
+ * function will report an error on the monitor due to an execution error of
+ * pgautofailover.disable_secondary when there are still secondaries in the
+ * cluster, or more precise nodes that are not in 'sinlge' state.
+ */
+bool
+monitor_disable_secondary_for_formation(Monitor *monitor, const char *formation)
+{
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql = "SELECT * FROM pgautofailover.disable_secondary($1)";
+	int paramCount = 1;
+	Oid paramTypes[1] = { TEXTOID };
+	const char *paramValues[1];
+
+	paramValues[0] = formation;
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   NULL, NULL))
+	{
+		log_error("Failed to disable secondaries on formation \"%s\", "
+				  "see previous lines for details.",
+				  formation);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * monitor_drop_formation calls the SQL API on the monitor to drop formation.
+ */
+bool
+monitor_drop_formation(Monitor *monitor, char *formation)
+{
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql = "SELECT * FROM pgautofailover.drop_formation($1)";
+	int paramCount = 1;
+	Oid paramTypes[1] = { TEXTOID };
+	const char *paramValues[1];
+
+	paramValues[0] = formation;
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   NULL, NULL))
+	{
+		log_error("Failed to drop formation \"%s\", "
+				  "see previous lines for details.",
+				  formation);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * monitor_formation_uri calls the SQL API on the monitor that returns the
+ * connection string that can be used by applications to connect to the
+ * formation.
+ */
+bool
+monitor_formation_uri(Monitor *monitor,
+					  const char *formation,
+					  const char *citusClusterName,
+					  const SSLOptions *ssl,
+					  char *connectionString,
+					  size_t size)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_STRING, false };
+	PGSQL *pgsql = monitor_read_client(monitor);
+	const char *sql =
+		"SELECT formation_uri "
+		"FROM pgautofailover.formation_uri($1, $2, $3, $4, $5)";
+	int paramCount = 5;
+	Oid paramTypes[5] = { TEXTOID, TEXTOID, TEXTOID, TEXTOID, TEXTOID };
+	const char *paramValues[5] = { 0 };
+
+	paramValues[0] = formation;
+	paramValues[1] = citusClusterName;
+	paramValues[2] = ssl->sslModeStr;
+	paramValues[3] = ssl->caFile;
+	paramValues[4] = ssl->crlFile;
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &parseSingleValueResult))
+	{
+		log_error("Failed to list the formation uri for \"%s\", "
+				  "see previous lines for details.",
+				  formation);
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		/* errors have already been logged */
+		if (context.strVal)
+		{
+			free(context.strVal);
+		}
+		return false;
+	}
+
+	if (context.strVal == NULL || strcmp(context.strVal, "") == 0)
+	{
+		log_error("Formation \"%s\" currently has no nodes in group 0",
+				  formation);
+		if (context.strVal)
+		{
+			free(context.strVal);
+		}
+		return false;
+	}
+
+	strlcpy(connectionString, context.strVal, size);
+	free(context.strVal);
+
+	return true;
+}
+
+
+/*
+ * monitor_formation_readonly_uri calls the SQL API on the monitor that returns
+ * the connection string that applications can use to connect to the secondary
+ * nodes of the formation, the least lagging first, skipping the nodes that
+ * are more than maxLag bytes behind the primary.
+ *
+ * With preferStandby, the primary node is listed last and the connection
+ * string uses target_session_attrs=prefer-standby, for applications that
+ * wait for their LSN token on a standby, see pgautofailover.wait_for_lsn().
+ */
+bool
+monitor_formation_readonly_uri(Monitor *monitor,
+							   const char *formation,
+							   const char *citusClusterName,
+							   const SSLOptions *ssl,
+							   int64_t maxLag,
+							   bool preferStandby,
+							   char *connectionString,
+							   size_t size)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_STRING, false };
+	PGSQL *pgsql = monitor_read_client(monitor);
+	const char *sql =
+		"SELECT formation_uri "
+		"FROM pgautofailover.formation_uri($1, $2, $3, $4, $5, $6, $7)";
+	int paramCount = 7;
+	Oid paramTypes[7] = {
+		TEXTOID, TEXTOID, TEXTOID, TEXTOID, TEXTOID, TEXTOID, INT8OID
+	};
+	const char *paramValues[7] = { 0 };
+	IntString maxLagString = intToString(maxLag);
+
+	paramValues[0] = formation;
+	paramValues[1] = citusClusterName;
+	paramValues[2] = ssl->sslModeStr;
+	paramValues[3] = ssl->caFile;
+	paramValues[4] = ssl->crlFile;
+	paramValues[5] = preferStandby ? "prefer-standby" : "read-only";
+	paramValues[6] = maxLagString.strValue;
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &parseSingleValueResult))
+	{
+		log_error("Failed to list the read-only formation uri for \"%s\", "
+				  "see previous lines for details.",
+				  formation);
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		/* errors have already been logged */
+		if (context.strVal)
+		{
+			free(context.strVal);
+		}
+		return false;
+	}
+
+	if (context.strVal == NULL || strcmp(context.strVal, "") == 0)
+	{
+		if (preferStandby)
+		{
+			log_error("Formation \"%s\" currently has no primary node and "
+					  "no healthy secondary node", formation);
+		}
+		else
+		{
+			log_error("Formation \"%s\" currently has no healthy secondary "
+					  "node lagging less than %" PRId64 " bytes behind its "
+					  "primary",
+					  formation, maxLag);
+		}
+		if (context.strVal)
+		{
+			free(context.strVal);
+		}
+		return false;
+	}
+
+	strlcpy(connectionString, context.strVal, size);
+	free(context.strVal);
+
+	return true;
+}
+
+
+/*
+ * monitor_print_every_formation_uri prints a table of all our connection
+ * strings: first the monitor URI itself, and then one line per formation.
+ */
+bool
+monitor_print_every_formation_uri(Monitor *monitor, const SSLOptions *ssl)
+{
+	FormationURIParseContext context = { 0 };
+	PGSQL *pgsql = monitor_read_client(monitor);
+	const char *sql =
+		"SELECT 'monitor', 'monitor', $1 "
+		" UNION ALL "
+		"SELECT 'formation', formationid, formation_uri "
+		"  FROM pgautofailover.formation, "
+		"       pgautofailover.formation_uri"
+		"(formation.formationid, 'default', $2, $3, $4) "
+		" UNION ALL "
+		"SELECT 'read-replica', nodecluster, formation_uri "
+		"  FROM pgautofailover.formation "
+		"       JOIN pgautofailover.node using(formationid), "
+		"       pgautofailover.formation_uri"
+		"(formation.formationid, nodecluster, $2, $3, $4) "
+		" WHERE node.groupid = 0 and node.nodecluster <> 'default' ";
+
+	int paramCount = 4;
+	Oid paramTypes[4] = { TEXTOID, TEXTOID, TEXTOID, TEXTOID };
+	const char *paramValues[4];
+
+	paramValues[0] = monitor->pgsql.connectionString;
+	paramValues[1] = ssl->sslModeStr;
+	paramValues[2] = ssl->caFile;
+	paramValues[3] = ssl->crlFile;
+
+	context.parsedOK = false;
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &printFormationURI))
+	{
+		log_error("Failed to list the formation uri, "
+				  "see previous lines for details.");
+		return false;
+	}
+
+	if (!context.parsedOK)
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * monitor_print_every_formation_uri_as_json prints all our connection strings
+ * in the JSON format: first the monitor URI itself, and then one line per
+ * formation.
+ */
+bool
+monitor_print_every_formation_uri_as_json(Monitor *monitor,
+										  const SSLOptions *ssl,
+										  FILE *stream)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_STRING, false };
+	PGSQL *pgsql = monitor_read_client(monitor);
+	const char *sql =
+		"WITH formation(type, name, uri) AS ( "
+		"SELECT 'monitor', 'monitor', $1 "
+		" UNION ALL "
+		"SELECT 'formation', formationid, formation_uri "
+		"  FROM pgautofailover.formation, "
+		"       pgautofailover.formation_uri"
+		"(formation.formationid, 'default', $2, $3, $4)"
+		" UNION ALL "
+		"SELECT 'read-replica', nodecluster, formation_uri "
+		"  FROM pgautofailover.formation "
+		"       JOIN pgautofailover.node using(formationid), "
+		"       pgautofailover.formation_uri"
+		"(formation.formationid, nodecluster, $2, $3, $4) "
+		" WHERE node.groupid = 0 and node.nodecluster <> 'default' "
+		") "
+		"SELECT jsonb_pretty(jsonb_agg(row_to_json(formation))) FROM formation";
+
+	int paramCount = 4;
+	Oid paramTypes[4] = { TEXTOID, TEXTOID, TEXTOID, TEXTOID };
+	const char *paramValues[4];
+
+	paramValues[0] = monitor->pgsql.connectionString;
+	paramValues[1] = ssl->sslModeStr;
+	paramValues[2] = ssl->caFile;
+	paramValues[3] = ssl->crlFile;
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &parseSingleValueResult))
+	{
+		log_error("Failed to list the formation uri, "
+				  "see previous lines for details.");
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		/* errors have already been logged */
+		if (context.strVal)
+		{
+			free(context.strVal);
+		}
+		return false;
+	}
+
+	fformat(stream, "%s\n", context.strVal);
+	free(context.strVal);
+
+	return true;
+}
+
+
+/*
+ * printFormationURI loops over the results of the SQL query in
+ * monitor_print_every_formation_uri and outputs the result in table like
+ * format.
+ */
+static void
+printFormationURI(void *ctx, PGresult *result)
+{
+	FormationURIParseContext *context = (FormationURIParseContext *) ctx;
+	int currentTupleIndex = 0;
+	int nTuples = PQntuples(result);
+
+	int maxFormationNameSize = 7;   /* "monitor" */
+	char formationNameSeparator[BUFSIZE] = { 0 };
+
+	log_trace("printFormationURI: %d tuples", nTuples);
+
+	if (PQnfields(result) != 3)
+	{
+		log_error("Query returned %d columns, expected 3", PQnfields(result));
+		context->parsedOK = false;
+		return;
+	}
+
+	/*
+	 * Dynamically adjust our display output to the length of the longer
+	 * hostname in the result set
+	 */
+	for (currentTupleIndex = 0; currentTupleIndex < nTuples; currentTupleIndex++)
+	{
+		int size = strlen(PQgetvalue(result, currentTupleIndex, 1));
+
+		if (size > maxFormationNameSize)
+		{
+			maxFormationNameSize = size;
+		}
+	}
+
+	/* create the visual separator for the formation name too */
+	(void) prepareHostNameSeparator(formationNameSeparator, maxFormationNameSize);
+
+	fformat(stdout, "%12s | %*s | %s\n",
+			"Type", maxFormationNameSize, "Name", "Connection String");
+	fformat(stdout, "%12s-+-%*s-+-%s\n",
+			"------------", maxFormationNameSize, formationNameSeparator,
+			"------------------------------");
+
+	for (currentTupleIndex = 0; currentTupleIndex < nTuples; currentTupleIndex++)
+	{
+		char *type = PQgetvalue(result, currentTupleIndex, 0);
+		char *name = PQgetvalue(result, currentTupleIndex, 1);
+		char *URI = PQgetvalue(result, currentTupleIndex, 2);
+
+		fformat(stdout, "%12s | %*s | %s\n",
+				type, maxFormationNameSize, name, URI);
+	}
+	fformat(stdout, "\n");
+
+	context->parsedOK = true;
+}
+
+
+/*
+ * monitor_count_failover_candidates counts how many nodes in a given group are
+ * not currently in a primary state, and have candidatePriority > 0.
+ */
+bool
+monitor_count_failover_candidates(Monitor *monitor,
+								  char *formation, int groupId,
+								  int *failoverCandidateCount)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_INT, false };
+	PGSQL *pgsql = &monitor->pgsql;
+	char *sql =
+		"select count(node.candidatepriority) "
+		"       filter(where node.candidatepriority > 0) "
+		"       as failover_candidate_count "
+		"  from pgautofailover.get_nodes($1, $2) as gn "
+		"  join pgautofailover.node "
+		"    on node.nodeid = gn.node_id "
+		" where not node_is_primary";
+
+	int paramCount = 2;
+	Oid paramTypes[2] = { TEXTOID, INT4OID };
+	const char *paramValues[2] = { 0 };
+	IntString myGroupIdString = intToString(groupId);
+
+	paramValues[0] = formation;
+	paramValues[1] = myGroupIdString.strValue;
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &parseSingleValueResult))
+	{
+		log_error("Failed to retrieve formation settings from the monitor");
+		return false;
+	}
 
-	if (!pgsql_execute_with_params(pgsql, sql,
-								   paramCount, paramTypes, paramValues,
-								   NULL, NULL))
+	if (!context.parsedOk)
 	{
-		log_error("Failed to enable secondaries on formation \"%s\", "
-				  "see previous lines for details.",
-				  formation);
+		log_error("Failed to parse query result from the monitor.");
 		return false;
 	}
 
-	/* disconnect from PostgreSQL now */
-	pgsql_finish(&monitor->pgsql);
+	*failoverCandidateCount = context.intVal;
 
 	return true;
 }
 
 
 /*
- * monitor_disable_secondary_for_formation disables secondaries for the given
- * formation. This requires no secondaries to be currently in the formation,
- * function will report an error on the monitor due to an execution error of
- * pgautofailover.disable_secondary when there are still secondaries in the
- * cluster, or more precise nodes that are not in 'sinlge' state.
+ * monitor_print_formation_settings calls the function
+ * pgautofailover.formation_settings on the monitor, and prints a line of
+ * output per state record obtained.
  */
 bool
-monitor_disable_secondary_for_formation(Monitor *monitor, const char *formation)
+monitor_print_formation_settings(Monitor *monitor, char *formation)
 {
+	MonitorAssignedStateParseContext context = { 0 };
 	PGSQL *pgsql = &monitor->pgsql;
-	const char *sql = "SELECT * FROM pgautofailover.disable_secondary($1)";
+	char *sql =
+		"select context, group_id, node_id, nodename, setting, value "
+		" from pgautofailover.formation_settings($1)"
+		" order by case context when 'formation' then 0 "
+		" when 'primary' then 1 "
+		" when 'node' then 2 else 3 end, "
+		" setting, group_id, node_id";
 	int paramCount = 1;
 	Oid paramTypes[1] = { TEXTOID };
-	const char *paramValues[1];
-
-	paramValues[0] = formation;
+	const char *paramValues[1] = { formation };
 
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
-								   NULL, NULL))
+								   &context, &printFormationSettings))
 	{
-		log_error("Failed to disable secondaries on formation \"%s\", "
-				  "see previous lines for details.",
-				  formation);
+		log_error("Failed to retrieve formation settings from the monitor");
+		return false;
+	}
+
+	if (!context.parsedOK)
+	{
+		log_error("Failed to parse formation settings from the monitor "
+				  "for formation \"%s\"", formation);
 		return false;
 	}
 
@@ -2824,85 +5456,155 @@ monitor_disable_secondary_for_formation(Monitor *monitor, const char *formation)
 
 
 /*
- * monitor_drop_formation calls the SQL API on the monitor to drop formation.
+ * printFormationSettings loops over pgautofailover.formation_settings()
+ * results and prints them, one per line.
  */
-bool
-monitor_drop_formation(Monitor *monitor, char *formation)
+static void
+printFormationSettings(void *ctx, PGresult *result)
 {
-	PGSQL *pgsql = &monitor->pgsql;
-	const char *sql = "SELECT * FROM pgautofailover.drop_formation($1)";
-	int paramCount = 1;
-	Oid paramTypes[1] = { TEXTOID };
-	const char *paramValues[1];
+	MonitorAssignedStateParseContext *context =
+		(MonitorAssignedStateParseContext *) ctx;
+	int index = 0;
+	int nTuples = PQntuples(result);
 
-	paramValues[0] = formation;
+	int maxNameSize = 4;        /* "Name" */
+	int maxSettingSize = 7;     /* "Setting" */
+	int maxValueSize = 5;       /* "Value" */
 
-	if (!pgsql_execute_with_params(pgsql, sql,
-								   paramCount, paramTypes, paramValues,
-								   NULL, NULL))
+	char nameSeparatorHeader[BUFSIZE] = { 0 };
+	char settingSeparatorHeader[BUFSIZE] = { 0 };
+	char valueSeparatorHeader[BUFSIZE] = { 0 };
+
+	if (nTuples == 0)
 	{
-		log_error("Failed to drop formation \"%s\", "
-				  "see previous lines for details.",
-				  formation);
-		return false;
+		log_debug("Query returned 0 rows");
+		context->parsedOK = false;
+		return;
 	}
 
-	return true;
+	if (PQnfields(result) != 6)
+	{
+		log_error("Query returned %d columns, expected 6", PQnfields(result));
+		context->parsedOK = false;
+		return;
+	}
+
+	for (index = 0; index < nTuples; index++)
+	{
+		char *nodename = PQgetvalue(result, index, 3);
+		char *setting = PQgetvalue(result, index, 4);
+		char *value = PQgetvalue(result, index, 5);
+
+		if (strlen(nodename) > maxNameSize)
+		{
+			maxNameSize = strlen(nodename);
+		}
+
+		if (strlen(setting) > maxSettingSize)
+		{
+			maxSettingSize = strlen(setting);
+		}
+
+		if (strlen(value) > maxValueSize)
+		{
+			maxValueSize = strlen(value);
+		}
+	}
+
+	(void) prepareHostNameSeparator(nameSeparatorHeader, maxNameSize);
+	(void) prepareHostNameSeparator(settingSeparatorHeader, maxSettingSize);
+	(void) prepareHostNameSeparator(valueSeparatorHeader, maxValueSize);
+
+	fformat(stdout, "%9s | %*s | %*s | %-*s\n",
+			"Context",
+			maxNameSize, "Name",
+			maxSettingSize, "Setting",
+			maxValueSize, "Value");
+
+	fformat(stdout, "%9s-+-%*s-+-%*s-+-%*s\n",
+			"---------",
+			maxNameSize, nameSeparatorHeader,
+			maxSettingSize, settingSeparatorHeader,
+			maxValueSize, valueSeparatorHeader);
+
+	for (index = 0; index < nTuples; index++)
+	{
+		char *context = PQgetvalue(result, index, 0);
+
+		/* not used at the moment
+		 * char *group_id = PQgetvalue(result, index, 1);
+		 * char *node_id = PQgetvalue(result, index, 2);
+		 */
+		char *nodename = PQgetvalue(result, index, 3);
+		char *setting = PQgetvalue(result, index, 4);
+		char *value = PQgetvalue(result, index, 5);
+
+		fformat(stdout, "%9s | %*s | %*s | %-*s\n",
+				context,
+				maxNameSize, nodename,
+				maxSettingSize, setting,
+				maxValueSize, value);
+	}
+
+	fformat(stdout, "\n");
+
+	context->parsedOK = true;
 }
 
 
 /*
- * monitor_formation_uri calls the SQL API on the monitor that returns the
- * connection string that can be used by applications to connect to the
- * formation.
+ * monitor_print_formation_settings calls the function
+ * pgautofailover.formation_settings on the monitor, and prints a line of
+ * output per state record obtained.
  */
 bool
-monitor_formation_uri(Monitor *monitor,
-					  const char *formation,
-					  const char *citusClusterName,
-					  const SSLOptions *ssl,
-					  char *connectionString,
-					  size_t size)
+monitor_print_formation_settings_as_json(Monitor *monitor, char *formation)
 {
 	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_STRING, false };
 	PGSQL *pgsql = &monitor->pgsql;
-	const char *sql =
-		"SELECT formation_uri "
-		"FROM pgautofailover.formation_uri($1, $2, $3, $4, $5)";
-	int paramCount = 5;
-	Oid paramTypes[5] = { TEXTOID, TEXTOID, TEXTOID, TEXTOID, TEXTOID };
-	const char *paramValues[5] = { 0 };
-
-	paramValues[0] = formation;
-	paramValues[1] = citusClusterName;
-	paramValues[2] = ssl->sslModeStr;
-	paramValues[3] = ssl->caFile;
-	paramValues[4] = ssl->crlFile;
+	char *sql =
+		"with settings as "
+		" ( "
+		"  select * "
+		"    from pgautofailover.formation_settings($1) "
+		" ), "
+		" f(json) as "
+		" ( "
+		"   select jsonb_agg(row_to_json(settings)) "
+		"     from settings "
+		"    where context = 'formation' "
+		" ), "
+		" p(json) as "
+		" ( "
+		"  select jsonb_agg(row_to_json(settings)) "
+		"    from settings "
+		"   where context = 'primary' "
+		" ), "
+		" n(json) as "
+		" ( "
+		"   select jsonb_agg(row_to_json(settings)) "
+		"     from settings "
+		"    where context = 'node' "
+		" ) "
+		"select jsonb_pretty(jsonb_build_object("
+		"'formation', f.json, 'primary', p.json, 'nodes', n.json)) "
+		"  from f, p, n";
+	int paramCount = 1;
+	Oid paramTypes[1] = { TEXTOID };
+	const char *paramValues[1] = { formation };
 
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
 								   &context, &parseSingleValueResult))
 	{
-		log_error("Failed to list the formation uri for \"%s\", "
-				  "see previous lines for details.",
-				  formation);
+		log_error("Failed to retrieve current state from the monitor");
 		return false;
 	}
 
 	if (!context.parsedOk)
 	{
-		/* errors have already been logged */
-		if (context.strVal)
-		{
-			free(context.strVal);
-		}
-		return false;
-	}
-
-	if (context.strVal == NULL || strcmp(context.strVal, "") == 0)
-	{
-		log_error("Formation \"%s\" currently has no nodes in group 0",
-				  formation);
+		log_error("Failed to parse formation settings from the monitor "
+				  "for formation \"%s\"", formation);
 		if (context.strVal)
 		{
 			free(context.strVal);
@@ -2910,7 +5612,7 @@ monitor_formation_uri(Monitor *monitor,
 		return false;
 	}
 
-	strlcpy(connectionString, context.strVal, size);
+	fformat(stdout, "%s\n", context.strVal);
 	free(context.strVal);
 
 	return true;
@@ -2918,52 +5620,68 @@ monitor_formation_uri(Monitor *monitor,
 
 
 /*
- * monitor_print_every_formation_uri prints a table of all our connection
- * strings: first the monitor URI itself, and then one line per formation.
+ * monitor_print_every_formation_settings prints the replication settings of
+ * all the formations registered on the monitor, using the same monitor
+ * connection for all the queries.
  */
 bool
-monitor_print_every_formation_uri(Monitor *monitor, const SSLOptions *ssl)
+monitor_print_every_formation_settings(Monitor *monitor)
 {
-	FormationURIParseContext context = { 0 };
-	PGSQL *pgsql = &monitor->pgsql;
-	const char *sql =
-		"SELECT 'monitor', 'monitor', $1 "
-		" UNION ALL "
-		"SELECT 'formation', formationid, formation_uri "
-		"  FROM pgautofailover.formation, "
-		"       pgautofailover.formation_uri"
-		"(formation.formationid, 'default', $2, $3, $4) "
-		" UNION ALL "
-		"SELECT 'read-replica', nodecluster, formation_uri "
-		"  FROM pgautofailover.formation "
-		"       JOIN pgautofailover.node using(formationid), "
-		"       pgautofailover.formation_uri"
-		"(formation.formationid, nodecluster, $2, $3, $4) "
-		" WHERE node.groupid = 0 and node.nodecluster <> 'default' ";
+	FormationNamesArray formationsArray = { 0 };
 
-	int paramCount = 4;
-	Oid paramTypes[4] = { TEXTOID, TEXTOID, TEXTOID, TEXTOID };
-	const char *paramValues[4];
+	if (!monitor_get_formation_names(monitor, &formationsArray))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	for (int index = 0; index < formationsArray.count; index++)
+	{
+		char *formation = formationsArray.names[index];
 
-	paramValues[0] = monitor->pgsql.connectionString;
-	paramValues[1] = ssl->sslModeStr;
-	paramValues[2] = ssl->caFile;
-	paramValues[3] = ssl->crlFile;
+		fformat(stdout, "Formation: %s\n\n", formation);
 
-	context.parsedOK = false;
+		if (!monitor_print_formation_settings(monitor, formation))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+	}
 
-	if (!pgsql_execute_with_params(pgsql, sql,
-								   paramCount, paramTypes, paramValues,
-								   &context, &printFormationURI))
+	return true;
+}
+
+
+/*
+ * monitor_print_every_formation_settings_as_json prints the replication
+ * settings of all the formations registered on the monitor as a single JSON
+ * array, obtained from a single query.
+ */
+bool
+monitor_print_every_formation_settings_as_json(Monitor *monitor)
+{
+	MonitorJSONResultContext context = { { 0 }, stdout, false };
+	PGSQL *pgsql = monitor_read_client(monitor);
+	const char *sql =
+		"  SELECT f.formationid as formation, s.* "
+		"    FROM pgautofailover.formation f, "
+		"         pgautofailover.formation_settings(f.formationid) s "
+		"ORDER BY f.formationid, "
+		"         case s.context when 'formation' then 0 "
+		"                        when 'primary' then 1 "
+		"                        when 'node' then 2 else 3 end, "
+		"         s.setting, s.group_id, s.node_id";
+
+	if (!pgsql_execute_with_params(pgsql, sql, 0, NULL, NULL,
+								   &context, &printResultAsJSON))
 	{
-		log_error("Failed to list the formation uri, "
-				  "see previous lines for details.");
+		log_error("Failed to retrieve formation settings from the monitor");
 		return false;
 	}
 
 	if (!context.parsedOK)
 	{
-		/* errors have already been logged */
+		log_error("Failed to parse formation settings from the monitor");
 		return false;
 	}
 
@@ -2972,56 +5690,51 @@ monitor_print_every_formation_uri(Monitor *monitor, const SSLOptions *ssl)
 
 
 /*
- * monitor_print_every_formation_uri_as_json prints all our connection strings
- * in the JSON format: first the monitor URI itself, and then one line per
- * formation.
+ * monitor_synchronous_standby_names returns the value for the Postgres
+ * parameter "synchronous_standby_names" to use for a given group. The setting
+ * is computed on the monitor depending on the current values of the formation
+ * number_sync_standbys and each node's candidate priority and replication
+ * quorum properties.
  */
 bool
-monitor_print_every_formation_uri_as_json(Monitor *monitor,
-										  const SSLOptions *ssl,
-										  FILE *stream)
+monitor_synchronous_standby_names(Monitor *monitor,
+								  char *formation, int groupId,
+								  char *synchronous_standby_names, int size)
 {
-	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_STRING, false };
 	PGSQL *pgsql = &monitor->pgsql;
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_STRING, false };
+
 	const char *sql =
-		"WITH formation(type, name, uri) AS ( "
-		"SELECT 'monitor', 'monitor', $1 "
-		" UNION ALL "
-		"SELECT 'formation', formationid, formation_uri "
-		"  FROM pgautofailover.formation, "
-		"       pgautofailover.formation_uri"
-		"(formation.formationid, 'default', $2, $3, $4)"
-		" UNION ALL "
-		"SELECT 'read-replica', nodecluster, formation_uri "
-		"  FROM pgautofailover.formation "
-		"       JOIN pgautofailover.node using(formationid), "
-		"       pgautofailover.formation_uri"
-		"(formation.formationid, nodecluster, $2, $3, $4) "
-		" WHERE node.groupid = 0 and node.nodecluster <> 'default' "
-		") "
-		"SELECT jsonb_pretty(jsonb_agg(row_to_json(formation))) FROM formation";
+		"select pgautofailover.synchronous_standby_names($1, $2)";
 
-	int paramCount = 4;
-	Oid paramTypes[4] = { TEXTOID, TEXTOID, TEXTOID, TEXTOID };
-	const char *paramValues[4];
+	int paramCount = 2;
+	Oid paramTypes[2] = { TEXTOID, INT4OID };
+	const char *paramValues[2] = { 0 };
+	IntString myGroupIdString = intToString(groupId);
 
-	paramValues[0] = monitor->pgsql.connectionString;
-	paramValues[1] = ssl->sslModeStr;
-	paramValues[2] = ssl->caFile;
-	paramValues[3] = ssl->crlFile;
+	paramValues[0] = formation;
+	paramValues[1] = myGroupIdString.strValue;
 
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
 								   &context, &parseSingleValueResult))
 	{
-		log_error("Failed to list the formation uri, "
-				  "see previous lines for details.");
+		log_error("Failed to get the synchronous_standby_names setting value "
+				  " from the monitor for formation %s and group %d",
+				  formation, groupId);
+		if (context.strVal)
+		{
+			free(context.strVal);
+		}
 		return false;
 	}
 
 	if (!context.parsedOk)
 	{
-		/* errors have already been logged */
+		log_error("Failed to get the synchronous_standby_names setting value "
+				  " from the monitor for formation %s and group %d,"
+				  "see above for details",
+				  formation, groupId);
 		if (context.strVal)
 		{
 			free(context.strVal);
@@ -3029,7 +5742,7 @@ monitor_print_every_formation_uri_as_json(Monitor *monitor,
 		return false;
 	}
 
-	fformat(stream, "%s\n", context.strVal);
+	strlcpy(synchronous_standby_names, context.strVal, size);
 	free(context.strVal);
 
 	return true;
@@ -3037,21 +5750,56 @@ monitor_print_every_formation_uri_as_json(Monitor *monitor,
 
 
 /*
- * printFormationURI loops over the results of the SQL query in
- * monitor_print_every_formation_uri and outputs the result in table like
- * format.
+ * monitor_print_every_synchronous_standby_names prints the value of the
+ * synchronous_standby_names setting for every group of every formation
+ * registered on the monitor, computed in a single query.
  */
-static void
-printFormationURI(void *ctx, PGresult *result)
+bool
+monitor_print_every_synchronous_standby_names(Monitor *monitor, bool outputJSON)
 {
-	FormationURIParseContext *context = (FormationURIParseContext *) ctx;
-	int currentTupleIndex = 0;
-	int nTuples = PQntuples(result);
+	MonitorJSONResultContext context = { { 0 }, stdout, false };
+	PGSQL *pgsql = monitor_read_client(monitor);
+	const char *sql =
+		"  SELECT formationid as formation, groupid as group, "
+		"         pgautofailover.synchronous_standby_names(formationid, groupid)"
+		"         as synchronous_standby_names "
+		"    FROM (select distinct formationid, groupid "
+		"            from pgautofailover.node) as groups "
+		"ORDER BY formationid, groupid";
+
+	if (!pgsql_execute_with_params(pgsql, sql, 0, NULL, NULL,
+								   &context,
+								   outputJSON
+								   ? &printResultAsJSON
+								   : &printStandbyNames))
+	{
+		log_error("Failed to get the synchronous_standby_names setting values "
+				  "from the monitor");
+		return false;
+	}
 
-	int maxFormationNameSize = 7;   /* "monitor" */
-	char formationNameSeparator[BUFSIZE] = { 0 };
+	if (!context.parsedOK)
+	{
+		log_error("Failed to parse the synchronous_standby_names setting "
+				  "values from the monitor");
+		return false;
+	}
 
-	log_trace("printFormationURI: %d tuples", nTuples);
+	return true;
+}
+
+
+/*
+ * printStandbyNames prints the result of the query in
+ * monitor_print_every_synchronous_standby_names as a table.
+ */
+static void
+printStandbyNames(void *ctx, PGresult *result)
+{
+	MonitorJSONResultContext *context = (MonitorJSONResultContext *) ctx;
+	int nTuples = PQntuples(result);
+	int maxFormationSize = 9;   /* "Formation" */
+	char formationSeparator[BUFSIZE] = { 0 };
 
 	if (PQnfields(result) != 3)
 	{
@@ -3060,351 +5808,414 @@ printFormationURI(void *ctx, PGresult *result)
 		return;
 	}
 
-	/*
-	 * Dynamically adjust our display output to the length of the longer
-	 * hostname in the result set
-	 */
-	for (currentTupleIndex = 0; currentTupleIndex < nTuples; currentTupleIndex++)
+	for (int index = 0; index < nTuples; index++)
 	{
-		int size = strlen(PQgetvalue(result, currentTupleIndex, 1));
+		int size = strlen(PQgetvalue(result, index, 0));
 
-		if (size > maxFormationNameSize)
+		if (size > maxFormationSize)
 		{
-			maxFormationNameSize = size;
+			maxFormationSize = size;
 		}
 	}
 
-	/* create the visual separator for the formation name too */
-	(void) prepareHostNameSeparator(formationNameSeparator, maxFormationNameSize);
+	(void) prepareHostNameSeparator(formationSeparator, maxFormationSize);
 
-	fformat(stdout, "%12s | %*s | %s\n",
-			"Type", maxFormationNameSize, "Name", "Connection String");
-	fformat(stdout, "%12s-+-%*s-+-%s\n",
-			"------------", maxFormationNameSize, formationNameSeparator,
-			"------------------------------");
+	fformat(context->stream, "%*s | %5s | %s\n",
+			maxFormationSize, "Formation", "Group",
+			"synchronous_standby_names");
 
-	for (currentTupleIndex = 0; currentTupleIndex < nTuples; currentTupleIndex++)
-	{
-		char *type = PQgetvalue(result, currentTupleIndex, 0);
-		char *name = PQgetvalue(result, currentTupleIndex, 1);
-		char *URI = PQgetvalue(result, currentTupleIndex, 2);
+	fformat(context->stream, "%*s-+-%5s-+-%s\n",
+			maxFormationSize, formationSeparator, "-----",
+			"-------------------------");
 
-		fformat(stdout, "%12s | %*s | %s\n",
-				type, maxFormationNameSize, name, URI);
+	for (int index = 0; index < nTuples; index++)
+	{
+		fformat(context->stream, "%*s | %5s | '%s'\n",
+				maxFormationSize, PQgetvalue(result, index, 0),
+				PQgetvalue(result, index, 1),
+				PQgetvalue(result, index, 2));
 	}
-	fformat(stdout, "\n");
+
+	fformat(context->stream, "\n");
 
 	context->parsedOK = true;
 }
 
 
 /*
- * monitor_count_failover_candidates counts how many nodes in a given group are
- * not currently in a primary state, and have candidatePriority > 0.
+ * monitor_report_latency sends to the monitor the round-trip time that we
+ * measured to each of the given peer nodes, in milliseconds.
  */
 bool
-monitor_count_failover_candidates(Monitor *monitor,
-								  char *formation, int groupId,
-								  int *failoverCandidateCount)
+monitor_report_latency(Monitor *monitor, int64_t nodeId,
+					   int count, int64_t *peerNodeIds, double *rtt)
 {
-	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_INT, false };
 	PGSQL *pgsql = &monitor->pgsql;
-	char *sql =
-		"select count(node.candidatepriority) "
-		"       filter(where node.candidatepriority > 0) "
-		"       as failover_candidate_count "
-		"  from pgautofailover.get_nodes($1, $2) as gn "
-		"  join pgautofailover.node "
-		"    on node.nodeid = gn.node_id "
-		" where not node_is_primary";
-
-	int paramCount = 2;
-	Oid paramTypes[2] = { TEXTOID, INT4OID };
-	const char *paramValues[2] = { 0 };
-	IntString myGroupIdString = intToString(groupId);
+	const char *sql =
+		"SELECT pgautofailover.report_latency($1, $2::bigint[], $3::float8[])";
+	int paramCount = 3;
+	Oid paramTypes[3] = { INT8OID, TEXTOID, TEXTOID };
+	const char *paramValues[3];
 
-	paramValues[0] = formation;
-	paramValues[1] = myGroupIdString.strValue;
+	PQExpBuffer peers = createPQExpBuffer();
+	PQExpBuffer rtts = createPQExpBuffer();
 
-	if (!pgsql_execute_with_params(pgsql, sql,
-								   paramCount, paramTypes, paramValues,
-								   &context, &parseSingleValueResult))
+	if (peers == NULL || rtts == NULL)
 	{
-		log_error("Failed to retrieve formation settings from the monitor");
+		log_error("Failed to allocate memory");
+		destroyPQExpBuffer(peers);
+		destroyPQExpBuffer(rtts);
 		return false;
 	}
 
-	if (!context.parsedOk)
+	appendPQExpBufferStr(peers, "{");
+	appendPQExpBufferStr(rtts, "{");
+
+	for (int i = 0; i < count; i++)
 	{
-		log_error("Failed to parse query result from the monitor.");
+		const char *sep = i == 0 ? "" : ",";
+
+		appendPQExpBuffer(peers, "%s%" PRId64, sep, peerNodeIds[i]);
+		appendPQExpBuffer(rtts, "%s%.3f", sep, rtt[i]);
+	}
+
+	appendPQExpBufferStr(peers, "}");
+	appendPQExpBufferStr(rtts, "}");
+
+	if (PQExpBufferBroken(peers) || PQExpBufferBroken(rtts))
+	{
+		log_error("Failed to allocate memory");
+		destroyPQExpBuffer(peers);
+		destroyPQExpBuffer(rtts);
 		return false;
 	}
 
-	*failoverCandidateCount = context.intVal;
+	paramValues[0] = intToString(nodeId).strValue;
+	paramValues[1] = peers->data;
+	paramValues[2] = rtts->data;
+
+	bool success =
+		pgsql_execute_with_params(pgsql, sql,
+								  paramCount, paramTypes, paramValues,
+								  NULL, NULL);
+
+	destroyPQExpBuffer(peers);
+	destroyPQExpBuffer(rtts);
+
+	if (!success)
+	{
+		log_error("Failed to report latency of node %" PRId64
+				  " to the monitor", nodeId);
+		return false;
+	}
 
 	return true;
 }
 
 
 /*
- * monitor_print_formation_settings calls the function
- * pgautofailover.formation_settings on the monitor, and prints a line of
- * output per state record obtained.
+ * monitor_report_health_signals sends to the monitor the health signals that
+ * we measured on the primary node, in milliseconds. The monitor sets
+ * switchover to true when it started a switchover away from our node.
  */
 bool
-monitor_print_formation_settings(Monitor *monitor, char *formation)
+monitor_report_health_signals(Monitor *monitor, int64_t nodeId,
+							  double canaryMs, double walFlushMs,
+							  double checkpointSyncMs,
+							  bool *switchover)
 {
-	MonitorAssignedStateParseContext context = { 0 };
 	PGSQL *pgsql = &monitor->pgsql;
-	char *sql =
-		"select context, group_id, node_id, nodename, setting, value "
-		" from pgautofailover.formation_settings($1)"
-		" order by case context when 'formation' then 0 "
-		" when 'primary' then 1 "
-		" when 'node' then 2 else 3 end, "
-		" setting, group_id, node_id";
-	int paramCount = 1;
-	Oid paramTypes[1] = { TEXTOID };
-	const char *paramValues[1] = { formation };
+	const char *sql =
+		"SELECT pgautofailover.report_health_signals($1, $2, $3, $4)";
+	int paramCount = 4;
+	Oid paramTypes[4] = { INT8OID, FLOAT8OID, FLOAT8OID, FLOAT8OID };
+	const char *paramValues[4];
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BOOL, false };
+
+	char canary[BUFSIZE] = { 0 };
+	char walFlush[BUFSIZE] = { 0 };
+	char checkpointSync[BUFSIZE] = { 0 };
+
+	sformat(canary, sizeof(canary), "%.3f", canaryMs);
+	sformat(walFlush, sizeof(walFlush), "%.3f", walFlushMs);
+	sformat(checkpointSync, sizeof(checkpointSync), "%.3f", checkpointSyncMs);
+
+	paramValues[0] = intToString(nodeId).strValue;
+	paramValues[1] = canary;
+	paramValues[2] = walFlush;
+	paramValues[3] = checkpointSync;
 
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
-								   &context, &printFormationSettings))
+								   &context, &parseSingleValueResult))
 	{
-		log_error("Failed to retrieve formation settings from the monitor");
+		log_error("Failed to report health signals of node %" PRId64
+				  " to the monitor", nodeId);
 		return false;
 	}
 
-	if (!context.parsedOK)
+	if (!context.parsedOk)
 	{
-		log_error("Failed to parse formation settings from the monitor "
-				  "for formation \"%s\"", formation);
+		log_error("Failed to parse the result of "
+				  "pgautofailover.report_health_signals()");
 		return false;
 	}
 
+	*switchover = context.boolVal;
+
 	return true;
 }
 
 
 /*
- * printFormationSettings loops over pgautofailover.formation_settings()
- * results and prints them, one per line.
+ * monitor_report_load sends to the monitor the load of our standby node: the
+ * percentage of CPU time spent working and waiting for I/O, the count of
+ * active client connections, and the replay lag in bytes.
  */
-static void
-printFormationSettings(void *ctx, PGresult *result)
+bool
+monitor_report_load(Monitor *monitor, int64_t nodeId,
+					double cpu, double iowait,
+					int activeConnections, int64_t replayLag)
 {
-	MonitorAssignedStateParseContext *context =
-		(MonitorAssignedStateParseContext *) ctx;
-	int index = 0;
-	int nTuples = PQntuples(result);
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql =
+		"SELECT pgautofailover.report_load($1, $2, $3, $4, $5)";
+	int paramCount = 5;
+	Oid paramTypes[5] = { INT8OID, FLOAT8OID, FLOAT8OID, INT4OID, INT8OID };
+	const char *paramValues[5];
 
-	int maxNameSize = 4;        /* "Name" */
-	int maxSettingSize = 7;     /* "Setting" */
-	int maxValueSize = 5;       /* "Value" */
+	IntString nodeIdString = intToString(nodeId);
+	IntString connectionsString = intToString(activeConnections);
+	IntString replayLagString = intToString(replayLag);
 
-	char nameSeparatorHeader[BUFSIZE] = { 0 };
-	char settingSeparatorHeader[BUFSIZE] = { 0 };
-	char valueSeparatorHeader[BUFSIZE] = { 0 };
+	char cpuStr[BUFSIZE] = { 0 };
+	char iowaitStr[BUFSIZE] = { 0 };
+
+	sformat(cpuStr, sizeof(cpuStr), "%.1f", cpu);
+	sformat(iowaitStr, sizeof(iowaitStr), "%.1f", iowait);
+
+	paramValues[0] = nodeIdString.strValue;
+	paramValues[1] = cpuStr;
+	paramValues[2] = iowaitStr;
+	paramValues[3] = connectionsString.strValue;
+	paramValues[4] = replayLagString.strValue;
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   NULL, NULL))
+	{
+		log_error("Failed to report load of node %" PRId64
+				  " to the monitor", nodeId);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * monitor_report_node_inventory reports the versions and key settings of the
+ * given node to the monitor, where they are found in the
+ * pgautofailover.node_inventory view. The settings are given as a JSON object.
+ */
+bool
+monitor_report_node_inventory(Monitor *monitor, int64_t nodeId,
+							  const char *pgAutoctlVersion,
+							  const char *pgVersion,
+							  const char *tuningProfile,
+							  const char *settingsHash,
+							  const char *settings)
+{
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql =
+		"SELECT pgautofailover.report_node_inventory"
+		"($1, $2, $3, $4, $5, $6::jsonb)";
+	int paramCount = 6;
+	Oid paramTypes[6] = {
+		INT8OID, TEXTOID, TEXTOID, TEXTOID, TEXTOID, TEXTOID
+	};
+	const char *paramValues[6];
 
-	if (nTuples == 0)
-	{
-		log_debug("Query returned 0 rows");
-		context->parsedOK = false;
-		return;
-	}
+	IntString nodeIdString = intToString(nodeId);
 
-	if (PQnfields(result) != 6)
-	{
-		log_error("Query returned %d columns, expected 6", PQnfields(result));
-		context->parsedOK = false;
-		return;
-	}
+	paramValues[0] = nodeIdString.strValue;
+	paramValues[1] = pgAutoctlVersion;
+	paramValues[2] = pgVersion;
+	paramValues[3] = IS_EMPTY_STRING_BUFFER(tuningProfile) ? NULL : tuningProfile;
+	paramValues[4] = settingsHash;
+	paramValues[5] = settings;
 
-	for (index = 0; index < nTuples; index++)
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   NULL, NULL))
 	{
-		char *nodename = PQgetvalue(result, index, 3);
-		char *setting = PQgetvalue(result, index, 4);
-		char *value = PQgetvalue(result, index, 5);
+		log_error("Failed to report the inventory of node %" PRId64
+				  " to the monitor", nodeId);
+		return false;
+	}
 
-		if (strlen(nodename) > maxNameSize)
-		{
-			maxNameSize = strlen(nodename);
-		}
+	return true;
+}
 
-		if (strlen(setting) > maxSettingSize)
-		{
-			maxSettingSize = strlen(setting);
-		}
 
-		if (strlen(value) > maxValueSize)
-		{
-			maxValueSize = strlen(value);
-		}
-	}
+/*
+ * monitor_report_crash_recovery reports the progress of the crash recovery
+ * of the given node to the monitor, with the estimated remaining time in
+ * seconds (-1 when unknown). The monitor sets stopRecovery to true when it
+ * would rather have the node cloned again than wait for crash recovery, see
+ * pgautofailover.crash_recovery_max_eta.
+ */
+bool
+monitor_report_crash_recovery(Monitor *monitor, int64_t nodeId,
+							  uint64_t startLSN, uint64_t replayLSN,
+							  uint64_t endLSN, int64_t eta,
+							  bool *stopRecovery)
+{
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql =
+		"SELECT pgautofailover.report_crash_recovery($1, $2, $3, $4, $5)";
+	int paramCount = 5;
+	Oid paramTypes[5] = { INT8OID, LSNOID, LSNOID, LSNOID, INT8OID };
+	const char *paramValues[5];
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BOOL, false };
 
-	(void) prepareHostNameSeparator(nameSeparatorHeader, maxNameSize);
-	(void) prepareHostNameSeparator(settingSeparatorHeader, maxSettingSize);
-	(void) prepareHostNameSeparator(valueSeparatorHeader, maxValueSize);
+	char start[PG_LSN_MAXLENGTH] = { 0 };
+	char replay[PG_LSN_MAXLENGTH] = { 0 };
+	char end[PG_LSN_MAXLENGTH] = { 0 };
 
-	fformat(stdout, "%9s | %*s | %*s | %-*s\n",
-			"Context",
-			maxNameSize, "Name",
-			maxSettingSize, "Setting",
-			maxValueSize, "Value");
+	sformat(start, sizeof(start), "%X/%X",
+			(uint32_t) (startLSN >> 32), (uint32_t) startLSN);
+	sformat(replay, sizeof(replay), "%X/%X",
+			(uint32_t) (replayLSN >> 32), (uint32_t) replayLSN);
+	sformat(end, sizeof(end), "%X/%X",
+			(uint32_t) (endLSN >> 32), (uint32_t) endLSN);
 
-	fformat(stdout, "%9s-+-%*s-+-%*s-+-%*s\n",
-			"---------",
-			maxNameSize, nameSeparatorHeader,
-			maxSettingSize, settingSeparatorHeader,
-			maxValueSize, valueSeparatorHeader);
+	paramValues[0] = intToString(nodeId).strValue;
+	paramValues[1] = start;
+	paramValues[2] = replay;
+	paramValues[3] = end;
+	paramValues[4] = intToString(eta).strValue;
 
-	for (index = 0; index < nTuples; index++)
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &parseSingleValueResult))
 	{
-		char *context = PQgetvalue(result, index, 0);
-
-		/* not used at the moment
-		 * char *group_id = PQgetvalue(result, index, 1);
-		 * char *node_id = PQgetvalue(result, index, 2);
-		 */
-		char *nodename = PQgetvalue(result, index, 3);
-		char *setting = PQgetvalue(result, index, 4);
-		char *value = PQgetvalue(result, index, 5);
+		log_error("Failed to report crash recovery progress of node %" PRId64
+				  " to the monitor", nodeId);
+		return false;
+	}
 
-		fformat(stdout, "%9s | %*s | %*s | %-*s\n",
-				context,
-				maxNameSize, nodename,
-				maxSettingSize, setting,
-				maxValueSize, value);
+	if (!context.parsedOk)
+	{
+		log_error("Failed to parse the result of "
+				  "pgautofailover.report_crash_recovery()");
+		return false;
 	}
 
-	fformat(stdout, "\n");
+	*stopRecovery = context.boolVal;
 
-	context->parsedOK = true;
+	return true;
 }
 
 
 /*
- * monitor_print_formation_settings calls the function
- * pgautofailover.formation_settings on the monitor, and prints a line of
- * output per state record obtained.
+ * monitor_report_rewind reports to the monitor the estimate of the cost of
+ * pg_rewind on the given node, and then its progress. The monitor sets
+ * cloneRather to true when the node should rather be cloned again, see
+ * pgautofailover.rewind_clone_threshold.
  */
 bool
-monitor_print_formation_settings_as_json(Monitor *monitor, char *formation)
+monitor_report_rewind(Monitor *monitor, int64_t nodeId,
+					  uint64_t divergenceBytes, uint64_t databaseBytes,
+					  uint64_t doneBytes, uint64_t totalBytes,
+					  bool *cloneRather)
 {
-	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_STRING, false };
 	PGSQL *pgsql = &monitor->pgsql;
-	char *sql =
-		"with settings as "
-		" ( "
-		"  select * "
-		"    from pgautofailover.formation_settings($1) "
-		" ), "
-		" f(json) as "
-		" ( "
-		"   select jsonb_agg(row_to_json(settings)) "
-		"     from settings "
-		"    where context = 'formation' "
-		" ), "
-		" p(json) as "
-		" ( "
-		"  select jsonb_agg(row_to_json(settings)) "
-		"    from settings "
-		"   where context = 'primary' "
-		" ), "
-		" n(json) as "
-		" ( "
-		"   select jsonb_agg(row_to_json(settings)) "
-		"     from settings "
-		"    where context = 'node' "
-		" ) "
-		"select jsonb_pretty(jsonb_build_object("
-		"'formation', f.json, 'primary', p.json, 'nodes', n.json)) "
-		"  from f, p, n";
-	int paramCount = 1;
-	Oid paramTypes[1] = { TEXTOID };
-	const char *paramValues[1] = { formation };
+	const char *sql =
+		"SELECT pgautofailover.report_rewind($1, $2, $3, $4, $5)";
+	int paramCount = 5;
+	Oid paramTypes[5] = { INT8OID, INT8OID, INT8OID, INT8OID, INT8OID };
+	const char *paramValues[5];
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BOOL, false };
+
+	IntString nodeIdString = intToString(nodeId);
+	IntString divergenceString = intToString(divergenceBytes);
+	IntString databaseString = intToString(databaseBytes);
+	IntString doneString = intToString(doneBytes);
+	IntString totalString = intToString(totalBytes);
+
+	paramValues[0] = nodeIdString.strValue;
+	paramValues[1] = divergenceString.strValue;
+	paramValues[2] = databaseString.strValue;
+	paramValues[3] = doneString.strValue;
+	paramValues[4] = totalString.strValue;
 
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
 								   &context, &parseSingleValueResult))
 	{
-		log_error("Failed to retrieve current state from the monitor");
+		log_error("Failed to report pg_rewind progress of node %" PRId64
+				  " to the monitor", nodeId);
 		return false;
 	}
 
 	if (!context.parsedOk)
 	{
-		log_error("Failed to parse formation settings from the monitor "
-				  "for formation \"%s\"", formation);
-		if (context.strVal)
-		{
-			free(context.strVal);
-		}
+		log_error("Failed to parse the result of "
+				  "pgautofailover.report_rewind()");
 		return false;
 	}
 
-	fformat(stdout, "%s\n", context.strVal);
-	free(context.strVal);
+	*cloneRather = context.boolVal;
 
 	return true;
 }
 
 
 /*
- * monitor_synchronous_standby_names returns the value for the Postgres
- * parameter "synchronous_standby_names" to use for a given group. The setting
- * is computed on the monitor depending on the current values of the formation
- * number_sync_standbys and each node's candidate priority and replication
- * quorum properties.
+ * monitor_report_slot_retention reports to the monitor how much WAL the
+ * replication slot of the node slotNodeId retains on our node. The monitor
+ * sets dropSlot to true when that node is over the formation budget and is
+ * going to be cloned again, see pgautofailover.report_slot_retention.
  */
 bool
-monitor_synchronous_standby_names(Monitor *monitor,
-								  char *formation, int groupId,
-								  char *synchronous_standby_names, int size)
+monitor_report_slot_retention(Monitor *monitor, int64_t nodeId,
+							  int64_t slotNodeId, int64_t retainedBytes,
+							  bool *dropSlot)
 {
 	PGSQL *pgsql = &monitor->pgsql;
-	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_STRING, false };
-
 	const char *sql =
-		"select pgautofailover.synchronous_standby_names($1, $2)";
+		"SELECT pgautofailover.report_slot_retention($1, $2, $3)";
+	int paramCount = 3;
+	Oid paramTypes[3] = { INT8OID, INT8OID, INT8OID };
+	const char *paramValues[3];
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BOOL, false };
 
-	int paramCount = 2;
-	Oid paramTypes[2] = { TEXTOID, INT4OID };
-	const char *paramValues[2] = { 0 };
-	IntString myGroupIdString = intToString(groupId);
+	IntString nodeIdString = intToString(nodeId);
+	IntString slotNodeIdString = intToString(slotNodeId);
+	IntString retainedBytesString = intToString(retainedBytes);
 
-	paramValues[0] = formation;
-	paramValues[1] = myGroupIdString.strValue;
+	paramValues[0] = nodeIdString.strValue;
+	paramValues[1] = slotNodeIdString.strValue;
+	paramValues[2] = retainedBytesString.strValue;
 
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
 								   &context, &parseSingleValueResult))
 	{
-		log_error("Failed to get the synchronous_standby_names setting value "
-				  " from the monitor for formation %s and group %d",
-				  formation, groupId);
-		if (context.strVal)
-		{
-			free(context.strVal);
-		}
+		log_error("Failed to report the WAL retained by the replication slot "
+				  "of node %" PRId64 " to the monitor", slotNodeId);
 		return false;
 	}
 
 	if (!context.parsedOk)
 	{
-		log_error("Failed to get the synchronous_standby_names setting value "
-				  " from the monitor for formation %s and group %d,"
-				  "see above for details",
-				  formation, groupId);
-		if (context.strVal)
-		{
-			free(context.strVal);
-		}
+		log_error("Failed to parse the result of "
+				  "pgautofailover.report_slot_retention()");
 		return false;
 	}
 
-	strlcpy(synchronous_standby_names, context.strVal, size);
-	free(context.strVal);
+	*dropSlot = context.boolVal;
 
 	return true;
 }
@@ -3742,7 +6553,7 @@ monitor_process_notifications(Monitor *monitor,
 							  void *notificationContext,
 							  NotificationProcessingFunction processor)
 {
-	PGconn *connection = monitor->notificationClient.connection;
+	PGSQL *client = monitor_notification_client(monitor);
 	PGnotify *notify;
 
 
@@ -3773,7 +6584,7 @@ monitor_process_notifications(Monitor *monitor,
 		return false;
 	}
 
-	if (!pgsql_listen(&(monitor->notificationClient), channels))
+	if (!pgsql_listen(client, channels))
 	{
 		/* restore signal masks (un block them) now */
 		(void) unblock_signals(&sig_mask_orig);
@@ -3781,7 +6592,7 @@ monitor_process_notifications(Monitor *monitor,
 		return false;
 	}
 
-	if (monitor->notificationClient.connection == NULL)
+	if (client->connection == NULL)
 	{
 		log_warn("Lost connection.");
 
@@ -3797,7 +6608,8 @@ monitor_process_notifications(Monitor *monitor,
 	 *
 	 * https://www.postgresql.org/docs/current/libpq-example.html#LIBPQ-EXAMPLE-2
 	 */
-	int sock = PQsocket(monitor->notificationClient.connection);
+	PGconn *connection = client->connection;
+	int sock = PQsocket(connection);
 
 	if (sock < 0)
 	{
@@ -3835,34 +6647,160 @@ monitor_process_notifications(Monitor *monitor,
 		return true;
 	}
 
-	/* Now check for input */
-	PQconsumeInput(connection);
+	/* Now check for input, the socket is also readable when it's closed */
+	if (!PQconsumeInput(connection))
+	{
+		log_warn("Failed to get monitor notifications: %s",
+				 PQerrorMessage(connection));
+		return false;
+	}
+
 	while ((notify = PQnotifies(connection)) != NULL)
 	{
 		if (strcmp(notify->relname, "log") == 0)
 		{
 			log_info("%s", notify->extra);
 		}
-		else if (strcmp(notify->relname, "state") == 0)
+		else if (strcmp(notify->relname, "state") == 0 ||
+				 strncmp(notify->relname, "state.", 6) == 0)
+		{
+			CurrentNodeState nodeState = { 0 };
+
+			log_trace("received \"%s\" on \"%s\"",
+					  notify->extra, notify->relname);
+
+			/* errors are logged by monitor_parse_state_notification */
+			if (monitor_parse_state_notification(&nodeState,
+												 notify->relname,
+												 notify->extra))
+			{
+				(void) (*processor)(notificationContext, &nodeState);
+			}
+		}
+		else if (strncmp(notify->relname, "slot.", 5) == 0)
 		{
 			CurrentNodeState nodeState = { 0 };
 
-			log_trace("received \"%s\"", notify->extra);
+			log_trace("received \"%s\" on \"%s\"",
+					  notify->extra, notify->relname);
 
-			/* errors are logged by parse_state_notification_message */
-			if (parse_state_notification_message(&nodeState, notify->extra))
+			/* errors are logged by parse_slot_notification_message */
+			if (parse_slot_notification_message(&nodeState,
+												notify->relname,
+												notify->extra))
 			{
 				(void) (*processor)(notificationContext, &nodeState);
 			}
 		}
 		else
 		{
-			log_warn("BUG: received unknown notification on channel \"%s\": %s",
-					 notify->relname, notify->extra);
+			log_warn("BUG: received unknown notification on channel \"%s\": %s",
+					 notify->relname, notify->extra);
+		}
+
+		PQfreemem(notify);
+		PQconsumeInput(connection);
+	}
+
+	return true;
+}
+
+
+/*
+ * monitor_log_notifications is a Notification Processing Function that gets
+ * all the notifications from the monitor and append them to our logs.
+ */
+static void
+monitor_log_notifications(void *context, CurrentNodeState *nodeState)
+{
+	LogNotificationContext *ctx = (LogNotificationContext *) context;
+
+	nodestate_log(nodeState, ctx->logLevel, 0);
+}
+
+
+/*
+ * monitor_get_notifications listens to notifications from the monitor and logs
+ * them all.
+ */
+bool
+monitor_get_notifications(Monitor *monitor, int timeoutMs)
+{
+	char *channels[] = { "state", "log", NULL };
+	LogNotificationContext context = { LOG_INFO };
+
+	return monitor_process_notifications(monitor,
+										 timeoutMs,
+										 channels,
+										 (void *) &context,
+										 &monitor_log_notifications);
+}
+
+
+/*
+ * monitor_poll_state_notifications processes the state change notifications
+ * that the monitor has sent us, without waiting for more. The first call
+ * opens the notification connection and issues LISTEN, and the next calls
+ * only read what's available on that connection, so that callers may poll
+ * often without any extra round-trip to the monitor.
+ *
+ * When groupId is -1 we listen to the state changes of the whole formation,
+ * on the "state" channel.
+ */
+bool
+monitor_poll_state_notifications(Monitor *monitor,
+								 const char *formation,
+								 int groupId,
+								 void *notificationContext,
+								 NotificationProcessingFunction processor)
+{
+	PGSQL *client = &(monitor->notificationClient);
+	PGnotify *notify;
+
+	if (client->connection == NULL)
+	{
+		char stateChannel[NAMEDATALEN] = "state";
+		char *channels[] = { stateChannel, NULL };
+
+		if (groupId >= 0)
+		{
+			(void) monitor_get_state_channel(monitor, formation, groupId,
+											 stateChannel, sizeof(stateChannel));
+		}
+
+		if (!pgsql_listen(client, channels))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+	}
+
+	PGconn *connection = client->connection;
+
+	/* libpq sockets are non-blocking, this only reads what's available */
+	if (!PQconsumeInput(connection))
+	{
+		log_warn("Failed to get monitor notifications: %s",
+				 PQerrorMessage(connection));
+		pgsql_finish(client);
+		return false;
+	}
+
+	while ((notify = PQnotifies(connection)) != NULL)
+	{
+		CurrentNodeState nodeState = { 0 };
+
+		log_trace("received \"%s\" on \"%s\"", notify->extra, notify->relname);
+
+		/* errors are logged by monitor_parse_state_notification */
+		if (monitor_parse_state_notification(&nodeState,
+											 notify->relname,
+											 notify->extra))
+		{
+			(void) (*processor)(notificationContext, &nodeState);
 		}
 
 		PQfreemem(notify);
-		PQconsumeInput(connection);
 	}
 
 	return true;
@@ -3870,33 +6808,24 @@ monitor_process_notifications(Monitor *monitor,
 
 
 /*
- * monitor_log_notifications is a Notification Processing Function that gets
- * all the notifications from the monitor and append them to our logs.
- */
-static void
-monitor_log_notifications(void *context, CurrentNodeState *nodeState)
-{
-	LogNotificationContext *ctx = (LogNotificationContext *) context;
-
-	nodestate_log(nodeState, ctx->logLevel, 0);
-}
-
-
-/*
- * monitor_get_notifications listens to notifications from the monitor and logs
- * them all.
+ * monitor_wait_state_notifications waits for up to timeoutMs for the state
+ * change notifications of the monitor, and calls processor on each of them.
+ * We listen to the "state" channel, where the monitor notifies the changes of
+ * every group, so that a caller may follow many groups at once.
  */
 bool
-monitor_get_notifications(Monitor *monitor, int timeoutMs)
+monitor_wait_state_notifications(Monitor *monitor,
+								 int timeoutMs,
+								 void *notificationContext,
+								 NotificationProcessingFunction processor)
 {
-	char *channels[] = { "state", "log", NULL };
-	LogNotificationContext context = { LOG_INFO };
+	char *channels[] = { "state", NULL };
 
 	return monitor_process_notifications(monitor,
 										 timeoutMs,
 										 channels,
-										 (void *) &context,
-										 &monitor_log_notifications);
+										 notificationContext,
+										 processor);
 }
 
 
@@ -4075,6 +7004,11 @@ monitor_notification_process_wait_for_state_change(void *context,
 	/* here, we received a state change that belongs to our formation/group */
 	ctx->stateHasChanged = true;
 	nodestate_log(nodeState, LOG_INFO, ctx->nodeId);
+
+	if (ctx->transitions != NULL)
+	{
+		(void) group_transitions_update(ctx->transitions, nodeState);
+	}
 }
 
 
@@ -4094,16 +7028,45 @@ monitor_wait_for_state_change(Monitor *monitor,
 							  int timeoutMs,
 							  bool *stateHasChanged)
 {
-	PGconn *connection = monitor->notificationClient.connection;
+	return monitor_wait_for_group_state_change(monitor,
+											   formation,
+											   groupId,
+											   nodeId,
+											   timeoutMs,
+											   NULL,
+											   stateHasChanged);
+}
+
+
+/*
+ * monitor_wait_for_group_state_change implements monitor_wait_for_state_change
+ * and also maintains the given transitions, when not NULL, from the state
+ * change notifications that we receive for our group.
+ */
+bool
+monitor_wait_for_group_state_change(Monitor *monitor,
+									const char *formation,
+									int groupId,
+									int64_t nodeId,
+									int timeoutMs,
+									GroupTransitions *transitions,
+									bool *stateHasChanged)
+{
+	PGconn *connection = monitor_notification_client(monitor)->connection;
 
 	WaitForStateChangeNotificationContext context = {
 		(char *) formation,
 		groupId,
 		nodeId,
-		false                   /* stateHasChanged */
+		false,                  /* stateHasChanged */
+		transitions
 	};
 
-	char *channels[] = { "state", NULL };
+	char stateChannel[NAMEDATALEN] = { 0 };
+	char *channels[] = { stateChannel, NULL };
+
+	instr_time startTime;
+	instr_time duration;
 
 	if (connection == NULL)
 	{
@@ -4111,14 +7074,45 @@ monitor_wait_for_state_change(Monitor *monitor,
 		return false;
 	}
 
-	if (!monitor_process_notifications(
-			monitor,
-			timeoutMs,
-			channels,
-			(void *) &context,
-			&monitor_notification_process_wait_for_state_change))
+	/* only listen to the notifications of our group when possible */
+	(void) monitor_get_state_channel(monitor, formation, groupId,
+									 stateChannel, sizeof(stateChannel));
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	/*
+	 * Notifications about other groups wake us up too: keep waiting until our
+	 * group state has changed, a signal is received, or the timeout expires.
+	 */
+	for (;;)
 	{
-		return false;
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, startTime);
+
+		int remainingMs = timeoutMs - (int) INSTR_TIME_GET_MILLISEC(duration);
+
+		if (remainingMs <= 0)
+		{
+			break;
+		}
+
+		if (!monitor_process_notifications(
+				monitor,
+				remainingMs,
+				channels,
+				(void *) &context,
+				&monitor_notification_process_wait_for_state_change))
+		{
+			*stateHasChanged = context.stateHasChanged;
+			return false;
+		}
+
+		if (context.stateHasChanged ||
+			asked_to_stop || asked_to_stop_fast ||
+			asked_to_reload || asked_to_quit)
+		{
+			break;
+		}
 	}
 
 	*stateHasChanged = context.stateHasChanged;
@@ -4127,6 +7121,263 @@ monitor_wait_for_state_change(Monitor *monitor,
 }
 
 
+/*
+ * monitor_notify_replication_slots_created notifies the standby nodes of our
+ * group that we have just created replication slots, so that the standby
+ * nodes that are waiting for their slot during `pg_autoctl create postgres`
+ * can proceed with pg_basebackup right away.
+ */
+bool
+monitor_notify_replication_slots_created(Monitor *monitor,
+										 const char *formation,
+										 int groupId,
+										 int64_t nodeId)
+{
+	PGSQL *pgsql = &monitor->pgsql;
+	char slotChannel[NAMEDATALEN] = { 0 };
+	char payload[BUFSIZE] = { 0 };
+
+	const char *sql = "SELECT pg_notify($1, $2)";
+	int paramCount = 2;
+	Oid paramTypes[2] = { TEXTOID, TEXTOID };
+	const char *paramValues[2] = { slotChannel, payload };
+
+	if (!monitor_get_slot_channel(formation, groupId,
+								  slotChannel, sizeof(slotChannel)))
+	{
+		log_debug("Skipping replication slot notification: formation "
+				  "name \"%s\" is too long", formation);
+		return true;
+	}
+
+	sformat(payload, sizeof(payload), "%" PRId64, nodeId);
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   NULL, NULL))
+	{
+		log_warn("Failed to notify \"%s\" on the monitor", slotChannel);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * monitor_listen_replication_slots starts listening to the notifications
+ * sent by the primary of the given group when it creates replication slots.
+ * Call it before checking for our replication slot on the primary, so that
+ * we don't miss the notification.
+ */
+bool
+monitor_listen_replication_slots(Monitor *monitor,
+								 const char *formation,
+								 int groupId)
+{
+	char slotChannel[NAMEDATALEN] = { 0 };
+	char *channels[] = { slotChannel, NULL };
+
+	if (!monitor_get_slot_channel(formation, groupId,
+								  slotChannel, sizeof(slotChannel)))
+	{
+		/* monitor_wait_for_replication_slots then sleeps for the timeout */
+		return true;
+	}
+
+	return pgsql_listen(&(monitor->notificationClient), channels);
+}
+
+
+/*
+ * monitor_notification_process_wait_for_replication_slots is a Notification
+ * Processing Function that registers that the primary of our group has
+ * created replication slots.
+ */
+static void
+monitor_notification_process_wait_for_replication_slots(void *context,
+														CurrentNodeState *nodeState)
+{
+	WaitForReplicationSlotNotificationContext *ctx =
+		(WaitForReplicationSlotNotificationContext *) context;
+
+	if (strcmp(nodeState->formation, ctx->formation) != 0 ||
+		nodeState->groupId != ctx->groupId)
+	{
+		return;
+	}
+
+	log_debug("Primary node %" PRId64 " has created replication slots",
+			  nodeState->node.nodeId);
+
+	ctx->slotsCreated = true;
+}
+
+
+/*
+ * monitor_wait_for_replication_slots waits for timeout milliseconds or until
+ * the primary of the given group notifies that it has created replication
+ * slots, whichever comes first. The slotsCreated boolean is set to true when
+ * we have received such a notification.
+ *
+ * Primary nodes that run an older version of pg_autoctl don't send the
+ * notification, so callers still need to check for their slot after the
+ * timeout.
+ */
+bool
+monitor_wait_for_replication_slots(Monitor *monitor,
+								   const char *formation,
+								   int groupId,
+								   int timeoutMs,
+								   bool *slotsCreated)
+{
+	WaitForReplicationSlotNotificationContext context = {
+		(char *) formation,
+		groupId,
+		false                   /* slotsCreated */
+	};
+
+	char slotChannel[NAMEDATALEN] = { 0 };
+	char *channels[] = { slotChannel, NULL };
+
+	instr_time startTime;
+	instr_time duration;
+
+	*slotsCreated = false;
+
+	if (!monitor_get_slot_channel(formation, groupId,
+								  slotChannel, sizeof(slotChannel)))
+	{
+		pg_usleep(timeoutMs * 1000L);
+		return true;
+	}
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	for (;;)
+	{
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, startTime);
+
+		int remainingMs = timeoutMs - (int) INSTR_TIME_GET_MILLISEC(duration);
+
+		if (remainingMs <= 0)
+		{
+			break;
+		}
+
+		if (!monitor_process_notifications(
+				monitor,
+				remainingMs,
+				channels,
+				(void *) &context,
+				&monitor_notification_process_wait_for_replication_slots))
+		{
+			return false;
+		}
+
+		if (context.slotsCreated ||
+			asked_to_stop || asked_to_stop_fast ||
+			asked_to_reload || asked_to_quit)
+		{
+			break;
+		}
+	}
+
+	*slotsCreated = context.slotsCreated;
+
+	return true;
+}
+
+
+/*
+ * group_transitions_reset forgets about the transitions we know of, and
+ * considers that the group state has just changed. We use it when we might
+ * have missed some notifications.
+ */
+void
+group_transitions_reset(GroupTransitions *transitions)
+{
+	transitions->count = 0;
+	transitions->lastChangeTime = time(NULL);
+}
+
+
+/*
+ * group_transitions_update registers the state of a node as seen in a state
+ * change notification: the node is added to the transitions when its goal
+ * state differs from its reported state, and removed otherwise.
+ */
+void
+group_transitions_update(GroupTransitions *transitions,
+						 CurrentNodeState *nodeState)
+{
+	int64_t nodeId = nodeState->node.nodeId;
+	bool inTransition = nodeState->reportedState != nodeState->goalState;
+	uint64_t now = time(NULL);
+
+	transitions->lastChangeTime = now;
+
+	for (int i = 0; i < transitions->count; i++)
+	{
+		if (transitions->nodeIds[i] == nodeId)
+		{
+			if (inTransition)
+			{
+				transitions->seenTimes[i] = now;
+			}
+			else
+			{
+				/* replace this entry with the last one */
+				int last = --(transitions->count);
+
+				transitions->nodeIds[i] = transitions->nodeIds[last];
+				transitions->seenTimes[i] = transitions->seenTimes[last];
+			}
+			return;
+		}
+	}
+
+	if (inTransition && transitions->count < GROUP_TRANSITIONS_MAX_NODES)
+	{
+		int index = (transitions->count)++;
+
+		transitions->nodeIds[index] = nodeId;
+		transitions->seenTimes[index] = now;
+	}
+}
+
+
+/*
+ * group_transitions_count returns how many nodes of the group are in the
+ * middle of a transition. A transition that we have not heard from in expiry
+ * seconds is forgotten: a node might be stuck in a state for a long time, or
+ * we might have missed the notification that it's done.
+ */
+int
+group_transitions_count(GroupTransitions *transitions, int expiry)
+{
+	uint64_t now = time(NULL);
+
+	for (int i = 0; i < transitions->count;)
+	{
+		if ((now - transitions->seenTimes[i]) > expiry)
+		{
+			int last = --(transitions->count);
+
+			transitions->nodeIds[i] = transitions->nodeIds[last];
+			transitions->seenTimes[i] = transitions->seenTimes[last];
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	return transitions->count;
+}
+
+
 /*
  * monitor_report_state_print_headers fetches other nodes array on the monitor
  * and prints a table array on stdout to prepare for notifications output.
@@ -4228,6 +7479,8 @@ monitor_check_report_state(void *context, CurrentNodeState *nodeState)
 			NodeStateToString(nodeState->reportedState),
 			NodeStateToString(nodeState->goalState));
 
+	(void) wait_steps_record(ctx->steps, nodeState);
+
 	if (nodeState->goalState == ctx->targetState &&
 		nodeState->reportedState == ctx->targetState &&
 		!ctx->firstLoop)
@@ -4262,6 +7515,7 @@ monitor_wait_until_some_node_reported_state(Monitor *monitor,
 
 	NodeAddressArray nodesArray = { 0 };
 	NodeAddressHeaders headers = { 0 };
+	WaitSteps steps = { 0 };
 
 	WaitUntilStateNotificationContext context = {
 		(char *) formation,
@@ -4269,10 +7523,12 @@ monitor_wait_until_some_node_reported_state(Monitor *monitor,
 		&headers,
 		targetState,
 		false,                  /* failoverIsDone */
-		true                    /* firstLoop */
+		true,                   /* firstLoop */
+		&steps
 	};
 
-	char *channels[] = { "state", NULL };
+	char stateChannel[NAMEDATALEN] = { 0 };
+	char *channels[] = { stateChannel, NULL };
 
 	uint64_t start = time(NULL);
 
@@ -4282,6 +7538,12 @@ monitor_wait_until_some_node_reported_state(Monitor *monitor,
 		return false;
 	}
 
+	/* only listen to the notifications of our group when possible */
+	(void) monitor_get_state_channel(monitor, formation, groupId,
+									 stateChannel, sizeof(stateChannel));
+
+	(void) wait_steps_init(&steps);
+
 	/* when timeout <= 0 we just never stop waiting */
 	if (timeout > 0)
 	{
@@ -4293,6 +7555,9 @@ monitor_wait_until_some_node_reported_state(Monitor *monitor,
 	(void) monitor_report_state_print_headers(monitor, formation, groupId,
 											  nodeKind, &nodesArray, &headers);
 
+	/* we only needed the nodes to compute the headers */
+	nodeAddressArrayFree(&nodesArray);
+
 	while (!context.failoverIsDone)
 	{
 		/* when timeout <= 0 we just never stop waiting */
@@ -4325,6 +7590,8 @@ monitor_wait_until_some_node_reported_state(Monitor *monitor,
 	/* disconnect from monitor */
 	pgsql_finish(&monitor->notificationClient);
 
+	(void) wait_steps_log(&steps);
+
 	return context.failoverIsDone;
 }
 
@@ -4378,6 +7645,8 @@ monitor_check_node_report_state(void *context, CurrentNodeState *nodeState)
 			NodeStateToString(nodeState->reportedState),
 			NodeStateToString(nodeState->goalState));
 
+	(void) wait_steps_record(ctx->steps, nodeState);
+
 	for (int i = 0; i < ctx->targetStatesLength; i++)
 	{
 		if (nodeState->goalState == ctx->targetStates[i] &&
@@ -4417,6 +7686,7 @@ monitor_wait_until_node_reported_state(Monitor *monitor,
 
 	NodeAddressArray nodesArray = { 0 };
 	NodeAddressHeaders headers = { 0 };
+	WaitSteps steps = { 0 };
 
 	WaitUntilNodeStateNotificationContext context = {
 		(char *) formation,
@@ -4426,10 +7696,12 @@ monitor_wait_until_node_reported_state(Monitor *monitor,
 		targetStates,
 		targetStatesLength,
 		false,                  /* done */
-		true                    /* firstLoop */
+		true,                   /* firstLoop */
+		&steps
 	};
 
-	char *channels[] = { "state", NULL };
+	char stateChannel[NAMEDATALEN] = { 0 };
+	char *channels[] = { stateChannel, NULL };
 
 	uint64_t start = time(NULL);
 
@@ -4439,9 +7711,18 @@ monitor_wait_until_node_reported_state(Monitor *monitor,
 		return false;
 	}
 
+	/* only listen to the notifications of our group when possible */
+	(void) monitor_get_state_channel(monitor, formation, groupId,
+									 stateChannel, sizeof(stateChannel));
+
+	(void) wait_steps_init(&steps);
+
 	(void) monitor_report_state_print_headers(monitor, formation, groupId,
 											  nodeKind, &nodesArray, &headers);
 
+	/* we only needed the nodes to compute the headers */
+	nodeAddressArrayFree(&nodesArray);
+
 	while (!context.done)
 	{
 		uint64_t now = time(NULL);
@@ -4467,10 +7748,87 @@ monitor_wait_until_node_reported_state(Monitor *monitor,
 	/* disconnect from monitor */
 	pgsql_finish(&monitor->notificationClient);
 
+	(void) wait_steps_log(&steps);
+
 	return context.done;
 }
 
 
+/*
+ * wait_steps_init starts the clock for a new wait.
+ */
+static void
+wait_steps_init(WaitSteps *steps)
+{
+	steps->count = 0;
+	INSTR_TIME_SET_CURRENT(steps->startTime);
+}
+
+
+/*
+ * wait_steps_record registers a state change notification received while
+ * waiting, with the time elapsed since the beginning of the wait.
+ */
+static void
+wait_steps_record(WaitSteps *steps, CurrentNodeState *nodeState)
+{
+	instr_time duration;
+
+	if (steps == NULL || steps->count >= WAIT_STEPS_MAX_COUNT)
+	{
+		return;
+	}
+
+	WaitStep *step = &(steps->steps[steps->count++]);
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, steps->startTime);
+
+	step->elapsedMs = INSTR_TIME_GET_MILLISEC(duration);
+	step->nodeId = nodeState->node.nodeId;
+	step->reportedState = nodeState->reportedState;
+	step->goalState = nodeState->goalState;
+
+	strlcpy(step->name, nodeState->node.name, sizeof(step->name));
+}
+
+
+/*
+ * wait_steps_log logs the state changes received while waiting, with the
+ * time it took to reach each of them, from the beginning of the wait and
+ * from the previous step.
+ */
+static void
+wait_steps_log(WaitSteps *steps)
+{
+	double previousMs = 0.0;
+
+	if (steps->count == 0)
+	{
+		return;
+	}
+
+	log_info("Received %d state changes in %.0f ms:",
+			 steps->count, steps->steps[steps->count - 1].elapsedMs);
+
+	for (int i = 0; i < steps->count; i++)
+	{
+		WaitStep *step = &(steps->steps[i]);
+
+		log_info("%8.0f ms (+%6.0f ms): node %" PRId64 " \"%s\" "
+				 "is \"%s\", assigned \"%s\"",
+				 step->elapsedMs,
+				 step->elapsedMs - previousMs,
+				 step->nodeId,
+				 step->name,
+				 NodeStateToString(step->reportedState),
+				 NodeStateToString(step->goalState));
+
+		previousMs = step->elapsedMs;
+	}
+}
+
+
 /*
  * monitor_get_extension_version gets the current extension version from the
  * Monitor's Postgres catalog pg_available_extensions.
@@ -24,8 +24,50 @@ typedef struct Monitor
 	PGSQL pgsql;
 	PGSQL notificationClient;
 	MonitorConfig config;
+
+	/* pgautofailover.group_notifications, fetched once from the monitor */
+	bool groupNotificationsChecked;
+	bool groupNotifications;
+
+	/* wait for notifications on the pgsql connection, see monitor.c */
+	bool singleConnection;
+
+	/* read-only endpoint, such as a hot standby of the monitor */
+	PGSQL readClient;
+	bool hasReadClient;
+	bool readClientIsFresh;
+	uint64_t readClientCheckTime;   /* epoch */
 } Monitor;
 
+/*
+ * GroupTransitions tracks the nodes of our group that are in the middle of a
+ * transition, as seen in the state change notifications from the monitor: a
+ * node is in transition when its goal state differs from its reported state.
+ */
+#define GROUP_TRANSITIONS_MAX_NODES 32
+
+typedef struct GroupTransitions
+{
+	int count;
+	int64_t nodeIds[GROUP_TRANSITIONS_MAX_NODES];
+	uint64_t seenTimes[GROUP_TRANSITIONS_MAX_NODES];    /* epoch */
+
+	uint64_t lastChangeTime;                            /* epoch */
+} GroupTransitions;
+
+/*
+ * When the node is in a transition, node_active also returns the primary
+ * node and the synchronous_standby_names of its group, which the transitions
+ * need, saving a round trip to the monitor for each of them.
+ */
+typedef struct MonitorGroupSettings
+{
+	bool hasPrimary;
+	NodeAddress primaryNode;
+	bool hasSynchronousStandbyNames;
+	char synchronousStandbyNames[BUFSIZE];
+} MonitorGroupSettings;
+
 typedef struct MonitorAssignedState
 {
 	char name[_POSIX_HOST_NAME_MAX];
@@ -34,8 +76,31 @@ typedef struct MonitorAssignedState
 	NodeState state;
 	int candidatePriority;
 	bool replicationQuorum;
+	int64_t topologyVersion;
+	int leaseDurationMs;
+	int64_t traceId;            /* decision that assigned state, 0 if unknown */
+	MonitorGroupSettings groupSettings;
 } MonitorAssignedState;
 
+/*
+ * SwitchoverGroup is a group where pgautofailover.perform_switchover_away_from_cluster
+ * has started a switchover, and the standby node that it promotes there.
+ */
+#define SWITCHOVER_GROUPS_MAX_COUNT 1024
+
+typedef struct SwitchoverGroup
+{
+	int groupId;
+	int64_t nodeId;
+	char nodeName[_POSIX_HOST_NAME_MAX];
+} SwitchoverGroup;
+
+typedef struct SwitchoverGroupArray
+{
+	int count;
+	SwitchoverGroup groups[SWITCHOVER_GROUPS_MAX_COUNT];
+} SwitchoverGroupArray;
+
 typedef struct StateNotification
 {
 	char message[BUFSIZE];
@@ -71,6 +136,7 @@ typedef struct MonitorEvent
 } MonitorEvent;
 
 #define EVENTS_ARRAY_MAX_COUNT 1024
+#define EVENTS_STREAM_PAGE_SIZE 1000
 
 typedef struct MonitorEventsArray
 {
@@ -90,10 +156,21 @@ typedef struct CoordinatorNodeAddress
 	NodeAddress node;
 } CoordinatorNodeAddress;
 
+/* formation names as listed on the monitor, for --all-formations */
+#define FORMATION_ARRAY_MAX_COUNT 128
+
+typedef struct FormationNamesArray
+{
+	int count;
+	char names[FORMATION_ARRAY_MAX_COUNT][NAMEDATALEN];
+} FormationNamesArray;
+
 #define NODE_FORMAT "%" PRId64 " \"%s\" (%s:%d)"
 
 bool monitor_init(Monitor *monitor, char *url);
+bool monitor_init_read_client(Monitor *monitor, char *url);
 void monitor_setup_notifications(Monitor *monitor, int groupId, int64_t nodeId);
+PGSQL * monitor_notification_client(Monitor *monitor);
 bool monitor_has_received_notifications(Monitor *monitor);
 bool monitor_process_state_notification(int notificationGroupId,
 										int64_t notificationNodeId,
@@ -106,6 +183,9 @@ bool monitor_retryable_error(const char *sqlstate);
 
 bool monitor_get_nodes(Monitor *monitor, char *formation, int groupId,
 					   NodeAddressArray *nodeArray);
+bool monitor_parse_nodes_result(PGresult *result, NodeAddressArray *nodesArray);
+bool monitor_parse_current_state_result(PGresult *result,
+										CurrentNodeStateArray *nodesArray);
 bool monitor_print_nodes(Monitor *monitor, char *formation, int groupId);
 bool monitor_print_nodes_as_json(Monitor *monitor, char *formation, int groupId);
 bool monitor_get_other_nodes(Monitor *monitor,
@@ -120,6 +200,7 @@ bool monitor_print_other_nodes_as_json(Monitor *monitor,
 
 bool monitor_get_primary(Monitor *monitor, char *formation, int groupId,
 						 NodeAddress *node);
+bool monitor_get_upstream(Monitor *monitor, int64_t nodeId, NodeAddress *node);
 bool monitor_get_coordinator(Monitor *monitor, char *formation,
 							 CoordinatorNodeAddress *coordinatorNodeAddress);
 bool monitor_get_most_advanced_standby(Monitor *monitor,
@@ -141,12 +222,26 @@ bool monitor_register_node(Monitor *monitor,
 						   char *citusClusterName,
 						   bool *mayRetry,
 						   MonitorAssignedState *assignedState);
+bool monitor_register_nodes(Monitor *monitor, char *formation, char *dbname,
+							char *nodesJSON, bool outputJSON);
 bool monitor_node_active(Monitor *monitor,
 						 char *formation, int64_t nodeId,
 						 int groupId, NodeState currentState,
 						 bool pgIsRunning, int currentTLI,
-						 char *currentLSN, char *pgsrSyncState,
+						 char *currentLSN, char *replayLSN,
+						 char *pgsrSyncState,
+						 StandbyLSNs *standbyLSNs,
 						 MonitorAssignedState *assignedState);
+bool monitor_node_active_get_other_nodes(Monitor *monitor,
+										 char *formation, int64_t nodeId,
+										 int groupId, NodeState currentState,
+										 bool pgIsRunning, int currentTLI,
+										 char *currentLSN, char *replayLSN,
+										 char *pgsrSyncState,
+										 StandbyLSNs *standbyLSNs,
+										 MonitorAssignedState *assignedState,
+										 NodeAddressArray *nodeArray,
+										 bool *otherNodesOK);
 bool monitor_get_node_replication_settings(Monitor *monitor,
 										   NodeReplicationSettings *settings);
 bool monitor_set_node_candidate_priority(Monitor *monitor,
@@ -159,6 +254,34 @@ bool monitor_get_formation_number_sync_standbys(Monitor *monitor, char *formatio
 												int *numberSyncStandbys);
 bool monitor_set_formation_number_sync_standbys(Monitor *monitor, char *formation,
 												int numberSyncStandbys);
+bool monitor_get_formation_target_recovery_seconds(Monitor *monitor,
+												   char *formation,
+												   int *targetRecoverySeconds);
+bool monitor_set_formation_target_recovery_seconds(Monitor *monitor,
+												   char *formation,
+												   int targetRecoverySeconds);
+bool monitor_get_formation_slot_retention_budget(Monitor *monitor,
+												 char *formation,
+												 int *budgetMB);
+bool monitor_set_formation_slot_retention_budget(Monitor *monitor,
+												 char *formation,
+												 int budgetMB);
+bool monitor_set_formation_remote_wal_compression(Monitor *monitor,
+												  char *formation,
+												  char *method);
+bool monitor_get_node_wal_compression(Monitor *monitor, int64_t nodeId,
+									  char *method, size_t size);
+bool monitor_get_formation_monitor(Monitor *monitor, char *formation,
+								   char *monitorURI, size_t size);
+bool monitor_export_formation(Monitor *monitor, char *formation, char **export);
+bool monitor_import_formation(Monitor *monitor, const char *export,
+							  int *nodeCount);
+bool monitor_forward_formation(Monitor *monitor, char *formation,
+							   char *monitorURI, int *nodeCount);
+bool monitor_set_formation_health_policy(Monitor *monitor,
+										 char *formation,
+										 char *setting,
+										 int value);
 
 bool monitor_remove_by_hostname(Monitor *monitor,
 								char *host, int port, bool force,
@@ -174,20 +297,46 @@ bool monitor_get_groupId_from_name(Monitor *monitor,
 
 bool monitor_perform_failover(Monitor *monitor, char *formation, int group);
 bool monitor_perform_promotion(Monitor *monitor, char *formation, char *name);
+bool monitor_perform_switchover_away_from_cluster(Monitor *monitor,
+												  char *formation,
+												  char *cluster,
+												  int maxGroups,
+												  SwitchoverGroupArray *groupsArray);
 
 bool monitor_get_current_state(Monitor *monitor, char *formation, int group,
 							   CurrentNodeStateArray *nodesArray);
 bool monitor_get_last_events(Monitor *monitor, char *formation, int group,
 							 int count,
 							 MonitorEventsArray *monitorEventsArray);
+bool monitor_get_events_since(Monitor *monitor, char *formation, int group,
+							  int64_t eventId, int count,
+							  MonitorEventsArray *monitorEventsArray,
+							  int64_t *watermark);
 bool monitor_print_state(Monitor *monitor, char *formation, int group);
 bool monitor_print_last_events(Monitor *monitor,
-							   char *formation, int group, int count);
+							   char *formation, int group,
+							   char *eventType, int count);
 bool monitor_print_state_as_json(Monitor *monitor, char *formation, int group);
+bool monitor_get_formation_names(Monitor *monitor,
+								 FormationNamesArray *formationsArray);
+bool monitor_print_every_formation_state(Monitor *monitor);
+bool monitor_print_every_formation_state_as_json(Monitor *monitor);
 bool monitor_print_last_events_as_json(Monitor *monitor,
 									   char *formation, int group,
-									   int count,
+									   char *eventType, int count,
 									   FILE *stream);
+void monitor_print_events_header(void);
+bool monitor_stream_events(Monitor *monitor, char *formation, int group,
+						   const char *sinceTime, bool outputJSON,
+						   int64_t *lastEventId);
+bool monitor_create_event_stream(Monitor *monitor, const char *slotName);
+bool monitor_drop_event_stream(Monitor *monitor, const char *slotName);
+bool monitor_stream_slot_events(Monitor *monitor, const char *slotName,
+								int *eventCount);
+bool monitor_print_last_failovers(Monitor *monitor, char *formation, int count);
+bool monitor_print_last_failovers_as_json(Monitor *monitor,
+										  char *formation, int count,
+										  FILE *stream);
 
 bool monitor_print_every_formation_uri(Monitor *monitor, const SSLOptions *ssl);
 bool monitor_print_every_formation_uri_as_json(Monitor *monitor,
@@ -209,6 +358,8 @@ bool monitor_count_failover_candidates(Monitor *monitor,
 
 bool monitor_print_formation_settings(Monitor *monitor, char *formation);
 bool monitor_print_formation_settings_as_json(Monitor *monitor, char *formation);
+bool monitor_print_every_formation_settings(Monitor *monitor);
+bool monitor_print_every_formation_settings_as_json(Monitor *monitor);
 
 bool monitor_formation_uri(Monitor *monitor,
 						   const char *formation,
@@ -216,17 +367,53 @@ bool monitor_formation_uri(Monitor *monitor,
 						   const SSLOptions *ssl,
 						   char *connectionString,
 						   size_t size);
+bool monitor_formation_readonly_uri(Monitor *monitor,
+									const char *formation,
+									const char *citusClusterName,
+									const SSLOptions *ssl,
+									int64_t maxLag,
+									bool preferStandby,
+									char *connectionString,
+									size_t size);
 
 bool monitor_synchronous_standby_names(Monitor *monitor,
 									   char *formation, int groupId,
 									   char *synchronous_standby_names,
 									   int size);
+bool monitor_print_every_synchronous_standby_names(Monitor *monitor,
+												   bool outputJSON);
 
 bool monitor_update_node_metadata(Monitor *monitor,
 								  int64_t nodeId,
 								  const char *name,
 								  const char *hostname,
 								  int port);
+bool monitor_report_latency(Monitor *monitor, int64_t nodeId,
+							int count, int64_t *peerNodeIds, double *rtt);
+bool monitor_report_health_signals(Monitor *monitor, int64_t nodeId,
+								   double canaryMs, double walFlushMs,
+								   double checkpointSyncMs,
+								   bool *switchover);
+bool monitor_report_load(Monitor *monitor, int64_t nodeId,
+						 double cpu, double iowait,
+						 int activeConnections, int64_t replayLag);
+bool monitor_report_node_inventory(Monitor *monitor, int64_t nodeId,
+								   const char *pgAutoctlVersion,
+								   const char *pgVersion,
+								   const char *tuningProfile,
+								   const char *settingsHash,
+								   const char *settings);
+bool monitor_report_crash_recovery(Monitor *monitor, int64_t nodeId,
+								   uint64_t startLSN, uint64_t replayLSN,
+								   uint64_t endLSN, int64_t eta,
+								   bool *stopRecovery);
+bool monitor_report_rewind(Monitor *monitor, int64_t nodeId,
+						   uint64_t divergenceBytes, uint64_t databaseBytes,
+						   uint64_t doneBytes, uint64_t totalBytes,
+						   bool *cloneRather);
+bool monitor_report_slot_retention(Monitor *monitor, int64_t nodeId,
+								   int64_t slotNodeId, int64_t retainedBytes,
+								   bool *dropSlot);
 bool monitor_set_node_system_identifier(Monitor *monitor,
 										int64_t nodeId,
 										uint64_t system_identifier);
@@ -237,9 +424,38 @@ bool monitor_set_group_system_identifier(Monitor *monitor,
 bool monitor_start_maintenance(Monitor *monitor, int64_t nodeId, bool *mayRetry);
 bool monitor_stop_maintenance(Monitor *monitor, int64_t nodeId, bool *mayRetry);
 
+/*
+ * We have several function that consume monitor notification in different
+ * ways. They all have many things in common:
+ *
+ * - they need to call pselect() and take care of signal processing and race
+ *   conditions
+ *
+ * - they need to filter out some of the notifications
+ *
+ * - they need to process the notifications that have not been filtered out.
+ *
+ * Both the filtering and the processing are specific to each top-level
+ * function that needs to consumer monitor's notifications.
+ */
+typedef void (*NotificationProcessingFunction)(void *context,
+											   CurrentNodeState *nodeState);
+
 bool monitor_get_notifications(Monitor *monitor, int timeoutMs);
+bool monitor_poll_state_notifications(Monitor *monitor,
+									  const char *formation,
+									  int groupId,
+									  void *notificationContext,
+									  NotificationProcessingFunction processor);
+bool monitor_wait_state_notifications(Monitor *monitor,
+									  int timeoutMs,
+									  void *notificationContext,
+									  NotificationProcessingFunction processor);
 bool monitor_wait_until_primary_applied_settings(Monitor *monitor,
 												 const char *formation);
+bool monitor_listen_state_changes(Monitor *monitor,
+								  const char *formation,
+								  int groupId);
 bool monitor_wait_until_some_node_reported_state(Monitor *monitor,
 												 const char *formation,
 												 int groupId,
@@ -259,6 +475,29 @@ bool monitor_wait_for_state_change(Monitor *monitor,
 								   int64_t nodeId,
 								   int timeoutMs,
 								   bool *stateHasChanged);
+bool monitor_wait_for_group_state_change(Monitor *monitor,
+										 const char *formation,
+										 int groupId,
+										 int64_t nodeId,
+										 int timeoutMs,
+										 GroupTransitions *transitions,
+										 bool *stateHasChanged);
+bool monitor_notify_replication_slots_created(Monitor *monitor,
+											  const char *formation,
+											  int groupId,
+											  int64_t nodeId);
+bool monitor_listen_replication_slots(Monitor *monitor,
+									  const char *formation,
+									  int groupId);
+bool monitor_wait_for_replication_slots(Monitor *monitor,
+										const char *formation,
+										int groupId,
+										int timeoutMs,
+										bool *slotsCreated);
+void group_transitions_reset(GroupTransitions *transitions);
+void group_transitions_update(GroupTransitions *transitions,
+							  CurrentNodeState *nodeState);
+int group_transitions_count(GroupTransitions *transitions, int expiry);
 bool monitor_get_extension_version(Monitor *monitor,
 								   MonitorExtensionVersion *version);
 bool monitor_extension_update(Monitor *monitor, const char *targetVersion);
@@ -98,6 +98,42 @@
 	make_strbuf_option("ssl", "key_file", "server-key", \
 					   false, MAXPGPATH, config->pgSetup.ssl.serverKey)
 
+#define OPTION_SUPERVISOR_POSTGRES_RESTART_DELAY(config) \
+	make_int_option_default("supervisor", "postgres_restart_delay", \
+							NULL, false, \
+							&(config->postgres_restart.delayMs), \
+							SUPERVISOR_POSTGRES_RESTART_DELAY_MS)
+
+#define OPTION_SUPERVISOR_POSTGRES_RESTART_MULTIPLIER(config) \
+	make_int_option_default("supervisor", "postgres_restart_multiplier", \
+							NULL, false, \
+							&(config->postgres_restart.multiplier), \
+							SUPERVISOR_POSTGRES_RESTART_MULTIPLIER)
+
+#define OPTION_SUPERVISOR_POSTGRES_RESTART_MAX_DELAY(config) \
+	make_int_option_default("supervisor", "postgres_restart_max_delay", \
+							NULL, false, \
+							&(config->postgres_restart.maxDelayMs), \
+							SUPERVISOR_POSTGRES_RESTART_MAX_DELAY_MS)
+
+#define OPTION_SUPERVISOR_LISTENER_RESTART_DELAY(config) \
+	make_int_option_default("supervisor", "listener_restart_delay", \
+							NULL, false, \
+							&(config->listener_restart.delayMs), \
+							SUPERVISOR_RESTART_DELAY_MS)
+
+#define OPTION_SUPERVISOR_LISTENER_RESTART_MULTIPLIER(config) \
+	make_int_option_default("supervisor", "listener_restart_multiplier", \
+							NULL, false, \
+							&(config->listener_restart.multiplier), \
+							SUPERVISOR_RESTART_MULTIPLIER)
+
+#define OPTION_SUPERVISOR_LISTENER_RESTART_MAX_DELAY(config) \
+	make_int_option_default("supervisor", "listener_restart_max_delay", \
+							NULL, false, \
+							&(config->listener_restart.maxDelayMs), \
+							SUPERVISOR_RESTART_MAX_DELAY_MS)
+
 
 #define SET_INI_OPTIONS_ARRAY(config) \
 	{ \
@@ -118,6 +154,12 @@
 		OPTION_SSL_CRL_FILE(config), \
 		OPTION_SSL_SERVER_CERT(config), \
 		OPTION_SSL_SERVER_KEY(config), \
+		OPTION_SUPERVISOR_POSTGRES_RESTART_DELAY(config), \
+		OPTION_SUPERVISOR_POSTGRES_RESTART_MULTIPLIER(config), \
+		OPTION_SUPERVISOR_POSTGRES_RESTART_MAX_DELAY(config), \
+		OPTION_SUPERVISOR_LISTENER_RESTART_DELAY(config), \
+		OPTION_SUPERVISOR_LISTENER_RESTART_MULTIPLIER(config), \
+		OPTION_SUPERVISOR_LISTENER_RESTART_MAX_DELAY(config), \
 		INI_OPTION_LAST \
 	}
 
@@ -17,6 +17,7 @@
 #include "pgctl.h"
 #include "parson.h"
 #include "pgsql.h"
+#include "supervisor.h"
 
 typedef struct MonitorConfig
 {
@@ -31,6 +32,10 @@ typedef struct MonitorConfig
 
 	/* PostgreSQL setup */
 	PostgresSetup pgSetup;
+
+	/* restart backoff of the supervised services */
+	RestartBackoff postgres_restart;
+	RestartBackoff listener_restart;
 } MonitorConfig;
 
 
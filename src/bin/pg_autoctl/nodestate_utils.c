@@ -585,7 +585,6 @@ bool
 nodestateFilterArrayGroup(CurrentNodeStateArray *nodesArray, const char *name)
 {
 	int groupId = -1;
-	CurrentNodeStateArray nodesInSameGroup = { 0 };
 
 	/* first, find the groupId of the target node name */
 	for (int index = 0; index < nodesArray->count; index++)
@@ -603,32 +602,209 @@ nodestateFilterArrayGroup(CurrentNodeStateArray *nodesArray, const char *name)
 	/* return false when the node name was not found */
 	if (groupId == -1)
 	{
-		/* turn the given nodesArray into a all-zero empty array */
-		memset(nodesArray, 0, sizeof(CurrentNodeStateArray));
+		/* turn the given nodesArray into an empty array */
+		nodesArray->count = 0;
 
 		return false;
 	}
 
-	/* now, build a new nodesArray with only the nodes in the same group */
+	/*
+	 * Now, only keep the nodes in the same group, in place. The entries we
+	 * keep are never after the entries we look at, and the headers are
+	 * preserved.
+	 */
+	int count = 0;
+
 	for (int index = 0; index < nodesArray->count; index++)
 	{
 		CurrentNodeState *nodeState = &(nodesArray->nodes[index]);
 
 		if (nodeState->groupId == groupId)
 		{
-			nodesInSameGroup.nodes[nodesInSameGroup.count] = *nodeState;
-			++nodesInSameGroup.count;
+			nodesArray->nodes[count++] = *nodeState;
 		}
 	}
 
-	/*
-	 * Finally, override the nodesArray parameter with the new contents. Note
-	 * that we want to preserve the headers.
-	 */
-	NodeAddressHeaders headers = nodesArray->headers;
+	nodesArray->count = count;
+
+	return true;
+}
+
+
+/*
+ * nodeAddressArrayReserve ensures that the given array has room for at least
+ * count nodes, growing its allocated memory as needed. The current entries
+ * are kept, and the new entries are set to zero.
+ */
+bool
+nodeAddressArrayReserve(NodeAddressArray *nodesArray, int count)
+{
+	if (count <= nodesArray->capacity)
+	{
+		return true;
+	}
+
+	int capacity = nodesArray->capacity == 0 ? 8 : nodesArray->capacity;
+
+	while (capacity < count)
+	{
+		capacity *= 2;
+	}
+
+	NodeAddress *nodes =
+		(NodeAddress *) realloc(nodesArray->nodes,
+								capacity * sizeof(NodeAddress));
+
+	if (nodes == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return false;
+	}
+
+	memset(nodes + nodesArray->capacity, 0,
+		   (capacity - nodesArray->capacity) * sizeof(NodeAddress));
+
+	nodesArray->nodes = nodes;
+	nodesArray->capacity = capacity;
 
-	*nodesArray = nodesInSameGroup;
-	nodesArray->headers = headers;
+	return true;
+}
+
+
+/*
+ * nodeAddressArrayAppend adds a copy of the given node at the end of the
+ * array.
+ */
+bool
+nodeAddressArrayAppend(NodeAddressArray *nodesArray, NodeAddress *node)
+{
+	if (!nodeAddressArrayReserve(nodesArray, nodesArray->count + 1))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	nodesArray->nodes[nodesArray->count++] = *node;
 
 	return true;
 }
+
+
+/*
+ * nodeAddressArrayCopy sets target to a copy of the source array.
+ */
+bool
+nodeAddressArrayCopy(NodeAddressArray *target, NodeAddressArray *source)
+{
+	if (target == source)
+	{
+		return true;
+	}
+
+	if (!nodeAddressArrayReserve(target, source->count))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (source->count > 0)
+	{
+		memcpy(target->nodes, source->nodes,
+			   source->count * sizeof(NodeAddress));
+	}
+	target->count = source->count;
+
+	return true;
+}
+
+
+/*
+ * nodeAddressArrayMove moves the contents of the source array to the target
+ * array, without copying the nodes, and releases the previous contents of the
+ * target. The source array is then empty.
+ */
+void
+nodeAddressArrayMove(NodeAddressArray *target, NodeAddressArray *source)
+{
+	if (target == source)
+	{
+		return;
+	}
+
+	nodeAddressArrayFree(target);
+
+	*target = *source;
+
+	source->count = 0;
+	source->capacity = 0;
+	source->nodes = NULL;
+}
+
+
+/*
+ * nodeAddressArrayFree releases the memory used by the array, which is then
+ * empty and can be used again.
+ */
+void
+nodeAddressArrayFree(NodeAddressArray *nodesArray)
+{
+	free(nodesArray->nodes);
+
+	nodesArray->count = 0;
+	nodesArray->capacity = 0;
+	nodesArray->nodes = NULL;
+}
+
+
+/*
+ * currentNodeStateArrayReserve ensures that the given array has room for at
+ * least count node states, as nodeAddressArrayReserve does.
+ */
+bool
+currentNodeStateArrayReserve(CurrentNodeStateArray *nodesArray, int count)
+{
+	if (count <= nodesArray->capacity)
+	{
+		return true;
+	}
+
+	int capacity = nodesArray->capacity == 0 ? 8 : nodesArray->capacity;
+
+	while (capacity < count)
+	{
+		capacity *= 2;
+	}
+
+	CurrentNodeState *nodes =
+		(CurrentNodeState *) realloc(nodesArray->nodes,
+									 capacity * sizeof(CurrentNodeState));
+
+	if (nodes == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return false;
+	}
+
+	memset(nodes + nodesArray->capacity, 0,
+		   (capacity - nodesArray->capacity) * sizeof(CurrentNodeState));
+
+	nodesArray->nodes = nodes;
+	nodesArray->capacity = capacity;
+
+	return true;
+}
+
+
+/*
+ * currentNodeStateArrayFree releases the memory used by the array, which is
+ * then empty and can be used again.
+ */
+void
+currentNodeStateArrayFree(CurrentNodeStateArray *nodesArray)
+{
+	free(nodesArray->nodes);
+
+	nodesArray->count = 0;
+	nodesArray->capacity = 0;
+	nodesArray->nodes = NULL;
+}
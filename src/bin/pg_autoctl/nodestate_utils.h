@@ -36,6 +36,8 @@ typedef struct CurrentNodeState
 	int health;
 	double healthLag;
 	double reportLag;
+
+	int64_t eventId;            /* from notifications, 0 when unknown */
 } CurrentNodeState;
 
 
@@ -63,10 +65,12 @@ typedef struct NodeAddressHeaders
 } NodeAddressHeaders;
 
 
+/* see currentNodeStateArrayReserve() and currentNodeStateArrayFree() */
 typedef struct CurrentNodeStateArray
 {
 	int count;
-	CurrentNodeState nodes[NODE_ARRAY_MAX_COUNT];
+	int capacity;
+	CurrentNodeState *nodes;
 	NodeAddressHeaders headers;
 } CurrentNodeStateArray;
 
@@ -105,4 +109,13 @@ void printNodeEntry(NodeAddressHeaders *headers, NodeAddress *node);
 bool nodestateFilterArrayGroup(CurrentNodeStateArray *nodesArray,
 							   const char *name);
 
+bool nodeAddressArrayReserve(NodeAddressArray *nodesArray, int count);
+bool nodeAddressArrayAppend(NodeAddressArray *nodesArray, NodeAddress *node);
+bool nodeAddressArrayCopy(NodeAddressArray *target, NodeAddressArray *source);
+void nodeAddressArrayMove(NodeAddressArray *target, NodeAddressArray *source);
+void nodeAddressArrayFree(NodeAddressArray *nodesArray);
+
+bool currentNodeStateArrayReserve(CurrentNodeStateArray *nodesArray, int count);
+void currentNodeStateArrayFree(CurrentNodeStateArray *nodesArray);
+
 #endif /* NODESTATE_H */
@@ -0,0 +1,1074 @@
+/*
+ * src/bin/pg_autoctl/parallel_clone.c
+ *     Clone a standby node over several connections to its upstream node
+ *
+ * A single pg_basebackup stream is bound by one TCP connection and one
+ * walsender process on the upstream node, which leaves most of a high
+ * bandwidth link unused. When replication.clone_jobs is more than 1, we take
+ * a non-exclusive backup of the upstream node the same way we do for
+ * replication.clone_command, and copy its data directory with that many
+ * processes, each with its own connection, reading the files by chunks with
+ * pg_read_binary_file().
+ *
+ * The files are assigned to the jobs by size, largest first, to the job that
+ * has the least bytes to copy so far, so that the jobs finish at about the
+ * same time. WAL files are not copied: as for replication.clone_command,
+ * Postgres recovers from the backup_label we install, streaming the WAL it
+ * needs from the upstream node, where our replication slot retains it.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "postgres_fe.h"
+#include "portability/instr_time.h"
+
+#include "cli_root.h"
+#include "defaults.h"
+#include "env_utils.h"
+#include "file_utils.h"
+#include "lock_utils.h"
+#include "log.h"
+#include "monitor.h"
+#include "parallel_clone.h"
+#include "pgctl.h"
+#include "pgsetup.h"
+#include "pgsql.h"
+#include "signals.h"
+#include "string_utils.h"
+#include "system_utils.h"
+
+
+/*
+ * The data directory is listed with a recursive query, where we skip the
+ * same contents as pg_basebackup does: the directories that only make sense
+ * on the running upstream node are created empty, and some files are not
+ * copied at all. The listing is ordered so that a directory always comes
+ * before its contents.
+ */
+#define PARALLEL_CLONE_LIST_FILES_SQL \
+	"WITH RECURSIVE files(path, name, size, isdir) AS " \
+	"( " \
+	"  SELECT e.name, e.name, s.size, s.isdir " \
+	"    FROM pg_ls_dir('.', true, false) AS e(name), " \
+	"         LATERAL pg_stat_file(e.name, true) AS s " \
+	"   UNION ALL " \
+	"  SELECT f.path || '/' || e.name, e.name, s.size, s.isdir " \
+	"    FROM files AS f, " \
+	"         LATERAL pg_ls_dir(f.path, true, false) AS e(name), " \
+	"         LATERAL pg_stat_file(f.path || '/' || e.name, true) AS s " \
+	"   WHERE f.isdir " \
+	"     AND f.path NOT IN ('pg_wal', 'pg_replslot', 'pg_dynshmem', " \
+	"                        'pg_notify', 'pg_serial', 'pg_snapshots', " \
+	"                        'pg_stat_tmp', 'pg_subtrans') " \
+	"     AND f.name NOT LIKE 'pgsql\\_tmp%' " \
+	") " \
+	"SELECT path, size, isdir " \
+	"  FROM files " \
+	" WHERE size IS NOT NULL " \
+	"   AND name NOT IN ('postmaster.pid', 'postmaster.opts', " \
+	"                    'backup_label', 'tablespace_map', " \
+	"                    'backup_manifest', 'current_logfiles', " \
+	"                    'pg_internal.init') " \
+	"   AND name NOT LIKE 'pgsql\\_tmp%' " \
+	"ORDER BY path COLLATE \"C\""
+
+#define PARALLEL_CLONE_TABLESPACES_SQL \
+	"SELECT count(*) FROM pg_tablespace " \
+	" WHERE spcname NOT IN ('pg_default', 'pg_global')"
+
+/* Postgres uses pg_control to know where to start, we copy it last */
+#define PG_CONTROL_FILE "global/pg_control"
+
+/* context of the parsing of the data directory listing */
+typedef struct CloneFileListContext
+{
+	char sqlstate[SQLSTATE_LENGTH];
+	bool parsedOk;
+	CloneFileList *list;
+} CloneFileListContext;
+
+
+static bool parallel_clone_list_files(PGSQL *upstreamClient,
+									  CloneFileList *list);
+static void parseCloneFileList(void *ctx, PGresult *result);
+static void parallel_clone_free_files(CloneFileList *list);
+static int parallel_clone_compare_size(const void *a, const void *b);
+static bool parallel_clone_create_directories(const char *backupDir,
+											  CloneFileList *list);
+static bool parallel_clone_run_jobs(const char *connectionString,
+									const char *backupDir,
+									const char *progressFile,
+									CloneFileList *list,
+									CloneJob *jobs, int jobCount);
+static bool parallel_clone_start_job(const char *connectionString,
+									 const char *backupDir,
+									 CloneFileList *list,
+									 CloneJob *job,
+									 uint64_t *progress);
+static bool parallel_clone_job(const char *connectionString,
+							   const char *backupDir,
+							   CloneFileList *list,
+							   CloneJob *job,
+							   uint64_t *progress);
+static bool parallel_clone_copy_file(PGSQL *pgsql,
+									 const char *backupDir,
+									 CloneFile *file,
+									 char *buffer,
+									 CloneJob *job,
+									 instr_time startTime,
+									 uint64_t *progress);
+static void parallel_clone_terminate_jobs(CloneJob *jobs, int jobCount);
+static void parallel_clone_report_progress(const char *progressFile,
+										   BaseBackupProgress *progress,
+										   uint64_t *lastLogTime);
+static bool parallel_clone_install(const char *backupDir, const char *pgdata);
+
+
+/*
+ * parallel_clone copies the data directory of our upstream node in the
+ * replication.backup_directory with upstream->cloneJobs processes, and then
+ * installs it as our PGDATA. The backupLabel is set to the backup_label and
+ * tablespace_map contents that the caller must install in there.
+ *
+ * When the upstream node has user tablespaces, that we can't copy with SQL
+ * functions, we set unsupported to true and return false, so that the caller
+ * uses pg_basebackup instead.
+ */
+bool
+parallel_clone(PostgresSetup *pgSetup,
+			   ReplicationSource *upstream,
+			   BackupLabel *backupLabel,
+			   bool *unsupported)
+{
+	NodeAddress *primaryNode = &(upstream->primaryNode);
+
+	PostgresSetup upstreamSetup = { 0 };
+	PGSQL upstreamClient = { 0 };
+	char connectionString[MAXCONNINFO] = { 0 };
+	char pgpassword[BUFSIZE] = { 0 };
+
+	CloneFileList list = { 0 };
+	CloneJob jobs[PARALLEL_CLONE_MAX_JOBS] = { 0 };
+	int jobCount = upstream->cloneJobs;
+	uint64_t rate = 0;
+
+	int serverVersionNum = 0;
+
+	*unsupported = false;
+
+	if (jobCount > PARALLEL_CLONE_MAX_JOBS)
+	{
+		log_warn("Using %d clone jobs rather than replication.clone_jobs %d",
+				 PARALLEL_CLONE_MAX_JOBS, jobCount);
+		jobCount = PARALLEL_CLONE_MAX_JOBS;
+	}
+
+	if (!parse_backup_rate(upstream->maximumBackupRate, &rate))
+	{
+		log_error("Failed to parse replication.maximum_backup_rate \"%s\"",
+				  upstream->maximumBackupRate);
+		return false;
+	}
+
+	/* prepare a PostgresSetup that allows preparing a connection string */
+	strlcpy(upstreamSetup.username, PG_AUTOCTL_REPLICA_USERNAME, NAMEDATALEN);
+	strlcpy(upstreamSetup.dbname, pgSetup->dbname, NAMEDATALEN);
+	strlcpy(upstreamSetup.pghost, primaryNode->host, _POSIX_HOST_NAME_MAX);
+	upstreamSetup.pgport = primaryNode->port;
+	upstreamSetup.ssl = pgSetup->ssl;
+
+	pg_setup_get_local_connection_string(&upstreamSetup, connectionString);
+
+	if (!pgsql_init(&upstreamClient, connectionString, PGSQL_CONN_UPSTREAM))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	/* the backup is tied to the session, keep it open until we stop it */
+	upstreamClient.connectionStatementType = PGSQL_CONNECTION_MULTI_STATEMENT;
+
+	/* the jobs inherit our environment */
+	if (!IS_EMPTY_STRING_BUFFER(upstream->password))
+	{
+		if (env_exists("PGPASSWORD") &&
+			!get_env_copy("PGPASSWORD", pgpassword, sizeof(pgpassword)))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+		setenv("PGPASSWORD", upstream->password, 1);
+	}
+
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BIGINT, false };
+
+	bool success =
+		pgsql_execute_with_params(&upstreamClient,
+								  PARALLEL_CLONE_TABLESPACES_SQL,
+								  0, NULL, NULL,
+								  &context, &parseSingleValueResult) &&
+		context.parsedOk;
+
+	if (success && context.bigint > 0)
+	{
+		log_warn("The upstream node " NODE_FORMAT " has %" PRIu64 " "
+				 "tablespaces, that replication.clone_jobs does not support",
+				 primaryNode->nodeId,
+				 primaryNode->name,
+				 primaryNode->host,
+				 primaryNode->port,
+				 context.bigint);
+
+		*unsupported = true;
+		success = false;
+	}
+
+	if (success)
+	{
+		log_debug("mkdir -p \"%s\"", upstream->backupDir);
+
+		success = ensure_empty_dir(upstream->backupDir, 0700);
+	}
+
+	bool backupStarted =
+		success &&
+		pgsql_backup_start(&upstreamClient, "pg_auto_failover clone",
+						   &serverVersionNum);
+
+	if (success && !backupStarted)
+	{
+		log_error("Failed to start a backup on the upstream node " NODE_FORMAT,
+				  primaryNode->nodeId,
+				  primaryNode->name,
+				  primaryNode->host,
+				  primaryNode->port);
+		success = false;
+	}
+
+	if (success)
+	{
+		success = parallel_clone_list_files(&upstreamClient, &list);
+	}
+
+	if (success)
+	{
+		char totalBytes[BUFSIZE] = { 0 };
+
+		for (int i = 0; i < jobCount; i++)
+		{
+			jobs[i].index = i;
+			jobs[i].rate = rate / jobCount;
+		}
+
+		(void) parallel_clone_assign_jobs(&list, jobs, jobCount);
+
+		pretty_print_bytes(totalBytes, sizeof(totalBytes), list.totalBytes);
+
+		log_info("Cloning %d files (%s) from " NODE_FORMAT " with %d jobs",
+				 list.count,
+				 totalBytes,
+				 primaryNode->nodeId,
+				 primaryNode->name,
+				 primaryNode->host,
+				 primaryNode->port,
+				 jobCount);
+
+		success =
+			parallel_clone_create_directories(upstream->backupDir, &list) &&
+			parallel_clone_run_jobs(connectionString,
+									upstream->backupDir,
+									upstream->backupProgressFile,
+									&list, jobs, jobCount);
+	}
+
+	/* copy pg_control last, on the connection that holds the backup */
+	if (success)
+	{
+		CloneFile control = { PG_CONTROL_FILE, 0, false, -1 };
+		CloneJob controlJob = { 0 };
+		uint64_t progress = 0;
+		char *buffer = malloc(PARALLEL_CLONE_CHUNK_SIZE * sizeof(char));
+
+		instr_time startTime;
+
+		INSTR_TIME_SET_CURRENT(startTime);
+
+		if (buffer == NULL)
+		{
+			log_error(ALLOCATION_FAILED_ERROR);
+			success = false;
+		}
+		else
+		{
+			success = parallel_clone_copy_file(&upstreamClient,
+											   upstream->backupDir,
+											   &control, buffer, &controlJob,
+											   startTime, &progress);
+			free(buffer);
+		}
+	}
+
+	/* always stop the backup, even when the copy failed */
+	if (backupStarted)
+	{
+		bool stopped =
+			pgsql_backup_stop(&upstreamClient, serverVersionNum, backupLabel);
+
+		if (stopped)
+		{
+			log_info("Stopped the backup of the upstream node at LSN %s",
+					 backupLabel->stopLSN);
+		}
+
+		success = success && stopped;
+	}
+
+	pgsql_finish(&upstreamClient);
+	parallel_clone_free_files(&list);
+
+	/* clean-up the environment again */
+	if (!IS_EMPTY_STRING_BUFFER(upstream->password))
+	{
+		if (IS_EMPTY_STRING_BUFFER(pgpassword))
+		{
+			unsetenv("PGPASSWORD");
+		}
+		else
+		{
+			setenv("PGPASSWORD", pgpassword, 1);
+		}
+	}
+
+	if (!success)
+	{
+		return false;
+	}
+
+	return parallel_clone_install(upstream->backupDir, pgSetup->pgdata);
+}
+
+
+/*
+ * parallel_clone_list_files lists the files and directories of the data
+ * directory of the upstream node that we copy.
+ */
+static bool
+parallel_clone_list_files(PGSQL *upstreamClient, CloneFileList *list)
+{
+	CloneFileListContext context = { { 0 }, false, list };
+
+	if (!pgsql_execute_with_params(upstreamClient,
+								   PARALLEL_CLONE_LIST_FILES_SQL,
+								   0, NULL, NULL,
+								   &context, &parseCloneFileList))
+	{
+		log_error("Failed to list the files of the upstream data directory");
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		log_error("Failed to parse the files of the upstream data directory");
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * parseCloneFileList parses the path, size, and isdir columns of the data
+ * directory listing.
+ */
+static void
+parseCloneFileList(void *ctx, PGresult *result)
+{
+	CloneFileListContext *context = (CloneFileListContext *) ctx;
+	CloneFileList *list = context->list;
+
+	if (PQnfields(result) != 3)
+	{
+		log_error("Query returned %d columns, expected 3", PQnfields(result));
+		context->parsedOk = false;
+		return;
+	}
+
+	int count = PQntuples(result);
+
+	list->files = (CloneFile *) calloc(count > 0 ? count : 1, sizeof(CloneFile));
+
+	if (list->files == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		context->parsedOk = false;
+		return;
+	}
+
+	for (int row = 0; row < count; row++)
+	{
+		CloneFile *file = &(list->files[row]);
+
+		file->path = strdup(PQgetvalue(result, row, 0));
+		file->isdir = strcmp(PQgetvalue(result, row, 2), "t") == 0;
+		file->job = -1;
+
+		if (file->path == NULL)
+		{
+			log_error(ALLOCATION_FAILED_ERROR);
+			context->parsedOk = false;
+			return;
+		}
+
+		list->count = row + 1;
+
+		if (!stringToUInt64(PQgetvalue(result, row, 1), &(file->size)))
+		{
+			log_error("Failed to parse the size \"%s\" of file \"%s\"",
+					  PQgetvalue(result, row, 1), file->path);
+			context->parsedOk = false;
+			return;
+		}
+
+		if (!file->isdir)
+		{
+			list->totalBytes += file->size;
+		}
+	}
+
+	context->parsedOk = true;
+}
+
+
+/*
+ * parallel_clone_free_files frees the memory of the data directory listing.
+ */
+static void
+parallel_clone_free_files(CloneFileList *list)
+{
+	for (int i = 0; i < list->count; i++)
+	{
+		free(list->files[i].path);
+	}
+
+	free(list->files);
+
+	list->count = 0;
+	list->files = NULL;
+}
+
+
+/*
+ * parallel_clone_assign_jobs assigns each file to a job, largest files
+ * first, to the job that has the least bytes to copy so far. The pg_control
+ * file is left out, we copy it last ourselves.
+ */
+void
+parallel_clone_assign_jobs(CloneFileList *list, CloneJob *jobs, int jobCount)
+{
+	CloneFile **sorted = (CloneFile **) calloc(list->count > 0 ? list->count : 1,
+											   sizeof(CloneFile *));
+
+	if (sorted == NULL)
+	{
+		/* assign the files round-robin then */
+		for (int i = 0; i < list->count; i++)
+		{
+			CloneFile *file = &(list->files[i]);
+
+			if (!file->isdir && strcmp(file->path, PG_CONTROL_FILE) != 0)
+			{
+				file->job = i % jobCount;
+				jobs[file->job].assignedBytes += file->size;
+			}
+		}
+		return;
+	}
+
+	int sortedCount = 0;
+
+	for (int i = 0; i < list->count; i++)
+	{
+		CloneFile *file = &(list->files[i]);
+
+		if (!file->isdir && strcmp(file->path, PG_CONTROL_FILE) != 0)
+		{
+			sorted[sortedCount++] = file;
+		}
+	}
+
+	qsort(sorted, sortedCount, sizeof(CloneFile *), parallel_clone_compare_size);
+
+	for (int i = 0; i < sortedCount; i++)
+	{
+		int target = 0;
+
+		for (int j = 1; j < jobCount; j++)
+		{
+			if (jobs[j].assignedBytes < jobs[target].assignedBytes)
+			{
+				target = j;
+			}
+		}
+
+		sorted[i]->job = target;
+		jobs[target].assignedBytes += sorted[i]->size;
+	}
+
+	free(sorted);
+}
+
+
+/*
+ * parallel_clone_compare_size sorts files by decreasing size.
+ */
+static int
+parallel_clone_compare_size(const void *a, const void *b)
+{
+	const CloneFile *fileA = *(const CloneFile **) a;
+	const CloneFile *fileB = *(const CloneFile **) b;
+
+	if (fileA->size == fileB->size)
+	{
+		return 0;
+	}
+
+	return fileA->size > fileB->size ? -1 : 1;
+}
+
+
+/*
+ * parallel_clone_create_directories creates the directories of the listing
+ * in the backup directory, before the jobs copy the files in there.
+ */
+static bool
+parallel_clone_create_directories(const char *backupDir, CloneFileList *list)
+{
+	char path[MAXPGPATH] = { 0 };
+
+	for (int i = 0; i < list->count; i++)
+	{
+		CloneFile *file = &(list->files[i]);
+
+		if (!file->isdir)
+		{
+			continue;
+		}
+
+		join_path_components(path, backupDir, file->path);
+
+		if (mkdir(path, 0700) != 0 && errno != EEXIST)
+		{
+			log_error("Failed to create directory \"%s\": %m", path);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * parallel_clone_run_jobs starts a sub-process per job, and then waits until
+ * they are all done, reporting the progress of the copy meanwhile.
+ */
+static bool
+parallel_clone_run_jobs(const char *connectionString,
+						const char *backupDir,
+						const char *progressFile,
+						CloneFileList *list,
+						CloneJob *jobs, int jobCount)
+{
+	BaseBackupProgress progress = { 0 };
+	uint64_t lastLogTime = 0;
+	int startedCount = 0;
+	int runningCount = 0;
+	bool success = true;
+
+	/* the jobs count the bytes they copied in a shared array */
+	size_t progressSize = jobCount * sizeof(uint64_t);
+	uint64_t *jobsProgress = (uint64_t *) mmap(NULL, progressSize,
+											   PROT_READ | PROT_WRITE,
+											   MAP_SHARED | MAP_ANONYMOUS,
+											   -1, 0);
+
+	if (jobsProgress == MAP_FAILED)
+	{
+		log_error("Failed to allocate shared memory for the clone jobs: %m");
+		return false;
+	}
+
+	bzero((void *) jobsProgress, progressSize);
+
+	progress.totalBytes = list->totalBytes;
+	progress.startTime = (uint64_t) time(NULL);
+
+	for (int i = 0; i < jobCount; i++)
+	{
+		if (!parallel_clone_start_job(connectionString, backupDir, list,
+									  &(jobs[i]), &(jobsProgress[i])))
+		{
+			(void) parallel_clone_terminate_jobs(jobs, startedCount);
+			success = false;
+			break;
+		}
+
+		++startedCount;
+	}
+
+	runningCount = startedCount;
+
+	while (runningCount > 0)
+	{
+		int status;
+		pid_t pid = waitpid(-1, &status, WNOHANG);
+
+		if (pid == -1 && errno == ECHILD)
+		{
+			break;
+		}
+
+		if (pid > 0)
+		{
+			for (int i = 0; i < startedCount; i++)
+			{
+				if (jobs[i].pid == pid)
+				{
+					jobs[i].pid = 0;
+
+					if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+					{
+						log_error("Clone job %d (pid %d) failed", i, pid);
+
+						/* no need to finish the copy of the other jobs */
+						if (success)
+						{
+							(void) parallel_clone_terminate_jobs(jobs,
+																 startedCount);
+						}
+						success = false;
+					}
+				}
+			}
+
+			--runningCount;
+			continue;
+		}
+
+		if (success && (asked_to_stop || asked_to_stop_fast || asked_to_quit))
+		{
+			log_info("Stopping the clone jobs");
+
+			(void) parallel_clone_terminate_jobs(jobs, startedCount);
+			success = false;
+		}
+
+		progress.doneBytes = 0;
+
+		for (int i = 0; i < startedCount; i++)
+		{
+			progress.doneBytes += jobsProgress[i];
+		}
+
+		(void) parallel_clone_report_progress(progressFile, &progress,
+											  &lastLogTime);
+
+		pg_usleep(100 * 1000); /* 100 ms */
+	}
+
+	(void) munmap(jobsProgress, progressSize);
+
+	/* the progress file only makes sense while we are cloning */
+	if (!IS_EMPTY_STRING_BUFFER(progressFile) && file_exists(progressFile))
+	{
+		(void) unlink_file(progressFile);
+	}
+
+	return success;
+}
+
+
+/*
+ * parallel_clone_start_job forks a sub-process that copies the files of the
+ * given job.
+ */
+static bool
+parallel_clone_start_job(const char *connectionString,
+						 const char *backupDir,
+						 CloneFileList *list,
+						 CloneJob *job,
+						 uint64_t *progress)
+{
+	/* Flush stdio channels just before fork, to avoid double-output problems */
+	fflush(stdout);
+	fflush(stderr);
+
+	pid_t fpid = fork();
+
+	switch (fpid)
+	{
+		case -1:
+		{
+			log_error("Failed to fork clone job %d: %m", job->index);
+			return false;
+		}
+
+		case 0:
+		{
+			/* initialize the semaphore used for locking log output */
+			if (!semaphore_init(&log_semaphore))
+			{
+				exit(EXIT_CODE_INTERNAL_ERROR);
+			}
+
+			/* set our logging facility to use our semaphore as a lock */
+			(void) log_set_udata(&log_semaphore);
+			(void) log_set_lock(&semaphore_log_lock_function);
+
+			bool success =
+				parallel_clone_job(connectionString, backupDir, list, job,
+								   progress);
+
+			(void) semaphore_finish(&log_semaphore);
+
+			exit(success ? EXIT_CODE_QUIT : EXIT_CODE_INTERNAL_ERROR);
+		}
+
+		default:
+		{
+			/* fork succeeded, in parent */
+			job->pid = fpid;
+			return true;
+		}
+	}
+}
+
+
+/*
+ * parallel_clone_job copies the files assigned to the given job, on its own
+ * connection to the upstream node.
+ */
+static bool
+parallel_clone_job(const char *connectionString,
+				   const char *backupDir,
+				   CloneFileList *list,
+				   CloneJob *job,
+				   uint64_t *progress)
+{
+	PGSQL pgsql = { 0 };
+	bool success = true;
+
+	instr_time startTime;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	char *buffer = malloc(PARALLEL_CLONE_CHUNK_SIZE * sizeof(char));
+
+	if (buffer == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return false;
+	}
+
+	if (!pgsql_init(&pgsql, (char *) connectionString, PGSQL_CONN_UPSTREAM))
+	{
+		/* errors have already been logged */
+		free(buffer);
+		return false;
+	}
+
+	/* re-use the same connection for all our files */
+	pgsql.connectionStatementType = PGSQL_CONNECTION_MULTI_STATEMENT;
+
+	for (int i = 0; success && i < list->count; i++)
+	{
+		CloneFile *file = &(list->files[i]);
+
+		if (file->job != job->index)
+		{
+			continue;
+		}
+
+		success = parallel_clone_copy_file(&pgsql, backupDir, file, buffer,
+										   job, startTime, progress);
+	}
+
+	pgsql_finish(&pgsql);
+	free(buffer);
+
+	return success;
+}
+
+
+/*
+ * parallel_clone_copy_file copies a file from the upstream data directory to
+ * the backup directory, reading it by chunks until we get a short read, and
+ * sleeping between chunks to keep the job under its rate.
+ *
+ * A file that is removed on the upstream node while we copy it is skipped,
+ * as pg_basebackup does: the WAL replay fixes that.
+ */
+static bool
+parallel_clone_copy_file(PGSQL *pgsql,
+						 const char *backupDir,
+						 CloneFile *file,
+						 char *buffer,
+						 CloneJob *job,
+						 instr_time startTime,
+						 uint64_t *progress)
+{
+	char path[MAXPGPATH] = { 0 };
+	uint64_t offset = 0;
+
+	join_path_components(path, backupDir, file->path);
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+	if (fd < 0)
+	{
+		log_error("Failed to create file \"%s\": %m", path);
+		return false;
+	}
+
+	for (;;)
+	{
+		int bytesRead = 0;
+		bool missing = false;
+
+		if (asked_to_stop || asked_to_stop_fast || asked_to_quit)
+		{
+			close(fd);
+			return false;
+		}
+
+		if (!pgsql_read_binary_file(pgsql, file->path, offset,
+									buffer, PARALLEL_CLONE_CHUNK_SIZE,
+									&bytesRead, &missing))
+		{
+			log_error("Failed to read file \"%s\" from the upstream node",
+					  file->path);
+			close(fd);
+			return false;
+		}
+
+		if (missing)
+		{
+			log_debug("File \"%s\" has been removed on the upstream node",
+					  file->path);
+			close(fd);
+			return unlink_file(path);
+		}
+
+		for (int written = 0; written < bytesRead;)
+		{
+			ssize_t bytes = write(fd, buffer + written, bytesRead - written);
+
+			if (bytes < 0)
+			{
+				log_error("Failed to write file \"%s\": %m", path);
+				close(fd);
+				return false;
+			}
+
+			written += bytes;
+		}
+
+		offset += bytesRead;
+		*progress += bytesRead;
+
+		/* sleep until the time we should have spent copying at our rate */
+		if (job->rate > 0)
+		{
+			instr_time duration;
+
+			INSTR_TIME_SET_CURRENT(duration);
+			INSTR_TIME_SUBTRACT(duration, startTime);
+
+			double expectedUs = (double) *progress * 1000000.0 / job->rate;
+			double elapsedUs = INSTR_TIME_GET_MICROSEC(duration);
+
+			if (expectedUs > elapsedUs)
+			{
+				pg_usleep((long) (expectedUs - elapsedUs));
+			}
+		}
+
+		if (bytesRead < PARALLEL_CLONE_CHUNK_SIZE)
+		{
+			break;
+		}
+	}
+
+	if (fsync(fd) != 0)
+	{
+		log_error("Failed to fsync file \"%s\": %m", path);
+		close(fd);
+		return false;
+	}
+
+	if (close(fd) != 0)
+	{
+		log_error("Failed to close file \"%s\": %m", path);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * parallel_clone_terminate_jobs asks the running jobs to stop.
+ */
+static void
+parallel_clone_terminate_jobs(CloneJob *jobs, int jobCount)
+{
+	for (int i = 0; i < jobCount; i++)
+	{
+		if (jobs[i].pid > 0 && kill(jobs[i].pid, SIGTERM) != 0)
+		{
+			log_warn("Failed to stop clone job %d (pid %d): %m",
+					 i, jobs[i].pid);
+		}
+	}
+}
+
+
+/*
+ * parallel_clone_report_progress writes the progress of the copy to the same
+ * file as pg_basebackup progress, so that pg_autoctl show basebackup works
+ * the same, and logs the progress every 10s.
+ */
+static void
+parallel_clone_report_progress(const char *progressFile,
+							   BaseBackupProgress *progress,
+							   uint64_t *lastLogTime)
+{
+	uint64_t now = (uint64_t) time(NULL);
+
+	if (progress->updateTime == now)
+	{
+		return;
+	}
+
+	progress->updateTime = now;
+
+	if (!IS_EMPTY_STRING_BUFFER(progressFile))
+	{
+		(void) pg_basebackup_write_progress_file(progressFile, progress);
+	}
+
+	if (now - *lastLogTime < 10)
+	{
+		return;
+	}
+
+	*lastLogTime = now;
+
+	uint64_t elapsed = now - progress->startTime;
+
+	if (elapsed == 0 || progress->totalBytes == 0)
+	{
+		return;
+	}
+
+	char done[BUFSIZE] = { 0 };
+	char total[BUFSIZE] = { 0 };
+	char rate[BUFSIZE] = { 0 };
+
+	pretty_print_bytes(done, sizeof(done), progress->doneBytes);
+	pretty_print_bytes(total, sizeof(total), progress->totalBytes);
+	pretty_print_bytes(rate, sizeof(rate), progress->doneBytes / elapsed);
+
+	log_info("Cloned %s of %s (%d%%) at %s/s",
+			 done,
+			 total,
+			 (int) (100 * progress->doneBytes / progress->totalBytes),
+			 rate);
+}
+
+
+/*
+ * parse_backup_rate parses replication.maximum_backup_rate the same way as
+ * pg_basebackup --max-rate does: in kilobytes per second, or with a k or M
+ * unit.
+ */
+bool
+parse_backup_rate(const char *rate, uint64_t *bytesPerSecond)
+{
+	char *unit = NULL;
+
+	if (IS_EMPTY_STRING_BUFFER(rate))
+	{
+		*bytesPerSecond = 0;
+		return true;
+	}
+
+	errno = 0;
+	double value = strtod(rate, &unit);
+
+	if (errno != 0 || unit == rate || value < 0)
+	{
+		return false;
+	}
+
+	while (*unit == ' ')
+	{
+		++unit;
+	}
+
+	if (*unit == '\0' || strcmp(unit, "k") == 0)
+	{
+		*bytesPerSecond = (uint64_t) (value * 1024);
+	}
+	else if (strcmp(unit, "M") == 0)
+	{
+		*bytesPerSecond = (uint64_t) (value * 1024 * 1024);
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * parallel_clone_install replaces pgdata with the backup directory.
+ */
+static bool
+parallel_clone_install(const char *backupDir, const char *pgdata)
+{
+	if (directory_exists(pgdata))
+	{
+		if (!rmtree(pgdata, true))
+		{
+			log_error("Failed to remove directory \"%s\": %m", pgdata);
+			return false;
+		}
+	}
+
+	log_debug("mv \"%s\" \"%s\"", backupDir, pgdata);
+
+	if (rename(backupDir, pgdata) != 0)
+	{
+		log_error("Failed to install the cloned directory \"%s\" in \"%s\": %m",
+				  backupDir, pgdata);
+		return false;
+	}
+
+	return true;
+}
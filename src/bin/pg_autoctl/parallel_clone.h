@@ -0,0 +1,60 @@
+/*
+ * src/bin/pg_autoctl/parallel_clone.h
+ *     Clone a standby node over several connections to its upstream node
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#ifndef PARALLEL_CLONE_H
+#define PARALLEL_CLONE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "pgsetup.h"
+#include "pgsql.h"
+
+/* we don't open more connections than that to the upstream node */
+#define PARALLEL_CLONE_MAX_JOBS 32
+
+/* each job reads the files with pg_read_binary_file() by chunks of 1MB */
+#define PARALLEL_CLONE_CHUNK_SIZE (1024 * 1024)
+
+/* one file or directory of the upstream data directory */
+typedef struct CloneFile
+{
+	char *path;                 /* relative to the data directory */
+	uint64_t size;
+	bool isdir;
+	int job;                    /* -1 when the file is not copied by a job */
+} CloneFile;
+
+typedef struct CloneFileList
+{
+	int count;
+	uint64_t totalBytes;
+	CloneFile *files;
+} CloneFileList;
+
+/* a job copies its files at rate bytes per second, 0 means no limit */
+typedef struct CloneJob
+{
+	int index;
+	uint64_t assignedBytes;
+	uint64_t rate;
+	pid_t pid;
+} CloneJob;
+
+
+bool parallel_clone(PostgresSetup *pgSetup,
+					ReplicationSource *upstream,
+					BackupLabel *backupLabel,
+					bool *unsupported);
+void parallel_clone_assign_jobs(CloneFileList *list,
+								CloneJob *jobs, int jobCount);
+bool parse_backup_rate(const char *rate, uint64_t *bytesPerSecond);
+
+#endif /* PARALLEL_CLONE_H */
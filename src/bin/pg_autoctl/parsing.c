@@ -37,9 +37,18 @@ static bool parse_controldata_field_lsn(const char *controlDataString,
 										char lsn[]);
 
 static bool parse_bool_with_len(const char *value, size_t len, bool *result);
+static bool parse_notification_health(const char *str, int *health);
 
 static int nodeAddressCmpByNodeId(const void *a, const void *b);
 
+/* characters that are kept as-is in the parts of a Postgres URI */
+#define URI_UNRESERVED_CHARS \
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-._~"
+#define URI_QUERY_CHARS URI_UNRESERVED_CHARS "/:@!$'()*+,;"
+
+static void uri_escape(const char *value, const char *allowed,
+					   char *escaped, size_t size);
+
 #define RE_MATCH_COUNT 10
 
 
@@ -281,6 +290,23 @@ parse_controldata(PostgresControlData *pgControlData,
 		log_error("Failed to parse pg_controldata output");
 		return false;
 	}
+
+	/* only used to report crash recovery progress, not mandatory */
+	if (!parse_controldata_field_lsn(control_data_string,
+									 "Latest checkpoint's REDO location",
+									 pgControlData->latestCheckpointRedoLSN))
+	{
+		strlcpy(pgControlData->latestCheckpointRedoLSN, "0/0",
+				PG_LSN_MAXLENGTH);
+	}
+
+	if (!parse_controldata_field_uint32(control_data_string,
+										"Bytes per WAL segment",
+										&(pgControlData->wal_segment_size)))
+	{
+		pgControlData->wal_segment_size = 0;
+	}
+
 	return true;
 }
 
@@ -477,7 +503,11 @@ parse_state_notification_message(CurrentNodeState *nodeState,
 	}
 	strlcpy(nodeState->formation, str, sizeof(nodeState->formation));
 
-	double number = json_object_get_number(jsobj, "groupId");
+	/* monitors before 2.1 do not send the eventId */
+	double number = json_object_get_number(jsobj, "eventId");
+	nodeState->eventId = (int64_t) number;
+
+	number = json_object_get_number(jsobj, "groupId");
 	nodeState->groupId = (int) number;
 
 	number = json_object_get_number(jsobj, "nodeId");
@@ -532,27 +562,179 @@ parse_state_notification_message(CurrentNodeState *nodeState,
 
 	str = (char *) json_object_get_string(jsobj, "health");
 
-	if (streq(str, "unknown"))
+	if (!parse_notification_health(str, &(nodeState->health)))
+	{
+		log_error("Failed to parse health in JSON "
+				  "notification message \"%s\"", message);
+		json_value_free(json);
+		return false;
+	}
+
+	json_value_free(json);
+	return true;
+}
+
+
+/*
+ * parse_group_state_notification_message parses pgautofailover state change
+ * notifications received on a group channel "state.<formation>.<group>". The
+ * formation and group are taken from the channel name, and the message is a
+ * compact JSON array:
+ *
+ *   [nodeId, "name", "host", port, "reportedState", "goalState", "health",
+ *    eventId]
+ *
+ * Monitors before 2.1 do not send the eventId.
+ */
+bool
+parse_group_state_notification_message(CurrentNodeState *nodeState,
+									   const char *channel,
+									   const char *message)
+{
+	const char *prefix = "state.";
+	size_t prefixLen = strlen(prefix);
+	char *groupSeparator = strrchr(channel, '.');
+
+	log_trace("parse_group_state_notification_message: %s: %s",
+			  channel, message);
+
+	if (strncmp(channel, prefix, prefixLen) != 0 ||
+		groupSeparator == NULL ||
+		groupSeparator < channel + prefixLen ||
+		!stringToInt(groupSeparator + 1, &(nodeState->groupId)))
 	{
-		nodeState->health = -1;
+		log_error("Failed to parse formation and group from notification "
+				  "channel \"%s\"", channel);
+		return false;
+	}
+
+	size_t formationLen = groupSeparator - (channel + prefixLen);
+
+	if (formationLen >= sizeof(nodeState->formation))
+	{
+		log_error("Failed to parse formation from notification "
+				  "channel \"%s\"", channel);
+		return false;
+	}
+
+	strlcpy(nodeState->formation, channel + prefixLen, formationLen + 1);
+
+	JSON_Value *json = json_parse_string(message);
+	JSON_Array *jsArray = json_value_get_array(json);
+
+	if (json_type(json) != JSONArray ||
+		json_array_get_count(jsArray) < 7 ||
+		json_array_get_count(jsArray) > 8)
+	{
+		log_error("Failed to parse JSON notification message: \"%s\"", message);
+		json_value_free(json);
+		return false;
+	}
+
+	const char *name = json_array_get_string(jsArray, 1);
+	const char *host = json_array_get_string(jsArray, 2);
+	const char *reportedState = json_array_get_string(jsArray, 4);
+	const char *goalState = json_array_get_string(jsArray, 5);
+	const char *health = json_array_get_string(jsArray, 6);
+
+	if (name == NULL || host == NULL ||
+		reportedState == NULL || goalState == NULL ||
+		!parse_notification_health(health, &(nodeState->health)))
+	{
+		log_error("Failed to parse JSON notification message: \"%s\"", message);
+		json_value_free(json);
+		return false;
+	}
+
+	nodeState->node.nodeId = (int64_t) json_array_get_number(jsArray, 0);
+	strlcpy(nodeState->node.name, name, sizeof(nodeState->node.name));
+	strlcpy(nodeState->node.host, host, sizeof(nodeState->node.host));
+	nodeState->node.port = (int) json_array_get_number(jsArray, 3);
+	nodeState->reportedState = NodeStateFromString(reportedState);
+	nodeState->goalState = NodeStateFromString(goalState);
+	nodeState->eventId = (int64_t) json_array_get_number(jsArray, 7);
+
+	json_value_free(json);
+	return true;
+}
+
+
+/*
+ * parse_slot_notification_message parses the notifications that a primary
+ * keeper sends on the channel "slot.<formation>.<group>" once it has created
+ * replication slots for new standby nodes. The formation and group are taken
+ * from the channel name, and the message is the nodeId of the primary.
+ */
+bool
+parse_slot_notification_message(CurrentNodeState *nodeState,
+								const char *channel,
+								const char *message)
+{
+	const char *prefix = "slot.";
+	size_t prefixLen = strlen(prefix);
+	char *groupSeparator = strrchr(channel, '.');
+
+	log_trace("parse_slot_notification_message: %s: %s", channel, message);
+
+	if (strncmp(channel, prefix, prefixLen) != 0 ||
+		groupSeparator == NULL ||
+		groupSeparator < channel + prefixLen ||
+		!stringToInt(groupSeparator + 1, &(nodeState->groupId)))
+	{
+		log_error("Failed to parse formation and group from notification "
+				  "channel \"%s\"", channel);
+		return false;
+	}
+
+	size_t formationLen = groupSeparator - (channel + prefixLen);
+
+	if (formationLen >= sizeof(nodeState->formation))
+	{
+		log_error("Failed to parse formation from notification "
+				  "channel \"%s\"", channel);
+		return false;
+	}
+
+	strlcpy(nodeState->formation, channel + prefixLen, formationLen + 1);
+
+	if (!stringToInt64(message, &(nodeState->node.nodeId)))
+	{
+		log_error("Failed to parse notification message: \"%s\"", message);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * parse_notification_health parses the health of a node in a notification
+ * message: -1 for unknown, 0 for bad and 1 for good.
+ */
+static bool
+parse_notification_health(const char *str, int *health)
+{
+	if (str == NULL)
+	{
+		return false;
+	}
+	else if (streq(str, "unknown"))
+	{
+		*health = -1;
 	}
 	else if (streq(str, "bad"))
 	{
-		nodeState->health = 0;
+		*health = 0;
 	}
 	else if (streq(str, "good"))
 	{
-		nodeState->health = 1;
+		*health = 1;
 	}
 	else
 	{
-		log_error("Failed to parse health in JSON "
-				  "notification message \"%s\"", message);
-		json_value_free(json);
 		return false;
 	}
 
-	json_value_free(json);
 	return true;
 }
 
@@ -843,40 +1025,128 @@ parse_pguri_info_key_vals(const char *pguri,
  * and values, in a user friendly way. The pguri parameter should point to a
  * memory area that has been allocated by the caller and has at least
  * MAXCONNINFO bytes.
+ *
+ * When the connection string lists several hosts, such as a primary monitor
+ * and its standby monitors, the hostname and port pieces are comma separated
+ * lists, that we zip back together as host1:port1,host2:port2.
+ *
+ * The pieces are percent-encoded, so that a Unix socket directory as host, or
+ * a value that contains an URI separator, is decoded back as-is by libpq, and
+ * IPv6 addresses are written in square brackets.
  */
 bool
 buildPostgresURIfromPieces(URIParams *uriParams, char *pguri)
 {
 	int index = 0;
+	char hostsAndPorts[MAXCONNINFO] = { 0 };
+	char hosts[MAXCONNINFO] = { 0 };
+	char ports[MAXCONNINFO] = { 0 };
+	char username[MAXCONNINFO] = { 0 };
+	char dbname[MAXCONNINFO] = { 0 };
+	char keyword[MAXCONNINFO] = { 0 };
+	char value[MAXCONNINFO] = { 0 };
+
+	strlcpy(hosts, uriParams->hostname, MAXCONNINFO);
+	strlcpy(ports, uriParams->port, MAXCONNINFO);
+
+	char *hostPtr = hosts;
+	char *portPtr = ports;
+	char *host = NULL;
+	char *lastPort = uriParams->port;
+
+	while ((host = strsep(&hostPtr, ",")) != NULL)
+	{
+		/* a single port applies to every host */
+		char *port = strchr(uriParams->port, ',') == NULL
+					 ? uriParams->port
+					 : strsep(&portPtr, ",");
+
+		if (port == NULL)
+		{
+			port = lastPort;
+		}
+		lastPort = port;
+
+		/* an IPv6 address is the only kind of host that contains a colon */
+		bool ipv6 = strchr(host, ':') != NULL;
+		char escapedHost[MAXCONNINFO] = { 0 };
+
+		uri_escape(host,
+				   ipv6 ? URI_UNRESERVED_CHARS ":" : URI_UNRESERVED_CHARS,
+				   escapedHost, MAXCONNINFO);
+
+		sformat(hostsAndPorts, MAXCONNINFO, "%s%s%s%s%s%s%s",
+				hostsAndPorts,
+				hostsAndPorts[0] == '\0' ? "" : ",",
+				ipv6 ? "[" : "",
+				escapedHost,
+				ipv6 ? "]" : "",
+				port[0] == '\0' ? "" : ":",
+				port);
+	}
+
+	uri_escape(uriParams->username, URI_UNRESERVED_CHARS,
+			   username, MAXCONNINFO);
+	uri_escape(uriParams->dbname, URI_UNRESERVED_CHARS,
+			   dbname, MAXCONNINFO);
 
 	sformat(pguri, MAXCONNINFO,
-			"postgres://%s@%s:%s/%s?",
-			uriParams->username,
-			uriParams->hostname,
-			uriParams->port,
-			uriParams->dbname);
+			"postgres://%s@%s/%s?",
+			username,
+			hostsAndPorts,
+			dbname);
 
 	for (index = 0; index < uriParams->parameters.count; index++)
 	{
-		if (index == 0)
+		uri_escape(uriParams->parameters.keywords[index], URI_QUERY_CHARS,
+				   keyword, MAXCONNINFO);
+		uri_escape(uriParams->parameters.values[index], URI_QUERY_CHARS,
+				   value, MAXCONNINFO);
+
+		sformat(pguri, MAXCONNINFO,
+				"%s%s%s=%s",
+				pguri,
+				index == 0 ? "" : "&",
+				keyword,
+				value);
+	}
+
+	return true;
+}
+
+
+/*
+ * uri_escape copies value to escaped, percent-encoding the characters that
+ * are not in the allowed set, as libpq decodes them in a connection URI.
+ */
+static void
+uri_escape(const char *value, const char *allowed, char *escaped, size_t size)
+{
+	size_t length = 0;
+
+	for (const char *ptr = value; *ptr != '\0'; ptr++)
+	{
+		bool keep = strchr(allowed, *ptr) != NULL;
+		int charLength = keep ? 1 : 3;
+
+		if (length + charLength >= size)
 		{
-			sformat(pguri, MAXCONNINFO,
-					"%s%s=%s",
-					pguri,
-					uriParams->parameters.keywords[index],
-					uriParams->parameters.values[index]);
+			break;
+		}
+
+		if (keep)
+		{
+			escaped[length] = *ptr;
 		}
 		else
 		{
-			sformat(pguri, MAXCONNINFO,
-					"%s&%s=%s",
-					pguri,
-					uriParams->parameters.keywords[index],
-					uriParams->parameters.values[index]);
+			sformat(escaped + length, 4, "%%%02X", (unsigned char) *ptr);
 		}
+
+		length += charLength;
 	}
 
-	return true;
+	escaped[length] = '\0';
 }
 
 
@@ -1046,12 +1316,9 @@ parseNodesArray(const char *nodesJSON,
 	JSON_Array *jsArray = json_value_get_array(json);
 	int len = json_array_get_count(jsArray);
 
-	if (NODE_ARRAY_MAX_COUNT < len)
+	if (!nodeAddressArrayReserve(nodesArray, len))
 	{
-		log_error("Failed to parse nodes array which contains "
-				  "%d nodes: pg_autoctl supports up to %d nodes",
-				  len,
-				  NODE_ARRAY_MAX_COUNT);
+		/* errors have already been logged */
 		json_value_free(template);
 		json_value_free(json);
 		return false;
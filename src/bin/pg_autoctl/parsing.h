@@ -35,6 +35,12 @@ bool parse_controldata(PostgresControlData *pgControlData,
 
 bool parse_state_notification_message(CurrentNodeState *nodeState,
 									  const char *message);
+bool parse_group_state_notification_message(CurrentNodeState *nodeState,
+											const char *channel,
+											const char *message);
+bool parse_slot_notification_message(CurrentNodeState *nodeState,
+									 const char *channel,
+									 const char *message);
 
 bool parse_bool(const char *value, bool *result);
 
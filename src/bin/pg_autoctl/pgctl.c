@@ -18,7 +18,9 @@
 
 #include "postgres_fe.h"
 #include "pqexpbuffer.h"
+#include "portability/instr_time.h"
 
+#include "controlfile.h"
 #include "defaults.h"
 #include "env_utils.h"
 #include "file_utils.h"
@@ -28,6 +30,7 @@
 #include "pgsql.h"
 #include "pgsetup.h"
 #include "pgtuning.h"
+#include "probe_cache.h"
 #include "signals.h"
 #include "string_utils.h"
 
@@ -40,6 +43,13 @@
 #define AUTOCTL_CONF_INCLUDE_LINE "include '" AUTOCTL_DEFAULTS_CONF_FILENAME "'"
 #define AUTOCTL_SB_CONF_INCLUDE_LINE "include '" AUTOCTL_STANDBY_CONF_FILENAME "'"
 
+/*
+ * When Postgres fails to start we log the end of its log files, which might
+ * have grown very large, such as after a crash loop.
+ */
+#define PG_LOG_TAIL_MAX_BYTES (64 * 1024)
+#define PG_LOG_TAIL_MAX_LINES 200
+
 static bool pg_include_config(const char *configFilePath,
 							  const char *configIncludeLine,
 							  const char *configIncludeComment);
@@ -55,6 +65,8 @@ static bool prepare_guc_settings_from_pgsetup(const char *configFilePath,
 											  const char *hostname,
 											  bool includeTuning);
 static void log_program_output(Program prog, int outLogLevel, int errorLogLevel);
+static void log_program_record(const char *command, Program *program,
+							   instr_time startTime);
 
 
 static bool prepare_recovery_settings(const char *pgdata,
@@ -63,7 +75,8 @@ static bool prepare_recovery_settings(const char *pgdata,
 									  char *primarySlotName,
 									  char *targetLSN,
 									  char *targetAction,
-									  char *targetTimeline);
+									  char *targetTimeline,
+									  char *restoreCommand);
 
 static bool escape_recovery_conf_string(char *destination,
 										int destinationSize,
@@ -82,38 +95,66 @@ static bool prepare_conninfo_sslmode(PQExpBuffer buffer, SSLOptions sslOptions);
 static bool pg_write_recovery_conf(const char *pgdata,
 								   ReplicationSource *replicationSource);
 static bool pg_write_standby_signal(const char *pgdata,
+									const char *pg_ctl,
 									ReplicationSource *replicationSource);
 static bool ensure_empty_tablespace_dirs(const char *pgdata);
 
+static bool pg_basebackup_run(const char *pg_basebackup,
+							  const char *primaryConnInfo,
+							  ReplicationSource *replicationSource,
+							  const char *incrementalManifest);
+static bool pg_basebackup_incremental(const char *pg_basebackup,
+									  const char *pg_ctl,
+									  const char *primaryConnInfo,
+									  ReplicationSource *replicationSource,
+									  char *combinedDir);
+static bool pg_basebackup_save_incremental_base(const char *pg_ctl,
+												const char *backupDir,
+												const char *baseDir);
+static bool run_backup_program(const char *name, char **args);
+static void pg_basebackup_process_buffer(const char *buffer, bool error);
+static void pg_basebackup_write_progress(bool force);
+static void pg_rewind_process_buffer(const char *buffer, bool error);
+
+static bool timeline_history_cache_read(const char *filename,
+										TimeLineHistory *timelines);
+static bool timeline_history_cache_write(const char *filename,
+										 TimeLineHistory *timelines);
+
+/* progress of the running pg_basebackup, see pg_basebackup_process_buffer */
+static BaseBackupProgress basebackupProgress = { 0 };
+static char basebackupProgressFile[MAXPGPATH] = { 0 };
+
+/* who to tell about the progress of the running pg_rewind */
+static RewindProgressFunction rewindProgressHook = NULL;
+static void *rewindProgressHookContext = NULL;
+
 /*
  * Get pg_ctl --version output in pgSetup->pg_version.
  */
 bool
 pg_ctl_version(PostgresSetup *pgSetup)
 {
-	Program prog = run_program(pgSetup->pg_ctl, "--version", NULL);
+	char versionOutput[BUFSIZE] = { 0 };
 	char pg_version_string[PG_VERSION_STRING_MAX] = { 0 };
 	int pg_version = 0;
 
-	if (prog.returnCode != 0)
+	if (!probe_cache_run(pgSetup->pg_ctl, "--version",
+						 versionOutput, sizeof(versionOutput)))
 	{
-		errno = prog.error;
 		log_error("Failed to run \"pg_ctl --version\" using program \"%s\": %m",
 				  pgSetup->pg_ctl);
-		free_program(&prog);
 		return false;
 	}
 
-	if (!parse_version_number(prog.stdOut,
+	if (!parse_version_number(versionOutput,
 							  pg_version_string,
 							  PG_VERSION_STRING_MAX,
 							  &pg_version))
 	{
 		/* errors have already been logged */
-		free_program(&prog);
 		return false;
 	}
-	free_program(&prog);
 
 	strlcpy(pgSetup->pg_version, pg_version_string, PG_VERSION_STRING_MAX);
 
@@ -139,32 +180,17 @@ set_pg_ctl_from_config_bindir(PostgresSetup *pgSetup, const char *pg_config)
 		return false;
 	}
 
-	Program prog = run_program(pg_config, "--bindir", NULL);
-
-	char *lines[1];
+	char bindir[MAXPGPATH] = { 0 };
 
-	if (prog.returnCode != 0)
+	if (!probe_cache_run(pg_config, "--bindir", bindir, sizeof(bindir)))
 	{
-		errno = prog.error;
 		log_error("Failed to run \"pg_config --bindir\" using program \"%s\": %m",
 				  pg_config);
-		free_program(&prog);
 		return false;
 	}
 
-	if (splitLines(prog.stdOut, lines, 1) != 1)
-	{
-		log_error("Unable to parse output from pg_config --bindir");
-		free_program(&prog);
-		return false;
-	}
-
-	char *bindir = lines[0];
 	join_path_components(pg_ctl, bindir, "pg_ctl");
 
-	/* we're now done with the Program and its output */
-	free_program(&prog);
-
 	if (!file_exists(pg_ctl))
 	{
 		log_error("Failed to find pg_ctl at \"%s\" from PG_CONFIG at \"%s\"",
@@ -180,7 +206,8 @@ set_pg_ctl_from_config_bindir(PostgresSetup *pgSetup, const char *pg_config)
 
 
 /*
- * Read some of the information from pg_controldata output.
+ * Read some of the information from the control file, or from pg_controldata
+ * output when we do not know the layout of the control file.
  */
 bool
 pg_controldata(PostgresSetup *pgSetup, bool missing_ok)
@@ -188,9 +215,9 @@ pg_controldata(PostgresSetup *pgSetup, bool missing_ok)
 	char globalControlPath[MAXPGPATH] = { 0 };
 	char pg_controldata_path[MAXPGPATH] = { 0 };
 
-	if (pgSetup->pgdata[0] == '\0' || pgSetup->pg_ctl[0] == '\0')
+	if (pgSetup->pgdata[0] == '\0')
 	{
-		log_error("BUG: pg_controldata: missing pgSetup pgdata or pg_ctl");
+		log_error("BUG: pg_controldata: missing pgSetup pgdata");
 		return false;
 	}
 
@@ -207,14 +234,50 @@ pg_controldata(PostgresSetup *pgSetup, bool missing_ok)
 		return false;
 	}
 
+	/*
+	 * Read the control file directly when we know its layout, and only run
+	 * the pg_controldata binary for unknown versions of the file.
+	 */
+	switch (controlfile_read(pgSetup->pgdata, &(pgSetup->control)))
+	{
+		case CONTROL_FILE_OK:
+		{
+			return true;
+		}
+
+		case CONTROL_FILE_ERROR:
+		{
+			/* errors have already been logged */
+			return missing_ok;
+		}
+
+		case CONTROL_FILE_UNKNOWN_VERSION:
+		{
+			break;
+		}
+	}
+
+	if (pgSetup->pg_ctl[0] == '\0')
+	{
+		log_error("BUG: pg_controldata: missing pgSetup pg_ctl");
+		return false;
+	}
+
 	/* now find the pg_controldata binary */
 	path_in_same_directory(pgSetup->pg_ctl, "pg_controldata", pg_controldata_path);
 	log_debug("%s %s", pg_controldata_path, pgSetup->pgdata);
 
 	/* We parse the output of pg_controldata, make sure it's as expected */
 	setenv("LANG", "C", 1);
+
+	instr_time startTime;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
 	Program prog = run_program(pg_controldata_path, pgSetup->pgdata, NULL);
 
+	(void) log_program_record("pg_controldata", &prog, startTime);
+
 	if (prog.returnCode == 0)
 	{
 		if (prog.stdOut == NULL)
@@ -672,9 +735,8 @@ find_extension_control_file(const char *pg_ctl, const char *extName)
 {
 	char pg_config_path[MAXPGPATH] = { 0 };
 	char extension_path[MAXPGPATH] = { 0 };
-	char *share_dir;
+	char share_dir[MAXPGPATH] = { 0 };
 	char extension_control_file_name[MAXPGPATH] = { 0 };
-	char *lines[1];
 
 	log_debug("Checking if the %s extension is installed", extName);
 
@@ -684,44 +746,26 @@ find_extension_control_file(const char *pg_ctl, const char *extName)
 		return false;
 	}
 
-	Program prog = run_program(pg_config_path, "--sharedir", NULL);
-
-	if (prog.returnCode == 0)
+	if (!probe_cache_run(pg_config_path, "--sharedir",
+						 share_dir, sizeof(share_dir)))
 	{
-		if (!prog.stdOut)
-		{
-			log_error("Got empty output from pg_config --sharedir");
-			free_program(&prog);
-			return false;
-		}
-		if (splitLines(prog.stdOut, lines, 1) != 1)
-		{
-			log_error("Unable to parse output from pg_config --sharedir");
-			free_program(&prog);
-			return false;
-		}
-		share_dir = lines[0];
-
-		join_path_components(extension_path, share_dir, "extension");
-		sformat(extension_control_file_name, MAXPGPATH, "%s.control", extName);
-		join_path_components(extension_path, extension_path, extension_control_file_name);
-		if (!file_exists(extension_path))
-		{
-			log_error("Failed to find extension control file \"%s\"",
-					  extension_path);
-			free_program(&prog);
-			return false;
-		}
+		log_error("Failed to run \"pg_config --sharedir\" using program "
+				  "\"%s\": %m",
+				  pg_config_path);
+		return false;
 	}
-	else
+
+	join_path_components(extension_path, share_dir, "extension");
+	sformat(extension_control_file_name, MAXPGPATH, "%s.control", extName);
+	join_path_components(extension_path, extension_path, extension_control_file_name);
+
+	if (!file_exists(extension_path))
 	{
-		(void) log_program_output(prog, LOG_INFO, LOG_ERROR);
-		log_error("Failed to run \"%s\", see above for details",
-				  pg_config_path);
-		free_program(&prog);
+		log_error("Failed to find extension control file \"%s\"",
+				  extension_path);
 		return false;
 	}
-	free_program(&prog);
+
 	return true;
 }
 
@@ -1150,6 +1194,7 @@ prepare_guc_settings_from_pgsetup(const char *configFilePath,
 	if (includeTuning)
 	{
 		if (!pgtuning_prepare_guc_settings(postgres_tuning,
+										   pgSetup,
 										   tuning,
 										   sizeof(tuning)))
 		{
@@ -1252,23 +1297,25 @@ ensure_empty_tablespace_dirs(const char *pgdata)
 /*
  * Call pg_basebackup, using a temporary directory for the duration of the data
  * transfer.
+ *
+ * When replication.incremental_base_directory is set, we keep there a copy of
+ * the last backup, and the next time we take an incremental backup on top of
+ * it and combine both with pg_combinebackup (Postgres 17 and later), so that
+ * only the blocks that changed since are sent over. When that's not possible,
+ * we take a full backup.
  */
 bool
 pg_basebackup(const char *pgdata,
 			  const char *pg_ctl,
 			  ReplicationSource *replicationSource)
 {
-	int returnCode;
 	char pg_basebackup[MAXPGPATH];
 
 	NodeAddress *primaryNode = &(replicationSource->primaryNode);
 	char primaryConnInfo[MAXCONNINFO] = { 0 };
 
-	char *args[16];
-	int argsIndex = 0;
-
-	char command[BUFSIZE];
 	char pgpassword[BUFSIZE] = { 0 };
+	char combinedDir[MAXPGPATH] = { 0 };
 
 	log_debug("mkdir -p \"%s\"", replicationSource->backupDir);
 	if (!ensure_empty_dir(replicationSource->backupDir, 0700))
@@ -1317,10 +1364,93 @@ pg_basebackup(const char *pgdata,
 		return false;
 	}
 
+	bool incremental =
+		!IS_EMPTY_STRING_BUFFER(replicationSource->incrementalBaseDir) &&
+		pg_basebackup_incremental(pg_basebackup, pg_ctl, primaryConnInfo,
+								  replicationSource, combinedDir);
+
+	bool success =
+		incremental ||
+		(ensure_empty_dir(replicationSource->backupDir, 0700) &&
+		 pg_basebackup_run(pg_basebackup, primaryConnInfo,
+						   replicationSource, NULL));
+
+	/* clean-up the environment again */
+	if (!IS_EMPTY_STRING_BUFFER(replicationSource->password))
+	{
+		if (IS_EMPTY_STRING_BUFFER(pgpassword))
+		{
+			unsetenv("PGPASSWORD");
+		}
+		else
+		{
+			setenv("PGPASSWORD", pgpassword, 1);
+		}
+	}
+
+	if (!success)
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	const char *backupDir = incremental ? combinedDir : replicationSource->backupDir;
+
+	/* keep a copy of the new backup as the base of the next one */
+	char *baseDir = replicationSource->incrementalBaseDir;
+
+	if (!IS_EMPTY_STRING_BUFFER(baseDir))
+	{
+		(void) pg_basebackup_save_incremental_base(pg_ctl, backupDir, baseDir);
+	}
+
+	/* replace $pgdata with the backup directory */
+	if (directory_exists(pgdata))
+	{
+		if (!rmtree(pgdata, true))
+		{
+			log_error("Failed to remove directory \"%s\": %m", pgdata);
+			return false;
+		}
+	}
+
+	log_debug("mv \"%s\" \"%s\"", backupDir, pgdata);
+
+	if (rename(backupDir, pgdata) != 0)
+	{
+		log_error(
+			"Failed to install pg_basebackup dir " " \"%s\" in \"%s\": %m",
+			backupDir, pgdata);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * pg_basebackup_run runs pg_basebackup to copy the data directory of the
+ * upstream node in replicationSource->backupDir. When incrementalManifest is
+ * not NULL, pg_basebackup only fetches the blocks that changed since the
+ * backup of the given manifest.
+ */
+static bool
+pg_basebackup_run(const char *pg_basebackup,
+				  const char *primaryConnInfo,
+				  ReplicationSource *replicationSource,
+				  const char *incrementalManifest)
+{
+	char *args[20];
+	int argsIndex = 0;
+
+	char command[BUFSIZE];
+	char compress[BUFSIZE] = { 0 };
+	char incremental[BUFSIZE] = { 0 };
+
 	args[argsIndex++] = (char *) pg_basebackup;
 	args[argsIndex++] = "-w";
 	args[argsIndex++] = "-d";
-	args[argsIndex++] = primaryConnInfo;
+	args[argsIndex++] = (char *) primaryConnInfo;
 	args[argsIndex++] = "--pgdata";
 	args[argsIndex++] = replicationSource->backupDir;
 	args[argsIndex++] = "-U";
@@ -1338,8 +1468,46 @@ pg_basebackup(const char *pgdata,
 		args[argsIndex++] = replicationSource->slotName;
 	}
 
+	/*
+	 * We use the plain format, where only server-side compression is
+	 * supported (Postgres 15 and later): the server compresses the data it
+	 * sends, and pg_basebackup decompresses it on the fly.
+	 */
+	if (!IS_EMPTY_STRING_BUFFER(replicationSource->backupCompression))
+	{
+		if (strncmp(replicationSource->backupCompression, "server-", 7) == 0 ||
+			strcmp(replicationSource->backupCompression, "none") == 0)
+		{
+			sformat(compress, sizeof(compress), "--compress=%s",
+					replicationSource->backupCompression);
+			args[argsIndex++] = compress;
+		}
+		else
+		{
+			log_warn("Ignoring replication.backup_compression \"%s\": "
+					 "only server-side compression methods such as "
+					 "server-zstd are supported",
+					 replicationSource->backupCompression);
+		}
+	}
+
+	if (incrementalManifest != NULL)
+	{
+		sformat(incremental, sizeof(incremental), "--incremental=%s",
+				incrementalManifest);
+		args[argsIndex++] = incremental;
+	}
+
 	args[argsIndex] = NULL;
 
+	/* prepare for progress reporting, when we have a file to report to */
+	basebackupProgress = (BaseBackupProgress) { 0 };
+	basebackupProgress.startTime = (uint64_t) time(NULL);
+
+	strlcpy(basebackupProgressFile,
+			replicationSource->backupProgressFile,
+			MAXPGPATH);
+
 	/*
 	 * We do not want to call setsid() when running this program, as the
 	 * pg_basebackup subprogram is not intended to be its own session leader,
@@ -1348,7 +1516,7 @@ pg_basebackup(const char *pgdata,
 	Program program = { 0 };
 
 	(void) initialize_program(&program, args, false);
-	program.processBuffer = &processBufferCallback;
+	program.processBuffer = &pg_basebackup_process_buffer;
 
 	/* log the exact command line we're using */
 	int commandSize = snprintf_program_command_line(&program, command, BUFSIZE);
@@ -1363,22 +1531,22 @@ pg_basebackup(const char *pgdata,
 		log_info("%s", command);
 	}
 
+	instr_time startTime;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
 	(void) execute_subprogram(&program);
 
-	/* clean-up the environment again */
-	if (!IS_EMPTY_STRING_BUFFER(replicationSource->password))
+	(void) log_program_record("pg_basebackup", &program, startTime);
+
+	/* the progress file only makes sense while pg_basebackup is running */
+	if (!IS_EMPTY_STRING_BUFFER(basebackupProgressFile))
 	{
-		if (IS_EMPTY_STRING_BUFFER(pgpassword))
-		{
-			unsetenv("PGPASSWORD");
-		}
-		else
-		{
-			setenv("PGPASSWORD", pgpassword, 1);
-		}
+		(void) unlink_file(basebackupProgressFile);
+		bzero((void *) basebackupProgressFile, MAXPGPATH);
 	}
 
-	returnCode = program.returnCode;
+	int returnCode = program.returnCode;
 	free_program(&program);
 
 	if (returnCode != 0)
@@ -1387,23 +1555,326 @@ pg_basebackup(const char *pgdata,
 		return false;
 	}
 
-	/* replace $pgdata with the backup directory */
-	if (directory_exists(pgdata))
+	return true;
+}
+
+
+/*
+ * pg_basebackup_incremental takes an incremental backup on top of the base
+ * backup kept in replicationSource->incrementalBaseDir, and combines both
+ * into the combinedDir directory, which is then a full backup. When that
+ * fails, the caller takes a full backup instead.
+ */
+static bool
+pg_basebackup_incremental(const char *pg_basebackup,
+						  const char *pg_ctl,
+						  const char *primaryConnInfo,
+						  ReplicationSource *replicationSource,
+						  char *combinedDir)
+{
+	char pg_combinebackup[MAXPGPATH] = { 0 };
+	char manifest[MAXPGPATH] = { 0 };
+	char *baseDir = replicationSource->incrementalBaseDir;
+
+	path_in_same_directory(pg_ctl, "pg_combinebackup", pg_combinebackup);
+	join_path_components(manifest, baseDir, "backup_manifest");
+
+	if (!file_exists(pg_combinebackup))
 	{
-		if (!rmtree(pgdata, true))
+		log_warn("Skipping incremental backup, which requires Postgres 17 "
+				 "or later: \"%s\" does not exist",
+				 pg_combinebackup);
+		return false;
+	}
+
+	if (!file_exists(manifest))
+	{
+		log_info("Taking a full backup, the base of the next incremental "
+				 "backups is kept in \"%s\"", baseDir);
+		return false;
+	}
+
+	if (!pg_basebackup_run(pg_basebackup, primaryConnInfo,
+						   replicationSource, manifest))
+	{
+		log_warn("Failed to take an incremental backup on top of \"%s\", "
+				 "taking a full backup instead",
+				 baseDir);
+		return false;
+	}
+
+	sformat(combinedDir, MAXPGPATH, "%s_combined", replicationSource->backupDir);
+
+	if (directory_exists(combinedDir) && !rmtree(combinedDir, true))
+	{
+		log_error("Failed to remove directory \"%s\": %m", combinedDir);
+		return false;
+	}
+
+	char *args[] = {
+		pg_combinebackup,
+		baseDir,
+		replicationSource->backupDir,
+		"--output",
+		combinedDir,
+		NULL
+	};
+
+	if (!run_backup_program("pg_combinebackup", args))
+	{
+		log_warn("Failed to combine the incremental backup with \"%s\", "
+				 "taking a full backup instead",
+				 baseDir);
+
+		(void) rmtree(combinedDir, true);
+		return false;
+	}
+
+	/* the incremental backup is not needed anymore */
+	if (!rmtree(replicationSource->backupDir, true))
+	{
+		log_warn("Failed to remove directory \"%s\": %m",
+				 replicationSource->backupDir);
+	}
+
+	return true;
+}
+
+
+/*
+ * pg_basebackup_save_incremental_base copies the given full backup to
+ * baseDir, where the next incremental backup finds it. We use
+ * pg_combinebackup with a single full backup to copy it, which also writes
+ * the backup_manifest of the copy. A failure here only means that the next
+ * backup is a full one again.
+ */
+static bool
+pg_basebackup_save_incremental_base(const char *pg_ctl,
+									const char *backupDir,
+									const char *baseDir)
+{
+	char pg_combinebackup[MAXPGPATH] = { 0 };
+	char newBaseDir[MAXPGPATH] = { 0 };
+
+	path_in_same_directory(pg_ctl, "pg_combinebackup", pg_combinebackup);
+
+	if (!file_exists(pg_combinebackup))
+	{
+		/* we already warned about it */
+		return false;
+	}
+
+	sformat(newBaseDir, sizeof(newBaseDir), "%s.new", baseDir);
+
+	if (directory_exists(newBaseDir) && !rmtree(newBaseDir, true))
+	{
+		log_warn("Failed to remove directory \"%s\": %m", newBaseDir);
+		return false;
+	}
+
+	char *args[] = {
+		pg_combinebackup,
+		(char *) backupDir,
+		"--output",
+		newBaseDir,
+		NULL
+	};
+
+	if (!run_backup_program("pg_combinebackup", args))
+	{
+		log_warn("Failed to keep a copy of the backup in \"%s\", "
+				 "the next backup is going to be a full backup",
+				 baseDir);
+
+		(void) rmtree(newBaseDir, true);
+		return false;
+	}
+
+	if (directory_exists(baseDir) && !rmtree(baseDir, true))
+	{
+		log_warn("Failed to remove directory \"%s\": %m", baseDir);
+		return false;
+	}
+
+	log_debug("mv \"%s\" \"%s\"", newBaseDir, baseDir);
+
+	if (rename(newBaseDir, baseDir) != 0)
+	{
+		log_warn("Failed to rename \"%s\" to \"%s\": %m", newBaseDir, baseDir);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * run_backup_program runs the given backup tool and logs its output, and
+ * returns true when it exited successfully.
+ */
+static bool
+run_backup_program(const char *name, char **args)
+{
+	char command[BUFSIZE];
+	Program program = { 0 };
+
+	(void) initialize_program(&program, args, false);
+	program.processBuffer = &processBufferCallback;
+
+	int commandSize = snprintf_program_command_line(&program, command, BUFSIZE);
+
+	if (commandSize >= BUFSIZE)
+	{
+		/* we only display the first BUFSIZE bytes of the real command */
+		log_info("%s...", command);
+	}
+	else
+	{
+		log_info("%s", command);
+	}
+
+	instr_time startTime;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	(void) execute_subprogram(&program);
+
+	(void) log_program_record(name, &program, startTime);
+
+	int returnCode = program.returnCode;
+	free_program(&program);
+
+	if (returnCode != 0)
+	{
+		log_error("Failed to run %s: exit code %d", name, returnCode);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * pg_basebackup_process_buffer logs the output of pg_basebackup, and parses
+ * its --progress lines, which look like the following:
+ *
+ *   123456/7890123 kB (1%), 0/1 tablespace (...ckup/base/16384/2608)
+ */
+static void
+pg_basebackup_process_buffer(const char *buffer, bool error)
+{
+	const char *line = buffer;
+
+	while (line != NULL && *line != '\0')
+	{
+		uint64_t doneKB = 0;
+		uint64_t totalKB = 0;
+
+		if (sscanf(line, " %" SCNu64 "/%" SCNu64 " kB", &doneKB, &totalKB) == 2)
 		{
-			log_error("Failed to remove directory \"%s\": %m", pgdata);
-			return false;
+			basebackupProgress.doneBytes = doneKB * 1024;
+			basebackupProgress.totalBytes = totalKB * 1024;
+
+			(void) pg_basebackup_write_progress(doneKB == totalKB);
+		}
+
+		line = strchr(line, '\n');
+
+		if (line != NULL)
+		{
+			++line;
 		}
 	}
 
-	log_debug("mv \"%s\" \"%s\"", replicationSource->backupDir, pgdata);
+	(void) processBufferCallback(buffer, error);
+}
+
 
-	if (rename(replicationSource->backupDir, pgdata) != 0)
+/*
+ * pg_basebackup_write_progress writes the current pg_basebackup progress to
+ * the progress file, at most once per second unless force is true.
+ */
+static void
+pg_basebackup_write_progress(bool force)
+{
+	uint64_t now = (uint64_t) time(NULL);
+
+	if (IS_EMPTY_STRING_BUFFER(basebackupProgressFile))
 	{
-		log_error(
-			"Failed to install pg_basebackup dir " " \"%s\" in \"%s\": %m",
-			replicationSource->backupDir, pgdata);
+		return;
+	}
+
+	if (!force && basebackupProgress.updateTime == now)
+	{
+		return;
+	}
+
+	basebackupProgress.updateTime = now;
+
+	if (!pg_basebackup_write_progress_file(basebackupProgressFile,
+										   &basebackupProgress))
+	{
+		/* errors have already been logged, stop trying */
+		bzero((void *) basebackupProgressFile, MAXPGPATH);
+	}
+}
+
+
+/*
+ * pg_basebackup_write_progress_file writes the given progress of a base
+ * backup to the given file, that pg_autoctl show basebackup reads.
+ */
+bool
+pg_basebackup_write_progress_file(const char *filename,
+								  BaseBackupProgress *progress)
+{
+	char contents[BUFSIZE] = { 0 };
+
+	int len = sformat(contents, sizeof(contents),
+					  "%" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+					  progress->doneBytes,
+					  progress->totalBytes,
+					  progress->startTime,
+					  progress->updateTime);
+
+	return write_file(contents, len, filename);
+}
+
+
+/*
+ * pg_basebackup_read_progress reads the progress of a running pg_basebackup
+ * from the given file. It returns false when no pg_basebackup is running.
+ */
+bool
+pg_basebackup_read_progress(const char *filename, BaseBackupProgress *progress)
+{
+	char *contents = NULL;
+	long size = 0L;
+
+	if (IS_EMPTY_STRING_BUFFER(filename) || !file_exists(filename))
+	{
+		return false;
+	}
+
+	if (!read_file(filename, &contents, &size))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	int matched = sscanf(contents,
+						 "%" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64,
+						 &(progress->doneBytes),
+						 &(progress->totalBytes),
+						 &(progress->startTime),
+						 &(progress->updateTime));
+
+	free(contents);
+
+	if (matched != 4)
+	{
+		log_warn("Failed to parse pg_basebackup progress file \"%s\"",
+				 filename);
 		return false;
 	}
 
@@ -1415,11 +1886,19 @@ pg_basebackup(const char *pgdata,
  * pg_rewind runs the pg_rewind program to rewind the given database directory
  * to a state where it can follow the given primary. We need the ability to
  * connect to the node.
+ *
+ * With restoreTargetWal, pg_rewind fetches the local WAL it needs to find the
+ * changed blocks from the archives with the restore_command of the target
+ * configuration, when the local pg_wal has recycled it already. The progress
+ * of pg_rewind is given to progressHook, when set.
  */
 bool
 pg_rewind(const char *pgdata,
 		  const char *pg_ctl,
-		  ReplicationSource *replicationSource)
+		  ReplicationSource *replicationSource,
+		  bool restoreTargetWal,
+		  RewindProgressFunction progressHook,
+		  void *progressHookContext)
 {
 	int returnCode;
 	char pg_rewind[MAXPGPATH] = { 0 };
@@ -1427,7 +1906,7 @@ pg_rewind(const char *pgdata,
 	NodeAddress *primaryNode = &(replicationSource->primaryNode);
 	char primaryConnInfo[MAXCONNINFO] = { 0 };
 
-	char *args[7];
+	char *args[8];
 	int argsIndex = 0;
 
 	char command[BUFSIZE];
@@ -1472,8 +1951,17 @@ pg_rewind(const char *pgdata,
 	args[argsIndex++] = "--source-server";
 	args[argsIndex++] = primaryConnInfo;
 	args[argsIndex++] = "--progress";
+
+	if (restoreTargetWal)
+	{
+		args[argsIndex++] = "--restore-target-wal";
+	}
+
 	args[argsIndex] = NULL;
 
+	rewindProgressHook = progressHook;
+	rewindProgressHookContext = progressHookContext;
+
 	/*
 	 * We do not want to call setsid() when running this program, as the
 	 * pg_rewind subprogram is not intended to be its own session leader, but
@@ -1482,7 +1970,7 @@ pg_rewind(const char *pgdata,
 	Program program = { 0 };
 
 	(void) initialize_program(&program, args, false);
-	program.processBuffer = &processBufferCallback;
+	program.processBuffer = &pg_rewind_process_buffer;
 
 	/* log the exact command line we're using */
 	int commandSize = snprintf_program_command_line(&program, command, BUFSIZE);
@@ -1497,8 +1985,17 @@ pg_rewind(const char *pgdata,
 		log_info("%s", command);
 	}
 
+	instr_time startTime;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
 	(void) execute_subprogram(&program);
 
+	(void) log_program_record("pg_rewind", &program, startTime);
+
+	rewindProgressHook = NULL;
+	rewindProgressHookContext = NULL;
+
 	/* clean-up the environment again */
 	if (!IS_EMPTY_STRING_BUFFER(replicationSource->password))
 	{
@@ -1525,6 +2022,67 @@ pg_rewind(const char *pgdata,
 }
 
 
+/*
+ * pg_rewind_process_buffer gives the progress lines of pg_rewind --progress,
+ * such as "  1024/20480 kB (5%) copied", to the progress hook, and then logs
+ * the output as usual.
+ */
+static void
+pg_rewind_process_buffer(const char *buffer, bool error)
+{
+	const char *line = buffer;
+
+	while (rewindProgressHook != NULL && line != NULL && *line != '\0')
+	{
+		uint64_t doneKB = 0;
+		uint64_t totalKB = 0;
+
+		if (sscanf(line, " %" SCNu64 "/%" SCNu64 " kB", &doneKB, &totalKB) == 2)
+		{
+			(*rewindProgressHook)(rewindProgressHookContext,
+								  doneKB * 1024,
+								  totalKB * 1024);
+		}
+
+		line = strchr(line, '\n');
+
+		if (line != NULL)
+		{
+			++line;
+		}
+	}
+
+	(void) processBufferCallback(buffer, error);
+}
+
+
+/*
+ * log_program_record logs a structured record of a program run with its
+ * duration, which is only output when using the JSON log format.
+ */
+static void
+log_program_record(const char *command, Program *program, instr_time startTime)
+{
+	instr_time duration;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	IntString returnCode = intToString(program->returnCode);
+
+	const char *fields[] = {
+		"program", program->program,
+		"command", command,
+		"return_code", returnCode.strValue,
+		NULL
+	};
+
+	log_record(LOG_INFO, "program.run",
+			   (long long) INSTR_TIME_GET_MICROSEC(duration),
+			   fields);
+}
+
+
 /* log_program_output logs the output of the given program. */
 static void
 log_program_output(Program prog, int outLogLevel, int errorLogLevel)
@@ -1569,6 +2127,10 @@ pg_ctl_initdb(const char *pg_ctl, const char *pgdata)
 	log_info("Initialising a PostgreSQL cluster at \"%s\"", pgdata);
 	log_info("%s initdb -s -D %s --option '--auth=trust'", pg_ctl, pgdata);
 
+	instr_time startTime;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
 	Program program = run_program(pg_ctl, "initdb",
 								  "--silent",
 								  "--pgdata", pgdata,
@@ -1577,6 +2139,8 @@ pg_ctl_initdb(const char *pg_ctl, const char *pgdata)
 								  "--option", "'--auth=trust'",
 								  NULL);
 
+	(void) log_program_record("initdb", &program, startTime);
+
 	bool success = program.returnCode == 0;
 
 	if (program.returnCode != 0)
@@ -1709,7 +2273,7 @@ pg_ctl_postgres(const char *pg_ctl, const char *pgdata, int pgport,
 /*
  * pg_log_startup logs the PGDATA/startup.log file contents so that our users
  * have enough information about why Postgres failed to start when that
- * happens.
+ * happens. We only log the last PG_LOG_TAIL_MAX_LINES lines of each file.
  */
 bool
 pg_log_startup(const char *pgdata, int logLevel)
@@ -1719,6 +2283,7 @@ pg_log_startup(const char *pgdata, int logLevel)
 	char pgStartupPath[MAXPGPATH] = { 0 };
 	char *fileContents;
 	long fileSize;
+	bool truncated = false;
 
 	/* logLevel to use when introducing which file path logs come from */
 	int pathLogLevel = logLevel <= LOG_DEBUG ? LOG_DEBUG : LOG_WARN;
@@ -1730,13 +2295,19 @@ pg_log_startup(const char *pgdata, int logLevel)
 	/* prepare startup.log file in PGDATA */
 	join_path_components(pgStartupPath, pgdata, "startup.log");
 
-	if (read_file(pgStartupPath, &fileContents, &fileSize) && fileSize > 0)
+	if (read_file_tail(pgStartupPath,
+					   PG_LOG_TAIL_MAX_BYTES, PG_LOG_TAIL_MAX_LINES,
+					   &fileContents, &fileSize, &truncated) &&
+		fileSize > 0)
 	{
-		char *lines[BUFSIZE];
-		int lineCount = splitLines(fileContents, lines, BUFSIZE);
+		char *lines[PG_LOG_TAIL_MAX_LINES];
+		int lineCount =
+			splitLines(fileContents, lines, PG_LOG_TAIL_MAX_LINES);
 		int lineNumber = 0;
 
-		log_level(pathLogLevel, "Postgres logs from \"%s\":", pgStartupPath);
+		log_level(pathLogLevel, "Postgres logs from \"%s\"%s:",
+				  pgStartupPath,
+				  truncated ? ", last lines only" : "");
 
 		for (lineNumber = 0; lineNumber < lineCount; lineNumber++)
 		{
@@ -1840,16 +2411,20 @@ pg_log_startup(const char *pgdata, int logLevel)
 			char *fileContents;
 			long fileSize;
 
-			log_level(pathLogLevel,
-					  "Postgres logs from \"%s\":", pgLogFilePath);
-
-			if (read_file(pgLogFilePath, &fileContents, &fileSize) &&
+			if (read_file_tail(pgLogFilePath,
+							   PG_LOG_TAIL_MAX_BYTES, PG_LOG_TAIL_MAX_LINES,
+							   &fileContents, &fileSize, &truncated) &&
 				fileSize > 0)
 			{
-				char *lines[BUFSIZE];
-				int lineCount = splitLines(fileContents, lines, BUFSIZE);
+				char *lines[PG_LOG_TAIL_MAX_LINES];
+				int lineCount =
+					splitLines(fileContents, lines, PG_LOG_TAIL_MAX_LINES);
 				int lineNumber = 0;
 
+				log_level(pathLogLevel, "Postgres logs from \"%s\"%s:",
+						  pgLogFilePath,
+						  truncated ? ", last lines only" : "");
+
 				for (lineNumber = 0; lineNumber < lineCount; lineNumber++)
 				{
 					if (strstr(lines[lineNumber], "FATAL") != NULL)
@@ -1944,6 +2519,10 @@ pg_ctl_stop(const char *pg_ctl, const char *pgdata)
 
 	log_info("%s --pgdata %s --wait stop --mode fast", pg_ctl, pgdata);
 
+	instr_time startTime;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
 	Program program = run_program(pg_ctl,
 								  "--pgdata", pgdata,
 								  "--wait",
@@ -1951,6 +2530,8 @@ pg_ctl_stop(const char *pg_ctl, const char *pgdata)
 								  "--mode", "fast",
 								  NULL);
 
+	(void) log_program_record("stop", &program, startTime);
+
 	/*
 	 * Case 1. "pg_ctl stop" was successful, so we could stop the PostgreSQL
 	 * server successfully.
@@ -2012,9 +2593,15 @@ pg_ctl_stop(const char *pg_ctl, const char *pgdata)
 int
 pg_ctl_status(const char *pg_ctl, const char *pgdata, bool log_output)
 {
+	instr_time startTime;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
 	Program program = run_program(pg_ctl, "status", "-D", pgdata, NULL);
 	int returnCode = program.returnCode;
 
+	(void) log_program_record("status", &program, startTime);
+
 	log_level(log_output ? LOG_INFO : LOG_DEBUG,
 			  "%s status -D %s [%d]", pg_ctl, pgdata, returnCode);
 
@@ -2034,10 +2621,16 @@ pg_ctl_status(const char *pg_ctl, const char *pgdata, bool log_output)
 bool
 pg_ctl_promote(const char *pg_ctl, const char *pgdata)
 {
+	instr_time startTime;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
 	Program program =
 		run_program(pg_ctl, "promote", "-D", pgdata, "--no-wait", NULL);
 	int returnCode = program.returnCode;
 
+	(void) log_program_record("promote", &program, startTime);
+
 	log_debug("%s promote -D %s --no-wait", pg_ctl, pgdata);
 
 	if (program.stdErr != NULL)
@@ -2106,7 +2699,7 @@ pg_setup_standby_mode(uint32_t pg_control_version,
 		 * the main postgresql.conf file and create an empty standby.signal
 		 * file to trigger starting the server in standby mode.
 		 */
-		return pg_write_standby_signal(pgdata, replicationSource);
+		return pg_write_standby_signal(pgdata, pg_ctl, replicationSource);
 	}
 }
 
@@ -2126,12 +2719,14 @@ pg_write_recovery_conf(const char *pgdata, ReplicationSource *replicationSource)
 	char targetLSN[PG_LSN_MAXLENGTH] = { 0 };
 	char targetAction[NAMEDATALEN] = { 0 };
 	char targetTimeline[NAMEDATALEN] = { 0 };
+	char restoreCommand[MAXCONNINFO] = { 0 };
 
 	GUC recoverySettingsStandby[] = {
 		{ "standby_mode", "'on'" },
 		{ "primary_conninfo", (char *) primaryConnInfo },
 		{ "primary_slot_name", (char *) primarySlotName },
 		{ "recovery_target_timeline", (char *) targetTimeline },
+		{ "restore_command", (char *) restoreCommand },
 		{ NULL, NULL }
 	};
 
@@ -2143,6 +2738,7 @@ pg_write_recovery_conf(const char *pgdata, ReplicationSource *replicationSource)
 		{ "recovery_target_lsn", (char *) targetLSN },
 		{ "recovery_target_inclusive", "'true'" },
 		{ "recovery_target_action", (char *) targetAction },
+		{ "restore_command", (char *) restoreCommand },
 		{ NULL, NULL }
 	};
 
@@ -2163,7 +2759,8 @@ pg_write_recovery_conf(const char *pgdata, ReplicationSource *replicationSource)
 								   primarySlotName,
 								   targetLSN,
 								   targetAction,
-								   targetTimeline))
+								   targetTimeline,
+								   restoreCommand))
 	{
 		/* errors have already been logged */
 		return false;
@@ -2185,6 +2782,7 @@ pg_write_recovery_conf(const char *pgdata, ReplicationSource *replicationSource)
  */
 static bool
 pg_write_standby_signal(const char *pgdata,
+						const char *pg_ctl,
 						ReplicationSource *replicationSource)
 {
 	char standbyConfigFilePath[MAXPGPATH] = { 0 };
@@ -2197,11 +2795,19 @@ pg_write_standby_signal(const char *pgdata,
 	char targetLSN[PG_LSN_MAXLENGTH] = { 0 };
 	char targetAction[NAMEDATALEN] = { 0 };
 	char targetTimeline[NAMEDATALEN] = { 0 };
+	char restoreCommand[MAXCONNINFO] = { 0 };
+
+	/* also make WAL replay faster, see pgtuning_prepare_standby_settings */
+	StandbyTuning tuning = { 0 };
 
 	GUC recoverySettingsStandby[] = {
 		{ "primary_conninfo", (char *) primaryConnInfo },
 		{ "primary_slot_name", (char *) primarySlotName },
 		{ "recovery_target_timeline", (char *) targetTimeline },
+		{ "restore_command", (char *) restoreCommand },
+		{ "recovery_prefetch", tuning.recovery_prefetch },
+		{ "maintenance_io_concurrency", tuning.maintenance_io_concurrency },
+		{ "wal_decode_buffer_size", tuning.wal_decode_buffer_size },
 		{ NULL, NULL }
 	};
 
@@ -2212,6 +2818,10 @@ pg_write_standby_signal(const char *pgdata,
 		{ "recovery_target_lsn", (char *) targetLSN },
 		{ "recovery_target_inclusive", "'true'" },
 		{ "recovery_target_action", targetAction },
+		{ "restore_command", (char *) restoreCommand },
+		{ "recovery_prefetch", tuning.recovery_prefetch },
+		{ "maintenance_io_concurrency", tuning.maintenance_io_concurrency },
+		{ "wal_decode_buffer_size", tuning.wal_decode_buffer_size },
 		{ NULL, NULL }
 	};
 
@@ -2230,12 +2840,15 @@ pg_write_standby_signal(const char *pgdata,
 								   primarySlotName,
 								   targetLSN,
 								   targetAction,
-								   targetTimeline))
+								   targetTimeline,
+								   restoreCommand))
 	{
 		/* errors have already been logged */
 		return false;
 	}
 
+	(void) pgtuning_prepare_standby_settings(pgdata, pg_ctl, &tuning);
+
 	/* set our configuration file paths, all found in PGDATA */
 	join_path_components(signalFilePath, pgdata, "standby.signal");
 	join_path_components(configFilePath, pgdata, "postgresql.conf");
@@ -2309,7 +2922,8 @@ prepare_recovery_settings(const char *pgdata,
 						  char *primarySlotName,
 						  char *targetLSN,
 						  char *targetAction,
-						  char *targetTimeline)
+						  char *targetTimeline,
+						  char *restoreCommand)
 {
 	bool escape = true;
 	NodeAddress *primaryNode = &(replicationSource->primaryNode);
@@ -2383,6 +2997,22 @@ prepare_recovery_settings(const char *pgdata,
 				replicationSource->targetAction);
 	}
 
+	/*
+	 * When a restore_command is setup, Postgres fetches from the archives the
+	 * WAL that the upstream node doesn't have anymore, both when catching up
+	 * and when fetching the missing WAL up to targetLSN.
+	 */
+	if (!IS_EMPTY_STRING_BUFFER(replicationSource->restoreCommand))
+	{
+		if (!escape_recovery_conf_string(restoreCommand,
+										 MAXCONNINFO,
+										 replicationSource->restoreCommand))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+	}
+
 	return true;
 }
 
@@ -2655,11 +3285,17 @@ prepare_conninfo_sslmode(PQExpBuffer buffer, SSLOptions sslOptions)
 /*
  * pgctl_identify_system connects with replication=1 to our target node and run
  * the IDENTIFY_SYSTEM command to check that HBA is ready.
+ *
+ * When replicationSource->timelinesFile is set, the timeline history of the
+ * upstream node is cached in that file, and we only fetch it again with the
+ * TIMELINE_HISTORY command when the upstream node is on another timeline.
  */
 bool
 pgctl_identify_system(ReplicationSource *replicationSource)
 {
 	NodeAddress *primaryNode = &(replicationSource->primaryNode);
+	TimeLineHistory *timelines = &(replicationSource->system.timelines);
+	bool useCache = !IS_EMPTY_STRING_BUFFER(replicationSource->timelinesFile);
 
 	char primaryConnInfo[MAXCONNINFO] = { 0 };
 	char primaryConnInfoReplication[MAXCONNINFO] = { 0 };
@@ -2707,6 +3343,16 @@ pgctl_identify_system(ReplicationSource *replicationSource)
 		return false;
 	}
 
+	/* a new pg_autoctl process starts with the history cached on-disk */
+	if (useCache && timelines->count == 0)
+	{
+		(void) timeline_history_cache_read(replicationSource->timelinesFile,
+										   timelines);
+	}
+
+	uint64_t cachedIdentifier = timelines->identifier;
+	uint32_t cachedTimeline = timelines->timeline;
+
 	if (!pgsql_identify_system(&replicationClient,
 							   &(replicationSource->system)))
 	{
@@ -2714,10 +3360,123 @@ pgctl_identify_system(ReplicationSource *replicationSource)
 		return false;
 	}
 
+	if (useCache &&
+		timelines->count > 0 &&
+		(timelines->identifier != cachedIdentifier ||
+		 timelines->timeline != cachedTimeline))
+	{
+		/* failing to cache the history is not an error */
+		(void) timeline_history_cache_write(replicationSource->timelinesFile,
+											timelines);
+	}
+
+	return true;
+}
+
+
+/*
+ * timeline_history_cache_read reads a timeline history that we previously
+ * cached on-disk with timeline_history_cache_write. The file uses the format
+ * of the Postgres timeline history files, with a first comment line that
+ * contains the system identifier and the timeline of the history.
+ */
+static bool
+timeline_history_cache_read(const char *filename, TimeLineHistory *timelines)
+{
+	IdentifySystem system = { 0 };
+	char *contents = NULL;
+	long fileSize = 0L;
+
+	if (!read_file_if_exists(filename, &contents, &fileSize))
+	{
+		/* errors have already been logged, or the file doesn't exist */
+		return false;
+	}
+
+	if (sscanf(contents,
+			   "# pg_autoctl timeline history of system %" SCNu64
+			   " timeline %" SCNu32,
+			   &(system.identifier),
+			   &(system.timeline)) != 2)
+	{
+		log_warn("Failed to parse timeline history cache file \"%s\", "
+				 "ignoring", filename);
+		free(contents);
+		return false;
+	}
+
+	if (!parseTimeLineHistory(filename, contents, &system))
+	{
+		log_warn("Failed to parse timeline history cache file \"%s\", "
+				 "ignoring", filename);
+		free(contents);
+		return false;
+	}
+
+	free(contents);
+
+	log_debug("Read the history of timeline %d from \"%s\"",
+			  system.timeline, filename);
+
+	*timelines = system.timelines;
+
 	return true;
 }
 
 
+/*
+ * timeline_history_cache_write writes the given timeline history to filename,
+ * in the format that timeline_history_cache_read expects.
+ */
+static bool
+timeline_history_cache_write(const char *filename, TimeLineHistory *timelines)
+{
+	PQExpBuffer content = createPQExpBuffer();
+
+	if (content == NULL)
+	{
+		log_error("Failed to allocate memory");
+		return false;
+	}
+
+	appendPQExpBuffer(content,
+					  "# pg_autoctl timeline history of system %" PRIu64
+					  " timeline %" PRIu32 "\n",
+					  timelines->identifier,
+					  timelines->timeline);
+
+	/* the last entry is the tip of the timeline, it's not in the history */
+	for (int i = 0; i < timelines->count - 1; i++)
+	{
+		TimeLineHistoryEntry *entry = &(timelines->history[i]);
+
+		appendPQExpBuffer(content, "%u\t%X/%X\n",
+						  entry->tli,
+						  (uint32_t) (entry->end >> 32),
+						  (uint32_t) entry->end);
+	}
+
+	if (PQExpBufferBroken(content))
+	{
+		log_error("Failed to allocate memory");
+		destroyPQExpBuffer(content);
+		return false;
+	}
+
+	bool success = write_file_atomic(content->data, content->len, filename);
+
+	destroyPQExpBuffer(content);
+
+	if (success)
+	{
+		log_debug("Cached the history of timeline %d in \"%s\"",
+				  timelines->timeline, filename);
+	}
+
+	return success;
+}
+
+
 /*
  * pg_is_running returns true if PostgreSQL is running.
  */
@@ -28,6 +28,19 @@
 
 #define PG_CTL_STATUS_NOT_RUNNING 3
 
+/*
+ * While pg_basebackup runs, we parse its --progress output and keep the
+ * latest figures in a small file, so that other pg_autoctl commands can
+ * display them.
+ */
+typedef struct BaseBackupProgress
+{
+	uint64_t doneBytes;
+	uint64_t totalBytes;
+	uint64_t startTime;         /* epoch */
+	uint64_t updateTime;        /* epoch */
+} BaseBackupProgress;
+
 bool pg_controldata(PostgresSetup *pgSetup, bool missing_ok);
 bool set_pg_ctl_from_PG_CONFIG(PostgresSetup *pgSetup);
 bool set_pg_ctl_from_pg_config(PostgresSetup *pgSetup);
@@ -47,9 +60,21 @@ bool pg_auto_failover_default_settings_file_exists(PostgresSetup *pgSetup);
 bool pg_basebackup(const char *pgdata,
 				   const char *pg_ctl,
 				   ReplicationSource *replicationSource);
+bool pg_basebackup_read_progress(const char *filename,
+								 BaseBackupProgress *progress);
+bool pg_basebackup_write_progress_file(const char *filename,
+									   BaseBackupProgress *progress);
+/* called with the progress that pg_rewind --progress outputs, in bytes */
+typedef void (*RewindProgressFunction)(void *context,
+									   uint64_t doneBytes,
+									   uint64_t totalBytes);
+
 bool pg_rewind(const char *pgdata,
 			   const char *pg_ctl,
-			   ReplicationSource *replicationSource);
+			   ReplicationSource *replicationSource,
+			   bool restoreTargetWal,
+			   RewindProgressFunction progressHook,
+			   void *progressHookContext);
 
 bool pg_ctl_initdb(const char *pg_ctl, const char *pgdata);
 bool pg_ctl_postgres(const char *pg_ctl, const char *pgdata, int pgport,
@@ -11,11 +11,13 @@
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/stat.h>
 
 #include "postgres_fe.h"
 #include "pqexpbuffer.h"
 
 #include "defaults.h"
+#include "dns_cache.h"
 #include "file_utils.h"
 #include "ipaddr.h"
 #include "parsing.h"
@@ -27,6 +29,29 @@
 
 #define HBA_LINE_COMMENT " # Auto-generated by pg_auto_failover"
 
+/*
+ * We keep an in-memory index of the rules found in the HBA file, so that we
+ * don't have to read and scan the whole file again for each node when the
+ * list of other nodes changes. The index is valid for as long as the HBA file
+ * has the same inode, size, and modification time as when we loaded it.
+ */
+typedef struct HBARuleIndex
+{
+	char hbaFilePath[MAXPGPATH];
+	ino_t inode;
+	off_t size;
+	int64_t mtime;
+
+	char *contents;             /* current file contents */
+
+	int count;
+	int ownedCount;             /* rules with our HBA_LINE_COMMENT */
+	int capacity;               /* always a power of two */
+	char **rules;               /* open addressing hash table */
+} HBARuleIndex;
+
+static HBARuleIndex hbaRuleIndex = { 0 };
+
 static bool pghba_append_rule_to_buffer(PQExpBuffer buffer,
 										bool ssl,
 										HBADatabaseType databaseType,
@@ -40,6 +65,23 @@ static void append_database_field(PQExpBuffer destination,
 static void append_hostname_or_cidr(PQExpBuffer destination,
 									const char *host);
 static int escape_hba_string(char *destination, const char *hbaString);
+static bool pghba_build_node_rules(PQExpBuffer *hbaLines,
+								   bool ssl,
+								   const char *database,
+								   const char *username,
+								   const char *host,
+								   const char *authenticationScheme);
+static bool pghba_index_stat(const char *hbaFilePath,
+							 ino_t *inode, off_t *size, int64_t *mtime);
+static bool pghba_index_load(HBARuleIndex *index, const char *hbaFilePath);
+static bool pghba_index_set_contents(HBARuleIndex *index,
+									 const char *hbaFilePath,
+									 PQExpBuffer contents);
+static bool pghba_index_parse(HBARuleIndex *index);
+static uint32_t hash_hba_rule(const char *rule);
+static bool pghba_index_contains(HBARuleIndex *index, const char *rule);
+static bool pghba_index_add(HBARuleIndex *index, const char *rule, bool owned);
+static void pghba_index_reset(HBARuleIndex *index);
 
 
 /*
@@ -256,6 +298,11 @@ pghba_ensure_host_rule_exists(const char *hbaFilePath,
  *
  *  host(ssl) replication "pgautofailover_replicator" hostname/ip trust
  *  host(ssl) "dbname"    "pgautofailover_replicator" hostname/ip trust
+ *
+ * The rules are looked-up in the in-memory index of the HBA file, and we only
+ * resolve a node's hostname when its rules are not found already. The HBA
+ * file is only rewritten when rules have been added, in which case
+ * hbaChanged is set to true.
  */
 bool
 pghba_ensure_host_rules_exist(const char *hbaFilePath,
@@ -264,80 +311,52 @@ pghba_ensure_host_rules_exist(const char *hbaFilePath,
 							  const char *database,
 							  const char *username,
 							  const char *authenticationScheme,
-							  HBAEditLevel hbaLevel)
+							  HBAEditLevel hbaLevel,
+							  bool *hbaChanged)
 {
-	PQExpBuffer newHbaContents = createPQExpBuffer();
-	char *currentHbaContents = NULL;
-	long currentHbaSize = 0L;
-	char *includeLine = NULL;
+	HBARuleIndex *index = &hbaRuleIndex;
+	PQExpBuffer newHbaContents = NULL;
 
-	int nodeIndex = 0;
 	int hbaLinesAdded = 0;
 
-	PQExpBuffer hbaLineReplicationBuffer = NULL;
-	PQExpBuffer hbaLineDatabaseBuffer = NULL;
-
-	if (newHbaContents == NULL)
-	{
-		log_error("Failed to allocate memory");
-		return false;
-	}
+	*hbaChanged = false;
 
-	if (!read_file(hbaFilePath, &currentHbaContents, &currentHbaSize))
+	if (!pghba_index_load(index, hbaFilePath))
 	{
-		/* read_file logs an error */
-		destroyPQExpBuffer(newHbaContents);
+		/* errors have already been logged */
 		return false;
 	}
 
-	/* always begin with the existing HBA file */
-	appendPQExpBufferStr(newHbaContents, currentHbaContents);
-
-	for (nodeIndex = 0; nodeIndex < nodesArray->count; nodeIndex++)
+	for (int nodeIndex = 0; nodeIndex < nodesArray->count; nodeIndex++)
 	{
 		NodeAddress *node = &(nodesArray->nodes[nodeIndex]);
 
-		int hbaLinesIndex = 0;
-		PQExpBuffer hbaLines[3] = { 0 };
-
 		bool useHostname = true;
 		char ipaddr[BUFSIZE] = { 0 };
 
-		/* done with the new HBA line buffers (and safe to call on NULL) */
-		destroyPQExpBuffer(hbaLineReplicationBuffer);
-		destroyPQExpBuffer(hbaLineDatabaseBuffer);
-
-		/* we need new buffers now */
-		hbaLineReplicationBuffer = createPQExpBuffer();
-		hbaLineDatabaseBuffer = createPQExpBuffer();
+		PQExpBuffer hbaLines[3] = { 0 };
 
-		if (hbaLineReplicationBuffer == NULL ||
-			hbaLineDatabaseBuffer == NULL)
+		if (!pghba_build_node_rules(hbaLines, ssl, database, username,
+									node->host, authenticationScheme))
 		{
-			log_error("Failed to allocate memory");
-
-			/* done with the old pg_hba.conf contents */
-			free(currentHbaContents);
+			/* errors have already been logged */
 			destroyPQExpBuffer(newHbaContents);
-
-			/* done with the new HBA line buffers */
-			destroyPQExpBuffer(hbaLineReplicationBuffer);
-			destroyPQExpBuffer(hbaLineDatabaseBuffer);
-
 			return false;
 		}
 
-		if (hbaLevel >= HBA_EDIT_MINIMAL)
+		/*
+		 * When using a hostname in the HBA host field, Postgres is very picky
+		 * about the matching rules. We have an opportunity here to check the
+		 * same DNS and reverse DNS rules as Postgres, and warn our users when
+		 * we see something that we know Postgres won't be happy with.
+		 *
+		 * HBA & DNS is hard, and slow: we skip the checks when the rules
+		 * using the hostname are in the HBA file already.
+		 */
+		if (hbaLevel >= HBA_EDIT_MINIMAL &&
+			!(pghba_index_contains(index, hbaLines[0]->data) &&
+			  pghba_index_contains(index, hbaLines[1]->data)))
 		{
-			/*
-			 * When using a hostname in the HBA host field, Postgres is very
-			 * picky about the matching rules. We have an opportunity here to
-			 * check the same DNS and reverse DNS rules as Postgres, and warn
-			 * our users when we see something that we know Postgres won't be
-			 * happy with.
-			 *
-			 * HBA & DNS is hard.
-			 */
 			if (!pghba_check_hostname(node->host, ipaddr, sizeof(ipaddr),
 									  &useHostname))
 			{
@@ -348,55 +367,18 @@ pghba_ensure_host_rules_exist(const char *hbaFilePath,
 			{
 				log_warn("Using IP address \"%s\" in HBA file "
 						 "instead of hostname \"%s\"", ipaddr, node->host);
-			}
-		}
-
-		log_debug("pghba_ensure_host_rules_exist: %" PRId64 " \"%s\" (%s:%d)",
-				  node->nodeId,
-				  node->name,
-				  useHostname ? node->host : ipaddr,
-				  node->port);
-
-		if (!pghba_append_rule_to_buffer(hbaLineReplicationBuffer,
-										 ssl,
-										 HBA_DATABASE_REPLICATION,
-										 NULL,
-										 username,
-										 useHostname ? node->host : ipaddr,
-										 authenticationScheme))
-		{
-			/* errors have already been logged */
-
-			/* done with the old pg_hba.conf contents */
-			free(currentHbaContents);
-			destroyPQExpBuffer(newHbaContents);
-
-			/* done with the new HBA line buffers (and safe to call on NULL) */
-			destroyPQExpBuffer(hbaLineReplicationBuffer);
-			destroyPQExpBuffer(hbaLineDatabaseBuffer);
-
-			return false;
-		}
 
-		if (!pghba_append_rule_to_buffer(hbaLineDatabaseBuffer,
-										 ssl,
-										 HBA_DATABASE_DBNAME,
-										 database,
-										 username,
-										 useHostname ? node->host : ipaddr,
-										 authenticationScheme))
-		{
-			/* errors have already been logged */
-
-			/* done with the old pg_hba.conf contents */
-			free(currentHbaContents);
-			destroyPQExpBuffer(newHbaContents);
+				destroyPQExpBuffer(hbaLines[0]);
+				destroyPQExpBuffer(hbaLines[1]);
 
-			/* done with the new HBA line buffers (and safe to call on NULL) */
-			destroyPQExpBuffer(hbaLineReplicationBuffer);
-			destroyPQExpBuffer(hbaLineDatabaseBuffer);
-
-			return false;
+				if (!pghba_build_node_rules(hbaLines, ssl, database, username,
+											ipaddr, authenticationScheme))
+				{
+					/* errors have already been logged */
+					destroyPQExpBuffer(newHbaContents);
+					return false;
+				}
+			}
 		}
 
 		log_info("%s HBA rules for node %" PRId64 " \"%s\" (%s:%d)",
@@ -406,24 +388,16 @@ pghba_ensure_host_rules_exist(const char *hbaFilePath,
 				 useHostname ? node->host : ipaddr,
 				 node->port);
 
-		hbaLines[0] = hbaLineReplicationBuffer;
-		hbaLines[1] = hbaLineDatabaseBuffer;
-
-		for (hbaLinesIndex = 0; hbaLines[hbaLinesIndex] != NULL; hbaLinesIndex++)
+		for (int hbaLinesIndex = 0;
+			 hbaLines[hbaLinesIndex] != NULL;
+			 hbaLinesIndex++)
 		{
 			PQExpBuffer hbaLineBuffer = hbaLines[hbaLinesIndex];
 
 			log_debug("Ensuring the HBA file \"%s\" contains the line: %s",
 					  hbaFilePath, hbaLineBuffer->data);
 
-			includeLine = strstr(currentHbaContents, hbaLineBuffer->data);
-
-			/*
-			 * If the rule was found and it starts on a new line. We can
-			 * skip adding it.
-			 */
-			if (includeLine != NULL && (includeLine == currentHbaContents ||
-										includeLine[-1] == '\n'))
+			if (pghba_index_contains(index, hbaLineBuffer->data))
 			{
 				log_debug("Line already exists in %s, skipping %s",
 						  hbaFilePath, hbaLineBuffer->data);
@@ -440,56 +414,477 @@ pghba_ensure_host_rules_exist(const char *hbaFilePath,
 			{
 				log_warn("Skipping HBA edits (per --skip-pg-hba) for rule: %s",
 						 hbaLineBuffer->data);
+				continue;
 			}
-			else
+
+			/* always begin with the existing HBA file */
+			if (newHbaContents == NULL)
 			{
-				/* now append the line to the new HBA file contents */
-				log_info("Adding HBA rule: %s", hbaLineBuffer->data);
+				newHbaContents = createPQExpBuffer();
+
+				if (newHbaContents == NULL)
+				{
+					log_error("Failed to allocate memory");
+					destroyPQExpBuffer(hbaLines[0]);
+					destroyPQExpBuffer(hbaLines[1]);
+					return false;
+				}
+
+				appendPQExpBufferStr(newHbaContents, index->contents);
+			}
+
+			/* now append the line to the new HBA file contents */
+			log_info("Adding HBA rule: %s", hbaLineBuffer->data);
 
-				appendPQExpBufferStr(newHbaContents, hbaLineBuffer->data);
-				appendPQExpBufferStr(newHbaContents, HBA_LINE_COMMENT "\n");
+			appendPQExpBufferStr(newHbaContents, hbaLineBuffer->data);
+			appendPQExpBufferStr(newHbaContents, HBA_LINE_COMMENT "\n");
 
-				++hbaLinesAdded;
+			/* two nodes may share a hostname, add their rules only once */
+			if (!pghba_index_add(index, hbaLineBuffer->data, true))
+			{
+				/* errors have already been logged */
+				destroyPQExpBuffer(hbaLines[0]);
+				destroyPQExpBuffer(hbaLines[1]);
+				destroyPQExpBuffer(newHbaContents);
+				return false;
 			}
+
+			++hbaLinesAdded;
 		}
-	}
 
-	/* done with the new HBA line buffers (and safe to call on NULL) */
-	destroyPQExpBuffer(hbaLineReplicationBuffer);
-	destroyPQExpBuffer(hbaLineDatabaseBuffer);
+		/* done with the new HBA line buffers */
+		destroyPQExpBuffer(hbaLines[0]);
+		destroyPQExpBuffer(hbaLines[1]);
+	}
 
-	/* done with the old pg_hba.conf contents */
-	free(currentHbaContents);
+	/* when no rule is missing, we're done already */
+	if (hbaLinesAdded == 0)
+	{
+		return true;
+	}
 
 	/* memory allocation could have failed while building string */
 	if (PQExpBufferBroken(newHbaContents))
 	{
 		log_error("Failed to allocate memory");
 		destroyPQExpBuffer(newHbaContents);
+		pghba_index_reset(index);
+		return false;
+	}
+
+	log_info("Writing %d new HBA rules in \"%s\"", hbaLinesAdded, hbaFilePath);
+
+	if (!write_file_atomic(newHbaContents->data,
+						   newHbaContents->len,
+						   hbaFilePath))
+	{
+		/* write_file_atomic logs an error */
+		destroyPQExpBuffer(newHbaContents);
+		pghba_index_reset(index);
+		return false;
+	}
+
+	*hbaChanged = true;
+
+	/* the index now matches the new file, attach its contents */
+	bool success = pghba_index_set_contents(index, hbaFilePath, newHbaContents);
+
+	destroyPQExpBuffer(newHbaContents);
+
+	log_debug("Wrote new %s", hbaFilePath);
+
+	return success;
+}
+
+
+/*
+ * pghba_build_node_rules builds the two HBA rules needed for a node that
+ * connects from the given host: one for replication and one for the given
+ * database. The hbaLines array is expected to have room for a NULL
+ * terminating entry.
+ */
+static bool
+pghba_build_node_rules(PQExpBuffer *hbaLines,
+					   bool ssl,
+					   const char *database,
+					   const char *username,
+					   const char *host,
+					   const char *authenticationScheme)
+{
+	hbaLines[0] = createPQExpBuffer();
+	hbaLines[1] = createPQExpBuffer();
+	hbaLines[2] = NULL;
+
+	if (hbaLines[0] == NULL || hbaLines[1] == NULL)
+	{
+		log_error("Failed to allocate memory");
+
+		/* safe to call on NULL */
+		destroyPQExpBuffer(hbaLines[0]);
+		destroyPQExpBuffer(hbaLines[1]);
+
+		return false;
+	}
+
+	/* pghba_append_rule_to_buffer destroys the buffer on failure */
+	if (!pghba_append_rule_to_buffer(hbaLines[0],
+									 ssl,
+									 HBA_DATABASE_REPLICATION,
+									 NULL,
+									 username,
+									 host,
+									 authenticationScheme))
+	{
+		/* errors have already been logged */
+		destroyPQExpBuffer(hbaLines[1]);
+		return false;
+	}
+
+	if (!pghba_append_rule_to_buffer(hbaLines[1],
+									 ssl,
+									 HBA_DATABASE_DBNAME,
+									 database,
+									 username,
+									 host,
+									 authenticationScheme))
+	{
+		/* errors have already been logged */
+		destroyPQExpBuffer(hbaLines[0]);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * pghba_index_stat fetches the properties of the HBA file that we use to
+ * know if our in-memory index is still valid.
+ */
+static bool
+pghba_index_stat(const char *hbaFilePath,
+				 ino_t *inode, off_t *size, int64_t *mtime)
+{
+	struct stat buf;
+
+	if (stat(hbaFilePath, &buf) != 0)
+	{
+		log_error("Failed to get file information for \"%s\": %m",
+				  hbaFilePath);
+		return false;
+	}
+
+	*inode = buf.st_ino;
+	*size = buf.st_size;
+	*mtime = ST_MTIME_S(buf);
+
+	return true;
+}
+
+
+/*
+ * pghba_index_load ensures that the in-memory index of the HBA rules matches
+ * the current contents of the given HBA file, reading and parsing the file
+ * again only when it has changed on-disk since we last did.
+ */
+static bool
+pghba_index_load(HBARuleIndex *index, const char *hbaFilePath)
+{
+	ino_t inode = 0;
+	off_t size = 0;
+	int64_t mtime = 0;
+
+	if (!pghba_index_stat(hbaFilePath, &inode, &size, &mtime))
+	{
+		/* errors have already been logged */
+		pghba_index_reset(index);
+		return false;
+	}
+
+	if (index->contents != NULL &&
+		strcmp(index->hbaFilePath, hbaFilePath) == 0 &&
+		index->inode == inode &&
+		index->size == size &&
+		index->mtime == mtime)
+	{
+		log_trace("pghba_index_load: \"%s\" has not changed", hbaFilePath);
+		return true;
+	}
+
+	pghba_index_reset(index);
+
+	char *contents = NULL;
+	long fileSize = 0L;
+
+	if (!read_file(hbaFilePath, &contents, &fileSize))
+	{
+		/* read_file logs an error */
+		return false;
+	}
+
+	strlcpy(index->hbaFilePath, hbaFilePath, sizeof(index->hbaFilePath));
+	index->inode = inode;
+	index->size = size;
+	index->mtime = mtime;
+	index->contents = contents;
+
+	if (!pghba_index_parse(index))
+	{
+		/* errors have already been logged */
+		pghba_index_reset(index);
+		return false;
+	}
+
+	log_debug("Indexed %d HBA rules from \"%s\", %d of them added "
+			  "by pg_auto_failover",
+			  index->count, hbaFilePath, index->ownedCount);
+
+	return true;
+}
+
+
+/*
+ * pghba_index_set_contents attaches the given contents, that we just wrote to
+ * the HBA file, to our index. The rules we added have been indexed already.
+ */
+static bool
+pghba_index_set_contents(HBARuleIndex *index,
+						 const char *hbaFilePath,
+						 PQExpBuffer contents)
+{
+	char *newContents = strdup(contents->data);
+
+	if (newContents == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		pghba_index_reset(index);
+		return false;
+	}
+
+	free(index->contents);
+	index->contents = newContents;
+
+	if (!pghba_index_stat(hbaFilePath,
+						  &(index->inode), &(index->size), &(index->mtime)))
+	{
+		/* errors have already been logged */
+		pghba_index_reset(index);
 		return false;
 	}
 
-	/* write the new pg_hba.conf, unless --skip-pg-hba has been used */
-	if (hbaLevel >= HBA_EDIT_MINIMAL && hbaLinesAdded > 0)
+	return true;
+}
+
+
+/*
+ * pghba_index_parse adds every rule found in the HBA file contents to the
+ * index. A rule is a line of the file without its comment, if any, and
+ * without leading and trailing spaces, as built by
+ * pghba_append_rule_to_buffer.
+ */
+static bool
+pghba_index_parse(HBARuleIndex *index)
+{
+	char *line = index->contents;
+
+	while (line != NULL && *line != '\0')
 	{
-		log_info("Writing new HBA rules in \"%s\"", hbaFilePath);
+		char *eol = strchr(line, '\n');
+		int lineLength = eol == NULL ? strlen(line) : eol - line;
+
+		char rule[BUFSIZE] = { 0 };
+		int ruleLength = 0;
+		bool inQuotes = false;
 
-		if (!write_file(newHbaContents->data, newHbaContents->len, hbaFilePath))
+		/* skip leading spaces */
+		while (lineLength > 0 && (*line == ' ' || *line == '\t'))
 		{
-			/* write_file logs an error */
-			destroyPQExpBuffer(newHbaContents);
+			++line;
+			--lineLength;
+		}
+
+		/* stop at a comment, out of a quoted string */
+		for (; ruleLength < lineLength; ruleLength++)
+		{
+			if (line[ruleLength] == '"')
+			{
+				inQuotes = !inQuotes;
+			}
+			else if (line[ruleLength] == '#' && !inQuotes)
+			{
+				break;
+			}
+		}
+
+		bool owned =
+			lineLength > ruleLength &&
+			strncmp(line + ruleLength,
+					HBA_LINE_COMMENT + 1,
+					strlen(HBA_LINE_COMMENT + 1)) == 0;
+
+		/* skip trailing spaces */
+		while (ruleLength > 0 &&
+			   (line[ruleLength - 1] == ' ' ||
+				line[ruleLength - 1] == '\t' ||
+				line[ruleLength - 1] == '\r'))
+		{
+			--ruleLength;
+		}
+
+		if (ruleLength > 0 && ruleLength < sizeof(rule))
+		{
+			strlcpy(rule, line, ruleLength + 1);
+
+			if (!pghba_index_add(index, rule, owned))
+			{
+				/* errors have already been logged */
+				return false;
+			}
+		}
+
+		line = eol == NULL ? NULL : eol + 1;
+	}
+
+	return true;
+}
+
+
+/*
+ * hash_hba_rule computes the FNV-1a hash of an HBA rule.
+ */
+static uint32_t
+hash_hba_rule(const char *rule)
+{
+	uint32_t hash = 2166136261U;
+
+	for (const char *ptr = rule; *ptr != '\0'; ptr++)
+	{
+		hash ^= (unsigned char) *ptr;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+
+/*
+ * pghba_index_contains returns true when the given rule is found in the
+ * index.
+ */
+static bool
+pghba_index_contains(HBARuleIndex *index, const char *rule)
+{
+	if (index->capacity == 0)
+	{
+		return false;
+	}
+
+	uint32_t mask = index->capacity - 1;
+
+	for (uint32_t slot = hash_hba_rule(rule) & mask;
+		 index->rules[slot] != NULL;
+		 slot = (slot + 1) & mask)
+	{
+		if (strcmp(index->rules[slot], rule) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * pghba_index_add adds a copy of the given rule to the index, unless it's
+ * already there. The hash table is kept at most half full.
+ */
+static bool
+pghba_index_add(HBARuleIndex *index, const char *rule, bool owned)
+{
+	if (pghba_index_contains(index, rule))
+	{
+		return true;
+	}
+
+	if (2 * (index->count + 1) > index->capacity)
+	{
+		int capacity = index->capacity == 0 ? 64 : 2 * index->capacity;
+		char **rules = (char **) calloc(capacity, sizeof(char *));
+
+		if (rules == NULL)
+		{
+			log_error(ALLOCATION_FAILED_ERROR);
 			return false;
 		}
+
+		for (int i = 0; i < index->capacity; i++)
+		{
+			if (index->rules[i] != NULL)
+			{
+				uint32_t slot = hash_hba_rule(index->rules[i]) & (capacity - 1);
+
+				while (rules[slot] != NULL)
+				{
+					slot = (slot + 1) & (capacity - 1);
+				}
+
+				rules[slot] = index->rules[i];
+			}
+		}
+
+		free(index->rules);
+		index->rules = rules;
+		index->capacity = capacity;
 	}
 
-	destroyPQExpBuffer(newHbaContents);
+	char *entry = strdup(rule);
 
-	log_debug("Wrote new %s", hbaFilePath);
+	if (entry == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return false;
+	}
+
+	uint32_t mask = index->capacity - 1;
+	uint32_t slot = hash_hba_rule(rule) & mask;
+
+	while (index->rules[slot] != NULL)
+	{
+		slot = (slot + 1) & mask;
+	}
+
+	index->rules[slot] = entry;
+	++(index->count);
+
+	if (owned)
+	{
+		++(index->ownedCount);
+	}
 
 	return true;
 }
 
 
+/*
+ * pghba_index_reset releases the memory used by the index, which is then
+ * loaded again from the HBA file at next use.
+ */
+static void
+pghba_index_reset(HBARuleIndex *index)
+{
+	for (int i = 0; i < index->capacity; i++)
+	{
+		free(index->rules[i]);
+	}
+
+	free(index->rules);
+	free(index->contents);
+
+	memset(index, 0, sizeof(HBARuleIndex));
+}
+
+
 /*
  * append_database_field writes the database field to destination according to
  * the databaseType. If the type is HBA_DATABASE_DBNAME then the databaseName
@@ -739,8 +1134,8 @@ pghba_check_hostname(const char *hostname,
 
 	bool foundHostnameFromAddress = false;
 
-	if (!resolveHostnameForwardAndReverse(hostname, ipaddr, size,
-										  &foundHostnameFromAddress))
+	if (!dns_cache_resolve_forward_and_reverse(hostname, ipaddr, size,
+											   &foundHostnameFromAddress))
 	{
 		/* errors have already been logged (DNS failure) */
 		*useHostname = true;
@@ -37,7 +37,8 @@ bool pghba_ensure_host_rules_exist(const char *hbaFilePath,
 								   const char *database,
 								   const char *username,
 								   const char *authenticationScheme,
-								   HBAEditLevel hbaLevel);
+								   HBAEditLevel hbaLevel,
+								   bool *hbaChanged);
 
 bool pghba_enable_lan_cidr(PGSQL *pgsql,
 						   bool ssl,
@@ -10,6 +10,7 @@
  */
 
 #include <inttypes.h>
+#include <poll.h>
 #include <pwd.h>
 #include <signal.h>
 #include <stdlib.h>
@@ -18,10 +19,15 @@
 #include <time.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
 #include "parson.h"
 
 #include "postgres_fe.h"
 #include "pqexpbuffer.h"
+#include "portability/instr_time.h"
 
 #include "defaults.h"
 #include "env_utils.h"
@@ -31,10 +37,36 @@
 #include "signals.h"
 #include "string_utils.h"
 
+/*
+ * The socket directory that we failed to connect through, when our setup
+ * uses a TCP hostname, see pg_setup_reject_local_socket().
+ */
+static char rejectedSocketDir[MAXPGPATH] = { 0 };
+
+static bool pg_setup_local_socket_exists(PostgresSetup *pgSetup);
+
+
+/*
+ * When waiting for Postgres to be ready, we follow the changes made to the
+ * postmaster.pid file. On Linux we wait for inotify events on the PGDATA
+ * directory, elsewhere we probe the file with an exponential backoff.
+ */
+#define PIDFILE_WAIT_MIN_MS 5
+#define PIDFILE_WAIT_MAX_MS 100
+
+typedef struct PidFileWatch
+{
+	int fd;                   /* inotify file descriptor, or -1 */
+	int sleepMs;              /* current backoff delay */
+} PidFileWatch;
 
 static bool get_pgpid(PostgresSetup *pgSetup, bool pgIsNotRunningIsOk);
 static PostmasterStatus pmStatusFromString(const char *postmasterStatus);
 
+static void pidfile_watch_init(PidFileWatch *watch, const char *pgdata);
+static void pidfile_watch_wait(PidFileWatch *watch);
+static void pidfile_watch_finish(PidFileWatch *watch);
+
 
 /*
  * Discover PostgreSQL environment from given clues, or a partial setup.
@@ -79,6 +111,11 @@ pg_setup_init(PostgresSetup *pgSetup,
 		strlcpy(pgSetup->hbaLevelStr, options->hbaLevelStr, NAMEDATALEN);
 	}
 
+	/*
+	 * Also make sure that we keep the workload to tune Postgres for.
+	 */
+	strlcpy(pgSetup->tuningProfile, options->tuningProfile, NAMEDATALEN);
+
 	/*
 	 * Make sure that we keep the SSL options too.
 	 */
@@ -555,6 +592,9 @@ read_pg_pidfile(PostgresSetup *pgSetup, bool pgIsNotRunningIsOk, int maxRetries)
 		return false;
 	}
 
+	/* Postgres might have been restarted with another socket directory */
+	memset(pgSetup->pidFile.socketDir, 0, sizeof(pgSetup->pidFile.socketDir));
+
 	for (lineno = 1; lineno <= LOCK_FILE_LINE_PM_STATUS; lineno++)
 	{
 		if (fgets(line, sizeof(line), fp) == NULL)
@@ -644,6 +684,8 @@ read_pg_pidfile(PostgresSetup *pgSetup, bool pgIsNotRunningIsOk, int maxRetries)
 		{
 			if (lineLength > 0)
 			{
+				strlcpy(pgSetup->pidFile.socketDir, line, MAXPGPATH);
+
 				int n = strlcpy(pgSetup->pghost, line, _POSIX_HOST_NAME_MAX);
 
 				if (n >= _POSIX_HOST_NAME_MAX)
@@ -776,6 +818,9 @@ pg_setup_get_local_connection_string(PostgresSetup *pgSetup,
 		return false;
 	}
 
+	char host[MAXPGPATH] = { 0 };
+	bool unixSocket = false;
+
 	appendPQExpBuffer(connStringBuffer, "port=%d dbname=%s",
 					  pgSetup->pgport, pgSetup->dbname);
 
@@ -787,22 +832,12 @@ pg_setup_get_local_connection_string(PostgresSetup *pgSetup,
 		return false;
 	}
 
-	/*
-	 * When PG_REGRESS_SOCK_DIR is set and empty, we force the connection
-	 * string to use "localhost" (TCP/IP hostname for IP 127.0.0.1 or ::1,
-	 * usually), even when the configuration setup is using a unix directory
-	 * setting.
-	 */
-	if (env_found_empty("PG_REGRESS_SOCK_DIR") &&
-		(IS_EMPTY_STRING_BUFFER(pgSetup->pghost) ||
-		 pgSetup->pghost[0] == '/'))
-	{
-		appendPQExpBufferStr(connStringBuffer, " host=localhost");
-	}
-	else if (!IS_EMPTY_STRING_BUFFER(pgSetup->pghost))
+	(void) pg_setup_get_local_host(pgSetup, host, sizeof(host), &unixSocket);
+
+	if (!IS_EMPTY_STRING_BUFFER(host))
 	{
 		if (pg_regress_sock_dir_exists && strlen(pg_regress_sock_dir) > 0 &&
-			strcmp(pgSetup->pghost, pg_regress_sock_dir) != 0)
+			strcmp(host, pg_regress_sock_dir) != 0)
 		{
 			/*
 			 * It might turn out ok (stray environment), but in case of
@@ -812,9 +847,9 @@ pg_setup_get_local_connection_string(PostgresSetup *pgSetup,
 			log_warn("PG_REGRESS_SOCK_DIR is set to \"%s\", "
 					 "and our setup is using \"%s\"",
 					 pg_regress_sock_dir,
-					 pgSetup->pghost);
+					 host);
 		}
-		appendPQExpBuffer(connStringBuffer, " host=%s", pgSetup->pghost);
+		appendPQExpBuffer(connStringBuffer, " host=%s", host);
 	}
 
 	if (!IS_EMPTY_STRING_BUFFER(pgSetup->username))
@@ -847,6 +882,123 @@ pg_setup_get_local_connection_string(PostgresSetup *pgSetup,
 }
 
 
+/*
+ * pg_setup_get_local_host sets host to the host that pg_autoctl connects to
+ * for the local Postgres instance, and unixSocket to true when that's a Unix
+ * domain socket directory. The host is empty when we let libpq use its
+ * default socket directory.
+ *
+ * Connections through a Unix socket skip the TCP and TLS handshakes that a
+ * connection to localhost costs when SSL is enabled, so when our setup uses
+ * a TCP hostname and the Postgres pidfile gives us the socket directory of
+ * the running instance, we prefer that directory, as long as the socket file
+ * for our port is there. The TCP hostname might have been given on purpose,
+ * for instance because the HBA rules for local connections don't accept us,
+ * so once a connection through that directory has failed, see
+ * pg_setup_reject_local_socket(), we use TCP again.
+ *
+ * When PG_REGRESS_SOCK_DIR is set and empty, we force the connection string
+ * to use "localhost" (TCP/IP hostname for IP 127.0.0.1 or ::1, usually),
+ * even when the configuration setup is using a unix directory setting.
+ */
+bool
+pg_setup_get_local_host(PostgresSetup *pgSetup,
+						char *host, size_t size, bool *unixSocket)
+{
+	bool forceTCP = env_found_empty("PG_REGRESS_SOCK_DIR");
+
+	if (forceTCP &&
+		(IS_EMPTY_STRING_BUFFER(pgSetup->pghost) ||
+		 pgSetup->pghost[0] == '/'))
+	{
+		strlcpy(host, "localhost", size);
+		*unixSocket = false;
+	}
+	else if (IS_EMPTY_STRING_BUFFER(pgSetup->pghost) ||
+			 pgSetup->pghost[0] == '/')
+	{
+		strlcpy(host, pgSetup->pghost, size);
+		*unixSocket = true;
+	}
+	else if (!forceTCP &&
+			 !IS_EMPTY_STRING_BUFFER(pgSetup->pidFile.socketDir) &&
+			 strcmp(pgSetup->pidFile.socketDir, rejectedSocketDir) != 0 &&
+			 pg_setup_local_socket_exists(pgSetup))
+	{
+		strlcpy(host, pgSetup->pidFile.socketDir, size);
+		*unixSocket = true;
+	}
+	else
+	{
+		strlcpy(host, pgSetup->pghost, size);
+		*unixSocket = false;
+	}
+
+	return true;
+}
+
+
+/*
+ * pg_setup_local_socket_exists returns true when the socket file of our
+ * Postgres port exists in the socket directory found in the pidfile.
+ */
+static bool
+pg_setup_local_socket_exists(PostgresSetup *pgSetup)
+{
+	char socketPath[MAXPGPATH] = { 0 };
+
+	int n = sformat(socketPath, sizeof(socketPath), "%s/.s.PGSQL.%d",
+					pgSetup->pidFile.socketDir, pgSetup->pgport);
+
+	if (n >= (int) sizeof(socketPath))
+	{
+		return false;
+	}
+
+	return file_exists(socketPath);
+}
+
+
+/*
+ * pg_setup_local_socket_preferred returns true when pg_setup_get_local_host()
+ * uses the socket directory from the pidfile rather than the TCP hostname of
+ * our setup.
+ */
+bool
+pg_setup_local_socket_preferred(PostgresSetup *pgSetup)
+{
+	char host[MAXPGPATH] = { 0 };
+	bool unixSocket = false;
+
+	(void) pg_setup_get_local_host(pgSetup, host, sizeof(host), &unixSocket);
+
+	return unixSocket &&
+		   !IS_EMPTY_STRING_BUFFER(pgSetup->pghost) &&
+		   pgSetup->pghost[0] != '/';
+}
+
+
+/*
+ * pg_setup_reject_local_socket is called when we failed to connect through
+ * the socket directory that pg_setup_get_local_host() preferred to our TCP
+ * hostname: we then use the TCP hostname for the rest of this process, or
+ * until Postgres uses another socket directory. When rejected is false, we
+ * prefer the socket directory again.
+ */
+void
+pg_setup_reject_local_socket(PostgresSetup *pgSetup, bool rejected)
+{
+	if (rejected)
+	{
+		strlcpy(rejectedSocketDir, pgSetup->pidFile.socketDir, MAXPGPATH);
+	}
+	else
+	{
+		memset(rejectedSocketDir, 0, sizeof(rejectedSocketDir));
+	}
+}
+
+
 /*
  * pg_setup_pgdata_exists returns true when PGDATA exists, hosts a
  * global/pg_control file (so that it looks like a Postgres cluster) and when
@@ -1019,13 +1171,15 @@ pg_setup_is_ready(PostgresSetup *pgSetup, bool pgIsNotRunningIsOk)
 
 /*
  * pg_setup_wait_until_is_ready loops over pg_setup_is_running() and returns
- * when Postgres is ready. The loop tries every 100ms up to the given timeout,
- * given in seconds.
+ * when Postgres is ready. The loop probes postmaster.pid again each time the
+ * file is changed, or at least every 100ms, up to the given timeout, given in
+ * seconds.
  */
 bool
 pg_setup_wait_until_is_ready(PostgresSetup *pgSetup, int timeout, int logLevel)
 {
 	uint64_t startTime = time(NULL);
+	instr_time startInstrTime;
 	int attempts = 0;
 
 	pid_t previousPostgresPid = pgSetup->pidFile.pid;
@@ -1035,15 +1189,18 @@ pg_setup_wait_until_is_ready(PostgresSetup *pgSetup, int timeout, int logLevel)
 	bool missingPgdataIsOk = false;
 	bool postgresNotRunningIsOk = true;
 
+	PidFileWatch watch = { 0 };
+
 	log_trace("pg_setup_wait_until_is_ready");
 
+	INSTR_TIME_SET_CURRENT(startInstrTime);
+
+	(void) pidfile_watch_init(&watch, pgSetup->pgdata);
+
 	for (attempts = 1; !pgIsRunning; attempts++)
 	{
 		uint64_t now = time(NULL);
 
-		/* sleep 100 ms in between postmaster.pid probes */
-		pg_usleep(100 * 1000);
-
 		pgIsRunning = get_pgpid(pgSetup, postgresNotRunningIsOk) &&
 					  pgSetup->pidFile.pid > 0;
 
@@ -1060,10 +1217,13 @@ pg_setup_wait_until_is_ready(PostgresSetup *pgSetup, int timeout, int logLevel)
 		}
 
 		/* we're done if we reach the timeout */
-		if ((now - startTime) >= timeout)
+		if (pgIsRunning || (now - startTime) >= timeout)
 		{
 			break;
 		}
+
+		/* wait until postmaster.pid changes, or for a short while */
+		(void) pidfile_watch_wait(&watch);
 	}
 
 	/*
@@ -1085,6 +1245,7 @@ pg_setup_wait_until_is_ready(PostgresSetup *pgSetup, int timeout, int logLevel)
 		{
 			/* errors have already been logged */
 			log_error("pg_setup_wait_until_is_ready: pg_setup_init is false");
+			(void) pidfile_watch_finish(&watch);
 			return false;
 		}
 
@@ -1098,7 +1259,8 @@ pg_setup_wait_until_is_ready(PostgresSetup *pgSetup, int timeout, int logLevel)
 	 * Ok so we have a postmaster.pid file with a pid > 0 (not a standalone
 	 * backend, the service has started). Postgres might still be "starting"
 	 * rather than "ready" though, so let's continue our attempts and make sure
-	 * that Postgres is ready.
+	 * that Postgres is ready. The postmaster updates the status line of its
+	 * pidfile when it's ready, which wakes us up.
 	 */
 	for (; !pgIsReady; attempts++)
 	{
@@ -1119,15 +1281,17 @@ pg_setup_wait_until_is_ready(PostgresSetup *pgSetup, int timeout, int logLevel)
 		}
 
 		/* we're done if we reach the timeout */
-		if ((now - startTime) >= timeout)
+		if (pgIsReady || (now - startTime) >= timeout)
 		{
 			break;
 		}
 
-		/* sleep 100 ms in between postmaster.pid probes */
-		pg_usleep(100 * 1000);
+		/* wait until postmaster.pid changes, or for a short while */
+		(void) pidfile_watch_wait(&watch);
 	}
 
+	(void) pidfile_watch_finish(&watch);
+
 	if (!pgIsReady)
 	{
 		/* offer more diagnostic information to the user */
@@ -1141,14 +1305,101 @@ pg_setup_wait_until_is_ready(PostgresSetup *pgSetup, int timeout, int logLevel)
 		return pgIsReady;
 	}
 
+	instr_time duration;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startInstrTime);
+
 	/* here we know that pgIsReady is true */
 	log_level(logLevel,
-			  "Postgres is now serving PGDATA \"%s\" on port %d with pid %d",
-			  pgSetup->pgdata, pgSetup->pgport, pgSetup->pidFile.pid);
+			  "Postgres is now serving PGDATA \"%s\" on port %d with pid %d "
+			  "(ready after %.0f ms)",
+			  pgSetup->pgdata, pgSetup->pgport, pgSetup->pidFile.pid,
+			  INSTR_TIME_GET_MILLISEC(duration));
 	return true;
 }
 
 
+/*
+ * pidfile_watch_init prepares to wait for changes in the postmaster.pid file
+ * of the given PGDATA. As the file might not exist yet, on Linux we watch the
+ * PGDATA directory itself for files being created or written to.
+ */
+static void
+pidfile_watch_init(PidFileWatch *watch, const char *pgdata)
+{
+	watch->fd = -1;
+	watch->sleepMs = PIDFILE_WAIT_MIN_MS;
+
+#ifdef __linux__
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (fd < 0)
+	{
+		log_debug("Failed to initialize inotify: %m");
+		return;
+	}
+
+	if (inotify_add_watch(fd, pgdata,
+						  IN_CREATE | IN_MODIFY |
+						  IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		log_debug("Failed to watch directory \"%s\": %m", pgdata);
+		close(fd);
+		return;
+	}
+
+	watch->fd = fd;
+#endif
+}
+
+
+/*
+ * pidfile_watch_wait waits until a file is changed in PGDATA, or for at most
+ * PIDFILE_WAIT_MAX_MS milliseconds. Without inotify, we sleep for an
+ * increasing amount of time, starting at PIDFILE_WAIT_MIN_MS.
+ */
+static void
+pidfile_watch_wait(PidFileWatch *watch)
+{
+	if (watch->fd < 0)
+	{
+		pg_usleep(watch->sleepMs * 1000L);
+
+		watch->sleepMs = Min(watch->sleepMs * 2, PIDFILE_WAIT_MAX_MS);
+		return;
+	}
+
+#ifdef __linux__
+	struct pollfd pfd = { .fd = watch->fd, .events = POLLIN };
+
+	if (poll(&pfd, 1, PIDFILE_WAIT_MAX_MS) > 0)
+	{
+		char buffer[4096]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+		/* we don't need the events themselves, just drain the queue */
+		while (read(watch->fd, buffer, sizeof(buffer)) > 0)
+		{ }
+	}
+#endif
+}
+
+
+/*
+ * pidfile_watch_finish releases the resources used to watch postmaster.pid.
+ */
+static void
+pidfile_watch_finish(PidFileWatch *watch)
+{
+	if (watch->fd >= 0)
+	{
+		close(watch->fd);
+		watch->fd = -1;
+	}
+}
+
+
 /*
  * pg_setup_wait_until_is_stopped loops over pg_ctl_status() and returns when
  * Postgres is stopped. The loop tries every 100ms up to the given timeout,
@@ -1961,6 +2212,33 @@ pgsetup_parse_hba_level(const char *level)
 }
 
 
+/*
+ * pgsetup_parse_tuning_profile parses a string that represents a
+ * PgTuningProfile value. An empty string is the unknown profile.
+ */
+PgTuningProfile
+pgsetup_parse_tuning_profile(const char *profile)
+{
+	PgTuningProfile enumArray[] = {
+		PG_TUNING_PROFILE_MIXED,
+		PG_TUNING_PROFILE_OLTP,
+		PG_TUNING_PROFILE_OLAP
+	};
+
+	char *profileArray[] = { "mixed", "oltp", "olap", NULL };
+
+	for (int i = 0; profileArray[i] != NULL; i++)
+	{
+		if (strcmp(profile, profileArray[i]) == 0)
+		{
+			return enumArray[i];
+		}
+	}
+
+	return PG_TUNING_PROFILE_UNKNOWN;
+}
+
+
 /*
  * pgsetup_hba_level_to_string returns the string representation of an
  * hbaLevel enum value.
@@ -56,6 +56,10 @@ typedef struct pg_control_data
 	DBState state;                      /* see enum above */
 	char latestCheckpointLSN[PG_LSN_MAXLENGTH];
 	uint32_t timeline_id;
+
+	/* only from pg_controldata, where crash recovery starts */
+	char latestCheckpointRedoLSN[PG_LSN_MAXLENGTH];
+	uint32_t wal_segment_size;
 } PostgresControlData;
 
 /*
@@ -67,6 +71,7 @@ typedef struct pg_pidfile
 {
 	pid_t pid;
 	unsigned short port;
+	char socketDir[MAXPGPATH];  /* first of unix_socket_directories */
 } PostgresPIDFile;
 
 /*
@@ -172,6 +177,18 @@ typedef enum
 	HBA_EDIT_LAN,
 } HBAEditLevel;
 
+/*
+ * Which workload do we tune Postgres for? The default, unknown, keeps the
+ * basic tuning based on the RAM and CPU count only.
+ */
+typedef enum
+{
+	PG_TUNING_PROFILE_UNKNOWN = 0,
+	PG_TUNING_PROFILE_MIXED,
+	PG_TUNING_PROFILE_OLTP,
+	PG_TUNING_PROFILE_OLAP
+} PgTuningProfile;
+
 /*
  * pg_auto_failover also support SSL settings.
  */
@@ -222,6 +239,7 @@ typedef struct pg_setup
 	char authMethod[NAMEDATALEN];           /* auth method, defaults to trust */
 	char hbaLevelStr[NAMEDATALEN];          /* user choice of HBA editing */
 	HBAEditLevel hbaLevel;                  /* user choice of HBA editing */
+	char tuningProfile[NAMEDATALEN];        /* oltp, olap, or mixed */
 	PostmasterStatus pm_status;             /* Postmaster status */
 	bool is_in_recovery;                    /* select pg_is_in_recovery() */
 	PostgresControlData control;            /* pg_controldata pgdata */
@@ -248,6 +266,10 @@ bool pg_setup_as_json(PostgresSetup *pgSetup, JSON_Value *js);
 
 bool pg_setup_get_local_connection_string(PostgresSetup *pgSetup,
 										  char *connectionString);
+bool pg_setup_get_local_host(PostgresSetup *pgSetup,
+							 char *host, size_t size, bool *unixSocket);
+bool pg_setup_local_socket_preferred(PostgresSetup *pgSetup);
+void pg_setup_reject_local_socket(PostgresSetup *pgSetup, bool rejected);
 bool pg_setup_pgdata_exists(PostgresSetup *pgSetup);
 bool pg_setup_is_running(PostgresSetup *pgSetup);
 PostgresRole pg_setup_role(PostgresSetup *pgSetup);
@@ -277,6 +299,7 @@ bool pg_setup_standby_slot_supported(PostgresSetup *pgSetup, int logLevel);
 
 HBAEditLevel pgsetup_parse_hba_level(const char *level);
 char * pgsetup_hba_level_to_string(HBAEditLevel hbaLevel);
+PgTuningProfile pgsetup_parse_tuning_profile(const char *profile);
 const char * dbstateToString(DBState state);
 
 #endif /* PGSETUP_H */
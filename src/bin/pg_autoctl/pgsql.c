@@ -6,6 +6,7 @@
  * Licensed under the PostgreSQL License.
  *
  */
+#include <poll.h>
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
@@ -22,6 +23,7 @@
 
 #include "cli_root.h"
 #include "defaults.h"
+#include "file_utils.h"
 #include "log.h"
 #include "parsing.h"
 #include "pgsql.h"
@@ -36,26 +38,68 @@
 #define STR_ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE "55000"
 #define STR_ERRCODE_OBJECT_IN_USE "55006"
 #define STR_ERRCODE_UNDEFINED_OBJECT "42704"
+#define STR_ERRCODE_MONITOR_BUSY "53Z01"
+#define STR_ERRCODE_LOCK_NOT_AVAILABLE "55P03"
 
 static char * ConnectionTypeToString(ConnectionType connectionType);
 static void log_connection_error(PGconn *connection, int logLevel);
 static void pgAutoCtlDefaultNoticeProcessor(void *arg, const char *message);
 static void pgAutoCtlDebugNoticeProcessor(void *arg, const char *message);
 static PGconn * pgsql_open_connection(PGSQL *pgsql);
+static PGconn * pgsql_connect(PGSQL *pgsql, bool nonBlocking);
+static PostgresPollingStatusType pgsql_poll_pending_connection(PGSQL *pgsql,
+															   bool wait);
+static bool pgsql_complete_pending_connection(PGSQL *pgsql);
+static void pgsql_close_persistent_connection(PGSQL *pgsql);
 static bool pgsql_retry_open_connection(PGSQL *pgsql);
+static bool pgsql_execute_statement(PGSQL *pgsql, const char *stmtName,
+									const char *sql, int paramCount,
+									const Oid *paramTypes,
+									const char **paramValues,
+									void *context,
+									ParsePostgresResultCB *parseFun);
+static PGresult * pgsql_execute_with_deadline(PGSQL *pgsql, PGconn *connection,
+											 const char *stmtName,
+											 const char *sql, int paramCount,
+											 const Oid *paramTypes,
+											 const char **paramValues,
+											 bool *timedOut);
+static bool pgsql_wait_for_result(PGSQL *pgsql, PGconn *connection,
+								  instr_time startTime);
+static void pgsql_cancel_query(PGSQL *pgsql, PGconn *connection);
+static bool pgsql_prepare_statement(PGSQL *pgsql, const char *stmtName,
+									const char *sql, int paramCount,
+									const Oid *paramTypes);
+static bool pgsql_execute_pipeline_queries(PGSQL *pgsql,
+										   PGSQLQuery *queries,
+										   int queryCount);
+static void pgsql_log_monitor_record(PGSQL *pgsql, const char *sql,
+									 int queryCount,
+									 instr_time startTime, bool success);
 static bool is_response_ok(PGresult *result);
+static void format_debug_parameters(int paramCount, const char **paramValues,
+									char *buffer, int size);
+static void log_query_error(PGSQL *pgsql, PGresult *result,
+							const char *sql, const char *debugParameters,
+							void *context);
 static bool clear_results(PGSQL *pgsql);
 static void pgsql_handle_notifications(PGSQL *pgsql);
 static bool pgsql_alter_system_set(PGSQL *pgsql, GUC setting);
 static bool pgsql_get_current_setting(PGSQL *pgsql, char *settingName,
 									  char **currentValue);
 static void parsePgMetadata(void *ctx, PGresult *result);
+static void parseStandbyLSNs(void *ctx, PGresult *result);
 static void parsePgReachedTargetLSN(void *ctx, PGresult *result);
 static void parseReplicationSlotMaintain(void *ctx, PGresult *result);
+static void parseReplicationSlotRetention(void *ctx, PGresult *result);
 static void parsePgReachedTargetLSN(void *ctx, PGresult *result);
 static void parseIdentifySystemResult(void *ctx, PGresult *result);
+static void parseBackupStopResult(void *ctx, PGresult *result);
 static void parseTimelineHistoryResult(void *ctx, PGresult *result);
 
+/* fallback_application_name of the connections we open, see below */
+static char pgsqlApplicationName[BUFSIZE] = { 0 };
+
 
 /*
  * parseSingleValueResult is a ParsePostgresResultCB callback that reads the
@@ -151,6 +195,11 @@ pgsql_init(PGSQL *pgsql, char *url, ConnectionType connectionType)
 {
 	pgsql->connectionType = connectionType;
 	pgsql->connection = NULL;
+	pgsql->pendingConnection = NULL;
+	pgsql->statementTimeoutMs = 0;
+	pgsql->connectionStatementTimeoutMs = 0;
+	pgsql->lockTimeoutMs = 0;
+	pgsql->connectionLockTimeoutMs = 0;
 
 	/* set our default retry policy for interactive commands */
 	(void) pgsql_set_interactive_retry_policy(&(pgsql->retryPolicy));
@@ -186,9 +235,12 @@ pgsql_set_retry_policy(ConnectionRetryPolicy *retryPolicy,
 	retryPolicy->maxSleepTime = maxSleepTime;
 	retryPolicy->baseSleepTime = baseSleepTime;
 
-	/* initialize a seed for our random number generator */
+	/*
+	 * Initialize a seed for our random number generator. Many nodes retrying
+	 * after the same failure must not pick the same random sleep times.
+	 */
 #if PG_MAJORVERSION_NUM < 15
-	pg_srand48(time(0));
+	pg_srand48((long) (getpid() ^ time(NULL)));
 #else
 	pg_prng_seed(&(retryPolicy->prng_state), (uint64) (getpid() ^ time(NULL)));
 #endif
@@ -281,7 +333,8 @@ pgsql_set_monitor_interactive_retry_policy(ConnectionRetryPolicy *retryPolicy)
 
 /*
  * pick_random_sleep_time picks a random sleep time between the given policy
- * base sleep time and 3 times the previous sleep time. See below in
+ * base sleep time and 3 times the previous sleep time, or 3 times the base
+ * sleep time on the first attempt. See below in
  * pgsql_compute_connection_retry_sleep_time for a deep dive into why we are
  * interested in this computation.
  */
@@ -294,9 +347,14 @@ pick_random_sleep_time(ConnectionRetryPolicy *retryPolicy)
 	uint32_t random = pg_prng_uint32(&(retryPolicy->prng_state));
 #endif
 
+	int previousSleepTime =
+		retryPolicy->sleepTime > retryPolicy->baseSleepTime
+		? retryPolicy->sleepTime
+		: retryPolicy->baseSleepTime;
+
 	return random_between(random,
 						  retryPolicy->baseSleepTime,
-						  retryPolicy->sleepTime * 3);
+						  previousSleepTime * 3);
 }
 
 
@@ -442,6 +500,12 @@ ConnectionTypeToString(ConnectionType connectionType)
 void
 pgsql_finish(PGSQL *pgsql)
 {
+	if (pgsql->pendingConnection != NULL)
+	{
+		PQfinish(pgsql->pendingConnection);
+		pgsql->pendingConnection = NULL;
+	}
+
 	if (pgsql->connection != NULL)
 	{
 		char scrubbedConnectionString[MAXCONNINFO] = { 0 };
@@ -474,6 +538,20 @@ pgsql_finish(PGSQL *pgsql)
 }
 
 
+/*
+ * pgsql_close_persistent_connection closes the connection of a PGSQL client
+ * in PGSQL_CONNECTION_PERSISTENT mode and keeps the client in that mode, so
+ * that the next query opens a new connection that is kept open again.
+ */
+static void
+pgsql_close_persistent_connection(PGSQL *pgsql)
+{
+	PQfinish(pgsql->connection);
+	pgsql->connection = NULL;
+	pgsql->preparedStatementCount = 0;
+}
+
+
 /*
  * log_connection_error logs the PQerrorMessage from the given connection.
  */
@@ -515,10 +593,31 @@ log_connection_error(PGconn *connection, int logLevel)
 static PGconn *
 pgsql_open_connection(PGSQL *pgsql)
 {
+	/* a persistent connection might have been closed by the server */
+	if (pgsql->connection != NULL &&
+		pgsql->connectionStatementType == PGSQL_CONNECTION_PERSISTENT &&
+		PQstatus(pgsql->connection) == CONNECTION_BAD)
+	{
+		log_debug("Reconnecting to [%s]: the connection has been lost",
+				  ConnectionTypeToString(pgsql->connectionType));
+		(void) pgsql_close_persistent_connection(pgsql);
+	}
+
+	/* the statement_timeout and lock_timeout are set when connecting */
+	if (pgsql->connection != NULL &&
+		pgsql->connectionStatementType == PGSQL_CONNECTION_PERSISTENT &&
+		(pgsql->connectionStatementTimeoutMs != pgsql->statementTimeoutMs ||
+		 pgsql->connectionLockTimeoutMs != pgsql->lockTimeoutMs))
+	{
+		log_debug("Reconnecting to [%s]: the statement or lock timeout changed",
+				  ConnectionTypeToString(pgsql->connectionType));
+		(void) pgsql_close_persistent_connection(pgsql);
+	}
+
 	/* we might be connected already */
 	if (pgsql->connection != NULL)
 	{
-		if (pgsql->connectionStatementType != PGSQL_CONNECTION_MULTI_STATEMENT)
+		if (pgsql->connectionStatementType == PGSQL_CONNECTION_SINGLE_STATEMENT)
 		{
 			log_error("BUG: requested to open an already open connection in "
 					  "non PGSQL_CONNECTION_MULTI_STATEMENT mode");
@@ -528,6 +627,21 @@ pgsql_open_connection(PGSQL *pgsql)
 		return pgsql->connection;
 	}
 
+	/* prepared statements are tied to the connection */
+	pgsql->preparedStatementCount = 0;
+
+	/* use the connection that pgsql_start_connection started, if any */
+	if (pgsql_complete_pending_connection(pgsql))
+	{
+		pgsql->status = PG_CONNECTION_OK;
+
+		PQsetNoticeProcessor(pgsql->connection,
+							 &pgAutoCtlDefaultNoticeProcessor,
+							 NULL);
+
+		return pgsql->connection;
+	}
+
 	char scrubbedConnectionString[MAXCONNINFO] = { 0 };
 
 	(void) parse_and_scrub_connection_string(pgsql->connectionString,
@@ -545,7 +659,7 @@ pgsql_open_connection(PGSQL *pgsql)
 	INSTR_TIME_SET_ZERO(pgsql->retryPolicy.connectTime);
 
 	/* Make a connection to the database */
-	pgsql->connection = PQconnectdb(pgsql->connectionString);
+	pgsql->connection = pgsql_connect(pgsql, false);
 
 	/* Check to see that the backend connection was successfully made */
 	if (PQstatus(pgsql->connection) != CONNECTION_OK)
@@ -596,6 +710,257 @@ pgsql_open_connection(PGSQL *pgsql)
 }
 
 
+/*
+ * pgsql_set_application_name sets the fallback_application_name of the
+ * connections that we open from now on, NULL or an empty string to reset it.
+ * The keeper uses it to stamp its connections with the trace id of the
+ * monitor decision it is carrying out, which then shows in pg_stat_activity
+ * and in the server logs. An application_name given in the connection string
+ * takes precedence.
+ */
+void
+pgsql_set_application_name(const char *applicationName)
+{
+	if (applicationName == NULL)
+	{
+		pgsqlApplicationName[0] = '\0';
+		return;
+	}
+
+	strlcpy(pgsqlApplicationName, applicationName, sizeof(pgsqlApplicationName));
+}
+
+
+/*
+ * pgsql_connect connects to the database with PQconnectdbParams, or starts
+ * connecting with PQconnectStartParams when nonBlocking is true. When the
+ * client has a statement timeout, the session is opened with the matching
+ * statement_timeout, so that the server also stops working on queries that
+ * we have stopped waiting for.
+ */
+static PGconn *
+pgsql_connect(PGSQL *pgsql, bool nonBlocking)
+{
+	char options[BUFSIZE] = { 0 };
+	int paramCount = 1;
+
+	const char *keywords[] = { "dbname", NULL, NULL, NULL };
+	const char *values[] = { pgsql->connectionString, NULL, NULL, NULL };
+
+	if (pgsql->statementTimeoutMs > 0 && pgsql->lockTimeoutMs > 0)
+	{
+		sformat(options, sizeof(options),
+				"-c statement_timeout=%d -c lock_timeout=%d",
+				pgsql->statementTimeoutMs,
+				pgsql->lockTimeoutMs);
+	}
+	else if (pgsql->statementTimeoutMs > 0)
+	{
+		sformat(options, sizeof(options), "-c statement_timeout=%d",
+				pgsql->statementTimeoutMs);
+	}
+	else if (pgsql->lockTimeoutMs > 0)
+	{
+		sformat(options, sizeof(options), "-c lock_timeout=%d",
+				pgsql->lockTimeoutMs);
+	}
+
+	if (options[0] != '\0')
+	{
+		keywords[paramCount] = "options";
+		values[paramCount] = options;
+		++paramCount;
+	}
+
+	if (pgsqlApplicationName[0] != '\0')
+	{
+		keywords[paramCount] = "fallback_application_name";
+		values[paramCount] = pgsqlApplicationName;
+		++paramCount;
+	}
+
+	pgsql->connectionStatementTimeoutMs = pgsql->statementTimeoutMs;
+	pgsql->connectionLockTimeoutMs = pgsql->lockTimeoutMs;
+
+	/* expand_dbname: our connection string is given as the dbname */
+	if (nonBlocking)
+	{
+		return PQconnectStartParams(keywords, values, 1);
+	}
+
+	return PQconnectdbParams(keywords, values, 1);
+}
+
+
+/*
+ * pgsql_start_connection starts connecting to the database without waiting,
+ * when the client has no connection yet. The TCP, TLS, and authentication
+ * handshakes then progress each time pgsql_continue_connection() is called,
+ * and the next query completes the connection and uses it. This allows the
+ * keeper to connect to the monitor while it checks the local Postgres.
+ *
+ * Returns true when a connection has been started. When it can't be, the
+ * next query connects as usual, and reports errors.
+ */
+bool
+pgsql_start_connection(PGSQL *pgsql)
+{
+	if (pgsql->connection != NULL || pgsql->pendingConnection != NULL)
+	{
+		return false;
+	}
+
+	/* we implement our own retry strategy */
+	setenv("PGCONNECT_TIMEOUT", POSTGRES_CONNECT_TIMEOUT, 1);
+
+	PGconn *connection = pgsql_connect(pgsql, true);
+
+	if (connection == NULL || PQstatus(connection) == CONNECTION_BAD)
+	{
+		PQfinish(connection);
+		return false;
+	}
+
+	log_trace("Started connecting to [%s]",
+			  ConnectionTypeToString(pgsql->connectionType));
+
+	pgsql->pendingConnection = connection;
+	pgsql->pendingPollingStatus = PGRES_POLLING_WRITING;
+
+	return true;
+}
+
+
+/*
+ * pgsql_continue_connection progresses the connection started with
+ * pgsql_start_connection as far as it can without waiting.
+ */
+void
+pgsql_continue_connection(PGSQL *pgsql)
+{
+	if (pgsql->pendingConnection != NULL)
+	{
+		(void) pgsql_poll_pending_connection(pgsql, false);
+	}
+}
+
+
+/*
+ * pgsql_poll_pending_connection calls PQconnectPoll() on the pending
+ * connection of the client each time its socket is ready, and returns the
+ * resulting polling status. When wait is true, we wait until the connection
+ * completes or fails, for up to POSTGRES_CONNECT_TIMEOUT, otherwise we return
+ * as soon as the socket is not ready.
+ */
+static PostgresPollingStatusType
+pgsql_poll_pending_connection(PGSQL *pgsql, bool wait)
+{
+	PGconn *connection = pgsql->pendingConnection;
+	PostgresPollingStatusType status = pgsql->pendingPollingStatus;
+	int timeoutMs = atoi(POSTGRES_CONNECT_TIMEOUT) * 1000;
+
+	instr_time startTime;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	while (status == PGRES_POLLING_READING || status == PGRES_POLLING_WRITING)
+	{
+		struct pollfd pollFd = {
+			.fd = PQsocket(connection),
+			.events = status == PGRES_POLLING_READING ? POLLIN : POLLOUT
+		};
+
+		int waitMs = 0;
+
+		if (wait)
+		{
+			instr_time elapsed;
+
+			INSTR_TIME_SET_CURRENT(elapsed);
+			INSTR_TIME_SUBTRACT(elapsed, startTime);
+
+			waitMs = timeoutMs - (int) INSTR_TIME_GET_MILLISEC(elapsed);
+
+			if (waitMs <= 0)
+			{
+				status = PGRES_POLLING_FAILED;
+				break;
+			}
+		}
+
+		int ready = poll(&pollFd, 1, waitMs);
+
+		if (ready < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (ready < 0)
+		{
+			log_debug("Failed to wait for the connection to [%s]: %m",
+					  ConnectionTypeToString(pgsql->connectionType));
+			status = PGRES_POLLING_FAILED;
+			break;
+		}
+
+		/* the socket is not ready yet, which the caller does not wait for */
+		if (ready == 0 && !wait)
+		{
+			break;
+		}
+
+		status = PQconnectPoll(connection);
+	}
+
+	pgsql->pendingPollingStatus = status;
+
+	return status;
+}
+
+
+/*
+ * pgsql_complete_pending_connection waits until the connection started with
+ * pgsql_start_connection is complete, and then makes it the connection of
+ * the client. When the connection failed, we return false and the caller
+ * connects again, with its retry policy and error reporting.
+ */
+static bool
+pgsql_complete_pending_connection(PGSQL *pgsql)
+{
+	PGconn *connection = pgsql->pendingConnection;
+
+	if (connection == NULL)
+	{
+		return false;
+	}
+
+	/* only count the time spent waiting for the connection to complete */
+	INSTR_TIME_SET_CURRENT(pgsql->retryPolicy.startTime);
+	INSTR_TIME_SET_ZERO(pgsql->retryPolicy.connectTime);
+
+	PostgresPollingStatusType status = pgsql_poll_pending_connection(pgsql, true);
+
+	pgsql->pendingConnection = NULL;
+
+	if (status != PGRES_POLLING_OK || PQstatus(connection) != CONNECTION_OK)
+	{
+		log_debug("Failed to complete the connection to [%s], "
+				  "connecting again: %s",
+				  ConnectionTypeToString(pgsql->connectionType),
+				  PQerrorMessage(connection));
+
+		PQfinish(connection);
+		return false;
+	}
+
+	INSTR_TIME_SET_CURRENT(pgsql->retryPolicy.connectTime);
+
+	pgsql->connection = connection;
+
+	return true;
+}
+
+
 /*
  * Refrain from warning too often. The user certainly wants to know that we are
  * still trying to connect, though warning several times a second is not going
@@ -694,7 +1059,7 @@ pgsql_retry_open_connection(PGSQL *pgsql)
 				 * PQping does not check authentication, so we might still fail
 				 * to connect to the server.
 				 */
-				pgsql->connection = PQconnectdb(pgsql->connectionString);
+				pgsql->connection = pgsql_connect(pgsql, false);
 
 				if (PQstatus(pgsql->connection) == CONNECTION_OK)
 				{
@@ -1018,10 +1383,73 @@ bool
 pgsql_execute_with_params(PGSQL *pgsql, const char *sql, int paramCount,
 						  const Oid *paramTypes, const char **paramValues,
 						  void *context, ParsePostgresResultCB *parseFun)
+{
+	instr_time startTime;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	bool success = pgsql_execute_statement(pgsql, NULL, sql,
+										   paramCount, paramTypes, paramValues,
+										   context, parseFun);
+
+	(void) pgsql_log_monitor_record(pgsql, sql, 1, startTime, success);
+
+	return success;
+}
+
+
+/*
+ * pgsql_execute_prepared runs a given SQL command as pgsql_execute_with_params
+ * does. When the connection is kept open between queries
+ * (PGSQL_CONNECTION_PERSISTENT), the query is prepared with the given name the
+ * first time it's used on the connection, and later calls only execute the
+ * prepared statement, saving the parse and plan work on the server.
+ *
+ * Callers must use a different name for each different SQL text.
+ */
+bool
+pgsql_execute_prepared(PGSQL *pgsql, const char *stmtName,
+					   const char *sql, int paramCount,
+					   const Oid *paramTypes, const char **paramValues,
+					   void *context, ParsePostgresResultCB *parseFun)
+{
+	instr_time startTime;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	bool success = pgsql_execute_statement(pgsql, stmtName, sql,
+										   paramCount, paramTypes, paramValues,
+										   context, parseFun);
+
+	(void) pgsql_log_monitor_record(pgsql, sql, 1, startTime, success);
+
+	return success;
+}
+
+
+/*
+ * pgsql_execute_statement implements both pgsql_execute_with_params and
+ * pgsql_execute_prepared, the latter when stmtName is not NULL.
+ */
+static bool
+pgsql_execute_statement(PGSQL *pgsql, const char *stmtName,
+						const char *sql, int paramCount,
+						const Oid *paramTypes, const char **paramValues,
+						void *context, ParsePostgresResultCB *parseFun)
 {
 	char debugParameters[BUFSIZE] = { 0 };
 	PGresult *result = NULL;
 
+	/*
+	 * A persistent connection might have been closed by the server since we
+	 * last used it, when Postgres has been restarted for instance. We only
+	 * notice that when sending the next query, and then retry that query
+	 * once on a new connection.
+	 */
+	bool reusedConnection =
+		pgsql->connection != NULL &&
+		pgsql->connectionStatementType == PGSQL_CONNECTION_PERSISTENT;
+
 	PGconn *connection = pgsql_open_connection(pgsql);
 
 	if (connection == NULL)
@@ -1033,38 +1461,56 @@ pgsql_execute_with_params(PGSQL *pgsql, const char *sql, int paramCount,
 
 	if (paramCount > 0)
 	{
-		int paramIndex = 0;
-		int remainingBytes = BUFSIZE;
-		char *writePointer = (char *) debugParameters;
+		(void) format_debug_parameters(paramCount, paramValues,
+									   debugParameters, sizeof(debugParameters));
+		log_debug("%s", debugParameters);
+	}
 
-		for (paramIndex = 0; paramIndex < paramCount; paramIndex++)
-		{
-			int bytesWritten = 0;
-			const char *value = paramValues[paramIndex];
+	bool usePreparedStatement =
+		stmtName != NULL &&
+		pgsql->connectionStatementType == PGSQL_CONNECTION_PERSISTENT &&
+		pgsql_prepare_statement(pgsql, stmtName, sql, paramCount, paramTypes);
 
-			if (paramIndex > 0)
-			{
-				bytesWritten = sformat(writePointer, remainingBytes, ", ");
-				remainingBytes -= bytesWritten;
-				writePointer += bytesWritten;
-			}
+	/* preparing the statement might have found the connection to be lost */
+	connection = pgsql->connection;
 
-			if (value == NULL)
-			{
-				bytesWritten = sformat(writePointer, remainingBytes, "NULL");
-			}
-			else
-			{
-				bytesWritten =
-					sformat(writePointer, remainingBytes, "'%s'", value);
-			}
-			remainingBytes -= bytesWritten;
-			writePointer += bytesWritten;
+	if (connection == NULL)
+	{
+		if (!reusedConnection)
+		{
+			log_error("Failed to prepare statement \"%s\", "
+					  "the connection has been lost", stmtName);
+			return false;
 		}
-		log_debug("%s", debugParameters);
+
+		return pgsql_execute_statement(pgsql, stmtName, sql,
+									   paramCount, paramTypes, paramValues,
+									   context, parseFun);
 	}
 
-	if (paramCount == 0)
+	if (pgsql->statementTimeoutMs > 0)
+	{
+		bool timedOut = false;
+
+		result = pgsql_execute_with_deadline(pgsql, connection,
+											 usePreparedStatement ? stmtName : NULL,
+											 sql, paramCount,
+											 paramTypes, paramValues,
+											 &timedOut);
+
+		/* the query has been canceled, and the connection closed */
+		if (timedOut)
+		{
+			return false;
+		}
+	}
+	else if (usePreparedStatement)
+	{
+		result = PQexecPrepared(connection, stmtName,
+								paramCount, paramValues,
+								NULL, NULL, 0);
+	}
+	else if (paramCount == 0)
 	{
 		result = PQexec(connection, sql);
 	}
@@ -1075,61 +1521,24 @@ pgsql_execute_with_params(PGSQL *pgsql, const char *sql, int paramCount,
 							  NULL, NULL, 0);
 	}
 
-	if (!is_response_ok(result))
+	if (!is_response_ok(result) &&
+		reusedConnection &&
+		PQstatus(connection) == CONNECTION_BAD)
 	{
-		char *sqlstate = PQresultErrorField(result, PG_DIAG_SQLSTATE);
-		char *message = PQerrorMessage(connection);
-		char *errorLines[BUFSIZE];
-		int lineCount = splitLines(message, errorLines, BUFSIZE);
-		int lineNumber = 0;
-
-		char *prefix =
-			pgsql->connectionType == PGSQL_CONN_MONITOR ? "Monitor" : "Postgres";
-
-		/*
-		 * PostgreSQL Error message might contain several lines. Log each of
-		 * them as a separate ERROR line here.
-		 */
-		for (lineNumber = 0; lineNumber < lineCount; lineNumber++)
-		{
-			log_error("%s %s", prefix, errorLines[lineNumber]);
-		}
-
-		/*
-		 * The monitor uses those error codes in situations we know how to
-		 * handle, so if we have one of those, it's not a client-side error
-		 * with a badly formed SQL query etc.
-		 */
-		if (pgsql->connectionType == PGSQL_CONN_MONITOR &&
-			sqlstate != NULL &&
-			!(strcmp(sqlstate, STR_ERRCODE_INVALID_OBJECT_DEFINITION) == 0 ||
-			  strcmp(sqlstate, STR_ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE) == 0 ||
-			  strcmp(sqlstate, STR_ERRCODE_OBJECT_IN_USE) == 0 ||
-			  strcmp(sqlstate, STR_ERRCODE_UNDEFINED_OBJECT) == 0))
-		{
-			log_error("SQL query: %s", sql);
-			log_error("SQL params: %s", debugParameters);
-		}
-		else
-		{
-			log_debug("SQL query: %s", sql);
-			log_debug("SQL params: %s", debugParameters);
-		}
+		log_debug("Lost connection to [%s], retrying the query",
+				  ConnectionTypeToString(pgsql->connectionType));
 
-		/* now stash away the SQL STATE if any */
-		if (context && sqlstate)
-		{
-			AbstractResultContext *ctx = (AbstractResultContext *) context;
+		PQclear(result);
+		(void) pgsql_close_persistent_connection(pgsql);
 
-			strlcpy(ctx->sqlstate, sqlstate, SQLSTATE_LENGTH);
-		}
+		return pgsql_execute_statement(pgsql, stmtName, sql,
+									   paramCount, paramTypes, paramValues,
+									   context, parseFun);
+	}
 
-		/* if we get a connection exception, track that */
-		if (sqlstate &&
-			strncmp(sqlstate, STR_ERRCODE_CLASS_CONNECTION_EXCEPTION, 2) == 0)
-		{
-			pgsql->status = PG_CONNECTION_BAD;
-		}
+	if (!is_response_ok(result))
+	{
+		(void) log_query_error(pgsql, result, sql, debugParameters, context);
 
 		PQclear(result);
 		clear_results(pgsql);
@@ -1143,6 +1552,12 @@ pgsql_execute_with_params(PGSQL *pgsql, const char *sql, int paramCount,
 			PQfinish(pgsql->connection);
 			pgsql->connection = NULL;
 		}
+		else if (pgsql->connectionStatementType == PGSQL_CONNECTION_PERSISTENT &&
+				 pgsql->connection != NULL &&
+				 PQstatus(pgsql->connection) == CONNECTION_BAD)
+		{
+			(void) pgsql_close_persistent_connection(pgsql);
+		}
 
 		return false;
 	}
@@ -1165,733 +1580,2175 @@ pgsql_execute_with_params(PGSQL *pgsql, const char *sql, int paramCount,
 
 
 /*
- * is_response_ok returns whether the query result is a correct response
- * (not an error or failure).
+ * pgsql_execute_with_deadline sends the query without waiting, and then waits
+ * for its results until the statement timeout of the client has passed. When
+ * the query has been prepared, stmtName is not NULL.
+ *
+ * As with PQexec, we return the last result of the query. When the query did
+ * not complete in time, we cancel it, close the connection, set timedOut to
+ * true, and return NULL.
  */
-static bool
-is_response_ok(PGresult *result)
+static PGresult *
+pgsql_execute_with_deadline(PGSQL *pgsql, PGconn *connection,
+							const char *stmtName,
+							const char *sql, int paramCount,
+							const Oid *paramTypes, const char **paramValues,
+							bool *timedOut)
 {
-	ExecStatusType resultStatus = PQresultStatus(result);
-
-	return resultStatus == PGRES_SINGLE_TUPLE || resultStatus == PGRES_TUPLES_OK ||
-		   resultStatus == PGRES_COMMAND_OK;
-}
+	int sent = 0;
+	instr_time startTime;
 
+	INSTR_TIME_SET_CURRENT(startTime);
 
-/*
- * clear_results consumes results on a connection until NULL is returned.
- * If an error is returned it returns false.
- */
-static bool
-clear_results(PGSQL *pgsql)
-{
-	PGconn *connection = pgsql->connection;
+	*timedOut = false;
 
-	/*
-	 * Per Postgres documentation: You should, however, remember to check
-	 * PQnotifies after each PQgetResult or PQexec, to see if any
-	 * notifications came in during the processing of the command.
-	 *
-	 * Before calling clear_results(), we called PQexecParams().
-	 */
-	(void) pgsql_handle_notifications(pgsql);
+	if (stmtName != NULL)
+	{
+		sent = PQsendQueryPrepared(connection, stmtName,
+								   paramCount, paramValues,
+								   NULL, NULL, 0);
+	}
+	else if (paramCount == 0)
+	{
+		/* PQsendQuery allows several statements, as PQexec does */
+		sent = PQsendQuery(connection, sql);
+	}
+	else
+	{
+		sent = PQsendQueryParams(connection, sql,
+								 paramCount, paramTypes, paramValues,
+								 NULL, NULL, 0);
+	}
 
-	while (true)
+	if (!sent)
 	{
-		PGresult *result = PQgetResult(connection);
+		/* PQgetResult now returns the error */
+		return PQgetResult(connection);
+	}
 
-		/*
-		 * Per Postgres documentation: You should, however, remember to check
-		 * PQnotifies after each PQgetResult or PQexec, to see if any
-		 * notifications came in during the processing of the command.
-		 *
-		 * Here, we just called PQgetResult().
-		 */
-		(void) pgsql_handle_notifications(pgsql);
+	PGresult *lastResult = NULL;
 
-		if (result == NULL)
+	for (;;)
+	{
+		if (!pgsql_wait_for_result(pgsql, connection, startTime))
 		{
-			break;
+			PQclear(lastResult);
+			pgsql_finish(pgsql);
+
+			*timedOut = true;
+			return NULL;
 		}
 
-		if (!is_response_ok(result))
-		{
-			log_error("Failure from Postgres: %s", PQerrorMessage(connection));
+		PGresult *result = PQgetResult(connection);
 
-			PQclear(result);
-			pgsql_finish(pgsql);
-			return false;
+		if (result == NULL)
+		{
+			break;
 		}
 
-		PQclear(result);
+		PQclear(lastResult);
+		lastResult = result;
 	}
 
-	return true;
+	return lastResult;
 }
 
 
 /*
- * pgsql_handle_notifications check PQnotifies when a PGSQL notificationChannel
- * has been set. Then if the parsed notification is from the
- * notificationGroupId we set notificationReceived and also log the
- * notification.
- *
- * This allow another part of the code to later know that some notifications
- * have been received.
+ * pgsql_wait_for_result waits until PQgetResult can be called without
+ * blocking, for as long as the statement timeout of the client allows since
+ * the given startTime. When that's too long, we cancel the query and return
+ * false. Without a statement timeout we return true at once, and PQgetResult
+ * then waits for the result.
  */
-static void
-pgsql_handle_notifications(PGSQL *pgsql)
+static bool
+pgsql_wait_for_result(PGSQL *pgsql, PGconn *connection, instr_time startTime)
 {
-	PGconn *connection = pgsql->connection;
-	PGnotify *notify;
-
-	if (pgsql->notificationProcessFunction == NULL)
+	if (pgsql->statementTimeoutMs <= 0)
 	{
-		return;
+		return true;
 	}
 
-	PQconsumeInput(connection);
-	while ((notify = PQnotifies(connection)) != NULL)
+	while (PQisBusy(connection))
 	{
-		log_trace("pgsql_handle_notifications: \"%s\"", notify->extra);
+		instr_time elapsed;
 
-		if ((*pgsql->notificationProcessFunction)(pgsql->notificationGroupId,
-												  pgsql->notificationNodeId,
-												  notify->relname,
-												  notify->extra))
+		INSTR_TIME_SET_CURRENT(elapsed);
+		INSTR_TIME_SUBTRACT(elapsed, startTime);
+
+		int waitMs =
+			pgsql->statementTimeoutMs - (int) INSTR_TIME_GET_MILLISEC(elapsed);
+
+		if (waitMs <= 0)
 		{
-			/* mark that we received some notifications */
-			pgsql->notificationReceived = true;
+			log_error("Query to [%s] did not complete within %d ms, "
+					  "canceling it",
+					  ConnectionTypeToString(pgsql->connectionType),
+					  pgsql->statementTimeoutMs);
+
+			(void) pgsql_cancel_query(pgsql, connection);
+
+			return false;
 		}
 
-		PQfreemem(notify);
-		PQconsumeInput(connection);
+		struct pollfd pollFd = {
+			.fd = PQsocket(connection),
+			.events = POLLIN
+		};
+
+		int ready = poll(&pollFd, 1, waitMs);
+
+		if (ready < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		/* when the connection is lost, PQgetResult returns the error */
+		if (ready < 0 || (ready > 0 && !PQconsumeInput(connection)))
+		{
+			break;
+		}
 	}
+
+	return true;
 }
 
 
 /*
- * pgsql_is_in_recovery connects to PostgreSQL and sets the is_in_recovery
- * boolean to the result of the SELECT pg_is_in_recovery() query. It returns
- * false when something went wrong doing that.
+ * pgsql_cancel_query asks the server to cancel the query that is running on
+ * the given connection. The statement_timeout of the session also stops the
+ * query on the server, so failing to cancel is only a warning.
  */
-bool
-pgsql_is_in_recovery(PGSQL *pgsql, bool *is_in_recovery)
+static void
+pgsql_cancel_query(PGSQL *pgsql, PGconn *connection)
 {
-	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BOOL, false };
-	char *sql = "SELECT pg_is_in_recovery()";
+	char errbuf[256] = { 0 };
 
-	if (!pgsql_execute_with_params(pgsql, sql, 0, NULL, NULL,
-								   &context, &parseSingleValueResult))
+	PGcancel *cancel = PQgetCancel(connection);
+
+	if (cancel == NULL)
 	{
-		/* errors have been logged already */
-		return false;
+		log_warn("Failed to cancel the query on [%s]",
+				 ConnectionTypeToString(pgsql->connectionType));
+		return;
 	}
 
-	if (!context.parsedOk)
+	if (!PQcancel(cancel, errbuf, sizeof(errbuf)))
 	{
-		log_error("Failed to get result from pg_is_in_recovery()");
-		return false;
+		log_warn("Failed to cancel the query on [%s]: %s",
+				 ConnectionTypeToString(pgsql->connectionType),
+				 errbuf);
 	}
 
-	*is_in_recovery = context.boolVal;
-
-	return true;
+	PQfreeCancel(cancel);
 }
 
 
 /*
- * check_postgresql_settings connects to our local PostgreSQL instance and
- * verifies that our minimal viable configuration is in place by running a SQL
- * query that looks at the current settings.
+ * pgsql_log_monitor_record logs a structured record of a call to the
+ * monitor, with its duration, which is only output when using the JSON log
+ * format. The call is named after the first pgautofailover function found in
+ * the SQL text, such as "node_active".
  */
-bool
-pgsql_check_postgresql_settings(PGSQL *pgsql, bool isCitusInstanceKind,
-								bool *settings_are_ok)
+static void
+pgsql_log_monitor_record(PGSQL *pgsql, const char *sql, int queryCount,
+						 instr_time startTime, bool success)
 {
-	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BOOL, false };
-	const char *sql =
-		isCitusInstanceKind ?
-		CHECK_CITUS_NODE_SETTINGS_SQL : CHECK_POSTGRESQL_NODE_SETTINGS_SQL;
-
-	if (!pgsql_execute_with_params(pgsql, sql, 0, NULL, NULL,
-								   &context, &parseSingleValueResult))
+	if (pgsql->connectionType != PGSQL_CONN_MONITOR ||
+		log_get_format() != LOG_FORMAT_JSON)
 	{
-		/* errors have been logged already */
-		return false;
+		return;
 	}
 
-	if (!context.parsedOk)
+	instr_time duration;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	char function[NAMEDATALEN] = { 0 };
+	const char *schema = "pgautofailover.";
+	const char *name = strstr(sql, schema);
+
+	if (name != NULL)
 	{
-		/* errors have already been logged */
-		return false;
+		name += strlen(schema);
+
+		int len = strspn(name, "abcdefghijklmnopqrstuvwxyz_0123456789");
+
+		sformat(function, sizeof(function), "%.*s", len, name);
+	}
+	else
+	{
+		/* first keyword of the query, such as LISTEN */
+		sformat(function, sizeof(function), "%.*s",
+				(int) strcspn(sql, " ;\n"), sql);
 	}
 
-	*settings_are_ok = context.boolVal;
+	IntString queries = intToString(queryCount);
 
-	return true;
+	const char *fields[] = {
+		"function", function,
+		"queries", queries.strValue,
+		"success", success ? "true" : "false",
+		NULL
+	};
+
+	log_record(LOG_INFO, "monitor.call",
+			   (long long) INSTR_TIME_GET_MICROSEC(duration),
+			   fields);
 }
 
 
 /*
- * pgsql_check_monitor_settings connects to the given pgsql instance to check
- * that pgautofailover is part of shared_preload_libraries.
+ * pgsql_prepare_statement prepares the given SQL query on the current
+ * connection, unless it has been prepared already. It returns true when the
+ * statement can be executed with PQexecPrepared.
+ *
+ * When we run out of space to track prepared statements, or when the server
+ * refuses to prepare the statement, the caller sends the SQL text instead.
  */
-bool
-pgsql_check_monitor_settings(PGSQL *pgsql, bool *settings_are_ok)
+static bool
+pgsql_prepare_statement(PGSQL *pgsql, const char *stmtName,
+						const char *sql, int paramCount,
+						const Oid *paramTypes)
 {
-	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BOOL, false };
-	const char *sql =
-		"select exists(select 1 from "
-		"unnest("
-		"string_to_array(current_setting('shared_preload_libraries'), ','))"
-		" as t(name) "
-		"where trim(name) = 'pgautofailover');";
+	for (int i = 0; i < pgsql->preparedStatementCount; i++)
+	{
+		if (strcmp(pgsql->preparedStatements[i], stmtName) == 0)
+		{
+			return true;
+		}
+	}
 
-	if (!pgsql_execute_with_params(pgsql, sql, 0, NULL, NULL,
-								   &context, &parseSingleValueResult))
+	if (pgsql->preparedStatementCount >= PGSQL_MAX_PREPARED_STATEMENTS)
 	{
-		/* errors have been logged already */
 		return false;
 	}
 
-	if (!context.parsedOk)
+	PGresult *result = PQprepare(pgsql->connection, stmtName, sql,
+								 paramCount, paramTypes);
+
+	if (!is_response_ok(result))
 	{
-		/* errors have already been logged */
+		log_debug("Failed to prepare statement \"%s\": %s",
+				  stmtName, PQerrorMessage(pgsql->connection));
+
+		PQclear(result);
+
+		if (PQstatus(pgsql->connection) == CONNECTION_BAD)
+		{
+			(void) pgsql_close_persistent_connection(pgsql);
+		}
+
 		return false;
 	}
 
-	*settings_are_ok = context.boolVal;
+	PQclear(result);
+
+	strlcpy(pgsql->preparedStatements[pgsql->preparedStatementCount++],
+			stmtName,
+			NAMEDATALEN);
 
 	return true;
 }
 
 
 /*
- * postgres_sprintf_replicationSlotName prints the replication Slot Name to use
- * for given nodeId in the given slotName buffer of given size.
+ * pgsql_execute_pipeline sends a list of independent SQL queries to the
+ * server at once, and then reads and parses their results in turn. This saves
+ * a network round trip per query when compared to calling
+ * pgsql_execute_with_params() for each of them, which matters when the
+ * server is far away.
+ *
+ * Each query runs in its own implicit transaction: an error in one query does
+ * not prevent the next ones to run. The success field of each query is set
+ * accordingly, and the function returns true only when all the queries have
+ * been successful.
+ *
+ * When pg_autoctl is built against a libpq that does not implement pipeline
+ * mode (before Postgres 14), the queries are sent one after the other.
  */
 bool
-postgres_sprintf_replicationSlotName(int64_t nodeId, char *slotName, int size)
+pgsql_execute_pipeline(PGSQL *pgsql, PGSQLQuery *queries, int queryCount)
 {
-	int bytesWritten =
-		sformat(slotName, size, "%s_%" PRId64,
-				REPLICATION_SLOT_NAME_DEFAULT,
-				nodeId);
-
-	return bytesWritten <= size;
-}
+	instr_time startTime;
 
+	INSTR_TIME_SET_CURRENT(startTime);
 
-/*
- * pgsql_set_synchronous_standby_names set synchronous_standby_names on the
- * local Postgres to the value computed on the pg_auto_failover monitor.
- */
-bool
-pgsql_set_synchronous_standby_names(PGSQL *pgsql,
-									char *synchronous_standby_names)
-{
-	char quoted[BUFSIZE] = { 0 };
-	GUC setting = { "synchronous_standby_names", quoted };
+	bool success = pgsql_execute_pipeline_queries(pgsql, queries, queryCount);
 
-	if (sformat(quoted, BUFSIZE, "'%s'", synchronous_standby_names) >= BUFSIZE)
+	if (queryCount > 0)
 	{
-		log_error("Failed to apply the synchronous_standby_names value \"%s\": "
-				  "pg_autoctl supports values up to %d bytes and this one "
-				  "requires %lu bytes",
-				  synchronous_standby_names,
-				  BUFSIZE,
-				  (unsigned long) strlen(synchronous_standby_names));
-		return false;
+		(void) pgsql_log_monitor_record(pgsql, queries[0].sql, queryCount,
+										startTime, success);
 	}
 
-	return pgsql_alter_system_set(pgsql, setting);
+	return success;
 }
 
 
 /*
- * pgsql_replication_slot_maintain advances the current confirmed position of
- * the given replication slot up to the given LSN position, create the
- * replication slot if it does not exist yet, and remove the slots that exist
- * in Postgres but are ommited in the given array of slots.
+ * pgsql_execute_pipeline_queries implements pgsql_execute_pipeline.
  */
-typedef struct ReplicationSlotMaintainContext
+static bool
+pgsql_execute_pipeline_queries(PGSQL *pgsql, PGSQLQuery *queries,
+							   int queryCount)
 {
-	char sqlstate[SQLSTATE_LENGTH];
-	char operation[NAMEDATALEN];
-	char slotName[BUFSIZE];
-	char lsn[PG_LSN_MAXLENGTH];
-	bool parsedOK;
-} ReplicationSlotMaintainContext;
+#ifdef LIBPQ_HAS_PIPELINING
+	bool success = true;
 
+	PGconn *connection = pgsql_open_connection(pgsql);
 
-/*
- * pgsql_replication_slot_exists checks that a replication slot with the given
- * slotName exists on the Postgres server.
- */
-bool
-pgsql_replication_slot_exists(PGSQL *pgsql, const char *slotName,
-							  bool *slotExists)
-{
-	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BOOL, false };
-	char *sql = "SELECT 1 FROM pg_replication_slots WHERE slot_name = $1";
-	int paramCount = 1;
-	Oid paramTypes[1] = { NAMEOID };
-	const char *paramValues[1] = { slotName };
-
-	if (!pgsql_execute_with_params(pgsql, sql,
-								   paramCount, paramTypes, paramValues,
-								   &context, &fetchedRows))
+	if (connection == NULL)
 	{
-		/* errors have already been logged */
 		return false;
 	}
 
-	if (!context.parsedOk)
+	if (!PQenterPipelineMode(connection))
 	{
-		log_error("Failed to check if the replication slot \"%s\" exists",
-				  slotName);
-		return false;
+		log_error("Failed to enter pipeline mode: %s",
+				  PQerrorMessage(connection));
+		pgsql_finish(pgsql);
+		return false;
+	}
+
+	for (int i = 0; i < queryCount; i++)
+	{
+		PGSQLQuery *query = &(queries[i]);
+
+		log_debug("%s;", query->sql);
+
+		query->success = false;
+
+		if (!PQsendQueryParams(connection, query->sql,
+							   query->paramCount,
+							   query->paramTypes,
+							   query->paramValues,
+							   NULL, NULL, 0))
+		{
+			log_error("Failed to send query \"%s\": %s",
+					  query->sql, PQerrorMessage(connection));
+			pgsql_finish(pgsql);
+			return false;
+		}
+
+		/* one sync point per query, so that each runs in its own transaction */
+#ifdef LIBPQ_HAS_SEND_PIPELINE_SYNC
+		int synced = PQsendPipelineSync(connection);
+#else
+		int synced = PQpipelineSync(connection);
+#endif
+
+		if (!synced)
+		{
+			log_error("Failed to send pipeline sync: %s",
+					  PQerrorMessage(connection));
+			pgsql_finish(pgsql);
+			return false;
+		}
+	}
+
+	if (PQflush(connection) != 0)
+	{
+		log_error("Failed to send queries: %s", PQerrorMessage(connection));
+		pgsql_finish(pgsql);
+		return false;
+	}
+
+	/*
+	 * Now read the results. For each query we get its result, then NULL, then
+	 * the PGRES_PIPELINE_SYNC result for the sync point that follows it. The
+	 * statement timeout of the client, if any, applies to the whole pipeline.
+	 */
+	instr_time startTime;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	for (int i = 0; i < queryCount; i++)
+	{
+		PGSQLQuery *query = &(queries[i]);
+		char debugParameters[BUFSIZE] = { 0 };
+
+		if (!pgsql_wait_for_result(pgsql, connection, startTime))
+		{
+			pgsql_finish(pgsql);
+			return false;
+		}
+
+		PGresult *result = PQgetResult(connection);
+
+		(void) pgsql_handle_notifications(pgsql);
+
+		if (result == NULL)
+		{
+			log_error("Failed to get result for query \"%s\": %s",
+					  query->sql, PQerrorMessage(connection));
+			pgsql_finish(pgsql);
+			return false;
+		}
+
+		if (is_response_ok(result))
+		{
+			if (query->parseFun != NULL)
+			{
+				(*query->parseFun)(query->context, result);
+			}
+			query->success = true;
+		}
+		else
+		{
+			if (query->paramCount > 0)
+			{
+				(void) format_debug_parameters(query->paramCount,
+											   query->paramValues,
+											   debugParameters,
+											   sizeof(debugParameters));
+			}
+
+			(void) log_query_error(pgsql, result, query->sql,
+								   debugParameters, query->context);
+			success = false;
+		}
+
+		PQclear(result);
+
+		/* consume the end of this query's results and its sync point */
+		bool synced = false;
+
+		while (!synced)
+		{
+			if (!pgsql_wait_for_result(pgsql, connection, startTime))
+			{
+				pgsql_finish(pgsql);
+				return false;
+			}
+
+			result = PQgetResult(connection);
+
+			(void) pgsql_handle_notifications(pgsql);
+
+			if (result == NULL)
+			{
+				if (PQstatus(connection) == CONNECTION_BAD)
+				{
+					log_error("Failed to get pipeline results: %s",
+							  PQerrorMessage(connection));
+					pgsql->status = PG_CONNECTION_BAD;
+					pgsql_finish(pgsql);
+					return false;
+				}
+				continue;
+			}
+
+			synced = PQresultStatus(result) == PGRES_PIPELINE_SYNC;
+
+			PQclear(result);
+		}
+	}
+
+	if (!PQexitPipelineMode(connection))
+	{
+		log_error("Failed to exit pipeline mode: %s",
+				  PQerrorMessage(connection));
+		pgsql_finish(pgsql);
+		return false;
+	}
+
+	if (pgsql->status == PG_CONNECTION_BAD ||
+		pgsql->connectionStatementType == PGSQL_CONNECTION_SINGLE_STATEMENT)
+	{
+		PQfinish(pgsql->connection);
+		pgsql->connection = NULL;
+	}
+
+	return success;
+#else
+	bool success = true;
+
+	for (int i = 0; i < queryCount; i++)
+	{
+		PGSQLQuery *query = &(queries[i]);
+
+		query->success =
+			pgsql_execute_statement(pgsql, NULL, query->sql,
+									query->paramCount,
+									query->paramTypes,
+									query->paramValues,
+									query->context,
+									query->parseFun);
+
+		success = success && query->success;
+	}
+
+	return success;
+#endif
+}
+
+
+/*
+ * format_debug_parameters writes the given parameter values in the buffer, in
+ * a format suitable for our logs.
+ */
+static void
+format_debug_parameters(int paramCount, const char **paramValues,
+						char *buffer, int size)
+{
+	int remainingBytes = size;
+	char *writePointer = buffer;
+
+	for (int paramIndex = 0; paramIndex < paramCount; paramIndex++)
+	{
+		int bytesWritten = 0;
+		const char *value = paramValues[paramIndex];
+
+		if (paramIndex > 0)
+		{
+			bytesWritten = sformat(writePointer, remainingBytes, ", ");
+			remainingBytes -= bytesWritten;
+			writePointer += bytesWritten;
+		}
+
+		if (value == NULL)
+		{
+			bytesWritten = sformat(writePointer, remainingBytes, "NULL");
+		}
+		else
+		{
+			bytesWritten =
+				sformat(writePointer, remainingBytes, "'%s'", value);
+		}
+		remainingBytes -= bytesWritten;
+		writePointer += bytesWritten;
+	}
+}
+
+
+/*
+ * log_query_error logs the error message of a failed query, stashes away its
+ * SQL STATE in the given context when there's one, and tracks connection
+ * exceptions in the pgsql status.
+ */
+static void
+log_query_error(PGSQL *pgsql, PGresult *result,
+				const char *sql, const char *debugParameters, void *context)
+{
+	char *sqlstate = PQresultErrorField(result, PG_DIAG_SQLSTATE);
+	char *message = PQerrorMessage(pgsql->connection);
+	char *errorLines[BUFSIZE];
+	int lineCount = splitLines(message, errorLines, BUFSIZE);
+	int lineNumber = 0;
+
+	char *prefix =
+		pgsql->connectionType == PGSQL_CONN_MONITOR ? "Monitor" : "Postgres";
+
+	/*
+	 * PostgreSQL Error message might contain several lines. Log each of
+	 * them as a separate ERROR line here.
+	 */
+	for (lineNumber = 0; lineNumber < lineCount; lineNumber++)
+	{
+		log_error("%s %s", prefix, errorLines[lineNumber]);
+	}
+
+	/*
+	 * The monitor uses those error codes in situations we know how to
+	 * handle, so if we have one of those, it's not a client-side error
+	 * with a badly formed SQL query etc.
+	 */
+	if (pgsql->connectionType == PGSQL_CONN_MONITOR &&
+		sqlstate != NULL &&
+		!(strcmp(sqlstate, STR_ERRCODE_INVALID_OBJECT_DEFINITION) == 0 ||
+		  strcmp(sqlstate, STR_ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE) == 0 ||
+		  strcmp(sqlstate, STR_ERRCODE_OBJECT_IN_USE) == 0 ||
+		  strcmp(sqlstate, STR_ERRCODE_UNDEFINED_OBJECT) == 0 ||
+		  strcmp(sqlstate, STR_ERRCODE_MONITOR_BUSY) == 0 ||
+		  strcmp(sqlstate, STR_ERRCODE_LOCK_NOT_AVAILABLE) == 0))
+	{
+		log_error("SQL query: %s", sql);
+		log_error("SQL params: %s", debugParameters);
+	}
+	else
+	{
+		log_debug("SQL query: %s", sql);
+		log_debug("SQL params: %s", debugParameters);
+	}
+
+	/* now stash away the SQL STATE if any */
+	if (context && sqlstate)
+	{
+		AbstractResultContext *ctx = (AbstractResultContext *) context;
+
+		strlcpy(ctx->sqlstate, sqlstate, SQLSTATE_LENGTH);
+	}
+
+	/* if we get a connection exception, track that */
+	if (sqlstate &&
+		strncmp(sqlstate, STR_ERRCODE_CLASS_CONNECTION_EXCEPTION, 2) == 0)
+	{
+		pgsql->status = PG_CONNECTION_BAD;
+	}
+}
+
+
+/*
+ * is_response_ok returns whether the query result is a correct response
+ * (not an error or failure).
+ */
+static bool
+is_response_ok(PGresult *result)
+{
+	ExecStatusType resultStatus = PQresultStatus(result);
+
+	return resultStatus == PGRES_SINGLE_TUPLE || resultStatus == PGRES_TUPLES_OK ||
+		   resultStatus == PGRES_COMMAND_OK;
+}
+
+
+/*
+ * clear_results consumes results on a connection until NULL is returned.
+ * If an error is returned it returns false.
+ */
+static bool
+clear_results(PGSQL *pgsql)
+{
+	PGconn *connection = pgsql->connection;
+
+	/*
+	 * Per Postgres documentation: You should, however, remember to check
+	 * PQnotifies after each PQgetResult or PQexec, to see if any
+	 * notifications came in during the processing of the command.
+	 *
+	 * Before calling clear_results(), we called PQexecParams().
+	 */
+	(void) pgsql_handle_notifications(pgsql);
+
+	while (true)
+	{
+		PGresult *result = PQgetResult(connection);
+
+		/*
+		 * Per Postgres documentation: You should, however, remember to check
+		 * PQnotifies after each PQgetResult or PQexec, to see if any
+		 * notifications came in during the processing of the command.
+		 *
+		 * Here, we just called PQgetResult().
+		 */
+		(void) pgsql_handle_notifications(pgsql);
+
+		if (result == NULL)
+		{
+			break;
+		}
+
+		if (!is_response_ok(result))
+		{
+			log_error("Failure from Postgres: %s", PQerrorMessage(connection));
+
+			PQclear(result);
+			pgsql_finish(pgsql);
+			return false;
+		}
+
+		PQclear(result);
+	}
+
+	return true;
+}
+
+
+/*
+ * pgsql_handle_notifications check PQnotifies when a PGSQL notificationChannel
+ * has been set. Then if the parsed notification is from the
+ * notificationGroupId we set notificationReceived and also log the
+ * notification.
+ *
+ * This allow another part of the code to later know that some notifications
+ * have been received.
+ */
+static void
+pgsql_handle_notifications(PGSQL *pgsql)
+{
+	PGconn *connection = pgsql->connection;
+	PGnotify *notify;
+
+	if (pgsql->notificationProcessFunction == NULL)
+	{
+		return;
+	}
+
+	PQconsumeInput(connection);
+	while ((notify = PQnotifies(connection)) != NULL)
+	{
+		log_trace("pgsql_handle_notifications: \"%s\"", notify->extra);
+
+		if ((*pgsql->notificationProcessFunction)(pgsql->notificationGroupId,
+												  pgsql->notificationNodeId,
+												  notify->relname,
+												  notify->extra))
+		{
+			/* mark that we received some notifications */
+			pgsql->notificationReceived = true;
+		}
+
+		PQfreemem(notify);
+		PQconsumeInput(connection);
+	}
+}
+
+
+/*
+ * pgsql_is_in_recovery connects to PostgreSQL and sets the is_in_recovery
+ * boolean to the result of the SELECT pg_is_in_recovery() query. It returns
+ * false when something went wrong doing that.
+ */
+bool
+pgsql_is_in_recovery(PGSQL *pgsql, bool *is_in_recovery)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BOOL, false };
+	char *sql = "SELECT pg_is_in_recovery()";
+
+	if (!pgsql_execute_with_params(pgsql, sql, 0, NULL, NULL,
+								   &context, &parseSingleValueResult))
+	{
+		/* errors have been logged already */
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		log_error("Failed to get result from pg_is_in_recovery()");
+		return false;
+	}
+
+	*is_in_recovery = context.boolVal;
+
+	return true;
+}
+
+
+/*
+ * pgsql_promote asks a standby server to promote with pg_promote(), without
+ * waiting for the promotion to be complete: the caller then polls
+ * pg_is_in_recovery() on the same connection. pg_promote() is available
+ * since Postgres 12.
+ */
+bool
+pgsql_promote(PGSQL *pgsql)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BOOL, false };
+	char *sql = "SELECT pg_promote(wait => false)";
+
+	if (!pgsql_execute_with_params(pgsql, sql, 0, NULL, NULL,
+								   &context, &parseSingleValueResult))
+	{
+		/* errors have been logged already */
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		log_error("Failed to get result from pg_promote()");
+		return false;
+	}
+
+	if (!context.boolVal)
+	{
+		log_error("Failed to signal the postmaster to promote");
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * pgsql_count_active_queries sets activeCount to how many client sessions but
+ * ours are currently running a query, or are in the middle of a transaction.
+ */
+bool
+pgsql_count_active_queries(PGSQL *pgsql, int *activeCount)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_INT, false };
+	char *sql =
+		"SELECT count(*)::int "
+		"FROM pg_stat_activity "
+		"WHERE backend_type = 'client backend' AND state <> 'idle' "
+		"AND pid <> pg_backend_pid()";
+
+	if (!pgsql_execute_with_params(pgsql, sql, 0, NULL, NULL,
+								   &context, &parseSingleValueResult))
+	{
+		/* errors have been logged already */
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		log_error("Failed to count active queries in pg_stat_activity");
+		return false;
+	}
+
+	*activeCount = context.intVal;
+
+	return true;
+}
+
+
+/*
+ * pgsql_get_settings_hash computes the md5 of the names and values of the
+ * Postgres settings that are not set to their default value, leaving out the
+ * settings that depend on the current session.
+ */
+bool
+pgsql_get_settings_hash(PGSQL *pgsql, char *hash, size_t size)
+{
+	SingleValueResultContext context = { 0 };
+	char *sql =
+		"SELECT md5(coalesce(string_agg(name || '=' || setting, ',' "
+		"ORDER BY name), '')) "
+		"FROM pg_settings "
+		"WHERE source NOT IN ('default', 'client', 'session')";
+
+	context.resultType = PGSQL_RESULT_STRING;
+
+	if (!pgsql_execute_with_params(pgsql, sql, 0, NULL, NULL,
+								   &context, &parseSingleValueResult))
+	{
+		/* errors have been logged already */
+		return false;
+	}
+
+	if (!context.parsedOk || context.strVal == NULL)
+	{
+		log_error("Failed to compute the hash of the Postgres settings");
+		return false;
+	}
+
+	strlcpy(hash, context.strVal, size);
+	free(context.strVal);
+
+	return true;
+}
+
+
+/*
+ * check_postgresql_settings connects to our local PostgreSQL instance and
+ * verifies that our minimal viable configuration is in place by running a SQL
+ * query that looks at the current settings.
+ */
+bool
+pgsql_check_postgresql_settings(PGSQL *pgsql, bool isCitusInstanceKind,
+								bool *settings_are_ok)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BOOL, false };
+	const char *sql =
+		isCitusInstanceKind ?
+		CHECK_CITUS_NODE_SETTINGS_SQL : CHECK_POSTGRESQL_NODE_SETTINGS_SQL;
+
+	if (!pgsql_execute_with_params(pgsql, sql, 0, NULL, NULL,
+								   &context, &parseSingleValueResult))
+	{
+		/* errors have been logged already */
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	*settings_are_ok = context.boolVal;
+
+	return true;
+}
+
+
+/*
+ * pgsql_check_monitor_settings connects to the given pgsql instance to check
+ * that pgautofailover is part of shared_preload_libraries.
+ */
+bool
+pgsql_check_monitor_settings(PGSQL *pgsql, bool *settings_are_ok)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BOOL, false };
+	const char *sql =
+		"select exists(select 1 from "
+		"unnest("
+		"string_to_array(current_setting('shared_preload_libraries'), ','))"
+		" as t(name) "
+		"where trim(name) = 'pgautofailover');";
+
+	if (!pgsql_execute_with_params(pgsql, sql, 0, NULL, NULL,
+								   &context, &parseSingleValueResult))
+	{
+		/* errors have been logged already */
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	*settings_are_ok = context.boolVal;
+
+	return true;
+}
+
+
+/*
+ * postgres_sprintf_replicationSlotName prints the replication Slot Name to use
+ * for given nodeId in the given slotName buffer of given size.
+ */
+bool
+postgres_sprintf_replicationSlotName(int64_t nodeId, char *slotName, int size)
+{
+	int bytesWritten =
+		sformat(slotName, size, "%s_%" PRId64,
+				REPLICATION_SLOT_NAME_DEFAULT,
+				nodeId);
+
+	return bytesWritten <= size;
+}
+
+
+/*
+ * pgsql_set_synchronous_standby_names set synchronous_standby_names on the
+ * local Postgres to the value computed on the pg_auto_failover monitor. When
+ * Postgres already uses that value, we skip the ALTER SYSTEM and the reload.
+ */
+bool
+pgsql_set_synchronous_standby_names(PGSQL *pgsql,
+									char *synchronous_standby_names)
+{
+	char quoted[BUFSIZE] = { 0 };
+	GUC setting = { "synchronous_standby_names", quoted };
+	char *currentValue = NULL;
+
+	if (pgsql_get_current_setting(pgsql,
+								  "synchronous_standby_names",
+								  &currentValue))
+	{
+		bool unchanged = streq(currentValue, synchronous_standby_names);
+
+		free(currentValue);
+
+		if (unchanged)
+		{
+			log_debug("synchronous_standby_names is already set to '%s'",
+					  synchronous_standby_names);
+			return true;
+		}
+	}
+
+	if (sformat(quoted, BUFSIZE, "'%s'", synchronous_standby_names) >= BUFSIZE)
+	{
+		log_error("Failed to apply the synchronous_standby_names value \"%s\": "
+				  "pg_autoctl supports values up to %d bytes and this one "
+				  "requires %lu bytes",
+				  synchronous_standby_names,
+				  BUFSIZE,
+				  (unsigned long) strlen(synchronous_standby_names));
+		return false;
+	}
+
+	return pgsql_alter_system_set(pgsql, setting);
+}
+
+
+/*
+ * pgsql_replication_slot_maintain advances the current confirmed position of
+ * the given replication slot up to the given LSN position, create the
+ * replication slot if it does not exist yet, and remove the slots that exist
+ * in Postgres but are ommited in the given array of slots.
+ */
+typedef struct ReplicationSlotMaintainContext
+{
+	char sqlstate[SQLSTATE_LENGTH];
+	char operation[NAMEDATALEN];
+	char slotName[BUFSIZE];
+	char lsn[PG_LSN_MAXLENGTH];
+	int createdCount;
+	bool parsedOK;
+} ReplicationSlotMaintainContext;
+
+
+/*
+ * pgsql_replication_slot_exists checks that a replication slot with the given
+ * slotName exists on the Postgres server.
+ */
+bool
+pgsql_replication_slot_exists(PGSQL *pgsql, const char *slotName,
+							  bool *slotExists)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BOOL, false };
+	char *sql = "SELECT 1 FROM pg_replication_slots WHERE slot_name = $1";
+	int paramCount = 1;
+	Oid paramTypes[1] = { NAMEOID };
+	const char *paramValues[1] = { slotName };
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &fetchedRows))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		log_error("Failed to check if the replication slot \"%s\" exists",
+				  slotName);
+		return false;
+	}
+
+	/* we receive 0 rows in the result when the slot does not exist yet */
+	*slotExists = context.intVal == 1;
+
+	return true;
+}
+
+
+/*
+ * pgsql_create_replication_slot tries to create a replication slot on the
+ * database identified by a connection string. It's implemented as CREATE IF
+ * NOT EXISTS so that it's idempotent and can be retried easily.
+ */
+bool
+pgsql_create_replication_slot(PGSQL *pgsql, const char *slotName)
+{
+	ReplicationSlotMaintainContext context = { 0 };
+	char *sql =
+		"SELECT 'create', slot_name, lsn "
+		"  FROM pg_create_physical_replication_slot($1) "
+		" WHERE NOT EXISTS "
+		" (SELECT 1 FROM pg_replication_slots WHERE slot_name = $1)";
+	const Oid paramTypes[1] = { TEXTOID };
+	const char *paramValues[1] = { slotName };
+
+	log_trace("pgsql_create_replication_slot");
+
+	/*
+	 * parseReplicationSlotMaintain will log_info() the replication slot
+	 * creation if it happens. When the slot already exists we return 0 row and
+	 * remain silent about it.
+	 */
+	return pgsql_execute_with_params(pgsql, sql, 1, paramTypes, paramValues,
+									 &context, parseReplicationSlotMaintain);
+}
+
+
+/*
+ * pgsql_drop_replication_slot drops a given replication slot.
+ */
+bool
+pgsql_drop_replication_slot(PGSQL *pgsql, const char *slotName)
+{
+	char *sql =
+		"SELECT pg_drop_replication_slot(slot_name) "
+		"  FROM pg_replication_slots "
+		" WHERE slot_name = $1";
+	Oid paramTypes[1] = { TEXTOID };
+	const char *paramValues[1] = { slotName };
+
+	log_info("Drop replication slot \"%s\"", slotName);
+
+	return pgsql_execute_with_params(pgsql, sql,
+									 1, paramTypes, paramValues, NULL, NULL);
+}
+
+
+/*
+ * BuildNodesArrayValues build the SQL expression to use in a FROM clause to
+ * represent the list of other standby nodes from the given nodeArray.
+ *
+ * Such a list looks either like:
+ *
+ *   VALUES($1, $2::pg_lsn), ($3, $4)
+ *
+ * or for an empty set (e.g. when we're the only standby):
+ *
+ *   SELECT id, lsn
+ *     FROM (values (null::int, null::pg_lsn)) as t(id, lsn)
+ *    WHERE false
+ *
+ * We actually need to provide an empty set (0 rows) with columns of the
+ * expected data types so that we can join against the existing replication
+ * slots and drop them. If the set is empty, we drop all the slots.
+ *
+ * We return how many parameters we filled in paramTypes and paramValues from
+ * the nodeArray.
+ */
+#define NODEID_MAX_LENGTH 20    /* should allow for bigint digits */
+
+typedef struct nodesArraysValuesParams
+{
+	int count;
+	Oid *types;
+	char **values;
+
+	/*
+	 * Allocate arrays for the data separately from the values array, which
+	 * needs to be a (const char **) thing rather than a (char [][]) thing,
+	 * because of the pgsql_execute_with_params and libpq APIs.
+	 */
+	char (*nodeIds)[NODEID_MAX_LENGTH];
+	char (*lsns)[PG_LSN_MAXLENGTH];
+} nodesArraysValuesParams;
+
+
+static void FreeNodesArrayValues(nodesArraysValuesParams *sqlParams);
+
+
+static bool
+BuildNodesArrayValues(NodeAddressArray *nodeArray,
+					  nodesArraysValuesParams *sqlParams,
+					  PQExpBuffer values)
+{
+	int nodeIndex = 0;
+	int paramIndex = 0;
+
+	/* when we didn't find any node to process, return our empty set */
+	if (nodeArray->count == 0)
+	{
+		appendPQExpBufferStr(
+			values,
+			"SELECT id, lsn "
+			"FROM (values (null::int, null::pg_lsn)) as t(id, lsn) "
+			"where false");
+
+		return true;
+	}
+
+	sqlParams->types = (Oid *) calloc(nodeArray->count * 2, sizeof(Oid));
+	sqlParams->values = (char **) calloc(nodeArray->count * 2, sizeof(char *));
+	sqlParams->nodeIds = calloc(nodeArray->count, NODEID_MAX_LENGTH);
+	sqlParams->lsns = calloc(nodeArray->count, PG_LSN_MAXLENGTH);
+
+	if (sqlParams->types == NULL || sqlParams->values == NULL ||
+		sqlParams->nodeIds == NULL || sqlParams->lsns == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		(void) FreeNodesArrayValues(sqlParams);
+		return false;
+	}
+
+	/* we start the VALUES subquery with the values SQL keyword */
+	appendPQExpBufferStr(values, "values ");
+
+	/*
+	 * Build a SQL VALUES statement for every other node registered in the
+	 * system, so that we can maintain their LSN position locally on a standby
+	 * server.
+	 */
+	for (nodeIndex = 0; nodeIndex < nodeArray->count; nodeIndex++)
+	{
+		NodeAddress *node = &(nodeArray->nodes[nodeIndex]);
+		char *nodeIdString = intToString(node->nodeId).strValue;
+
+		int idParamIndex = paramIndex;
+		int lsnParamIndex = paramIndex + 1;
+
+		sqlParams->types[idParamIndex] = INT8OID;
+		strlcpy(sqlParams->nodeIds[nodeIndex], nodeIdString, NODEID_MAX_LENGTH);
+
+		/* store the (char *) pointer to the data in values */
+		sqlParams->values[idParamIndex] = sqlParams->nodeIds[nodeIndex];
+
+		sqlParams->types[lsnParamIndex] = LSNOID;
+		strlcpy(sqlParams->lsns[nodeIndex], node->lsn, PG_LSN_MAXLENGTH);
+
+		/* store the (char *) pointer to the data in values */
+		sqlParams->values[lsnParamIndex] = sqlParams->lsns[nodeIndex];
+
+		appendPQExpBuffer(values,
+						  "%s($%d, $%d%s)",
+						  paramIndex == 0 ? "" : ",",
+
+		                  /* we begin at $1 here: intentional off-by-one */
+						  idParamIndex + 1, lsnParamIndex + 1,
+
+		                  /* cast only the first row */
+						  paramIndex == 0 ? "::pg_lsn" : "");
+
+		/* prepare next round */
+		paramIndex += 2;
+	}
+
+	/* count how many parameters where appended to the VALUES() parts */
+	sqlParams->count = paramIndex;
+
+	return true;
+}
+
+
+/*
+ * FreeNodesArrayValues releases the memory allocated by
+ * BuildNodesArrayValues.
+ */
+static void
+FreeNodesArrayValues(nodesArraysValuesParams *sqlParams)
+{
+	free(sqlParams->types);
+	free(sqlParams->values);
+	free(sqlParams->nodeIds);
+	free(sqlParams->lsns);
+
+	sqlParams->types = NULL;
+	sqlParams->values = NULL;
+	sqlParams->nodeIds = NULL;
+	sqlParams->lsns = NULL;
+	sqlParams->count = 0;
+}
+
+
+/*
+ * pgsql_replication_slot_create_and_drop drops replication slots that belong
+ * to nodes that have been removed, and creates replication slots for nodes
+ * that have been newly registered. We call that function on the primary, where
+ * the slots are maintained by the replication protocol.
+ *
+ * On the standby nodes, we advance the slots ourselves and use the other
+ * function pgsql_replication_slot_maintain which is complete (create, drop,
+ * advance).
+ *
+ * The createdCount is set to the number of replication slots that have been
+ * created.
+ */
+bool
+pgsql_replication_slot_create_and_drop(PGSQL *pgsql, NodeAddressArray *nodeArray,
+									   int *createdCount)
+{
+	PQExpBuffer query = createPQExpBuffer();
+	PQExpBuffer values = createPQExpBuffer();
+
+	/* *INDENT-OFF* */
+	char *sqlTemplate =
+		/*
+		 * We could simplify the writing of this query, but we prefer that it
+		 * looks as much as possible like the query used in
+		 * pgsql_replication_slot_maintain() so that we can maintain both
+		 * easily.
+		 */
+		"WITH nodes(slot_name, lsn) as ("
+		" SELECT '" REPLICATION_SLOT_NAME_DEFAULT "_' || id, lsn"
+		"   FROM (%s) as sb(id, lsn) "
+		"), \n"
+		"dropped as ("
+		" SELECT slot_name, pg_drop_replication_slot(slot_name) "
+		"   FROM pg_replication_slots pgrs LEFT JOIN nodes USING(slot_name) "
+		"  WHERE nodes.slot_name IS NULL "
+		"    AND (   slot_name ~ '" REPLICATION_SLOT_NAME_PATTERN "' "
+		"         OR slot_name ~ '" REPLICATION_SLOT_NAME_DEFAULT "' )"
+		"    AND not active"
+		"    AND slot_type = 'physical'"
+		"), \n"
+		"created as ("
+		"SELECT c.slot_name, c.lsn "
+		"  FROM nodes LEFT JOIN pg_replication_slots pgrs USING(slot_name), "
+		"       LATERAL pg_create_physical_replication_slot(slot_name, true) c"
+		" WHERE pgrs.slot_name IS NULL "
+		") \n"
+		"SELECT 'create', slot_name, lsn FROM created "
+		" union all "
+		"SELECT 'drop', slot_name, NULL::pg_lsn FROM dropped";
+	/* *INDENT-ON* */
+
+	nodesArraysValuesParams sqlParams = { 0 };
+	ReplicationSlotMaintainContext context = { 0 };
+
+	if (!BuildNodesArrayValues(nodeArray, &sqlParams, values))
+	{
+		/* errors have already been logged */
+		destroyPQExpBuffer(query);
+		destroyPQExpBuffer(values);
+
+		return false;
+	}
+
+	/* add the computed ($1,$2), ... string to the query "template" */
+	appendPQExpBuffer(query, sqlTemplate, values->data);
+
+	/* the SQL text depends on the number of nodes */
+	char stmtName[NAMEDATALEN] = { 0 };
+
+	sformat(stmtName, sizeof(stmtName),
+			"pgautofailover_slot_create_and_drop_%d", nodeArray->count);
+
+	bool success =
+		pgsql_execute_prepared(pgsql,
+							   stmtName,
+							   query->data,
+							   sqlParams.count,
+							   sqlParams.types,
+							   (const char **) sqlParams.values,
+							   &context,
+							   parseReplicationSlotMaintain);
+
+	destroyPQExpBuffer(query);
+	destroyPQExpBuffer(values);
+	(void) FreeNodesArrayValues(&sqlParams);
+
+	*createdCount = context.createdCount;
+
+	return success;
+}
+
+
+/*
+ * pgsql_replication_slot_maintain creates, drops, and advance replication
+ * slots that belong to other standby nodes. We call that function on the
+ * standby nodes, where the slots are maintained manually just in case we need
+ * them at failover.
+ */
+bool
+pgsql_replication_slot_maintain(PGSQL *pgsql, NodeAddressArray *nodeArray)
+{
+	PQExpBuffer query = createPQExpBuffer();
+	PQExpBuffer values = createPQExpBuffer();
+
+	/* *INDENT-OFF* */
+	char *sqlTemplate =
+		"WITH nodes(slot_name, lsn) as ("
+		" SELECT '" REPLICATION_SLOT_NAME_DEFAULT "_' || id, lsn"
+		"   FROM (%s) as sb(id, lsn) "
+		"), \n"
+		"dropped as ("
+		" SELECT slot_name, pg_drop_replication_slot(slot_name) "
+		"   FROM pg_replication_slots pgrs LEFT JOIN nodes USING(slot_name) "
+		"  WHERE nodes.slot_name IS NULL "
+		"    AND slot_name ~ '" REPLICATION_SLOT_NAME_PATTERN "' "
+		"    AND not active"
+		"    AND slot_type = 'physical'"
+		"), \n"
+		"advanced as ("
+		"SELECT a.slot_name, a.end_lsn"
+		"  FROM pg_replication_slots s JOIN nodes USING(slot_name), "
+		"       LATERAL pg_replication_slot_advance(slot_name, lsn) a"
+		" WHERE nodes.lsn <> '0/0' and nodes.lsn >= s.restart_lsn "
+		"   and not s.active "
+		"), \n"
+		"created as ("
+		"SELECT c.slot_name, c.lsn "
+		"  FROM nodes LEFT JOIN pg_replication_slots pgrs USING(slot_name), "
+		"       LATERAL pg_create_physical_replication_slot(slot_name, true) c"
+		" WHERE pgrs.slot_name IS NULL "
+		") \n"
+		"SELECT 'create', slot_name, lsn FROM created "
+		" union all "
+		"SELECT 'drop', slot_name, NULL::pg_lsn FROM dropped "
+		" union all "
+		"SELECT 'advance', slot_name, end_lsn FROM advanced ";
+	/* *INDENT-ON* */
+
+	nodesArraysValuesParams sqlParams = { 0 };
+	ReplicationSlotMaintainContext context = { 0 };
+
+	if (!BuildNodesArrayValues(nodeArray, &sqlParams, values))
+	{
+		/* errors have already been logged */
+		destroyPQExpBuffer(query);
+		destroyPQExpBuffer(values);
+
+		return false;
+	}
+
+	/* add the computed ($1,$2), ... string to the query "template" */
+	appendPQExpBuffer(query, sqlTemplate, values->data);
+
+	/* the SQL text depends on the number of nodes */
+	char stmtName[NAMEDATALEN] = { 0 };
+
+	sformat(stmtName, sizeof(stmtName),
+			"pgautofailover_slot_maintain_%d", nodeArray->count);
+
+	bool success =
+		pgsql_execute_prepared(pgsql,
+							   stmtName,
+							   query->data,
+							   sqlParams.count,
+							   sqlParams.types,
+							   (const char **) sqlParams.values,
+							   &context,
+							   parseReplicationSlotMaintain);
+
+	destroyPQExpBuffer(query);
+	destroyPQExpBuffer(values);
+	(void) FreeNodesArrayValues(&sqlParams);
+
+	return success;
+}
+
+
+/*
+ * parseReplicationSlotMaintain parses the result from a PostgreSQL query
+ * fetching two columns from pg_stat_replication: sync_state and currentLSN.
+ */
+static void
+parseReplicationSlotMaintain(void *ctx, PGresult *result)
+{
+	int rowNumber = 0;
+	ReplicationSlotMaintainContext *context =
+		(ReplicationSlotMaintainContext *) ctx;
+
+	if (PQnfields(result) != 3)
+	{
+		log_error("Query returned %d columns, expected 3", PQnfields(result));
+		context->parsedOK = false;
+		return;
+	}
+
+	for (rowNumber = 0; rowNumber < PQntuples(result); rowNumber++)
+	{
+		/* operation and slotName can't be NULL given how the SQL is built */
+		char *operation = PQgetvalue(result, rowNumber, 0);
+		char *slotName = PQgetvalue(result, rowNumber, 1);
+		char *lsn = PQgetisnull(result, rowNumber, 2) ? ""
+					: PQgetvalue(result, rowNumber, 2);
+
+		/* adding or removing another standby node is worthy of a log line */
+		if (strcmp(operation, "create") == 0)
+		{
+			log_info("Creating replication slot \"%s\"", slotName);
+			++context->createdCount;
+		}
+		else if (strcmp(operation, "drop") == 0)
+		{
+			log_info("Dropping replication slot \"%s\"", slotName);
+		}
+		else
+		{
+			log_debug("parseReplicationSlotMaintain: %s %s %s",
+					  operation, slotName, lsn);
+		}
+	}
+
+	context->parsedOK = true;
+}
+
+
+/*
+ * ReplicationSlotRetentionContext is used to parse the WAL retained by our
+ * replication slots.
+ */
+typedef struct ReplicationSlotRetentionContext
+{
+	char sqlstate[SQLSTATE_LENGTH];
+	ReplicationSlotRetentionArray *slotsArray;
+	bool parsedOK;
+} ReplicationSlotRetentionContext;
+
+
+/*
+ * pgsql_replication_slot_retention fetches how much WAL each of the
+ * replication slots of the other nodes retains on the local Postgres
+ * instance: the distance from the slot restart_lsn to the current WAL
+ * position, or the current replay position on a standby node.
+ */
+bool
+pgsql_replication_slot_retention(PGSQL *pgsql,
+								 ReplicationSlotRetentionArray *slotsArray)
+{
+	ReplicationSlotRetentionContext context = { { 0 }, slotsArray, false };
+
+	/* *INDENT-OFF* */
+	char *sql =
+		"SELECT substring(slot_name from '[0-9]+$')::bigint, active, "
+		"       greatest(pg_wal_lsn_diff("
+		"                  CASE WHEN pg_is_in_recovery() "
+		"                       THEN pg_last_wal_replay_lsn() "
+		"                       ELSE pg_current_wal_lsn() "
+		"                   END, restart_lsn), 0)::bigint "
+		"  FROM pg_replication_slots "
+		" WHERE slot_name ~ '" REPLICATION_SLOT_NAME_PATTERN "[0-9]+$' "
+		"   AND slot_type = 'physical' "
+		"   AND restart_lsn IS NOT NULL "
+		" ORDER BY 1";
+	/* *INDENT-ON* */
+
+	if (!pgsql_execute_with_params(pgsql, sql, 0, NULL, NULL,
+								   &context, &parseReplicationSlotRetention))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (!context.parsedOK)
+	{
+		log_error("Failed to parse the WAL retained by replication slots");
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * parseReplicationSlotRetention parses the node id, active flag, and
+ * retained bytes of our replication slots.
+ */
+static void
+parseReplicationSlotRetention(void *ctx, PGresult *result)
+{
+	ReplicationSlotRetentionContext *context =
+		(ReplicationSlotRetentionContext *) ctx;
+	ReplicationSlotRetentionArray *slotsArray = context->slotsArray;
+
+	if (PQnfields(result) != 3)
+	{
+		log_error("Query returned %d columns, expected 3", PQnfields(result));
+		context->parsedOK = false;
+		return;
+	}
+
+	if (PQntuples(result) > REPLICATION_SLOT_RETENTION_MAX_COUNT)
+	{
+		log_error("Query returned %d replication slots, pg_autoctl supports "
+				  "up to %d", PQntuples(result),
+				  REPLICATION_SLOT_RETENTION_MAX_COUNT);
+		context->parsedOK = false;
+		return;
+	}
+
+	slotsArray->count = 0;
+
+	for (int rowNumber = 0; rowNumber < PQntuples(result); rowNumber++)
+	{
+		ReplicationSlotRetention *slot =
+			&(slotsArray->slots[slotsArray->count]);
+
+		char *nodeId = PQgetvalue(result, rowNumber, 0);
+		char *active = PQgetvalue(result, rowNumber, 1);
+		char *retainedBytes = PQgetvalue(result, rowNumber, 2);
+
+		if (!stringToInt64(nodeId, &(slot->nodeId)) ||
+			!stringToInt64(retainedBytes, &(slot->retainedBytes)))
+		{
+			log_error("Failed to parse replication slot of node \"%s\" "
+					  "retaining \"%s\" bytes", nodeId, retainedBytes);
+			context->parsedOK = false;
+			return;
+		}
+
+		slot->active = active != NULL && strcmp(active, "t") == 0;
+
+		++slotsArray->count;
 	}
 
-	/* we receive 0 rows in the result when the slot does not exist yet */
-	*slotExists = context.intVal == 1;
+	context->parsedOK = true;
+}
+
+
+/*
+ * pgsql_disable_synchronous_replication disables synchronous replication
+ * in Postgres such that writes do not block if there is no replica.
+ */
+bool
+pgsql_disable_synchronous_replication(PGSQL *pgsql)
+{
+	GUC setting = { "synchronous_standby_names", "''" };
+	char *cancelBlockedStatementsCommand =
+		"SELECT pg_cancel_backend(pid) "
+		"  FROM pg_stat_activity "
+		" WHERE wait_event = 'SyncRep'";
+
+	log_info("Disabling synchronous replication");
+
+	if (!pgsql_alter_system_set(pgsql, setting))
+	{
+		return false;
+	}
+
+	log_debug("Unblocking commands waiting for synchronous replication");
+
+	if (!pgsql_execute(pgsql, cancelBlockedStatementsCommand))
+	{
+		return false;
+	}
 
 	return true;
 }
 
 
 /*
- * pgsql_create_replication_slot tries to create a replication slot on the
- * database identified by a connection string. It's implemented as CREATE IF
- * NOT EXISTS so that it's idempotent and can be retried easily.
+ * pgsql_set_default_transaction_mode_read_only makes it so that the server
+ * won't be a target of a connection string requiring target_session_attrs
+ * read-write by issuing ALTER SYSTEM SET transaction_mode_read_only TO on;
+ *
  */
 bool
-pgsql_create_replication_slot(PGSQL *pgsql, const char *slotName)
+pgsql_set_default_transaction_mode_read_only(PGSQL *pgsql)
 {
-	ReplicationSlotMaintainContext context = { 0 };
-	char *sql =
-		"SELECT 'create', slot_name, lsn "
-		"  FROM pg_create_physical_replication_slot($1) "
-		" WHERE NOT EXISTS "
-		" (SELECT 1 FROM pg_replication_slots WHERE slot_name = $1)";
-	const Oid paramTypes[1] = { TEXTOID };
-	const char *paramValues[1] = { slotName };
+	GUC setting = { "default_transaction_read_only", "'on'" };
 
-	log_trace("pgsql_create_replication_slot");
+	log_info("Setting default_transaction_read_only to on");
 
-	/*
-	 * parseReplicationSlotMaintain will log_info() the replication slot
-	 * creation if it happens. When the slot already exists we return 0 row and
-	 * remain silent about it.
-	 */
-	return pgsql_execute_with_params(pgsql, sql, 1, paramTypes, paramValues,
-									 &context, parseReplicationSlotMaintain);
+	return pgsql_alter_system_set(pgsql, setting);
 }
 
 
 /*
- * pgsql_drop_replication_slot drops a given replication slot.
+ * pgsql_set_default_transaction_mode_read_write makes it so that the server
+ * can be a target of a connection string requiring target_session_attrs
+ * read-write by issuing ALTER SYSTEM SET transaction_mode_read_only TO off;
+ *
  */
 bool
-pgsql_drop_replication_slot(PGSQL *pgsql, const char *slotName)
+pgsql_set_default_transaction_mode_read_write(PGSQL *pgsql)
 {
-	char *sql =
-		"SELECT pg_drop_replication_slot(slot_name) "
-		"  FROM pg_replication_slots "
-		" WHERE slot_name = $1";
-	Oid paramTypes[1] = { TEXTOID };
-	const char *paramValues[1] = { slotName };
+	GUC setting = { "default_transaction_read_only", "'off'" };
 
-	log_info("Drop replication slot \"%s\"", slotName);
+	log_info("Setting default_transaction_read_only to off");
 
-	return pgsql_execute_with_params(pgsql, sql,
-									 1, paramTypes, paramValues, NULL, NULL);
+	return pgsql_alter_system_set(pgsql, setting);
 }
 
 
 /*
- * BuildNodesArrayValues build the SQL expression to use in a FROM clause to
- * represent the list of other standby nodes from the given nodeArray.
- *
- * Such a list looks either like:
- *
- *   VALUES($1, $2::pg_lsn), ($3, $4)
- *
- * or for an empty set (e.g. when we're the only standby):
- *
- *   SELECT id, lsn
- *     FROM (values (null::int, null::pg_lsn)) as t(id, lsn)
- *    WHERE false
- *
- * We actually need to provide an empty set (0 rows) with columns of the
- * expected data types so that we can join against the existing replication
- * slots and drop them. If the set is empty, we drop all the slots.
- *
- * We return how many parameters we filled in paramTypes and paramValues from
- * the nodeArray.
+ * pgsql_set_checkpoint_settings sets max_wal_size (in MB) and
+ * checkpoint_timeout (in seconds) with ALTER SYSTEM, both settings are
+ * applied with a reload.
  */
-#define NODEID_MAX_LENGTH 20    /* should allow for bigint digits */
+bool
+pgsql_set_checkpoint_settings(PGSQL *pgsql,
+							  uint64_t maxWalSizeMB,
+							  int checkpointTimeout)
+{
+	char maxWalSize[BUFSIZE] = { 0 };
+	char timeout[BUFSIZE] = { 0 };
 
-typedef struct nodesArraysValuesParams
+	GUC maxWalSizeSetting = { "max_wal_size", maxWalSize };
+	GUC timeoutSetting = { "checkpoint_timeout", timeout };
+
+	sformat(maxWalSize, sizeof(maxWalSize), "'%lluMB'",
+			(unsigned long long) maxWalSizeMB);
+	sformat(timeout, sizeof(timeout), "'%ds'", checkpointTimeout);
+
+	return pgsql_alter_system_set(pgsql, maxWalSizeSetting) &&
+		   pgsql_alter_system_set(pgsql, timeoutSetting);
+}
+
+
+/*
+ * pgsql_reset_checkpoint_settings undoes pgsql_set_checkpoint_settings with
+ * ALTER SYSTEM RESET, and reloads the configuration.
+ */
+bool
+pgsql_reset_checkpoint_settings(PGSQL *pgsql)
 {
-	int count;
-	Oid types[NODE_ARRAY_MAX_COUNT * 2];
-	char *values[NODE_ARRAY_MAX_COUNT * 2];
+	/* ALTER SYSTEM cannot run inside a transaction block */
+	if (!pgsql_execute(pgsql, "ALTER SYSTEM RESET max_wal_size"))
+	{
+		return false;
+	}
 
-	/*
-	 * Pre-allocate arrays for the data separately from the values array, which
-	 * needs to be a (const char **) thing rather than a (char [][]) thing,
-	 * because of the pgsql_execute_with_params and libpq APIs.
-	 */
-	char nodeIds[NODE_ARRAY_MAX_COUNT][NODEID_MAX_LENGTH];
-	char lsns[NODE_ARRAY_MAX_COUNT][PG_LSN_MAXLENGTH];
-} nodesArraysValuesParams;
+	if (!pgsql_execute(pgsql, "ALTER SYSTEM RESET checkpoint_timeout"))
+	{
+		return false;
+	}
 
+	return pgsql_reload_conf(pgsql);
+}
 
-static bool
-BuildNodesArrayValues(NodeAddressArray *nodeArray,
-					  nodesArraysValuesParams *sqlParams,
-					  PQExpBuffer values)
+
+/*
+ * pgsql_set_wal_compression sets wal_compression with ALTER SYSTEM, and
+ * reloads the configuration. The method is one of on, pglz, lz4, or zstd.
+ */
+bool
+pgsql_set_wal_compression(PGSQL *pgsql, const char *method)
 {
-	int nodeIndex = 0;
-	int paramIndex = 0;
+	char value[BUFSIZE] = { 0 };
+	GUC setting = { "wal_compression", value };
 
-	/* when we didn't find any node to process, return our empty set */
-	if (nodeArray->count == 0)
+	sformat(value, sizeof(value), "'%s'", method);
+
+	return pgsql_alter_system_set(pgsql, setting);
+}
+
+
+/*
+ * pgsql_reset_wal_compression undoes pgsql_set_wal_compression with ALTER
+ * SYSTEM RESET, and reloads the configuration.
+ */
+bool
+pgsql_reset_wal_compression(PGSQL *pgsql)
+{
+	/* ALTER SYSTEM cannot run inside a transaction block */
+	if (!pgsql_execute(pgsql, "ALTER SYSTEM RESET wal_compression"))
 	{
-		appendPQExpBufferStr(
-			values,
-			"SELECT id, lsn "
-			"FROM (values (null::int, null::pg_lsn)) as t(id, lsn) "
-			"where false");
+		return false;
+	}
 
-		return true;
+	return pgsql_reload_conf(pgsql);
+}
+
+
+/*
+ * pgsql_checkpoint runs a CHECKPOINT command on postgres to trigger a checkpoint.
+ */
+bool
+pgsql_checkpoint(PGSQL *pgsql)
+{
+	return pgsql_execute(pgsql, "CHECKPOINT");
+}
+
+
+/*
+ * pgsql_spread_checkpoint runs a checkpoint on a primary server that is paced
+ * by checkpoint_completion_target, as opposed to the CHECKPOINT command which
+ * always runs an immediate checkpoint. The only SQL level API that allows
+ * requesting such a checkpoint is the non-exclusive backup API, which we use
+ * here without copying any file.
+ */
+bool
+pgsql_spread_checkpoint(PGSQL *pgsql, bool fast)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_INT, false };
+	char *versionSQL = "SELECT current_setting('server_version_num')::int";
+
+	const Oid paramTypes[2] = { TEXTOID, BOOLOID };
+	const char *paramValues[2] = { "pg_autoctl checkpoint", fast ? "t" : "f" };
+
+	if (!pgsql_begin(pgsql))
+	{
+		/* errors have already been logged */
+		return false;
 	}
 
-	/* we start the VALUES subquery with the values SQL keyword */
-	appendPQExpBufferStr(values, "values ");
+	if (!pgsql_execute_with_params(pgsql, versionSQL, 0, NULL, NULL,
+								   &context, &parseSingleValueResult) ||
+		!context.parsedOk)
+	{
+		log_error("Failed to get the server_version_num setting");
+		pgsql_rollback(pgsql);
+		return false;
+	}
 
-	/*
-	 * Build a SQL VALUES statement for every other node registered in the
-	 * system, so that we can maintain their LSN position locally on a standby
-	 * server.
-	 */
-	for (nodeIndex = 0; nodeIndex < nodeArray->count; nodeIndex++)
+	/* Postgres 15 renamed the backup functions and removed exclusive mode */
+	char *startSQL =
+		context.intVal >= 150000
+		? "SELECT pg_backup_start($1, $2)"
+		: "SELECT pg_start_backup($1, $2, false)";
+
+	char *stopSQL =
+		context.intVal >= 150000
+		? "SELECT pg_backup_stop(false)"
+		: "SELECT pg_stop_backup(false, false)";
+
+	if (!pgsql_execute_with_params(pgsql, startSQL, 2, paramTypes, paramValues,
+								   NULL, NULL))
 	{
-		NodeAddress *node = &(nodeArray->nodes[nodeIndex]);
-		char *nodeIdString = intToString(node->nodeId).strValue;
+		/* errors have already been logged */
+		pgsql_rollback(pgsql);
+		return false;
+	}
 
-		int idParamIndex = paramIndex;
-		int lsnParamIndex = paramIndex + 1;
+	if (!pgsql_execute_with_params(pgsql, stopSQL, 0, NULL, NULL, NULL, NULL))
+	{
+		/* errors have already been logged */
+		pgsql_rollback(pgsql);
+		return false;
+	}
 
-		sqlParams->types[idParamIndex] = INT8OID;
-		strlcpy(sqlParams->nodeIds[nodeIndex], nodeIdString, NODEID_MAX_LENGTH);
+	return pgsql_commit(pgsql);
+}
 
-		/* store the (char *) pointer to the data in values */
-		sqlParams->values[idParamIndex] = sqlParams->nodeIds[nodeIndex];
 
-		sqlParams->types[lsnParamIndex] = LSNOID;
-		strlcpy(sqlParams->lsns[nodeIndex], node->lsn, PG_LSN_MAXLENGTH);
+/*
+ * pgsql_backup_start starts a non-exclusive backup, which is tied to the
+ * session: the caller keeps the connection open until pgsql_backup_stop.
+ * The server_version_num of the server is returned for pgsql_backup_stop.
+ */
+bool
+pgsql_backup_start(PGSQL *pgsql, const char *label, int *serverVersionNum)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_INT, false };
+	char *versionSQL = "SELECT current_setting('server_version_num')::int";
 
-		/* store the (char *) pointer to the data in values */
-		sqlParams->values[lsnParamIndex] = sqlParams->lsns[nodeIndex];
+	const Oid paramTypes[1] = { TEXTOID };
+	const char *paramValues[1] = { label };
 
-		appendPQExpBuffer(values,
-						  "%s($%d, $%d%s)",
-						  paramIndex == 0 ? "" : ",",
+	if (!pgsql_execute_with_params(pgsql, versionSQL, 0, NULL, NULL,
+								   &context, &parseSingleValueResult) ||
+		!context.parsedOk)
+	{
+		log_error("Failed to get the server_version_num setting");
+		return false;
+	}
 
-		                  /* we begin at $1 here: intentional off-by-one */
-						  idParamIndex + 1, lsnParamIndex + 1,
+	*serverVersionNum = context.intVal;
 
-		                  /* cast only the first row */
-						  paramIndex == 0 ? "::pg_lsn" : "");
+	/* Postgres 15 renamed the backup functions and removed exclusive mode */
+	char *startSQL =
+		context.intVal >= 150000
+		? "SELECT pg_backup_start($1, true)"
+		: "SELECT pg_start_backup($1, true, false)";
 
-		/* prepare next round */
-		paramIndex += 2;
+	if (!pgsql_execute_with_params(pgsql, startSQL, 1, paramTypes, paramValues,
+								   NULL, NULL))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * BackupStopContext keeps the result of pg_backup_stop().
+ */
+typedef struct BackupStopContext
+{
+	char sqlstate[SQLSTATE_LENGTH];
+	bool parsedOk;
+	BackupLabel *backupLabel;
+} BackupStopContext;
+
+
+/*
+ * pgsql_backup_stop stops the non-exclusive backup that pgsql_backup_start
+ * started in the same session, and returns the contents of the backup_label
+ * and tablespace_map files of the backup. We don't wait for the WAL to be
+ * archived, the standby streams it from its upstream node.
+ */
+bool
+pgsql_backup_stop(PGSQL *pgsql, int serverVersionNum, BackupLabel *backupLabel)
+{
+	BackupStopContext context = { { 0 }, false, backupLabel };
+
+	char *stopSQL =
+		serverVersionNum >= 150000
+		? "SELECT labelfile, spcmapfile, lsn FROM pg_backup_stop(false)"
+		: "SELECT labelfile, spcmapfile, lsn FROM pg_stop_backup(false, false)";
+
+	if (!pgsql_execute_with_params(pgsql, stopSQL, 0, NULL, NULL,
+								   &context, &parseBackupStopResult))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		log_error("Failed to parse the result of pg_backup_stop()");
+		return false;
 	}
 
-	/* count how many parameters where appended to the VALUES() parts */
-	sqlParams->count = paramIndex;
-
 	return true;
 }
 
 
 /*
- * pgsql_replication_slot_create_and_drop drops replication slots that belong
- * to nodes that have been removed, and creates replication slots for nodes
- * that have been newly registered. We call that function on the primary, where
- * the slots are maintained by the replication protocol.
- *
- * On the standby nodes, we advance the slots ourselves and use the other
- * function pgsql_replication_slot_maintain which is complete (create, drop,
- * advance).
+ * pgsql_read_binary_file reads up to size bytes of the given file of the
+ * server data directory from the given offset, with pg_read_binary_file(),
+ * and sets bytesRead to how many bytes it copied in the buffer. The result is
+ * fetched in binary format, which saves the hex encoding of the bytea on both
+ * sides of the connection. When the file has been removed, missing is set to
+ * true.
  */
 bool
-pgsql_replication_slot_create_and_drop(PGSQL *pgsql, NodeAddressArray *nodeArray)
+pgsql_read_binary_file(PGSQL *pgsql, const char *path, uint64_t offset,
+					   char *buffer, int size, int *bytesRead, bool *missing)
 {
-	PQExpBuffer query = createPQExpBuffer();
-	PQExpBuffer values = createPQExpBuffer();
+	const char *sql = "SELECT pg_read_binary_file($1, $2, $3, true)";
+	char offsetString[BUFSIZE] = { 0 };
+	char sizeString[BUFSIZE] = { 0 };
+	char debugParameters[BUFSIZE] = { 0 };
 
-	/* *INDENT-OFF* */
-	char *sqlTemplate =
-		/*
-		 * We could simplify the writing of this query, but we prefer that it
-		 * looks as much as possible like the query used in
-		 * pgsql_replication_slot_maintain() so that we can maintain both
-		 * easily.
-		 */
-		"WITH nodes(slot_name, lsn) as ("
-		" SELECT '" REPLICATION_SLOT_NAME_DEFAULT "_' || id, lsn"
-		"   FROM (%s) as sb(id, lsn) "
-		"), \n"
-		"dropped as ("
-		" SELECT slot_name, pg_drop_replication_slot(slot_name) "
-		"   FROM pg_replication_slots pgrs LEFT JOIN nodes USING(slot_name) "
-		"  WHERE nodes.slot_name IS NULL "
-		"    AND (   slot_name ~ '" REPLICATION_SLOT_NAME_PATTERN "' "
-		"         OR slot_name ~ '" REPLICATION_SLOT_NAME_DEFAULT "' )"
-		"    AND not active"
-		"    AND slot_type = 'physical'"
-		"), \n"
-		"created as ("
-		"SELECT c.slot_name, c.lsn "
-		"  FROM nodes LEFT JOIN pg_replication_slots pgrs USING(slot_name), "
-		"       LATERAL pg_create_physical_replication_slot(slot_name, true) c"
-		" WHERE pgrs.slot_name IS NULL "
-		") \n"
-		"SELECT 'create', slot_name, lsn FROM created "
-		" union all "
-		"SELECT 'drop', slot_name, NULL::pg_lsn FROM dropped";
-	/* *INDENT-ON* */
+	sformat(offsetString, sizeof(offsetString), "%" PRIu64, offset);
+	sformat(sizeString, sizeof(sizeString), "%d", size);
 
-	nodesArraysValuesParams sqlParams = { 0 };
-	ReplicationSlotMaintainContext context = { 0 };
+	const Oid paramTypes[3] = { TEXTOID, INT8OID, INT8OID };
+	const char *paramValues[3] = { path, offsetString, sizeString };
 
-	if (!BuildNodesArrayValues(nodeArray, &sqlParams, values))
+	*bytesRead = 0;
+	*missing = false;
+
+	PGconn *connection = pgsql_open_connection(pgsql);
+
+	if (connection == NULL)
 	{
 		/* errors have already been logged */
-		destroyPQExpBuffer(query);
-		destroyPQExpBuffer(values);
-
 		return false;
 	}
 
-	/* add the computed ($1,$2), ... string to the query "template" */
-	appendPQExpBuffer(query, sqlTemplate, values->data);
-
-	bool success =
-		pgsql_execute_with_params(pgsql,
-								  query->data,
-								  sqlParams.count,
-								  sqlParams.types,
-								  (const char **) sqlParams.values,
-								  &context,
-								  parseReplicationSlotMaintain);
+	PGresult *result = PQexecParams(connection, sql,
+									3, paramTypes, paramValues,
+									NULL, NULL, 1);
 
-	destroyPQExpBuffer(query);
-	destroyPQExpBuffer(values);
+	if (!is_response_ok(result))
+	{
+		(void) format_debug_parameters(3, paramValues,
+									   debugParameters, sizeof(debugParameters));
+		(void) log_query_error(pgsql, result, sql, debugParameters, NULL);
 
-	return success;
-}
+		PQclear(result);
+		clear_results(pgsql);
 
+		if (pgsql->connectionStatementType == PGSQL_CONNECTION_SINGLE_STATEMENT)
+		{
+			pgsql_finish(pgsql);
+		}
 
-/*
- * pgsql_replication_slot_maintain creates, drops, and advance replication
- * slots that belong to other standby nodes. We call that function on the
- * standby nodes, where the slots are maintained manually just in case we need
- * them at failover.
- */
-bool
-pgsql_replication_slot_maintain(PGSQL *pgsql, NodeAddressArray *nodeArray)
-{
-	PQExpBuffer query = createPQExpBuffer();
-	PQExpBuffer values = createPQExpBuffer();
+		return false;
+	}
 
-	/* *INDENT-OFF* */
-	char *sqlTemplate =
-		"WITH nodes(slot_name, lsn) as ("
-		" SELECT '" REPLICATION_SLOT_NAME_DEFAULT "_' || id, lsn"
-		"   FROM (%s) as sb(id, lsn) "
-		"), \n"
-		"dropped as ("
-		" SELECT slot_name, pg_drop_replication_slot(slot_name) "
-		"   FROM pg_replication_slots pgrs LEFT JOIN nodes USING(slot_name) "
-		"  WHERE nodes.slot_name IS NULL "
-		"    AND slot_name ~ '" REPLICATION_SLOT_NAME_PATTERN "' "
-		"    AND not active"
-		"    AND slot_type = 'physical'"
-		"), \n"
-		"advanced as ("
-		"SELECT a.slot_name, a.end_lsn"
-		"  FROM pg_replication_slots s JOIN nodes USING(slot_name), "
-		"       LATERAL pg_replication_slot_advance(slot_name, lsn) a"
-		" WHERE nodes.lsn <> '0/0' and nodes.lsn >= s.restart_lsn "
-		"   and not s.active "
-		"), \n"
-		"created as ("
-		"SELECT c.slot_name, c.lsn "
-		"  FROM nodes LEFT JOIN pg_replication_slots pgrs USING(slot_name), "
-		"       LATERAL pg_create_physical_replication_slot(slot_name, true) c"
-		" WHERE pgrs.slot_name IS NULL "
-		") \n"
-		"SELECT 'create', slot_name, lsn FROM created "
-		" union all "
-		"SELECT 'drop', slot_name, NULL::pg_lsn FROM dropped "
-		" union all "
-		"SELECT 'advance', slot_name, end_lsn FROM advanced ";
-	/* *INDENT-ON* */
+	if (PQntuples(result) != 1 || PQnfields(result) != 1)
+	{
+		log_error("Query returned %d rows and %d columns, expected 1 and 1",
+				  PQntuples(result), PQnfields(result));
 
-	nodesArraysValuesParams sqlParams = { 0 };
-	ReplicationSlotMaintainContext context = { 0 };
+		PQclear(result);
+		clear_results(pgsql);
 
-	if (!BuildNodesArrayValues(nodeArray, &sqlParams, values))
-	{
-		/* errors have already been logged */
-		destroyPQExpBuffer(query);
-		destroyPQExpBuffer(values);
+		if (pgsql->connectionStatementType == PGSQL_CONNECTION_SINGLE_STATEMENT)
+		{
+			pgsql_finish(pgsql);
+		}
 
 		return false;
 	}
 
-	/* add the computed ($1,$2), ... string to the query "template" */
-	appendPQExpBuffer(query, sqlTemplate, values->data);
+	if (PQgetisnull(result, 0, 0))
+	{
+		*missing = true;
+	}
+	else
+	{
+		int length = PQgetlength(result, 0, 0);
 
-	bool success =
-		pgsql_execute_with_params(pgsql,
-								  query->data,
-								  sqlParams.count,
-								  sqlParams.types,
-								  (const char **) sqlParams.values,
-								  &context,
-								  parseReplicationSlotMaintain);
+		if (length > size)
+		{
+			log_error("pg_read_binary_file() returned %d bytes, "
+					  "expected at most %d", length, size);
 
-	destroyPQExpBuffer(query);
-	destroyPQExpBuffer(values);
+			PQclear(result);
+			clear_results(pgsql);
 
-	return success;
+			if (pgsql->connectionStatementType ==
+				PGSQL_CONNECTION_SINGLE_STATEMENT)
+			{
+				pgsql_finish(pgsql);
+			}
+
+			return false;
+		}
+
+		memcpy(buffer, PQgetvalue(result, 0, 0), length);
+		*bytesRead = length;
+	}
+
+	PQclear(result);
+	clear_results(pgsql);
+
+	if (pgsql->connectionStatementType == PGSQL_CONNECTION_SINGLE_STATEMENT)
+	{
+		pgsql_finish(pgsql);
+	}
+
+	return true;
 }
 
 
 /*
- * parseReplicationSlotMaintain parses the result from a PostgreSQL query
- * fetching two columns from pg_stat_replication: sync_state and currentLSN.
+ * parseBackupStopResult parses the labelfile, spcmapfile, and lsn columns
+ * returned by pg_backup_stop().
  */
 static void
-parseReplicationSlotMaintain(void *ctx, PGresult *result)
+parseBackupStopResult(void *ctx, PGresult *result)
 {
-	int rowNumber = 0;
-	ReplicationSlotMaintainContext *context =
-		(ReplicationSlotMaintainContext *) ctx;
+	BackupStopContext *context = (BackupStopContext *) ctx;
+	BackupLabel *backupLabel = context->backupLabel;
 
 	if (PQnfields(result) != 3)
 	{
 		log_error("Query returned %d columns, expected 3", PQnfields(result));
-		context->parsedOK = false;
+		context->parsedOk = false;
 		return;
 	}
 
-	for (rowNumber = 0; rowNumber < PQntuples(result); rowNumber++)
+	if (PQntuples(result) != 1)
 	{
-		/* operation and slotName can't be NULL given how the SQL is built */
-		char *operation = PQgetvalue(result, rowNumber, 0);
-		char *slotName = PQgetvalue(result, rowNumber, 1);
-		char *lsn = PQgetisnull(result, rowNumber, 2) ? ""
-					: PQgetvalue(result, rowNumber, 2);
+		log_error("Query returned %d rows, expected 1", PQntuples(result));
+		context->parsedOk = false;
+		return;
+	}
 
-		/* adding or removing another standby node is worthy of a log line */
-		if (strcmp(operation, "create") == 0)
-		{
-			log_info("Creating replication slot \"%s\"", slotName);
-		}
-		else if (strcmp(operation, "drop") == 0)
-		{
-			log_info("Dropping replication slot \"%s\"", slotName);
-		}
-		else
-		{
-			log_debug("parseReplicationSlotMaintain: %s %s %s",
-					  operation, slotName, lsn);
-		}
+	strlcpy(backupLabel->stopLSN, PQgetvalue(result, 0, 2), PG_LSN_MAXLENGTH);
+
+	char *labelFile = PQgetvalue(result, 0, 0);
+	char *spcmapFile = PQgetisnull(result, 0, 1) ? "" : PQgetvalue(result, 0, 1);
+
+	if (strlcpy(backupLabel->labelFile, labelFile, BUFSIZE) >= BUFSIZE ||
+		strlcpy(backupLabel->spcmapFile, spcmapFile, BUFSIZE) >= BUFSIZE)
+	{
+		log_error("The backup_label or tablespace_map returned by "
+				  "pg_backup_stop() are longer than %d bytes", BUFSIZE - 1);
+		context->parsedOk = false;
+		return;
 	}
 
-	context->parsedOK = true;
+	context->parsedOk = true;
 }
 
 
 /*
- * pgsql_disable_synchronous_replication disables synchronous replication
- * in Postgres such that writes do not block if there is no replica.
+ * pgsql_get_redo_distance computes how many bytes of WAL a crash recovery
+ * would have to replay if it were to start now, that is the distance between
+ * the redo location of the last checkpoint (or restartpoint for a standby)
+ * and the current WAL location (or replay location for a standby).
  */
 bool
-pgsql_disable_synchronous_replication(PGSQL *pgsql)
+pgsql_get_redo_distance(PGSQL *pgsql, uint64_t *redoBytes)
 {
-	GUC setting = { "synchronous_standby_names", "''" };
-	char *cancelBlockedStatementsCommand =
-		"SELECT pg_cancel_backend(pid) "
-		"  FROM pg_stat_activity "
-		" WHERE wait_event = 'SyncRep'";
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BIGINT, false };
 
-	log_info("Disabling synchronous replication");
+	char *sql =
+		"SELECT pg_wal_lsn_diff("
+		"         CASE WHEN pg_is_in_recovery() "
+		"              THEN pg_last_wal_replay_lsn() "
+		"              ELSE pg_current_wal_lsn() "
+		"          END, "
+		"         redo_lsn)::bigint "
+		"  FROM pg_control_checkpoint()";
 
-	if (!pgsql_alter_system_set(pgsql, setting))
+	if (!pgsql_execute_with_params(pgsql, sql, 0, NULL, NULL,
+								   &context, &parseSingleValueResult))
 	{
+		/* errors have already been logged */
 		return false;
 	}
 
-	log_debug("Unblocking commands waiting for synchronous replication");
+	if (!context.parsedOk)
+	{
+		log_error("Failed to get result from pg_control_checkpoint()");
+		return false;
+	}
 
-	if (!pgsql_execute(pgsql, cancelBlockedStatementsCommand))
+	*redoBytes = context.bigint;
+
+	return true;
+}
+
+
+/*
+ * pgsql_measure_health_signals times a canary statement that reads the
+ * checkpointer statistics, and a transaction that assigns a transaction id
+ * and then waits for its commit record to be flushed locally, without waiting
+ * for the synchronous standby nodes.
+ *
+ * The checkpointer statistics moved to pg_stat_checkpointer in Postgres 17.
+ */
+bool
+pgsql_measure_health_signals(PGSQL *pgsql, uint32_t pg_control_version,
+							 PostgresHealthSignals *signals)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BIGINT, false };
+
+	instr_time startTime;
+	instr_time duration;
+
+	char *canarySQL =
+		pg_control_version >= 1700
+		? "SELECT sync_time::bigint FROM pg_stat_checkpointer"
+		: "SELECT checkpoint_sync_time::bigint FROM pg_stat_bgwriter";
+
+	char *walFlushSQL =
+		"SELECT set_config('synchronous_commit', 'local', true), "
+		"       txid_current()";
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	if (!pgsql_execute_with_params(pgsql, canarySQL, 0, NULL, NULL,
+								   &context, &parseSingleValueResult))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	if (!context.parsedOk)
+	{
+		log_error("Failed to get the checkpointer statistics");
+		return false;
+	}
+
+	signals->canaryMs = INSTR_TIME_GET_MILLISEC(duration);
+	signals->checkpointSyncTime = context.bigint;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	if (!pgsql_execute(pgsql, walFlushSQL))
 	{
+		/* errors have already been logged */
 		return false;
 	}
 
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	signals->walFlushMs = INSTR_TIME_GET_MILLISEC(duration);
+
 	return true;
 }
 
 
 /*
- * pgsql_set_default_transaction_mode_read_only makes it so that the server
- * won't be a target of a connection string requiring target_session_attrs
- * read-write by issuing ALTER SYSTEM SET transaction_mode_read_only TO on;
- *
+ * pgsql_measure_load counts the client connections that are running a query,
+ * not counting our own, and the WAL bytes that the standby has received and
+ * not replayed yet.
  */
 bool
-pgsql_set_default_transaction_mode_read_only(PGSQL *pgsql)
+pgsql_measure_load(PGSQL *pgsql, PostgresLoad *load)
 {
-	GUC setting = { "default_transaction_read_only", "'on'" };
+	SingleValueResultContext connContext = { { 0 }, PGSQL_RESULT_INT, false };
+	SingleValueResultContext lagContext = { { 0 }, PGSQL_RESULT_BIGINT, false };
 
-	log_info("Setting default_transaction_read_only to on");
+	char *connectionsSQL =
+		"SELECT count(*) FROM pg_stat_activity "
+		" WHERE state = 'active' AND backend_type = 'client backend' "
+		"   AND pid <> pg_backend_pid()";
 
-	return pgsql_alter_system_set(pgsql, setting);
-}
+	char *replayLagSQL =
+		"SELECT greatest(pg_wal_lsn_diff(pg_last_wal_receive_lsn(), "
+		"                                pg_last_wal_replay_lsn()), 0)::bigint";
 
+	if (!pgsql_execute_with_params(pgsql, connectionsSQL, 0, NULL, NULL,
+								   &connContext, &parseSingleValueResult))
+	{
+		/* errors have already been logged */
+		return false;
+	}
 
-/*
- * pgsql_set_default_transaction_mode_read_write makes it so that the server
- * can be a target of a connection string requiring target_session_attrs
- * read-write by issuing ALTER SYSTEM SET transaction_mode_read_only TO off;
- *
- */
-bool
-pgsql_set_default_transaction_mode_read_write(PGSQL *pgsql)
-{
-	GUC setting = { "default_transaction_read_only", "'off'" };
+	if (!connContext.parsedOk)
+	{
+		log_error("Failed to count the active connections");
+		return false;
+	}
 
-	log_info("Setting default_transaction_read_only to off");
+	if (!pgsql_execute_with_params(pgsql, replayLagSQL, 0, NULL, NULL,
+								   &lagContext, &parseSingleValueResult))
+	{
+		/* errors have already been logged */
+		return false;
+	}
 
-	return pgsql_alter_system_set(pgsql, setting);
-}
+	if (!lagContext.parsedOk)
+	{
+		log_error("Failed to get the replay lag");
+		return false;
+	}
 
+	load->activeConnections = connContext.intVal;
+	load->replayLag = (int64_t) lagContext.bigint;
 
-/*
- * pgsql_checkpoint runs a CHECKPOINT command on postgres to trigger a checkpoint.
- */
-bool
-pgsql_checkpoint(PGSQL *pgsql)
-{
-	return pgsql_execute(pgsql, "CHECKPOINT");
+	return true;
 }
 
 
@@ -2377,17 +4234,50 @@ pgsql_has_replica(PGSQL *pgsql, char *userName, bool *hasReplica)
 
 /*
  * hostname_from_uri parses a PostgreSQL connection string URI and returns
- * whether the URL was successfully parsed.
+ * whether the URL was successfully parsed. When the URI lists several hosts,
+ * we return the first one.
  */
 bool
 hostname_from_uri(const char *pguri,
 				  char *hostname, int maxHostLength, int *port)
 {
-	int found = 0;
+	URIHostArray hostArray = { 0 };
+
+	if (!hostnames_from_uri(pguri, &hostArray))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	int hostNameLength = strlcpy(hostname, hostArray.hosts[0], maxHostLength);
+
+	if (hostNameLength >= maxHostLength)
+	{
+		log_error("The URL \"%s\" contains a hostname of %d characters, "
+				  "the maximum supported by pg_autoctl is %d characters",
+				  pguri, hostNameLength, maxHostLength);
+		return false;
+	}
+
+	*port = hostArray.ports[0];
+
+	return true;
+}
+
+
+/*
+ * hostnames_from_uri parses a PostgreSQL connection string URI and fills in
+ * the given hostArray with each host and port it lists. As in libpq, a single
+ * port applies to every host, and the default port is POSTGRES_PORT.
+ */
+bool
+hostnames_from_uri(const char *pguri, URIHostArray *hostArray)
+{
 	char *errmsg;
-	PQconninfoOption *conninfo, *option;
+	char hosts[MAXCONNINFO] = { 0 };
+	char ports[MAXCONNINFO] = { 0 };
 
-	conninfo = PQconninfoParse(pguri, &errmsg);
+	PQconninfoOption *conninfo = PQconninfoParse(pguri, &errmsg);
 	if (conninfo == NULL)
 	{
 		log_error("Failed to parse pguri \"%s\": %s", pguri, errmsg);
@@ -2395,55 +4285,98 @@ hostname_from_uri(const char *pguri,
 		return false;
 	}
 
-	for (option = conninfo; option->keyword != NULL; option++)
+	for (PQconninfoOption *option = conninfo; option->keyword != NULL; option++)
 	{
+		if (option->val == NULL)
+		{
+			continue;
+		}
+
+		/* prefer host over hostaddr when both are given */
 		if (strcmp(option->keyword, "host") == 0 ||
-			strcmp(option->keyword, "hostaddr") == 0)
+			(strcmp(option->keyword, "hostaddr") == 0 && hosts[0] == '\0'))
 		{
-			if (option->val)
-			{
-				int hostNameLength = strlcpy(hostname, option->val, maxHostLength);
+			strlcpy(hosts, option->val, MAXCONNINFO);
+		}
+		else if (strcmp(option->keyword, "port") == 0)
+		{
+			strlcpy(ports, option->val, MAXCONNINFO);
+		}
+	}
+	PQconninfoFree(conninfo);
 
-				if (hostNameLength >= maxHostLength)
-				{
-					log_error(
-						"The URL \"%s\" contains a hostname of %d characters, "
-						"the maximum supported by pg_autoctl is %d characters",
-						option->val, hostNameLength, maxHostLength);
-					PQconninfoFree(conninfo);
-					return false;
-				}
+	hostArray->count = 0;
 
-				++found;
-			}
+	char *hostPtr = hosts;
+	char *hostItem = NULL;
+
+	while ((hostItem = strsep(&hostPtr, ",")) != NULL)
+	{
+		if (hostArray->count == URI_MAX_HOSTS)
+		{
+			log_error("The URL \"%s\" contains more than %d hosts, "
+					  "the maximum supported by pg_autoctl",
+					  pguri, URI_MAX_HOSTS);
+			return false;
 		}
 
-		if (strcmp(option->keyword, "port") == 0)
+		int hostNameLength = strlcpy(hostArray->hosts[hostArray->count],
+									 hostItem, _POSIX_HOST_NAME_MAX);
+
+		if (hostNameLength >= _POSIX_HOST_NAME_MAX)
 		{
-			if (option->val)
-			{
-				/* we expect a single port number in a monitor's URI */
-				if (!stringToInt(option->val, port))
-				{
-					log_error("Failed to parse port number : %s", option->val);
+			log_error("The URL \"%s\" contains a hostname of %d characters, "
+					  "the maximum supported by pg_autoctl is %d characters",
+					  pguri, hostNameLength, _POSIX_HOST_NAME_MAX);
+			return false;
+		}
 
-					PQconninfoFree(conninfo);
-					return false;
-				}
-				++found;
-			}
-			else
-			{
-				*port = POSTGRES_PORT;
-			}
+		hostArray->ports[hostArray->count] = POSTGRES_PORT;
+		++hostArray->count;
+	}
+
+	if (ports[0] == '\0')
+	{
+		return true;
+	}
+
+	int portCount = 0;
+	char *portPtr = ports;
+	char *portItem = NULL;
+
+	while ((portItem = strsep(&portPtr, ",")) != NULL)
+	{
+		if (portCount == hostArray->count)
+		{
+			log_error("The URL \"%s\" contains more ports than hosts", pguri);
+			return false;
 		}
 
-		if (found == 2)
+		/* an empty item in the list stands for the default port */
+		if (portItem[0] != '\0' &&
+			!stringToInt(portItem, &(hostArray->ports[portCount])))
 		{
-			break;
+			log_error("Failed to parse port number : %s", portItem);
+			return false;
 		}
+
+		++portCount;
+	}
+
+	/* a single port number applies to every host */
+	if (portCount == 1)
+	{
+		for (int i = 1; i < hostArray->count; i++)
+		{
+			hostArray->ports[i] = hostArray->ports[0];
+		}
+	}
+	else if (portCount != hostArray->count)
+	{
+		log_error("The URL \"%s\" contains %d hosts and %d ports",
+				  pguri, hostArray->count, portCount);
+		return false;
 	}
-	PQconninfoFree(conninfo);
 
 	return true;
 }
@@ -2504,6 +4437,7 @@ typedef struct PgMetadata
 	bool pg_is_in_recovery;
 	char syncState[PGSR_SYNC_STATE_MAXLENGTH];
 	char currentLSN[PG_LSN_MAXLENGTH];
+	char replayLSN[PG_LSN_MAXLENGTH];
 	PostgresControlData control;
 } PgMetadata;
 
@@ -2513,6 +4447,7 @@ pgsql_get_postgres_metadata(PGSQL *pgsql,
 							bool *pg_is_in_recovery,
 							char *pgsrSyncState,
 							char *currentLSN,
+							char *replayLSN,
 							PostgresControlData *control)
 {
 	PgMetadata context = { 0 };
@@ -2538,7 +4473,11 @@ pgsql_get_postgres_metadata(PGSQL *pgsql,
 		" case when pg_is_in_recovery()"
 		" then (select received_tli from pg_stat_wal_receiver)"
 		" else (select timeline_id from pg_control_checkpoint()) "
-		" end as timeline_id "
+		" end as timeline_id, "
+		" case when pg_is_in_recovery()"
+		" then pg_last_wal_replay_lsn()"
+		" else pg_current_wal_flush_lsn()"
+		" end as replay_lsn "
 		" from (values(1)) as dummy"
 		" full outer join"
 		" (select pg_control_version, catalog_version_no, system_identifier "
@@ -2564,8 +4503,9 @@ pgsql_get_postgres_metadata(PGSQL *pgsql,
 		"as rep on true";
 	/* *INDENT-ON* */
 
-	if (!pgsql_execute_with_params(pgsql, sql, 0, NULL, NULL,
-								   &context, &parsePgMetadata))
+	if (!pgsql_execute_prepared(pgsql, "pgautofailover_metadata",
+								sql, 0, NULL, NULL,
+								&context, &parsePgMetadata))
 	{
 		/* errors have been logged already */
 		return false;
@@ -2579,7 +4519,7 @@ pgsql_get_postgres_metadata(PGSQL *pgsql,
 
 	*pg_is_in_recovery = context.pg_is_in_recovery;
 
-	/* the last two metadata items are opt-in */
+	/* the last metadata items are opt-in */
 	if (pgsrSyncState != NULL)
 	{
 		strlcpy(pgsrSyncState, context.syncState, PGSR_SYNC_STATE_MAXLENGTH);
@@ -2590,11 +4530,14 @@ pgsql_get_postgres_metadata(PGSQL *pgsql,
 		strlcpy(currentLSN, context.currentLSN, PG_LSN_MAXLENGTH);
 	}
 
+	if (replayLSN != NULL)
+	{
+		strlcpy(replayLSN, context.replayLSN, PG_LSN_MAXLENGTH);
+	}
+
 	/* overwrite the Control Data fetched from the query */
 	*control = context.control;
 
-	pgsql_finish(pgsql);
-
 	return true;
 }
 
@@ -2609,9 +4552,9 @@ parsePgMetadata(void *ctx, PGresult *result)
 	PgMetadata *context = (PgMetadata *) ctx;
 	char *value;
 
-	if (PQnfields(result) != 7)
+	if (PQnfields(result) != 8)
 	{
-		log_error("Query returned %d columns, expected 7", PQnfields(result));
+		log_error("Query returned %d columns, expected 8", PQnfields(result));
 		context->parsedOk = false;
 		return;
 	}
@@ -2691,6 +4634,134 @@ parsePgMetadata(void *ctx, PGresult *result)
 		}
 	}
 
+	if (!PQgetisnull(result, 0, 7))
+	{
+		value = PQgetvalue(result, 0, 7);
+
+		strlcpy(context->replayLSN, value, PG_LSN_MAXLENGTH);
+	}
+	else
+	{
+		context->replayLSN[0] = '\0';
+	}
+
+	context->parsedOk = true;
+}
+
+
+typedef struct StandbyLSNsContext
+{
+	char sqlstate[6];
+	bool parsedOk;
+	StandbyLSNs *standbyLSNs;
+} StandbyLSNsContext;
+
+
+/*
+ * pgsql_get_standby_lsns fetches the write, flush, and replay LSN positions
+ * of the standby nodes that are currently using one of our replication slots
+ * from pg_stat_replication, so that the primary can report them to the
+ * monitor. This is fresher than what the standby nodes report themselves.
+ *
+ * The node ids and LSN positions are formatted as Postgres array literals,
+ * ready to be sent to node_active.
+ */
+bool
+pgsql_get_standby_lsns(PGSQL *pgsql, StandbyLSNs *standbyLSNs)
+{
+	StandbyLSNsContext context = { { 0 }, false, standbyLSNs };
+
+	/* *INDENT-OFF* */
+	char *sql =
+		"select count(*),"
+		" coalesce(array_agg(substring(slot_name from '[0-9]+$')::bigint"
+		"                    order by slot_name), '{}'),"
+		" coalesce(array_agg(coalesce(write_lsn, '0/0')"
+		"                    order by slot_name), '{}'),"
+		" coalesce(array_agg(coalesce(flush_lsn, '0/0')"
+		"                    order by slot_name), '{}'),"
+		" coalesce(array_agg(coalesce(replay_lsn, '0/0')"
+		"                    order by slot_name), '{}')"
+		"  from pg_replication_slots slot"
+		"  join pg_stat_replication rep"
+		"    on rep.pid = slot.active_pid"
+		" where slot_name ~ '" REPLICATION_SLOT_NAME_PATTERN "[0-9]+$'";
+	/* *INDENT-ON* */
+
+	if (!pgsql_execute_prepared(pgsql, "pgautofailover_standby_lsns",
+								sql, 0, NULL, NULL,
+								&context, &parseStandbyLSNs))
+	{
+		/* errors have been logged already */
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		log_error("Failed to parse the LSN positions of the standby nodes");
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * parseStandbyLSNs parses the result of the pgsql_get_standby_lsns query: a
+ * count and four arrays, as text.
+ */
+static void
+parseStandbyLSNs(void *ctx, PGresult *result)
+{
+	StandbyLSNsContext *context = (StandbyLSNsContext *) ctx;
+	StandbyLSNs *standbyLSNs = context->standbyLSNs;
+
+	char *arrays[] = {
+		standbyLSNs->nodeIds,
+		standbyLSNs->writeLSNs,
+		standbyLSNs->flushLSNs,
+		standbyLSNs->replayLSNs
+	};
+
+	if (PQnfields(result) != 5)
+	{
+		log_error("Query returned %d columns, expected 5", PQnfields(result));
+		context->parsedOk = false;
+		return;
+	}
+
+	if (PQntuples(result) != 1)
+	{
+		log_error("Query returned %d rows, expected 1", PQntuples(result));
+		context->parsedOk = false;
+		return;
+	}
+
+	char *value = PQgetvalue(result, 0, 0);
+
+	if (!stringToInt(value, &(standbyLSNs->count)))
+	{
+		log_error("Failed to parse standby nodes count \"%s\"", value);
+		context->parsedOk = false;
+		return;
+	}
+
+	for (int i = 0; i < 4; i++)
+	{
+		/* a truncated array literal would not be accepted by the monitor */
+		if (PQgetlength(result, 0, i + 1) >= STANDBY_LSNS_ARRAY_MAXLENGTH)
+		{
+			log_error("Failed to parse the LSN positions of %d standby nodes, "
+					  "the result is too long",
+					  standbyLSNs->count);
+			context->parsedOk = false;
+			return;
+		}
+
+		strlcpy(arrays[i], PQgetvalue(result, 0, i + 1),
+				STANDBY_LSNS_ARRAY_MAXLENGTH);
+	}
+
 	context->parsedOk = true;
 }
 
@@ -2705,43 +4776,72 @@ typedef struct PgReachedTargetLSN
 } PgReachedTargetLSN;
 
 
+/*
+ * The functions that wait for a target LSN to be reached do so on the server
+ * side, in a recursive query that checks the LSN every 10ms, using
+ * pg_sleep(). This way the wait ends within 10ms of the LSN being reached,
+ * without a network round trip per check, and at most after timeoutMs.
+ */
+#define WAIT_FOR_LSN_INTERVAL_MS 10
+
+
+/*
+ * We pick the most advanced LSN reached by the pgautofailover replication
+ * slots, and only consider those that have made it to "sync" or "quorum"
+ * sync_state already.
+ */
+#define SLOT_FLUSH_LSN_QUERY \
+	"   select flush_lsn " \
+	"     from pg_replication_slots slot" \
+	"     join pg_stat_replication rep" \
+	"       on rep.pid = slot.active_pid" \
+	"   where (   slot_name ~ '" REPLICATION_SLOT_NAME_PATTERN "' " \
+	"          or slot_name = '" REPLICATION_SLOT_NAME_DEFAULT "') " \
+	"     and sync_state in ('sync', 'quorum') " \
+	"order by flush_lsn desc limit 1"
+
+
 /*
  * pgsql_one_slot_has_reached_target_lsn checks that at least one replication
  * slot has reached the given LSN already, using the Postgres system views
- * pg_replication_slots and pg_stat_replication on the primary server.
+ * pg_replication_slots and pg_stat_replication on the primary server. When
+ * given a positive timeoutMs, the server waits up to that long for the LSN to
+ * be reached.
  */
 bool
 pgsql_one_slot_has_reached_target_lsn(PGSQL *pgsql,
 									  char *targetLSN,
+									  int timeoutMs,
 									  char *currentLSN,
 									  bool *hasReachedLSN)
 {
 	PgReachedTargetLSN context = { 0 };
 
 	/*
-	 * We pick the most advanced LSN reached by the pgautofailover replication
-	 * slots, and only consider those that have made it to "sync" or "quorum"
-	 * sync_state already. This function is typically called after sync rep has
-	 * been enabled on the primary.
+	 * This function is typically called after sync rep has been enabled on
+	 * the primary.
 	 */
 
 	/* *INDENT-OFF* */
 	char *sql =
-		"   select $1::pg_lsn <= flush_lsn, flush_lsn "
-		"     from pg_replication_slots slot"
-		"     join pg_stat_replication rep"
-		"       on rep.pid = slot.active_pid"
-		"   where (   slot_name ~ '" REPLICATION_SLOT_NAME_PATTERN "' "
-		"          or slot_name = '" REPLICATION_SLOT_NAME_DEFAULT "') "
-		"     and sync_state in ('sync', 'quorum') "
-		"order by flush_lsn desc limit 1";
+		"with recursive wait(n, lsn) as ("
+		" select 0, (" SLOT_FLUSH_LSN_QUERY ")"
+		" union all "
+		" select n + 1, (" SLOT_FLUSH_LSN_QUERY ")"
+		"   from wait, lateral pg_sleep(0.01)"
+		"  where (lsn is null or lsn < $1::pg_lsn) and n < $2"
+		")"
+		" select $1::pg_lsn <= lsn, lsn from wait order by n desc limit 1";
 	/* *INDENT-ON* */
 
-	const Oid paramTypes[1] = { LSNOID };
-	const char *paramValues[1] = { targetLSN };
+	IntString loopsString = intToString(timeoutMs / WAIT_FOR_LSN_INTERVAL_MS);
+
+	const Oid paramTypes[2] = { LSNOID, INT4OID };
+	const char *paramValues[2] = { targetLSN, loopsString.strValue };
 
-	if (!pgsql_execute_with_params(pgsql, sql, 1, paramTypes, paramValues,
-								   &context, &parsePgReachedTargetLSN))
+	if (!pgsql_execute_prepared(pgsql, "pgautofailover_one_slot_reached_lsn",
+								sql, 2, paramTypes, paramValues,
+								&context, &parsePgReachedTargetLSN))
 	{
 		/* errors have been logged already */
 		return false;
@@ -2749,15 +4849,14 @@ pgsql_one_slot_has_reached_target_lsn(PGSQL *pgsql,
 
 	if (!context.parsedOk)
 	{
-		if (context.noRows)
-		{
-			log_warn("No standby nodes are connected at the moment");
-		}
-		else
-		{
-			log_error("Failed to fetch current flush_lsn location for "
-					  "connected standby nodes, see above for details");
-		}
+		log_error("Failed to fetch current flush_lsn location for "
+				  "connected standby nodes, see above for details");
+		return false;
+	}
+
+	if (IS_EMPTY_STRING_BUFFER(context.currentLSN))
+	{
+		log_warn("No standby nodes are connected at the moment");
 		return false;
 	}
 
@@ -2770,22 +4869,37 @@ pgsql_one_slot_has_reached_target_lsn(PGSQL *pgsql,
 
 /*
  * pgsql_has_reached_target_lsn calls pg_last_wal_replay_lsn() and compares the
- * current LSN on the system to the given targetLSN.
+ * current LSN on the system to the given targetLSN. When given a positive
+ * timeoutMs, the server waits up to that long for the LSN to be reached.
  */
 bool
-pgsql_has_reached_target_lsn(PGSQL *pgsql, char *targetLSN,
+pgsql_has_reached_target_lsn(PGSQL *pgsql, char *targetLSN, int timeoutMs,
 							 char *currentLSN, bool *hasReachedLSN)
 {
 	PgReachedTargetLSN context = { 0 };
+
+	/* *INDENT-OFF* */
 	char *sql =
-		"SELECT $1::pg_lsn <= pg_last_wal_replay_lsn(), "
-		" pg_last_wal_replay_lsn()";
+		"with recursive wait(n, reached, lsn) as ("
+		" select 0, $1::pg_lsn <= pg_last_wal_replay_lsn(), "
+		"        pg_last_wal_replay_lsn()"
+		" union all "
+		" select n + 1, $1::pg_lsn <= pg_last_wal_replay_lsn(), "
+		"        pg_last_wal_replay_lsn()"
+		"   from wait, lateral pg_sleep(0.01)"
+		"  where not reached and n < $2"
+		")"
+		" select reached, lsn from wait order by n desc limit 1";
+	/* *INDENT-ON* */
+
+	IntString loopsString = intToString(timeoutMs / WAIT_FOR_LSN_INTERVAL_MS);
 
-	const Oid paramTypes[1] = { LSNOID };
-	const char *paramValues[1] = { targetLSN };
+	const Oid paramTypes[2] = { LSNOID, INT4OID };
+	const char *paramValues[2] = { targetLSN, loopsString.strValue };
 
-	if (!pgsql_execute_with_params(pgsql, sql, 1, paramTypes, paramValues,
-								   &context, &parsePgReachedTargetLSN))
+	if (!pgsql_execute_prepared(pgsql, "pgautofailover_reached_lsn",
+								sql, 2, paramTypes, paramValues,
+								&context, &parsePgReachedTargetLSN))
 	{
 		/* errors have been logged already */
 		return false;
@@ -2804,6 +4918,69 @@ pgsql_has_reached_target_lsn(PGSQL *pgsql, char *targetLSN,
 }
 
 
+/*
+ * pgsql_create_lsn_token_functions creates or upgrades the functions that
+ * applications use to read their own writes from a standby node, in the
+ * pgautofailover schema of the database:
+ *
+ *  - pgautofailover.lsn_token() returns an LSN that covers the transactions
+ *    committed so far, to be called on the primary after writing. That's the
+ *    current WAL insert location, so that asynchronous commits are covered
+ *    too;
+ *
+ *  - pgautofailover.wait_for_lsn(token, timeout_ms) waits until the node has
+ *    replayed the given token, and returns false when the timeout is reached
+ *    first. On the primary, the token is always reached already.
+ *
+ * The wait uses the same server-side loop as pgsql_has_reached_target_lsn(),
+ * checking the LSN every WAIT_FOR_LSN_INTERVAL_MS. The functions are created
+ * on the primary node, and standby nodes get them from there. The script
+ * commits locally, so that it doesn't wait for a synchronous standby that
+ * might not be available.
+ */
+bool
+pgsql_create_lsn_token_functions(PGSQL *pgsql)
+{
+	/* *INDENT-OFF* */
+	const char *script =
+		"BEGIN; "
+		"SET LOCAL synchronous_commit TO local; "
+		"CREATE SCHEMA IF NOT EXISTS pgautofailover; "
+		"GRANT USAGE ON SCHEMA pgautofailover TO public; "
+		"CREATE OR REPLACE FUNCTION pgautofailover.lsn_token() "
+		"RETURNS pg_lsn LANGUAGE sql VOLATILE "
+		"AS $$ "
+		" select case when pg_catalog.pg_is_in_recovery() "
+		"             then pg_catalog.pg_last_wal_replay_lsn() "
+		"             else pg_catalog.pg_current_wal_insert_lsn() "
+		"         end "
+		"$$; "
+		"CREATE OR REPLACE FUNCTION pgautofailover.wait_for_lsn"
+		"(token pg_lsn, timeout_ms int DEFAULT 1000) "
+		"RETURNS bool LANGUAGE sql VOLATILE STRICT "
+		"AS $$ "
+		" with recursive wait(n, reached) as ("
+		"  select 0, token <= pgautofailover.lsn_token() "
+		"  union all "
+		"  select n + 1, token <= pgautofailover.lsn_token() "
+		"    from wait, lateral pg_catalog.pg_sleep(0.01) "
+		"   where not reached and n < timeout_ms / 10"
+		" )"
+		" select reached from wait order by n desc limit 1 "
+		"$$; "
+		"COMMIT";
+	/* *INDENT-ON* */
+
+	if (!pgsql_execute(pgsql, script))
+	{
+		/* errors have been logged already */
+		return false;
+	}
+
+	return true;
+}
+
+
 /*
  * parsePgMetadata parses the result from a PostgreSQL query fetching
  * two columns from pg_stat_replication: sync_state and currentLSN.
@@ -2916,8 +5093,22 @@ pgsql_identify_system(PGSQL *pgsql, IdentifySystem *system)
 		return false;
 	}
 
-	/* while at it, we also run the TIMELINE_HISTORY command */
-	if (system->timeline > 1)
+	/*
+	 * While at it, we also run the TIMELINE_HISTORY command, unless we
+	 * already have the history of that timeline: it never changes.
+	 */
+	if (system->timeline <= 1)
+	{
+		system->timelines.count = 0;
+	}
+	else if (system->timelines.count > 0 &&
+			 system->timelines.identifier == system->identifier &&
+			 system->timelines.timeline == system->timeline)
+	{
+		log_debug("TIMELINE_HISTORY: using the cached history of timeline %d",
+				  system->timeline);
+	}
+	else
 	{
 		TimelineHistoryResult hContext = { 0 };
 
@@ -2952,7 +5143,8 @@ pgsql_identify_system(PGSQL *pgsql, IdentifySystem *system)
 
 		if (!parseTimeLineHistory(hContext.filename, hContext.content, system))
 		{
-			/* errors have already been logged */
+			/* errors have already been logged, don't keep a partial history */
+			system->timelines.count = 0;
 			PQfinish(connection);
 			return false;
 		}
@@ -3108,6 +5300,8 @@ parseTimeLineHistory(const char *filename, const char *content,
 
 	uint64_t prevend = InvalidXLogRecPtr;
 
+	system->timelines.identifier = system->identifier;
+	system->timelines.timeline = system->timeline;
 	system->timelines.count = 0;
 
 	TimeLineHistoryEntry *entry =
@@ -3220,9 +5414,12 @@ pgsql_listen(PGSQL *pgsql, char *channels[])
 
 	/*
 	 * mark the connection as multi statement since it is going to be used by
-	 * for processing notifications
+	 * for processing notifications, unless it is kept open already
 	 */
-	pgsql->connectionStatementType = PGSQL_CONNECTION_MULTI_STATEMENT;
+	if (pgsql->connectionStatementType != PGSQL_CONNECTION_PERSISTENT)
+	{
+		pgsql->connectionStatementType = PGSQL_CONNECTION_MULTI_STATEMENT;
+	}
 
 	/* open a connection upfront since it is needed by PQescape functions */
 	PGconn *connection = pgsql_open_connection(pgsql);
@@ -3281,9 +5478,12 @@ pgsql_prepare_to_wait(PGSQL *pgsql)
 {
 	/*
 	 * mark the connection as multi statement since it is going to be used by
-	 * for processing notifications
+	 * for processing notifications, unless it is kept open already
 	 */
-	pgsql->connectionStatementType = PGSQL_CONNECTION_MULTI_STATEMENT;
+	if (pgsql->connectionStatementType != PGSQL_CONNECTION_PERSISTENT)
+	{
+		pgsql->connectionStatementType = PGSQL_CONNECTION_MULTI_STATEMENT;
+	}
 
 	/* open a connection upfront since it is needed by PQescape functions */
 	PGconn *connection = pgsql_open_connection(pgsql);
@@ -32,10 +32,19 @@
  */
 #define BOOLOID 16
 #define NAMEOID 19
+#define INT2OID 21
 #define INT4OID 23
 #define INT8OID 20
 #define TEXTOID 25
+#define OIDOID 26
+#define JSONOID 114
+#define FLOAT4OID 700
+#define FLOAT8OID 701
+#define TIMESTAMPOID 1114
+#define TIMESTAMPTZOID 1184
+#define NUMERICOID 1700
 #define LSNOID 3220
+#define JSONBOID 3802
 
 /*
  * Maximum connection info length as used in walreceiver.h
@@ -49,13 +58,6 @@
  */
 #define PGSR_SYNC_STATE_MAXLENGTH 10
 
-/*
- * We receive a list of "other nodes" from the monitor, and we store that list
- * in local memory. We pre-allocate the memory storage, and limit how many node
- * addresses we can handle because of the pre-allocation strategy.
- */
-#define NODE_ARRAY_MAX_COUNT 128
-
 
 /* abstract representation of a Postgres server that we can connect to */
 typedef enum
@@ -111,11 +113,17 @@ typedef struct ConnectionRetryPolicy
  *
  * A common use case for maintaining a connection open, is while wishing to open
  * and maintain a transaction block. Another, is while listening for events.
+ *
+ * A persistent connection is kept open between queries outside of any
+ * transaction block, and is transparently opened again when it's been lost.
+ * The keeper main loop uses that for its local Postgres queries, together
+ * with prepared statements.
  */
 typedef enum
 {
 	PGSQL_CONNECTION_SINGLE_STATEMENT = 0,
-	PGSQL_CONNECTION_MULTI_STATEMENT
+	PGSQL_CONNECTION_MULTI_STATEMENT,
+	PGSQL_CONNECTION_PERSISTENT
 } ConnectionStatementType;
 
 /*
@@ -133,6 +141,9 @@ typedef enum
 	PG_CONNECTION_BAD
 } PGConnStatus;
 
+/* we only prepare a handful of statements on persistent connections */
+#define PGSQL_MAX_PREPARED_STATEMENTS 16
+
 /* notification processing */
 typedef bool (*ProcessNotificationFunction)(int notificationGroupId,
 											int64_t notificationNodeId,
@@ -151,6 +162,22 @@ typedef struct PGSQL
 	int notificationGroupId;
 	int64_t notificationNodeId;
 	bool notificationReceived;
+
+	/* names of the statements prepared on the current connection */
+	char preparedStatements[PGSQL_MAX_PREPARED_STATEMENTS][NAMEDATALEN];
+	int preparedStatementCount;
+
+	/* connection started by pgsql_start_connection, not complete yet */
+	PGconn *pendingConnection;
+	PostgresPollingStatusType pendingPollingStatus;
+
+	/* deadline of each query in milliseconds, 0 (zero) waits forever */
+	int statementTimeoutMs;
+	int connectionStatementTimeoutMs;   /* statement_timeout of the session */
+
+	/* how long queries wait for a lock, 0 (zero) waits as long as needed */
+	int lockTimeoutMs;
+	int connectionLockTimeoutMs;        /* lock_timeout of the session */
 } PGSQL;
 
 
@@ -173,12 +200,32 @@ typedef struct NodeAddress
 	bool isPrimary;
 } NodeAddress;
 
+/*
+ * We receive a list of "other nodes" from the monitor, and we store that list
+ * in local memory. The nodes are allocated on the heap and the array grows as
+ * needed, see nodeAddressArrayReserve() and nodeAddressArrayFree().
+ */
 typedef struct NodeAddressArray
 {
 	int count;
-	NodeAddress nodes[NODE_ARRAY_MAX_COUNT];
+	int capacity;
+	NodeAddress *nodes;
 } NodeAddressArray;
 
+/*
+ * A connection string may list several hosts, as in postgres://a:5432,b:5432/
+ * where libpq tries each of them in turn. The monitor URI uses that to point
+ * to a primary monitor and its standby monitors.
+ */
+#define URI_MAX_HOSTS 8
+
+typedef struct URIHostArray
+{
+	int count;
+	char hosts[URI_MAX_HOSTS][_POSIX_HOST_NAME_MAX];
+	int ports[URI_MAX_HOSTS];
+} URIHostArray;
+
 
 /*
  * TimeLineHistoryEntry is taken from Postgres definitions and adapted to
@@ -203,8 +250,15 @@ typedef struct TimeLineHistoryEntry
 } TimeLineHistoryEntry;
 
 
+/*
+ * The TimeLineHistory also registers the system identifier and timeline that
+ * the history belongs to, so that we fetch it again only when that changes:
+ * the history of a given timeline never changes.
+ */
 typedef struct TimeLineHistory
 {
+	uint64_t identifier;
+	uint32_t timeline;
 	int count;
 	TimeLineHistoryEntry history[PG_AUTOCTL_MAX_TIMELINES];
 } TimeLineHistory;
@@ -237,6 +291,13 @@ typedef struct ReplicationSource
 	char slotName[MAXCONNINFO];
 	char password[MAXCONNINFO];
 	char maximumBackupRate[MAXIMUM_BACKUP_RATE_LEN];
+	char backupCompression[NAMEDATALEN];
+	char incrementalBaseDir[MAXPGPATH];
+	char cloneCommand[MAXCONNINFO];
+	int cloneJobs;
+	char backupProgressFile[MAXPGPATH];
+	char timelinesFile[MAXPGPATH];
+	char restoreCommand[MAXCONNINFO];
 	char backupDir[MAXCONNINFO];
 	char applicationName[MAXCONNINFO];
 	char targetLSN[PG_LSN_MAXLENGTH];
@@ -256,6 +317,22 @@ typedef struct ReplicationSource
 /* callback for parsing query results */
 typedef void (ParsePostgresResultCB)(void *context, PGresult *result);
 
+/*
+ * A query to send in a pipeline with pgsql_execute_pipeline, with the same
+ * arguments as pgsql_execute_with_params. The success field is set once the
+ * results have been read.
+ */
+typedef struct PGSQLQuery
+{
+	const char *sql;
+	int paramCount;
+	const Oid *paramTypes;
+	const char **paramValues;
+	void *context;
+	ParsePostgresResultCB *parseFun;
+	bool success;
+} PGSQLQuery;
+
 typedef enum
 {
 	PGSQL_RESULT_BOOL = 1,
@@ -278,6 +355,81 @@ typedef struct AbstractResultContext
 	char sqlstate[SQLSTATE_LENGTH];
 } AbstractResultContext;
 
+/*
+ * PostgresHealthSignals are cheap local measurements that show a slow primary
+ * before it stops answering: the latency of a canary statement, the latency
+ * of a local WAL flush, and the cumulative time spent by the checkpointer in
+ * fsync calls, all in milliseconds.
+ */
+typedef struct PostgresHealthSignals
+{
+	double canaryMs;
+	double walFlushMs;
+	uint64_t checkpointSyncTime;
+} PostgresHealthSignals;
+
+
+/*
+ * PostgresLoad is the part of the load of a standby node that Postgres
+ * knows about: the count of client connections running a query, and the WAL
+ * bytes received and not replayed yet.
+ */
+typedef struct PostgresLoad
+{
+	int activeConnections;
+	int64_t replayLag;
+} PostgresLoad;
+
+
+/*
+ * ReplicationSlotRetention is the WAL that the replication slot of another
+ * node retains on the local Postgres instance, in bytes.
+ */
+#define REPLICATION_SLOT_RETENTION_MAX_COUNT 32
+
+typedef struct ReplicationSlotRetention
+{
+	int64_t nodeId;
+	int64_t retainedBytes;
+	bool active;
+} ReplicationSlotRetention;
+
+typedef struct ReplicationSlotRetentionArray
+{
+	int count;
+	ReplicationSlotRetention slots[REPLICATION_SLOT_RETENTION_MAX_COUNT];
+} ReplicationSlotRetentionArray;
+
+
+/*
+ * StandbyLSNs are the positions of the standby nodes as seen by the primary
+ * in pg_stat_replication, as Postgres array literals with one entry per
+ * standby node, in the same order in every array.
+ */
+#define STANDBY_LSNS_ARRAY_MAXLENGTH BUFSIZE
+
+typedef struct StandbyLSNs
+{
+	int count;
+	char nodeIds[STANDBY_LSNS_ARRAY_MAXLENGTH];
+	char writeLSNs[STANDBY_LSNS_ARRAY_MAXLENGTH];
+	char flushLSNs[STANDBY_LSNS_ARRAY_MAXLENGTH];
+	char replayLSNs[STANDBY_LSNS_ARRAY_MAXLENGTH];
+} StandbyLSNs;
+
+
+/*
+ * The contents of the backup_label and tablespace_map files that a copy of
+ * a data directory made during a non-exclusive backup needs.
+ */
+typedef struct BackupLabel
+{
+	char labelFile[BUFSIZE];
+	char spcmapFile[BUFSIZE];
+	char stopLSN[PG_LSN_MAXLENGTH];
+} BackupLabel;
+
+
 /* data structure for keeping a single-value query result */
 typedef struct SingleValueResultContext
 {
@@ -331,7 +483,10 @@ void pgsql_set_monitor_interactive_retry_policy(ConnectionRetryPolicy *retryPoli
 int pgsql_compute_connection_retry_sleep_time(ConnectionRetryPolicy *retryPolicy);
 bool pgsql_retry_policy_expired(ConnectionRetryPolicy *retryPolicy);
 
+void pgsql_set_application_name(const char *applicationName);
 void pgsql_finish(PGSQL *pgsql);
+bool pgsql_start_connection(PGSQL *pgsql);
+void pgsql_continue_connection(PGSQL *pgsql);
 void parseSingleValueResult(void *ctx, PGresult *result);
 void fetchedRows(void *ctx, PGresult *result);
 bool pgsql_begin(PGSQL *pgsql);
@@ -341,10 +496,18 @@ bool pgsql_execute(PGSQL *pgsql, const char *sql);
 bool pgsql_execute_with_params(PGSQL *pgsql, const char *sql, int paramCount,
 							   const Oid *paramTypes, const char **paramValues,
 							   void *parseContext, ParsePostgresResultCB *parseFun);
+bool pgsql_execute_prepared(PGSQL *pgsql, const char *stmtName,
+							const char *sql, int paramCount,
+							const Oid *paramTypes, const char **paramValues,
+							void *parseContext, ParsePostgresResultCB *parseFun);
+bool pgsql_execute_pipeline(PGSQL *pgsql, PGSQLQuery *queries, int queryCount);
 bool pgsql_check_postgresql_settings(PGSQL *pgsql, bool isCitusInstanceKind,
 									 bool *settings_are_ok);
 bool pgsql_check_monitor_settings(PGSQL *pgsql, bool *settings_are_ok);
 bool pgsql_is_in_recovery(PGSQL *pgsql, bool *is_in_recovery);
+bool pgsql_promote(PGSQL *pgsql);
+bool pgsql_count_active_queries(PGSQL *pgsql, int *activeCount);
+bool pgsql_get_settings_hash(PGSQL *pgsql, char *hash, size_t size);
 bool pgsql_reload_conf(PGSQL *pgsql);
 bool pgsql_replication_slot_exists(PGSQL *pgsql, const char *slotName,
 								   bool *slotExists);
@@ -354,12 +517,26 @@ bool postgres_sprintf_replicationSlotName(int64_t nodeId, char *slotName, int si
 bool pgsql_set_synchronous_standby_names(PGSQL *pgsql,
 										 char *synchronous_standby_names);
 bool pgsql_replication_slot_create_and_drop(PGSQL *pgsql,
-											NodeAddressArray *nodeArray);
+											NodeAddressArray *nodeArray,
+											int *createdCount);
 bool pgsql_replication_slot_maintain(PGSQL *pgsql, NodeAddressArray *nodeArray);
+bool pgsql_replication_slot_retention(PGSQL *pgsql,
+									  ReplicationSlotRetentionArray *slotsArray);
 bool pgsql_disable_synchronous_replication(PGSQL *pgsql);
 bool pgsql_set_default_transaction_mode_read_only(PGSQL *pgsql);
 bool pgsql_set_default_transaction_mode_read_write(PGSQL *pgsql);
+bool pgsql_set_checkpoint_settings(PGSQL *pgsql,
+								   uint64_t maxWalSizeMB,
+								   int checkpointTimeout);
+bool pgsql_reset_checkpoint_settings(PGSQL *pgsql);
+bool pgsql_set_wal_compression(PGSQL *pgsql, const char *method);
+bool pgsql_reset_wal_compression(PGSQL *pgsql);
 bool pgsql_checkpoint(PGSQL *pgsql);
+bool pgsql_spread_checkpoint(PGSQL *pgsql, bool fast);
+bool pgsql_get_redo_distance(PGSQL *pgsql, uint64_t *redoBytes);
+bool pgsql_measure_health_signals(PGSQL *pgsql, uint32_t pg_control_version,
+								  PostgresHealthSignals *signals);
+bool pgsql_measure_load(PGSQL *pgsql, PostgresLoad *load);
 bool pgsql_get_hba_file_path(PGSQL *pgsql, char *hbaFilePath, int maxPathLength);
 bool pgsql_create_database(PGSQL *pgsql, const char *dbname, const char *owner);
 bool pgsql_create_extension(PGSQL *pgsql, const char *name);
@@ -369,19 +546,31 @@ bool pgsql_create_user(PGSQL *pgsql, const char *userName, const char *password,
 bool pgsql_has_replica(PGSQL *pgsql, char *userName, bool *hasReplica);
 bool hostname_from_uri(const char *pguri,
 					   char *hostname, int maxHostLength, int *port);
+bool hostnames_from_uri(const char *pguri, URIHostArray *hostArray);
+bool pgsql_backup_start(PGSQL *pgsql, const char *label, int *serverVersionNum);
+bool pgsql_backup_stop(PGSQL *pgsql, int serverVersionNum,
+					   BackupLabel *backupLabel);
+bool pgsql_read_binary_file(PGSQL *pgsql, const char *path, uint64_t offset,
+							char *buffer, int size,
+							int *bytesRead, bool *missing);
 bool validate_connection_string(const char *connectionString);
 bool pgsql_reset_primary_conninfo(PGSQL *pgsql);
 
 bool pgsql_get_postgres_metadata(PGSQL *pgsql,
 								 bool *pg_is_in_recovery,
 								 char *pgsrSyncState, char *currentLSN,
+								 char *replayLSN,
 								 PostgresControlData *control);
 
+bool pgsql_get_standby_lsns(PGSQL *pgsql, StandbyLSNs *standbyLSNs);
+
 bool pgsql_one_slot_has_reached_target_lsn(PGSQL *pgsql,
 										   char *targetLSN,
+										   int timeoutMs,
 										   char *currentLSN,
 										   bool *hasReachedLSN);
-bool pgsql_has_reached_target_lsn(PGSQL *pgsql, char *targetLSN,
+bool pgsql_create_lsn_token_functions(PGSQL *pgsql);
+bool pgsql_has_reached_target_lsn(PGSQL *pgsql, char *targetLSN, int timeoutMs,
 								  char *currentLSN, bool *hasReachedLSN);
 bool pgsql_identify_system(PGSQL *pgsql, IdentifySystem *system);
 bool pgsql_listen(PGSQL *pgsql, char *channels[]);
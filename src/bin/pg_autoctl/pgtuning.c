@@ -14,6 +14,7 @@
 #include "env_utils.h"
 #include "file_utils.h"
 #include "log.h"
+#include "parsing.h"
 #include "pgctl.h"
 #include "pgtuning.h"
 #include "system_utils.h"
@@ -26,6 +27,10 @@
  * Dynamic code is then used on the target systems to compute better values
  * dynamically for some parameters: work_mem, maintenance_work_mem,
  * effective_cache_size, autovacuum_max_workers.
+ *
+ * When a tuning profile (oltp, olap, mixed) has been given, we also compute
+ * WAL, checkpoint, I/O and parallel query settings, see
+ * pgtuning_compute_profile_settings.
  */
 GUC postgres_tuning[] = {
 	{ "track_functions", "pl" },
@@ -47,12 +52,27 @@ typedef struct DynamicTuning
 	uint64_t work_mem;
 	uint64_t maintenance_work_mem;
 	uint64_t effective_cache_size;
+
+	/* only computed when a tuning profile has been given */
+	PgTuningProfile profile;
+	bool huge_pages;
+	uint64_t max_wal_size;
+	int checkpoint_timeout;             /* in minutes */
+	int effective_io_concurrency;       /* 0 when the storage is unknown */
+	int max_worker_processes;
+	int max_parallel_workers;
+	int max_parallel_workers_per_gather;
+	int max_parallel_maintenance_workers;   /* 0 before Postgres 11 */
 } DynamicTuning;
 
 
 static bool pgtuning_compute_mem_settings(SystemInfo *sysInfo,
 										  DynamicTuning *tuning);
 
+static void pgtuning_compute_profile_settings(SystemInfo *sysInfo,
+											  PostgresSetup *pgSetup,
+											  DynamicTuning *tuning);
+
 void pgtuning_log_settings(DynamicTuning *tuning, int logLevel);
 
 static int pgtuning_compute_max_workers(SystemInfo *sysInfo);
@@ -63,10 +83,13 @@ static bool pgtuning_edit_guc_settings(GUC *settings, DynamicTuning *tuning,
 
 /*
  * pgtuning_prepare_guc_settings probes the system information (nCPU and total
- * RAM) and computes some better defaults for Postgres.
+ * RAM) and computes some better defaults for Postgres. When pgSetup has a
+ * tuning profile, we also probe the storage that holds PGDATA, the NUMA
+ * topology and the huge pages available.
  */
 bool
-pgtuning_prepare_guc_settings(GUC *settings, char *config, size_t size)
+pgtuning_prepare_guc_settings(GUC *settings, PostgresSetup *pgSetup,
+							  char *config, size_t size)
 {
 	SystemInfo sysInfo = { 0 };
 	DynamicTuning tuning = { 0 };
@@ -99,6 +122,29 @@ pgtuning_prepare_guc_settings(GUC *settings, char *config, size_t size)
 			return false;
 		}
 
+		if (pgSetup != NULL)
+		{
+			tuning.profile =
+				pgsetup_parse_tuning_profile(pgSetup->tuningProfile);
+		}
+
+		if (tuning.profile != PG_TUNING_PROFILE_UNKNOWN)
+		{
+			if (!IS_EMPTY_STRING_BUFFER(pgSetup->pgdata))
+			{
+				(void) get_storage_info(pgSetup->pgdata, &sysInfo);
+			}
+
+			log_debug("Detected %s storage for \"%s\", %d NUMA nodes, "
+					  "and %llu huge pages",
+					  storage_kind_to_string(sysInfo.storage),
+					  pgSetup->pgdata,
+					  sysInfo.numaNodes,
+					  (unsigned long long) sysInfo.hugePagesTotal);
+
+			(void) pgtuning_compute_profile_settings(&sysInfo, pgSetup, &tuning);
+		}
+
 		(void) pgtuning_log_settings(&tuning, LOG_DEBUG);
 	}
 
@@ -106,6 +152,90 @@ pgtuning_prepare_guc_settings(GUC *settings, char *config, size_t size)
 }
 
 
+/*
+ * pgtuning_prepare_standby_settings computes the settings that make WAL
+ * replay faster on a standby, from the storage that holds PGDATA.
+ *
+ * Replay is single-threaded, and only the prefetching of the blocks that the
+ * upcoming WAL records reference can keep fast storage busy. Prefetching
+ * appeared in Postgres 15, and uses up to maintenance_io_concurrency
+ * concurrent I/Os, looking ahead in WAL by up to wal_decode_buffer_size. On
+ * rotational or unknown storage we keep the Postgres defaults.
+ */
+void
+pgtuning_prepare_standby_settings(const char *pgdata, const char *pg_ctl,
+								  StandbyTuning *tuning)
+{
+	PostgresSetup pgSetup = { 0 };
+	SystemInfo sysInfo = { 0 };
+	int pg_version = 0;
+
+	*tuning = (StandbyTuning) {
+		0
+	};
+
+	/* as in pgtuning_prepare_guc_settings, not when running the unit tests */
+	if (env_exists(PG_AUTOCTL_DEBUG) && env_exists("PG_REGRESS_SOCK_DIR"))
+	{
+		return;
+	}
+
+	if (pg_ctl == NULL)
+	{
+		return;
+	}
+
+	strlcpy(pgSetup.pg_ctl, pg_ctl, sizeof(pgSetup.pg_ctl));
+
+	if (IS_EMPTY_STRING_BUFFER(pgSetup.pg_ctl) ||
+		!pg_ctl_version(&pgSetup) ||
+		!parse_pg_version_string(pgSetup.pg_version, &pg_version) ||
+		pg_version < 1500)
+	{
+		return;
+	}
+
+	if (!get_storage_info(pgdata, &sysInfo))
+	{
+		return;
+	}
+
+	switch (sysInfo.storage)
+	{
+		case STORAGE_KIND_SSD:
+		{
+			strlcpy(tuning->maintenance_io_concurrency, "200", NAMEDATALEN);
+			strlcpy(tuning->wal_decode_buffer_size, "'2MB'", NAMEDATALEN);
+			break;
+		}
+
+		case STORAGE_KIND_NVME:
+		{
+			strlcpy(tuning->maintenance_io_concurrency, "256", NAMEDATALEN);
+			strlcpy(tuning->wal_decode_buffer_size, "'4MB'", NAMEDATALEN);
+			break;
+		}
+
+		case STORAGE_KIND_HDD:
+		case STORAGE_KIND_UNKNOWN:
+		{
+			return;
+		}
+	}
+
+	/* try is the default, and does not fail where posix_fadvise is missing */
+	strlcpy(tuning->recovery_prefetch, "'try'", NAMEDATALEN);
+
+	log_debug("Detected %s storage for \"%s\", setting "
+			  "maintenance_io_concurrency to %s and "
+			  "wal_decode_buffer_size to %s on the standby",
+			  storage_kind_to_string(sysInfo.storage),
+			  pgdata,
+			  tuning->maintenance_io_concurrency,
+			  tuning->wal_decode_buffer_size);
+}
+
+
 /*
  * pgtuning_compute_max_workers returns how many autovacuum max workers we can
  * setup on the local system, depending on its number of CPUs.
@@ -212,6 +342,163 @@ pgtuning_compute_mem_settings(SystemInfo *sysInfo, DynamicTuning *tuning)
 }
 
 
+/*
+ * pgtuning_compute_profile_settings computes the settings that depend on the
+ * workload the user told us to expect, on top of the memory settings that
+ * have already been computed.
+ *
+ * The WAL and checkpoint settings bound the crash recovery time, which is
+ * also the time it takes to restart a primary in place rather than failover:
+ * OLTP gets frequent checkpoints, OLAP bulk loads get more WAL between
+ * checkpoints.
+ */
+static void
+pgtuning_compute_profile_settings(SystemInfo *sysInfo,
+								  PostgresSetup *pgSetup,
+								  DynamicTuning *tuning)
+{
+	uint64_t oneGB = ((uint64_t) 1) << 30;
+	int pg_version = 0;
+
+	/* we need enough reserved huge pages for the whole shared_buffers */
+	tuning->huge_pages =
+		sysInfo->hugePagesTotal * sysInfo->hugePageSize >
+		tuning->shared_buffers;
+
+	if (sysInfo->totalram <= (8 * oneGB))
+	{
+		tuning->max_wal_size = 2 * oneGB;
+	}
+	else if (sysInfo->totalram <= (64 * oneGB))
+	{
+		tuning->max_wal_size = 8 * oneGB;
+	}
+	else if (sysInfo->totalram <= (256 * oneGB))
+	{
+		tuning->max_wal_size = 16 * oneGB;
+	}
+	else
+	{
+		tuning->max_wal_size = 32 * oneGB;
+	}
+
+	/* replaying WAL from a rotational disk is slow, keep less of it */
+	if (sysInfo->storage == STORAGE_KIND_HDD)
+	{
+		tuning->max_wal_size /= 2;
+	}
+
+	/*
+	 * effective_io_concurrency is only supported where posix_fadvise is,
+	 * which is also where we know how to probe the storage (Linux).
+	 */
+	switch (sysInfo->storage)
+	{
+		case STORAGE_KIND_HDD:
+		{
+			tuning->effective_io_concurrency = 2;
+			break;
+		}
+
+		case STORAGE_KIND_SSD:
+		{
+			tuning->effective_io_concurrency = 200;
+			break;
+		}
+
+		case STORAGE_KIND_NVME:
+		{
+			tuning->effective_io_concurrency = 256;
+			break;
+		}
+
+		case STORAGE_KIND_UNKNOWN:
+		{
+			tuning->effective_io_concurrency = 0;
+			break;
+		}
+	}
+
+	/*
+	 * A parallel query is better kept on a single NUMA node, so that its
+	 * workers share the same local memory.
+	 */
+	int ncpu = sysInfo->ncpu > 0 ? sysInfo->ncpu : 1;
+	int cpuPerNode =
+		sysInfo->numaNodes > 1 ? ncpu / sysInfo->numaNodes : ncpu;
+
+	switch (tuning->profile)
+	{
+		case PG_TUNING_PROFILE_OLTP:
+		{
+			tuning->checkpoint_timeout = 10;
+			tuning->max_parallel_workers = ncpu / 4;
+			tuning->max_parallel_workers_per_gather = 2;
+			tuning->max_parallel_maintenance_workers = 2;
+			break;
+		}
+
+		case PG_TUNING_PROFILE_OLAP:
+		{
+			tuning->checkpoint_timeout = 30;
+			tuning->max_wal_size *= 2;
+			tuning->work_mem *= 4;
+			tuning->max_parallel_workers = ncpu;
+			tuning->max_parallel_workers_per_gather = ncpu / 2;
+			tuning->max_parallel_maintenance_workers = ncpu / 4;
+			break;
+		}
+
+		case PG_TUNING_PROFILE_MIXED:
+		case PG_TUNING_PROFILE_UNKNOWN:
+		{
+			tuning->checkpoint_timeout = 15;
+			tuning->max_parallel_workers = ncpu / 2;
+			tuning->max_parallel_workers_per_gather = ncpu / 4;
+			tuning->max_parallel_maintenance_workers = 2;
+			break;
+		}
+	}
+
+	if (tuning->max_parallel_workers_per_gather > cpuPerNode / 2)
+	{
+		tuning->max_parallel_workers_per_gather = cpuPerNode / 2;
+	}
+
+	if (tuning->max_parallel_workers_per_gather < 2)
+	{
+		tuning->max_parallel_workers_per_gather = 2;
+	}
+
+	if (tuning->max_parallel_maintenance_workers >
+		tuning->max_parallel_workers_per_gather)
+	{
+		tuning->max_parallel_maintenance_workers =
+			tuning->max_parallel_workers_per_gather;
+	}
+
+	if (tuning->max_parallel_workers < tuning->max_parallel_workers_per_gather)
+	{
+		tuning->max_parallel_workers = tuning->max_parallel_workers_per_gather;
+	}
+
+	/* keep the Postgres default of 8 as a minimum */
+	tuning->max_worker_processes = tuning->max_parallel_workers + 4;
+
+	if (tuning->max_worker_processes < 8)
+	{
+		tuning->max_worker_processes = 8;
+	}
+
+	/* max_parallel_maintenance_workers appeared in Postgres 11 */
+	if (!parse_pg_version_string(pgSetup->pg_version, &pg_version) ||
+		pg_version < 1100)
+	{
+		tuning->max_parallel_maintenance_workers = 0;
+	}
+}
+
+
 /*
  * pgtuning_log_mem_settings logs the memory settings we computed.
  */
@@ -237,6 +524,33 @@ pgtuning_log_settings(DynamicTuning *tuning, int logLevel)
 	(void) pretty_print_bytes(buf, sizeof(buf),
 							  tuning->effective_cache_size);
 	log_level(logLevel, "Setting effective_cache_size to %s", buf);
+
+	if (tuning->profile == PG_TUNING_PROFILE_UNKNOWN)
+	{
+		return;
+	}
+
+	log_level(logLevel, "Setting huge_pages to %s",
+			  tuning->huge_pages ? "try" : "off");
+
+	(void) pretty_print_bytes(buf, sizeof(buf), tuning->max_wal_size);
+	log_level(logLevel, "Setting max_wal_size to %s", buf);
+
+	log_level(logLevel, "Setting checkpoint_timeout to %dmin",
+			  tuning->checkpoint_timeout);
+
+	if (tuning->effective_io_concurrency > 0)
+	{
+		log_level(logLevel, "Setting effective_io_concurrency to %d",
+				  tuning->effective_io_concurrency);
+	}
+
+	log_level(logLevel, "Setting max_worker_processes to %d, "
+						"max_parallel_workers to %d, "
+						"max_parallel_workers_per_gather to %d",
+			  tuning->max_worker_processes,
+			  tuning->max_parallel_workers,
+			  tuning->max_parallel_workers_per_gather);
 }
 
 
@@ -363,6 +677,47 @@ pgtuning_edit_guc_settings(GUC *settings, DynamicTuning *tuning,
 		}
 	}
 
+	/* settings that only a tuning profile computes */
+	if (tuning->profile != PG_TUNING_PROFILE_UNKNOWN)
+	{
+		char pretty[BUFSIZE] = { 0 };
+
+		appendPQExpBuffer(contents, "huge_pages = %s\n",
+						  tuning->huge_pages ? "try" : "off");
+
+		(void) pretty_print_bytes(pretty, sizeof(pretty), tuning->max_wal_size);
+		appendPQExpBuffer(contents, "max_wal_size = '%s'\n", pretty);
+
+		appendPQExpBuffer(contents, "checkpoint_timeout = '%dmin'\n",
+						  tuning->checkpoint_timeout);
+		appendPQExpBuffer(contents, "checkpoint_completion_target = 0.9\n");
+		appendPQExpBuffer(contents, "wal_compression = on\n");
+
+		if (tuning->effective_io_concurrency > 0)
+		{
+			appendPQExpBuffer(contents, "effective_io_concurrency = %d\n",
+							  tuning->effective_io_concurrency);
+		}
+
+		/*
+		 * A standby refuses to start with a max_worker_processes lower than
+		 * its primary, all the nodes of a group should use the same profile.
+		 */
+		appendPQExpBuffer(contents, "max_worker_processes = %d\n",
+						  tuning->max_worker_processes);
+		appendPQExpBuffer(contents, "max_parallel_workers = %d\n",
+						  tuning->max_parallel_workers);
+		appendPQExpBuffer(contents, "max_parallel_workers_per_gather = %d\n",
+						  tuning->max_parallel_workers_per_gather);
+
+		if (tuning->max_parallel_maintenance_workers > 0)
+		{
+			appendPQExpBuffer(contents,
+							  "max_parallel_maintenance_workers = %d\n",
+							  tuning->max_parallel_maintenance_workers);
+		}
+	}
+
 	/* memory allocation could have failed while building string */
 	if (PQExpBufferBroken(contents))
 	{
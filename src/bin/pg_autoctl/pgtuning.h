@@ -12,8 +12,25 @@
 
 #include <stdbool.h>
 
+#include "pgsetup.h"
+
 extern GUC postgres_tuning[];
 
-bool pgtuning_prepare_guc_settings(GUC *settings, char *config, size_t size);
+/*
+ * Settings that only apply to secondary nodes, where they make WAL replay
+ * faster. They are written to the standby configuration file, which is
+ * emptied at promotion. An empty value means we keep the Postgres default.
+ */
+typedef struct StandbyTuning
+{
+	char recovery_prefetch[NAMEDATALEN];
+	char maintenance_io_concurrency[NAMEDATALEN];
+	char wal_decode_buffer_size[NAMEDATALEN];
+} StandbyTuning;
+
+bool pgtuning_prepare_guc_settings(GUC *settings, PostgresSetup *pgSetup,
+								   char *config, size_t size);
+void pgtuning_prepare_standby_settings(const char *pgdata, const char *pg_ctl,
+									   StandbyTuning *tuning);
 
 #endif /* PGTUNING_H */
@@ -450,9 +450,38 @@ pidfile_as_json(JSON_Value *js, const char *pidfile, bool includeStatus)
 				*separator = '\0';
 				stringToInt(fileLines[lineNumber], &pidnum);
 
+				/* the service name is followed by its restart counters */
+				char *restarts = strchr(serviceName, ' ');
+				char *restartMs = NULL;
+
+				if (restarts != NULL)
+				{
+					*restarts++ = '\0';
+
+					if ((restartMs = strchr(restarts, ' ')) != NULL)
+					{
+						*restartMs++ = '\0';
+					}
+				}
+
 				json_object_set_string(jsServiceObj, "name", serviceName);
 				json_object_set_number(jsServiceObj, "pid", pidnum);
 
+				if (restarts != NULL && restartMs != NULL)
+				{
+					int restartCount = 0;
+					double timeToRestartMs = 0.0;
+
+					if (stringToInt(restarts, &restartCount) &&
+						stringToDouble(restartMs, &timeToRestartMs))
+					{
+						json_object_set_number(jsServiceObj, "restarts",
+											   (double) restartCount);
+						json_object_set_number(jsServiceObj, "timeToRestartMs",
+											   timeToRestartMs);
+					}
+				}
+
 				if (includeStatus)
 				{
 					if (kill(pidnum, 0) == 0)
@@ -0,0 +1,658 @@
+/*
+ * src/bin/pg_autoctl/prewarm.c
+ *     Warm-up the shared buffers of a standby with the primary's block list
+ *
+ * When the pg_prewarm library is loaded, its autoprewarm worker dumps the
+ * list of the blocks that are in shared buffers to the autoprewarm.blocks
+ * file in PGDATA at regular intervals. Standby nodes fetch a copy of the
+ * primary's file, and load the same blocks in their own shared buffers with
+ * the pg_prewarm() function, so that after a failover the new primary does
+ * not start with a cold cache.
+ *
+ * The autoprewarm.blocks file has a "<<count>>" header line, and then a line
+ * per block: database, tablespace, relfilenode, fork number, block number.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "postgres_fe.h"
+#include "pqexpbuffer.h"
+
+#include "defaults.h"
+#include "file_utils.h"
+#include "log.h"
+#include "pgsetup.h"
+#include "pgsql.h"
+#include "prewarm.h"
+#include "string_utils.h"
+
+
+/*
+ * The primary's file is read over a normal connection with the replication
+ * user, which is a superuser, as pg_rewind does. The file is renamed in place
+ * by the autoprewarm worker, so we never read a partial dump.
+ */
+#define PREWARM_FETCH_BLOCK_LIST_SQL \
+	"SELECT convert_from(pg_read_binary_file($1, 0, size, true), " \
+	"'SQL_ASCII') " \
+	"FROM pg_stat_file($1, true) WHERE size IS NOT NULL"
+
+#define PREWARM_DATABASE_NAME_SQL \
+	"SELECT datname FROM pg_database WHERE oid = $1 AND datallowconn"
+
+#define PREWARM_HAS_EXTENSION_SQL \
+	"SELECT exists(SELECT 1 FROM pg_extension WHERE extname = 'pg_prewarm')"
+
+/*
+ * Relations might have been dropped, rewritten, or truncated since the
+ * primary dumped its block list: we skip the relations that we can't find
+ * and the blocks that are past the end of the relation fork.
+ */
+#define PREWARM_LOAD_BLOCKS_SQL \
+	"SELECT coalesce(sum(pg_prewarm(rel, $1, fork, " \
+	"first, least(last, nblocks - 1))), 0) " \
+	"FROM (SELECT r.rel, t.fork, t.first, t.last, " \
+	"pg_relation_size(r.rel, t.fork) " \
+	"/ current_setting('block_size')::bigint AS nblocks " \
+	"FROM unnest($2::oid[], $3::oid[], $4::text[], $5::bigint[], $6::bigint[]) " \
+	"AS t(tablespace, filenode, fork, first, last), " \
+	"LATERAL (SELECT pg_filenode_relation(t.tablespace, t.filenode) AS rel) r " \
+	"WHERE r.rel IS NOT NULL) AS blocks " \
+	"WHERE first < nblocks"
+
+/* the fork names that pg_prewarm() expects, indexed by fork number */
+static const char *PrewarmForkNames[] = { "main", "fsm", "vm", "init" };
+
+#define PREWARM_FORK_COUNT \
+	((uint32_t) (sizeof(PrewarmForkNames) / sizeof(PrewarmForkNames[0])))
+
+/* the ranges of blocks to load from a single database */
+typedef struct PrewarmRanges
+{
+	int count;
+	PQExpBuffer tablespaces;
+	PQExpBuffer filenodes;
+	PQExpBuffer forks;
+	PQExpBuffer firsts;
+	PQExpBuffer lasts;
+} PrewarmRanges;
+
+
+static int prewarm_compare_blocks(const void *a, const void *b);
+static bool prewarm_ranges_init(PrewarmRanges *ranges);
+static void prewarm_ranges_append(PrewarmRanges *ranges,
+								  PrewarmBlock *first, uint32_t last);
+static void prewarm_ranges_close(PrewarmRanges *ranges);
+static void prewarm_ranges_free(PrewarmRanges *ranges);
+static bool prewarm_load_ranges(PostgresSetup *pgSetup,
+								uint32_t database,
+								PrewarmRanges *ranges,
+								const char *mode,
+								bool *skipDatabase);
+static bool prewarm_get_database_name(PostgresSetup *pgSetup,
+									  uint32_t database,
+									  char *dbname,
+									  bool *found);
+
+
+/*
+ * prewarm_fetch_block_list fetches the autoprewarm.blocks file of the primary
+ * node and writes it at the given filename. When the primary has not dumped
+ * its block list yet, the function returns false without writing anything.
+ */
+bool
+prewarm_fetch_block_list(NodeAddress *primaryNode,
+						 PostgresSetup *pgSetup,
+						 const char *filename)
+{
+	PostgresSetup upstreamSetup = { 0 };
+	PGSQL upstreamClient = { 0 };
+	char connectionString[MAXCONNINFO] = { 0 };
+
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_STRING, false };
+
+	const Oid paramTypes[1] = { TEXTOID };
+	const char *paramValues[1] = { AUTOPREWARM_FILE };
+
+	/* prepare a PostgresSetup that allows preparing a connection string */
+	strlcpy(upstreamSetup.username, PG_AUTOCTL_REPLICA_USERNAME, NAMEDATALEN);
+	strlcpy(upstreamSetup.dbname, pgSetup->dbname, NAMEDATALEN);
+	strlcpy(upstreamSetup.pghost, primaryNode->host, _POSIX_HOST_NAME_MAX);
+	upstreamSetup.pgport = primaryNode->port;
+	upstreamSetup.ssl = pgSetup->ssl;
+
+	pg_setup_get_local_connection_string(&upstreamSetup, connectionString);
+
+	if (!pgsql_init(&upstreamClient, connectionString, PGSQL_CONN_UPSTREAM))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	/* the keeper main loop must not wait for an unavailable primary */
+	(void) pgsql_set_main_loop_retry_policy(&(upstreamClient.retryPolicy));
+
+	bool success =
+		pgsql_execute_with_params(&upstreamClient,
+								  PREWARM_FETCH_BLOCK_LIST_SQL,
+								  1, paramTypes, paramValues,
+								  &context, &parseSingleValueResult);
+
+	pgsql_finish(&upstreamClient);
+
+	if (!success)
+	{
+		log_warn("Failed to fetch the block list of the primary node "
+				 "%" PRId64 " \"%s\" (%s:%d)",
+				 primaryNode->nodeId,
+				 primaryNode->name,
+				 primaryNode->host,
+				 primaryNode->port);
+		return false;
+	}
+
+	if (context.ntuples == 0)
+	{
+		log_debug("The primary node %" PRId64 " \"%s\" (%s:%d) has no %s "
+				  "file, is pg_prewarm in shared_preload_libraries?",
+				  primaryNode->nodeId,
+				  primaryNode->name,
+				  primaryNode->host,
+				  primaryNode->port,
+				  AUTOPREWARM_FILE);
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		log_warn("Failed to parse the block list of the primary node "
+				 "%" PRId64 " \"%s\" (%s:%d)",
+				 primaryNode->nodeId,
+				 primaryNode->name,
+				 primaryNode->host,
+				 primaryNode->port);
+		return false;
+	}
+
+	success = write_file(context.strVal, strlen(context.strVal), filename);
+
+	free(context.strVal);
+
+	return success;
+}
+
+
+/*
+ * prewarm_read_block_list parses the block list found at filename, and sorts
+ * it by database, relation fork, and block number.
+ */
+bool
+prewarm_read_block_list(const char *filename, PrewarmBlockList *list)
+{
+	char *contents = NULL;
+	long size = 0L;
+	int expected = 0;
+
+	if (!read_file(filename, &contents, &size))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (sscanf(contents, "<<%d>>", &expected) != 1 || expected < 0)
+	{
+		log_error("Failed to parse block list file \"%s\": "
+				  "missing header line", filename);
+		free(contents);
+		return false;
+	}
+
+	PrewarmBlock *blocks =
+		(PrewarmBlock *) calloc(Max(expected, 1), sizeof(PrewarmBlock));
+
+	if (blocks == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		free(contents);
+		return false;
+	}
+
+	int count = 0;
+	char *line = strchr(contents, '\n');
+
+	while (line != NULL && count < expected)
+	{
+		PrewarmBlock *block = &(blocks[count]);
+
+		/* skip the newline character that ends the previous line */
+		++line;
+
+		if (*line == '\0')
+		{
+			break;
+		}
+
+		if (sscanf(line, "%u,%u,%u,%u,%u",
+				   &(block->database),
+				   &(block->tablespace),
+				   &(block->filenode),
+				   &(block->forknum),
+				   &(block->blocknum)) != 5)
+		{
+			log_error("Failed to parse block list file \"%s\": "
+					  "invalid line %d", filename, count + 2);
+			free(blocks);
+			free(contents);
+			return false;
+		}
+
+		if (block->forknum < PREWARM_FORK_COUNT)
+		{
+			++count;
+		}
+
+		line = strchr(line, '\n');
+	}
+
+	free(contents);
+
+	qsort(blocks, count, sizeof(PrewarmBlock), prewarm_compare_blocks);
+
+	/* the list is replaced, blocks have yet to be loaded */
+	prewarm_free_block_list(list);
+
+	list->blocks = blocks;
+	list->count = count;
+	list->done = 0;
+
+	log_debug("Read %d blocks from the block list file \"%s\"",
+			  count, filename);
+
+	return true;
+}
+
+
+/*
+ * prewarm_free_block_list frees the memory used by a block list.
+ */
+void
+prewarm_free_block_list(PrewarmBlockList *list)
+{
+	free(list->blocks);
+
+	list->blocks = NULL;
+	list->count = 0;
+	list->done = 0;
+}
+
+
+/*
+ * prewarm_load_blocks loads the blocks of the list that have not been loaded
+ * yet in the local Postgres instance, using pg_prewarm() with the given mode,
+ * one of "buffer", "read", or "prefetch". When maxBlocks is positive, we stop
+ * after that many blocks, and the next call continues from there.
+ *
+ * The pg_prewarm extension must have been created in the databases of the
+ * blocks that we load: other databases are skipped.
+ */
+bool
+prewarm_load_blocks(PostgresSetup *pgSetup,
+					PrewarmBlockList *list,
+					const char *mode,
+					int maxBlocks)
+{
+	bool success = true;
+	int loaded = 0;
+
+	while (list->done < list->count && (maxBlocks <= 0 || loaded < maxBlocks))
+	{
+		PrewarmRanges ranges = { 0 };
+		uint32_t database = list->blocks[list->done].database;
+
+		int current = list->done;
+
+		if (!prewarm_ranges_init(&ranges))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+
+		/* collect ranges of consecutive blocks in the same database */
+		while (current < list->count &&
+			   list->blocks[current].database == database &&
+			   (maxBlocks <= 0 || loaded + (current - list->done) < maxBlocks))
+		{
+			PrewarmBlock *first = &(list->blocks[current]);
+			uint32_t last = first->blocknum;
+
+			for (++current; current < list->count; current++)
+			{
+				PrewarmBlock *next = &(list->blocks[current]);
+
+				if (next->database != first->database ||
+					next->tablespace != first->tablespace ||
+					next->filenode != first->filenode ||
+					next->forknum != first->forknum ||
+					next->blocknum > last + 1)
+				{
+					break;
+				}
+
+				last = next->blocknum;
+			}
+
+			prewarm_ranges_append(&ranges, first, last);
+		}
+
+		prewarm_ranges_close(&ranges);
+
+		bool skipDatabase = false;
+
+		/* shared catalogs (database 0) are loaded by Postgres anyway */
+		if (database != 0 &&
+			!prewarm_load_ranges(pgSetup, database, &ranges, mode,
+								 &skipDatabase))
+		{
+			success = false;
+		}
+
+		prewarm_ranges_free(&ranges);
+
+		if (database == 0 || skipDatabase)
+		{
+			/* skip all the blocks of this database */
+			while (current < list->count &&
+				   list->blocks[current].database == database)
+			{
+				++current;
+			}
+		}
+
+		loaded += current - list->done;
+		list->done = current;
+	}
+
+	return success;
+}
+
+
+/*
+ * prewarm_compare_blocks is a qsort comparison function for PrewarmBlock.
+ */
+static int
+prewarm_compare_blocks(const void *a, const void *b)
+{
+	const PrewarmBlock *ba = (const PrewarmBlock *) a;
+	const PrewarmBlock *bb = (const PrewarmBlock *) b;
+
+	const uint32_t keysA[] = {
+		ba->database, ba->tablespace, ba->filenode, ba->forknum, ba->blocknum
+	};
+	const uint32_t keysB[] = {
+		bb->database, bb->tablespace, bb->filenode, bb->forknum, bb->blocknum
+	};
+
+	for (int i = 0; i < 5; i++)
+	{
+		if (keysA[i] != keysB[i])
+		{
+			return keysA[i] < keysB[i] ? -1 : 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * prewarm_ranges_init prepares the array literals that we send to Postgres.
+ */
+static bool
+prewarm_ranges_init(PrewarmRanges *ranges)
+{
+	ranges->count = 0;
+	ranges->tablespaces = createPQExpBuffer();
+	ranges->filenodes = createPQExpBuffer();
+	ranges->forks = createPQExpBuffer();
+	ranges->firsts = createPQExpBuffer();
+	ranges->lasts = createPQExpBuffer();
+
+	if (ranges->tablespaces == NULL ||
+		ranges->filenodes == NULL ||
+		ranges->forks == NULL ||
+		ranges->firsts == NULL ||
+		ranges->lasts == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		prewarm_ranges_free(ranges);
+		return false;
+	}
+
+	appendPQExpBufferChar(ranges->tablespaces, '{');
+	appendPQExpBufferChar(ranges->filenodes, '{');
+	appendPQExpBufferChar(ranges->forks, '{');
+	appendPQExpBufferChar(ranges->firsts, '{');
+	appendPQExpBufferChar(ranges->lasts, '{');
+
+	return true;
+}
+
+
+/*
+ * prewarm_ranges_append adds the range of blocks from first to last.
+ */
+static void
+prewarm_ranges_append(PrewarmRanges *ranges, PrewarmBlock *first, uint32_t last)
+{
+	const char *sep = ranges->count == 0 ? "" : ",";
+
+	appendPQExpBuffer(ranges->tablespaces, "%s%u", sep, first->tablespace);
+	appendPQExpBuffer(ranges->filenodes, "%s%u", sep, first->filenode);
+	appendPQExpBuffer(ranges->forks, "%s%s",
+					  sep, PrewarmForkNames[first->forknum]);
+	appendPQExpBuffer(ranges->firsts, "%s%u", sep, first->blocknum);
+	appendPQExpBuffer(ranges->lasts, "%s%u", sep, last);
+
+	++ranges->count;
+}
+
+
+/*
+ * prewarm_ranges_close closes the array literals.
+ */
+static void
+prewarm_ranges_close(PrewarmRanges *ranges)
+{
+	appendPQExpBufferChar(ranges->tablespaces, '}');
+	appendPQExpBufferChar(ranges->filenodes, '}');
+	appendPQExpBufferChar(ranges->forks, '}');
+	appendPQExpBufferChar(ranges->firsts, '}');
+	appendPQExpBufferChar(ranges->lasts, '}');
+}
+
+
+/*
+ * prewarm_ranges_free frees the array literals.
+ */
+static void
+prewarm_ranges_free(PrewarmRanges *ranges)
+{
+	/* safe to call on NULL */
+	destroyPQExpBuffer(ranges->tablespaces);
+	destroyPQExpBuffer(ranges->filenodes);
+	destroyPQExpBuffer(ranges->forks);
+	destroyPQExpBuffer(ranges->firsts);
+	destroyPQExpBuffer(ranges->lasts);
+}
+
+
+/*
+ * prewarm_load_ranges connects to the given database and loads the given
+ * ranges of blocks there. When the database does not exist anymore, or does
+ * not have the pg_prewarm extension, skipDatabase is set to true.
+ */
+static bool
+prewarm_load_ranges(PostgresSetup *pgSetup,
+					uint32_t database,
+					PrewarmRanges *ranges,
+					const char *mode,
+					bool *skipDatabase)
+{
+	PostgresSetup dbSetup = *pgSetup;
+	PGSQL pgsql = { 0 };
+	char connectionString[MAXCONNINFO] = { 0 };
+	bool found = false;
+
+	if (PQExpBufferBroken(ranges->tablespaces) ||
+		PQExpBufferBroken(ranges->filenodes) ||
+		PQExpBufferBroken(ranges->forks) ||
+		PQExpBufferBroken(ranges->firsts) ||
+		PQExpBufferBroken(ranges->lasts))
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return false;
+	}
+
+	if (!prewarm_get_database_name(pgSetup, database, dbSetup.dbname, &found))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (!found)
+	{
+		log_debug("Skipping prewarm of database %u: not found", database);
+		*skipDatabase = true;
+		return true;
+	}
+
+	pg_setup_get_local_connection_string(&dbSetup, connectionString);
+
+	if (!pgsql_init(&pgsql, connectionString, PGSQL_CONN_LOCAL))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	(void) pgsql_set_main_loop_retry_policy(&(pgsql.retryPolicy));
+
+	SingleValueResultContext hasExtension =
+	{ { 0 }, PGSQL_RESULT_BOOL, false };
+
+	if (!pgsql_execute_with_params(&pgsql, PREWARM_HAS_EXTENSION_SQL,
+								   0, NULL, NULL,
+								   &hasExtension, &parseSingleValueResult) ||
+		!hasExtension.parsedOk)
+	{
+		log_warn("Failed to check for the pg_prewarm extension "
+				 "in database \"%s\"", dbSetup.dbname);
+		pgsql_finish(&pgsql);
+		return false;
+	}
+
+	if (!hasExtension.boolVal)
+	{
+		log_debug("Skipping prewarm of database \"%s\": "
+				  "the pg_prewarm extension has not been created",
+				  dbSetup.dbname);
+		pgsql_finish(&pgsql);
+		*skipDatabase = true;
+		return true;
+	}
+
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BIGINT, false };
+
+	const Oid paramTypes[6] = {
+		TEXTOID, TEXTOID, TEXTOID, TEXTOID, TEXTOID, TEXTOID
+	};
+	const char *paramValues[6] = {
+		mode,
+		ranges->tablespaces->data,
+		ranges->filenodes->data,
+		ranges->forks->data,
+		ranges->firsts->data,
+		ranges->lasts->data
+	};
+
+	bool success =
+		pgsql_execute_with_params(&pgsql, PREWARM_LOAD_BLOCKS_SQL,
+								  6, paramTypes, paramValues,
+								  &context, &parseSingleValueResult);
+
+	pgsql_finish(&pgsql);
+
+	if (!success || !context.parsedOk)
+	{
+		log_warn("Failed to prewarm %d ranges of blocks in database \"%s\"",
+				 ranges->count, dbSetup.dbname);
+		return false;
+	}
+
+	log_debug("Prewarmed %" PRIu64 " blocks in database \"%s\" (%s)",
+			  context.bigint, dbSetup.dbname, mode);
+
+	return true;
+}
+
+
+/*
+ * prewarm_get_database_name sets dbname to the name of the database with the
+ * given OID in the local Postgres instance, when it exists and accepts
+ * connections.
+ */
+static bool
+prewarm_get_database_name(PostgresSetup *pgSetup,
+						  uint32_t database,
+						  char *dbname,
+						  bool *found)
+{
+	PGSQL pgsql = { 0 };
+	char connectionString[MAXCONNINFO] = { 0 };
+
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_STRING, false };
+
+	IntString databaseString = intToString(database);
+
+	const Oid paramTypes[1] = { OIDOID };
+	const char *paramValues[1] = { databaseString.strValue };
+
+	pg_setup_get_local_connection_string(pgSetup, connectionString);
+
+	if (!pgsql_init(&pgsql, connectionString, PGSQL_CONN_LOCAL))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	(void) pgsql_set_main_loop_retry_policy(&(pgsql.retryPolicy));
+
+	bool success =
+		pgsql_execute_with_params(&pgsql, PREWARM_DATABASE_NAME_SQL,
+								  1, paramTypes, paramValues,
+								  &context, &parseSingleValueResult);
+
+	pgsql_finish(&pgsql);
+
+	if (!success)
+	{
+		log_warn("Failed to get the name of database %u", database);
+		return false;
+	}
+
+	*found = context.ntuples == 1 && context.parsedOk;
+
+	if (*found)
+	{
+		strlcpy(dbname, context.strVal, NAMEDATALEN);
+		free(context.strVal);
+	}
+
+	return true;
+}
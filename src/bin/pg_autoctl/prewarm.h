@@ -0,0 +1,57 @@
+/*
+ * src/bin/pg_autoctl/prewarm.h
+ *     Warm-up the shared buffers of a standby with the primary's block list
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#ifndef PREWARM_H
+#define PREWARM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pgsetup.h"
+#include "pgsql.h"
+
+/* the file that pg_prewarm's autoprewarm worker dumps in PGDATA */
+#define AUTOPREWARM_FILE "autoprewarm.blocks"
+
+/* one line of the autoprewarm.blocks file */
+typedef struct PrewarmBlock
+{
+	uint32_t database;
+	uint32_t tablespace;
+	uint32_t filenode;
+	uint32_t forknum;
+	uint32_t blocknum;
+} PrewarmBlock;
+
+/*
+ * PrewarmBlockList is the block list of the primary, sorted so that the
+ * blocks of a relation fork can be loaded by ranges. Loading a large block
+ * list takes time, so the keeper loads it a chunk at a time, and keeps track
+ * of how many blocks have been loaded already.
+ */
+typedef struct PrewarmBlockList
+{
+	uint64_t fetchTime;         /* epoch */
+	int count;
+	int done;
+	PrewarmBlock *blocks;
+} PrewarmBlockList;
+
+
+bool prewarm_fetch_block_list(NodeAddress *primaryNode,
+							  PostgresSetup *pgSetup,
+							  const char *filename);
+bool prewarm_read_block_list(const char *filename, PrewarmBlockList *list);
+void prewarm_free_block_list(PrewarmBlockList *list);
+bool prewarm_load_blocks(PostgresSetup *pgSetup,
+						 PrewarmBlockList *list,
+						 const char *mode,
+						 int maxBlocks);
+
+#endif /* PREWARM_H */
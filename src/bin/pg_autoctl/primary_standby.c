@@ -6,6 +6,9 @@
  * Licensed under the PostgreSQL License.
  *
  */
+#include <dirent.h>
+#include <inttypes.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
@@ -16,11 +19,13 @@
 #include "file_utils.h"
 #include "keeper.h"
 #include "log.h"
+#include "parallel_clone.h"
 #include "parsing.h"
 #include "pgctl.h"
 #include "pghba.h"
 #include "pgsql.h"
 #include "primary_standby.h"
+#include "runprogram.h"
 #include "signals.h"
 #include "state.h"
 
@@ -30,6 +35,44 @@ static bool local_postgres_wait_until_ready(LocalPostgresServer *postgres);
 static void local_postgres_update_pg_failures_tracking(LocalPostgresServer *postgres,
 													   bool pgIsRunning);
 
+static bool primary_needs_rewind(LocalPostgresServer *postgres,
+								 uint64_t *divergenceBytes);
+static bool primary_rewind_estimate(LocalPostgresServer *postgres,
+									uint64_t divergenceBytes,
+									bool *cloneRather);
+static void primary_rewind_progress(void *context,
+									uint64_t doneBytes,
+									uint64_t totalBytes);
+static void primary_rewind_report(LocalPostgresServer *postgres,
+								  bool *cloneRather);
+static bool directory_size(const char *path, uint64_t *size);
+static bool standby_is_running_in_recovery(LocalPostgresServer *postgres);
+static bool standby_reload_replication_source(LocalPostgresServer *postgres);
+static bool standby_clone_with_command(LocalPostgresServer *postgres);
+static bool standby_clone_in_parallel(LocalPostgresServer *postgres);
+static void standby_promote_restore_connection(PGSQL *pgsql,
+											   ConnectionStatementType statementType);
+static bool standby_install_backup_label(const char *pgdata,
+										 BackupLabel *backupLabel);
+
+static void crash_recovery_init_progress(LocalPostgresServer *postgres);
+static void crash_recovery_update_progress(LocalPostgresServer *postgres,
+										   pid_t postmasterPid,
+										   bool *stopRecovery);
+static void crash_recovery_report_progress(LocalPostgresServer *postgres,
+										   bool *stopRecovery);
+static bool crash_recovery_find_end_lsn(const char *pgdata,
+										uint32_t timeline,
+										uint32_t walSegmentSize,
+										uint64_t *endLSN);
+static bool crash_recovery_find_replay_lsn(pid_t postmasterPid,
+										   uint32_t walSegmentSize,
+										   uint64_t *replayLSN);
+static bool parse_wal_file_name(const char *name,
+								uint32_t walSegmentSize,
+								uint32_t *timeline,
+								uint64_t *lsn);
+
 /*
  * Default settings for postgres databases managed by pg_auto_failover.
  * These settings primarily ensure that streaming replication is
@@ -298,6 +341,9 @@ local_postgres_wait_until_ready(LocalPostgresServer *postgres)
 
 		if (pgIsRunning)
 		{
+			/* a connection kept open to the previous Postgres is now gone */
+			(void) local_postgres_finish(postgres);
+
 			/* update pgSetup cache with new Postgres pid and all */
 			local_postgres_init(postgres, pgSetup);
 
@@ -531,10 +577,13 @@ bool
 primary_drop_all_replication_slots(LocalPostgresServer *postgres)
 {
 	NodeAddressArray otherNodesArray = { 0 };
+	int createdCount = 0;
 
 	log_info("Dropping replication slots (to reset their xmin)");
 
-	if (!postgres_replication_slot_create_and_drop(postgres, &otherNodesArray))
+	if (!postgres_replication_slot_create_and_drop(postgres,
+												   &otherNodesArray,
+												   &createdCount))
 	{
 		log_error("Failed to drop replication slots on the local Postgres "
 				  "instance, see above for details");
@@ -552,13 +601,15 @@ primary_drop_all_replication_slots(LocalPostgresServer *postgres)
  */
 bool
 postgres_replication_slot_create_and_drop(LocalPostgresServer *postgres,
-										  NodeAddressArray *nodeArray)
+										  NodeAddressArray *nodeArray,
+										  int *createdCount)
 {
 	PGSQL *pgsql = &(postgres->sqlClient);
 
 	log_trace("postgres_replication_slot_drop_removed");
 
-	bool result = pgsql_replication_slot_create_and_drop(pgsql, nodeArray);
+	bool result =
+		pgsql_replication_slot_create_and_drop(pgsql, nodeArray, createdCount);
 
 	pgsql_finish(pgsql);
 	return result;
@@ -935,8 +986,26 @@ standby_init_database(LocalPostgresServer *postgres,
 				return false;
 			}
 
+			/* a storage snapshot is faster than copying the files over */
+			if (!IS_EMPTY_STRING_BUFFER(upstream->cloneCommand))
+			{
+				if (!standby_clone_with_command(postgres))
+				{
+					return false;
+				}
+			}
+
+			/* several connections use more of a link than one stream */
+			else if (upstream->cloneJobs > 1)
+			{
+				if (!standby_clone_in_parallel(postgres))
+				{
+					return false;
+				}
+			}
+
 			/* now pg_basebackup from our upstream node */
-			if (!pg_basebackup(pgSetup->pgdata, pgSetup->pg_ctl, upstream))
+			else if (!pg_basebackup(pgSetup->pgdata, pgSetup->pg_ctl, upstream))
 			{
 				return false;
 			}
@@ -1015,6 +1084,247 @@ standby_init_database(LocalPostgresServer *postgres,
 }
 
 
+/*
+ * standby_promote_restore_connection restores the statement type that our
+ * connection had before standby_promote kept it open, and closes it when it
+ * would have been closed after each statement.
+ */
+static void
+standby_promote_restore_connection(PGSQL *pgsql,
+								   ConnectionStatementType statementType)
+{
+	if (statementType == PGSQL_CONNECTION_SINGLE_STATEMENT)
+	{
+		pgsql_finish(pgsql);
+	}
+
+	pgsql->connectionStatementType = statementType;
+}
+
+
+/*
+ * standby_clone_with_command runs the replication.clone_command to install in
+ * PGDATA a copy of the data directory of the upstream node, typically from a
+ * storage snapshot, while a non-exclusive backup is in progress on the
+ * upstream node. The command is run with /bin/sh and is given the upstream
+ * node host and port, and our PGDATA, as $1, $2, and $3.
+ *
+ * The copy is then a backup of the upstream node, that Postgres recovers from
+ * the backup_label we write in there, streaming the WAL it needs from the
+ * upstream node.
+ */
+static bool
+standby_clone_with_command(LocalPostgresServer *postgres)
+{
+	PostgresSetup *pgSetup = &(postgres->postgresSetup);
+	ReplicationSource *upstream = &(postgres->replicationSource);
+	NodeAddress *primaryNode = &(upstream->primaryNode);
+
+	PostgresSetup upstreamSetup = { 0 };
+	PGSQL upstreamClient = { 0 };
+	char connectionString[MAXCONNINFO] = { 0 };
+	char port[BUFSIZE] = { 0 };
+
+	BackupLabel backupLabel = { 0 };
+	int serverVersionNum = 0;
+
+	instr_time startTime;
+	instr_time duration;
+
+	/* prepare a PostgresSetup that allows preparing a connection string */
+	strlcpy(upstreamSetup.username, PG_AUTOCTL_REPLICA_USERNAME, NAMEDATALEN);
+	strlcpy(upstreamSetup.dbname, pgSetup->dbname, NAMEDATALEN);
+	strlcpy(upstreamSetup.pghost, primaryNode->host, _POSIX_HOST_NAME_MAX);
+	upstreamSetup.pgport = primaryNode->port;
+	upstreamSetup.ssl = pgSetup->ssl;
+
+	pg_setup_get_local_connection_string(&upstreamSetup, connectionString);
+
+	if (!pgsql_init(&upstreamClient, connectionString, PGSQL_CONN_UPSTREAM))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	/* the backup is tied to the session, keep it open until we stop it */
+	upstreamClient.connectionStatementType = PGSQL_CONNECTION_MULTI_STATEMENT;
+
+	if (!pgsql_backup_start(&upstreamClient, "pg_auto_failover clone",
+							&serverVersionNum))
+	{
+		log_error("Failed to start a backup on the upstream node " NODE_FORMAT,
+				  primaryNode->nodeId,
+				  primaryNode->name,
+				  primaryNode->host,
+				  primaryNode->port);
+		pgsql_finish(&upstreamClient);
+		return false;
+	}
+
+	sformat(port, sizeof(port), "%d", primaryNode->port);
+
+	log_info("Running replication.clone_command \"%s\"", upstream->cloneCommand);
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	Program program = run_program("/bin/sh", "-c", upstream->cloneCommand,
+								  "pg_autoctl",
+								  primaryNode->host,
+								  port,
+								  pgSetup->pgdata,
+								  NULL);
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	bool cloned = program.returnCode == 0;
+
+	if (!cloned)
+	{
+		if (program.stdErr != NULL)
+		{
+			log_error("%s", program.stdErr);
+		}
+
+		log_error("Failed to run replication.clone_command \"%s\", "
+				  "exit code %d",
+				  upstream->cloneCommand, program.returnCode);
+	}
+	else
+	{
+		log_info("Ran replication.clone_command in %.3f ms",
+				 INSTR_TIME_GET_MILLISEC(duration));
+	}
+
+	free_program(&program);
+
+	/* always stop the backup, even when the command failed */
+	bool stopped =
+		pgsql_backup_stop(&upstreamClient, serverVersionNum, &backupLabel);
+
+	pgsql_finish(&upstreamClient);
+
+	if (!cloned || !stopped)
+	{
+		return false;
+	}
+
+	return standby_install_backup_label(pgSetup->pgdata, &backupLabel);
+}
+
+
+/*
+ * standby_clone_in_parallel copies the data directory of the upstream node
+ * with replication.clone_jobs connections, see parallel_clone.c, and falls
+ * back to pg_basebackup when the upstream node has contents that we can't
+ * copy that way.
+ */
+static bool
+standby_clone_in_parallel(LocalPostgresServer *postgres)
+{
+	PostgresSetup *pgSetup = &(postgres->postgresSetup);
+	ReplicationSource *upstream = &(postgres->replicationSource);
+
+	BackupLabel backupLabel = { 0 };
+	bool unsupported = false;
+
+	instr_time startTime;
+	instr_time duration;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	if (!parallel_clone(pgSetup, upstream, &backupLabel, &unsupported))
+	{
+		if (!unsupported)
+		{
+			log_error("Failed to clone the upstream node with "
+					  "replication.clone_jobs %d, see above for details",
+					  upstream->cloneJobs);
+			return false;
+		}
+
+		log_warn("Using pg_basebackup rather than replication.clone_jobs");
+
+		return pg_basebackup(pgSetup->pgdata, pgSetup->pg_ctl, upstream);
+	}
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	log_info("Cloned the upstream node in %.3f s",
+			 INSTR_TIME_GET_MILLISEC(duration) / 1000.0);
+
+	return standby_install_backup_label(pgSetup->pgdata, &backupLabel);
+}
+
+
+/*
+ * standby_install_backup_label writes the backup_label and tablespace_map
+ * files of a non-exclusive backup in a copy of a data directory, and removes
+ * the files of the copy that only make sense on the running upstream node,
+ * as pg_basebackup skips them.
+ */
+static bool
+standby_install_backup_label(const char *pgdata, BackupLabel *backupLabel)
+{
+	char path[MAXPGPATH] = { 0 };
+
+	if (!directory_exists(pgdata))
+	{
+		log_error("The replication.clone_command did not create \"%s\"",
+				  pgdata);
+		return false;
+	}
+
+	join_path_components(path, pgdata, "backup_label");
+
+	if (!write_file(backupLabel->labelFile,
+					strlen(backupLabel->labelFile),
+					path))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (!IS_EMPTY_STRING_BUFFER(backupLabel->spcmapFile))
+	{
+		join_path_components(path, pgdata, "tablespace_map");
+
+		if (!write_file(backupLabel->spcmapFile,
+						strlen(backupLabel->spcmapFile),
+						path))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+	}
+
+	const char *runtimeFiles[] = { "postmaster.pid", "postmaster.opts", NULL };
+
+	for (int i = 0; runtimeFiles[i] != NULL; i++)
+	{
+		join_path_components(path, pgdata, runtimeFiles[i]);
+
+		if (file_exists(path) && !unlink_file(path))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+	}
+
+	/* the replication slots of the upstream node are not ours */
+	join_path_components(path, pgdata, "pg_replslot");
+
+	if (directory_exists(path) && !rmtree(path, false))
+	{
+		log_error("Failed to remove the contents of \"%s\": %m", path);
+		return false;
+	}
+
+	return true;
+}
+
+
 /*
  * primary_rewind_to_standby brings a database directory of a failed primary back
  * into a state where it can become the standby of the new primary.
@@ -1058,10 +1368,63 @@ primary_rewind_to_standby(LocalPostgresServer *postgres)
 				  primaryNode->port);
 	}
 
-	if (!pg_rewind(pgSetup->pgdata, pgSetup->pg_ctl, replicationSource))
+	uint64_t divergenceBytes = 0;
+
+	if (!primary_needs_rewind(postgres, &divergenceBytes))
 	{
-		log_error("Failed to rewind old data directory");
-		return false;
+		log_info("Skipping pg_rewind: the local WAL ends before the new "
+				 "primary timeline forked off ours");
+	}
+	else
+	{
+		bool cloneRather = false;
+
+		if (!primary_rewind_estimate(postgres, divergenceBytes, &cloneRather))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+
+		if (cloneRather)
+		{
+			log_info("The monitor estimates that cloning this node again is "
+					 "faster than pg_rewind, skipping pg_rewind");
+			return false;
+		}
+
+		/*
+		 * pg_rewind finds the restore_command in the target configuration,
+		 * where a former primary does not have our standby settings yet.
+		 */
+		bool restoreTargetWal =
+			!IS_EMPTY_STRING_BUFFER(replicationSource->restoreCommand) &&
+			pgSetup->control.pg_control_version >= 1300;
+
+		if (restoreTargetWal &&
+			!pg_setup_standby_mode(pgSetup->control.pg_control_version,
+								   pgSetup->pgdata,
+								   pgSetup->pg_ctl,
+								   replicationSource))
+		{
+			log_error("Failed to setup the restore_command for pg_rewind");
+			return false;
+		}
+
+		bool rewound = pg_rewind(pgSetup->pgdata,
+								 pgSetup->pg_ctl,
+								 replicationSource,
+								 restoreTargetWal,
+								 &primary_rewind_progress,
+								 (void *) postgres);
+
+		postgres->rewind.done = true;
+		(void) primary_rewind_report(postgres, &cloneRather);
+
+		if (!rewound)
+		{
+			log_error("Failed to rewind old data directory");
+			return false;
+		}
 	}
 
 	if (!pg_setup_standby_mode(pgSetup->control.pg_control_version,
@@ -1084,84 +1447,321 @@ primary_rewind_to_standby(LocalPostgresServer *postgres)
 
 
 /*
- * postgres_maybe_do_crash_recovery implements a round of Postgres crash
- * recovery for the local instance of Postgres when pg_rewind would otherwise
- * fail because of its internal checks.
+ * primary_needs_rewind returns false when the local Postgres instance, which
+ * is a stopped former primary, has not written any WAL past the point where
+ * the new primary timeline forked off, as found in the timeline history that
+ * pgctl_identify_system() fetched from the new primary. In that case pg_rewind
+ * would have nothing to do, yet it would still scan the whole data directory.
+ *
+ * Only a clean shutdown tells us where the local WAL ends: the shutdown
+ * checkpoint is then the last record. The new primary forked off at a record
+ * boundary, so when the shutdown checkpoint starts before the fork point, the
+ * whole local WAL is part of the new primary history. Otherwise we set
+ * divergenceBytes to how much WAL the local node wrote past the fork point.
+ *
+ * When anything is unknown, we return true and pg_rewind does its job.
  */
-bool
-postgres_maybe_do_crash_recovery(LocalPostgresServer *postgres)
+static bool
+primary_needs_rewind(LocalPostgresServer *postgres, uint64_t *divergenceBytes)
 {
 	PostgresSetup *pgSetup = &(postgres->postgresSetup);
-	ReplicationSource *replicationSource = &(postgres->replicationSource);
+	IdentifySystem *system = &(postgres->replicationSource.system);
 
-	LocalExpectedPostgresStatus *pgStatus = &(postgres->expectedPgStatus);
+	uint64_t checkpointLSN = InvalidXLogRecPtr;
+	const bool missingPgdataIsOk = false;
 
-	/* update our service controller for Postgres to release control */
-	if (!keeper_set_postgres_state_unknown(&(pgStatus->state),
-										   pgStatus->pgStatusPath))
+	/* postgres_maybe_do_crash_recovery() might have changed the control file */
+	if (!pg_controldata(pgSetup, missingPgdataIsOk))
 	{
 		/* errors have already been logged */
-		return false;
+		return true;
 	}
 
-	/* we don't log the output for pg_ctl_status here */
-	int status = pg_ctl_status(pgSetup->pg_ctl, pgSetup->pgdata, false);
-
-	if (status != PG_CTL_STATUS_NOT_RUNNING)
+	if (pgSetup->control.state != DB_SHUTDOWNED)
 	{
-		log_error("Failed to prepare for crash recovery: "
-				  "Postgres is not stopped");
-		return false;
+		log_debug("primary_needs_rewind: Postgres was not shut down cleanly");
+		return true;
 	}
 
-	/*
-	 * pg_rewind fails when the target cluster (meaning the local Postgres
-	 * instance) is either running or has not been shutdown correctly. Time to
-	 * use pg_controldata and see if the DBState there is to pg_rewind liking.
-	 */
-	const bool missingPgdataIsOk = false;
-
-	if (!pg_controldata(pgSetup, missingPgdataIsOk))
+	if (!parseLSN(pgSetup->control.latestCheckpointLSN, &checkpointLSN))
 	{
-		/* errors have already been logged */
-		return false;
+		log_debug("primary_needs_rewind: failed to parse LSN \"%s\"",
+				  pgSetup->control.latestCheckpointLSN);
+		return true;
 	}
 
-	/*
-	 * We know that Postgres is not running thanks to pg_ctl_status, and we
-	 * just grabbed the output from pg_controldata. We can now implement the
-	 * same pre-condition checks as in Postgres pg_rewind.c.
-	 */
-	if (pgSetup->control.state != DB_SHUTDOWNED &&
-		pgSetup->control.state != DB_SHUTDOWNED_IN_RECOVERY)
+	for (int i = 0; i < system->timelines.count; i++)
 	{
-		/*
-		 * Before calling pg_rewind, attempt crash recovery on the Postgres
-		 * instance and then shutdown.
-		 */
-		ReplicationSource crashRecoveryReplicationSource = { 0 };
+		TimeLineHistoryEntry *entry = &(system->timelines.history[i]);
 
-		log_info("Postgres needs to enter crash recovery before pg_rewind.");
+		if (entry->tli != pgSetup->control.timeline_id)
+		{
+			continue;
+		}
 
-		crashRecoveryReplicationSource = *replicationSource;
+		/* the new primary is still using our timeline: it's not promoted */
+		if (XLogRecPtrIsInvalid(entry->end))
+		{
+			return true;
+		}
 
-		/* we target the earlier consistent state possible, or 'immediate' */
-		strlcpy(crashRecoveryReplicationSource.targetLSN,
-				"immediate",
-				sizeof(crashRecoveryReplicationSource.targetLSN));
+		log_info("Local timeline %d ends with a shutdown checkpoint at %s, "
+				 "new primary timeline %d forked off at %X/%X",
+				 pgSetup->control.timeline_id,
+				 pgSetup->control.latestCheckpointLSN,
+				 system->timeline,
+				 (uint32_t) (entry->end >> 32),
+				 (uint32_t) entry->end);
 
-		/* pause when reaching target to avoid creating a new local timeline */
-		strlcpy(crashRecoveryReplicationSource.targetAction,
-				"pause",
-				sizeof(crashRecoveryReplicationSource.targetAction));
+		if (entry->end <= checkpointLSN)
+		{
+			*divergenceBytes = checkpointLSN - entry->end;
+			return true;
+		}
 
-		strlcpy(crashRecoveryReplicationSource.targetTimeline,
-				"current",
-				sizeof(crashRecoveryReplicationSource.targetTimeline));
+		return false;
+	}
 
-		if (!pg_setup_standby_mode(pgSetup->control.pg_control_version,
-								   pgSetup->pgdata,
-								   pgSetup->pg_ctl,
+	log_debug("primary_needs_rewind: timeline %d not found "
+			  "in the new primary timeline history",
+			  pgSetup->control.timeline_id);
+
+	return true;
+}
+
+
+/*
+ * primary_rewind_estimate prepares the estimate of the cost of pg_rewind, and
+ * gives it to the rewind hook, which sets cloneRather to true when cloning the
+ * node again is expected to be faster.
+ *
+ * pg_rewind copies the blocks that the local node changed past the fork
+ * point, which takes about as many bytes as the WAL that it wrote since then,
+ * and a base backup copies the whole database.
+ */
+static bool
+primary_rewind_estimate(LocalPostgresServer *postgres,
+						uint64_t divergenceBytes,
+						bool *cloneRather)
+{
+	PostgresSetup *pgSetup = &(postgres->postgresSetup);
+	RewindProgress *progress = &(postgres->rewind);
+
+	char path[MAXPGPATH] = { 0 };
+	uint64_t databaseBytes = 0;
+
+	*progress = (RewindProgress) { 0 };
+
+	const char *dirs[] = { "base", "global", NULL };
+
+	for (int i = 0; dirs[i] != NULL; i++)
+	{
+		join_path_components(path, pgSetup->pgdata, dirs[i]);
+
+		if (!directory_size(path, &databaseBytes))
+		{
+			log_warn("Failed to compute the size of \"%s\"", path);
+			databaseBytes = 0;
+			break;
+		}
+	}
+
+	progress->startTime = (uint64_t) time(NULL);
+	progress->updateTime = progress->startTime;
+	progress->divergenceBytes = divergenceBytes;
+	progress->databaseBytes = databaseBytes;
+
+	if (divergenceBytes > 0 && databaseBytes > 0)
+	{
+		char divergence[BUFSIZE] = { 0 };
+		char database[BUFSIZE] = { 0 };
+
+		pretty_print_bytes(divergence, sizeof(divergence), divergenceBytes);
+		pretty_print_bytes(database, sizeof(database), databaseBytes);
+
+		log_info("Local WAL diverged from the new primary timeline by %s, "
+				 "for a database of %s",
+				 divergence, database);
+	}
+
+	(void) primary_rewind_report(postgres, cloneRather);
+
+	return true;
+}
+
+
+/*
+ * primary_rewind_progress is called with the progress lines of pg_rewind.
+ */
+static void
+primary_rewind_progress(void *context, uint64_t doneBytes, uint64_t totalBytes)
+{
+	LocalPostgresServer *postgres = (LocalPostgresServer *) context;
+	RewindProgress *progress = &(postgres->rewind);
+
+	/* once pg_rewind runs, we let it finish */
+	bool cloneRather = false;
+
+	progress->updateTime = (uint64_t) time(NULL);
+	progress->doneBytes = doneBytes;
+	progress->totalBytes = totalBytes;
+
+	(void) primary_rewind_report(postgres, &cloneRather);
+}
+
+
+/*
+ * primary_rewind_report calls the rewind progress hook, when one has been set
+ * up.
+ */
+static void
+primary_rewind_report(LocalPostgresServer *postgres, bool *cloneRather)
+{
+	if (postgres->rewindHook == NULL)
+	{
+		return;
+	}
+
+	if (!(*postgres->rewindHook)(postgres->rewindHookContext,
+								 &(postgres->rewind),
+								 cloneRather))
+	{
+		log_warn("Failed to report pg_rewind progress, continuing");
+	}
+}
+
+
+/*
+ * directory_size adds the size of the files in the given directory and its
+ * sub-directories to size.
+ */
+static bool
+directory_size(const char *path, uint64_t *size)
+{
+	DIR *dir = opendir(path);
+
+	if (dir == NULL)
+	{
+		log_debug("Failed to open directory \"%s\": %m", path);
+		return false;
+	}
+
+	struct dirent *entry = NULL;
+	bool success = true;
+
+	while (success && (entry = readdir(dir)) != NULL)
+	{
+		char entryPath[MAXPGPATH] = { 0 };
+		struct stat st;
+
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+		{
+			continue;
+		}
+
+		join_path_components(entryPath, path, entry->d_name);
+
+		/* files might be removed while we walk the directory */
+		if (lstat(entryPath, &st) != 0)
+		{
+			continue;
+		}
+
+		if (S_ISDIR(st.st_mode))
+		{
+			success = directory_size(entryPath, size);
+		}
+		else if (S_ISREG(st.st_mode))
+		{
+			*size += st.st_size;
+		}
+	}
+
+	closedir(dir);
+
+	return success;
+}
+
+
+/*
+ * postgres_maybe_do_crash_recovery implements a round of Postgres crash
+ * recovery for the local instance of Postgres when pg_rewind would otherwise
+ * fail because of its internal checks.
+ */
+bool
+postgres_maybe_do_crash_recovery(LocalPostgresServer *postgres)
+{
+	PostgresSetup *pgSetup = &(postgres->postgresSetup);
+	ReplicationSource *replicationSource = &(postgres->replicationSource);
+
+	LocalExpectedPostgresStatus *pgStatus = &(postgres->expectedPgStatus);
+
+	/* update our service controller for Postgres to release control */
+	if (!keeper_set_postgres_state_unknown(&(pgStatus->state),
+										   pgStatus->pgStatusPath))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	/* we don't log the output for pg_ctl_status here */
+	int status = pg_ctl_status(pgSetup->pg_ctl, pgSetup->pgdata, false);
+
+	if (status != PG_CTL_STATUS_NOT_RUNNING)
+	{
+		log_error("Failed to prepare for crash recovery: "
+				  "Postgres is not stopped");
+		return false;
+	}
+
+	/*
+	 * pg_rewind fails when the target cluster (meaning the local Postgres
+	 * instance) is either running or has not been shutdown correctly. Time to
+	 * use pg_controldata and see if the DBState there is to pg_rewind liking.
+	 */
+	const bool missingPgdataIsOk = false;
+
+	if (!pg_controldata(pgSetup, missingPgdataIsOk))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	/*
+	 * We know that Postgres is not running thanks to pg_ctl_status, and we
+	 * just grabbed the output from pg_controldata. We can now implement the
+	 * same pre-condition checks as in Postgres pg_rewind.c.
+	 */
+	if (pgSetup->control.state != DB_SHUTDOWNED &&
+		pgSetup->control.state != DB_SHUTDOWNED_IN_RECOVERY)
+	{
+		/*
+		 * Before calling pg_rewind, attempt crash recovery on the Postgres
+		 * instance and then shutdown.
+		 */
+		ReplicationSource crashRecoveryReplicationSource = { 0 };
+
+		log_info("Postgres needs to enter crash recovery before pg_rewind.");
+
+		crashRecoveryReplicationSource = *replicationSource;
+
+		/* we target the earlier consistent state possible, or 'immediate' */
+		strlcpy(crashRecoveryReplicationSource.targetLSN,
+				"immediate",
+				sizeof(crashRecoveryReplicationSource.targetLSN));
+
+		/* pause when reaching target to avoid creating a new local timeline */
+		strlcpy(crashRecoveryReplicationSource.targetAction,
+				"pause",
+				sizeof(crashRecoveryReplicationSource.targetAction));
+
+		strlcpy(crashRecoveryReplicationSource.targetTimeline,
+				"current",
+				sizeof(crashRecoveryReplicationSource.targetTimeline));
+
+		if (!pg_setup_standby_mode(pgSetup->control.pg_control_version,
+								   pgSetup->pgdata,
+								   pgSetup->pg_ctl,
 								   &crashRecoveryReplicationSource))
 		{
 			log_error("Failed to setup for crash recovery "
@@ -1206,34 +1806,63 @@ postgres_maybe_do_crash_recovery(LocalPostgresServer *postgres)
 
 			default:
 			{
+				bool stopRecovery = false;
+
+				(void) crash_recovery_init_progress(postgres);
+
 				/* wait until postgres crash recovery is done */
-				for (int attempts = 0;; attempts++)
+				for (;;)
 				{
-					int timeout = 30;
+					int timeout = CRASH_RECOVERY_PROGRESS_INTERVAL;
 
-					if (pg_setup_wait_until_is_ready(pgSetup, timeout, LOG_INFO))
+					if (pg_setup_wait_until_is_ready(pgSetup, timeout, LOG_DEBUG))
 					{
 						break;
 					}
-				}
 
-				/* get Postgres current LSN after recovery, might be useful */
-				PGSQL *pgsql = &(postgres->sqlClient);
+					(void) crash_recovery_update_progress(postgres, fpid,
+														  &stopRecovery);
 
-				if (pgsql_get_postgres_metadata(pgsql,
-												&pgSetup->is_in_recovery,
-												postgres->pgsrSyncState,
-												postgres->currentLSN,
-												&(pgSetup->control)))
-				{
-					log_info("Postgres has finished crash recovery at LSN %s",
-							 postgres->currentLSN);
+					if (stopRecovery)
+					{
+						log_warn("Stopping Postgres crash recovery, as asked "
+								 "by the monitor: the node will be cloned "
+								 "again instead");
+						break;
+					}
 				}
-				else
+
+				postgres->crashRecovery.done = true;
+
+				if (!stopRecovery)
 				{
-					log_error("Failed to get Postgres metadata, continuing");
+					/* get Postgres current LSN after recovery, might be useful */
+					PGSQL *pgsql = &(postgres->sqlClient);
+
+					if (pgsql_get_postgres_metadata(pgsql,
+													&pgSetup->is_in_recovery,
+													postgres->pgsrSyncState,
+													postgres->currentLSN,
+													postgres->replayLSN,
+													&(pgSetup->control)))
+					{
+						log_info("Postgres has finished crash recovery "
+								 "at LSN %s",
+								 postgres->currentLSN);
+
+						(void) parseLSN(postgres->currentLSN,
+										&(postgres->crashRecovery.replayLSN));
+					}
+					else
+					{
+						log_error("Failed to get Postgres metadata, continuing");
+					}
+
+					postgres->crashRecovery.eta = 0;
 				}
 
+				(void) crash_recovery_report_progress(postgres, &stopRecovery);
+
 
 				/*
 				 * Now stop Postgres by just killing our child process, and
@@ -1259,6 +1888,12 @@ postgres_maybe_do_crash_recovery(LocalPostgresServer *postgres)
 					/* waitpid could be WIFSTOPPED, then try again */
 				} while (!(WIFEXITED(status) || !WIFSIGNALED(status)));
 
+				/* pg_rewind then fails, and the FSM uses pg_basebackup */
+				if (stopRecovery)
+				{
+					return false;
+				}
+
 				if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_CODE_QUIT)
 				{
 					return true;
@@ -1286,6 +1921,333 @@ postgres_maybe_do_crash_recovery(LocalPostgresServer *postgres)
 }
 
 
+/*
+ * crash_recovery_init_progress prepares for crash recovery progress
+ * reporting: recovery starts at the REDO location of the latest checkpoint,
+ * and ends somewhere in the latest WAL segment written to pg_wal.
+ */
+static void
+crash_recovery_init_progress(LocalPostgresServer *postgres)
+{
+	PostgresSetup *pgSetup = &(postgres->postgresSetup);
+	CrashRecoveryProgress *progress = &(postgres->crashRecovery);
+
+	*progress = (CrashRecoveryProgress) { 0 };
+
+	progress->startTime = (uint64_t) time(NULL);
+	progress->updateTime = progress->startTime;
+	progress->eta = -1;
+
+	progress->walSegmentSize =
+		pgSetup->control.wal_segment_size > 0
+		? pgSetup->control.wal_segment_size
+		: 16 * 1024 * 1024;
+
+	if (!parseLSN(pgSetup->control.latestCheckpointRedoLSN,
+				  &(progress->startLSN)))
+	{
+		progress->startLSN = 0;
+	}
+
+	progress->replayLSN = progress->startLSN;
+
+	if (!crash_recovery_find_end_lsn(pgSetup->pgdata,
+									 pgSetup->control.timeline_id,
+									 progress->walSegmentSize,
+									 &(progress->endLSN)))
+	{
+		log_debug("Failed to estimate where crash recovery ends");
+	}
+
+	log_info("Crash recovery starts at %s and should end before %X/%X",
+			 pgSetup->control.latestCheckpointRedoLSN,
+			 (uint32_t) (progress->endLSN >> 32),
+			 (uint32_t) progress->endLSN);
+}
+
+
+/*
+ * crash_recovery_update_progress finds out which WAL segment Postgres is
+ * replaying, estimates the remaining time from the average replay rate since
+ * the start of crash recovery, and reports the progress.
+ */
+static void
+crash_recovery_update_progress(LocalPostgresServer *postgres,
+							   pid_t postmasterPid,
+							   bool *stopRecovery)
+{
+	CrashRecoveryProgress *progress = &(postgres->crashRecovery);
+
+	uint64_t replayLSN = 0;
+	uint64_t now = (uint64_t) time(NULL);
+
+	if (!crash_recovery_find_replay_lsn(postmasterPid,
+										progress->walSegmentSize,
+										&replayLSN))
+	{
+		log_info("Postgres is still in crash recovery, started %" PRIu64
+				 "s ago",
+				 now - progress->startTime);
+		return;
+	}
+
+	progress->updateTime = now;
+	progress->replayLSN = replayLSN;
+
+	/* we might have missed segments that were written late */
+	if (progress->endLSN < replayLSN + progress->walSegmentSize)
+	{
+		progress->endLSN = replayLSN + progress->walSegmentSize;
+	}
+
+	uint64_t elapsed = now - progress->startTime;
+	uint64_t replayed =
+		replayLSN > progress->startLSN ? replayLSN - progress->startLSN : 0;
+
+	if (elapsed > 0 && replayed > 0)
+	{
+		uint64_t bytesPerSecond = replayed / elapsed;
+
+		progress->eta =
+			bytesPerSecond > 0
+			? (int64_t) ((progress->endLSN - replayLSN) / bytesPerSecond)
+			: -1;
+	}
+
+	double percent =
+		progress->endLSN > progress->startLSN
+		? 100.0 * (double) replayed /
+		  (double) (progress->endLSN - progress->startLSN)
+		: 0.0;
+
+	if (progress->eta >= 0)
+	{
+		log_info("Postgres crash recovery is replaying %X/%X (%.0f%%), "
+				 "about %" PRId64 "s remaining",
+				 (uint32_t) (replayLSN >> 32),
+				 (uint32_t) replayLSN,
+				 percent,
+				 progress->eta);
+	}
+	else
+	{
+		log_info("Postgres crash recovery is replaying %X/%X (%.0f%%)",
+				 (uint32_t) (replayLSN >> 32),
+				 (uint32_t) replayLSN,
+				 percent);
+	}
+
+	(void) crash_recovery_report_progress(postgres, stopRecovery);
+}
+
+
+/*
+ * crash_recovery_report_progress calls the crash recovery progress hook, when
+ * one has been set up.
+ */
+static void
+crash_recovery_report_progress(LocalPostgresServer *postgres,
+							   bool *stopRecovery)
+{
+	if (postgres->crashRecoveryHook == NULL)
+	{
+		return;
+	}
+
+	if (!(*postgres->crashRecoveryHook)(postgres->crashRecoveryHookContext,
+										&(postgres->crashRecovery),
+										stopRecovery))
+	{
+		log_warn("Failed to report crash recovery progress, continuing");
+	}
+}
+
+
+/*
+ * crash_recovery_find_end_lsn returns the end of the WAL segment of the given
+ * timeline that has been written last in pg_wal. Postgres renames old
+ * segments to future names for recycling them, their modification time tells
+ * them apart from the segments that have been written.
+ */
+static bool
+crash_recovery_find_end_lsn(const char *pgdata,
+							uint32_t timeline,
+							uint32_t walSegmentSize,
+							uint64_t *endLSN)
+{
+	char walDir[MAXPGPATH] = { 0 };
+	time_t latest = 0;
+
+	join_path_components(walDir, pgdata, "pg_wal");
+
+	DIR *dir = opendir(walDir);
+
+	if (dir == NULL)
+	{
+		log_debug("Failed to open directory \"%s\": %m", walDir);
+		return false;
+	}
+
+	struct dirent *entry = NULL;
+
+	while ((entry = readdir(dir)) != NULL)
+	{
+		char path[MAXPGPATH] = { 0 };
+		struct stat st;
+
+		uint32_t tli = 0;
+		uint64_t lsn = 0;
+
+		if (!parse_wal_file_name(entry->d_name, walSegmentSize, &tli, &lsn) ||
+			tli != timeline)
+		{
+			continue;
+		}
+
+		join_path_components(path, walDir, entry->d_name);
+
+		if (stat(path, &st) != 0)
+		{
+			continue;
+		}
+
+		if (st.st_mtime > latest ||
+			(st.st_mtime == latest && lsn + walSegmentSize > *endLSN))
+		{
+			latest = st.st_mtime;
+			*endLSN = lsn + walSegmentSize;
+		}
+	}
+
+	closedir(dir);
+
+	return latest > 0;
+}
+
+
+/*
+ * crash_recovery_find_replay_lsn finds the startup process of the given
+ * postmaster, and the WAL segment it's replaying from its process title, such
+ * as "postgres: startup recovering 000000010000000000000003". We then return
+ * the start of that segment.
+ *
+ * We read the process titles in /proc, which only exists on Linux.
+ */
+static bool
+crash_recovery_find_replay_lsn(pid_t postmasterPid,
+							   uint32_t walSegmentSize,
+							   uint64_t *replayLSN)
+{
+#if defined(__linux__)
+	DIR *dir = opendir("/proc");
+
+	if (dir == NULL)
+	{
+		return false;
+	}
+
+	bool found = false;
+	struct dirent *entry = NULL;
+
+	while (!found && (entry = readdir(dir)) != NULL)
+	{
+		char path[MAXPGPATH] = { 0 };
+		char line[BUFSIZE] = { 0 };
+		int ppid = 0;
+
+		if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+		{
+			continue;
+		}
+
+		/* /proc/<pid>/stat is "pid (comm) state ppid ..." */
+		sformat(path, sizeof(path), "/proc/%s/stat", entry->d_name);
+
+		FILE *file = fopen(path, "r");
+
+		if (file == NULL)
+		{
+			continue;
+		}
+
+		bool parsed = fgets(line, sizeof(line), file) != NULL;
+		char *comm = parsed ? strrchr(line, ')') : NULL;
+
+		fclose(file);
+
+		if (comm == NULL ||
+			sscanf(comm + 1, " %*c %d", &ppid) != 1 ||
+			ppid != postmasterPid)
+		{
+			continue;
+		}
+
+		sformat(path, sizeof(path), "/proc/%s/cmdline", entry->d_name);
+
+		file = fopen(path, "r");
+
+		if (file == NULL)
+		{
+			continue;
+		}
+
+		bzero(line, sizeof(line));
+		size_t bytes = fread(line, sizeof(char), sizeof(line) - 1, file);
+
+		fclose(file);
+
+		char *recovering = bytes > 0 ? strstr(line, "recovering ") : NULL;
+
+		if (recovering != NULL && strstr(line, "startup") != NULL)
+		{
+			char walFileName[MAXPGPATH] = { 0 };
+			uint32_t tli = 0;
+
+			found =
+				sscanf(recovering, "recovering %24s", walFileName) == 1 &&
+				parse_wal_file_name(walFileName, walSegmentSize,
+									&tli, replayLSN);
+		}
+	}
+
+	closedir(dir);
+
+	return found;
+#else
+	return false;
+#endif
+}
+
+
+/*
+ * parse_wal_file_name parses a WAL file name such as
+ * 000000010000000000000003 into its timeline and its start LSN.
+ */
+static bool
+parse_wal_file_name(const char *name, uint32_t walSegmentSize,
+					uint32_t *timeline, uint64_t *lsn)
+{
+	uint32_t log = 0;
+	uint32_t seg = 0;
+
+	if (strlen(name) != 24 || strspn(name, "0123456789ABCDEF") != 24 ||
+		walSegmentSize == 0)
+	{
+		return false;
+	}
+
+	if (sscanf(name, "%08X%08X%08X", timeline, &log, &seg) != 3)
+	{
+		return false;
+	}
+
+	uint64_t segmentsPerLogId = UINT64_C(0x100000000) / walSegmentSize;
+
+	*lsn = ((uint64_t) log * segmentsPerLogId + seg) * walSegmentSize;
+
+	return true;
+}
+
 /*
  * standby_promote promotes a standby postgres server to primary.
  */
@@ -1322,36 +2284,86 @@ standby_promote(LocalPostgresServer *postgres)
 		return true;
 	}
 
-	/* disconnect from PostgreSQL now */
-	pgsql_finish(pgsql);
+	/*
+	 * Keep our connection open while we wait for the promotion, so that we
+	 * can poll pg_is_in_recovery() often without paying for a new connection
+	 * each time.
+	 */
+	ConnectionStatementType statementType = pgsql->connectionStatementType;
+
+	if (statementType == PGSQL_CONNECTION_SINGLE_STATEMENT)
+	{
+		pgsql->connectionStatementType = PGSQL_CONNECTION_MULTI_STATEMENT;
+	}
 
 	log_info("Promoting postgres");
 
-	if (!pg_ctl_promote(pgSetup->pg_ctl, pgSetup->pgdata))
+	instr_time startTime;
+	instr_time duration;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	/* pg_promote() saves spawning pg_ctl promote, from Postgres 12 on */
+	if (pgSetup->control.pg_control_version >= 1200)
+	{
+		if (!pgsql_promote(pgsql))
+		{
+			log_error("Failed to promote standby: see pg_promote errors above");
+			standby_promote_restore_connection(pgsql, statementType);
+			return false;
+		}
+	}
+	else if (!pg_ctl_promote(pgSetup->pg_ctl, pgSetup->pgdata))
 	{
 		log_error("Failed to promote standby: see pg_ctl promote errors above");
+		standby_promote_restore_connection(pgsql, statementType);
 		return false;
 	}
 
-	do {
-		log_info("Waiting for postgres to promote");
-		pg_usleep(AWAIT_PROMOTION_SLEEP_TIME_MS * 1000);
+	uint64_t lastLogTime = 0;
+
+	for (;;)
+	{
+		if (!pgsql_is_in_recovery(pgsql, &inRecovery))
+		{
+			log_error("Failed to determine whether postgres is in "
+					  "recovery mode after promotion");
+			standby_promote_restore_connection(pgsql, statementType);
+			return false;
+		}
+
+		if (!inRecovery)
+		{
+			break;
+		}
 
 		if (asked_to_stop || asked_to_stop_fast)
 		{
 			log_trace("standby_promote: signaled");
 			pgsql_finish(pgsql);
+			pgsql->connectionStatementType = statementType;
 
 			return false;
 		}
 
-		if (!pgsql_is_in_recovery(pgsql, &inRecovery))
+		uint64_t now = time(NULL);
+
+		if (lastLogTime == 0 || (now - lastLogTime) >= 1)
 		{
-			log_error("Failed to determine whether postgres is in "
-					  "recovery mode after promotion");
-			return false;
+			log_info("Waiting for postgres to promote");
+			lastLogTime = now;
 		}
-	} while (inRecovery);
+
+		pg_usleep(AWAIT_PROMOTION_POLL_INTERVAL_MS * 1000);
+	}
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	log_info("Postgres has been promoted in %.3f ms",
+			 INSTR_TIME_GET_MILLISEC(duration));
+
+	standby_promote_restore_connection(pgsql, statementType);
 
 	/*
 	 * It's necessary to do a checkpoint before allowing the old primary to
@@ -1377,6 +2389,23 @@ standby_promote(LocalPostgresServer *postgres)
 		return false;
 	}
 
+	/*
+	 * Our shared buffers have been warmed-up with the primary's block list
+	 * while we were a secondary. Now ask the kernel to read-ahead the blocks
+	 * of that list too, which does not delay the promotion.
+	 */
+	if (!IS_EMPTY_STRING_BUFFER(postgres->prewarmPath) &&
+		file_exists(postgres->prewarmPath))
+	{
+		if (!prewarm_read_block_list(postgres->prewarmPath,
+									 &(postgres->prewarm)) ||
+			!prewarm_load_blocks(pgSetup, &(postgres->prewarm), "prefetch", 0))
+		{
+			log_warn("Failed to prefetch the primary's block list, "
+					 "continuing with the promotion");
+		}
+	}
+
 	/* disconnect from PostgreSQL now */
 	pgsql_finish(pgsql);
 
@@ -1424,8 +2453,10 @@ primary_standby_has_caught_up(LocalPostgresServer *postgres)
 		return false;
 	}
 
+	/* wait on the server for up to a keeper round for the standby */
 	if (!pgsql_one_slot_has_reached_target_lsn(pgsql,
 											   postgres->standbyTargetLSN,
+											   PG_AUTOCTL_KEEPER_SLEEP_TIME * 1000,
 											   standbyCurrentLSN,
 											   &hasReachedLSN))
 	{
@@ -1482,6 +2513,11 @@ standby_follow_new_primary(LocalPostgresServer *postgres)
 		}
 	}
 
+	if (standby_can_reload_replication_source(postgres))
+	{
+		return standby_reload_replication_source(postgres);
+	}
+
 	/* cleanup our existing standby setup, including postgresql.auto.conf */
 	if (!pg_cleanup_standby_mode(pgSetup->control.pg_control_version,
 								 pgSetup->pg_ctl,
@@ -1532,6 +2568,12 @@ standby_follow_new_primary(LocalPostgresServer *postgres)
  * recovery_target_lsn (inclusive) with a recovery_target_action set to
  * 'promote' so that as soon as we get our WAL bytes we are promoted to being a
  * primary.
+ *
+ * Starting with Postgres 13, a running standby streams the missing WAL from
+ * the upstream standby with just a reload, and without a recovery target: the
+ * upstream node is in report_lsn and does not receive WAL anymore, so the
+ * stream stops at its LSN anyway. That saves a Postgres restart cycle on the
+ * failover critical path.
  */
 bool
 standby_fetch_missing_wal(LocalPostgresServer *postgres)
@@ -1551,8 +2593,29 @@ standby_fetch_missing_wal(LocalPostgresServer *postgres)
 			 upstreamNode->port,
 			 replicationSource->targetLSN);
 
-	/* apply new replication source to fetch missing WAL bits */
-	if (!standby_restart_with_current_replication_source(postgres))
+	bool fetchedWAL = false;
+
+	if (standby_is_running_in_recovery(postgres))
+	{
+		char targetLSN[PG_LSN_MAXLENGTH] = { 0 };
+
+		log_info("Streaming the missing WAL without restarting Postgres");
+
+		/* without a recovery target, the new source is applied with a reload */
+		strlcpy(targetLSN, replicationSource->targetLSN, PG_LSN_MAXLENGTH);
+		bzero(replicationSource->targetLSN, PG_LSN_MAXLENGTH);
+
+		fetchedWAL = standby_restart_with_current_replication_source(postgres);
+
+		strlcpy(replicationSource->targetLSN, targetLSN, PG_LSN_MAXLENGTH);
+	}
+	else
+	{
+		/* apply new replication source to fetch missing WAL bits */
+		fetchedWAL = standby_restart_with_current_replication_source(postgres);
+	}
+
+	if (!fetchedWAL)
 	{
 		log_error("Failed to setup replication "
 				  "from upstream node " NODE_FORMAT
@@ -1574,8 +2637,10 @@ standby_fetch_missing_wal(LocalPostgresServer *postgres)
 			break;
 		}
 
+		/* the server returns as soon as the LSN has been reached */
 		if (!pgsql_has_reached_target_lsn(pgsql,
 										  replicationSource->targetLSN,
+										  AWAIT_PROMOTION_SLEEP_TIME_MS,
 										  currentLSN,
 										  &hasReachedLSN))
 		{
@@ -1587,12 +2652,18 @@ standby_fetch_missing_wal(LocalPostgresServer *postgres)
 		{
 			log_info("Postgres recovery is at LSN %s, waiting for LSN %s",
 					 currentLSN, replicationSource->targetLSN);
-			pg_usleep(AWAIT_PROMOTION_SLEEP_TIME_MS * 1000);
+
+			/* when not in recovery yet, the server could not wait for us */
+			if (IS_EMPTY_STRING_BUFFER(currentLSN))
+			{
+				pg_usleep(AWAIT_PROMOTION_SLEEP_TIME_MS * 1000);
+			}
 		}
 	}
 
 	/* done with fast-forwarding, keep the value for node_active() call */
 	strlcpy(postgres->currentLSN, currentLSN, PG_LSN_MAXLENGTH);
+	strlcpy(postgres->replayLSN, currentLSN, PG_LSN_MAXLENGTH);
 
 	/* we might have been interrupted before the end */
 	if (!hasReachedLSN)
@@ -1650,6 +2721,11 @@ standby_restart_with_current_replication_source(LocalPostgresServer *postgres)
 		}
 	}
 
+	if (standby_can_reload_replication_source(postgres))
+	{
+		return standby_reload_replication_source(postgres);
+	}
+
 	/* cleanup our existing standby setup, including postgresql.auto.conf */
 	if (!pg_cleanup_standby_mode(pgSetup->control.pg_control_version,
 								 pgSetup->pg_ctl,
@@ -1691,6 +2767,98 @@ standby_restart_with_current_replication_source(LocalPostgresServer *postgres)
 }
 
 
+/*
+ * standby_can_reload_replication_source returns true when the new replication
+ * source can be applied to the running standby with just a reload. Starting
+ * with Postgres 13, primary_conninfo and primary_slot_name are reloadable,
+ * and the startup process restarts the WAL receiver when they change. The
+ * recovery target settings still require a restart, and so does a Postgres
+ * instance that is not running as a standby already.
+ */
+bool
+standby_can_reload_replication_source(LocalPostgresServer *postgres)
+{
+	ReplicationSource *replicationSource = &(postgres->replicationSource);
+
+	if (!IS_EMPTY_STRING_BUFFER(replicationSource->targetLSN) ||
+		!IS_EMPTY_STRING_BUFFER(replicationSource->targetTimeline))
+	{
+		return false;
+	}
+
+	return standby_is_running_in_recovery(postgres);
+}
+
+
+/*
+ * standby_is_running_in_recovery returns true when Postgres is running as a
+ * standby with a version where primary_conninfo and primary_slot_name are
+ * reloadable, that is Postgres 13 and later.
+ */
+static bool
+standby_is_running_in_recovery(LocalPostgresServer *postgres)
+{
+	PGSQL *pgsql = &(postgres->sqlClient);
+	PostgresSetup *pgSetup = &(postgres->postgresSetup);
+
+	bool pgIsInRecovery = false;
+
+	if (pgSetup->control.pg_control_version < 1300)
+	{
+		return false;
+	}
+
+	if (!pg_is_running(pgSetup->pg_ctl, pgSetup->pgdata))
+	{
+		return false;
+	}
+
+	if (!pgsql_is_in_recovery(pgsql, &pgIsInRecovery))
+	{
+		/* errors have already been logged, just restart then */
+		return false;
+	}
+
+	return pgIsInRecovery;
+}
+
+
+/*
+ * standby_reload_replication_source rewrites the standby setup with the
+ * current replication source and reloads the Postgres configuration, keeping
+ * the shared buffers and the read-only sessions of the standby.
+ */
+static bool
+standby_reload_replication_source(LocalPostgresServer *postgres)
+{
+	PGSQL *pgsql = &(postgres->sqlClient);
+	PostgresSetup *pgSetup = &(postgres->postgresSetup);
+	ReplicationSource *replicationSource = &(postgres->replicationSource);
+
+	if (!pg_setup_standby_mode(pgSetup->control.pg_control_version,
+							   pgSetup->pgdata,
+							   pgSetup->pg_ctl,
+							   replicationSource))
+	{
+		log_error("Failed to setup Postgres as a standby");
+		return false;
+	}
+
+	log_info("Reloading Postgres configuration at \"%s\"", pgSetup->pgdata);
+
+	if (!pgsql_reload_conf(pgsql))
+	{
+		log_error("Failed to reload Postgres after changing its "
+				  "primary conninfo, see above for details");
+		return false;
+	}
+
+	pgsql_finish(pgsql);
+
+	return true;
+}
+
+
 /*
  * standby_cleanup_as_primary removes the setup for a standby server and
  * restarts as a primary. It's typically called after standby_fetch_missing_wal
@@ -1742,6 +2910,7 @@ standby_check_timeline_with_upstream(LocalPostgresServer *postgres)
 									 &(postgres->postgresSetup.is_in_recovery),
 									 postgres->pgsrSyncState,
 									 postgres->currentLSN,
+									 postgres->replayLSN,
 									 &(postgres->postgresSetup.control)))
 	{
 		log_error("Failed to update the local Postgres metadata");
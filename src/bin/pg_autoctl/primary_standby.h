@@ -15,6 +15,7 @@
 #include "postgres_fe.h"
 #include "pgsql.h"
 #include "pgsetup.h"
+#include "prewarm.h"
 
 
 /* Communication device between node-active and postgres processes */
@@ -25,13 +26,60 @@ typedef struct LocalExpectedPostgresStatus
 } LocalExpectedPostgresStatus;
 
 
+/*
+ * While postgres_maybe_do_crash_recovery() waits for Postgres, we follow the
+ * replay progress from the redo point of the latest checkpoint up to the end
+ * of the WAL found in pg_wal. A progress hook, when set, is called at each
+ * update and may ask us to stop crash recovery.
+ */
+typedef struct CrashRecoveryProgress
+{
+	uint64_t startTime;         /* epoch */
+	uint64_t updateTime;        /* epoch */
+	uint64_t startLSN;          /* REDO location of the latest checkpoint */
+	uint64_t replayLSN;         /* segment the startup process replays */
+	uint64_t endLSN;            /* end of the latest segment in pg_wal */
+	uint32_t walSegmentSize;
+	int64_t eta;                /* seconds, -1 when unknown */
+	bool done;
+} CrashRecoveryProgress;
+
+typedef bool (*CrashRecoveryProgressFunction)(void *context,
+											  CrashRecoveryProgress *progress,
+											  bool *stopRecovery);
+
+/*
+ * Before running pg_rewind on a former primary, we estimate its cost from the
+ * WAL that the local node wrote past the point where the new primary timeline
+ * forked off, compared to the size of the database, and then we follow the
+ * pg_rewind --progress output. A progress hook, when set, is called with the
+ * estimate first, when it may ask us to clone the node again instead, and
+ * then at each update.
+ */
+typedef struct RewindProgress
+{
+	uint64_t startTime;         /* epoch */
+	uint64_t updateTime;        /* epoch */
+	uint64_t divergenceBytes;   /* local WAL past the fork point, 0: unknown */
+	uint64_t databaseBytes;     /* size of the local base and global dirs */
+	uint64_t doneBytes;
+	uint64_t totalBytes;        /* 0 until pg_rewind reports progress */
+	bool done;
+} RewindProgress;
+
+typedef bool (*RewindProgressHookFunction)(void *context,
+										   RewindProgress *progress,
+										   bool *cloneRather);
+
 /*
  * LocalPostgresServer represents a local postgres database cluster that
  * we can manage via a SQL connection and operations on the database
  * directory contained in the PostgresSetup.
  *
- * currentLSN value is kept as text for better portability. We do not
- * perform any operation on the value after it was read from database.
+ * currentLSN and replayLSN values are kept as text for better portability. We
+ * do not perform any operation on the values after they were read from
+ * database. On a standby node, currentLSN is the received WAL position and
+ * replayLSN the replayed one, on a primary node they are the same.
  */
 typedef struct LocalPostgresServer
 {
@@ -41,12 +89,28 @@ typedef struct LocalPostgresServer
 	bool pgIsRunning;
 	char pgsrSyncState[PGSR_SYNC_STATE_MAXLENGTH];
 	char currentLSN[PG_LSN_MAXLENGTH];
+	char replayLSN[PG_LSN_MAXLENGTH];
+	StandbyLSNs standbyLSNs;        /* only on a primary */
 	uint64_t pgFirstStartFailureTs;
 	int pgStartRetries;
 	PgInstanceKind pgKind;
 	LocalExpectedPostgresStatus expectedPgStatus;
 	char standbyTargetLSN[PG_LSN_MAXLENGTH];
 	char synchronousStandbyNames[BUFSIZE];
+
+	/* copy of the primary's block list, empty when prewarm is disabled */
+	char prewarmPath[MAXPGPATH];
+	PrewarmBlockList prewarm;
+
+	/* progress of postgres_maybe_do_crash_recovery(), and who to tell */
+	CrashRecoveryProgress crashRecovery;
+	CrashRecoveryProgressFunction crashRecoveryHook;
+	void *crashRecoveryHookContext;
+
+	/* estimate and progress of pg_rewind, and who to tell */
+	RewindProgress rewind;
+	RewindProgressHookFunction rewindHook;
+	void *rewindHookContext;
 } LocalPostgresServer;
 
 
@@ -74,7 +138,8 @@ bool primary_drop_replication_slots(LocalPostgresServer *postgres);
 bool primary_drop_all_replication_slots(LocalPostgresServer *postgres);
 bool primary_set_synchronous_standby_names(LocalPostgresServer *postgres);
 bool postgres_replication_slot_create_and_drop(LocalPostgresServer *postgres,
-											   NodeAddressArray *nodeArray);
+											   NodeAddressArray *nodeArray,
+											   int *createdCount);
 bool postgres_replication_slot_maintain(LocalPostgresServer *postgres,
 										NodeAddressArray *nodeArray);
 bool primary_disable_synchronous_replication(LocalPostgresServer *postgres);
@@ -109,6 +174,7 @@ bool primary_standby_has_caught_up(LocalPostgresServer *postgres);
 bool standby_follow_new_primary(LocalPostgresServer *postgres);
 bool standby_fetch_missing_wal(LocalPostgresServer *postgres);
 bool standby_restart_with_current_replication_source(LocalPostgresServer *postgres);
+bool standby_can_reload_replication_source(LocalPostgresServer *postgres);
 bool standby_cleanup_as_primary(LocalPostgresServer *postgres);
 bool standby_check_timeline_with_upstream(LocalPostgresServer *postgres);
 
@@ -0,0 +1,298 @@
+/*
+ * src/bin/pg_autoctl/probe_cache.c
+ *     Cache the output of the Postgres binaries we probe, such as
+ *     pg_ctl --version and pg_config --bindir.
+ *
+ * Finding which Postgres installation to use runs pg_ctl --version and
+ * pg_config --bindir for each candidate found in the PATH, and every
+ * pg_autoctl command does that again. The output of those programs only
+ * changes when the binaries are replaced, so we keep it in a cache file in
+ * the pg_autoctl configuration directory, keyed on the program path, its
+ * argument, and the modification time and size of the program file.
+ *
+ * The cache file contains one tab-separated entry per line:
+ *
+ *   program <tab> arg <tab> mtime <tab> size <tab> output
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "postgres_fe.h"
+#include "pqexpbuffer.h"
+
+#include "env_utils.h"
+#include "file_utils.h"
+#include "log.h"
+#include "probe_cache.h"
+#include "runprogram.h"
+#include "string_utils.h"
+
+typedef struct ProbeCacheKey
+{
+	const char *program;
+	const char *arg;
+	int64_t mtime;
+	int64_t size;
+} ProbeCacheKey;
+
+static bool probe_cache_filename(char *filename, size_t size);
+static bool probe_cache_lookup(const char *filename, ProbeCacheKey *key,
+							   char *output, size_t size);
+static void probe_cache_store(const char *filename, ProbeCacheKey *key,
+							  const char *output);
+static bool probe_cache_entry_matches(char *line, ProbeCacheKey *key,
+									  char **output);
+
+
+/*
+ * probe_cache_run runs the given program with the given argument, and copies
+ * the first line of its output to the given buffer. When the cache has an
+ * entry for the same program file, the program is not run at all.
+ */
+bool
+probe_cache_run(const char *program, const char *arg, char *output, size_t size)
+{
+	char filename[MAXPGPATH] = { 0 };
+	struct stat programStat = { 0 };
+	bool useCache = probe_cache_filename(filename, sizeof(filename));
+
+	if (stat(program, &programStat) != 0)
+	{
+		log_debug("Failed to stat \"%s\": %m", program);
+		useCache = false;
+	}
+
+	ProbeCacheKey key = {
+		.program = program,
+		.arg = arg,
+		.mtime = (int64_t) programStat.st_mtime,
+		.size = (int64_t) programStat.st_size
+	};
+
+	if (useCache && probe_cache_lookup(filename, &key, output, size))
+	{
+		log_trace("probe_cache_run: \"%s %s\" found in cache", program, arg);
+		return true;
+	}
+
+	Program prog = run_program(program, arg, NULL);
+
+	if (prog.returnCode != 0 || prog.stdOut == NULL)
+	{
+		errno = prog.error;
+		free_program(&prog);
+		return false;
+	}
+
+	char *lines[1];
+
+	if (splitLines(prog.stdOut, lines, 1) != 1)
+	{
+		log_error("Unable to parse output from \"%s %s\"", program, arg);
+		free_program(&prog);
+		return false;
+	}
+
+	strlcpy(output, lines[0], size);
+	free_program(&prog);
+
+	if (useCache)
+	{
+		(void) probe_cache_store(filename, &key, output);
+	}
+
+	return true;
+}
+
+
+/*
+ * probe_cache_filename computes the path to the cache file, in the top-level
+ * pg_autoctl configuration directory, and returns false when that directory
+ * does not exist, in which case we don't use the cache.
+ */
+static bool
+probe_cache_filename(char *filename, size_t size)
+{
+	char home[MAXPGPATH] = { 0 };
+	char fallback[MAXPGPATH] = { 0 };
+	char configdir[MAXPGPATH] = { 0 };
+
+	if (!get_env_copy_with_fallback("HOME", home, sizeof(home), ""))
+	{
+		return false;
+	}
+
+	join_path_components(fallback, home, ".config");
+
+	if (!get_env_copy_with_fallback("XDG_CONFIG_HOME",
+									configdir, sizeof(configdir), fallback))
+	{
+		return false;
+	}
+
+	join_path_components(configdir, configdir, "pg_autoctl");
+
+	if (!directory_exists(configdir))
+	{
+		return false;
+	}
+
+	join_path_components(filename, configdir, PROBE_CACHE_FILENAME);
+
+	return true;
+}
+
+
+/*
+ * probe_cache_lookup looks for the given key in the cache file, and copies
+ * the cached output in the given buffer when found.
+ */
+static bool
+probe_cache_lookup(const char *filename, ProbeCacheKey *key,
+				   char *output, size_t size)
+{
+	char *contents = NULL;
+	long fileSize = 0;
+	char *lines[PROBE_CACHE_MAX_ENTRIES];
+	bool found = false;
+
+	if (!file_exists(filename) ||
+		!read_file_if_exists(filename, &contents, &fileSize))
+	{
+		return false;
+	}
+
+	int lineCount = splitLines(contents, lines, PROBE_CACHE_MAX_ENTRIES);
+
+	for (int i = 0; i < lineCount; i++)
+	{
+		char *cachedOutput = NULL;
+
+		if (probe_cache_entry_matches(lines[i], key, &cachedOutput))
+		{
+			strlcpy(output, cachedOutput, size);
+			found = true;
+			break;
+		}
+	}
+
+	free(contents);
+
+	return found;
+}
+
+
+/*
+ * probe_cache_store adds the given entry to the cache file, replacing any
+ * previous entry for the same program and argument. Failing to write the
+ * cache is not an error, the next command will run the program again.
+ */
+static void
+probe_cache_store(const char *filename, ProbeCacheKey *key, const char *output)
+{
+	char *contents = NULL;
+	long fileSize = 0;
+	char *lines[PROBE_CACHE_MAX_ENTRIES];
+	int lineCount = 0;
+
+	PQExpBuffer buffer = createPQExpBuffer();
+
+	if (buffer == NULL)
+	{
+		log_debug("Failed to allocate memory for the probe cache");
+		return;
+	}
+
+	appendPQExpBuffer(buffer, "%s\t%s\t%" PRId64 "\t%" PRId64 "\t%s\n",
+					  key->program, key->arg, key->mtime, key->size, output);
+
+	if (file_exists(filename) &&
+		read_file_if_exists(filename, &contents, &fileSize))
+	{
+		lineCount = splitLines(contents, lines, PROBE_CACHE_MAX_ENTRIES);
+	}
+
+	/* keep the other entries, up to our maximum number of entries */
+	for (int i = 0; i < lineCount && i < PROBE_CACHE_MAX_ENTRIES - 1; i++)
+	{
+		char program[MAXPGPATH] = { 0 };
+		char arg[BUFSIZE] = { 0 };
+
+		/* skip previous entries for the same program and argument */
+		if (sscanf(lines[i], "%1023[^\t]\t%1023[^\t]", program, arg) == 2 &&
+			strcmp(program, key->program) == 0 &&
+			strcmp(arg, key->arg) == 0)
+		{
+			continue;
+		}
+
+		appendPQExpBuffer(buffer, "%s\n", lines[i]);
+	}
+
+	if (contents != NULL)
+	{
+		free(contents);
+	}
+
+	if (PQExpBufferBroken(buffer) ||
+		!write_file_atomic(buffer->data, buffer->len, filename))
+	{
+		log_debug("Failed to write the probe cache file \"%s\"", filename);
+	}
+
+	destroyPQExpBuffer(buffer);
+}
+
+
+/*
+ * probe_cache_entry_matches parses a cache file line in place, and returns
+ * true when it matches the given key, setting output to the cached output.
+ */
+static bool
+probe_cache_entry_matches(char *line, ProbeCacheKey *key, char **output)
+{
+	char *fields[5] = { 0 };
+	char *ptr = line;
+	int64_t mtime = 0;
+	int64_t size = 0;
+
+	for (int i = 0; i < 4; i++)
+	{
+		char *tab = strchr(ptr, '\t');
+
+		if (tab == NULL)
+		{
+			return false;
+		}
+
+		*tab = '\0';
+		fields[i] = ptr;
+		ptr = tab + 1;
+	}
+	fields[4] = ptr;
+
+	if (strcmp(fields[0], key->program) != 0 ||
+		strcmp(fields[1], key->arg) != 0 ||
+		!stringToInt64(fields[2], &mtime) ||
+		!stringToInt64(fields[3], &size))
+	{
+		return false;
+	}
+
+	if (mtime != key->mtime || size != key->size)
+	{
+		return false;
+	}
+
+	*output = fields[4];
+
+	return true;
+}
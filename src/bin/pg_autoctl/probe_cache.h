@@ -0,0 +1,22 @@
+/*
+ * src/bin/pg_autoctl/probe_cache.h
+ *     Cache the output of the Postgres binaries we probe, such as
+ *     pg_ctl --version and pg_config --bindir.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#ifndef PROBE_CACHE_H
+#define PROBE_CACHE_H
+
+#include <stdbool.h>
+
+#define PROBE_CACHE_FILENAME "probes.cache"
+#define PROBE_CACHE_MAX_ENTRIES 64
+
+bool probe_cache_run(const char *program, const char *arg,
+					 char *output, size_t size);
+
+#endif /* PROBE_CACHE_H */
@@ -20,17 +20,21 @@
 #include "fsm.h"
 #include "keeper.h"
 #include "keeper_config.h"
+#include "keeper_metrics.h"
 #include "keeper_pg_init.h"
+#include "keeper_profile.h"
 #include "log.h"
 #include "monitor.h"
 #include "pgctl.h"
 #include "pidfile.h"
 #include "service_keeper.h"
+#include "service_metrics.h"
 #include "service_postgres_ctl.h"
 #include "signals.h"
 #include "state.h"
 #include "string_utils.h"
 #include "supervisor.h"
+#include "systemd_notify.h"
 
 #include "runprogram.h"
 
@@ -49,18 +53,44 @@ KeeperReloadFunction *KeeperReloadHooks = KeeperReloadHooksArray;
 KeeperNodesArrayRefreshFunction KeeperNodesArrayRefreshArray[] = {
 	&keeper_refresh_hba,
 	&keeper_refresh_citus_remove_dropped_nodes,
+	&keeper_refresh_topology,
 	NULL
 };
 
 KeeperNodesArrayRefreshFunction *KeeperRefreshHooks =
 	KeeperNodesArrayRefreshArray;
 
+/* list of hooks to run when the node becomes primary or stops being one */
+KeeperRoleChangeFunction KeeperRoleChangeHooksArray[] = {
+	&keeper_role_change_run_command,
+	&keeper_role_change_pgbouncer,
+	NULL
+};
+
+KeeperRoleChangeFunction *KeeperRoleChangeHooks = KeeperRoleChangeHooksArray;
+
 
 static bool service_keeper_node_active(Keeper *keeper, bool doInit);
+static int service_keeper_polling_interval(Keeper *keeper);
+static void service_keeper_startup_phase(Keeper *keeper, const char *name,
+										 instr_time phaseStartTime);
+static void service_keeper_startup_ready(Keeper *keeper);
+static bool service_keeper_in_monitor_backoff(Keeper *keeper);
+static void service_keeper_monitor_backoff(Keeper *keeper, bool success);
 static void check_for_network_partitions(Keeper *keeper);
+static void service_keeper_renew_lease(Keeper *keeper,
+									   MonitorAssignedState *assignedState,
+									   instr_time startTime);
+static void service_keeper_check_lease(Keeper *keeper);
+static int service_keeper_lease_call_timeout(Keeper *keeper, int callTimeoutMs);
 static bool is_network_healthy(Keeper *keeper);
 static bool in_network_partition(KeeperStateData *keeperState, uint64_t now,
 								 int networkPartitionTimeout);
+static void service_keeper_notify_systemd(Keeper *keeper,
+										  bool couldContactMonitorThisRound,
+										  bool *notifiedReady,
+										  NodeState *notifiedCurrentRole,
+										  NodeState *notifiedAssignedRole);
 
 
 /*
@@ -70,7 +100,8 @@ static bool in_network_partition(KeeperStateData *keeperState, uint64_t now,
 bool
 start_keeper(Keeper *keeper)
 {
-	const char *pidfile = keeper->config.pathnames.pid;
+	KeeperConfig *config = &(keeper->config);
+	const char *pidfile = config->pathnames.pid;
 
 	Service subprocesses[] = {
 		{
@@ -85,11 +116,41 @@ start_keeper(Keeper *keeper)
 			-1,
 			&service_keeper_start,
 			(void *) keeper
+		},
+		{
+			SERVICE_NAME_METRICS,
+			RP_PERMANENT,
+			-1,
+			&service_metrics_start,
+			(void *) keeper
 		}
 	};
 
 	int subprocessesCount = sizeof(subprocesses) / sizeof(subprocesses[0]);
 
+	/* the supervisor backs off when a service keeps crashing */
+	subprocesses[0].backoff = config->postgres_restart;
+	subprocesses[1].backoff = config->node_active_restart;
+
+	/* the supervisor also applies the scheduling of the node-active service */
+	subprocesses[1].scheduling = config->node_active_scheduling;
+
+	/*
+	 * The node-active process maintains the metrics file, which is also read
+	 * by pg_autoctl status --fast, so we reset it at each start. The metrics
+	 * HTTP service is optional, and it is the last entry of our array.
+	 */
+	if (!keeper_metrics_create(config->pathnames.metrics))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (config->metrics_port <= 0)
+	{
+		--subprocessesCount;
+	}
+
 	return supervisor_start(subprocesses, subprocessesCount, pidfile);
 }
 
@@ -208,6 +269,11 @@ service_keeper_node_active_init(Keeper *keeper)
 	bool pgIsNotRunningIsOk = true;
 	bool monitorDisabledIsOk = true;
 
+	instr_time phaseStartTime;
+
+	INSTR_TIME_SET_CURRENT(keeper->startupProfile.startTime);
+	phaseStartTime = keeper->startupProfile.startTime;
+
 	if (!keeper_config_read_file(config,
 								 missingPgdataIsOk,
 								 pgIsNotRunningIsOk,
@@ -217,6 +283,8 @@ service_keeper_node_active_init(Keeper *keeper)
 		exit(EXIT_CODE_BAD_CONFIG);
 	}
 
+	(void) service_keeper_startup_phase(keeper, "setup", phaseStartTime);
+
 	/*
 	 * Check that the init is finished. This function is called from
 	 * cli_service_run when used in the CLI `pg_autoctl run`, and the
@@ -234,12 +302,16 @@ service_keeper_node_active_init(Keeper *keeper)
 		}
 	}
 
+	INSTR_TIME_SET_CURRENT(phaseStartTime);
+
 	if (!keeper_init(keeper, config))
 	{
 		log_fatal("Failed to initialize keeper, see above for details");
 		exit(EXIT_CODE_PGCTL);
 	}
 
+	(void) service_keeper_startup_phase(keeper, "init", phaseStartTime);
+
 	return true;
 }
 
@@ -266,8 +338,51 @@ keeper_node_active_loop(Keeper *keeper, pid_t start_pid)
 
 	bool nodeHasBeenDroppedFromTheMonitor = false;
 
+	/*
+	 * With startup.fast_start, when our previous run passed the startup
+	 * checks with the same binaries and configuration files, we defer those
+	 * checks until we have reported to the monitor once.
+	 */
+	bool deferStartupChecks =
+		config->startup_fast_start &&
+		!config->monitorDisabled &&
+		keeper_startup_cache_is_valid(keeper);
+
+	instr_time phaseStartTime;
+
+	uint64_t loopCount = 0;
+
+	bool notifiedSystemdReady = false;
+	NodeState notifiedCurrentRole = NO_STATE;
+	NodeState notifiedAssignedRole = NO_STATE;
+
 	log_debug("pg_autoctl service is starting");
 
+	/* we don't know yet if our group is stable */
+	(void) group_transitions_reset(&(keeper->groupTransitions));
+	keeper->pollingIntervalMs = PG_AUTOCTL_KEEPER_SLEEP_TIME * 1000;
+
+	/* memory locks are not inherited, we have to lock our own memory */
+	if (config->node_active_scheduling.lockMemory)
+	{
+		if (lock_process_memory())
+		{
+			log_info("Locked the memory of the pg_autoctl node-active process");
+		}
+		else
+		{
+			log_warn("Failed to lock the memory of the pg_autoctl node-active "
+					 "process, continuing without");
+		}
+	}
+
+	/* when the metrics service is enabled, maintain the keeper metrics */
+	if (keeper_metrics_attach(config->pathnames.metrics))
+	{
+		(void) keeper_metrics_record_service_start(
+			KEEPER_METRICS_SERVICE_NODE_ACTIVE);
+	}
+
 	/* setup our monitor client connection with our notification handler */
 	(void) monitor_setup_notifications(monitor,
 									   keeperState->current_group,
@@ -283,12 +398,20 @@ keeper_node_active_loop(Keeper *keeper, pid_t start_pid)
 	{
 		bool dropped = false;
 
+		INSTR_TIME_SET_CURRENT(phaseStartTime);
+
+		/* when our formation moved to another monitor, we're not dropped */
+		(void) keeper_follow_formation_directory(keeper);
+
 		if (!keeper_ensure_node_has_been_dropped(keeper, &dropped))
 		{
 			/* errors have already been logged */
 			return false;
 		}
 
+		(void) service_keeper_startup_phase(keeper, "dropped check",
+											phaseStartTime);
+
 		if (dropped)
 		{
 			/* signal that it's time to shutdown everything */
@@ -318,39 +441,80 @@ keeper_node_active_loop(Keeper *keeper, pid_t start_pid)
 		 * same, and this didn't change in the previous loop), then we can
 		 * sleep for a while. As the monitor notifies every state change, we
 		 * can also interrupt our sleep as soon as we get the hint.
+		 *
+		 * The notification connection is kept open from one iteration to the
+		 * next, so that the notifications sent while we are busy talking to
+		 * the monitor or to Postgres are waiting for us on the socket, and
+		 * wake us up as soon as we wait again.
 		 */
-		if (doSleep && !config->monitorDisabled)
+		if (doSleep &&
+			!config->monitorDisabled &&
+			!service_keeper_in_monitor_backoff(keeper))
 		{
-			int timeoutMs = PG_AUTOCTL_KEEPER_SLEEP_TIME * 1000;
+			int timeoutMs = service_keeper_polling_interval(keeper);
 
 			bool groupStateHasChanged = false;
 
+			instr_time sleepStartTime;
+
+			INSTR_TIME_SET_CURRENT(sleepStartTime);
+
 			/* establish a connection for notifications if none present */
-			(void) pgsql_prepare_to_wait(&(monitor->notificationClient));
-			(void) monitor_wait_for_state_change(monitor,
-												 config->formation,
-												 keeperState->current_group,
-												 keeperState->current_node_id,
-												 timeoutMs,
-												 &groupStateHasChanged);
-
-			/* when no state change has been notified, close the connection */
-			if (!groupStateHasChanged &&
-				monitor->notificationClient.connectionStatementType ==
-				PGSQL_CONNECTION_MULTI_STATEMENT)
+			(void) pgsql_prepare_to_wait(monitor_notification_client(monitor));
+
+			if (!monitor_wait_for_group_state_change(
+					monitor,
+					config->formation,
+					keeperState->current_group,
+					keeperState->current_node_id,
+					timeoutMs,
+					&(keeper->groupTransitions),
+					&groupStateHasChanged) &&
+				!(asked_to_stop || asked_to_stop_fast ||
+				  asked_to_reload || asked_to_quit))
 			{
-				pgsql_finish(&(monitor->notificationClient));
+				/* we lost the connection, open a new one next time */
+				pgsql_finish(monitor_notification_client(monitor));
+
+				/* and we might have missed some notifications */
+				(void) group_transitions_reset(&(keeper->groupTransitions));
 			}
+
+			(void) keeper_metrics_record_wakeup(sleepStartTime, timeoutMs);
 		}
-		else if (doSleep && config->monitorDisabled)
+		else if (doSleep)
 		{
 			int timeoutUs = PG_AUTOCTL_KEEPER_SLEEP_TIME * 1000 * 1000;
 
+			instr_time sleepStartTime;
+
+			INSTR_TIME_SET_CURRENT(sleepStartTime);
+
 			pg_usleep(timeoutUs);
+
+			(void) keeper_metrics_record_wakeup(sleepStartTime, timeoutUs / 1000);
 		}
 
 		doSleep = true;
 
+		instr_time loopStartTime;
+
+		INSTR_TIME_SET_CURRENT(loopStartTime);
+
+		/* pg_autoctl do profile signals us with SIGUSR1 */
+		KeeperProfileMark loopMark = { 0 };
+		KeeperProfileMark mark = { 0 };
+
+		(void) keeper_profile_maintain(config->pathnames.pid);
+		(void) keeper_profile_begin(&loopMark);
+
+		/* JSON log lines of the same round share a correlation id */
+		char correlationId[LOG_CORRELATION_ID_SIZE] = { 0 };
+
+		sformat(correlationId, sizeof(correlationId),
+				"%d-%" PRIu64, getpid(), ++loopCount);
+		(void) log_set_correlation_id(correlationId);
+
 		/*
 		 * Handle signals.
 		 *
@@ -362,9 +526,25 @@ keeper_node_active_loop(Keeper *keeper, pid_t start_pid)
 		 * signaled to us and from where we can immediately exit whatever we're
 		 * doing. It's important to avoid e.g. leaving state.new files behind.
 		 */
-		if (asked_to_reload || firstLoop)
+		if (firstLoop && deferStartupChecks)
+		{
+			log_info("Deferring the startup checks that passed in the "
+					 "previous run until the first call to the monitor");
+		}
+		else if (asked_to_reload || firstLoop)
 		{
+			INSTR_TIME_SET_CURRENT(phaseStartTime);
+			(void) keeper_profile_begin(&mark);
+
 			(void) keeper_call_reload_hooks(keeper, firstLoop, doInit);
+
+			(void) keeper_profile_end(KEEPER_PROFILE_PHASE_RELOAD, &mark);
+
+			if (firstLoop)
+			{
+				(void) service_keeper_startup_phase(keeper, "configuration",
+													phaseStartTime);
+			}
 		}
 
 		if (asked_to_stop || asked_to_stop_fast || asked_to_quit)
@@ -403,11 +583,31 @@ keeper_node_active_loop(Keeper *keeper, pid_t start_pid)
 					 NodeStateToString(keeperState->current_role));
 		}
 
+		/*
+		 * The monitor call reports what we find in the local Postgres, so it
+		 * has to wait for our local checks. Connecting to the monitor does
+		 * not: start the connection now without waiting, and make its
+		 * handshakes progress in between our local queries. Then node_active
+		 * only waits for what remains of the connection, and the round trip.
+		 */
+		if (!config->monitorDisabled &&
+			!service_keeper_in_monitor_backoff(keeper))
+		{
+			(void) pgsql_start_connection(&(keeper->monitor.pgsql));
+		}
+
 		/*
 		 * Check for any changes in the local PostgreSQL instance, and update
 		 * our in-memory values for the replication WAL lag and sync_state.
 		 */
-		if (!keeper_update_pg_state(keeper, LOG_WARN))
+		INSTR_TIME_SET_CURRENT(phaseStartTime);
+		(void) keeper_profile_begin(&mark);
+
+		bool updatedPgState = keeper_update_pg_state(keeper, LOG_WARN);
+
+		(void) keeper_profile_end(KEEPER_PROFILE_PHASE_POSTGRES, &mark);
+
+		if (!updatedPgState)
 		{
 			warnedOnCurrentIteration = true;
 			log_warn("Failed to update the keeper's state from the local "
@@ -420,6 +620,12 @@ keeper_node_active_loop(Keeper *keeper, pid_t start_pid)
 					 postgres->pgIsRunning ? "running" : "not running");
 		}
 
+		if (firstLoop)
+		{
+			(void) service_keeper_startup_phase(keeper, "postgres",
+												phaseStartTime);
+		}
+
 		CHECK_FOR_FAST_SHUTDOWN;
 
 		/*
@@ -450,9 +656,20 @@ keeper_node_active_loop(Keeper *keeper, pid_t start_pid)
 		 */
 		else
 		{
+			INSTR_TIME_SET_CURRENT(phaseStartTime);
+			(void) keeper_profile_begin(&mark);
+
 			couldContactMonitorThisRound =
 				service_keeper_node_active(keeper, doInit);
 
+			(void) keeper_profile_end(KEEPER_PROFILE_PHASE_NODE_ACTIVE, &mark);
+
+			if (firstLoop)
+			{
+				(void) service_keeper_startup_phase(keeper, "node_active",
+													phaseStartTime);
+			}
+
 			if (!couldContactMonitor &&
 				couldContactMonitorThisRound &&
 				!firstLoop)
@@ -470,6 +687,9 @@ keeper_node_active_loop(Keeper *keeper, pid_t start_pid)
 			couldContactMonitor = couldContactMonitorThisRound;
 		}
 
+		/* log lines of a transition carry the trace id of its decision */
+		(void) keeper_update_trace_id(keeper);
+
 		if (keeperState->assigned_role != keeperState->current_role)
 		{
 			needStateChange = true;
@@ -515,7 +735,14 @@ keeper_node_active_loop(Keeper *keeper, pid_t start_pid)
 			 */
 			if (keeper_should_ensure_current_state_before_transition(keeper))
 			{
-				if (!keeper_ensure_current_state(keeper))
+				(void) keeper_profile_begin(&mark);
+
+				bool ensured = keeper_ensure_current_state(keeper);
+
+				(void) keeper_profile_end(KEEPER_PROFILE_PHASE_ENSURE_STATE,
+										  &mark);
+
+				if (!ensured)
 				{
 					/*
 					 * We don't take care of the warnedOnCurrentIteration here
@@ -531,6 +758,10 @@ keeper_node_active_loop(Keeper *keeper, pid_t start_pid)
 				}
 			}
 
+			NodeState previousRole = keeperState->current_role;
+
+			(void) keeper_profile_begin(&mark);
+
 			if (!keeper_fsm_reach_assigned_state(keeper))
 			{
 				log_error("Failed to transition to state \"%s\", retrying... ",
@@ -538,10 +769,23 @@ keeper_node_active_loop(Keeper *keeper, pid_t start_pid)
 
 				transitionFailed = true;
 			}
+			else
+			{
+				/* make client connections follow the primary right away */
+				(void) keeper_call_role_change_hooks(keeper, previousRole);
+			}
+
+			(void) keeper_profile_end(KEEPER_PROFILE_PHASE_TRANSITION, &mark);
 		}
 		else if (couldContactMonitor || config->monitorDisabled)
 		{
-			if (!keeper_ensure_current_state(keeper))
+			(void) keeper_profile_begin(&mark);
+
+			bool ensured = keeper_ensure_current_state(keeper);
+
+			(void) keeper_profile_end(KEEPER_PROFILE_PHASE_ENSURE_STATE, &mark);
+
+			if (!ensured)
 			{
 				warnedOnCurrentIteration = true;
 				log_warn("pg_autoctl failed to ensure current state \"%s\": "
@@ -556,10 +800,75 @@ keeper_node_active_loop(Keeper *keeper, pid_t start_pid)
 						 NodeStateToString(keeperState->current_role),
 						 postgres->pgIsRunning ? "is" : "is not");
 			}
+
+			(void) keeper_profile_begin(&mark);
+
+			/* failing to report our network latency is not critical */
+			if (couldContactMonitor && !keeper_maintain_latency(keeper))
+			{
+				log_warn("Failed to report network latency to the monitor, "
+						 "retrying in %ds", config->latency_interval);
+			}
+
+			/* failing to report our health signals is not critical either */
+			if (couldContactMonitor && !keeper_maintain_health_signals(keeper))
+			{
+				log_warn("Failed to report health signals to the monitor, "
+						 "retrying in %ds", config->health_signals_interval);
+			}
+
+			/* nor is failing to report our load */
+			if (couldContactMonitor && !keeper_maintain_load(keeper))
+			{
+				log_warn("Failed to report load to the monitor, "
+						 "retrying in %ds", config->load_interval);
+			}
+
+			/* and a stale checkpoint tuning is not critical either */
+			if (couldContactMonitor && !keeper_maintain_recovery_target(keeper))
+			{
+				log_warn("Failed to tune checkpoints for the formation "
+						 "recovery target, retrying in %ds",
+						 RECOVERY_TUNING_INTERVAL);
+			}
+
+			/* the WAL retention budget is checked again in a while */
+			if (couldContactMonitor && !keeper_maintain_slot_retention(keeper))
+			{
+				log_warn("Failed to report the WAL retained by replication "
+						 "slots, retrying in %ds",
+						 SLOT_RETENTION_INTERVAL);
+			}
+
+			/* a WAL stream compressed a little late is fine too */
+			if (couldContactMonitor && !keeper_maintain_wal_compression(keeper))
+			{
+				log_warn("Failed to apply the wal_compression policy of "
+						 "the formation, retrying in %ds",
+						 WAL_COMPRESSION_INTERVAL);
+			}
+
+			/* the fleet inventory can wait for the next round too */
+			if (couldContactMonitor && !keeper_maintain_inventory(keeper))
+			{
+				log_warn("Failed to report the node inventory to the "
+						 "monitor, retrying in %ds",
+						 NODE_INVENTORY_INTERVAL);
+			}
+
+			(void) keeper_profile_end(KEEPER_PROFILE_PHASE_MEASUREMENTS, &mark);
 		}
 
-		/* now is a good time to make sure we're closing our connections */
-		pgsql_finish(&(postgres->sqlClient));
+		/*
+		 * We keep our local Postgres connection open for the next round, see
+		 * keeper_update_pg_state(), unless a transition used it in another
+		 * mode.
+		 */
+		if (postgres->sqlClient.connectionStatementType !=
+			PGSQL_CONNECTION_PERSISTENT)
+		{
+			pgsql_finish(&(postgres->sqlClient));
+		}
 
 		CHECK_FOR_FAST_SHUTDOWN;
 
@@ -573,6 +882,8 @@ keeper_node_active_loop(Keeper *keeper, pid_t start_pid)
 		 * When the monitor is disabled, only write the state to disk when we
 		 * just successfully implemented a state change.
 		 */
+		(void) keeper_profile_begin(&mark);
+
 		if (!config->monitorDisabled || (needStateChange && !transitionFailed))
 		{
 			if (!keeper_store_state(keeper))
@@ -581,6 +892,15 @@ keeper_node_active_loop(Keeper *keeper, pid_t start_pid)
 			}
 		}
 
+		/* our own role is part of the topology snapshot */
+		if (needStateChange && !transitionFailed)
+		{
+			(void) keeper_refresh_topology(keeper, &(keeper->otherNodes), false);
+		}
+
+		(void) keeper_profile_end(KEEPER_PROFILE_PHASE_STATE_WRITE, &mark);
+		(void) keeper_profile_loop_end(&loopMark);
+
 		/*
 		 * If the node has been dropped, we exit the process... after having
 		 * done at least another round where we could contact the monitor to
@@ -619,6 +939,32 @@ keeper_node_active_loop(Keeper *keeper, pid_t start_pid)
 			firstLoop = false;
 		}
 
+		if (couldContactMonitorThisRound || config->monitorDisabled)
+		{
+			(void) service_keeper_startup_ready(keeper);
+		}
+
+		/*
+		 * Now that the monitor knows about us, run the startup checks that we
+		 * have deferred, as on the first round of a normal start.
+		 */
+		if (deferStartupChecks && couldContactMonitorThisRound)
+		{
+			INSTR_TIME_SET_CURRENT(phaseStartTime);
+
+			(void) keeper_call_reload_hooks(keeper, true, true);
+
+			instr_time duration;
+
+			INSTR_TIME_SET_CURRENT(duration);
+			INSTR_TIME_SUBTRACT(duration, phaseStartTime);
+
+			log_info("Ran the deferred startup checks in %d ms",
+					 (int) INSTR_TIME_GET_MILLISEC(duration));
+
+			deferStartupChecks = false;
+		}
+
 		/* if we failed to contact the monitor, we must re-try the init steps */
 		if (doInit && couldContactMonitorThisRound)
 		{
@@ -646,6 +992,18 @@ keeper_node_active_loop(Keeper *keeper, pid_t start_pid)
 			(void) keeper_call_reload_hooks(keeper, firstLoop, doInit);
 		}
 
+		(void) keeper_metrics_record_loop(keeper, loopStartTime);
+
+		/* report our progress to systemd when using Type=notify */
+		(void) service_keeper_notify_systemd(keeper,
+											 couldContactMonitorThisRound,
+											 &notifiedSystemdReady,
+											 &notifiedCurrentRole,
+											 &notifiedAssignedRole);
+
+		/* write out buffered log lines, if any, at the end of each round */
+		(void) log_flush();
+
 		/* advance the warnings "counters" */
 		if (warnedOnPreviousIteration)
 		{
@@ -662,6 +1020,7 @@ keeper_node_active_loop(Keeper *keeper, pid_t start_pid)
 	/* One last check that we do not have any connections open */
 	pgsql_finish(&(keeper->monitor.pgsql));
 	pgsql_finish(&(monitor->notificationClient));
+	pgsql_finish(&(postgres->sqlClient));
 
 	if (nodeHasBeenDroppedFromTheMonitor)
 	{
@@ -690,22 +1049,125 @@ service_keeper_node_active(Keeper *keeper, bool doInit)
 	KeeperStateData *keeperState = &(keeper->state);
 
 	MonitorAssignedState assignedState = { 0 };
+	NodeAddressArray otherNodesArray = { 0 };
+	bool otherNodesOK = false;
 
 	uint64_t now = time(NULL);
 
+	instr_time startTime;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	(void) service_keeper_check_lease(keeper);
+
+	/* wait some more before calling the monitor again after a failure */
+	if (service_keeper_in_monitor_backoff(keeper))
+	{
+		log_debug("Waiting for %d ms after %d failed calls to the monitor",
+				  keeper->monitorBackoff.sleepTime,
+				  keeper->monitorBackoff.attempts);
+
+		(void) check_for_network_partitions(keeper);
+
+		return false;
+	}
+
+	/*
+	 * With monitor.single_connection, we wait for notifications on the same
+	 * connection that we use for queries, which we then keep open, and close
+	 * the notification connection if we had one before a reload.
+	 */
+	keeper->monitor.singleConnection = config->monitor_single_connection;
+
+	if (keeper->monitor.singleConnection)
+	{
+		pgsql_finish(&(keeper->monitor.notificationClient));
+	}
+
+	/*
+	 * With monitor.keepalive, the connection to the monitor is kept open from
+	 * one call to the next, which saves a TCP and TLS handshake per call.
+	 * pgsql_finish() resets the connection mode, so we set it at each round.
+	 */
+	if (config->monitor_keepalive || config->monitor_single_connection)
+	{
+		keeper->monitor.pgsql.connectionStatementType =
+			PGSQL_CONNECTION_PERSISTENT;
+	}
+	else if (keeper->monitor.pgsql.connectionStatementType ==
+			 PGSQL_CONNECTION_PERSISTENT)
+	{
+		pgsql_finish(&(keeper->monitor.pgsql));
+	}
+
+	/*
+	 * With monitor.call_timeout, we stop waiting for a call to the monitor
+	 * that takes too long, such as when node_active waits for a lock held by
+	 * another operation, and cancel it. The call then fails as when we can't
+	 * contact the monitor, and the keeper goes on with its loop.
+	 *
+	 * When our primary holds a lease, the call is also bounded by what
+	 * remains of the lease, see service_keeper_lease_call_timeout.
+	 */
+	keeper->monitor.pgsql.statementTimeoutMs =
+		service_keeper_lease_call_timeout(
+			keeper,
+			config->monitor_call_timeout > 0
+			? config->monitor_call_timeout * 1000 : 0);
+
+	/*
+	 * Lock waits give up after half of that time, when the monitor is busy
+	 * with another operation such as an update of its extension. The monitor
+	 * then answers with a lock_not_available error that we retry at the next
+	 * round, and the connection remains usable.
+	 */
+	keeper->monitor.pgsql.lockTimeoutMs =
+		keeper->monitor.pgsql.statementTimeoutMs / 2;
+
 	/*
 	 * Report the current state to the monitor and get the assigned state.
+	 * When we don't know the topology version of our list of other nodes yet,
+	 * also fetch the other nodes in the same round trip, unless we are being
+	 * dropped.
 	 */
-	if (!keeper_node_active(keeper, doInit, &assignedState))
+	bool fetchOtherNodes =
+		keeperState->current_role != DROPPED_STATE &&
+		!keeper->otherNodesVersionKnown;
+
+	bool nodeActiveOK =
+		fetchOtherNodes
+		? keeper_node_active_get_other_nodes(keeper, doInit, &assignedState,
+											 &otherNodesArray, &otherNodesOK)
+		: keeper_node_active(keeper, doInit, &assignedState);
+
+	(void) keeper_metrics_record_node_active(keeper, startTime, nodeActiveOK);
+	(void) service_keeper_monitor_backoff(keeper, nodeActiveOK);
+
+	if (!nodeActiveOK)
 	{
 		log_error("Failed to get the goal state from the monitor");
 
+		/*
+		 * When the monitor is reachable but doesn't know about our node
+		 * anymore, our formation might have moved to another monitor, that
+		 * we call at the next round.
+		 */
+		if (keeper->monitor.pgsql.status == PG_CONNECTION_OK &&
+			keeper_follow_formation_directory(keeper))
+		{
+			nodeAddressArrayFree(&otherNodesArray);
+
+			return false;
+		}
+
 		/*
 		 * Check whether we're likely to be in a network partition.
 		 * That will cause the assigned_role to become demoted.
 		 */
 		(void) check_for_network_partitions(keeper);
 
+		nodeAddressArrayFree(&otherNodesArray);
+
 		return false;
 	}
 
@@ -714,6 +1176,9 @@ service_keeper_node_active(Keeper *keeper, bool doInit)
 	 */
 	keeperState->last_monitor_contact = now;
 	keeperState->assigned_role = assignedState.state;
+	keeper->goalTraceId = assignedState.traceId;
+
+	(void) service_keeper_renew_lease(keeper, &assignedState, startTime);
 
 	if (keeperState->assigned_role != keeperState->current_role)
 	{
@@ -726,21 +1191,57 @@ service_keeper_node_active(Keeper *keeper, bool doInit)
 	if (keeperState->current_role == DROPPED_STATE &&
 		keeperState->current_role == keeperState->assigned_role)
 	{
+		nodeAddressArrayFree(&otherNodesArray);
+
 		return true;
 	}
 
 	bool forceCacheInvalidation = false;
 
-	if (!keeper_refresh_other_nodes(keeper, forceCacheInvalidation))
+	/*
+	 * The monitor returns a version of the topology of our group, that
+	 * changes when nodes are added or removed, change address, or start or
+	 * stop taking writes. Only fetch the list of other nodes again when that
+	 * version moved.
+	 */
+	if (keeper->otherNodesVersionKnown &&
+		keeper->otherNodesVersion == assignedState.topologyVersion)
+	{
+		otherNodesOK = true;
+	}
+	else if (!fetchOtherNodes)
+	{
+		otherNodesOK = keeper_refresh_other_nodes(keeper, forceCacheInvalidation);
+	}
+	else if (otherNodesOK)
+	{
+		otherNodesOK = keeper_call_refresh_hooks(keeper,
+												 &otherNodesArray,
+												 forceCacheInvalidation);
+
+		if (otherNodesOK)
+		{
+			(void) nodeAddressArrayMove(&(keeper->otherNodes), &otherNodesArray);
+		}
+	}
+
+	nodeAddressArrayFree(&otherNodesArray);
+
+	if (!otherNodesOK)
 	{
 		/*
 		 * We have a new MD5 but failed to update our list, try again next
 		 * round, the monitor might be restarting or something.
 		 */
 		log_error("Failed to update our list of other nodes");
+
+		keeper->otherNodesVersionKnown = false;
 		return false;
 	}
 
+	keeper->otherNodesVersion = assignedState.topologyVersion;
+	keeper->otherNodesVersionKnown = true;
+
 	/*
 	 * Also update the groupId and replication slot name in the
 	 * configuration file.
@@ -779,15 +1280,439 @@ service_keeper_node_active(Keeper *keeper, bool doInit)
 }
 
 
+/*
+ * service_keeper_startup_phase records how long a phase of our startup took,
+ * until we are ready.
+ */
+static void
+service_keeper_startup_phase(Keeper *keeper, const char *name,
+							 instr_time phaseStartTime)
+{
+	KeeperStartupProfile *profile = &(keeper->startupProfile);
+
+	if (profile->reported || profile->phaseCount >= KEEPER_STARTUP_MAX_PHASES)
+	{
+		return;
+	}
+
+	instr_time duration;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, phaseStartTime);
+
+	KeeperStartupPhase *phase = &(profile->phases[profile->phaseCount++]);
+
+	phase->name = name;
+	phase->durationMs = (int) INSTR_TIME_GET_MILLISEC(duration);
+
+	log_debug("Startup phase \"%s\" took %d ms", name, phase->durationMs);
+}
+
+
+/*
+ * service_keeper_startup_ready logs how long it took from the start of the
+ * node-active service until our first successful call to the monitor, and
+ * how long each phase of the startup took, once.
+ */
+static void
+service_keeper_startup_ready(Keeper *keeper)
+{
+	KeeperStartupProfile *profile = &(keeper->startupProfile);
+	char phases[BUFSIZE] = { 0 };
+	int len = 0;
+
+	if (profile->reported)
+	{
+		return;
+	}
+
+	profile->reported = true;
+
+	for (int i = 0; i < profile->phaseCount; i++)
+	{
+		KeeperStartupPhase *phase = &(profile->phases[i]);
+
+		len += sformat(phases + len, sizeof(phases) - len, "%s%s %d ms",
+					   i == 0 ? "" : ", ",
+					   phase->name,
+					   phase->durationMs);
+
+		if (len >= sizeof(phases))
+		{
+			break;
+		}
+	}
+
+	instr_time duration;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, profile->startTime);
+
+	log_info("pg_autoctl service is ready after %d ms (%s)",
+			 (int) INSTR_TIME_GET_MILLISEC(duration),
+			 phases);
+}
+
+
+/*
+ * service_keeper_polling_interval returns how long to wait for notifications
+ * from the monitor before the next round of the keeper main loop.
+ *
+ * While any node of our group has a goal state that differs from its reported
+ * state, we use a tight interval, so that the monitor gets our reports as
+ * fast as possible during a failover. Once the group has been stable for a
+ * while, and the notifications connection is healthy, we back off to a longer
+ * interval: the monitor wakes us up with a notification on every state
+ * change anyway, and idle nodes then call the monitor less often.
+ *
+ * The longest interval is kept well below the network partition timeout,
+ * which is computed from our last contact with the monitor.
+ */
+static int
+service_keeper_polling_interval(Keeper *keeper)
+{
+	KeeperConfig *config = &(keeper->config);
+	KeeperStateData *keeperState = &(keeper->state);
+	GroupTransitions *transitions = &(keeper->groupTransitions);
+
+	int baseIntervalMs = PG_AUTOCTL_KEEPER_SLEEP_TIME * 1000;
+	int maxIntervalMs = PG_AUTOCTL_KEEPER_MAX_SLEEP_TIME_MS;
+	int previousIntervalMs = keeper->pollingIntervalMs;
+
+	uint64_t now = time(NULL);
+
+	bool notificationsAreHealthy =
+		monitor_notification_client(&(keeper->monitor))->connection != NULL;
+
+	if (config->network_partition_timeout > 0 &&
+		config->network_partition_timeout * 1000 / 4 < maxIntervalMs)
+	{
+		maxIntervalMs = config->network_partition_timeout * 1000 / 4;
+	}
+
+	if (config->network_partition_confirmed_timeout > 0 &&
+		config->network_partition_confirmed_timeout * 1000 / 4 < maxIntervalMs)
+	{
+		maxIntervalMs = config->network_partition_confirmed_timeout * 1000 / 4;
+	}
+
+	if (keeperState->current_role != keeperState->assigned_role ||
+		group_transitions_count(transitions,
+								PG_AUTOCTL_KEEPER_TRANSITION_EXPIRY) > 0)
+	{
+		keeper->pollingIntervalMs = PG_AUTOCTL_KEEPER_FAST_SLEEP_TIME_MS;
+	}
+	else if (!notificationsAreHealthy ||
+			 (now - transitions->lastChangeTime) < PG_AUTOCTL_KEEPER_STABLE_TIME)
+	{
+		keeper->pollingIntervalMs = baseIntervalMs;
+	}
+	else
+	{
+		/* the group is stable, double the interval up to the max */
+		keeper->pollingIntervalMs =
+			keeper->pollingIntervalMs < baseIntervalMs
+			? baseIntervalMs
+			: keeper->pollingIntervalMs * 2;
+	}
+
+	if (keeper->pollingIntervalMs > maxIntervalMs)
+	{
+		keeper->pollingIntervalMs =
+			maxIntervalMs > baseIntervalMs ? maxIntervalMs : baseIntervalMs;
+	}
+
+	if (keeper->pollingIntervalMs != previousIntervalMs)
+	{
+		log_debug("Polling the monitor every %dms, "
+				  "%d node(s) of the group are in a transition",
+				  keeper->pollingIntervalMs,
+				  transitions->count);
+	}
+
+	return keeper->pollingIntervalMs;
+}
+
+
+/*
+ * service_keeper_in_monitor_backoff returns true when our last call to the
+ * monitor failed recently enough that we should not call it again yet.
+ */
+static bool
+service_keeper_in_monitor_backoff(Keeper *keeper)
+{
+	ConnectionRetryPolicy *backoff = &(keeper->monitorBackoff);
+
+	if (backoff->attempts == 0)
+	{
+		return false;
+	}
+
+	instr_time elapsed;
+
+	INSTR_TIME_SET_CURRENT(elapsed);
+	INSTR_TIME_SUBTRACT(elapsed, keeper->monitorBackoffTime);
+
+	return INSTR_TIME_GET_MILLISEC(elapsed) < backoff->sleepTime;
+}
+
+
+/*
+ * service_keeper_monitor_backoff updates our backoff of the calls to the
+ * monitor after a call. When the monitor restarts, or refuses calls because
+ * it is busy, every keeper fails at about the same time: rather than all of
+ * them calling again at the next round, they each wait a decorrelated jitter
+ * delay, which grows with the number of failed calls in a row.
+ */
+static void
+service_keeper_monitor_backoff(Keeper *keeper, bool success)
+{
+	ConnectionRetryPolicy *backoff = &(keeper->monitorBackoff);
+
+	if (success)
+	{
+		backoff->attempts = 0;
+		backoff->sleepTime = 0;
+		return;
+	}
+
+	if (backoff->attempts == 0)
+	{
+		(void) pgsql_set_retry_policy(backoff,
+									  0, /* we only use the sleep time */
+									  -1,
+									  PG_AUTOCTL_MONITOR_BACKOFF_CAP_SLEEP_TIME,
+									  PG_AUTOCTL_KEEPER_SLEEP_TIME * 1000);
+	}
+
+	(void) pgsql_compute_connection_retry_sleep_time(backoff);
+
+	INSTR_TIME_SET_CURRENT(keeper->monitorBackoffTime);
+}
+
+
+/*
+ * service_keeper_notify_systemd implements the sd_notify(3) protocol for the
+ * node-active loop, which is a sub-process of the supervisor, hence the
+ * NotifyAccess=all setting of our systemd unit.
+ *
+ * We send READY=1 once, the first time a round of node_active succeeded and
+ * Postgres is running, and then a STATUS= line each time our current or
+ * assigned state changes. WATCHDOG=1 is sent at every round of the loop.
+ */
+static void
+service_keeper_notify_systemd(Keeper *keeper,
+							  bool couldContactMonitorThisRound,
+							  bool *notifiedReady,
+							  NodeState *notifiedCurrentRole,
+							  NodeState *notifiedAssignedRole)
+{
+	KeeperConfig *config = &(keeper->config);
+	KeeperStateData *keeperState = &(keeper->state);
+	LocalPostgresServer *postgres = &(keeper->postgres);
+
+	char status[BUFSIZE] = { 0 };
+
+	(void) systemd_notify_watchdog();
+
+	sformat(status, sizeof(status),
+			"current state: %s, assigned state: %s, Postgres %s running",
+			NodeStateToString(keeperState->current_role),
+			NodeStateToString(keeperState->assigned_role),
+			postgres->pgIsRunning ? "is" : "is not");
+
+	if (!*notifiedReady)
+	{
+		if ((couldContactMonitorThisRound || config->monitorDisabled) &&
+			postgres->pgIsRunning)
+		{
+			if (systemd_notify_ready(status))
+			{
+				*notifiedReady = true;
+				*notifiedCurrentRole = keeperState->current_role;
+				*notifiedAssignedRole = keeperState->assigned_role;
+			}
+		}
+		return;
+	}
+
+	if (*notifiedCurrentRole != keeperState->current_role ||
+		*notifiedAssignedRole != keeperState->assigned_role)
+	{
+		if (systemd_notify_status(status))
+		{
+			*notifiedCurrentRole = keeperState->current_role;
+			*notifiedAssignedRole = keeperState->assigned_role;
+		}
+	}
+}
+
+
+/*
+ * service_keeper_renew_lease keeps track of the primary lease that the monitor
+ * renewed with our last node_active call. The lease starts when we sent the
+ * call, before the monitor received it, so our lease never outlives the one
+ * that the monitor counts.
+ *
+ * The expiry time of the lease is written to the Postgres expected status
+ * file, and the Postgres controller stops Postgres once it has expired. That
+ * check does not depend on this process: a call to the monitor that hangs
+ * can't keep our primary accepting writes past its lease. When the monitor
+ * renews the lease and still wants us to be the primary, the controller
+ * starts Postgres again.
+ */
+static void
+service_keeper_renew_lease(Keeper *keeper,
+						   MonitorAssignedState *assignedState,
+						   instr_time startTime)
+{
+	KeeperStateData *keeperState = &(keeper->state);
+	LocalExpectedPostgresStatus *pgStatus = &(keeper->postgres.expectedPgStatus);
+
+	keeper->leaseDurationMs = assignedState->leaseDurationMs;
+	keeper->leaseStartTime = startTime;
+
+	uint64_t leaseExpiryTimeMs = 0;
+	bool renewed = false;
+
+	if (keeper->leaseDurationMs > 0 &&
+		keeperState->current_role == PRIMARY_STATE)
+	{
+		if (assignedState->state == PRIMARY_STATE)
+		{
+			instr_time duration;
+
+			INSTR_TIME_SET_CURRENT(duration);
+			INSTR_TIME_SUBTRACT(duration, startTime);
+
+			leaseExpiryTimeMs =
+				keeper_postgres_monotonic_ms() -
+				(uint64_t) INSTR_TIME_GET_MILLISEC(duration) +
+				(uint64_t) keeper->leaseDurationMs;
+
+			renewed = true;
+		}
+		else
+		{
+			/* on our way out of the primary role, never extend the lease */
+			leaseExpiryTimeMs = pgStatus->state.leaseExpiryTimeMs;
+		}
+	}
+
+	if (leaseExpiryTimeMs != pgStatus->state.leaseExpiryTimeMs &&
+		!keeper_set_postgres_lease(&(pgStatus->state),
+								   pgStatus->pgStatusPath,
+								   leaseExpiryTimeMs))
+	{
+		/* errors have already been logged */
+		log_error("Failed to record our primary lease");
+		return;
+	}
+
+	if (!keeper->leaseFenced)
+	{
+		return;
+	}
+
+	if (renewed)
+	{
+		log_info("Primary lease renewed by the monitor, "
+				 "Postgres accepts writes again");
+
+		keeper->leaseFenced = false;
+	}
+	else if (keeperState->current_role != PRIMARY_STATE)
+	{
+		/* the FSM takes it from here */
+		keeper->leaseFenced = false;
+	}
+}
+
+
+/*
+ * service_keeper_check_lease logs when the lease that the monitor granted
+ * with our last successful node_active call has expired. The monitor may then
+ * proceed with a failover without waiting for the whole
+ * primary_demote_timeout, and the Postgres controller stops Postgres on its
+ * own, see service_keeper_renew_lease().
+ */
+static void
+service_keeper_check_lease(Keeper *keeper)
+{
+	KeeperStateData *keeperState = &(keeper->state);
+
+	if (keeper->leaseDurationMs <= 0 ||
+		keeper->leaseFenced ||
+		keeperState->current_role != PRIMARY_STATE)
+	{
+		return;
+	}
+
+	instr_time duration;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, keeper->leaseStartTime);
+
+	double elapsedMs = INSTR_TIME_GET_MILLISEC(duration);
+
+	if (elapsedMs < keeper->leaseDurationMs)
+	{
+		return;
+	}
+
+	log_warn("Primary lease of %d ms expired %.0f ms ago, "
+			 "Postgres is being stopped until the monitor renews it",
+			 keeper->leaseDurationMs,
+			 elapsedMs - keeper->leaseDurationMs);
+
+	keeper->leaseFenced = true;
+}
+
+
+/*
+ * service_keeper_lease_call_timeout returns how long we may wait for the
+ * monitor to answer our node_active call, in milliseconds, based on the
+ * given monitor.call_timeout. When our primary holds a lease, a call that
+ * hangs must fail while the lease still runs, so that we can try again, and
+ * we wait for half of the lease at most.
+ *
+ * We use a fixed share of the lease rather than what remains of it, because
+ * changing the statement timeout opens a new connection to the monitor.
+ */
+static int
+service_keeper_lease_call_timeout(Keeper *keeper, int callTimeoutMs)
+{
+	KeeperStateData *keeperState = &(keeper->state);
+
+	if (keeper->leaseDurationMs <= 0 ||
+		keeperState->current_role != PRIMARY_STATE)
+	{
+		return callTimeoutMs;
+	}
+
+	int leaseTimeoutMs = keeper->leaseDurationMs / 2;
+
+	if (callTimeoutMs <= 0 || leaseTimeoutMs < callTimeoutMs)
+	{
+		return leaseTimeoutMs;
+	}
+
+	return callTimeoutMs;
+}
+
+
 /*
  * check_for_network_partitions checks whether we're likely to be in a network
- * partition. That will cause the assigned_role to become demoted.
+ * partition. That will cause the assigned_role to become demoted. When our
+ * primary lease has expired, we also stop accepting writes right away.
  */
 static void
 check_for_network_partitions(Keeper *keeper)
 {
 	KeeperStateData *keeperState = &(keeper->state);
 
+	(void) service_keeper_check_lease(keeper);
+
 	if (keeperState->current_role == PRIMARY_STATE)
 	{
 		log_warn("Checking for network partitions...");
@@ -795,6 +1720,7 @@ check_for_network_partitions(Keeper *keeper)
 		if (!is_network_healthy(keeper))
 		{
 			keeperState->assigned_role = DEMOTE_TIMEOUT_STATE;
+			keeper->goalTraceId = 0;
 
 			log_info("Network in not healthy, switching to state %s",
 					 NodeStateToString(keeperState->assigned_role));
@@ -845,6 +1771,38 @@ is_network_healthy(Keeper *keeper)
 		return true;
 	}
 
+	/*
+	 * When timeout.network_partition_confirmed_timeout is set, probe the
+	 * monitor and the other nodes over TCP. When none of them can be reached,
+	 * the partition is confirmed and we use the shorter timeout. When any of
+	 * them answers, we might only have lost the monitor, and we keep waiting
+	 * for the whole network_partition_timeout as before.
+	 */
+	int confirmedTimeout = config->network_partition_confirmed_timeout;
+
+	if (confirmedTimeout > 0 && confirmedTimeout < networkPartitionTimeout &&
+		in_network_partition(keeperState, now, confirmedTimeout))
+	{
+		int probedCount = 0;
+		int reachableCount = keeper_probe_network_peers(keeper, &probedCount);
+
+		if (probedCount > 0 && reachableCount == 0)
+		{
+			log_info("Failed to reach any of %d peers over TCP, "
+					 "network partition confirmed after %d seconds",
+					 probedCount,
+					 (int) (now - keeperState->last_monitor_contact));
+
+			networkPartitionTimeout = confirmedTimeout;
+		}
+		else
+		{
+			log_info("Could reach %d of %d peers over TCP, "
+					 "network partition not confirmed",
+					 reachableCount, probedCount);
+		}
+	}
+
 	if (!in_network_partition(keeperState, now, networkPartitionTimeout))
 	{
 		/* still had recent contact with monitor and/or secondary */
@@ -0,0 +1,446 @@
+/*
+ * src/bin/pg_autoctl/service_metrics.c
+ *   The pg_autoctl service that serves the keeper metrics over HTTP.
+ *
+ * The service answers GET /metrics requests with the keeper metrics in the
+ * Prometheus text exposition format. The metrics are read from the memory
+ * that the node-active process shares with us, see keeper_metrics.c, so that
+ * scraping them requires neither a SQL query nor a connection to the monitor.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "postgres_fe.h"
+#include "pqexpbuffer.h"
+
+#include "cli_common.h"
+#include "cli_root.h"
+#include "defaults.h"
+#include "keeper_metrics.h"
+#include "log.h"
+#include "pidfile.h"
+#include "service_metrics.h"
+#include "signals.h"
+#include "string_utils.h"
+#include "supervisor.h"
+
+#include "runprogram.h"
+
+/* we only read the request line, and ignore headers and body */
+#define METRICS_REQUEST_MAXLEN 4096
+
+/* how long we wait for a request before giving up on a client, in ms */
+#define METRICS_CLIENT_TIMEOUT 1000
+
+/* how long we wait before trying to listen again, in seconds */
+#define METRICS_LISTEN_RETRY_TIME 10
+
+static int service_metrics_listen(KeeperConfig *config);
+static void service_metrics_handle_client(KeeperConfig *config, int clientFd);
+static bool service_metrics_send(int fd, const char *status,
+								 const char *body, size_t size);
+
+
+/*
+ * service_metrics_start starts a subprocess that serves the keeper metrics.
+ */
+bool
+service_metrics_start(void *context, pid_t *pid)
+{
+	/* Flush stdio channels just before fork, to avoid double-output problems */
+	fflush(stdout);
+	fflush(stderr);
+
+	pid_t fpid = fork();
+
+	switch (fpid)
+	{
+		case -1:
+		{
+			log_error("Failed to fork the metrics process");
+			return false;
+		}
+
+		case 0:
+		{
+			/* here we call execv() so we never get back */
+			(void) service_metrics_runprogram();
+
+			/* unexpected */
+			log_fatal("BUG: returned from service_metrics_runprogram()");
+			exit(EXIT_CODE_INTERNAL_ERROR);
+		}
+
+		default:
+		{
+			/* fork succeeded, in parent */
+			log_debug("pg_autoctl metrics process started in subprocess %d",
+					  fpid);
+			*pid = fpid;
+			return true;
+		}
+	}
+}
+
+
+/*
+ * service_metrics_runprogram runs the metrics service:
+ *
+ *   $ pg_autoctl do service metrics --pgdata ...
+ *
+ * This function is intended to be called from the child process after a fork()
+ * has been successfully done at the parent process level: it's calling
+ * execve() and will never return.
+ */
+void
+service_metrics_runprogram()
+{
+	char *args[12];
+	int argsIndex = 0;
+
+	char command[BUFSIZE];
+
+	/* use --pgdata option rather than the config, see service_keeper.c */
+	char *pgdata = keeperOptions.pgSetup.pgdata;
+
+	setenv(PG_AUTOCTL_DEBUG, "1", 1);
+
+	args[argsIndex++] = (char *) pg_autoctl_program;
+	args[argsIndex++] = "do";
+	args[argsIndex++] = "service";
+	args[argsIndex++] = "metrics";
+	args[argsIndex++] = "--pgdata";
+	args[argsIndex++] = pgdata;
+	args[argsIndex++] = logLevelToString(log_get_level());
+	args[argsIndex] = NULL;
+
+	/* we do not want to call setsid() when running this program. */
+	Program program = { 0 };
+	(void) initialize_program(&program, args, false);
+
+	program.capture = false;    /* redirect output, don't capture */
+	program.stdOutFd = STDOUT_FILENO;
+	program.stdErrFd = STDERR_FILENO;
+
+	/* log the exact command line we're using */
+	(void) snprintf_program_command_line(&program, command, BUFSIZE);
+
+	log_info("%s", command);
+
+	(void) execute_program(&program);
+}
+
+
+/*
+ * service_metrics_loop serves the metrics until asked to stop. Clients are
+ * handled one at a time: a scrape is a single memory copy and a few kB of
+ * text, and Prometheus does not scrape concurrently.
+ *
+ * The metrics are not essential to the keeper: when we can not listen on the
+ * metrics port, we keep trying rather than exiting, so that the supervisor
+ * does not shut down the other services after too many restarts.
+ */
+bool
+service_metrics_loop(KeeperConfig *config, pid_t start_pid)
+{
+	int listenFd = -1;
+	uint64_t lastListenAttempt = 0;
+
+	/* clients that go away while we answer must not kill the service */
+	(void) signal(SIGPIPE, SIG_IGN);
+
+	while (!(asked_to_stop || asked_to_stop_fast || asked_to_quit))
+	{
+		/* Check that we still own our PID file, or quit now */
+		(void) check_pidfile(config->pathnames.pid, start_pid);
+
+		if (listenFd < 0)
+		{
+			uint64_t now = time(NULL);
+
+			if ((now - lastListenAttempt) < METRICS_LISTEN_RETRY_TIME)
+			{
+				pg_usleep(1000 * 1000);
+				continue;
+			}
+
+			lastListenAttempt = now;
+			listenFd = service_metrics_listen(config);
+
+			if (listenFd < 0)
+			{
+				log_warn("Retrying in %ds", METRICS_LISTEN_RETRY_TIME);
+				continue;
+			}
+
+			log_info("Serving keeper metrics at http://%s:%d/metrics",
+					 config->metrics_listen_address,
+					 config->metrics_port);
+		}
+
+		struct pollfd pollFd = { .fd = listenFd, .events = POLLIN };
+
+		/* wake up every second to check for signals */
+		int ready = poll(&pollFd, 1, 1000);
+
+		if (ready < 0)
+		{
+			if (errno != EINTR)
+			{
+				log_error("Failed to wait for metrics clients: %m");
+				close(listenFd);
+				listenFd = -1;
+			}
+			continue;
+		}
+
+		if (ready == 0)
+		{
+			continue;
+		}
+
+		int clientFd = accept(listenFd, NULL, NULL);
+
+		if (clientFd < 0)
+		{
+			if (errno != EINTR && errno != EAGAIN)
+			{
+				log_warn("Failed to accept a metrics client: %m");
+			}
+			continue;
+		}
+
+		(void) service_metrics_handle_client(config, clientFd);
+
+		close(clientFd);
+	}
+
+	if (listenFd >= 0)
+	{
+		close(listenFd);
+	}
+
+	return true;
+}
+
+
+/*
+ * service_metrics_listen opens the listening socket of the metrics service,
+ * and returns -1 when it failed to do so.
+ */
+static int
+service_metrics_listen(KeeperConfig *config)
+{
+	struct addrinfo *lookup;
+	struct addrinfo hints;
+
+	int listenFd = -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = PF_UNSPEC;     /* accept any family as supported by OS */
+	hints.ai_socktype = SOCK_STREAM; /* we only want TCP sockets */
+	hints.ai_protocol = IPPROTO_TCP; /* we only want TCP sockets */
+	hints.ai_flags = AI_PASSIVE;
+
+	int error = getaddrinfo(config->metrics_listen_address,
+							intToString(config->metrics_port).strValue,
+							&hints,
+							&lookup);
+
+	if (error != 0)
+	{
+		log_warn("Failed to resolve metrics.listen_address \"%s\": %s",
+				 config->metrics_listen_address, gai_strerror(error));
+		return -1;
+	}
+
+	for (struct addrinfo *ai = lookup; ai; ai = ai->ai_next)
+	{
+		int one = 1;
+		int sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+		if (sock < 0)
+		{
+			log_warn("Failed to create a socket: %m");
+			continue;
+		}
+
+		/* allow restarting the service right away */
+		(void) setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+		if (bind(sock, ai->ai_addr, ai->ai_addrlen) != 0 ||
+			listen(sock, 16) != 0)
+		{
+			log_warn("Failed to listen on %s:%d: %m",
+					 config->metrics_listen_address,
+					 config->metrics_port);
+			close(sock);
+			continue;
+		}
+
+		listenFd = sock;
+		break;
+	}
+
+	freeaddrinfo(lookup);
+
+	if (listenFd < 0)
+	{
+		log_warn("Failed to serve keeper metrics on %s:%d",
+				 config->metrics_listen_address,
+				 config->metrics_port);
+	}
+
+	return listenFd;
+}
+
+
+/*
+ * service_metrics_handle_client reads the request of a client and sends the
+ * metrics, or an error.
+ */
+static void
+service_metrics_handle_client(KeeperConfig *config, int clientFd)
+{
+	char request[METRICS_REQUEST_MAXLEN] = { 0 };
+	size_t length = 0;
+
+	struct timeval timeout = {
+		.tv_sec = METRICS_CLIENT_TIMEOUT / 1000,
+		.tv_usec = (METRICS_CLIENT_TIMEOUT % 1000) * 1000
+	};
+
+	(void) setsockopt(clientFd, SOL_SOCKET, SO_RCVTIMEO,
+					  &timeout, sizeof(timeout));
+	(void) setsockopt(clientFd, SOL_SOCKET, SO_SNDTIMEO,
+					  &timeout, sizeof(timeout));
+
+	/* read until the end of the request line */
+	while (length < sizeof(request) - 1 && strchr(request, '\n') == NULL)
+	{
+		ssize_t bytes = read(clientFd, request + length,
+							 sizeof(request) - 1 - length);
+
+		if (bytes <= 0)
+		{
+			log_debug("Failed to read metrics request: %m");
+			return;
+		}
+
+		length += bytes;
+	}
+
+	if (strncmp(request, "GET ", 4) != 0)
+	{
+		const char *body = "Method Not Allowed\n";
+
+		(void) service_metrics_send(clientFd, "405 Method Not Allowed",
+									body, strlen(body));
+		return;
+	}
+
+	if (strncmp(request + 4, "/metrics ", 9) != 0 &&
+		strncmp(request + 4, "/metrics?", 9) != 0 &&
+		strncmp(request + 4, "/metrics\r", 9) != 0)
+	{
+		const char *body = "Not Found, see /metrics\n";
+
+		(void) service_metrics_send(clientFd, "404 Not Found",
+									body, strlen(body));
+		return;
+	}
+
+	KeeperMetrics metrics = { 0 };
+
+	/* the node-active service might have been started after us */
+	if (!keeper_metrics_attach(config->pathnames.metrics) ||
+		!keeper_metrics_snapshot(&metrics))
+	{
+		const char *body = "Keeper metrics are not available\n";
+
+		(void) service_metrics_send(clientFd, "503 Service Unavailable",
+									body, strlen(body));
+		return;
+	}
+
+	PQExpBuffer out = createPQExpBuffer();
+
+	if (out == NULL)
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		return;
+	}
+
+	(void) keeper_metrics_format(&metrics, config->formation, out);
+
+	if (PQExpBufferBroken(out))
+	{
+		log_error(ALLOCATION_FAILED_ERROR);
+		destroyPQExpBuffer(out);
+		return;
+	}
+
+	(void) service_metrics_send(clientFd, "200 OK", out->data, out->len);
+
+	destroyPQExpBuffer(out);
+}
+
+
+/*
+ * service_metrics_send sends an HTTP response to the client.
+ */
+static bool
+service_metrics_send(int fd, const char *status, const char *body, size_t size)
+{
+	char header[BUFSIZE] = { 0 };
+
+	sformat(header, sizeof(header),
+			"HTTP/1.0 %s\r\n"
+			"Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+			"Content-Length: %zu\r\n"
+			"Connection: close\r\n"
+			"\r\n",
+			status, size);
+
+	const char *buffers[] = { header, body };
+	size_t sizes[] = { strlen(header), size };
+
+	for (int i = 0; i < 2; i++)
+	{
+		size_t sent = 0;
+
+		while (sent < sizes[i])
+		{
+			ssize_t bytes = write(fd, buffers[i] + sent, sizes[i] - sent);
+
+			if (bytes < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+
+				log_debug("Failed to send metrics response: %m");
+				return false;
+			}
+
+			sent += bytes;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,21 @@
+/*
+ * src/bin/pg_autoctl/service_metrics.h
+ *   The pg_autoctl service that serves the keeper metrics over HTTP.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+#ifndef SERVICE_METRICS_H
+#define SERVICE_METRICS_H
+
+#include <inttypes.h>
+#include <signal.h>
+
+#include "keeper_config.h"
+
+bool service_metrics_start(void *context, pid_t *pid);
+void service_metrics_runprogram(void);
+bool service_metrics_loop(KeeperConfig *config, pid_t start_pid);
+
+#endif /* SERVICE_METRICS_H */
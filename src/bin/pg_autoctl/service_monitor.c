@@ -26,6 +26,7 @@
 #include "signals.h"
 #include "string_utils.h"
 #include "supervisor.h"
+#include "systemd_notify.h"
 
 #include "runprogram.h"
 
@@ -63,6 +64,10 @@ start_monitor(Monitor *monitor)
 
 	int subprocessesCount = sizeof(subprocesses) / sizeof(subprocesses[0]);
 
+	/* the supervisor backs off when a service keeps crashing */
+	subprocesses[0].backoff = config->postgres_restart;
+	subprocesses[1].backoff = config->listener_restart;
+
 	/* initialize our local Postgres instance representation */
 	(void) local_postgres_init(&postgres, pgSetup);
 
@@ -277,8 +282,16 @@ monitor_service_run(Monitor *monitor)
 		{
 			log_info("Contacting the monitor to LISTEN to its events.");
 			loggedAboutListening = true;
+
+			/* Postgres is running and the extension is ready for nodes */
+			(void) systemd_notify_ready("monitor is running");
 		}
 
+		(void) systemd_notify_watchdog();
+
+		/* write out buffered log lines, if any, before waiting */
+		(void) log_flush();
+
 		if (!monitor_get_notifications(monitor,
 
 		                               /* we want the time in milliseconds */
@@ -36,6 +36,8 @@ static bool shutdownSequenceInProgress = false;
 static bool ensure_postgres_status(LocalPostgresServer *postgres,
 								   Service *service);
 
+static bool ensure_postgres_status_fenced(LocalPostgresServer *postgres,
+										  Service *service);
 static bool ensure_postgres_status_stopped(LocalPostgresServer *postgres,
 										   Service *service);
 
@@ -359,7 +361,8 @@ service_postgres_ctl_loop(LocalPostgresServer *postgres)
 			}
 		}
 
-		pg_usleep(100 * 1000);  /* 100ms */
+		/* wake up early when Postgres exits */
+		(void) supervisor_wait_for_services(&postgresService, 1, 100);
 	}
 }
 
@@ -401,11 +404,21 @@ ensure_postgres_status(LocalPostgresServer *postgres, Service *service)
 
 		case PG_EXPECTED_STATUS_RUNNING:
 		{
+			if (keeper_postgres_lease_expired(pgStatus))
+			{
+				return ensure_postgres_status_fenced(postgres, service);
+			}
+
 			return ensure_postgres_status_running(postgres, service, false);
 		}
 
 		case PG_EXPECTED_STATUS_RUNNING_AS_SUBPROCESS:
 		{
+			if (keeper_postgres_lease_expired(pgStatus))
+			{
+				return ensure_postgres_status_fenced(postgres, service);
+			}
+
 			return ensure_postgres_status_running(postgres, service, true);
 		}
 	}
@@ -415,6 +428,36 @@ ensure_postgres_status(LocalPostgresServer *postgres, Service *service)
 }
 
 
+/*
+ * ensure_postgres_status_fenced stops Postgres when the primary lease that the
+ * node-active process last renewed has expired. We check the lease at each
+ * round of our loop, every 100ms at most, whether or not the node-active
+ * process is still waiting for the monitor: once the lease has expired the
+ * monitor may fail over, so our primary must stop accepting writes first.
+ *
+ * Postgres is started again when the node-active process writes a lease that
+ * the monitor has renewed, or a new expected status.
+ */
+static bool
+ensure_postgres_status_fenced(LocalPostgresServer *postgres, Service *service)
+{
+	PostgresSetup *pgSetup = &(postgres->postgresSetup);
+
+	bool pgIsNotRunningIsOk = true;
+	bool pgIsRunning = pg_setup_is_ready(pgSetup, pgIsNotRunningIsOk);
+
+	if (pgIsRunning)
+	{
+		log_warn("Primary lease expired, stopping Postgres (pid %d) "
+				 "until the monitor renews the lease",
+				 service->pid);
+
+		return service_postgres_stop(service);
+	}
+	return true;
+}
+
+
 /*
  * ensure_postgres_status_stopped ensures that Postgres is stopped.
  */
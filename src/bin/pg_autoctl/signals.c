@@ -25,10 +25,12 @@ volatile sig_atomic_t asked_to_stop = 0;      /* SIGTERM */
 volatile sig_atomic_t asked_to_stop_fast = 0; /* SIGINT */
 volatile sig_atomic_t asked_to_reload = 0;    /* SIGHUP */
 volatile sig_atomic_t asked_to_quit = 0;      /* SIGQUIT */
+volatile sig_atomic_t asked_to_profile = 0;   /* SIGUSR1 */
 
 /*
  * set_signal_handlers sets our signal handlers for the 4 signals that we
- * specifically handle in pg_autoctl.
+ * specifically handle in pg_autoctl, and for SIGUSR1, which asks the
+ * node-active service to profile its main loop, see keeper_profile.c.
  */
 void
 set_signal_handlers(bool exitOnQuit)
@@ -39,6 +41,7 @@ set_signal_handlers(bool exitOnQuit)
 	pqsignal(SIGHUP, catch_reload);
 	pqsignal(SIGINT, catch_int);
 	pqsignal(SIGTERM, catch_term);
+	pqsignal(SIGUSR1, catch_profile);
 
 	if (exitOnQuit)
 	{
@@ -160,6 +163,17 @@ catch_quit(int sig)
 }
 
 
+/*
+ * catch_profile receives the SIGUSR1 signal.
+ */
+void
+catch_profile(int sig)
+{
+	asked_to_profile = 1;
+	pqsignal(sig, catch_profile);
+}
+
+
 /*
  * quit_and_exit exit(EXIT_CODE_QUIT) upon receiving the SIGQUIT signal.
  */
@@ -24,6 +24,7 @@
 #include "file_utils.h"
 #include "keeper_config.h"
 #include "keeper.h"
+#include "keeper_metrics.h"
 #include "log.h"
 #include "pgctl.h"
 #include "pgsetup.h"
@@ -159,12 +160,18 @@ keeper_state_write(KeeperStateData *keeperState, const char *filename)
 		return false;
 	}
 
+	instr_time fsyncStartTime;
+
+	INSTR_TIME_SET_CURRENT(fsyncStartTime);
+
 	if (fsync(fd) != 0)
 	{
 		log_fatal("fsync error: %m");
 		return false;
 	}
 
+	(void) keeper_metrics_record_state_fsync(fsyncStartTime);
+
 	if (close(fd) != 0)
 	{
 		log_fatal("Failed to close file \"%s\": %m", tempFileName);
@@ -306,6 +313,41 @@ print_keeper_state(KeeperStateData *keeperState, FILE *stream)
 	fformat(stream, "PostgreSQL System Id:     %" PRIu64 "\n",
 			keeperState->system_identifier);
 
+	/*
+	 * Crash recovery, when it's running.
+	 */
+	if (keeperState->crash_recovery_start_time > 0)
+	{
+		fformat(stream, "Crash Recovery Started:   %s\n",
+				epoch_to_string(keeperState->crash_recovery_start_time,
+								timestring));
+		fformat(stream, "Crash Recovery Replay:    %X/%X (from %X/%X to %X/%X)\n",
+				(uint32_t) (keeperState->crash_recovery_replay_lsn >> 32),
+				(uint32_t) keeperState->crash_recovery_replay_lsn,
+				(uint32_t) (keeperState->crash_recovery_start_lsn >> 32),
+				(uint32_t) keeperState->crash_recovery_start_lsn,
+				(uint32_t) (keeperState->crash_recovery_end_lsn >> 32),
+				(uint32_t) keeperState->crash_recovery_end_lsn);
+		fformat(stream, "Crash Recovery ETA:       %" PRId64 "s\n",
+				keeperState->crash_recovery_eta);
+	}
+
+	/*
+	 * pg_rewind, when it's running.
+	 */
+	if (keeperState->rewind_start_time > 0)
+	{
+		fformat(stream, "Rewind Started:           %s\n",
+				epoch_to_string(keeperState->rewind_start_time, timestring));
+		fformat(stream, "Rewind Divergence:        %" PRIu64 " bytes "
+				"(database of %" PRIu64 " bytes)\n",
+				keeperState->rewind_divergence_bytes,
+				keeperState->rewind_database_bytes);
+		fformat(stream, "Rewind Progress:          %" PRIu64 "/%" PRIu64 " bytes\n",
+				keeperState->rewind_done_bytes,
+				keeperState->rewind_total_bytes);
+	}
+
 	fflush(stream);
 }
 
@@ -345,6 +387,52 @@ keeperStateAsJSON(KeeperStateData *keeperState, JSON_Value *js)
 	json_object_set_number(jsobj, "pgversion",
 						   (double) keeperState->pg_control_version);
 
+	if (keeperState->crash_recovery_start_time > 0)
+	{
+		char lsn[PG_LSN_MAXLENGTH] = { 0 };
+
+		json_object_dotset_string(
+			jsobj, "crash_recovery.start_time",
+			epoch_to_string(keeperState->crash_recovery_start_time,
+							timestring));
+
+		sformat(lsn, sizeof(lsn), "%X/%X",
+				(uint32_t) (keeperState->crash_recovery_start_lsn >> 32),
+				(uint32_t) keeperState->crash_recovery_start_lsn);
+		json_object_dotset_string(jsobj, "crash_recovery.start_lsn", lsn);
+
+		sformat(lsn, sizeof(lsn), "%X/%X",
+				(uint32_t) (keeperState->crash_recovery_replay_lsn >> 32),
+				(uint32_t) keeperState->crash_recovery_replay_lsn);
+		json_object_dotset_string(jsobj, "crash_recovery.replay_lsn", lsn);
+
+		sformat(lsn, sizeof(lsn), "%X/%X",
+				(uint32_t) (keeperState->crash_recovery_end_lsn >> 32),
+				(uint32_t) keeperState->crash_recovery_end_lsn);
+		json_object_dotset_string(jsobj, "crash_recovery.end_lsn", lsn);
+
+		json_object_dotset_number(jsobj, "crash_recovery.eta",
+								  (double) keeperState->crash_recovery_eta);
+	}
+
+	if (keeperState->rewind_start_time > 0)
+	{
+		json_object_dotset_string(
+			jsobj, "rewind.start_time",
+			epoch_to_string(keeperState->rewind_start_time, timestring));
+
+		json_object_dotset_number(
+			jsobj, "rewind.divergence_bytes",
+			(double) keeperState->rewind_divergence_bytes);
+		json_object_dotset_number(
+			jsobj, "rewind.database_bytes",
+			(double) keeperState->rewind_database_bytes);
+		json_object_dotset_number(jsobj, "rewind.done_bytes",
+								  (double) keeperState->rewind_done_bytes);
+		json_object_dotset_number(jsobj, "rewind.total_bytes",
+								  (double) keeperState->rewind_total_bytes);
+	}
+
 	return true;
 }
 
@@ -494,109 +582,155 @@ NodeStateToString(NodeState s)
 
 
 /*
- * NodeStateFromString converts a string representation of a node state into
- * the corresponding internal ENUM value.
+ * NodeStateFromString is called for every state name we parse from the
+ * monitor, the state file and the command line. Rather than a chain of
+ * strcmp() calls we hash the name into a small table: the hash function below
+ * is collision free for the current set of state names, so that a lookup costs
+ * a single strcmp() to verify the hit.
+ *
+ * The table is built from NodeStateToString() at first use, so that adding a
+ * state only requires editing NodeStateToString(). Should a new state name
+ * collide with an existing one, we fall back to a linear scan and the
+ * "pg_autoctl do fsm check" command reports the problem.
  */
-NodeState
-NodeStateFromString(const char *str)
+#define NODE_STATE_HASH_SIZE 64
+#define NODE_STATE_HASH_SEED 27
+#define NODE_STATE_HASH_MULT 37
+
+typedef struct NodeStateHashTable
 {
-	if (strcmp(str, "unknown") == 0)
-	{
-		return NO_STATE;
-	}
-	else if (strcmp(str, "init") == 0)
-	{
-		return INIT_STATE;
-	}
-	else if (strcmp(str, "single") == 0)
-	{
-		return SINGLE_STATE;
-	}
-	else if (strcmp(str, "primary") == 0)
-	{
-		return PRIMARY_STATE;
-	}
-	else if (strcmp(str, "wait_primary") == 0)
-	{
-		return WAIT_PRIMARY_STATE;
-	}
-	else if (strcmp(str, "wait_standby") == 0)
-	{
-		return WAIT_STANDBY_STATE;
-	}
-	else if (strcmp(str, "demoted") == 0)
-	{
-		return DEMOTED_STATE;
-	}
-	else if (strcmp(str, "demote_timeout") == 0)
-	{
-		return DEMOTE_TIMEOUT_STATE;
-	}
-	else if (strcmp(str, "draining") == 0)
-	{
-		return DRAINING_STATE;
-	}
-	else if (strcmp(str, "secondary") == 0)
-	{
-		return SECONDARY_STATE;
-	}
-	else if (strcmp(str, "catchingup") == 0)
-	{
-		return CATCHINGUP_STATE;
-	}
-	else if (strcmp(str, "prepare_promotion") == 0)
-	{
-		return PREP_PROMOTION_STATE;
-	}
-	else if (strcmp(str, "stop_replication") == 0)
-	{
-		return STOP_REPLICATION_STATE;
-	}
-	else if (strcmp(str, "maintenance") == 0)
-	{
-		return MAINTENANCE_STATE;
-	}
-	else if (strcmp(str, "join_primary") == 0)
-	{
-		return JOIN_PRIMARY_STATE;
-	}
-	else if (strcmp(str, "apply_settings") == 0)
-	{
-		return APPLY_SETTINGS_STATE;
-	}
-	else if (strcmp(str, "prepare_maintenance") == 0)
-	{
-		return PREPARE_MAINTENANCE_STATE;
-	}
-	else if (strcmp(str, "wait_maintenance") == 0)
+	bool built;
+	bool perfect;
+	int8_t slots[NODE_STATE_HASH_SIZE];
+} NodeStateHashTable;
+
+static NodeStateHashTable NodeStateHash = { 0 };
+
+static uint32_t node_state_hash(const char *str);
+static void node_state_hash_build(void);
+
+
+/*
+ * node_state_hash computes the hash slot of the given state name.
+ */
+static uint32_t
+node_state_hash(const char *str)
+{
+	uint32_t hash = NODE_STATE_HASH_SEED;
+
+	for (const unsigned char *ptr = (const unsigned char *) str; *ptr; ptr++)
 	{
-		return WAIT_MAINTENANCE_STATE;
+		hash = (hash * NODE_STATE_HASH_MULT) ^ *ptr;
 	}
-	else if (strcmp(str, "report_lsn") == 0)
+
+	return hash % NODE_STATE_HASH_SIZE;
+}
+
+
+/*
+ * node_state_hash_build fills-in the NodeStateHash table from the state names
+ * known to NodeStateToString.
+ */
+static void
+node_state_hash_build()
+{
+	NodeStateHash.built = true;
+	NodeStateHash.perfect = true;
+
+	for (int slot = 0; slot < NODE_STATE_HASH_SIZE; slot++)
 	{
-		return REPORT_LSN_STATE;
+		NodeStateHash.slots[slot] = -1;
 	}
-	else if (strcmp(str, "fast_forward") == 0)
+
+	for (int state = NO_STATE; state < NODE_STATE_COUNT; state++)
 	{
-		return FAST_FORWARD_STATE;
+		uint32_t slot = node_state_hash(NodeStateToString((NodeState) state));
+
+		if (NodeStateHash.slots[slot] != -1)
+		{
+			log_debug("State names \"%s\" and \"%s\" share hash slot %u, "
+					  "using a linear scan to parse state names",
+					  NodeStateToString((NodeState) state),
+					  NodeStateToString(NodeStateHash.slots[slot]),
+					  slot);
+
+			NodeStateHash.perfect = false;
+			return;
+		}
+
+		NodeStateHash.slots[slot] = (int8_t) state;
 	}
-	else if (strcmp(str, "join_secondary") == 0)
+}
+
+
+/*
+ * NodeStateFromString converts a string representation of a node state into
+ * the corresponding internal ENUM value.
+ */
+NodeState
+NodeStateFromString(const char *str)
+{
+	if (!NodeStateHash.built)
 	{
-		return JOIN_SECONDARY_STATE;
+		(void) node_state_hash_build();
 	}
-	else if (strcmp(str, "dropped") == 0)
+
+	if (NodeStateHash.perfect)
 	{
-		return DROPPED_STATE;
+		int8_t state = NodeStateHash.slots[node_state_hash(str)];
+
+		if (state != -1 && strcmp(str, NodeStateToString(state)) == 0)
+		{
+			return (NodeState) state;
+		}
 	}
 	else
 	{
-		log_fatal("Failed to parse state string \"%s\"", str);
-		return NO_STATE;
+		for (int state = NO_STATE; state < NODE_STATE_COUNT; state++)
+		{
+			if (strcmp(str, NodeStateToString((NodeState) state)) == 0)
+			{
+				return (NodeState) state;
+			}
+		}
 	}
+
+	log_fatal("Failed to parse state string \"%s\"", str);
 	return NO_STATE;
 }
 
 
+/*
+ * NodeStateHashIsPerfect returns true when the state names hash without
+ * collision, which "pg_autoctl do fsm check" verifies at build time.
+ */
+bool
+NodeStateHashIsPerfect()
+{
+	if (!NodeStateHash.built)
+	{
+		(void) node_state_hash_build();
+	}
+
+	return NodeStateHash.perfect;
+}
+
+
+/*
+ * NodeStateIsPrimary returns true when the given state is one where the node
+ * takes writes, as in the monitor's CanTakeWritesInState.
+ */
+bool
+NodeStateIsPrimary(NodeState s)
+{
+	return s == SINGLE_STATE ||
+		   s == PRIMARY_STATE ||
+		   s == WAIT_PRIMARY_STATE ||
+		   s == JOIN_PRIMARY_STATE ||
+		   s == APPLY_SETTINGS_STATE;
+}
+
+
 /*
  * epoch_to_string converts a number of seconds from epoch into a date time
  * string.
@@ -743,12 +877,18 @@ keeper_init_state_write(KeeperStateInit *initState, const char *filename)
 		return false;
 	}
 
+	instr_time fsyncStartTime;
+
+	INSTR_TIME_SET_CURRENT(fsyncStartTime);
+
 	if (fsync(fd) != 0)
 	{
 		log_fatal("fsync error: %m");
 		return false;
 	}
 
+	(void) keeper_metrics_record_state_fsync(fsyncStartTime);
+
 	close(fd);
 
 	return true;
@@ -929,6 +1069,50 @@ keeper_set_postgres_state_stopped(KeeperStatePostgres *pgStatus,
 }
 
 
+/*
+ * keeper_set_postgres_lease updates the Postgres expected status file with the
+ * expiry time of our primary lease, or zero when we don't hold a lease.
+ */
+bool
+keeper_set_postgres_lease(KeeperStatePostgres *pgStatus,
+						  const char *filename,
+						  uint64_t leaseExpiryTimeMs)
+{
+	pgStatus->leaseExpiryTimeMs = leaseExpiryTimeMs;
+
+	return keeper_postgres_state_update(pgStatus, filename);
+}
+
+
+/*
+ * keeper_postgres_lease_expired returns true when the expected status carries
+ * a primary lease that has expired.
+ */
+bool
+keeper_postgres_lease_expired(KeeperStatePostgres *pgStatus)
+{
+	return pgStatus->leaseExpiryTimeMs > 0 &&
+		   pgStatus->leaseExpiryTimeMs <= keeper_postgres_monotonic_ms();
+}
+
+
+/*
+ * keeper_postgres_monotonic_ms returns the current time of the monotonic
+ * clock, in milliseconds. The clock is the same in every process of the
+ * system, so that the node-active process and the Postgres controller agree
+ * on when a lease expires, and it does not jump with the wall clock.
+ */
+uint64_t
+keeper_postgres_monotonic_ms(void)
+{
+	struct timespec ts = { 0 };
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+
 /*
  * keeper_postgres_state_create creates our pg_autoctl.pg file.
  */
@@ -936,8 +1120,25 @@ bool
 keeper_postgres_state_update(KeeperStatePostgres *pgStatus,
 							 const char *filename)
 {
+	KeeperStatePostgres onDiskStatus = { 0 };
+
 	pgStatus->pg_autoctl_state_version = PG_AUTOCTL_STATE_VERSION;
 
+	/*
+	 * We ensure the expected Postgres status at each round of the keeper main
+	 * loop, which most of the time is the same as the one already on-disk.
+	 * Reading the small file is much cheaper than another fsync().
+	 */
+	if (file_exists(filename) &&
+		keeper_postgres_state_read(&onDiskStatus, filename) &&
+		memcmp(&onDiskStatus, pgStatus, sizeof(KeeperStatePostgres)) == 0)
+	{
+		log_trace("keeper_postgres_state_update: %s is already expected",
+				  ExpectedPostgresStatusToString(pgStatus->pgExpectedStatus));
+		(void) keeper_metrics_record_state_write_skipped();
+		return true;
+	}
+
 	log_debug("Writing keeper postgres expected state file at \"%s\"", filename);
 	log_debug("keeper_postgres_state_create: version = %d",
 			  pgStatus->pg_autoctl_state_version);
@@ -998,12 +1199,18 @@ keeper_postgres_state_write(KeeperStatePostgres *pgStatus,
 		return false;
 	}
 
+	instr_time fsyncStartTime;
+
+	INSTR_TIME_SET_CURRENT(fsyncStartTime);
+
 	if (fsync(fd) != 0)
 	{
 		log_fatal("fsync error: %m");
 		return false;
 	}
 
+	(void) keeper_metrics_record_state_fsync(fsyncStartTime);
+
 	close(fd);
 
 	return true;
@@ -1046,3 +1253,282 @@ keeper_postgres_state_read(KeeperStatePostgres *pgStatus, const char *filename)
 			  filename, pg_autoctl_state_version);
 	return false;
 }
+
+
+/*
+ * keeper_transition_history_read reads our history of FSM transitions. When
+ * the file does not exist yet, the history is empty.
+ */
+bool
+keeper_transition_history_read(KeeperTransitionHistory *history,
+							   const char *filename)
+{
+	char *content = NULL;
+	long fileSize;
+
+	history->pg_autoctl_state_version = PG_AUTOCTL_STATE_VERSION;
+	history->count = 0;
+	history->next = 0;
+
+	if (!file_exists(filename))
+	{
+		return true;
+	}
+
+	if (!read_file(filename, &content, &fileSize))
+	{
+		log_error("Failed to read transition history from file \"%s\"",
+				  filename);
+		return false;
+	}
+
+	KeeperTransitionHistory *onDisk = (KeeperTransitionHistory *) content;
+
+	if (fileSize >= sizeof(KeeperTransitionHistory) &&
+		onDisk->pg_autoctl_state_version == PG_AUTOCTL_STATE_VERSION &&
+		onDisk->count >= 0 &&
+		onDisk->count <= KEEPER_TRANSITION_HISTORY_SIZE &&
+		onDisk->next >= 0 &&
+		onDisk->next < KEEPER_TRANSITION_HISTORY_SIZE)
+	{
+		*history = *onDisk;
+		free(content);
+		return true;
+	}
+
+	free(content);
+
+	log_error("Transition history file \"%s\" exists but "
+			  "is broken or wrong version",
+			  filename);
+	return false;
+}
+
+
+/*
+ * keeper_transition_history_record adds a transition to our history, or
+ * updates the last entry when this is another attempt at a transition that
+ * just failed. The resulting entry is copied to the transition parameter.
+ * The trace id of the monitor decision that assigned the state is kept with
+ * the entry, see GetGoalStateTraceId() on the monitor.
+ *
+ * The history is only there to help understand what happened on the node,
+ * so we start a new one when the file can't be read.
+ */
+bool
+keeper_transition_history_record(const char *filename,
+								 NodeState current,
+								 NodeState assigned,
+								 uint64_t startTime,
+								 uint64_t durationMs,
+								 bool success,
+								 int64_t traceId,
+								 KeeperTransition *transition)
+{
+	KeeperTransitionHistory history = { 0 };
+	char buffer[PG_AUTOCTL_KEEPER_STATE_FILE_SIZE] = { 0 };
+
+	if (!keeper_transition_history_read(&history, filename))
+	{
+		log_warn("Starting a new transition history in \"%s\"", filename);
+
+		history.pg_autoctl_state_version = PG_AUTOCTL_STATE_VERSION;
+		history.count = 0;
+		history.next = 0;
+	}
+
+	int last = (history.next + KEEPER_TRANSITION_HISTORY_SIZE - 1) %
+			   KEEPER_TRANSITION_HISTORY_SIZE;
+	KeeperTransition *entry = &(history.transitions[last]);
+
+	if (history.count == 0 ||
+		entry->success ||
+		entry->current != current ||
+		entry->assigned != assigned)
+	{
+		entry = &(history.transitions[history.next]);
+
+		entry->current = current;
+		entry->assigned = assigned;
+		entry->startTime = startTime;
+		entry->retries = 0;
+
+		history.next = (history.next + 1) % KEEPER_TRANSITION_HISTORY_SIZE;
+
+		if (history.count < KEEPER_TRANSITION_HISTORY_SIZE)
+		{
+			++history.count;
+		}
+	}
+	else
+	{
+		++(entry->retries);
+	}
+
+	entry->endTime = startTime + durationMs / 1000;
+	entry->durationMs = durationMs;
+	entry->success = success;
+
+	history.traceIds[entry - history.transitions] = traceId;
+
+	*transition = *entry;
+
+	/* see keeper_state_write() about the IGNORE-BANNED memcpy */
+	memcpy(buffer, &history, sizeof(KeeperTransitionHistory)); /* IGNORE-BANNED */
+
+	if (!write_file_atomic(buffer, PG_AUTOCTL_KEEPER_STATE_FILE_SIZE, filename))
+	{
+		log_warn("Failed to write transition history file \"%s\"", filename);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * print_keeper_transition_history prints our history of FSM transitions, the
+ * most recent last.
+ */
+void
+print_keeper_transition_history(KeeperTransitionHistory *history, FILE *stream)
+{
+	char startString[MAXCTIMESIZE] = { 0 };
+	char endString[MAXCTIMESIZE] = { 0 };
+
+	fformat(stream, "%24s | %24s | %19s | %19s | %10s | %7s | %7s | %8s\n",
+			"Start Time", "End Time", "From", "To",
+			"Duration", "Retries", "Outcome", "Trace");
+	fformat(stream, "%24s-+-%24s-+-%19s-+-%19s-+-%10s-+-%7s-+-%7s-+-%8s\n",
+			"------------------------", "------------------------",
+			"-------------------", "-------------------",
+			"----------", "-------", "-------", "--------");
+
+	for (int i = 0; i < history->count; i++)
+	{
+		int index = (history->next - history->count + i +
+					 KEEPER_TRANSITION_HISTORY_SIZE) %
+					KEEPER_TRANSITION_HISTORY_SIZE;
+		KeeperTransition *transition = &(history->transitions[index]);
+
+		fformat(stream,
+				"%24s | %24s | %19s | %19s | %8.3fs | %7d | %7s | %8" PRId64 "\n",
+				epoch_to_string(transition->startTime, startString),
+				epoch_to_string(transition->endTime, endString),
+				NodeStateToString(transition->current),
+				NodeStateToString(transition->assigned),
+				(double) transition->durationMs / 1000.0,
+				transition->retries,
+				transition->success ? "success" : "failed",
+				history->traceIds[index]);
+	}
+
+	fflush(stream);
+}
+
+
+/*
+ * keeperTransitionHistoryAsJSON adds our history of FSM transitions to the
+ * given JSON array, the most recent last.
+ */
+bool
+keeperTransitionHistoryAsJSON(KeeperTransitionHistory *history, JSON_Value *js)
+{
+	JSON_Array *jsArray = json_value_get_array(js);
+
+	for (int i = 0; i < history->count; i++)
+	{
+		int index = (history->next - history->count + i +
+					 KEEPER_TRANSITION_HISTORY_SIZE) %
+					KEEPER_TRANSITION_HISTORY_SIZE;
+		KeeperTransition *transition = &(history->transitions[index]);
+		char timestring[MAXCTIMESIZE] = { 0 };
+
+		JSON_Value *jsTransition = json_value_init_object();
+		JSON_Object *jsobj = json_value_get_object(jsTransition);
+
+		json_object_set_string(jsobj, "start_time",
+							   epoch_to_string(transition->startTime,
+											   timestring));
+		json_object_set_string(jsobj, "end_time",
+							   epoch_to_string(transition->endTime,
+											   timestring));
+		json_object_set_string(jsobj, "from",
+							   NodeStateToString(transition->current));
+		json_object_set_string(jsobj, "to",
+							   NodeStateToString(transition->assigned));
+		json_object_set_number(jsobj, "duration_ms",
+							   (double) transition->durationMs);
+		json_object_set_number(jsobj, "retries",
+							   (double) transition->retries);
+		json_object_set_boolean(jsobj, "success", transition->success);
+		json_object_set_number(jsobj, "trace_id",
+							   (double) history->traceIds[index]);
+
+		json_array_append_value(jsArray, jsTransition);
+	}
+
+	return true;
+}
+
+
+/*
+ * keeper_startup_cache_read reads the startup cache file, and returns false
+ * when there is no usable cache, in which case we run all the checks.
+ */
+bool
+keeper_startup_cache_read(KeeperStartupCache *cache, const char *filename)
+{
+	char *content = NULL;
+	long fileSize;
+
+	if (!file_exists(filename))
+	{
+		return false;
+	}
+
+	if (!read_file(filename, &content, &fileSize))
+	{
+		log_debug("Failed to read startup cache from file \"%s\"", filename);
+		return false;
+	}
+
+	KeeperStartupCache *onDisk = (KeeperStartupCache *) content;
+
+	if (fileSize >= sizeof(KeeperStartupCache) &&
+		onDisk->pg_autoctl_state_version == PG_AUTOCTL_STATE_VERSION)
+	{
+		*cache = *onDisk;
+		free(content);
+		return true;
+	}
+
+	free(content);
+
+	log_debug("Startup cache file \"%s\" is broken or wrong version, "
+			  "ignoring it", filename);
+	return false;
+}
+
+
+/*
+ * keeper_startup_cache_write writes the startup cache file.
+ */
+bool
+keeper_startup_cache_write(KeeperStartupCache *cache, const char *filename)
+{
+	char buffer[PG_AUTOCTL_KEEPER_STATE_FILE_SIZE] = { 0 };
+
+	cache->pg_autoctl_state_version = PG_AUTOCTL_STATE_VERSION;
+
+	/* see keeper_state_write() about the IGNORE-BANNED memcpy */
+	memcpy(buffer, cache, sizeof(KeeperStartupCache)); /* IGNORE-BANNED */
+
+	if (!write_file_atomic(buffer, PG_AUTOCTL_KEEPER_STATE_FILE_SIZE, filename))
+	{
+		log_warn("Failed to write startup cache file \"%s\"", filename);
+		return false;
+	}
+
+	return true;
+}
@@ -59,6 +59,9 @@ typedef enum
 
 #define MAX_NODE_STATE_LEN 19   /* "prepare_maintenance" */
 
+/* number of concrete states, from NO_STATE to DROPPED_STATE included */
+#define NODE_STATE_COUNT (DROPPED_STATE + 1)
+
 /*
  * ANY_STATE matches with any state, as its name implies:
  */
@@ -120,6 +123,22 @@ typedef struct
 	uint64_t last_secondary_contact;
 	int64_t xlog_lag;
 	int keeper_is_paused;
+
+	/* crash recovery in progress, see postgres_maybe_do_crash_recovery() */
+	uint64_t crash_recovery_start_time;     /* epoch, 0 when not running */
+	uint64_t crash_recovery_update_time;    /* epoch */
+	uint64_t crash_recovery_start_lsn;
+	uint64_t crash_recovery_replay_lsn;
+	uint64_t crash_recovery_end_lsn;
+	int64_t crash_recovery_eta;             /* seconds, -1 when unknown */
+
+	/* pg_rewind in progress, see primary_rewind_to_standby() */
+	uint64_t rewind_start_time;             /* epoch, 0 when not running */
+	uint64_t rewind_update_time;            /* epoch */
+	uint64_t rewind_divergence_bytes;
+	uint64_t rewind_database_bytes;
+	uint64_t rewind_done_bytes;
+	uint64_t rewind_total_bytes;
 } KeeperStateData;
 
 _Static_assert(sizeof(KeeperStateData) < PG_AUTOCTL_KEEPER_STATE_FILE_SIZE,
@@ -194,14 +213,90 @@ typedef struct
 {
 	int pg_autoctl_state_version;
 	ExpectedPostgresStatus pgExpectedStatus;
+
+	/*
+	 * When our primary holds a lease from the monitor, the time when the
+	 * lease expires on the monotonic clock, in milliseconds, and zero
+	 * otherwise. The Postgres controller stops Postgres once the lease has
+	 * expired, even while the node-active process waits for the monitor.
+	 */
+	uint64_t leaseExpiryTimeMs;
 } KeeperStatePostgres;
 
 _Static_assert(sizeof(KeeperStatePostgres) < PG_AUTOCTL_KEEPER_STATE_FILE_SIZE,
 			   "Size of KeeperStatePostgres is larger than expected. "
 			   "Please review PG_AUTOCTL_KEEPER_STATE_FILE_SIZE");
 
+
+/*
+ * The keeper keeps a history of its last FSM transitions on-disk, in a ring
+ * of KEEPER_TRANSITION_HISTORY_SIZE entries, so that after an incident we can
+ * see how long each transition took on this node. Consecutive failed
+ * attempts at the same transition share an entry, which counts the retries:
+ * a transition that keeps failing does not push the rest of the history out.
+ *
+ *  Note: This struct is serialized/deserialized to/from state file. Therefore
+ *  keeping the memory layout the same is important. Please
+ *  - do not change the order of fields
+ *  - do not add a new field in between, always add to the end
+ *  - do not use any pointers
+ */
+#define KEEPER_TRANSITION_HISTORY_SIZE 20
+
+typedef struct KeeperTransition
+{
+	NodeState current;
+	NodeState assigned;
+	uint64_t startTime;     /* epoch of the first attempt */
+	uint64_t endTime;       /* epoch of the end of the last attempt */
+	uint64_t durationMs;    /* of the last attempt */
+	int retries;
+	int success;
+} KeeperTransition;
+
+typedef struct
+{
+	int pg_autoctl_state_version;
+	int count;                  /* entries in use */
+	int next;                   /* entry where the next transition goes */
+	KeeperTransition transitions[KEEPER_TRANSITION_HISTORY_SIZE];
+
+	/* trace id of the monitor decision behind each transition, 0 if none */
+	int64_t traceIds[KEEPER_TRANSITION_HISTORY_SIZE];
+} KeeperTransitionHistory;
+
+_Static_assert(sizeof(KeeperTransitionHistory) < PG_AUTOCTL_KEEPER_STATE_FILE_SIZE,
+			   "Size of KeeperTransitionHistory is larger than expected. "
+			   "Please review PG_AUTOCTL_KEEPER_STATE_FILE_SIZE");
+
+/*
+ * The keeper remembers the startup checks that passed in its previous run,
+ * with fingerprints of the binaries and of the configuration files they
+ * depend on, so that the next start with the same fingerprints can defer
+ * those checks. See keeper_startup_cache_is_valid().
+ *
+ *  Note: This struct is serialized/deserialized to/from state file. Therefore
+ *  keeping the memory layout the same is important. Please
+ *  - do not change the order of fields
+ *  - do not add a new field in between, always add to the end
+ *  - do not use any pointers
+ */
+typedef struct
+{
+	int pg_autoctl_state_version;
+	uint64_t binariesFingerprint;
+	uint64_t configurationFingerprint;
+	uint64_t validatedTime;     /* epoch of the checks */
+} KeeperStartupCache;
+
+_Static_assert(sizeof(KeeperStartupCache) < PG_AUTOCTL_KEEPER_STATE_FILE_SIZE,
+			   "Size of KeeperStartupCache is larger than expected. "
+			   "Please review PG_AUTOCTL_KEEPER_STATE_FILE_SIZE");
+
 const char * NodeStateToString(NodeState s);
 NodeState NodeStateFromString(const char *str);
+bool NodeStateHashIsPerfect(void);
+bool NodeStateIsPrimary(NodeState s);
 const char * epoch_to_string(uint64_t seconds, char *buffer);
 
 void keeper_state_init(KeeperStateData *keeperState);
@@ -238,6 +333,29 @@ bool keeper_postgres_state_update(KeeperStatePostgres *pgStatus,
 								  const char *filename);
 bool keeper_postgres_state_read(KeeperStatePostgres *pgStatus,
 								const char *filename);
+bool keeper_set_postgres_lease(KeeperStatePostgres *pgStatus,
+							   const char *filename,
+							   uint64_t leaseExpiryTimeMs);
+bool keeper_postgres_lease_expired(KeeperStatePostgres *pgStatus);
+uint64_t keeper_postgres_monotonic_ms(void);
+
+bool keeper_transition_history_read(KeeperTransitionHistory *history,
+									const char *filename);
+bool keeper_transition_history_record(const char *filename,
+									  NodeState current,
+									  NodeState assigned,
+									  uint64_t startTime,
+									  uint64_t durationMs,
+									  bool success,
+									  int64_t traceId,
+									  KeeperTransition *transition);
+void print_keeper_transition_history(KeeperTransitionHistory *history,
+									 FILE *stream);
+bool keeperTransitionHistoryAsJSON(KeeperTransitionHistory *history,
+								   JSON_Value *js);
+
+bool keeper_startup_cache_read(KeeperStartupCache *cache, const char *filename);
+bool keeper_startup_cache_write(KeeperStartupCache *cache, const char *filename);
 
 
 #endif /* STATE_H */
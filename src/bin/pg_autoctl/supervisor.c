@@ -7,7 +7,9 @@
  *
  */
 
+#include <errno.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,6 +17,10 @@
 #include <time.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
 #include "postgres_fe.h"
 #include "pqexpbuffer.h"
 
@@ -32,6 +38,7 @@
 #include "state.h"
 #include "supervisor.h"
 #include "signals.h"
+#include "system_utils.h"
 #include "string_utils.h"
 
 static bool supervisor_init(Supervisor *supervisor);
@@ -58,8 +65,25 @@ static bool supervisor_restart_service(Supervisor *supervisor,
 
 static bool supervisor_may_restart(Service *service);
 
+static int supervisor_restart_delay(Service *service);
+
+static bool supervisor_restart_pending(Supervisor *supervisor);
+
+static int supervisor_start_pending_services(Supervisor *supervisor);
+
+static bool supervisor_restart_service_now(Supervisor *supervisor,
+										   Service *service);
+
 static bool supervisor_update_pidfile(Supervisor *supervisor);
 
+static void supervisor_lock_memory(Supervisor *supervisor);
+static void supervisor_apply_scheduling(Service *service);
+
+static int supervisor_pidfd_open(pid_t pid);
+
+/* set to false the first time pidfd_open() fails with ENOSYS */
+static bool pidfdSupported = true;
+
 
 /*
  * supervisor_start starts given services as sub-processes and then supervise
@@ -86,6 +110,8 @@ supervisor_start(Service services[], int serviceCount, const char *pidfile)
 		return false;
 	}
 
+	(void) supervisor_lock_memory(&supervisor);
+
 	/*
 	 * Start all the given services, in order.
 	 *
@@ -105,13 +131,23 @@ supervisor_start(Service services[], int serviceCount, const char *pidfile)
 		{
 			uint64_t now = time(NULL);
 			RestartCounters *counters = &(service->restartCounters);
+			RestartBackoff *backoff = &(service->backoff);
 
 			counters->count = 1;
 			counters->position = 0;
 			counters->startTime[counters->position] = now;
 
+			if (backoff->multiplier <= 0)
+			{
+				backoff->delayMs = SUPERVISOR_RESTART_DELAY_MS;
+				backoff->multiplier = SUPERVISOR_RESTART_MULTIPLIER;
+				backoff->maxDelayMs = SUPERVISOR_RESTART_MAX_DELAY_MS;
+			}
+
 			log_info("Started pg_autoctl %s service with pid %d",
 					 service->name, service->pid);
+
+			(void) supervisor_apply_scheduling(service);
 		}
 		else
 		{
@@ -195,7 +231,7 @@ supervisor_loop(Supervisor *supervisor)
 	bool firstLoop = true;
 
 	/* wait until all subprocesses are done */
-	while (subprocessCount > 0)
+	while (subprocessCount > 0 || supervisor_restart_pending(supervisor))
 	{
 		pid_t pid;
 		int status;
@@ -203,6 +239,9 @@ supervisor_loop(Supervisor *supervisor)
 		/* Check that we still own our PID file, or quit now */
 		(void) check_pidfile(supervisor->pidfile, supervisor->pid);
 
+		/* restart the services which restart delay has expired */
+		subprocessCount += supervisor_start_pending_services(supervisor);
+
 		/* If necessary, now is a good time to reload services */
 		if (asked_to_reload)
 		{
@@ -217,8 +256,13 @@ supervisor_loop(Supervisor *supervisor)
 		}
 		else
 		{
+			/* write out buffered log lines, if any, before sleeping */
+			(void) log_flush();
+
 			/* avoid busy looping on waitpid(WNOHANG) */
-			pg_usleep(100 * 1000); /* 100 ms */
+			(void) supervisor_wait_for_services(supervisor->services,
+												supervisor->serviceCount,
+												100);
 		}
 
 		/* ignore errors */
@@ -238,6 +282,13 @@ supervisor_loop(Supervisor *supervisor)
 						return true;
 					}
 
+					/* services waiting for their restart delay */
+					if (supervisor_restart_pending(supervisor))
+					{
+						(void) supervisor_handle_signals(supervisor);
+						break;
+					}
+
 					log_fatal("Unexpected ECHILD error from waitpid()");
 					return false;
 				}
@@ -336,6 +387,12 @@ supervisor_reload_services(Supervisor *supervisor)
 	{
 		Service *service = &(supervisor->services[serviceIndex]);
 
+		/* the process is gone, a restart is pending */
+		if (service->restartCounters.pending)
+		{
+			continue;
+		}
+
 		log_info("Reloading service \"%s\" by signaling pid %d with SIGHUP",
 				 service->name, service->pid);
 
@@ -366,6 +423,13 @@ supervisor_stop_subprocesses(Supervisor *supervisor)
 	{
 		Service *service = &(supervisor->services[serviceIndex]);
 
+		/* the process is gone, and won't be restarted now */
+		if (service->restartCounters.pending)
+		{
+			service->restartCounters.pending = false;
+			continue;
+		}
+
 		if (kill(service->pid, signal) != 0)
 		{
 			log_error("Failed to send signal %s to service %s with pid %d",
@@ -397,6 +461,13 @@ supervisor_stop_other_services(Supervisor *supervisor, pid_t pid)
 		{
 			Service *service = &(supervisor->services[serviceIndex]);
 
+			/* the process is gone, and won't be restarted now */
+			if (service->restartCounters.pending)
+			{
+				service->restartCounters.pending = false;
+				continue;
+			}
+
 			if (service->pid != pid)
 			{
 				if (kill(service->pid, signal) != 0)
@@ -642,6 +713,8 @@ supervisor_restart_service(Supervisor *supervisor, Service *service, int status)
 
 	RestartCounters *counters = &(service->restartCounters);
 
+	INSTR_TIME_SET_CURRENT(counters->exitTime);
+
 	/*
 	 * If we're in the middle of a shutdown sequence, we won't have to restart
 	 * services and apply any restart strategy etc.
@@ -723,6 +796,9 @@ supervisor_restart_service(Supervisor *supervisor, Service *service, int status)
 	 */
 	if (supervisor_may_restart(service))
 	{
+		/* compute the delay before we start the service again */
+		counters->delayMs = supervisor_restart_delay(service);
+
 		/* update our ring buffer: move our clock hand */
 		int position = (counters->position + 1) % SUPERVISOR_SERVICE_MAX_RETRY;
 
@@ -772,8 +848,36 @@ supervisor_restart_service(Supervisor *supervisor, Service *service, int status)
 	 * Now the service RestartPolicy is either RP_PERMANENT, and we need to
 	 * restart it no matter what, or RP_TRANSIENT with a failure status
 	 * (non-zero return code), and we need to start the service in that case
-	 * too.
+	 * too. When the service keeps crashing, wait for the restart delay: the
+	 * main supervisor loop then restarts the service.
 	 */
+	if (counters->delayMs > 0)
+	{
+		log_info("Restarting service %s in %dms, after %d restarts in a row",
+				 service->name, counters->delayMs, counters->consecutive - 1);
+
+		counters->pending = true;
+
+		return false;
+	}
+
+	return supervisor_restart_service_now(supervisor, service);
+}
+
+
+/*
+ * supervisor_restart_service_now starts the given service again, and updates
+ * our PID file with its new PID.
+ */
+static bool
+supervisor_restart_service_now(Supervisor *supervisor, Service *service)
+{
+	RestartCounters *counters = &(service->restartCounters);
+
+	instr_time duration;
+
+	counters->pending = false;
+
 	log_info("Restarting service %s", service->name);
 	bool restarted = (*service->startFunction)(service->context, &(service->pid));
 
@@ -790,6 +894,19 @@ supervisor_restart_service(Supervisor *supervisor, Service *service, int status)
 		return false;
 	}
 
+	(void) supervisor_apply_scheduling(service);
+
+	/* track the actual start time, after the restart delay if any */
+	counters->startTime[counters->position] = time(NULL);
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, counters->exitTime);
+
+	counters->lastRestartMs = INSTR_TIME_GET_MILLISEC(duration);
+
+	log_debug("Restarted service %s in %.3fms",
+			  service->name, counters->lastRestartMs);
+
 	/*
 	 * Now we have restarted the service, it has a new PID and we need to
 	 * update our PID file with the new information. Failing to update the PID
@@ -812,6 +929,75 @@ supervisor_restart_service(Supervisor *supervisor, Service *service, int status)
 }
 
 
+/*
+ * supervisor_lock_memory locks the memory of the supervisor process when one
+ * of its services asks for it: the supervisor is the process that restarts the
+ * services, so it should not be paged out either.
+ */
+static void
+supervisor_lock_memory(Supervisor *supervisor)
+{
+	for (int i = 0; i < supervisor->serviceCount; i++)
+	{
+		if (supervisor->services[i].scheduling.lockMemory)
+		{
+			if (lock_process_memory())
+			{
+				log_info("Locked the memory of the pg_autoctl supervisor");
+			}
+			else
+			{
+				log_warn("Failed to lock the memory of the pg_autoctl "
+						 "supervisor, continuing without");
+			}
+
+			return;
+		}
+	}
+}
+
+
+/*
+ * supervisor_apply_scheduling applies the scheduling policy, nice value and
+ * CPU affinity of a service to its process, which we have just started. The
+ * service runs either way, so failing to apply its scheduling only warrants
+ * a warning.
+ */
+static void
+supervisor_apply_scheduling(Service *service)
+{
+	ServiceScheduling *scheduling = &(service->scheduling);
+
+	if (!IS_EMPTY_STRING_BUFFER(scheduling->policy) &&
+		strcmp(scheduling->policy, "other") != 0)
+	{
+		if (!set_process_sched_policy(service->pid, scheduling->policy))
+		{
+			log_warn("Failed to set scheduling policy \"%s\" for service %s",
+					 scheduling->policy, service->name);
+		}
+	}
+
+	if (scheduling->nice != 0)
+	{
+		if (!set_process_nice(service->pid, scheduling->nice))
+		{
+			log_warn("Failed to set nice value %d for service %s",
+					 scheduling->nice, service->name);
+		}
+	}
+
+	if (!IS_EMPTY_STRING_BUFFER(scheduling->cpuList))
+	{
+		if (!set_process_cpu_affinity(service->pid, scheduling->cpuList))
+		{
+			log_warn("Failed to set CPU affinity \"%s\" for service %s",
+					 scheduling->cpuList, service->name);
+		}
+	}
+}
+
+
 /*
  * supervisor_count_restarts returns true when we have restarted more than
  * SUPERVISOR_SERVICE_MAX_RETRY in the last SUPERVISOR_SERVICE_MAX_TIME period
@@ -866,6 +1052,113 @@ supervisor_may_restart(Service *service)
 }
 
 
+/*
+ * supervisor_restart_delay returns how long to wait before restarting the
+ * given service, in milliseconds. The first restart is done at once, and then
+ * we back off exponentially while the service keeps crashing, until it runs
+ * for SUPERVISOR_RESTART_STABLE_TIME seconds again.
+ */
+static int
+supervisor_restart_delay(Service *service)
+{
+	uint64_t now = time(NULL);
+	RestartCounters *counters = &(service->restartCounters);
+	RestartBackoff *backoff = &(service->backoff);
+
+	uint64_t startTime = counters->startTime[counters->position];
+
+	if ((now - startTime) >= SUPERVISOR_RESTART_STABLE_TIME)
+	{
+		counters->consecutive = 0;
+	}
+
+	if (counters->consecutive++ == 0)
+	{
+		return 0;
+	}
+
+	int delayMs = backoff->delayMs;
+
+	for (int i = 1; i < counters->consecutive - 1; i++)
+	{
+		if (delayMs >= backoff->maxDelayMs / backoff->multiplier)
+		{
+			delayMs = backoff->maxDelayMs;
+			break;
+		}
+
+		delayMs *= backoff->multiplier;
+	}
+
+	return delayMs < backoff->maxDelayMs ? delayMs : backoff->maxDelayMs;
+}
+
+
+/*
+ * supervisor_restart_pending returns true when a service is waiting for its
+ * restart delay to expire.
+ */
+static bool
+supervisor_restart_pending(Supervisor *supervisor)
+{
+	for (int serviceIndex = 0; serviceIndex < supervisor->serviceCount; serviceIndex++)
+	{
+		if (supervisor->services[serviceIndex].restartCounters.pending)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * supervisor_start_pending_services restarts the services which restart delay
+ * has expired, and returns how many services have been restarted.
+ */
+static int
+supervisor_start_pending_services(Supervisor *supervisor)
+{
+	int restartedCount = 0;
+
+	for (int serviceIndex = 0; serviceIndex < supervisor->serviceCount; serviceIndex++)
+	{
+		Service *service = &(supervisor->services[serviceIndex]);
+		RestartCounters *counters = &(service->restartCounters);
+
+		if (!counters->pending)
+		{
+			continue;
+		}
+
+		/* no restart in the middle of a shutdown sequence */
+		if (supervisor->shutdownSequenceInProgress)
+		{
+			counters->pending = false;
+			continue;
+		}
+
+		instr_time duration;
+
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, counters->exitTime);
+
+		if (INSTR_TIME_GET_MILLISEC(duration) < counters->delayMs)
+		{
+			continue;
+		}
+
+		if (supervisor_restart_service_now(supervisor, service))
+		{
+			++restartedCount;
+		}
+	}
+
+	return restartedCount;
+}
+
+
 /*
  * supervisor_update_pidfile creates a pidfile with all our PIDs in there.
  */
@@ -895,8 +1188,14 @@ supervisor_update_pidfile(Supervisor *supervisor)
 	{
 		Service *service = &(supervisor->services[serviceIndex]);
 
-		/* one line per service, pid space name */
-		appendPQExpBuffer(content, "%d %s\n", service->pid, service->name);
+		RestartCounters *counters = &(service->restartCounters);
+
+		/* one line per service: pid, name, restarts, time to restart */
+		appendPQExpBuffer(content, "%d %s %d %.3f\n",
+						  service->pid,
+						  service->name,
+						  counters->count - 1,
+						  counters->lastRestartMs);
 	}
 
 	bool success = write_file(content->data, content->len, supervisor->pidfile);
@@ -906,6 +1205,129 @@ supervisor_update_pidfile(Supervisor *supervisor)
 }
 
 
+/*
+ * supervisor_wait_for_services sleeps for timeoutMs milliseconds, or until
+ * one of the given services exits or we receive a signal, whichever comes
+ * first. The caller is expected to call waitpid() next.
+ *
+ * On Linux 5.3 and later, we use a pidfd per service, which poll() sees as
+ * readable as soon as the process has exited. Elsewhere, or when pidfd_open()
+ * fails, we just sleep.
+ */
+void
+supervisor_wait_for_services(Service services[], int serviceCount,
+							 int timeoutMs)
+{
+	struct pollfd pfds[SUPERVISOR_MAX_SERVICES] = { 0 };
+	int pidfdCount = 0;
+
+	if (serviceCount > SUPERVISOR_MAX_SERVICES)
+	{
+		serviceCount = SUPERVISOR_MAX_SERVICES;
+	}
+
+	for (int serviceIndex = 0; serviceIndex < serviceCount; serviceIndex++)
+	{
+		Service *service = &(services[serviceIndex]);
+
+		pfds[serviceIndex].fd = -1;
+		pfds[serviceIndex].events = POLLIN;
+		pfds[serviceIndex].revents = 0;
+
+		/* the process is gone, a restart is pending */
+		if (service->restartCounters.pending || service->pid <= 0)
+		{
+			continue;
+		}
+
+		/* open a pidfd for each new pid, and only once */
+		if (service->pidfdPid != service->pid)
+		{
+			if (service->pidfdPid > 0 && service->pidfd >= 0)
+			{
+				close(service->pidfd);
+			}
+
+			service->pidfd = supervisor_pidfd_open(service->pid);
+			service->pidfdPid = service->pid;
+		}
+
+		if (service->pidfd >= 0)
+		{
+			pfds[serviceIndex].fd = service->pidfd;
+			++pidfdCount;
+		}
+	}
+
+	if (pidfdCount == 0)
+	{
+		pg_usleep(timeoutMs * 1000L);
+		return;
+	}
+
+	/* a signal interrupts poll(), and the caller then handles it */
+	if (poll(pfds, serviceCount, timeoutMs) <= 0)
+	{
+		return;
+	}
+
+	/*
+	 * The pidfd of an exited process stays readable, so we close it now, and
+	 * only open a new one when the service has been restarted with a new pid.
+	 */
+	for (int serviceIndex = 0; serviceIndex < serviceCount; serviceIndex++)
+	{
+		Service *service = &(services[serviceIndex]);
+
+		if (pfds[serviceIndex].fd >= 0 && pfds[serviceIndex].revents != 0)
+		{
+			log_trace("supervisor_wait_for_services: service %s with pid %d "
+					  "has exited", service->name, service->pid);
+
+			close(service->pidfd);
+			service->pidfd = -1;
+		}
+	}
+}
+
+
+/*
+ * supervisor_pidfd_open returns a file descriptor that refers to the given
+ * process, or -1 when the system does not support it.
+ */
+static int
+supervisor_pidfd_open(pid_t pid)
+{
+	if (!pidfdSupported)
+	{
+		return -1;
+	}
+
+#if defined(SYS_pidfd_open)
+	int pidfd = (int) syscall(SYS_pidfd_open, pid, 0);
+
+	if (pidfd < 0)
+	{
+		if (errno == ENOSYS)
+		{
+			log_debug("pidfd_open() is not supported, "
+					  "polling for children processes instead");
+			pidfdSupported = false;
+		}
+		else
+		{
+			log_debug("Failed to open a pidfd for pid %d: %m", pid);
+		}
+	}
+
+	return pidfd;
+#else
+	pidfdSupported = false;
+	return -1;
+#endif
+}
+
+
 /*
  * supervisor_find_service_pid reads the pidfile contents and process it line
  * by line to find the pid of the given service name.
@@ -949,7 +1371,16 @@ supervisor_find_service_pid(const char *pidfile,
 			continue;
 		}
 
-		if (streq(serviceName, separator + 1))
+		/* the service name is followed by its restart counters */
+		char *name = separator + 1;
+		char *nameEnd = strchr(name, ' ');
+
+		if (nameEnd != NULL)
+		{
+			*nameEnd = '\0';
+		}
+
+		if (streq(serviceName, name))
 		{
 			*separator = '\0';
 			stringToInt(fileLines[lineNumber], pid);
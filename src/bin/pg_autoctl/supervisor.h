@@ -12,6 +12,8 @@
 #include <inttypes.h>
 #include <signal.h>
 
+#include "portability/instr_time.h"
+
 /*
  * pg_autoctl runs sub-processes as "services", and we need to use the same
  * service names in several places:
@@ -23,6 +25,7 @@
 #define SERVICE_NAME_POSTGRES "postgres"
 #define SERVICE_NAME_KEEPER "node-active"
 #define SERVICE_NAME_MONITOR "listener"
+#define SERVICE_NAME_METRICS "metrics"
 
 /*
  * At pg_autoctl create time we use a transient service to initialize our local
@@ -84,8 +87,51 @@ typedef struct RestartCounters
 	int count;                  /* how many restarts including first start */
 	int position;               /* array index */
 	uint64_t startTime[SUPERVISOR_SERVICE_MAX_RETRY];
+
+	int consecutive;            /* restarts without a stable run in between */
+	bool pending;               /* waiting for the restart delay to expire */
+	int delayMs;                /* restart delay being applied */
+	instr_time exitTime;        /* when we noticed the service had quit */
+	double lastRestartMs;       /* time to restart, from exit to new start */
 }  RestartCounters;
 
+/*
+ * Restarting a service that has just crashed is done at once. When a service
+ * keeps crashing, we wait for delayMs before the second restart in a row,
+ * and multiply the delay at each following restart, up to maxDelayMs. A
+ * service that has been running for SUPERVISOR_RESTART_STABLE_TIME seconds
+ * is restarted at once again the next time it quits.
+ *
+ * A zero-valued RestartBackoff uses the SUPERVISOR_RESTART_* defaults.
+ */
+typedef struct RestartBackoff
+{
+	int delayMs;
+	int multiplier;
+	int maxDelayMs;
+} RestartBackoff;
+
+/*
+ * The supervisor applies the scheduling of a service process once it has
+ * started it, so that the keeper main loop keeps running in time on busy
+ * hosts. The policy is one of "other", "batch", "fifo" or "rr", and cpuList
+ * is a list of CPUs such as "0,2-3". A zero-valued ServiceScheduling leaves
+ * the process as it was forked.
+ *
+ * Memory locks are not inherited by child processes, so lockMemory is
+ * applied by the supervisor to itself, and by the service process to itself.
+ */
+typedef struct ServiceScheduling
+{
+	char policy[NAMEDATALEN];
+	int nice;
+	char cpuList[BUFSIZE];
+	int lockMemory;
+} ServiceScheduling;
+
+/* we don't have that many services, see SERVICE_NAME_* above */
+#define SUPERVISOR_MAX_SERVICES 8
+
 /*
  * The supervisor works with an array of Service entries. Each service defines
  * its behavior thanks to a start function, a stop function, and a reload
@@ -102,6 +148,10 @@ typedef struct Service
 	bool (*startFunction)(void *context, pid_t *pid);
 	void *context;             /* Service Context (Monitor or Keeper struct) */
 	RestartCounters restartCounters;
+	RestartBackoff backoff;
+	ServiceScheduling scheduling;
+	int pidfd;                 /* process file descriptor, when supported */
+	pid_t pidfdPid;            /* pid that pidfd has been opened for */
 } Service;
 
 
@@ -133,5 +183,8 @@ bool supervisor_find_service_pid(const char *pidfile,
 								 const char *serviceName,
 								 pid_t *pid);
 
+void supervisor_wait_for_services(Service services[], int serviceCount,
+								  int timeoutMs);
+
 
 #endif /* SUPERVISOR_H */
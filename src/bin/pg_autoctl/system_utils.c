@@ -8,21 +8,36 @@
  */
 
 #if defined(__linux__)
+#include <ctype.h>
+#include <sched.h>
+#include <sys/stat.h>
 #include <sys/sysinfo.h>
+#include <sys/sysmacros.h>
+#include <dirent.h>
+#include <unistd.h>
 #else
 #include <sys/types.h>
 #include <sys/sysctl.h>
 #include <sys/param.h>
 #endif
 
+#include <errno.h>
 #include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 
+#include "defaults.h"
 #include "log.h"
 #include "file_utils.h"
 #include "system_utils.h"
 
 #if defined(__linux__)
 static bool get_system_info_linux(SystemInfo *sysInfo);
+static void get_numa_nodes_linux(SystemInfo *sysInfo);
+static void get_huge_pages_linux(SystemInfo *sysInfo);
+static bool read_sysfs_int(const char *path, int *value);
 #endif
 
 #if defined(__APPLE__) || defined(BSD)
@@ -66,11 +81,430 @@ get_system_info_linux(SystemInfo *sysInfo)
 	sysInfo->ncpu = get_nprocs();
 	sysInfo->totalram = linuxSysInfo.totalram;
 
+	(void) get_numa_nodes_linux(sysInfo);
+	(void) get_huge_pages_linux(sysInfo);
+
+	return true;
+}
+
+
+/*
+ * get_numa_nodes_linux counts the NUMA nodes listed in sysfs. Systems without
+ * NUMA support don't have the directory, and we leave numaNodes to zero.
+ */
+static void
+get_numa_nodes_linux(SystemInfo *sysInfo)
+{
+	DIR *dir = opendir("/sys/devices/system/node");
+	struct dirent *entry = NULL;
+
+	if (dir == NULL)
+	{
+		return;
+	}
+
+	while ((entry = readdir(dir)) != NULL)
+	{
+		if (strncmp(entry->d_name, "node", 4) == 0 &&
+			isdigit((unsigned char) entry->d_name[4]))
+		{
+			++(sysInfo->numaNodes);
+		}
+	}
+
+	closedir(dir);
+}
+
+
+/*
+ * get_huge_pages_linux reads the number and size of the huge pages that the
+ * system has reserved from /proc/meminfo. Files in /proc don't have a size,
+ * we read them a line at a time.
+ */
+static void
+get_huge_pages_linux(SystemInfo *sysInfo)
+{
+	char line[BUFSIZE] = { 0 };
+	FILE *meminfo = fopen_read_only("/proc/meminfo");
+
+	if (meminfo == NULL)
+	{
+		return;
+	}
+
+	while (fgets(line, sizeof(line), meminfo) != NULL)
+	{
+		unsigned long long value = 0;
+
+		if (sscanf(line, "HugePages_Total: %llu", &value) == 1)
+		{
+			sysInfo->hugePagesTotal = value;
+		}
+		else if (sscanf(line, "Hugepagesize: %llu kB", &value) == 1)
+		{
+			sysInfo->hugePageSize = value * 1024;
+		}
+	}
+
+	fclose(meminfo);
+}
+
+
+/*
+ * get_storage_info finds the block device that holds the given path in
+ * sysfs, and whether it's a rotational disk, an SSD, or an NVMe device.
+ * Partitions don't have their own queue directory, we then look at the
+ * parent device.
+ */
+bool
+get_storage_info(const char *path, SystemInfo *sysInfo)
+{
+	struct stat st;
+	char devicePath[MAXPGPATH] = { 0 };
+	char resolvedPath[MAXPGPATH] = { 0 };
+	char rotationalPath[MAXPGPATH] = { 0 };
+	int rotational = 0;
+
+	sysInfo->storage = STORAGE_KIND_UNKNOWN;
+
+	if (stat(path, &st) != 0)
+	{
+		log_debug("Failed to stat \"%s\": %m", path);
+		return false;
+	}
+
+	sformat(devicePath, sizeof(devicePath), "/sys/dev/block/%u:%u",
+			major(st.st_dev), minor(st.st_dev));
+
+	if (realpath(devicePath, resolvedPath) == NULL)
+	{
+		/* tmpfs, overlayfs, network file systems... */
+		log_debug("Failed to find the block device of \"%s\"", path);
+		return false;
+	}
+
+	sformat(rotationalPath, sizeof(rotationalPath),
+			"%s/queue/rotational", resolvedPath);
+
+	if (!read_sysfs_int(rotationalPath, &rotational))
+	{
+		sformat(rotationalPath, sizeof(rotationalPath),
+				"%s/../queue/rotational", resolvedPath);
+
+		if (!read_sysfs_int(rotationalPath, &rotational))
+		{
+			log_debug("Failed to read \"%s\"", rotationalPath);
+			return false;
+		}
+	}
+
+	if (rotational == 1)
+	{
+		sysInfo->storage = STORAGE_KIND_HDD;
+	}
+	else if (strstr(resolvedPath, "/nvme") != NULL)
+	{
+		sysInfo->storage = STORAGE_KIND_NVME;
+	}
+	else
+	{
+		sysInfo->storage = STORAGE_KIND_SSD;
+	}
+
+	return true;
+}
+
+
+/*
+ * read_sysfs_int reads a sysfs file that contains a single integer.
+ */
+static bool
+read_sysfs_int(const char *path, int *value)
+{
+	char line[BUFSIZE] = { 0 };
+
+	if (!file_exists(path))
+	{
+		return false;
+	}
+
+	FILE *file = fopen_read_only(path);
+
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	bool success = fgets(line, sizeof(line), file) != NULL &&
+				   sscanf(line, "%d", value) == 1;
+
+	fclose(file);
+
+	return success;
+}
+
+
+/*
+ * get_cpu_times reads the cumulative CPU time of the system from the first
+ * line of /proc/stat, which adds up all the CPUs:
+ *
+ *   cpu  user nice system idle iowait irq softirq steal ...
+ */
+bool
+get_cpu_times(CPUTimes *cpuTimes)
+{
+	char line[BUFSIZE] = { 0 };
+	unsigned long long user = 0, nice = 0, system = 0, idle = 0;
+	unsigned long long iowait = 0, irq = 0, softirq = 0, steal = 0;
+
+	FILE *stat = fopen_read_only("/proc/stat");
+
+	if (stat == NULL)
+	{
+		log_debug("Failed to open \"/proc/stat\": %m");
+		return false;
+	}
+
+	bool success =
+		fgets(line, sizeof(line), stat) != NULL &&
+		sscanf(line, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+			   &user, &nice, &system, &idle,
+			   &iowait, &irq, &softirq, &steal) >= 5;
+
+	fclose(stat);
+
+	if (!success)
+	{
+		log_debug("Failed to parse the cpu line of \"/proc/stat\"");
+		return false;
+	}
+
+	cpuTimes->idle = idle;
+	cpuTimes->iowait = iowait;
+	cpuTimes->total = user + nice + system + idle + iowait + irq + softirq + steal;
+
+	return true;
+}
+
+
+#else
+
+
+/*
+ * get_storage_info is only implemented on Linux, elsewhere the storage kind
+ * is unknown.
+ */
+bool
+get_storage_info(const char *path, SystemInfo *sysInfo)
+{
+	sysInfo->storage = STORAGE_KIND_UNKNOWN;
+
+	return false;
+}
+
+
+/*
+ * get_cpu_times is only implemented on Linux, elsewhere we don't report the
+ * CPU usage.
+ */
+bool
+get_cpu_times(CPUTimes *cpuTimes)
+{
+	return false;
+}
+
+
+#endif
+
+
+/*
+ * set_process_sched_policy sets the scheduling policy of the given process to
+ * one of "other", "batch", "fifo" or "rr". The real-time policies "fifo" and
+ * "rr" use their lowest priority, which is enough for the process to run
+ * before any process of the default policy. Scheduling policies are only
+ * supported on Linux, where changing to a real-time policy requires the
+ * CAP_SYS_NICE capability or an RLIMIT_RTPRIO limit.
+ */
+bool
+set_process_sched_policy(pid_t pid, const char *policy)
+{
+#if defined(__linux__)
+	int policyId = -1;
+
+	if (strcmp(policy, "other") == 0)
+	{
+		policyId = SCHED_OTHER;
+	}
+	else if (strcmp(policy, "batch") == 0)
+	{
+		policyId = SCHED_BATCH;
+	}
+	else if (strcmp(policy, "fifo") == 0)
+	{
+		policyId = SCHED_FIFO;
+	}
+	else if (strcmp(policy, "rr") == 0)
+	{
+		policyId = SCHED_RR;
+	}
+	else
+	{
+		log_error("Unknown scheduling policy \"%s\", expected one of "
+				  "\"other\", \"batch\", \"fifo\" or \"rr\"",
+				  policy);
+		return false;
+	}
+
+	struct sched_param param = { 0 };
+
+	param.sched_priority = sched_get_priority_min(policyId);
+
+	if (sched_setscheduler(pid, policyId, &param) != 0)
+	{
+		log_error("Failed to set scheduling policy \"%s\" for process %d: %m",
+				  policy, pid);
+		return false;
+	}
+
+	return true;
+#else
+	if (strcmp(policy, "other") == 0)
+	{
+		return true;
+	}
+
+	log_error("Failed to set scheduling policy \"%s\" for process %d: "
+			  "scheduling policies are only supported on Linux",
+			  policy, pid);
+	return false;
+#endif
+}
+
+
+/*
+ * set_process_nice sets the nice value of the given process, from -20 (most
+ * favorable scheduling) to 19 (least favorable).
+ */
+bool
+set_process_nice(pid_t pid, int nice)
+{
+	if (setpriority(PRIO_PROCESS, pid, nice) != 0)
+	{
+		log_error("Failed to set nice value %d for process %d: %m", nice, pid);
+		return false;
+	}
+
 	return true;
 }
 
 
+/*
+ * set_process_cpu_affinity restricts the given process to run on the CPUs of
+ * cpuList, such as "0,2-3". CPU affinity is only supported on Linux.
+ */
+bool
+set_process_cpu_affinity(pid_t pid, const char *cpuList)
+{
+#if defined(__linux__)
+	cpu_set_t cpuSet;
+	const char *ptr = cpuList;
+
+	CPU_ZERO(&cpuSet);
+
+	while (*ptr != '\0')
+	{
+		char *end = NULL;
+		long first, last;
+
+		errno = 0;
+		first = last = strtol(ptr, &end, 10);
+
+		if (*end == '-')
+		{
+			ptr = end + 1;
+			last = strtol(ptr, &end, 10);
+		}
+
+		if (errno != 0 || end == ptr || first < 0 || last < first ||
+			last >= CPU_SETSIZE || (*end != ',' && *end != '\0'))
+		{
+			log_error("Failed to parse CPU list \"%s\"", cpuList);
+			return false;
+		}
+
+		for (long cpu = first; cpu <= last; cpu++)
+		{
+			CPU_SET(cpu, &cpuSet);
+		}
+
+		ptr = *end == ',' ? end + 1 : end;
+	}
+
+	if (sched_setaffinity(pid, sizeof(cpuSet), &cpuSet) != 0)
+	{
+		log_error("Failed to set CPU affinity \"%s\" for process %d: %m",
+				  cpuList, pid);
+		return false;
+	}
+
+	return true;
+#else
+	log_error("Failed to set CPU affinity \"%s\" for process %d: "
+			  "CPU affinity is only supported on Linux",
+			  cpuList, pid);
+	return false;
 #endif
+}
+
+
+/*
+ * lock_process_memory locks the current and future memory pages of the
+ * calling process in RAM, so that it is never paged out. The locks are not
+ * inherited by the child processes, nor kept across execve(), so each process
+ * has to lock its own memory.
+ */
+bool
+lock_process_memory()
+{
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+	{
+		log_error("Failed to lock the memory of process %d: %m", getpid());
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * storage_kind_to_string returns a string representation of a storage kind.
+ */
+char *
+storage_kind_to_string(StorageKind storage)
+{
+	switch (storage)
+	{
+		case STORAGE_KIND_HDD:
+		{
+			return "HDD";
+		}
+
+		case STORAGE_KIND_SSD:
+		{
+			return "SSD";
+		}
+
+		case STORAGE_KIND_NVME:
+		{
+			return "NVMe";
+		}
+
+		case STORAGE_KIND_UNKNOWN:
+			return "unknown";
+	}
+
+	return "unknown";
+}
 
 
 /*
@@ -11,16 +11,45 @@
 #define SYSTEM_UTILS_H
 
 #include <stdbool.h>
+#include <sys/types.h>
 
 
+/* kind of storage device that holds a given directory */
+typedef enum
+{
+	STORAGE_KIND_UNKNOWN = 0,
+	STORAGE_KIND_HDD,
+	STORAGE_KIND_SSD,
+	STORAGE_KIND_NVME
+} StorageKind;
+
 /* taken from sysinfo(2) on Linux */
 typedef struct SystemInfo
 {
 	uint64_t totalram;          /* Total usable main memory size */
 	unsigned short ncpu;        /* Number of current processes */
+	unsigned short numaNodes;   /* Number of NUMA nodes, 0 when unknown */
+	uint64_t hugePagesTotal;    /* Number of huge pages reserved */
+	uint64_t hugePageSize;      /* Size of the huge pages, in bytes */
+	StorageKind storage;        /* Storage of the given directory */
 } SystemInfo;
 
+/* cumulative CPU time of the system, in clock ticks, from /proc/stat */
+typedef struct CPUTimes
+{
+	uint64_t total;
+	uint64_t idle;
+	uint64_t iowait;
+} CPUTimes;
+
 bool get_system_info(SystemInfo *sysInfo);
+bool get_cpu_times(CPUTimes *cpuTimes);
+bool get_storage_info(const char *path, SystemInfo *sysInfo);
+char * storage_kind_to_string(StorageKind storage);
+bool set_process_sched_policy(pid_t pid, const char *policy);
+bool set_process_nice(pid_t pid, int nice);
+bool set_process_cpu_affinity(pid_t pid, const char *cpuList);
+bool lock_process_memory(void);
 void pretty_print_bytes(char *buffer, size_t size, uint64_t bytes);
 
 
@@ -27,6 +27,25 @@
 	make_strbuf_option_default("Unit", "Description", NULL, true, BUFSIZE, \
 							   config->Description, "pg_auto_failover")
 
+/*
+ * pg_autoctl implements the sd_notify(3) protocol: READY=1 is sent by the
+ * node-active sub-process once the monitor has been contacted and Postgres
+ * is running, hence NotifyAccess=all. Reaching that point might take a long
+ * time (pg_basebackup, monitor unavailable at boot), so we do not time out.
+ */
+#define OPTION_SYSTEMD_TYPE(config) \
+	make_strbuf_option_default("Service", "Type", NULL, true, BUFSIZE, \
+							   config->Type, "notify")
+
+#define OPTION_SYSTEMD_NOTIFY_ACCESS(config) \
+	make_strbuf_option_default("Service", "NotifyAccess", NULL, true, BUFSIZE, \
+							   config->NotifyAccess, "all")
+
+#define OPTION_SYSTEMD_TIMEOUT_START_SEC(config) \
+	make_strbuf_option_default("Service", "TimeoutStartSec", \
+							   NULL, true, BUFSIZE, \
+							   config->TimeoutStartSec, "infinity")
+
 #define OPTION_SYSTEMD_WORKING_DIRECTORY(config) \
 	make_strbuf_option_default("Service", "WorkingDirectory", \
 							   NULL, true, BUFSIZE, \
@@ -65,6 +84,9 @@
 #define SET_INI_OPTIONS_ARRAY(config) \
 	{ \
 		OPTION_SYSTEMD_DESCRIPTION(config), \
+		OPTION_SYSTEMD_TYPE(config), \
+		OPTION_SYSTEMD_NOTIFY_ACCESS(config), \
+		OPTION_SYSTEMD_TIMEOUT_START_SEC(config), \
 		OPTION_SYSTEMD_WORKING_DIRECTORY(config), \
 		OPTION_SYSTEMD_ENVIRONMENT_PGDATA(config), \
 		OPTION_SYSTEMD_USER(config), \
@@ -23,6 +23,9 @@ typedef struct SystemdServiceConfig
 	char Description[BUFSIZE];
 
 	/* Service */
+	char Type[BUFSIZE];
+	char NotifyAccess[BUFSIZE];
+	char TimeoutStartSec[BUFSIZE];
 	char WorkingDirectory[MAXPGPATH];
 	char EnvironmentPGDATA[BUFSIZE];
 	char User[NAMEDATALEN];
@@ -0,0 +1,138 @@
+/*
+ * src/bin/pg_autoctl/systemd_notify.c
+ *     Implement the systemd sd_notify(3) protocol for Type=notify services
+ *
+ * We do not link with libsystemd: the protocol is a single datagram sent to
+ * the unix socket found in the NOTIFY_SOCKET environment variable, and when
+ * that variable is not set (we are not running under systemd, or the unit
+ * is not Type=notify) every function here is a no-op.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "postgres_fe.h"
+
+#include "defaults.h"
+#include "file_utils.h"
+#include "log.h"
+#include "systemd_notify.h"
+
+
+/*
+ * systemd_notify sends the given message to the systemd notification socket,
+ * when there is one. Messages are newline separated assignments such as
+ * "READY=1" or "STATUS=...", see sd_notify(3).
+ */
+bool
+systemd_notify(const char *message)
+{
+	const char *socketPath = getenv("NOTIFY_SOCKET");
+
+	if (socketPath == NULL || socketPath[0] == '\0')
+	{
+		/* not running as a systemd Type=notify service */
+		return true;
+	}
+
+	/* systemd uses either an absolute pathname or an abstract socket */
+	size_t pathLength = strlen(socketPath);
+
+	if ((socketPath[0] != '/' && socketPath[0] != '@') || pathLength < 2)
+	{
+		log_warn("Ignoring unsupported NOTIFY_SOCKET \"%s\"", socketPath);
+		return false;
+	}
+
+	struct sockaddr_un addr = { 0 };
+
+	if (pathLength >= sizeof(addr.sun_path))
+	{
+		log_warn("Ignoring NOTIFY_SOCKET \"%s\": path is too long", socketPath);
+		return false;
+	}
+
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, socketPath, pathLength);
+
+	/* a leading @ denotes a Linux abstract namespace socket */
+	if (addr.sun_path[0] == '@')
+	{
+		addr.sun_path[0] = '\0';
+	}
+
+	socklen_t addrLength = offsetof(struct sockaddr_un, sun_path) + pathLength;
+
+	int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+	if (fd < 0)
+	{
+		log_warn("Failed to create systemd notification socket: %m");
+		return false;
+	}
+
+	ssize_t sent = sendto(fd, message, strlen(message), MSG_NOSIGNAL,
+						  (struct sockaddr *) &addr, addrLength);
+
+	if (sent < 0)
+	{
+		log_warn("Failed to notify systemd at \"%s\": %m", socketPath);
+		close(fd);
+		return false;
+	}
+
+	close(fd);
+
+	log_trace("systemd_notify: %s", message);
+
+	return true;
+}
+
+
+/*
+ * systemd_notify_ready tells systemd that the service has finished starting
+ * up, along with a status line for systemctl status.
+ */
+bool
+systemd_notify_ready(const char *status)
+{
+	char message[BUFSIZE] = { 0 };
+
+	sformat(message, sizeof(message), "READY=1\nSTATUS=%s", status);
+
+	return systemd_notify(message);
+}
+
+
+/*
+ * systemd_notify_status updates the status line shown by systemctl status.
+ */
+bool
+systemd_notify_status(const char *status)
+{
+	char message[BUFSIZE] = { 0 };
+
+	sformat(message, sizeof(message), "STATUS=%s", status);
+
+	return systemd_notify(message);
+}
+
+
+/*
+ * systemd_notify_watchdog keeps the systemd watchdog happy, when the unit
+ * uses WatchdogSec. Otherwise systemd ignores the message.
+ */
+bool
+systemd_notify_watchdog(void)
+{
+	return systemd_notify("WATCHDOG=1");
+}
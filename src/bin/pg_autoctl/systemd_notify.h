@@ -0,0 +1,20 @@
+/*
+ * src/bin/pg_autoctl/systemd_notify.h
+ *     Implement the systemd sd_notify(3) protocol for Type=notify services
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#ifndef SYSTEMD_NOTIFY_H
+#define SYSTEMD_NOTIFY_H
+
+#include <stdbool.h>
+
+bool systemd_notify(const char *message);
+bool systemd_notify_ready(const char *status);
+bool systemd_notify_status(const char *status);
+bool systemd_notify_watchdog(void);
+
+#endif /* SYSTEMD_NOTIFY_H */
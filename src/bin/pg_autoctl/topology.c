@@ -0,0 +1,306 @@
+/*
+ * src/bin/pg_autoctl/topology.c
+ *     Local snapshot of the topology of our group, for client discovery
+ *
+ * When topology.snapshot is set, the keeper maintains a JSON file with the
+ * list of the nodes of its group, their role, and their LSN as last reported
+ * to the monitor. When topology.service_file is also set, the keeper also
+ * maintains a libpq connection service file for the group.
+ *
+ * Both files are written in the pg_autoctl runtime directory, next to the
+ * pidfile, and are renamed in place so that readers never see a partial
+ * write. They are only written again when their contents change, so that
+ * sidecars watching them with inotify are only woken up when something
+ * happened.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "postgres_fe.h"
+#include "pqexpbuffer.h"
+
+#include "parson.h"
+
+#include "defaults.h"
+#include "file_utils.h"
+#include "keeper.h"
+#include "log.h"
+#include "parsing.h"
+#include "state.h"
+#include "topology.h"
+
+
+static void topology_node_as_json(NodeAddress *node, bool local, bool ready,
+								  uint64_t primaryLSN, JSON_Array *jsNodes);
+static bool topology_write_service_file(Keeper *keeper,
+										NodeAddressArray *nodesArray);
+static bool topology_write_file_if_changed(char *data, long size,
+										   const char *filename);
+
+
+/*
+ * topology_write_snapshot writes the topology file for our group, from the
+ * given list of other nodes and our local state.
+ */
+bool
+topology_write_snapshot(Keeper *keeper, NodeAddressArray *otherNodes)
+{
+	KeeperConfig *config = &(keeper->config);
+	LocalPostgresServer *postgres = &(keeper->postgres);
+
+	NodeAddressArray nodesArray = { 0 };
+	NodeAddress localNode = { 0 };
+	uint64_t primaryLSN = 0;
+
+	/* the local node is not part of the other nodes list, add it first */
+	localNode.nodeId = keeper->state.current_node_id;
+	localNode.port = config->pgSetup.pgport;
+	localNode.isPrimary = NodeStateIsPrimary(keeper->state.current_role);
+
+	strlcpy(localNode.name, config->name, sizeof(localNode.name));
+	strlcpy(localNode.host, config->hostname, sizeof(localNode.host));
+	strlcpy(localNode.lsn, postgres->currentLSN, sizeof(localNode.lsn));
+
+	if (!nodeAddressArrayAppend(&nodesArray, &localNode))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	for (int index = 0; index < otherNodes->count; index++)
+	{
+		if (!nodeAddressArrayAppend(&nodesArray, &(otherNodes->nodes[index])))
+		{
+			/* errors have already been logged */
+			nodeAddressArrayFree(&nodesArray);
+			return false;
+		}
+	}
+
+	/* the lag of each node is computed against the primary LSN, if any */
+	for (int index = 0; index < nodesArray.count; index++)
+	{
+		NodeAddress *node = &(nodesArray.nodes[index]);
+
+		if (node->isPrimary && !parseLSN(node->lsn, &primaryLSN))
+		{
+			primaryLSN = 0;
+		}
+	}
+
+	JSON_Value *js = json_value_init_object();
+	JSON_Value *jsNodesValue = json_value_init_array();
+
+	JSON_Object *jsRoot = json_value_get_object(js);
+	JSON_Array *jsNodes = json_value_get_array(jsNodesValue);
+
+	json_object_set_string(jsRoot, "formation", config->formation);
+	json_object_set_number(jsRoot, "group", (double) config->groupId);
+	json_object_set_string(jsRoot, "dbname", config->pgSetup.dbname);
+
+	for (int index = 0; index < nodesArray.count; index++)
+	{
+		/* the local node is not ready while draining its read sessions */
+		bool local = index == 0;
+		bool ready = !local || !keeper->standbyDraining;
+
+		(void) topology_node_as_json(&(nodesArray.nodes[index]),
+									 local,
+									 ready,
+									 primaryLSN,
+									 jsNodes);
+	}
+
+	json_object_set_value(jsRoot, "nodes", jsNodesValue);
+
+	char *serialized_string = json_serialize_to_string_pretty(js);
+
+	bool success =
+		topology_write_file_if_changed(serialized_string,
+									   strlen(serialized_string),
+									   config->pathnames.topology);
+
+	json_free_serialized_string(serialized_string);
+	json_value_free(js);
+
+	if (success && config->topology_service_file)
+	{
+		success = topology_write_service_file(keeper, &nodesArray);
+	}
+
+	nodeAddressArrayFree(&nodesArray);
+
+	return success;
+}
+
+
+/*
+ * topology_node_as_json appends the given node to the given JSON array.
+ */
+static void
+topology_node_as_json(NodeAddress *node, bool local, bool ready,
+					  uint64_t primaryLSN, JSON_Array *jsNodes)
+{
+	JSON_Value *jsNode = json_value_init_object();
+	JSON_Object *jsNodeObj = json_value_get_object(jsNode);
+
+	uint64_t lsn = 0;
+
+	json_object_set_number(jsNodeObj, "node_id", (double) node->nodeId);
+	json_object_set_string(jsNodeObj, "name", node->name);
+	json_object_set_string(jsNodeObj, "host", node->host);
+	json_object_set_number(jsNodeObj, "port", (double) node->port);
+	json_object_set_string(jsNodeObj, "role",
+						   node->isPrimary ? "primary" : "standby");
+	json_object_set_boolean(jsNodeObj, "local", local);
+	json_object_set_boolean(jsNodeObj, "ready", ready);
+	json_object_set_string(jsNodeObj, "lsn", node->lsn);
+
+	if (primaryLSN > 0 && parseLSN(node->lsn, &lsn))
+	{
+		uint64_t lag = primaryLSN > lsn ? primaryLSN - lsn : 0;
+
+		json_object_set_number(jsNodeObj, "lag", (double) lag);
+	}
+	else
+	{
+		json_object_set_null(jsNodeObj, "lag");
+	}
+
+	json_array_append_value(jsNodes, jsNode);
+}
+
+
+/*
+ * topology_write_service_file writes a libpq connection service file with a
+ * service for the group, that always connects to the primary thanks to
+ * target_session_attrs, and a service for the current primary only. Client
+ * applications use it with PGSERVICEFILE and PGSERVICE, or the service
+ * connection parameter.
+ */
+static bool
+topology_write_service_file(Keeper *keeper, NodeAddressArray *nodesArray)
+{
+	KeeperConfig *config = &(keeper->config);
+	PQExpBuffer contents = createPQExpBuffer();
+	char serviceName[BUFSIZE] = { 0 };
+
+	if (contents == NULL)
+	{
+		log_error("Failed to allocate memory");
+		return false;
+	}
+
+	if (config->groupId > 0)
+	{
+		sformat(serviceName, sizeof(serviceName), "%s_%d",
+				config->formation, config->groupId);
+	}
+	else
+	{
+		strlcpy(serviceName, config->formation, sizeof(serviceName));
+	}
+
+	appendPQExpBuffer(contents,
+					  "# pg_auto_failover formation \"%s\" group %d\n"
+					  "# maintained by pg_autoctl, do not edit\n\n"
+					  "[%s]\n",
+					  config->formation,
+					  config->groupId,
+					  serviceName);
+
+	appendPQExpBufferStr(contents, "host=");
+
+	for (int index = 0; index < nodesArray->count; index++)
+	{
+		appendPQExpBuffer(contents, "%s%s",
+						  index == 0 ? "" : ",",
+						  nodesArray->nodes[index].host);
+	}
+
+	appendPQExpBufferStr(contents, "\nport=");
+
+	for (int index = 0; index < nodesArray->count; index++)
+	{
+		appendPQExpBuffer(contents, "%s%d",
+						  index == 0 ? "" : ",",
+						  nodesArray->nodes[index].port);
+	}
+
+	appendPQExpBuffer(contents,
+					  "\ndbname=%s\n"
+					  "target_session_attrs=read-write\n",
+					  config->pgSetup.dbname);
+
+	for (int index = 0; index < nodesArray->count; index++)
+	{
+		NodeAddress *node = &(nodesArray->nodes[index]);
+
+		if (node->isPrimary)
+		{
+			appendPQExpBuffer(contents,
+							  "\n[%s_primary]\n"
+							  "host=%s\n"
+							  "port=%d\n"
+							  "dbname=%s\n",
+							  serviceName,
+							  node->host,
+							  node->port,
+							  config->pgSetup.dbname);
+			break;
+		}
+	}
+
+	/* memory allocation could have failed while building string */
+	if (PQExpBufferBroken(contents))
+	{
+		log_error("Failed to allocate memory");
+		destroyPQExpBuffer(contents);
+		return false;
+	}
+
+	bool success =
+		topology_write_file_if_changed(contents->data,
+									   contents->len,
+									   config->pathnames.topologyService);
+
+	destroyPQExpBuffer(contents);
+
+	return success;
+}
+
+
+/*
+ * topology_write_file_if_changed writes the given contents to filename, only
+ * when the file does not already have the same contents.
+ */
+static bool
+topology_write_file_if_changed(char *data, long size, const char *filename)
+{
+	char *contents = NULL;
+	long fileSize = 0;
+
+	if (file_exists(filename) &&
+		read_file_if_exists(filename, &contents, &fileSize))
+	{
+		bool unchanged =
+			fileSize == size && memcmp(contents, data, size) == 0;
+
+		free(contents);
+
+		if (unchanged)
+		{
+			return true;
+		}
+	}
+
+	log_debug("Writing topology file \"%s\"", filename);
+
+	return write_file_atomic(data, size, filename);
+}
@@ -0,0 +1,20 @@
+/*
+ * src/bin/pg_autoctl/topology.h
+ *     Local snapshot of the topology of our group, for client discovery
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stdbool.h>
+
+#include "keeper.h"
+#include "pgsql.h"
+
+bool topology_write_snapshot(Keeper *keeper, NodeAddressArray *otherNodes);
+
+#endif /* TOPOLOGY_H */
@@ -46,11 +46,17 @@
 volatile sig_atomic_t window_size_changed = 0;      /* SIGWINCH */
 
 static bool cli_watch_update_from_monitor(WatchContext *context);
+static bool cli_watch_update_events(WatchContext *context, bool applyToNodes);
+static bool cli_watch_events_pending(WatchContext *context);
+static void cli_watch_apply_event(WatchContext *context, MonitorEvent *event);
+static void cli_watch_process_notification(void *ctx,
+										   CurrentNodeState *nodeState);
 static bool cli_watch_process_keys(WatchContext *context);
 
 static int print_watch_header(WatchContext *context, int r);
 static int print_watch_footer(WatchContext *context);
-static int print_nodes_array(WatchContext *context, int r, int c);
+static int print_nodes_array(WatchContext *context, int r, int c,
+							 bool computeLens);
 static int print_events_array(WatchContext *context, int r, int c);
 
 static void print_current_time(WatchContext *context, int r);
@@ -114,8 +120,6 @@ cli_watch_main_loop(WatchContext *context)
 {
 	WatchContext previous = { 0 };
 
-	int step = -1;
-
 	/* the main loop */
 	for (;;)
 	{
@@ -126,13 +130,11 @@ cli_watch_main_loop(WatchContext *context)
 
 		/*
 		 * First, update the data that we want to display, and process key
-		 * strokes. We are going to update our data set twice per second, and
-		 * we want to react to key strokes and other events much faster than
-		 * this, every 50ms.
+		 * strokes. We react to key strokes and monitor notifications every
+		 * 50ms, and only fetch the whole data set from the monitor now and
+		 * then, see cli_watch_update().
 		 */
-		step = (step + 1) % 10;
-
-		(void) cli_watch_update(context, step);
+		(void) cli_watch_update(context);
 
 		if (context->shouldExit)
 		{
@@ -218,15 +220,72 @@ cli_watch_end_window(WatchContext *context)
 
 /*
  * watch_update updates the context to be displayed on the terminal window.
+ *
+ * We LISTEN to the monitor's state change notifications, and apply them to
+ * our nodes array as soon as they are received. A state change also means a
+ * new event, and we only fetch the events that are more recent than the ones
+ * we already have. The whole current state is fetched again only every
+ * WATCH_LISTEN_UPDATE_INTERVAL_MS, to update the reported LSN positions, or
+ * when we get notified about a node we don't know yet.
+ *
+ * When we can't LISTEN, we fetch everything every WATCH_UPDATE_INTERVAL_MS.
+ * When we could LISTEN again after having lost the connection, we catch up
+ * with the events that we missed in the meantime instead, since the events
+ * have the state changes that the notifications would have told us about.
  */
 bool
-cli_watch_update(WatchContext *context, int step)
+cli_watch_update(WatchContext *context)
 {
-	/* only update data from the monitor at step 0 */
-	if (step == 0)
+	Monitor *monitor = &(context->monitor);
+
+	instr_time elapsed;
+
+	if (context->listening)
+	{
+		context->listening =
+			monitor_poll_state_notifications(monitor,
+											 context->formation,
+											 context->groupId,
+											 (void *) context,
+											 &cli_watch_process_notification);
+	}
+
+	INSTR_TIME_SET_CURRENT(elapsed);
+	INSTR_TIME_SUBTRACT(elapsed, context->updateTime);
+
+	int interval =
+		context->listening
+		? WATCH_LISTEN_UPDATE_INTERVAL_MS
+		: WATCH_UPDATE_INTERVAL_MS;
+
+	if (!context->listening &&
+		!context->nodesNeedUpdate &&
+		context->lastEventId > 0 &&
+		INSTR_TIME_GET_MILLISEC(elapsed) >= WATCH_UPDATE_INTERVAL_MS &&
+		monitor_poll_state_notifications(monitor,
+										 context->formation,
+										 context->groupId,
+										 (void *) context,
+										 &cli_watch_process_notification))
+	{
+		context->listening = true;
+		context->couldContactMonitor = cli_watch_update_events(context, true);
+	}
+	else if (INSTR_TIME_IS_ZERO(context->updateTime) ||
+			 context->nodesNeedUpdate ||
+			 INSTR_TIME_GET_MILLISEC(elapsed) >= interval)
 	{
 		context->couldContactMonitor = cli_watch_update_from_monitor(context);
 	}
+	else if (context->eventsNeedUpdate || cli_watch_events_pending(context))
+	{
+		context->couldContactMonitor = cli_watch_update_events(context, true);
+	}
+
+	INSTR_TIME_SET_CURRENT(elapsed);
+	INSTR_TIME_SUBTRACT(elapsed, context->updateTime);
+
+	context->nodesAge = (int) (INSTR_TIME_GET_MILLISEC(elapsed) / 1000);
 
 	/* now process any key pressed by the user */
 	bool processKeys = cli_watch_process_keys(context);
@@ -247,51 +306,260 @@ cli_watch_update_from_monitor(WatchContext *context)
 {
 	Monitor *monitor = &(context->monitor);
 	CurrentNodeStateArray *nodesArray = &(context->nodesArray);
-	MonitorEventsArray *eventsArray = &(context->eventsArray);
+
+	INSTR_TIME_SET_CURRENT(context->updateTime);
+
+	/*
+	 * LISTEN before fetching the current state, so that we don't miss the
+	 * changes that happen in between.
+	 */
+	if (!context->listening)
+	{
+		context->listening =
+			monitor_poll_state_notifications(monitor,
+											 context->formation,
+											 context->groupId,
+											 (void *) context,
+											 &cli_watch_process_notification);
+	}
 
 	/*
 	 * We use a transaction despite being read-only, because we want to re-use
 	 * a single connection to the monitor.
 	 */
 	PGSQL *pgsql = &(monitor->pgsql);
+	PGSQL *readClient = &(monitor->readClient);
 
 	pgsql->connectionStatementType = PGSQL_CONNECTION_MULTI_STATEMENT;
 
-	if (!monitor_get_current_state(monitor,
-								   context->formation,
-								   context->groupId,
-								   nodesArray))
+	if (monitor->hasReadClient)
 	{
-		/* errors have already been logged */
-		return false;
+		readClient->connectionStatementType = PGSQL_CONNECTION_MULTI_STATEMENT;
 	}
 
-	if (!monitor_get_formation_number_sync_standbys(
+	bool success =
+		monitor_get_current_state(monitor,
+								  context->formation,
+								  context->groupId,
+								  nodesArray) &&
+		monitor_get_formation_number_sync_standbys(
 			monitor,
 			context->formation,
-			&(context->number_sync_standbys)))
+			&(context->number_sync_standbys)) &&
+		cli_watch_update_events(context, false);
+
+	/* time to finish our connections */
+	pgsql_finish(pgsql);
+
+	if (monitor->hasReadClient)
 	{
-		/* errors have already been logged */
-		return false;
+		pgsql_finish(readClient);
 	}
 
-	if (!monitor_get_last_events(monitor,
-								 context->formation,
-								 context->groupId,
-								 EVENTS_BUFFER_COUNT,
-								 eventsArray))
+	if (success)
+	{
+		context->nodesNeedUpdate = false;
+		++context->nodesVersion;
+	}
+
+	/* errors have already been logged */
+	return success;
+}
+
+
+/*
+ * cli_watch_update_events fetches the events that are more recent than the
+ * ones we already have, and appends them to our events array, keeping only
+ * the EVENTS_BUFFER_COUNT most recent events. When applyToNodes is true, the
+ * state changes that the new events record are also applied to our nodes
+ * array.
+ */
+static bool
+cli_watch_update_events(WatchContext *context, bool applyToNodes)
+{
+	MonitorEventsArray *eventsArray = &(context->eventsArray);
+
+	/* that's a large array, and we only have one watch context */
+	static MonitorEventsArray newEventsArray = { 0 };
+
+	/* on failure, we fetch the events again with the whole current state */
+	context->eventsNeedUpdate = false;
+
+	INSTR_TIME_SET_CURRENT(context->eventsTime);
+
+	if (!monitor_get_events_since(&(context->monitor),
+								  context->formation,
+								  context->groupId,
+								  context->lastEventId,
+								  EVENTS_BUFFER_COUNT,
+								  &newEventsArray,
+								  &(context->eventsWatermark)))
 	{
 		/* errors have already been logged */
 		return false;
 	}
 
-	/* time to finish our connection */
-	pgsql_finish(pgsql);
+	if (newEventsArray.count == 0)
+	{
+		return true;
+	}
+
+	if (applyToNodes)
+	{
+		/* we might have missed older events, fetch everything again */
+		if (newEventsArray.count == EVENTS_BUFFER_COUNT)
+		{
+			context->nodesNeedUpdate = true;
+		}
+
+		for (int index = 0; index < newEventsArray.count; index++)
+		{
+			cli_watch_apply_event(context, &(newEventsArray.events[index]));
+		}
+	}
+
+	/* make room for the new events, forgetting about the oldest ones */
+	int keep =
+		Min(eventsArray->count, EVENTS_BUFFER_COUNT - newEventsArray.count);
+
+	if (keep < eventsArray->count)
+	{
+		memmove(&(eventsArray->events[0]),
+				&(eventsArray->events[eventsArray->count - keep]),
+				keep * sizeof(MonitorEvent));
+	}
+
+	memcpy(&(eventsArray->events[keep]),
+		   &(newEventsArray.events[0]),
+		   newEventsArray.count * sizeof(MonitorEvent));
+
+	eventsArray->count = keep + newEventsArray.count;
+
+	context->lastEventId = eventsArray->events[eventsArray->count - 1].eventId;
+	++context->eventsVersion;
 
 	return true;
 }
 
 
+/*
+ * cli_watch_events_pending returns true when we have been notified about an
+ * event that was not visible yet when we last fetched the events, because a
+ * transaction with a smaller event id had not committed yet, or because the
+ * event is deferred. We then fetch the events again, at most every
+ * WATCH_UPDATE_INTERVAL_MS.
+ *
+ * Once the watermark is past the notified event, it has either been fetched
+ * or will never show up, as when deferred events are lost in a crash.
+ */
+static bool
+cli_watch_events_pending(WatchContext *context)
+{
+	instr_time elapsed;
+
+	if (context->notifiedEventId <= context->eventsWatermark)
+	{
+		return false;
+	}
+
+	INSTR_TIME_SET_CURRENT(elapsed);
+	INSTR_TIME_SUBTRACT(elapsed, context->eventsTime);
+
+	return INSTR_TIME_GET_MILLISEC(elapsed) >= WATCH_UPDATE_INTERVAL_MS;
+}
+
+
+/*
+ * cli_watch_apply_event applies the state change recorded in the given event
+ * to our nodes array, unless we already know about a more recent change of
+ * the same node.
+ */
+static void
+cli_watch_apply_event(WatchContext *context, MonitorEvent *event)
+{
+	CurrentNodeStateArray *nodesArray = &(context->nodesArray);
+
+	for (int index = 0; index < nodesArray->count; index++)
+	{
+		CurrentNodeState *node = &(nodesArray->nodes[index]);
+
+		if (node->node.nodeId == event->nodeId)
+		{
+			if (event->eventId > node->eventId)
+			{
+				node->reportedState = event->reportedState;
+				node->goalState = event->assignedState;
+				node->candidatePriority = event->candidatePriority;
+				node->replicationQuorum = event->replicationQuorum;
+				node->eventId = event->eventId;
+
+				++context->nodesVersion;
+			}
+
+			return;
+		}
+	}
+
+	/* that's a new node, fetch the whole current state again */
+	context->nodesNeedUpdate = true;
+}
+
+
+/*
+ * cli_watch_process_notification is a NotificationProcessingFunction that
+ * applies a state change notification to our nodes array.
+ */
+static void
+cli_watch_process_notification(void *ctx, CurrentNodeState *nodeState)
+{
+	WatchContext *context = (WatchContext *) ctx;
+	CurrentNodeStateArray *nodesArray = &(context->nodesArray);
+
+	if (strcmp(nodeState->formation, context->formation) != 0 ||
+		(context->groupId >= 0 && nodeState->groupId != context->groupId))
+	{
+		return;
+	}
+
+	/*
+	 * Each state change is also a new event, that we might have fetched
+	 * already. Monitors before 2.1 don't send the eventId.
+	 */
+	if (nodeState->eventId == 0 || nodeState->eventId > context->lastEventId)
+	{
+		context->eventsNeedUpdate = true;
+	}
+
+	if (nodeState->eventId > context->notifiedEventId)
+	{
+		context->notifiedEventId = nodeState->eventId;
+	}
+
+	for (int index = 0; index < nodesArray->count; index++)
+	{
+		CurrentNodeState *node = &(nodesArray->nodes[index]);
+
+		if (node->node.nodeId == nodeState->node.nodeId)
+		{
+			if (nodeState->eventId == 0 || nodeState->eventId > node->eventId)
+			{
+				node->reportedState = nodeState->reportedState;
+				node->goalState = nodeState->goalState;
+				node->health = nodeState->health;
+				node->eventId = nodeState->eventId;
+
+				++context->nodesVersion;
+			}
+
+			return;
+		}
+	}
+
+	/* that's a new node, fetch the whole current state again */
+	context->nodesNeedUpdate = true;
+}
+
+
 /* Capture CTRL + a key */
 #define ctrl(x) ((x) & 0x1f)
 
@@ -532,6 +800,30 @@ cli_watch_render(WatchContext *context, WatchContext *previous)
 		}
 	}
 
+	/*
+	 * Most of the times nothing changed since the previous call, and we then
+	 * avoid redisplaying what's already visible on the terminal: we compare
+	 * the current context with the previous one, and the versions of the data
+	 * that cli_watch_update() maintains.
+	 */
+	bool displayChanged =
+		context->rows != previous->rows ||
+		context->cols != previous->cols ||
+		context->selectedRow != previous->selectedRow ||
+		context->selectedArea != previous->selectedArea ||
+		context->startCol != previous->startCol ||
+		context->cookedMode != previous->cookedMode;
+
+	bool nodesChanged =
+		displayChanged ||
+		context->nodesVersion != previous->nodesVersion ||
+		context->nodesAge != previous->nodesAge;
+
+	bool eventsChanged =
+		displayChanged ||
+		context->eventsVersion != previous->eventsVersion ||
+		context->nodesArray.count != previous->nodesArray.count;
+
 	/*
 	 * Print the main header and then the nodes array.
 	 */
@@ -541,28 +833,25 @@ cli_watch_render(WatchContext *context, WatchContext *previous)
 	(void) clear_line_at(1);
 	++printedRows;
 
-	int nodeRows = print_nodes_array(context, nodeHeaderRow, 0);
-	printedRows += nodeRows;
+	if (nodesChanged)
+	{
+		bool computeLens =
+			context->nodesVersion != previous->nodesVersion ||
+			context->cols != previous->cols;
+
+		context->nodesRows =
+			print_nodes_array(context, nodeHeaderRow, 0, computeLens);
+	}
+
+	printedRows += context->nodesRows;
 
 	(void) clear_line_at(printedRows);
 
 	/*
-	 * Now print the events array. Because that operation is more expensive,
-	 * and because most of the times there is no event happening, we compare
-	 * the current context with the previous one and avoid this part of the
-	 * code entirely when we figure out that we would only redisplay what's
-	 * already visible on the terminal.
+	 * Now print the events array, which is more expensive, only when it
+	 * changed or moved.
 	 */
-
-	if (context->rows != previous->rows ||
-		context->cols != previous->cols ||
-		context->selectedRow != previous->selectedRow ||
-		context->selectedArea != previous->selectedArea ||
-		context->startCol != previous->startCol ||
-		context->cookedMode != previous->cookedMode ||
-		context->eventsArray.count != previous->eventsArray.count ||
-		(context->eventsArray.events[0].eventId !=
-		 previous->eventsArray.events[0].eventId))
+	if (eventsChanged)
 	{
 		(void) clear_line_at(++printedRows);
 
@@ -684,14 +973,18 @@ print_watch_footer(WatchContext *context)
  * window of size (context->rows, context->cols).
  */
 static int
-print_nodes_array(WatchContext *context, int r, int c)
+print_nodes_array(WatchContext *context, int r, int c, bool computeLens)
 {
 	CurrentNodeStateArray *nodesArray = &(context->nodesArray);
 
 	int lines = 0;
 	int currentRow = r;
 
-	(void) compute_column_spec_lens(context);
+	/* the column lengths only change with the data to display */
+	if (computeLens)
+	{
+		(void) compute_column_spec_lens(context);
+	}
 
 	ColPolicy *columnPolicy = pick_column_policy(context);
 
@@ -1026,7 +1319,8 @@ print_node_state(WatchContext *context, ColPolicy *policy,
 			{
 				char str[9] = { 0 };
 
-				(void) IntervalToString(nodeState->healthLag, str, sizeof(str));
+				(void) IntervalToString(nodeState->healthLag + context->nodesAge,
+										str, sizeof(str));
 
 				mvprintw(r, cc, "%*s", len, str);
 				break;
@@ -1036,16 +1330,19 @@ print_node_state(WatchContext *context, ColPolicy *policy,
 			{
 				char str[9] = { 0 };
 
-				if (nodeState->reportLag > 10.0)
+				/* lags are aged since we fetched them, see cli_watch_update */
+				double reportLag = nodeState->reportLag + context->nodesAge;
+
+				if (reportLag > 10.0)
 				{
 					attron(A_REVERSE);
 				}
 
-				(void) IntervalToString(nodeState->reportLag, str, sizeof(str));
+				(void) IntervalToString(reportLag, str, sizeof(str));
 
 				mvprintw(r, cc, "%*s", len, str);
 
-				if (nodeState->reportLag > 10.0)
+				if (reportLag > 10.0)
 				{
 					attroff(A_REVERSE);
 				}
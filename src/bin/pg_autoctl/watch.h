@@ -43,6 +43,14 @@ typedef struct MonitorEventsHeaders
 
 #define EVENTS_BUFFER_COUNT 80
 
+/*
+ * We LISTEN to the state changes of the formation, and then we only need to
+ * fetch the whole current state from the monitor now and then, to update the
+ * reported LSN positions. When we can't LISTEN, we poll more often.
+ */
+#define WATCH_UPDATE_INTERVAL_MS 500
+#define WATCH_LISTEN_UPDATE_INTERVAL_MS 5000
+
 /* share a context between the update and render functions */
 typedef struct WatchContext
 {
@@ -52,6 +60,7 @@ typedef struct WatchContext
 	int selectedRow;
 	int selectedArea;           /* area 1: node states, area 2: node events */
 	int startCol;
+	int nodesRows;              /* rows used by the nodes array, with header */
 	WatchMoveFocus move;
 
 	/* internal state */
@@ -66,6 +75,21 @@ typedef struct WatchContext
 	int groupId;
 	int number_sync_standbys;
 
+	/* incremental updates from the monitor */
+	bool listening;
+	bool nodesNeedUpdate;       /* notified about a node we don't know */
+	bool eventsNeedUpdate;      /* notified about a state change */
+	instr_time updateTime;      /* when we last fetched the current state */
+	instr_time eventsTime;      /* when we last fetched the events */
+	int64_t lastEventId;        /* most recent event we fetched */
+	int64_t eventsWatermark;    /* events up to there were visible then */
+	int64_t notifiedEventId;    /* most recent event we were notified about */
+
+	/* versions of the data to display, to only redraw what changed */
+	uint64_t nodesVersion;
+	uint64_t eventsVersion;
+	int nodesAge;               /* seconds since updateTime, to age the lags */
+
 	/* data to display */
 	CurrentNodeStateArray nodesArray;
 	MonitorEventsArray eventsArray;
@@ -76,7 +100,7 @@ void cli_watch_main_loop(WatchContext *context);
 void cli_watch_init_window(WatchContext *context);
 void cli_watch_end_window(WatchContext *context);
 
-bool cli_watch_update(WatchContext *context, int step);
+bool cli_watch_update(WatchContext *context);
 bool cli_watch_render(WatchContext *context, WatchContext *previous);
 
 #endif  /* WATCH_H */
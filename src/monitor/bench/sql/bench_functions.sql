@@ -0,0 +1,251 @@
+-- Copyright (c) Microsoft Corporation. All rights reserved.
+-- Licensed under the PostgreSQL License.
+
+-- Performance checks of the monitor API: we register a citus formation of
+-- :groups groups of :nodes nodes each, and then call each of the functions
+-- that the keepers and the clients use :iterations times.
+--
+-- The regression output only lists the functions and how many calls were
+-- made, the timings and the buffer usage of a call as seen by EXPLAIN
+-- (ANALYZE, BUFFERS) are written to the :report file. To see the plans of
+-- the queries run within the functions, use -v auto_explain=on, and find
+-- them in the server logs.
+--
+--   make -C src/monitor installcheck-bench
+--   psql -v groups=100 -v iterations=1000 -f bench/sql/bench_functions.sql
+\set ECHO none
+
+\if :{?groups}
+\else
+\set groups 10
+\endif
+
+\if :{?nodes}
+\else
+\set nodes 3
+\endif
+
+\if :{?iterations}
+\else
+\set iterations 10000
+\endif
+
+\if :{?report}
+\else
+\set report results/bench_functions.report
+\endif
+
+\if :{?auto_explain}
+\else
+\set auto_explain off
+\endif
+
+set client_min_messages to warning;
+
+create extension if not exists pgautofailover cascade;
+
+select set_config('bench.groups', :'groups', false),
+       set_config('bench.nodes', :'nodes', false),
+       set_config('bench.iterations', :'iterations', false)
+\gset
+
+create temp table bench_calls
+ (
+   name     text,
+   callno   int,
+   ms       double precision
+ );
+
+create temp table bench_plans
+ (
+   name     text,
+   plan     json
+ );
+
+--
+-- The functions are called for each node in turn, with $1 the node id, $2
+-- its group id, and $3 its goal state. A call to node_active reports the
+-- goal state of the node as its current state, as a keeper does once it
+-- has reached its goal.
+--
+create temp table bench_queries
+ (
+   name     text,
+   query    text
+ );
+
+insert into bench_queries(name, query)
+     values ('node_active',
+             'select * from pgautofailover.node_active(''bench'', $1, $2, '
+             'current_group_role => $3)'),
+            ('get_other_nodes',
+             'select * from pgautofailover.get_other_nodes($1)'),
+            ('current_state',
+             'select * from pgautofailover.current_state(''bench'')'),
+            ('last_events',
+             'select * from pgautofailover.last_events(''bench'', 10)'),
+            ('formation_uri',
+             'select pgautofailover.formation_uri(''bench'')'),
+            ('synchronous_standby_names',
+             'select pgautofailover.synchronous_standby_names(''bench'', $2)');
+
+--
+-- Register the nodes, and have them report their goal state until every
+-- group has a primary and its secondary nodes.
+--
+select *
+  from pgautofailover.create_formation('bench', 'citus', 'bench', true, 0)
+\gset
+
+do $$
+declare
+  groups int := current_setting('bench.groups')::int;
+  nodes  int := current_setting('bench.nodes')::int;
+begin
+  for g in 0 .. groups - 1
+  loop
+    for n in 1 .. nodes
+    loop
+      perform pgautofailover.register_node(
+                'bench', 'localhost', 10000 + g * nodes + n, 'bench',
+                node_name => format('bench_%s_%s', g, n),
+                sysidentifier => 6852685710417058800 + g,
+                desired_group_id => g,
+                node_kind => case when g = 0 then 'coordinator'
+                                  else 'worker' end);
+    end loop;
+  end loop;
+end
+$$;
+
+do $$
+declare
+  node record;
+begin
+  for round in 1 .. 10
+  loop
+    for node in select nodeid, groupid, goalstate
+                  from pgautofailover.node
+                 where formationid = 'bench'
+              order by nodeid
+    loop
+      perform pgautofailover.node_active('bench', node.nodeid, node.groupid,
+                                         current_group_role => node.goalstate);
+    end loop;
+  end loop;
+end
+$$;
+
+--
+-- Now time the calls of each function in turn.
+--
+do $$
+declare
+  q          record;
+  node       record;
+  nodes      bigint[];
+  iterations int := current_setting('bench.iterations')::int;
+  i          int;
+  start      timestamptz;
+begin
+  select array_agg(nodeid order by nodeid)
+    into nodes
+    from pgautofailover.node
+   where formationid = 'bench';
+
+  for q in select name, query from bench_queries order by name
+  loop
+    for i in 0 .. iterations - 1
+    loop
+      select nodeid, groupid, goalstate
+        into node
+        from pgautofailover.node
+       where nodeid = nodes[1 + i % array_length(nodes, 1)];
+
+      start := clock_timestamp();
+
+      execute q.query using node.nodeid, node.groupid, node.goalstate;
+
+      insert into bench_calls(name, callno, ms)
+           values (q.name, i,
+                   extract(epoch from clock_timestamp() - start) * 1000);
+    end loop;
+  end loop;
+end
+$$;
+
+--
+-- And get the execution time and the buffer usage of a call of each
+-- function. The buffers that the queries within the function used are
+-- counted in the top-level plan node.
+--
+\if :auto_explain
+load 'auto_explain';
+set auto_explain.log_min_duration to 0;
+set auto_explain.log_analyze to on;
+set auto_explain.log_buffers to on;
+set auto_explain.log_nested_statements to on;
+\endif
+
+do $$
+declare
+  q     record;
+  node  record;
+  plan  json;
+begin
+  select nodeid, groupid, goalstate
+    into node
+    from pgautofailover.node
+   where formationid = 'bench'
+order by nodeid
+   limit 1;
+
+  for q in select name, query from bench_queries order by name
+  loop
+    execute 'explain (analyze, buffers, format json) ' || q.query
+       into plan
+      using node.nodeid, node.groupid, node.goalstate;
+
+    insert into bench_plans(name, plan) values(q.name, plan);
+  end loop;
+end
+$$;
+
+\if :auto_explain
+reset auto_explain.log_min_duration;
+\endif
+
+\o :report
+
+select :'groups' as groups, :'nodes' as nodes, :'iterations' as iterations;
+
+  select c.name,
+         count(*) as calls,
+         round(avg(ms)::numeric, 3) as avg_ms,
+         round(percentile_cont(0.5) within group (order by ms)::numeric, 3)
+         as p50_ms,
+         round(percentile_cont(0.99) within group (order by ms)::numeric, 3)
+         as p99_ms,
+         round(max(ms)::numeric, 3) as max_ms,
+         round((p.plan->0->>'Execution Time')::numeric, 3) as explain_ms,
+         p.plan->0->'Plan'->>'Shared Hit Blocks' as shared_hit,
+         p.plan->0->'Plan'->>'Shared Read Blocks' as shared_read
+    from bench_calls c
+    join bench_plans p using(name)
+group by c.name, p.plan::text
+order by c.name;
+
+\o
+
+--
+-- The regression output only depends on the settings.
+--
+\pset format unaligned
+\pset tuples_only on
+
+  select name, count(*)
+    from bench_calls
+group by name
+order by name;
+
+drop extension pgautofailover;
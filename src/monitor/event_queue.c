@@ -0,0 +1,961 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/event_queue.c
+ *
+ * Implementation of the deferred logging of events in the
+ * pgautofailover.event table.
+ *
+ * When pgautofailover.deferred_events is on, NotifyStateChange() does not
+ * insert the event in the node_active transaction anymore. The event is
+ * copied in a slot of a shared memory queue instead, and the first health
+ * check worker of the database inserts the queued events in batches.
+ *
+ * Events get their eventid from the event sequence when they are queued, and
+ * are inserted in that order. A slot is only made visible to the worker when
+ * the transaction that queued the event commits, so that events of aborted
+ * state changes are never logged, the same as their NOTIFY.
+ *
+ * The eventid order is not the order in which events become visible: the
+ * transactions that log events commit in any order, and a deferred event is
+ * only inserted at the next round of the worker. A reader that fetches the
+ * events with an eventid greater than the last one it got would then skip the
+ * events that show up later with a smaller eventid. That's why every eventid,
+ * deferred or not, is taken while holding the queue lock and tracked until
+ * its event is visible or aborted, and event_watermark() returns the eventid
+ * up to which readers can safely fetch events.
+ *
+ * The queue only lives in shared memory. The worker inserts the pending
+ * events before the monitor stops, but when any backend crashes the
+ * postmaster re-initializes shared memory, and the events that have not been
+ * inserted yet are lost. The state changes themselves are not lost, only the
+ * rows that record them in the event table.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+/* these are internal headers */
+#include "event_queue.h"
+#include "metadata.h"
+#include "node_metadata.h"
+#include "notifications.h"
+#include "replication_state.h"
+#include "version_compat.h"
+
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lmgr.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/pg_lsn.h"
+#include "utils/timestamp.h"
+
+
+/*
+ * When the queue is full, or when an event does not fit in a slot, the event
+ * is inserted right away as if deferred events were disabled.
+ */
+#define EVENT_QUEUE_SIZE 128
+#define EVENT_QUEUE_NAME_SIZE 256
+
+/*
+ * The eventids of the events inserted right away are tracked until the end of
+ * the transaction that inserts them. When all the entries are in use, we only
+ * count the eventids that don't fit, and keep the smallest of them until that
+ * count is back to zero.
+ */
+#define EVENT_IN_FLIGHT_SIZE 128
+
+#define AUTO_FAILOVER_EVENT_SEQUENCE_NAME "event_eventid_seq"
+#define AUTO_FAILOVER_EVENT_SEQUENCE "pgautofailover.event_eventid_seq"
+
+
+typedef enum EventSlotState
+{
+	EVENT_SLOT_FREE = 0,
+	EVENT_SLOT_RESERVED,        /* being filled, transaction in progress */
+	EVENT_SLOT_READY            /* committed, waiting to be inserted */
+} EventSlotState;
+
+typedef struct QueuedEvent
+{
+	EventSlotState state;
+	Oid dboid;
+	int64 eventId;
+	TimestampTz eventTime;
+	char formationId[NAMEDATALEN];
+	int64 nodeId;
+	int groupId;
+	char nodeName[EVENT_QUEUE_NAME_SIZE];
+	char nodeHost[EVENT_QUEUE_NAME_SIZE];
+	int nodePort;
+	ReplicationState reportedState;
+	ReplicationState goalState;
+	SyncState pgsrSyncState;
+	int reportedTLI;
+	XLogRecPtr reportedLSN;
+	int candidatePriority;
+	bool replicationQuorum;
+	EventCode eventCode;
+	char description[BUFSIZE];
+} QueuedEvent;
+
+typedef struct InFlightEventId
+{
+	Oid dboid;
+	int64 eventId;              /* 0 when the entry is free */
+} InFlightEventId;
+
+typedef struct EventQueueControlData
+{
+	int trancheId;
+	char *lockTrancheName;
+	LWLock lock;
+	QueuedEvent slots[EVENT_QUEUE_SIZE];
+	InFlightEventId inFlight[EVENT_IN_FLIGHT_SIZE];
+	int overflowCount;
+	int64 overflowEventId;
+} EventQueueControlData;
+
+/*
+ * PendingEventSlot tracks a slot or an in-flight eventid reserved by the
+ * current transaction, and the subtransaction that logged the event.
+ */
+typedef struct PendingEventSlot
+{
+	int slot;
+	int inFlight;
+	bool overflow;
+	SubTransactionId subId;
+} PendingEventSlot;
+
+/*
+ * ReadyEvent is a copy of a committed event, taken by the worker.
+ */
+typedef struct ReadyEvent
+{
+	int slot;
+	QueuedEvent event;
+} ReadyEvent;
+
+
+/* GUC variables */
+bool DeferredEvents = false;
+
+static EventQueueControlData *EventQueueControl = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* slots reserved by the current transaction, in TopTransactionContext */
+static List *PendingEventSlots = NIL;
+
+
+static void EventQueueShmemInit(void);
+static PendingEventSlot * NewPendingEventSlot(void);
+static int ReserveEventSlot(int64 *eventId);
+static int64 NextEventId(Oid sequenceId);
+static void ReleasePendingEventSlot(PendingEventSlot *pendingSlot,
+									EventSlotState state);
+static void SetPendingSlotsState(EventSlotState state);
+static int64 LastEventId(void);
+static int64 LowestInFlightEventId(Oid databaseId);
+static void EventQueueXactCallback(XactEvent event, void *arg);
+static void EventQueueSubXactCallback(SubXactEvent event,
+									  SubTransactionId mySubid,
+									  SubTransactionId parentSubid,
+									  void *arg);
+static int CompareReadyEvents(const void *left, const void *right);
+
+
+PG_FUNCTION_INFO_V1(event_watermark);
+
+
+/*
+ * InitializeEventQueue, called at server start, requests the shared memory
+ * needed by the event queue and registers the transaction callbacks.
+ */
+void
+InitializeEventQueue(void)
+{
+	/* on PG 15, we use shmem_request_hook_type */
+#if PG_VERSION_NUM < 150000
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(EventQueueShmemSize());
+	}
+#endif
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = EventQueueShmemInit;
+
+	RegisterXactCallback(EventQueueXactCallback, NULL);
+	RegisterSubXactCallback(EventQueueSubXactCallback, NULL);
+}
+
+
+/*
+ * EventQueueShmemSize computes how much shared memory the event queue needs.
+ */
+size_t
+EventQueueShmemSize(void)
+{
+	return sizeof(EventQueueControlData);
+}
+
+
+/*
+ * EventQueueShmemInit initializes the shared memory of the event queue.
+ */
+static void
+EventQueueShmemInit(void)
+{
+	bool alreadyInitialized = false;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	EventQueueControl =
+		(EventQueueControlData *) ShmemInitStruct("pg_auto_failover Event Queue",
+												  sizeof(EventQueueControlData),
+												  &alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		memset(EventQueueControl, 0, sizeof(EventQueueControlData));
+
+		EventQueueControl->trancheId = LWLockNewTrancheId();
+		EventQueueControl->lockTrancheName = "pg_auto_failover Event Queue";
+		LWLockRegisterTranche(EventQueueControl->trancheId,
+							  EventQueueControl->lockTrancheName);
+
+		LWLockInitialize(&EventQueueControl->lock, EventQueueControl->trancheId);
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/*
+ * QueueEvent copies the given event in a slot of the event queue, and returns
+ * the eventid it has been given. When the event can't be queued, 0 is
+ * returned and the caller inserts the event itself.
+ */
+int64
+QueueEvent(AutoFailoverNode *node, EventCode eventCode, char *description)
+{
+	if (strlen(node->formationId) >= NAMEDATALEN ||
+		strlen(node->nodeName) >= EVENT_QUEUE_NAME_SIZE ||
+		strlen(node->nodeHost) >= EVENT_QUEUE_NAME_SIZE ||
+		strlen(description) >= BUFSIZE)
+	{
+		return 0;
+	}
+
+	int64 eventId = 0;
+	int slot = ReserveEventSlot(&eventId);
+
+	if (slot < 0)
+	{
+		return 0;
+	}
+
+	/*
+	 * The slot is now ours until the end of the transaction, and is not read
+	 * by anyone else until it's marked ready, so we fill it without holding
+	 * the lock. Its database and eventid have already been set.
+	 */
+	QueuedEvent *event = &(EventQueueControl->slots[slot]);
+
+	/* that's the default value of eventtime: now() */
+	event->eventTime = GetCurrentTransactionStartTimestamp();
+
+	strlcpy(event->formationId, node->formationId, NAMEDATALEN);
+	event->nodeId = node->nodeId;
+	event->groupId = node->groupId;
+	strlcpy(event->nodeName, node->nodeName, EVENT_QUEUE_NAME_SIZE);
+	strlcpy(event->nodeHost, node->nodeHost, EVENT_QUEUE_NAME_SIZE);
+	event->nodePort = node->nodePort;
+	event->reportedState = node->reportedState;
+	event->goalState = node->goalState;
+	event->pgsrSyncState = node->pgsrSyncState;
+	event->reportedTLI = node->reportedTLI;
+	event->reportedLSN = node->reportedLSN;
+	event->candidatePriority = node->candidatePriority;
+	event->replicationQuorum = node->replicationQuorum;
+	event->eventCode = eventCode;
+	strlcpy(event->description, description, BUFSIZE);
+
+	return eventId;
+}
+
+
+/*
+ * AssignEventId returns a new eventid for an event that the current
+ * transaction inserts right away, and tracks it until the transaction ends,
+ * so that event_watermark() does not go past it before the event is visible.
+ */
+int64
+AssignEventId(void)
+{
+	Oid sequenceId = pgAutoFailoverRelationId(AUTO_FAILOVER_EVENT_SEQUENCE_NAME);
+
+	/* allocate first, we can't error out with an eventid not tracked */
+	PendingEventSlot *pendingSlot = NewPendingEventSlot();
+
+	/*
+	 * nextval() locks the sequence, lock it before the queue lock so that we
+	 * never wait for a heavyweight lock while holding an LWLock.
+	 */
+	LockRelationOid(sequenceId, RowExclusiveLock);
+
+	LWLockAcquire(&EventQueueControl->lock, LW_EXCLUSIVE);
+
+	int64 eventId = NextEventId(sequenceId);
+
+	for (int index = 0; index < EVENT_IN_FLIGHT_SIZE; index++)
+	{
+		InFlightEventId *inFlight = &(EventQueueControl->inFlight[index]);
+
+		if (inFlight->eventId == 0)
+		{
+			inFlight->dboid = MyDatabaseId;
+			inFlight->eventId = eventId;
+			pendingSlot->inFlight = index;
+			break;
+		}
+	}
+
+	if (pendingSlot->inFlight < 0)
+	{
+		if (EventQueueControl->overflowCount == 0 ||
+			eventId < EventQueueControl->overflowEventId)
+		{
+			EventQueueControl->overflowEventId = eventId;
+		}
+
+		++EventQueueControl->overflowCount;
+		pendingSlot->overflow = true;
+	}
+
+	LWLockRelease(&EventQueueControl->lock);
+
+	return eventId;
+}
+
+
+/*
+ * NewPendingEventSlot adds a new entry to the list of the slots reserved by
+ * the current transaction, and returns it.
+ */
+static PendingEventSlot *
+NewPendingEventSlot(void)
+{
+	MemoryContext oldContext = MemoryContextSwitchTo(TopTransactionContext);
+	PendingEventSlot *pendingSlot = palloc0(sizeof(PendingEventSlot));
+	PendingEventSlots = lappend(PendingEventSlots, pendingSlot);
+	MemoryContextSwitchTo(oldContext);
+
+	pendingSlot->slot = -1;
+	pendingSlot->inFlight = -1;
+	pendingSlot->overflow = false;
+	pendingSlot->subId = GetCurrentSubTransactionId();
+
+	return pendingSlot;
+}
+
+
+/*
+ * ReserveEventSlot finds a free slot in the queue and reserves it for the
+ * current transaction, with a new eventid, or returns -1 when the queue is
+ * full.
+ */
+static int
+ReserveEventSlot(int64 *eventId)
+{
+	int slot = -1;
+	Oid sequenceId = pgAutoFailoverRelationId(AUTO_FAILOVER_EVENT_SEQUENCE_NAME);
+
+	/* allocate first, we can't error out with a reserved slot not tracked */
+	PendingEventSlot *pendingSlot = NewPendingEventSlot();
+
+	/* see AssignEventId() */
+	LockRelationOid(sequenceId, RowExclusiveLock);
+
+	LWLockAcquire(&EventQueueControl->lock, LW_EXCLUSIVE);
+
+	for (int index = 0; index < EVENT_QUEUE_SIZE; index++)
+	{
+		QueuedEvent *event = &(EventQueueControl->slots[index]);
+
+		if (event->state == EVENT_SLOT_FREE)
+		{
+			event->state = EVENT_SLOT_RESERVED;
+			event->dboid = MyDatabaseId;
+			event->eventId = 0;
+			pendingSlot->slot = slot = index;
+			break;
+		}
+	}
+
+	if (slot >= 0)
+	{
+		*eventId = NextEventId(sequenceId);
+		EventQueueControl->slots[slot].eventId = *eventId;
+	}
+
+	LWLockRelease(&EventQueueControl->lock);
+
+	if (slot < 0)
+	{
+		PendingEventSlots = list_delete_ptr(PendingEventSlots, pendingSlot);
+	}
+
+	return slot;
+}
+
+
+/*
+ * NextEventId returns the next value of the event sequence. The caller holds
+ * the queue lock, so that event_watermark() never sees an eventid that has
+ * been returned and is not tracked yet.
+ */
+static int64
+NextEventId(Oid sequenceId)
+{
+	return DatumGetInt64(DirectFunctionCall1(nextval_oid,
+											 ObjectIdGetDatum(sequenceId)));
+}
+
+
+/*
+ * ReleasePendingEventSlot sets the state of the slot reserved by the given
+ * entry, and forgets about its in-flight eventid. The caller holds the queue
+ * lock.
+ */
+static void
+ReleasePendingEventSlot(PendingEventSlot *pendingSlot, EventSlotState state)
+{
+	if (pendingSlot->slot >= 0)
+	{
+		EventQueueControl->slots[pendingSlot->slot].state = state;
+	}
+
+	if (pendingSlot->inFlight >= 0)
+	{
+		EventQueueControl->inFlight[pendingSlot->inFlight].eventId = 0;
+	}
+
+	if (pendingSlot->overflow)
+	{
+		--EventQueueControl->overflowCount;
+	}
+}
+
+
+/*
+ * SetPendingSlotsState marks the slots reserved by the current transaction as
+ * ready, when the transaction commits, or as free again when it aborts. The
+ * in-flight eventids are released in both cases.
+ */
+static void
+SetPendingSlotsState(EventSlotState state)
+{
+	ListCell *pendingCell = NULL;
+
+	if (PendingEventSlots == NIL)
+	{
+		return;
+	}
+
+	LWLockAcquire(&EventQueueControl->lock, LW_EXCLUSIVE);
+
+	foreach(pendingCell, PendingEventSlots)
+	{
+		PendingEventSlot *pendingSlot = (PendingEventSlot *) lfirst(pendingCell);
+
+		ReleasePendingEventSlot(pendingSlot, state);
+	}
+
+	LWLockRelease(&EventQueueControl->lock);
+
+	/* the list itself is released with TopTransactionContext */
+	PendingEventSlots = NIL;
+}
+
+
+/*
+ * EventQueueXactCallback publishes the events queued by a transaction when it
+ * commits, and forgets about them when it aborts. XACT_EVENT_COMMIT is sent
+ * once the transaction is visible as committed, so its events that have been
+ * inserted right away are visible when we release their eventids.
+ */
+static void
+EventQueueXactCallback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		{
+			SetPendingSlotsState(EVENT_SLOT_READY);
+			break;
+		}
+
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+		{
+			SetPendingSlotsState(EVENT_SLOT_FREE);
+			break;
+		}
+
+		case XACT_EVENT_PRE_PREPARE:
+		{
+			if (PendingEventSlots != NIL)
+			{
+				ereport(ERROR,
+						(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						 errmsg("cannot PREPARE a transaction that has "
+								"logged pg_auto_failover events")));
+			}
+			break;
+		}
+
+		default:
+		{
+			break;
+		}
+	}
+}
+
+
+/*
+ * EventQueueSubXactCallback forgets about the events queued by a
+ * subtransaction that aborts, and hands over the events of a subtransaction
+ * that commits to its parent.
+ */
+static void
+EventQueueSubXactCallback(SubXactEvent event, SubTransactionId mySubid,
+						  SubTransactionId parentSubid, void *arg)
+{
+	ListCell *pendingCell = NULL;
+	List *remainingSlots = NIL;
+
+	if (PendingEventSlots == NIL)
+	{
+		return;
+	}
+
+	switch (event)
+	{
+		case SUBXACT_EVENT_COMMIT_SUB:
+		{
+			foreach(pendingCell, PendingEventSlots)
+			{
+				PendingEventSlot *pendingSlot =
+					(PendingEventSlot *) lfirst(pendingCell);
+
+				if (pendingSlot->subId == mySubid)
+				{
+					pendingSlot->subId = parentSubid;
+				}
+			}
+			break;
+		}
+
+		case SUBXACT_EVENT_ABORT_SUB:
+		{
+			MemoryContext oldContext =
+				MemoryContextSwitchTo(TopTransactionContext);
+
+			LWLockAcquire(&EventQueueControl->lock, LW_EXCLUSIVE);
+
+			foreach(pendingCell, PendingEventSlots)
+			{
+				PendingEventSlot *pendingSlot =
+					(PendingEventSlot *) lfirst(pendingCell);
+
+				if (pendingSlot->subId != mySubid)
+				{
+					remainingSlots = lappend(remainingSlots, pendingSlot);
+				}
+				else
+				{
+					ReleasePendingEventSlot(pendingSlot, EVENT_SLOT_FREE);
+				}
+			}
+
+			LWLockRelease(&EventQueueControl->lock);
+
+			MemoryContextSwitchTo(oldContext);
+
+			PendingEventSlots = remainingSlots;
+			break;
+		}
+
+		default:
+		{
+			break;
+		}
+	}
+}
+
+
+/*
+ * ReadyEventSlots returns a copy of the committed events of the given
+ * database, sorted by eventid.
+ */
+List *
+ReadyEventSlots(Oid databaseId)
+{
+	List *readyEventList = NIL;
+	int readyCount = 0;
+	ReadyEvent *readyEvents = NULL;
+
+	LWLockAcquire(&EventQueueControl->lock, LW_SHARED);
+
+	for (int index = 0; index < EVENT_QUEUE_SIZE; index++)
+	{
+		QueuedEvent *event = &(EventQueueControl->slots[index]);
+
+		if (event->state == EVENT_SLOT_READY && event->dboid == databaseId)
+		{
+			if (readyEvents == NULL)
+			{
+				readyEvents = palloc(EVENT_QUEUE_SIZE * sizeof(ReadyEvent));
+			}
+
+			readyEvents[readyCount].slot = index;
+			memcpy(&(readyEvents[readyCount].event), event, sizeof(QueuedEvent));
+
+			++readyCount;
+		}
+	}
+
+	LWLockRelease(&EventQueueControl->lock);
+
+	if (readyCount == 0)
+	{
+		return NIL;
+	}
+
+	qsort(readyEvents, readyCount, sizeof(ReadyEvent), CompareReadyEvents);
+
+	for (int index = 0; index < readyCount; index++)
+	{
+		readyEventList = lappend(readyEventList, &(readyEvents[index]));
+	}
+
+	return readyEventList;
+}
+
+
+/*
+ * CompareReadyEvents is a qsort comparator that sorts events by eventid.
+ */
+static int
+CompareReadyEvents(const void *left, const void *right)
+{
+	const ReadyEvent *leftEvent = (const ReadyEvent *) left;
+	const ReadyEvent *rightEvent = (const ReadyEvent *) right;
+
+	if (leftEvent->event.eventId < rightEvent->event.eventId)
+	{
+		return -1;
+	}
+
+	return leftEvent->event.eventId > rightEvent->event.eventId ? 1 : 0;
+}
+
+
+/*
+ * InsertQueuedEvents inserts the given events in the pgautofailover.event
+ * table, in the already opened SPI connection and transaction.
+ *
+ * An event that has already been inserted, because we failed to release its
+ * slot after our previous transaction committed, is skipped.
+ */
+void
+InsertQueuedEvents(List *slotList)
+{
+	ListCell *eventCell = NULL;
+	Oid replicationStateTypeOid = ReplicationStateTypeOid();
+
+	Oid argTypes[] = {
+		INT8OID, /* eventid */
+		TIMESTAMPTZOID, /* eventtime */
+		TEXTOID, /* formationid */
+		INT8OID, /* nodeid */
+		INT4OID, /* groupid */
+		TEXTOID, /* nodename */
+		TEXTOID, /* nodehost */
+		INT4OID, /* nodeport */
+		replicationStateTypeOid, /* reportedstate */
+		replicationStateTypeOid, /* goalstate */
+		TEXTOID, /* pg_stat_replication.sync_state */
+		INT4OID, /* timeline_id */
+		LSNOID,  /* reportedLSN */
+		INT4OID, /* candidate_priority */
+		BOOLOID, /* replication_quorum */
+		TEXTOID, /* description */
+		INT2OID  /* eventcode */
+	};
+
+	const int argCount = sizeof(argTypes) / sizeof(argTypes[0]);
+
+	static MetadataPlan insertPlan = { 0 };
+
+	const char *insertQuery =
+		"INSERT INTO " AUTO_FAILOVER_EVENT_TABLE
+		"(eventid, eventtime, formationid, nodeid, groupid,"
+		" nodename, nodehost, nodeport,"
+		" reportedstate, goalstate, reportedrepstate, reportedtli, reportedlsn,"
+		" candidatepriority, replicationquorum, description, eventcode) "
+		"VALUES ($1, $2, $3, $4, $5, $6, $7, $8, $9, $10, $11, $12, $13, $14,"
+		" $15, $16, $17) "
+		"ON CONFLICT DO NOTHING";
+
+	foreach(eventCell, slotList)
+	{
+		QueuedEvent *event = &(((ReadyEvent *) lfirst(eventCell))->event);
+
+		Datum argValues[] = {
+			Int64GetDatum(event->eventId),                /* eventid */
+			TimestampTzGetDatum(event->eventTime),        /* eventtime */
+			CStringGetTextDatum(event->formationId),      /* formationid */
+			Int64GetDatum(event->nodeId),                 /* nodeid */
+			Int32GetDatum(event->groupId),                /* groupid */
+			CStringGetTextDatum(event->nodeName),         /* nodename */
+			CStringGetTextDatum(event->nodeHost),         /* nodehost */
+			Int32GetDatum(event->nodePort),               /* nodeport */
+			ObjectIdGetDatum(ReplicationStateGetEnum(event->reportedState)),
+			ObjectIdGetDatum(ReplicationStateGetEnum(event->goalState)),
+			CStringGetTextDatum(SyncStateToString(event->pgsrSyncState)),
+			Int32GetDatum(event->reportedTLI),            /* reportedTLI */
+			LSNGetDatum(event->reportedLSN),              /* reportedLSN */
+			Int32GetDatum(event->candidatePriority),      /* candidate_priority */
+			BoolGetDatum(event->replicationQuorum),       /* replication_quorum */
+			CStringGetTextDatum(event->description),      /* description */
+			Int16GetDatum((int16) event->eventCode)       /* eventcode */
+		};
+
+		int spiStatus = ExecuteMetadataPlan(&insertPlan, insertQuery,
+											argCount, argTypes, argValues,
+											NULL, false, 0);
+
+		if (spiStatus != SPI_OK_INSERT)
+		{
+			elog(ERROR, "could not insert into " AUTO_FAILOVER_EVENT_TABLE);
+		}
+	}
+}
+
+
+/*
+ * ReleaseEventSlots frees the slots of the given events, once they have been
+ * inserted. A slot that has been discarded and re-used meanwhile is left
+ * alone.
+ */
+void
+ReleaseEventSlots(List *slotList)
+{
+	ListCell *eventCell = NULL;
+
+	LWLockAcquire(&EventQueueControl->lock, LW_EXCLUSIVE);
+
+	foreach(eventCell, slotList)
+	{
+		ReadyEvent *readyEvent = (ReadyEvent *) lfirst(eventCell);
+		QueuedEvent *event = &(EventQueueControl->slots[readyEvent->slot]);
+
+		if (event->state == EVENT_SLOT_READY &&
+			event->dboid == readyEvent->event.dboid &&
+			event->eventId == readyEvent->event.eventId)
+		{
+			event->state = EVENT_SLOT_FREE;
+		}
+	}
+
+	LWLockRelease(&EventQueueControl->lock);
+}
+
+
+/*
+ * DiscardQueuedEvents frees the slots of the committed events of the given
+ * database, which is being dropped.
+ */
+void
+DiscardQueuedEvents(Oid databaseId)
+{
+	LWLockAcquire(&EventQueueControl->lock, LW_EXCLUSIVE);
+
+	for (int index = 0; index < EVENT_QUEUE_SIZE; index++)
+	{
+		QueuedEvent *event = &(EventQueueControl->slots[index]);
+
+		if (event->state == EVENT_SLOT_READY && event->dboid == databaseId)
+		{
+			event->state = EVENT_SLOT_FREE;
+		}
+	}
+
+	LWLockRelease(&EventQueueControl->lock);
+}
+
+
+/*
+ * event_watermark returns the greatest eventid such that every event with a
+ * smaller or equal eventid is either visible to the statements that start
+ * after it returns, or never going to be. Readers that fetch the events more
+ * recent than a given eventid also skip the events past the watermark,
+ * computed in a previous statement, so that they don't skip the events that
+ * show up late with a smaller eventid.
+ *
+ * We read the sequence before looking at the in-flight eventids: an eventid
+ * that had been returned by then is either still tracked, or its transaction
+ * has ended already. That relies on the sequence not caching values in the
+ * backends, which is the default.
+ */
+Datum
+event_watermark(PG_FUNCTION_ARGS)
+{
+	checkPgAutoFailoverVersion();
+
+	/* the queue of a standby is empty, whatever the primary still has */
+	if (RecoveryInProgress())
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("pgautofailover.event_watermark() cannot be "
+						"computed during recovery"),
+				 errhint("Fetch the events from the primary monitor.")));
+	}
+
+	/* a snapshot taken before us could miss the events we count as visible */
+	if (IsolationUsesXactSnapshot())
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("pgautofailover.event_watermark() is only supported "
+						"at the READ COMMITTED isolation level")));
+	}
+
+	int64 lastEventId = LastEventId();
+	int64 lowestEventId = LowestInFlightEventId(MyDatabaseId);
+
+	if (lowestEventId > 0 && lowestEventId <= lastEventId)
+	{
+		PG_RETURN_INT64(lowestEventId - 1);
+	}
+
+	PG_RETURN_INT64(lastEventId);
+}
+
+
+/*
+ * LastEventId returns the last value of the event sequence, or 0 when no
+ * eventid has been given yet.
+ */
+static int64
+LastEventId(void)
+{
+	int64 lastEventId = 0;
+
+	const char *selectQuery =
+		"SELECT last_value FROM " AUTO_FAILOVER_EVENT_SEQUENCE
+		" WHERE is_called";
+
+	SPI_connect();
+
+	int spiStatus = SPI_execute(selectQuery, true, 1);
+
+	if (spiStatus != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not read " AUTO_FAILOVER_EVENT_SEQUENCE);
+	}
+
+	if (SPI_processed > 0)
+	{
+		bool isNull = false;
+
+		Datum lastValueDatum = SPI_getbinval(SPI_tuptable->vals[0],
+											 SPI_tuptable->tupdesc,
+											 1,
+											 &isNull);
+
+		lastEventId = isNull ? 0 : DatumGetInt64(lastValueDatum);
+	}
+
+	SPI_finish();
+
+	return lastEventId;
+}
+
+
+/*
+ * LowestInFlightEventId returns the smallest eventid of the given database
+ * whose event is not visible yet, either because its transaction is still in
+ * progress or because it's a deferred event that has not been inserted yet,
+ * or 0 when there is none.
+ */
+static int64
+LowestInFlightEventId(Oid databaseId)
+{
+	int64 lowestEventId = 0;
+
+	LWLockAcquire(&EventQueueControl->lock, LW_SHARED);
+
+	for (int index = 0; index < EVENT_QUEUE_SIZE; index++)
+	{
+		QueuedEvent *event = &(EventQueueControl->slots[index]);
+
+		if (event->state != EVENT_SLOT_FREE &&
+			event->dboid == databaseId &&
+			event->eventId > 0 &&
+			(lowestEventId == 0 || event->eventId < lowestEventId))
+		{
+			lowestEventId = event->eventId;
+		}
+	}
+
+	for (int index = 0; index < EVENT_IN_FLIGHT_SIZE; index++)
+	{
+		InFlightEventId *inFlight = &(EventQueueControl->inFlight[index]);
+
+		if (inFlight->eventId > 0 &&
+			inFlight->dboid == databaseId &&
+			(lowestEventId == 0 || inFlight->eventId < lowestEventId))
+		{
+			lowestEventId = inFlight->eventId;
+		}
+	}
+
+	/* we don't know the database of those, be conservative */
+	if (EventQueueControl->overflowCount > 0 &&
+		(lowestEventId == 0 ||
+		 EventQueueControl->overflowEventId < lowestEventId))
+	{
+		lowestEventId = EventQueueControl->overflowEventId;
+	}
+
+	LWLockRelease(&EventQueueControl->lock);
+
+	return lowestEventId;
+}
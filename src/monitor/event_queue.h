@@ -0,0 +1,36 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/event_queue.h
+ *
+ * Declarations for public functions related to the deferred logging of
+ * events in the pgautofailover.event table.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "postgres.h"
+
+#include "nodes/pg_list.h"
+
+#include "node_metadata.h"
+#include "notifications.h"
+
+
+/* GUCs */
+extern bool DeferredEvents;
+
+
+extern size_t EventQueueShmemSize(void);
+extern void InitializeEventQueue(void);
+extern int64 QueueEvent(AutoFailoverNode *node, EventCode eventCode,
+						 char *description);
+extern int64 AssignEventId(void);
+extern List * ReadyEventSlots(Oid databaseId);
+extern void InsertQueuedEvents(List *slotList);
+extern void ReleaseEventSlots(List *slotList);
+extern void DiscardQueuedEvents(Oid databaseId);
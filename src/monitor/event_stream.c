@@ -0,0 +1,219 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/event_stream.c
+ *
+ * Implementation of the pgautofailover logical decoding output plugin, which
+ * streams the rows inserted in the pgautofailover.event table as JSON.
+ *
+ * The monitor events are the history of the topology changes of every
+ * formation. A logical replication slot that uses this plugin gives external
+ * consumers an ordered feed of those changes that survives disconnections,
+ * where NOTIFY messages are lost when nobody is listening. The slots are
+ * created and consumed with the functions pgautofailover.create_event_stream,
+ * read_event_stream and ack_event_stream, which pg_autoctl do monitor
+ * stream-events uses.
+ *
+ * Each event is output as the row_to_json() of the inserted row, and the
+ * commit of a transaction that inserted events is output as an empty
+ * message, so that consumers know the LSN up to which they can acknowledge
+ * the events they have processed.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+/* these are internal headers */
+#include "metadata.h"
+#include "version_compat.h"
+
+#include "access/htup_details.h"
+#include "catalog/partition.h"
+#include "replication/logical.h"
+#include "replication/output_plugin.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+
+#define AUTO_FAILOVER_EVENT_TABLE_NAME "event"
+
+typedef struct EventStreamData
+{
+	MemoryContext context;
+	Oid eventRelationId;
+	bool transactionHasEvents;
+} EventStreamData;
+
+
+static void EventStreamStartup(LogicalDecodingContext *ctx,
+							   OutputPluginOptions *opt,
+							   bool is_init);
+static void EventStreamShutdown(LogicalDecodingContext *ctx);
+static void EventStreamBegin(LogicalDecodingContext *ctx, ReorderBufferTXN *txn);
+static void EventStreamChange(LogicalDecodingContext *ctx,
+							  ReorderBufferTXN *txn,
+							  Relation relation,
+							  ReorderBufferChange *change);
+static void EventStreamCommit(LogicalDecodingContext *ctx,
+							  ReorderBufferTXN *txn,
+							  XLogRecPtr commitLSN);
+static bool IsEventRelation(EventStreamData *data, Relation relation);
+
+
+/*
+ * _PG_output_plugin_init is called by Postgres when a replication slot with
+ * the pgautofailover plugin is used.
+ */
+void
+_PG_output_plugin_init(OutputPluginCallbacks *cb)
+{
+	cb->startup_cb = EventStreamStartup;
+	cb->begin_cb = EventStreamBegin;
+	cb->change_cb = EventStreamChange;
+	cb->commit_cb = EventStreamCommit;
+	cb->shutdown_cb = EventStreamShutdown;
+}
+
+
+/*
+ * EventStreamStartup prepares the private data of our decoding session. The
+ * plugin has no options.
+ */
+static void
+EventStreamStartup(LogicalDecodingContext *ctx, OutputPluginOptions *opt,
+				   bool is_init)
+{
+	EventStreamData *data = palloc0(sizeof(EventStreamData));
+
+	if (ctx->output_plugin_options != NIL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("the pgautofailover output plugin has no options")));
+	}
+
+	data->context = AllocSetContextCreate(ctx->context,
+										  "pgautofailover event stream",
+										  ALLOCSET_DEFAULT_SIZES);
+	data->eventRelationId = InvalidOid;
+
+	ctx->output_plugin_private = data;
+	opt->output_type = OUTPUT_PLUGIN_TEXTUAL_OUTPUT;
+}
+
+
+/*
+ * EventStreamShutdown releases the memory of our decoding session.
+ */
+static void
+EventStreamShutdown(LogicalDecodingContext *ctx)
+{
+	EventStreamData *data = (EventStreamData *) ctx->output_plugin_private;
+
+	MemoryContextDelete(data->context);
+}
+
+
+/*
+ * EventStreamBegin is called at the beginning of each decoded transaction,
+ * that we only output when it inserted some events.
+ */
+static void
+EventStreamBegin(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
+{
+	EventStreamData *data = (EventStreamData *) ctx->output_plugin_private;
+
+	data->transactionHasEvents = false;
+}
+
+
+/*
+ * EventStreamChange outputs the rows inserted in the event table as JSON, and
+ * skips every other change.
+ */
+static void
+EventStreamChange(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+				  Relation relation, ReorderBufferChange *change)
+{
+	EventStreamData *data = (EventStreamData *) ctx->output_plugin_private;
+
+	if (change->action != REORDER_BUFFER_CHANGE_INSERT ||
+		change->data.tp.newtuple == NULL ||
+		!IsEventRelation(data, relation))
+	{
+		return;
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(data->context);
+
+	HeapTuple tuple = &(change->data.tp.newtuple->tuple);
+	Datum row = heap_copy_tuple_as_datum(tuple, RelationGetDescr(relation));
+	text *json = DatumGetTextPP(DirectFunctionCall1(row_to_json, row));
+
+	OutputPluginPrepareWrite(ctx, true);
+	appendBinaryStringInfo(ctx->out, VARDATA_ANY(json), VARSIZE_ANY_EXHDR(json));
+	OutputPluginWrite(ctx, true);
+
+	data->transactionHasEvents = true;
+
+	MemoryContextSwitchTo(oldContext);
+	MemoryContextReset(data->context);
+}
+
+
+/*
+ * EventStreamCommit outputs an empty message at the commit of a transaction
+ * that inserted events: its LSN is where consumers acknowledge the events.
+ */
+static void
+EventStreamCommit(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+				  XLogRecPtr commitLSN)
+{
+	EventStreamData *data = (EventStreamData *) ctx->output_plugin_private;
+
+	if (!data->transactionHasEvents)
+	{
+		return;
+	}
+
+	OutputPluginPrepareWrite(ctx, true);
+	OutputPluginWrite(ctx, true);
+}
+
+
+/*
+ * IsEventRelation returns true when the given relation is the event table,
+ * or one of its partitions, but not the event archive.
+ */
+static bool
+IsEventRelation(EventStreamData *data, Relation relation)
+{
+	if (!OidIsValid(data->eventRelationId))
+	{
+		data->eventRelationId =
+			pgAutoFailoverRelationId(AUTO_FAILOVER_EVENT_TABLE_NAME);
+	}
+
+	Oid relationId = RelationGetRelid(relation);
+
+	if (relationId == data->eventRelationId)
+	{
+		return true;
+	}
+
+	if (!relation->rd_rel->relispartition)
+	{
+		return false;
+	}
+
+#if (PG_VERSION_NUM >= 140000)
+	return get_partition_parent(relationId, true) == data->eventRelationId;
+#else
+	return get_partition_parent(relationId) == data->eventRelationId;
+#endif
+}
@@ -0,0 +1,925 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/failover_metadata.c
+ *
+ * Implementation of the timeline of the failovers orchestrated by the
+ * monitor. Each failover of a group gets a row in pgautofailover.failover,
+ * and each of its phases a row in pgautofailover.failover_phase with the time
+ * when the phase started. A phase ends when the next one starts, and the last
+ * phase ends with the failover.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "failover_metadata.h"
+#include "formation_metadata.h"
+#include "metadata.h"
+#include "node_metadata.h"
+#include "replication_state.h"
+
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+
+
+/* GUC variables */
+int FailoverMaxConcurrency = 0;
+int FailoverCoordinatorTimeoutMs = 30 * 1000;
+
+/* in the same order as the FailoverPhase enum */
+static const char *FailoverPhaseNames[] = {
+	"detection",
+	"draining",
+	"report_lsn",
+	"fast_forward",
+	"promotion",
+	"secondaries",
+	"done"
+};
+
+
+static FailoverPhase GoalStateFailoverPhase(ReplicationState goalState);
+static bool StartsFailover(AutoFailoverNode *node, ReplicationState goalState);
+static int64 GetOpenFailoverId(char *formationId, int groupId);
+static int64 GetOpenFailoverTraceId(char *formationId, int groupId);
+static int64 NextTraceId(void);
+static int64 StartFailover(AutoFailoverNode *node);
+static void InsertFailoverPhase(int64 failoverId, FailoverPhase phase,
+								int64 nodeId, TimestampTz startTime);
+static void FinishFailover(AutoFailoverNode *node, int64 failoverId);
+static bool GroupIsWaitingForFailover(AutoFailoverNode *primaryNode);
+static bool CoordinatorFailoverPending(char *formationId);
+static int GroupFailoverPriority(AutoFailoverFormation *formation, int groupId);
+static int CountOpenFailovers(char *formationId);
+static TimestampTz GetOpenFailoverStartTime(char *formationId, int groupId);
+static void ReportFormationRecovery(char *formationId);
+
+
+/*
+ * RecordFailoverPhase is called when the given goal state is assigned to the
+ * given node, before its goalState is updated. When the goal state is part of
+ * a failover, the failover of the group is started if needed, and the phase
+ * of the goal state is recorded.
+ *
+ * Phases only get their first start time recorded: assigning report_lsn to
+ * each standby node in turn is a single report_lsn phase.
+ *
+ * Returns true when the goal state is part of a failover.
+ */
+bool
+RecordFailoverPhase(AutoFailoverNode *node, ReplicationState goalState)
+{
+	FailoverPhase phase = GoalStateFailoverPhase(goalState);
+
+	if (phase == FAILOVER_PHASE_NONE)
+	{
+		return false;
+	}
+
+	int64 failoverId = GetOpenFailoverId(node->formationId, node->groupId);
+
+	if (failoverId == 0)
+	{
+		if (!StartsFailover(node, goalState))
+		{
+			return false;
+		}
+
+		failoverId = StartFailover(node);
+	}
+
+	if (phase == FAILOVER_PHASE_DONE)
+	{
+		FinishFailover(node, failoverId);
+	}
+	else
+	{
+		InsertFailoverPhase(failoverId, phase, node->nodeId,
+							GetCurrentTransactionStartTimestamp());
+	}
+
+	return true;
+}
+
+
+/*
+ * FailoverMayStart returns true when the failover of the group of the given
+ * unhealthy primary node may start now. When many groups of a formation fail
+ * at once, such as in a zone outage, their failovers would otherwise compete
+ * for the monitor and the Citus coordinator in an arbitrary order:
+ *
+ * - the coordinator group of a Citus formation fails over first, and the
+ *   worker groups wait until its failover is done, or for
+ *   pgautofailover.failover_coordinator_timeout at most,
+ *
+ * - then at most pgautofailover.failover_max_concurrency failovers are in
+ *   progress at the same time in the formation, and the waiting groups
+ *   start by decreasing priority, as set with set_group_failover_priority,
+ *   then by group id. The coordinator group is never held back.
+ *
+ * Groups without a failover candidate are not waiting for a failover, and
+ * don't take a place in the queue.
+ */
+bool
+FailoverMayStart(AutoFailoverNode *primaryNode)
+{
+	char *formationId = primaryNode->formationId;
+	int groupId = primaryNode->groupId;
+
+	AutoFailoverFormation *formation = GetFormation(formationId);
+
+	bool isCitusFormation =
+		formation != NULL && formation->kind == FORMATION_KIND_CITUS;
+	bool isCoordinatorGroup =
+		isCitusFormation && groupId == FAILOVER_COORDINATOR_GROUP_ID;
+	bool coordinatorFirst =
+		isCitusFormation && !isCoordinatorGroup &&
+		FailoverCoordinatorTimeoutMs > 0;
+
+	if (isCoordinatorGroup || (!coordinatorFirst && FailoverMaxConcurrency <= 0))
+	{
+		return true;
+	}
+
+	if (!GroupIsWaitingForFailover(primaryNode))
+	{
+		return true;
+	}
+
+	/* the lock is held until commit, after the failover has been recorded */
+	LockFormationFailovers(formationId, ExclusiveLock);
+
+	if (coordinatorFirst && CoordinatorFailoverPending(formationId))
+	{
+		elog(DEBUG1,
+			 "failover of group %d in formation \"%s\" waits for the "
+			 "failover of the coordinator group",
+			 groupId, formationId);
+		return false;
+	}
+
+	if (FailoverMaxConcurrency <= 0)
+	{
+		return true;
+	}
+
+	int openCount = CountOpenFailovers(formationId);
+	int priority = GroupFailoverPriority(formation, groupId);
+	int aheadCount = 0;
+
+	List *nodesList = AllAutoFailoverNodes(formationId);
+	ListCell *nodeCell = NULL;
+
+	foreach(nodeCell, nodesList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+		if (node->groupId == groupId ||
+			!IsInPrimaryState(node) ||
+			!IsUnhealthy(node) ||
+			GetOpenFailoverId(formationId, node->groupId) > 0 ||
+			!GroupIsWaitingForFailover(node))
+		{
+			continue;
+		}
+
+		int otherPriority = GroupFailoverPriority(formation, node->groupId);
+
+		if (otherPriority > priority ||
+			(otherPriority == priority && node->groupId < groupId))
+		{
+			++aheadCount;
+		}
+	}
+
+	if (openCount + aheadCount >= FailoverMaxConcurrency)
+	{
+		elog(DEBUG1,
+			 "failover of group %d in formation \"%s\" waits: "
+			 "%d failovers in progress and %d groups ahead in the queue",
+			 groupId, formationId, openCount, aheadCount);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * GroupIsWaitingForFailover returns true when the group of the given primary
+ * node has a healthy standby node that could be promoted.
+ */
+static bool
+GroupIsWaitingForFailover(AutoFailoverNode *primaryNode)
+{
+	List *groupNodesList =
+		AutoFailoverNodeGroup(primaryNode->formationId, primaryNode->groupId);
+
+	List *candidateNodesList =
+		GroupOtherNodesListInState(groupNodesList,
+								   primaryNode,
+								   REPLICATION_STATE_SECONDARY);
+
+	return CountHealthyCandidates(candidateNodesList) >= 1;
+}
+
+
+/*
+ * CoordinatorFailoverPending returns true when the coordinator group of the
+ * given Citus formation has a failover in progress since less than
+ * pgautofailover.failover_coordinator_timeout, or is about to start one.
+ */
+static bool
+CoordinatorFailoverPending(char *formationId)
+{
+	TimestampTz startTime =
+		GetOpenFailoverStartTime(formationId, FAILOVER_COORDINATOR_GROUP_ID);
+
+	if (startTime != 0)
+	{
+		return !TimestampDifferenceExceeds(startTime,
+										   GetCurrentTimestamp(),
+										   FailoverCoordinatorTimeoutMs);
+	}
+
+	AutoFailoverNode *coordinatorNode =
+		GetPrimaryNodeInGroup(formationId, FAILOVER_COORDINATOR_GROUP_ID);
+
+	return coordinatorNode != NULL &&
+		   IsInPrimaryState(coordinatorNode) &&
+		   IsUnhealthy(coordinatorNode) &&
+		   GroupIsWaitingForFailover(coordinatorNode);
+}
+
+
+/*
+ * GroupFailoverPriority returns the failover priority of the given group, as
+ * set with pgautofailover.set_group_failover_priority, zero by default. The
+ * coordinator group of a Citus formation comes before all the others.
+ */
+static int
+GroupFailoverPriority(AutoFailoverFormation *formation, int groupId)
+{
+	int priority = 0;
+
+	if (formation->kind == FORMATION_KIND_CITUS &&
+		groupId == FAILOVER_COORDINATOR_GROUP_ID)
+	{
+		return INT_MAX;
+	}
+
+	Oid argTypes[] = {
+		TEXTOID, /* formationid */
+		INT4OID  /* groupid */
+	};
+
+	Datum argValues[] = {
+		CStringGetTextDatum(formation->formationId), /* formationid */
+		Int32GetDatum(groupId)                       /* groupid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan selectPlan = { 0 };
+
+	const char *selectQuery =
+		"SELECT priority FROM " AUTO_FAILOVER_GROUP_FAILOVER_PRIORITY_TABLE
+		" WHERE formationid = $1 AND groupid = $2";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&selectPlan, selectQuery,
+										argCount, argTypes, argValues,
+										NULL, true, 1);
+	if (spiStatus != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not select from "
+			 AUTO_FAILOVER_GROUP_FAILOVER_PRIORITY_TABLE);
+	}
+
+	if (SPI_processed > 0)
+	{
+		bool isNull = false;
+		Datum priorityDatum = SPI_getbinval(SPI_tuptable->vals[0],
+											SPI_tuptable->tupdesc,
+											1, &isNull);
+
+		priority = DatumGetInt32(priorityDatum);
+	}
+
+	SPI_finish();
+
+	return priority;
+}
+
+
+/*
+ * CountOpenFailovers returns how many failovers are in progress in the given
+ * formation.
+ */
+static int
+CountOpenFailovers(char *formationId)
+{
+	int openCount = 0;
+
+	Oid argTypes[] = {
+		TEXTOID /* formationid */
+	};
+
+	Datum argValues[] = {
+		CStringGetTextDatum(formationId) /* formationid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan selectPlan = { 0 };
+
+	const char *selectQuery =
+		"SELECT count(*) FROM " AUTO_FAILOVER_FAILOVER_TABLE
+		" WHERE formationid = $1 AND endtime IS NULL";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&selectPlan, selectQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 1);
+	if (spiStatus != SPI_OK_SELECT || SPI_processed == 0)
+	{
+		elog(ERROR, "could not select from " AUTO_FAILOVER_FAILOVER_TABLE);
+	}
+
+	bool isNull = false;
+	Datum countDatum = SPI_getbinval(SPI_tuptable->vals[0],
+									 SPI_tuptable->tupdesc,
+									 1, &isNull);
+
+	openCount = (int) DatumGetInt64(countDatum);
+
+	SPI_finish();
+
+	return openCount;
+}
+
+
+/*
+ * GetOpenFailoverStartTime returns the start time of the failover of the
+ * given group that is still in progress, or zero when there is none.
+ */
+static TimestampTz
+GetOpenFailoverStartTime(char *formationId, int groupId)
+{
+	TimestampTz startTime = 0;
+
+	Oid argTypes[] = {
+		TEXTOID, /* formationid */
+		INT4OID  /* groupid */
+	};
+
+	Datum argValues[] = {
+		CStringGetTextDatum(formationId), /* formationid */
+		Int32GetDatum(groupId)            /* groupid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan selectPlan = { 0 };
+
+	const char *selectQuery =
+		"SELECT starttime FROM " AUTO_FAILOVER_FAILOVER_TABLE
+		" WHERE formationid = $1 AND groupid = $2 AND endtime IS NULL";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&selectPlan, selectQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 1);
+	if (spiStatus != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not select from " AUTO_FAILOVER_FAILOVER_TABLE);
+	}
+
+	if (SPI_processed > 0)
+	{
+		bool isNull = false;
+		Datum startTimeDatum = SPI_getbinval(SPI_tuptable->vals[0],
+											 SPI_tuptable->tupdesc,
+											 1, &isNull);
+
+		startTime = DatumGetTimestampTz(startTimeDatum);
+	}
+
+	SPI_finish();
+
+	return startTime;
+}
+
+
+/*
+ * GetGoalStateTraceId returns the trace id of the decision that is assigning
+ * a new goal state to the given node. A decision is all the goal states that
+ * the monitor assigns to the nodes of a group in the same transaction, and
+ * all the goal states of a failover share the trace id of the decision that
+ * started the failover. Keepers stamp the trace id on their logs, transition
+ * records and connections, so that a failover can be followed from hop to
+ * hop.
+ */
+int64
+GetGoalStateTraceId(AutoFailoverNode *node)
+{
+	static TransactionId traceXid = InvalidTransactionId;
+	static char traceFormationId[NAMEDATALEN] = { 0 };
+	static int traceGroupId = -1;
+	static int64 traceId = 0;
+
+	TransactionId xid = GetTopTransactionId();
+
+	if (xid == traceXid &&
+		node->groupId == traceGroupId &&
+		strncmp(node->formationId, traceFormationId, NAMEDATALEN) == 0)
+	{
+		return traceId;
+	}
+
+	int64 failoverTraceId =
+		GetOpenFailoverTraceId(node->formationId, node->groupId);
+
+	traceXid = xid;
+	traceGroupId = node->groupId;
+	strlcpy(traceFormationId, node->formationId, NAMEDATALEN);
+	traceId = failoverTraceId > 0 ? failoverTraceId : NextTraceId();
+
+	return traceId;
+}
+
+
+/*
+ * GoalStateFailoverPhase returns the failover phase that assigning the given
+ * goal state belongs to, if any.
+ */
+static FailoverPhase
+GoalStateFailoverPhase(ReplicationState goalState)
+{
+	switch (goalState)
+	{
+		case REPLICATION_STATE_DRAINING:
+		case REPLICATION_STATE_DEMOTE_TIMEOUT:
+		case REPLICATION_STATE_PREPARE_MAINTENANCE:
+		{
+			return FAILOVER_PHASE_DRAINING;
+		}
+
+		case REPLICATION_STATE_REPORT_LSN:
+		{
+			return FAILOVER_PHASE_REPORT_LSN;
+		}
+
+		case REPLICATION_STATE_FAST_FORWARD:
+		{
+			return FAILOVER_PHASE_FAST_FORWARD;
+		}
+
+		case REPLICATION_STATE_PREPARE_PROMOTION:
+		case REPLICATION_STATE_STOP_REPLICATION:
+		{
+			return FAILOVER_PHASE_PROMOTION;
+		}
+
+		case REPLICATION_STATE_WAIT_PRIMARY:
+		{
+			return FAILOVER_PHASE_SECONDARIES;
+		}
+
+		case REPLICATION_STATE_PRIMARY:
+		case REPLICATION_STATE_SINGLE:
+		{
+			return FAILOVER_PHASE_DONE;
+		}
+
+		default:
+		{
+			return FAILOVER_PHASE_NONE;
+		}
+	}
+}
+
+
+/*
+ * StartsFailover returns true when assigning the given goal state to the node
+ * starts a failover of its group.
+ *
+ * The report_lsn goal state is also assigned to nodes that come back from
+ * maintenance, and to the only node of a group when its candidate priority
+ * is zero: it only starts a failover when it is assigned to a node that was a
+ * standby or the primary of a group that has other nodes.
+ */
+static bool
+StartsFailover(AutoFailoverNode *node, ReplicationState goalState)
+{
+	switch (goalState)
+	{
+		case REPLICATION_STATE_DRAINING:
+		case REPLICATION_STATE_DEMOTE_TIMEOUT:
+		case REPLICATION_STATE_PREPARE_MAINTENANCE:
+		case REPLICATION_STATE_FAST_FORWARD:
+		case REPLICATION_STATE_PREPARE_PROMOTION:
+		case REPLICATION_STATE_STOP_REPLICATION:
+		{
+			return true;
+		}
+
+		case REPLICATION_STATE_REPORT_LSN:
+		{
+			List *groupNodeList =
+				AutoFailoverNodeGroup(node->formationId, node->groupId);
+
+			return list_length(groupNodeList) > 1 &&
+				   (node->goalState == REPLICATION_STATE_SECONDARY ||
+					node->goalState == REPLICATION_STATE_CATCHINGUP ||
+					node->goalState == REPLICATION_STATE_DRAINING ||
+					node->goalState == REPLICATION_STATE_DEMOTED);
+		}
+
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+
+/*
+ * GetOpenFailoverId returns the id of the failover of the given group that
+ * is still in progress, or zero when there is none.
+ */
+static int64
+GetOpenFailoverId(char *formationId, int groupId)
+{
+	int64 failoverId = 0;
+
+	Oid argTypes[] = {
+		TEXTOID, /* formationid */
+		INT4OID  /* groupid */
+	};
+
+	Datum argValues[] = {
+		CStringGetTextDatum(formationId), /* formationid */
+		Int32GetDatum(groupId)            /* groupid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan selectPlan = { 0 };
+
+	const char *selectQuery =
+		"SELECT failoverid FROM " AUTO_FAILOVER_FAILOVER_TABLE
+		" WHERE formationid = $1 AND groupid = $2 AND endtime IS NULL";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&selectPlan, selectQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 1);
+	if (spiStatus != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not select from " AUTO_FAILOVER_FAILOVER_TABLE);
+	}
+
+	if (SPI_processed > 0)
+	{
+		bool isNull = false;
+		Datum failoverIdDatum = SPI_getbinval(SPI_tuptable->vals[0],
+											  SPI_tuptable->tupdesc,
+											  1, &isNull);
+
+		failoverId = DatumGetInt64(failoverIdDatum);
+	}
+
+	SPI_finish();
+
+	return failoverId;
+}
+
+
+/*
+ * GetOpenFailoverTraceId returns the trace id of the failover of the given
+ * group that is still in progress, or zero when there is none.
+ */
+static int64
+GetOpenFailoverTraceId(char *formationId, int groupId)
+{
+	int64 traceId = 0;
+
+	Oid argTypes[] = {
+		TEXTOID, /* formationid */
+		INT4OID  /* groupid */
+	};
+
+	Datum argValues[] = {
+		CStringGetTextDatum(formationId), /* formationid */
+		Int32GetDatum(groupId)            /* groupid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan selectPlan = { 0 };
+
+	const char *selectQuery =
+		"SELECT traceid FROM " AUTO_FAILOVER_FAILOVER_TABLE
+		" WHERE formationid = $1 AND groupid = $2 AND endtime IS NULL"
+		"   AND traceid IS NOT NULL";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&selectPlan, selectQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 1);
+	if (spiStatus != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not select from " AUTO_FAILOVER_FAILOVER_TABLE);
+	}
+
+	if (SPI_processed > 0)
+	{
+		bool isNull = false;
+		Datum traceIdDatum = SPI_getbinval(SPI_tuptable->vals[0],
+										   SPI_tuptable->tupdesc,
+										   1, &isNull);
+
+		traceId = DatumGetInt64(traceIdDatum);
+	}
+
+	SPI_finish();
+
+	return traceId;
+}
+
+
+/*
+ * NextTraceId mints a new trace id from pgautofailover.trace_id_seq.
+ */
+static int64
+NextTraceId(void)
+{
+	int64 traceId = 0;
+
+	static MetadataPlan nextvalPlan = { 0 };
+
+	const char *nextvalQuery =
+		"SELECT nextval('" AUTO_FAILOVER_TRACE_ID_SEQUENCE "')";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&nextvalPlan, nextvalQuery,
+										0, NULL, NULL,
+										NULL, false, 1);
+
+	if (spiStatus == SPI_OK_SELECT && SPI_processed > 0)
+	{
+		bool isNull = false;
+		Datum traceIdDatum = SPI_getbinval(SPI_tuptable->vals[0],
+										   SPI_tuptable->tupdesc,
+										   1, &isNull);
+
+		traceId = DatumGetInt64(traceIdDatum);
+	}
+	else
+	{
+		elog(ERROR, "could not get the next value of "
+			 AUTO_FAILOVER_TRACE_ID_SEQUENCE);
+	}
+
+	SPI_finish();
+
+	return traceId;
+}
+
+
+/*
+ * StartFailover registers a new failover for the group of the given node,
+ * and its detection phase. When the primary node has stopped reporting or is
+ * unhealthy, the detection phase starts at its last report, otherwise the
+ * failover has been asked for, and the detection phase is empty.
+ */
+static int64
+StartFailover(AutoFailoverNode *node)
+{
+	int64 failoverId = 0;
+	TimestampTz now = GetCurrentTransactionStartTimestamp();
+	TimestampTz detectionTime = now;
+
+	AutoFailoverNode *primaryNode =
+		StateBelongsToPrimary(node->goalState)
+		? node
+		: GetPrimaryOrDemotedNodeInGroup(node->formationId, node->groupId);
+
+	if (primaryNode != NULL &&
+		(IsUnhealthy(primaryNode) || !IsReporting(primaryNode)) &&
+		primaryNode->reportTime < now)
+	{
+		detectionTime = primaryNode->reportTime;
+	}
+
+	Oid argTypes[] = {
+		TEXTOID, /* formationid */
+		INT4OID, /* groupid */
+		INT8OID  /* traceid */
+	};
+
+	Datum argValues[] = {
+		CStringGetTextDatum(node->formationId), /* formationid */
+		Int32GetDatum(node->groupId),           /* groupid */
+		Int64GetDatum(node->goalTraceId)        /* traceid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan insertPlan = { 0 };
+
+	const char *insertQuery =
+		"INSERT INTO " AUTO_FAILOVER_FAILOVER_TABLE
+		" (formationid, groupid, traceid) VALUES ($1, $2, $3) "
+		"RETURNING failoverid";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&insertPlan, insertQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
+
+	if (spiStatus == SPI_OK_INSERT_RETURNING && SPI_processed > 0)
+	{
+		bool isNull = false;
+		Datum failoverIdDatum = SPI_getbinval(SPI_tuptable->vals[0],
+											  SPI_tuptable->tupdesc,
+											  1, &isNull);
+
+		failoverId = DatumGetInt64(failoverIdDatum);
+	}
+	else
+	{
+		elog(ERROR, "could not insert into " AUTO_FAILOVER_FAILOVER_TABLE);
+	}
+
+	SPI_finish();
+
+	InsertFailoverPhase(failoverId, FAILOVER_PHASE_DETECTION,
+						primaryNode != NULL ? primaryNode->nodeId : node->nodeId,
+						detectionTime);
+
+	return failoverId;
+}
+
+
+/*
+ * InsertFailoverPhase records the start of a phase of the given failover,
+ * unless the phase has already started.
+ */
+static void
+InsertFailoverPhase(int64 failoverId, FailoverPhase phase,
+					int64 nodeId, TimestampTz startTime)
+{
+	Oid argTypes[] = {
+		INT8OID,       /* failoverid */
+		TEXTOID,       /* phase */
+		INT4OID,       /* phaseorder */
+		INT8OID,       /* nodeid */
+		TIMESTAMPTZOID /* starttime */
+	};
+
+	Datum argValues[] = {
+		Int64GetDatum(failoverId),                          /* failoverid */
+		CStringGetTextDatum(FailoverPhaseNames[phase]),     /* phase */
+		Int32GetDatum((int32) phase),                       /* phaseorder */
+		Int64GetDatum(nodeId),                              /* nodeid */
+		TimestampTzGetDatum(startTime)                      /* starttime */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan insertPlan = { 0 };
+
+	const char *insertQuery =
+		"INSERT INTO " AUTO_FAILOVER_FAILOVER_PHASE_TABLE
+		" (failoverid, phase, phaseorder, nodeid, starttime) "
+		"VALUES ($1, $2, $3, $4, $5) "
+		"ON CONFLICT (failoverid, phase) DO NOTHING";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&insertPlan, insertQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
+	if (spiStatus != SPI_OK_INSERT)
+	{
+		elog(ERROR, "could not insert into " AUTO_FAILOVER_FAILOVER_PHASE_TABLE);
+	}
+
+	SPI_finish();
+}
+
+
+/*
+ * FinishFailover records the end of the given failover, and reports the
+ * recovery of the formation when that was its last failover in progress.
+ */
+static void
+FinishFailover(AutoFailoverNode *node, int64 failoverId)
+{
+	Oid argTypes[] = {
+		INT8OID /* failoverid */
+	};
+
+	Datum argValues[] = {
+		Int64GetDatum(failoverId) /* failoverid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan updatePlan = { 0 };
+
+	const char *updateQuery =
+		"UPDATE " AUTO_FAILOVER_FAILOVER_TABLE
+		" SET endtime = now() WHERE failoverid = $1";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&updatePlan, updateQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
+	if (spiStatus != SPI_OK_UPDATE)
+	{
+		elog(ERROR, "could not update " AUTO_FAILOVER_FAILOVER_TABLE);
+	}
+
+	SPI_finish();
+
+	if (CountOpenFailovers(node->formationId) == 0)
+	{
+		ReportFormationRecovery(node->formationId);
+	}
+}
+
+
+/*
+ * ReportFormationRecovery logs how long the formation took to recover from
+ * its last incident, when that incident had the failovers of several groups,
+ * as computed by pgautofailover.failover_incidents.
+ */
+static void
+ReportFormationRecovery(char *formationId)
+{
+	Oid argTypes[] = {
+		TEXTOID /* formationid */
+	};
+
+	Datum argValues[] = {
+		CStringGetTextDatum(formationId) /* formationid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan selectPlan = { 0 };
+
+	const char *selectQuery =
+		"SELECT group_count, failover_count, recovery_time::text "
+		"  FROM " AUTO_FAILOVER_FAILOVER_INCIDENTS_FUNCTION "($1) "
+		" ORDER BY incident_id DESC LIMIT 1";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&selectPlan, selectQuery,
+										argCount, argTypes, argValues,
+										NULL, true, 1);
+	if (spiStatus != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not select from "
+			 AUTO_FAILOVER_FAILOVER_INCIDENTS_FUNCTION);
+	}
+
+	if (SPI_processed > 0)
+	{
+		HeapTuple heapTuple = SPI_tuptable->vals[0];
+		TupleDesc tupleDesc = SPI_tuptable->tupdesc;
+		bool isNull = false;
+
+		Datum groupCountDatum = SPI_getbinval(heapTuple, tupleDesc, 1, &isNull);
+		Datum failoverCountDatum =
+			SPI_getbinval(heapTuple, tupleDesc, 2, &isNull);
+		char *recoveryTime = SPI_getvalue(heapTuple, tupleDesc, 3);
+
+		int groupCount = DatumGetInt32(groupCountDatum);
+		int failoverCount = DatumGetInt32(failoverCountDatum);
+
+		if (groupCount > 1 && recoveryTime != NULL)
+		{
+			ereport(LOG,
+					(errmsg("formation \"%s\" recovered from the failover of "
+							"%d groups in %s",
+							formationId, groupCount, recoveryTime),
+					 errdetail("The incident had %d failovers, see "
+							   AUTO_FAILOVER_FAILOVER_INCIDENTS_FUNCTION "().",
+							   failoverCount)));
+		}
+	}
+
+	SPI_finish();
+}
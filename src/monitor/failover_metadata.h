@@ -0,0 +1,57 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/failover_metadata.h
+ *
+ * Declarations for public functions and types related to the timeline of
+ * the failovers orchestrated by the monitor.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "node_metadata.h"
+#include "replication_state.h"
+
+#define AUTO_FAILOVER_FAILOVER_TABLE "pgautofailover.failover"
+#define AUTO_FAILOVER_FAILOVER_PHASE_TABLE "pgautofailover.failover_phase"
+#define AUTO_FAILOVER_TRACE_ID_SEQUENCE "pgautofailover.trace_id_seq"
+#define AUTO_FAILOVER_GROUP_FAILOVER_PRIORITY_TABLE \
+	"pgautofailover.group_failover_priority"
+#define AUTO_FAILOVER_FAILOVER_INCIDENTS_FUNCTION \
+	"pgautofailover.failover_incidents"
+
+/* the coordinator group of a Citus formation */
+#define FAILOVER_COORDINATOR_GROUP_ID 0
+
+
+/*
+ * FailoverPhase lists the phases of a failover, in the order in which they
+ * happen. The detection phase goes from the last report of the failed primary
+ * to the first goal state assignment of the failover, and the failover ends
+ * when a node is assigned the primary (or single) goal state.
+ */
+typedef enum FailoverPhase
+{
+	FAILOVER_PHASE_NONE = -1,
+	FAILOVER_PHASE_DETECTION = 0,
+	FAILOVER_PHASE_DRAINING,
+	FAILOVER_PHASE_REPORT_LSN,
+	FAILOVER_PHASE_FAST_FORWARD,
+	FAILOVER_PHASE_PROMOTION,
+	FAILOVER_PHASE_SECONDARIES,
+	FAILOVER_PHASE_DONE
+} FailoverPhase;
+
+
+extern bool RecordFailoverPhase(AutoFailoverNode *node,
+								ReplicationState goalState);
+extern bool FailoverMayStart(AutoFailoverNode *primaryNode);
+extern int64 GetGoalStateTraceId(AutoFailoverNode *node);
+
+/* GUCs */
+extern int FailoverMaxConcurrency;
+extern int FailoverCoordinatorTimeoutMs;
@@ -0,0 +1,578 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/failover_simulator.c
+ *
+ * Implementation of the replay of past failovers of a group.
+ *
+ * The monitor records every state change of the nodes in the
+ * pgautofailover.event table. Replaying those events rebuilds the
+ * information the monitor had when it selected a failover candidate, and then
+ * we can run the candidate selection again with other values for the
+ * settings, such as pgautofailover.node_considered_unhealthy_timeout and
+ * pgautofailover.promote_wal_log_threshold, and compare the decisions and
+ * timings with the ones that were actually made. No node is involved.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+/* these are internal headers */
+#include "group_state_machine.h"
+#include "metadata.h"
+#include "node_metadata.h"
+#include "replication_state.h"
+#include "version_compat.h"
+
+#include "access/htup_details.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/builtins.h"
+#include "utils/pg_lsn.h"
+#include "utils/timestamp.h"
+
+
+#define REPLAY_FAILOVER_DECISIONS_COLUMNS 8
+
+#define SELECT_EVENTS_QUERY \
+	"SELECT eventid, eventtime, nodeid, nodename, nodehost, nodeport, " \
+	"       reportedstate, goalstate, reportedtli, reportedlsn, " \
+	"       candidatepriority, replicationquorum, description " \
+	"  FROM pgautofailover.event " \
+	" WHERE formationid = $1 AND groupid = $2 AND eventtime >= $3 " \
+	" ORDER BY eventid"
+
+
+/*
+ * GroupEvent is a row of the pgautofailover.event table.
+ */
+typedef struct GroupEvent
+{
+	int64 eventId;
+	TimestampTz eventTime;
+	int64 nodeId;
+	char *nodeName;
+	char *nodeHost;
+	int nodePort;
+	ReplicationState reportedState;
+	ReplicationState goalState;
+	int reportedTLI;
+	XLogRecPtr reportedLSN;
+	int candidatePriority;
+	bool replicationQuorum;
+	char *description;
+} GroupEvent;
+
+
+/*
+ * FailoverDecision is the result of replaying a failover: the node that the
+ * monitor selected, and the node that would have been selected with the
+ * simulated settings.
+ */
+typedef struct FailoverDecision
+{
+	int64 eventId;
+	TimestampTz eventTime;
+	int64 primaryNodeId;
+	int64 actualNodeId;
+	int64 simulatedNodeId;
+	bool hasTimings;
+	double actualElapsedMs;
+	double simulatedDetectionMs;
+	char *message;
+} FailoverDecision;
+
+
+static List * GetGroupEvents(char *formationId, int groupId, TimestampTz since);
+static AutoFailoverNode * GetSimulatedNode(List **nodesList,
+										   char *formationId, int groupId,
+										   GroupEvent *event);
+static bool IsFailoverSelection(GroupEvent *event, AutoFailoverNode *node);
+static FailoverDecision * ReplayFailoverDecision(List *nodesList,
+												 GroupEvent *event,
+												 FailoverDecisionSettings *settings);
+static void ApplyGroupEvent(AutoFailoverNode *node, GroupEvent *event);
+
+
+PG_FUNCTION_INFO_V1(replay_failover_decisions);
+
+
+/*
+ * replay_failover_decisions replays the events of a group and returns a row
+ * per failover candidate selection found in the events, with the node that
+ * the simulated settings would have selected.
+ *
+ * Arguments that are negative stand for the current value of the matching
+ * GUC.
+ */
+Datum
+replay_failover_decisions(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+
+	checkPgAutoFailoverVersion();
+
+	/* stuff done only on the first call of the function */
+	if (SRF_IS_FIRSTCALL())
+	{
+		text *formationIdText = PG_GETARG_TEXT_P(0);
+		char *formationId = text_to_cstring(formationIdText);
+		int32 groupId = PG_GETARG_INT32(1);
+		TimestampTz since = PG_GETARG_TIMESTAMPTZ(2);
+		int32 unhealthyTimeoutMs = PG_GETARG_INT32(3);
+		int32 promoteXlogThreshold = PG_GETARG_INT32(4);
+
+		FailoverDecisionSettings settings = { 0 };
+
+		List *nodesList = NIL;
+		List *resultList = NIL;
+		ListCell *eventCell = NULL;
+		int64 electedNodeId = 0;
+
+		/* create a function context for cross-call persistence */
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		MemoryContext oldcontext =
+			MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		InitFailoverDecisionSettings(&settings, formationId);
+
+		if (unhealthyTimeoutMs >= 0)
+		{
+			settings.unhealthyTimeoutMs = unhealthyTimeoutMs;
+		}
+
+		if (promoteXlogThreshold >= 0)
+		{
+			settings.promoteXlogThreshold = promoteXlogThreshold;
+		}
+
+		/*
+		 * The network latency, the load and the WAL rates of the nodes are
+		 * only known for the current time, they are not historical data.
+		 */
+		settings.promoteXlogThresholdTimeMs = 0;
+		settings.preferLowLatency = false;
+		settings.preferLeastLoaded = false;
+		settings.maxCatchUpTimeMs = 0;
+		settings.notify = false;
+
+		List *eventsList = GetGroupEvents(formationId, groupId, since);
+
+		/*
+		 * We replay the events as if the monitor had been running for the
+		 * whole startup grace period before the first event.
+		 */
+		if (eventsList != NIL)
+		{
+			GroupEvent *firstEvent = (GroupEvent *) linitial(eventsList);
+
+			settings.startTime =
+				firstEvent->eventTime -
+				(TimestampTz) StartupGracePeriodMs * INT64CONST(1000);
+		}
+
+		foreach(eventCell, eventsList)
+		{
+			GroupEvent *event = (GroupEvent *) lfirst(eventCell);
+			AutoFailoverNode *node =
+				GetSimulatedNode(&nodesList, formationId, groupId, event);
+
+			CHECK_FOR_INTERRUPTS();
+
+			/* a failover is done when its candidate has been promoted */
+			if (event->nodeId == electedNodeId &&
+				event->reportedState == REPLICATION_STATE_PRIMARY)
+			{
+				electedNodeId = 0;
+			}
+
+			/* the decision is made with the state of the nodes before it */
+			if (event->nodeId != electedNodeId &&
+				IsFailoverSelection(event, node))
+			{
+				settings.now = event->eventTime;
+
+				FailoverDecision *decision =
+					ReplayFailoverDecision(nodesList, event, &settings);
+
+				resultList = lappend(resultList, decision);
+				electedNodeId = event->nodeId;
+			}
+
+			ApplyGroupEvent(node, event);
+		}
+
+		funcctx->user_fctx = resultList;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	/* stuff done on every call of the function */
+	funcctx = SRF_PERCALL_SETUP();
+
+	List *resultList = (List *) funcctx->user_fctx;
+
+	if (resultList != NIL)
+	{
+		TupleDesc resultDescriptor = NULL;
+		Datum values[REPLAY_FAILOVER_DECISIONS_COLUMNS];
+		bool isNulls[REPLAY_FAILOVER_DECISIONS_COLUMNS];
+
+		FailoverDecision *decision = (FailoverDecision *) linitial(resultList);
+
+		memset(values, 0, sizeof(values));
+		memset(isNulls, false, sizeof(isNulls));
+
+		values[0] = Int64GetDatum(decision->eventId);
+		values[1] = TimestampTzGetDatum(decision->eventTime);
+		values[2] = Int64GetDatum(decision->primaryNodeId);
+		values[3] = Int64GetDatum(decision->actualNodeId);
+		values[4] = Int64GetDatum(decision->simulatedNodeId);
+		values[5] = Float8GetDatum(decision->actualElapsedMs);
+		values[6] = Float8GetDatum(decision->simulatedDetectionMs);
+		values[7] = CStringGetTextDatum(decision->message);
+
+		isNulls[2] = decision->primaryNodeId == 0;
+		isNulls[4] = decision->simulatedNodeId == 0;
+		isNulls[5] = !decision->hasTimings;
+		isNulls[6] = !decision->hasTimings;
+
+		TypeFuncClass resultTypeClass = get_call_result_type(fcinfo, NULL,
+															 &resultDescriptor);
+		if (resultTypeClass != TYPEFUNC_COMPOSITE)
+		{
+			ereport(ERROR, (errmsg("return type must be a row type")));
+		}
+
+		HeapTuple resultTuple = heap_form_tuple(resultDescriptor, values, isNulls);
+		Datum resultDatum = HeapTupleGetDatum(resultTuple);
+
+		/* prepare next SRF call */
+		funcctx->user_fctx = list_delete_first(resultList);
+
+		SRF_RETURN_NEXT(funcctx, PointerGetDatum(resultDatum));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
+
+
+/*
+ * GetGroupEvents returns the list of events of the given group since the
+ * given time, in the order in which they happened.
+ */
+static List *
+GetGroupEvents(char *formationId, int groupId, TimestampTz since)
+{
+	List *eventsList = NIL;
+	MemoryContext callerContext = CurrentMemoryContext;
+
+	Oid argTypes[] = {
+		TEXTOID,        /* formationid */
+		INT4OID,        /* groupid */
+		TIMESTAMPTZOID  /* eventtime */
+	};
+
+	Datum argValues[] = {
+		CStringGetTextDatum(formationId), /* formationid */
+		Int32GetDatum(groupId),           /* groupid */
+		TimestampTzGetDatum(since)        /* eventtime */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	SPI_connect();
+
+	int spiStatus = SPI_execute_with_args(SELECT_EVENTS_QUERY,
+										  argCount, argTypes, argValues,
+										  NULL, true, 0);
+	if (spiStatus != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not select from pgautofailover.event");
+	}
+
+	MemoryContext spiContext = MemoryContextSwitchTo(callerContext);
+
+	for (uint64 rowNumber = 0; rowNumber < SPI_processed; rowNumber++)
+	{
+		HeapTuple heapTuple = SPI_tuptable->vals[rowNumber];
+		TupleDesc tupleDescriptor = SPI_tuptable->tupdesc;
+		bool isNull = false;
+
+		GroupEvent *event = (GroupEvent *) palloc0(sizeof(GroupEvent));
+
+		event->eventId =
+			DatumGetInt64(heap_getattr(heapTuple, 1, tupleDescriptor, &isNull));
+		event->eventTime =
+			DatumGetTimestampTz(heap_getattr(heapTuple, 2,
+											 tupleDescriptor, &isNull));
+		event->nodeId =
+			DatumGetInt64(heap_getattr(heapTuple, 3, tupleDescriptor, &isNull));
+		event->nodeName =
+			TextDatumGetCString(heap_getattr(heapTuple, 4,
+											 tupleDescriptor, &isNull));
+		event->nodeHost =
+			TextDatumGetCString(heap_getattr(heapTuple, 5,
+											 tupleDescriptor, &isNull));
+		event->nodePort =
+			DatumGetInt32(heap_getattr(heapTuple, 6, tupleDescriptor, &isNull));
+		event->reportedState =
+			EnumGetReplicationState(
+				DatumGetObjectId(heap_getattr(heapTuple, 7,
+											  tupleDescriptor, &isNull)));
+		event->goalState =
+			EnumGetReplicationState(
+				DatumGetObjectId(heap_getattr(heapTuple, 8,
+											  tupleDescriptor, &isNull)));
+		event->reportedTLI =
+			DatumGetInt32(heap_getattr(heapTuple, 9, tupleDescriptor, &isNull));
+		event->reportedLSN =
+			DatumGetLSN(heap_getattr(heapTuple, 10, tupleDescriptor, &isNull));
+
+		Datum candidatePriority =
+			heap_getattr(heapTuple, 11, tupleDescriptor, &isNull);
+		event->candidatePriority = isNull ? 0 : DatumGetInt32(candidatePriority);
+
+		Datum replicationQuorum =
+			heap_getattr(heapTuple, 12, tupleDescriptor, &isNull);
+		event->replicationQuorum =
+			isNull ? true : DatumGetBool(replicationQuorum);
+
+		Datum description =
+			heap_getattr(heapTuple, 13, tupleDescriptor, &isNull);
+		event->description = isNull ? "" : TextDatumGetCString(description);
+
+		eventsList = lappend(eventsList, event);
+	}
+
+	MemoryContextSwitchTo(spiContext);
+
+	SPI_finish();
+
+	return eventsList;
+}
+
+
+/*
+ * GetSimulatedNode returns the simulated node that the event is about, and
+ * adds a new one to the list when the event is the first one we see for this
+ * node.
+ */
+static AutoFailoverNode *
+GetSimulatedNode(List **nodesList, char *formationId, int groupId,
+				 GroupEvent *event)
+{
+	ListCell *nodeCell = NULL;
+
+	foreach(nodeCell, *nodesList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+		if (node->nodeId == event->nodeId)
+		{
+			return node;
+		}
+	}
+
+	AutoFailoverNode *node = (AutoFailoverNode *) palloc0(sizeof(AutoFailoverNode));
+
+	node->formationId = formationId;
+	node->nodeId = event->nodeId;
+	node->groupId = groupId;
+	node->nodeName = event->nodeName;
+	node->nodeHost = event->nodeHost;
+	node->nodePort = event->nodePort;
+	node->goalState = event->goalState;
+	node->reportedState = event->reportedState;
+	node->reportTime = event->eventTime;
+	node->pgIsRunning = true;
+	node->health = NODE_HEALTH_GOOD;
+	node->healthCheckTime = event->eventTime;
+	node->stateChangeTime = event->eventTime;
+	node->reportedTLI = event->reportedTLI;
+	node->reportedLSN = event->reportedLSN;
+	node->candidatePriority = event->candidatePriority;
+	node->replicationQuorum = event->replicationQuorum;
+
+	*nodesList = lappend(*nodesList, node);
+
+	return node;
+}
+
+
+/*
+ * IsFailoverSelection returns true when the event is the monitor assigning a
+ * goal state to the node that it selected as the failover candidate.
+ */
+static bool
+IsFailoverSelection(GroupEvent *event, AutoFailoverNode *node)
+{
+	if (event->goalState == node->goalState)
+	{
+		return false;
+	}
+
+	return event->goalState == REPLICATION_STATE_PREPARE_PROMOTION ||
+		   event->goalState == REPLICATION_STATE_STOP_REPLICATION ||
+		   event->goalState == REPLICATION_STATE_FAST_FORWARD;
+}
+
+
+/*
+ * ReplayFailoverDecision runs the failover candidate selection with the
+ * simulated settings and the state of the simulated nodes, and compares the
+ * result with the node that the monitor selected.
+ */
+static FailoverDecision *
+ReplayFailoverDecision(List *nodesList, GroupEvent *event,
+					   FailoverDecisionSettings *settings)
+{
+	CandidateList candidateList = { 0 };
+	AutoFailoverNode *primaryNode = NULL;
+	List *candidateNodesGroupList = NIL;
+	ListCell *nodeCell = NULL;
+
+	FailoverDecision *decision =
+		(FailoverDecision *) palloc0(sizeof(FailoverDecision));
+
+	decision->eventId = event->eventId;
+	decision->eventTime = event->eventTime;
+	decision->actualNodeId = event->nodeId;
+
+	foreach(nodeCell, nodesList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+		if (StateBelongsToPrimary(node->reportedState))
+		{
+			primaryNode = node;
+			continue;
+		}
+
+		/*
+		 * Candidates are the standby nodes that have reported their LSN, or
+		 * that are secondary nodes that the fast path could have selected.
+		 */
+		if ((node->reportedState == REPLICATION_STATE_REPORT_LSN ||
+			 node->reportedState == REPLICATION_STATE_SECONDARY) &&
+			!IsUnhealthyAt(node, settings->now, settings->startTime,
+						   settings->unhealthyTimeoutMs))
+		{
+			candidateNodesGroupList = lappend(candidateNodesGroupList, node);
+		}
+	}
+
+	if (primaryNode != NULL)
+	{
+		decision->primaryNodeId = primaryNode->nodeId;
+
+		/*
+		 * When the primary failed its health checks, it is considered
+		 * unhealthy once it has not reported in the simulated timeout.
+		 */
+		if (primaryNode->health == NODE_HEALTH_BAD)
+		{
+			TimestampTz detectionTime =
+				primaryNode->reportTime +
+				(TimestampTz) settings->unhealthyTimeoutMs * INT64CONST(1000);
+
+			if (detectionTime < primaryNode->healthCheckTime)
+			{
+				detectionTime = primaryNode->healthCheckTime;
+			}
+
+			decision->hasTimings = true;
+			decision->actualElapsedMs =
+				(double) (event->eventTime - primaryNode->reportTime) / 1000.0;
+			decision->simulatedDetectionMs =
+				(double) (detectionTime - primaryNode->reportTime) / 1000.0;
+		}
+	}
+
+	List *mostAdvancedNodeList =
+		ListMostAdvancedStandbyNodes(candidateNodesGroupList);
+
+	if (list_length(mostAdvancedNodeList) == 0)
+	{
+		decision->message = "No healthy candidate had reported its LSN";
+
+		return decision;
+	}
+
+	AutoFailoverNode *mostAdvancedNode =
+		(AutoFailoverNode *) linitial(mostAdvancedNodeList);
+
+	candidateList.groupNodesList = nodesList;
+	candidateList.candidateNodesGroupList = candidateNodesGroupList;
+	candidateList.candidateCount = list_length(candidateNodesGroupList);
+	candidateList.mostAdvancedNodesGroupList = mostAdvancedNodeList;
+	candidateList.mostAdvancedReportedLSN = mostAdvancedNode->reportedLSN;
+
+	settings->message[0] = '\0';
+
+	AutoFailoverNode *selectedNode =
+		ChooseFailoverCandidate(&candidateList, primaryNode, settings);
+
+	if (selectedNode != NULL)
+	{
+		decision->simulatedNodeId = selectedNode->nodeId;
+	}
+
+	if (settings->message[0] != '\0')
+	{
+		decision->message = pstrdup(settings->message);
+	}
+	else if (selectedNode == NULL)
+	{
+		decision->message = "No candidate would have been selected";
+	}
+	else
+	{
+		decision->message =
+			psprintf("Selecting " NODE_FORMAT, NODE_FORMAT_ARGS(selectedNode));
+	}
+
+	return decision;
+}
+
+
+/*
+ * ApplyGroupEvent updates the simulated node with the information from the
+ * event. The monitor records an event when it marks a node as healthy or
+ * unhealthy, and otherwise when the node reports or is assigned a new goal.
+ */
+static void
+ApplyGroupEvent(AutoFailoverNode *node, GroupEvent *event)
+{
+	if (strstr(event->description, "is marked as unhealthy by the monitor"))
+	{
+		node->health = NODE_HEALTH_BAD;
+		node->healthCheckTime = event->eventTime;
+	}
+	else if (strstr(event->description, "is marked as healthy by the monitor"))
+	{
+		node->health = NODE_HEALTH_GOOD;
+		node->healthCheckTime = event->eventTime;
+	}
+	else
+	{
+		node->reportTime = event->eventTime;
+	}
+
+	if (node->reportedState != event->reportedState)
+	{
+		node->stateChangeTime = event->eventTime;
+	}
+
+	node->goalState = event->goalState;
+	node->reportedState = event->reportedState;
+	node->reportedTLI = event->reportedTLI;
+	node->reportedLSN = event->reportedLSN;
+	node->candidatePriority = event->candidatePriority;
+	node->replicationQuorum = event->replicationQuorum;
+}
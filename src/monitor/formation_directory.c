@@ -0,0 +1,457 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/formation_directory.c
+ *
+ * Implementation of the functions that move a formation from one monitor to
+ * another one.
+ *
+ * A monitor manages the formations that are registered in its own tables,
+ * and the pgautofailover.formation_directory table lists the formations that
+ * are managed by another monitor, with the connection string of that
+ * monitor. The keepers and the pg_autoctl commands look up the directory and
+ * follow the formations that have moved, so that several monitors can share
+ * the formations of a large deployment.
+ *
+ * pg_autoctl perform move-formation exports the formation and its nodes from
+ * the source monitor with pgautofailover.export_formation, imports them on
+ * the target monitor with pgautofailover.import_formation, and then deletes
+ * them from the source monitor with pgautofailover.forward_formation, which
+ * adds the directory entry. The nodes keep their node ids, and don't need to
+ * register again.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+
+/* these are internal headers */
+#include "formation_metadata.h"
+#include "metadata.h"
+#include "node_cache.h"
+#include "node_metadata.h"
+#include "notifications.h"
+
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "storage/lockdefs.h"
+#include "utils/builtins.h"
+
+
+#define AUTO_FAILOVER_FORMATION_DIRECTORY_TABLE \
+	"pgautofailover.formation_directory"
+
+
+static char * ImportedFormationId(Datum exportDatum);
+static void ImportFormationCheckNodes(char *formationId, Datum exportDatum);
+
+
+PG_FUNCTION_INFO_V1(import_formation);
+PG_FUNCTION_INFO_V1(forward_formation);
+
+
+/*
+ * import_formation registers on this monitor the formation and the nodes
+ * that pgautofailover.export_formation returned on another monitor, with
+ * their node ids, their current and goal states, and their last report. It
+ * returns how many nodes have been imported.
+ */
+Datum
+import_formation(PG_FUNCTION_ARGS)
+{
+	checkPgAutoFailoverVersion();
+
+	Datum exportDatum = PG_GETARG_DATUM(0);
+	char *formationId = ImportedFormationId(exportDatum);
+
+	LockFormation(formationId, ExclusiveLock);
+
+	ImportFormationCheckNodes(formationId, exportDatum);
+
+	Oid argTypes[] = {
+		JSONBOID, /* export */
+		TEXTOID   /* formationid */
+	};
+
+	Datum argValues[] = {
+		exportDatum,                        /* export */
+		CStringGetTextDatum(formationId)    /* formationid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	/*
+	 * The formation might exist already without nodes, such as the default
+	 * formation that every monitor has, in which case we replace its
+	 * properties with the imported ones.
+	 */
+	static MetadataPlan deleteFormationPlan = { 0 };
+	static MetadataPlan insertFormationPlan = { 0 };
+	static MetadataPlan insertNodesPlan = { 0 };
+	static MetadataPlan insertReportsPlan = { 0 };
+	static MetadataPlan missingReportsPlan = { 0 };
+	static MetadataPlan sequencePlan = { 0 };
+	static MetadataPlan directoryPlan = { 0 };
+
+	const char *deleteFormationQuery =
+		"DELETE FROM " AUTO_FAILOVER_FORMATION_TABLE
+		" WHERE formationid = $2";
+
+	const char *insertFormationQuery =
+		"INSERT INTO " AUTO_FAILOVER_FORMATION_TABLE
+		" SELECT * FROM jsonb_populate_record("
+		"null::" AUTO_FAILOVER_FORMATION_TABLE ", $1->'formation')";
+
+	const char *insertNodesQuery =
+		"INSERT INTO " AUTO_FAILOVER_NODE_TABLE
+		" SELECT * FROM jsonb_populate_recordset("
+		"null::" AUTO_FAILOVER_NODE_TABLE ", $1->'nodes')";
+
+	/*
+	 * node_active only updates the node_report row of a node, which is
+	 * inserted when the node registers: every imported node needs one, with
+	 * its last report on the other monitor when the export has it.
+	 */
+	const char *insertReportsQuery =
+		"INSERT INTO " AUTO_FAILOVER_NODE_REPORT_TABLE
+		" SELECT report.*"
+		"   FROM jsonb_populate_recordset("
+		"null::" AUTO_FAILOVER_NODE_REPORT_TABLE ", $1->'reports') AS report"
+		"   JOIN " AUTO_FAILOVER_NODE_TABLE " AS node USING(nodeid)"
+		"  WHERE node.formationid = $2";
+
+	const char *missingReportsQuery =
+		"INSERT INTO " AUTO_FAILOVER_NODE_REPORT_TABLE " (nodeid)"
+		" SELECT nodeid FROM " AUTO_FAILOVER_NODE_TABLE
+		"  WHERE formationid = $2"
+		" ON CONFLICT (nodeid) DO NOTHING";
+
+	/* the nodes registered here later must not reuse the imported node ids */
+	const char *sequenceQuery =
+		"SELECT setval('pgautofailover.node_nodeid_seq', "
+		"greatest(max(nodeid), "
+		"(SELECT last_value FROM pgautofailover.node_nodeid_seq))) "
+		"FROM " AUTO_FAILOVER_NODE_TABLE;
+
+	const char *directoryQuery =
+		"DELETE FROM " AUTO_FAILOVER_FORMATION_DIRECTORY_TABLE
+		" WHERE formationid = $2";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&deleteFormationPlan,
+										deleteFormationQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
+
+	if (spiStatus != SPI_OK_DELETE)
+	{
+		elog(ERROR, "could not delete from " AUTO_FAILOVER_FORMATION_TABLE);
+	}
+
+	spiStatus = ExecuteMetadataPlan(&insertFormationPlan, insertFormationQuery,
+									argCount, argTypes, argValues,
+									NULL, false, 0);
+
+	if (spiStatus != SPI_OK_INSERT || SPI_processed != 1)
+	{
+		elog(ERROR, "could not insert into " AUTO_FAILOVER_FORMATION_TABLE);
+	}
+
+	spiStatus = ExecuteMetadataPlan(&insertNodesPlan, insertNodesQuery,
+									argCount, argTypes, argValues,
+									NULL, false, 0);
+
+	if (spiStatus != SPI_OK_INSERT)
+	{
+		elog(ERROR, "could not insert into " AUTO_FAILOVER_NODE_TABLE);
+	}
+
+	int nodeCount = (int) SPI_processed;
+
+	spiStatus = ExecuteMetadataPlan(&insertReportsPlan, insertReportsQuery,
+									argCount, argTypes, argValues,
+									NULL, false, 0);
+
+	if (spiStatus != SPI_OK_INSERT)
+	{
+		elog(ERROR, "could not insert into " AUTO_FAILOVER_NODE_REPORT_TABLE);
+	}
+
+	spiStatus = ExecuteMetadataPlan(&missingReportsPlan, missingReportsQuery,
+									argCount, argTypes, argValues,
+									NULL, false, 0);
+
+	if (spiStatus != SPI_OK_INSERT)
+	{
+		elog(ERROR, "could not insert into " AUTO_FAILOVER_NODE_REPORT_TABLE);
+	}
+
+	spiStatus = ExecuteMetadataPlan(&sequencePlan, sequenceQuery,
+									argCount, argTypes, argValues,
+									NULL, false, 0);
+
+	if (spiStatus != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not update pgautofailover.node_nodeid_seq");
+	}
+
+	spiStatus = ExecuteMetadataPlan(&directoryPlan, directoryQuery,
+									argCount, argTypes, argValues,
+									NULL, false, 0);
+
+	if (spiStatus != SPI_OK_DELETE)
+	{
+		elog(ERROR,
+			 "could not delete from " AUTO_FAILOVER_FORMATION_DIRECTORY_TABLE);
+	}
+
+	SPI_finish();
+
+	InvalidateNodeCache();
+
+	char message[BUFSIZE] = { 0 };
+
+	LogAndNotifyMessage(
+		message, BUFSIZE,
+		"Imported formation \"%s\" with %d node(s) from another monitor",
+		formationId, nodeCount);
+
+	PG_RETURN_INT32(nodeCount);
+}
+
+
+/*
+ * ImportedFormationId returns the formation id of the output of
+ * pgautofailover.export_formation, or errors out when the given JSON is not
+ * such an output.
+ */
+static char *
+ImportedFormationId(Datum exportDatum)
+{
+	Oid argTypes[] = { JSONBOID };
+	Datum argValues[] = { exportDatum };
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan selectPlan = { 0 };
+
+	const char *selectQuery =
+		"SELECT $1->'formation'->>'formationid'"
+		" WHERE jsonb_typeof($1->'nodes') = 'array'";
+
+	MemoryContext callerContext = CurrentMemoryContext;
+	char *formationId = NULL;
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&selectPlan, selectQuery,
+										argCount, argTypes, argValues,
+										NULL, true, 1);
+
+	if (spiStatus != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not read the formation to import");
+	}
+
+	if (SPI_processed == 1)
+	{
+		bool isNull = false;
+		Datum formationIdDatum = SPI_getbinval(SPI_tuptable->vals[0],
+											   SPI_tuptable->tupdesc,
+											   1, &isNull);
+
+		if (!isNull)
+		{
+			MemoryContext spiContext = MemoryContextSwitchTo(callerContext);
+
+			formationId = TextDatumGetCString(formationIdDatum);
+
+			MemoryContextSwitchTo(spiContext);
+		}
+	}
+
+	SPI_finish();
+
+	if (formationId == NULL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("the formation to import is not an output of "
+						"pgautofailover.export_formation")));
+	}
+
+	return formationId;
+}
+
+
+/*
+ * ImportFormationCheckNodes errors out when the formation already has nodes
+ * registered on this monitor, or when one of the node ids to import is used
+ * already by a node of another formation.
+ */
+static void
+ImportFormationCheckNodes(char *formationId, Datum exportDatum)
+{
+	List *nodesList = AllAutoFailoverNodes(formationId);
+
+	if (list_length(nodesList) > 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("formation \"%s\" already has %d node(s) registered "
+						"on this monitor",
+						formationId, list_length(nodesList))));
+	}
+
+	Oid argTypes[] = { JSONBOID };
+	Datum argValues[] = { exportDatum };
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan selectPlan = { 0 };
+
+	const char *selectQuery =
+		"SELECT imported.nodeid"
+		"  FROM jsonb_populate_recordset("
+		"null::" AUTO_FAILOVER_NODE_TABLE ", $1->'nodes') AS imported"
+		"  JOIN " AUTO_FAILOVER_NODE_TABLE " AS node USING(nodeid)"
+		" ORDER BY imported.nodeid";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&selectPlan, selectQuery,
+										argCount, argTypes, argValues,
+										NULL, true, 1);
+
+	if (spiStatus != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not read the nodes to import");
+	}
+
+	if (SPI_processed > 0)
+	{
+		bool isNull = false;
+		Datum nodeIdDatum = SPI_getbinval(SPI_tuptable->vals[0],
+										  SPI_tuptable->tupdesc,
+										  1, &isNull);
+
+		ereport(ERROR,
+				(errcode(ERRCODE_UNIQUE_VIOLATION),
+				 errmsg("node id %lld of formation \"%s\" is already used "
+						"by another node on this monitor",
+						(long long) DatumGetInt64(nodeIdDatum), formationId),
+				 errhint("Federated monitors should register their nodes "
+						 "with disjoint ranges of node ids, see the sequence "
+						 "pgautofailover.node_nodeid_seq.")));
+	}
+
+	SPI_finish();
+}
+
+
+/*
+ * forward_formation deletes the formation and its nodes from this monitor,
+ * once they have been imported on the monitor at the given connection
+ * string, and registers that monitor in pgautofailover.formation_directory.
+ * The keepers of the nodes then follow the directory entry after their next
+ * call to node_active fails. It returns how many nodes have been deleted.
+ */
+Datum
+forward_formation(PG_FUNCTION_ARGS)
+{
+	checkPgAutoFailoverVersion();
+
+	text *formationIdText = PG_GETARG_TEXT_P(0);
+	char *formationId = text_to_cstring(formationIdText);
+	text *monitorURIText = PG_GETARG_TEXT_P(1);
+
+	LockFormation(formationId, ExclusiveLock);
+
+	AutoFailoverFormation *formation = GetFormation(formationId);
+
+	if (formation == NULL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("formation \"%s\" does not exist", formationId)));
+	}
+
+	Oid argTypes[] = {
+		TEXTOID, /* formationid */
+		TEXTOID  /* monitoruri */
+	};
+
+	Datum argValues[] = {
+		PointerGetDatum(formationIdText),  /* formationid */
+		PointerGetDatum(monitorURIText)    /* monitoruri */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan deleteNodesPlan = { 0 };
+	static MetadataPlan deleteFormationPlan = { 0 };
+	static MetadataPlan directoryPlan = { 0 };
+
+	const char *deleteNodesQuery =
+		"DELETE FROM " AUTO_FAILOVER_NODE_TABLE
+		" WHERE formationid = $1";
+
+	const char *deleteFormationQuery =
+		"DELETE FROM " AUTO_FAILOVER_FORMATION_TABLE
+		" WHERE formationid = $1";
+
+	const char *directoryQuery =
+		"INSERT INTO " AUTO_FAILOVER_FORMATION_DIRECTORY_TABLE
+		" (formationid, monitoruri, updatetime)"
+		" VALUES ($1, $2, now())"
+		" ON CONFLICT (formationid) DO UPDATE"
+		"    SET monitoruri = excluded.monitoruri,"
+		"        updatetime = excluded.updatetime";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&deleteNodesPlan, deleteNodesQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
+
+	if (spiStatus != SPI_OK_DELETE)
+	{
+		elog(ERROR, "could not delete from " AUTO_FAILOVER_NODE_TABLE);
+	}
+
+	int nodeCount = (int) SPI_processed;
+
+	spiStatus = ExecuteMetadataPlan(&deleteFormationPlan, deleteFormationQuery,
+									argCount, argTypes, argValues,
+									NULL, false, 0);
+
+	if (spiStatus != SPI_OK_DELETE)
+	{
+		elog(ERROR, "could not delete from " AUTO_FAILOVER_FORMATION_TABLE);
+	}
+
+	spiStatus = ExecuteMetadataPlan(&directoryPlan, directoryQuery,
+									argCount, argTypes, argValues,
+									NULL, false, 0);
+
+	if (spiStatus != SPI_OK_INSERT)
+	{
+		elog(ERROR,
+			 "could not update " AUTO_FAILOVER_FORMATION_DIRECTORY_TABLE);
+	}
+
+	SPI_finish();
+
+	InvalidateNodeCache();
+
+	/* the connection string might contain a password, don't log it */
+	char message[BUFSIZE] = { 0 };
+
+	LogAndNotifyMessage(
+		message, BUFSIZE,
+		"Formation \"%s\" and its %d node(s) are now managed by another "
+		"monitor, see " AUTO_FAILOVER_FORMATION_DIRECTORY_TABLE,
+		formationId, nodeCount);
+
+	PG_RETURN_INT32(nodeCount);
+}
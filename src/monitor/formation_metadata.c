@@ -18,13 +18,18 @@
 #include "health_check.h"
 #include "metadata.h"
 #include "formation_metadata.h"
+#include "group_state_machine.h"
+#include "node_cache.h"
 #include "node_metadata.h"
 #include "notifications.h"
+#include "stat_functions.h"
 
 #include "access/htup_details.h"
+#include "access/xact.h"
 #include "access/xlogdefs.h"
 #include "catalog/pg_type.h"
 #include "executor/spi.h"
+#include "lib/stringinfo.h"
 #include "nodes/makefuncs.h"
 #include "nodes/parsenodes.h"
 #include "parser/parse_type.h"
@@ -38,10 +43,50 @@ PG_FUNCTION_INFO_V1(drop_formation);
 PG_FUNCTION_INFO_V1(enable_secondary);
 PG_FUNCTION_INFO_V1(disable_secondary);
 PG_FUNCTION_INFO_V1(set_formation_number_sync_standbys);
+PG_FUNCTION_INFO_V1(set_formation_health_check_tcp_user_timeout);
+PG_FUNCTION_INFO_V1(set_formation_health_policy);
+
+/* these functions count their calls in pgautofailover.stat_functions */
+TRACKED_FUNCTION(create_formation, STAT_FUNCTION_CREATE_FORMATION);
+TRACKED_FUNCTION(drop_formation, STAT_FUNCTION_DROP_FORMATION);
+TRACKED_FUNCTION(enable_secondary, STAT_FUNCTION_ENABLE_SECONDARY);
+TRACKED_FUNCTION(disable_secondary, STAT_FUNCTION_DISABLE_SECONDARY);
+TRACKED_FUNCTION(set_formation_number_sync_standbys,
+				 STAT_FUNCTION_SET_FORMATION_NUMBER_SYNC_STANDBYS);
 
 Datum AutoFailoverFormationGetDatum(FunctionCallInfo fcinfo,
 									AutoFailoverFormation *formation);
 
+/*
+ * The health policy settings that set_formation_health_policy accepts, which
+ * are also the names of the formation columns where we store them.
+ */
+static const char *FormationHealthPolicySettings[] = {
+	"health_check_period",
+	"health_check_timeout",
+	"node_considered_unhealthy_timeout",
+	"primary_demote_timeout",
+	"health_check_tcp_user_timeout",
+	NULL
+};
+
+/*
+ * The state machine looks up the timeouts of a node's formation many times
+ * per call, so we keep the health policy of the last formation we looked up
+ * until the end of the current transaction.
+ */
+static bool FormationHealthPolicyValid = false;
+static bool FormationHealthPolicyCallbackRegistered = false;
+static char FormationHealthPolicyId[NAMEDATALEN];
+static FormationHealthPolicy CachedFormationHealthPolicy;
+
+static int FormationIntColumn(HeapTuple heapTuple, TupleDesc tupleDescriptor,
+							  const char *columnName);
+static bool FormationBoolColumn(HeapTuple heapTuple, TupleDesc tupleDescriptor,
+								const char *columnName);
+static FormationHealthPolicy * GetFormationHealthPolicy(const char *formationId);
+static void FormationHealthPolicyXactCallback(XactEvent event, void *arg);
+
 /*
  * GetFormation returns an AutoFailoverFormation structure with the formationId
  * and its kind, when the formation has already been created, or NULL
@@ -62,13 +107,16 @@ GetFormation(const char *formationId)
 	};
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
 
+	static MetadataPlan selectPlan = { 0 };
+
 	const char *selectQuery =
 		"SELECT * FROM " AUTO_FAILOVER_FORMATION_TABLE " WHERE formationId = $1";
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(selectQuery, argCount, argTypes, argValues,
-										  NULL, false, 1);
+	int spiStatus = ExecuteMetadataPlan(&selectPlan, selectQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 1);
 	if (spiStatus != SPI_OK_SELECT)
 	{
 		elog(ERROR, "could not select from " AUTO_FAILOVER_FORMATION_TABLE);
@@ -105,6 +153,25 @@ GetFormation(const char *formationId)
 		strlcpy(formation->dbname, NameStr(*DatumGetName(dbname)), NAMEDATALEN);
 		formation->opt_secondary = DatumGetBool(opt_secondary);
 		formation->number_sync_standbys = DatumGetInt32(number_sync_standbys);
+		formation->preferLeastLoaded =
+			FormationBoolColumn(heapTuple, tupleDescriptor,
+								"prefer_least_loaded");
+		formation->slotRetentionBudgetMB =
+			FormationIntColumn(heapTuple, tupleDescriptor,
+							   "slot_retention_budget_mb");
+
+		formation->healthPolicy.healthCheckPeriod =
+			FormationIntColumn(heapTuple, tupleDescriptor,
+							   "health_check_period");
+		formation->healthPolicy.healthCheckTimeout =
+			FormationIntColumn(heapTuple, tupleDescriptor,
+							   "health_check_timeout");
+		formation->healthPolicy.unhealthyTimeout =
+			FormationIntColumn(heapTuple, tupleDescriptor,
+							   "node_considered_unhealthy_timeout");
+		formation->healthPolicy.demoteTimeout =
+			FormationIntColumn(heapTuple, tupleDescriptor,
+							   "primary_demote_timeout");
 
 		MemoryContextSwitchTo(spiContext);
 	}
@@ -124,8 +191,8 @@ GetFormation(const char *formationId)
  * the given formation kind. We know only two formation kind at the moment,
  * 'pgsql' and 'citus'. Support is only implemented for 'pgsql'.
  */
-Datum
-create_formation(PG_FUNCTION_ARGS)
+static Datum
+create_formation_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
@@ -153,8 +220,8 @@ create_formation(PG_FUNCTION_ARGS)
  * and may only succeed when no nodes belong to target formation. This is
  * checked by the foreign key reference installed in the pgautofailover schema.
  */
-Datum
-drop_formation(PG_FUNCTION_ARGS)
+static Datum
+drop_formation_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
@@ -173,8 +240,8 @@ drop_formation(PG_FUNCTION_ARGS)
  * Subsequent nodes added to the formation will be assigned secondary of an
  * already running node as long as there are nodes without a secondary.
  */
-Datum
-enable_secondary(PG_FUNCTION_ARGS)
+static Datum
+enable_secondary_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
@@ -192,8 +259,8 @@ enable_secondary(PG_FUNCTION_ARGS)
  * when no nodes of the formation are currently in the secondary role. This is
  * enforced by a trigger on the formation table.
  */
-Datum
-disable_secondary(PG_FUNCTION_ARGS)
+static Datum
+disable_secondary_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
@@ -237,6 +304,8 @@ AddFormation(const char *formationId,
 
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
 
+	static MetadataPlan insertPlan = { 0 };
+
 	const char *insertQuery =
 		"INSERT INTO " AUTO_FAILOVER_FORMATION_TABLE
 		" (formationid, kind, dbname, opt_secondary, number_sync_standbys)"
@@ -244,8 +313,9 @@ AddFormation(const char *formationId,
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(insertQuery, argCount, argTypes,
-										  argValues, NULL, false, 0);
+	int spiStatus = ExecuteMetadataPlan(&insertPlan, insertQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
 
 	if (spiStatus != SPI_OK_INSERT)
 	{
@@ -274,14 +344,16 @@ RemoveFormation(const char *formationId)
 
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
 
+	static MetadataPlan deletePlan = { 0 };
+
 	const char *deleteQuery =
 		"DELETE FROM " AUTO_FAILOVER_FORMATION_TABLE " WHERE formationid = $1";
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(deleteQuery,
-										  argCount, argTypes, argValues,
-										  NULL, false, 0);
+	int spiStatus = ExecuteMetadataPlan(&deletePlan, deleteQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
 
 	if (spiStatus != SPI_OK_DELETE)
 	{
@@ -321,6 +393,8 @@ SetFormationKind(const char *formationId, FormationKind kind)
 	};
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
 
+	static MetadataPlan updatePlan = { 0 };
+
 	const char *updateQuery =
 		"UPDATE " AUTO_FAILOVER_FORMATION_TABLE
 		" SET kind = $1"
@@ -328,9 +402,9 @@ SetFormationKind(const char *formationId, FormationKind kind)
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(updateQuery,
-										  argCount, argTypes, argValues,
-										  NULL, false, 0);
+	int spiStatus = ExecuteMetadataPlan(&updatePlan, updateQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
 	if (spiStatus != SPI_OK_UPDATE)
 	{
 		elog(ERROR, "could not update " AUTO_FAILOVER_FORMATION_TABLE);
@@ -357,6 +431,8 @@ SetFormationDBName(const char *formationId, const char *dbname)
 	};
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
 
+	static MetadataPlan updatePlan = { 0 };
+
 	const char *updateQuery =
 		"UPDATE " AUTO_FAILOVER_FORMATION_TABLE
 		" SET dbname = $1"
@@ -364,9 +440,9 @@ SetFormationDBName(const char *formationId, const char *dbname)
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(updateQuery,
-										  argCount, argTypes, argValues,
-										  NULL, false, 0);
+	int spiStatus = ExecuteMetadataPlan(&updatePlan, updateQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
 	if (spiStatus != SPI_OK_UPDATE)
 	{
 		elog(ERROR, "could not update " AUTO_FAILOVER_FORMATION_TABLE);
@@ -397,6 +473,8 @@ SetFormationOptSecondary(const char *formationId, bool optSecondary)
 	};
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
 
+	static MetadataPlan updatePlan = { 0 };
+
 	const char *updateQuery =
 		"UPDATE " AUTO_FAILOVER_FORMATION_TABLE
 		" SET opt_secondary = $1"
@@ -404,9 +482,9 @@ SetFormationOptSecondary(const char *formationId, bool optSecondary)
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(updateQuery,
-										  argCount, argTypes, argValues,
-										  NULL, false, 0);
+	int spiStatus = ExecuteMetadataPlan(&updatePlan, updateQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
 	if (spiStatus != SPI_OK_UPDATE)
 	{
 		elog(ERROR, "could not update " AUTO_FAILOVER_FORMATION_TABLE);
@@ -533,8 +611,8 @@ IsCitusFormation(AutoFailoverFormation *formation)
  * set_formation_number_sync_standbys sets number_sync_standbys property of a
  * formation. The function returns true on success.
  */
-Datum
-set_formation_number_sync_standbys(PG_FUNCTION_ARGS)
+static Datum
+set_formation_number_sync_standbys_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
@@ -711,6 +789,8 @@ SetFormationNumberSyncStandbys(const char *formationId, int numberSyncStandbys)
 	};
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
 
+	static MetadataPlan updatePlan = { 0 };
+
 	const char *updateQuery =
 		"UPDATE " AUTO_FAILOVER_FORMATION_TABLE
 		" SET number_sync_standbys = $1"
@@ -718,11 +798,322 @@ SetFormationNumberSyncStandbys(const char *formationId, int numberSyncStandbys)
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(updateQuery,
+	int spiStatus = ExecuteMetadataPlan(&updatePlan, updateQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
+	SPI_finish();
+
+	if (spiStatus != SPI_OK_UPDATE)
+	{
+		elog(ERROR, "could not update " AUTO_FAILOVER_FORMATION_TABLE);
+		return false;
+	}
+
+	/* synchronous_standby_names depends on number_sync_standbys */
+	InvalidateNodeCache();
+
+	return true;
+}
+
+
+/*
+ * set_formation_health_check_tcp_user_timeout sets the TCP user timeout, in
+ * milliseconds, of the health check connections to the nodes of a formation,
+ * so that critical formations get a faster failure detection. Zero uses the
+ * pgautofailover.health_check_tcp_user_timeout setting instead.
+ */
+Datum
+set_formation_health_check_tcp_user_timeout(PG_FUNCTION_ARGS)
+{
+	checkPgAutoFailoverVersion();
+
+	text *formationIdText = PG_GETARG_TEXT_P(0);
+	char *formationId = text_to_cstring(formationIdText);
+	int tcpUserTimeout = PG_GETARG_INT32(1);
+
+	AutoFailoverFormation *formation = GetFormation(formationId);
+
+	if (formation == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("unknown formation \"%s\"", formationId)));
+	}
+
+	if (tcpUserTimeout < 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid value for health_check_tcp_user_timeout: "
+						"\"%d\"", tcpUserTimeout),
+				 errdetail("A non-negative integer is expected")));
+	}
+
+	bool success =
+		SetFormationHealthCheckTcpUserTimeout(formationId, tcpUserTimeout);
+
+	/* the health check workers connect again with the new setting */
+	NotifyNodeListChange();
+
+	PG_RETURN_BOOL(success);
+}
+
+
+/*
+ * set_formation_health_policy sets one of the health check and failover
+ * timeouts of a formation, in milliseconds, that otherwise default to the
+ * GUC of the same name. Zero resets the formation to the GUC value.
+ */
+Datum
+set_formation_health_policy(PG_FUNCTION_ARGS)
+{
+	checkPgAutoFailoverVersion();
+
+	char *formationId = text_to_cstring(PG_GETARG_TEXT_P(0));
+	char *setting = text_to_cstring(PG_GETARG_TEXT_P(1));
+	int value = PG_GETARG_INT32(2);
+	const char *columnName = NULL;
+
+	for (int index = 0; FormationHealthPolicySettings[index] != NULL; index++)
+	{
+		if (strcmp(setting, FormationHealthPolicySettings[index]) == 0)
+		{
+			columnName = FormationHealthPolicySettings[index];
+			break;
+		}
+	}
+
+	if (columnName == NULL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("unknown formation health policy setting \"%s\"",
+						setting)));
+	}
+
+	if (value < 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid value for %s: \"%d\"", setting, value),
+				 errdetail("A non-negative integer is expected")));
+	}
+
+	if (GetFormation(formationId) == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("unknown formation \"%s\"", formationId)));
+	}
+
+	Oid argTypes[] = {
+		INT4OID,     /* value */
+		TEXTOID      /* formationId */
+	};
+
+	Datum argValues[] = {
+		Int32GetDatum(value),              /* value */
+		CStringGetTextDatum(formationId)   /* formationId */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	StringInfo updateQuery = makeStringInfo();
+
+	/* the column name comes from FormationHealthPolicySettings */
+	appendStringInfo(updateQuery,
+					 "UPDATE " AUTO_FAILOVER_FORMATION_TABLE
+					 " SET %s = $1 WHERE formationid = $2",
+					 columnName);
+
+	SPI_connect();
+
+	int spiStatus = SPI_execute_with_args(updateQuery->data,
 										  argCount, argTypes, argValues,
 										  NULL, false, 0);
 	SPI_finish();
 
+	if (spiStatus != SPI_OK_UPDATE)
+	{
+		elog(ERROR, "could not update " AUTO_FAILOVER_FORMATION_TABLE);
+	}
+
+	FormationHealthPolicyValid = false;
+
+	/* the health check workers load the new policy with the node list */
+	NotifyNodeListChange();
+
+	PG_RETURN_BOOL(true);
+}
+
+
+/*
+ * FormationUnhealthyTimeoutMs returns the node_considered_unhealthy_timeout
+ * of the given formation.
+ */
+int
+FormationUnhealthyTimeoutMs(const char *formationId)
+{
+	FormationHealthPolicy *policy = GetFormationHealthPolicy(formationId);
+
+	return policy->unhealthyTimeout > 0
+		   ? policy->unhealthyTimeout
+		   : UnhealthyTimeoutMs;
+}
+
+
+/*
+ * FormationDemoteTimeoutMs returns the primary_demote_timeout of the given
+ * formation.
+ */
+int
+FormationDemoteTimeoutMs(const char *formationId)
+{
+	FormationHealthPolicy *policy = GetFormationHealthPolicy(formationId);
+
+	return policy->demoteTimeout > 0 ? policy->demoteTimeout : DrainTimeoutMs;
+}
+
+
+/*
+ * FormationPrefersLeastLoaded returns true when the failover candidate
+ * selection of the given formation breaks the ties between equally advanced
+ * candidates by their load.
+ */
+bool
+FormationPrefersLeastLoaded(const char *formationId)
+{
+	AutoFailoverFormation *formation = GetFormation(formationId);
+
+	return formation != NULL && formation->preferLeastLoaded;
+}
+
+
+/*
+ * GetFormationHealthPolicy returns the health policy of the given formation,
+ * from our cache when it's the formation we looked up last in the current
+ * transaction. Unknown formations get the GUC values.
+ */
+static FormationHealthPolicy *
+GetFormationHealthPolicy(const char *formationId)
+{
+	if (!FormationHealthPolicyCallbackRegistered)
+	{
+		RegisterXactCallback(FormationHealthPolicyXactCallback, NULL);
+		FormationHealthPolicyCallbackRegistered = true;
+	}
+
+	if (FormationHealthPolicyValid &&
+		strncmp(FormationHealthPolicyId, formationId, NAMEDATALEN) == 0)
+	{
+		return &CachedFormationHealthPolicy;
+	}
+
+	AutoFailoverFormation *formation = GetFormation(formationId);
+
+	memset(&CachedFormationHealthPolicy, 0, sizeof(FormationHealthPolicy));
+
+	if (formation != NULL)
+	{
+		CachedFormationHealthPolicy = formation->healthPolicy;
+	}
+
+	strlcpy(FormationHealthPolicyId, formationId, NAMEDATALEN);
+	FormationHealthPolicyValid = true;
+
+	return &CachedFormationHealthPolicy;
+}
+
+
+/*
+ * FormationHealthPolicyXactCallback forgets the cached health policy at the
+ * end of each transaction, so that we never use a stale one.
+ */
+static void
+FormationHealthPolicyXactCallback(XactEvent event, void *arg)
+{
+	FormationHealthPolicyValid = false;
+}
+
+
+/*
+ * FormationIntColumn returns the value of the given integer column of a
+ * formation tuple, or zero when the column is NULL, or does not exist yet
+ * because the extension has not been updated.
+ */
+static int
+FormationIntColumn(HeapTuple heapTuple, TupleDesc tupleDescriptor,
+				   const char *columnName)
+{
+	bool isNull = false;
+	int attributeNumber = SPI_fnumber(tupleDescriptor, columnName);
+
+	if (attributeNumber <= 0)
+	{
+		return 0;
+	}
+
+	Datum value = heap_getattr(heapTuple, attributeNumber,
+							   tupleDescriptor, &isNull);
+
+	return isNull ? 0 : DatumGetInt32(value);
+}
+
+
+/*
+ * FormationBoolColumn returns the value of the given boolean column of a
+ * formation tuple, or false when the column is NULL, or does not exist yet
+ * because the extension has not been updated.
+ */
+static bool
+FormationBoolColumn(HeapTuple heapTuple, TupleDesc tupleDescriptor,
+					const char *columnName)
+{
+	bool isNull = false;
+	int attributeNumber = SPI_fnumber(tupleDescriptor, columnName);
+
+	if (attributeNumber <= 0)
+	{
+		return false;
+	}
+
+	Datum value = heap_getattr(heapTuple, attributeNumber,
+							   tupleDescriptor, &isNull);
+
+	return isNull ? false : DatumGetBool(value);
+}
+
+
+/*
+ * SetFormationHealthCheckTcpUserTimeout sets the health_check_tcp_user_timeout
+ * property of a formation entry. Returns true if successfull.
+ */
+bool
+SetFormationHealthCheckTcpUserTimeout(const char *formationId,
+									  int tcpUserTimeout)
+{
+	Oid argTypes[] = {
+		INT4OID,     /* tcpUserTimeout */
+		TEXTOID      /* formationId */
+	};
+
+	Datum argValues[] = {
+		Int32GetDatum(tcpUserTimeout),     /* tcpUserTimeout */
+		CStringGetTextDatum(formationId)   /* formationId */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan updatePlan = { 0 };
+
+	const char *updateQuery =
+		"UPDATE " AUTO_FAILOVER_FORMATION_TABLE
+		" SET health_check_tcp_user_timeout = $1"
+		" WHERE formationid = $2";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&updatePlan, updateQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
+	SPI_finish();
+
 	if (spiStatus != SPI_OK_UPDATE)
 	{
 		elog(ERROR, "could not update " AUTO_FAILOVER_FORMATION_TABLE);
@@ -30,6 +30,20 @@
 #define Anum_pgautofailover_formation_number_sync_standbys 5
 
 
+/*
+ * FormationHealthPolicy holds the per-formation values of the health check
+ * and failover timeouts, in milliseconds. Zero stands for the value of the
+ * matching GUC.
+ */
+typedef struct FormationHealthPolicy
+{
+	int healthCheckPeriod;          /* pgautofailover.health_check_period */
+	int healthCheckTimeout;         /* pgautofailover.health_check_timeout */
+	int unhealthyTimeout;           /* node_considered_unhealthy_timeout */
+	int demoteTimeout;              /* primary_demote_timeout */
+} FormationHealthPolicy;
+
+
 /*
  * AutoFailoverFormation represents a formation that is being managed by the
  * pg_auto_failover monitor.
@@ -41,6 +55,9 @@ typedef struct AutoFailoverFormation
 	char dbname[NAMEDATALEN];
 	bool opt_secondary;
 	int number_sync_standbys;
+	bool preferLeastLoaded;
+	int slotRetentionBudgetMB;
+	FormationHealthPolicy healthPolicy;
 } AutoFailoverFormation;
 
 
@@ -61,6 +78,11 @@ extern bool FormationNumSyncStandbyIsValid(AutoFailoverFormation *formation,
 
 extern bool SetFormationNumberSyncStandbys(const char *formationId,
 										   int numberSyncStandbys);
+extern bool SetFormationHealthCheckTcpUserTimeout(const char *formationId,
+												  int tcpUserTimeout);
+extern int FormationUnhealthyTimeoutMs(const char *formationId);
+extern int FormationDemoteTimeoutMs(const char *formationId);
+extern bool FormationPrefersLeastLoaded(const char *formationId);
 
 extern FormationKind FormationKindFromString(const char *kind);
 extern char * FormationKindToString(FormationKind kind);
@@ -0,0 +1,303 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/goal_state_wait.c
+ *
+ * Implementation of the wait for a change of the goal state of a node, used
+ * by the node_active_wait() procedure so that keepers can report their state
+ * and then wait for a new goal state in a single round trip.
+ *
+ * Waiters sleep on a condition variable in shared memory, picked from the
+ * nodeid of the node that they wait for. Each transaction that changes the
+ * goal state of a node broadcasts the matching condition variable when it
+ * commits, and waiters then check the goal state of their node again: several
+ * nodes share the same condition variable, so wakeups might be spurious.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+/* these are internal headers */
+#include "goal_state_wait.h"
+#include "group_state_machine.h"
+#include "metadata.h"
+#include "node_metadata.h"
+#include "replication_state.h"
+#include "version_compat.h"
+
+#include "access/xact.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "storage/condition_variable.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/timestamp.h"
+
+
+/* must be 64 or less, we track pending changes in an uint64 bitmap */
+#define GOAL_STATE_WAIT_SLOTS 64
+
+typedef struct GoalStateWaitControlData
+{
+	ConditionVariable slots[GOAL_STATE_WAIT_SLOTS];
+} GoalStateWaitControlData;
+
+
+static GoalStateWaitControlData *GoalStateWaitControl = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* slots of the nodes which goal state the current transaction changed */
+static uint64 PendingGoalStateChanges = 0;
+
+
+static void GoalStateWaitShmemInit(void);
+static void GoalStateWaitXactCallback(XactEvent event, void *arg);
+
+PG_FUNCTION_INFO_V1(wait_for_goal_state_change);
+
+
+/*
+ * InitializeGoalStateWait, called at server start, requests the shared memory
+ * needed for the goal state waits and registers the transaction callback.
+ */
+void
+InitializeGoalStateWait(void)
+{
+	/* on PG 15, we use shmem_request_hook_type */
+#if PG_VERSION_NUM < 150000
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(GoalStateWaitShmemSize());
+	}
+#endif
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = GoalStateWaitShmemInit;
+
+	RegisterXactCallback(GoalStateWaitXactCallback, NULL);
+}
+
+
+/*
+ * GoalStateWaitShmemSize computes how much shared memory the goal state waits
+ * need.
+ */
+size_t
+GoalStateWaitShmemSize(void)
+{
+	return sizeof(GoalStateWaitControlData);
+}
+
+
+/*
+ * GoalStateWaitShmemInit initializes the shared memory of the goal state
+ * waits.
+ */
+static void
+GoalStateWaitShmemInit(void)
+{
+	bool alreadyInitialized = false;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	GoalStateWaitControl =
+		(GoalStateWaitControlData *) ShmemInitStruct(
+			"pg_auto_failover Goal State Wait",
+			sizeof(GoalStateWaitControlData),
+			&alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		for (int slot = 0; slot < GOAL_STATE_WAIT_SLOTS; slot++)
+		{
+			ConditionVariableInit(&(GoalStateWaitControl->slots[slot]));
+		}
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/*
+ * GoalStateChanged registers that the current transaction changes the goal
+ * state of the given node. Waiters are woken up when the transaction commits.
+ */
+void
+GoalStateChanged(int64 nodeId)
+{
+	PendingGoalStateChanges |= UINT64CONST(1) << (nodeId % GOAL_STATE_WAIT_SLOTS);
+}
+
+
+/*
+ * GoalStateWaitXactCallback wakes up the waiters of the nodes which goal state
+ * has been changed by a transaction, once it has committed. Callbacks for the
+ * COMMIT event are called after the transaction is visible to new snapshots,
+ * so the waiters then see the new goal state.
+ */
+static void
+GoalStateWaitXactCallback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		case XACT_EVENT_PREPARE:
+		{
+			if (PendingGoalStateChanges != 0 && GoalStateWaitControl != NULL)
+			{
+				for (int slot = 0; slot < GOAL_STATE_WAIT_SLOTS; slot++)
+				{
+					if (PendingGoalStateChanges & (UINT64CONST(1) << slot))
+					{
+						ConditionVariableBroadcast(
+							&(GoalStateWaitControl->slots[slot]));
+					}
+				}
+			}
+			PendingGoalStateChanges = 0;
+			break;
+		}
+
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+		{
+			PendingGoalStateChanges = 0;
+			break;
+		}
+
+		default:
+		{
+			break;
+		}
+	}
+}
+
+
+/*
+ * wait_for_goal_state_change waits until the goal state of the given node is
+ * different from the given one, and returns the new goal state, or NULL when
+ * the timeout expires first.
+ *
+ * The wait happens in the transaction of the caller, which should not hold
+ * any lock that the transactions changing the goal state need: that's why
+ * node_active_wait() commits the node_active() call before waiting.
+ *
+ * While waiting, the node does not report to the monitor, so the timeout is
+ * capped to half of pgautofailover.node_considered_unhealthy_timeout.
+ */
+Datum
+wait_for_goal_state_change(PG_FUNCTION_ARGS)
+{
+	checkPgAutoFailoverVersion();
+
+	int64 nodeId = PG_GETARG_INT64(0);
+	Oid goalStateOid = PG_GETARG_OID(1);
+	int32 timeoutMs = PG_GETARG_INT32(2);
+
+	ReplicationState knownGoalState = EnumGetReplicationState(goalStateOid);
+
+	if (timeoutMs < 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("timeout_ms must be positive, got %d", timeoutMs)));
+	}
+
+	if (timeoutMs > UnhealthyTimeoutMs / 2)
+	{
+		ereport(DEBUG1,
+				(errmsg("wait_for_goal_state_change: "
+						"using a timeout of %dms rather than %dms",
+						UnhealthyTimeoutMs / 2, timeoutMs)));
+
+		timeoutMs = UnhealthyTimeoutMs / 2;
+	}
+
+	ConditionVariable *cv =
+		&(GoalStateWaitControl->slots[nodeId % GOAL_STATE_WAIT_SLOTS]);
+
+	TimestampTz startTime = GetCurrentTimestamp();
+
+	for (;;)
+	{
+		/*
+		 * Get on the wait list before checking the goal state, so that we
+		 * can't miss a broadcast that happens in between.
+		 */
+		ConditionVariablePrepareToSleep(cv);
+
+		AutoFailoverNode *node = GetAutoFailoverNodeById(nodeId);
+
+		if (node == NULL)
+		{
+			ConditionVariableCancelSleep();
+
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("couldn't find node with nodeid %lld",
+							(long long) nodeId)));
+		}
+
+		if (node->goalState != knownGoalState)
+		{
+			ConditionVariableCancelSleep();
+
+			PG_RETURN_OID(ReplicationStateGetEnum(node->goalState));
+		}
+
+		long elapsedSecs = 0;
+		int elapsedMicrosecs = 0;
+
+		TimestampDifference(startTime, GetCurrentTimestamp(),
+							&elapsedSecs, &elapsedMicrosecs);
+
+		long elapsedMs = elapsedSecs * 1000 + elapsedMicrosecs / 1000;
+
+		if (elapsedMs >= timeoutMs)
+		{
+			break;
+		}
+
+#if (PG_VERSION_NUM >= 120000)
+		(void) WaitLatch(MyLatch,
+						 WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+						 timeoutMs - elapsedMs,
+						 PG_WAIT_EXTENSION);
+#else
+		int waitResult = WaitLatch(MyLatch,
+								   WL_LATCH_SET | WL_TIMEOUT |
+								   WL_POSTMASTER_DEATH,
+								   timeoutMs - elapsedMs,
+								   PG_WAIT_EXTENSION);
+
+		if (waitResult & WL_POSTMASTER_DEATH)
+		{
+			proc_exit(1);
+		}
+#endif
+
+		ResetLatch(MyLatch);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	ConditionVariableCancelSleep();
+
+	PG_RETURN_NULL();
+}
@@ -0,0 +1,21 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/goal_state_wait.h
+ *
+ * Declarations for public functions related to the wait for a change of the
+ * goal state of a node.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "postgres.h"
+
+
+extern size_t GoalStateWaitShmemSize(void);
+extern void InitializeGoalStateWait(void);
+extern void GoalStateChanged(int64 nodeId);
@@ -16,12 +16,19 @@
 #include "funcapi.h"
 #include "miscadmin.h"
 
+#include "failover_metadata.h"
 #include "formation_metadata.h"
 #include "group_state_machine.h"
+#include "health_check.h"
+#include "metadata.h"
+#include "node_latency.h"
+#include "node_load.h"
 #include "node_metadata.h"
 #include "notifications.h"
 #include "replication_state.h"
+#include "sync_standby_lag.h"
 #include "version_compat.h"
+#include "wal_rate.h"
 
 #include "access/htup_details.h"
 #include "catalog/pg_enum.h"
@@ -30,39 +37,67 @@
 #include "nodes/parsenodes.h"
 #include "parser/parse_type.h"
 #include "utils/builtins.h"
+#include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/syscache.h"
 #include "utils/timestamp.h"
 
 
 /*
- * To communicate with the BuildCandidateList function, it's easier to handle a
- * structure with those bits of information to share:
+ * GroupSnapshot is what the group state machine knows about the group of the
+ * active node: it's loaded once per call to ProceedGroupState and then shared
+ * by the decision functions, which used to each scan pgautofailover.node
+ * again.
+ *
+ * The activeNode takes the place of its own entry in nodesList, and
+ * AssignGoalState updates the goal state of the nodes in memory, so that the
+ * snapshot stays accurate for the rest of the call.
  */
-typedef struct CandidateList
+typedef struct GroupSnapshot
 {
-	int numberSyncStandbys;
-	List *candidateNodesGroupList;
-	List *mostAdvancedNodesGroupList;
-	XLogRecPtr mostAdvancedReportedLSN;
-	int candidateCount;
-	int quorumCandidateCount;
-	int missingNodesCount;
-} CandidateList;
+	AutoFailoverFormation *formation;
+	List *nodesList;
+	int nodesCount;
+	AutoFailoverNode *primaryNode;
+} GroupSnapshot;
 
 
 /* private function forward declarations */
-static bool ProceedGroupStateForPrimaryNode(AutoFailoverNode *primaryNode);
+static bool ProceedGroupStateInternal(AutoFailoverNode *activeNode);
+static void LoadGroupSnapshot(GroupSnapshot *snapshot,
+							  AutoFailoverNode *activeNode);
+static bool ProceedGroupStateForPrimaryNode(AutoFailoverNode *primaryNode,
+											GroupSnapshot *snapshot);
 static bool ProceedGroupStateForMSFailover(AutoFailoverNode *activeNode,
-										   AutoFailoverNode *primaryNode);
+										   AutoFailoverNode *primaryNode,
+										   GroupSnapshot *snapshot);
 static bool ProceedWithMSFailover(AutoFailoverNode *activeNode,
 								  AutoFailoverNode *candidateNode);
 
+static bool ProceedWithPreElectedCandidate(AutoFailoverNode *primaryNode,
+										   List *nodesGroupList,
+										   int numberSyncStandbys);
+
 static bool BuildCandidateList(List *standbyNodesGroupList,
 							   CandidateList *candidateList);
 
 static AutoFailoverNode * SelectFailoverCandidateNode(CandidateList *candidateList,
 													  AutoFailoverNode *primaryNode);
+static int CompareCandidateLatency(CandidateList *candidateList,
+								   AutoFailoverNode *node,
+								   AutoFailoverNode *otherNode,
+								   AutoFailoverNode *primaryNode);
+static List * LatencyPeerNodes(List *groupNodesList,
+							   AutoFailoverNode *node,
+							   AutoFailoverNode *primaryNode);
+static int CompareCandidateLoad(AutoFailoverNode *node,
+								AutoFailoverNode *otherNode,
+								TimestampTz now);
+static void SelectedByLoadMessage(CandidateList *candidateList,
+								  AutoFailoverNode *selectedNode,
+								  FailoverDecisionSettings *settings);
+static void DecisionMessage(FailoverDecisionSettings *settings,
+							const char *fmt, ...);
 
 static bool PromoteSelectedNode(AutoFailoverNode *selectedNode,
 								AutoFailoverNode *primaryNode,
@@ -73,33 +108,72 @@ static void AssignGoalState(AutoFailoverNode *pgAutoFailoverNode,
 static bool WalDifferenceWithin(AutoFailoverNode *secondaryNode,
 								AutoFailoverNode *primaryNode,
 								int64 delta);
+static int64 WalThresholdBytes(AutoFailoverNode *primaryNode,
+							   int thresholdBytes,
+							   int thresholdTimeMs);
+static bool CanStartStandbyClone(AutoFailoverNode *activeNode,
+								 List *nodesGroupList);
 
 /* GUC variables */
 int EnableSyncXlogThreshold = DEFAULT_XLOG_SEG_SIZE;
 int PromoteXlogThreshold = DEFAULT_XLOG_SEG_SIZE;
+int EnableSyncXlogThresholdTimeMs = 0;
+int PromoteXlogThresholdTimeMs = 0;
+int FailoverCandidateMaxReportAgeMs = 0;
+int MaxConcurrentClones = 0;
+int DegradedPrimaryThresholdMs = 0;
+int DegradedPrimarySamples = 3;
+int CrashRecoveryMaxEta = 0;
+int RewindCloneThreshold = 0;
 
 
 /*
  * ProceedGroupState proceeds the state machines of the group of which
  * the given node is part.
+ *
+ * The group state machine looks up the nodes of the group several times, and
+ * each lookup allocates the nodes and their names. We run it in its own
+ * memory context, so that all of that is released in one go when we're done.
+ * The only changes that outlive the memory context are made to activeNode,
+ * which the caller allocated.
  */
 bool
 ProceedGroupState(AutoFailoverNode *activeNode)
+{
+	MemoryContext groupStateContext =
+		AllocSetContextCreate(CurrentMemoryContext,
+							  "ProceedGroupState",
+							  ALLOCSET_DEFAULT_SIZES);
+	MemoryContext oldContext = MemoryContextSwitchTo(groupStateContext);
+
+	bool result = ProceedGroupStateInternal(activeNode);
+
+	MemoryContextSwitchTo(oldContext);
+	MemoryContextDelete(groupStateContext);
+
+	return result;
+}
+
+
+/*
+ * ProceedGroupStateInternal implements ProceedGroupState.
+ *
+ * The formation and the nodes of the group are loaded once in a GroupSnapshot
+ * that every decision made here then uses.
+ */
+static bool
+ProceedGroupStateInternal(AutoFailoverNode *activeNode)
 {
 	char *formationId = activeNode->formationId;
 	int groupId = activeNode->groupId;
 
-	AutoFailoverFormation *formation = GetFormation(formationId);
+	GroupSnapshot snapshot = { 0 };
 
-	List *nodesGroupList = AutoFailoverNodeGroup(formationId, groupId);
-	int nodesCount = list_length(nodesGroupList);
+	LoadGroupSnapshot(&snapshot, activeNode);
 
-	if (formation == NULL)
-	{
-		ereport(ERROR,
-				(errmsg("Formation for %s could not be found",
-						activeNode->formationId)));
-	}
+	AutoFailoverFormation *formation = snapshot.formation;
+	List *nodesGroupList = snapshot.nodesList;
+	int nodesCount = snapshot.nodesCount;
 
 	/*
 	 * If the active node just reached the DROPPED state, proceed to remove it
@@ -191,11 +265,10 @@ ProceedGroupState(AutoFailoverNode *activeNode)
 	 */
 	if (IsInPrimaryState(activeNode))
 	{
-		return ProceedGroupStateForPrimaryNode(activeNode);
+		return ProceedGroupStateForPrimaryNode(activeNode, &snapshot);
 	}
 
-	AutoFailoverNode *primaryNode =
-		GetPrimaryOrDemotedNodeInGroup(formationId, groupId);
+	AutoFailoverNode *primaryNode = snapshot.primaryNode;
 
 	/*
 	 * We want to have a primaryNode around for most operations, but also need
@@ -226,6 +299,20 @@ ProceedGroupState(AutoFailoverNode *activeNode)
 						   ReplicationStateGetName(activeNode->goalState))));
 	}
 
+	/*
+	 * When many groups of the formation fail at the same time, their
+	 * failovers start in order of priority, and the ones that have to wait
+	 * are proceeded again at the next call.
+	 */
+	if (primaryNode != NULL &&
+		IsInPrimaryState(primaryNode) &&
+		IsUnhealthy(primaryNode) &&
+		!IsFailoverInProgress(nodesGroupList) &&
+		!FailoverMayStart(primaryNode))
+	{
+		return false;
+	}
+
 	/* Multiple Standby failover is handled in its own function. */
 	if (nodesCount > 2 && IsUnhealthy(primaryNode))
 	{
@@ -242,8 +329,9 @@ ProceedGroupState(AutoFailoverNode *activeNode)
 		 * least one candidates for failover.
 		 */
 		List *candidateNodesList =
-			AutoFailoverOtherNodesListInState(primaryNode,
-											  REPLICATION_STATE_SECONDARY);
+			GroupOtherNodesListInState(nodesGroupList,
+									   primaryNode,
+									   REPLICATION_STATE_SECONDARY);
 
 		int candidatesCount = CountHealthyCandidates(candidateNodesList);
 
@@ -293,7 +381,7 @@ ProceedGroupState(AutoFailoverNode *activeNode)
 		 * stop here. When it return false, it did nothing, and so we want to
 		 * apply the common orchestration code for a failover.
 		 */
-		if (ProceedGroupStateForMSFailover(activeNode, primaryNode))
+		if (ProceedGroupStateForMSFailover(activeNode, primaryNode, &snapshot))
 		{
 			return true;
 		}
@@ -378,16 +466,21 @@ ProceedGroupState(AutoFailoverNode *activeNode)
 	if (IsCurrentState(activeNode, REPLICATION_STATE_REPORT_LSN) ||
 		IsCurrentState(activeNode, REPLICATION_STATE_FAST_FORWARD))
 	{
-		return ProceedGroupStateForMSFailover(activeNode, primaryNode);
+		return ProceedGroupStateForMSFailover(activeNode, primaryNode,
+											  &snapshot);
 	}
 
 	/*
 	 * when primary node is ready for replication:
 	 *  wait_standby -> catchingup
+	 *
+	 * In each of these cases, the node only starts its clone when the number
+	 * of concurrent clones in the group allows it, see CanStartStandbyClone.
 	 */
 	if (IsCurrentState(activeNode, REPLICATION_STATE_WAIT_STANDBY) &&
 		(IsCurrentState(primaryNode, REPLICATION_STATE_WAIT_PRIMARY) ||
-		 IsCurrentState(primaryNode, REPLICATION_STATE_JOIN_PRIMARY)))
+		 IsCurrentState(primaryNode, REPLICATION_STATE_JOIN_PRIMARY)) &&
+		CanStartStandbyClone(activeNode, nodesGroupList))
 	{
 		char message[BUFSIZE];
 
@@ -413,7 +506,8 @@ ProceedGroupState(AutoFailoverNode *activeNode)
 	 */
 	if (IsCurrentState(activeNode, REPLICATION_STATE_WAIT_STANDBY) &&
 		IsCurrentState(primaryNode, REPLICATION_STATE_PRIMARY) &&
-		activeNode->replicationQuorum)
+		activeNode->replicationQuorum &&
+		CanStartStandbyClone(activeNode, nodesGroupList))
 	{
 		char message[BUFSIZE];
 
@@ -441,7 +535,8 @@ ProceedGroupState(AutoFailoverNode *activeNode)
 	 */
 	if (IsCurrentState(activeNode, REPLICATION_STATE_WAIT_STANDBY) &&
 		IsCurrentState(primaryNode, REPLICATION_STATE_PRIMARY) &&
-		!activeNode->replicationQuorum)
+		!activeNode->replicationQuorum &&
+		CanStartStandbyClone(activeNode, nodesGroupList))
 	{
 		char message[BUFSIZE];
 
@@ -475,7 +570,11 @@ ProceedGroupState(AutoFailoverNode *activeNode)
 		 IsCurrentState(primaryNode, REPLICATION_STATE_PRIMARY)) &&
 		IsHealthy(activeNode) &&
 		activeNode->reportedTLI == primaryNode->reportedTLI &&
-		WalDifferenceWithin(activeNode, primaryNode, EnableSyncXlogThreshold))
+		WalDifferenceWithin(activeNode, primaryNode,
+							WalThresholdBytes(primaryNode,
+											  EnableSyncXlogThreshold,
+											  EnableSyncXlogThresholdTimeMs)) &&
+		!CatchUpTimeExceeds(activeNode, primaryNode, true, MaxCatchUpTimeMs))
 	{
 		char message[BUFSIZE] = { 0 };
 
@@ -500,7 +599,10 @@ ProceedGroupState(AutoFailoverNode *activeNode)
 		IsInPrimaryState(primaryNode) &&
 		IsUnhealthy(primaryNode) && IsHealthy(activeNode) &&
 		activeNode->candidatePriority > 0 &&
-		WalDifferenceWithin(activeNode, primaryNode, PromoteXlogThreshold))
+		WalDifferenceWithin(activeNode, primaryNode,
+							WalThresholdBytes(primaryNode,
+											  PromoteXlogThreshold,
+											  PromoteXlogThresholdTimeMs)))
 	{
 		char message[BUFSIZE];
 
@@ -898,7 +1000,7 @@ ProceedGroupState(AutoFailoverNode *activeNode)
 		AssignGoalState(activeNode, REPLICATION_STATE_SECONDARY, message);
 
 		/* compute next step for the primary depending on node settings */
-		return ProceedGroupStateForPrimaryNode(primaryNode);
+		return ProceedGroupStateForPrimaryNode(primaryNode, &snapshot);
 	}
 
 	/*
@@ -931,13 +1033,265 @@ ProceedGroupState(AutoFailoverNode *activeNode)
 }
 
 
+/*
+ * LoadGroupSnapshot loads the formation and the nodes of the group of the
+ * given activeNode, and finds the primary node of the group.
+ */
+static void
+LoadGroupSnapshot(GroupSnapshot *snapshot, AutoFailoverNode *activeNode)
+{
+	ListCell *nodeCell = NULL;
+
+	snapshot->formation = GetFormation(activeNode->formationId);
+
+	if (snapshot->formation == NULL)
+	{
+		ereport(ERROR,
+				(errmsg("Formation for %s could not be found",
+						activeNode->formationId)));
+	}
+
+	snapshot->nodesList =
+		AutoFailoverNodeGroup(activeNode->formationId, activeNode->groupId);
+
+	/* goal states assigned to the activeNode must be seen in the list */
+	foreach(nodeCell, snapshot->nodesList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+		if (node->nodeId == activeNode->nodeId)
+		{
+			lfirst(nodeCell) = activeNode;
+		}
+	}
+
+	snapshot->nodesCount = list_length(snapshot->nodesList);
+	snapshot->primaryNode = FindPrimaryOrDemotedNode(snapshot->nodesList);
+}
+
+
+/*
+ * ProceedPendingGroupState proceeds the state machines of the nodes of the
+ * given group, unless the group is settled. That's how the health check
+ * workers take the timeout driven decisions without waiting for a keeper of
+ * the group to call node_active.
+ *
+ * We only proceed as the nodes that are still reporting, as if they had just
+ * called node_active. The transitions of a node wait for its own report of
+ * its current state, and they must not fire for a node that has stopped
+ * reporting: the deadlines of a group, such as a failed primary or the end of
+ * a demote_timeout, are acted upon by the other nodes of the group.
+ *
+ * Returns false when the group is settled, and true otherwise.
+ */
+bool
+ProceedPendingGroupState(char *formationId, int groupId)
+{
+	ListCell *nodeCell = NULL;
+
+	/* most groups are settled, don't get in the way of their keepers */
+	List *nodesGroupList = AutoFailoverNodeGroup(formationId, groupId);
+
+	if (nodesGroupList == NIL || IsGroupSettled(nodesGroupList))
+	{
+		ScheduleGroupStateDeadline(formationId, groupId);
+		return false;
+	}
+
+	LockFormation(formationId, ShareLock);
+	LockNodeGroup(formationId, groupId, ExclusiveLock);
+
+	nodesGroupList = AutoFailoverNodeGroup(formationId, groupId);
+
+	if (nodesGroupList == NIL || IsGroupSettled(nodesGroupList))
+	{
+		ScheduleGroupStateDeadline(formationId, groupId);
+		return false;
+	}
+
+	foreach(nodeCell, nodesGroupList)
+	{
+		AutoFailoverNode *groupNode = (AutoFailoverNode *) lfirst(nodeCell);
+
+		/* each call may have changed the group, so read the node again */
+		AutoFailoverNode *node = GetAutoFailoverNodeById(groupNode->nodeId);
+
+		if (node != NULL && IsReporting(node))
+		{
+			ProceedGroupState(node);
+		}
+	}
+
+	ScheduleGroupStateDeadline(formationId, groupId);
+
+	return true;
+}
+
+
+/*
+ * ScheduleGroupStateDeadline registers in shared memory when the next timeout
+ * driven decision of the given group is due, so that a health check worker
+ * runs its state machine then, even when no keeper of the group calls
+ * node_active anymore.
+ */
+void
+ScheduleGroupStateDeadline(char *formationId, int groupId)
+{
+	if (!ProceedPendingGroups)
+	{
+		return;
+	}
+
+	List *groupNodeList = AutoFailoverNodeGroup(formationId, groupId);
+
+	ScheduleGroupDeadline(formationId, groupId,
+						  GroupNextDeadline(groupNodeList,
+											GetCurrentTimestamp()));
+}
+
+
+/*
+ * GroupNextDeadline returns the first time after now when a timeout that the
+ * state machine uses expires for a node of the given group, or zero when
+ * there is none: a node stops being considered reporting after
+ * node_considered_unhealthy_timeout, a demote_timeout ends after
+ * primary_demote_timeout or when the primary lease expires, and unhealthy
+ * nodes are only failed over after the startup_grace_period of the monitor.
+ */
+TimestampTz
+GroupNextDeadline(List *groupNodeList, TimestampTz now)
+{
+	TimestampTz nextDeadline = 0;
+	ListCell *nodeCell = NULL;
+
+	if (groupNodeList == NIL)
+	{
+		return 0;
+	}
+
+	/* the nodes of a group all belong to the same formation */
+	AutoFailoverNode *firstNode = (AutoFailoverNode *) linitial(groupNodeList);
+	int unhealthyTimeoutMs = FormationUnhealthyTimeoutMs(firstNode->formationId);
+	int demoteTimeoutMs = FormationDemoteTimeoutMs(firstNode->formationId);
+
+	TimestampTz startupDeadline =
+		TimestampTzPlusMilliseconds(PgStartTime, StartupGracePeriodMs);
+
+	if (startupDeadline > now)
+	{
+		nextDeadline = startupDeadline;
+	}
+
+	foreach(nodeCell, groupNodeList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+		TimestampTz reportDeadline =
+			TimestampTzPlusMilliseconds(node->reportTime, unhealthyTimeoutMs);
+
+		if (reportDeadline > now &&
+			(nextDeadline == 0 || reportDeadline < nextDeadline))
+		{
+			nextDeadline = reportDeadline;
+		}
+
+		if (node->goalState == REPLICATION_STATE_DEMOTE_TIMEOUT)
+		{
+			TimestampTz drainDeadline =
+				TimestampTzPlusMilliseconds(node->stateChangeTime,
+											demoteTimeoutMs);
+
+			if (drainDeadline > now &&
+				(nextDeadline == 0 || drainDeadline < nextDeadline))
+			{
+				nextDeadline = drainDeadline;
+			}
+
+			TimestampTz leaseDeadline = PrimaryLeaseExpiryTime(node);
+
+			if (leaseDeadline > now &&
+				(nextDeadline == 0 || leaseDeadline < nextDeadline))
+			{
+				nextDeadline = leaseDeadline;
+			}
+		}
+	}
+
+	return nextDeadline;
+}
+
+
+/*
+ * IsGroupSettled returns true when the state machine has nothing to decide
+ * for the given group: every node reached its goal state, is healthy and
+ * reporting, and the group is either a single node or a primary with its
+ * secondary nodes.
+ *
+ * Timeout driven decisions always involve a node that is not healthy or not
+ * reporting anymore, so they are still taken by the state machine.
+ */
+bool
+IsGroupSettled(List *groupNodeList)
+{
+	int nodesCount = list_length(groupNodeList);
+	int singleCount = 0;
+	int primaryCount = 0;
+	ListCell *nodeCell = NULL;
+
+	foreach(nodeCell, groupNodeList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+		if (node->goalState != node->reportedState ||
+			!IsHealthy(node) ||
+			!IsReporting(node))
+		{
+			return false;
+		}
+
+		switch (node->goalState)
+		{
+			case REPLICATION_STATE_SINGLE:
+			{
+				++singleCount;
+				break;
+			}
+
+			case REPLICATION_STATE_PRIMARY:
+			{
+				++primaryCount;
+				break;
+			}
+
+			case REPLICATION_STATE_SECONDARY:
+			{
+				break;
+			}
+
+			default:
+			{
+				return false;
+			}
+		}
+	}
+
+	if (nodesCount == 1)
+	{
+		return singleCount == 1;
+	}
+
+	return singleCount == 0 && primaryCount == 1;
+}
+
 /*
  * Group State Machine when a primary node contacts the monitor.
  */
 static bool
-ProceedGroupStateForPrimaryNode(AutoFailoverNode *primaryNode)
+ProceedGroupStateForPrimaryNode(AutoFailoverNode *primaryNode,
+								GroupSnapshot *snapshot)
 {
-	List *otherNodesGroupList = AutoFailoverOtherNodesList(primaryNode);
+	List *otherNodesGroupList =
+		GroupOtherNodesList(snapshot->nodesList, primaryNode);
 	int otherNodesCount = list_length(otherNodesGroupList);
 
 	/*
@@ -1011,8 +1365,7 @@ ProceedGroupStateForPrimaryNode(AutoFailoverNode *primaryNode)
 		int secondaryNodesCount = otherNodesCount;
 		int secondaryQuorumNodesCount = otherNodesCount;
 
-		AutoFailoverFormation *formation =
-			GetFormation(primaryNode->formationId);
+		AutoFailoverFormation *formation = snapshot->formation;
 		ListCell *nodeCell = NULL;
 
 		foreach(nodeCell, otherNodesGroupList)
@@ -1178,6 +1531,29 @@ ProceedGroupStateForPrimaryNode(AutoFailoverNode *primaryNode)
 			return true;
 		}
 
+		/*
+		 * when the number of synchronous standby nodes to wait for changed
+		 * because some of them started or stopped lagging behind:
+		 *     primary ➜ apply_settings
+		 */
+		if (IsCurrentState(primaryNode, REPLICATION_STATE_PRIMARY) &&
+			UpdateLaggingSyncStandbys(primaryNode, otherNodesGroupList))
+		{
+			char message[BUFSIZE] = { 0 };
+
+			LogAndNotifyMessage(
+				message, BUFSIZE,
+				"Setting goal state of " NODE_FORMAT
+				" to apply_settings after the number of synchronous "
+				"standby nodes to wait for changed.",
+				NODE_FORMAT_ARGS(primaryNode));
+
+			AssignGoalState(primaryNode,
+							REPLICATION_STATE_APPLY_SETTINGS, message);
+
+			return true;
+		}
+
 		/*
 		 * when a node has changed its replication settings:
 		 *     apply_settings ➜ wait_primary
@@ -1256,10 +1632,10 @@ ProceedGroupStateForPrimaryNode(AutoFailoverNode *primaryNode)
  */
 static bool
 ProceedGroupStateForMSFailover(AutoFailoverNode *activeNode,
-							   AutoFailoverNode *primaryNode)
+							   AutoFailoverNode *primaryNode,
+							   GroupSnapshot *snapshot)
 {
-	List *nodesGroupList =
-		AutoFailoverNodeGroup(activeNode->formationId, activeNode->groupId);
+	List *nodesGroupList = snapshot->nodesList;
 	CandidateList candidateList = { 0 };
 
 	/*
@@ -1338,8 +1714,18 @@ ProceedGroupStateForMSFailover(AutoFailoverNode *activeNode,
 	 * different candidateNodesGroupList in which every node has reported their
 	 * LSN position, allowing progress to be made.
 	 */
-	char *formationId = activeNode->formationId;
-	AutoFailoverFormation *formation = GetFormation(formationId);
+	AutoFailoverFormation *formation = snapshot->formation;
+
+	/*
+	 * When all the standby nodes have recently reported their LSN, after the
+	 * primary failed, we might be able to skip the REPORT_LSN round.
+	 */
+	if (ProceedWithPreElectedCandidate(primaryNode,
+									   nodesGroupList,
+									   formation->number_sync_standbys))
+	{
+		return true;
+	}
 
 	candidateList.numberSyncStandbys = formation->number_sync_standbys;
 
@@ -1491,6 +1877,154 @@ ProceedGroupStateForMSFailover(AutoFailoverNode *activeNode,
 }
 
 
+/*
+ * ProceedWithPreElectedCandidate implements a fast path for failover, where
+ * we promote a candidate without having the standby nodes go through the
+ * REPORT_LSN state first.
+ *
+ * The keepers report their LSN to the monitor at every node_active() call,
+ * so when the primary failed we might already know the LSN of every standby
+ * node, and then we know about the next candidate already. That's only true
+ * when every standby node is a healthy secondary that has reported its LSN
+ * after the failed health check of the primary, and no longer ago than
+ * pgautofailover.failover_candidate_max_report_age milliseconds.
+ *
+ * We only use the fast path when the selected candidate has the most advanced
+ * LSN, because fetching missing WAL requires the REPORT_LSN state anyway. The
+ * other standby nodes are assigned REPORT_LSN, so that they stop following
+ * the failed primary and later join the new one.
+ *
+ * The LSNs we compare were reported while the standby nodes were still
+ * streaming, and a primary that is only cut off from the monitor may keep
+ * committing. Another standby node of the replication quorum could then
+ * acknowledge synchronous commits that the selected candidate did not
+ * receive. The REPORT_LSN round stops the replication before comparing the
+ * LSNs, so we only skip it when no other standby node is in the replication
+ * quorum, which also rules out number_sync_standbys above zero.
+ */
+static bool
+ProceedWithPreElectedCandidate(AutoFailoverNode *primaryNode,
+							   List *nodesGroupList,
+							   int numberSyncStandbys)
+{
+	CandidateList candidateList = { 0 };
+	ListCell *nodeCell = NULL;
+	TimestampTz now = GetCurrentTimestamp();
+
+	if (FailoverCandidateMaxReportAgeMs <= 0 ||
+		primaryNode == NULL ||
+		primaryNode->health != NODE_HEALTH_BAD)
+	{
+		return false;
+	}
+
+	candidateList.numberSyncStandbys = numberSyncStandbys;
+	candidateList.groupNodesList = nodesGroupList;
+
+	foreach(nodeCell, nodesGroupList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+		if (node->nodeId == primaryNode->nodeId)
+		{
+			continue;
+		}
+
+		/*
+		 * Reports made before the primary failed might be missing some WAL
+		 * that the standby received afterwards, and old reports are not
+		 * trusted either: in both cases take the long road.
+		 */
+		if (!IsCurrentState(node, REPLICATION_STATE_SECONDARY) ||
+			!IsHealthy(node) ||
+			node->reportedLSN == InvalidXLogRecPtr ||
+			!TimestampDifferenceExceeds(primaryNode->healthCheckTime,
+										node->walReportTime,
+										0) ||
+			TimestampDifferenceExceeds(node->walReportTime,
+									   now,
+									   FailoverCandidateMaxReportAgeMs))
+		{
+			return false;
+		}
+
+		candidateList.candidateNodesGroupList =
+			lappend(candidateList.candidateNodesGroupList, node);
+
+		/* when number_sync_standbys is zero, quorum isn't discriminant */
+		if (node->replicationQuorum || numberSyncStandbys == 0)
+		{
+			++(candidateList.quorumCandidateCount);
+		}
+	}
+
+	candidateList.candidateCount =
+		list_length(candidateList.candidateNodesGroupList);
+
+	if (candidateList.candidateCount == 0 ||
+		candidateList.quorumCandidateCount < numberSyncStandbys + 1)
+	{
+		return false;
+	}
+
+	List *mostAdvancedNodeList = ListMostAdvancedStandbyNodes(nodesGroupList);
+
+	if (list_length(mostAdvancedNodeList) == 0)
+	{
+		return false;
+	}
+
+	AutoFailoverNode *mostAdvancedNode =
+		(AutoFailoverNode *) linitial(mostAdvancedNodeList);
+
+	candidateList.mostAdvancedNodesGroupList = mostAdvancedNodeList;
+	candidateList.mostAdvancedReportedLSN = mostAdvancedNode->reportedLSN;
+
+	AutoFailoverNode *selectedNode =
+		SelectFailoverCandidateNode(&candidateList, primaryNode);
+
+	if (selectedNode == NULL ||
+		selectedNode->reportedLSN != candidateList.mostAdvancedReportedLSN)
+	{
+		return false;
+	}
+
+	/* only the selected node may have acknowledged synchronous commits */
+	foreach(nodeCell, candidateList.candidateNodesGroupList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+		if (node->nodeId != selectedNode->nodeId && node->replicationQuorum)
+		{
+			return false;
+		}
+	}
+
+	foreach(nodeCell, candidateList.candidateNodesGroupList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+		char message[BUFSIZE] = { 0 };
+
+		if (node->nodeId == selectedNode->nodeId)
+		{
+			continue;
+		}
+
+		LogAndNotifyMessage(
+			message, BUFSIZE,
+			"Setting goal state of " NODE_FORMAT
+			" to report_lsn after " NODE_FORMAT
+			" has been selected from recent LSN reports",
+			NODE_FORMAT_ARGS(node),
+			NODE_FORMAT_ARGS(selectedNode));
+
+		AssignGoalState(node, REPLICATION_STATE_REPORT_LSN, message);
+	}
+
+	return PromoteSelectedNode(selectedNode, primaryNode, &candidateList);
+}
+
+
 /*
  * BuildCandidateList builds the list of current standby candidates that have
  * already reported their LSN, and sets nodes that should be reporting to the
@@ -1515,6 +2049,8 @@ BuildCandidateList(List *nodesGroupList, CandidateList *candidateList)
 	List *secondaryStates = list_make2_int(REPLICATION_STATE_SECONDARY,
 										   REPLICATION_STATE_CATCHINGUP);
 
+	candidateList->groupNodesList = nodesGroupList;
+
 	foreach(nodeCell, nodesGroupList)
 	{
 		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
@@ -1698,6 +2234,158 @@ ProceedWithMSFailover(AutoFailoverNode *activeNode,
 }
 
 
+/*
+ * CompareCandidateLatency compares the network latency of two failover
+ * candidates to the other nodes of the replication quorum, as reported by the
+ * keepers in pgautofailover.node_latency. It returns a negative number when
+ * node is noticeably closer to its peers than otherNode, a positive number
+ * when otherNode is, and zero otherwise, including when some of the latency
+ * measurements are missing.
+ */
+static int
+CompareCandidateLatency(CandidateList *candidateList,
+						AutoFailoverNode *node,
+						AutoFailoverNode *otherNode,
+						AutoFailoverNode *primaryNode)
+{
+	double nodeRtt = 0;
+	double otherNodeRtt = 0;
+
+	List *groupNodesList = candidateList->groupNodesList;
+
+	/* the callers that don't have the group at hand yet, fetch it once */
+	if (groupNodesList == NIL)
+	{
+		groupNodesList = AutoFailoverNodeGroup(node->formationId, node->groupId);
+		candidateList->groupNodesList = groupNodesList;
+	}
+
+	List *nodePeers = LatencyPeerNodes(groupNodesList, node, primaryNode);
+	List *otherNodePeers = LatencyPeerNodes(groupNodesList, otherNode, primaryNode);
+
+	if (nodePeers == NIL ||
+		otherNodePeers == NIL ||
+		!GetNodeLatencyToPeers(node, nodePeers, &nodeRtt) ||
+		!GetNodeLatencyToPeers(otherNode, otherNodePeers, &otherNodeRtt))
+	{
+		return 0;
+	}
+
+	elog(DEBUG1,
+		 "Latency to the replication quorum is %.3fms for node " INT64_FORMAT
+		 " and %.3fms for node " INT64_FORMAT,
+		 nodeRtt, node->nodeId, otherNodeRtt, otherNode->nodeId);
+
+	/* ignore differences that are within the measurement noise */
+	if (nodeRtt < otherNodeRtt * LATENCY_SIGNIFICANT_RATIO)
+	{
+		return -1;
+	}
+	else if (otherNodeRtt < nodeRtt * LATENCY_SIGNIFICANT_RATIO)
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * LatencyPeerNodes returns the list of nodes that a candidate would have to
+ * replicate to when promoted: the other nodes of its group that take part in
+ * the replication quorum, not counting the failed primary node.
+ */
+static List *
+LatencyPeerNodes(List *groupNodesList,
+				 AutoFailoverNode *node,
+				 AutoFailoverNode *primaryNode)
+{
+	List *peerNodeList = NIL;
+	ListCell *nodeCell = NULL;
+
+	foreach(nodeCell, groupNodesList)
+	{
+		AutoFailoverNode *peerNode = (AutoFailoverNode *) lfirst(nodeCell);
+
+		if (peerNode->nodeId == node->nodeId ||
+			(primaryNode != NULL && peerNode->nodeId == primaryNode->nodeId) ||
+			!peerNode->replicationQuorum)
+		{
+			continue;
+		}
+
+		peerNodeList = lappend(peerNodeList, peerNode);
+	}
+
+	return peerNodeList;
+}
+
+
+/*
+ * CompareCandidateLoad compares the load of two failover candidates, as
+ * reported by their keepers in pgautofailover.node_load. It returns a
+ * negative number when node is noticeably less loaded than otherNode, a
+ * positive number when otherNode is, and zero otherwise, including when one
+ * of the load reports is missing or too old.
+ */
+static int
+CompareCandidateLoad(AutoFailoverNode *node, AutoFailoverNode *otherNode,
+					 TimestampTz now)
+{
+	NodeLoad load = { 0 };
+	NodeLoad otherLoad = { 0 };
+
+	if (!GetNodeLoad(node, now, &load) ||
+		!GetNodeLoad(otherNode, now, &otherLoad))
+	{
+		return 0;
+	}
+
+	elog(DEBUG1,
+		 "Load is cpu %.1f%%, iowait %.1f%%, %d active connections, "
+		 "replay lag " INT64_FORMAT " bytes for node " INT64_FORMAT
+		 " and cpu %.1f%%, iowait %.1f%%, %d active connections, "
+		 "replay lag " INT64_FORMAT " bytes for node " INT64_FORMAT,
+		 load.cpu, load.iowait, load.activeConnections, load.replayLag,
+		 node->nodeId,
+		 otherLoad.cpu, otherLoad.iowait, otherLoad.activeConnections,
+		 otherLoad.replayLag, otherNode->nodeId);
+
+	return CompareNodeLoad(&load, &otherLoad);
+}
+
+
+/*
+ * SelectedByLoadMessage explains that the selected candidate won over other
+ * equally advanced candidates because it is less loaded, and keeps the
+ * explanation in the candidate list so that PromoteSelectedNode records it
+ * in the failover event.
+ */
+static void
+SelectedByLoadMessage(CandidateList *candidateList,
+					  AutoFailoverNode *selectedNode,
+					  FailoverDecisionSettings *settings)
+{
+	NodeLoad load = { 0 };
+
+	if (!GetNodeLoad(selectedNode, settings->now, &load))
+	{
+		return;
+	}
+
+	DecisionMessage(
+		settings,
+		"Selecting " NODE_FORMAT
+		" as the least loaded of the most advanced candidates: "
+		"cpu %.1f%%, iowait %.1f%%, %d active connections, "
+		"replay lag " INT64_FORMAT " bytes",
+		NODE_FORMAT_ARGS(selectedNode),
+		load.cpu, load.iowait, load.activeConnections, load.replayLag);
+
+	strlcpy(candidateList->selectionReason, settings->message, BUFSIZE);
+}
+
+
 /*
  * SelectFailoverCandidateNode returns the candidate to failover to when we
  * have one already.
@@ -1719,6 +2407,91 @@ ProceedWithMSFailover(AutoFailoverNode *activeNode,
 static AutoFailoverNode *
 SelectFailoverCandidateNode(CandidateList *candidateList,
 							AutoFailoverNode *primaryNode)
+{
+	FailoverDecisionSettings settings = { 0 };
+
+	/* the candidates all belong to the formation of the group */
+	AutoFailoverNode *mostAdvancedNode =
+		(AutoFailoverNode *) linitial(candidateList->mostAdvancedNodesGroupList);
+
+	InitFailoverDecisionSettings(&settings, mostAdvancedNode->formationId);
+
+	return ChooseFailoverCandidate(candidateList, primaryNode, &settings);
+}
+
+
+/*
+ * InitFailoverDecisionSettings prepares the settings for a failover decision
+ * made now in the given formation, with the current values of the GUCs and
+ * of the formation health policy.
+ */
+void
+InitFailoverDecisionSettings(FailoverDecisionSettings *settings,
+							 const char *formationId)
+{
+	settings->now = GetCurrentTimestamp();
+	settings->startTime = PgStartTime;
+	settings->unhealthyTimeoutMs = FormationUnhealthyTimeoutMs(formationId);
+	settings->promoteXlogThreshold = PromoteXlogThreshold;
+	settings->promoteXlogThresholdTimeMs = PromoteXlogThresholdTimeMs;
+	settings->maxCatchUpTimeMs = MaxCatchUpTimeMs;
+	settings->preferLowLatency = PreferLowLatencyCandidates;
+	settings->preferLeastLoaded = FormationPrefersLeastLoaded(formationId);
+	settings->notify = true;
+	settings->message[0] = '\0';
+}
+
+
+/*
+ * DecisionMessage formats a message about the failover candidate selection
+ * in settings->message, and logs and notifies it unless we are simulating.
+ */
+static void
+DecisionMessage(FailoverDecisionSettings *settings, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+
+	/*
+	 * Explanation of IGNORE-BANNED
+	 * Arguments are always non-null and we
+	 * do not write before the allocated buffer.
+	 */
+	int n = vsnprintf(settings->message, /* IGNORE-BANNED */
+					  sizeof(settings->message),
+					  fmt, args);
+	va_end(args);
+
+	if (n < 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY),
+						errmsg("out of memory")));
+	}
+
+	if (settings->notify)
+	{
+		char message[BUFSIZE] = { 0 };
+
+		LogAndNotifyMessage(message, BUFSIZE, "%s", settings->message);
+	}
+	else
+	{
+		elog(DEBUG1, "%s", settings->message);
+	}
+}
+
+
+/*
+ * ChooseFailoverCandidate implements SelectFailoverCandidateNode given the
+ * clock and settings to use for the decision, and only ever reads from the
+ * catalogs when settings->preferLowLatency or settings->maxCatchUpTimeMs ask
+ * for it.
+ */
+AutoFailoverNode *
+ChooseFailoverCandidate(CandidateList *candidateList,
+						AutoFailoverNode *primaryNode,
+						FailoverDecisionSettings *settings)
 {
 	/*
 	 * Build the list of failover candidate nodes, ordered by priority.
@@ -1734,6 +2507,9 @@ SelectFailoverCandidateNode(CandidateList *candidateList,
 	/* the goal in this function is to find this one */
 	AutoFailoverNode *selectedNode = NULL;
 
+	/* the candidate that won a tie on load, when prefer_least_loaded is set */
+	AutoFailoverNode *leastLoadedNode = NULL;
+
 	ListCell *nodeCell = NULL;
 
 	/*
@@ -1755,23 +2531,27 @@ SelectFailoverCandidateNode(CandidateList *candidateList,
 	 * pgautofailover.enable_sync_wal_log_threshold GUC to a larger value and
 	 * thus explicitely accept data loss.
 	 */
+	int64 promoteThreshold =
+		WalThresholdBytes(primaryNode,
+						  settings->promoteXlogThreshold,
+						  settings->promoteXlogThresholdTimeMs);
+
 	if (primaryNode &&
-		!WalDifferenceWithin(mostAdvancedNode, primaryNode, PromoteXlogThreshold))
+		!WalDifferenceWithin(mostAdvancedNode, primaryNode, promoteThreshold))
 	{
-		char message[BUFSIZE] = { 0 };
-
-		LogAndNotifyMessage(
-			message, BUFSIZE,
+		DecisionMessage(
+			settings,
 			"One of the most advanced standby nodes in the group "
 			"is " NODE_FORMAT
 			"with reported LSN %X/%X, which is more than "
-			"pgautofailover.enable_sync_wal_log_threshold (%d) behind "
+			"pgautofailover.promote_wal_log_threshold (" INT64_FORMAT
+			" bytes) behind "
 			"the primary " NODE_FORMAT
 			", which has reported %X/%X",
 			NODE_FORMAT_ARGS(mostAdvancedNode),
 			(uint32) (mostAdvancedNode->reportedLSN >> 32),
 			(uint32) mostAdvancedNode->reportedLSN,
-			PromoteXlogThreshold,
+			promoteThreshold,
 			NODE_FORMAT_ARGS(primaryNode),
 			(uint32) (primaryNode->reportedLSN >> 32),
 			(uint32) primaryNode->reportedLSN);
@@ -1789,12 +2569,11 @@ SelectFailoverCandidateNode(CandidateList *candidateList,
 		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
 
 		/* all the candidates are now in the REPORT_LSN state */
-		if (IsUnhealthy(node))
+		if (IsUnhealthyAt(node, settings->now, settings->startTime,
+						  settings->unhealthyTimeoutMs))
 		{
-			char message[BUFSIZE];
-
-			LogAndNotifyMessage(
-				message, BUFSIZE,
+			DecisionMessage(
+				settings,
 				"Not selecting failover candidate " NODE_FORMAT
 				"because it is unhealthy",
 				NODE_FORMAT_ARGS(node));
@@ -1810,10 +2589,56 @@ SelectFailoverCandidateNode(CandidateList *candidateList,
 			{
 				selectedNode = node;
 			}
-			else if (cPriority == selectedNode->candidatePriority &&
-					 cLSN > selectedNode->reportedLSN)
+			else if (cPriority == selectedNode->candidatePriority)
 			{
-				selectedNode = node;
+				/*
+				 * When asked to, the lower latency to the rest of the
+				 * replication quorum wins over the more advanced LSN: a
+				 * candidate with missing WAL fetches it before promotion.
+				 */
+				int latency =
+					settings->preferLowLatency
+					? CompareCandidateLatency(candidateList,
+											  node, selectedNode, primaryNode)
+					: 0;
+
+				if (latency < 0)
+				{
+					selectedNode = node;
+				}
+				else if (latency == 0 && cLSN > selectedNode->reportedLSN)
+				{
+					selectedNode = node;
+				}
+				else if (latency == 0 && cLSN == selectedNode->reportedLSN)
+				{
+					/*
+					 * No data loss either way: when the formation asks for
+					 * it, pick the least loaded candidate, so that the new
+					 * primary has room for the write traffic, and otherwise
+					 * pick the shortest replay backlog.
+					 */
+					int load =
+						settings->preferLeastLoaded
+						? CompareCandidateLoad(node, selectedNode,
+											   settings->now)
+						: 0;
+
+					if (load < 0)
+					{
+						selectedNode = node;
+						leastLoadedNode = node;
+					}
+					else if (load > 0)
+					{
+						leastLoadedNode = selectedNode;
+					}
+					else if (node->reportedReplayLSN >
+							 selectedNode->reportedReplayLSN)
+					{
+						selectedNode = node;
+					}
+				}
 			}
 			else if (cPriority < selectedNode->candidatePriority)
 			{
@@ -1840,7 +2665,7 @@ SelectFailoverCandidateNode(CandidateList *candidateList,
 		{
 			AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
 
-			if (IsHealthy(node))
+			if (IsHealthyAt(node, settings->now))
 			{
 				someMostAdvancedStandbysAreHealthy = true;
 				break;
@@ -1849,10 +2674,8 @@ SelectFailoverCandidateNode(CandidateList *candidateList,
 
 		if (!someMostAdvancedStandbysAreHealthy)
 		{
-			char message[BUFSIZE] = { 0 };
-
-			LogAndNotifyMessage(
-				message, BUFSIZE,
+			DecisionMessage(
+				settings,
 				"The selected candidate " NODE_FORMAT
 				" needs to fetch missing "
 				"WAL to reach LSN %X/%X (from current reported LSN %X/%X) "
@@ -1868,6 +2691,57 @@ SelectFailoverCandidateNode(CandidateList *candidateList,
 		}
 	}
 
+	/*
+	 * When the selected candidate is predicted to need more than
+	 * pgautofailover.max_catchup_time to fetch the missing WAL, given the rate
+	 * at which it has been receiving WAL recently, prefer one of the most
+	 * advanced standby nodes with the best candidate priority.
+	 */
+	if (selectedNode &&
+		selectedNode->reportedLSN < candidateList->mostAdvancedReportedLSN &&
+		CatchUpTimeExceeds(selectedNode, mostAdvancedNode, false,
+						   settings->maxCatchUpTimeMs))
+	{
+		AutoFailoverNode *mostAdvancedCandidate = NULL;
+
+		foreach(nodeCell, candidateList->mostAdvancedNodesGroupList)
+		{
+			AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+			if (node->candidatePriority > 0 &&
+				IsHealthyAt(node, settings->now) &&
+				list_member_ptr(candidateList->candidateNodesGroupList, node) &&
+				(mostAdvancedCandidate == NULL ||
+				 node->candidatePriority >
+				 mostAdvancedCandidate->candidatePriority))
+			{
+				mostAdvancedCandidate = node;
+			}
+		}
+
+		if (mostAdvancedCandidate != NULL)
+		{
+			DecisionMessage(
+				settings,
+				"Selecting " NODE_FORMAT
+				" rather than " NODE_FORMAT
+				" which is predicted to need more than %d ms "
+				"to fetch missing WAL to reach LSN %X/%X",
+				NODE_FORMAT_ARGS(mostAdvancedCandidate),
+				NODE_FORMAT_ARGS(selectedNode),
+				settings->maxCatchUpTimeMs,
+				(uint32) (mostAdvancedNode->reportedLSN >> 32),
+				(uint32) mostAdvancedNode->reportedLSN);
+
+			selectedNode = mostAdvancedCandidate;
+		}
+	}
+
+	if (selectedNode != NULL && selectedNode == leastLoadedNode)
+	{
+		SelectedByLoadMessage(candidateList, selectedNode, settings);
+	}
+
 	return selectedNode;
 }
 
@@ -1922,7 +2796,7 @@ PromoteSelectedNode(AutoFailoverNode *selectedNode,
 			selectedNode->candidatePriority,
 			NODE_FORMAT_ARGS(selectedNode));
 
-		NotifyStateChange(selectedNode, message);
+		NotifyStateChange(selectedNode, EVENT_CODE_SETTINGS, message);
 	}
 
 	/*
@@ -1968,7 +2842,7 @@ PromoteSelectedNode(AutoFailoverNode *selectedNode,
 					node->candidatePriority,
 					NODE_FORMAT_ARGS(node));
 
-				NotifyStateChange(node, message);
+				NotifyStateChange(node, EVENT_CODE_SETTINGS, message);
 			}
 		}
 	}
@@ -1983,19 +2857,21 @@ PromoteSelectedNode(AutoFailoverNode *selectedNode,
 				message, BUFSIZE,
 				"Setting goal state of " NODE_FORMAT
 				" to prepare_promotion after " NODE_FORMAT
-				" became unhealthy and %d nodes reported their LSN position.",
+				" became unhealthy and %d nodes reported their LSN position.%s%s",
 				NODE_FORMAT_ARGS(selectedNode),
 				NODE_FORMAT_ARGS(primaryNode),
-				candidateList->candidateCount);
+				candidateList->candidateCount,
+				SELECTION_REASON_ARGS(candidateList));
 		}
 		else
 		{
 			LogAndNotifyMessage(
 				message, BUFSIZE,
 				"Setting goal state of " NODE_FORMAT
-				" to prepare_promotion and %d nodes reported their LSN position.",
+				" to prepare_promotion and %d nodes reported their LSN position.%s%s",
 				NODE_FORMAT_ARGS(selectedNode),
-				candidateList->candidateCount);
+				candidateList->candidateCount,
+				SELECTION_REASON_ARGS(candidateList));
 		}
 
 		AssignGoalState(selectedNode,
@@ -2015,19 +2891,21 @@ PromoteSelectedNode(AutoFailoverNode *selectedNode,
 				message, BUFSIZE,
 				"Setting goal state of " NODE_FORMAT
 				" to fast_forward after " NODE_FORMAT
-				" became unhealthy and %d nodes reported their LSN position.",
+				" became unhealthy and %d nodes reported their LSN position.%s%s",
 				NODE_FORMAT_ARGS(selectedNode),
 				NODE_FORMAT_ARGS(primaryNode),
-				candidateList->candidateCount);
+				candidateList->candidateCount,
+				SELECTION_REASON_ARGS(candidateList));
 		}
 		else
 		{
 			LogAndNotifyMessage(
 				message, BUFSIZE,
 				"Setting goal state of " NODE_FORMAT
-				" to fast_forward after %d nodes reported their LSN position.",
+				" to fast_forward after %d nodes reported their LSN position.%s%s",
 				NODE_FORMAT_ARGS(selectedNode),
-				candidateList->candidateCount);
+				candidateList->candidateCount,
+				SELECTION_REASON_ARGS(candidateList));
 		}
 
 		AssignGoalState(selectedNode,
@@ -2052,6 +2930,42 @@ AssignGoalState(AutoFailoverNode *pgAutoFailoverNode,
 }
 
 
+/*
+ * CanStartStandbyClone returns true when the given node, which reports
+ * WAIT_STANDBY, may be assigned CATCHINGUP and start its pg_basebackup now.
+ *
+ * When a rack is replaced, many standby nodes register at about the same
+ * time, and running all their pg_basebackup at once hurts the primary. When
+ * pgautofailover.max_concurrent_clones is set, the extra nodes are kept in
+ * WAIT_STANDBY, and as they call node_active regularly a node starts its
+ * clone as soon as another one has reached CATCHINGUP.
+ */
+static bool
+CanStartStandbyClone(AutoFailoverNode *activeNode, List *nodesGroupList)
+{
+	if (MaxConcurrentClones <= 0)
+	{
+		return true;
+	}
+
+	int clonesCount = CountStandbyClonesInProgress(nodesGroupList);
+
+	if (clonesCount < MaxConcurrentClones)
+	{
+		return true;
+	}
+
+	elog(DEBUG1,
+		 "Keeping " NODE_FORMAT " in wait_standby: %d standby nodes in "
+		 "group %d are being cloned already",
+		 NODE_FORMAT_ARGS(activeNode),
+		 clonesCount,
+		 activeNode->groupId);
+
+	return false;
+}
+
+
 /*
  * WalDifferenceWithin returns whether the most recently reported relative log
  * position of the given nodes is within the specified bound. Returns false if
@@ -2081,3 +2995,44 @@ WalDifferenceWithin(AutoFailoverNode *secondaryNode,
 
 	return walDifference <= delta;
 }
+
+
+/*
+ * WalThresholdBytes returns the WAL threshold to use with
+ * WalDifferenceWithin(). When the threshold is also given as a duration, we
+ * convert it to bytes with the rate at which the primary node has been
+ * generating WAL, see wal_rate.c, so that the threshold tracks how long the
+ * standby would take to catch up rather than a fixed amount of WAL. We keep
+ * at least one WAL page of slack for the reports that are in flight.
+ *
+ * Without a duration, or until we know the WAL rate of the primary, the
+ * threshold in bytes applies.
+ */
+static int64
+WalThresholdBytes(AutoFailoverNode *primaryNode,
+				  int thresholdBytes,
+				  int thresholdTimeMs)
+{
+	double bytesPerSecond = 0;
+
+	if (thresholdTimeMs <= 0 ||
+		primaryNode == NULL ||
+		!GetWalRate(primaryNode->nodeId, &bytesPerSecond))
+	{
+		return thresholdBytes;
+	}
+
+	double bytes = bytesPerSecond * (double) thresholdTimeMs / 1000.0;
+
+	if (bytes < XLOG_BLCKSZ)
+	{
+		return XLOG_BLCKSZ;
+	}
+
+	if (bytes >= (double) PG_INT64_MAX)
+	{
+		return PG_INT64_MAX;
+	}
+
+	return (int64) bytes;
+}
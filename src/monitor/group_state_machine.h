@@ -15,7 +15,9 @@
 #include "postgres.h"
 
 #include "access/xlogdefs.h"
+#include "datatype/timestamp.h"
 #include "node_metadata.h"
+#include "notifications.h"
 
 /*
  * AutoFailoverNodeState describes the current state of a node in a group.
@@ -27,6 +29,7 @@ typedef struct AutoFailoverNodeState
 	ReplicationState replicationState;
 	int32 reportedTLI;
 	XLogRecPtr reportedLSN;
+	XLogRecPtr reportedReplayLSN;
 	SyncState pgsrSyncState;
 	bool pgIsRunning;
 	int candidatePriority;
@@ -34,12 +37,79 @@ typedef struct AutoFailoverNodeState
 } AutoFailoverNodeState;
 
 
+/*
+ * To communicate with the BuildCandidateList function, it's easier to handle a
+ * structure with those bits of information to share:
+ */
+typedef struct CandidateList
+{
+	int numberSyncStandbys;
+	List *groupNodesList;       /* every node of the group, NIL to fetch them */
+	List *candidateNodesGroupList;
+	List *mostAdvancedNodesGroupList;
+	XLogRecPtr mostAdvancedReportedLSN;
+	int candidateCount;
+	int quorumCandidateCount;
+	int missingNodesCount;
+	char selectionReason[BUFSIZE];  /* why the candidate was preferred */
+} CandidateList;
+
+
+/*
+ * The explanation of the candidate selection, when there's one, follows the
+ * goal state message of the selected node in the failover event.
+ */
+#define SELECTION_REASON_ARGS(candidateList) \
+	((candidateList)->selectionReason[0] == '\0' ? "" : " "), \
+	((candidateList)->selectionReason)
+
+
+/*
+ * FailoverDecisionSettings holds the clock and the settings that the failover
+ * candidate selection depends on. The monitor uses the current time and GUC
+ * values, and the failover simulator replays past events with other values.
+ * When notify is false the decision messages are only kept in message.
+ */
+typedef struct FailoverDecisionSettings
+{
+	TimestampTz now;
+	TimestampTz startTime;
+	int unhealthyTimeoutMs;
+	int promoteXlogThreshold;
+	int promoteXlogThresholdTimeMs;
+	int maxCatchUpTimeMs;
+	bool preferLowLatency;
+	bool preferLeastLoaded;
+	bool notify;
+	char message[BUFSIZE];
+} FailoverDecisionSettings;
+
+
 /* public function declarations */
 extern bool ProceedGroupState(AutoFailoverNode *activeNode);
+extern bool ProceedPendingGroupState(char *formationId, int groupId);
+extern void ScheduleGroupStateDeadline(char *formationId, int groupId);
+extern TimestampTz GroupNextDeadline(List *groupNodeList, TimestampTz now);
+extern bool IsGroupSettled(List *groupNodeList);
+extern void InitFailoverDecisionSettings(FailoverDecisionSettings *settings,
+										 const char *formationId);
+extern AutoFailoverNode * ChooseFailoverCandidate(CandidateList *candidateList,
+												  AutoFailoverNode *primaryNode,
+												  FailoverDecisionSettings *settings);
 
 /* GUCs */
 extern int EnableSyncXlogThreshold;
 extern int PromoteXlogThreshold;
+extern int EnableSyncXlogThresholdTimeMs;
+extern int PromoteXlogThresholdTimeMs;
+extern int FailoverCandidateMaxReportAgeMs;
+extern int DegradedPrimaryThresholdMs;
+extern int DegradedPrimarySamples;
+extern int CrashRecoveryMaxEta;
+extern int RewindCloneThreshold;
+extern int MaxConcurrentClones;
 extern int DrainTimeoutMs;
+extern int PrimaryLeaseDurationMs;
+extern int LeaseClockSkewMs;
 extern int UnhealthyTimeoutMs;
 extern int StartupGracePeriodMs;
@@ -18,6 +18,7 @@
 #include "access/htup.h"
 #include "access/tupdesc.h"
 #include "nodes/pg_list.h"
+#include "utils/timestamp.h"
 
 
 /*
@@ -31,9 +32,21 @@ typedef enum
 	NODE_HEALTH_GOOD = 1
 } NodeHealthState;
 
+/*
+ * HealthCheckProbeLevel is what a health check expects from a node before
+ * finding it healthy: that it answers the startup packet, a trivial query, or
+ * on the primary a transaction commit, which needs a WAL flush.
+ */
+typedef enum
+{
+	HEALTH_CHECK_PROBE_CONNECT = 0,
+	HEALTH_CHECK_PROBE_QUERY = 1,
+	HEALTH_CHECK_PROBE_WRITE = 2
+} HealthCheckProbeLevel;
+
 /*
  * NodeHealth represents a node that is to be health-checked and its last-known
- * health state.
+ * health state, and the health state found by the current round of checks.
  */
 typedef struct NodeHealth
 {
@@ -41,9 +54,24 @@ typedef struct NodeHealth
 	char *nodeName;
 	char *nodeHost;
 	int nodePort;
+	bool isPrimary;
 	NodeHealthState healthState;
+	NodeHealthState checkedHealthState;
+	bool checkTimeShared;       /* checked time is kept in shared memory */
+	TimestampTz reportTime;
+	bool reportedAlive;
+	int tcpUserTimeout;
+	int healthCheckPeriod;      /* of the formation, zero for the GUC */
+	int healthCheckTimeout;     /* of the formation, zero for the GUC */
 } NodeHealth;
 
+/* a group of nodes whose state machine the health check workers proceed */
+typedef struct PendingGroup
+{
+	char *formationId;
+	int groupId;
+} PendingGroup;
+
 
 /* GUCs to configure health checks */
 extern bool HealthChecksEnabled;
@@ -51,20 +79,52 @@ extern int HealthCheckPeriod;
 extern int HealthCheckTimeout;
 extern int HealthCheckMaxRetries;
 extern int HealthCheckRetryDelay;
+extern int HealthCheckWorkers;
+extern bool HealthCheckKeepAlive;
+extern int HealthCheckTcpUserTimeout;
+extern int HealthCheckKeepAlivesIdle;
+extern int HealthCheckKeepAlivesInterval;
+extern int HealthCheckKeepAlivesCount;
+extern int HealthCheckPassivePeriod;
+extern int HealthCheckBackoffThreshold;
+extern int HealthCheckBackoffMaxDelay;
+extern int HealthCheckSpread;
+extern int HealthCheckMaxConnects;
+extern int HealthCheckProbe;
+extern int HealthCheckSlowThreshold;
+extern int HealthCheckDnsTtl;
+extern int HealthFlapSamples;
+extern int HealthFlapMinInterval;
+extern int HealthCheckStatsMaxNodes;
+extern int EventRetention;
+extern int EventArchive;
+extern bool ProceedPendingGroups;
+extern int TableHealthHotUpdateRatio;
+extern int TableHealthDeadTupleRatio;
 
 extern size_t HealthCheckWorkerShmemSize(void);
 
 extern void InitializeHealthCheckWorker(void);
 extern void HealthCheckWorkerMain(Datum arg);
 extern void HealthCheckWorkerLauncherMain(Datum arg);
-extern List * LoadNodeHealthList(void);
+extern List * LoadNodeHealthList(int shard, int shardCount);
 extern NodeHealth * TupleToNodeHealth(HeapTuple heapTuple,
 									  TupleDesc tupleDescriptor);
-extern void SetNodeHealthState(int64 nodeId,
-							   char *nodeName,
-							   char *nodeHost,
-							   uint16 nodePort,
-							   int previousHealthState,
-							   int healthState);
+extern void SetNodeHealthStateList(List *nodeHealthList);
+extern void SetNodeReportList(List *nodeHealthList, int shard, int shardCount);
+extern void MaintainEventPartitions(void);
+extern bool MigrateUpgradeEvents(void);
+extern void CheckTableHealth(void);
+extern void FlushEventQueue(void);
+extern void ProceedPendingGroupStates(int shard, int shardCount);
+extern long ProceedExpiredGroupStates(int shard, int shardCount);
+extern void ScheduleGroupDeadline(char *formationId, int groupId,
+								  TimestampTz deadline);
+extern List * PopExpiredGroupDeadlines(int shard, int shardCount,
+									   TimestampTz now,
+									   TimestampTz *nextDeadline);
 extern void StopHealthCheckWorker(Oid databaseId);
+extern void NotifyNodeListChange(void);
 extern char * NodeHealthToString(NodeHealthState health);
+extern TimestampTz NodeHealthCheckTime(int64 nodeId,
+									   TimestampTz healthCheckTime);
@@ -13,6 +13,8 @@
 #include "postgres.h"
 #include "miscadmin.h"
 
+#include "event_queue.h"
+#include "group_state_machine.h"
 #include "health_check.h"
 #include "metadata.h"
 #include "notifications.h"
@@ -26,8 +28,11 @@
 #include "nodes/pg_list.h"
 #include "pgstat.h"
 #include "utils/builtins.h"
+#include "utils/hsearch.h"
 #include "utils/memutils.h"
+#include "utils/resowner.h"
 #include "utils/snapmgr.h"
+#include "utils/timestamp.h"
 
 
 /* human-readable names for addressing columns of health check queries */
@@ -36,22 +41,70 @@
 #define TLIST_NUM_NODE_HOST 3
 #define TLIST_NUM_NODE_PORT 4
 #define TLIST_NUM_HEALTH_STATUS 5
+#define TLIST_NUM_TCP_USER_TIMEOUT 6
+#define TLIST_NUM_HEALTH_CHECK_PERIOD 7
+#define TLIST_NUM_HEALTH_CHECK_TIMEOUT 8
+#define TLIST_NUM_IS_PRIMARY 9
+
+/* maps a node id to its health description */
+typedef struct NodeHealthEntry
+{
+	int64 nodeId;
+	NodeHealth *nodeHealth;
+} NodeHealthEntry;
+
+/*
+ * CheckTableHealth compares the updates counts of the monitor tables with the
+ * ones it found at its previous run, and only warns about tables that had at
+ * least TABLE_HEALTH_MIN_ROWS updates or dead rows.
+ */
+#define TABLE_HEALTH_MAX_TABLES 128
+#define TABLE_HEALTH_MIN_ROWS 1000
+
+/*
+ * MigrateUpgradeEvents moves that many events in each transaction, one batch
+ * per round of health checks.
+ */
+#define EVENT_MIGRATION_BATCH_SIZE 10000
+
+typedef struct TableUpdateCounts
+{
+	Oid relationId;
+	int64 updates;
+	int64 hotUpdates;
+} TableUpdateCounts;
+
+static TableUpdateCounts PreviousUpdateCounts[TABLE_HEALTH_MAX_TABLES];
+static int PreviousUpdateCountsCount = 0;
 
 
 /* GUCs */
 bool HealthChecksEnabled = true;
+int EventRetention = 0;
+int EventArchive = 0;
+bool ProceedPendingGroups = false;
+int TableHealthHotUpdateRatio = 50;
+int TableHealthDeadTupleRatio = 20;
 
 
+static void ProceedGroupStateList(List *groupList);
+static void ProceedGroupStateInSubTransaction(PendingGroup *group);
+static List * LockChangedHealthGroups(char *checkedValues);
 static bool HaMonitorHasBeenLoaded(void);
+static TableUpdateCounts * FindPreviousUpdateCounts(Oid relationId);
 static void StartSPITransaction(void);
 static void EndSPITransaction(void);
 
 
 /*
  * LoadNodeHealthList loads a list of nodes of which to check the health.
+ *
+ * When using more than one health check worker per database, nodes are split
+ * in shardCount shards using a hash of their nodeid, and only the nodes that
+ * belong to the given shard are returned.
  */
 List *
-LoadNodeHealthList(void)
+LoadNodeHealthList(int shard, int shardCount)
 {
 	List *nodeHealthList = NIL;
 	int spiStatus PG_USED_FOR_ASSERTS_ONLY = 0;
@@ -70,8 +123,23 @@ LoadNodeHealthList(void)
 	{
 		initStringInfo(&query);
 		appendStringInfo(&query,
-						 "SELECT nodeid, nodename, nodehost, nodeport, health "
-						 "FROM " AUTO_FAILOVER_NODE_TABLE);
+						 "SELECT nodeid, nodename, nodehost, nodeport, health, "
+						 "       formation.health_check_tcp_user_timeout, "
+						 "       formation.health_check_period, "
+						 "       formation.health_check_timeout, "
+						 "       reportedstate IN ('single', 'wait_primary', "
+						 "                         'primary', 'join_primary', "
+						 "                         'apply_settings') "
+						 "FROM " AUTO_FAILOVER_NODE_TABLE
+						 " JOIN " AUTO_FAILOVER_FORMATION_TABLE
+						 " USING (formationid)");
+
+		if (shardCount > 1)
+		{
+			appendStringInfo(&query,
+							 " WHERE (pg_catalog.hashint8(nodeid) & %d) %% %d = %d",
+							 INT_MAX, shardCount, shard);
+		}
 
 		pgstat_report_activity(STATE_RUNNING, query.data);
 
@@ -109,6 +177,124 @@ LoadNodeHealthList(void)
 }
 
 
+/*
+ * SetNodeReportList sets the last report time of the given nodes, and their
+ * reportedAlive flag when pgautofailover.health_check_passive_period is set
+ * and their keeper has reported within that period that Postgres is running.
+ * Each keeper calls node_active every second or so, which is as good as a
+ * successful health check, so that we only have to connect to the nodes
+ * whose keeper is quiet.
+ */
+void
+SetNodeReportList(List *nodeHealthList, int shard, int shardCount)
+{
+	ListCell *nodeHealthCell = NULL;
+	StringInfoData query;
+	HASHCTL info;
+
+	MemoryContext upperContext = CurrentMemoryContext;
+
+	foreach(nodeHealthCell, nodeHealthList)
+	{
+		NodeHealth *nodeHealth = (NodeHealth *) lfirst(nodeHealthCell);
+
+		nodeHealth->reportedAlive = false;
+		nodeHealth->reportTime = 0;
+	}
+
+	if ((HealthCheckPassivePeriod <= 0 && HealthCheckBackoffThreshold <= 0) ||
+		nodeHealthList == NIL)
+	{
+		return;
+	}
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(int64);
+	info.entrysize = sizeof(NodeHealthEntry);
+	info.hcxt = upperContext;
+
+	HTAB *nodeHealthHash =
+		hash_create("pg_auto_failover reported nodes",
+					list_length(nodeHealthList), &info,
+					HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	foreach(nodeHealthCell, nodeHealthList)
+	{
+		NodeHealth *nodeHealth = (NodeHealth *) lfirst(nodeHealthCell);
+
+		NodeHealthEntry *entry =
+			(NodeHealthEntry *) hash_search(nodeHealthHash,
+											&(nodeHealth->nodeId),
+											HASH_ENTER, NULL);
+		entry->nodeHealth = nodeHealth;
+	}
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+					 "SELECT node.nodeid, report.reporttime, "
+					 "%s AND node.reportedpgisrunning "
+					 "AND report.reporttime >= now() - interval '%d ms' "
+					 "FROM " AUTO_FAILOVER_NODE_TABLE
+					 " JOIN " AUTO_FAILOVER_NODE_REPORT_TABLE " AS report"
+					 " ON report.nodeid = node.nodeid",
+					 HealthCheckPassivePeriod > 0 ? "true" : "false",
+					 HealthCheckPassivePeriod);
+
+	if (shardCount > 1)
+	{
+		appendStringInfo(&query,
+						 " WHERE (pg_catalog.hashint8(node.nodeid) & %d) %% %d = %d",
+						 INT_MAX, shardCount, shard);
+	}
+
+	StartSPITransaction();
+
+	if (HaMonitorHasBeenLoaded())
+	{
+		pgstat_report_activity(STATE_RUNNING, query.data);
+
+		int spiStatus = SPI_execute(query.data, true, 0);
+
+		if (spiStatus == SPI_OK_SELECT)
+		{
+			for (uint64 rowNumber = 0; rowNumber < SPI_processed; rowNumber++)
+			{
+				HeapTuple heapTuple = SPI_tuptable->vals[rowNumber];
+				TupleDesc tupleDesc = SPI_tuptable->tupdesc;
+				bool isNull = false;
+
+				Datum nodeIdDatum = SPI_getbinval(heapTuple, tupleDesc,
+												  1, &isNull);
+				Datum reportTimeDatum = SPI_getbinval(heapTuple, tupleDesc,
+													  2, &isNull);
+				Datum reportedAliveDatum = SPI_getbinval(heapTuple, tupleDesc,
+														 3, &isNull);
+				int64 nodeId = DatumGetInt64(nodeIdDatum);
+
+				NodeHealthEntry *entry =
+					(NodeHealthEntry *) hash_search(nodeHealthHash, &nodeId,
+													HASH_FIND, NULL);
+
+				if (entry != NULL)
+				{
+					entry->nodeHealth->reportTime =
+						DatumGetTimestampTz(reportTimeDatum);
+					entry->nodeHealth->reportedAlive =
+						DatumGetBool(reportedAliveDatum);
+				}
+			}
+		}
+	}
+
+	EndSPITransaction();
+
+	MemoryContextSwitchTo(upperContext);
+
+	hash_destroy(nodeHealthHash);
+	pfree(query.data);
+}
+
+
 /*
  * HaMonitorHasBeenLoaded returns true if the extension has been created
  * in the current database and the extension script has been executed. Otherwise,
@@ -164,77 +350,164 @@ TupleToNodeHealth(HeapTuple heapTuple, TupleDesc tupleDescriptor)
 										TLIST_NUM_NODE_PORT, &isNull);
 	Datum healthStateDatum = SPI_getbinval(heapTuple, tupleDescriptor,
 										   TLIST_NUM_HEALTH_STATUS, &isNull);
+	Datum tcpUserTimeoutDatum = SPI_getbinval(heapTuple, tupleDescriptor,
+											  TLIST_NUM_TCP_USER_TIMEOUT,
+											  &isNull);
+	Datum periodDatum = SPI_getbinval(heapTuple, tupleDescriptor,
+									  TLIST_NUM_HEALTH_CHECK_PERIOD,
+									  &isNull);
+	Datum timeoutDatum = SPI_getbinval(heapTuple, tupleDescriptor,
+									   TLIST_NUM_HEALTH_CHECK_TIMEOUT,
+									   &isNull);
+	Datum isPrimaryDatum = SPI_getbinval(heapTuple, tupleDescriptor,
+										 TLIST_NUM_IS_PRIMARY, &isNull);
 
 	NodeHealth *nodeHealth = palloc0(sizeof(NodeHealth));
 	nodeHealth->nodeId = DatumGetInt64(nodeIdDatum);
 	nodeHealth->nodeName = TextDatumGetCString(nodeNameDatum);
 	nodeHealth->nodeHost = TextDatumGetCString(nodeHostDatum);
 	nodeHealth->nodePort = DatumGetInt32(nodePortDatum);
+	nodeHealth->isPrimary = !isNull && DatumGetBool(isPrimaryDatum);
 	nodeHealth->healthState = DatumGetInt32(healthStateDatum);
+	nodeHealth->checkedHealthState = NODE_HEALTH_UNKNOWN;
+	nodeHealth->tcpUserTimeout = DatumGetInt32(tcpUserTimeoutDatum);
+	nodeHealth->healthCheckPeriod = DatumGetInt32(periodDatum);
+	nodeHealth->healthCheckTimeout = DatumGetInt32(timeoutDatum);
 
 	return nodeHealth;
 }
 
 
 /*
- * SetNodeHealthState updates the health state of a node in the metadata.
+ * SetNodeHealthStateList updates the health state of all the nodes that have
+ * been checked in the last round, using a single UPDATE statement in a single
+ * transaction. Only the nodes whose health has changed are updated and
+ * returned by the statement, and only those get a notification and an event.
+ * The previous health is read from the table rather than from our own copy,
+ * which the health check worker now keeps for several rounds.
+ *
+ * The time of the checks is kept in shared memory by RecordHealthCheckStats()
+ * and found there by NodeHealthCheckTime(), so healthchecktime is only set in
+ * the node_report table for the nodes whose health changes, and for the nodes
+ * that have no room in the shared memory statistics. A healthy cluster then
+ * does not write to the tables at each round.
+ *
+ * The groups of the nodes whose health changed then run their state machine
+ * in the same transaction, so that the goal states are assigned when the
+ * failure is detected, and the notifications wake up the keepers with their
+ * new goal state, rather than at the next node_active call of a keeper.
  */
 void
-SetNodeHealthState(int64 nodeId,
-				   char *nodeName,
-				   char *nodeHost,
-				   uint16 nodePort,
-				   int previousHealthState,
-				   int healthState)
+SetNodeHealthStateList(List *nodeHealthList)
 {
+	StringInfoData checkedValues;
 	StringInfoData query;
+	ListCell *nodeHealthCell = NULL;
+	int checkedNodeCount = 0;
 	int spiStatus PG_USED_FOR_ASSERTS_ONLY = 0;
 	MemoryContext upperContext = CurrentMemoryContext;
 
+	initStringInfo(&checkedValues);
+	appendStringInfoString(&checkedValues,
+						   "WITH checked(nodeid, nodehost, nodeport, health, "
+						   "shared) AS (VALUES ");
+
+	foreach(nodeHealthCell, nodeHealthList)
+	{
+		NodeHealth *nodeHealth = (NodeHealth *) lfirst(nodeHealthCell);
+
+		if (nodeHealth->checkedHealthState == NODE_HEALTH_UNKNOWN)
+		{
+			continue;
+		}
+
+		appendStringInfo(&checkedValues,
+						 "%s(%lld::bigint, %s, %d, %d, %s)",
+						 checkedNodeCount == 0 ? "" : ", ",
+						 (long long) nodeHealth->nodeId,
+						 quote_literal_cstr(nodeHealth->nodeHost),
+						 nodeHealth->nodePort,
+						 nodeHealth->checkedHealthState,
+						 nodeHealth->checkTimeShared ? "true" : "false");
+
+		++checkedNodeCount;
+	}
+
+	if (checkedNodeCount == 0)
+	{
+		pfree(checkedValues.data);
+		return;
+	}
+
+	appendStringInfoString(&checkedValues, ") ");
+
+	initStringInfo(&query);
+	appendStringInfoString(&query, checkedValues.data);
+	appendStringInfoString(&query,
+						   ", report AS ("
+						   "UPDATE " AUTO_FAILOVER_NODE_REPORT_TABLE " AS report"
+						   "   SET healthchecktime = now() "
+						   "  FROM checked, " AUTO_FAILOVER_NODE_TABLE
+						   " WHERE report.nodeid = checked.nodeid "
+						   "   AND node.nodeid = checked.nodeid "
+						   "   AND node.nodehost = checked.nodehost "
+						   "   AND node.nodeport = checked.nodeport "
+						   "   AND (node.health <> checked.health "
+						   "        OR NOT checked.shared)), "
+						   "updated AS ("
+						   "UPDATE " AUTO_FAILOVER_NODE_TABLE
+						   "   SET health = checked.health "
+						   "  FROM checked "
+						   " WHERE node.nodeid = checked.nodeid "
+						   "   AND node.nodehost = checked.nodehost "
+						   "   AND node.nodeport = checked.nodeport "
+						   "   AND node.health <> checked.health "
+						   " RETURNING node.*) "
+						   "SELECT " AUTO_FAILOVER_NODE_TABLE_ALL_COLUMNS
+						   "  FROM updated AS node" AUTO_FAILOVER_NODE_REPORT_JOIN
+						   " ORDER BY nodeid");
+
 	StartSPITransaction();
 
 	if (HaMonitorHasBeenLoaded())
 	{
-		initStringInfo(&query);
-		appendStringInfo(&query,
-						 "UPDATE " AUTO_FAILOVER_NODE_TABLE
-						 "   SET health = %d, healthchecktime = now() "
-						 " WHERE nodeid = %lld "
-						 "   AND nodehost = %s AND nodeport = %d "
-						 " RETURNING node.*",
-						 healthState,
-						 (long long) nodeId,
-						 quote_literal_cstr(nodeHost),
-						 nodePort);
+		ListCell *groupCell = NULL;
+
+		/* take the group locks before the node locks, as node_active does */
+		List *groupList = LockChangedHealthGroups(checkedValues.data);
 
 		pgstat_report_activity(STATE_RUNNING, query.data);
 
 		spiStatus = SPI_execute(query.data, false, 0);
-		Assert(spiStatus == SPI_OK_UPDATE_RETURNING);
+		Assert(spiStatus == SPI_OK_SELECT);
 
 		/*
-		 * We should have 0 or 1 row impacted, because of pkey on nodeid. We
-		 * might have updated zero rows when a node is concurrently being
-		 * DELETEd, because of the default REPETEABLE READ isolation level.
+		 * Nodes that are concurrently being DELETEd are not returned, because
+		 * of the default REPETEABLE READ isolation level.
 		 */
-		if (SPI_processed == 1)
+		for (uint64 rowNumber = 0; rowNumber < SPI_processed; rowNumber++)
 		{
-			if (healthState != previousHealthState)
-			{
-				HeapTuple heapTuple = SPI_tuptable->vals[0];
-				AutoFailoverNode *pgAutoFailoverNode =
-					TupleToAutoFailoverNode(SPI_tuptable->tupdesc, heapTuple);
+			HeapTuple heapTuple = SPI_tuptable->vals[rowNumber];
+			AutoFailoverNode *pgAutoFailoverNode =
+				TupleToAutoFailoverNode(SPI_tuptable->tupdesc, heapTuple);
 
-				char message[BUFSIZE] = { 0 };
+			char message[BUFSIZE] = { 0 };
 
-				LogAndNotifyMessage(message, sizeof(message),
-									"Node " NODE_FORMAT
-									" is marked as %s by the monitor",
-									NODE_FORMAT_ARGS(pgAutoFailoverNode),
-									healthState == 0 ? "unhealthy" : "healthy");
+			LogAndNotifyMessage(message, sizeof(message),
+								"Node " NODE_FORMAT
+								" is marked as %s by the monitor",
+								NODE_FORMAT_ARGS(pgAutoFailoverNode),
+								pgAutoFailoverNode->health == NODE_HEALTH_BAD
+								? "unhealthy" : "healthy");
 
-				NotifyStateChange(pgAutoFailoverNode, message);
-			}
+			NotifyStateChange(pgAutoFailoverNode, EVENT_CODE_HEALTH, message);
+		}
+
+		foreach(groupCell, groupList)
+		{
+			PendingGroup *group = (PendingGroup *) lfirst(groupCell);
+
+			ProceedGroupStateInSubTransaction(group);
 		}
 	}
 	else
@@ -245,6 +518,545 @@ SetNodeHealthState(int64 nodeId,
 	EndSPITransaction();
 
 	MemoryContextSwitchTo(upperContext);
+
+	pfree(checkedValues.data);
+	pfree(query.data);
+}
+
+
+/*
+ * LockChangedHealthGroups locks the groups of the nodes whose health is about
+ * to change, given the checked CTE of SetNodeHealthStateList, and returns the
+ * list of those groups.
+ */
+static List *
+LockChangedHealthGroups(char *checkedValues)
+{
+	StringInfoData query;
+	List *groupList = NIL;
+	ListCell *groupCell = NULL;
+
+	initStringInfo(&query);
+	appendStringInfoString(&query, checkedValues);
+	appendStringInfoString(&query,
+						   "SELECT DISTINCT node.formationid, node.groupid "
+						   "  FROM checked JOIN " AUTO_FAILOVER_NODE_TABLE
+						   "    ON node.nodeid = checked.nodeid "
+						   "   AND node.nodehost = checked.nodehost "
+						   "   AND node.nodeport = checked.nodeport "
+						   " WHERE node.health <> checked.health "
+						   " ORDER BY formationid, groupid");
+
+	pgstat_report_activity(STATE_RUNNING, query.data);
+
+	if (SPI_execute(query.data, true, 0) == SPI_OK_SELECT)
+	{
+		for (uint64 rowNumber = 0; rowNumber < SPI_processed; rowNumber++)
+		{
+			HeapTuple heapTuple = SPI_tuptable->vals[rowNumber];
+			bool isNull = false;
+
+			Datum formationIdDatum =
+				SPI_getbinval(heapTuple, SPI_tuptable->tupdesc, 1, &isNull);
+			Datum groupIdDatum =
+				SPI_getbinval(heapTuple, SPI_tuptable->tupdesc, 2, &isNull);
+
+			PendingGroup *group = palloc0(sizeof(PendingGroup));
+
+			group->formationId = TextDatumGetCString(formationIdDatum);
+			group->groupId = DatumGetInt32(groupIdDatum);
+
+			groupList = lappend(groupList, group);
+		}
+	}
+
+	foreach(groupCell, groupList)
+	{
+		PendingGroup *group = (PendingGroup *) lfirst(groupCell);
+
+		LockFormation(group->formationId, ShareLock);
+		LockNodeGroup(group->formationId, group->groupId, ExclusiveLock);
+	}
+
+	pfree(query.data);
+
+	return groupList;
+}
+
+
+/*
+ * ProceedPendingGroupStates runs the state machine of the groups that are
+ * not settled, for the formations that belong to the given shard. Timeout
+ * driven decisions, such as failing over an unhealthy primary node or a
+ * demote timeout, are then taken even when no keeper of the group calls
+ * node_active anymore.
+ *
+ * Each group is processed in its own transaction, so that we only hold its
+ * lock for a short while, and an error in one group does not prevent taking
+ * decisions for the other ones.
+ */
+void
+ProceedPendingGroupStates(int shard, int shardCount)
+{
+	StringInfoData query;
+	List *groupList = NIL;
+	MemoryContext upperContext = CurrentMemoryContext;
+
+	if (!ProceedPendingGroups)
+	{
+		return;
+	}
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+					 "SELECT DISTINCT formationid, groupid "
+					 "FROM " AUTO_FAILOVER_NODE_TABLE);
+
+	if (shardCount > 1)
+	{
+		appendStringInfo(&query,
+						 " WHERE (pg_catalog.hashtext(formationid) & %d) %% %d = %d",
+						 INT_MAX, shardCount, shard);
+	}
+
+	StartSPITransaction();
+
+	if (HaMonitorHasBeenLoaded())
+	{
+		pgstat_report_activity(STATE_RUNNING, query.data);
+
+		if (SPI_execute(query.data, true, 0) == SPI_OK_SELECT)
+		{
+			MemoryContext oldContext = MemoryContextSwitchTo(upperContext);
+
+			for (uint64 rowNumber = 0; rowNumber < SPI_processed; rowNumber++)
+			{
+				HeapTuple heapTuple = SPI_tuptable->vals[rowNumber];
+				bool isNull = false;
+
+				Datum formationIdDatum =
+					SPI_getbinval(heapTuple, SPI_tuptable->tupdesc, 1, &isNull);
+				Datum groupIdDatum =
+					SPI_getbinval(heapTuple, SPI_tuptable->tupdesc, 2, &isNull);
+
+				PendingGroup *group = palloc0(sizeof(PendingGroup));
+
+				group->formationId = TextDatumGetCString(formationIdDatum);
+				group->groupId = DatumGetInt32(groupIdDatum);
+
+				groupList = lappend(groupList, group);
+			}
+
+			MemoryContextSwitchTo(oldContext);
+		}
+	}
+
+	EndSPITransaction();
+
+	MemoryContextSwitchTo(upperContext);
+
+	pfree(query.data);
+
+	ProceedGroupStateList(groupList);
+}
+
+
+/*
+ * ProceedExpiredGroupStates runs the state machine of the groups of the given
+ * shard that have a deadline in the past, as scheduled in shared memory by
+ * the backends that ran the state machine of the group before, and returns
+ * how many milliseconds are left until the next deadline of the shard, or -1
+ * when there is none.
+ *
+ * That's how timeout driven decisions are taken when they are due, rather
+ * than at the next health check round.
+ */
+long
+ProceedExpiredGroupStates(int shard, int shardCount)
+{
+	TimestampTz nextDeadline = 0;
+	long secs = 0;
+	int microsecs = 0;
+
+	if (!ProceedPendingGroups)
+	{
+		return -1;
+	}
+
+	TimestampTz now = GetCurrentTimestamp();
+	List *groupList =
+		PopExpiredGroupDeadlines(shard, shardCount, now, &nextDeadline);
+
+	ProceedGroupStateList(groupList);
+
+	if (nextDeadline == 0)
+	{
+		return -1;
+	}
+
+	/* round up, so that we don't wake up just before the deadline */
+	TimestampDifference(now, nextDeadline, &secs, &microsecs);
+
+	return secs * 1000 + (microsecs + 999) / 1000;
+}
+
+
+/*
+ * ProceedGroupStateList proceeds the state machine of each group of the given
+ * list, in its own transaction: we then only hold the group lock for a short
+ * while, and an error in one group does not prevent taking decisions for the
+ * other ones.
+ */
+static void
+ProceedGroupStateList(List *groupList)
+{
+	ListCell *groupCell = NULL;
+	MemoryContext upperContext = CurrentMemoryContext;
+
+	foreach(groupCell, groupList)
+	{
+		PendingGroup *group = (PendingGroup *) lfirst(groupCell);
+
+		StartSPITransaction();
+
+		if (HaMonitorHasBeenLoaded())
+		{
+			ProceedGroupStateInSubTransaction(group);
+		}
+
+		EndSPITransaction();
+
+		MemoryContextSwitchTo(upperContext);
+	}
+}
+
+
+/*
+ * ProceedGroupStateInSubTransaction proceeds the state machine of the given
+ * group in a subtransaction of the current transaction, so that an error only
+ * rolls back the decisions for this group.
+ */
+static void
+ProceedGroupStateInSubTransaction(PendingGroup *group)
+{
+	MemoryContext groupContext = CurrentMemoryContext;
+	ResourceOwner groupOwner = CurrentResourceOwner;
+
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(groupContext);
+
+	PG_TRY();
+	{
+		ProceedPendingGroupState(group->formationId, group->groupId);
+
+		ReleaseCurrentSubTransaction();
+	}
+	PG_CATCH();
+	{
+		MemoryContextSwitchTo(groupContext);
+
+		ErrorData *errorData = CopyErrorData();
+		FlushErrorState();
+
+		RollbackAndReleaseCurrentSubTransaction();
+
+		ereport(WARNING,
+				(errmsg("failed to proceed the state machine of "
+						"formation \"%s\" group %d: %s",
+						group->formationId, group->groupId,
+						errorData->message)));
+
+		FreeErrorData(errorData);
+	}
+	PG_END_TRY();
+
+	MemoryContextSwitchTo(groupContext);
+	CurrentResourceOwner = groupOwner;
+}
+
+
+/*
+ * MaintainEventPartitions calls pgautofailover.maintain_event_partitions() so
+ * that the daily partitions of the event table exist ahead of time, the
+ * partitions older than pgautofailover.event_archive are moved to the archive,
+ * and the events older than pgautofailover.event_retention are dropped.
+ *
+ * The function is only found once the extension has been updated to a version
+ * that archives the event table, until then we skip the maintenance.
+ */
+void
+MaintainEventPartitions(void)
+{
+	StringInfoData query;
+	MemoryContext upperContext = CurrentMemoryContext;
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+					 "SELECT pgautofailover.maintain_event_partitions(%d, 2, %d) "
+					 " WHERE to_regprocedure("
+					 "'pgautofailover.maintain_event_partitions"
+					 "(integer,integer,integer)')"
+					 " IS NOT NULL",
+					 EventRetention, EventArchive);
+
+	StartSPITransaction();
+
+	if (HaMonitorHasBeenLoaded())
+	{
+		int spiStatus PG_USED_FOR_ASSERTS_ONLY = 0;
+
+		pgstat_report_activity(STATE_RUNNING, query.data);
+
+		spiStatus = SPI_execute(query.data, false, 0);
+		Assert(spiStatus == SPI_OK_SELECT);
+	}
+
+	EndSPITransaction();
+
+	MemoryContextSwitchTo(upperContext);
+
+	pfree(query.data);
+}
+
+
+/*
+ * MigrateUpgradeEvents moves a batch of the events that the extension upgrade
+ * has kept aside in pgautofailover.event_upgrade_old to the event table, by
+ * calling pgautofailover.migrate_upgrade_events(). The upgrade then doesn't
+ * hold its locks for as long as it takes to copy all the events, and each
+ * batch is a short transaction of its own that doesn't block node_active.
+ *
+ * Returns true when some events have been moved, and false when there is
+ * nothing left to migrate, or when the extension has not been updated to a
+ * version that knows how to migrate the events yet.
+ */
+bool
+MigrateUpgradeEvents(void)
+{
+	StringInfoData query;
+	MemoryContext upperContext = CurrentMemoryContext;
+	int64 movedCount = 0;
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+					 "SELECT pgautofailover.migrate_upgrade_events(%d) "
+					 " WHERE to_regprocedure("
+					 "'pgautofailover.migrate_upgrade_events(integer)')"
+					 " IS NOT NULL",
+					 EVENT_MIGRATION_BATCH_SIZE);
+
+	StartSPITransaction();
+
+	if (HaMonitorHasBeenLoaded())
+	{
+		pgstat_report_activity(STATE_RUNNING, query.data);
+
+		int spiStatus = SPI_execute(query.data, false, 0);
+
+		if (spiStatus == SPI_OK_SELECT && SPI_processed == 1)
+		{
+			bool isNull = false;
+			Datum movedCountDatum = SPI_getbinval(SPI_tuptable->vals[0],
+												  SPI_tuptable->tupdesc,
+												  1, &isNull);
+
+			movedCount = isNull ? 0 : DatumGetInt64(movedCountDatum);
+		}
+	}
+
+	EndSPITransaction();
+
+	MemoryContextSwitchTo(upperContext);
+
+	pfree(query.data);
+
+	if (movedCount > 0)
+	{
+		ereport(LOG,
+				(errmsg("pg_auto_failover monitor moved %lld events "
+						"kept aside by the extension upgrade",
+						(long long) movedCount)));
+	}
+
+	return movedCount > 0;
+}
+
+
+/*
+ * CheckTableHealth warns when the monitor tables are not maintained well
+ * enough by HOT updates and autovacuum. The node table and the tables that
+ * the keepers update at each report only stay small when most of their
+ * updates are HOT updates, and when their dead rows are vacuumed quickly.
+ * An index on an updated column prevents HOT updates, and a long running
+ * transaction prevents pruning and vacuum, and then the tables grow and the
+ * monitor protocol functions slow down.
+ *
+ * The HOT updates ratio is computed with the updates since the previous
+ * check, so that a problem that began recently is not hidden by the history
+ * of the table. The view pgautofailover.table_health has the details.
+ */
+void
+CheckTableHealth(void)
+{
+	MemoryContext upperContext = CurrentMemoryContext;
+	TableUpdateCounts currentCounts[TABLE_HEALTH_MAX_TABLES];
+	int currentCount = 0;
+
+	if (TableHealthHotUpdateRatio == 0 && TableHealthDeadTupleRatio == 0)
+	{
+		return;
+	}
+
+	const char *query =
+		"SELECT relid, relname, n_live_tup, n_dead_tup, "
+		"       n_tup_upd, n_tup_hot_upd, "
+		"       coalesce(last_autovacuum::text, 'never') "
+		"  FROM pg_catalog.pg_stat_all_tables "
+		" WHERE schemaname = 'pgautofailover'";
+
+	StartSPITransaction();
+
+	if (HaMonitorHasBeenLoaded())
+	{
+		pgstat_report_activity(STATE_RUNNING, query);
+
+		int spiStatus = SPI_execute(query, true, 0);
+
+		for (uint64 rowNumber = 0;
+			 spiStatus == SPI_OK_SELECT && rowNumber < SPI_processed;
+			 rowNumber++)
+		{
+			HeapTuple heapTuple = SPI_tuptable->vals[rowNumber];
+			TupleDesc tupleDesc = SPI_tuptable->tupdesc;
+			bool isNull = false;
+
+			Oid relationId =
+				DatumGetObjectId(SPI_getbinval(heapTuple, tupleDesc, 1, &isNull));
+			char *relationName = SPI_getvalue(heapTuple, tupleDesc, 2);
+			int64 liveRows =
+				DatumGetInt64(SPI_getbinval(heapTuple, tupleDesc, 3, &isNull));
+			int64 deadRows =
+				DatumGetInt64(SPI_getbinval(heapTuple, tupleDesc, 4, &isNull));
+			int64 updates =
+				DatumGetInt64(SPI_getbinval(heapTuple, tupleDesc, 5, &isNull));
+			int64 hotUpdates =
+				DatumGetInt64(SPI_getbinval(heapTuple, tupleDesc, 6, &isNull));
+			char *lastAutovacuum = SPI_getvalue(heapTuple, tupleDesc, 7);
+
+			TableUpdateCounts *previous = FindPreviousUpdateCounts(relationId);
+
+			/* the statistics might have been reset since the previous check */
+			if (TableHealthHotUpdateRatio > 0 &&
+				previous != NULL &&
+				updates >= previous->updates &&
+				hotUpdates >= previous->hotUpdates)
+			{
+				int64 newUpdates = updates - previous->updates;
+				int64 newHotUpdates = hotUpdates - previous->hotUpdates;
+
+				if (newUpdates >= TABLE_HEALTH_MIN_ROWS &&
+					newHotUpdates * 100 < newUpdates * TableHealthHotUpdateRatio)
+				{
+					ereport(WARNING,
+							(errmsg("only %lld of the %lld updates of table "
+									"pgautofailover.%s since the previous "
+									"check were HOT updates",
+									(long long) newHotUpdates,
+									(long long) newUpdates,
+									relationName),
+							 errhint("Indexes on updated columns and long "
+									 "running transactions prevent HOT "
+									 "updates, see the view "
+									 "pgautofailover.table_health.")));
+				}
+			}
+
+			if (TableHealthDeadTupleRatio > 0 &&
+				deadRows >= TABLE_HEALTH_MIN_ROWS &&
+				deadRows * 100 > (liveRows + deadRows) * TableHealthDeadTupleRatio)
+			{
+				ereport(WARNING,
+						(errmsg("table pgautofailover.%s has %lld dead rows "
+								"and %lld live rows, last autovacuum: %s",
+								relationName,
+								(long long) deadRows,
+								(long long) liveRows,
+								lastAutovacuum),
+						 errhint("Long running transactions prevent vacuum "
+								 "from removing dead rows, see the view "
+								 "pgautofailover.table_health.")));
+			}
+
+			if (currentCount < TABLE_HEALTH_MAX_TABLES)
+			{
+				currentCounts[currentCount].relationId = relationId;
+				currentCounts[currentCount].updates = updates;
+				currentCounts[currentCount].hotUpdates = hotUpdates;
+				++currentCount;
+			}
+		}
+	}
+
+	EndSPITransaction();
+
+	MemoryContextSwitchTo(upperContext);
+
+	memcpy(PreviousUpdateCounts, currentCounts,
+		   currentCount * sizeof(TableUpdateCounts));
+	PreviousUpdateCountsCount = currentCount;
+}
+
+
+/*
+ * FindPreviousUpdateCounts returns the update counts of the given table at
+ * the previous run of CheckTableHealth, or NULL.
+ */
+static TableUpdateCounts *
+FindPreviousUpdateCounts(Oid relationId)
+{
+	for (int index = 0; index < PreviousUpdateCountsCount; index++)
+	{
+		if (PreviousUpdateCounts[index].relationId == relationId)
+		{
+			return &(PreviousUpdateCounts[index]);
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * FlushEventQueue inserts in a single transaction the events of our database
+ * that have been queued by the state changes when deferred events are
+ * enabled. When the extension has been dropped, the events are discarded.
+ */
+void
+FlushEventQueue(void)
+{
+	MemoryContext upperContext = CurrentMemoryContext;
+	List *readyEventList = ReadyEventSlots(MyDatabaseId);
+
+	if (readyEventList == NIL)
+	{
+		return;
+	}
+
+	StartSPITransaction();
+
+	if (HaMonitorHasBeenLoaded())
+	{
+		pgstat_report_activity(STATE_RUNNING,
+							   "INSERT INTO " AUTO_FAILOVER_EVENT_TABLE);
+
+		InsertQueuedEvents(readyEventList);
+	}
+
+	EndSPITransaction();
+
+	MemoryContextSwitchTo(upperContext);
+
+	ReleaseEventSlots(readyEventList);
 }
 
 
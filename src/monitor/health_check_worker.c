@@ -12,6 +12,10 @@
 
 #include "postgres.h"
 
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
 /* these are internal headers */
 #include "health_check.h"
 #include "metadata.h"
@@ -21,11 +25,13 @@
 #include "access/heapam.h"
 #include "access/htup_details.h"
 #include "access/xact.h"
+#include "catalog/pg_collation.h"
 #include "catalog/pg_database.h"
 #include "commands/extension.h"
 #include "miscadmin.h"
 #include "pgstat.h"
 #include "postmaster/bgworker.h"
+#include "port/atomics.h"
 #include "storage/ipc.h"
 #include "storage/latch.h"
 #include "storage/lmgr.h"
@@ -35,11 +41,12 @@
 
 /* these headers are used by this particular worker's code */
 #include "fmgr.h"
+#include "funcapi.h"
+#include "lib/pairingheap.h"
 #include "lib/stringinfo.h"
 #include "libpq-fe.h"
 #include "libpq-int.h"
 #include "libpq/pqsignal.h"
-#include "poll.h"
 #include "sys/time.h"
 #include "utils/builtins.h"
 #include "utils/memutils.h"
@@ -58,8 +65,50 @@
 	"connect_timeout=%u"
 #define MAX_CONN_INFO_SIZE 1024
 
+/* libpq knows about tcp_user_timeout since Postgres 12 */
+#if (PG_VERSION_NUM >= 120000)
+#define HAVE_TCP_USER_TIMEOUT
+#endif
+
 #define CANNOT_CONNECT_NOW "57P03"
 
+/*
+ * The WaitEventSet always contains the process latch and the postmaster death
+ * events, then one socket event per health check that is connecting. We
+ * allocate room for twice the number of health checks so that sockets can be
+ * added as connections are opened without having to rebuild the set.
+ */
+#define HEALTH_CHECK_FIXED_EVENTS 2
+#define HEALTH_CHECK_MIN_SOCKET_EVENTS 64
+
+/*
+ * Latency histograms use power-of-two buckets of microseconds: bucket i
+ * counts the latencies in [2^i, 2^(i+1)) us, the first bucket also counts
+ * latencies under a microsecond, and the last one everything above.
+ */
+#define HEALTH_CHECK_LATENCY_BUCKETS 32
+
+#define HEALTH_CHECK_STATS_COLUMNS 13
+
+/*
+ * Resolved host names are cached with up to this many addresses each, see
+ * ResolvedHost. We remove the entries of the host names that no health check
+ * used for this many TTLs.
+ */
+#define RESOLVED_HOST_NAME_MAXLEN 256
+#define RESOLVED_HOST_MAX_ADDRESSES 8
+#define RESOLVED_HOST_ADDRESS_MAXLEN 64
+#define RESOLVED_HOST_EVICT_TTLS 10
+
+/*
+ * The first health check worker of each database also maintains the daily
+ * partitions of the event table, once an hour.
+ */
+#define EVENT_MAINTENANCE_PERIOD_MS (60 * 60 * 1000)
+
+/* it also checks the HOT updates and dead rows of the monitor tables */
+#define TABLE_HEALTH_CHECK_PERIOD_MS (10 * 60 * 1000)
+
 
 typedef enum
 {
@@ -67,7 +116,8 @@ typedef enum
 	HEALTH_CHECK_CONNECTING = 1,
 	HEALTH_CHECK_OK = 2,
 	HEALTH_CHECK_RETRY = 3,
-	HEALTH_CHECK_DEAD = 4
+	HEALTH_CHECK_DEAD = 4,
+	HEALTH_CHECK_PROBING = 5
 } HealthCheckState;
 
 typedef struct HealthCheck
@@ -79,9 +129,107 @@ typedef struct HealthCheck
 	PostgresPollingStatusType pollingStatus;
 	int numTries;
 	struct timeval nextEventTime;
+
+	/* registration of the connection socket in the WaitEventSet */
+	int waitEventPos;
+	uint32 waitEvents;
+	pgsocket waitEventSocket;
+	struct addrinfo *waitEventAddr;
+
+	/* registration of nextEventTime in the timer heap */
+	pairingheap_node timerNode;
+	bool hasTimer;
+
+	/* set to true once the check reached either OK or DEAD */
+	bool done;
+
+	/* measurements of the current round, published in shared memory */
+	struct timeval attemptStartTime;
+	int64 connectLatency;
+	int64 responseLatency;
+	int retryCount;
+	int connectionCount;
+
+	/*
+	 * Backoff of the nodes that have been failing their checks for longer
+	 * than pgautofailover.health_check_backoff_threshold, kept from one round
+	 * to the next: we skip their checks until nextCheckTime.
+	 */
+	TimestampTz deadSince;
+	TimestampTz nextCheckTime;
+	int backoffDelay;
+
+	/* nodes with a longer health check period than the round skip rounds */
+	TimestampTz lastCheckTime;
+
+	/* the check starts at the phase of the node in the round */
+	struct timeval startTime;
+
+	/* connecting, or waiting for pgautofailover.health_check_max_connects */
+	bool connecting;
+	bool waitingForConnect;
+
+	/* the probe follows the connection of this try, which counted already */
+	bool probeOnNewConnection;
+
+	/* addresses of the node host that failed in the current try */
+	int failedAddressCount;
+
+	/*
+	 * Flap damping, kept from one round to the next: the health state that
+	 * the last checks found, how many rounds in a row, and when the health
+	 * of the node last changed.
+	 */
+	NodeHealthState pendingHealthState;
+	int pendingHealthCount;
+	TimestampTz lastTransitionTime;
+	bool transitionSuppressed;
 } HealthCheck;
 
 
+/*
+ * HealthCheckEntry maps a node id to its health check when refreshing the
+ * list of nodes to check.
+ */
+typedef struct HealthCheckEntry
+{
+	int64 nodeId;
+	HealthCheck *healthCheck;
+	bool kept;
+} HealthCheckEntry;
+
+
+/*
+ * HealthCheckEventLoop is the long-lived state used to wait for I/O and
+ * timeouts on all the health checks of a round. Within a round, the
+ * WaitEventSet is only rebuilt when it runs out of room or when we detect that
+ * it contains a socket that has since been closed: sockets are added to the
+ * set as connections are started, and their event mask is changed in place
+ * when libpq wants to read rather than write, or the other way round.
+ *
+ * Each pending health check also has an entry in a timer heap, keyed on its
+ * nextEventTime, so that a wakeup only has to process the sockets that are
+ * ready and the timers that have expired.
+ */
+typedef struct HealthCheckEventLoop
+{
+	MemoryContext context;
+	WaitEventSet *waitEventSet;
+	WaitEvent *occurredEvents;
+	int maxEvents;
+	int eventCount;
+	int socketCount;
+	bool rebuildWaitEventSet;
+	pairingheap *timerHeap;
+	List *healthCheckList;
+	int pendingCheckCount;
+
+	/* checks waiting for a connection slot, in order */
+	int connectingCount;
+	List *waitingForConnectList;
+} HealthCheckEventLoop;
+
+
 /*
  * Shared memory data for all maintenance workers.
  */
@@ -95,19 +243,122 @@ typedef struct HealthCheckHelperControlData
 	int trancheId;
 	char *lockTrancheName;
 	LWLock lock;
+
+	/*
+	 * Incremented each time a transaction that adds, removes, or changes the
+	 * host or port of a node commits, so that health check workers know when
+	 * to reload their list of nodes.
+	 */
+	pg_atomic_uint64 nodeListGeneration;
+
+	/* lock protecting HealthCheckStatsHash */
+	LWLock statsLock;
+
+	/* lock protecting GroupDeadlineHash */
+	LWLock deadlineLock;
 } HealthCheckHelperControlData;
 
 /*
- * Per database worker state.
+ * Health check workers are identified by the database they run on, and by
+ * the shard of the nodes they are responsible for in that database.
  */
-typedef struct HealthCheckHelperDatabase
+typedef struct HealthCheckWorkerKey
 {
-	/* hash key: database to run on */
 	Oid dboid;
+	int shard;
+} HealthCheckWorkerKey;
+
+/*
+ * Per database and per shard worker state.
+ */
+typedef struct HealthCheckHelperDatabase
+{
+	/* hash key: database to run on, and shard of nodes to check */
+	HealthCheckWorkerKey key;
 	pid_t workerPid;
+	Latch *workerLatch;
 	BackgroundWorkerHandle *handle;
 } HealthCheckHelperDatabase;
 
+/*
+ * Health check statistics are kept per database and node.
+ */
+typedef struct HealthCheckStatsKey
+{
+	Oid dboid;
+	int64 nodeId;
+} HealthCheckStatsKey;
+
+typedef struct HealthCheckLatencyHistogram
+{
+	uint64 count;
+	uint64 max;
+	uint64 buckets[HEALTH_CHECK_LATENCY_BUCKETS];
+} HealthCheckLatencyHistogram;
+
+/*
+ * HealthCheckStats accumulates the results of the health checks of a node
+ * since the node has been added to the health check worker, or since the
+ * server started. Latencies are in microseconds.
+ *
+ * The time of the last check is kept here rather than in the node_report
+ * table, which is only updated when the health of the node changes, see
+ * NodeHealthCheckTime().
+ */
+typedef struct HealthCheckStats
+{
+	HealthCheckStatsKey key;
+	TimestampTz lastCheckTime;
+	uint64 checkCount;
+	uint64 failureCount;
+	uint64 retryCount;
+	uint64 connectionCount;
+	uint64 suppressedCount;
+	HealthCheckLatencyHistogram connectLatency;
+	HealthCheckLatencyHistogram responseLatency;
+} HealthCheckStats;
+
+/*
+ * The deadlines of the timeout driven decisions are kept per database and
+ * group, so that the health check workers run the state machine of a group
+ * when its next decision is due.
+ */
+typedef struct GroupDeadlineKey
+{
+	Oid dboid;
+	char formationId[NAMEDATALEN];
+	int groupId;
+} GroupDeadlineKey;
+
+typedef struct GroupDeadline
+{
+	GroupDeadlineKey key;
+	TimestampTz deadline;
+} GroupDeadline;
+
+/*
+ * ResolvedHost caches the addresses of a node host name, so that the health
+ * checks connect with hostaddr= rather than having libpq resolve the name
+ * synchronously at each connection, which blocks every other health check
+ * of the worker when the resolver is slow. The names are resolved again in
+ * between the rounds, once their pgautofailover.health_check_dns_ttl has
+ * expired, and we keep using the previous addresses when that fails.
+ *
+ * The checks connect to the preferred address; when it fails, they try the
+ * next one right away, and the address that answers becomes the preferred
+ * one.
+ */
+typedef struct ResolvedHost
+{
+	char hostname[RESOLVED_HOST_NAME_MAXLEN];   /* hash key */
+	int addressCount;
+	char addresses[RESOLVED_HOST_MAX_ADDRESSES][RESOLVED_HOST_ADDRESS_MAXLEN];
+	int preferredAddress;
+	TimestampTz resolveTime;    /* zero until we tried resolving the name */
+	TimestampTz lastUseTime;
+	bool failed;                /* the last lookup failed */
+} ResolvedHost;
+
 typedef struct DatabaseListEntry
 {
 	Oid dboid;
@@ -120,25 +371,86 @@ typedef struct DatabaseListEntry
  * activated, and a lock to protect access to it.
  */
 static HTAB *HealthCheckWorkerDBHash;
+static HTAB *HealthCheckStatsHash;
+static HTAB *GroupDeadlineHash;
 static HealthCheckHelperControlData *HealthCheckHelperControl = NULL;
 static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
 
+/* per-worker cache of the addresses of the node host names */
+static HTAB *ResolvedHostHash = NULL;
+
+/* per-process event loop state of a health check worker */
+static HealthCheckEventLoop *EventLoop = NULL;
+
+/* per-process list of health checks, kept from one round to the next */
+static MemoryContext HealthCheckListContext = NULL;
+
+/* set when the current transaction changes the list of nodes */
+static bool NodeListChanged = false;
+
+
+PG_FUNCTION_INFO_V1(health_check_stats);
+
 
 /* private function declarations */
 static void pg_auto_failover_monitor_sigterm(SIGNAL_ARGS);
 static void pg_auto_failover_monitor_sighup(SIGNAL_ARGS);
-static BackgroundWorkerHandle * RegisterHealthCheckWorker(DatabaseListEntry *db);
+static void StartHealthCheckWorker(DatabaseListEntry *entry, int shard);
+static BackgroundWorkerHandle * RegisterHealthCheckWorker(DatabaseListEntry *db,
+														  int shard);
+static void StopHealthCheckWorkerShard(Oid databaseId, int shard);
 static List * BuildDatabaseList(void);
 static bool pgAutoFailoverExtensionExists(void);
-static List * CreateHealthChecks(List *nodeHealthList);
+static List * RefreshHealthChecks(List *healthCheckList, List *nodeHealthList);
 static HealthCheck * CreateHealthCheck(NodeHealth *nodeHealth);
+static void FreeHealthCheck(HealthCheck *healthCheck);
+static void StartHealthCheckRound(List *healthCheckList, int roundPeriod);
+static int HealthCheckRoundPeriod(List *healthCheckList);
+static int NodeHealthCheckPeriod(NodeHealth *node);
+static int NodeHealthCheckTimeout(NodeHealth *node);
+static int NodeHealthCheckPhase(NodeHealth *node, int roundPeriod);
+static void FinishHealthCheckRound(List *healthCheckList);
+static void UpdateHealthCheckBackoff(HealthCheck *healthCheck, TimestampTz now);
+static void DampHealthTransitions(List *healthCheckList);
+static NodeHealthState CheckResult(HealthCheck *healthCheck);
+static void NodeListChangeXactCallback(XactEvent event, void *arg);
+static void RecordHealthCheckStats(List *healthCheckList);
+static void RecordLatency(HealthCheckLatencyHistogram *histogram, int64 latency);
+static double LatencyPercentile(HealthCheckLatencyHistogram *histogram,
+								double percentile);
+static void RemoveHealthCheckStats(Oid databaseId, int64 nodeId);
+static void RemoveGroupDeadlines(Oid databaseId);
+static void WakeHealthCheckWorkers(Oid databaseId);
+static int FormationShard(const char *formationId, int shardCount);
+static int64 SubtractTimesMicros(struct timeval x, struct timeval y);
+static bool SendHealthCheckProbe(HealthCheck *healthCheck,
+								 struct timeval currentTime);
+static void RetryHealthCheckProbe(HealthCheck *healthCheck,
+								  struct timeval currentTime);
+static const char * HealthCheckProbeQuery(HealthCheck *healthCheck);
 static void DoHealthChecks(List *healthCheckList);
+static void StartWaitingHealthChecks(struct timeval currentTime);
 static void ManageHealthCheck(HealthCheck *healthCheck, struct timeval currentTime);
-static int WaitForEvent(List *healthCheckList);
+static void StartHealthCheckEventLoop(List *healthCheckList);
+static void RebuildWaitEventSet(int socketCount);
+static void UpdateHealthCheckEvents(HealthCheck *healthCheck,
+									struct timeval currentTime);
+static void AddHealthCheckSocket(HealthCheck *healthCheck, pgsocket socket,
+								 uint32 events);
+static int CompareHealthCheckTimers(const pairingheap_node *a,
+									const pairingheap_node *b,
+									void *arg);
+static int WaitForEvents(void);
 static int CompareTimes(struct timeval *leftTime, struct timeval *rightTime);
 static int SubtractTimes(struct timeval base, struct timeval subtract);
 static struct timeval AddTimeMillis(struct timeval base, uint32 additionalMs);
 static void LatchWait(long timeoutMs);
+static void AppendSocketOptions(StringInfo connInfoString, NodeHealth *node);
+static ResolvedHost * LookupResolvedHost(const char *hostname, bool create);
+static bool AppendHostAddress(StringInfo connInfoString, NodeHealth *node);
+static bool TryNextHostAddress(HealthCheck *healthCheck);
+static void RefreshResolvedHosts(struct timeval deadline);
+static void ResolveHost(ResolvedHost *host);
 static void HealthCheckWorkerShmemInit(void);
 
 
@@ -151,6 +463,23 @@ int HealthCheckPeriod = 5 * 1000;
 int HealthCheckTimeout = 5 * 1000;
 int HealthCheckMaxRetries = 2;
 int HealthCheckRetryDelay = 2 * 1000;
+int HealthCheckWorkers = 1;
+int HealthCheckStatsMaxNodes = 1024;
+bool HealthCheckKeepAlive = false;
+int HealthCheckTcpUserTimeout = 0;
+int HealthCheckKeepAlivesIdle = 0;
+int HealthCheckKeepAlivesInterval = 0;
+int HealthCheckKeepAlivesCount = 0;
+int HealthCheckPassivePeriod = 0;
+int HealthCheckBackoffThreshold = 0;
+int HealthCheckBackoffMaxDelay = 5 * 60 * 1000;
+int HealthCheckSpread = 50;
+int HealthCheckMaxConnects = 0;
+int HealthCheckProbe = HEALTH_CHECK_PROBE_CONNECT;
+int HealthCheckSlowThreshold = 0;
+int HealthCheckDnsTtl = 60;
+int HealthFlapSamples = 1;
+int HealthFlapMinInterval = 0;
 
 
 /*
@@ -205,6 +534,60 @@ InitializeHealthCheckWorker(void)
 
 	prev_shmem_startup_hook = shmem_startup_hook;
 	shmem_startup_hook = HealthCheckWorkerShmemInit;
+
+	RegisterXactCallback(NodeListChangeXactCallback, NULL);
+}
+
+
+/*
+ * NotifyNodeListChange registers that the current transaction adds, removes,
+ * or changes the host or port of a node. Health check workers are told to
+ * reload their list of nodes once the transaction commits.
+ */
+void
+NotifyNodeListChange(void)
+{
+	NodeListChanged = true;
+}
+
+
+/*
+ * NodeListChangeXactCallback increments the shared node list generation at
+ * commit time when the transaction called NotifyNodeListChange, so that a
+ * health check worker never reloads the list before the change is visible.
+ */
+static void
+NodeListChangeXactCallback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		case XACT_EVENT_PREPARE:
+		{
+			if (NodeListChanged && HealthCheckHelperControl != NULL)
+			{
+				pg_atomic_fetch_add_u64(
+					&(HealthCheckHelperControl->nodeListGeneration), 1);
+			}
+
+			NodeListChanged = false;
+			break;
+		}
+
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+		{
+			NodeListChanged = false;
+			break;
+		}
+
+		default:
+		{
+			/* nothing to do */
+			break;
+		}
+	}
 }
 
 
@@ -258,133 +641,155 @@ HealthCheckWorkerLauncherMain(Datum arg)
 
 		foreach(databaseListCell, databaseList)
 		{
-			int pid;
-			BackgroundWorkerHandle *handle = NULL;
 			DatabaseListEntry *entry =
 				(DatabaseListEntry *) lfirst(databaseListCell);
-			bool isFound = false;
 
-			LWLockAcquire(&HealthCheckHelperControl->lock, LW_EXCLUSIVE);
+			for (int shard = 0; shard < HealthCheckWorkers; shard++)
+			{
+				StartHealthCheckWorker(entry, shard);
+			}
+		}
+
+		MemoryContextReset(launcherContext);
 
+		LatchWait(HealthCheckTimeout);
 
-			HealthCheckHelperDatabase *dbData = hash_search(HealthCheckWorkerDBHash,
-															(void *) &entry->dboid,
-															HASH_ENTER, &isFound);
-			if (isFound)
-			{
-				handle = dbData->handle;
+		if (got_sighup)
+		{
+			got_sighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+	}
 
-				LWLockRelease(&HealthCheckHelperControl->lock);
+	MemoryContextReset(launcherContext);
+	MemoryContextSwitchTo(originalContext);
+}
 
-				/*
-				 * This database has already been processed.
-				 *
-				 * Perform a quick and inexpensive check to verify that it is
-				 * actually running. Note that it is not possible to get
-				 * BGWH_NOT_YET_STARTED at this point, because this is not first
-				 * time we try to register the worker due to the isFound value
-				 * above. The HealthCheckWorkerDBHash only maintains verified
-				 * started entries. Thus we can only get BGWH_STARTED or
-				 * BGWH_STOPPED.
-				 */
-				if (GetBackgroundWorkerPid(handle, &pid) != BGWH_STARTED)
-				{
-					ereport(WARNING,
-							(errmsg(
-								 "found stopped worker for pg_auto_failover "
-								 "health checks in \"%s\"",
-								 entry->dbname)));
-
-					/*
-					 * Now we know that the worker has stopped. We use
-					 * StopHealthCheckWorker to remove the entry from the
-					 * HealthCheckWorkerDBHash. That will force a retry in the
-					 * next scan of the databaselist.
-					 *
-					 * Furthermore, if the status from GetBackgroundWorkerPid
-					 * was not the correct one, then StopHealthCheckWorker will
-					 * also make certain that the rogue worker will be stopped.
-					 * That will leave HealthCheckWorkerDBHash in a consistent
-					 * state.
-					 */
-					StopHealthCheckWorker(entry->dboid);
-				}
 
-				continue;
-			}
+/*
+ * StartHealthCheckWorker makes sure that a health check worker is running for
+ * the given database and shard, starting one when needed.
+ */
+static void
+StartHealthCheckWorker(DatabaseListEntry *entry, int shard)
+{
+	int pid;
+	BackgroundWorkerHandle *handle = NULL;
+	bool isFound = false;
+	HealthCheckWorkerKey key;
 
-			/* register a worker for the entry database, in the background */
-			handle = RegisterHealthCheckWorker(entry);
-			if (handle)
-			{
-				/*
-				 * Once started, the Health Check process will update its
-				 * pid.
-				 */
-				dbData->workerPid = 0;
+	memset(&key, 0, sizeof(key));
+	key.dboid = entry->dboid;
+	key.shard = shard;
 
-				/*
-				 * We need to release the lock for the worker to be able to
-				 * complete its startup procedure: the per-database worker
-				 * takes the control lock in SHARED mode to edit its own PID in
-				 * its own entry in HealthCheckWorkerDBHash.
-				 */
-				LWLockRelease(&HealthCheckHelperControl->lock);
+	LWLockAcquire(&HealthCheckHelperControl->lock, LW_EXCLUSIVE);
 
-				/*
-				 * WaitForBackgroundWorkerStartup will wait for worker to start;
-				 * thus, BGWH_NOT_YET_STARTED is never returned. However, if the
-				 * postmaster has died, it will give up and return
-				 * BGWH_POSTMASTER_DIED. In such a case the process will get
-				 * signaled to stop and we will exit further down. For good
-				 * measure though, do verify the process did actually start
-				 * before marking it as Active.
-				 */
-				if (WaitForBackgroundWorkerStartup(handle, &pid) == BGWH_STARTED)
-				{
-					dbData->handle = handle;
-					ereport(LOG,
-							(errmsg(
-								 "started worker for pg_auto_failover "
-								 "health checks in \"%s\"",
-								 entry->dbname)));
-					continue;
-				}
-			}
+	HealthCheckHelperDatabase *dbData = hash_search(HealthCheckWorkerDBHash,
+													(void *) &key,
+													HASH_ENTER, &isFound);
+	if (isFound)
+	{
+		handle = dbData->handle;
 
-			LWLockRelease(&HealthCheckHelperControl->lock);
+		LWLockRelease(&HealthCheckHelperControl->lock);
+
+		/*
+		 * This database has already been processed.
+		 *
+		 * Perform a quick and inexpensive check to verify that it is
+		 * actually running. Note that it is not possible to get
+		 * BGWH_NOT_YET_STARTED at this point, because this is not first
+		 * time we try to register the worker due to the isFound value
+		 * above. The HealthCheckWorkerDBHash only maintains verified
+		 * started entries. Thus we can only get BGWH_STARTED or
+		 * BGWH_STOPPED.
+		 */
+		if (GetBackgroundWorkerPid(handle, &pid) != BGWH_STARTED)
+		{
+			ereport(WARNING,
+					(errmsg(
+						 "found stopped worker for pg_auto_failover "
+						 "health checks in \"%s\" (shard %d)",
+						 entry->dbname, shard)));
 
 			/*
-			 * Similarly to the comment above, we either failed to start
-			 * the worker, or we failed to register it.
+			 * Now we know that the worker has stopped. We use
+			 * StopHealthCheckWorkerShard to remove the entry from the
+			 * HealthCheckWorkerDBHash. That will force a retry in the
+			 * next scan of the databaselist.
 			 *
-			 * NOTE. We use StopHealthCheckWorker to remove the entry
-			 * from the HealthCheckWorkerDBHash so that it will be
-			 * retried in the next databaselist scan. The call to kill()
-			 * the failed worker in StopHealthCheckWorker() will take
-			 * place only if a handle was registered.
+			 * Furthermore, if the status from GetBackgroundWorkerPid
+			 * was not the correct one, then StopHealthCheckWorkerShard will
+			 * also make certain that the rogue worker will be stopped.
+			 * That will leave HealthCheckWorkerDBHash in a consistent
+			 * state.
 			 */
-			ereport(WARNING,
-					(errmsg("failed to %s worker for pg_auto_failover "
-							"health checks in \"%s\"",
-							handle ? "start" : "register",
-							entry->dbname)));
-			StopHealthCheckWorker(entry->dboid);
+			StopHealthCheckWorkerShard(entry->dboid, shard);
 		}
 
-		MemoryContextReset(launcherContext);
+		return;
+	}
 
-		LatchWait(HealthCheckTimeout);
+	/* register a worker for the entry database, in the background */
+	handle = RegisterHealthCheckWorker(entry, shard);
+	if (handle)
+	{
+		/*
+		 * Once started, the Health Check process will update its
+		 * pid.
+		 */
+		dbData->workerPid = 0;
+		dbData->workerLatch = NULL;
 
-		if (got_sighup)
+		/*
+		 * We need to release the lock for the worker to be able to
+		 * complete its startup procedure: the per-database worker
+		 * takes the control lock in SHARED mode to edit its own PID in
+		 * its own entry in HealthCheckWorkerDBHash.
+		 */
+		LWLockRelease(&HealthCheckHelperControl->lock);
+
+		/*
+		 * WaitForBackgroundWorkerStartup will wait for worker to start;
+		 * thus, BGWH_NOT_YET_STARTED is never returned. However, if the
+		 * postmaster has died, it will give up and return
+		 * BGWH_POSTMASTER_DIED. In such a case the process will get
+		 * signaled to stop and we will exit further down. For good
+		 * measure though, do verify the process did actually start
+		 * before marking it as Active.
+		 */
+		if (WaitForBackgroundWorkerStartup(handle, &pid) == BGWH_STARTED)
 		{
-			got_sighup = false;
-			ProcessConfigFile(PGC_SIGHUP);
+			dbData->handle = handle;
+			ereport(LOG,
+					(errmsg(
+						 "started worker for pg_auto_failover "
+						 "health checks in \"%s\" (shard %d)",
+						 entry->dbname, shard)));
+			return;
 		}
 	}
+	else
+	{
+		LWLockRelease(&HealthCheckHelperControl->lock);
+	}
 
-	MemoryContextReset(launcherContext);
-	MemoryContextSwitchTo(originalContext);
+	/*
+	 * Similarly to the comment above, we either failed to start
+	 * the worker, or we failed to register it.
+	 *
+	 * NOTE. We use StopHealthCheckWorkerShard to remove the entry
+	 * from the HealthCheckWorkerDBHash so that it will be
+	 * retried in the next databaselist scan. The call to kill()
+	 * the failed worker in StopHealthCheckWorkerShard() will take
+	 * place only if a handle was registered.
+	 */
+	ereport(WARNING,
+			(errmsg("failed to %s worker for pg_auto_failover "
+					"health checks in \"%s\" (shard %d)",
+					handle ? "start" : "register",
+					entry->dbname, shard)));
+	StopHealthCheckWorkerShard(entry->dboid, shard);
 }
 
 
@@ -397,7 +802,7 @@ HealthCheckWorkerLauncherMain(Datum arg)
  * lock from the caller before waiting for the worker's start.
  */
 static BackgroundWorkerHandle *
-RegisterHealthCheckWorker(DatabaseListEntry *db)
+RegisterHealthCheckWorker(DatabaseListEntry *db, int shard)
 {
 	BackgroundWorker worker;
 	BackgroundWorkerHandle *handle;
@@ -413,12 +818,19 @@ RegisterHealthCheckWorker(DatabaseListEntry *db)
 	worker.bgw_restart_time = BGW_NEVER_RESTART;
 	worker.bgw_main_arg = ObjectIdGetDatum(db->dboid);
 	worker.bgw_notify_pid = MyProcPid;
+	memcpy(worker.bgw_extra, &shard, sizeof(int));
 	strlcpy(worker.bgw_library_name, "pgautofailover",
 			sizeof(worker.bgw_library_name));
 	strlcpy(worker.bgw_function_name, "HealthCheckWorkerMain",
 			sizeof(worker.bgw_function_name));
 	appendStringInfo(&buf, "pg_auto_failover monitor healthcheck worker %s",
 					 db->dbname);
+
+	if (HealthCheckWorkers > 1)
+	{
+		appendStringInfo(&buf, " (shard %d)", shard);
+	}
+
 	strlcpy(worker.bgw_name, buf.data,
 			sizeof(worker.bgw_name));
 
@@ -493,7 +905,20 @@ void
 HealthCheckWorkerMain(Datum arg)
 {
 	Oid dboid = DatumGetObjectId(arg);
+	int shard = 0;
 	bool foundPgAutoFailoverExtension = false;
+	HealthCheckWorkerKey key;
+	List *healthCheckList = NIL;
+	uint64 loadedGeneration = 0;
+	int loadedShardCount = 0;
+	struct timeval nextMaintenanceTime = { 0, 0 };
+	struct timeval nextTableHealthTime = { 0, 0 };
+
+	memcpy(&shard, MyBgworkerEntry->bgw_extra, sizeof(int));
+
+	memset(&key, 0, sizeof(key));
+	key.dboid = dboid;
+	key.shard = shard;
 
 	/*
 	 * Look up this worker's configuration.
@@ -502,7 +927,7 @@ HealthCheckWorkerMain(Datum arg)
 
 	HealthCheckHelperDatabase *myDbData = (HealthCheckHelperDatabase *)
 										  hash_search(HealthCheckWorkerDBHash,
-													  (void *) &dboid, HASH_FIND, NULL);
+													  (void *) &key, HASH_FIND, NULL);
 
 	if (!myDbData)
 	{
@@ -516,6 +941,7 @@ HealthCheckWorkerMain(Datum arg)
 
 	/* from this point, DROP DATABASE will attempt to kill the worker */
 	myDbData->workerPid = MyProcPid;
+	myDbData->workerLatch = MyLatch;
 
 	/* Establish signal handlers before unblocking signals. */
 	pqsignal(SIGHUP, pg_auto_failover_monitor_sighup);
@@ -544,6 +970,12 @@ HealthCheckWorkerMain(Datum arg)
 															 ALLOCSET_DEFAULT_INITSIZE,
 															 ALLOCSET_DEFAULT_MAXSIZE);
 
+	HealthCheckListContext = AllocSetContextCreate(TopMemoryContext,
+												   "Health check list context",
+												   ALLOCSET_DEFAULT_MINSIZE,
+												   ALLOCSET_DEFAULT_INITSIZE,
+												   ALLOCSET_DEFAULT_MAXSIZE);
+
 	MemoryContextSwitchTo(healthCheckContext);
 
 	/*
@@ -554,8 +986,11 @@ HealthCheckWorkerMain(Datum arg)
 		struct timeval currentTime = { 0, 0 };
 		struct timeval roundEndTime = { 0, 0 };
 
+		/* the round is as short as the shortest formation health check period */
+		int roundPeriod = HealthCheckRoundPeriod(healthCheckList);
+
 		gettimeofday(&currentTime, NULL);
-		roundEndTime = AddTimeMillis(currentTime, HealthCheckPeriod);
+		roundEndTime = AddTimeMillis(currentTime, roundPeriod);
 
 		if (!foundPgAutoFailoverExtension)
 		{
@@ -570,23 +1005,134 @@ HealthCheckWorkerMain(Datum arg)
 
 		if (foundPgAutoFailoverExtension)
 		{
-			List *nodeHealthList = LoadNodeHealthList();
+			uint64 nodeListGeneration = pg_atomic_read_u64(
+				&(HealthCheckHelperControl->nodeListGeneration));
+
+			/*
+			 * Only reload the list of nodes when it has changed since the
+			 * last time, or when we have no node to check yet: the extension
+			 * might have been created or updated since.
+			 */
+			if (healthCheckList == NIL ||
+				nodeListGeneration != loadedGeneration ||
+				loadedShardCount != HealthCheckWorkers)
+			{
+				List *nodeHealthList =
+					LoadNodeHealthList(shard, HealthCheckWorkers);
+
+				healthCheckList = RefreshHealthChecks(healthCheckList,
+													  nodeHealthList);
+
+				loadedGeneration = nodeListGeneration;
+				loadedShardCount = HealthCheckWorkers;
+			}
 
-			if (nodeHealthList != NIL)
+			if (healthCheckList != NIL)
 			{
-				List *healthCheckList = CreateHealthChecks(nodeHealthList);
+				List *nodeHealthList = NIL;
+				ListCell *healthCheckCell = NULL;
+
+				foreach(healthCheckCell, healthCheckList)
+				{
+					HealthCheck *healthCheck =
+						(HealthCheck *) lfirst(healthCheckCell);
+
+					nodeHealthList = lappend(nodeHealthList, healthCheck->node);
+				}
+
+				/* nodes whose keeper reports to us are not probed */
+				SetNodeReportList(nodeHealthList, shard, HealthCheckWorkers);
+
+				StartHealthCheckRound(healthCheckList, roundPeriod);
 
 				DoHealthChecks(healthCheckList);
+
+				/* an oscillating health only changes once it settles */
+				DampHealthTransitions(healthCheckList);
+
+				/* publish the statistics and the time of the checks */
+				RecordHealthCheckStats(healthCheckList);
+
+				/* apply the results of this round in a single transaction */
+				SetNodeHealthStateList(nodeHealthList);
+
+				FinishHealthCheckRound(healthCheckList);
+			}
+
+			/* timeout driven decisions don't wait for the keepers */
+			ProceedPendingGroupStates(shard, HealthCheckWorkers);
+
+			/* the first worker also inserts the deferred events */
+			if (shard == 0)
+			{
+				FlushEventQueue();
+			}
+
+			if (shard == 0 &&
+				SubtractTimesMicros(nextMaintenanceTime, currentTime) <= 0)
+			{
+				MaintainEventPartitions();
+
+				nextMaintenanceTime =
+					AddTimeMillis(currentTime, EVENT_MAINTENANCE_PERIOD_MS);
+			}
+
+			/* and moves the events kept aside by an extension upgrade */
+			if (shard == 0)
+			{
+				(void) MigrateUpgradeEvents();
+			}
+
+			if (shard == 0 &&
+				SubtractTimesMicros(nextTableHealthTime, currentTime) <= 0)
+			{
+				CheckTableHealth();
+
+				nextTableHealthTime =
+					AddTimeMillis(currentTime, TABLE_HEALTH_CHECK_PERIOD_MS);
 			}
 
 			MemoryContextReset(healthCheckContext);
 		}
 
-		gettimeofday(&currentTime, NULL);
-		int timeout = SubtractTimes(roundEndTime, currentTime);
-
-		if (timeout >= 0)
+		/*
+		 * Wait for the next round, and meanwhile take the timeout driven
+		 * decisions when they are due, rather than at the next round.
+		 */
+		for (;;)
 		{
+			gettimeofday(&currentTime, NULL);
+			int timeout = SubtractTimes(roundEndTime, currentTime);
+
+			if (timeout < 0 || got_sigterm || got_sighup)
+			{
+				break;
+			}
+
+			if (foundPgAutoFailoverExtension)
+			{
+				long deadlineTimeout =
+					ProceedExpiredGroupStates(shard, HealthCheckWorkers);
+
+				if (deadlineTimeout >= 0 && deadlineTimeout < timeout)
+				{
+					timeout = (int) deadlineTimeout;
+				}
+
+				MemoryContextReset(healthCheckContext);
+
+				/* resolve the node host names again before the next round */
+				RefreshResolvedHosts(roundEndTime);
+
+				gettimeofday(&currentTime, NULL);
+				timeout = Min(timeout, SubtractTimes(roundEndTime, currentTime));
+
+				if (timeout < 0)
+				{
+					break;
+				}
+			}
+
 			LatchWait(timeout);
 		}
 
@@ -594,9 +1140,26 @@ HealthCheckWorkerMain(Datum arg)
 		{
 			got_sighup = false;
 			ProcessConfigFile(PGC_SIGHUP);
+
+			/* the number of workers has been reduced, this shard is gone */
+			if (shard >= HealthCheckWorkers)
+			{
+				elog(LOG,
+					 "pg_auto_failover health check shard %d is not needed "
+					 "anymore in database %d", shard, dboid);
+
+				StopHealthCheckWorkerShard(dboid, shard);
+				break;
+			}
 		}
 	}
 
+	/* don't lose the deferred events on a clean shutdown */
+	if (shard == 0 && foundPgAutoFailoverExtension)
+	{
+		FlushEventQueue();
+	}
+
 	elog(LOG,
 		 "pg_auto_failover monitor exiting for database %d", dboid);
 
@@ -628,565 +1191,2637 @@ pgAutoFailoverExtensionExists(void)
 
 
 /*
- * CreateHealthChecks creates a list of health checks from a list of node health
- * descriptions.
+ * RefreshHealthChecks updates the list of health checks to match the freshly
+ * loaded list of node health descriptions: health checks for nodes that are
+ * still around are kept as-is, including their connection, new nodes get a
+ * new health check, and health checks for removed nodes are freed.
+ *
+ * A node that has been given another host or port is considered a new node.
  */
 static List *
-CreateHealthChecks(List *nodeHealthList)
+RefreshHealthChecks(List *healthCheckList, List *nodeHealthList)
 {
-	List *healthCheckList = NIL;
+	List *newHealthCheckList = NIL;
+	ListCell *healthCheckCell = NULL;
 	ListCell *nodeHealthCell = NULL;
+	HASHCTL info;
 
-	foreach(nodeHealthCell, nodeHealthList)
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(int64);
+	info.entrysize = sizeof(HealthCheckEntry);
+	info.hcxt = CurrentMemoryContext;
+
+	HTAB *healthCheckHash =
+		hash_create("pg_auto_failover health checks",
+					Max(list_length(healthCheckList), 16), &info,
+					HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	foreach(healthCheckCell, healthCheckList)
+	{
+		HealthCheck *healthCheck = (HealthCheck *) lfirst(healthCheckCell);
+
+		HealthCheckEntry *entry =
+			(HealthCheckEntry *) hash_search(healthCheckHash,
+											 &(healthCheck->node->nodeId),
+											 HASH_ENTER, NULL);
+		entry->healthCheck = healthCheck;
+		entry->kept = false;
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(HealthCheckListContext);
+
+	foreach(nodeHealthCell, nodeHealthList)
 	{
 		NodeHealth *nodeHealth = (NodeHealth *) lfirst(nodeHealthCell);
-		HealthCheck *healthCheck = CreateHealthCheck(nodeHealth);
-		healthCheckList = lappend(healthCheckList, healthCheck);
+		HealthCheck *healthCheck = NULL;
+		bool found = false;
+
+		HealthCheckEntry *entry =
+			(HealthCheckEntry *) hash_search(healthCheckHash,
+											 &(nodeHealth->nodeId),
+											 HASH_FIND, &found);
+
+		if (found &&
+			entry->healthCheck->node->nodePort == nodeHealth->nodePort &&
+			strcmp(entry->healthCheck->node->nodeHost, nodeHealth->nodeHost) == 0)
+		{
+			NodeHealth *existingNodeHealth = entry->healthCheck->node;
+
+			if (strcmp(existingNodeHealth->nodeName, nodeHealth->nodeName) != 0)
+			{
+				pfree(existingNodeHealth->nodeName);
+				existingNodeHealth->nodeName = pstrdup(nodeHealth->nodeName);
+			}
+
+			existingNodeHealth->healthState = nodeHealth->healthState;
+			existingNodeHealth->isPrimary = nodeHealth->isPrimary;
+
+			healthCheck = entry->healthCheck;
+			entry->kept = true;
+
+			existingNodeHealth->healthCheckPeriod = nodeHealth->healthCheckPeriod;
+			existingNodeHealth->healthCheckTimeout =
+				nodeHealth->healthCheckTimeout;
+
+			/* reconnect with the new socket options of the formation */
+			if (existingNodeHealth->tcpUserTimeout != nodeHealth->tcpUserTimeout)
+			{
+				existingNodeHealth->tcpUserTimeout = nodeHealth->tcpUserTimeout;
+
+				if (healthCheck->connection != NULL)
+				{
+					PQfinish(healthCheck->connection);
+					healthCheck->connection = NULL;
+				}
+			}
+		}
+		else
+		{
+			healthCheck = CreateHealthCheck(nodeHealth);
+		}
+
+		newHealthCheckList = lappend(newHealthCheckList, healthCheck);
+	}
+
+	foreach(healthCheckCell, healthCheckList)
+	{
+		HealthCheck *healthCheck = (HealthCheck *) lfirst(healthCheckCell);
+
+		HealthCheckEntry *entry =
+			(HealthCheckEntry *) hash_search(healthCheckHash,
+											 &(healthCheck->node->nodeId),
+											 HASH_FIND, NULL);
+
+		if (!entry->kept)
+		{
+			RemoveHealthCheckStats(MyDatabaseId, healthCheck->node->nodeId);
+			FreeHealthCheck(healthCheck);
+		}
 	}
 
-	return healthCheckList;
+	list_free(healthCheckList);
+
+	MemoryContextSwitchTo(oldContext);
+
+	hash_destroy(healthCheckHash);
+
+	return newHealthCheckList;
 }
 
 
 /*
  * CreateHealthCheck creates a health check from a health check description.
+ * The health check and its own copy of the description are allocated in the
+ * current memory context.
  */
 static HealthCheck *
 CreateHealthCheck(NodeHealth *nodeHealth)
 {
-	struct timeval invalidTime = { 0, 0 };
+	NodeHealth *node = palloc0(sizeof(NodeHealth));
+
+	node->nodeId = nodeHealth->nodeId;
+	node->nodeName = pstrdup(nodeHealth->nodeName);
+	node->nodeHost = pstrdup(nodeHealth->nodeHost);
+	node->nodePort = nodeHealth->nodePort;
+	node->isPrimary = nodeHealth->isPrimary;
+	node->healthState = nodeHealth->healthState;
+	node->checkedHealthState = NODE_HEALTH_UNKNOWN;
+	node->tcpUserTimeout = nodeHealth->tcpUserTimeout;
+	node->healthCheckPeriod = nodeHealth->healthCheckPeriod;
+	node->healthCheckTimeout = nodeHealth->healthCheckTimeout;
 
 	HealthCheck *healthCheck = palloc0(sizeof(HealthCheck));
-	healthCheck->node = nodeHealth;
+	healthCheck->node = node;
 	healthCheck->state = HEALTH_CHECK_INITIAL;
 	healthCheck->connection = NULL;
-	healthCheck->numTries = 0;
-	healthCheck->nextEventTime = invalidTime;
 
 	return healthCheck;
 }
 
 
 /*
- * DoHealthChecks performs the given health checks.
+ * FreeHealthCheck closes the connection of the health check, if any, and
+ * frees it.
  */
 static void
-DoHealthChecks(List *healthCheckList)
+FreeHealthCheck(HealthCheck *healthCheck)
 {
-	while (!got_sigterm)
+	if (healthCheck->connection != NULL)
 	{
-		int pendingCheckCount = 0;
-		struct timeval currentTime = { 0, 0 };
-		ListCell *healthCheckCell = NULL;
+		PQfinish(healthCheck->connection);
+	}
 
-		gettimeofday(&currentTime, NULL);
+	pfree(healthCheck->node->nodeName);
+	pfree(healthCheck->node->nodeHost);
+	pfree(healthCheck->node);
+	pfree(healthCheck);
+}
 
-		foreach(healthCheckCell, healthCheckList)
-		{
-			HealthCheck *healthCheck = (HealthCheck *) lfirst(healthCheckCell);
 
-			ManageHealthCheck(healthCheck, currentTime);
+/*
+ * StartHealthCheckRound resets the per-round state of the health checks. When
+ * pgautofailover.health_check_keepalive is on, the connections that succeeded
+ * in the previous round are kept, and the next check only sends a probe.
+ *
+ * The nodes whose keeper has recently reported a running Postgres are not
+ * probed at all: their check is done and good from the start. The nodes
+ * that are in backoff are not probed either, and their health is left
+ * unchanged, unless their keeper has reported since they failed. The same
+ * goes for the nodes of a formation with a longer health check period than
+ * the round, until their period has elapsed.
+ *
+ * The checks are spread over pgautofailover.health_check_spread percent of
+ * the round, each node starting at the same phase in every round, so that
+ * the period between two checks of a node stays the same.
+ */
+static void
+StartHealthCheckRound(List *healthCheckList, int roundPeriod)
+{
+	ListCell *healthCheckCell = NULL;
+	struct timeval invalidTime = { 0, 0 };
+	struct timeval roundStartTime = { 0, 0 };
+	TimestampTz now = GetCurrentTimestamp();
 
-			if (healthCheck->state != HEALTH_CHECK_OK &&
-				healthCheck->state != HEALTH_CHECK_DEAD)
-			{
-				pendingCheckCount++;
-			}
+	gettimeofday(&roundStartTime, NULL);
+
+	foreach(healthCheckCell, healthCheckList)
+	{
+		HealthCheck *healthCheck = (HealthCheck *) lfirst(healthCheckCell);
+
+		if (healthCheck->connection != NULL && !HealthCheckKeepAlive)
+		{
+			PQfinish(healthCheck->connection);
+			healthCheck->connection = NULL;
 		}
-		if (pendingCheckCount == 0)
+
+		healthCheck->node->checkedHealthState = NODE_HEALTH_UNKNOWN;
+		healthCheck->state = HEALTH_CHECK_INITIAL;
+		healthCheck->readyToPoll = false;
+		healthCheck->numTries = 0;
+		healthCheck->nextEventTime = invalidTime;
+		healthCheck->waitEventPos = -1;
+		healthCheck->waitEvents = 0;
+		healthCheck->waitEventSocket = PGINVALID_SOCKET;
+		healthCheck->waitEventAddr = NULL;
+		healthCheck->hasTimer = false;
+		healthCheck->done = false;
+		healthCheck->attemptStartTime = invalidTime;
+		healthCheck->connectLatency = -1;
+		healthCheck->responseLatency = -1;
+		healthCheck->retryCount = 0;
+		healthCheck->connectionCount = 0;
+		healthCheck->connecting = false;
+		healthCheck->waitingForConnect = false;
+		healthCheck->probeOnNewConnection = false;
+		healthCheck->failedAddressCount = 0;
+		healthCheck->transitionSuppressed = false;
+		healthCheck->startTime =
+			AddTimeMillis(roundStartTime,
+						  NodeHealthCheckPhase(healthCheck->node, roundPeriod));
+
+		/* a keeper report resets the backoff right away */
+		if (healthCheck->deadSince != 0 &&
+			healthCheck->node->reportTime > healthCheck->deadSince)
 		{
-			break;
+			healthCheck->deadSince = 0;
+			healthCheck->nextCheckTime = 0;
+			healthCheck->backoffDelay = 0;
 		}
 
-		WaitForEvent(healthCheckList);
+		/* allow for half a round of jitter in when the rounds start */
+		int checkPeriod =
+			NodeHealthCheckPeriod(healthCheck->node) - roundPeriod / 2;
+
+		if (healthCheck->node->reportedAlive)
+		{
+			healthCheck->node->checkedHealthState = NODE_HEALTH_GOOD;
+			healthCheck->state = HEALTH_CHECK_OK;
+			healthCheck->lastCheckTime = now;
+		}
+		else if (healthCheck->nextCheckTime > now)
+		{
+			/* the check is done, and the health of the node is unknown */
+			healthCheck->state = HEALTH_CHECK_DEAD;
+		}
+		else if (healthCheck->lastCheckTime != 0 &&
+				 !TimestampDifferenceExceeds(healthCheck->lastCheckTime, now,
+											 checkPeriod))
+		{
+			/* not due yet: keep the health, and the connection, unchanged */
+			healthCheck->state = HEALTH_CHECK_OK;
+		}
+		else
+		{
+			healthCheck->lastCheckTime = now;
+		}
 	}
 }
 
 
 /*
- * WaitForEvent sleeps until a time-based or I/O event occurs in any of the health
- * checks.
+ * HealthCheckRoundPeriod returns the duration of a round of health checks:
+ * pgautofailover.health_check_period, or the shortest health check period of
+ * the formations of the nodes we check.
  */
 static int
-WaitForEvent(List *healthCheckList)
+HealthCheckRoundPeriod(List *healthCheckList)
 {
 	ListCell *healthCheckCell = NULL;
-	int healthCheckCount = list_length(healthCheckList);
-	struct timeval currentTime = { 0, 0 };
-	struct timeval nextEventTime = { 0, 0 };
-	int healthCheckIndex = 0;
+	int roundPeriod = HealthCheckPeriod;
 
-	struct pollfd *pollFDs = (struct pollfd *) palloc0(healthCheckCount * sizeof(struct
-																				 pollfd));
+	foreach(healthCheckCell, healthCheckList)
+	{
+		HealthCheck *healthCheck = (HealthCheck *) lfirst(healthCheckCell);
+		int nodePeriod = NodeHealthCheckPeriod(healthCheck->node);
 
-	gettimeofday(&currentTime, NULL);
+		if (nodePeriod < roundPeriod)
+		{
+			roundPeriod = nodePeriod;
+		}
+	}
+
+	return roundPeriod;
+}
+
+
+/*
+ * NodeHealthCheckPeriod returns the health check period of the formation of
+ * the given node, or pgautofailover.health_check_period.
+ */
+static int
+NodeHealthCheckPeriod(NodeHealth *node)
+{
+	return node->healthCheckPeriod > 0
+		   ? node->healthCheckPeriod
+		   : HealthCheckPeriod;
+}
+
+
+/*
+ * NodeHealthCheckTimeout returns the health check timeout of the formation of
+ * the given node, or pgautofailover.health_check_timeout.
+ */
+static int
+NodeHealthCheckTimeout(NodeHealth *node)
+{
+	return node->healthCheckTimeout > 0
+		   ? node->healthCheckTimeout
+		   : HealthCheckTimeout;
+}
+
+
+/*
+ * NodeHealthCheckPhase returns the delay, in milliseconds from the start of
+ * a round, at which the given node is checked. The phase is derived from the
+ * node id with Fibonacci hashing, which spreads consecutive node ids evenly
+ * over the first pgautofailover.health_check_spread percent of the round.
+ */
+static int
+NodeHealthCheckPhase(NodeHealth *node, int roundPeriod)
+{
+	uint64 window = (uint64) roundPeriod * HealthCheckSpread / 100;
+	uint64 fraction =
+		((uint64) node->nodeId * UINT64CONST(0x9E3779B97F4A7C15)) >> 32;
+
+	return (int) ((fraction * window) >> 32);
+}
+
+
+/*
+ * FinishHealthCheckRound closes the connections that we do not keep for the
+ * next round, and registers the health state that has just been applied.
+ */
+static void
+FinishHealthCheckRound(List *healthCheckList)
+{
+	ListCell *healthCheckCell = NULL;
+	TimestampTz now = GetCurrentTimestamp();
 
 	foreach(healthCheckCell, healthCheckList)
 	{
 		HealthCheck *healthCheck = (HealthCheck *) lfirst(healthCheckCell);
-		struct pollfd *pollFileDescriptor = &pollFDs[healthCheckIndex];
+		NodeHealth *nodeHealth = healthCheck->node;
 
-		pollFileDescriptor->fd = -1;
-		pollFileDescriptor->events = 0;
-		pollFileDescriptor->revents = 0;
+		/* a round interrupted by SIGTERM leaves checks in progress */
+		if (healthCheck->connection != NULL &&
+			(healthCheck->state != HEALTH_CHECK_OK || !HealthCheckKeepAlive))
+		{
+			PQfinish(healthCheck->connection);
+			healthCheck->connection = NULL;
+		}
 
-		if (healthCheck->state == HEALTH_CHECK_CONNECTING ||
-			healthCheck->state == HEALTH_CHECK_RETRY)
+		if (nodeHealth->checkedHealthState != NODE_HEALTH_UNKNOWN)
 		{
-			bool hasTimeout = healthCheck->nextEventTime.tv_sec != 0;
+			nodeHealth->healthState = nodeHealth->checkedHealthState;
+		}
 
-			if (hasTimeout &&
-				(nextEventTime.tv_sec == 0 ||
-				 CompareTimes(&healthCheck->nextEventTime, &nextEventTime) < 0))
-			{
-				nextEventTime = healthCheck->nextEventTime;
-			}
+		UpdateHealthCheckBackoff(healthCheck, now);
+	}
+}
+
+
+/*
+ * DampHealthTransitions keeps the current health of the nodes whose checks
+ * found a different health in this round, until the change settles: each
+ * health change brings an event, a notification to every keeper, and a run
+ * of the group state machine, and a node on a marginal network link would
+ * otherwise produce a stream of them.
+ *
+ * The new health must be found pgautofailover.health_flap_samples rounds in
+ * a row, and at least pgautofailover.health_flap_min_interval must have
+ * elapsed since the previous health change of the node. Until then, the
+ * check counts as a suppressed transition in the health check statistics.
+ * New nodes, whose health is still unknown, are not damped.
+ */
+static void
+DampHealthTransitions(List *healthCheckList)
+{
+	ListCell *healthCheckCell = NULL;
+	TimestampTz now = GetCurrentTimestamp();
+
+	foreach(healthCheckCell, healthCheckList)
+	{
+		HealthCheck *healthCheck = (HealthCheck *) lfirst(healthCheckCell);
+		NodeHealth *nodeHealth = healthCheck->node;
+		NodeHealthState checkedHealthState = nodeHealth->checkedHealthState;
+
+		/* skipped checks, and checks interrupted by SIGTERM */
+		if (checkedHealthState == NODE_HEALTH_UNKNOWN)
+		{
+			continue;
 		}
 
-		if (healthCheck->state == HEALTH_CHECK_CONNECTING)
+		if (nodeHealth->healthState == NODE_HEALTH_UNKNOWN ||
+			checkedHealthState == nodeHealth->healthState)
 		{
-			PGconn *connection = healthCheck->connection;
-			int pollEventMask = 0;
+			healthCheck->pendingHealthCount = 0;
+			continue;
+		}
 
-			if (healthCheck->pollingStatus == PGRES_POLLING_READING)
-			{
-				pollEventMask = POLLIN;
-			}
-			else if (healthCheck->pollingStatus == PGRES_POLLING_WRITING)
-			{
-				pollEventMask = POLLOUT;
-			}
+		if (healthCheck->pendingHealthCount == 0 ||
+			healthCheck->pendingHealthState != checkedHealthState)
+		{
+			healthCheck->pendingHealthState = checkedHealthState;
+			healthCheck->pendingHealthCount = 0;
+		}
+
+		healthCheck->pendingHealthCount++;
 
-			pollFileDescriptor->fd = PQsocket(connection);
-			pollFileDescriptor->events = pollEventMask;
+		bool settling = healthCheck->pendingHealthCount < HealthFlapSamples;
+		bool rateLimited =
+			HealthFlapMinInterval > 0 &&
+			healthCheck->lastTransitionTime != 0 &&
+			!TimestampDifferenceExceeds(healthCheck->lastTransitionTime, now,
+										HealthFlapMinInterval);
+
+		if (settling || rateLimited)
+		{
+			elog(DEBUG1,
+				 "Node " INT64_FORMAT " (%s:%d) stays %s: %s",
+				 nodeHealth->nodeId,
+				 nodeHealth->nodeHost,
+				 nodeHealth->nodePort,
+				 NodeHealthToString(nodeHealth->healthState),
+				 settling
+				 ? "health change not confirmed yet"
+				 : "health changed too recently");
+
+			nodeHealth->checkedHealthState = nodeHealth->healthState;
+			healthCheck->transitionSuppressed = true;
+			continue;
 		}
 
-		healthCheckIndex++;
+		healthCheck->pendingHealthCount = 0;
+		healthCheck->lastTransitionTime = now;
 	}
+}
+
+
+/*
+ * CheckResult returns the health found by the check of the current round,
+ * before DampHealthTransitions possibly kept the current health instead.
+ */
+static NodeHealthState
+CheckResult(HealthCheck *healthCheck)
+{
+	return healthCheck->transitionSuppressed
+		   ? healthCheck->pendingHealthState
+		   : healthCheck->node->checkedHealthState;
+}
+
+
+/*
+ * UpdateHealthCheckBackoff keeps track of how long the node has been failing
+ * its health checks. Once that's longer than
+ * pgautofailover.health_check_backoff_threshold, each failed check doubles
+ * the delay until the next one, up to
+ * pgautofailover.health_check_backoff_max_delay. A successful check resets
+ * the backoff.
+ */
+static void
+UpdateHealthCheckBackoff(HealthCheck *healthCheck, TimestampTz now)
+{
+	NodeHealthState checkedHealthState = CheckResult(healthCheck);
 
-	int pollTimeout = SubtractTimes(nextEventTime, currentTime);
-	if (pollTimeout < 0)
+	if (HealthCheckBackoffThreshold <= 0 ||
+		checkedHealthState == NODE_HEALTH_GOOD)
 	{
-		pollTimeout = 0;
+		healthCheck->deadSince = 0;
+		healthCheck->nextCheckTime = 0;
+		healthCheck->backoffDelay = 0;
+		return;
 	}
-	else if (pollTimeout > HealthCheckRetryDelay)
+
+	/* skipped checks, and checks interrupted by SIGTERM */
+	if (checkedHealthState != NODE_HEALTH_BAD)
 	{
-		pollTimeout = HealthCheckRetryDelay;
+		return;
 	}
 
-	int pollResult = poll(pollFDs, healthCheckCount, pollTimeout);
+	if (healthCheck->deadSince == 0)
+	{
+		healthCheck->deadSince = now;
+	}
 
-	if (pollResult < 0)
+	if (!TimestampDifferenceExceeds(healthCheck->deadSince, now,
+									HealthCheckBackoffThreshold))
 	{
-		return STATUS_ERROR;
+		return;
 	}
 
-	healthCheckIndex = 0;
+	healthCheck->backoffDelay =
+		healthCheck->backoffDelay == 0
+		? NodeHealthCheckPeriod(healthCheck->node)
+		: Min(healthCheck->backoffDelay, HealthCheckBackoffMaxDelay / 2) * 2;
 
-	foreach(healthCheckCell, healthCheckList)
-	{
-		HealthCheck *healthCheck = (HealthCheck *) lfirst(healthCheckCell);
-		struct pollfd *pollFileDescriptor = &pollFDs[healthCheckIndex];
+	healthCheck->backoffDelay =
+		Min(healthCheck->backoffDelay, HealthCheckBackoffMaxDelay);
 
-		healthCheck->readyToPoll = pollFileDescriptor->revents != 0;
+	healthCheck->nextCheckTime =
+		TimestampTzPlusMilliseconds(now, healthCheck->backoffDelay);
 
-		healthCheckIndex++;
+	if (healthCheck->backoffDelay < HealthCheckBackoffMaxDelay)
+	{
+		elog(DEBUG1,
+			 "Node " INT64_FORMAT " (%s:%d) has been failing health checks "
+			 "since %s, next check in %dms",
+			 healthCheck->node->nodeId,
+			 healthCheck->node->nodeHost,
+			 healthCheck->node->nodePort,
+			 timestamptz_to_str(healthCheck->deadSince),
+			 healthCheck->backoffDelay);
 	}
-
-	return 0;
 }
 
 
 /*
- * LatchWait sleeps on the process latch until a timeout occurs.
+ * DoHealthChecks performs the given health checks.
+ *
+ * Each health check starts at the phase of its node in the round, then we
+ * only visit the checks for which an I/O event or a timer is due, until every
+ * check is done.
  */
 static void
-LatchWait(long timeoutMs)
+DoHealthChecks(List *healthCheckList)
 {
-	int waitResult = 0;
+	struct timeval currentTime = { 0, 0 };
+	ListCell *healthCheckCell = NULL;
 
-	/*
-	 * Background workers mustn't call usleep() or any direct equivalent:
-	 * instead, they may wait on their process latch, which sleeps as
-	 * necessary, but is awakened if postmaster dies.  That way the
-	 * background process goes away immediately in an emergency.
-	 */
-#if (PG_VERSION_NUM >= 100000)
-	waitResult = WaitLatch(MyLatch,
-						   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
-						   timeoutMs, WAIT_EVENT_CLIENT_READ);
-#else
-	waitResult = WaitLatch(MyLatch,
-						   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
-						   timeoutMs);
-#endif
+	StartHealthCheckEventLoop(healthCheckList);
 
-	ResetLatch(MyLatch);
+	gettimeofday(&currentTime, NULL);
 
-	/* emergency bailout if postmaster has died */
-	if (waitResult & WL_POSTMASTER_DEATH)
+	foreach(healthCheckCell, healthCheckList)
 	{
-		elog(LOG, "pg_auto_failover monitor exiting");
+		HealthCheck *healthCheck = (HealthCheck *) lfirst(healthCheckCell);
 
-		proc_exit(1);
+		ManageHealthCheck(healthCheck, currentTime);
+		UpdateHealthCheckEvents(healthCheck, currentTime);
 	}
-}
-
 
-/*
- * ManageHealthCheck proceeds the health check state machine.
- */
-static void
-ManageHealthCheck(HealthCheck *healthCheck, struct timeval currentTime)
-{
-	HealthCheckState checkState = healthCheck->state;
-	NodeHealth *nodeHealth = healthCheck->node;
+	StartWaitingHealthChecks(currentTime);
 
-	switch (checkState)
+	while (!got_sigterm && EventLoop->pendingCheckCount > 0)
 	{
-		case HEALTH_CHECK_RETRY:
+		int eventCount = WaitForEvents();
+
+		gettimeofday(&currentTime, NULL);
+
+		for (int eventIndex = 0; eventIndex < eventCount; eventIndex++)
 		{
-			if (healthCheck->numTries >= HealthCheckMaxRetries + 1)
-			{
-				SetNodeHealthState(healthCheck->node->nodeId,
-								   healthCheck->node->nodeName,
-								   healthCheck->node->nodeHost,
-								   healthCheck->node->nodePort,
-								   nodeHealth->healthState,
-								   NODE_HEALTH_BAD);
+			WaitEvent *event = &(EventLoop->occurredEvents[eventIndex]);
+			HealthCheck *healthCheck = (HealthCheck *) event->user_data;
 
-				healthCheck->state = HEALTH_CHECK_DEAD;
-				break;
+			if (!(event->events & WL_SOCKET_MASK) || healthCheck == NULL)
+			{
+				continue;
 			}
 
-			if (CompareTimes(&healthCheck->nextEventTime, &currentTime) > 0)
+			/*
+			 * A socket that has been closed since it was registered may still
+			 * be reported on platforms where the kernel does not drop it from
+			 * the set for us. Skip it and get rid of it before waiting again.
+			 */
+			if (healthCheck->waitEventPos != event->pos)
 			{
-				/* Retry time lies in the future */
-				break;
+				EventLoop->rebuildWaitEventSet = true;
+				continue;
 			}
 
-			/* Fall through to re-connect */
+			healthCheck->readyToPoll = true;
+			ManageHealthCheck(healthCheck, currentTime);
+			healthCheck->readyToPoll = false;
+
+			UpdateHealthCheckEvents(healthCheck, currentTime);
 		}
 
-		/* fallthrough */
-		case HEALTH_CHECK_INITIAL:
+		/*
+		 * Now process expired timers. Timers that are (re-)armed while doing
+		 * so are set in the future, or at currentTime at the earliest, so this
+		 * loop always terminates.
+		 */
+		while (!pairingheap_is_empty(EventLoop->timerHeap))
 		{
-			StringInfo connInfoString = makeStringInfo();
+			HealthCheck *healthCheck =
+				pairingheap_container(HealthCheck, timerNode,
+									  pairingheap_first(EventLoop->timerHeap));
 
-			appendStringInfo(connInfoString, CONN_INFO_TEMPLATE,
-							 nodeHealth->nodeHost, nodeHealth->nodePort,
-							 HealthCheckTimeout);
+			if (CompareTimes(&healthCheck->nextEventTime, &currentTime) >= 0)
+			{
+				break;
+			}
 
-			PGconn *connection = PQconnectStart(connInfoString->data);
-			PQsetnonblocking(connection, true);
+			(void) pairingheap_remove_first(EventLoop->timerHeap);
+			healthCheck->hasTimer = false;
 
-			ConnStatusType connStatus = PQstatus(connection);
-			if (connStatus == CONNECTION_BAD)
-			{
-				struct timeval nextTryTime = { 0, 0 };
+			ManageHealthCheck(healthCheck, currentTime);
+			UpdateHealthCheckEvents(healthCheck, currentTime);
+		}
 
-				PQfinish(connection);
+		StartWaitingHealthChecks(currentTime);
+	}
+}
 
-				nextTryTime = AddTimeMillis(currentTime, HealthCheckRetryDelay);
 
-				healthCheck->nextEventTime = nextTryTime;
-				healthCheck->connection = NULL;
-				healthCheck->pollingStatus = PGRES_POLLING_FAILED;
-				healthCheck->state = HEALTH_CHECK_RETRY;
-			}
+/*
+ * StartWaitingHealthChecks starts the health checks that are waiting for
+ * fewer than pgautofailover.health_check_max_connects connections to be in
+ * progress, in the order in which they were due.
+ */
+static void
+StartWaitingHealthChecks(struct timeval currentTime)
+{
+	while (EventLoop->waitingForConnectList != NIL &&
+		   (HealthCheckMaxConnects <= 0 ||
+			EventLoop->connectingCount < HealthCheckMaxConnects))
+	{
+		HealthCheck *healthCheck =
+			(HealthCheck *) linitial(EventLoop->waitingForConnectList);
+
+		EventLoop->waitingForConnectList =
+			list_delete_first(EventLoop->waitingForConnectList);
+
+		healthCheck->waitingForConnect = false;
+
+		ManageHealthCheck(healthCheck, currentTime);
+		UpdateHealthCheckEvents(healthCheck, currentTime);
+	}
+}
+
+
+/*
+ * StartHealthCheckEventLoop prepares the event loop for a new round of health
+ * checks. The WaitEventSet is reset when the previous round registered sockets
+ * in it, so that it never refers to health checks that have since been freed,
+ * and when it is too small for the current list of nodes.
+ */
+static void
+StartHealthCheckEventLoop(List *healthCheckList)
+{
+	int healthCheckCount = list_length(healthCheckList);
+
+	if (EventLoop == NULL)
+	{
+		MemoryContext eventLoopContext =
+			AllocSetContextCreate(TopMemoryContext,
+								  "Health check event loop context",
+								  ALLOCSET_DEFAULT_MINSIZE,
+								  ALLOCSET_DEFAULT_INITSIZE,
+								  ALLOCSET_DEFAULT_MAXSIZE);
+
+		EventLoop = (HealthCheckEventLoop *)
+					MemoryContextAllocZero(eventLoopContext,
+										   sizeof(HealthCheckEventLoop));
+
+		EventLoop->context = eventLoopContext;
+		EventLoop->rebuildWaitEventSet = true;
+
+		MemoryContext oldContext = MemoryContextSwitchTo(eventLoopContext);
+		EventLoop->timerHeap = pairingheap_allocate(CompareHealthCheckTimers, NULL);
+		MemoryContextSwitchTo(oldContext);
+	}
+
+	/* timers of the previous round, if any, belong to freed health checks */
+	pairingheap_reset(EventLoop->timerHeap);
+
+	EventLoop->healthCheckList = healthCheckList;
+	EventLoop->pendingCheckCount = healthCheckCount;
+	EventLoop->socketCount = 0;
+	EventLoop->connectingCount = 0;
+	EventLoop->waitingForConnectList = NIL;
+
+	if (EventLoop->waitEventSet == NULL ||
+		EventLoop->eventCount > HEALTH_CHECK_FIXED_EVENTS ||
+		EventLoop->maxEvents < HEALTH_CHECK_FIXED_EVENTS + healthCheckCount)
+	{
+		EventLoop->rebuildWaitEventSet = true;
+	}
+
+	if (EventLoop->rebuildWaitEventSet)
+	{
+		RebuildWaitEventSet(healthCheckCount);
+	}
+}
+
+
+/*
+ * RebuildWaitEventSet creates a new WaitEventSet with room for at least twice
+ * the given number of sockets, and registers the latch, the postmaster death
+ * event, and the sockets of the health checks that are currently connecting.
+ */
+static void
+RebuildWaitEventSet(int socketCount)
+{
+	ListCell *healthCheckCell = NULL;
+	MemoryContext oldContext = MemoryContextSwitchTo(EventLoop->context);
+
+	int maxSockets = Max(HEALTH_CHECK_MIN_SOCKET_EVENTS, 2 * socketCount);
+
+	if (EventLoop->waitEventSet != NULL)
+	{
+		FreeWaitEventSet(EventLoop->waitEventSet);
+	}
+
+	if (EventLoop->occurredEvents != NULL)
+	{
+		pfree(EventLoop->occurredEvents);
+	}
+
+	EventLoop->maxEvents = HEALTH_CHECK_FIXED_EVENTS + maxSockets;
+	EventLoop->waitEventSet =
+		CreateWaitEventSet(EventLoop->context, EventLoop->maxEvents);
+	EventLoop->occurredEvents =
+		(WaitEvent *) palloc0(EventLoop->maxEvents * sizeof(WaitEvent));
+
+	AddWaitEventToSet(EventLoop->waitEventSet, WL_LATCH_SET, PGINVALID_SOCKET,
+					  MyLatch, NULL);
+	AddWaitEventToSet(EventLoop->waitEventSet, WL_POSTMASTER_DEATH,
+					  PGINVALID_SOCKET, NULL, NULL);
+
+	EventLoop->eventCount = HEALTH_CHECK_FIXED_EVENTS;
+	EventLoop->socketCount = 0;
+	EventLoop->rebuildWaitEventSet = false;
+
+	MemoryContextSwitchTo(oldContext);
+
+	foreach(healthCheckCell, EventLoop->healthCheckList)
+	{
+		HealthCheck *healthCheck = (HealthCheck *) lfirst(healthCheckCell);
+
+		if (healthCheck->waitEventPos >= 0)
+		{
+			healthCheck->waitEventPos = -1;
+
+			AddHealthCheckSocket(healthCheck,
+								 healthCheck->waitEventSocket,
+								 healthCheck->waitEvents);
+		}
+	}
+}
+
+
+/*
+ * UpdateHealthCheckEvents registers the socket and the timeout that the given
+ * health check is now waiting on, depending on its new state, and keeps track
+ * of the number of health checks that are not done yet.
+ */
+static void
+UpdateHealthCheckEvents(HealthCheck *healthCheck, struct timeval currentTime)
+{
+	pgsocket socket = PGINVALID_SOCKET;
+	struct addrinfo *addr = NULL;
+	uint32 events = 0;
+
+	if ((healthCheck->state == HEALTH_CHECK_CONNECTING ||
+		 healthCheck->state == HEALTH_CHECK_PROBING) &&
+		healthCheck->connection != NULL)
+	{
+		socket = PQsocket(healthCheck->connection);
+		addr = healthCheck->connection->addr_cur;
+		events = healthCheck->pollingStatus == PGRES_POLLING_READING
+				 ? WL_SOCKET_READABLE
+				 : WL_SOCKET_WRITEABLE;
+	}
+
+	/*
+	 * When the connection has been closed, or when libpq moved on to another
+	 * address of the host and opened a new socket, we forget about the old
+	 * registration. Closed sockets are dropped from epoll and kqueue sets by
+	 * the kernel, and otherwise we rebuild the set when they are reported.
+	 */
+	if (healthCheck->waitEventPos >= 0 &&
+		(socket == PGINVALID_SOCKET ||
+		 socket != healthCheck->waitEventSocket ||
+		 addr != healthCheck->waitEventAddr))
+	{
+		healthCheck->waitEventPos = -1;
+		healthCheck->waitEventSocket = PGINVALID_SOCKET;
+		healthCheck->waitEventAddr = NULL;
+		--EventLoop->socketCount;
+	}
+
+	if (socket != PGINVALID_SOCKET)
+	{
+		if (healthCheck->waitEventPos < 0)
+		{
+			healthCheck->waitEventAddr = addr;
+			AddHealthCheckSocket(healthCheck, socket, events);
+		}
+		else if (healthCheck->waitEvents != events)
+		{
+			ModifyWaitEvent(EventLoop->waitEventSet,
+							healthCheck->waitEventPos,
+							events,
+							NULL);
+			healthCheck->waitEvents = events;
+		}
+	}
+
+	bool connecting = healthCheck->state == HEALTH_CHECK_CONNECTING;
+
+	if (connecting != healthCheck->connecting)
+	{
+		healthCheck->connecting = connecting;
+		EventLoop->connectingCount += connecting ? 1 : -1;
+	}
+
+	if (healthCheck->hasTimer)
+	{
+		pairingheap_remove(EventLoop->timerHeap, &(healthCheck->timerNode));
+		healthCheck->hasTimer = false;
+	}
+
+	if (healthCheck->state == HEALTH_CHECK_INITIAL)
+	{
+		/* wait for a connection slot, or for the phase of the node */
+		if (healthCheck->waitingForConnect)
+		{
+			EventLoop->waitingForConnectList =
+				lappend(EventLoop->waitingForConnectList, healthCheck);
+		}
+		else
+		{
+			pairingheap_add(EventLoop->timerHeap, &(healthCheck->timerNode));
+			healthCheck->hasTimer = true;
+		}
+	}
+	else if (healthCheck->state == HEALTH_CHECK_CONNECTING ||
+			 healthCheck->state == HEALTH_CHECK_PROBING ||
+			 healthCheck->state == HEALTH_CHECK_RETRY)
+	{
+		/* when out of retries, the check is marked dead at the next wakeup */
+		if (healthCheck->state == HEALTH_CHECK_RETRY &&
+			healthCheck->numTries >= HealthCheckMaxRetries + 1)
+		{
+			healthCheck->nextEventTime = currentTime;
+		}
+
+		pairingheap_add(EventLoop->timerHeap, &(healthCheck->timerNode));
+		healthCheck->hasTimer = true;
+	}
+	else if ((healthCheck->state == HEALTH_CHECK_OK ||
+			  healthCheck->state == HEALTH_CHECK_DEAD) &&
+			 !healthCheck->done)
+	{
+		healthCheck->done = true;
+		--EventLoop->pendingCheckCount;
+	}
+}
+
+
+/*
+ * AddHealthCheckSocket adds the given socket to the WaitEventSet, rebuilding
+ * the set first when it is full.
+ */
+static void
+AddHealthCheckSocket(HealthCheck *healthCheck, pgsocket socket, uint32 events)
+{
+	if (EventLoop->eventCount >= EventLoop->maxEvents)
+	{
+		RebuildWaitEventSet(EventLoop->socketCount + 1);
+	}
+
+	healthCheck->waitEventPos =
+		AddWaitEventToSet(EventLoop->waitEventSet, events, socket, NULL,
+						  (void *) healthCheck);
+	healthCheck->waitEvents = events;
+	healthCheck->waitEventSocket = socket;
+
+	++EventLoop->eventCount;
+	++EventLoop->socketCount;
+}
+
+
+/*
+ * CompareHealthCheckTimers orders health checks by nextEventTime. The pairing
+ * heap keeps the greatest element first, so we reverse the comparison to have
+ * the earliest timer first.
+ */
+static int
+CompareHealthCheckTimers(const pairingheap_node *a,
+						 const pairingheap_node *b,
+						 void *arg)
+{
+	const HealthCheck *left = pairingheap_const_container(HealthCheck, timerNode, a);
+	const HealthCheck *right = pairingheap_const_container(HealthCheck, timerNode, b);
+
+	return CompareTimes((struct timeval *) &(right->nextEventTime),
+						(struct timeval *) &(left->nextEventTime));
+}
+
+
+/*
+ * WaitForEvents sleeps until a time-based or I/O event occurs in any of the
+ * health checks, or until our latch is set, and returns how many events are
+ * available in EventLoop->occurredEvents.
+ */
+static int
+WaitForEvents(void)
+{
+	struct timeval currentTime = { 0, 0 };
+	long timeout = HealthCheckRetryDelay;
+
+	if (EventLoop->rebuildWaitEventSet)
+	{
+		RebuildWaitEventSet(EventLoop->socketCount);
+	}
+
+	if (!pairingheap_is_empty(EventLoop->timerHeap))
+	{
+		HealthCheck *healthCheck =
+			pairingheap_container(HealthCheck, timerNode,
+								  pairingheap_first(EventLoop->timerHeap));
+
+		gettimeofday(&currentTime, NULL);
+
+		timeout = SubtractTimes(healthCheck->nextEventTime, currentTime);
+
+		if (timeout < 0)
+		{
+			timeout = 0;
+		}
+		else if (timeout > HealthCheckRetryDelay)
+		{
+			timeout = HealthCheckRetryDelay;
+		}
+	}
+
+	int eventCount = WaitEventSetWait(EventLoop->waitEventSet,
+									  timeout,
+									  EventLoop->occurredEvents,
+									  EventLoop->maxEvents,
+									  WAIT_EVENT_CLIENT_READ);
+
+	for (int eventIndex = 0; eventIndex < eventCount; eventIndex++)
+	{
+		WaitEvent *event = &(EventLoop->occurredEvents[eventIndex]);
+
+		if (event->events & WL_POSTMASTER_DEATH)
+		{
+			elog(LOG, "pg_auto_failover monitor exiting");
+
+			proc_exit(1);
+		}
+
+		if (event->events & WL_LATCH_SET)
+		{
+			ResetLatch(MyLatch);
+		}
+	}
+
+	return eventCount;
+}
+
+
+/*
+ * AppendSocketOptions appends the TCP keepalive and user timeout options of
+ * the health check connections to the given connection string. A zero value
+ * keeps the system default, and the formation's health_check_tcp_user_timeout
+ * takes precedence over pgautofailover.health_check_tcp_user_timeout.
+ *
+ * With persistent connections, a dead peer is then noticed by the kernel as
+ * soon as a probe is not acknowledged in time, rather than after the
+ * connect_timeout of a new connection.
+ */
+static void
+AppendSocketOptions(StringInfo connInfoString, NodeHealth *node)
+{
+	int tcpUserTimeout = node->tcpUserTimeout > 0
+						 ? node->tcpUserTimeout
+						 : HealthCheckTcpUserTimeout;
+
+	if (HealthCheckKeepAlivesIdle > 0)
+	{
+		appendStringInfo(connInfoString, " keepalives_idle=%d",
+						 HealthCheckKeepAlivesIdle);
+	}
+
+	if (HealthCheckKeepAlivesInterval > 0)
+	{
+		appendStringInfo(connInfoString, " keepalives_interval=%d",
+						 HealthCheckKeepAlivesInterval);
+	}
+
+	if (HealthCheckKeepAlivesCount > 0)
+	{
+		appendStringInfo(connInfoString, " keepalives_count=%d",
+						 HealthCheckKeepAlivesCount);
+	}
+
+#ifdef HAVE_TCP_USER_TIMEOUT
+	if (tcpUserTimeout > 0)
+	{
+		appendStringInfo(connInfoString, " tcp_user_timeout=%d",
+						 tcpUserTimeout);
+	}
+#else
+	(void) tcpUserTimeout;
+#endif
+}
+
+
+/*
+ * LookupResolvedHost returns the cache entry of the given host name, and
+ * creates it when asked to. It returns NULL when the name is not found, or
+ * when it does not need resolving: a numeric address, a Unix socket
+ * directory, or a name too long for our cache.
+ */
+static ResolvedHost *
+LookupResolvedHost(const char *hostname, bool create)
+{
+	char key[RESOLVED_HOST_NAME_MAXLEN] = { 0 };
+	struct in6_addr address;
+	bool found = false;
+
+	if (hostname == NULL ||
+		hostname[0] == '\0' ||
+		hostname[0] == '/' ||
+		strlen(hostname) >= RESOLVED_HOST_NAME_MAXLEN ||
+		inet_pton(AF_INET, hostname, &address) == 1 ||
+		inet_pton(AF_INET6, hostname, &address) == 1)
+	{
+		return NULL;
+	}
+
+	if (ResolvedHostHash == NULL)
+	{
+		HASHCTL info;
+
+		memset(&info, 0, sizeof(info));
+		info.keysize = RESOLVED_HOST_NAME_MAXLEN;
+		info.entrysize = sizeof(ResolvedHost);
+		info.hcxt = TopMemoryContext;
+
+		ResolvedHostHash =
+			hash_create("pg_auto_failover resolved hosts", 64, &info,
+						HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	strlcpy(key, hostname, sizeof(key));
+
+	ResolvedHost *host =
+		(ResolvedHost *) hash_search(ResolvedHostHash, key,
+									 create ? HASH_ENTER : HASH_FIND,
+									 &found);
+
+	if (host != NULL && !found)
+	{
+		host->addressCount = 0;
+		host->preferredAddress = 0;
+		host->resolveTime = 0;
+		host->lastUseTime = 0;
+		host->failed = false;
+	}
+
+	return host;
+}
+
+
+/*
+ * AppendHostAddress adds the cached address of the node host to the
+ * connection string of its health check as hostaddr=, and keeps host= for
+ * the TLS verification. It returns false when the host name does not
+ * resolve, in which case the check fails without connecting.
+ *
+ * Before the host name is resolved between two rounds for the first time,
+ * libpq resolves it for us.
+ */
+static bool
+AppendHostAddress(StringInfo connInfoString, NodeHealth *node)
+{
+	if (HealthCheckDnsTtl <= 0)
+	{
+		return true;
+	}
+
+	ResolvedHost *host = LookupResolvedHost(node->nodeHost, true);
+
+	if (host == NULL)
+	{
+		return true;
+	}
+
+	host->lastUseTime = GetCurrentTimestamp();
+
+	if (host->addressCount > 0)
+	{
+		appendStringInfo(connInfoString, " hostaddr=%s",
+						 host->addresses[host->preferredAddress]);
+		return true;
+	}
+
+	return !host->failed;
+}
+
+
+/*
+ * TryNextHostAddress makes the next address of the node host the preferred
+ * one, after a failure to connect to the current one. It returns true when
+ * that address has not failed already in the current try.
+ */
+static bool
+TryNextHostAddress(HealthCheck *healthCheck)
+{
+	if (HealthCheckDnsTtl <= 0)
+	{
+		return false;
+	}
+
+	ResolvedHost *host = LookupResolvedHost(healthCheck->node->nodeHost, false);
+
+	if (host == NULL || host->addressCount <= 1)
+	{
+		return false;
+	}
+
+	host->preferredAddress = (host->preferredAddress + 1) % host->addressCount;
+
+	if (++healthCheck->failedAddressCount < host->addressCount)
+	{
+		return true;
+	}
+
+	healthCheck->failedAddressCount = 0;
+
+	return false;
+}
+
+
+/*
+ * RefreshResolvedHosts resolves the host names whose addresses have expired,
+ * or whose last lookup failed, until the given deadline: the start of the
+ * next round. We also forget about the host names that are not used anymore.
+ */
+static void
+RefreshResolvedHosts(struct timeval deadline)
+{
+	HASH_SEQ_STATUS status;
+	ResolvedHost *host = NULL;
+
+	if (ResolvedHostHash == NULL || HealthCheckDnsTtl <= 0)
+	{
+		return;
+	}
+
+	TimestampTz now = GetCurrentTimestamp();
+	long ttl = HealthCheckDnsTtl * 1000L;
+
+	hash_seq_init(&status, ResolvedHostHash);
+
+	while ((host = (ResolvedHost *) hash_seq_search(&status)) != NULL)
+	{
+		struct timeval currentTime = { 0, 0 };
+
+		if (TimestampDifferenceExceeds(host->lastUseTime, now,
+									   ttl * RESOLVED_HOST_EVICT_TTLS))
+		{
+			hash_search(ResolvedHostHash, host->hostname, HASH_REMOVE, NULL);
+			continue;
+		}
+
+		/* a failed lookup is retried at the next round */
+		long expiry = host->failed ? Min(ttl, HealthCheckPeriod) : ttl;
+
+		if (host->resolveTime != 0 &&
+			!TimestampDifferenceExceeds(host->resolveTime, now, expiry))
+		{
+			continue;
+		}
+
+		gettimeofday(&currentTime, NULL);
+
+		if (CompareTimes(&deadline, &currentTime) <= 0 ||
+			got_sigterm || got_sighup)
+		{
+			hash_seq_term(&status);
+			break;
+		}
+
+		ResolveHost(host);
+	}
+}
+
+
+/*
+ * ResolveHost resolves the host name of the given cache entry, and keeps its
+ * previous addresses when the lookup fails.
+ */
+static void
+ResolveHost(ResolvedHost *host)
+{
+	struct addrinfo hints;
+	struct addrinfo *lookup = NULL;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_ADDRCONFIG;
+
+	host->resolveTime = GetCurrentTimestamp();
+
+	int error = getaddrinfo(host->hostname, NULL, &hints, &lookup);
+
+	if (error != 0)
+	{
+		if (!host->failed)
+		{
+			ereport(LOG,
+					(errmsg("pg_auto_failover health check could not resolve "
+							"host \"%s\": %s",
+							host->hostname, gai_strerror(error)),
+					 host->addressCount > 0
+					 ? errdetail("Using the %d address(es) resolved previously.",
+								 host->addressCount)
+					 : 0));
+		}
+
+		host->failed = true;
+		return;
+	}
+
+	char previous[RESOLVED_HOST_ADDRESS_MAXLEN] = { 0 };
+
+	if (host->addressCount > 0)
+	{
+		strlcpy(previous, host->addresses[host->preferredAddress],
+				sizeof(previous));
+	}
+
+	host->addressCount = 0;
+	host->preferredAddress = 0;
+	host->failed = false;
+
+	for (struct addrinfo *ai = lookup;
+		 ai != NULL && host->addressCount < RESOLVED_HOST_MAX_ADDRESSES;
+		 ai = ai->ai_next)
+	{
+		char address[RESOLVED_HOST_ADDRESS_MAXLEN] = { 0 };
+		bool duplicate = false;
+
+		if (getnameinfo(ai->ai_addr, ai->ai_addrlen,
+						address, sizeof(address),
+						NULL, 0, NI_NUMERICHOST) != 0)
+		{
+			continue;
+		}
+
+		for (int i = 0; i < host->addressCount; i++)
+		{
+			if (strcmp(host->addresses[i], address) == 0)
+			{
+				duplicate = true;
+				break;
+			}
+		}
+
+		if (duplicate)
+		{
+			continue;
+		}
+
+		/* the address that answered last stays the preferred one */
+		if (strcmp(address, previous) == 0)
+		{
+			host->preferredAddress = host->addressCount;
+		}
+
+		strlcpy(host->addresses[host->addressCount++], address,
+				RESOLVED_HOST_ADDRESS_MAXLEN);
+	}
+
+	freeaddrinfo(lookup);
+}
+
+
+/*
+ * LatchWait sleeps on the process latch until a timeout occurs.
+ */
+static void
+LatchWait(long timeoutMs)
+{
+	int waitResult = 0;
+
+	/*
+	 * Background workers mustn't call usleep() or any direct equivalent:
+	 * instead, they may wait on their process latch, which sleeps as
+	 * necessary, but is awakened if postmaster dies.  That way the
+	 * background process goes away immediately in an emergency.
+	 */
+#if (PG_VERSION_NUM >= 100000)
+	waitResult = WaitLatch(MyLatch,
+						   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+						   timeoutMs, WAIT_EVENT_CLIENT_READ);
+#else
+	waitResult = WaitLatch(MyLatch,
+						   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+						   timeoutMs);
+#endif
+
+	ResetLatch(MyLatch);
+
+	/* emergency bailout if postmaster has died */
+	if (waitResult & WL_POSTMASTER_DEATH)
+	{
+		elog(LOG, "pg_auto_failover monitor exiting");
+
+		proc_exit(1);
+	}
+}
+
+
+/*
+ * ManageHealthCheck proceeds the health check state machine.
+ */
+static void
+ManageHealthCheck(HealthCheck *healthCheck, struct timeval currentTime)
+{
+	HealthCheckState checkState = healthCheck->state;
+	NodeHealth *nodeHealth = healthCheck->node;
+
+	switch (checkState)
+	{
+		case HEALTH_CHECK_RETRY:
+		{
+			if (healthCheck->numTries >= HealthCheckMaxRetries + 1)
+			{
+				nodeHealth->checkedHealthState = NODE_HEALTH_BAD;
+
+				healthCheck->state = HEALTH_CHECK_DEAD;
+				break;
+			}
+
+			if (CompareTimes(&healthCheck->nextEventTime, &currentTime) > 0)
+			{
+				/* Retry time lies in the future */
+				break;
+			}
+
+			healthCheck->retryCount++;
+
+			/* Fall through to re-connect */
+		}
+
+		/* fallthrough */
+		case HEALTH_CHECK_INITIAL:
+		{
+			if (checkState == HEALTH_CHECK_INITIAL)
+			{
+				/* the phase of the node in the round lies in the future */
+				if (CompareTimes(&healthCheck->startTime, &currentTime) > 0)
+				{
+					healthCheck->nextEventTime = healthCheck->startTime;
+					break;
+				}
+
+				/* don't open too many connections at once */
+				if (healthCheck->connection == NULL &&
+					HealthCheckMaxConnects > 0 &&
+					EventLoop->connectingCount >= HealthCheckMaxConnects)
+				{
+					healthCheck->waitingForConnect = true;
+					break;
+				}
+			}
+
+			/* probe the connection kept open from a previous round */
+			if (healthCheck->connection != NULL)
+			{
+				healthCheck->probeOnNewConnection = false;
+
+				if (SendHealthCheckProbe(healthCheck, currentTime))
+				{
+					break;
+				}
+
+				/* the connection is broken, open a new one */
+				PQfinish(healthCheck->connection);
+				healthCheck->connection = NULL;
+			}
+
+			StringInfo connInfoString = makeStringInfo();
+
+			appendStringInfo(connInfoString, CONN_INFO_TEMPLATE,
+							 nodeHealth->nodeHost, nodeHealth->nodePort,
+							 NodeHealthCheckTimeout(nodeHealth));
+
+			bool hostResolved = AppendHostAddress(connInfoString, nodeHealth);
+
+			AppendSocketOptions(connInfoString, nodeHealth);
+
+			healthCheck->attemptStartTime = currentTime;
+
+			PGconn *connection = NULL;
+			ConnStatusType connStatus = CONNECTION_BAD;
+
+			/* when the host name does not resolve, the try fails right away */
+			if (hostResolved)
+			{
+				connection = PQconnectStart(connInfoString->data);
+				PQsetnonblocking(connection, true);
+
+				/* each new connection costs a full (TLS) handshake */
+				healthCheck->connectionCount++;
+
+				connStatus = PQstatus(connection);
+			}
+
+			if (connStatus == CONNECTION_BAD)
+			{
+				struct timeval nextTryTime = { 0, 0 };
+
+				PQfinish(connection);
+
+				nextTryTime = AddTimeMillis(currentTime, HealthCheckRetryDelay);
+
+				/* the next address of the node is part of the same try */
+				if (TryNextHostAddress(healthCheck))
+				{
+					nextTryTime = currentTime;
+					healthCheck->numTries--;
+				}
+
+				healthCheck->nextEventTime = nextTryTime;
+				healthCheck->connection = NULL;
+				healthCheck->pollingStatus = PGRES_POLLING_FAILED;
+				healthCheck->state = HEALTH_CHECK_RETRY;
+			}
 			else
 			{
 				struct timeval timeoutTime = { 0, 0 };
 
-				timeoutTime = AddTimeMillis(currentTime, HealthCheckTimeout);
+				timeoutTime = AddTimeMillis(currentTime,
+											NodeHealthCheckTimeout(nodeHealth));
+
+				healthCheck->nextEventTime = timeoutTime;
+				healthCheck->connection = connection;
+				healthCheck->pollingStatus = PGRES_POLLING_WRITING;
+				healthCheck->state = HEALTH_CHECK_CONNECTING;
+			}
+
+			healthCheck->numTries++;
+
+			pfree(connInfoString->data);
+			pfree(connInfoString);
+
+			break;
+		}
+
+		case HEALTH_CHECK_CONNECTING:
+		{
+			PGconn *connection = healthCheck->connection;
+			PostgresPollingStatusType pollingStatus = PGRES_POLLING_FAILED;
+
+			if (CompareTimes(&healthCheck->nextEventTime, &currentTime) < 0)
+			{
+				struct timeval nextTryTime = { 0, 0 };
+
+				PQfinish(connection);
+
+				healthCheck->connection = NULL;
+				healthCheck->pollingStatus = pollingStatus;
+
+				/* we were only completing a keep-alive connection */
+				if (nodeHealth->checkedHealthState == NODE_HEALTH_GOOD)
+				{
+					healthCheck->numTries = 0;
+					healthCheck->state = HEALTH_CHECK_OK;
+					break;
+				}
+
+				/* the next try connects to the next address of the node */
+				(void) TryNextHostAddress(healthCheck);
+
+				nextTryTime = AddTimeMillis(currentTime, HealthCheckRetryDelay);
+
+				healthCheck->nextEventTime = nextTryTime;
+				healthCheck->state = HEALTH_CHECK_RETRY;
+				break;
+			}
+
+			if (!healthCheck->readyToPoll)
+			{
+				break;
+			}
+
+			/* This logic is taken from libpq's internal_ping (fe-connect.c) */
+			pollingStatus = PQconnectPoll(connection);
+			char *sqlstate = connection->last_sqlstate;
+			bool receivedSqlstate = (sqlstate != NULL && strlen(sqlstate) == 5);
+			bool cannotConnectNowSqlstate = (receivedSqlstate &&
+											 strcmp(sqlstate, CANNOT_CONNECT_NOW) == 0);
+
+			if (pollingStatus == PGRES_POLLING_OK ||
+
+			    /* an auth request means pg is running */
+				connection->auth_req_received ||
+
+			    /* any error but CANNOT_CONNECT means the db is accepting connections */
+				(receivedSqlstate && !cannotConnectNowSqlstate))
+			{
+				/*
+				 * With query probes, the node is only healthy once it has
+				 * answered the probe query on the completed connection. When
+				 * we can't log in, we are left with the startup packet.
+				 */
+				if (HealthCheckProbe != HEALTH_CHECK_PROBE_CONNECT &&
+					pollingStatus != PGRES_POLLING_FAILED)
+				{
+					if (pollingStatus == PGRES_POLLING_OK)
+					{
+						healthCheck->connectLatency =
+							SubtractTimesMicros(currentTime,
+												healthCheck->attemptStartTime);
+						healthCheck->probeOnNewConnection = true;
+
+						if (!SendHealthCheckProbe(healthCheck, currentTime))
+						{
+							PQfinish(connection);
+
+							healthCheck->connection = NULL;
+							RetryHealthCheckProbe(healthCheck, currentTime);
+						}
+						break;
+					}
+
+					healthCheck->pollingStatus = pollingStatus;
+					break;
+				}
+
+				/* a keep-alive connection is only measured once */
+				if (nodeHealth->checkedHealthState != NODE_HEALTH_GOOD)
+				{
+					healthCheck->connectLatency =
+						SubtractTimesMicros(currentTime,
+											healthCheck->attemptStartTime);
+				}
+
+				nodeHealth->checkedHealthState = NODE_HEALTH_GOOD;
+
+				/*
+				 * In keep-alive mode, complete the connection so that the
+				 * next rounds only have to send a probe on it.
+				 */
+				if (HealthCheckKeepAlive &&
+					(pollingStatus == PGRES_POLLING_READING ||
+					 pollingStatus == PGRES_POLLING_WRITING))
+				{
+					healthCheck->pollingStatus = pollingStatus;
+					break;
+				}
+
+				if (!HealthCheckKeepAlive || pollingStatus != PGRES_POLLING_OK)
+				{
+					PQfinish(connection);
+					healthCheck->connection = NULL;
+				}
+
+				healthCheck->numTries = 0;
+				healthCheck->state = HEALTH_CHECK_OK;
+			}
+			else if (pollingStatus == PGRES_POLLING_FAILED)
+			{
+				struct timeval nextTryTime = { 0, 0 };
+
+				PQfinish(connection);
+
+				nextTryTime = AddTimeMillis(currentTime, HealthCheckRetryDelay);
+
+				/* the next address of the node is part of the same try */
+				if (TryNextHostAddress(healthCheck))
+				{
+					nextTryTime = currentTime;
+					healthCheck->numTries--;
+				}
+
+				healthCheck->nextEventTime = nextTryTime;
+				healthCheck->connection = NULL;
+				healthCheck->state = HEALTH_CHECK_RETRY;
+			}
+			else
+			{
+				/* Health check is still connecting */
+			}
+
+			healthCheck->pollingStatus = pollingStatus;
+
+			break;
+		}
+
+		case HEALTH_CHECK_PROBING:
+		{
+			PGconn *connection = healthCheck->connection;
+			bool probeFailed = false;
+			bool probeError = false;
+
+			if (CompareTimes(&healthCheck->nextEventTime, &currentTime) < 0)
+			{
+				/* the node accepts connections but does not answer queries */
+				PQfinish(connection);
+
+				healthCheck->connection = NULL;
+				RetryHealthCheckProbe(healthCheck, currentTime);
+				break;
+			}
+
+			if (!healthCheck->readyToPoll)
+			{
+				break;
+			}
+
+			if (healthCheck->pollingStatus == PGRES_POLLING_WRITING)
+			{
+				int flushResult = PQflush(connection);
+
+				if (flushResult == 0)
+				{
+					healthCheck->pollingStatus = PGRES_POLLING_READING;
+				}
+
+				probeFailed = flushResult < 0;
+			}
+			else if (!PQconsumeInput(connection))
+			{
+				probeFailed = true;
+			}
+			else
+			{
+				while (!PQisBusy(connection))
+				{
+					PGresult *result = PQgetResult(connection);
+
+					if (result == NULL)
+					{
+						break;
+					}
+
+					/* such as the statement_timeout of the probe query */
+					if (PQresultStatus(result) == PGRES_FATAL_ERROR)
+					{
+						probeError = true;
+					}
+
+					PQclear(result);
+				}
+
+				if (!PQisBusy(connection))
+				{
+					if (PQstatus(connection) == CONNECTION_OK)
+					{
+						int64 responseLatency =
+							SubtractTimesMicros(currentTime,
+												healthCheck->attemptStartTime);
+						bool slowResponse =
+							HealthCheckProbe != HEALTH_CHECK_PROBE_CONNECT &&
+							HealthCheckSlowThreshold > 0 &&
+							responseLatency > HealthCheckSlowThreshold * 1000L;
+
+						healthCheck->responseLatency = responseLatency;
+
+						if (probeError || slowResponse)
+						{
+							/* a degraded node counts as a failed try */
+							elog(DEBUG1,
+								 "Node " INT64_FORMAT " (%s:%d) %s the health "
+								 "check probe in %.3f ms",
+								 nodeHealth->nodeId,
+								 nodeHealth->nodeHost,
+								 nodeHealth->nodePort,
+								 probeError ? "failed" : "was slow to answer",
+								 responseLatency / 1000.0);
+
+							RetryHealthCheckProbe(healthCheck, currentTime);
+							break;
+						}
+
+						nodeHealth->checkedHealthState = NODE_HEALTH_GOOD;
+
+						/* the connection was only completed to probe it */
+						if (!HealthCheckKeepAlive)
+						{
+							PQfinish(connection);
+							healthCheck->connection = NULL;
+						}
+
+						healthCheck->numTries = 0;
+						healthCheck->state = HEALTH_CHECK_OK;
+					}
+					else
+					{
+						probeFailed = true;
+					}
+				}
+			}
+
+			/* reconnect right away when the kept-alive connection is lost */
+			if (probeFailed)
+			{
+				PQfinish(connection);
+
+				healthCheck->connection = NULL;
+				healthCheck->state = HEALTH_CHECK_INITIAL;
+
+				ManageHealthCheck(healthCheck, currentTime);
+			}
+
+			break;
+		}
+
+		case HEALTH_CHECK_DEAD:
+		case HEALTH_CHECK_OK:
+		default:
+		{
+			/* Health check is done */
+		}
+	}
+}
+
+
+/*
+ * HealthCheckProbeQuery returns the query that probes the given node. In
+ * keep-alive mode with connection probes an empty query is enough. Query
+ * probes are bounded by a statement_timeout, and on the primary the write
+ * probe commits a transaction that has an xid, which makes Postgres flush a
+ * commit record to the WAL: that catches a stuck WAL disk without needing a
+ * heartbeat table on the node. The commit does not wait for the standby
+ * nodes, which have their own health checks.
+ */
+static const char *
+HealthCheckProbeQuery(HealthCheck *healthCheck)
+{
+	static char query[256];
+	NodeHealth *node = healthCheck->node;
+
+	if (HealthCheckProbe == HEALTH_CHECK_PROBE_CONNECT)
+	{
+		return "";
+	}
+
+	if (HealthCheckProbe == HEALTH_CHECK_PROBE_WRITE && node->isPrimary)
+	{
+		snprintf(query, sizeof(query),
+				 "SET statement_timeout TO %d; "
+				 "SET synchronous_commit TO local; "
+				 "SELECT pg_catalog.txid_current()",
+				 NodeHealthCheckTimeout(node));
+	}
+	else
+	{
+		snprintf(query, sizeof(query),
+				 "SET statement_timeout TO %d; SELECT 1",
+				 NodeHealthCheckTimeout(node));
+	}
+
+	return query;
+}
+
+
+/*
+ * RetryHealthCheckProbe schedules another try after a probe that timed out,
+ * failed, or was answered too slowly. The caller closes the connection when
+ * it can't be used anymore.
+ */
+static void
+RetryHealthCheckProbe(HealthCheck *healthCheck, struct timeval currentTime)
+{
+	/* a probe on a kept-alive connection is a try of its own */
+	if (!healthCheck->probeOnNewConnection)
+	{
+		healthCheck->numTries++;
+	}
+
+	healthCheck->nextEventTime = AddTimeMillis(currentTime, HealthCheckRetryDelay);
+	healthCheck->pollingStatus = PGRES_POLLING_FAILED;
+	healthCheck->state = HEALTH_CHECK_RETRY;
+}
+
+
+/*
+ * SendHealthCheckProbe sends the probe query on the connection that has been
+ * kept open to the node, and returns false when the connection is broken.
+ */
+static bool
+SendHealthCheckProbe(HealthCheck *healthCheck, struct timeval currentTime)
+{
+	PGconn *connection = healthCheck->connection;
+
+	if (PQstatus(connection) != CONNECTION_OK ||
+		!PQsendQuery(connection, HealthCheckProbeQuery(healthCheck)))
+	{
+		return false;
+	}
+
+	int flushResult = PQflush(connection);
+
+	if (flushResult < 0)
+	{
+		return false;
+	}
+
+	healthCheck->attemptStartTime = currentTime;
+	healthCheck->nextEventTime =
+		AddTimeMillis(currentTime, NodeHealthCheckTimeout(healthCheck->node));
+	healthCheck->pollingStatus =
+		flushResult == 0 ? PGRES_POLLING_READING : PGRES_POLLING_WRITING;
+	healthCheck->state = HEALTH_CHECK_PROBING;
+
+	return true;
+}
+
+
+/*
+ * CompareTime compares two timeval structs.
+ *
+ * If leftTime < rightTime, return -1
+ * If leftTime > rightTime, return 1
+ * else, return 0
+ */
+static int
+CompareTimes(struct timeval *leftTime, struct timeval *rightTime)
+{
+	int compareResult = 0;
+
+	if (leftTime->tv_sec < rightTime->tv_sec)
+	{
+		compareResult = -1;
+	}
+	else if (leftTime->tv_sec > rightTime->tv_sec)
+	{
+		compareResult = 1;
+	}
+	else if (leftTime->tv_usec < rightTime->tv_usec)
+	{
+		compareResult = -1;
+	}
+	else if (leftTime->tv_usec > rightTime->tv_usec)
+	{
+		compareResult = 1;
+	}
+	else
+	{
+		compareResult = 0;
+	}
+
+	return compareResult;
+}
 
-				healthCheck->nextEventTime = timeoutTime;
-				healthCheck->connection = connection;
-				healthCheck->pollingStatus = PGRES_POLLING_WRITING;
-				healthCheck->state = HEALTH_CHECK_CONNECTING;
-			}
 
-			healthCheck->numTries++;
+/*
+ * SubtractTimes subtract the ‘struct timeval’ values y from x,
+ * returning the result.
+ *
+ * From:
+ * http://www.gnu.org/software/libc/manual/html_node/Elapsed-Time.html
+ */
+static int
+SubtractTimes(struct timeval x, struct timeval y)
+{
+	int differenceMs = 0;
 
-			pfree(connInfoString->data);
-			pfree(connInfoString);
+	/* Perform the carry for the later subtraction by updating y. */
+	if (x.tv_usec < y.tv_usec)
+	{
+		int nsec = (y.tv_usec - x.tv_usec) / 1000000 + 1;
+		y.tv_usec -= 1000000 * nsec;
+		y.tv_sec += nsec;
+	}
 
-			break;
+	if (x.tv_usec - y.tv_usec > 1000000)
+	{
+		int nsec = (x.tv_usec - y.tv_usec) / 1000000;
+		y.tv_usec += 1000000 * nsec;
+		y.tv_sec -= nsec;
+	}
+
+	differenceMs += 1000 * (x.tv_sec - y.tv_sec);
+	differenceMs += (x.tv_usec - y.tv_usec) / 1000;
+
+	return differenceMs;
+}
+
+
+/*
+ * AddTimeMillis adds additionalMs milliseconds to a timeval.
+ */
+static struct timeval
+AddTimeMillis(struct timeval base, uint32 additionalMs)
+{
+	struct timeval result = { 0, 0 };
+
+	result.tv_sec = base.tv_sec + additionalMs / 1000;
+	result.tv_usec = base.tv_usec + (additionalMs % 1000) * 1000;
+
+	return result;
+}
+
+
+/*
+ * SubtractTimesMicros returns the number of microseconds from y to x.
+ */
+static int64
+SubtractTimesMicros(struct timeval x, struct timeval y)
+{
+	return (int64) (x.tv_sec - y.tv_sec) * 1000000 + (x.tv_usec - y.tv_usec);
+}
+
+
+/*
+ * HealthCheckWorkerShmemSize computes how much shared memory is required.
+ */
+size_t
+HealthCheckWorkerShmemSize(void)
+{
+	Size size = 0;
+
+	size = add_size(size, sizeof(HealthCheckHelperDatabase));
+
+	/*
+	 * We request enough shared memory to have one hash-table entry for each
+	 * worker process. We couldn't start more anyway, so there's little point
+	 * in allocating more.
+	 */
+	Size hashSize = hash_estimate_size(max_worker_processes,
+									   sizeof(HealthCheckHelperDatabase));
+	size = add_size(size, hashSize);
+
+	/* and one statistics entry per node, up to the configured maximum */
+	Size statsHashSize = hash_estimate_size(HealthCheckStatsMaxNodes,
+											sizeof(HealthCheckStats));
+	size = add_size(size, statsHashSize);
+
+	/* groups have at least one node, so that's enough deadlines too */
+	Size deadlineHashSize = hash_estimate_size(HealthCheckStatsMaxNodes,
+											   sizeof(GroupDeadline));
+	size = add_size(size, deadlineHashSize);
+
+	return size;
+}
+
+
+/*
+ * HealthCheckWorkerShmemInit initializes the requested shared memory for the
+ * maintenance daemon.
+ */
+static void
+HealthCheckWorkerShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	HASHCTL hashInfo;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	HealthCheckHelperControl =
+		(HealthCheckHelperControlData *)
+		ShmemInitStruct("pg_auto_failover Health Check Helper Daemon",
+						HealthCheckWorkerShmemSize(),
+						&alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		HealthCheckHelperControl->trancheId = LWLockNewTrancheId();
+		HealthCheckHelperControl->lockTrancheName =
+			"pg_auto_failover Health Check Daemon";
+		LWLockRegisterTranche(HealthCheckHelperControl->trancheId,
+							  HealthCheckHelperControl->lockTrancheName);
+
+		LWLockInitialize(&HealthCheckHelperControl->lock,
+						 HealthCheckHelperControl->trancheId);
+
+		LWLockInitialize(&HealthCheckHelperControl->statsLock,
+						 HealthCheckHelperControl->trancheId);
+
+		LWLockInitialize(&HealthCheckHelperControl->deadlineLock,
+						 HealthCheckHelperControl->trancheId);
+
+		pg_atomic_init_u64(&(HealthCheckHelperControl->nodeListGeneration), 0);
+	}
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(HealthCheckWorkerKey);
+	hashInfo.entrysize = sizeof(HealthCheckHelperDatabase);
+	hashInfo.hash = tag_hash;
+	int hashFlags = (HASH_ELEM | HASH_FUNCTION);
+
+	HealthCheckWorkerDBHash = ShmemInitHash("pg_auto_failover Database Hash",
+											max_worker_processes,
+											max_worker_processes,
+											&hashInfo, hashFlags);
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(HealthCheckStatsKey);
+	hashInfo.entrysize = sizeof(HealthCheckStats);
+
+	HealthCheckStatsHash = ShmemInitHash("pg_auto_failover Health Check Stats",
+										 HealthCheckStatsMaxNodes,
+										 HealthCheckStatsMaxNodes,
+										 &hashInfo,
+										 HASH_ELEM | HASH_BLOBS);
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(GroupDeadlineKey);
+	hashInfo.entrysize = sizeof(GroupDeadline);
+
+	GroupDeadlineHash = ShmemInitHash("pg_auto_failover Group Deadlines",
+									  HealthCheckStatsMaxNodes,
+									  HealthCheckStatsMaxNodes,
+									  &hashInfo,
+									  HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/*
+ * StopHealthCheckWorker stops the maintenance daemons for the given database
+ * and removes them from the Health Check Launcher control hash.
+ */
+void
+StopHealthCheckWorker(Oid databaseId)
+{
+	HASH_SEQ_STATUS status;
+	HealthCheckHelperDatabase *dbData = NULL;
+	List *workerPidList = NIL;
+	ListCell *workerPidCell = NULL;
+
+	LWLockAcquire(&HealthCheckHelperControl->lock, LW_EXCLUSIVE);
+
+	/* removing the entry just returned by hash_seq_search is allowed */
+	hash_seq_init(&status, HealthCheckWorkerDBHash);
+
+	while ((dbData = (HealthCheckHelperDatabase *) hash_seq_search(&status)) != NULL)
+	{
+		if (dbData->key.dboid != databaseId)
+		{
+			continue;
 		}
 
-		case HEALTH_CHECK_CONNECTING:
+		if (dbData->workerPid > 0)
 		{
-			PGconn *connection = healthCheck->connection;
-			PostgresPollingStatusType pollingStatus = PGRES_POLLING_FAILED;
+			workerPidList = lappend_int(workerPidList, dbData->workerPid);
+		}
 
-			if (CompareTimes(&healthCheck->nextEventTime, &currentTime) < 0)
-			{
-				struct timeval nextTryTime = { 0, 0 };
+		(void) hash_search(HealthCheckWorkerDBHash, &(dbData->key),
+						   HASH_REMOVE, NULL);
+	}
 
-				PQfinish(connection);
+	LWLockRelease(&HealthCheckHelperControl->lock);
 
-				nextTryTime = AddTimeMillis(currentTime, HealthCheckRetryDelay);
+	foreach(workerPidCell, workerPidList)
+	{
+		kill(lfirst_int(workerPidCell), SIGTERM);
+	}
 
-				healthCheck->nextEventTime = nextTryTime;
-				healthCheck->connection = NULL;
-				healthCheck->pollingStatus = pollingStatus;
-				healthCheck->state = HEALTH_CHECK_RETRY;
-				break;
-			}
+	list_free(workerPidList);
 
-			if (!healthCheck->readyToPoll)
-			{
-				break;
-			}
+	RemoveHealthCheckStats(databaseId, 0);
+	RemoveGroupDeadlines(databaseId);
+}
 
-			/* This logic is taken from libpq's internal_ping (fe-connect.c) */
-			pollingStatus = PQconnectPoll(connection);
-			char *sqlstate = connection->last_sqlstate;
-			bool receivedSqlstate = (sqlstate != NULL && strlen(sqlstate) == 5);
-			bool cannotConnectNowSqlstate = (receivedSqlstate &&
-											 strcmp(sqlstate, CANNOT_CONNECT_NOW) == 0);
 
-			if (pollingStatus == PGRES_POLLING_OK ||
+/*
+ * StopHealthCheckWorkerShard stops the maintenance daemon for the given
+ * database and shard, and removes it from the Health Check Launcher control
+ * hash.
+ */
+static void
+StopHealthCheckWorkerShard(Oid databaseId, int shard)
+{
+	bool found = false;
+	pid_t workerPid = 0;
+	HealthCheckWorkerKey key;
 
-			    /* an auth request means pg is running */
-				connection->auth_req_received ||
+	memset(&key, 0, sizeof(key));
+	key.dboid = databaseId;
+	key.shard = shard;
 
-			    /* any error but CANNOT_CONNECT means the db is accepting connections */
-				(receivedSqlstate && !cannotConnectNowSqlstate))
-			{
-				PQfinish(connection);
+	LWLockAcquire(&HealthCheckHelperControl->lock, LW_EXCLUSIVE);
 
-				SetNodeHealthState(healthCheck->node->nodeId,
-								   healthCheck->node->nodeName,
-								   healthCheck->node->nodeHost,
-								   healthCheck->node->nodePort,
-								   nodeHealth->healthState,
-								   NODE_HEALTH_GOOD);
+	HealthCheckHelperDatabase *dbData = (HealthCheckHelperDatabase *)
+										hash_search(HealthCheckWorkerDBHash,
+													&key, HASH_REMOVE, &found);
 
-				healthCheck->connection = NULL;
-				healthCheck->numTries = 0;
-				healthCheck->state = HEALTH_CHECK_OK;
-			}
-			else if (pollingStatus == PGRES_POLLING_FAILED)
-			{
-				struct timeval nextTryTime = { 0, 0 };
+	if (found)
+	{
+		workerPid = dbData->workerPid;
+	}
 
-				PQfinish(connection);
+	LWLockRelease(&HealthCheckHelperControl->lock);
+
+	if (workerPid > 0 && workerPid != MyProcPid)
+	{
+		kill(workerPid, SIGTERM);
+	}
+}
+
+
+/*
+ * RecordHealthCheckStats adds the measurements of the round that just ended
+ * to the statistics of each node in shared memory, including the time of the
+ * check. When the statistics hash is full, nodes that are not in there yet
+ * are not accounted for, and their checkTimeShared flag is left false so
+ * that SetNodeHealthStateList() stores the time of their check in the
+ * node_report table instead.
+ */
+static void
+RecordHealthCheckStats(List *healthCheckList)
+{
+	ListCell *healthCheckCell = NULL;
+	HealthCheckStatsKey key;
+	TimestampTz now = GetCurrentTimestamp();
+
+	memset(&key, 0, sizeof(key));
+	key.dboid = MyDatabaseId;
+
+	LWLockAcquire(&HealthCheckHelperControl->statsLock, LW_EXCLUSIVE);
+
+	foreach(healthCheckCell, healthCheckList)
+	{
+		HealthCheck *healthCheck = (HealthCheck *) lfirst(healthCheckCell);
+		NodeHealthState checkedHealthState =
+			healthCheck->node->checkedHealthState;
+		bool found = false;
+
+		healthCheck->node->checkTimeShared = false;
+
+		/* a round interrupted by SIGTERM leaves unfinished checks */
+		if (checkedHealthState == NODE_HEALTH_UNKNOWN)
+		{
+			continue;
+		}
+
+		key.nodeId = healthCheck->node->nodeId;
+
+		HealthCheckStats *stats =
+			(HealthCheckStats *) hash_search(HealthCheckStatsHash, &key,
+											 HASH_ENTER_NULL, &found);
+
+		if (stats == NULL)
+		{
+			continue;
+		}
+
+		if (!found)
+		{
+			memset(stats, 0, sizeof(HealthCheckStats));
+			stats->key = key;
+		}
+
+		stats->lastCheckTime = now;
+		healthCheck->node->checkTimeShared = true;
 
-				nextTryTime = AddTimeMillis(currentTime, HealthCheckRetryDelay);
+		stats->checkCount++;
+		stats->retryCount += healthCheck->retryCount;
+		stats->connectionCount += healthCheck->connectionCount;
 
-				healthCheck->nextEventTime = nextTryTime;
-				healthCheck->connection = NULL;
-				healthCheck->state = HEALTH_CHECK_RETRY;
-			}
-			else
-			{
-				/* Health check is still connecting */
-			}
+		if (CheckResult(healthCheck) == NODE_HEALTH_BAD)
+		{
+			stats->failureCount++;
+		}
 
-			healthCheck->pollingStatus = pollingStatus;
+		if (healthCheck->transitionSuppressed)
+		{
+			stats->suppressedCount++;
+		}
 
-			break;
+		if (healthCheck->connectLatency >= 0)
+		{
+			RecordLatency(&(stats->connectLatency), healthCheck->connectLatency);
 		}
 
-		case HEALTH_CHECK_DEAD:
-		case HEALTH_CHECK_OK:
-		default:
+		if (healthCheck->responseLatency >= 0)
 		{
-			/* Health check is done */
+			RecordLatency(&(stats->responseLatency),
+						  healthCheck->responseLatency);
 		}
 	}
+
+	LWLockRelease(&HealthCheckHelperControl->statsLock);
 }
 
 
 /*
- * CompareTime compares two timeval structs.
- *
- * If leftTime < rightTime, return -1
- * If leftTime > rightTime, return 1
- * else, return 0
+ * RecordLatency adds a latency, in microseconds, to the given histogram.
  */
-static int
-CompareTimes(struct timeval *leftTime, struct timeval *rightTime)
+static void
+RecordLatency(HealthCheckLatencyHistogram *histogram, int64 latency)
 {
-	int compareResult = 0;
+	uint64 value = latency > 0 ? (uint64) latency : 0;
+	int bucket = 0;
 
-	if (leftTime->tv_sec < rightTime->tv_sec)
+	while (bucket < HEALTH_CHECK_LATENCY_BUCKETS - 1 &&
+		   (value >> (bucket + 1)) > 0)
 	{
-		compareResult = -1;
+		++bucket;
 	}
-	else if (leftTime->tv_sec > rightTime->tv_sec)
+
+	histogram->buckets[bucket]++;
+	histogram->count++;
+
+	if (value > histogram->max)
 	{
-		compareResult = 1;
+		histogram->max = value;
 	}
-	else if (leftTime->tv_usec < rightTime->tv_usec)
+}
+
+
+/*
+ * LatencyPercentile returns an estimate of the given percentile of the
+ * latencies in the histogram, in milliseconds. We return the upper bound of
+ * the bucket where the percentile lies, which is never more than the maximum
+ * latency that has been recorded.
+ */
+static double
+LatencyPercentile(HealthCheckLatencyHistogram *histogram, double percentile)
+{
+	double exactRank = percentile * histogram->count;
+	uint64 rank = Max((uint64) exactRank, 1);
+	uint64 seen = 0;
+
+	if ((double) rank < exactRank)
 	{
-		compareResult = -1;
+		++rank;
 	}
-	else if (leftTime->tv_usec > rightTime->tv_usec)
+
+	for (int bucket = 0; bucket < HEALTH_CHECK_LATENCY_BUCKETS; bucket++)
 	{
-		compareResult = 1;
+		seen += histogram->buckets[bucket];
+
+		if (seen >= rank)
+		{
+			uint64 upperBound = UINT64CONST(1) << (bucket + 1);
+
+			return Min(upperBound, histogram->max) / 1000.0;
+		}
+	}
+
+	return histogram->max / 1000.0;
+}
+
+
+/*
+ * RemoveHealthCheckStats removes the statistics of the given node from the
+ * shared memory hash, or the statistics of every node of the database when
+ * nodeId is zero.
+ */
+static void
+RemoveHealthCheckStats(Oid databaseId, int64 nodeId)
+{
+	HealthCheckStatsKey key;
+
+	memset(&key, 0, sizeof(key));
+	key.dboid = databaseId;
+	key.nodeId = nodeId;
+
+	LWLockAcquire(&HealthCheckHelperControl->statsLock, LW_EXCLUSIVE);
+
+	if (nodeId != 0)
+	{
+		(void) hash_search(HealthCheckStatsHash, &key, HASH_REMOVE, NULL);
 	}
 	else
 	{
-		compareResult = 0;
+		HASH_SEQ_STATUS status;
+		HealthCheckStats *stats = NULL;
+
+		/* removing the entry just returned by hash_seq_search is allowed */
+		hash_seq_init(&status, HealthCheckStatsHash);
+
+		while ((stats = (HealthCheckStats *) hash_seq_search(&status)) != NULL)
+		{
+			if (stats->key.dboid == databaseId)
+			{
+				(void) hash_search(HealthCheckStatsHash, &(stats->key),
+								   HASH_REMOVE, NULL);
+			}
+		}
 	}
 
-	return compareResult;
+	LWLockRelease(&HealthCheckHelperControl->statsLock);
 }
 
 
 /*
- * SubtractTimes subtract the ‘struct timeval’ values y from x,
- * returning the result.
- *
- * From:
- * http://www.gnu.org/software/libc/manual/html_node/Elapsed-Time.html
+ * NodeHealthCheckTime returns when the given node of the current database
+ * has last been checked: the health check workers keep that time in shared
+ * memory, and only store it in the node_report table when the health of the
+ * node changes. The given healthCheckTime, as read from the tables, is
+ * returned when it is more recent or when we have no time in shared memory,
+ * which is the case after a restart until the node has been checked again.
  */
-static int
-SubtractTimes(struct timeval x, struct timeval y)
+TimestampTz
+NodeHealthCheckTime(int64 nodeId, TimestampTz healthCheckTime)
 {
-	int differenceMs = 0;
+	HealthCheckStatsKey key;
+	bool found = false;
 
-	/* Perform the carry for the later subtraction by updating y. */
-	if (x.tv_usec < y.tv_usec)
+	if (HealthCheckHelperControl == NULL)
 	{
-		int nsec = (y.tv_usec - x.tv_usec) / 1000000 + 1;
-		y.tv_usec -= 1000000 * nsec;
-		y.tv_sec += nsec;
+		return healthCheckTime;
 	}
 
-	if (x.tv_usec - y.tv_usec > 1000000)
+	memset(&key, 0, sizeof(key));
+	key.dboid = MyDatabaseId;
+	key.nodeId = nodeId;
+
+	LWLockAcquire(&HealthCheckHelperControl->statsLock, LW_SHARED);
+
+	HealthCheckStats *stats =
+		(HealthCheckStats *) hash_search(HealthCheckStatsHash, &key,
+										 HASH_FIND, &found);
+
+	if (found && stats->lastCheckTime > healthCheckTime)
 	{
-		int nsec = (x.tv_usec - y.tv_usec) / 1000000;
-		y.tv_usec += 1000000 * nsec;
-		y.tv_sec -= nsec;
+		healthCheckTime = stats->lastCheckTime;
 	}
 
-	differenceMs += 1000 * (x.tv_sec - y.tv_sec);
-	differenceMs += (x.tv_usec - y.tv_usec) / 1000;
+	LWLockRelease(&HealthCheckHelperControl->statsLock);
 
-	return differenceMs;
+	return healthCheckTime;
 }
 
 
 /*
- * AddTimeMillis adds additionalMs milliseconds to a timeval.
+ * ScheduleGroupDeadline registers when the next timeout driven decision of
+ * the given group is due, or that there is none when deadline is zero. The
+ * health check workers of the current database are woken up when the
+ * deadline is sooner than the one they knew about.
+ *
+ * When the shared memory is full, the deadline is not registered, and the
+ * decision waits until the next health check round, as before.
  */
-static struct timeval
-AddTimeMillis(struct timeval base, uint32 additionalMs)
+void
+ScheduleGroupDeadline(char *formationId, int groupId, TimestampTz deadline)
 {
-	struct timeval result = { 0, 0 };
+	GroupDeadlineKey key;
+	bool found = false;
+	bool wakeWorkers = false;
 
-	result.tv_sec = base.tv_sec + additionalMs / 1000;
-	result.tv_usec = base.tv_usec + (additionalMs % 1000) * 1000;
+	if (!ProceedPendingGroups || HealthCheckHelperControl == NULL)
+	{
+		return;
+	}
 
-	return result;
+	memset(&key, 0, sizeof(key));
+	key.dboid = MyDatabaseId;
+	strlcpy(key.formationId, formationId, NAMEDATALEN);
+	key.groupId = groupId;
+
+	LWLockAcquire(&HealthCheckHelperControl->deadlineLock, LW_EXCLUSIVE);
+
+	if (deadline == 0)
+	{
+		(void) hash_search(GroupDeadlineHash, &key, HASH_REMOVE, NULL);
+	}
+	else
+	{
+		GroupDeadline *entry = (GroupDeadline *)
+							   hash_search(GroupDeadlineHash, &key,
+										   HASH_ENTER_NULL, &found);
+
+		if (entry != NULL)
+		{
+			wakeWorkers = !found || deadline < entry->deadline;
+			entry->deadline = deadline;
+		}
+	}
+
+	LWLockRelease(&HealthCheckHelperControl->deadlineLock);
+
+	if (wakeWorkers)
+	{
+		WakeHealthCheckWorkers(MyDatabaseId);
+	}
 }
 
 
 /*
- * HealthCheckWorkerShmemSize computes how much shared memory is required.
+ * PopExpiredGroupDeadlines removes the deadlines of the current database
+ * that are not in the future anymore for the formations of the given shard,
+ * and returns the list of their groups. The next deadline of the shard is
+ * set in nextDeadline, or zero when there is none.
  */
-size_t
-HealthCheckWorkerShmemSize(void)
+List *
+PopExpiredGroupDeadlines(int shard, int shardCount, TimestampTz now,
+						 TimestampTz *nextDeadline)
 {
-	Size size = 0;
+	HASH_SEQ_STATUS status;
+	GroupDeadline *entry = NULL;
+	List *groupList = NIL;
 
-	size = add_size(size, sizeof(HealthCheckHelperDatabase));
+	*nextDeadline = 0;
 
-	/*
-	 * We request enough shared memory to have one hash-table entry for each
-	 * worker process. We couldn't start more anyway, so there's little point
-	 * in allocating more.
-	 */
-	Size hashSize = hash_estimate_size(max_worker_processes,
-									   sizeof(HealthCheckHelperDatabase));
-	size = add_size(size, hashSize);
+	LWLockAcquire(&HealthCheckHelperControl->deadlineLock, LW_EXCLUSIVE);
 
-	return size;
+	/* removing the entry just returned by hash_seq_search is allowed */
+	hash_seq_init(&status, GroupDeadlineHash);
+
+	while ((entry = (GroupDeadline *) hash_seq_search(&status)) != NULL)
+	{
+		if (entry->key.dboid != MyDatabaseId ||
+			FormationShard(entry->key.formationId, shardCount) != shard)
+		{
+			continue;
+		}
+
+		if (entry->deadline <= now)
+		{
+			PendingGroup *group = palloc0(sizeof(PendingGroup));
+
+			group->formationId = pstrdup(entry->key.formationId);
+			group->groupId = entry->key.groupId;
+
+			groupList = lappend(groupList, group);
+
+			(void) hash_search(GroupDeadlineHash, &(entry->key),
+							   HASH_REMOVE, NULL);
+		}
+		else if (*nextDeadline == 0 || entry->deadline < *nextDeadline)
+		{
+			*nextDeadline = entry->deadline;
+		}
+	}
+
+	LWLockRelease(&HealthCheckHelperControl->deadlineLock);
+
+	return groupList;
 }
 
 
 /*
- * HealthCheckWorkerShmemInit initializes the requested shared memory for the
- * maintenance daemon.
+ * RemoveGroupDeadlines removes the deadlines of the groups of the given
+ * database.
  */
 static void
-HealthCheckWorkerShmemInit(void)
+RemoveGroupDeadlines(Oid databaseId)
 {
-	bool alreadyInitialized = false;
-	HASHCTL hashInfo;
+	HASH_SEQ_STATUS status;
+	GroupDeadline *entry = NULL;
 
-	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	LWLockAcquire(&HealthCheckHelperControl->deadlineLock, LW_EXCLUSIVE);
 
-	HealthCheckHelperControl =
-		(HealthCheckHelperControlData *)
-		ShmemInitStruct("pg_auto_failover Health Check Helper Daemon",
-						HealthCheckWorkerShmemSize(),
-						&alreadyInitialized);
+	/* removing the entry just returned by hash_seq_search is allowed */
+	hash_seq_init(&status, GroupDeadlineHash);
 
-	/*
-	 * Might already be initialized on EXEC_BACKEND type platforms that call
-	 * shared library initialization functions in every backend.
-	 */
-	if (!alreadyInitialized)
+	while ((entry = (GroupDeadline *) hash_seq_search(&status)) != NULL)
 	{
-		HealthCheckHelperControl->trancheId = LWLockNewTrancheId();
-		HealthCheckHelperControl->lockTrancheName =
-			"pg_auto_failover Health Check Daemon";
-		LWLockRegisterTranche(HealthCheckHelperControl->trancheId,
-							  HealthCheckHelperControl->lockTrancheName);
-
-		LWLockInitialize(&HealthCheckHelperControl->lock,
-						 HealthCheckHelperControl->trancheId);
+		if (entry->key.dboid == databaseId)
+		{
+			(void) hash_search(GroupDeadlineHash, &(entry->key),
+							   HASH_REMOVE, NULL);
+		}
 	}
 
-	memset(&hashInfo, 0, sizeof(hashInfo));
-	hashInfo.keysize = sizeof(Oid);
-	hashInfo.entrysize = sizeof(HealthCheckHelperDatabase);
-	hashInfo.hash = tag_hash;
-	int hashFlags = (HASH_ELEM | HASH_FUNCTION);
+	LWLockRelease(&HealthCheckHelperControl->deadlineLock);
+}
 
-	HealthCheckWorkerDBHash = ShmemInitHash("pg_auto_failover Database Hash",
-											max_worker_processes,
-											max_worker_processes,
-											&hashInfo, hashFlags);
 
-	LWLockRelease(AddinShmemInitLock);
+/*
+ * WakeHealthCheckWorkers sets the latch of the health check workers of the
+ * given database, so that they look at the group deadlines again.
+ */
+static void
+WakeHealthCheckWorkers(Oid databaseId)
+{
+	HASH_SEQ_STATUS status;
+	HealthCheckHelperDatabase *dbData = NULL;
 
-	if (prev_shmem_startup_hook != NULL)
+	LWLockAcquire(&HealthCheckHelperControl->lock, LW_SHARED);
+
+	hash_seq_init(&status, HealthCheckWorkerDBHash);
+
+	while ((dbData = (HealthCheckHelperDatabase *) hash_seq_search(&status)) != NULL)
 	{
-		prev_shmem_startup_hook();
+		if (dbData->key.dboid == databaseId && dbData->workerLatch != NULL)
+		{
+			SetLatch(dbData->workerLatch);
+		}
 	}
+
+	LWLockRelease(&HealthCheckHelperControl->lock);
 }
 
 
 /*
- * StopHealthCheckWorker stops the maintenance daemon for the given database
- * and removes it from the Health Check Launcher control hash.
+ * FormationShard returns the shard of the health check workers that is
+ * responsible for the given formation, the same way as the SQL query of
+ * ProceedPendingGroupStates does.
  */
-void
-StopHealthCheckWorker(Oid databaseId)
+static int
+FormationShard(const char *formationId, int shardCount)
 {
-	bool found = false;
-	pid_t workerPid = 0;
+	if (shardCount <= 1)
+	{
+		return 0;
+	}
 
-	LWLockAcquire(&HealthCheckHelperControl->lock, LW_EXCLUSIVE);
+	Datum hash = DirectFunctionCall1Coll(hashtext,
+										 DEFAULT_COLLATION_OID,
+										 CStringGetTextDatum(formationId));
 
-	HealthCheckHelperDatabase *dbData = (HealthCheckHelperDatabase *)
-										hash_search(HealthCheckWorkerDBHash,
-													&databaseId, HASH_REMOVE, &found);
+	return (DatumGetInt32(hash) & INT_MAX) % shardCount;
+}
 
-	if (found)
+
+/*
+ * health_check_stats returns the health check statistics of the nodes of the
+ * current database: how many checks have been done, how many of them failed,
+ * how many retries were needed, and the distribution of the connection and
+ * response latencies, in milliseconds.
+ */
+Datum
+health_check_stats(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+
+	checkPgAutoFailoverVersion();
+
+	/* stuff done only on the first call of the function */
+	if (SRF_IS_FIRSTCALL())
 	{
-		workerPid = dbData->workerPid;
+		HASH_SEQ_STATUS status;
+		HealthCheckStats *stats = NULL;
+		List *statsList = NIL;
+
+		/* create a function context for cross-call persistence */
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		MemoryContext oldcontext =
+			MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		/* copy our entries so that we do not hold the lock between calls */
+		LWLockAcquire(&HealthCheckHelperControl->statsLock, LW_SHARED);
+
+		hash_seq_init(&status, HealthCheckStatsHash);
+
+		while ((stats = (HealthCheckStats *) hash_seq_search(&status)) != NULL)
+		{
+			if (stats->key.dboid == MyDatabaseId)
+			{
+				HealthCheckStats *statsCopy = palloc(sizeof(HealthCheckStats));
+
+				*statsCopy = *stats;
+				statsList = lappend(statsList, statsCopy);
+			}
+		}
+
+		LWLockRelease(&HealthCheckHelperControl->statsLock);
+
+		funcctx->user_fctx = statsList;
+		MemoryContextSwitchTo(oldcontext);
 	}
 
-	LWLockRelease(&HealthCheckHelperControl->lock);
+	/* stuff done on every call of the function */
+	funcctx = SRF_PERCALL_SETUP();
+
+	List *statsList = (List *) funcctx->user_fctx;
 
-	if (workerPid > 0)
+	if (statsList != NIL)
 	{
-		kill(workerPid, SIGTERM);
+		TupleDesc resultDescriptor = NULL;
+		Datum values[HEALTH_CHECK_STATS_COLUMNS];
+		bool isNulls[HEALTH_CHECK_STATS_COLUMNS];
+
+		HealthCheckStats *stats = (HealthCheckStats *) linitial(statsList);
+		HealthCheckLatencyHistogram *connectLatency = &(stats->connectLatency);
+		HealthCheckLatencyHistogram *responseLatency = &(stats->responseLatency);
+
+		memset(values, 0, sizeof(values));
+		memset(isNulls, false, sizeof(isNulls));
+
+		values[0] = Int64GetDatum(stats->key.nodeId);
+		values[1] = Int64GetDatum(stats->checkCount);
+		values[2] = Int64GetDatum(stats->failureCount);
+		values[3] = Int64GetDatum(stats->retryCount);
+		values[4] = Int64GetDatum(stats->connectionCount);
+
+		if (connectLatency->count > 0)
+		{
+			values[5] = Float8GetDatum(LatencyPercentile(connectLatency, 0.5));
+			values[6] = Float8GetDatum(LatencyPercentile(connectLatency, 0.99));
+			values[7] = Float8GetDatum(connectLatency->max / 1000.0);
+		}
+		else
+		{
+			isNulls[5] = isNulls[6] = isNulls[7] = true;
+		}
+
+		if (responseLatency->count > 0)
+		{
+			values[8] = Float8GetDatum(LatencyPercentile(responseLatency, 0.5));
+			values[9] = Float8GetDatum(LatencyPercentile(responseLatency, 0.99));
+			values[10] = Float8GetDatum(responseLatency->max / 1000.0);
+		}
+		else
+		{
+			isNulls[8] = isNulls[9] = isNulls[10] = true;
+		}
+
+		values[11] = Int64GetDatum(stats->suppressedCount);
+		values[12] = TimestampTzGetDatum(stats->lastCheckTime);
+
+		TypeFuncClass resultTypeClass = get_call_result_type(fcinfo, NULL,
+															 &resultDescriptor);
+		if (resultTypeClass != TYPEFUNC_COMPOSITE)
+		{
+			ereport(ERROR, (errmsg("return type must be a row type")));
+		}
+
+		HeapTuple resultTuple = heap_form_tuple(resultDescriptor, values, isNulls);
+		Datum resultDatum = HeapTupleGetDatum(resultTuple);
+
+		/* prepare next SRF call */
+		funcctx->user_fctx = list_delete_first(statsList);
+
+		SRF_RETURN_NEXT(funcctx, PointerGetDatum(resultDatum));
 	}
+
+	SRF_RETURN_DONE(funcctx);
 }
@@ -15,6 +15,7 @@
 #include "fmgr.h"
 
 #include "metadata.h"
+#include "stat_functions.h"
 #include "version_compat.h"
 
 #include "access/genam.h"
@@ -35,10 +36,30 @@
 #include "utils/fmgroids.h"
 #include "utils/lsyscache.h"
 #include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/relcache.h"
+#include "utils/syscache.h"
 
 bool EnableVersionChecks = true; /* version checks are enabled */
+int NodeActiveMaxConcurrency = 0; /* zero disables the admission control */
+bool NodeActiveAsyncCommit = true; /* heartbeats don't wait for a WAL flush */
+
+/*
+ * The version check runs at the beginning of most of our protocol functions,
+ * node_active included, and reading pg_available_extensions means reading
+ * every control file of the extension directory. We remember that the check
+ * passed in this backend, and check again once ALTER EXTENSION has been seen.
+ * In other backends, updating the extension replaces some functions of ours,
+ * so the syscache invalidation callback on pg_proc resets the cache too.
+ */
+static bool VersionCheckCacheValid = false;
+static bool VersionCheckCallbackRegistered = false;
+static uint64 VersionCheckInvalidations = 0;
+
+static void InvalidateVersionCheckCallback(Datum argument, int cacheId,
+										   uint32 hashValue);
 
 /*
  * pgAutoFailoverRelationId returns the OID of a given relation in the
@@ -131,8 +152,9 @@ pgAutoFailoverExtensionOwner(void)
 
 
 /*
- * LockFormation takes a lock on a formation to prevent concurrent
- * membership changes.
+ * LockFormation takes a lock on a formation. The calls that change a single
+ * group take it in ShareLock mode, and the formation-wide changes, such as
+ * its number_sync_standbys setting, in ExclusiveLock mode.
  */
 void
 LockFormation(char *formationId, LOCKMODE lockMode)
@@ -146,7 +168,66 @@ LockFormation(char *formationId, LOCKMODE lockMode)
 	SET_LOCKTAG_ADVISORY(tag, MyDatabaseId, 0, formationIdHash,
 						 ADV_LOCKTAG_CLASS_AUTO_FAILOVER_FORMATION);
 
+	instr_time lockStartTime;
+	INSTR_TIME_SET_CURRENT(lockStartTime);
+
+	(void) LockAcquire(&tag, lockMode, sessionLock, dontWait);
+
+	CountLockWait(lockStartTime, true);
+}
+
+
+/*
+ * LockFormationMembership takes a lock on the list of nodes of a formation to
+ * prevent concurrent membership changes: registering and removing nodes. The
+ * node_active calls do not take that lock, so that the membership changes in
+ * a group do not block the other groups of the formation. The callers take
+ * it after LockFormation and before LockNodeGroup.
+ */
+void
+LockFormationMembership(char *formationId, LOCKMODE lockMode)
+{
+	LOCKTAG tag;
+	const bool sessionLock = false;
+	const bool dontWait = false;
+
+	uint32 formationIdHash = string_hash(formationId, NAMEDATALEN);
+
+	SET_LOCKTAG_ADVISORY(tag, MyDatabaseId, 0, formationIdHash,
+						 ADV_LOCKTAG_CLASS_AUTO_FAILOVER_FORMATION_MEMBERSHIP);
+
+	instr_time lockStartTime;
+	INSTR_TIME_SET_CURRENT(lockStartTime);
+
+	(void) LockAcquire(&tag, lockMode, sessionLock, dontWait);
+
+	CountLockWait(lockStartTime, true);
+}
+
+
+/*
+ * LockFormationFailovers takes a lock on the failovers of a formation, so
+ * that the groups that compete to start a failover at the same time see the
+ * failovers that the others started, see FailoverMayStart().
+ */
+void
+LockFormationFailovers(char *formationId, LOCKMODE lockMode)
+{
+	LOCKTAG tag;
+	const bool sessionLock = false;
+	const bool dontWait = false;
+
+	uint32 formationIdHash = string_hash(formationId, NAMEDATALEN);
+
+	SET_LOCKTAG_ADVISORY(tag, MyDatabaseId, 0, formationIdHash,
+						 ADV_LOCKTAG_CLASS_AUTO_FAILOVER_FORMATION_FAILOVERS);
+
+	instr_time lockStartTime;
+	INSTR_TIME_SET_CURRENT(lockStartTime);
+
 	(void) LockAcquire(&tag, lockMode, sessionLock, dontWait);
+
+	CountLockWait(lockStartTime, true);
 }
 
 
@@ -166,7 +247,49 @@ LockNodeGroup(char *formationId, int groupId, LOCKMODE lockMode)
 	SET_LOCKTAG_ADVISORY(tag, MyDatabaseId, formationIdHash, (uint32) groupId,
 						 ADV_LOCKTAG_CLASS_AUTO_FAILOVER_NODE_GROUP);
 
+	instr_time lockStartTime;
+	INSTR_TIME_SET_CURRENT(lockStartTime);
+
 	(void) LockAcquire(&tag, lockMode, sessionLock, dontWait);
+
+	CountLockWait(lockStartTime, false);
+}
+
+
+/*
+ * TryLockNodeActiveSlot takes one of pgautofailover.node_active_max_concurrency
+ * slots for the current node_active call, and keeps it until the end of the
+ * transaction. Calls start from the slot of their node, so that concurrent
+ * calls usually find a free slot at the first try. Returns false when every
+ * slot is taken.
+ */
+bool
+TryLockNodeActiveSlot(int64 nodeId)
+{
+	const bool sessionLock = false;
+	const bool dontWait = true;
+
+	if (NodeActiveMaxConcurrency <= 0)
+	{
+		return true;
+	}
+
+	for (int i = 0; i < NodeActiveMaxConcurrency; i++)
+	{
+		LOCKTAG tag;
+		uint32 slot = (uint32) ((nodeId + i) % NodeActiveMaxConcurrency);
+
+		SET_LOCKTAG_ADVISORY(tag, MyDatabaseId, 0, slot,
+							 ADV_LOCKTAG_CLASS_AUTO_FAILOVER_NODE_ACTIVE_SLOT);
+
+		if (LockAcquire(&tag, ExclusiveLock, sessionLock, dontWait) !=
+			LOCKACQUIRE_NOT_AVAIL)
+		{
+			return true;
+		}
+	}
+
+	return false;
 }
 
 
@@ -179,6 +302,9 @@ LockNodeGroup(char *formationId, int groupId, LOCKMODE lockMode)
  * We need to be careful that the pgautofailover.so that is currently loaded in
  * the Postgres backend is intended to work with the current extension version
  * definition (schema and SQL definitions of C coded functions).
+ *
+ * Once the check has passed, we skip it until the extension might have
+ * changed, see InvalidateVersionCheckCache().
  */
 void
 checkPgAutoFailoverVersion()
@@ -186,11 +312,21 @@ checkPgAutoFailoverVersion()
 	char *installedVersion = NULL;
 	char *availableVersion = NULL;
 
-	if (!EnableVersionChecks)
+	if (!EnableVersionChecks || VersionCheckCacheValid)
 	{
 		return;
 	}
 
+	if (!VersionCheckCallbackRegistered)
+	{
+		CacheRegisterSyscacheCallback(PROCOID,
+									  InvalidateVersionCheckCallback,
+									  (Datum) 0);
+		VersionCheckCallbackRegistered = true;
+	}
+
+	uint64 invalidations = VersionCheckInvalidations;
+
 	const int argCount = 1;
 	Oid argTypes[] = { TEXTOID };
 	Datum argValues[] = { CStringGetTextDatum(AUTO_FAILOVER_EXTENSION_NAME) };
@@ -270,4 +406,91 @@ checkPgAutoFailoverVersion()
 				 errhint("Run ALTER EXTENSION %s UPDATE and try again.",
 						 AUTO_FAILOVER_EXTENSION_NAME)));
 	}
+
+	/* the extension may have changed while we were checking it */
+	VersionCheckCacheValid = invalidations == VersionCheckInvalidations;
+}
+
+
+/*
+ * InvalidateVersionCheckCache has the next call to checkPgAutoFailoverVersion
+ * check the extension versions again. Our ProcessUtility hook calls it when
+ * the extension is created, updated, or dropped.
+ */
+void
+InvalidateVersionCheckCache(void)
+{
+	VersionCheckCacheValid = false;
+	VersionCheckInvalidations++;
+}
+
+
+/*
+ * InvalidateVersionCheckCallback is our syscache invalidation callback for
+ * pg_proc.
+ */
+static void
+InvalidateVersionCheckCallback(Datum argument, int cacheId, uint32 hashValue)
+{
+	InvalidateVersionCheckCache();
+}
+
+
+/*
+ * ExecuteMetadataPlan executes the given query with SPI, the same way as
+ * SPI_execute_with_args does, except that the query is only parsed and
+ * planned the first time it is executed in a backend. The plan is then kept
+ * in metadataPlan and re-used by the next calls.
+ *
+ * Plans are invalidated and re-planned by Postgres when the tables they use
+ * change, and we prepare the query again when its argument types changed.
+ */
+int
+ExecuteMetadataPlan(MetadataPlan *metadataPlan, const char *query,
+					int argCount, Oid *argTypes, Datum *argValues,
+					const char *argNulls, bool readOnly, long count)
+{
+	if (metadataPlan->plan != NULL &&
+		(metadataPlan->argCount != argCount ||
+		 (argCount > 0 &&
+		  memcmp(metadataPlan->argTypes, argTypes, argCount * sizeof(Oid)) != 0)))
+	{
+		SPI_freeplan(metadataPlan->plan);
+		metadataPlan->plan = NULL;
+
+		if (metadataPlan->argTypes != NULL)
+		{
+			pfree(metadataPlan->argTypes);
+			metadataPlan->argTypes = NULL;
+		}
+	}
+
+	if (metadataPlan->plan == NULL)
+	{
+		SPIPlanPtr plan = SPI_prepare(query, argCount, argTypes);
+
+		if (plan == NULL)
+		{
+			elog(ERROR, "could not prepare \"%s\": %s",
+				 query, SPI_result_code_string(SPI_result));
+		}
+
+		if (SPI_keepplan(plan) != 0)
+		{
+			elog(ERROR, "could not save the plan of \"%s\"", query);
+		}
+
+		if (argCount > 0)
+		{
+			metadataPlan->argTypes =
+				MemoryContextAlloc(TopMemoryContext, argCount * sizeof(Oid));
+			memcpy(metadataPlan->argTypes, argTypes, argCount * sizeof(Oid));
+		}
+
+		metadataPlan->argCount = argCount;
+		metadataPlan->plan = plan;
+	}
+
+	return SPI_execute_plan(metadataPlan->plan, argValues, argNulls,
+							readOnly, count);
 }
@@ -13,9 +13,10 @@
 
 #pragma once
 
+#include "executor/spi.h"
 #include "storage/lockdefs.h"
 
-#define AUTO_FAILOVER_EXTENSION_VERSION "2.0"
+#define AUTO_FAILOVER_EXTENSION_VERSION "2.1"
 #define AUTO_FAILOVER_EXTENSION_NAME "pgautofailover"
 #define AUTO_FAILOVER_SCHEMA_NAME "pgautofailover"
 #define AUTO_FAILOVER_FORMATION_TABLE "pgautofailover.formation"
@@ -32,16 +33,50 @@
 typedef enum AutoFailoverHALocktagClass
 {
 	ADV_LOCKTAG_CLASS_AUTO_FAILOVER_FORMATION = 10,
-	ADV_LOCKTAG_CLASS_AUTO_FAILOVER_NODE_GROUP = 11
+	ADV_LOCKTAG_CLASS_AUTO_FAILOVER_NODE_GROUP = 11,
+	ADV_LOCKTAG_CLASS_AUTO_FAILOVER_NODE_ACTIVE_SLOT = 12,
+	ADV_LOCKTAG_CLASS_AUTO_FAILOVER_FORMATION_MEMBERSHIP = 13,
+	ADV_LOCKTAG_CLASS_AUTO_FAILOVER_FORMATION_FAILOVERS = 14
 } AutoFailoverHALocktagClass;
 
+/*
+ * The monitor refuses node_active calls with this SQLSTATE when more than
+ * pgautofailover.node_active_max_concurrency of them are running already,
+ * and the keepers then retry after a random delay.
+ */
+#define ERRCODE_AUTO_FAILOVER_MONITOR_BUSY MAKE_SQLSTATE('5', '3', 'Z', '0', '1')
+
+/*
+ * MetadataPlan is a per-backend cache of the SPI plan of a metadata query.
+ * Call sites declare a static MetadataPlan initialized to zero next to the
+ * query text, and ExecuteMetadataPlan prepares the plan on first use.
+ *
+ * We also remember the argument types the plan was prepared with: the OID of
+ * the replication_state type changes when the extension is re-created.
+ */
+typedef struct MetadataPlan
+{
+	SPIPlanPtr plan;
+	int argCount;
+	Oid *argTypes;
+} MetadataPlan;
+
 /* GUC variable for version checks, true by default */
 extern bool EnableVersionChecks;
+extern int NodeActiveMaxConcurrency;
+extern bool NodeActiveAsyncCommit;
 
 /* public function declarations */
 extern Oid pgAutoFailoverRelationId(const char *relname);
 extern Oid pgAutoFailoverSchemaId(void);
 extern Oid pgAutoFailoverExtensionOwner(void);
 extern void LockFormation(char *formationId, LOCKMODE lockMode);
+extern void LockFormationMembership(char *formationId, LOCKMODE lockMode);
+extern void LockFormationFailovers(char *formationId, LOCKMODE lockMode);
 extern void LockNodeGroup(char *formationId, int groupId, LOCKMODE lockMode);
+extern bool TryLockNodeActiveSlot(int64 nodeId);
 extern void checkPgAutoFailoverVersion(void);
+extern void InvalidateVersionCheckCache(void);
+extern int ExecuteMetadataPlan(MetadataPlan *metadataPlan, const char *query,
+							   int argCount, Oid *argTypes, Datum *argValues,
+							   const char *argNulls, bool readOnly, long count);
@@ -0,0 +1,804 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/metrics_worker.c
+ *
+ * Implementation of the background worker that serves the monitor metrics
+ * over HTTP, in the Prometheus text exposition format.
+ *
+ * The worker is only registered when pgautofailover.metrics_port is set. Each
+ * scrape reads the nodes in a single SPI query, and adds the WAL rates that
+ * are kept in shared memory, see wal_rate.c. The rendered metrics are cached
+ * for a second, so that several scrapers do not add up to more queries.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+/* these are internal headers */
+#include "metadata.h"
+#include "metrics_worker.h"
+#include "node_metadata.h"
+#include "version_compat.h"
+#include "wal_rate.h"
+
+/* these are always necessary for a bgworker */
+#include "access/xact.h"
+#include "commands/extension.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
+
+/* these headers are used by this particular worker's code */
+#include "lib/stringinfo.h"
+#include "libpq/pqsignal.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+#include "utils/timestamp.h"
+
+
+/* we only read the request line, and ignore headers and body */
+#define METRICS_REQUEST_MAXLEN 4096
+
+/* how long we wait for a request before giving up on a client, in ms */
+#define METRICS_CLIENT_TIMEOUT_MS 1000
+
+/* how long we serve the same metrics before querying the nodes again */
+#define METRICS_CACHE_TIME_MS 1000
+
+/* how long we wait before trying to listen again, in ms */
+#define METRICS_LISTEN_RETRY_TIME_MS (10 * 1000)
+
+/*
+ * The lag of a node is measured against the node that is currently in one of
+ * the states where Postgres accepts writes, in the same group.
+ */
+#define METRICS_SELECT_NODES \
+	"SELECT node.formationid, node.groupid, node.nodeid, node.nodename, " \
+	"node.reportedstate::text, node.goalstate::text, node.health, " \
+	"extract(epoch from now() - report.reporttime)::float8, " \
+	"(primary_lsn.reportedlsn - report.reportedlsn)::float8 " \
+	"FROM " AUTO_FAILOVER_NODE_TABLE AUTO_FAILOVER_NODE_REPORT_JOIN \
+	" LEFT JOIN LATERAL (" \
+	"SELECT r.reportedlsn " \
+	"FROM " AUTO_FAILOVER_NODE_TABLE " AS p " \
+	"LEFT JOIN " AUTO_FAILOVER_NODE_REPORT_TABLE " AS r USING (nodeid) " \
+	"WHERE p.formationid = node.formationid " \
+	"AND p.groupid = node.groupid " \
+	"AND p.reportedstate IN " \
+	"('single', 'primary', 'wait_primary', 'join_primary', 'apply_settings') " \
+	"ORDER BY p.nodeid LIMIT 1) AS primary_lsn ON true " \
+	"ORDER BY node.formationid, node.groupid, node.nodeid"
+
+#define METRICS_SELECT_EVENTS \
+	"SELECT CASE WHEN is_called THEN last_value ELSE 0 END " \
+	"FROM pgautofailover.event_eventid_seq"
+
+/* one row of METRICS_SELECT_NODES */
+typedef struct MetricsNode
+{
+	char *formationId;
+	int groupId;
+	int64 nodeId;
+	char *nodeName;
+	char *reportedState;
+	char *goalState;
+	int health;
+	double reportAge;
+	bool hasLag;
+	double lagBytes;
+	bool hasWalRate;
+	double walRate;
+} MetricsNode;
+
+
+/* flags set by signal handlers */
+static volatile sig_atomic_t got_sighup = false;
+static volatile sig_atomic_t got_sigterm = false;
+
+/* GUC variables */
+int MetricsPort = 0;
+char *MetricsListenAddress = NULL;
+char *MetricsDatabase = NULL;
+
+/* the last rendered metrics, and when we rendered them */
+static StringInfo MetricsCache = NULL;
+static TimestampTz MetricsCacheTime = 0;
+static bool MetricsCacheAvailable = false;
+
+
+static void pg_auto_failover_metrics_sigterm(SIGNAL_ARGS);
+static void pg_auto_failover_metrics_sighup(SIGNAL_ARGS);
+static int MetricsListen(void);
+static void MetricsHandleClient(int clientFd);
+static bool RenderMetrics(StringInfo out);
+static int LoadMetricsNodes(MetricsNode **nodeArray, int64 *eventCount);
+static void AppendMetricsHeader(StringInfo out, const char *name,
+								const char *type, const char *help);
+static void AppendNodeLabels(StringInfo out, MetricsNode *node);
+static void AppendLabelValue(StringInfo out, const char *value);
+static void MetricsSend(int fd, const char *status,
+						const char *body, size_t size);
+
+
+/*
+ * RegisterMetricsWorker registers the metrics worker when a metrics port has
+ * been set up. The GUCs must have been defined already.
+ */
+void
+RegisterMetricsWorker(void)
+{
+	BackgroundWorker worker;
+
+	if (MetricsPort <= 0)
+	{
+		return;
+	}
+
+	memset(&worker, 0, sizeof(worker));
+
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time = 1;
+	worker.bgw_main_arg = Int32GetDatum(0);
+	worker.bgw_notify_pid = 0;
+	strlcpy(worker.bgw_library_name, "pgautofailover", sizeof(worker.bgw_library_name));
+	strlcpy(worker.bgw_name, "pg_auto_failover metrics", sizeof(worker.bgw_name));
+	strlcpy(worker.bgw_function_name, "MetricsWorkerMain",
+			sizeof(worker.bgw_function_name));
+
+	RegisterBackgroundWorker(&worker);
+}
+
+
+/*
+ * Signal handler for SIGTERM
+ *		Set a flag to let the main loop to terminate, and set our latch to wake
+ *		it up.
+ */
+static void
+pg_auto_failover_metrics_sigterm(SIGNAL_ARGS)
+{
+	int save_errno = errno;
+
+	got_sigterm = true;
+	SetLatch(MyLatch);
+
+	errno = save_errno;
+}
+
+
+/*
+ * Signal handler for SIGHUP
+ *		Set a flag to tell the main loop to reread the config file, and set
+ *		our latch to wake it up.
+ */
+static void
+pg_auto_failover_metrics_sighup(SIGNAL_ARGS)
+{
+	int save_errno = errno;
+
+	got_sighup = true;
+	SetLatch(MyLatch);
+
+	errno = save_errno;
+}
+
+
+/*
+ * MetricsWorkerMain is the main entry-point for the background worker that
+ * serves the metrics. Clients are handled one at a time: a scrape is a single
+ * query, or a copy of the cached metrics, and Prometheus does not scrape
+ * concurrently.
+ *
+ * When we can not listen on the metrics port, we keep trying rather than
+ * exiting, the postmaster would otherwise restart us every second.
+ */
+void
+MetricsWorkerMain(Datum arg)
+{
+	int listenFd = -1;
+	TimestampTz lastListenAttempt = 0;
+
+	/* Establish signal handlers before unblocking signals. */
+	pqsignal(SIGHUP, pg_auto_failover_metrics_sighup);
+	pqsignal(SIGINT, SIG_IGN);
+	pqsignal(SIGTERM, pg_auto_failover_metrics_sigterm);
+
+	/* clients that go away while we answer must not kill the worker */
+	pqsignal(SIGPIPE, SIG_IGN);
+
+	/* We're now ready to receive signals */
+	BackgroundWorkerUnblockSignals();
+
+	/* Connect to the monitor database */
+	BackgroundWorkerInitializeConnection(MetricsDatabase, NULL, 0);
+
+	/* Make background worker recognisable in pg_stat_activity */
+	pgstat_report_appname("pg_auto_failover metrics");
+
+	MemoryContext oldContext = MemoryContextSwitchTo(TopMemoryContext);
+	MetricsCache = makeStringInfo();
+	MemoryContextSwitchTo(oldContext);
+
+	MemoryContext metricsContext = AllocSetContextCreate(CurrentMemoryContext,
+														 "Metrics context",
+														 ALLOCSET_DEFAULT_MINSIZE,
+														 ALLOCSET_DEFAULT_INITSIZE,
+														 ALLOCSET_DEFAULT_MAXSIZE);
+
+	MemoryContextSwitchTo(metricsContext);
+
+	while (!got_sigterm)
+	{
+		int waitResult = 0;
+		int events = WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH;
+		long timeoutMs = METRICS_LISTEN_RETRY_TIME_MS;
+
+		if (listenFd < 0)
+		{
+			TimestampTz now = GetCurrentTimestamp();
+
+			if (lastListenAttempt == 0 ||
+				TimestampDifferenceExceeds(lastListenAttempt, now,
+										   METRICS_LISTEN_RETRY_TIME_MS))
+			{
+				lastListenAttempt = now;
+				listenFd = MetricsListen();
+
+				if (listenFd >= 0)
+				{
+					elog(LOG,
+						 "pg_auto_failover serving metrics at "
+						 "http://%s:%d/metrics",
+						 MetricsListenAddress, MetricsPort);
+				}
+			}
+		}
+
+		if (listenFd >= 0)
+		{
+			events |= WL_SOCKET_READABLE;
+		}
+
+#if (PG_VERSION_NUM >= 100000)
+		waitResult = WaitLatchOrSocket(MyLatch, events, listenFd, timeoutMs,
+									   WAIT_EVENT_CLIENT_READ);
+#else
+		waitResult = WaitLatchOrSocket(MyLatch, events, listenFd, timeoutMs);
+#endif
+
+		ResetLatch(MyLatch);
+
+		/* emergency bailout if postmaster has died */
+		if (waitResult & WL_POSTMASTER_DEATH)
+		{
+			elog(LOG, "pg_auto_failover metrics exiting");
+
+			proc_exit(1);
+		}
+
+		if (got_sighup)
+		{
+			got_sighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		if (waitResult & WL_SOCKET_READABLE)
+		{
+			int clientFd = accept(listenFd, NULL, NULL);
+
+			if (clientFd < 0)
+			{
+				if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+				{
+					ereport(WARNING,
+							(errcode_for_socket_access(),
+							 errmsg("could not accept a metrics client: %m")));
+				}
+				continue;
+			}
+
+			MetricsHandleClient(clientFd);
+
+			close(clientFd);
+
+			MemoryContextReset(metricsContext);
+		}
+	}
+
+	if (listenFd >= 0)
+	{
+		close(listenFd);
+	}
+
+	elog(LOG, "pg_auto_failover metrics exiting");
+
+	proc_exit(0);
+}
+
+
+/*
+ * MetricsListen opens the non-blocking listening socket of the metrics
+ * worker, and returns -1 when it failed to do so.
+ */
+static int
+MetricsListen(void)
+{
+	struct addrinfo *lookup = NULL;
+	struct addrinfo hints;
+	char port[12] = { 0 };
+
+	int listenFd = -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = PF_UNSPEC;     /* accept any family as supported by OS */
+	hints.ai_socktype = SOCK_STREAM; /* we only want TCP sockets */
+	hints.ai_protocol = IPPROTO_TCP; /* we only want TCP sockets */
+	hints.ai_flags = AI_PASSIVE;
+
+	pg_snprintf(port, sizeof(port), "%d", MetricsPort);
+
+	int error = getaddrinfo(MetricsListenAddress, port, &hints, &lookup);
+
+	if (error != 0)
+	{
+		ereport(WARNING,
+				(errmsg("could not resolve pgautofailover.metrics_listen_address "
+						"\"%s\": %s", MetricsListenAddress, gai_strerror(error))));
+		return -1;
+	}
+
+	for (struct addrinfo *ai = lookup; ai; ai = ai->ai_next)
+	{
+		int one = 1;
+		int sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+		if (sock < 0)
+		{
+			continue;
+		}
+
+		/* allow restarting the worker right away */
+		(void) setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+		if (bind(sock, ai->ai_addr, ai->ai_addrlen) != 0 ||
+			listen(sock, 16) != 0 ||
+			!pg_set_noblock(sock))
+		{
+			close(sock);
+			continue;
+		}
+
+		listenFd = sock;
+		break;
+	}
+
+	freeaddrinfo(lookup);
+
+	if (listenFd < 0)
+	{
+		ereport(WARNING,
+				(errcode_for_socket_access(),
+				 errmsg("could not serve pg_auto_failover metrics on %s:%d: %m",
+						MetricsListenAddress, MetricsPort)));
+	}
+
+	return listenFd;
+}
+
+
+/*
+ * MetricsHandleClient reads the request of a client and sends the metrics,
+ * or an error.
+ */
+static void
+MetricsHandleClient(int clientFd)
+{
+	char request[METRICS_REQUEST_MAXLEN] = { 0 };
+	size_t length = 0;
+
+	struct timeval timeout = {
+		.tv_sec = METRICS_CLIENT_TIMEOUT_MS / 1000,
+		.tv_usec = (METRICS_CLIENT_TIMEOUT_MS % 1000) * 1000
+	};
+
+	/* accepted sockets do not inherit O_NONBLOCK on every platform */
+	(void) pg_set_block(clientFd);
+
+	(void) setsockopt(clientFd, SOL_SOCKET, SO_RCVTIMEO,
+					  &timeout, sizeof(timeout));
+	(void) setsockopt(clientFd, SOL_SOCKET, SO_SNDTIMEO,
+					  &timeout, sizeof(timeout));
+
+	/* read until the end of the request line */
+	while (length < sizeof(request) - 1 && strchr(request, '\n') == NULL)
+	{
+		ssize_t bytes = read(clientFd, request + length,
+							 sizeof(request) - 1 - length);
+
+		if (bytes <= 0)
+		{
+			return;
+		}
+
+		length += bytes;
+	}
+
+	if (strncmp(request, "GET ", 4) != 0)
+	{
+		const char *body = "Method Not Allowed\n";
+
+		MetricsSend(clientFd, "405 Method Not Allowed", body, strlen(body));
+		return;
+	}
+
+	if (strncmp(request + 4, "/metrics ", 9) != 0 &&
+		strncmp(request + 4, "/metrics?", 9) != 0 &&
+		strncmp(request + 4, "/metrics\r", 9) != 0)
+	{
+		const char *body = "Not Found, see /metrics\n";
+
+		MetricsSend(clientFd, "404 Not Found", body, strlen(body));
+		return;
+	}
+
+	TimestampTz now = GetCurrentTimestamp();
+
+	if (MetricsCacheTime == 0 ||
+		TimestampDifferenceExceeds(MetricsCacheTime, now, METRICS_CACHE_TIME_MS))
+	{
+		resetStringInfo(MetricsCache);
+
+		MetricsCacheAvailable = RenderMetrics(MetricsCache);
+		MetricsCacheTime = now;
+	}
+
+	if (!MetricsCacheAvailable)
+	{
+		const char *body = "pg_auto_failover extension is not available\n";
+
+		MetricsSend(clientFd, "503 Service Unavailable", body, strlen(body));
+		return;
+	}
+
+	MetricsSend(clientFd, "200 OK", MetricsCache->data, MetricsCache->len);
+}
+
+
+/*
+ * RenderMetrics appends the metrics to the given buffer, and returns false
+ * when the pgautofailover extension does not exist in the metrics database.
+ *
+ * The buffer is allocated in TopMemoryContext, so we render into a temporary
+ * buffer first and copy it in the end.
+ */
+static bool
+RenderMetrics(StringInfo out)
+{
+	MetricsNode *nodeArray = NULL;
+	int64 eventCount = 0;
+	StringInfoData buffer;
+
+	int nodeCount = LoadMetricsNodes(&nodeArray, &eventCount);
+
+	if (nodeCount < 0)
+	{
+		return false;
+	}
+
+	initStringInfo(&buffer);
+
+	AppendMetricsHeader(&buffer, "pg_auto_failover_node_health", "gauge",
+						"Health of the node as seen by the monitor health "
+						"checks: 1 is good, 0 is bad, -1 is unknown.");
+
+	for (int i = 0; i < nodeCount; i++)
+	{
+		appendStringInfoString(&buffer, "pg_auto_failover_node_health");
+		AppendNodeLabels(&buffer, &nodeArray[i]);
+		appendStringInfo(&buffer, "} %d\n", nodeArray[i].health);
+	}
+
+	AppendMetricsHeader(&buffer, "pg_auto_failover_node_state", "gauge",
+						"Reported and goal state of the node, always 1.");
+
+	for (int i = 0; i < nodeCount; i++)
+	{
+		appendStringInfoString(&buffer, "pg_auto_failover_node_state");
+		AppendNodeLabels(&buffer, &nodeArray[i]);
+		appendStringInfoString(&buffer, ",reported_state=");
+		AppendLabelValue(&buffer, nodeArray[i].reportedState);
+		appendStringInfoString(&buffer, ",goal_state=");
+		AppendLabelValue(&buffer, nodeArray[i].goalState);
+		appendStringInfoString(&buffer, "} 1\n");
+	}
+
+	AppendMetricsHeader(&buffer, "pg_auto_failover_node_state_reached", "gauge",
+						"Whether the node reported its goal state.");
+
+	for (int i = 0; i < nodeCount; i++)
+	{
+		bool reached =
+			strcmp(nodeArray[i].reportedState, nodeArray[i].goalState) == 0;
+
+		appendStringInfoString(&buffer, "pg_auto_failover_node_state_reached");
+		AppendNodeLabels(&buffer, &nodeArray[i]);
+		appendStringInfo(&buffer, "} %d\n", reached ? 1 : 0);
+	}
+
+	AppendMetricsHeader(&buffer, "pg_auto_failover_node_report_age_seconds",
+						"gauge",
+						"Time since the keeper of the node last reported "
+						"to the monitor.");
+
+	for (int i = 0; i < nodeCount; i++)
+	{
+		appendStringInfoString(&buffer,
+							   "pg_auto_failover_node_report_age_seconds");
+		AppendNodeLabels(&buffer, &nodeArray[i]);
+		appendStringInfo(&buffer, "} %.3f\n", nodeArray[i].reportAge);
+	}
+
+	AppendMetricsHeader(&buffer, "pg_auto_failover_node_lag_bytes", "gauge",
+						"Reported LSN of the primary of the group minus the "
+						"reported LSN of the node.");
+
+	for (int i = 0; i < nodeCount; i++)
+	{
+		if (!nodeArray[i].hasLag)
+		{
+			continue;
+		}
+
+		appendStringInfoString(&buffer, "pg_auto_failover_node_lag_bytes");
+		AppendNodeLabels(&buffer, &nodeArray[i]);
+		appendStringInfo(&buffer, "} %.0f\n", nodeArray[i].lagBytes);
+	}
+
+	AppendMetricsHeader(&buffer, "pg_auto_failover_node_wal_rate_bytes", "gauge",
+						"Rate at which the reported LSN of the node advances, "
+						"per second.");
+
+	for (int i = 0; i < nodeCount; i++)
+	{
+		if (!nodeArray[i].hasWalRate)
+		{
+			continue;
+		}
+
+		appendStringInfoString(&buffer, "pg_auto_failover_node_wal_rate_bytes");
+		AppendNodeLabels(&buffer, &nodeArray[i]);
+		appendStringInfo(&buffer, "} %.0f\n", nodeArray[i].walRate);
+	}
+
+	AppendMetricsHeader(&buffer, "pg_auto_failover_events_total", "counter",
+						"Events logged by the monitor, use rate() to get "
+						"the event rate.");
+
+	appendStringInfo(&buffer, "pg_auto_failover_events_total " INT64_FORMAT "\n",
+					 eventCount);
+
+	appendBinaryStringInfo(out, buffer.data, buffer.len);
+
+	return true;
+}
+
+
+/*
+ * LoadMetricsNodes reads the nodes and the event count in a single
+ * transaction, and returns how many nodes it found, or -1 when the
+ * pgautofailover extension does not exist.
+ */
+static int
+LoadMetricsNodes(MetricsNode **nodeArray, int64 *eventCount)
+{
+	MemoryContext upperContext = CurrentMemoryContext;
+	int nodeCount = -1;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+
+	if (get_extension_oid(AUTO_FAILOVER_EXTENSION_NAME, true) == InvalidOid)
+	{
+		CommitTransactionCommand();
+		MemoryContextSwitchTo(upperContext);
+
+		return -1;
+	}
+
+	SPI_connect();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	pgstat_report_activity(STATE_RUNNING, METRICS_SELECT_NODES);
+
+	if (SPI_execute(METRICS_SELECT_NODES, true, 0) == SPI_OK_SELECT)
+	{
+		MemoryContext spiContext = MemoryContextSwitchTo(upperContext);
+
+		nodeCount = SPI_processed;
+		*nodeArray = (MetricsNode *) palloc0(Max(nodeCount, 1) *
+											 sizeof(MetricsNode));
+
+		for (int i = 0; i < nodeCount; i++)
+		{
+			HeapTuple tuple = SPI_tuptable->vals[i];
+			TupleDesc tupleDesc = SPI_tuptable->tupdesc;
+			MetricsNode *node = &((*nodeArray)[i]);
+			bool isNull = false;
+
+			node->formationId = SPI_getvalue(tuple, tupleDesc, 1);
+			node->groupId = DatumGetInt32(SPI_getbinval(tuple, tupleDesc, 2,
+														&isNull));
+			node->nodeId = DatumGetInt64(SPI_getbinval(tuple, tupleDesc, 3,
+													   &isNull));
+			node->nodeName = SPI_getvalue(tuple, tupleDesc, 4);
+			node->reportedState = SPI_getvalue(tuple, tupleDesc, 5);
+			node->goalState = SPI_getvalue(tuple, tupleDesc, 6);
+			node->health = DatumGetInt32(SPI_getbinval(tuple, tupleDesc, 7,
+													   &isNull));
+			node->reportAge = DatumGetFloat8(SPI_getbinval(tuple, tupleDesc, 8,
+														   &isNull));
+
+			Datum lag = SPI_getbinval(tuple, tupleDesc, 9, &isNull);
+
+			node->hasLag = !isNull;
+			node->lagBytes = isNull ? 0 : DatumGetFloat8(lag);
+
+			node->hasWalRate = GetWalRate(node->nodeId, &(node->walRate));
+		}
+
+		MemoryContextSwitchTo(spiContext);
+	}
+
+	pgstat_report_activity(STATE_RUNNING, METRICS_SELECT_EVENTS);
+
+	if (nodeCount >= 0 &&
+		SPI_execute(METRICS_SELECT_EVENTS, true, 1) == SPI_OK_SELECT &&
+		SPI_processed == 1)
+	{
+		bool isNull = false;
+		Datum value = SPI_getbinval(SPI_tuptable->vals[0],
+									SPI_tuptable->tupdesc, 1, &isNull);
+
+		*eventCount = isNull ? 0 : DatumGetInt64(value);
+	}
+
+	pgstat_report_activity(STATE_IDLE, NULL);
+	SPI_finish();
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+
+	/* CommitTransactionCommand resets the memory context to TopMemoryContext */
+	MemoryContextSwitchTo(upperContext);
+
+	return nodeCount;
+}
+
+
+/*
+ * AppendMetricsHeader appends the HELP and TYPE lines of a metric.
+ */
+static void
+AppendMetricsHeader(StringInfo out, const char *name,
+					const char *type, const char *help)
+{
+	appendStringInfo(out, "# HELP %s %s\n", name, help);
+	appendStringInfo(out, "# TYPE %s %s\n", name, type);
+}
+
+
+/*
+ * AppendNodeLabels opens the labels of a node metric, the caller adds more
+ * labels if needed and closes the braces.
+ */
+static void
+AppendNodeLabels(StringInfo out, MetricsNode *node)
+{
+	appendStringInfoString(out, "{formation=");
+	AppendLabelValue(out, node->formationId);
+	appendStringInfo(out, ",group=\"%d\",node_id=\"" INT64_FORMAT "\",node_name=",
+					 node->groupId, node->nodeId);
+	AppendLabelValue(out, node->nodeName);
+}
+
+
+/*
+ * AppendLabelValue appends a quoted label value, escaped as the Prometheus
+ * text format requires.
+ */
+static void
+AppendLabelValue(StringInfo out, const char *value)
+{
+	appendStringInfoChar(out, '"');
+
+	for (const char *ptr = value ? value : ""; *ptr != '\0'; ptr++)
+	{
+		switch (*ptr)
+		{
+			case '\\':
+			{
+				appendStringInfoString(out, "\\\\");
+				break;
+			}
+
+			case '"':
+			{
+				appendStringInfoString(out, "\\\"");
+				break;
+			}
+
+			case '\n':
+			{
+				appendStringInfoString(out, "\\n");
+				break;
+			}
+
+			default:
+			{
+				appendStringInfoChar(out, *ptr);
+				break;
+			}
+		}
+	}
+
+	appendStringInfoChar(out, '"');
+}
+
+
+/*
+ * MetricsSend sends an HTTP response to the client.
+ */
+static void
+MetricsSend(int fd, const char *status, const char *body, size_t size)
+{
+	StringInfoData header;
+
+	initStringInfo(&header);
+
+	appendStringInfo(&header,
+					 "HTTP/1.0 %s\r\n"
+					 "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+					 "Content-Length: %zu\r\n"
+					 "Connection: close\r\n"
+					 "\r\n",
+					 status, size);
+
+	const char *buffers[] = { header.data, body };
+	size_t sizes[] = { header.len, size };
+
+	for (int i = 0; i < 2; i++)
+	{
+		size_t sent = 0;
+
+		while (sent < sizes[i])
+		{
+			ssize_t bytes = write(fd, buffers[i] + sent, sizes[i] - sent);
+
+			if (bytes < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+
+				return;
+			}
+
+			sent += bytes;
+		}
+	}
+}
@@ -0,0 +1,28 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/metrics_worker.h
+ *
+ * Declarations for the background worker that serves the monitor metrics in
+ * the Prometheus text exposition format.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "postgres.h"
+
+#include "fmgr.h"
+
+
+/* GUCs */
+extern int MetricsPort;
+extern char *MetricsListenAddress;
+extern char *MetricsDatabase;
+
+
+extern void RegisterMetricsWorker(void);
+extern void MetricsWorkerMain(Datum arg);
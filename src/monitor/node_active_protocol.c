@@ -20,9 +20,14 @@
 #include "formation_metadata.h"
 #include "group_state_machine.h"
 #include "metadata.h"
+#include "node_cache.h"
 #include "node_metadata.h"
 #include "notifications.h"
 #include "replication_state.h"
+#include "stat_functions.h"
+#include "sync_standby_lag.h"
+#include "version_compat.h"
+#include "wal_rate.h"
 
 #include "access/htup_details.h"
 #include "access/xlogdefs.h"
@@ -31,14 +36,22 @@
 #include "nodes/parsenodes.h"
 #include "parser/parse_type.h"
 #include "storage/lockdefs.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/guc.h"
 #include "utils/pg_lsn.h"
 #include "utils/syscache.h"
+#include "utils/tuplestore.h"
 
 
 /* private function forward declarations */
 static AutoFailoverNodeState * NodeActive(char *formationId,
-										  AutoFailoverNodeState *currentNodeState);
+										  AutoFailoverNodeState *currentNodeState,
+										  StandbyLSNReport *standbyLSNReport);
+static bool IsUnchangedNodeReport(AutoFailoverNode *pgAutoFailoverNode,
+								  AutoFailoverNodeState *currentNodeState);
+static AutoFailoverNodeState * AssignedNodeState(AutoFailoverNode *pgAutoFailoverNode);
+static void ReturnNodesList(FunctionCallInfo fcinfo, List *nodesList);
 static void JoinAutoFailoverFormation(AutoFailoverFormation *formation,
 									  char *nodeName, char *nodeHost, int nodePort,
 									  uint64 sysIdentifier, char *nodeCluster,
@@ -47,8 +60,13 @@ static int AssignGroupId(AutoFailoverFormation *formation,
 						 char *nodeHost, int nodePort,
 						 ReplicationState *initialState);
 
+static bool IsNodeRegisteredInAdvance(AutoFailoverNode *node, char *formationId,
+									  char *nodeHost, int nodePort);
+
 static bool RemoveNode(AutoFailoverNode *currentNode, bool force);
 
+static char * BuildSynchronousStandbyNames(char *formationId, int32 groupId);
+
 /* SQL-callable function declarations */
 PG_FUNCTION_INFO_V1(register_node);
 PG_FUNCTION_INFO_V1(node_active);
@@ -57,6 +75,7 @@ PG_FUNCTION_INFO_V1(get_nodes);
 PG_FUNCTION_INFO_V1(get_primary);
 PG_FUNCTION_INFO_V1(get_other_node);
 PG_FUNCTION_INFO_V1(get_other_nodes);
+PG_FUNCTION_INFO_V1(get_upstream);
 PG_FUNCTION_INFO_V1(remove_node);
 PG_FUNCTION_INFO_V1(remove_node_by_nodeid);
 PG_FUNCTION_INFO_V1(remove_node_by_host);
@@ -67,6 +86,28 @@ PG_FUNCTION_INFO_V1(stop_maintenance);
 PG_FUNCTION_INFO_V1(set_node_candidate_priority);
 PG_FUNCTION_INFO_V1(set_node_replication_quorum);
 PG_FUNCTION_INFO_V1(synchronous_standby_names);
+PG_FUNCTION_INFO_V1(proceed_pending_group);
+
+/* these functions count their calls in pgautofailover.stat_functions */
+TRACKED_FUNCTION(register_node, STAT_FUNCTION_REGISTER_NODE);
+TRACKED_FUNCTION(node_active, STAT_FUNCTION_NODE_ACTIVE);
+TRACKED_FUNCTION(update_node_metadata, STAT_FUNCTION_UPDATE_NODE_METADATA);
+TRACKED_FUNCTION(get_nodes, STAT_FUNCTION_GET_NODES);
+TRACKED_FUNCTION(get_primary, STAT_FUNCTION_GET_PRIMARY);
+TRACKED_FUNCTION(get_other_nodes, STAT_FUNCTION_GET_OTHER_NODES);
+TRACKED_FUNCTION(get_upstream, STAT_FUNCTION_GET_UPSTREAM);
+TRACKED_FUNCTION(remove_node_by_nodeid, STAT_FUNCTION_REMOVE_NODE_BY_NODEID);
+TRACKED_FUNCTION(remove_node_by_host, STAT_FUNCTION_REMOVE_NODE_BY_HOST);
+TRACKED_FUNCTION(perform_failover, STAT_FUNCTION_PERFORM_FAILOVER);
+TRACKED_FUNCTION(perform_promotion, STAT_FUNCTION_PERFORM_PROMOTION);
+TRACKED_FUNCTION(start_maintenance, STAT_FUNCTION_START_MAINTENANCE);
+TRACKED_FUNCTION(stop_maintenance, STAT_FUNCTION_STOP_MAINTENANCE);
+TRACKED_FUNCTION(set_node_candidate_priority,
+				 STAT_FUNCTION_SET_NODE_CANDIDATE_PRIORITY);
+TRACKED_FUNCTION(set_node_replication_quorum,
+				 STAT_FUNCTION_SET_NODE_REPLICATION_QUORUM);
+TRACKED_FUNCTION(synchronous_standby_names,
+				 STAT_FUNCTION_SYNCHRONOUS_STANDBY_NAMES);
 
 
 /*
@@ -76,8 +117,8 @@ PG_FUNCTION_INFO_V1(synchronous_standby_names);
  * nodeport are valid, and it does a SELECT pg_is_in_recovery() to help decide
  * what initial role to attribute the entering node.
  */
-Datum
-register_node(PG_FUNCTION_ARGS)
+static Datum
+register_node_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
@@ -120,7 +161,13 @@ register_node(PG_FUNCTION_ARGS)
 	currentNodeState.candidatePriority = candidatePriority;
 	currentNodeState.replicationQuorum = replicationQuorum;
 
-	LockFormation(formationId, ExclusiveLock);
+	/*
+	 * Registrations are serialized within a formation, as the groupId and
+	 * the initial state depend on the other nodes, but they don't block the
+	 * node_active calls of the other groups.
+	 */
+	LockFormation(formationId, ShareLock);
+	LockFormationMembership(formationId, ExclusiveLock);
 
 	AutoFailoverFormation *formation = GetFormation(formationId);
 
@@ -182,18 +229,40 @@ register_node(PG_FUNCTION_ARGS)
 	}
 
 	/*
-	 * The register_node() function is STRICT but users may have skipped the
-	 * --name option on the create command line. We still want to avoid having
-	 * to scan all the 10 parameters for ISNULL tests, so instead our client
-	 * sends an empty string for the nodename.
+	 * Nodes registered in advance with register_nodes() are adopted by the
+	 * keeper that registers with the same node id, host and port, as long as
+	 * the node has not reported yet.
 	 */
-	JoinAutoFailoverFormation(formation,
-							  strcmp(nodeName, "") == 0 ? NULL : nodeName,
-							  nodeHost,
-							  nodePort,
-							  sysIdentifier,
-							  nodeCluster,
-							  &currentNodeState);
+	AutoFailoverNode *registeredNode =
+		currentNodeId > 0 ? GetAutoFailoverNodeById(currentNodeId) : NULL;
+
+	if (IsNodeRegisteredInAdvance(registeredNode, formationId,
+								  nodeHost, nodePort))
+	{
+		if (sysIdentifier != 0)
+		{
+			SetAutoFailoverNodeSysIdentifier(registeredNode->nodeId,
+											 sysIdentifier);
+		}
+
+		currentNodeState.groupId = registeredNode->groupId;
+	}
+	else
+	{
+		/*
+		 * The register_node() function is STRICT but users may have skipped
+		 * the --name option on the create command line. We still want to
+		 * avoid having to scan all the 10 parameters for ISNULL tests, so
+		 * instead our client sends an empty string for the nodename.
+		 */
+		JoinAutoFailoverFormation(formation,
+								  strcmp(nodeName, "") == 0 ? NULL : nodeName,
+								  nodeHost,
+								  nodePort,
+								  sysIdentifier,
+								  nodeCluster,
+								  &currentNodeState);
+	}
 
 	AutoFailoverNode *pgAutoFailoverNode = GetAutoFailoverNode(nodeHost, nodePort);
 	if (pgAutoFailoverNode == NULL)
@@ -221,6 +290,34 @@ register_node(PG_FUNCTION_ARGS)
 			currentNodeState.candidatePriority);
 	}
 
+	/*
+	 * When the group already runs as many pg_basebackup as allowed, the new
+	 * standby node waits in wait_standby until one of them reaches
+	 * catchingup. Let the user know why the node doesn't make progress.
+	 */
+	if (pgAutoFailoverNode->goalState == REPLICATION_STATE_WAIT_STANDBY &&
+		MaxConcurrentClones > 0)
+	{
+		List *groupNodeList =
+			AutoFailoverNodeGroup(formationId, currentNodeState.groupId);
+		int clonesCount = CountStandbyClonesInProgress(groupNodeList);
+
+		if (clonesCount >= MaxConcurrentClones)
+		{
+			char message[BUFSIZE] = { 0 };
+
+			LogAndNotifyMessage(
+				message, BUFSIZE,
+				NODE_FORMAT " waits in wait_standby: %d standby nodes "
+				"are being cloned in group %d, and "
+				"pgautofailover.max_concurrent_clones is %d",
+				NODE_FORMAT_ARGS(pgAutoFailoverNode),
+				clonesCount,
+				pgAutoFailoverNode->groupId,
+				MaxConcurrentClones);
+		}
+	}
+
 	/*
 	 * When adding a second sync node to a formation that has
 	 * number_sync_standbys set to zero (the default value for single node and
@@ -346,8 +443,8 @@ register_node(PG_FUNCTION_ARGS)
  * periodically call this function from the moment they start to communicate
  * their state to the monitor to obtain their assigned state.
  */
-Datum
-node_active(PG_FUNCTION_ARGS)
+static Datum
+node_active_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
@@ -365,6 +462,16 @@ node_active(PG_FUNCTION_ARGS)
 	text *currentPgsrSyncStateText = PG_GETARG_TEXT_P(7);
 	char *currentPgsrSyncState = text_to_cstring(currentPgsrSyncStateText);
 
+	XLogRecPtr currentReplayLSN = PG_GETARG_LSN(8);
+
+	StandbyLSNReport standbyLSNReport = { 0 };
+
+	InitStandbyLSNReport(&standbyLSNReport,
+						 PG_GETARG_ARRAYTYPE_P(9),
+						 PG_GETARG_ARRAYTYPE_P(10),
+						 PG_GETARG_ARRAYTYPE_P(11),
+						 PG_GETARG_ARRAYTYPE_P(12));
+
 	AutoFailoverNodeState currentNodeState = { 0 };
 
 	currentNodeState.nodeId = currentNodeId;
@@ -373,18 +480,23 @@ node_active(PG_FUNCTION_ARGS)
 		EnumGetReplicationState(currentReplicationStateOid);
 	currentNodeState.reportedTLI = currentTLI;
 	currentNodeState.reportedLSN = currentLSN;
+	currentNodeState.reportedReplayLSN = currentReplayLSN;
 	currentNodeState.pgsrSyncState = SyncStateFromString(currentPgsrSyncState);
 	currentNodeState.pgIsRunning = currentPgIsRunning;
 
 	AutoFailoverNodeState *assignedNodeState =
-		NodeActive(formationId, &currentNodeState);
+		NodeActive(formationId, &currentNodeState, &standbyLSNReport);
 
 	Oid newReplicationStateOid =
 		ReplicationStateGetEnum(assignedNodeState->replicationState);
 
+	/* keepers only fetch the other nodes again when the topology changed */
+	List *groupNodeList =
+		AutoFailoverNodeGroup(formationId, assignedNodeState->groupId);
+
 	TupleDesc resultDescriptor = NULL;
-	Datum values[5];
-	bool isNulls[5];
+	Datum values[6];
+	bool isNulls[6];
 
 	memset(values, 0, sizeof(values));
 	memset(isNulls, false, sizeof(isNulls));
@@ -394,6 +506,7 @@ node_active(PG_FUNCTION_ARGS)
 	values[2] = ObjectIdGetDatum(newReplicationStateOid);
 	values[3] = Int32GetDatum(assignedNodeState->candidatePriority);
 	values[4] = BoolGetDatum(assignedNodeState->replicationQuorum);
+	values[5] = Int64GetDatum(GroupTopologyVersion(groupNodeList));
 
 	TypeFuncClass resultTypeClass =
 		get_call_result_type(fcinfo, NULL, &resultDescriptor);
@@ -412,9 +525,11 @@ node_active(PG_FUNCTION_ARGS)
 
 /*
  * NodeActive reports the current state of a node and returns the assigned state.
+ * A primary node also reports the LSN positions of its standby nodes.
  */
 static AutoFailoverNodeState *
-NodeActive(char *formationId, AutoFailoverNodeState *currentNodeState)
+NodeActive(char *formationId, AutoFailoverNodeState *currentNodeState,
+		   StandbyLSNReport *standbyLSNReport)
 {
 	AutoFailoverNode *pgAutoFailoverNode = GetAutoFailoverNodeById(
 		currentNodeState->nodeId);
@@ -434,8 +549,77 @@ NodeActive(char *formationId, AutoFailoverNodeState *currentNodeState)
 	}
 	else
 	{
+		/* shed the load when too many keepers call us at once */
+		if (!TryLockNodeActiveSlot(currentNodeState->nodeId))
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_AUTO_FAILOVER_MONITOR_BUSY),
+					 errmsg("the monitor is busy, %d node_active calls are "
+							"already in progress",
+							NodeActiveMaxConcurrency),
+					 errhint("Retry after a random delay.")));
+		}
+
 		LockFormation(formationId, ShareLock);
 
+		/* keep track of the WAL rate of the node, see wal_rate.c */
+		RecordWalReport(pgAutoFailoverNode->nodeId,
+						currentNodeState->reportedLSN,
+						GetCurrentTimestamp());
+
+		/* the primary's view of its standby nodes, see sync_standby_lag.c */
+		if (CanTakeWritesInState(currentNodeState->replicationState))
+		{
+			RecordStandbyLSNReport(pgAutoFailoverNode->nodeId,
+								   standbyLSNReport);
+		}
+
+		/*
+		 * Most calls report the same state as the previous one, in a group
+		 * where every node already reached its goal state. There is nothing
+		 * for the state machine to decide then, so we only record the report
+		 * time and LSN, without taking the group lock. The UPDATE checks that
+		 * our goal state did not change concurrently.
+		 *
+		 * When the primary reports fresh standby LSN positions and the number
+		 * of synchronous standby nodes adapts to their lag, the state machine
+		 * has to look at them though.
+		 *
+		 * Losing the last heartbeats of a standby node in a crash of the
+		 * monitor is harmless: the keepers report again at their next call.
+		 * So such a transaction doesn't wait for its WAL to be flushed,
+		 * unless the session already asked for a lower durability.
+		 *
+		 * With pgautofailover.primary_lease_duration, the report time of the
+		 * primary is when its lease started though: losing it would have us
+		 * compute an earlier expiry than the one the keeper holds, and
+		 * promote another node while the primary still accepts writes. The
+		 * lease renewals are then always committed synchronously.
+		 */
+		if (IsUnchangedNodeReport(pgAutoFailoverNode, currentNodeState) &&
+			!(SyncStandbyMaxLag > 0 && standbyLSNReport->count > 0) &&
+			IsGroupSettled(AutoFailoverNodeGroup(formationId,
+												 pgAutoFailoverNode->groupId)) &&
+			ReportAutoFailoverNodeActivity(pgAutoFailoverNode->nodeId,
+										   currentNodeState->replicationState,
+										   currentNodeState->reportedLSN,
+										   currentNodeState->reportedReplayLSN))
+		{
+			bool renewsLease =
+				PrimaryLeaseDurationMs > 0 &&
+				currentNodeState->replicationState == REPLICATION_STATE_PRIMARY;
+
+			if (NodeActiveAsyncCommit && !renewsLease &&
+				synchronous_commit > SYNCHRONOUS_COMMIT_OFF)
+			{
+				(void) set_config_option("synchronous_commit", "off",
+										 PGC_USERSET, PGC_S_SESSION,
+										 GUC_ACTION_LOCAL, true, 0, false);
+			}
+
+			return AssignedNodeState(pgAutoFailoverNode);
+		}
+
 		if (pgAutoFailoverNode->reportedState != currentNodeState->replicationState)
 		{
 			/*
@@ -469,8 +653,14 @@ NodeActive(char *formationId, AutoFailoverNodeState *currentNodeState)
 			pgAutoFailoverNode->reportedState = currentNodeState->replicationState;
 			pgAutoFailoverNode->pgsrSyncState = currentNodeState->pgsrSyncState;
 			pgAutoFailoverNode->reportedLSN = currentNodeState->reportedLSN;
+			pgAutoFailoverNode->reportedReplayLSN =
+				currentNodeState->reportedReplayLSN;
 
-			NotifyStateChange(pgAutoFailoverNode, message);
+			NotifyStateChange(pgAutoFailoverNode, EVENT_CODE_REPORTED_STATE,
+							  message);
+
+			/* get_primary also looks at reported states */
+			InvalidateNodeCache();
 		}
 
 		/*
@@ -483,13 +673,28 @@ NodeActive(char *formationId, AutoFailoverNodeState *currentNodeState)
 									currentNodeState->pgIsRunning,
 									currentNodeState->pgsrSyncState,
 									currentNodeState->reportedTLI,
-									currentNodeState->reportedLSN);
+									currentNodeState->reportedLSN,
+									currentNodeState->reportedReplayLSN);
 	}
 
 	LockNodeGroup(formationId, currentNodeState->groupId, ExclusiveLock);
 
 	ProceedGroupState(pgAutoFailoverNode);
 
+	/* the health check workers take the next timeout driven decision */
+	ScheduleGroupStateDeadline(formationId, currentNodeState->groupId);
+
+	return AssignedNodeState(pgAutoFailoverNode);
+}
+
+
+/*
+ * AssignedNodeState returns the state assigned to the given node, as returned
+ * by node_active.
+ */
+static AutoFailoverNodeState *
+AssignedNodeState(AutoFailoverNode *pgAutoFailoverNode)
+{
 	AutoFailoverNodeState *assignedNodeState =
 		(AutoFailoverNodeState *) palloc0(sizeof(AutoFailoverNodeState));
 	assignedNodeState->nodeId = pgAutoFailoverNode->nodeId;
@@ -502,6 +707,24 @@ NodeActive(char *formationId, AutoFailoverNodeState *currentNodeState)
 }
 
 
+/*
+ * IsUnchangedNodeReport returns true when the node reports the same state
+ * as in its previous call to node_active, and already reached its goal state.
+ * The LSN is expected to change from one call to the next.
+ */
+static bool
+IsUnchangedNodeReport(AutoFailoverNode *pgAutoFailoverNode,
+					  AutoFailoverNodeState *currentNodeState)
+{
+	return pgAutoFailoverNode->reportedState == currentNodeState->replicationState &&
+		   pgAutoFailoverNode->goalState == currentNodeState->replicationState &&
+		   pgAutoFailoverNode->pgIsRunning == currentNodeState->pgIsRunning &&
+		   pgAutoFailoverNode->pgsrSyncState == currentNodeState->pgsrSyncState &&
+		   (currentNodeState->reportedTLI == 0 ||
+			pgAutoFailoverNode->reportedTLI == currentNodeState->reportedTLI);
+}
+
+
 /*
  * JoinAutoFailoverFormation adds a new node to a AutoFailover formation.
  */
@@ -681,6 +904,25 @@ JoinAutoFailoverFormation(AutoFailoverFormation *formation,
 }
 
 
+/*
+ * IsNodeRegisteredInAdvance returns true when the given node exists in the
+ * given formation with the given host and port, and has not reported to the
+ * monitor yet: that's the case of nodes registered with register_nodes(),
+ * before their pg_autoctl service runs, and of a pg_autoctl create command
+ * that failed after its registration.
+ */
+static bool
+IsNodeRegisteredInAdvance(AutoFailoverNode *node, char *formationId,
+						  char *nodeHost, int nodePort)
+{
+	return node != NULL &&
+		   strcmp(node->formationId, formationId) == 0 &&
+		   strcmp(node->nodeHost, nodeHost) == 0 &&
+		   node->nodePort == nodePort &&
+		   node->reportedState == REPLICATION_STATE_INITIAL;
+}
+
+
 /*
  * AssignGroupId assigns a group ID to a new node and returns it.
  */
@@ -725,8 +967,8 @@ AssignGroupId(AutoFailoverFormation *formation, char *nodeHost, int nodePort,
 /*
  * get_primary returns the node in a group which currently takes writes.
  */
-Datum
-get_primary(PG_FUNCTION_ARGS)
+static Datum
+get_primary_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
@@ -739,12 +981,21 @@ get_primary(PG_FUNCTION_ARGS)
 	Datum values[4];
 	bool isNulls[4];
 
+	uint64 cacheGeneration = 0;
+
 	AutoFailoverNode *primaryNode =
-		GetPrimaryOrDemotedNodeInGroup(formationId, groupId);
+		LookupCachedPrimaryNode(formationId, groupId, &cacheGeneration);
 
 	if (primaryNode == NULL)
 	{
-		ereport(ERROR, (errmsg("group has no writable node right now")));
+		primaryNode = GetPrimaryOrDemotedNodeInGroup(formationId, groupId);
+
+		if (primaryNode == NULL)
+		{
+			ereport(ERROR, (errmsg("group has no writable node right now")));
+		}
+
+		CachePrimaryNode(formationId, groupId, cacheGeneration, primaryNode);
 	}
 
 	memset(values, 0, sizeof(values));
@@ -768,82 +1019,116 @@ get_primary(PG_FUNCTION_ARGS)
 }
 
 
-typedef struct get_nodes_fctx
-{
-	List *nodesList;
-} get_nodes_fctx;
-
 /*
- * get_nodes returns all the node in a group, if any.
+ * get_upstream returns the node that the given standby node streams WAL
+ * from: the primary node, or with pgautofailover.cascade_by_cluster a
+ * secondary node of the same node cluster.
  */
-Datum
-get_nodes(PG_FUNCTION_ARGS)
+static Datum
+get_upstream_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
-	FuncCallContext *funcctx;
-	get_nodes_fctx *fctx;
-	MemoryContext oldcontext;
+	int64 nodeId = PG_GETARG_INT64(0);
 
-	/* stuff done only on the first call of the function */
-	if (SRF_IS_FIRSTCALL())
+	TupleDesc resultDescriptor = NULL;
+	Datum values[4];
+	bool isNulls[4];
+
+	AutoFailoverNode *activeNode = GetAutoFailoverNodeById(nodeId);
+
+	if (activeNode == NULL)
 	{
-		text *formationIdText = PG_GETARG_TEXT_P(0);
-		char *formationId = text_to_cstring(formationIdText);
+		ereport(ERROR,
+				(errmsg("node " INT64_FORMAT " is not registered", nodeId)));
+	}
 
-		if (PG_ARGISNULL(0))
-		{
-			ereport(ERROR, (errmsg("formation_id must not be null")));
-		}
+	List *groupNodeList =
+		AutoFailoverNodeGroup(activeNode->formationId, activeNode->groupId);
 
-		checkPgAutoFailoverVersion();
+	AutoFailoverNode *upstreamNode = FindUpstreamNode(activeNode, groupNodeList);
 
-		/* create a function context for cross-call persistence */
-		funcctx = SRF_FIRSTCALL_INIT();
+	if (upstreamNode == NULL)
+	{
+		ereport(ERROR, (errmsg("group has no writable node right now")));
+	}
 
-		/*
-		 * switch to memory context appropriate for multiple function calls
-		 */
-		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
 
-		/* allocate memory for user context */
-		fctx = (get_nodes_fctx *) palloc(sizeof(get_nodes_fctx));
+	values[0] = Int64GetDatum(upstreamNode->nodeId);
+	values[1] = CStringGetTextDatum(upstreamNode->nodeName);
+	values[2] = CStringGetTextDatum(upstreamNode->nodeHost);
+	values[3] = Int32GetDatum(upstreamNode->nodePort);
 
-		/*
-		 * Use fctx to keep state from call to call. Seed current with the
-		 * original start value
-		 */
-		if (PG_ARGISNULL(1))
-		{
-			fctx->nodesList = AllAutoFailoverNodes(formationId);
-		}
-		else
-		{
-			int32 groupId = PG_GETARG_INT32(1);
+	TypeFuncClass resultTypeClass = get_call_result_type(fcinfo, NULL, &resultDescriptor);
+	if (resultTypeClass != TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR, (errmsg("return type must be a row type")));
+	}
 
-			fctx->nodesList = AutoFailoverAllNodesInGroup(formationId, groupId);
-		}
+	HeapTuple resultTuple = heap_form_tuple(resultDescriptor, values, isNulls);
+	Datum resultDatum = HeapTupleGetDatum(resultTuple);
+
+	PG_RETURN_DATUM(resultDatum);
+}
+
+
+/*
+ * get_nodes returns all the node in a group, if any.
+ */
+static Datum
+get_nodes_internal(PG_FUNCTION_ARGS)
+{
+	checkPgAutoFailoverVersion();
+
+	if (PG_ARGISNULL(0))
+	{
+		ereport(ERROR, (errmsg("formation_id must not be null")));
+	}
 
-		funcctx->user_fctx = fctx;
-		MemoryContextSwitchTo(oldcontext);
+	text *formationIdText = PG_GETARG_TEXT_P(0);
+	char *formationId = text_to_cstring(formationIdText);
+	List *nodesList = NIL;
+
+	if (PG_ARGISNULL(1))
+	{
+		nodesList = AllAutoFailoverNodes(formationId);
 	}
+	else
+	{
+		int32 groupId = PG_GETARG_INT32(1);
 
-	/* stuff done on every call of the function */
-	funcctx = SRF_PERCALL_SETUP();
+		nodesList = AutoFailoverAllNodesInGroup(formationId, groupId);
+	}
 
-	/*
-	 * get the saved state and use current as the result for this iteration
-	 */
-	fctx = funcctx->user_fctx;
+	ReturnNodesList(fcinfo, nodesList);
+
+	return (Datum) 0;
+}
+
+
+/*
+ * ReturnNodesList returns the given list of nodes as the result set of
+ * get_nodes and get_other_nodes. We use the materialize mode so that the list
+ * of nodes is scanned only once, rather than once per row returned.
+ */
+static void
+ReturnNodesList(FunctionCallInfo fcinfo, List *nodesList)
+{
+	ListCell *nodeCell = NULL;
 
-	if (fctx->nodesList != NIL)
+	InitMaterializedSRF(fcinfo, 0);
+
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+
+	foreach(nodeCell, nodesList)
 	{
-		TupleDesc resultDescriptor = NULL;
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
 		Datum values[6];
 		bool isNulls[6];
 
-		AutoFailoverNode *node = (AutoFailoverNode *) linitial(fctx->nodesList);
-
 		memset(values, 0, sizeof(values));
 		memset(isNulls, false, sizeof(isNulls));
 
@@ -854,23 +1139,9 @@ get_nodes(PG_FUNCTION_ARGS)
 		values[4] = LSNGetDatum(node->reportedLSN);
 		values[5] = BoolGetDatum(CanTakeWritesInState(node->reportedState));
 
-		TypeFuncClass resultTypeClass = get_call_result_type(fcinfo, NULL,
-															 &resultDescriptor);
-		if (resultTypeClass != TYPEFUNC_COMPOSITE)
-		{
-			ereport(ERROR, (errmsg("return type must be a row type")));
-		}
-
-		HeapTuple resultTuple = heap_form_tuple(resultDescriptor, values, isNulls);
-		Datum resultDatum = HeapTupleGetDatum(resultTuple);
-
-		/* prepare next SRF call */
-		fctx->nodesList = list_delete_first(fctx->nodesList);
-
-		SRF_RETURN_NEXT(funcctx, PointerGetDatum(resultDatum));
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc,
+							 values, isNulls);
 	}
-
-	SRF_RETURN_DONE(funcctx);
 }
 
 
@@ -891,114 +1162,45 @@ get_other_node(PG_FUNCTION_ARGS)
 /*
  * get_other_nodes returns the other node in a group, if any.
  */
-Datum
-get_other_nodes(PG_FUNCTION_ARGS)
+static Datum
+get_other_nodes_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
-	FuncCallContext *funcctx;
-	get_nodes_fctx *fctx;
-	MemoryContext oldcontext;
+	int64 nodeId = PG_GETARG_INT64(0);
+	List *nodesList = NIL;
 
-	/* stuff done only on the first call of the function */
-	if (SRF_IS_FIRSTCALL())
+	AutoFailoverNode *activeNode = GetAutoFailoverNodeById(nodeId);
+	if (activeNode == NULL)
 	{
-		int64 nodeId = PG_GETARG_INT64(0);
-
-
-		checkPgAutoFailoverVersion();
-
-		/* create a function context for cross-call persistence */
-		funcctx = SRF_FIRSTCALL_INIT();
-
-		/*
-		 * switch to memory context appropriate for multiple function calls
-		 */
-		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
-
-		/* allocate memory for user context */
-		fctx = (get_nodes_fctx *) palloc(sizeof(get_nodes_fctx));
-
-		/*
-		 * Use fctx to keep state from call to call. Seed current with the
-		 * original start value
-		 */
-		AutoFailoverNode *activeNode = GetAutoFailoverNodeById(nodeId);
-		if (activeNode == NULL)
-		{
-			ereport(ERROR, (errcode(ERRCODE_UNDEFINED_OBJECT),
-							errmsg("node %lld is not registered",
-								   (long long) nodeId)));
-		}
-
-		if (PG_NARGS() == 1)
-		{
-			fctx->nodesList = AutoFailoverOtherNodesList(activeNode);
-		}
-		else if (PG_NARGS() == 2)
-		{
-			Oid currentReplicationStateOid = PG_GETARG_OID(1);
-			ReplicationState currentState =
-				EnumGetReplicationState(currentReplicationStateOid);
-
-			fctx->nodesList =
-				AutoFailoverOtherNodesListInState(activeNode, currentState);
-		}
-		else
-		{
-			/* that's a bug in the SQL exposure of that function */
-			ereport(ERROR,
-					(errmsg("unsupported number of arguments (%d)",
-							PG_NARGS())));
-		}
-
-		funcctx->user_fctx = fctx;
-		MemoryContextSwitchTo(oldcontext);
+		ereport(ERROR, (errcode(ERRCODE_UNDEFINED_OBJECT),
+						errmsg("node %lld is not registered",
+							   (long long) nodeId)));
 	}
 
-	/* stuff done on every call of the function */
-	funcctx = SRF_PERCALL_SETUP();
-
-	/*
-	 * get the saved state and use current as the result for this iteration
-	 */
-	fctx = funcctx->user_fctx;
-
-	if (fctx->nodesList != NIL)
+	if (PG_NARGS() == 1)
 	{
-		TupleDesc resultDescriptor = NULL;
-		Datum values[6];
-		bool isNulls[6];
-
-		AutoFailoverNode *node = (AutoFailoverNode *) linitial(fctx->nodesList);
-
-		memset(values, 0, sizeof(values));
-		memset(isNulls, false, sizeof(isNulls));
-
-		values[0] = Int64GetDatum(node->nodeId);
-		values[1] = CStringGetTextDatum(node->nodeName);
-		values[2] = CStringGetTextDatum(node->nodeHost);
-		values[3] = Int32GetDatum(node->nodePort);
-		values[4] = LSNGetDatum(node->reportedLSN);
-		values[5] = BoolGetDatum(CanTakeWritesInState(node->reportedState));
-
-		TypeFuncClass resultTypeClass = get_call_result_type(fcinfo, NULL,
-															 &resultDescriptor);
-		if (resultTypeClass != TYPEFUNC_COMPOSITE)
-		{
-			ereport(ERROR, (errmsg("return type must be a row type")));
-		}
-
-		HeapTuple resultTuple = heap_form_tuple(resultDescriptor, values, isNulls);
-		Datum resultDatum = HeapTupleGetDatum(resultTuple);
-
-		/* prepare next SRF call */
-		fctx->nodesList = list_delete_first(fctx->nodesList);
+		nodesList = AutoFailoverOtherNodesList(activeNode);
+	}
+	else if (PG_NARGS() == 2)
+	{
+		Oid currentReplicationStateOid = PG_GETARG_OID(1);
+		ReplicationState currentState =
+			EnumGetReplicationState(currentReplicationStateOid);
 
-		SRF_RETURN_NEXT(funcctx, PointerGetDatum(resultDatum));
+		nodesList = AutoFailoverOtherNodesListInState(activeNode, currentState);
+	}
+	else
+	{
+		/* that's a bug in the SQL exposure of that function */
+		ereport(ERROR,
+				(errmsg("unsupported number of arguments (%d)",
+						PG_NARGS())));
 	}
 
-	SRF_RETURN_DONE(funcctx);
+	ReturnNodesList(fcinfo, nodesList);
+
+	return (Datum) 0;
 }
 
 
@@ -1019,8 +1221,8 @@ remove_node(PG_FUNCTION_ARGS)
 /*
  * remove_node removes the given node from the monitor.
  */
-Datum
-remove_node_by_nodeid(PG_FUNCTION_ARGS)
+static Datum
+remove_node_by_nodeid_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
@@ -1043,8 +1245,8 @@ remove_node_by_nodeid(PG_FUNCTION_ARGS)
 /*
  * remove_node removes the given node from the monitor.
  */
-Datum
-remove_node_by_host(PG_FUNCTION_ARGS)
+static Datum
+remove_node_by_host_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
@@ -1079,7 +1281,10 @@ RemoveNode(AutoFailoverNode *currentNode, bool force)
 		return false;
 	}
 
-	LockFormation(currentNode->formationId, ExclusiveLock);
+	/* only block the node_active calls of the group of the removed node */
+	LockFormation(currentNode->formationId, ShareLock);
+	LockFormationMembership(currentNode->formationId, ExclusiveLock);
+	LockNodeGroup(currentNode->formationId, currentNode->groupId, ExclusiveLock);
 
 	AutoFailoverFormation *formation = GetFormation(currentNode->formationId);
 
@@ -1265,8 +1470,8 @@ RemoveNode(AutoFailoverNode *currentNode, bool force)
 /*
  * perform_failover promotes the secondary in the given group
  */
-Datum
-perform_failover(PG_FUNCTION_ARGS)
+static Datum
+perform_failover_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
@@ -1424,7 +1629,7 @@ perform_failover(PG_FUNCTION_ARGS)
 			primaryNode->candidatePriority,
 			NODE_FORMAT_ARGS(primaryNode));
 
-		NotifyStateChange(primaryNode, message);
+		NotifyStateChange(primaryNode, EVENT_CODE_SETTINGS, message);
 
 		/* now proceed with the failover, starting with the first standby */
 		(void) ProceedGroupState(firstStandbyNode);
@@ -1437,8 +1642,8 @@ perform_failover(PG_FUNCTION_ARGS)
 /*
  * promote promotes a given target node in a group.
  */
-Datum
-perform_promotion(PG_FUNCTION_ARGS)
+static Datum
+perform_promotion_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
@@ -1555,7 +1760,7 @@ perform_promotion(PG_FUNCTION_ARGS)
 			currentNode->candidatePriority,
 			NODE_FORMAT_ARGS(currentNode));
 
-		NotifyStateChange(currentNode, message);
+		NotifyStateChange(currentNode, EVENT_CODE_SETTINGS, message);
 
 		/*
 		 * In case of errors in the perform_failover function, we ereport an
@@ -1577,14 +1782,43 @@ perform_promotion(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * proceed_pending_group runs the state machine of the given group as the
+ * health check workers do with pgautofailover.proceed_pending_groups, for
+ * each of its nodes that is still reporting, and returns false when the group
+ * is settled and there was nothing to do.
+ */
+Datum
+proceed_pending_group(PG_FUNCTION_ARGS)
+{
+	checkPgAutoFailoverVersion();
+
+	text *formationIdText = PG_GETARG_TEXT_P(0);
+	char *formationId = text_to_cstring(formationIdText);
+
+	int32 groupId = PG_GETARG_INT32(1);
+
+	AutoFailoverFormation *formation = GetFormation(formationId);
+
+	if (formation == NULL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("formation \"%s\" does not exist", formationId)));
+	}
+
+	PG_RETURN_BOOL(ProceedPendingGroupState(formationId, groupId));
+}
+
+
 /*
  * start_maintenance sets the given node in maintenance state.
  *
  * This operation is only allowed on a secondary node. To do so on a primary
  * node, first failover so that it's now a secondary.
  */
-Datum
-start_maintenance(PG_FUNCTION_ARGS)
+static Datum
+start_maintenance_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
@@ -1854,8 +2088,8 @@ start_maintenance(PG_FUNCTION_ARGS)
  *
  * This operation is only allowed on a node that's in the maintenance state.
  */
-Datum
-stop_maintenance(PG_FUNCTION_ARGS)
+static Datum
+stop_maintenance_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
@@ -1966,8 +2200,8 @@ stop_maintenance(PG_FUNCTION_ARGS)
 /*
  * set_node_candidate_priority sets node candidate priority property
  */
-Datum
-set_node_candidate_priority(PG_FUNCTION_ARGS)
+static Datum
+set_node_candidate_priority_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
@@ -2072,7 +2306,7 @@ set_node_candidate_priority(PG_FUNCTION_ARGS)
 			currentNode->candidatePriority,
 			NODE_FORMAT_ARGS(currentNode));
 
-		NotifyStateChange(currentNode, message);
+		NotifyStateChange(currentNode, EVENT_CODE_SETTINGS, message);
 	}
 	else
 	{
@@ -2128,8 +2362,8 @@ set_node_candidate_priority(PG_FUNCTION_ARGS)
 /*
  * set_node_replication_quorum sets node replication quorum property
  */
-Datum
-set_node_replication_quorum(PG_FUNCTION_ARGS)
+static Datum
+set_node_replication_quorum_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
@@ -2220,7 +2454,7 @@ set_node_replication_quorum(PG_FUNCTION_ARGS)
 			currentNode->replicationQuorum ? "true" : "false",
 			NODE_FORMAT_ARGS(currentNode));
 
-		NotifyStateChange(currentNode, message);
+		NotifyStateChange(currentNode, EVENT_CODE_SETTINGS, message);
 	}
 	else
 	{
@@ -2280,8 +2514,8 @@ set_node_replication_quorum(PG_FUNCTION_ARGS)
  * and will take it from there that they need to update their HBA rules when
  * the hostname has changed.
  */
-Datum
-update_node_metadata(PG_FUNCTION_ARGS)
+static Datum
+update_node_metadata_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
@@ -2358,9 +2592,15 @@ update_node_metadata(PG_FUNCTION_ARGS)
 /*
  * synchronous_standby_names returns the synchronous_standby_names parameter
  * value for a given Postgres service group in a given formation.
+ *
+ * The primary's keeper asks for it each time it applies settings, and
+ * formation_settings() computes it for every group, so we serve it from the
+ * node cache when its inputs have not changed. In adaptive mode the setting
+ * also depends on the lag of the standby nodes, which changes with every
+ * report, so it is not cached then.
  */
-Datum
-synchronous_standby_names(PG_FUNCTION_ARGS)
+static Datum
+synchronous_standby_names_internal(PG_FUNCTION_ARGS)
 {
 	checkPgAutoFailoverVersion();
 
@@ -2369,6 +2609,30 @@ synchronous_standby_names(PG_FUNCTION_ARGS)
 
 	int32 groupId = PG_GETARG_INT32(1);
 
+	uint64 cacheGeneration = 0;
+	char *standbyNames =
+		SyncStandbyMaxLag == 0
+		? LookupCachedStandbyNames(formationId, groupId, &cacheGeneration)
+		: NULL;
+
+	if (standbyNames == NULL)
+	{
+		standbyNames = BuildSynchronousStandbyNames(formationId, groupId);
+
+		CacheStandbyNames(formationId, groupId, cacheGeneration, standbyNames);
+	}
+
+	PG_RETURN_TEXT_P(cstring_to_text(standbyNames));
+}
+
+
+/*
+ * BuildSynchronousStandbyNames computes the synchronous_standby_names setting
+ * of the given group from the nodes of the group and the formation settings.
+ */
+static char *
+BuildSynchronousStandbyNames(char *formationId, int32 groupId)
+{
 	AutoFailoverFormation *formation = GetFormation(formationId);
 
 	List *nodesGroupList = AutoFailoverNodeGroup(formationId, groupId);
@@ -2389,7 +2653,7 @@ synchronous_standby_names(PG_FUNCTION_ARGS)
 	/* when we have a SINGLE node we disable synchronous replication */
 	if (nodesCount == 1)
 	{
-		PG_RETURN_TEXT_P(cstring_to_text(""));
+		return pstrdup("");
 	}
 
 	/* when we have more than one node, fetch the primary */
@@ -2415,12 +2679,12 @@ synchronous_standby_names(PG_FUNCTION_ARGS)
 							 "ANY 1 (pgautofailover_standby_%lld)",
 							 (long long) secondaryNode->nodeId);
 
-			PG_RETURN_TEXT_P(cstring_to_text(sbnames->data));
+			return sbnames->data;
 		}
 		else
 		{
 			/* disable synchronous replication */
-			PG_RETURN_TEXT_P(cstring_to_text(""));
+			return pstrdup("");
 		}
 	}
 
@@ -2450,7 +2714,7 @@ synchronous_standby_names(PG_FUNCTION_ARGS)
 			 *  If no standby participates in the replication Quorum, we
 			 * disable synchronous replication.
 			 */
-			PG_RETURN_TEXT_P(cstring_to_text(""));
+			return pstrdup("");
 		}
 		else
 		{
@@ -2458,11 +2722,11 @@ synchronous_standby_names(PG_FUNCTION_ARGS)
 			 * We accept number_sync_standbys to be set to zero to enable our
 			 * failover trade-off, but won't send a synchronous_standby_names
 			 * setting with ANY 0 () or FIRST 0 (), that would not make sense.
+			 * See EffectiveNumberSyncStandbys for the adaptive mode.
 			 */
 			int number_sync_standbys =
-				formation->number_sync_standbys == 0
-				? 1
-				: formation->number_sync_standbys;
+				EffectiveNumberSyncStandbys(formation,
+											syncStandbyNodesGroupList);
 
 			StringInfo sbnames = makeStringInfo();
 			ListCell *nodeCell = NULL;
@@ -2486,7 +2750,7 @@ synchronous_standby_names(PG_FUNCTION_ARGS)
 			}
 			appendStringInfoString(sbnames, ")");
 
-			PG_RETURN_TEXT_P(cstring_to_text(sbnames->data));
+			return sbnames->data;
 		}
 	}
 }
@@ -0,0 +1,603 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/node_cache.c
+ *
+ * Implementation of a shared memory cache of the primary node of each group,
+ * so that get_primary() can answer without scanning pgautofailover.node, and
+ * of the synchronous_standby_names setting of each group, so that
+ * synchronous_standby_names() and formation_settings() do not have to scan
+ * the nodes and build the setting again each time they are called.
+ *
+ * The cache is invalidated as a whole: every transaction that changes the
+ * role of a node, its name, host, or port, its candidate priority or
+ * replication quorum, or the number_sync_standbys of a formation, increments
+ * a generation counter when it commits, and cache entries are only used when
+ * they have been computed at the current generation. Both parts of an entry
+ * have their own generation, as they are computed separately.
+ *
+ * Readers do not take any lock: the entries are kept in an open addressing
+ * array where each entry is protected by a change counter, in the same way
+ * as PgBackendStatus. Writers, serialized by an LWLock, increment the counter
+ * before and after updating an entry, and readers retry when the counter was
+ * odd, or has changed while they copied the entry. Entries are never emptied
+ * once used, only overwritten, so that probe sequences stay valid.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+/* these are internal headers */
+#include "node_cache.h"
+#include "node_metadata.h"
+#include "version_compat.h"
+
+#include "access/xact.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+
+
+/*
+ * We cache up to NODE_CACHE_MAX_GROUPS groups, and only names and hostnames
+ * that fit in the entries: other groups are not cached.
+ */
+#define NODE_CACHE_MAX_GROUPS 1024
+#define NODE_CACHE_NAME_LEN 256
+#define NODE_CACHE_STANDBY_NAMES_LEN 1024
+
+/* how many entries we look at for a given group, and read attempts of each */
+#define NODE_CACHE_MAX_PROBES 8
+#define NODE_CACHE_MAX_READ_RETRIES 4
+
+
+typedef struct NodeCacheKey
+{
+	char formationId[NAMEDATALEN];
+	int32 groupId;
+} NodeCacheKey;
+
+typedef struct NodeCacheEntry
+{
+	/* odd while a writer is updating the entry */
+	pg_atomic_uint32 changeCount;
+
+	NodeCacheKey key;
+
+	/* the primary node of the group, zero generation when not cached */
+	uint64 generation;
+	int64 nodeId;
+	char nodeName[NODE_CACHE_NAME_LEN];
+	char nodeHost[NODE_CACHE_NAME_LEN];
+	int nodePort;
+
+	/* synchronous_standby_names of the group, likewise */
+	uint64 standbyNamesGeneration;
+	char standbyNames[NODE_CACHE_STANDBY_NAMES_LEN];
+} NodeCacheEntry;
+
+typedef struct NodeCacheControlData
+{
+	int trancheId;
+	char *lockTrancheName;
+	LWLock lock;
+
+	/* incremented each time a transaction that changed the nodes commits */
+	pg_atomic_uint64 generation;
+
+	/* writers hold the lock, readers use the change counter of each entry */
+	NodeCacheEntry entries[FLEXIBLE_ARRAY_MEMBER];
+} NodeCacheControlData;
+
+
+static NodeCacheControlData *NodeCacheControl = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* set when the current transaction changed the nodes */
+static bool NodeCacheInvalidated = false;
+
+
+static void NodeCacheShmemInit(void);
+static void NodeCacheXactCallback(XactEvent event, void *arg);
+static bool BuildNodeCacheKey(char *formationId, int32 groupId,
+							  NodeCacheKey *key);
+static bool LookupNodeCacheEntry(char *formationId, int32 groupId,
+								 uint64 *generation, NodeCacheEntry *copy);
+static bool ReadNodeCacheEntry(NodeCacheEntry *entry, NodeCacheEntry *copy);
+static NodeCacheEntry * BeginNodeCacheEntryUpdate(NodeCacheKey *key,
+												  uint64 generation);
+static void EndNodeCacheEntryUpdate(NodeCacheEntry *entry);
+
+
+/*
+ * InitializeNodeCache, called at server start, requests the shared memory
+ * needed for the node cache.
+ */
+void
+InitializeNodeCache(void)
+{
+	/* on PG 15, we use shmem_request_hook_type */
+#if PG_VERSION_NUM < 150000
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(NodeCacheShmemSize());
+	}
+#endif
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = NodeCacheShmemInit;
+
+	RegisterXactCallback(NodeCacheXactCallback, NULL);
+}
+
+
+/*
+ * NodeCacheShmemSize computes how much shared memory the node cache needs.
+ */
+size_t
+NodeCacheShmemSize(void)
+{
+	Size size = offsetof(NodeCacheControlData, entries);
+
+	size = add_size(size, mul_size(NODE_CACHE_MAX_GROUPS,
+								   sizeof(NodeCacheEntry)));
+
+	return size;
+}
+
+
+/*
+ * NodeCacheShmemInit initializes the shared memory of the node cache.
+ */
+static void
+NodeCacheShmemInit(void)
+{
+	bool alreadyInitialized = false;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	NodeCacheControl =
+		(NodeCacheControlData *) ShmemInitStruct("pg_auto_failover Node Cache",
+												 NodeCacheShmemSize(),
+												 &alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		NodeCacheControl->trancheId = LWLockNewTrancheId();
+		NodeCacheControl->lockTrancheName = "pg_auto_failover Node Cache";
+		LWLockRegisterTranche(NodeCacheControl->trancheId,
+							  NodeCacheControl->lockTrancheName);
+
+		LWLockInitialize(&NodeCacheControl->lock, NodeCacheControl->trancheId);
+
+		pg_atomic_init_u64(&(NodeCacheControl->generation), 1);
+
+		for (int index = 0; index < NODE_CACHE_MAX_GROUPS; index++)
+		{
+			NodeCacheEntry *entry = &(NodeCacheControl->entries[index]);
+
+			memset(entry, 0, sizeof(NodeCacheEntry));
+			pg_atomic_init_u32(&(entry->changeCount), 0);
+		}
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/*
+ * InvalidateNodeCache registers that the current transaction changes the role,
+ * name, host, port, candidate priority, or replication quorum of a node, or
+ * the number_sync_standbys of a formation. The whole cache is invalidated
+ * when the transaction commits.
+ */
+void
+InvalidateNodeCache(void)
+{
+	NodeCacheInvalidated = true;
+}
+
+
+/*
+ * NodeCacheXactCallback increments the cache generation once a transaction
+ * that called InvalidateNodeCache has committed. Callbacks for the COMMIT
+ * event are called after the transaction is visible to new snapshots, so a
+ * backend that reads the new generation then also sees the changes.
+ *
+ * A prepared transaction becomes visible at COMMIT PREPARED, maybe in another
+ * backend, where no callback knows that the cache has to be invalidated. So
+ * we refuse to PREPARE a transaction that invalidates the cache.
+ */
+static void
+NodeCacheXactCallback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		{
+			if (NodeCacheInvalidated && NodeCacheControl != NULL)
+			{
+				pg_atomic_fetch_add_u64(&(NodeCacheControl->generation), 1);
+			}
+
+			NodeCacheInvalidated = false;
+			break;
+		}
+
+		case XACT_EVENT_PRE_PREPARE:
+		{
+			if (NodeCacheInvalidated)
+			{
+				ereport(ERROR,
+						(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						 errmsg("cannot PREPARE a transaction that has "
+								"changed pg_auto_failover nodes")));
+			}
+			break;
+		}
+
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+		{
+			NodeCacheInvalidated = false;
+			break;
+		}
+
+		default:
+		{
+			/* nothing to do */
+			break;
+		}
+	}
+}
+
+
+/*
+ * LookupCachedPrimaryNode returns the cached primary node of the given group,
+ * or NULL when the cache can not be used. In that case, generation is set to
+ * the generation to pass to CachePrimaryNode once the primary node has been
+ * fetched from the node table.
+ */
+AutoFailoverNode *
+LookupCachedPrimaryNode(char *formationId, int32 groupId, uint64 *generation)
+{
+	NodeCacheEntry copy;
+
+	if (!LookupNodeCacheEntry(formationId, groupId, generation, &copy) ||
+		copy.generation != *generation)
+	{
+		return NULL;
+	}
+
+	AutoFailoverNode *primaryNode = palloc0(sizeof(AutoFailoverNode));
+
+	primaryNode->formationId = pstrdup(formationId);
+	primaryNode->groupId = groupId;
+	primaryNode->nodeId = copy.nodeId;
+	primaryNode->nodeName = pstrdup(copy.nodeName);
+	primaryNode->nodeHost = pstrdup(copy.nodeHost);
+	primaryNode->nodePort = copy.nodePort;
+
+	return primaryNode;
+}
+
+
+/*
+ * LookupCachedStandbyNames returns the cached synchronous_standby_names of the
+ * given group, or NULL when the cache can not be used. In that case,
+ * generation is set to the generation to pass to CacheStandbyNames once the
+ * setting has been computed.
+ */
+char *
+LookupCachedStandbyNames(char *formationId, int32 groupId, uint64 *generation)
+{
+	NodeCacheEntry copy;
+
+	if (!LookupNodeCacheEntry(formationId, groupId, generation, &copy) ||
+		copy.standbyNamesGeneration != *generation)
+	{
+		return NULL;
+	}
+
+	return pstrdup(copy.standbyNames);
+}
+
+
+/*
+ * LookupNodeCacheEntry copies the cache entry of the given group, and returns
+ * false when the group is not cached, or when the cache can not be used. The
+ * caller checks that the part of the entry it needs has been computed at the
+ * current generation, which we set in generation, or to zero when the cache
+ * can not be used.
+ */
+static bool
+LookupNodeCacheEntry(char *formationId, int32 groupId,
+					 uint64 *generation, NodeCacheEntry *copy)
+{
+	NodeCacheKey key;
+
+	*generation = 0;
+
+	/*
+	 * The current transaction might not see the same nodes as everybody else:
+	 * it either changed them itself, or uses a snapshot that could predate
+	 * the current generation.
+	 */
+	if (NodeCacheControl == NULL ||
+		NodeCacheInvalidated ||
+		IsolationUsesXactSnapshot() ||
+		!BuildNodeCacheKey(formationId, groupId, &key))
+	{
+		return false;
+	}
+
+	uint64 currentGeneration = pg_atomic_read_u64(&(NodeCacheControl->generation));
+	uint32 hash = tag_hash(&key, sizeof(NodeCacheKey));
+
+	/* on a miss, the caller computes the value and caches it for us */
+	*generation = currentGeneration;
+
+	for (int probe = 0; probe < NODE_CACHE_MAX_PROBES; probe++)
+	{
+		int index = (hash + probe) % NODE_CACHE_MAX_GROUPS;
+		NodeCacheEntry *entry = &(NodeCacheControl->entries[index]);
+
+		if (!ReadNodeCacheEntry(entry, copy))
+		{
+			/* a writer keeps updating that entry, just use the node table */
+			return false;
+		}
+
+		/* entries are never emptied, so the group is not cached */
+		if (copy->key.formationId[0] == '\0')
+		{
+			return false;
+		}
+
+		if (memcmp(&(copy->key), &key, sizeof(NodeCacheKey)) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * ReadNodeCacheEntry copies the given entry without taking any lock, and
+ * returns false when a concurrent writer kept us from getting a consistent
+ * copy after a few attempts.
+ */
+static bool
+ReadNodeCacheEntry(NodeCacheEntry *entry, NodeCacheEntry *copy)
+{
+	for (int attempt = 0; attempt < NODE_CACHE_MAX_READ_RETRIES; attempt++)
+	{
+		uint32 beforeChangeCount = pg_atomic_read_u32(&(entry->changeCount));
+
+		if ((beforeChangeCount & 1) == 0)
+		{
+			pg_read_barrier();
+
+			copy->key = entry->key;
+			copy->generation = entry->generation;
+			copy->nodeId = entry->nodeId;
+			memcpy(copy->nodeName, entry->nodeName, NODE_CACHE_NAME_LEN);
+			memcpy(copy->nodeHost, entry->nodeHost, NODE_CACHE_NAME_LEN);
+			copy->nodePort = entry->nodePort;
+			copy->standbyNamesGeneration = entry->standbyNamesGeneration;
+			memcpy(copy->standbyNames, entry->standbyNames,
+				   NODE_CACHE_STANDBY_NAMES_LEN);
+
+			pg_read_barrier();
+
+			if (pg_atomic_read_u32(&(entry->changeCount)) == beforeChangeCount)
+			{
+				/* the writer might have been copying the strings */
+				copy->nodeName[NODE_CACHE_NAME_LEN - 1] = '\0';
+				copy->nodeHost[NODE_CACHE_NAME_LEN - 1] = '\0';
+				copy->standbyNames[NODE_CACHE_STANDBY_NAMES_LEN - 1] = '\0';
+
+				return true;
+			}
+		}
+
+		pg_spin_delay();
+	}
+
+	return false;
+}
+
+
+/*
+ * CachePrimaryNode stores the primary node of the given group, as computed
+ * at the given generation. Nothing is stored when the generation has changed
+ * since, or when the node does not fit in a cache entry, or when all the
+ * entries where the group could go are used by other groups at the current
+ * generation.
+ */
+void
+CachePrimaryNode(char *formationId, int32 groupId, uint64 generation,
+				 AutoFailoverNode *primaryNode)
+{
+	NodeCacheKey key;
+
+	if (generation == 0 ||
+		!BuildNodeCacheKey(formationId, groupId, &key) ||
+		strlen(primaryNode->nodeName) >= NODE_CACHE_NAME_LEN ||
+		strlen(primaryNode->nodeHost) >= NODE_CACHE_NAME_LEN)
+	{
+		return;
+	}
+
+	LWLockAcquire(&NodeCacheControl->lock, LW_EXCLUSIVE);
+
+	NodeCacheEntry *targetEntry = BeginNodeCacheEntryUpdate(&key, generation);
+
+	if (targetEntry != NULL)
+	{
+		targetEntry->generation = generation;
+		targetEntry->nodeId = primaryNode->nodeId;
+		strlcpy(targetEntry->nodeName, primaryNode->nodeName, NODE_CACHE_NAME_LEN);
+		strlcpy(targetEntry->nodeHost, primaryNode->nodeHost, NODE_CACHE_NAME_LEN);
+		targetEntry->nodePort = primaryNode->nodePort;
+
+		EndNodeCacheEntryUpdate(targetEntry);
+	}
+
+	LWLockRelease(&NodeCacheControl->lock);
+}
+
+
+/*
+ * CacheStandbyNames stores the synchronous_standby_names of the given group,
+ * as computed at the given generation, in the same conditions as
+ * CachePrimaryNode.
+ */
+void
+CacheStandbyNames(char *formationId, int32 groupId, uint64 generation,
+				  const char *standbyNames)
+{
+	NodeCacheKey key;
+
+	if (generation == 0 ||
+		!BuildNodeCacheKey(formationId, groupId, &key) ||
+		strlen(standbyNames) >= NODE_CACHE_STANDBY_NAMES_LEN)
+	{
+		return;
+	}
+
+	LWLockAcquire(&NodeCacheControl->lock, LW_EXCLUSIVE);
+
+	NodeCacheEntry *targetEntry = BeginNodeCacheEntryUpdate(&key, generation);
+
+	if (targetEntry != NULL)
+	{
+		targetEntry->standbyNamesGeneration = generation;
+		strlcpy(targetEntry->standbyNames, standbyNames,
+				NODE_CACHE_STANDBY_NAMES_LEN);
+
+		EndNodeCacheEntryUpdate(targetEntry);
+	}
+
+	LWLockRelease(&NodeCacheControl->lock);
+}
+
+
+/*
+ * BeginNodeCacheEntryUpdate finds the entry where to cache a value of the
+ * given group, computed at the given generation, and marks it as being
+ * updated. The caller holds the cache lock, and ends the update with
+ * EndNodeCacheEntryUpdate. Returns NULL when the generation has changed
+ * since, or when there is no room for the group.
+ *
+ * When the entry was used by another group, both its parts are reset.
+ */
+static NodeCacheEntry *
+BeginNodeCacheEntryUpdate(NodeCacheKey *key, uint64 generation)
+{
+	if (generation != pg_atomic_read_u64(&(NodeCacheControl->generation)))
+	{
+		return NULL;
+	}
+
+	uint32 hash = tag_hash(key, sizeof(NodeCacheKey));
+
+	/*
+	 * Use the entry of the group when it exists already, or else the first
+	 * entry that is stale, or else the first empty one.
+	 */
+	NodeCacheEntry *targetEntry = NULL;
+
+	for (int probe = 0; probe < NODE_CACHE_MAX_PROBES; probe++)
+	{
+		int index = (hash + probe) % NODE_CACHE_MAX_GROUPS;
+		NodeCacheEntry *entry = &(NodeCacheControl->entries[index]);
+
+		if (memcmp(&(entry->key), key, sizeof(NodeCacheKey)) == 0)
+		{
+			targetEntry = entry;
+			break;
+		}
+
+		bool isEmpty = entry->key.formationId[0] == '\0';
+		bool isStale = entry->generation != generation &&
+					   entry->standbyNamesGeneration != generation;
+
+		if (targetEntry == NULL && (isEmpty || isStale))
+		{
+			targetEntry = entry;
+		}
+
+		if (isEmpty)
+		{
+			break;
+		}
+	}
+
+	if (targetEntry == NULL)
+	{
+		return NULL;
+	}
+
+	pg_atomic_fetch_add_u32(&(targetEntry->changeCount), 1);
+	pg_write_barrier();
+
+	if (memcmp(&(targetEntry->key), key, sizeof(NodeCacheKey)) != 0)
+	{
+		targetEntry->key = *key;
+		targetEntry->generation = 0;
+		targetEntry->standbyNamesGeneration = 0;
+	}
+
+	return targetEntry;
+}
+
+
+/*
+ * EndNodeCacheEntryUpdate lets readers use the given entry again.
+ */
+static void
+EndNodeCacheEntryUpdate(NodeCacheEntry *entry)
+{
+	pg_write_barrier();
+	pg_atomic_fetch_add_u32(&(entry->changeCount), 1);
+}
+
+
+/*
+ * BuildNodeCacheKey prepares the hash key for the given group, and returns
+ * false when the formation id is too long to be cached.
+ */
+static bool
+BuildNodeCacheKey(char *formationId, int32 groupId, NodeCacheKey *key)
+{
+	if (strlen(formationId) >= NAMEDATALEN)
+	{
+		return false;
+	}
+
+	memset(key, 0, sizeof(NodeCacheKey));
+
+	strlcpy(key->formationId, formationId, NAMEDATALEN);
+	key->groupId = groupId;
+
+	return true;
+}
@@ -0,0 +1,34 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/node_cache.h
+ *
+ * Declarations for public functions related to the shared memory cache of
+ * the primary node and the synchronous_standby_names of each group.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "postgres.h"
+
+#include "node_metadata.h"
+
+
+extern size_t NodeCacheShmemSize(void);
+extern void InitializeNodeCache(void);
+extern void InvalidateNodeCache(void);
+extern AutoFailoverNode * LookupCachedPrimaryNode(char *formationId,
+												  int32 groupId,
+												  uint64 *generation);
+extern void CachePrimaryNode(char *formationId, int32 groupId,
+							 uint64 generation,
+							 AutoFailoverNode *primaryNode);
+extern char * LookupCachedStandbyNames(char *formationId, int32 groupId,
+									   uint64 *generation);
+extern void CacheStandbyNames(char *formationId, int32 groupId,
+							  uint64 generation,
+							  const char *standbyNames);
@@ -0,0 +1,125 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/node_latency.c
+ *
+ * Implementation of the network latency matrix of a group. Keepers measure
+ * the round-trip time to the other nodes of their group and report it in
+ * pgautofailover.node_latency, one row per pair of nodes. Failover candidate
+ * selection may then prefer the candidate that is closest to the other
+ * nodes of the replication quorum.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "metadata.h"
+#include "node_latency.h"
+#include "node_metadata.h"
+
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+
+
+/* GUC variable, off by default */
+bool PreferLowLatencyCandidates = false;
+
+
+/*
+ * GetNodeLatencyToPeers sets maxRtt to the highest round-trip time between
+ * the given node and any of the given peer nodes, in milliseconds. When both
+ * nodes of a pair have measured it, we use the average of both measurements.
+ *
+ * Returns false when the latency to some of the peer nodes is not known.
+ */
+bool
+GetNodeLatencyToPeers(AutoFailoverNode *node, List *peerNodeList,
+					  double *maxRtt)
+{
+	int peerCount = list_length(peerNodeList);
+	Datum *peerNodeIds = NULL;
+	ListCell *nodeCell = NULL;
+	int index = 0;
+	bool found = false;
+
+	*maxRtt = 0;
+
+	if (peerCount == 0)
+	{
+		return true;
+	}
+
+	peerNodeIds = (Datum *) palloc0(peerCount * sizeof(Datum));
+
+	foreach(nodeCell, peerNodeList)
+	{
+		AutoFailoverNode *peerNode = (AutoFailoverNode *) lfirst(nodeCell);
+
+		peerNodeIds[index++] = Int64GetDatum(peerNode->nodeId);
+	}
+
+	ArrayType *peerNodeIdArray = construct_array(peerNodeIds, peerCount,
+												 INT8OID, sizeof(int64),
+												 FLOAT8PASSBYVAL, 'd');
+
+	Oid argTypes[] = {
+		INT8OID,     /* nodeid */
+		INT8ARRAYOID /* peer node ids */
+	};
+
+	Datum argValues[] = {
+		Int64GetDatum(node->nodeId),            /* nodeid */
+		PointerGetDatum(peerNodeIdArray)        /* peer node ids */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan selectPlan = { 0 };
+
+	const char *selectQuery =
+		"SELECT count(*), max(rtt) FROM ("
+		"  SELECT avg(rtt) AS rtt FROM " AUTO_FAILOVER_NODE_LATENCY_TABLE
+		"   WHERE (nodeid = $1 AND peernodeid = ANY($2))"
+		"      OR (peernodeid = $1 AND nodeid = ANY($2))"
+		" GROUP BY CASE WHEN nodeid = $1 THEN peernodeid ELSE nodeid END"
+		") AS peers";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&selectPlan, selectQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 1);
+	if (spiStatus != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not select from " AUTO_FAILOVER_NODE_LATENCY_TABLE);
+	}
+
+	if (SPI_processed > 0)
+	{
+		bool countIsNull = false;
+		bool rttIsNull = false;
+
+		Datum countDatum = SPI_getbinval(SPI_tuptable->vals[0],
+										 SPI_tuptable->tupdesc,
+										 1, &countIsNull);
+		Datum rttDatum = SPI_getbinval(SPI_tuptable->vals[0],
+									   SPI_tuptable->tupdesc,
+									   2, &rttIsNull);
+
+		if (!countIsNull && !rttIsNull &&
+			DatumGetInt64(countDatum) == peerCount)
+		{
+			*maxRtt = DatumGetFloat8(rttDatum);
+			found = true;
+		}
+	}
+
+	SPI_finish();
+
+	return found;
+}
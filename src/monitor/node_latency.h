@@ -0,0 +1,29 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/node_latency.h
+ *
+ * Declarations for public functions and types related to the network
+ * latency between the nodes of a group.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "node_metadata.h"
+
+#define AUTO_FAILOVER_NODE_LATENCY_TABLE "pgautofailover.node_latency"
+
+/* a candidate must be at least 10% closer to its peers to be preferred */
+#define LATENCY_SIGNIFICANT_RATIO 0.9
+
+
+/* public function declarations */
+extern bool GetNodeLatencyToPeers(AutoFailoverNode *node, List *peerNodeList,
+								  double *maxRtt);
+
+/* GUCs */
+extern bool PreferLowLatencyCandidates;
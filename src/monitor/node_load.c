@@ -0,0 +1,151 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/node_load.c
+ *
+ * Implementation of the load reports of the standby nodes. Keepers sample
+ * their CPU usage, I/O wait, active client connections and replay lag and
+ * report them in pgautofailover.node_load, one row per node. Formations
+ * with prefer_least_loaded then break the ties between equally advanced
+ * failover candidates by promoting the least loaded one, so that the new
+ * primary has room for the write traffic.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "metadata.h"
+#include "node_load.h"
+#include "node_metadata.h"
+
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+
+
+static double LoadDifference(double value, double otherValue, double minimum);
+
+
+/*
+ * GetNodeLoad sets load to the last load vector that the keeper of the given
+ * node reported. Returns false when the node never reported its load, or
+ * when its last report is older than NODE_LOAD_MAX_REPORT_AGE_MS.
+ */
+bool
+GetNodeLoad(AutoFailoverNode *node, TimestampTz now, NodeLoad *load)
+{
+	bool found = false;
+
+	Oid argTypes[] = {
+		INT8OID /* nodeid */
+	};
+
+	Datum argValues[] = {
+		Int64GetDatum(node->nodeId) /* nodeid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan selectPlan = { 0 };
+
+	const char *selectQuery =
+		"SELECT reporttime, cpu, iowait, active_connections, replay_lag"
+		"  FROM " AUTO_FAILOVER_NODE_LOAD_TABLE
+		" WHERE nodeid = $1";
+
+	memset(load, 0, sizeof(NodeLoad));
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&selectPlan, selectQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 1);
+	if (spiStatus != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not select from " AUTO_FAILOVER_NODE_LOAD_TABLE);
+	}
+
+	if (SPI_processed > 0)
+	{
+		HeapTuple heapTuple = SPI_tuptable->vals[0];
+		TupleDesc tupleDescriptor = SPI_tuptable->tupdesc;
+		bool isNull = false;
+
+		load->reportTime =
+			DatumGetTimestampTz(SPI_getbinval(heapTuple, tupleDescriptor,
+											  1, &isNull));
+		load->cpu =
+			DatumGetFloat8(SPI_getbinval(heapTuple, tupleDescriptor,
+										 2, &isNull));
+		load->iowait =
+			DatumGetFloat8(SPI_getbinval(heapTuple, tupleDescriptor,
+										 3, &isNull));
+		load->activeConnections =
+			DatumGetInt32(SPI_getbinval(heapTuple, tupleDescriptor,
+										4, &isNull));
+		load->replayLag =
+			DatumGetInt64(SPI_getbinval(heapTuple, tupleDescriptor,
+										5, &isNull));
+
+		found = !TimestampDifferenceExceeds(load->reportTime, now,
+											NODE_LOAD_MAX_REPORT_AGE_MS);
+	}
+
+	SPI_finish();
+
+	return found;
+}
+
+
+/*
+ * CompareNodeLoad compares two load vectors. It returns a negative number
+ * when load is noticeably lighter than otherLoad, a positive number when
+ * otherLoad is, and zero otherwise.
+ *
+ * The measurements don't share a unit, so we add up their relative
+ * differences, each within [-1, 1]: a node that has half the active
+ * connections of the other one and the same CPU, I/O wait and replay lag is
+ * then less loaded by 0.5.
+ */
+int
+CompareNodeLoad(NodeLoad *load, NodeLoad *otherLoad)
+{
+	double difference =
+		LoadDifference(load->cpu, otherLoad->cpu, LOAD_CPU_FLOOR) +
+		LoadDifference(load->iowait, otherLoad->iowait, LOAD_IOWAIT_FLOOR) +
+		LoadDifference((double) load->activeConnections,
+					   (double) otherLoad->activeConnections,
+					   (double) LOAD_ACTIVE_CONNECTIONS_FLOOR) +
+		LoadDifference((double) load->replayLag,
+					   (double) otherLoad->replayLag,
+					   (double) LOAD_REPLAY_LAG_FLOOR);
+
+	if (difference < -LOAD_SIGNIFICANT_DIFFERENCE)
+	{
+		return -1;
+	}
+	else if (difference > LOAD_SIGNIFICANT_DIFFERENCE)
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * LoadDifference returns the difference of two measurements relative to the
+ * largest of them, where any measurement under the given minimum counts as
+ * the minimum, so that two mostly idle nodes compare equal.
+ */
+static double
+LoadDifference(double value, double otherValue, double minimum)
+{
+	double a = Max(value, minimum);
+	double b = Max(otherValue, minimum);
+
+	return (a - b) / Max(a, b);
+}
@@ -0,0 +1,57 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/node_load.h
+ *
+ * Declarations for public functions and types related to the load of the
+ * standby nodes, as reported by their keepers.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "datatype/timestamp.h"
+
+#include "node_metadata.h"
+
+#define AUTO_FAILOVER_NODE_LOAD_TABLE "pgautofailover.node_load"
+
+/* load reports older than that are not used to pick a failover candidate */
+#define NODE_LOAD_MAX_REPORT_AGE_MS 60000
+
+/*
+ * A candidate must be noticeably less loaded to be preferred: the sum of the
+ * relative differences of the load measurements must be over this ratio.
+ */
+#define LOAD_SIGNIFICANT_DIFFERENCE 0.25
+
+/* measurements under those floors are all considered idle */
+#define LOAD_CPU_FLOOR 5.0                          /* percent */
+#define LOAD_IOWAIT_FLOOR 5.0                       /* percent */
+#define LOAD_ACTIVE_CONNECTIONS_FLOOR 5
+#define LOAD_REPLAY_LAG_FLOOR (16 * 1024 * 1024)    /* bytes */
+
+
+/*
+ * NodeLoad is the last load vector reported by the keeper of a standby node:
+ * the percentage of CPU time spent working and waiting for I/O, the count of
+ * active client connections, and the WAL bytes received and not replayed
+ * yet.
+ */
+typedef struct NodeLoad
+{
+	TimestampTz reportTime;
+	double cpu;
+	double iowait;
+	int activeConnections;
+	int64 replayLag;
+} NodeLoad;
+
+
+/* public function declarations */
+extern bool GetNodeLoad(AutoFailoverNode *node, TimestampTz now,
+						NodeLoad *load);
+extern int CompareNodeLoad(NodeLoad *load, NodeLoad *otherLoad);
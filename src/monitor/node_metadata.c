@@ -19,10 +19,15 @@
 /* list_qsort is only in Postgres 11 and 12 */
 #include "version_compat.h"
 
+#include "failover_metadata.h"
+#include "formation_metadata.h"
+#include "goal_state_wait.h"
 #include "health_check.h"
 #include "metadata.h"
+#include "node_cache.h"
 #include "node_metadata.h"
 #include "notifications.h"
+#include "wal_rate.h"
 
 #include "access/genam.h"
 #include "access/heapam.h"
@@ -50,8 +55,11 @@
 
 /* GUC variables */
 int DrainTimeoutMs = 30 * 1000;
+int PrimaryLeaseDurationMs = 0;
+int LeaseClockSkewMs = 1000;
 int UnhealthyTimeoutMs = 20 * 1000;
 int StartupGracePeriodMs = 10 * 1000;
+bool CascadeByCluster = false;
 
 
 /*
@@ -74,14 +82,17 @@ AllAutoFailoverNodes(char *formationId)
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
 	uint64 rowNumber = 0;
 
+	static MetadataPlan selectPlan = { 0 };
+
 	const char *selectQuery =
 		SELECT_ALL_FROM_AUTO_FAILOVER_NODE_TABLE
 		" WHERE formationid = $1 ";
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(selectQuery, argCount, argTypes, argValues,
-										  NULL, false, 0);
+	int spiStatus = ExecuteMetadataPlan(&selectPlan, selectQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
 	if (spiStatus != SPI_OK_SELECT)
 	{
 		elog(ERROR, "could not select from " AUTO_FAILOVER_NODE_TABLE);
@@ -114,6 +125,7 @@ TupleToAutoFailoverNode(TupleDesc tupleDescriptor, HeapTuple heapTuple)
 {
 	bool isNull = false;
 	bool sysIdentifierIsNull = false;
+	bool goalTraceIdIsNull = false;
 
 	Datum formationId = heap_getattr(heapTuple,
 									 Anum_pgautofailover_node_formationid,
@@ -168,6 +180,12 @@ TupleToAutoFailoverNode(TupleDesc tupleDescriptor, HeapTuple heapTuple)
 	Datum nodeCluster = heap_getattr(heapTuple,
 									 Anum_pgautofailover_node_nodecluster,
 									 tupleDescriptor, &isNull);
+	Datum reportedReplayLSN = heap_getattr(heapTuple,
+										   Anum_pgautofailover_node_reportedreplaylsn,
+										   tupleDescriptor, &isNull);
+	Datum goalTraceId = heap_getattr(heapTuple,
+									 Anum_pgautofailover_node_goaltraceid,
+									 tupleDescriptor, &goalTraceIdIsNull);
 
 	Oid goalStateOid = DatumGetObjectId(goalState);
 	Oid reportedStateOid = DatumGetObjectId(reportedState);
@@ -192,13 +210,18 @@ TupleToAutoFailoverNode(TupleDesc tupleDescriptor, HeapTuple heapTuple)
 	pgAutoFailoverNode->reportTime = DatumGetTimestampTz(reportTime);
 	pgAutoFailoverNode->walReportTime = DatumGetTimestampTz(walReportTime);
 	pgAutoFailoverNode->health = DatumGetInt32(health);
-	pgAutoFailoverNode->healthCheckTime = DatumGetTimestampTz(healthCheckTime);
+	pgAutoFailoverNode->healthCheckTime =
+		NodeHealthCheckTime(pgAutoFailoverNode->nodeId,
+							DatumGetTimestampTz(healthCheckTime));
 	pgAutoFailoverNode->stateChangeTime = DatumGetTimestampTz(stateChangeTime);
 	pgAutoFailoverNode->reportedTLI = DatumGetInt32(reportedTLI);
 	pgAutoFailoverNode->reportedLSN = DatumGetLSN(reportedLSN);
+	pgAutoFailoverNode->reportedReplayLSN = DatumGetLSN(reportedReplayLSN);
 	pgAutoFailoverNode->candidatePriority = DatumGetInt32(candidatePriority);
 	pgAutoFailoverNode->replicationQuorum = DatumGetBool(replicationQuorum);
 	pgAutoFailoverNode->nodeCluster = TextDatumGetCString(nodeCluster);
+	pgAutoFailoverNode->goalTraceId =
+		goalTraceIdIsNull ? 0 : DatumGetInt64(goalTraceId);
 
 	return pgAutoFailoverNode;
 }
@@ -226,6 +249,8 @@ AutoFailoverNodeGroup(char *formationId, int groupId)
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
 	uint64 rowNumber = 0;
 
+	static MetadataPlan selectPlan = { 0 };
+
 	const char *selectQuery =
 		SELECT_ALL_FROM_AUTO_FAILOVER_NODE_TABLE
 		"    WHERE formationid = $1 AND groupid = $2"
@@ -234,8 +259,9 @@ AutoFailoverNodeGroup(char *formationId, int groupId)
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(selectQuery, argCount, argTypes, argValues,
-										  NULL, false, 0);
+	int spiStatus = ExecuteMetadataPlan(&selectPlan, selectQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
 	if (spiStatus != SPI_OK_SELECT)
 	{
 		elog(ERROR, "could not select from " AUTO_FAILOVER_NODE_TABLE);
@@ -260,6 +286,62 @@ AutoFailoverNodeGroup(char *formationId, int groupId)
 }
 
 
+/*
+ * GroupTopologyVersion returns a version number for the topology of a group,
+ * given as returned by AutoFailoverNodeGroup. The version changes when a node
+ * is added to or removed from the group, when a node name or address
+ * changes, and when a node starts or stops taking writes: all the properties
+ * that get_other_nodes returns, except for the LSN.
+ *
+ * When pgautofailover.cascade_by_cluster is on, the upstream node of each
+ * node is part of the topology too, so that standby nodes notice when they
+ * should stream from another node.
+ *
+ * The version is a 64-bit FNV-1a hash of those properties, so that it does
+ * not need to be stored and maintained in the catalogs: keepers only compare
+ * it to the version they saw last.
+ */
+int64
+GroupTopologyVersion(List *groupNodeList)
+{
+	StringInfo topology = makeStringInfo();
+	uint64 version = UINT64CONST(0xcbf29ce484222325);
+	ListCell *nodeCell = NULL;
+
+	foreach(nodeCell, groupNodeList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+		appendStringInfo(topology, INT64_FORMAT "|%s|%s|%d|%c\n",
+						 node->nodeId,
+						 node->nodeName,
+						 node->nodeHost,
+						 node->nodePort,
+						 CanTakeWritesInState(node->reportedState) ? 't' : 'f');
+
+		if (CascadeByCluster)
+		{
+			AutoFailoverNode *upstreamNode =
+				FindUpstreamNode(node, groupNodeList);
+
+			appendStringInfo(topology, INT64_FORMAT "\n",
+							 upstreamNode != NULL ? upstreamNode->nodeId : 0);
+		}
+	}
+
+	for (int i = 0; i < topology->len; i++)
+	{
+		version ^= (unsigned char) topology->data[i];
+		version *= UINT64CONST(0x100000001b3);
+	}
+
+	pfree(topology->data);
+	pfree(topology);
+
+	return (int64) version;
+}
+
+
 /*
  * AutoFailoverAllNodesInGroup returns all nodes in the given formation and
  * group as a list, and includes nodes that are currently being dropped.
@@ -282,6 +364,8 @@ AutoFailoverAllNodesInGroup(char *formationId, int groupId)
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
 	uint64 rowNumber = 0;
 
+	static MetadataPlan selectPlan = { 0 };
+
 	const char *selectQuery =
 		SELECT_ALL_FROM_AUTO_FAILOVER_NODE_TABLE
 		"    WHERE formationid = $1 AND groupid = $2"
@@ -289,8 +373,9 @@ AutoFailoverAllNodesInGroup(char *formationId, int groupId)
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(selectQuery, argCount, argTypes, argValues,
-										  NULL, false, 0);
+	int spiStatus = ExecuteMetadataPlan(&selectPlan, selectQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
 	if (spiStatus != SPI_OK_SELECT)
 	{
 		elog(ERROR, "could not select from " AUTO_FAILOVER_NODE_TABLE);
@@ -322,9 +407,6 @@ AutoFailoverAllNodesInGroup(char *formationId, int groupId)
 List *
 AutoFailoverOtherNodesList(AutoFailoverNode *pgAutoFailoverNode)
 {
-	ListCell *nodeCell = NULL;
-	List *otherNodesList = NIL;
-
 	if (pgAutoFailoverNode == NULL)
 	{
 		return NIL;
@@ -333,6 +415,27 @@ AutoFailoverOtherNodesList(AutoFailoverNode *pgAutoFailoverNode)
 	List *groupNodeList = AutoFailoverNodeGroup(pgAutoFailoverNode->formationId,
 												pgAutoFailoverNode->groupId);
 
+	return GroupOtherNodesList(groupNodeList, pgAutoFailoverNode);
+}
+
+
+/*
+ * GroupOtherNodesList returns a list of all the nodes of the given group node
+ * list, as returned by AutoFailoverNodeGroup, except for the given one. It
+ * allows callers that already have the group node list at hand to skip
+ * another scan of pgautofailover.node.
+ */
+List *
+GroupOtherNodesList(List *groupNodeList, AutoFailoverNode *pgAutoFailoverNode)
+{
+	ListCell *nodeCell = NULL;
+	List *otherNodesList = NIL;
+
+	if (pgAutoFailoverNode == NULL)
+	{
+		return NIL;
+	}
+
 	foreach(nodeCell, groupNodeList)
 	{
 		AutoFailoverNode *otherNode = (AutoFailoverNode *) lfirst(nodeCell);
@@ -356,9 +459,6 @@ List *
 AutoFailoverOtherNodesListInState(AutoFailoverNode *pgAutoFailoverNode,
 								  ReplicationState currentState)
 {
-	ListCell *nodeCell = NULL;
-	List *otherNodesList = NIL;
-
 	if (pgAutoFailoverNode == NULL)
 	{
 		return NIL;
@@ -367,6 +467,29 @@ AutoFailoverOtherNodesListInState(AutoFailoverNode *pgAutoFailoverNode,
 	List *groupNodeList = AutoFailoverNodeGroup(pgAutoFailoverNode->formationId,
 												pgAutoFailoverNode->groupId);
 
+	return GroupOtherNodesListInState(groupNodeList,
+									  pgAutoFailoverNode,
+									  currentState);
+}
+
+
+/*
+ * GroupOtherNodesListInState returns a list of all the nodes of the given
+ * group node list, except for the given one, that have the given goal state.
+ */
+List *
+GroupOtherNodesListInState(List *groupNodeList,
+						   AutoFailoverNode *pgAutoFailoverNode,
+						   ReplicationState currentState)
+{
+	ListCell *nodeCell = NULL;
+	List *otherNodesList = NIL;
+
+	if (pgAutoFailoverNode == NULL)
+	{
+		return NIL;
+	}
+
 	foreach(nodeCell, groupNodeList)
 	{
 		AutoFailoverNode *otherNode = (AutoFailoverNode *) lfirst(nodeCell);
@@ -485,12 +608,23 @@ GetNodeToFailoverFromInGroup(char *formationId, int32 groupId)
  */
 AutoFailoverNode *
 GetPrimaryOrDemotedNodeInGroup(char *formationId, int32 groupId)
+{
+	List *groupNodeList = AutoFailoverNodeGroup(formationId, groupId);
+
+	return FindPrimaryOrDemotedNode(groupNodeList);
+}
+
+
+/*
+ * FindPrimaryOrDemotedNode implements GetPrimaryOrDemotedNodeInGroup for a
+ * group node list that the caller already has at hand.
+ */
+AutoFailoverNode *
+FindPrimaryOrDemotedNode(List *groupNodeList)
 {
 	AutoFailoverNode *primaryNode = NULL;
 	ListCell *nodeCell = NULL;
 
-	List *groupNodeList = AutoFailoverNodeGroup(formationId, groupId);
-
 	/* first find a node that is writable */
 	foreach(nodeCell, groupNodeList)
 	{
@@ -556,6 +690,76 @@ FindFailoverNewStandbyNode(List *groupNodeList)
 }
 
 
+/*
+ * FindUpstreamNode returns the node in groupNodeList that the given standby
+ * node should stream WAL from, usually the primary node.
+ *
+ * When pgautofailover.cascade_by_cluster is on, the standby nodes that are
+ * neither failover candidates nor part of the replication quorum, and that
+ * are not in the same node cluster as the primary, stream from a secondary
+ * node of their own node cluster instead: the healthy one with the smallest
+ * node id, which itself streams from the primary. The primary then only
+ * sends WAL once to each node cluster.
+ *
+ * Failover candidates and replication quorum nodes always stream from the
+ * primary, so synchronous_standby_names and the failover logic only ever
+ * deal with direct standby nodes.
+ */
+AutoFailoverNode *
+FindUpstreamNode(AutoFailoverNode *node, List *groupNodeList)
+{
+	AutoFailoverNode *primaryNode = NULL;
+	AutoFailoverNode *relayNode = NULL;
+	ListCell *nodeCell = NULL;
+
+	foreach(nodeCell, groupNodeList)
+	{
+		AutoFailoverNode *otherNode = (AutoFailoverNode *) lfirst(nodeCell);
+
+		if (CanTakeWritesInState(otherNode->goalState))
+		{
+			primaryNode = otherNode;
+			break;
+		}
+	}
+
+	if (!CascadeByCluster ||
+		primaryNode == NULL ||
+		primaryNode->nodeId == node->nodeId ||
+		node->candidatePriority > 0 ||
+		node->replicationQuorum ||
+		strcmp(node->nodeCluster, primaryNode->nodeCluster) == 0)
+	{
+		return primaryNode;
+	}
+
+	foreach(nodeCell, groupNodeList)
+	{
+		AutoFailoverNode *otherNode = (AutoFailoverNode *) lfirst(nodeCell);
+
+		if (strcmp(otherNode->nodeCluster, node->nodeCluster) != 0 ||
+			!IsCurrentState(otherNode, REPLICATION_STATE_SECONDARY) ||
+			!IsHealthy(otherNode))
+		{
+			continue;
+		}
+
+		if (relayNode == NULL || otherNode->nodeId < relayNode->nodeId)
+		{
+			relayNode = otherNode;
+		}
+	}
+
+	/* the relay node of a cluster streams from the primary */
+	if (relayNode == NULL || relayNode->nodeId == node->nodeId)
+	{
+		return primaryNode;
+	}
+
+	return relayNode;
+}
+
+
 /*
  * FindMostAdvancedStandby returns the node in groupNodeList that has the most
  * advanced LSN.
@@ -572,7 +776,9 @@ FindMostAdvancedStandby(List *groupNodeList)
 		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
 
 		if (mostAdvancedNode == NULL ||
-			mostAdvancedNode->reportedLSN < node->reportedLSN)
+			mostAdvancedNode->reportedLSN < node->reportedLSN ||
+			(mostAdvancedNode->reportedLSN == node->reportedLSN &&
+			 mostAdvancedNode->reportedReplayLSN < node->reportedReplayLSN))
 		{
 			mostAdvancedNode = node;
 		}
@@ -756,6 +962,17 @@ pgautofailover_node_reportedlsn_compare(const void *a, const void *b)
 		return 1;
 	}
 
+	/* same data, the node that replayed more WAL is faster to promote */
+	if (node1->reportedReplayLSN > node2->reportedReplayLSN)
+	{
+		return -1;
+	}
+
+	if (node1->reportedReplayLSN < node2->reportedReplayLSN)
+	{
+		return 1;
+	}
+
 	return 0;
 }
 
@@ -869,6 +1086,32 @@ CountSyncStandbys(List *groupNodeList)
 }
 
 
+/*
+ * CountStandbyClonesInProgress returns how many nodes in the given
+ * groupNodeList have been assigned CATCHINGUP while still reporting
+ * WAIT_STANDBY: those nodes are running pg_basebackup.
+ */
+int
+CountStandbyClonesInProgress(List *groupNodeList)
+{
+	int count = 0;
+	ListCell *nodeCell = NULL;
+
+	foreach(nodeCell, groupNodeList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+		if (node->reportedState == REPLICATION_STATE_WAIT_STANDBY &&
+			node->goalState == REPLICATION_STATE_CATCHINGUP)
+		{
+			++count;
+		}
+	}
+
+	return count;
+}
+
+
 /*
  * IsHealthySyncStandby returns true if the node its replicationQuorum property
  * set to true in the given groupNodeList, but only if only if that node is
@@ -956,14 +1199,17 @@ GetAutoFailoverNode(char *nodeHost, int nodePort)
 	};
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
 
+	static MetadataPlan selectPlan = { 0 };
+
 	const char *selectQuery =
 		SELECT_ALL_FROM_AUTO_FAILOVER_NODE_TABLE
 		" WHERE nodehost = $1 AND nodeport = $2";
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(selectQuery, argCount, argTypes, argValues,
-										  NULL, false, 1);
+	int spiStatus = ExecuteMetadataPlan(&selectPlan, selectQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 1);
 	if (spiStatus != SPI_OK_SELECT)
 	{
 		elog(ERROR, "could not select from " AUTO_FAILOVER_NODE_TABLE);
@@ -1008,15 +1254,17 @@ GetAutoFailoverNodeById(int64 nodeId)
 	};
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
 
+	static MetadataPlan selectPlan = { 0 };
+
 	const char *selectQuery =
 		SELECT_ALL_FROM_AUTO_FAILOVER_NODE_TABLE
 		" WHERE nodeid = $1";
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(selectQuery,
-										  argCount, argTypes, argValues,
-										  NULL, false, 1);
+	int spiStatus = ExecuteMetadataPlan(&selectPlan, selectQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 1);
 	if (spiStatus != SPI_OK_SELECT)
 	{
 		elog(ERROR, "could not select from " AUTO_FAILOVER_NODE_TABLE);
@@ -1061,14 +1309,17 @@ GetAutoFailoverNodeByName(char *formationId, char *nodeName)
 	};
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
 
+	static MetadataPlan selectPlan = { 0 };
+
 	const char *selectQuery =
 		SELECT_ALL_FROM_AUTO_FAILOVER_NODE_TABLE
 		" WHERE formationid = $1 and nodename = $2";
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(selectQuery, argCount, argTypes, argValues,
-										  NULL, false, 1);
+	int spiStatus = ExecuteMetadataPlan(&selectPlan, selectQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 1);
 	if (spiStatus != SPI_OK_SELECT)
 	{
 		elog(ERROR, "could not select from " AUTO_FAILOVER_NODE_TABLE);
@@ -1199,6 +1450,8 @@ AddAutoFailoverNode(char *formationId,
 	 * sequence within that groupid.
 	 */
 
+	static MetadataPlan insertPlan = { 0 };
+
 	const char *insertQuery =
 		"WITH seq(nodeid) AS "
 		"(SELECT case when $2 = -1 "
@@ -1227,9 +1480,9 @@ AddAutoFailoverNode(char *formationId,
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(insertQuery, argCount,
-										  argTypes, argValues, argNulls,
-										  false, 0);
+	int spiStatus = ExecuteMetadataPlan(&insertPlan, insertQuery,
+										argCount, argTypes, argValues,
+										argNulls, false, 0);
 
 	if (spiStatus == SPI_OK_INSERT_RETURNING && SPI_processed > 0)
 	{
@@ -1247,17 +1500,40 @@ AddAutoFailoverNode(char *formationId,
 		elog(ERROR, "could not insert into " AUTO_FAILOVER_NODE_TABLE);
 	}
 
+	/* the columns updated at each node_active call live in node_report */
+	{
+		static MetadataPlan reportPlan = { 0 };
+
+		Oid reportArgTypes[] = { INT8OID };
+		Datum reportArgValues[] = { Int64GetDatum(insertedNodeId) };
+
+		const char *reportQuery =
+			"INSERT INTO " AUTO_FAILOVER_NODE_REPORT_TABLE " (nodeid) "
+			"VALUES ($1)";
+
+		int spiStatus = ExecuteMetadataPlan(&reportPlan, reportQuery,
+											1, reportArgTypes, reportArgValues,
+											NULL, false, 0);
+
+		if (spiStatus != SPI_OK_INSERT)
+		{
+			elog(ERROR, "could not insert into " AUTO_FAILOVER_NODE_REPORT_TABLE);
+		}
+	}
+
 	/* when a desired_node_id has been given, maintain the nodeid sequence */
 	if (nodeId != -1)
 	{
+		static MetadataPlan setValPlan = { 0 };
+
 		const char *setValQuery =
 			"SELECT setval('pgautofailover.node_nodeid_seq'::regclass, "
 			" max(nodeid)+1) "
 			" FROM " AUTO_FAILOVER_NODE_TABLE;
 
-		int spiStatus = SPI_execute_with_args(setValQuery,
-											  0, NULL, NULL, NULL,
-											  false, 0);
+		int spiStatus = ExecuteMetadataPlan(&setValPlan, setValQuery,
+											0, NULL, NULL,
+											NULL, false, 0);
 
 		if (spiStatus != SPI_OK_SELECT)
 		{
@@ -1268,6 +1544,10 @@ AddAutoFailoverNode(char *formationId,
 
 	SPI_finish();
 
+	/* health check workers reload their list of nodes at commit time */
+	NotifyNodeListChange();
+	InvalidateNodeCache();
+
 	return insertedNodeId;
 }
 
@@ -1283,28 +1563,33 @@ SetNodeGoalState(AutoFailoverNode *pgAutoFailoverNode,
 {
 	Oid goalStateOid = ReplicationStateGetEnum(goalState);
 	Oid replicationStateTypeOid = ReplicationStateTypeOid();
+	int64 traceId = GetGoalStateTraceId(pgAutoFailoverNode);
 
 	Oid argTypes[] = {
 		replicationStateTypeOid, /* goalstate */
-		INT8OID  /* nodeid */
+		INT8OID, /* nodeid */
+		INT8OID  /* goaltraceid */
 	};
 
 	Datum argValues[] = {
-		ObjectIdGetDatum(goalStateOid),           /* goalstate */
-		Int64GetDatum(pgAutoFailoverNode->nodeId) /* nodeid */
+		ObjectIdGetDatum(goalStateOid),            /* goalstate */
+		Int64GetDatum(pgAutoFailoverNode->nodeId), /* nodeid */
+		Int64GetDatum(traceId)                     /* goaltraceid */
 	};
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
 
+	static MetadataPlan updatePlan = { 0 };
+
 	const char *updateQuery =
 		"UPDATE " AUTO_FAILOVER_NODE_TABLE
-		" SET goalstate = $1, statechangetime = now() "
+		" SET goalstate = $1, statechangetime = now(), goaltraceid = $3 "
 		"WHERE nodeid = $2";
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(updateQuery,
-										  argCount, argTypes, argValues,
-										  NULL, false, 0);
+	int spiStatus = ExecuteMetadataPlan(&updatePlan, updateQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
 	if (spiStatus != SPI_OK_UPDATE)
 	{
 		elog(ERROR, "could not update " AUTO_FAILOVER_NODE_TABLE);
@@ -1312,6 +1597,13 @@ SetNodeGoalState(AutoFailoverNode *pgAutoFailoverNode,
 
 	SPI_finish();
 
+	InvalidateNodeCache();
+	GoalStateChanged(pgAutoFailoverNode->nodeId);
+
+	/* the failover timeline needs the previous goal state of the node */
+	pgAutoFailoverNode->goalTraceId = traceId;
+	bool isFailover = RecordFailoverPhase(pgAutoFailoverNode, goalState);
+
 	/*
 	 * Now that the UPDATE went through, update the pgAutoFailoverNode struct
 	 * with the new goal State and notify the state change.
@@ -1320,7 +1612,20 @@ SetNodeGoalState(AutoFailoverNode *pgAutoFailoverNode,
 
 	if (message != NULL)
 	{
-		NotifyStateChange(pgAutoFailoverNode, (char *) message);
+		EventCode eventCode = EVENT_CODE_GOAL_STATE;
+
+		if (isFailover)
+		{
+			eventCode = EVENT_CODE_FAILOVER;
+		}
+		else if (goalState == REPLICATION_STATE_PREPARE_MAINTENANCE ||
+				 goalState == REPLICATION_STATE_WAIT_MAINTENANCE ||
+				 goalState == REPLICATION_STATE_MAINTENANCE)
+		{
+			eventCode = EVENT_CODE_MAINTENANCE;
+		}
+
+		NotifyStateChange(pgAutoFailoverNode, eventCode, (char *) message);
 	}
 }
 
@@ -1336,7 +1641,8 @@ ReportAutoFailoverNodeState(char *nodeHost, int nodePort,
 							ReplicationState reportedState,
 							bool pgIsRunning, SyncState pgSyncState,
 							int reportedTLI,
-							XLogRecPtr reportedLSN)
+							XLogRecPtr reportedLSN,
+							XLogRecPtr reportedReplayLSN)
 {
 	Oid reportedStateOid = ReplicationStateGetEnum(reportedState);
 	Oid replicationStateTypeOid = ReplicationStateTypeOid();
@@ -1348,7 +1654,8 @@ ReportAutoFailoverNodeState(char *nodeHost, int nodePort,
 		INT4OID,                 /* reportedtli */
 		LSNOID,                  /* reportedlsn */
 		TEXTOID,                 /* nodehost */
-		INT4OID                  /* nodeport */
+		INT4OID,                 /* nodeport */
+		LSNOID                   /* reportedreplaylsn */
 	};
 
 	Datum argValues[] = {
@@ -1358,32 +1665,110 @@ ReportAutoFailoverNodeState(char *nodeHost, int nodePort,
 		Int32GetDatum(reportedTLI),                          /* reportedtli */
 		LSNGetDatum(reportedLSN),             /* reportedlsn */
 		CStringGetTextDatum(nodeHost),        /* nodehost */
-		Int32GetDatum(nodePort)               /* nodeport */
+		Int32GetDatum(nodePort),              /* nodeport */
+		LSNGetDatum(reportedReplayLSN)        /* reportedreplaylsn */
 	};
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
 
+	static MetadataPlan updatePlan = { 0 };
+
 	const char *updateQuery =
+		"WITH reported AS ("
 		"UPDATE " AUTO_FAILOVER_NODE_TABLE
-		" SET reportedstate = $1, reporttime = now(), "
+		" SET reportedstate = $1, "
 		"reportedpgisrunning = $2, reportedrepstate = $3, "
 		"reportedtli = CASE $4 WHEN 0 THEN reportedtli ELSE $4 END, "
-		"reportedlsn = CASE $5 WHEN '0/0'::pg_lsn THEN reportedlsn ELSE $5 END, "
-		"walreporttime = CASE $5 WHEN '0/0'::pg_lsn THEN walreporttime ELSE now() END, "
 		"statechangetime = CASE WHEN reportedstate <> $1 THEN now() ELSE statechangetime END "
-		"WHERE nodehost = $6 AND nodeport = $7";
+		"WHERE nodehost = $6 AND nodeport = $7 "
+		"RETURNING nodeid) "
+		"UPDATE " AUTO_FAILOVER_NODE_REPORT_TABLE " AS report"
+		" SET reporttime = now(), "
+		"reportedlsn = CASE $5 WHEN '0/0'::pg_lsn THEN report.reportedlsn ELSE $5 END, "
+		"walreporttime = CASE $5 WHEN '0/0'::pg_lsn THEN report.walreporttime ELSE now() END, "
+		"reportedreplaylsn = CASE $8 WHEN '0/0'::pg_lsn THEN report.reportedreplaylsn ELSE $8 END "
+		"FROM reported WHERE report.nodeid = reported.nodeid";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&updatePlan, updateQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
+
+	if (spiStatus != SPI_OK_UPDATE)
+	{
+		elog(ERROR, "could not update " AUTO_FAILOVER_NODE_TABLE);
+	}
+
+	SPI_finish();
+}
+
+
+/*
+ * ReportAutoFailoverNodeActivity persists the report time and the LSN of a
+ * node that reports the same state as before, and returns false when the
+ * node's reported state or goal state changed concurrently, in which case
+ * nothing has been updated.
+ *
+ * Only the narrow node_report row is updated. The node row is locked FOR
+ * SHARE, which waits for a concurrent state change to commit and then checks
+ * the states again, without writing a new version of the wide row.
+ *
+ * We use SPI to automatically handle triggers, function calls, etc.
+ */
+bool
+ReportAutoFailoverNodeActivity(int64 nodeId,
+							   ReplicationState reportedState,
+							   XLogRecPtr reportedLSN,
+							   XLogRecPtr reportedReplayLSN)
+{
+	Oid reportedStateOid = ReplicationStateGetEnum(reportedState);
+	Oid replicationStateTypeOid = ReplicationStateTypeOid();
+
+	Oid argTypes[] = {
+		INT8OID,                 /* nodeid */
+		replicationStateTypeOid, /* reportedstate */
+		LSNOID,                  /* reportedlsn */
+		LSNOID                   /* reportedreplaylsn */
+	};
+
+	Datum argValues[] = {
+		Int64GetDatum(nodeId),               /* nodeid */
+		ObjectIdGetDatum(reportedStateOid),  /* reportedstate */
+		LSNGetDatum(reportedLSN),            /* reportedlsn */
+		LSNGetDatum(reportedReplayLSN)       /* reportedreplaylsn */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan updatePlan = { 0 };
+
+	const char *updateQuery =
+		"WITH settled AS ("
+		"SELECT nodeid FROM " AUTO_FAILOVER_NODE_TABLE
+		" WHERE nodeid = $1 AND reportedstate = $2 AND goalstate = $2 "
+		"FOR SHARE) "
+		"UPDATE " AUTO_FAILOVER_NODE_REPORT_TABLE " AS report"
+		" SET reporttime = now(), "
+		"reportedlsn = CASE $3 WHEN '0/0'::pg_lsn THEN report.reportedlsn ELSE $3 END, "
+		"walreporttime = CASE $3 WHEN '0/0'::pg_lsn THEN report.walreporttime ELSE now() END, "
+		"reportedreplaylsn = CASE $4 WHEN '0/0'::pg_lsn THEN report.reportedreplaylsn ELSE $4 END "
+		"FROM settled WHERE report.nodeid = settled.nodeid";
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(updateQuery,
-										  argCount, argTypes, argValues,
-										  NULL, false, 0);
+	int spiStatus = ExecuteMetadataPlan(&updatePlan, updateQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
 
 	if (spiStatus != SPI_OK_UPDATE)
 	{
 		elog(ERROR, "could not update " AUTO_FAILOVER_NODE_TABLE);
 	}
 
+	bool updated = SPI_processed == 1;
+
 	SPI_finish();
+
+	return updated;
 }
 
 
@@ -1415,17 +1800,23 @@ ReportAutoFailoverNodeHealth(char *nodeHost, int nodePort,
 	};
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
 
+	static MetadataPlan updatePlan = { 0 };
+
 	const char *updateQuery =
+		"WITH checked AS ("
 		"UPDATE " AUTO_FAILOVER_NODE_TABLE
-		" SET goalstate = $1, health = $2, "
-		"healthchecktime = now(), statechangetime = now() "
-		"WHERE nodehost = $3 AND nodeport = $4";
+		" SET goalstate = $1, health = $2, statechangetime = now() "
+		"WHERE nodehost = $3 AND nodeport = $4 "
+		"RETURNING nodeid) "
+		"UPDATE " AUTO_FAILOVER_NODE_REPORT_TABLE " AS report"
+		" SET healthchecktime = now() "
+		"FROM checked WHERE report.nodeid = checked.nodeid";
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(updateQuery,
-										  argCount, argTypes, argValues,
-										  NULL, false, 0);
+	int spiStatus = ExecuteMetadataPlan(&updatePlan, updateQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
 
 	if (spiStatus != SPI_OK_UPDATE)
 	{
@@ -1433,6 +1824,8 @@ ReportAutoFailoverNodeHealth(char *nodeHost, int nodePort,
 	}
 
 	SPI_finish();
+
+	InvalidateNodeCache();
 }
 
 
@@ -1465,6 +1858,8 @@ ReportAutoFailoverNodeReplicationSetting(int64 nodeid,
 	};
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
 
+	static MetadataPlan updatePlan = { 0 };
+
 	const char *updateQuery =
 		"UPDATE " AUTO_FAILOVER_NODE_TABLE
 		"   SET candidatepriority = $1, replicationquorum = $2 "
@@ -1472,9 +1867,9 @@ ReportAutoFailoverNodeReplicationSetting(int64 nodeid,
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(updateQuery,
-										  argCount, argTypes, argValues,
-										  NULL, false, 0);
+	int spiStatus = ExecuteMetadataPlan(&updatePlan, updateQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
 
 	if (spiStatus != SPI_OK_UPDATE)
 	{
@@ -1482,6 +1877,51 @@ ReportAutoFailoverNodeReplicationSetting(int64 nodeid,
 	}
 
 	SPI_finish();
+
+	/* synchronous_standby_names depends on those settings */
+	InvalidateNodeCache();
+}
+
+
+/*
+ * SetAutoFailoverNodeSysIdentifier sets the system identifier of a node that
+ * was registered before its Postgres instance existed.
+ */
+void
+SetAutoFailoverNodeSysIdentifier(int64 nodeid, uint64 sysIdentifier)
+{
+	Oid argTypes[] = {
+		INT8OID,                 /* sysidentifier */
+		INT8OID                  /* nodeid */
+	};
+
+	Datum argValues[] = {
+		Int64GetDatum(sysIdentifier),         /* sysidentifier */
+		Int64GetDatum(nodeid)                 /* nodeid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan updatePlan = { 0 };
+
+	const char *updateQuery =
+		"UPDATE " AUTO_FAILOVER_NODE_TABLE
+		"   SET sysidentifier = $1 "
+		" WHERE nodeid = $2";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&updatePlan, updateQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
+
+	if (spiStatus != SPI_OK_UPDATE)
+	{
+		elog(ERROR, "could not update " AUTO_FAILOVER_NODE_TABLE);
+	}
+
+	SPI_finish();
+
+	InvalidateNodeCache();
 }
 
 
@@ -1512,6 +1952,8 @@ UpdateAutoFailoverNodeMetadata(int64 nodeid,
 	};
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
 
+	static MetadataPlan updatePlan = { 0 };
+
 	const char *updateQuery =
 		"UPDATE " AUTO_FAILOVER_NODE_TABLE
 		" SET nodename = $2, nodehost = $3, nodeport = $4 "
@@ -1519,9 +1961,9 @@ UpdateAutoFailoverNodeMetadata(int64 nodeid,
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(updateQuery,
-										  argCount, argTypes, argValues,
-										  NULL, false, 0);
+	int spiStatus = ExecuteMetadataPlan(&updatePlan, updateQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
 
 	if (spiStatus != SPI_OK_UPDATE)
 	{
@@ -1529,6 +1971,10 @@ UpdateAutoFailoverNodeMetadata(int64 nodeid,
 	}
 
 	SPI_finish();
+
+	/* the node might have a new host or port to check */
+	NotifyNodeListChange();
+	InvalidateNodeCache();
 }
 
 
@@ -1549,15 +1995,17 @@ RemoveAutoFailoverNode(AutoFailoverNode *pgAutoFailoverNode)
 	};
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
 
+	static MetadataPlan deletePlan = { 0 };
+
 	const char *deleteQuery =
 		"DELETE FROM " AUTO_FAILOVER_NODE_TABLE
 		" WHERE nodeid = $1";
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(deleteQuery,
-										  argCount, argTypes, argValues,
-										  NULL, false, 0);
+	int spiStatus = ExecuteMetadataPlan(&deletePlan, deleteQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
 
 	if (spiStatus != SPI_OK_DELETE)
 	{
@@ -1565,6 +2013,10 @@ RemoveAutoFailoverNode(AutoFailoverNode *pgAutoFailoverNode)
 	}
 
 	SPI_finish();
+
+	NotifyNodeListChange();
+	InvalidateNodeCache();
+	RemoveWalRates(MyDatabaseId, pgAutoFailoverNode->nodeId);
 }
 
 
@@ -1747,7 +2199,10 @@ bool
 IsBeingPromoted(AutoFailoverNode *node)
 {
 	return node != NULL &&
-		   ((node->reportedState == REPLICATION_STATE_REPORT_LSN &&
+		   ((node->reportedState == REPLICATION_STATE_SECONDARY &&
+			 node->goalState == REPLICATION_STATE_PREPARE_PROMOTION) ||
+
+			(node->reportedState == REPLICATION_STATE_REPORT_LSN &&
 			 (node->goalState == REPLICATION_STATE_FAST_FORWARD ||
 			  node->goalState == REPLICATION_STATE_PREPARE_PROMOTION)) ||
 
@@ -1900,7 +2355,17 @@ IsStateIn(ReplicationState state, List *allowedStates)
 bool
 IsHealthy(AutoFailoverNode *pgAutoFailoverNode)
 {
-	TimestampTz now = GetCurrentTimestamp();
+	return IsHealthyAt(pgAutoFailoverNode, GetCurrentTimestamp());
+}
+
+
+/*
+ * IsHealthyAt implements IsHealthy as of the given time, so that the failover
+ * simulator can replay past decisions.
+ */
+bool
+IsHealthyAt(AutoFailoverNode *pgAutoFailoverNode, TimestampTz now)
+{
 	int nodeActiveCallsFrequencyMs = 1 * 1000; /* keeper sleep time */
 
 	if (pgAutoFailoverNode == NULL)
@@ -1937,14 +2402,35 @@ IsHealthy(AutoFailoverNode *pgAutoFailoverNode)
 
 /*
  * IsUnhealthy returns whether the given node is unhealthy, meaning it failed
- * its last health check and has not reported for more than UnhealthyTimeoutMs,
- * and it's PostgreSQL instance has been reporting as running by the keeper.
+ * its last health check and has not reported for more than the
+ * node_considered_unhealthy_timeout of its formation, and it's PostgreSQL
+ * instance has been reporting as running by the keeper.
  */
 bool
 IsUnhealthy(AutoFailoverNode *pgAutoFailoverNode)
 {
-	TimestampTz now = GetCurrentTimestamp();
+	if (pgAutoFailoverNode == NULL)
+	{
+		return true;
+	}
 
+	return IsUnhealthyAt(pgAutoFailoverNode,
+						 GetCurrentTimestamp(),
+						 PgStartTime,
+						 FormationUnhealthyTimeoutMs(
+							 pgAutoFailoverNode->formationId));
+}
+
+
+/*
+ * IsUnhealthyAt implements IsUnhealthy as of the given time, for a monitor
+ * started at startTime and with the given unhealthy timeout, so that the
+ * failover simulator can replay past decisions with other settings.
+ */
+bool
+IsUnhealthyAt(AutoFailoverNode *pgAutoFailoverNode,
+			  TimestampTz now, TimestampTz startTime, int unhealthyTimeoutMs)
+{
 	if (pgAutoFailoverNode == NULL)
 	{
 		return true;
@@ -1953,14 +2439,14 @@ IsUnhealthy(AutoFailoverNode *pgAutoFailoverNode)
 	/* if the keeper isn't reporting, trust our Health Checks */
 	if (TimestampDifferenceExceeds(pgAutoFailoverNode->reportTime,
 								   now,
-								   UnhealthyTimeoutMs))
+								   unhealthyTimeoutMs))
 	{
 		if (pgAutoFailoverNode->health == NODE_HEALTH_BAD &&
-			TimestampDifferenceExceeds(PgStartTime,
+			TimestampDifferenceExceeds(startTime,
 									   pgAutoFailoverNode->healthCheckTime,
 									   0))
 		{
-			if (TimestampDifferenceExceeds(PgStartTime,
+			if (TimestampDifferenceExceeds(startTime,
 										   now,
 										   StartupGracePeriodMs))
 			{
@@ -1985,7 +2471,7 @@ IsUnhealthy(AutoFailoverNode *pgAutoFailoverNode)
 
 /*
  * IsReporting returns whether the given node has reported recently, within the
- * UnhealthyTimeoutMs interval.
+ * node_considered_unhealthy_timeout of its formation.
  */
 bool
 IsReporting(AutoFailoverNode *pgAutoFailoverNode)
@@ -1999,7 +2485,8 @@ IsReporting(AutoFailoverNode *pgAutoFailoverNode)
 
 	if (TimestampDifferenceExceeds(pgAutoFailoverNode->reportTime,
 								   now,
-								   UnhealthyTimeoutMs))
+								   FormationUnhealthyTimeoutMs(
+									   pgAutoFailoverNode->formationId)))
 	{
 		return false;
 	}
@@ -2026,10 +2513,45 @@ IsDrainTimeExpired(AutoFailoverNode *pgAutoFailoverNode)
 	TimestampTz now = GetCurrentTimestamp();
 	if (TimestampDifferenceExceeds(pgAutoFailoverNode->stateChangeTime,
 								   now,
-								   DrainTimeoutMs))
+								   FormationDemoteTimeoutMs(
+									   pgAutoFailoverNode->formationId)))
+	{
+		drainTimeExpired = true;
+	}
+
+	/* a primary that lost its lease has stopped accepting writes already */
+	TimestampTz leaseExpiryTime = PrimaryLeaseExpiryTime(pgAutoFailoverNode);
+
+	if (leaseExpiryTime != 0 && leaseExpiryTime <= now)
 	{
 		drainTimeExpired = true;
 	}
 
 	return drainTimeExpired;
 }
+
+
+/*
+ * PrimaryLeaseExpiryTime returns the time after which we know that the given
+ * primary node has fenced itself, or zero when it does not hold a lease.
+ *
+ * With pgautofailover.primary_lease_duration, each node_active call from a
+ * primary renews its lease, and the keeper stops Postgres as soon as the
+ * lease expires on its own clock. The keeper starts counting
+ * before sending the call, and we count from when we received it, and add
+ * pgautofailover.lease_clock_skew for the clocks running at different rates.
+ */
+TimestampTz
+PrimaryLeaseExpiryTime(AutoFailoverNode *pgAutoFailoverNode)
+{
+	if (PrimaryLeaseDurationMs <= 0 ||
+		pgAutoFailoverNode == NULL ||
+		pgAutoFailoverNode->reportedState != REPLICATION_STATE_PRIMARY)
+	{
+		return 0;
+	}
+
+	return TimestampTzPlusMilliseconds(pgAutoFailoverNode->reportTime,
+									   (int64) PrimaryLeaseDurationMs +
+									   LeaseClockSkewMs);
+}
@@ -48,33 +48,51 @@
 #define Anum_pgautofailover_node_candidate_priority 19
 #define Anum_pgautofailover_node_replication_quorum 20
 #define Anum_pgautofailover_node_nodecluster 21
+#define Anum_pgautofailover_node_reportedreplaylsn 22
+#define Anum_pgautofailover_node_goaltraceid 23
+
+/*
+ * The columns that node_active and the health checks update all the time live
+ * in the narrow pgautofailover.node_report table, so that those updates don't
+ * rewrite the wide rows of pgautofailover.node. Every node has its row in
+ * both tables.
+ *
+ * Queries that read nodes join both tables with the following column list,
+ * using the "node" and "report" aliases.
+ */
+#define AUTO_FAILOVER_NODE_REPORT_TABLE "pgautofailover.node_report"
 
 #define AUTO_FAILOVER_NODE_TABLE_ALL_COLUMNS \
-	"formationid, " \
-	"nodeid, " \
-	"groupid, " \
-	"nodename, " \
-	"nodehost, " \
-	"nodeport, " \
-	"sysidentifier, " \
-	"goalstate, " \
-	"reportedstate, " \
-	"reportedpgisrunning, " \
-	"reportedrepstate, " \
-	"reporttime, " \
-	"reportedtli, " \
-	"reportedlsn, " \
-	"walreporttime, " \
-	"health, " \
-	"healthchecktime, " \
-	"statechangetime, " \
-	"candidatepriority, " \
-	"replicationquorum, " \
-	"nodecluster"
+	"node.formationid, " \
+	"node.nodeid, " \
+	"node.groupid, " \
+	"node.nodename, " \
+	"node.nodehost, " \
+	"node.nodeport, " \
+	"node.sysidentifier, " \
+	"node.goalstate, " \
+	"node.reportedstate, " \
+	"node.reportedpgisrunning, " \
+	"node.reportedrepstate, " \
+	"report.reporttime, " \
+	"node.reportedtli, " \
+	"report.reportedlsn, " \
+	"report.walreporttime, " \
+	"node.health, " \
+	"report.healthchecktime, " \
+	"node.statechangetime, " \
+	"node.candidatepriority, " \
+	"node.replicationquorum, " \
+	"node.nodecluster, " \
+	"report.reportedreplaylsn, " \
+	"node.goaltraceid"
 
+#define AUTO_FAILOVER_NODE_REPORT_JOIN \
+	" LEFT JOIN " AUTO_FAILOVER_NODE_REPORT_TABLE " AS report USING (nodeid)"
 
 #define SELECT_ALL_FROM_AUTO_FAILOVER_NODE_TABLE \
-	"SELECT " AUTO_FAILOVER_NODE_TABLE_ALL_COLUMNS " FROM " AUTO_FAILOVER_NODE_TABLE
+	"SELECT " AUTO_FAILOVER_NODE_TABLE_ALL_COLUMNS \
+	" FROM " AUTO_FAILOVER_NODE_TABLE AUTO_FAILOVER_NODE_REPORT_JOIN
 
 /* pg_stat_replication.sync_state: "sync", "async", "quorum", "potential" */
 typedef enum SyncState
@@ -130,9 +148,11 @@ typedef struct AutoFailoverNode
 	TimestampTz stateChangeTime;
 	int reportedTLI;
 	XLogRecPtr reportedLSN;
+	XLogRecPtr reportedReplayLSN;
 	int candidatePriority;
 	bool replicationQuorum;
 	char *nodeCluster;
+	int64 goalTraceId;          /* decision that assigned goalState */
 } AutoFailoverNode;
 
 
@@ -153,27 +173,37 @@ typedef enum FormationKind
 /* public function declarations */
 extern List * AllAutoFailoverNodes(char *formationId);
 extern List * AutoFailoverNodeGroup(char *formationId, int groupId);
+extern int64 GroupTopologyVersion(List *groupNodeList);
 extern List * AutoFailoverAllNodesInGroup(char *formationId, int groupId);
 extern List * AutoFailoverOtherNodesList(AutoFailoverNode *pgAutoFailoverNode);
 extern List * AutoFailoverOtherNodesListInState(AutoFailoverNode *pgAutoFailoverNode,
 												ReplicationState currentState);
+extern List * GroupOtherNodesList(List *groupNodeList,
+								  AutoFailoverNode *pgAutoFailoverNode);
+extern List * GroupOtherNodesListInState(List *groupNodeList,
+										 AutoFailoverNode *pgAutoFailoverNode,
+										 ReplicationState currentState);
 extern List * AutoFailoverCandidateNodesListInState(AutoFailoverNode *pgAutoFailoverNode,
 													ReplicationState currentState);
 extern AutoFailoverNode * GetPrimaryNodeInGroup(char *formationId, int32 groupId);
 AutoFailoverNode * GetNodeToFailoverFromInGroup(char *formationId, int32 groupId);
 extern AutoFailoverNode * GetPrimaryOrDemotedNodeInGroup(char *formationId,
 														 int32 groupId);
+extern AutoFailoverNode * FindPrimaryOrDemotedNode(List *groupNodeList);
 extern AutoFailoverNode * FindFailoverNewStandbyNode(List *groupNodeList);
 extern List * GroupListCandidates(List *groupNodeList);
 extern List * ListMostAdvancedStandbyNodes(List *groupNodeList);
 extern List * GroupListSyncStandbys(List *groupNodeList);
 extern bool AllNodesHaveSameCandidatePriority(List *groupNodeList);
 extern int CountSyncStandbys(List *groupNodeList);
+extern int CountStandbyClonesInProgress(List *groupNodeList);
 extern bool IsHealthySyncStandby(AutoFailoverNode *node);
 extern int CountHealthySyncStandbys(List *groupNodeList);
 extern int CountHealthyCandidates(List *groupNodeList);
 extern bool IsFailoverInProgress(List *groupNodeList);
 extern AutoFailoverNode * FindMostAdvancedStandby(List *groupNodeList);
+extern AutoFailoverNode * FindUpstreamNode(AutoFailoverNode *node,
+										   List *groupNodeList);
 extern AutoFailoverNode * FindCandidateNodeBeingPromoted(List *groupNodeList);
 
 extern AutoFailoverNode * GetAutoFailoverNode(char *nodeHost, int nodePort);
@@ -205,7 +235,12 @@ extern void ReportAutoFailoverNodeState(char *nodeHost, int nodePort,
 										bool pgIsRunning,
 										SyncState pgSyncState,
 										int reportedTLI,
-										XLogRecPtr reportedLSN);
+										XLogRecPtr reportedLSN,
+										XLogRecPtr reportedReplayLSN);
+extern bool ReportAutoFailoverNodeActivity(int64 nodeId,
+										   ReplicationState reportedState,
+										   XLogRecPtr reportedLSN,
+										   XLogRecPtr reportedReplayLSN);
 extern void ReportAutoFailoverNodeHealth(char *nodeHost, int nodePort,
 										 ReplicationState goalState,
 										 NodeHealthState health);
@@ -214,6 +249,7 @@ extern void ReportAutoFailoverNodeReplicationSetting(int64 nodeid,
 													 int nodePort,
 													 int candidatePriority,
 													 bool replicationQuorum);
+extern void SetAutoFailoverNodeSysIdentifier(int64 nodeid, uint64 sysIdentifier);
 extern void UpdateAutoFailoverNodeMetadata(int64 nodeid,
 										   char *nodeName,
 										   char *nodeHost,
@@ -238,6 +274,14 @@ extern bool IsInPrimaryState(AutoFailoverNode *pgAutoFailoverNode);
 extern bool IsInMaintenance(AutoFailoverNode *node);
 extern bool IsStateIn(ReplicationState state, List *allowedStates);
 extern bool IsHealthy(AutoFailoverNode *pgAutoFailoverNode);
+extern bool IsHealthyAt(AutoFailoverNode *pgAutoFailoverNode, TimestampTz now);
 extern bool IsUnhealthy(AutoFailoverNode *pgAutoFailoverNode);
+extern bool IsUnhealthyAt(AutoFailoverNode *pgAutoFailoverNode,
+						  TimestampTz now, TimestampTz startTime,
+						  int unhealthyTimeoutMs);
 extern bool IsDrainTimeExpired(AutoFailoverNode *pgAutoFailoverNode);
+extern TimestampTz PrimaryLeaseExpiryTime(AutoFailoverNode *pgAutoFailoverNode);
 extern bool IsReporting(AutoFailoverNode *pgAutoFailoverNode);
+
+/* GUCs */
+extern bool CascadeByCluster;
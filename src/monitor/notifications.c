@@ -15,6 +15,7 @@
 
 #include "postgres.h"
 
+#include "event_queue.h"
 #include "metadata.h"
 #include "node_metadata.h"
 #include "notifications.h"
@@ -29,6 +30,13 @@
 #include "utils/pg_lsn.h"
 
 
+/* GUC variables */
+bool GroupNotifications = false;
+
+
+static void NotifyGroupStateChange(AutoFailoverNode *node, int64 eventid);
+
+
 /*
  * LogAndNotifyMessage emits the given message both as a log entry and also as
  * a notification on the CHANNEL_LOG channel.
@@ -66,19 +74,28 @@ LogAndNotifyMessage(char *message, size_t size, const char *fmt, ...)
  * as to be easy to parse by a machine.
  */
 int64
-NotifyStateChange(AutoFailoverNode *node, char *description)
+NotifyStateChange(AutoFailoverNode *node, EventCode eventCode, char *description)
 {
 	StringInfo payload = makeStringInfo();
 
 	/*
-	 * Insert the event in our events table.
+	 * Insert the event in our events table, or have the health check worker
+	 * insert it later when deferred events are enabled.
 	 */
-	int64 eventid = InsertEvent(node, description);
+	int64 eventid =
+		DeferredEvents ? QueueEvent(node, eventCode, description) : 0;
+
+	if (eventid == 0)
+	{
+		eventid = InsertEvent(node, eventCode, description);
+	}
 
 	/* build a json object from the notification pieces */
 	appendStringInfoChar(payload, '{');
 
 	appendStringInfo(payload, "\"type\": \"state\"");
+	appendStringInfo(payload, ", \"eventId\": %lld", (long long) eventid);
+	appendStringInfo(payload, ", \"eventCode\": %d", (int) eventCode);
 
 	appendStringInfo(payload, ", \"formation\": ");
 	escape_json(payload, node->formationId);
@@ -103,28 +120,80 @@ NotifyStateChange(AutoFailoverNode *node, char *description)
 	appendStringInfo(payload, ", \"health\":");
 	escape_json(payload, NodeHealthToString(node->health));
 
+	appendStringInfo(payload, ", \"traceId\": %lld",
+					 (long long) node->goalTraceId);
+
 	appendStringInfoChar(payload, '}');
 
 	Async_Notify(CHANNEL_STATE, payload->data);
 
 	pfree(payload->data);
 	pfree(payload);
+
+	if (GroupNotifications)
+	{
+		NotifyGroupStateChange(node, eventid);
+	}
+
 	return eventid;
 }
 
 
+/*
+ * NotifyGroupStateChange emits a notification message on the channel of the
+ * node's group, so that clients only interested in a single group don't have
+ * to receive and parse the notifications of every other group. The formation
+ * and group are given by the channel name, the payload is kept compact.
+ */
+static void
+NotifyGroupStateChange(AutoFailoverNode *node, int64 eventid)
+{
+	char *channel = psprintf("%s.%s.%d",
+							 CHANNEL_STATE, node->formationId, node->groupId);
+
+	if (strlen(channel) >= NAMEDATALEN)
+	{
+		/* clients fall back to the "state" channel for this group */
+		pfree(channel);
+		return;
+	}
+
+	StringInfo payload = makeStringInfo();
+
+	appendStringInfo(payload, "[%lld,", (long long) node->nodeId);
+	escape_json(payload, node->nodeName);
+	appendStringInfoChar(payload, ',');
+	escape_json(payload, node->nodeHost);
+	appendStringInfo(payload, ",%d,", node->nodePort);
+	escape_json(payload, ReplicationStateGetName(node->reportedState));
+	appendStringInfoChar(payload, ',');
+	escape_json(payload, ReplicationStateGetName(node->goalState));
+	appendStringInfoChar(payload, ',');
+	escape_json(payload, NodeHealthToString(node->health));
+	appendStringInfo(payload, ",%lld]", (long long) eventid);
+
+	Async_Notify(channel, payload->data);
+
+	pfree(channel);
+	pfree(payload->data);
+	pfree(payload);
+}
+
+
 /*
  * InsertEvent populates the monitor's pgautofailover.event table with a new
- * entry, and returns the id of the new event.
+ * entry, and returns the id of the new event. The eventid is given by
+ * AssignEventId(), which tracks it until our transaction ends.
  */
 int64
-InsertEvent(AutoFailoverNode *node, char *description)
+InsertEvent(AutoFailoverNode *node, EventCode eventCode, char *description)
 {
 	Oid goalStateOid = ReplicationStateGetEnum(node->goalState);
 	Oid reportedStateOid = ReplicationStateGetEnum(node->reportedState);
 	Oid replicationStateTypeOid = ReplicationStateTypeOid();
 
 	Oid argTypes[] = {
+		INT8OID, /* eventid */
 		TEXTOID, /* formationid */
 		INT8OID, /* nodeid */
 		INT4OID, /* groupid */
@@ -138,10 +207,14 @@ InsertEvent(AutoFailoverNode *node, char *description)
 		LSNOID,  /* reportedLSN */
 		INT4OID, /* candidate_priority */
 		BOOLOID, /* replication_quorum */
-		TEXTOID  /* description */
+		TEXTOID, /* description */
+		INT2OID  /* eventcode */
 	};
 
+	int64 eventId = AssignEventId();
+
 	Datum argValues[] = {
+		Int64GetDatum(eventId),                   /* eventid */
 		CStringGetTextDatum(node->formationId),   /* formationid */
 		Int64GetDatum(node->nodeId),              /* nodeid */
 		Int32GetDatum(node->groupId),             /* groupid */
@@ -155,37 +228,29 @@ InsertEvent(AutoFailoverNode *node, char *description)
 		LSNGetDatum(node->reportedLSN),           /* reportedLSN */
 		Int32GetDatum(node->candidatePriority),   /* candidate_priority */
 		BoolGetDatum(node->replicationQuorum),    /* replication_quorum */
-		CStringGetTextDatum(description)          /* description */
+		CStringGetTextDatum(description),         /* description */
+		Int16GetDatum((int16) eventCode)          /* eventcode */
 	};
 
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
-	int64 eventId = 0;
+
+	static MetadataPlan insertPlan = { 0 };
 
 	const char *insertQuery =
 		"INSERT INTO " AUTO_FAILOVER_EVENT_TABLE
-		"(formationid, nodeid, groupid, nodename, nodehost, nodeport,"
+		"(eventid, formationid, nodeid, groupid, nodename, nodehost, nodeport,"
 		" reportedstate, goalstate, reportedrepstate, reportedtli, reportedlsn,"
-		" candidatepriority, replicationquorum, description) "
-		"VALUES ($1, $2, $3, $4, $5, $6, $7, $8, $9, $10, $11, $12, $13, $14) "
-		"RETURNING eventid";
+		" candidatepriority, replicationquorum, description, eventcode) "
+		"VALUES ($1, $2, $3, $4, $5, $6, $7, $8, $9, $10, $11, $12, $13, $14,"
+		" $15, $16)";
 
 	SPI_connect();
 
-	int spiStatus = SPI_execute_with_args(insertQuery, argCount, argTypes,
-										  argValues, NULL, false, 0);
+	int spiStatus = ExecuteMetadataPlan(&insertPlan, insertQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
 
-	if (spiStatus == SPI_OK_INSERT_RETURNING && SPI_processed > 0)
-	{
-		bool isNull = false;
-
-		Datum eventIdDatum = SPI_getbinval(SPI_tuptable->vals[0],
-										   SPI_tuptable->tupdesc,
-										   1,
-										   &isNull);
-
-		eventId = DatumGetInt64(eventIdDatum);
-	}
-	else
+	if (spiStatus != SPI_OK_INSERT)
 	{
 		elog(ERROR, "could not insert into " AUTO_FAILOVER_EVENT_TABLE);
 	}
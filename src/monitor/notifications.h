@@ -24,20 +24,51 @@
  * produces:
  *
  * - the "state" channel is used when a node's state is assigned to something
- *   new
+ *   new, the payload includes the id of the event that records the change, so
+ *   that clients can detect the notifications they missed and fetch the
+ *   events they need from the event table
  *
  * - the "log" channel is used to duplicate message that are sent to the
  *   PostgreSQL logs, in order for a pg_auto_failover monitor client to subscribe to
  *   the chatter without having to actually have the privileges to tail the
  *   PostgreSQL server logs.
+ *
+ * - when pgautofailover.group_notifications is on, state changes are also
+ *   sent on the "state.<formation>.<group>" channel of the node's group, with a
+ *   compact payload: a JSON array of the node id, name, host, port, reported
+ *   state, goal state, health and event id. Groups whose channel name would not fit in
+ *   NAMEDATALEN only use the "state" channel.
  */
 #define CHANNEL_STATE "state"
 #define CHANNEL_LOG "log"
 #define BUFSIZE 8192
 
+/*
+ * Every event is recorded with a code that classifies it, so that the event
+ * history can be filtered by type without parsing the descriptions. The
+ * values are stored in the pgautofailover.event table and named in the
+ * pgautofailover.event_code table, so they must never be renumbered.
+ */
+typedef enum EventCode
+{
+	EVENT_CODE_UNKNOWN = 0,
+	EVENT_CODE_GOAL_STATE = 1,
+	EVENT_CODE_FAILOVER = 2,
+	EVENT_CODE_MAINTENANCE = 3,
+	EVENT_CODE_REPORTED_STATE = 4,
+	EVENT_CODE_HEALTH = 5,
+	EVENT_CODE_SETTINGS = 6
+} EventCode;
+
+
+/* GUCs */
+extern bool GroupNotifications;
+
 
 void LogAndNotifyMessage(char *message, size_t size, const char *fmt, ...) __attribute__(
 	(format(printf, 3, 4)));
 
-int64 NotifyStateChange(AutoFailoverNode *node, char *description);
-int64 InsertEvent(AutoFailoverNode *node, char *description);
+int64 NotifyStateChange(AutoFailoverNode *node, EventCode eventCode,
+						char *description);
+int64 InsertEvent(AutoFailoverNode *node, EventCode eventCode,
+				  char *description);
@@ -13,10 +13,20 @@
 #include "postgres.h"
 
 /* these are internal headers */
+#include "event_queue.h"
+#include "failover_metadata.h"
+#include "goal_state_wait.h"
 #include "health_check.h"
 #include "group_state_machine.h"
 #include "metadata.h"
+#include "metrics_worker.h"
+#include "node_cache.h"
+#include "node_latency.h"
+#include "notifications.h"
+#include "stat_functions.h"
+#include "sync_standby_lag.h"
 #include "version_compat.h"
+#include "wal_rate.h"
 
 /* these are always necessary for a bgworker */
 #include "miscadmin.h"
@@ -31,12 +41,21 @@
 #include "commands/dbcommands.h"
 #include "postmaster/postmaster.h"
 #include "utils/builtins.h"
+#include "utils/guc.h"
 #include "utils/memutils.h"
 #include "tcop/utility.h"
 
 
 ProcessUtility_hook_type PreviousProcessUtility_hook = NULL;
 
+/* values of pgautofailover.health_check_probe */
+static const struct config_enum_entry health_check_probe_options[] = {
+	{ "connect", HEALTH_CHECK_PROBE_CONNECT, false },
+	{ "query", HEALTH_CHECK_PROBE_QUERY, false },
+	{ "write", HEALTH_CHECK_PROBE_WRITE, false },
+	{ NULL, 0, false }
+};
+
 
 #if PG_VERSION_NUM >= 150000
 static shmem_request_hook_type prev_shmem_request_hook = NULL;
@@ -107,6 +126,11 @@ pgautofailover_shmem_request(void)
 	}
 
 	RequestAddinShmemSpace(HealthCheckWorkerShmemSize());
+	RequestAddinShmemSpace(NodeCacheShmemSize());
+	RequestAddinShmemSpace(WalRateShmemSize());
+	RequestAddinShmemSpace(EventQueueShmemSize());
+	RequestAddinShmemSpace(StatFunctionsShmemSize());
+	RequestAddinShmemSpace(GoalStateWaitShmemSize());
 }
 
 
@@ -151,23 +175,357 @@ StartMonitorNode(void)
 							NULL, &HealthCheckRetryDelay, 2 * 1000, 1, INT_MAX,
 							PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
 
+	DefineCustomIntVariable("pgautofailover.health_check_workers",
+							"Number of health check workers per database.",
+							"Nodes are split among the workers using a hash of "
+							"their node id.",
+							&HealthCheckWorkers, 1, 1, 100,
+							PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("pgautofailover.health_check_keepalive",
+							 "Keep health check connections open between checks",
+							 "Health checks then send an empty query on the "
+							 "existing connection, and only reconnect on failure.",
+							 &HealthCheckKeepAlive, false, PGC_SIGHUP,
+							 0, NULL, NULL, NULL);
+
+	DefineCustomEnumVariable("pgautofailover.health_check_probe",
+							 "What a node must answer to pass its health check.",
+							 "connect only needs the startup packet to be "
+							 "answered, query runs a trivial query, and write "
+							 "also commits a transaction on the primary.",
+							 &HealthCheckProbe, HEALTH_CHECK_PROBE_CONNECT,
+							 health_check_probe_options, PGC_SIGHUP,
+							 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.health_check_slow_threshold",
+							"Probe response time above which a node is degraded.",
+							"A slow answer to a query or write probe counts as "
+							"a failed try. Zero disables it.",
+							&HealthCheckSlowThreshold, 0, 0, INT_MAX,
+							PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.health_check_dns_ttl",
+							"Time during which the health checks connect to "
+							"the addresses resolved for a node host name.",
+							"The names are resolved again in between two "
+							"rounds of health checks. Zero has libpq resolve "
+							"them at each connection.",
+							&HealthCheckDnsTtl, 60, 0, 86400,
+							PGC_SIGHUP, GUC_UNIT_S, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.health_check_tcp_user_timeout",
+							"TCP user timeout of the health check connections.",
+							"Zero uses the system default. The formation "
+							"setting health_check_tcp_user_timeout overrides it.",
+							&HealthCheckTcpUserTimeout, 0, 0, INT_MAX,
+							PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.health_check_keepalives_idle",
+							"Idle time before sending TCP keepalives on the "
+							"health check connections.",
+							"Zero uses the system default.",
+							&HealthCheckKeepAlivesIdle, 0, 0, INT_MAX,
+							PGC_SIGHUP, GUC_UNIT_S, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.health_check_keepalives_interval",
+							"Time between TCP keepalives on the health check "
+							"connections.",
+							"Zero uses the system default.",
+							&HealthCheckKeepAlivesInterval, 0, 0, INT_MAX,
+							PGC_SIGHUP, GUC_UNIT_S, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.health_check_keepalives_count",
+							"Number of lost TCP keepalives before the health "
+							"check connection is considered dead.",
+							"Zero uses the system default.",
+							&HealthCheckKeepAlivesCount, 0, 0, INT_MAX,
+							PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.health_check_passive_period",
+							"Don't connect to nodes whose keeper reported a "
+							"running Postgres within this period.",
+							"Zero disables it, and every node is checked with a "
+							"connection at every round.",
+							&HealthCheckPassivePeriod, 0, 0, INT_MAX,
+							PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.health_check_backoff_threshold",
+							"Back off the health checks of nodes that have been "
+							"failing them for longer than this.",
+							"Zero disables it. A report from the node's keeper "
+							"resets the backoff.",
+							&HealthCheckBackoffThreshold, 0, 0, INT_MAX,
+							PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.health_check_spread",
+							"Percentage of the health check period over which "
+							"the health checks of a round are spread.",
+							"Each node is checked at a phase that depends on its "
+							"node id. Zero starts every check at once.",
+							&HealthCheckSpread, 50, 0, 100,
+							PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.health_check_max_connects",
+							"Maximum number of health check connections that "
+							"are being established at the same time.",
+							"Zero means no limit.",
+							&HealthCheckMaxConnects, 0, 0, INT_MAX,
+							PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.health_flap_samples",
+							"Number of health check rounds in a row that must "
+							"find a new health before the health of a node "
+							"changes.",
+							NULL, &HealthFlapSamples, 1, 1, 100,
+							PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.health_flap_min_interval",
+							"Minimum time between two health changes of a node.",
+							"Zero disables it.",
+							&HealthFlapMinInterval, 0, 0, INT_MAX,
+							PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.health_check_backoff_max_delay",
+							"Maximum delay between two health checks of a node "
+							"that is backed off.",
+							NULL, &HealthCheckBackoffMaxDelay, 5 * 60 * 1000,
+							1, INT_MAX,
+							PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.health_check_stats_max_nodes",
+							"Maximum number of nodes for which health check "
+							"statistics are kept.",
+							NULL, &HealthCheckStatsMaxNodes, 1024, 1, 100000,
+							PGC_POSTMASTER, 0, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("pgautofailover.proceed_pending_groups",
+							 "Run the state machine of the groups that are not "
+							 "settled from the health check workers.",
+							 "Timeout driven decisions then don't wait for a "
+							 "keeper of the group to call node_active.",
+							 &ProceedPendingGroups, false, PGC_SIGHUP,
+							 0, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("pgautofailover.group_notifications",
+							 "Also notify state changes on a channel per group",
+							 "The channel is named state.<formation>.<group>.",
+							 &GroupNotifications, false, PGC_SIGHUP,
+							 0, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("pgautofailover.deferred_events",
+							 "Insert the events from the health check worker, "
+							 "rather than in the transaction of the state change.",
+							 "Notifications are still sent when the state change "
+							 "commits.",
+							 &DeferredEvents, false, PGC_SIGHUP,
+							 0, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("pgautofailover.track_functions",
+							 "Collect statistics about the calls to the monitor "
+							 "protocol functions.",
+							 "The statistics are shown in the view "
+							 "pgautofailover.stat_functions.",
+							 &TrackFunctions, true, PGC_SUSET,
+							 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.event_retention",
+							"Drop the daily partitions of the event table that "
+							"are older than this.",
+							"Zero keeps all the events.",
+							&EventRetention, 0, 0, INT_MAX,
+							PGC_SIGHUP, GUC_UNIT_MIN, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.table_health_hot_update_ratio",
+							"Warn when less than this percentage of the "
+							"updates of a monitor table are HOT updates.",
+							"The health check worker checks the updates done "
+							"in the last 10 minutes. Zero disables it.",
+							&TableHealthHotUpdateRatio, 50, 0, 100,
+							PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.table_health_dead_tuple_ratio",
+							"Warn when more than this percentage of the rows "
+							"of a monitor table are dead rows.",
+							"Zero disables it.",
+							&TableHealthDeadTupleRatio, 20, 0, 100,
+							PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.event_archive",
+							"Archive the daily partitions of the event table "
+							"that are older than this.",
+							"Zero keeps the partitions as they are.",
+							&EventArchive, 0, 0, INT_MAX,
+							PGC_SIGHUP, GUC_UNIT_MIN, NULL, NULL, NULL);
+
 	DefineCustomIntVariable("pgautofailover.enable_sync_wal_log_threshold",
 							"Don't enable synchronous replication until secondary xlog"
 							" is within this many bytes of the primary's",
 							NULL, &EnableSyncXlogThreshold, DEFAULT_XLOG_SEG_SIZE, 1,
 							INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
 
+	DefineCustomIntVariable("pgautofailover.enable_sync_wal_log_threshold_time",
+							"Don't enable synchronous replication until secondary xlog"
+							" is within this much time of the primary's WAL "
+							"generation.",
+							"Converted to bytes with the measured WAL rate of "
+							"the primary. Zero uses "
+							"pgautofailover.enable_sync_wal_log_threshold.",
+							&EnableSyncXlogThresholdTimeMs, 0, 0, INT_MAX,
+							PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.sync_standby_max_lag",
+							"Don't count the synchronous standby nodes that are "
+							"more than this many bytes behind the primary's xlog "
+							"in number_sync_standbys.",
+							"Zero disables it. The primary always waits for at "
+							"least one synchronous standby node.",
+							&SyncStandbyMaxLag, 0, 0,
+							INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
+
 	DefineCustomIntVariable("pgautofailover.promote_wal_log_threshold",
 							"Don't promote secondary unless xlog is with this many bytes"
 							" of the master",
 							NULL, &PromoteXlogThreshold, DEFAULT_XLOG_SEG_SIZE, 1,
 							INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
 
+	DefineCustomIntVariable("pgautofailover.promote_wal_log_threshold_time",
+							"Don't promote secondary unless xlog is within this "
+							"much time of the primary's WAL generation.",
+							"Converted to bytes with the measured WAL rate of "
+							"the primary. Zero uses "
+							"pgautofailover.promote_wal_log_threshold.",
+							&PromoteXlogThresholdTimeMs, 0, 0, INT_MAX,
+							PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.failover_candidate_max_report_age",
+							"Promote a failover candidate without waiting for "
+							"the standby nodes to report their LSN again, when "
+							"their last reports are at most this old.",
+							"Zero disables this fast path.",
+							&FailoverCandidateMaxReportAgeMs, 0, 0, INT_MAX,
+							PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.failover_max_concurrency",
+							"Maximum number of failovers in progress at the "
+							"same time in a formation.",
+							"Other groups wait for their turn by decreasing "
+							"failover priority. Zero disables the limit.",
+							&FailoverMaxConcurrency, 0, 0, INT_MAX,
+							PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.failover_coordinator_timeout",
+							"How long the worker groups of a Citus formation "
+							"wait for the failover of the coordinator group.",
+							"Zero disables waiting for the coordinator group.",
+							&FailoverCoordinatorTimeoutMs, 30 * 1000, 0, INT_MAX,
+							PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.max_concurrent_clones",
+							"Maximum number of standby nodes of a group that "
+							"run pg_basebackup at the same time.",
+							"Other new standby nodes wait in wait_standby. "
+							"Zero disables the limit.",
+							&MaxConcurrentClones, 0, 0, INT_MAX,
+							PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("pgautofailover.cascade_by_cluster",
+							 "Have the standby nodes of a node cluster other "
+							 "than the primary's stream from a secondary node "
+							 "of that cluster.",
+							 "Only applies to the nodes that are neither failover "
+							 "candidates nor in the replication quorum.",
+							 &CascadeByCluster, false, PGC_SIGHUP,
+							 0, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("pgautofailover.prefer_low_latency_candidates",
+							 "Prefer the failover candidate with the lowest "
+							 "network latency to the other nodes of the "
+							 "replication quorum.",
+							 "Only applies to candidates of the same priority, "
+							 "using the latency reported by the keepers.",
+							 &PreferLowLatencyCandidates, false, PGC_SIGHUP,
+							 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.degraded_primary_threshold",
+							"Start a switchover when the health signals "
+							"reported by the primary node exceed this many "
+							"milliseconds.",
+							"Zero disables it. The signals must exceed the "
+							"threshold in degraded_primary_samples reports "
+							"in a row.",
+							&DegradedPrimaryThresholdMs, 0, 0, INT_MAX,
+							PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.degraded_primary_samples",
+							"Number of consecutive degraded health signals "
+							"reports before starting a switchover.",
+							NULL, &DegradedPrimarySamples, 3, 1, INT_MAX,
+							PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.crash_recovery_max_eta",
+							"Ask a node to stop crash recovery and be cloned "
+							"again when the remaining recovery time it "
+							"reports exceeds this.",
+							"Zero disables it.",
+							&CrashRecoveryMaxEta, 0, 0, INT_MAX,
+							PGC_SIGHUP, GUC_UNIT_S, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.rewind_clone_threshold",
+							"Ask a former primary node to be cloned again "
+							"rather than rewound when the WAL it wrote past "
+							"the new primary timeline exceeds this percentage "
+							"of its database size.",
+							"Zero disables it.",
+							&RewindCloneThreshold, 0, 0, 100,
+							PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.node_active_max_concurrency",
+							"Refuse node_active calls when this many of them "
+							"are in progress already.",
+							"Zero disables it. The keepers retry refused calls "
+							"after a random delay.",
+							&NodeActiveMaxConcurrency, 0, 0, INT_MAX,
+							PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("pgautofailover.node_active_async_commit",
+							 "Commit the node_active calls that only record a "
+							 "heartbeat without waiting for the WAL flush.",
+							 "Calls that change the state of a node, or insert "
+							 "events, are always committed synchronously.",
+							 &NodeActiveAsyncCommit, true, PGC_SIGHUP,
+							 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.max_catchup_time",
+							"Don't enable synchronous replication nor failover to "
+							"a standby that is predicted to need more than this "
+							"long to catch up.",
+							"The prediction uses the rate of the recent LSN "
+							"reports. Zero disables it.",
+							&MaxCatchUpTimeMs, 0, 0, INT_MAX,
+							PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
+
 	DefineCustomIntVariable("pgautofailover.primary_demote_timeout",
 							"Give the primary this long to drain before promoting the secondary",
 							NULL, &DrainTimeoutMs, 30 * 1000, 1, INT_MAX,
 							PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
 
+	DefineCustomIntVariable("pgautofailover.primary_lease_duration",
+							"Grant the primary a lease of this long with each "
+							"node_active call.",
+							"The primary stops accepting writes when its lease "
+							"expires, and a demote_timeout then ends when the "
+							"lease and the clock skew bound have elapsed. "
+							"Zero disables leases.",
+							&PrimaryLeaseDurationMs, 0, 0, INT_MAX / 2,
+							PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgautofailover.lease_clock_skew",
+							"Bound on the clock drift between the monitor and "
+							"the primary during a lease.",
+							NULL, &LeaseClockSkewMs, 1000, 0, INT_MAX / 2,
+							PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
+
 	DefineCustomIntVariable("pgautofailover.node_considered_unhealthy_timeout",
 							"Mark node unhealthy if last ping was over this long ago",
 							NULL, &UnhealthyTimeoutMs, 20 * 1000, 1, INT_MAX,
@@ -179,10 +537,32 @@ StartMonitorNode(void)
 							NULL, &StartupGracePeriodMs, 10 * 1000, 1, INT_MAX,
 							PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
 
+	DefineCustomIntVariable("pgautofailover.metrics_port",
+							"Serve the monitor metrics over HTTP on this port.",
+							"Zero disables the metrics worker.",
+							&MetricsPort, 0, 0, 65535,
+							PGC_POSTMASTER, 0, NULL, NULL, NULL);
+
+	DefineCustomStringVariable("pgautofailover.metrics_listen_address",
+							   "Address on which the metrics worker listens.",
+							   NULL, &MetricsListenAddress, "127.0.0.1",
+							   PGC_POSTMASTER, 0, NULL, NULL, NULL);
+
+	DefineCustomStringVariable("pgautofailover.metrics_database",
+							   "Database where the metrics worker reads the "
+							   "monitor metadata.",
+							   NULL, &MetricsDatabase, "pg_auto_failover",
+							   PGC_POSTMASTER, 0, NULL, NULL, NULL);
+
 	PreviousProcessUtility_hook = ProcessUtility_hook;
 	ProcessUtility_hook = pgautofailover_ProcessUtility;
 
 	InitializeHealthCheckWorker();
+	InitializeNodeCache();
+	InitializeWalRate();
+	InitializeEventQueue();
+	InitializeStatFunctions();
+	InitializeGoalStateWait();
 
 	worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
 	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
@@ -195,6 +575,8 @@ StartMonitorNode(void)
 			sizeof(worker.bgw_function_name));
 
 	RegisterBackgroundWorker(&worker);
+
+	RegisterMetricsWorker();
 }
 
 
@@ -240,8 +622,23 @@ pgautofailover_ProcessUtility(PlannedStmt * pstmt,
 		if (databaseOid != InvalidOid)
 		{
 			StopHealthCheckWorker(databaseOid);
+			RemoveWalRates(databaseOid, 0);
+			DiscardQueuedEvents(databaseOid);
 		}
 	}
+	else if (IsA(parsetree, DropStmt) &&
+			 ((DropStmt *) parsetree)->removeType == OBJECT_EXTENSION)
+	{
+		/* the nodes of a dropped extension must not be served anymore */
+		InvalidateNodeCache();
+		RemoveWalRates(MyDatabaseId, 0);
+		InvalidateVersionCheckCache();
+	}
+	else if (IsA(parsetree, AlterExtensionStmt) ||
+			 IsA(parsetree, CreateExtensionStmt))
+	{
+		InvalidateVersionCheckCache();
+	}
 
 	if (PreviousProcessUtility_hook)
 	{
@@ -4,6 +4,20 @@
 -- complain if script is sourced in psql, rather than via CREATE EXTENSION
 \echo Use "CREATE EXTENSION pgautofailover" to load this file. \quit
 
+--
+-- The partitioned pgautofailover.event table and the node_active_wait
+-- procedure need Postgres 11, see also version_compat.h.
+--
+DO
+$body$
+BEGIN
+   if current_setting('server_version_num')::int < 110000
+   then
+      raise exception 'pgautofailover requires Postgres 11 or newer';
+   end if;
+END
+$body$;
+
 DO
 $body$
 BEGIN
@@ -51,9 +65,26 @@ CREATE TABLE pgautofailover.formation
     dbname               name NOT NULL DEFAULT 'postgres',
     opt_secondary        bool NOT NULL DEFAULT true,
     number_sync_standbys int  NOT NULL DEFAULT 0,
+    target_recovery_seconds int NOT NULL DEFAULT 0,
+    health_check_tcp_user_timeout int NOT NULL DEFAULT 0,
+    health_check_period int NOT NULL DEFAULT 0,
+    health_check_timeout int NOT NULL DEFAULT 0,
+    node_considered_unhealthy_timeout int NOT NULL DEFAULT 0,
+    primary_demote_timeout int NOT NULL DEFAULT 0,
+    prefer_least_loaded  bool NOT NULL DEFAULT false,
+    slot_retention_budget_mb int NOT NULL DEFAULT 0,
+    remote_wal_compression text NOT NULL DEFAULT 'off',
 
     PRIMARY KEY   (formationid),
-    CHECK (kind IN ('pgsql', 'citus'))
+    CHECK (kind IN ('pgsql', 'citus')),
+    CHECK (target_recovery_seconds >= 0),
+    CHECK (health_check_tcp_user_timeout >= 0),
+    CHECK (health_check_period >= 0),
+    CHECK (health_check_timeout >= 0),
+    CHECK (node_considered_unhealthy_timeout >= 0),
+    CHECK (primary_demote_timeout >= 0),
+    CHECK (slot_retention_budget_mb >= 0),
+    CHECK (remote_wal_compression IN ('off', 'pglz', 'lz4', 'zstd'))
  );
 insert into pgautofailover.formation (formationid) values ('default');
 
@@ -98,6 +129,60 @@ grant execute on function
       pgautofailover.set_formation_number_sync_standbys(text, int)
    to autoctl_node;
 
+CREATE FUNCTION pgautofailover.set_formation_target_recovery_seconds
+ (
+    IN formation_id            text,
+    IN target_recovery_seconds int
+ )
+RETURNS bool LANGUAGE SQL STRICT SECURITY DEFINER
+AS $$
+    update pgautofailover.formation
+       set target_recovery_seconds = $2
+     where formationid = $1
+ returning true;
+$$;
+
+comment on function
+        pgautofailover.set_formation_target_recovery_seconds(text, int)
+        is 'set the worst-case crash recovery time the keepers tune checkpoints for, 0 to disable';
+
+grant execute on function
+      pgautofailover.set_formation_target_recovery_seconds(text, int)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.set_formation_health_check_tcp_user_timeout
+ (
+    IN formation_id     text,
+    IN tcp_user_timeout int
+ )
+RETURNS bool LANGUAGE C STRICT SECURITY DEFINER
+AS 'MODULE_PATHNAME', $$set_formation_health_check_tcp_user_timeout$$;
+
+comment on function
+        pgautofailover.set_formation_health_check_tcp_user_timeout(text, int)
+        is 'set the TCP user timeout of the health checks of a formation, in milliseconds, 0 to use the default';
+
+grant execute on function
+      pgautofailover.set_formation_health_check_tcp_user_timeout(text, int)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.set_formation_health_policy
+ (
+    IN formation_id text,
+    IN setting      text,
+    IN value        int
+ )
+RETURNS bool LANGUAGE C STRICT SECURITY DEFINER
+AS 'MODULE_PATHNAME', $$set_formation_health_policy$$;
+
+comment on function
+        pgautofailover.set_formation_health_policy(text, text, int)
+        is 'set a health check or failover timeout of a formation, in milliseconds, 0 to use the GUC';
+
+grant execute on function
+      pgautofailover.set_formation_health_policy(text, text, int)
+   to autoctl_node;
+
 CREATE TABLE pgautofailover.node
  (
     formationid          text not null default 'default',
@@ -111,16 +196,13 @@ CREATE TABLE pgautofailover.node
     reportedstate        pgautofailover.replication_state not null,
     reportedpgisrunning  bool default true,
     reportedrepstate     text default 'async',
-    reporttime           timestamptz not null default now(),
     reportedtli          int not null default 1 check (reportedtli > 0),
-    reportedlsn          pg_lsn not null default '0/0',
-    walreporttime        timestamptz not null default now(),
     health               integer not null default -1,
-    healthchecktime      timestamptz not null default now(),
     statechangetime      timestamptz not null default now(),
     candidatepriority	 int not null default 100,
     replicationquorum	 bool not null default true,
     nodecluster          text not null default 'default',
+    goaltraceid          bigint,
 
     -- node names must be unique in a given formation
     UNIQUE (formationid, nodename),
@@ -163,9 +245,61 @@ CREATE TABLE pgautofailover.node
  -- we expect few rows and lots of UPDATE, let's benefit from HOT
  WITH (fillfactor = 25);
 
+-- serves current_state(formation_id, group_id), groupid is never updated
+CREATE INDEX node_formationid_groupid_idx
+    ON pgautofailover.node (formationid, groupid);
+
+--
+-- Keepers report to the monitor every second or so, and the health checks
+-- run at about the same pace. Only keep the columns those updates need to
+-- change in this narrow table so that we don't rewrite the whole node row
+-- each time. Every node gets its row here when it registers.
+--
+CREATE TABLE pgautofailover.node_report
+ (
+    nodeid               bigint not null,
+    reporttime           timestamptz not null default now(),
+    reportedlsn          pg_lsn not null default '0/0',
+    reportedreplaylsn    pg_lsn not null default '0/0',
+    walreporttime        timestamptz not null default now(),
+    healthchecktime      timestamptz not null default now(),
+
+    PRIMARY KEY (nodeid),
+    FOREIGN KEY (nodeid) REFERENCES pgautofailover.node(nodeid) ON DELETE CASCADE
+ )
+ WITH (fillfactor = 25);
+
+--
+-- Events carry a compact code that classifies them, so that tools can
+-- filter the event history by type without parsing the descriptions. The
+-- codes must match the EventCode enum in src/monitor/notifications.h.
+--
+CREATE TABLE pgautofailover.event_code
+ (
+    code         smallint not null,
+    name         text not null,
+    description  text not null,
+
+    PRIMARY KEY (code),
+    UNIQUE (name)
+ );
+
+INSERT INTO pgautofailover.event_code (code, name, description)
+     VALUES (0, 'unknown', 'event that is not classified'),
+            (1, 'goal_state', 'the monitor assigned a new goal state to a node'),
+            (2, 'failover', 'a goal state assigned as part of a failover'),
+            (3, 'maintenance', 'a goal state that puts a node in maintenance'),
+            (4, 'reported_state', 'a node reported a new state'),
+            (5, 'health', 'the monitor health check changed the node health'),
+            (6, 'settings', 'the candidate priority or replication quorum of a node changed');
+
+grant select on pgautofailover.event_code to autoctl_node;
+
+CREATE SEQUENCE pgautofailover.event_eventid_seq;
+
 CREATE TABLE pgautofailover.event
  (
-    eventid           bigserial not null,
+    eventid           bigint not null DEFAULT nextval('pgautofailover.event_eventid_seq'::regclass),
     eventtime         timestamptz not null default now(),
     formationid       text not null,
     nodeid            bigint not null,
@@ -181,10 +315,407 @@ CREATE TABLE pgautofailover.event
     candidatepriority int,
     replicationquorum bool,
     description       text,
+    eventcode         smallint not null default 0,
+
+    PRIMARY KEY (eventid, eventtime)
+ )
+ -- daily partitions are managed by pgautofailover.maintain_event_partitions
+ PARTITION BY RANGE (eventtime);
+
+ALTER SEQUENCE pgautofailover.event_eventid_seq
+      OWNED BY pgautofailover.event.eventid;
+
+-- serves last_events(formation_id, group_id, count) and events_since()
+CREATE INDEX event_formationid_groupid_eventid_idx
+    ON pgautofailover.event (formationid, groupid, eventid);
+
+-- serves last_events(formation_id, count) with a backward index scan
+CREATE INDEX event_formationid_eventid_idx
+    ON pgautofailover.event (formationid, eventid);
+
+-- serves last_events_of_type(formation_id, event_type, group_id, count)
+CREATE INDEX event_formationid_eventcode_eventid_idx
+    ON pgautofailover.event (formationid, eventcode, eventid);
+
+-- events land here until the partition for their day exists
+CREATE TABLE pgautofailover.event_default
+     PARTITION OF pgautofailover.event DEFAULT;
+
+--
+-- Old events can be archived in a compact form: all the events of a
+-- formation for a given day are stored in a single row, one array per
+-- column, which Postgres compresses when TOASTing it. The archive is read
+-- with pgautofailover.archived_events().
+--
+CREATE TABLE pgautofailover.event_archive
+ (
+    formationid        text not null,
+    eventday           date not null,
+    eventcount         int not null,
+    firsteventid       bigint not null,
+    lasteventid        bigint not null,
+    eventid            bigint[] not null,
+    eventtime          timestamptz[] not null,
+    nodeid             bigint[] not null,
+    groupid            int[] not null,
+    nodename           text[] not null,
+    nodehost           text[] not null,
+    nodeport           integer[] not null,
+    reportedstate      pgautofailover.replication_state[] not null,
+    goalstate          pgautofailover.replication_state[] not null,
+    reportedrepstate   text[] not null,
+    reportedtli        int[] not null,
+    reportedlsn        pg_lsn[] not null,
+    candidatepriority  int[] not null,
+    replicationquorum  bool[] not null,
+    description        text[] not null,
+    eventcode          smallint[] not null,
+
+    PRIMARY KEY (formationid, eventday)
+ );
+
+CREATE FUNCTION pgautofailover.maintain_event_partitions
+ (
+    IN retention_minutes  int default 0,
+    IN days_ahead         int default 2,
+    IN archive_minutes    int default 0
+ )
+RETURNS void LANGUAGE plpgsql
+AS $$
+declare
+  retention_limit timestamptz;
+  archive_limit   timestamptz;
+  partition_day   timestamptz;
+  partition_name  text;
+  partition_rec   record;
+begin
+  if retention_minutes > 0
+  then
+    retention_limit := now() - retention_minutes * interval '1 minute';
+  end if;
+
+  if archive_minutes > 0
+  then
+    archive_limit := now() - archive_minutes * interval '1 minute';
+  end if;
+
+  --
+  -- Create the daily partitions of the next days, and of the days that have
+  -- events in the default partition, moving them into their partition.
+  --
+  for partition_day in
+      select distinct date_trunc('day', eventtime)
+        from pgautofailover.event_default
+       union
+      select date_trunc('day', now()) + i * interval '1 day'
+        from generate_series(0, days_ahead) as i
+    order by 1
+  loop
+    partition_name := 'event_' || to_char(partition_day, 'YYYYMMDD');
+
+    if to_regclass(format('pgautofailover.%I', partition_name)) is not null
+    then
+      continue;
+    end if;
+
+    -- events from before the retention period are not kept at all
+    if retention_limit is not null
+       and partition_day + interval '1 day' <= retention_limit
+    then
+      delete from pgautofailover.event_default
+            where eventtime < partition_day + interval '1 day';
+
+      continue;
+    end if;
+
+    execute format('create table pgautofailover.%I '
+                   '(like pgautofailover.event '
+                   ' including defaults including constraints)',
+                   partition_name);
+
+    execute format('with moved as '
+                   '(delete from pgautofailover.event_default '
+                   '  where eventtime >= $1 and eventtime < $2 '
+                   ' returning *) '
+                   'insert into pgautofailover.%I select * from moved',
+                   partition_name)
+      using partition_day, partition_day + interval '1 day';
+
+    execute format('alter table pgautofailover.event '
+                   'attach partition pgautofailover.%I '
+                   'for values from (%L) to (%L)',
+                   partition_name,
+                   partition_day,
+                   partition_day + interval '1 day');
+  end loop;
+
+  if retention_limit is null and archive_limit is null
+  then
+    return;
+  end if;
+
+  --
+  -- Drop the partitions that only contain events from before the retention
+  -- period, there's no need to DELETE anything. The partitions from before
+  -- the archive period are compacted into the archive first.
+  --
+  for partition_rec in
+      select c.oid::regclass as partition,
+             to_timestamp(substring(c.relname from 7), 'YYYYMMDD')
+               + interval '1 day' as upper_bound
+        from pg_catalog.pg_inherits i
+        join pg_catalog.pg_class c on c.oid = i.inhrelid
+       where i.inhparent = 'pgautofailover.event'::regclass
+         and c.relname ~ '^event_[0-9]{8}$'
+  loop
+    if partition_rec.upper_bound <= retention_limit
+    then
+      execute format('drop table %s', partition_rec.partition);
+    elsif partition_rec.upper_bound <= archive_limit
+    then
+      execute format('insert into pgautofailover.event_archive '
+                     'select formationid, $1, count(*), '
+                     '       min(eventid), max(eventid), '
+                     '       array_agg(eventid order by eventid), '
+                     '       array_agg(eventtime order by eventid), '
+                     '       array_agg(nodeid order by eventid), '
+                     '       array_agg(groupid order by eventid), '
+                     '       array_agg(nodename order by eventid), '
+                     '       array_agg(nodehost order by eventid), '
+                     '       array_agg(nodeport order by eventid), '
+                     '       array_agg(reportedstate order by eventid), '
+                     '       array_agg(goalstate order by eventid), '
+                     '       array_agg(reportedrepstate order by eventid), '
+                     '       array_agg(reportedtli order by eventid), '
+                     '       array_agg(reportedlsn order by eventid), '
+                     '       array_agg(candidatepriority order by eventid), '
+                     '       array_agg(replicationquorum order by eventid), '
+                     '       array_agg(description order by eventid), '
+                     '       array_agg(eventcode order by eventid) '
+                     '  from %s '
+                     'group by formationid '
+                     'on conflict (formationid, eventday) do nothing',
+                     partition_rec.partition)
+        using (partition_rec.upper_bound - interval '1 day')::date;
+
+      execute format('drop table %s', partition_rec.partition);
+    end if;
+  end loop;
+
+  if retention_limit is not null
+  then
+    delete from pgautofailover.event_archive
+          where eventday + 1 <= retention_limit::date;
+  end if;
+end;
+$$;
+
+comment on function pgautofailover.maintain_event_partitions(int,int,int)
+        is 'create the daily partitions of the event table, archive the partitions that are older than the archive period, and drop the events that are older than the retention period';
+
+CREATE FUNCTION pgautofailover.migrate_upgrade_events
+ (
+    IN batch_size int default 10000
+ )
+RETURNS bigint LANGUAGE plpgsql
+AS $$
+declare
+  moved_count bigint;
+begin
+  if to_regclass('pgautofailover.event_upgrade_old') is null
+  then
+    return 0;
+  end if;
+
+  -- the most recent events are moved first, they are the ones users look at
+  with moved as
+  (
+     delete from pgautofailover.event_upgrade_old
+      where eventid in (select eventid
+                          from pgautofailover.event_upgrade_old
+                      order by eventid desc
+                         limit batch_size)
+  returning *
+  )
+  insert into pgautofailover.event
+   (
+    eventid, eventtime, formationid, nodeid, groupid,
+    nodename, nodehost, nodeport,
+    reportedstate, goalstate, reportedrepstate,
+    reportedtli, reportedlsn, candidatepriority, replicationquorum,
+    description
+   )
+   select eventid, eventtime, formationid, nodeid, groupid,
+          nodename, nodehost, nodeport,
+          reportedstate, goalstate, reportedrepstate,
+          reportedtli, reportedlsn, candidatepriority, replicationquorum,
+          description
+     from moved;
+
+  get diagnostics moved_count = row_count;
+
+  if moved_count = 0
+  then
+    drop table pgautofailover.event_upgrade_old;
+  end if;
+
+  return moved_count;
+end;
+$$;
+
+comment on function pgautofailover.migrate_upgrade_events(int)
+        is 'move a batch of the events kept aside by the extension upgrade to the event table, and drop the old table once it is empty';
+
+CREATE FUNCTION pgautofailover.archived_events
+ (
+  formation_id text,
+  since        timestamptz default '-infinity',
+  until        timestamptz default 'infinity'
+ )
+RETURNS SETOF pgautofailover.event LANGUAGE SQL STRICT
+AS $$
+  select e.eventid, e.eventtime, a.formationid,
+         e.nodeid, e.groupid, e.nodename, e.nodehost, e.nodeport,
+         e.reportedstate, e.goalstate,
+         e.reportedrepstate, e.reportedtli, e.reportedlsn,
+         e.candidatepriority, e.replicationquorum, e.description,
+         e.eventcode
+    from pgautofailover.event_archive a,
+         unnest(a.eventid, a.eventtime,
+                a.nodeid, a.groupid, a.nodename, a.nodehost, a.nodeport,
+                a.reportedstate, a.goalstate,
+                a.reportedrepstate, a.reportedtli, a.reportedlsn,
+                a.candidatepriority, a.replicationquorum, a.description,
+                a.eventcode)
+         as e(eventid, eventtime,
+              nodeid, groupid, nodename, nodehost, nodeport,
+              reportedstate, goalstate,
+              reportedrepstate, reportedtli, reportedlsn,
+              candidatepriority, replicationquorum, description,
+              eventcode)
+   where a.formationid = formation_id
+     and a.eventday >= since::date
+     and a.eventday <= until::date
+     and e.eventtime >= since
+     and e.eventtime < until
+
+   union all
+
+  select *
+    from pgautofailover.event
+   where formationid = formation_id
+     and eventtime >= since
+     and eventtime < until
+
+order by eventid;
+$$;
+
+comment on function pgautofailover.archived_events(text,timestamptz,timestamptz)
+        is 'retrieve the events of a formation, from the archive and the event table';
+
+grant execute on function
+      pgautofailover.archived_events(text,timestamptz,timestamptz)
+   to autoctl_node;
+
+CREATE TABLE pgautofailover.failover
+ (
+    failoverid    bigserial,
+    formationid   text not null,
+    groupid       int not null,
+    starttime     timestamptz not null default now(),
+    endtime       timestamptz,
+    traceid       bigint,
+
+    PRIMARY KEY (failoverid),
+    FOREIGN KEY (formationid)
+     REFERENCES pgautofailover.formation(formationid) ON DELETE CASCADE
+ );
+
+-- there is at most one failover in progress per group
+CREATE UNIQUE INDEX failover_formationid_groupid_idx
+    ON pgautofailover.failover(formationid, groupid)
+ WHERE endtime IS NULL;
+
+CREATE TABLE pgautofailover.failover_phase
+ (
+    failoverid    bigint not null,
+    phase         text not null,
+    phaseorder    int not null,
+    nodeid        bigint not null,
+    starttime     timestamptz not null,
+
+    PRIMARY KEY (failoverid, phase),
+    FOREIGN KEY (failoverid)
+     REFERENCES pgautofailover.failover(failoverid) ON DELETE CASCADE
+ );
+
+CREATE TABLE pgautofailover.node_latency
+ (
+    nodeid        bigint not null,
+    peernodeid    bigint not null,
+    rtt           double precision not null,
+    reporttime    timestamptz not null default now(),
+
+    PRIMARY KEY (nodeid, peernodeid),
+    FOREIGN KEY (nodeid)
+     REFERENCES pgautofailover.node(nodeid) ON DELETE CASCADE,
+    FOREIGN KEY (peernodeid)
+     REFERENCES pgautofailover.node(nodeid) ON DELETE CASCADE
+ );
+
+comment on column pgautofailover.node_latency.rtt
+        is 'round-trip time from nodeid to peernodeid, in milliseconds';
+
+CREATE TABLE pgautofailover.lagging_standby
+ (
+    nodeid        bigint not null,
+    laggingsince  timestamptz not null default now(),
+
+    PRIMARY KEY (nodeid),
+    FOREIGN KEY (nodeid)
+     REFERENCES pgautofailover.node(nodeid) ON DELETE CASCADE
+ );
+
+CREATE TABLE pgautofailover.standby_lsn
+ (
+    nodeid          bigint not null,
+    primarynodeid   bigint not null,
+    reporttime      timestamptz not null default now(),
+    writelsn        pg_lsn not null,
+    flushlsn        pg_lsn not null,
+    replaylsn       pg_lsn not null,
+
+    PRIMARY KEY (nodeid),
+    FOREIGN KEY (nodeid)
+     REFERENCES pgautofailover.node(nodeid) ON DELETE CASCADE,
+    FOREIGN KEY (primarynodeid)
+     REFERENCES pgautofailover.node(nodeid) ON DELETE CASCADE
+ );
 
-    PRIMARY KEY (eventid)
+-- serves the lookups of the standby nodes of a given primary
+CREATE INDEX standby_lsn_primarynodeid_idx
+    ON pgautofailover.standby_lsn (primarynodeid);
+
+comment on table pgautofailover.standby_lsn
+        is 'LSN positions of the standby nodes as seen from pg_stat_replication on their primary';
+
+CREATE TABLE pgautofailover.node_health_signal
+ (
+    nodeid              bigint not null,
+    reporttime          timestamptz not null default now(),
+    canary_ms           double precision not null,
+    wal_flush_ms        double precision not null,
+    checkpoint_sync_ms  double precision not null,
+    degraded_samples    int not null default 0,
+
+    PRIMARY KEY (nodeid),
+    FOREIGN KEY (nodeid)
+     REFERENCES pgautofailover.node(nodeid) ON DELETE CASCADE
  );
 
+comment on column pgautofailover.node_health_signal.degraded_samples
+        is 'number of reports in a row over pgautofailover.degraded_primary_threshold';
+
 GRANT SELECT ON ALL TABLES IN SCHEMA pgautofailover TO autoctl_node;
 
 CREATE FUNCTION pgautofailover.set_node_system_identifier
@@ -272,6 +803,81 @@ grant execute on function
                                    int,bool,text)
    to autoctl_node;
 
+CREATE FUNCTION pgautofailover.register_nodes
+ (
+    IN formation_id         text,
+    IN dbname               name,
+    IN nodes                jsonb,
+   OUT node_host            text,
+   OUT node_port            int,
+   OUT assigned_node_id     bigint,
+   OUT assigned_group_id    int,
+   OUT assigned_group_state pgautofailover.replication_state,
+   OUT assigned_candidate_priority 	int,
+   OUT assigned_replication_quorum  bool,
+   OUT assigned_node_name   text
+ )
+RETURNS SETOF record LANGUAGE plpgsql STRICT SECURITY DEFINER
+AS $$
+declare
+  node       jsonb;
+  registered record;
+begin
+  if jsonb_typeof(nodes) <> 'array'
+  then
+    raise exception 'register_nodes expects a JSON array of nodes';
+  end if;
+
+  --
+  -- Register the nodes in the array order, all in the same transaction, so
+  -- that the state change notifications are sent together at commit time.
+  -- The first node of a group is its primary.
+  --
+  for node in select value from jsonb_array_elements(nodes)
+  loop
+    if node->>'host' is null or node->>'port' is null
+    then
+      raise exception 'register_nodes expects a host and a port for each node'
+            using detail = format('node %s', node);
+    end if;
+
+      select *
+        into registered
+        from pgautofailover.register_node(
+               formation_id,
+               node->>'host',
+               (node->>'port')::int,
+               dbname,
+               coalesce(node->>'name', ''),
+               0,
+               -1,
+               coalesce((node->>'group')::int, -1),
+               'init',
+               coalesce(node->>'kind', 'standalone'),
+               coalesce((node->>'candidate_priority')::int, 100),
+               coalesce((node->>'replication_quorum')::bool, true),
+               coalesce(node->>'cluster', 'default'));
+
+    node_host := node->>'host';
+    node_port := (node->>'port')::int;
+    assigned_node_id := registered.assigned_node_id;
+    assigned_group_id := registered.assigned_group_id;
+    assigned_group_state := registered.assigned_group_state;
+    assigned_candidate_priority := registered.assigned_candidate_priority;
+    assigned_replication_quorum := registered.assigned_replication_quorum;
+    assigned_node_name := registered.assigned_node_name;
+
+    return next;
+  end loop;
+end;
+$$;
+
+comment on function pgautofailover.register_nodes(text,name,jsonb)
+        is 'register many nodes in a single transaction';
+
+grant execute on function pgautofailover.register_nodes(text,name,jsonb)
+   to autoctl_node;
+
 
 CREATE FUNCTION pgautofailover.node_active
  (
@@ -283,18 +889,141 @@ CREATE FUNCTION pgautofailover.node_active
     IN current_tli			  		integer default 1,
     IN current_lsn			  		pg_lsn default '0/0',
     IN current_rep_state      		text default '',
+    IN current_replay_lsn     		pg_lsn default '0/0',
+    IN standby_node_ids             bigint[] default '{}',
+    IN standby_write_lsns           pg_lsn[] default '{}',
+    IN standby_flush_lsns           pg_lsn[] default '{}',
+    IN standby_replay_lsns          pg_lsn[] default '{}',
    OUT assigned_node_id       		bigint,
    OUT assigned_group_id      		int,
    OUT assigned_group_state   		pgautofailover.replication_state,
    OUT assigned_candidate_priority 	int,
-   OUT assigned_replication_quorum  bool
+   OUT assigned_replication_quorum  bool,
+   OUT group_topology_version       bigint
  )
 RETURNS record LANGUAGE C STRICT SECURITY DEFINER
 AS 'MODULE_PATHNAME', $$node_active$$;
 
 grant execute on function
       pgautofailover.node_active(text,bigint,int,
-                          pgautofailover.replication_state,bool,int,pg_lsn,text)
+                          pgautofailover.replication_state,bool,int,pg_lsn,text,
+                          pg_lsn,bigint[],pg_lsn[],pg_lsn[],pg_lsn[])
+   to autoctl_node;
+
+comment on function
+        pgautofailover.node_active(text,bigint,int,
+                          pgautofailover.replication_state,bool,int,pg_lsn,text,
+                          pg_lsn,bigint[],pg_lsn[],pg_lsn[],pg_lsn[])
+        is 'report the node state and get its goal state, a primary also reports the LSN positions of its standby nodes';
+
+CREATE FUNCTION pgautofailover.wait_for_goal_state_change
+ (
+    IN node_id        bigint,
+    IN goal_state     pgautofailover.replication_state,
+    IN timeout_ms     int
+ )
+RETURNS pgautofailover.replication_state LANGUAGE C STRICT SECURITY DEFINER
+AS 'MODULE_PATHNAME', $$wait_for_goal_state_change$$;
+
+comment on function
+        pgautofailover.wait_for_goal_state_change(bigint,
+                                                  pgautofailover.replication_state,
+                                                  int)
+        is 'wait until the goal state of a node changes, returns NULL on timeout';
+
+grant execute on function
+      pgautofailover.wait_for_goal_state_change(bigint,
+                                                pgautofailover.replication_state,
+                                                int)
+   to autoctl_node;
+
+--
+-- node_active_wait is a procedure rather than a function so that it can
+-- commit the node_active() transaction before waiting: waiting while holding
+-- the locks that node_active() takes would block the very transactions that
+-- assign a new goal state to the node. Transaction control is not allowed in
+-- SECURITY DEFINER procedures, the functions it calls are. Procedures are
+-- only available in Postgres 11 and newer.
+--
+CREATE PROCEDURE pgautofailover.node_active_wait
+ (
+    IN formation_id           		text,
+    IN node_id        		        bigint,
+    IN group_id       		        int,
+    IN current_group_role     		pgautofailover.replication_state,
+    IN current_pg_is_running  		bool,
+    IN current_tli			  		integer,
+    IN current_lsn			  		pg_lsn,
+    IN current_rep_state      		text,
+    IN current_replay_lsn     		pg_lsn,
+    IN timeout_ms                   int,
+ INOUT assigned_node_id       		bigint default null,
+ INOUT assigned_group_id      		int default null,
+ INOUT assigned_group_state   		pgautofailover.replication_state default null,
+ INOUT assigned_candidate_priority 	int default null,
+ INOUT assigned_replication_quorum  bool default null,
+ INOUT group_topology_version       bigint default null
+ )
+LANGUAGE plpgsql
+AS $$
+declare
+  new_goal_state pgautofailover.replication_state;
+begin
+    select *
+      into assigned_node_id,
+           assigned_group_id,
+           assigned_group_state,
+           assigned_candidate_priority,
+           assigned_replication_quorum,
+           group_topology_version
+      from pgautofailover.node_active(formation_id, node_id, group_id,
+                                      current_group_role,
+                                      current_pg_is_running,
+                                      current_tli, current_lsn,
+                                      current_rep_state,
+                                      current_replay_lsn);
+
+    -- the node has something to do already, don't make it wait
+    if assigned_group_state <> current_group_role
+    then
+        return;
+    end if;
+
+    commit;
+
+    new_goal_state :=
+      pgautofailover.wait_for_goal_state_change(assigned_node_id,
+                                                assigned_group_state,
+                                                timeout_ms);
+
+    if new_goal_state is not null
+    then
+        assigned_group_state := new_goal_state;
+
+        select candidatepriority, replicationquorum
+          into assigned_candidate_priority, assigned_replication_quorum
+          from pgautofailover.node
+         where nodeid = assigned_node_id;
+    end if;
+end;
+$$;
+
+comment on procedure
+        pgautofailover.node_active_wait(text,bigint,int,
+                                        pgautofailover.replication_state,
+                                        bool,int,pg_lsn,text,pg_lsn,int,
+                                        bigint,int,
+                                        pgautofailover.replication_state,
+                                        int,bool,bigint)
+        is 'report the node state, then wait for its goal state to change';
+
+grant execute on procedure
+      pgautofailover.node_active_wait(text,bigint,int,
+                                      pgautofailover.replication_state,
+                                      bool,int,pg_lsn,text,pg_lsn,int,
+                                      bigint,int,
+                                      pgautofailover.replication_state,
+                                      int,bool,bigint)
    to autoctl_node;
 
 CREATE FUNCTION pgautofailover.get_nodes
@@ -335,6 +1064,23 @@ comment on function pgautofailover.get_primary(text,int)
 grant execute on function pgautofailover.get_primary(text,int)
    to autoctl_node;
 
+CREATE FUNCTION pgautofailover.get_upstream
+ (
+    IN nodeid            bigint,
+   OUT node_id           bigint,
+   OUT node_name         text,
+   OUT node_host         text,
+   OUT node_port         int
+ )
+RETURNS record LANGUAGE C STRICT SECURITY DEFINER
+AS 'MODULE_PATHNAME', $$get_upstream$$;
+
+comment on function pgautofailover.get_upstream(bigint)
+        is 'get the node that a standby node streams from';
+
+grant execute on function pgautofailover.get_upstream(bigint)
+   to autoctl_node;
+
 CREATE FUNCTION pgautofailover.get_other_nodes
  (
     IN nodeid           bigint,
@@ -410,12 +1156,14 @@ CREATE FUNCTION pgautofailover.get_most_advanced_standby
  )
 RETURNS SETOF record LANGUAGE SQL STRICT
 AS $$
-   select nodeid, nodename, nodehost, nodeport, reportedlsn, false
+   select nodeid, nodename, nodehost, nodeport,
+          report.reportedlsn, false
      from pgautofailover.node
+left join pgautofailover.node_report as report using(nodeid)
     where formationid = $1
       and groupid = $2
       and reportedstate = 'report_lsn'
- order by reportedlsn desc, health desc
+ order by 5 desc, health desc
     limit 1;
 $$;
 
@@ -480,6 +1228,20 @@ comment on function pgautofailover.perform_promotion(text,text)
 grant execute on function pgautofailover.perform_promotion(text,text)
    to autoctl_node;
 
+CREATE FUNCTION pgautofailover.proceed_pending_group
+ (
+    IN formation_id text,
+    IN group_id     int
+ )
+RETURNS bool LANGUAGE C STRICT SECURITY DEFINER
+AS 'MODULE_PATHNAME', $$proceed_pending_group$$;
+
+comment on function pgautofailover.proceed_pending_group(text,int)
+        is 'run the state machine of a group that is not settled, for its nodes that are still reporting';
+
+grant execute on function pgautofailover.proceed_pending_group(text,int)
+   to autoctl_node;
+
 CREATE FUNCTION pgautofailover.start_maintenance(node_id bigint)
 RETURNS bool LANGUAGE C STRICT SECURITY DEFINER
 AS 'MODULE_PATHNAME', $$start_maintenance$$;
@@ -512,7 +1274,8 @@ with last_events as
          nodeid, groupid, nodename, nodehost, nodeport,
          reportedstate, goalstate,
          reportedrepstate, reportedtli, reportedlsn,
-         candidatepriority, replicationquorum, description
+         candidatepriority, replicationquorum, description,
+         eventcode
     from pgautofailover.event
 order by eventid desc
    limit count
@@ -533,19 +1296,20 @@ CREATE FUNCTION pgautofailover.last_events
  )
 RETURNS SETOF pgautofailover.event LANGUAGE SQL STRICT
 AS $$
-with last_events as
-(
-    select eventid, eventtime, formationid,
-           nodeid, groupid, nodename, nodehost, nodeport,
-           reportedstate, goalstate,
-           reportedrepstate, reportedtli, reportedlsn,
-           candidatepriority, replicationquorum, description
-      from pgautofailover.event
-     where formationid = formation_id
-  order by eventid desc
-     limit count
-)
-select * from last_events order by eventtime, eventid;
+  select *
+    from (
+            select eventid, eventtime, formationid,
+                   nodeid, groupid, nodename, nodehost, nodeport,
+                   reportedstate, goalstate,
+                   reportedrepstate, reportedtli, reportedlsn,
+                   candidatepriority, replicationquorum, description,
+                   eventcode
+              from pgautofailover.event
+             where formationid = formation_id
+          order by eventid desc
+             limit count
+         ) as last_events
+order by eventtime, eventid;
 $$;
 
 comment on function pgautofailover.last_events(text,int)
@@ -562,71 +1326,494 @@ CREATE FUNCTION pgautofailover.last_events
  )
 RETURNS SETOF pgautofailover.event LANGUAGE SQL STRICT
 AS $$
-with last_events as
-(
+  select *
+    from (
+            select eventid, eventtime, formationid,
+                   nodeid, groupid, nodename, nodehost, nodeport,
+                   reportedstate, goalstate,
+                   reportedrepstate, reportedtli, reportedlsn,
+                   candidatepriority, replicationquorum, description,
+                   eventcode
+              from pgautofailover.event
+             where formationid = formation_id
+               and groupid = group_id
+          order by eventid desc
+             limit count
+         ) as last_events
+order by eventtime, eventid;
+$$;
+
+comment on function pgautofailover.last_events(text,int,int)
+        is 'retrieve last COUNT events for given formation and group';
+
+grant execute on function pgautofailover.last_events(text,int,int)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.last_events_of_type
+ (
+  formation_id text,
+  event_type   text,
+  group_id     int default null,
+  count        int default 10
+ )
+RETURNS SETOF pgautofailover.event LANGUAGE plpgsql
+AS $$
+declare
+  type_code smallint;
+begin
+  select code into type_code
+    from pgautofailover.event_code
+   where name = event_type;
+
+  if not found
+  then
+    raise exception 'unknown event type "%"', event_type
+          using hint = 'see the names in pgautofailover.event_code';
+  end if;
+
+  return query
+    select *
+      from (
+              select eventid, eventtime, formationid,
+                     nodeid, groupid, nodename, nodehost, nodeport,
+                     reportedstate, goalstate,
+                     reportedrepstate, reportedtli, reportedlsn,
+                     candidatepriority, replicationquorum, description,
+                     eventcode
+                from pgautofailover.event
+               where formationid = formation_id
+                 and eventcode = type_code
+                 and (group_id is null or groupid = group_id)
+            order by eventid desc
+               limit count
+           ) as last_events
+  order by eventtime, eventid;
+end;
+$$;
+
+comment on function pgautofailover.last_events_of_type(text,text,int,int)
+        is 'retrieve last COUNT events of the given type for given formation';
+
+grant execute on function pgautofailover.last_events_of_type(text,text,int,int)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.event_watermark()
+RETURNS bigint LANGUAGE C STRICT SECURITY DEFINER
+AS 'MODULE_PATHNAME', $$event_watermark$$;
+
+comment on function pgautofailover.event_watermark()
+        is 'greatest eventid up to which every event is visible';
+
+grant execute on function pgautofailover.event_watermark()
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.events_since
+ (
+  formation_id  text,
+  group_id      int default null,
+  since_eventid bigint default 0,
+  since_time    timestamptz default null,
+  count         int default 1000
+ )
+RETURNS SETOF pgautofailover.event LANGUAGE plpgsql
+AS $$
+declare
+  watermark bigint;
+begin
+  -- events with a smaller id may still show up until the watermark, and the
+  -- query below takes its snapshot after we got it
+  watermark := pgautofailover.event_watermark();
+
+  return query
     select eventid, eventtime, formationid,
            nodeid, groupid, nodename, nodehost, nodeport,
            reportedstate, goalstate,
            reportedrepstate, reportedtli, reportedlsn,
-           candidatepriority, replicationquorum, description
+           candidatepriority, replicationquorum, description,
+           eventcode
       from pgautofailover.event
      where formationid = formation_id
-       and groupid = group_id
-  order by eventid desc
-     limit count
-)
-select * from last_events order by eventtime, eventid;
+       and (group_id is null or groupid = group_id)
+       and eventid > since_eventid
+       and eventid <= watermark
+       and (since_time is null or eventtime >= since_time)
+  order by eventid
+     limit count;
+end;
 $$;
 
-comment on function pgautofailover.last_events(text,int,int)
-        is 'retrieve last COUNT events for given formation and group';
+comment on function pgautofailover.events_since(text,int,bigint,timestamptz,int)
+        is 'retrieve up to COUNT visible events after the given event id and time';
 
-grant execute on function pgautofailover.last_events(text,int,int)
+grant execute on function pgautofailover.events_since(text,int,bigint,timestamptz,int)
    to autoctl_node;
 
-CREATE FUNCTION pgautofailover.current_state
+CREATE FUNCTION pgautofailover.last_failovers
  (
-    IN formation_id         text default 'default',
-   OUT formation_kind       text,
-   OUT nodename             text,
-   OUT nodehost             text,
-   OUT nodeport             int,
-   OUT group_id             int,
-   OUT node_id              bigint,
-   OUT current_group_state  pgautofailover.replication_state,
-   OUT assigned_group_state pgautofailover.replication_state,
-   OUT candidate_priority	int,
-   OUT replication_quorum	bool,
-   OUT reported_tli         int,
-   OUT reported_lsn         pg_lsn,
-   OUT health               integer,
-   OUT nodecluster          text
+    IN formation_id  text default 'default',
+    IN count         int default 10,
+   OUT failover_id   bigint,
+   OUT group_id      int,
+   OUT phase         text,
+   OUT node_id       bigint,
+   OUT start_time    timestamptz,
+   OUT end_time      timestamptz,
+   OUT duration      interval
  )
 RETURNS SETOF record LANGUAGE SQL STRICT
 AS $$
-   select kind, nodename, nodehost, nodeport, groupid, nodeid,
-          reportedstate, goalstate,
-   		  candidatepriority, replicationquorum,
-          reportedtli, reportedlsn, health, nodecluster
-     from pgautofailover.node
-     join pgautofailover.formation using(formationid)
-    where formationid = formation_id
- order by groupid, nodeid;
+with last_failovers as
+(
+    select failoverid, groupid, endtime
+      from pgautofailover.failover
+     where formationid = formation_id
+  order by failoverid desc
+     limit count
+),
+phases as
+(
+    select failoverid, groupid, phase, phaseorder, nodeid, starttime,
+           coalesce(lead(starttime) over w, endtime) as endtime
+      from last_failovers
+      join pgautofailover.failover_phase using(failoverid)
+    window w as (partition by failoverid order by starttime, phaseorder)
+)
+  select failoverid, groupid, phase, nodeid, starttime, endtime,
+         endtime - starttime
+    from phases
+order by failoverid, starttime, phaseorder;
 $$;
 
-comment on function pgautofailover.current_state(text)
-        is 'get the current state of both nodes of a formation';
+comment on function pgautofailover.last_failovers(text,int)
+        is 'retrieve the phases of the last COUNT failovers of a formation';
 
-grant execute on function pgautofailover.current_state(text)
+grant execute on function pgautofailover.last_failovers(text,int)
    to autoctl_node;
 
-CREATE FUNCTION pgautofailover.current_state
+CREATE FUNCTION pgautofailover.wal_rates
  (
     IN formation_id         text,
-    IN group_id             int,
-   OUT formation_kind       text,
-   OUT nodename             text,
-   OUT nodehost             text,
+   OUT node_id              bigint,
+   OUT wal_rate             double precision,
+   OUT catchup_time         double precision
+ )
+RETURNS SETOF record LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', $$wal_rates$$;
+
+comment on function pgautofailover.wal_rates(text)
+        is 'get the recent WAL rate of each node in bytes per second, and the predicted catch-up time of the standby nodes in seconds';
+
+grant execute on function pgautofailover.wal_rates(text)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.replay_failover_decisions
+ (
+    IN formation_id                      text,
+    IN group_id                          int,
+    IN since                             timestamptz default '-infinity',
+    IN node_considered_unhealthy_timeout int default -1,
+    IN promote_wal_log_threshold         int default -1,
+   OUT eventid                           bigint,
+   OUT eventtime                         timestamptz,
+   OUT primary_node_id                   bigint,
+   OUT actual_node_id                    bigint,
+   OUT simulated_node_id                 bigint,
+   OUT actual_elapsed_ms                 double precision,
+   OUT simulated_detection_ms            double precision,
+   OUT decision                          text
+ )
+RETURNS SETOF record LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', $$replay_failover_decisions$$;
+
+comment on function pgautofailover.replay_failover_decisions(text,int,timestamptz,int,int)
+        is 'replay the failover candidate selections found in the events of a group with other settings';
+
+grant execute on function pgautofailover.replay_failover_decisions(text,int,timestamptz,int,int)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.report_latency
+ (
+    IN node_id        bigint,
+    IN peer_node_ids  bigint[],
+    IN peer_rtts      double precision[]
+ )
+RETURNS void LANGUAGE SQL STRICT SECURITY DEFINER
+AS $$
+  insert into pgautofailover.node_latency(nodeid, peernodeid, rtt, reporttime)
+       select node_id, peer.nodeid, peer.rtt, now()
+         from unnest(peer_node_ids, peer_rtts) as peer(nodeid, rtt)
+         join pgautofailover.node on node.nodeid = peer.nodeid
+  on conflict (nodeid, peernodeid)
+    do update set rtt = excluded.rtt, reporttime = excluded.reporttime;
+$$;
+
+comment on function pgautofailover.report_latency(bigint,bigint[],double precision[])
+        is 'record the round-trip time measured by a node to its peer nodes';
+
+grant execute on function
+      pgautofailover.report_latency(bigint,bigint[],double precision[])
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.report_health_signals
+ (
+    IN node_id             bigint,
+    IN canary_ms           double precision,
+    IN wal_flush_ms        double precision,
+    IN checkpoint_sync_ms  double precision
+ )
+RETURNS bool LANGUAGE plpgsql STRICT SECURITY DEFINER
+AS $$
+declare
+  threshold        int;
+  samples          int;
+  degraded         bool;
+  degraded_count   int;
+  primary_node     record;
+begin
+  select setting::int into threshold
+    from pg_settings
+   where name = 'pgautofailover.degraded_primary_threshold';
+
+  select setting::int into samples
+    from pg_settings
+   where name = 'pgautofailover.degraded_primary_samples';
+
+  degraded := threshold > 0
+          and greatest(canary_ms, wal_flush_ms, checkpoint_sync_ms) > threshold;
+
+     insert into pgautofailover.node_health_signal
+                 (nodeid, reporttime,
+                  canary_ms, wal_flush_ms, checkpoint_sync_ms,
+                  degraded_samples)
+          values (node_id, now(),
+                  canary_ms, wal_flush_ms, checkpoint_sync_ms,
+                  case when degraded then 1 else 0 end)
+     on conflict (nodeid)
+       do update
+             set reporttime = excluded.reporttime,
+                 canary_ms = excluded.canary_ms,
+                 wal_flush_ms = excluded.wal_flush_ms,
+                 checkpoint_sync_ms = excluded.checkpoint_sync_ms,
+                 degraded_samples =
+                   case when degraded
+                        then node_health_signal.degraded_samples + 1
+                        else 0
+                    end
+       returning node_health_signal.degraded_samples
+            into degraded_count;
+
+  if not degraded or degraded_count < samples
+  then
+    return false;
+  end if;
+
+  select formationid, groupid, reportedstate, goalstate
+    into primary_node
+    from pgautofailover.node
+   where nodeid = node_id;
+
+  if not found
+     or primary_node.reportedstate <> 'primary'
+     or primary_node.goalstate <> 'primary'
+  then
+    return false;
+  end if;
+
+  --
+  -- perform_failover checks that the group is stable and has a candidate,
+  -- a refusal only means we try again at the next degraded report.
+  --
+  begin
+    perform pgautofailover.perform_failover(primary_node.formationid,
+                                            primary_node.groupid);
+  exception when others then
+    raise log 'could not start a switchover away from degraded primary '
+              'node % in formation "%" group %: %',
+              node_id, primary_node.formationid, primary_node.groupid,
+              sqlerrm;
+
+    return false;
+  end;
+
+  raise log 'started a switchover away from node % in formation "%" '
+            'group % after % degraded health signals reports',
+            node_id, primary_node.formationid, primary_node.groupid,
+            degraded_count;
+
+  update pgautofailover.node_health_signal
+     set degraded_samples = 0
+   where nodeid = node_id;
+
+  return true;
+end;
+$$;
+
+comment on function
+        pgautofailover.report_health_signals(bigint,double precision,double precision,double precision)
+        is 'record the health signals of a primary node, and switch over when they stay degraded';
+
+grant execute on function
+      pgautofailover.report_health_signals(bigint,double precision,double precision,double precision)
+   to autoctl_node;
+
+CREATE TABLE pgautofailover.node_crash_recovery
+ (
+    nodeid              bigint not null,
+    reporttime          timestamptz not null default now(),
+    start_lsn           pg_lsn not null,
+    replay_lsn          pg_lsn not null,
+    end_lsn             pg_lsn not null,
+    eta_seconds         bigint not null,
+
+    PRIMARY KEY (nodeid),
+    FOREIGN KEY (nodeid)
+     REFERENCES pgautofailover.node(nodeid) ON DELETE CASCADE
+ );
+
+comment on column pgautofailover.node_crash_recovery.eta_seconds
+        is 'estimated remaining crash recovery time, -1 when unknown, 0 when done';
+
+grant select on pgautofailover.node_crash_recovery to autoctl_node;
+
+CREATE FUNCTION pgautofailover.report_crash_recovery
+ (
+    IN node_id      bigint,
+    IN start_lsn    pg_lsn,
+    IN replay_lsn   pg_lsn,
+    IN end_lsn      pg_lsn,
+    IN eta_seconds  bigint
+ )
+RETURNS bool LANGUAGE plpgsql STRICT SECURITY DEFINER
+AS $$
+declare
+  max_eta   int;
+begin
+  select setting::int into max_eta
+    from pg_settings
+   where name = 'pgautofailover.crash_recovery_max_eta';
+
+     insert into pgautofailover.node_crash_recovery
+                 (nodeid, reporttime,
+                  start_lsn, replay_lsn, end_lsn, eta_seconds)
+          values (node_id, now(),
+                  start_lsn, replay_lsn, end_lsn, eta_seconds)
+     on conflict (nodeid)
+       do update
+             set reporttime = excluded.reporttime,
+                 start_lsn = excluded.start_lsn,
+                 replay_lsn = excluded.replay_lsn,
+                 end_lsn = excluded.end_lsn,
+                 eta_seconds = excluded.eta_seconds;
+
+  if max_eta > 0 and eta_seconds > max_eta
+  then
+    raise log 'asking node % to stop crash recovery and be cloned again: '
+              'it reports %s remaining, over crash_recovery_max_eta %s',
+              node_id, eta_seconds, max_eta;
+
+    return true;
+  end if;
+
+  return false;
+end;
+$$;
+
+comment on function
+        pgautofailover.report_crash_recovery(bigint,pg_lsn,pg_lsn,pg_lsn,bigint)
+        is 'record the crash recovery progress of a node, returns true when the node should rather be cloned again';
+
+grant execute on function
+      pgautofailover.report_crash_recovery(bigint,pg_lsn,pg_lsn,pg_lsn,bigint)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.function_stats
+ (
+   OUT funcname         text,
+   OUT calls            bigint,
+   OUT total_time       double precision,
+   OUT max_time         double precision,
+   OUT lock_wait_time   double precision,
+   OUT formation_lock_wait_time double precision,
+   OUT stats_reset      timestamptz
+ )
+RETURNS SETOF record LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', $$function_stats$$;
+
+comment on function pgautofailover.function_stats()
+        is 'get the calls statistics of the monitor protocol functions, with times in milliseconds';
+
+grant execute on function pgautofailover.function_stats()
+   to autoctl_node;
+
+CREATE VIEW pgautofailover.stat_functions
+    AS SELECT * FROM pgautofailover.function_stats();
+
+comment on view pgautofailover.stat_functions
+        is 'calls statistics of the monitor protocol functions, with times in milliseconds';
+
+grant select on pgautofailover.stat_functions
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.stat_functions_reset()
+RETURNS void LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', $$stat_functions_reset$$;
+
+comment on function pgautofailover.stat_functions_reset()
+        is 'reset the calls statistics of the monitor protocol functions';
+
+revoke execute on function pgautofailover.stat_functions_reset()
+  from public;
+
+CREATE FUNCTION pgautofailover.current_state
+ (
+    IN formation_id         text default 'default',
+   OUT formation_kind       text,
+   OUT nodename             text,
+   OUT nodehost             text,
+   OUT nodeport             int,
+   OUT group_id             int,
+   OUT node_id              bigint,
+   OUT current_group_state  pgautofailover.replication_state,
+   OUT assigned_group_state pgautofailover.replication_state,
+   OUT candidate_priority	int,
+   OUT replication_quorum	bool,
+   OUT reported_tli         int,
+   OUT reported_lsn         pg_lsn,
+   OUT health               integer,
+   OUT nodecluster          text,
+   OUT wal_rate             double precision,
+   OUT catchup_time         double precision
+ )
+RETURNS SETOF record LANGUAGE SQL STRICT
+AS $$
+   select kind, nodename, nodehost, nodeport, groupid, nodeid,
+          reportedstate, goalstate,
+   		  candidatepriority, replicationquorum,
+          reportedtli, report.reportedlsn,
+          health, nodecluster,
+          w.wal_rate, w.catchup_time
+     from pgautofailover.node
+     join pgautofailover.formation using(formationid)
+left join pgautofailover.node_report as report using(nodeid)
+left join pgautofailover.wal_rates(formation_id) w
+       on w.node_id = node.nodeid
+    where formationid = formation_id
+ order by groupid, nodeid;
+$$;
+
+comment on function pgautofailover.current_state(text)
+        is 'get the current state of both nodes of a formation';
+
+grant execute on function pgautofailover.current_state(text)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.current_state
+ (
+    IN formation_id         text,
+    IN group_id             int,
+   OUT formation_kind       text,
+   OUT nodename             text,
+   OUT nodehost             text,
    OUT nodeport             int,
    OUT group_id             int,
    OUT node_id              bigint,
@@ -637,16 +1824,23 @@ CREATE FUNCTION pgautofailover.current_state
    OUT reported_tli         int,
    OUT reported_lsn         pg_lsn,
    OUT health               integer,
-   OUT nodecluster          text
+   OUT nodecluster          text,
+   OUT wal_rate             double precision,
+   OUT catchup_time         double precision
  )
 RETURNS SETOF record LANGUAGE SQL STRICT
 AS $$
    select kind, nodename, nodehost, nodeport, groupid, nodeid,
           reportedstate, goalstate,
    		  candidatepriority, replicationquorum,
-          reportedtli, reportedlsn, health, nodecluster
+          reportedtli, report.reportedlsn,
+          health, nodecluster,
+          w.wal_rate, w.catchup_time
      from pgautofailover.node
      join pgautofailover.formation using(formationid)
+left join pgautofailover.node_report as report using(nodeid)
+left join pgautofailover.wal_rates(formation_id) w
+       on w.node_id = node.nodeid
     where formationid = formation_id
       and groupid = group_id
  order by groupid, nodeid;
@@ -665,40 +1859,127 @@ CREATE FUNCTION pgautofailover.formation_uri
     IN cluster_name         text DEFAULT 'default',
     IN sslmode              text DEFAULT 'prefer',
     IN sslrootcert          text DEFAULT '',
-    IN sslcrl               text DEFAULT ''
+    IN sslcrl               text DEFAULT '',
+    IN kind                 text DEFAULT 'read-write',
+    IN max_lag              bigint DEFAULT 16777216
  )
-RETURNS text LANGUAGE SQL STRICT
-AS $$
-    select case
-           when string_agg(format('%s:%s', nodehost, nodeport),',') is not null
-           then format(
-               'postgres://%s/%s?%ssslmode=%s%s%s',
-               string_agg(format('%s:%s', nodehost, nodeport),','),
-               -- as we join formation on node we get the same dbname for all
-               -- entries, pick one.
-               min(dbname),
-               case when cluster_name = 'default'
-                    then 'target_session_attrs=read-write&'
-                    else ''
-               end,
-               min(sslmode),
-               CASE WHEN min(sslrootcert) = ''
-                   THEN ''
-                   ELSE '&sslrootcert=' || sslrootcert
-               END,
-               CASE WHEN min(sslcrl) = ''
-                   THEN ''
-                   ELSE '&sslcrl=' || sslcrl
-               END
-           )
-           end as uri
+RETURNS text LANGUAGE plpgsql STRICT
+AS $$
+declare
+  hosts    text;
+  db_name  name;
+begin
+  if kind not in ('read-write', 'read-only', 'prefer-standby')
+  then
+    raise exception 'unknown formation_uri kind "%"', kind
+          using hint = 'use either read-write, read-only, or prefer-standby';
+  end if;
+
+  if kind = 'read-write'
+  then
+    select string_agg(format('%s:%s', nodehost, nodeport), ','),
+           -- as we join formation on node we get the same dbname for all
+           -- entries, pick one.
+           min(dbname)
+      into hosts, db_name
       from pgautofailover.node as node
            join pgautofailover.formation using(formationid)
      where formationid = formation_id
        and groupid = 0
        and nodecluster = cluster_name;
+  else
+    --
+    -- List the healthy secondary nodes, the least lagging first, and skip
+    -- the ones that are more than max_lag bytes behind the primary. We use
+    -- the most advanced of the replay LSN reported by the standby and the
+    -- one seen from the primary in pg_stat_replication.
+    --
+    -- With prefer-standby, the primary comes last, so that clients that
+    -- wait for their LSN token on a standby can still connect when no
+    -- secondary node is available.
+    --
+    select string_agg(format('%s:%s', standby.nodehost, standby.nodeport),
+                      ',' order by standby.isprimary, standby.lag,
+                                   standby.nodeid),
+           min(standby.dbname)
+      into hosts, db_name
+      from (
+             select node.nodeid, node.nodehost, node.nodeport,
+                    formation.dbname, false as isprimary,
+                    greatest(0,
+                             pg_wal_lsn_diff(
+                               primary_report.reportedlsn,
+                               greatest(report.reportedreplaylsn,
+                                        coalesce(standby_lsn.replaylsn,
+                                                 '0/0'))))
+                    as lag
+               from pgautofailover.node as node
+                    join pgautofailover.formation using(formationid)
+                    left join pgautofailover.node_report as report
+                      on report.nodeid = node.nodeid
+                    join pgautofailover.node as primary_node
+                      on primary_node.formationid = node.formationid
+                     and primary_node.groupid = node.groupid
+                     and primary_node.goalstate
+                         in ('single', 'primary', 'wait_primary',
+                             'join_primary', 'apply_settings')
+                    left join pgautofailover.node_report as primary_report
+                      on primary_report.nodeid = primary_node.nodeid
+                    left join pgautofailover.standby_lsn as standby_lsn
+                      on standby_lsn.nodeid = node.nodeid
+              where node.formationid = formation_id
+                and node.groupid = 0
+                and node.nodecluster = cluster_name
+                and node.reportedstate = 'secondary'
+                and node.goalstate = 'secondary'
+                and node.health <> 0
+             union all
+             select node.nodeid, node.nodehost, node.nodeport,
+                    formation.dbname, true, 0
+               from pgautofailover.node as node
+                    join pgautofailover.formation using(formationid)
+              where formation_uri.kind = 'prefer-standby'
+                and node.formationid = formation_id
+                and node.groupid = 0
+                and node.nodecluster = cluster_name
+                and node.goalstate
+                    in ('single', 'primary', 'wait_primary',
+                        'join_primary', 'apply_settings')
+           ) as standby
+     where standby.lag <= max_lag;
+  end if;
+
+  if hosts is null
+  then
+    return null;
+  end if;
+
+  return format(
+           'postgres://%s/%s?%ssslmode=%s%s%s',
+           hosts,
+           db_name,
+           case when kind = 'read-write' and cluster_name = 'default'
+                then 'target_session_attrs=read-write&'
+                when kind = 'prefer-standby'
+                then 'target_session_attrs=prefer-standby&'
+                else ''
+           end,
+           sslmode,
+           case when sslrootcert = ''
+                then ''
+                else '&sslrootcert=' || sslrootcert
+           end,
+           case when sslcrl = ''
+                then ''
+                else '&sslcrl=' || sslcrl
+           end);
+end;
 $$;
 
+comment on function
+        pgautofailover.formation_uri(text,text,text,text,text,text,bigint)
+        is 'get the connection string of a formation, read-only lists the secondary nodes by replication lag, prefer-standby then adds the primary';
+
 CREATE FUNCTION pgautofailover.enable_secondary
  (
    formation_id text
@@ -874,3 +2155,1006 @@ $$;
 
 comment on function pgautofailover.formation_settings(text)
         is 'get the current replication settings a formation';
+
+CREATE FUNCTION pgautofailover.formation_snapshot
+ (
+    IN formation_id         text DEFAULT 'default',
+    IN cluster_name         text DEFAULT 'default',
+    IN sslmode              text DEFAULT 'prefer',
+    IN sslrootcert          text DEFAULT '',
+    IN sslcrl               text DEFAULT ''
+ )
+RETURNS jsonb LANGUAGE SQL STRICT
+AS $$
+  select jsonb_build_object(
+           'formation', formation.formationid,
+           'kind', formation.kind,
+           'dbname', formation.dbname,
+           'number_sync_standbys', formation.number_sync_standbys,
+           'nodes',
+           (
+             select coalesce(jsonb_agg(to_jsonb(state)
+                                       order by state.group_id,
+                                                state.node_id),
+                             '[]')
+               from pgautofailover.current_state(formation_id) as state
+           ),
+           'settings',
+           (
+             select coalesce(jsonb_agg(to_jsonb(settings)), '[]')
+               from pgautofailover.formation_settings(formation_id) as settings
+           ),
+           'uri',
+           jsonb_build_object(
+             'read-write',
+             pgautofailover.formation_uri(formation_id, cluster_name, sslmode,
+                                          sslrootcert, sslcrl, 'read-write'),
+             'read-only',
+             pgautofailover.formation_uri(formation_id, cluster_name, sslmode,
+                                          sslrootcert, sslcrl, 'read-only')))
+    from pgautofailover.formation
+   where formation.formationid = formation_id;
+$$;
+
+comment on function
+        pgautofailover.formation_snapshot(text,text,text,text,text)
+        is 'get the nodes, settings, and connection strings of a formation in one call';
+
+grant execute on function
+      pgautofailover.formation_snapshot(text,text,text,text,text)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.health_check_stats
+ (
+   OUT node_id              bigint,
+   OUT checks               bigint,
+   OUT failures             bigint,
+   OUT retries              bigint,
+   OUT connections          bigint,
+   OUT connect_p50          double precision,
+   OUT connect_p99          double precision,
+   OUT connect_max          double precision,
+   OUT response_p50         double precision,
+   OUT response_p99         double precision,
+   OUT response_max         double precision,
+   OUT suppressed           bigint,
+   OUT last_check_time      timestamptz
+ )
+RETURNS SETOF record LANGUAGE C
+AS 'MODULE_PATHNAME', $$health_check_stats$$;
+
+comment on function pgautofailover.health_check_stats()
+        is 'get health check statistics for each node, latencies in milliseconds, the damped health changes, and the time of the last check';
+
+grant execute on function pgautofailover.health_check_stats()
+   to autoctl_node;
+
+--
+-- The event stream: a logical replication slot that uses the pgautofailover
+-- output plugin outputs the events as JSON, in commit order. This needs
+-- wal_level = logical on the monitor.
+--
+CREATE FUNCTION pgautofailover.create_event_stream
+ (
+    IN slot_name name
+ )
+RETURNS pg_lsn LANGUAGE plpgsql STRICT SECURITY DEFINER
+AS $$
+declare
+  slot_lsn pg_lsn;
+begin
+  select confirmed_flush_lsn
+    into slot_lsn
+    from pg_catalog.pg_replication_slots s
+   where s.slot_name = create_event_stream.slot_name
+     and s.plugin = 'pgautofailover';
+
+  if found
+  then
+    return slot_lsn;
+  end if;
+
+  select lsn
+    into slot_lsn
+    from pg_catalog.pg_create_logical_replication_slot(
+           create_event_stream.slot_name, 'pgautofailover');
+
+  return slot_lsn;
+end;
+$$;
+
+comment on function pgautofailover.create_event_stream(name)
+        is 'create a replication slot that streams the events, unless it exists already';
+
+grant execute on function pgautofailover.create_event_stream(name)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.read_event_stream
+ (
+    IN slot_name    name,
+    IN max_changes  int default 1000,
+   OUT lsn          pg_lsn,
+   OUT xid          xid,
+   OUT event        json
+ )
+RETURNS SETOF record LANGUAGE plpgsql STRICT SECURITY DEFINER
+AS $$
+begin
+  if not exists (select 1
+                   from pg_catalog.pg_replication_slots s
+                  where s.slot_name = read_event_stream.slot_name
+                    and s.plugin = 'pgautofailover')
+  then
+    raise exception 'replication slot "%" does not stream events', slot_name;
+  end if;
+
+  return query
+    select c.lsn, c.xid, nullif(c.data, '')::json
+      from pg_catalog.pg_logical_slot_peek_changes(
+             read_event_stream.slot_name, null, max_changes) as c;
+end;
+$$;
+
+comment on function pgautofailover.read_event_stream(name,int)
+        is 'read the next events from an event stream, a null event marks the commit of the previous ones';
+
+grant execute on function pgautofailover.read_event_stream(name,int)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.ack_event_stream
+ (
+    IN slot_name name,
+    IN upto_lsn  pg_lsn
+ )
+RETURNS void LANGUAGE plpgsql STRICT SECURITY DEFINER
+AS $$
+begin
+  if not exists (select 1
+                   from pg_catalog.pg_replication_slots s
+                  where s.slot_name = ack_event_stream.slot_name
+                    and s.plugin = 'pgautofailover')
+  then
+    raise exception 'replication slot "%" does not stream events', slot_name;
+  end if;
+
+  perform pg_catalog.pg_replication_slot_advance(slot_name, upto_lsn);
+end;
+$$;
+
+comment on function pgautofailover.ack_event_stream(name,pg_lsn)
+        is 'acknowledge the events of an event stream up to the given commit lsn';
+
+grant execute on function pgautofailover.ack_event_stream(name,pg_lsn)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.drop_event_stream
+ (
+    IN slot_name name
+ )
+RETURNS void LANGUAGE plpgsql STRICT SECURITY DEFINER
+AS $$
+begin
+  if not exists (select 1
+                   from pg_catalog.pg_replication_slots s
+                  where s.slot_name = drop_event_stream.slot_name
+                    and s.plugin = 'pgautofailover')
+  then
+    raise exception 'replication slot "%" does not stream events', slot_name;
+  end if;
+
+  perform pg_catalog.pg_drop_replication_slot(slot_name);
+end;
+$$;
+
+comment on function pgautofailover.drop_event_stream(name)
+        is 'drop the replication slot of an event stream';
+
+grant execute on function pgautofailover.drop_event_stream(name)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.set_formation_prefer_least_loaded
+ (
+    IN formation_id        text,
+    IN prefer_least_loaded bool
+ )
+RETURNS bool LANGUAGE SQL STRICT SECURITY DEFINER
+AS $$
+    update pgautofailover.formation
+       set prefer_least_loaded = $2
+     where formationid = $1
+ returning true;
+$$;
+
+comment on function
+        pgautofailover.set_formation_prefer_least_loaded(text, bool)
+        is 'break the ties between equally advanced failover candidates of a formation by their load';
+
+grant execute on function
+      pgautofailover.set_formation_prefer_least_loaded(text, bool)
+   to autoctl_node;
+
+CREATE TABLE pgautofailover.node_load
+ (
+    nodeid              bigint not null,
+    reporttime          timestamptz not null default now(),
+    cpu                 double precision not null,
+    iowait              double precision not null,
+    active_connections  int not null,
+    replay_lag          bigint not null,
+
+    PRIMARY KEY (nodeid),
+    FOREIGN KEY (nodeid)
+     REFERENCES pgautofailover.node(nodeid) ON DELETE CASCADE
+ );
+
+comment on column pgautofailover.node_load.cpu
+        is 'percentage of the CPU time spent outside of idle and iowait';
+
+comment on column pgautofailover.node_load.replay_lag
+        is 'WAL received and not replayed yet, in bytes';
+
+grant select on pgautofailover.node_load to autoctl_node;
+
+CREATE FUNCTION pgautofailover.report_load
+ (
+    IN node_id             bigint,
+    IN cpu                 double precision,
+    IN iowait              double precision,
+    IN active_connections  int,
+    IN replay_lag          bigint
+ )
+RETURNS void LANGUAGE SQL STRICT SECURITY DEFINER
+AS $$
+     insert into pgautofailover.node_load
+                 (nodeid, reporttime,
+                  cpu, iowait, active_connections, replay_lag)
+          values (node_id, now(),
+                  cpu, iowait, active_connections, replay_lag)
+     on conflict (nodeid)
+       do update
+             set reporttime = excluded.reporttime,
+                 cpu = excluded.cpu,
+                 iowait = excluded.iowait,
+                 active_connections = excluded.active_connections,
+                 replay_lag = excluded.replay_lag;
+$$;
+
+comment on function
+        pgautofailover.report_load(bigint,double precision,double precision,int,bigint)
+        is 'record the load of a standby node, used to break ties between failover candidates';
+
+grant execute on function
+      pgautofailover.report_load(bigint,double precision,double precision,int,bigint)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.perform_switchover_away_from_cluster
+ (
+    IN formation_id  text,
+    IN node_cluster  text,
+    IN max_groups    int default 0,
+   OUT group_id      int,
+   OUT node_id       bigint,
+   OUT node_name     text
+ )
+RETURNS SETOF record LANGUAGE plpgsql STRICT SECURITY DEFINER
+AS $$
+declare
+  candidate  record;
+  started    int := 0;
+begin
+  --
+  -- In each group where the primary node is in the given cluster and is
+  -- stable, target the best candidate standby node of another cluster.
+  --
+  for candidate in
+      select distinct on (p.groupid) p.groupid, s.nodeid, s.nodename
+        from pgautofailover.node p
+        join pgautofailover.node s
+          on s.formationid = p.formationid
+         and s.groupid = p.groupid
+         and s.nodeid <> p.nodeid
+   left join pgautofailover.node_report r
+          on r.nodeid = s.nodeid
+       where p.formationid = formation_id
+         and p.nodecluster = node_cluster
+         and p.reportedstate = 'primary'
+         and p.goalstate = 'primary'
+         and s.nodecluster <> node_cluster
+         and s.reportedstate = 'secondary'
+         and s.goalstate = 'secondary'
+         and s.candidatepriority > 0
+    order by p.groupid, s.candidatepriority desc,
+             r.reportedlsn desc
+  loop
+    exit when max_groups > 0 and started >= max_groups;
+
+    --
+    -- perform_promotion checks that the group can fail over, a refusal only
+    -- skips this group.
+    --
+    begin
+      perform pgautofailover.perform_promotion(formation_id, candidate.nodename);
+    exception when others then
+      raise notice 'could not start a switchover of group % in formation "%" '
+                   'to node % "%": %',
+                   candidate.groupid, formation_id,
+                   candidate.nodeid, candidate.nodename, sqlerrm;
+      continue;
+    end;
+
+    started := started + 1;
+
+    group_id := candidate.groupid;
+    node_id := candidate.nodeid;
+    node_name := candidate.nodename;
+
+    return next;
+  end loop;
+end;
+$$;
+
+comment on function
+        pgautofailover.perform_switchover_away_from_cluster(text,text,int)
+        is 'start a switchover to another cluster in the groups that have their primary in the given cluster';
+
+grant execute on function
+      pgautofailover.perform_switchover_away_from_cluster(text,text,int)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.set_formation_slot_retention_budget
+ (
+    IN formation_id             text,
+    IN slot_retention_budget_mb int
+ )
+RETURNS bool LANGUAGE SQL STRICT SECURITY DEFINER
+AS $$
+    update pgautofailover.formation
+       set slot_retention_budget_mb = $2
+     where formationid = $1
+ returning true;
+$$;
+
+comment on function
+        pgautofailover.set_formation_slot_retention_budget(text, int)
+        is 'set the WAL that the replication slot of a node may retain before the node is cloned again, in MB, 0 to disable';
+
+grant execute on function
+      pgautofailover.set_formation_slot_retention_budget(text, int)
+   to autoctl_node;
+
+CREATE TABLE pgautofailover.node_slot_retention
+ (
+    nodeid          bigint not null,
+    slotnodeid      bigint not null,
+    reporttime      timestamptz not null default now(),
+    retained_bytes  bigint not null,
+
+    PRIMARY KEY (nodeid, slotnodeid),
+    FOREIGN KEY (nodeid)
+     REFERENCES pgautofailover.node(nodeid) ON DELETE CASCADE,
+    FOREIGN KEY (slotnodeid)
+     REFERENCES pgautofailover.node(nodeid) ON DELETE CASCADE
+ );
+
+comment on column pgautofailover.node_slot_retention.retained_bytes
+        is 'WAL that the replication slot of slotnodeid retains on nodeid';
+
+grant select on pgautofailover.node_slot_retention to autoctl_node;
+
+CREATE FUNCTION pgautofailover.report_slot_retention
+ (
+    IN node_id        bigint,
+    IN slot_node_id   bigint,
+    IN retained_bytes bigint
+ )
+RETURNS bool LANGUAGE C STRICT SECURITY DEFINER
+AS 'MODULE_PATHNAME', $$report_slot_retention$$;
+
+comment on function
+        pgautofailover.report_slot_retention(bigint,bigint,bigint)
+        is 'record the WAL that a replication slot retains, returns true when the slot should be dropped';
+
+grant execute on function
+      pgautofailover.report_slot_retention(bigint,bigint,bigint)
+   to autoctl_node;
+
+CREATE TABLE pgautofailover.formation_directory
+ (
+    formationid  text not null,
+    monitoruri   text not null,
+    updatetime   timestamptz not null default now(),
+
+    PRIMARY KEY (formationid)
+ );
+
+comment on table pgautofailover.formation_directory
+        is 'formations that are managed by another monitor';
+
+grant select on pgautofailover.formation_directory to autoctl_node;
+
+CREATE FUNCTION pgautofailover.set_formation_monitor
+ (
+    IN formation_id text,
+    IN monitor_uri  text
+ )
+RETURNS bool LANGUAGE SQL STRICT SECURITY DEFINER
+AS $$
+      with deleted as
+      (
+         delete from pgautofailover.formation_directory
+          where formationid = formation_id
+            and monitor_uri = ''
+      returning true
+      )
+    , upserted as
+      (
+         insert into pgautofailover.formation_directory(formationid, monitoruri)
+              select formation_id, monitor_uri
+               where monitor_uri <> ''
+         on conflict (formationid)
+           do update set monitoruri = excluded.monitoruri,
+                         updatetime = now()
+      returning true
+      )
+    select exists(select 1 from deleted) or exists(select 1 from upserted);
+$$;
+
+comment on function pgautofailover.set_formation_monitor(text,text)
+        is 'register the monitor that manages a formation, or remove it with an empty string';
+
+grant execute on function pgautofailover.set_formation_monitor(text,text)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.formation_monitor
+ (
+    IN formation_id text
+ )
+RETURNS text LANGUAGE SQL STRICT STABLE SECURITY DEFINER
+AS $$
+    select monitoruri
+      from pgautofailover.formation_directory
+     where formationid = formation_id;
+$$;
+
+comment on function pgautofailover.formation_monitor(text)
+        is 'the connection string of the monitor that manages a formation, when not this one';
+
+grant execute on function pgautofailover.formation_monitor(text)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.export_formation
+ (
+    IN formation_id text
+ )
+RETURNS jsonb LANGUAGE SQL STRICT STABLE SECURITY DEFINER
+AS $$
+    select jsonb_build_object(
+             'formation', to_jsonb(formation),
+             'nodes', coalesce((select jsonb_agg(to_jsonb(node)
+                                                 order by node.nodeid)
+                                  from pgautofailover.node
+                                 where node.formationid = formation.formationid),
+                               '[]'::jsonb),
+             'reports', coalesce((select jsonb_agg(to_jsonb(report)
+                                                   order by report.nodeid)
+                                    from pgautofailover.node_report as report
+                                    join pgautofailover.node using(nodeid)
+                                   where node.formationid = formation.formationid),
+                                 '[]'::jsonb))
+      from pgautofailover.formation
+     where formationid = formation_id;
+$$;
+
+comment on function pgautofailover.export_formation(text)
+        is 'the formation, its nodes and their reports, for pgautofailover.import_formation';
+
+grant execute on function pgautofailover.export_formation(text)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.import_formation
+ (
+    IN formation jsonb
+ )
+RETURNS int LANGUAGE C STRICT SECURITY DEFINER
+AS 'MODULE_PATHNAME', $$import_formation$$;
+
+comment on function pgautofailover.import_formation(jsonb)
+        is 'register a formation and its nodes exported from another monitor';
+
+grant execute on function pgautofailover.import_formation(jsonb)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.forward_formation
+ (
+    IN formation_id text,
+    IN monitor_uri  text
+ )
+RETURNS int LANGUAGE C STRICT SECURITY DEFINER
+AS 'MODULE_PATHNAME', $$forward_formation$$;
+
+comment on function pgautofailover.forward_formation(text,text)
+        is 'remove a formation managed by another monitor now, and register that monitor';
+
+grant execute on function pgautofailover.forward_formation(text,text)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.node_active_group_settings
+ (
+    IN node_id                    bigint,
+   OUT primary_node_id            bigint,
+   OUT primary_name               text,
+   OUT primary_host               text,
+   OUT primary_port               int,
+   OUT synchronous_standby_names  text
+ )
+RETURNS SETOF record LANGUAGE plpgsql STRICT SECURITY DEFINER
+AS $$
+declare
+  node_row pgautofailover.node;
+begin
+  select * into node_row from pgautofailover.node where nodeid = node_id;
+
+  -- only the nodes that are in a transition need the group settings
+  if not found or node_row.goalstate = node_row.reportedstate
+  then
+    return;
+  end if;
+
+  begin
+    select p.primary_node_id, p.primary_name, p.primary_host, p.primary_port
+      into primary_node_id, primary_name, primary_host, primary_port
+      from pgautofailover.get_primary(node_row.formationid,
+                                      node_row.groupid) as p;
+  exception when others then
+    -- the group has no writable node right now
+    primary_node_id := null;
+  end;
+
+  begin
+    synchronous_standby_names :=
+      pgautofailover.synchronous_standby_names(node_row.formationid,
+                                               node_row.groupid);
+  exception when others then
+    synchronous_standby_names := null;
+  end;
+
+  return next;
+end;
+$$;
+
+comment on function pgautofailover.node_active_group_settings(bigint)
+        is 'the primary node and the synchronous_standby_names of the group of a node in a transition, returned with node_active';
+
+grant execute on function pgautofailover.node_active_group_settings(bigint)
+   to autoctl_node;
+
+CREATE TABLE pgautofailover.node_rewind
+ (
+    nodeid              bigint not null,
+    reporttime          timestamptz not null default now(),
+    divergence_bytes    bigint not null,
+    database_bytes      bigint not null,
+    done_bytes          bigint not null,
+    total_bytes         bigint not null,
+
+    PRIMARY KEY (nodeid),
+    FOREIGN KEY (nodeid)
+     REFERENCES pgautofailover.node(nodeid) ON DELETE CASCADE
+ );
+
+comment on column pgautofailover.node_rewind.divergence_bytes
+        is 'WAL the node wrote past the fork point of the new primary timeline';
+
+comment on column pgautofailover.node_rewind.total_bytes
+        is 'bytes that pg_rewind copies, 0 until pg_rewind has started';
+
+grant select on pgautofailover.node_rewind to autoctl_node;
+
+CREATE FUNCTION pgautofailover.report_rewind
+ (
+    IN node_id           bigint,
+    IN divergence_bytes  bigint,
+    IN database_bytes    bigint,
+    IN done_bytes        bigint,
+    IN total_bytes       bigint
+ )
+RETURNS bool LANGUAGE plpgsql STRICT SECURITY DEFINER
+AS $$
+declare
+  threshold   int;
+begin
+  select setting::int into threshold
+    from pg_settings
+   where name = 'pgautofailover.rewind_clone_threshold';
+
+     insert into pgautofailover.node_rewind
+                 (nodeid, reporttime,
+                  divergence_bytes, database_bytes, done_bytes, total_bytes)
+          values (node_id, now(),
+                  divergence_bytes, database_bytes, done_bytes, total_bytes)
+     on conflict (nodeid)
+       do update
+             set reporttime = excluded.reporttime,
+                 divergence_bytes = excluded.divergence_bytes,
+                 database_bytes = excluded.database_bytes,
+                 done_bytes = excluded.done_bytes,
+                 total_bytes = excluded.total_bytes;
+
+  -- once pg_rewind has started, we let it finish
+  if threshold > 0
+     and total_bytes = 0
+     and database_bytes > 0
+     and divergence_bytes > database_bytes / 100 * threshold
+  then
+    raise log 'asking node % to be cloned again rather than rewound: '
+              'its divergence of % bytes is over % percent '
+              '(rewind_clone_threshold) of its % bytes',
+              node_id, divergence_bytes, threshold, database_bytes;
+
+    return true;
+  end if;
+
+  return false;
+end;
+$$;
+
+comment on function
+        pgautofailover.report_rewind(bigint,bigint,bigint,bigint,bigint)
+        is 'record the pg_rewind estimate and progress of a node, returns true when the node should rather be cloned again';
+
+grant execute on function
+      pgautofailover.report_rewind(bigint,bigint,bigint,bigint,bigint)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.set_formation_remote_wal_compression
+ (
+    IN formation_id           text,
+    IN remote_wal_compression text
+ )
+RETURNS bool LANGUAGE SQL STRICT SECURITY DEFINER
+AS $$
+    update pgautofailover.formation
+       set remote_wal_compression = $2
+     where formationid = $1
+ returning true;
+$$;
+
+comment on function
+        pgautofailover.set_formation_remote_wal_compression(text, text)
+        is 'set the wal_compression method used when a group streams to a node in another cluster, off to disable';
+
+grant execute on function
+      pgautofailover.set_formation_remote_wal_compression(text, text)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.node_wal_compression
+ (
+    IN node_id bigint
+ )
+RETURNS text LANGUAGE SQL STRICT SECURITY DEFINER
+AS $$
+    select case when exists
+                (
+                  select 1
+                    from pgautofailover.node as other
+                   where other.formationid = node.formationid
+                     and other.groupid = node.groupid
+                     and other.nodeid <> node.nodeid
+                     and other.nodecluster <> node.nodecluster
+                )
+                then formation.remote_wal_compression
+                else 'off'
+            end
+      from pgautofailover.node
+           join pgautofailover.formation using(formationid)
+     where node.nodeid = node_id;
+$$;
+
+comment on function
+        pgautofailover.node_wal_compression(bigint)
+        is 'get the wal_compression method a node uses, off unless its group has nodes in another cluster';
+
+grant execute on function
+      pgautofailover.node_wal_compression(bigint)
+   to autoctl_node;
+
+-- trace ids are minted once per decision of the monitor, see AssignGoalState
+CREATE SEQUENCE pgautofailover.trace_id_seq;
+
+grant usage on sequence pgautofailover.trace_id_seq
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.node_trace_id
+ (
+    IN node_id bigint
+ )
+RETURNS bigint LANGUAGE SQL STRICT SECURITY DEFINER
+AS $$
+    select goaltraceid from pgautofailover.node where nodeid = node_id;
+$$;
+
+comment on function pgautofailover.node_trace_id(bigint)
+        is 'get the trace id of the decision that assigned the current goal state of a node';
+
+grant execute on function pgautofailover.node_trace_id(bigint)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.failover_trace
+ (
+    IN trace_id      bigint,
+   OUT failover_id   bigint,
+   OUT group_id      int,
+   OUT phase         text,
+   OUT node_id       bigint,
+   OUT start_time    timestamptz,
+   OUT duration      interval
+ )
+RETURNS SETOF record LANGUAGE SQL STRICT
+AS $$
+  select failoverid, groupid, phase, nodeid, failover_phase.starttime,
+         coalesce(lead(failover_phase.starttime) over w, endtime)
+         - failover_phase.starttime
+    from pgautofailover.failover
+         join pgautofailover.failover_phase using(failoverid)
+   where traceid = trace_id
+  window w as (partition by failoverid order by failover_phase.starttime, phaseorder)
+order by failover_phase.starttime, phaseorder;
+$$;
+
+comment on function pgautofailover.failover_trace(bigint)
+        is 'retrieve the phases of the failover that a trace id belongs to';
+
+grant execute on function pgautofailover.failover_trace(bigint)
+   to autoctl_node;
+
+--
+-- The node table and the tables that the keepers update at each report rely
+-- on HOT updates and frequent vacuums to stay small. The default autovacuum
+-- settings wait for 20% of a table to be dead rows, which for tables of a
+-- few rows means vacuuming well after their pages are full, so we vacuum
+-- them after a fixed number of dead rows instead.
+--
+ALTER TABLE pgautofailover.node
+  SET (autovacuum_vacuum_scale_factor = 0,
+       autovacuum_vacuum_threshold = 1000,
+       autovacuum_analyze_scale_factor = 0,
+       autovacuum_analyze_threshold = 1000);
+
+ALTER TABLE pgautofailover.node_report
+  SET (autovacuum_vacuum_scale_factor = 0,
+       autovacuum_vacuum_threshold = 1000,
+       autovacuum_analyze_scale_factor = 0,
+       autovacuum_analyze_threshold = 1000);
+
+ALTER TABLE pgautofailover.node_latency
+  SET (autovacuum_vacuum_scale_factor = 0,
+       autovacuum_vacuum_threshold = 1000);
+
+ALTER TABLE pgautofailover.standby_lsn
+  SET (autovacuum_vacuum_scale_factor = 0,
+       autovacuum_vacuum_threshold = 1000);
+
+ALTER TABLE pgautofailover.node_health_signal
+  SET (autovacuum_vacuum_scale_factor = 0,
+       autovacuum_vacuum_threshold = 1000);
+
+ALTER TABLE pgautofailover.node_load
+  SET (autovacuum_vacuum_scale_factor = 0,
+       autovacuum_vacuum_threshold = 1000);
+
+CREATE VIEW pgautofailover.table_health
+    AS SELECT s.relid::regclass as relation,
+              s.n_live_tup as live_tuples,
+              s.n_dead_tup as dead_tuples,
+              round(s.n_dead_tup::numeric
+                    / nullif(s.n_live_tup + s.n_dead_tup, 0), 3)
+              as dead_tuple_ratio,
+              s.n_tup_upd as updates,
+              s.n_tup_hot_upd as hot_updates,
+              round(s.n_tup_hot_upd::numeric / nullif(s.n_tup_upd, 0), 3)
+              as hot_update_ratio,
+              s.last_vacuum,
+              s.last_autovacuum,
+              s.autovacuum_count,
+              s.last_autoanalyze,
+              pg_catalog.pg_table_size(s.relid) as table_size,
+              pg_catalog.pg_indexes_size(s.relid) as indexes_size,
+              c.reloptions
+         FROM pg_catalog.pg_stat_all_tables s
+              JOIN pg_catalog.pg_class c on c.oid = s.relid
+        WHERE s.schemaname = 'pgautofailover'
+     ORDER BY pg_catalog.pg_total_relation_size(s.relid) desc;
+
+comment on view pgautofailover.table_health
+        is 'HOT updates, dead tuples, vacuum activity and size of the monitor tables';
+
+grant select on pgautofailover.table_health
+   to autoctl_node;
+
+--
+-- When many groups of a formation fail at once, such as in a zone outage,
+-- the monitor starts their failovers in order: the coordinator group of a
+-- Citus formation first, then the other groups by decreasing failover
+-- priority, at most pgautofailover.failover_max_concurrency at a time.
+--
+CREATE TABLE pgautofailover.group_failover_priority
+ (
+    formationid   text not null,
+    groupid       int not null,
+    priority      int not null default 0,
+
+    PRIMARY KEY (formationid, groupid),
+    FOREIGN KEY (formationid)
+     REFERENCES pgautofailover.formation(formationid) ON DELETE CASCADE
+ );
+
+grant select on pgautofailover.group_failover_priority to autoctl_node;
+
+CREATE FUNCTION pgautofailover.set_group_failover_priority
+ (
+    IN formation_id      text,
+    IN group_id          int,
+    IN failover_priority int
+ )
+RETURNS int LANGUAGE SQL STRICT SECURITY DEFINER
+AS $$
+  insert into pgautofailover.group_failover_priority
+              (formationid, groupid, priority)
+       values (formation_id, group_id, failover_priority)
+  on conflict (formationid, groupid)
+    do update set priority = excluded.priority
+    returning priority;
+$$;
+
+comment on function pgautofailover.set_group_failover_priority(text,int,int)
+        is 'set the priority of the failover of a group when several groups of the formation fail at once';
+
+grant execute on function
+      pgautofailover.set_group_failover_priority(text, int, int)
+   to autoctl_node;
+
+--
+-- The failovers that overlap in time form an incident, and the recovery time
+-- of the formation goes from the first detection of a failed primary to the
+-- end of the last failover of the incident.
+--
+CREATE FUNCTION pgautofailover.failover_incidents
+ (
+    IN formation_id    text default 'default',
+   OUT incident_id     bigint,
+   OUT start_time      timestamptz,
+   OUT end_time        timestamptz,
+   OUT group_count     int,
+   OUT failover_count  int,
+   OUT recovery_time   interval
+ )
+RETURNS SETOF record LANGUAGE SQL STRICT
+AS $$
+  with failovers as
+  (
+    select failover.failoverid, failover.groupid, failover.endtime,
+           coalesce(detection.starttime, failover.starttime) as starttime
+      from pgautofailover.failover
+           left join pgautofailover.failover_phase as detection
+                  on detection.failoverid = failover.failoverid
+                 and detection.phase = 'detection'
+     where formationid = formation_id
+  ),
+  overlap as
+  (
+    select failovers.*,
+           max(coalesce(endtime, 'infinity'))
+             over (order by starttime, failoverid
+                   rows between unbounded preceding and 1 preceding)
+           as previous_endtime
+      from failovers
+  ),
+  incident as
+  (
+    select overlap.*,
+           count(*) filter (where previous_endtime is null
+                               or starttime > previous_endtime)
+             over (order by starttime, failoverid)
+           as incidentid
+      from overlap
+  )
+  select incidentid,
+         min(starttime),
+         case when bool_and(endtime is not null) then max(endtime) end,
+         count(distinct groupid)::int,
+         count(*)::int,
+         case when bool_and(endtime is not null)
+              then max(endtime) - min(starttime)
+          end
+    from incident
+group by incidentid
+order by incidentid;
+$$;
+
+comment on function pgautofailover.failover_incidents(text)
+        is 'list the incidents of a formation: the failovers that overlap in time, and how long the formation took to recover from them';
+
+grant execute on function pgautofailover.failover_incidents(text)
+   to autoctl_node;
+
+CREATE TABLE pgautofailover.node_inventory_report
+ (
+    nodeid              bigint not null,
+    reporttime          timestamptz not null default now(),
+    pg_autoctl_version  text not null,
+    pg_version          text not null,
+    tuning_profile      text,
+    settings_hash       text not null,
+    settings            jsonb not null default '{}',
+
+    PRIMARY KEY (nodeid),
+    FOREIGN KEY (nodeid)
+     REFERENCES pgautofailover.node(nodeid) ON DELETE CASCADE
+ );
+
+comment on column pgautofailover.node_inventory_report.settings_hash
+        is 'md5 of the Postgres settings that are not set to their default value';
+
+comment on column pgautofailover.node_inventory_report.settings
+        is 'key pg_autoctl settings of the node, by section.option name';
+
+grant select on pgautofailover.node_inventory_report to autoctl_node;
+
+CREATE FUNCTION pgautofailover.report_node_inventory
+ (
+    IN node_id             bigint,
+    IN pg_autoctl_version  text,
+    IN pg_version          text,
+    IN tuning_profile      text,
+    IN settings_hash       text,
+    IN settings            jsonb
+ )
+RETURNS void LANGUAGE SQL SECURITY DEFINER
+AS $$
+     insert into pgautofailover.node_inventory_report
+                 (nodeid, reporttime, pg_autoctl_version, pg_version,
+                  tuning_profile, settings_hash, settings)
+          values (node_id, now(), pg_autoctl_version, pg_version,
+                  tuning_profile, settings_hash, coalesce(settings, '{}'))
+     on conflict (nodeid)
+       do update
+             set reporttime = excluded.reporttime,
+                 pg_autoctl_version = excluded.pg_autoctl_version,
+                 pg_version = excluded.pg_version,
+                 tuning_profile = excluded.tuning_profile,
+                 settings_hash = excluded.settings_hash,
+                 settings = excluded.settings;
+$$;
+
+comment on function
+        pgautofailover.report_node_inventory(bigint,text,text,text,text,jsonb)
+        is 'record the versions and key settings of a node, as sent by its keeper when they change';
+
+grant execute on function
+      pgautofailover.report_node_inventory(bigint,text,text,text,text,jsonb)
+   to autoctl_node;
+
+CREATE VIEW pgautofailover.node_inventory
+    AS SELECT n.formationid,
+              n.groupid,
+              n.nodeid,
+              n.nodename,
+              n.nodehost,
+              n.nodeport,
+              n.reportedstate,
+              n.goalstate,
+              i.pg_autoctl_version,
+              i.pg_version,
+              i.tuning_profile,
+              i.settings_hash,
+              i.settings,
+              i.reporttime
+         FROM pgautofailover.node n
+    LEFT JOIN pgautofailover.node_inventory_report i
+           ON i.nodeid = n.nodeid;
+
+comment on view pgautofailover.node_inventory
+        is 'versions and key settings of every node, to audit the settings of a whole fleet with a single query';
+
+grant select on pgautofailover.node_inventory
+   to autoctl_node;
@@ -25,11 +25,32 @@
 #include "nodes/parsenodes.h"
 #include "nodes/value.h"
 #include "parser/parse_type.h"
+#include "utils/inval.h"
 #include "utils/syscache.h"
 
 
+/*
+ * Converting between the pgautofailover.replication_state enum OIDs and our
+ * internal ReplicationState values happens for every node tuple we read and
+ * every state we assign. Rather than looking-up the type and the enum labels
+ * in the syscache each time, we keep a backend-local mapping, filled once and
+ * reset by the syscache invalidation callbacks on pg_enum and pg_type, so
+ * that ALTER TYPE ... ADD VALUE or dropping and creating the extension again
+ * is noticed.
+ */
+static bool ReplicationStateCacheValid = false;
+static bool ReplicationStateCacheCallbackRegistered = false;
+static uint64 ReplicationStateCacheInvalidations = 0;
+static Oid ReplicationStateCachedTypeOid = InvalidOid;
+static Oid ReplicationStateCachedEnumOids[REPLICATION_STATE_UNKNOWN];
+
+
 /* private function forward declarations */
 static bool IsReplicationStateName(char *name, ReplicationState replicationState);
+static Oid LookupReplicationStateTypeOid(void);
+static void EnsureReplicationStateCache(void);
+static void InvalidateReplicationStateCache(Datum argument, int cacheId,
+											uint32 hashValue);
 
 
 /*
@@ -38,6 +59,19 @@ static bool IsReplicationStateName(char *name, ReplicationState replicationState
  */
 Oid
 ReplicationStateTypeOid(void)
+{
+	EnsureReplicationStateCache();
+
+	return ReplicationStateCachedTypeOid;
+}
+
+
+/*
+ * LookupReplicationStateTypeOid looks up the OID of the
+ * pgautofailover.replication_state type in the catalogs.
+ */
+static Oid
+LookupReplicationStateTypeOid(void)
 {
 /* new String type in version 15devel  */
 #if (PG_VERSION_NUM >= 150000)
@@ -56,12 +90,97 @@ ReplicationStateTypeOid(void)
 }
 
 
+/*
+ * EnsureReplicationStateCache fills-in the backend-local mapping of the
+ * replication state enum OIDs, unless it's still valid.
+ */
+static void
+EnsureReplicationStateCache(void)
+{
+	if (ReplicationStateCacheValid)
+	{
+		return;
+	}
+
+	if (!ReplicationStateCacheCallbackRegistered)
+	{
+		CacheRegisterSyscacheCallback(ENUMOID,
+									  InvalidateReplicationStateCache,
+									  (Datum) 0);
+		CacheRegisterSyscacheCallback(TYPEOID,
+									  InvalidateReplicationStateCache,
+									  (Datum) 0);
+		ReplicationStateCacheCallbackRegistered = true;
+	}
+
+	uint64 invalidations = ReplicationStateCacheInvalidations;
+	Oid enumTypeOid = LookupReplicationStateTypeOid();
+
+	for (ReplicationState replicationState = REPLICATION_STATE_INITIAL;
+		 replicationState < REPLICATION_STATE_UNKNOWN;
+		 replicationState++)
+	{
+		const char *enumName = ReplicationStateGetName(replicationState);
+
+		HeapTuple enumTuple = SearchSysCache2(ENUMTYPOIDNAME,
+											  ObjectIdGetDatum(enumTypeOid),
+											  CStringGetDatum(enumName));
+
+		/* an older version of the extension may not have all the states */
+		if (!HeapTupleIsValid(enumTuple))
+		{
+			ReplicationStateCachedEnumOids[replicationState] = InvalidOid;
+			continue;
+		}
+
+		ReplicationStateCachedEnumOids[replicationState] =
+			HeapTupleGetOid(enumTuple);
+
+		ReleaseSysCache(enumTuple);
+	}
+
+	ReplicationStateCachedTypeOid = enumTypeOid;
+
+	/* the catalogs may have changed while we were reading them */
+	ReplicationStateCacheValid =
+		invalidations == ReplicationStateCacheInvalidations;
+}
+
+
+/*
+ * InvalidateReplicationStateCache is our syscache invalidation callback for
+ * pg_enum and pg_type. Those catalogs rarely change, so we simply reset the
+ * whole mapping.
+ */
+static void
+InvalidateReplicationStateCache(Datum argument, int cacheId, uint32 hashValue)
+{
+	ReplicationStateCacheValid = false;
+	ReplicationStateCacheInvalidations++;
+}
+
+
 /*
  * EnumGetReplicationState returns the internal value of a replication state enum.
  */
 ReplicationState
 EnumGetReplicationState(Oid replicationStateOid)
 {
+	EnsureReplicationStateCache();
+
+	for (ReplicationState replicationState = REPLICATION_STATE_INITIAL;
+		 replicationState < REPLICATION_STATE_UNKNOWN;
+		 replicationState++)
+	{
+		if (ReplicationStateCachedEnumOids[replicationState] ==
+			replicationStateOid &&
+			OidIsValid(replicationStateOid))
+		{
+			return replicationState;
+		}
+	}
+
+	/* not one of our known states, have a look at the catalogs */
 	HeapTuple enumTuple = SearchSysCache1(ENUMOID, ObjectIdGetDatum(replicationStateOid));
 	if (!HeapTupleIsValid(enumTuple))
 	{
@@ -86,23 +205,17 @@ EnumGetReplicationState(Oid replicationStateOid)
 Oid
 ReplicationStateGetEnum(ReplicationState replicationState)
 {
-	const char *enumName = ReplicationStateGetName(replicationState);
-	Oid enumTypeOid = ReplicationStateTypeOid();
+	EnsureReplicationStateCache();
 
-	HeapTuple enumTuple = SearchSysCache2(ENUMTYPOIDNAME,
-										  ObjectIdGetDatum(enumTypeOid),
-										  CStringGetDatum(enumName));
-	if (!HeapTupleIsValid(enumTuple))
+	if ((int) replicationState < (int) REPLICATION_STATE_INITIAL ||
+		replicationState >= REPLICATION_STATE_UNKNOWN ||
+		!OidIsValid(ReplicationStateCachedEnumOids[replicationState]))
 	{
 		ereport(ERROR, (errmsg("invalid value for enum: %d",
 							   replicationState)));
 	}
 
-	Oid replicationStateOid = HeapTupleGetOid(enumTuple);
-
-	ReleaseSysCache(enumTuple);
-
-	return replicationStateOid;
+	return ReplicationStateCachedEnumOids[replicationState];
 }
 
 
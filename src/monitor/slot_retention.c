@@ -0,0 +1,187 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/slot_retention.c
+ *
+ * Implementation of the WAL retention budget of the replication slots of a
+ * formation.
+ *
+ * Every node maintains a replication slot for each other node of its group.
+ * A standby node that has been down for hours, but not removed from the
+ * monitor, makes the primary retain WAL until its disk fills up. When the
+ * formation has a slot_retention_budget_mb, the keepers report how much WAL
+ * each of their slots retains, and we record that in
+ * pgautofailover.node_slot_retention. A standby node that makes its primary
+ * retain more than the budget is assigned wait_standby, so that it is cloned
+ * again, and the keepers drop its replication slot.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+
+/* these are internal headers */
+#include "formation_metadata.h"
+#include "metadata.h"
+#include "node_metadata.h"
+#include "notifications.h"
+#include "replication_state.h"
+
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "storage/lockdefs.h"
+
+
+#define AUTO_FAILOVER_NODE_SLOT_RETENTION_TABLE \
+	"pgautofailover.node_slot_retention"
+
+
+static void RecordSlotRetention(int64 nodeId, int64 slotNodeId,
+								int64 retainedBytes);
+
+
+PG_FUNCTION_INFO_V1(report_slot_retention);
+
+
+/*
+ * report_slot_retention is called by the keeper of a node for each of its
+ * replication slots, with the WAL bytes that the slot retains. It returns
+ * true when the keeper should drop the slot: the node of the slot makes its
+ * primary retain more WAL than the formation budget, and has been assigned
+ * wait_standby to be cloned again.
+ */
+Datum
+report_slot_retention(PG_FUNCTION_ARGS)
+{
+	checkPgAutoFailoverVersion();
+
+	int64 nodeId = PG_GETARG_INT64(0);
+	int64 slotNodeId = PG_GETARG_INT64(1);
+	int64 retainedBytes = PG_GETARG_INT64(2);
+
+	AutoFailoverNode *activeNode = GetAutoFailoverNodeById(nodeId);
+
+	if (activeNode == NULL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("couldn't find node with nodeid %lld",
+						(long long) nodeId)));
+	}
+
+	AutoFailoverNode *slotNode = GetAutoFailoverNodeById(slotNodeId);
+
+	/* the keeper drops the slots of the nodes that have been removed */
+	if (slotNode == NULL ||
+		strcmp(activeNode->formationId, slotNode->formationId) != 0 ||
+		activeNode->groupId != slotNode->groupId)
+	{
+		PG_RETURN_BOOL(false);
+	}
+
+	RecordSlotRetention(nodeId, slotNodeId, retainedBytes);
+
+	AutoFailoverFormation *formation = GetFormation(activeNode->formationId);
+
+	if (formation == NULL ||
+		formation->slotRetentionBudgetMB <= 0 ||
+		retainedBytes <= (int64) formation->slotRetentionBudgetMB * 1024 * 1024)
+	{
+		PG_RETURN_BOOL(false);
+	}
+
+	LockFormation(activeNode->formationId, ShareLock);
+	LockNodeGroup(activeNode->formationId, activeNode->groupId, ExclusiveLock);
+
+	/* the goal states might have changed while we waited for the lock */
+	activeNode = GetAutoFailoverNodeById(nodeId);
+	slotNode = GetAutoFailoverNodeById(slotNodeId);
+
+	if (activeNode == NULL || slotNode == NULL)
+	{
+		PG_RETURN_BOOL(false);
+	}
+
+	/* the node is going to be cloned again already */
+	if (slotNode->goalState == REPLICATION_STATE_WAIT_STANDBY)
+	{
+		PG_RETURN_BOOL(true);
+	}
+
+	/*
+	 * Only the WAL retained on the primary counts against the budget, the
+	 * standby nodes follow the decision. We don't interfere with a node that
+	 * is not a stable secondary, such as during a failover or a maintenance.
+	 */
+	if (!StateBelongsToPrimary(activeNode->goalState) ||
+		!IsCurrentState(slotNode, REPLICATION_STATE_SECONDARY))
+	{
+		PG_RETURN_BOOL(false);
+	}
+
+	char message[BUFSIZE] = { 0 };
+
+	LogAndNotifyMessage(
+		message, BUFSIZE,
+		"Setting goal state of " NODE_FORMAT
+		" to wait_standby so that it is cloned again: its replication slot "
+		"on " NODE_FORMAT " retains %lld MB of WAL, over the budget of %d MB "
+		"of formation \"%s\".",
+		NODE_FORMAT_ARGS(slotNode),
+		NODE_FORMAT_ARGS(activeNode),
+		(long long) (retainedBytes / (1024 * 1024)),
+		formation->slotRetentionBudgetMB,
+		formation->formationId);
+
+	SetNodeGoalState(slotNode, REPLICATION_STATE_WAIT_STANDBY, message);
+
+	PG_RETURN_BOOL(true);
+}
+
+
+/*
+ * RecordSlotRetention records the WAL bytes that the replication slot of
+ * slotNodeId retains on nodeId.
+ */
+static void
+RecordSlotRetention(int64 nodeId, int64 slotNodeId, int64 retainedBytes)
+{
+	Oid argTypes[] = {
+		INT8OID, /* nodeid */
+		INT8OID, /* slotnodeid */
+		INT8OID  /* retained_bytes */
+	};
+
+	Datum argValues[] = {
+		Int64GetDatum(nodeId),        /* nodeid */
+		Int64GetDatum(slotNodeId),    /* slotnodeid */
+		Int64GetDatum(retainedBytes)  /* retained_bytes */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan upsertPlan = { 0 };
+
+	const char *upsertQuery =
+		"INSERT INTO " AUTO_FAILOVER_NODE_SLOT_RETENTION_TABLE
+		" (nodeid, slotnodeid, reporttime, retained_bytes)"
+		" VALUES ($1, $2, now(), $3)"
+		" ON CONFLICT (nodeid, slotnodeid) DO UPDATE"
+		"    SET reporttime = excluded.reporttime,"
+		"        retained_bytes = excluded.retained_bytes";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&upsertPlan, upsertQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
+
+	if (spiStatus != SPI_OK_INSERT)
+	{
+		elog(ERROR, "could not update " AUTO_FAILOVER_NODE_SLOT_RETENTION_TABLE);
+	}
+
+	SPI_finish();
+}
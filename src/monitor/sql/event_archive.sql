@@ -0,0 +1,63 @@
+-- Copyright (c) Microsoft Corporation. All rights reserved.
+-- Licensed under the PostgreSQL License.
+
+-- maintain_event_partitions() archives the old daily partitions of the
+-- event table, archived_events() reads them back
+\x on
+
+select *
+  from pgautofailover.create_formation('archive', 'pgsql', 'archive', true, 0);
+
+insert into pgautofailover.event
+       (eventtime, formationid, nodeid, groupid, nodename, nodehost, nodeport,
+        reportedstate, goalstate, candidatepriority, replicationquorum,
+        description)
+values ('2020-01-01 12:00:00+00', 'archive', 2001, 0, 'archive1',
+        'localhost', 9921, 'init', 'single', 100, true, 'first'),
+       ('2020-01-01 12:00:10+00', 'archive', 2001, 0, 'archive1',
+        'localhost', 9921, 'single', 'single', 100, true, 'second'),
+       ('2020-01-02 12:00:00+00', 'archive', 2002, 0, 'archive2',
+        'localhost', 9922, 'init', 'wait_standby', 100, true, 'third');
+
+-- archive the partitions that are more than an hour old
+select count(*) as maintenance_calls
+  from pgautofailover.maintain_event_partitions(0, 2, 60);
+
+  select to_char(eventday, 'YYYY-MM-DD') as archived_eventday,
+         eventcount, nodeport, description
+    from pgautofailover.event_archive
+   where formationid = 'archive'
+order by eventday;
+
+-- the archived partitions are dropped
+select to_regclass('pgautofailover.event_20200101') is null as partition_dropped,
+       (select count(*)
+          from pgautofailover.event
+         where formationid = 'archive') as live_events;
+
+select nodeid as archived_nodeid, reportedstate, goalstate, description
+  from pgautofailover.archived_events('archive');
+
+-- events still in the event table are returned too
+insert into pgautofailover.event
+       (formationid, nodeid, groupid, nodename, nodehost, nodeport,
+        reportedstate, goalstate, candidatepriority, replicationquorum,
+        description)
+values ('archive', 2002, 0, 'archive2', 'localhost', 9922,
+        'wait_standby', 'catchingup', 100, true, 'fourth');
+
+select nodeid as archived_nodeid, description
+  from pgautofailover.archived_events('archive',
+         since => '2020-01-01 12:00:05+00');
+
+select nodeid as archived_nodeid, description
+  from pgautofailover.archived_events('archive',
+         until => '2020-01-01 12:00:05+00');
+
+-- the retention period also prunes the archive
+select count(*) as maintenance_calls
+  from pgautofailover.maintain_event_partitions(60, 2, 60);
+
+select count(*) as archived_days
+  from pgautofailover.event_archive
+ where formationid = 'archive';
@@ -0,0 +1,75 @@
+-- Copyright (c) Microsoft Corporation. All rights reserved.
+-- Licensed under the PostgreSQL License.
+
+-- the event stream functions manage logical replication slots that use the
+-- pgautofailover output plugin, which needs wal_level = logical: the
+-- expected output event_stream_1.out is for a monitor without it
+\x on
+\set SHOW_CONTEXT never
+
+select *
+  from pgautofailover.create_formation('stream', 'pgsql', 'stream', true, 0);
+
+-- only the slots that use the pgautofailover plugin are accepted
+select * from pgautofailover.read_event_stream('no_such_slot');
+
+select pgautofailover.ack_event_stream('no_such_slot', '0/0');
+
+select pgautofailover.drop_event_stream('no_such_slot');
+
+select slot_name as physical_slot_name
+  from pg_catalog.pg_create_physical_replication_slot('regress_physical');
+
+select * from pgautofailover.read_event_stream('regress_physical');
+
+select count(*) as dropped_slots
+  from pg_catalog.pg_drop_replication_slot('regress_physical');
+
+select pgautofailover.create_event_stream('regress_events') is not null
+       as stream_created;
+
+-- creating an existing stream returns its confirmed lsn
+select pgautofailover.create_event_stream('regress_events')
+       = (select confirmed_flush_lsn
+            from pg_catalog.pg_replication_slots
+           where slot_name = 'regress_events')
+       as same_stream_lsn;
+
+insert into pgautofailover.event
+       (formationid, nodeid, groupid, nodename, nodehost, nodeport,
+        reportedstate, goalstate, candidatepriority, replicationquorum,
+        description)
+values ('stream', 3001, 0, 'stream1', 'localhost', 9931,
+        'init', 'single', 100, true, 'first'),
+       ('stream', 3002, 0, 'stream2', 'localhost', 9932,
+        'init', 'wait_standby', 100, true, 'second');
+
+-- the events are streamed as JSON, a null event marks their commit
+  select event->>'nodeid' as streamed_nodeid,
+         event->>'goalstate' as goalstate,
+         event->>'description' as description
+    from pgautofailover.read_event_stream('regress_events')
+   where event->>'formationid' = 'stream'
+order by lsn;
+
+select count(*) > 0 as has_commit_marker
+  from pgautofailover.read_event_stream('regress_events')
+ where event is null;
+
+-- reading does not consume the events, acknowledging them does
+select count(*) as acknowledged_streams
+  from pgautofailover.ack_event_stream('regress_events',
+         (select max(lsn)
+            from pgautofailover.read_event_stream('regress_events')
+           where event is null));
+
+select count(*) as pending_events
+  from pgautofailover.read_event_stream('regress_events')
+ where event->>'formationid' = 'stream';
+
+select count(*) as dropped_streams
+  from pgautofailover.drop_event_stream('regress_events');
+
+select count(*) as remaining_slots
+  from pg_catalog.pg_replication_slots
+ where slot_name = 'regress_events';
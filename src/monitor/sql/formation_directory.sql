@@ -0,0 +1,74 @@
+-- Copyright (c) Microsoft Corporation. All rights reserved.
+-- Licensed under the PostgreSQL License.
+
+-- a formation moves to another monitor with export_formation, then
+-- forward_formation on the current monitor and import_formation on the
+-- target monitor: this monitor plays both parts here
+\x on
+
+select *
+  from pgautofailover.create_formation('moved', 'pgsql', 'moved', true, 0);
+
+select assigned_group_id, assigned_group_state, assigned_node_name
+  from pgautofailover.register_node('moved', 'localhost', 9961, 'moved',
+                                    'moved1');
+
+select assigned_group_id, assigned_group_state, assigned_node_name
+  from pgautofailover.register_node('moved', 'localhost', 9962, 'moved',
+                                    'moved2');
+
+-- moved1 reported a WAL position
+update pgautofailover.node_report
+   set reportedlsn = '0/3000060'
+ where nodeid = (select nodeid
+                   from pgautofailover.node
+                  where nodename = 'moved1');
+
+select pgautofailover.export_formation('moved') as export \gset
+
+select jsonb_array_length(:'export'::jsonb->'nodes') as nodes,
+       jsonb_array_length(:'export'::jsonb->'reports') as reports;
+
+select pgautofailover.forward_formation(
+         'moved',
+         'postgres://autoctl_node@other.example.com:5432/pg_auto_failover')
+    as forwarded;
+
+select count(*) as nodes
+  from pgautofailover.node
+ where formationid = 'moved';
+
+select pgautofailover.formation_monitor('moved') as monitor;
+
+-- the nodes come back with their ids, their states, and their reports
+select pgautofailover.import_formation(:'export') as imported;
+
+  select node.nodename,
+         node.reportedstate = imported.reportedstate
+     and node.goalstate = imported.goalstate as same_states,
+         report.reportedlsn
+    from pgautofailover.node
+    join jsonb_populate_recordset(null::pgautofailover.node,
+                                  :'export'::jsonb->'nodes') as imported
+         using(nodeid)
+    join pgautofailover.node_report as report using(nodeid)
+   where node.formationid = 'moved'
+order by node.nodeport;
+
+select pgautofailover.formation_monitor('moved') is null as local;
+
+-- the formation now has nodes on this monitor
+select pgautofailover.import_formation(:'export');
+
+-- an empty connection string removes a directory entry
+select pgautofailover.set_formation_monitor(
+         'other',
+         'postgres://autoctl_node@other.example.com:5432/pg_auto_failover')
+    as registered;
+
+select formationid, monitoruri
+  from pgautofailover.formation_directory;
+
+select pgautofailover.set_formation_monitor('other', '') as removed;
+
+select pgautofailover.set_formation_monitor('other', '') as removed;
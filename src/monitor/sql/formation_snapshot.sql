@@ -0,0 +1,63 @@
+-- Copyright (c) Microsoft Corporation. All rights reserved.
+-- Licensed under the PostgreSQL License.
+
+-- get_nodes() and get_other_nodes() return their rows in materialize mode,
+-- formation_snapshot() returns a formation in a single jsonb document
+\x on
+
+  select node_name is not null as node_name_is_set,
+         node_host, node_port, node_lsn, node_is_primary
+    from pgautofailover.get_nodes('bulk')
+order by node_port;
+
+select count(*) as nodes_in_group_1
+  from pgautofailover.get_nodes('bulk', 1);
+
+  select node_port as other_node_port
+    from pgautofailover.get_other_nodes(
+           (select nodeid
+              from pgautofailover.node
+             where formationid = 'bulk' and nodeport = 9901))
+order by node_port;
+
+select count(*) as other_secondary_nodes
+  from pgautofailover.get_other_nodes(
+         (select nodeid
+            from pgautofailover.node
+           where formationid = 'bulk' and nodeport = 9901),
+         'secondary');
+
+with snapshot(doc) as
+(
+  select pgautofailover.formation_snapshot('bulk')
+)
+select doc->>'formation' as formation_id,
+       doc->>'kind' as formation_kind,
+       doc->>'dbname' as formation_dbname,
+       doc->>'number_sync_standbys' as number_sync_standbys,
+       jsonb_array_length(doc->'nodes') as snapshot_nodes,
+       jsonb_array_length(doc->'settings')
+         = (select count(*)
+              from pgautofailover.formation_settings('bulk'))
+         as same_settings,
+       doc->'uri'->>'read-write'
+         is not distinct from
+         pgautofailover.formation_uri('bulk', 'default', 'prefer', '', '',
+                                      'read-write')
+         as same_read_write_uri,
+       doc->'uri'->>'read-only'
+         is not distinct from
+         pgautofailover.formation_uri('bulk', 'default', 'prefer', '', '',
+                                      'read-only')
+         as same_read_only_uri
+  from snapshot;
+
+-- the nodes are sorted by group and node id, as in current_state()
+select node->>'nodeport' as snapshot_nodeport,
+       node->>'assigned_group_state' as assigned_group_state,
+       node->>'candidate_priority' as candidate_priority
+  from jsonb_array_elements(
+         pgautofailover.formation_snapshot('bulk')->'nodes') as node;
+
+select pgautofailover.formation_snapshot('unknown') is null
+       as unknown_formation;
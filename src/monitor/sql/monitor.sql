@@ -3,6 +3,10 @@
 
 \x on
 
+-- the group topology version is a hash of the properties of the group nodes:
+-- rather than its values, we check when it changes
+create temporary table topology_version(step serial, version bigint);
+
 select *
   from pgautofailover.register_node('default', 'localhost', 9876, 'postgres');
 
@@ -10,33 +14,66 @@ select *
   from pgautofailover.set_node_system_identifier(1, 6852685710417058800);
 
 -- node_1 reports single
-select *
-  from pgautofailover.node_active('default', 1, 0,
-                                  current_group_role => 'single');
+with node_active as (
+  select * from pgautofailover.node_active('default', 1, 0,
+                                           current_group_role => 'single')
+), v as (insert into topology_version(version)
+         select group_topology_version from node_active)
+select assigned_node_id, assigned_group_id, assigned_group_state,
+       assigned_candidate_priority, assigned_replication_quorum
+  from node_active;
 
 -- register node_2
 select *
   from pgautofailover.register_node('default', 'localhost', 9877, 'postgres');
 
 -- node_2 reports wait_standby already
-select *
-  from pgautofailover.node_active('default', 2, 0,
-                                  current_group_role => 'wait_standby');
+with node_active as (
+  select * from pgautofailover.node_active('default', 2, 0,
+                                           current_group_role => 'wait_standby')
+), v as (insert into topology_version(version)
+         select group_topology_version from node_active)
+select assigned_node_id, assigned_group_id, assigned_group_state,
+       assigned_candidate_priority, assigned_replication_quorum
+  from node_active;
 
 -- node_1 reports single again, and gets assigned wait_primary
-select *
-  from pgautofailover.node_active('default', 1, 0,
-                                  current_group_role => 'single');
+with node_active as (
+  select * from pgautofailover.node_active('default', 1, 0,
+                                           current_group_role => 'single')
+), v as (insert into topology_version(version)
+         select group_topology_version from node_active)
+select assigned_node_id, assigned_group_id, assigned_group_state,
+       assigned_candidate_priority, assigned_replication_quorum
+  from node_active;
 
 -- node_1 now reports wait_primary
-select *
-  from pgautofailover.node_active('default', 1, 0,
-                                  current_group_role => 'wait_primary');
+with node_active as (
+  select * from pgautofailover.node_active('default', 1, 0,
+                                           current_group_role => 'wait_primary')
+), v as (insert into topology_version(version)
+         select group_topology_version from node_active)
+select assigned_node_id, assigned_group_id, assigned_group_state,
+       assigned_candidate_priority, assigned_replication_quorum
+  from node_active;
 
 -- node_2 now reports wait_standby, gets assigned catchingup
-select *
-  from pgautofailover.node_active('default', 2, 0,
-                                  current_group_role => 'wait_standby');
+with node_active as (
+  select * from pgautofailover.node_active('default', 2, 0,
+                                           current_group_role => 'wait_standby')
+), v as (insert into topology_version(version)
+         select group_topology_version from node_active)
+select assigned_node_id, assigned_group_id, assigned_group_state,
+       assigned_candidate_priority, assigned_replication_quorum
+  from node_active;
+
+-- the version changed when node_2 joined the group, and then stayed the same
+-- while the nodes only changed their states
+select (select version from topology_version where step = 1)
+       <> (select version from topology_version where step = 2)
+       as changed_with_node_2,
+       (select count(distinct version) from topology_version where step >= 2)
+       = 1 as stable_afterwards;
 
 -- register node_3 concurrently to node2 (probably) doing pg_basebackup
 select *
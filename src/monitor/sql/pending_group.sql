@@ -0,0 +1,56 @@
+-- Copyright (c) Microsoft Corporation. All rights reserved.
+-- Licensed under the PostgreSQL License.
+
+-- proceed_pending_group() runs the state machine of a group without any
+-- node_active call, and only for the nodes that are still reporting
+\x on
+
+select *
+  from pgautofailover.create_formation('pending', 'pgsql', 'pending', true, 0);
+
+select assigned_group_id, assigned_group_state, assigned_node_name
+  from pgautofailover.register_node('pending', 'localhost', 9951, 'pending',
+                                    'pending1');
+
+select assigned_group_id, assigned_group_state, assigned_node_name
+  from pgautofailover.register_node('pending', 'localhost', 9952, 'pending',
+                                    'pending2');
+
+select assigned_group_id, assigned_group_state, assigned_node_name
+  from pgautofailover.register_node('pending', 'localhost', 9953, 'pending',
+                                    'pending3', desired_group_id => 0);
+
+-- the nodes do not run a keeper, we set their states in a transaction
+begin;
+
+update pgautofailover.node
+   set sysidentifier = 6852685710417058900,
+       reportedstate = case when nodename = 'pending1'
+                            then 'wait_primary'
+                            else 'wait_standby'
+                        end::pgautofailover.replication_state,
+       goalstate = case when nodename = 'pending1'
+                        then 'wait_primary'
+                        else 'wait_standby'
+                    end::pgautofailover.replication_state
+ where formationid = 'pending';
+
+-- pending3 stopped reporting an hour ago
+update pgautofailover.node_report
+   set reporttime = now() - interval '1 hour'
+ where nodeid = (select nodeid
+                   from pgautofailover.node
+                  where nodename = 'pending3');
+
+-- the group advances: pending2 may now start its clone, pending3 waits
+select pgautofailover.proceed_pending_group('pending', 0) as proceeded;
+
+  select nodename, reportedstate, goalstate
+    from pgautofailover.node
+   where formationid = 'pending'
+order by nodeport;
+
+rollback;
+
+-- there is nothing to proceed in a group without nodes
+select pgautofailover.proceed_pending_group('pending', 1) as proceeded;
@@ -0,0 +1,35 @@
+-- Copyright (c) Microsoft Corporation. All rights reserved.
+-- Licensed under the PostgreSQL License.
+
+-- register_nodes() registers the nodes of a formation in a single transaction
+\x on
+\set SHOW_CONTEXT never
+
+select *
+  from pgautofailover.create_formation('bulk', 'pgsql', 'bulk', true, 0);
+
+-- the first node of the group is its primary
+select node_host, node_port, assigned_group_id, assigned_group_state,
+       assigned_candidate_priority, assigned_replication_quorum
+  from pgautofailover.register_nodes('bulk', 'bulk',
+         '[{"host": "localhost", "port": 9901},
+           {"host": "localhost", "port": 9902},
+           {"host": "localhost", "port": 9903, "candidate_priority": 0}]');
+
+  select nodeport, groupid, goalstate, reportedstate, candidatepriority
+    from pgautofailover.node
+   where formationid = 'bulk'
+order by nodeport;
+
+-- invalid arguments
+select * from pgautofailover.register_nodes('bulk', 'bulk', '{}');
+
+-- when a node is invalid, none of the nodes of the batch is registered
+select *
+  from pgautofailover.register_nodes('bulk', 'bulk',
+         '[{"host": "localhost", "port": 9904},
+           {"host": "localhost"}]');
+
+select count(*) as registered_nodes
+  from pgautofailover.node
+ where formationid = 'bulk';
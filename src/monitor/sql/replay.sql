@@ -0,0 +1,54 @@
+-- Copyright (c) Microsoft Corporation. All rights reserved.
+-- Licensed under the PostgreSQL License.
+
+-- replay_failover_decisions() replays the failovers found in the events
+\x on
+
+select *
+  from pgautofailover.create_formation('replay', 'pgsql', 'replay', true, 0);
+
+-- node 1001 is the primary, it fails at 00:00:00 and is marked unhealthy at
+-- 00:00:25, then node 1002 is selected at 00:00:30
+insert into pgautofailover.event
+       (eventtime, formationid, nodeid, groupid, nodename, nodehost, nodeport,
+        reportedstate, goalstate, reportedlsn, candidatepriority,
+        replicationquorum, description)
+values ('2026-01-01 00:00:00+00', 'replay', 1001, 0, 'replay1', 'localhost',
+        9911, 'primary', 'primary', '0/3000200', 100, true, 'report'),
+       ('2026-01-01 00:00:00+00', 'replay', 1002, 0, 'replay2', 'localhost',
+        9912, 'secondary', 'secondary', '0/3000100', 100, true, 'report'),
+       ('2026-01-01 00:00:00+00', 'replay', 1003, 0, 'replay3', 'localhost',
+        9913, 'secondary', 'secondary', '0/3000000', 100, true, 'report'),
+       ('2026-01-01 00:00:25+00', 'replay', 1001, 0, 'replay1', 'localhost',
+        9911, 'primary', 'primary', '0/3000200', 100, true,
+        'Node node 1001 "replay1" (localhost:9911) '
+        'is marked as unhealthy by the monitor'),
+       ('2026-01-01 00:00:30+00', 'replay', 1002, 0, 'replay2', 'localhost',
+        9912, 'secondary', 'prepare_promotion', '0/3000100', 100, true,
+        'Setting goal state of node 1002 to prepare_promotion');
+
+-- the most advanced standby node is selected, detected with the health check
+select primary_node_id, actual_node_id, simulated_node_id,
+       actual_elapsed_ms, simulated_detection_ms, decision
+  from pgautofailover.replay_failover_decisions('replay', 0,
+         node_considered_unhealthy_timeout => 20000,
+         promote_wal_log_threshold => 16777216);
+
+-- a longer timeout delays the detection
+select primary_node_id, actual_node_id, simulated_node_id,
+       actual_elapsed_ms, simulated_detection_ms, decision
+  from pgautofailover.replay_failover_decisions('replay', 0,
+         node_considered_unhealthy_timeout => 28000,
+         promote_wal_log_threshold => 16777216);
+
+-- a lower threshold prevents the failover: node 1002 is 256 bytes behind
+select actual_node_id, simulated_node_id is null as no_candidate,
+       decision like 'One of the most advanced standby nodes%' as lagging
+  from pgautofailover.replay_failover_decisions('replay', 0,
+         node_considered_unhealthy_timeout => 20000,
+         promote_wal_log_threshold => 128);
+
+-- events before the since argument are not replayed
+select count(*) as replayed_decisions
+  from pgautofailover.replay_failover_decisions('replay', 0,
+         since => '2026-01-01 00:00:29+00');
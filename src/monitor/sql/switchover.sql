@@ -0,0 +1,70 @@
+-- Copyright (c) Microsoft Corporation. All rights reserved.
+-- Licensed under the PostgreSQL License.
+
+-- perform_switchover_away_from_cluster() starts a switchover in the groups
+-- that have their primary node in the given node cluster
+\x on
+
+select *
+  from pgautofailover.create_formation('switch', 'citus', 'switch', true, 0);
+
+-- two groups, each with its primary in the default cluster: only a citus
+-- formation has more than one group
+select assigned_group_id, assigned_group_state, assigned_node_name
+  from pgautofailover.register_node('switch', 'localhost', 9941, 'switch',
+                                    'switch1', desired_group_id => 0,
+                                    node_kind => 'coordinator',
+                                    node_cluster => 'default');
+
+select assigned_group_id, assigned_group_state, assigned_node_name
+  from pgautofailover.register_node('switch', 'localhost', 9942, 'switch',
+                                    'switch2', desired_group_id => 0,
+                                    node_kind => 'coordinator',
+                                    node_cluster => 'dr');
+
+select assigned_group_id, assigned_group_state, assigned_node_name
+  from pgautofailover.register_node('switch', 'localhost', 9943, 'switch',
+                                    'switch3', desired_group_id => 1,
+                                    node_kind => 'worker',
+                                    node_cluster => 'default');
+
+select assigned_group_id, assigned_group_state, assigned_node_name
+  from pgautofailover.register_node('switch', 'localhost', 9944, 'switch',
+                                    'switch4', desired_group_id => 1,
+                                    node_kind => 'worker',
+                                    node_cluster => 'dr');
+
+-- the nodes do not run a keeper, we set their states in a transaction
+begin;
+
+update pgautofailover.node
+   set sysidentifier = 6852685710417058800 + groupid,
+       reportedstate = case when nodecluster = 'default'
+                            then 'primary'
+                            else 'secondary'
+                        end::pgautofailover.replication_state,
+       goalstate = case when nodecluster = 'default'
+                        then 'primary'
+                        else 'secondary'
+                    end::pgautofailover.replication_state
+ where formationid = 'switch';
+
+-- max_groups limits how many switchovers are started
+select group_id as switchover_group, node_name as switchover_node
+  from pgautofailover.perform_switchover_away_from_cluster('switch', 'default',
+                                                           max_groups => 1);
+
+  select nodename, reportedstate, goalstate
+    from pgautofailover.node
+   where formationid = 'switch'
+order by nodeport;
+
+-- the group that is already switching over is not selected again
+select group_id as switchover_group, node_name as switchover_node
+  from pgautofailover.perform_switchover_away_from_cluster('switch', 'default');
+
+-- no primary node is in the dr cluster
+select count(*) as dr_switchovers
+  from pgautofailover.perform_switchover_away_from_cluster('switch', 'dr');
+
+rollback;
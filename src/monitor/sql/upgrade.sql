@@ -13,4 +13,79 @@ ALTER EXTENSION pgautofailover UPDATE TO '1.2';
 ALTER EXTENSION pgautofailover UPDATE TO '1.3';
 \dx pgautofailover
 
+-- the next update scripts drop objects IF EXISTS that may not exist
+set client_min_messages to warning;
+
+ALTER EXTENSION pgautofailover UPDATE TO '1.4';
+\dx pgautofailover
+
+ALTER EXTENSION pgautofailover UPDATE TO '1.5';
+\dx pgautofailover
+
+ALTER EXTENSION pgautofailover UPDATE TO '1.6';
+\dx pgautofailover
+
+ALTER EXTENSION pgautofailover UPDATE TO '2.0';
+\dx pgautofailover
+
+ALTER EXTENSION pgautofailover UPDATE TO '2.1';
+\dx pgautofailover
+
+-- the objects of the extension, with the result type of the functions, the
+-- values of the enum types, and the columns of the tables and views: their
+-- order is not compared, as the update scripts add the new columns at the end
+-- of the existing tables
+create temporary view extension_objects(object, definition) as
+  select pg_describe_object(classid, objid, 0),
+         case classid
+              when 'pg_catalog.pg_proc'::regclass
+              then pg_get_function_result(objid)
+              when 'pg_catalog.pg_type'::regclass
+              then (select string_agg(enumlabel, ', ' order by enumsortorder)
+                      from pg_catalog.pg_enum
+                     where enumtypid = objid)
+          end
+    from pg_catalog.pg_depend
+   where refclassid = 'pg_catalog.pg_extension'::regclass
+     and refobjid = (select oid
+                       from pg_catalog.pg_extension
+                      where extname = 'pgautofailover')
+     and deptype = 'e'
+   union all
+  select format('column %s.%I', a.attrelid::regclass, a.attname),
+         format_type(a.atttypid, a.atttypmod)
+         || case when a.attnotnull then ' not null' else '' end
+         || coalesce(' default ' || pg_get_expr(ad.adbin, ad.adrelid), '')
+    from pg_catalog.pg_depend d
+         join pg_catalog.pg_attribute a on a.attrelid = d.objid
+         left join pg_catalog.pg_attrdef ad
+                on ad.adrelid = a.attrelid and ad.adnum = a.attnum
+   where d.classid = 'pg_catalog.pg_class'::regclass
+     and d.refclassid = 'pg_catalog.pg_extension'::regclass
+     and d.refobjid = (select oid
+                         from pg_catalog.pg_extension
+                        where extname = 'pgautofailover')
+     and d.deptype = 'e'
+     and a.attnum > 0
+     and not a.attisdropped;
+
+do $$
+begin
+  create temporary table upgraded_objects as table extension_objects;
+end
+$$;
+
+DROP EXTENSION pgautofailover;
+
+-- a fresh install of the same version must have the same objects
+CREATE EXTENSION pgautofailover;
+\dx pgautofailover
+
+  select 'upgrade' as installed_by, *
+    from (table upgraded_objects except table extension_objects) as o
+union all
+  select 'fresh', *
+    from (table extension_objects except table upgraded_objects) as o
+order by object, installed_by;
+
 DROP EXTENSION pgautofailover;
@@ -5,6 +5,10 @@
 
 \x on
 
+-- the group topology version is a hash of the properties of the group nodes:
+-- rather than its values, we check when it changes
+create temporary table topology_version(step serial, version bigint);
+
 -- create a citus formation
 select *
   from pgautofailover.create_formation('citus', 'citus', 'citus', true, 0);
@@ -20,9 +24,28 @@ select *
   from pgautofailover.set_node_system_identifier(4, 6862008014275870855);
 
 -- coordinator_1 reports single
-select *
-  from pgautofailover.node_active('citus', 4, 0,
-                                  current_group_role => 'single');
+with node_active as (
+  select * from pgautofailover.node_active('citus', 4, 0,
+                                           current_group_role => 'single')
+), v as (insert into topology_version(version)
+         select group_topology_version from node_active)
+select assigned_node_id, assigned_group_id, assigned_group_state,
+       assigned_candidate_priority, assigned_replication_quorum
+  from node_active;
+
+-- coordinator_1 reports single again
+with node_active as (
+  select * from pgautofailover.node_active('citus', 4, 0,
+                                           current_group_role => 'single')
+), v as (insert into topology_version(version)
+         select group_topology_version from node_active)
+select assigned_node_id, assigned_group_id, assigned_group_state,
+       assigned_candidate_priority, assigned_replication_quorum
+  from node_active;
+
+-- reporting the same state again does not change the version
+select count(distinct version) = 1 as stable_across_noop
+  from topology_version;
 
 -- register first worker
 select *
@@ -0,0 +1,412 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/stat_functions.c
+ *
+ * Implementation of the statistics that the monitor keeps about the calls to
+ * its protocol functions: how many times each function has been called, how
+ * long the calls took, and how long they waited for the formation and group
+ * locks, and for the formation locks alone. The statistics are kept in shared
+ * memory, shown in the view pgautofailover.stat_functions, and reset with the
+ * SQL function pgautofailover.stat_functions_reset().
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+/* these are internal headers */
+#include "metadata.h"
+#include "stat_functions.h"
+#include "version_compat.h"
+
+#include "access/htup_details.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+
+
+#define STAT_FUNCTIONS_COLUMNS 7
+
+
+typedef struct StatFunctionEntry
+{
+	slock_t mutex;
+	int64 calls;
+	double totalTime;
+	double maxTime;
+	double lockWaitTime;
+	double formationLockWaitTime;
+} StatFunctionEntry;
+
+typedef struct StatFunctionsControlData
+{
+	slock_t mutex;
+	TimestampTz resetTime;
+	StatFunctionEntry entries[STAT_FUNCTION_COUNT];
+} StatFunctionsControlData;
+
+
+/* in the same order as the StatFunction enum */
+static const char *StatFunctionNames[STAT_FUNCTION_COUNT] = {
+	"register_node",
+	"node_active",
+	"update_node_metadata",
+	"get_nodes",
+	"get_primary",
+	"get_other_nodes",
+	"remove_node_by_nodeid",
+	"remove_node_by_host",
+	"perform_failover",
+	"perform_promotion",
+	"start_maintenance",
+	"stop_maintenance",
+	"set_node_candidate_priority",
+	"set_node_replication_quorum",
+	"synchronous_standby_names",
+	"create_formation",
+	"drop_formation",
+	"enable_secondary",
+	"disable_secondary",
+	"set_formation_number_sync_standbys",
+	"get_upstream"
+};
+
+
+/* GUC variables */
+bool TrackFunctions = true;
+
+static StatFunctionsControlData *StatFunctionsControl = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/*
+ * When a tracked function calls another one, such as perform_promotion calling
+ * perform_failover, only the outer call is counted, and the lock waits are
+ * counted for the outer function.
+ */
+static bool InTrackedFunction = false;
+static double CurrentLockWaitTime = 0;
+static double CurrentFormationLockWaitTime = 0;
+
+
+PG_FUNCTION_INFO_V1(function_stats);
+PG_FUNCTION_INFO_V1(stat_functions_reset);
+
+static void StatFunctionsShmemInit(void);
+static void RecordFunctionCall(StatFunction statFunction, bool newCall,
+							   instr_time startTime);
+
+
+/*
+ * InitializeStatFunctions, called at server start, requests the shared memory
+ * needed to keep the function statistics.
+ */
+void
+InitializeStatFunctions(void)
+{
+	/* on PG 15, we use shmem_request_hook_type */
+#if PG_VERSION_NUM < 150000
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(StatFunctionsShmemSize());
+	}
+#endif
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = StatFunctionsShmemInit;
+}
+
+
+/*
+ * StatFunctionsShmemSize computes how much shared memory the function
+ * statistics need.
+ */
+size_t
+StatFunctionsShmemSize(void)
+{
+	return sizeof(StatFunctionsControlData);
+}
+
+
+/*
+ * StatFunctionsShmemInit initializes the shared memory of the function
+ * statistics.
+ */
+static void
+StatFunctionsShmemInit(void)
+{
+	bool alreadyInitialized = false;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	StatFunctionsControl =
+		(StatFunctionsControlData *)
+		ShmemInitStruct("pg_auto_failover Function Statistics",
+						sizeof(StatFunctionsControlData),
+						&alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		memset(StatFunctionsControl, 0, sizeof(StatFunctionsControlData));
+
+		SpinLockInit(&StatFunctionsControl->mutex);
+		StatFunctionsControl->resetTime = GetCurrentTimestamp();
+
+		for (int index = 0; index < STAT_FUNCTION_COUNT; index++)
+		{
+			SpinLockInit(&(StatFunctionsControl->entries[index].mutex));
+		}
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/*
+ * CallTrackedFunction calls the given function and counts the call in the
+ * statistics of statFunction, including when the function errors out.
+ *
+ * Set-returning functions are called once per row they return. The call is
+ * counted only once per scan, when SRF_FIRSTCALL_INIT has not been done yet,
+ * and the time spent in every row is added to the total time.
+ */
+Datum
+CallTrackedFunction(StatFunction statFunction, PGFunction function,
+					FunctionCallInfo fcinfo)
+{
+	instr_time startTime;
+	Datum result;
+
+	if (!TrackFunctions || StatFunctionsControl == NULL || InTrackedFunction)
+	{
+		return function(fcinfo);
+	}
+
+	bool newCall = fcinfo->flinfo == NULL || fcinfo->flinfo->fn_extra == NULL;
+
+	InTrackedFunction = true;
+	CurrentLockWaitTime = 0;
+	CurrentFormationLockWaitTime = 0;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	PG_TRY();
+	{
+		result = function(fcinfo);
+	}
+	PG_CATCH();
+	{
+		RecordFunctionCall(statFunction, newCall, startTime);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	RecordFunctionCall(statFunction, newCall, startTime);
+
+	return result;
+}
+
+
+/*
+ * RecordFunctionCall adds the time elapsed since startTime, and the lock
+ * waits of the call, to the statistics of the given function.
+ */
+static void
+RecordFunctionCall(StatFunction statFunction, bool newCall,
+				   instr_time startTime)
+{
+	instr_time duration;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	double elapsedTime = INSTR_TIME_GET_MILLISEC(duration);
+	StatFunctionEntry *entry = &(StatFunctionsControl->entries[statFunction]);
+
+	InTrackedFunction = false;
+
+	SpinLockAcquire(&entry->mutex);
+
+	if (newCall)
+	{
+		++(entry->calls);
+	}
+
+	entry->totalTime += elapsedTime;
+	entry->lockWaitTime += CurrentLockWaitTime;
+	entry->formationLockWaitTime += CurrentFormationLockWaitTime;
+
+	if (elapsedTime > entry->maxTime)
+	{
+		entry->maxTime = elapsedTime;
+	}
+
+	SpinLockRelease(&entry->mutex);
+}
+
+
+/*
+ * CountLockWait adds the time elapsed since lockStartTime to the lock waits
+ * of the tracked function that is running, if any. The waits for formation
+ * level locks are also counted on their own.
+ */
+void
+CountLockWait(instr_time lockStartTime, bool formationLock)
+{
+	instr_time duration;
+
+	if (!InTrackedFunction)
+	{
+		return;
+	}
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, lockStartTime);
+
+	double waitTime = INSTR_TIME_GET_MILLISEC(duration);
+
+	CurrentLockWaitTime += waitTime;
+
+	if (formationLock)
+	{
+		CurrentFormationLockWaitTime += waitTime;
+	}
+}
+
+
+/*
+ * function_stats returns the statistics of each tracked function, with the
+ * times in milliseconds.
+ */
+Datum
+function_stats(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+
+	checkPgAutoFailoverVersion();
+
+	/* stuff done only on the first call of the function */
+	if (SRF_IS_FIRSTCALL())
+	{
+		/* create a function context for cross-call persistence */
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		MemoryContext oldcontext =
+			MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		StatFunctionsControlData *snapshot =
+			palloc0(sizeof(StatFunctionsControlData));
+
+		if (StatFunctionsControl != NULL)
+		{
+			SpinLockAcquire(&StatFunctionsControl->mutex);
+			snapshot->resetTime = StatFunctionsControl->resetTime;
+			SpinLockRelease(&StatFunctionsControl->mutex);
+
+			for (int index = 0; index < STAT_FUNCTION_COUNT; index++)
+			{
+				StatFunctionEntry *entry =
+					&(StatFunctionsControl->entries[index]);
+
+				SpinLockAcquire(&entry->mutex);
+				snapshot->entries[index] = *entry;
+				SpinLockRelease(&entry->mutex);
+			}
+
+			funcctx->max_calls = STAT_FUNCTION_COUNT;
+		}
+
+		funcctx->user_fctx = snapshot;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	/* stuff done on every call of the function */
+	funcctx = SRF_PERCALL_SETUP();
+
+	StatFunctionsControlData *snapshot =
+		(StatFunctionsControlData *) funcctx->user_fctx;
+
+	if (funcctx->call_cntr < funcctx->max_calls)
+	{
+		TupleDesc resultDescriptor = NULL;
+		Datum values[STAT_FUNCTIONS_COLUMNS];
+		bool isNulls[STAT_FUNCTIONS_COLUMNS];
+
+		int index = funcctx->call_cntr;
+		StatFunctionEntry *entry = &(snapshot->entries[index]);
+
+		memset(values, 0, sizeof(values));
+		memset(isNulls, false, sizeof(isNulls));
+
+		values[0] = CStringGetTextDatum(StatFunctionNames[index]);
+		values[1] = Int64GetDatum(entry->calls);
+		values[2] = Float8GetDatum(entry->totalTime);
+		values[3] = Float8GetDatum(entry->maxTime);
+		values[4] = Float8GetDatum(entry->lockWaitTime);
+		values[5] = Float8GetDatum(entry->formationLockWaitTime);
+		values[6] = TimestampTzGetDatum(snapshot->resetTime);
+
+		TypeFuncClass resultTypeClass = get_call_result_type(fcinfo, NULL,
+															 &resultDescriptor);
+		if (resultTypeClass != TYPEFUNC_COMPOSITE)
+		{
+			ereport(ERROR, (errmsg("return type must be a row type")));
+		}
+
+		HeapTuple resultTuple = heap_form_tuple(resultDescriptor, values, isNulls);
+		Datum resultDatum = HeapTupleGetDatum(resultTuple);
+
+		SRF_RETURN_NEXT(funcctx, PointerGetDatum(resultDatum));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
+
+
+/*
+ * stat_functions_reset resets the statistics of all the tracked functions.
+ */
+Datum
+stat_functions_reset(PG_FUNCTION_ARGS)
+{
+	checkPgAutoFailoverVersion();
+
+	if (StatFunctionsControl == NULL)
+	{
+		PG_RETURN_VOID();
+	}
+
+	for (int index = 0; index < STAT_FUNCTION_COUNT; index++)
+	{
+		StatFunctionEntry *entry = &(StatFunctionsControl->entries[index]);
+
+		SpinLockAcquire(&entry->mutex);
+		entry->calls = 0;
+		entry->totalTime = 0;
+		entry->maxTime = 0;
+		entry->lockWaitTime = 0;
+		SpinLockRelease(&entry->mutex);
+	}
+
+	SpinLockAcquire(&StatFunctionsControl->mutex);
+	StatFunctionsControl->resetTime = GetCurrentTimestamp();
+	SpinLockRelease(&StatFunctionsControl->mutex);
+
+	PG_RETURN_VOID();
+}
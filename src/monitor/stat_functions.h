@@ -0,0 +1,78 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/stat_functions.h
+ *
+ * Declarations for public functions related to the statistics that the
+ * monitor keeps about the calls to its protocol functions.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "postgres.h"
+
+#include "fmgr.h"
+#include "portability/instr_time.h"
+
+
+/*
+ * The protocol functions for which we keep statistics. The names shown in
+ * pgautofailover.stat_functions are listed in the same order in
+ * stat_functions.c.
+ */
+typedef enum StatFunction
+{
+	STAT_FUNCTION_REGISTER_NODE = 0,
+	STAT_FUNCTION_NODE_ACTIVE,
+	STAT_FUNCTION_UPDATE_NODE_METADATA,
+	STAT_FUNCTION_GET_NODES,
+	STAT_FUNCTION_GET_PRIMARY,
+	STAT_FUNCTION_GET_OTHER_NODES,
+	STAT_FUNCTION_REMOVE_NODE_BY_NODEID,
+	STAT_FUNCTION_REMOVE_NODE_BY_HOST,
+	STAT_FUNCTION_PERFORM_FAILOVER,
+	STAT_FUNCTION_PERFORM_PROMOTION,
+	STAT_FUNCTION_START_MAINTENANCE,
+	STAT_FUNCTION_STOP_MAINTENANCE,
+	STAT_FUNCTION_SET_NODE_CANDIDATE_PRIORITY,
+	STAT_FUNCTION_SET_NODE_REPLICATION_QUORUM,
+	STAT_FUNCTION_SYNCHRONOUS_STANDBY_NAMES,
+	STAT_FUNCTION_CREATE_FORMATION,
+	STAT_FUNCTION_DROP_FORMATION,
+	STAT_FUNCTION_ENABLE_SECONDARY,
+	STAT_FUNCTION_DISABLE_SECONDARY,
+	STAT_FUNCTION_SET_FORMATION_NUMBER_SYNC_STANDBYS,
+	STAT_FUNCTION_GET_UPSTREAM,
+
+	STAT_FUNCTION_COUNT
+} StatFunction;
+
+
+/*
+ * TRACKED_FUNCTION defines the SQL callable function "name", which runs
+ * name_internal and counts the call in pgautofailover.stat_functions.
+ */
+#define TRACKED_FUNCTION(name, statFunction) \
+	static Datum name ## _internal(PG_FUNCTION_ARGS); \
+	Datum \
+	name(PG_FUNCTION_ARGS) \
+	{ \
+		return CallTrackedFunction(statFunction, name ## _internal, fcinfo); \
+	} \
+	extern int no_such_variable
+
+
+/* GUCs */
+extern bool TrackFunctions;
+
+
+extern size_t StatFunctionsShmemSize(void);
+extern void InitializeStatFunctions(void);
+extern Datum CallTrackedFunction(StatFunction statFunction,
+								 PGFunction function,
+								 FunctionCallInfo fcinfo);
+extern void CountLockWait(instr_time lockStartTime, bool formationLock);
@@ -0,0 +1,590 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/sync_standby_lag.c
+ *
+ * Implementation of the adaptive number of synchronous standby nodes. When
+ * pgautofailover.sync_standby_max_lag is set, the standby nodes of the
+ * replication quorum that lag behind the primary by more than that many
+ * bytes are registered in pgautofailover.lagging_standby, and are not
+ * counted anymore in the number of standby nodes that the primary waits for
+ * at commit time, until they catch up again.
+ *
+ * The keeper of the primary also reports the LSN positions of its standby
+ * nodes from pg_stat_replication in each node_active call, and we record them
+ * in pgautofailover.standby_lsn. That's fresher than the standby nodes own
+ * reports, which can be a full keeper loop interval old, and consistent with
+ * the LSN that the primary reports at the same time.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "formation_metadata.h"
+#include "metadata.h"
+#include "node_metadata.h"
+#include "notifications.h"
+#include "replication_state.h"
+#include "sync_standby_lag.h"
+
+#include "access/xlogdefs.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/pg_lsn.h"
+
+
+/* GUC variable, in bytes, zero disables the adaptive mode */
+int SyncStandbyMaxLag = 0;
+
+
+/* the flush LSN of a standby node as seen from the primary */
+typedef struct StandbyFlushLSN
+{
+	int64 nodeId;
+	XLogRecPtr flushLSN;
+} StandbyFlushLSN;
+
+
+static List * GetLaggingStandbyNodeIds(char *formationId, int groupId);
+static List * GetStandbyFlushLSNs(int64 primaryNodeId);
+static XLogRecPtr StandbyFlushLSNFromPrimary(AutoFailoverNode *node,
+											 List *standbyFlushLSNList);
+static bool NodeIdListMember(List *nodeIdList, int64 nodeId);
+static void SetLaggingStandby(AutoFailoverNode *node, bool lagging);
+static int CountNumberSyncStandbys(AutoFailoverFormation *formation,
+								   List *syncStandbyNodesList,
+								   List *laggingNodeIdList);
+
+
+/*
+ * EffectiveNumberSyncStandbys returns the number of synchronous standby
+ * nodes that the primary should wait for, among the given list of nodes that
+ * participate in the replication quorum.
+ *
+ * That's the formation number_sync_standbys, or one when it is set to zero,
+ * and in adaptive mode we don't count the lagging standby nodes when there
+ * are not enough of the others anymore. We never go below one though: the
+ * replication quorum nodes are there for durability.
+ */
+int
+EffectiveNumberSyncStandbys(AutoFailoverFormation *formation,
+							List *syncStandbyNodesList)
+{
+	AutoFailoverNode *firstNode = NULL;
+	List *laggingNodeIdList = NIL;
+
+	if (SyncStandbyMaxLag > 0 && syncStandbyNodesList != NIL)
+	{
+		firstNode = (AutoFailoverNode *) linitial(syncStandbyNodesList);
+		laggingNodeIdList =
+			GetLaggingStandbyNodeIds(firstNode->formationId, firstNode->groupId);
+	}
+
+	return CountNumberSyncStandbys(formation,
+								   syncStandbyNodesList,
+								   laggingNodeIdList);
+}
+
+
+/*
+ * UpdateLaggingSyncStandbys compares the reported LSN of the standby nodes of
+ * the replication quorum with the reported LSN of the primary, and registers
+ * the nodes that are lagging by more than pgautofailover.sync_standby_max_lag
+ * bytes. When the primary reported a more advanced flush LSN for a standby
+ * node than the standby itself did, we use that one. A lagging node is counted
+ * again when its lag is back to within half the threshold, so that we don't
+ * flap around the threshold.
+ *
+ * Returns true when the number of synchronous standby nodes that the primary
+ * should wait for has changed, and then the primary should be assigned the
+ * apply_settings goal state.
+ */
+bool
+UpdateLaggingSyncStandbys(AutoFailoverNode *primaryNode, List *standbyNodesList)
+{
+	AutoFailoverFormation *formation = GetFormation(primaryNode->formationId);
+	List *syncStandbyNodesList = GroupListSyncStandbys(standbyNodesList);
+	List *laggingNodeIdList =
+		GetLaggingStandbyNodeIds(primaryNode->formationId, primaryNode->groupId);
+	List *newLaggingNodeIdList = NIL;
+	ListCell *nodeCell = NULL;
+
+	/* in the common case, there's nothing to do */
+	if (SyncStandbyMaxLag == 0 && laggingNodeIdList == NIL)
+	{
+		return false;
+	}
+
+	int previousCount = CountNumberSyncStandbys(formation,
+												syncStandbyNodesList,
+												laggingNodeIdList);
+
+	List *standbyFlushLSNList =
+		SyncStandbyMaxLag > 0 ? GetStandbyFlushLSNs(primaryNode->nodeId) : NIL;
+
+	foreach(nodeCell, syncStandbyNodesList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+		bool wasLagging = NodeIdListMember(laggingNodeIdList, node->nodeId);
+		bool isLagging = wasLagging;
+
+		XLogRecPtr standbyLSN =
+			StandbyFlushLSNFromPrimary(node, standbyFlushLSNList);
+
+		uint64 lag =
+			primaryNode->reportedLSN > standbyLSN
+			? primaryNode->reportedLSN - standbyLSN
+			: 0;
+
+		if (SyncStandbyMaxLag == 0)
+		{
+			isLagging = false;
+		}
+		else if (IsCurrentState(node, REPLICATION_STATE_SECONDARY))
+		{
+			isLagging =
+				wasLagging
+				? lag > (uint64) SyncStandbyMaxLag / 2
+				: lag > (uint64) SyncStandbyMaxLag;
+		}
+
+		if (isLagging)
+		{
+			int64 *nodeId = palloc(sizeof(int64));
+
+			*nodeId = node->nodeId;
+			newLaggingNodeIdList = lappend(newLaggingNodeIdList, nodeId);
+		}
+
+		if (isLagging != wasLagging)
+		{
+			char message[BUFSIZE] = { 0 };
+
+			SetLaggingStandby(node, isLagging);
+
+			LogAndNotifyMessage(
+				message, BUFSIZE,
+				"%s " NODE_FORMAT
+				" in number_sync_standbys: its LSN %X/%X is "
+				UINT64_FORMAT " bytes behind the primary, "
+				"pgautofailover.sync_standby_max_lag is %d",
+				isLagging ? "Not counting" : "Counting again",
+				NODE_FORMAT_ARGS(node),
+				(uint32) (standbyLSN >> 32),
+				(uint32) standbyLSN,
+				lag,
+				SyncStandbyMaxLag);
+		}
+	}
+
+	/* forget about the nodes that left the replication quorum */
+	foreach(nodeCell, laggingNodeIdList)
+	{
+		int64 nodeId = *((int64 *) lfirst(nodeCell));
+		ListCell *syncCell = NULL;
+		bool found = false;
+
+		foreach(syncCell, syncStandbyNodesList)
+		{
+			AutoFailoverNode *node = (AutoFailoverNode *) lfirst(syncCell);
+
+			if (node->nodeId == nodeId)
+			{
+				found = true;
+				break;
+			}
+		}
+
+		if (!found)
+		{
+			AutoFailoverNode node = { 0 };
+
+			node.nodeId = nodeId;
+			SetLaggingStandby(&node, false);
+		}
+	}
+
+	int newCount = CountNumberSyncStandbys(formation,
+										   syncStandbyNodesList,
+										   newLaggingNodeIdList);
+
+	return previousCount != newCount;
+}
+
+
+/*
+ * CountNumberSyncStandbys implements EffectiveNumberSyncStandbys with the
+ * given list of lagging node ids.
+ */
+static int
+CountNumberSyncStandbys(AutoFailoverFormation *formation,
+						List *syncStandbyNodesList,
+						List *laggingNodeIdList)
+{
+	/*
+	 * We accept number_sync_standbys to be set to zero to enable our failover
+	 * trade-off, but won't send a synchronous_standby_names setting with ANY 0
+	 * () or FIRST 0 (), that would not make sense.
+	 */
+	int numberSyncStandbys =
+		formation->number_sync_standbys == 0
+		? 1
+		: formation->number_sync_standbys;
+
+	ListCell *nodeCell = NULL;
+	int upToDateCount = 0;
+
+	if (SyncStandbyMaxLag == 0)
+	{
+		return numberSyncStandbys;
+	}
+
+	foreach(nodeCell, syncStandbyNodesList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+		if (!NodeIdListMember(laggingNodeIdList, node->nodeId))
+		{
+			++upToDateCount;
+		}
+	}
+
+	return Max(1, Min(numberSyncStandbys, upToDateCount));
+}
+
+
+/*
+ * GetLaggingStandbyNodeIds returns the list of the ids of the nodes of the
+ * given group that are registered as lagging, as palloc'ed int64 values.
+ */
+static List *
+GetLaggingStandbyNodeIds(char *formationId, int groupId)
+{
+	List *nodeIdList = NIL;
+	MemoryContext callerContext = CurrentMemoryContext;
+
+	Oid argTypes[] = {
+		TEXTOID, /* formationid */
+		INT4OID  /* groupid */
+	};
+
+	Datum argValues[] = {
+		CStringGetTextDatum(formationId), /* formationid */
+		Int32GetDatum(groupId)            /* groupid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+	uint64 rowNumber = 0;
+
+	static MetadataPlan selectPlan = { 0 };
+
+	const char *selectQuery =
+		"SELECT lagging.nodeid FROM " AUTO_FAILOVER_LAGGING_STANDBY_TABLE
+		" AS lagging JOIN " AUTO_FAILOVER_NODE_TABLE " AS node"
+		" USING (nodeid) WHERE node.formationid = $1 AND node.groupid = $2";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&selectPlan, selectQuery,
+										argCount, argTypes, argValues,
+										NULL, false, 0);
+	if (spiStatus != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not select from " AUTO_FAILOVER_LAGGING_STANDBY_TABLE);
+	}
+
+	MemoryContext spiContext = MemoryContextSwitchTo(callerContext);
+
+	for (rowNumber = 0; rowNumber < SPI_processed; rowNumber++)
+	{
+		bool isNull = false;
+		Datum nodeIdDatum = SPI_getbinval(SPI_tuptable->vals[rowNumber],
+										  SPI_tuptable->tupdesc,
+										  1, &isNull);
+		int64 *nodeId = palloc(sizeof(int64));
+
+		*nodeId = DatumGetInt64(nodeIdDatum);
+		nodeIdList = lappend(nodeIdList, nodeId);
+	}
+
+	MemoryContextSwitchTo(spiContext);
+
+	SPI_finish();
+
+	return nodeIdList;
+}
+
+
+/*
+ * NodeIdListMember returns true when nodeId is found in nodeIdList.
+ */
+static bool
+NodeIdListMember(List *nodeIdList, int64 nodeId)
+{
+	ListCell *nodeIdCell = NULL;
+
+	foreach(nodeIdCell, nodeIdList)
+	{
+		if (*((int64 *) lfirst(nodeIdCell)) == nodeId)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * SetLaggingStandby registers the given node as lagging, or removes it from
+ * the lagging standby nodes.
+ */
+static void
+SetLaggingStandby(AutoFailoverNode *node, bool lagging)
+{
+	Oid argTypes[] = {
+		INT8OID  /* nodeid */
+	};
+
+	Datum argValues[] = {
+		Int64GetDatum(node->nodeId)  /* nodeid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan insertPlan = { 0 };
+	static MetadataPlan deletePlan = { 0 };
+
+	const char *insertQuery =
+		"INSERT INTO " AUTO_FAILOVER_LAGGING_STANDBY_TABLE
+		" (nodeid) VALUES ($1) ON CONFLICT DO NOTHING";
+
+	const char *deleteQuery =
+		"DELETE FROM " AUTO_FAILOVER_LAGGING_STANDBY_TABLE
+		" WHERE nodeid = $1";
+
+	SPI_connect();
+
+	int spiStatus =
+		lagging
+		? ExecuteMetadataPlan(&insertPlan, insertQuery,
+							  argCount, argTypes, argValues,
+							  NULL, false, 0)
+		: ExecuteMetadataPlan(&deletePlan, deleteQuery,
+							  argCount, argTypes, argValues,
+							  NULL, false, 0);
+
+	if (spiStatus != (lagging ? SPI_OK_INSERT : SPI_OK_DELETE))
+	{
+		elog(ERROR, "could not update " AUTO_FAILOVER_LAGGING_STANDBY_TABLE);
+	}
+
+	SPI_finish();
+}
+
+
+/*
+ * InitStandbyLSNReport initializes a StandbyLSNReport from the arrays given
+ * to node_active, and checks that they all have the same number of entries.
+ */
+void
+InitStandbyLSNReport(StandbyLSNReport *report,
+					 ArrayType *nodeIds,
+					 ArrayType *writeLSNs,
+					 ArrayType *flushLSNs,
+					 ArrayType *replayLSNs)
+{
+	ArrayType *arrays[] = { nodeIds, writeLSNs, flushLSNs, replayLSNs };
+	int count = ArrayGetNItems(ARR_NDIM(nodeIds), ARR_DIMS(nodeIds));
+
+	for (int i = 0; i < lengthof(arrays); i++)
+	{
+		if (ARR_NDIM(arrays[i]) > 1 ||
+			ARR_HASNULL(arrays[i]) ||
+			ArrayGetNItems(ARR_NDIM(arrays[i]), ARR_DIMS(arrays[i])) != count)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("standby node ids and LSN arrays must be "
+							"one-dimensional arrays of the same length, "
+							"without NULL entries")));
+		}
+	}
+
+	report->count = count;
+	report->nodeIds = nodeIds;
+	report->writeLSNs = writeLSNs;
+	report->flushLSNs = flushLSNs;
+	report->replayLSNs = replayLSNs;
+}
+
+
+/*
+ * RecordStandbyLSNReport records the LSN positions of the standby nodes as
+ * reported by the given primary node, and forgets about the standby nodes
+ * that are not connected to this primary anymore.
+ */
+void
+RecordStandbyLSNReport(int64 primaryNodeId, StandbyLSNReport *report)
+{
+	Oid lsnArrayOid = get_array_type(LSNOID);
+
+	Oid argTypes[] = {
+		INT8OID,      /* primarynodeid */
+		INT8ARRAYOID, /* standby node ids */
+		lsnArrayOid,  /* write LSNs */
+		lsnArrayOid,  /* flush LSNs */
+		lsnArrayOid   /* replay LSNs */
+	};
+
+	Datum argValues[] = {
+		Int64GetDatum(primaryNodeId),           /* primarynodeid */
+		PointerGetDatum(report->nodeIds),       /* standby node ids */
+		PointerGetDatum(report->writeLSNs),     /* write LSNs */
+		PointerGetDatum(report->flushLSNs),     /* flush LSNs */
+		PointerGetDatum(report->replayLSNs)     /* replay LSNs */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+
+	static MetadataPlan upsertPlan = { 0 };
+	static MetadataPlan deletePlan = { 0 };
+
+	const char *upsertQuery =
+		"INSERT INTO " AUTO_FAILOVER_STANDBY_LSN_TABLE
+		" (nodeid, primarynodeid, reporttime, writelsn, flushlsn, replaylsn)"
+		" SELECT standby.nodeid, $1, now(),"
+		"        standby.writelsn, standby.flushlsn, standby.replaylsn"
+		"   FROM unnest($2, $3, $4, $5)"
+		"     AS standby(nodeid, writelsn, flushlsn, replaylsn)"
+		"   JOIN " AUTO_FAILOVER_NODE_TABLE " AS node"
+		"     ON node.nodeid = standby.nodeid"
+		"  WHERE standby.nodeid <> $1"
+		" ON CONFLICT (nodeid) DO UPDATE"
+		"    SET primarynodeid = excluded.primarynodeid,"
+		"        reporttime = excluded.reporttime,"
+		"        writelsn = excluded.writelsn,"
+		"        flushlsn = excluded.flushlsn,"
+		"        replaylsn = excluded.replaylsn";
+
+	const char *deleteQuery =
+		"DELETE FROM " AUTO_FAILOVER_STANDBY_LSN_TABLE
+		" WHERE primarynodeid = $1 AND NOT (nodeid = ANY($2))";
+
+	SPI_connect();
+
+	if (report->count > 0)
+	{
+		int spiStatus = ExecuteMetadataPlan(&upsertPlan, upsertQuery,
+											argCount, argTypes, argValues,
+											NULL, false, 0);
+
+		if (spiStatus != SPI_OK_INSERT)
+		{
+			elog(ERROR, "could not update " AUTO_FAILOVER_STANDBY_LSN_TABLE);
+		}
+	}
+
+	int spiStatus = ExecuteMetadataPlan(&deletePlan, deleteQuery,
+										2, argTypes, argValues,
+										NULL, false, 0);
+
+	if (spiStatus != SPI_OK_DELETE)
+	{
+		elog(ERROR, "could not update " AUTO_FAILOVER_STANDBY_LSN_TABLE);
+	}
+
+	SPI_finish();
+}
+
+
+/*
+ * GetStandbyFlushLSNs returns the list of the flush LSN of the standby nodes
+ * as last reported by the given primary node, as palloc'ed StandbyFlushLSN
+ * values.
+ */
+static List *
+GetStandbyFlushLSNs(int64 primaryNodeId)
+{
+	List *standbyFlushLSNList = NIL;
+	MemoryContext callerContext = CurrentMemoryContext;
+
+	Oid argTypes[] = {
+		INT8OID  /* primarynodeid */
+	};
+
+	Datum argValues[] = {
+		Int64GetDatum(primaryNodeId)  /* primarynodeid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+	uint64 rowNumber = 0;
+
+	static MetadataPlan selectPlan = { 0 };
+
+	const char *selectQuery =
+		"SELECT nodeid, flushlsn FROM " AUTO_FAILOVER_STANDBY_LSN_TABLE
+		" WHERE primarynodeid = $1";
+
+	SPI_connect();
+
+	int spiStatus = ExecuteMetadataPlan(&selectPlan, selectQuery,
+										argCount, argTypes, argValues,
+										NULL, true, 0);
+	if (spiStatus != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not select from " AUTO_FAILOVER_STANDBY_LSN_TABLE);
+	}
+
+	MemoryContext spiContext = MemoryContextSwitchTo(callerContext);
+
+	for (rowNumber = 0; rowNumber < SPI_processed; rowNumber++)
+	{
+		bool isNull = false;
+		StandbyFlushLSN *standbyFlushLSN = palloc0(sizeof(StandbyFlushLSN));
+
+		Datum nodeIdDatum = SPI_getbinval(SPI_tuptable->vals[rowNumber],
+										  SPI_tuptable->tupdesc,
+										  1, &isNull);
+		Datum flushLSNDatum = SPI_getbinval(SPI_tuptable->vals[rowNumber],
+											SPI_tuptable->tupdesc,
+											2, &isNull);
+
+		standbyFlushLSN->nodeId = DatumGetInt64(nodeIdDatum);
+		standbyFlushLSN->flushLSN = DatumGetLSN(flushLSNDatum);
+
+		standbyFlushLSNList = lappend(standbyFlushLSNList, standbyFlushLSN);
+	}
+
+	MemoryContextSwitchTo(spiContext);
+
+	SPI_finish();
+
+	return standbyFlushLSNList;
+}
+
+
+/*
+ * StandbyFlushLSNFromPrimary returns the most advanced of the LSN reported by
+ * the given standby node and of its flush LSN as seen from the primary. Both
+ * are lower bounds of the WAL that the standby has received already.
+ */
+static XLogRecPtr
+StandbyFlushLSNFromPrimary(AutoFailoverNode *node, List *standbyFlushLSNList)
+{
+	ListCell *lsnCell = NULL;
+
+	foreach(lsnCell, standbyFlushLSNList)
+	{
+		StandbyFlushLSN *standbyFlushLSN = (StandbyFlushLSN *) lfirst(lsnCell);
+
+		if (standbyFlushLSN->nodeId == node->nodeId)
+		{
+			return Max(node->reportedLSN, standbyFlushLSN->flushLSN);
+		}
+	}
+
+	return node->reportedLSN;
+}
@@ -0,0 +1,54 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/sync_standby_lag.h
+ *
+ * Declarations for public functions related to the adaptive number of
+ * synchronous standby nodes that a primary waits for.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "formation_metadata.h"
+#include "node_metadata.h"
+
+#include "utils/array.h"
+
+#define AUTO_FAILOVER_LAGGING_STANDBY_TABLE "pgautofailover.lagging_standby"
+#define AUTO_FAILOVER_STANDBY_LSN_TABLE "pgautofailover.standby_lsn"
+
+
+/*
+ * StandbyLSNReport holds the LSN positions of the standby nodes as seen from
+ * pg_stat_replication on the primary, as sent by its keeper to node_active.
+ * The arrays have one entry per standby node, in the same order.
+ */
+typedef struct StandbyLSNReport
+{
+	int count;
+	ArrayType *nodeIds;         /* bigint[] */
+	ArrayType *writeLSNs;       /* pg_lsn[] */
+	ArrayType *flushLSNs;       /* pg_lsn[] */
+	ArrayType *replayLSNs;      /* pg_lsn[] */
+} StandbyLSNReport;
+
+
+/* public function declarations */
+extern int EffectiveNumberSyncStandbys(AutoFailoverFormation *formation,
+									   List *syncStandbyNodesList);
+extern bool UpdateLaggingSyncStandbys(AutoFailoverNode *primaryNode,
+									  List *standbyNodesList);
+extern void InitStandbyLSNReport(StandbyLSNReport *report,
+								 ArrayType *nodeIds,
+								 ArrayType *writeLSNs,
+								 ArrayType *flushLSNs,
+								 ArrayType *replayLSNs);
+extern void RecordStandbyLSNReport(int64 primaryNodeId,
+								   StandbyLSNReport *report);
+
+/* GUCs */
+extern int SyncStandbyMaxLag;
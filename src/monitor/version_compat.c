@@ -11,57 +11,71 @@
 
 #include "postgres.h"
 
-#if (PG_VERSION_NUM < 110000)
+#if (PG_VERSION_NUM < 150000)
 
 /*
- * The list_qsort API was introduced in Postgres 11:
- *
- * https://git.postgresql.org/gitweb/?p=postgresql.git;a=commit;h=ab72716778128fb63d54ac256adf7fe6820a1185
+ * The InitMaterializedSRF API was introduced in Postgres 15, this is a copy
+ * of its implementation so that our set-returning functions can use the
+ * materialize mode with older versions too.
  */
 
-#include "nodes/pg_list.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/tuplestore.h"
 #include "version_compat.h"
 
-/*
- * Sort a list using qsort. A sorted list is built but the cells of the
- * original list are re-used.  The comparator function receives arguments of
- * type ListCell **
- */
-List *
-list_qsort(const List *list, list_qsort_comparator cmp)
+void
+InitMaterializedSRF(FunctionCallInfo fcinfo, bits32 flags)
 {
-	ListCell *cell;
-	int i;
-	int len = list_length(list);
-	ListCell **list_arr;
-	List *new_list;
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc storedTupleDesc;
 
-	if (len == 0)
+	/* check to see if caller supports returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
 	{
-		return NIL;
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that "
+						"cannot accept a set")));
 	}
 
-	i = 0;
-	list_arr = palloc(sizeof(ListCell *) * len);
-	foreach(cell, list)
-		list_arr[i++] = cell;
+	if (!(rsinfo->allowedModes & SFRM_Materialize) ||
+		((flags & MAT_SRF_USE_EXPECTED_DESC) != 0 &&
+		 rsinfo->expectedDesc == NULL))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+	}
 
-	qsort(list_arr, len, sizeof(ListCell *), cmp);
+	/* the tuplestore must live as long as the query */
+	MemoryContext perQueryContext = rsinfo->econtext->ecxt_per_query_memory;
+	MemoryContext oldContext = MemoryContextSwitchTo(perQueryContext);
 
-	new_list = (List *) palloc(sizeof(List));
-	new_list->type = list->type;
-	new_list->length = len;
-	new_list->head = list_arr[0];
-	new_list->tail = list_arr[len - 1];
+	if ((flags & MAT_SRF_USE_EXPECTED_DESC) != 0)
+	{
+		storedTupleDesc = CreateTupleDescCopy(rsinfo->expectedDesc);
+	}
+	else if (get_call_result_type(fcinfo, NULL, &storedTupleDesc) !=
+			 TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR, (errmsg("return type must be a row type")));
+	}
 
-	for (i = 0; i < len - 1; i++)
+	if ((flags & MAT_SRF_BLESS) != 0)
 	{
-		list_arr[i]->next = list_arr[i + 1];
+		BlessTupleDesc(storedTupleDesc);
 	}
 
-	list_arr[len - 1]->next = NULL;
-	pfree(list_arr);
-	return new_list;
+	bool randomAccess = (rsinfo->allowedModes & SFRM_Materialize_Random) != 0;
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tuplestore_begin_heap(randomAccess, false, work_mem);
+	rsinfo->setDesc = storedTupleDesc;
+
+	MemoryContextSwitchTo(oldContext);
 }
 
 
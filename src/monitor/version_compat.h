@@ -14,31 +14,15 @@
 
 #include "postgres.h"
 
-/* we support Postgres versions 10, 11, 12, 13, and 14. And 15devel. */
-#if (PG_VERSION_NUM < 100000 || PG_VERSION_NUM >= 160000)
+/*
+ * The monitor supports Postgres versions 11, 12, 13, 14, and 15. Postgres 10
+ * lacks features that our schema uses, such as the primary key and default
+ * partition of the partitioned pgautofailover.event table.
+ */
+#if (PG_VERSION_NUM < 110000 || PG_VERSION_NUM >= 160000)
 #error "Unknown or unsupported postgresql version"
 #endif
 
-#if (PG_VERSION_NUM < 110000)
-
-#include "postmaster/bgworker.h"
-#include "utils/memutils.h"
-
-#define DEFAULT_XLOG_SEG_SIZE XLOG_SEG_SIZE
-
-#define BackgroundWorkerInitializeConnection(dbname, username, flags) \
-	BackgroundWorkerInitializeConnection(dbname, username)
-
-#define BackgroundWorkerInitializeConnectionByOid(dboid, useroid, flags) \
-	BackgroundWorkerInitializeConnectionByOid(dboid, useroid)
-
-#include "nodes/pg_list.h"
-
-typedef int (*list_qsort_comparator) (const void *a, const void *b);
-extern List * list_qsort(const List *list, list_qsort_comparator cmp);
-
-#endif
-
 #if (PG_VERSION_NUM < 120000)
 
 #define table_beginscan_catalog heap_beginscan_catalog
@@ -77,4 +61,16 @@ HeapTupleGetOid(HeapTuple tuple)
 
 #endif
 
+#if (PG_VERSION_NUM < 150000)
+
+#include "fmgr.h"
+
+/* see InitMaterializedSRF in Postgres 15 funcapi.h */
+#define MAT_SRF_USE_EXPECTED_DESC 0x01
+#define MAT_SRF_BLESS 0x02
+
+extern void InitMaterializedSRF(FunctionCallInfo fcinfo, bits32 flags);
+
+#endif
+
 #endif   /* VERSION_COMPAT_H */
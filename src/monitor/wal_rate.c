@@ -0,0 +1,549 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/wal_rate.c
+ *
+ * Implementation of the tracking of the rate at which the nodes report WAL
+ * progress to the monitor.
+ *
+ * Each call to node_active reports the current LSN of a node. We keep the
+ * last WAL_RATE_SAMPLES reports of each node in shared memory, which gives
+ * the WAL generation rate of a primary node, and the rate at which a standby
+ * node receives WAL. From those rates we predict how long a standby node
+ * needs to catch up with another node.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <math.h>
+
+/* these are internal headers */
+#include "metadata.h"
+#include "node_metadata.h"
+#include "version_compat.h"
+#include "wal_rate.h"
+
+#include "access/htup_details.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+
+
+/*
+ * We keep samples for up to WAL_RATE_MAX_NODES nodes: the rates of other
+ * nodes are unknown, and then catch-up time predictions are not used.
+ */
+#define WAL_RATE_MAX_NODES 1024
+#define WAL_RATE_SAMPLES 16
+
+#define WAL_RATES_COLUMNS 3
+
+
+typedef struct WalRateKey
+{
+	Oid dboid;
+	int64 nodeId;
+} WalRateKey;
+
+typedef struct WalSample
+{
+	XLogRecPtr lsn;
+	TimestampTz time;
+} WalSample;
+
+/*
+ * WalRateEntry is a ring buffer of the last reports of a node, where next is
+ * the position of the next sample to write.
+ */
+typedef struct WalRateEntry
+{
+	WalRateKey key;
+	int count;
+	int next;
+	WalSample samples[WAL_RATE_SAMPLES];
+} WalRateEntry;
+
+typedef struct WalRateControlData
+{
+	int trancheId;
+	char *lockTrancheName;
+	LWLock lock;
+} WalRateControlData;
+
+typedef struct WalRateResult
+{
+	int64 nodeId;
+	bool hasRate;
+	double rate;
+	bool hasCatchUpTime;
+	double catchUpTime;
+} WalRateResult;
+
+
+/* GUC variables */
+int MaxCatchUpTimeMs = 0;
+
+static WalRateControlData *WalRateControl = NULL;
+static HTAB *WalRateHash = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+
+PG_FUNCTION_INFO_V1(wal_rates);
+
+static void WalRateShmemInit(void);
+static void BuildWalRateKey(Oid databaseId, int64 nodeId, WalRateKey *key);
+
+
+/*
+ * InitializeWalRate, called at server start, requests the shared memory
+ * needed to keep the WAL reports samples.
+ */
+void
+InitializeWalRate(void)
+{
+	/* on PG 15, we use shmem_request_hook_type */
+#if PG_VERSION_NUM < 150000
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(WalRateShmemSize());
+	}
+#endif
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = WalRateShmemInit;
+}
+
+
+/*
+ * WalRateShmemSize computes how much shared memory the WAL samples need.
+ */
+size_t
+WalRateShmemSize(void)
+{
+	Size size = sizeof(WalRateControlData);
+
+	size = add_size(size, hash_estimate_size(WAL_RATE_MAX_NODES,
+											 sizeof(WalRateEntry)));
+
+	return size;
+}
+
+
+/*
+ * WalRateShmemInit initializes the shared memory of the WAL samples.
+ */
+static void
+WalRateShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	HASHCTL hashInfo;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	WalRateControl =
+		(WalRateControlData *) ShmemInitStruct("pg_auto_failover WAL Rates",
+											   sizeof(WalRateControlData),
+											   &alreadyInitialized);
+
+	/*
+	 * Might already be initialized on EXEC_BACKEND type platforms that call
+	 * shared library initialization functions in every backend.
+	 */
+	if (!alreadyInitialized)
+	{
+		WalRateControl->trancheId = LWLockNewTrancheId();
+		WalRateControl->lockTrancheName = "pg_auto_failover WAL Rates";
+		LWLockRegisterTranche(WalRateControl->trancheId,
+							  WalRateControl->lockTrancheName);
+
+		LWLockInitialize(&WalRateControl->lock, WalRateControl->trancheId);
+	}
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(WalRateKey);
+	hashInfo.entrysize = sizeof(WalRateEntry);
+
+	WalRateHash = ShmemInitHash("pg_auto_failover WAL Rates Hash",
+								WAL_RATE_MAX_NODES,
+								WAL_RATE_MAX_NODES,
+								&hashInfo,
+								HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/*
+ * RecordWalReport adds the LSN reported by the given node to its samples.
+ *
+ * When the LSN goes backwards, the node has been rewound or is following
+ * another timeline, and the previous samples are not relevant anymore.
+ */
+void
+RecordWalReport(int64 nodeId, XLogRecPtr reportedLSN, TimestampTz reportTime)
+{
+	WalRateKey key;
+	bool found = false;
+
+	if (WalRateControl == NULL || reportedLSN == InvalidXLogRecPtr)
+	{
+		return;
+	}
+
+	BuildWalRateKey(MyDatabaseId, nodeId, &key);
+
+	LWLockAcquire(&WalRateControl->lock, LW_EXCLUSIVE);
+
+	WalRateEntry *entry =
+		(WalRateEntry *) hash_search(WalRateHash, &key, HASH_ENTER_NULL, &found);
+
+	if (entry == NULL)
+	{
+		LWLockRelease(&WalRateControl->lock);
+		return;
+	}
+
+	if (!found)
+	{
+		entry->count = 0;
+		entry->next = 0;
+	}
+
+	if (entry->count > 0)
+	{
+		int last = (entry->next + WAL_RATE_SAMPLES - 1) % WAL_RATE_SAMPLES;
+		WalSample *lastSample = &(entry->samples[last]);
+
+		if (reportedLSN < lastSample->lsn)
+		{
+			entry->count = 0;
+			entry->next = 0;
+		}
+		else if (reportTime <= lastSample->time)
+		{
+			LWLockRelease(&WalRateControl->lock);
+			return;
+		}
+	}
+
+	entry->samples[entry->next].lsn = reportedLSN;
+	entry->samples[entry->next].time = reportTime;
+
+	entry->next = (entry->next + 1) % WAL_RATE_SAMPLES;
+
+	if (entry->count < WAL_RATE_SAMPLES)
+	{
+		++(entry->count);
+	}
+
+	LWLockRelease(&WalRateControl->lock);
+}
+
+
+/*
+ * RemoveWalRates removes the samples of the given node from the shared
+ * memory. When nodeId is zero, the samples of all the nodes of the given
+ * database are removed.
+ */
+void
+RemoveWalRates(Oid databaseId, int64 nodeId)
+{
+	if (WalRateControl == NULL)
+	{
+		return;
+	}
+
+	LWLockAcquire(&WalRateControl->lock, LW_EXCLUSIVE);
+
+	if (nodeId > 0)
+	{
+		WalRateKey key;
+
+		BuildWalRateKey(databaseId, nodeId, &key);
+
+		(void) hash_search(WalRateHash, &key, HASH_REMOVE, NULL);
+	}
+	else
+	{
+		HASH_SEQ_STATUS status;
+		WalRateEntry *entry = NULL;
+
+		hash_seq_init(&status, WalRateHash);
+
+		while ((entry = (WalRateEntry *) hash_seq_search(&status)) != NULL)
+		{
+			if (entry->key.dboid == databaseId)
+			{
+				(void) hash_search(WalRateHash, &(entry->key),
+								   HASH_REMOVE, NULL);
+			}
+		}
+	}
+
+	LWLockRelease(&WalRateControl->lock);
+}
+
+
+/*
+ * GetWalRate computes the rate at which the given node has been making WAL
+ * progress, in bytes per second, from its oldest and newest samples. It
+ * returns false when we don't have enough samples to compute a rate.
+ */
+bool
+GetWalRate(int64 nodeId, double *bytesPerSecond)
+{
+	WalRateKey key;
+	bool found = false;
+
+	if (WalRateControl == NULL)
+	{
+		return false;
+	}
+
+	BuildWalRateKey(MyDatabaseId, nodeId, &key);
+
+	LWLockAcquire(&WalRateControl->lock, LW_SHARED);
+
+	WalRateEntry *entry =
+		(WalRateEntry *) hash_search(WalRateHash, &key, HASH_FIND, &found);
+
+	if (!found || entry->count < 2)
+	{
+		LWLockRelease(&WalRateControl->lock);
+		return false;
+	}
+
+	int oldest = (entry->next + WAL_RATE_SAMPLES - entry->count) % WAL_RATE_SAMPLES;
+	int newest = (entry->next + WAL_RATE_SAMPLES - 1) % WAL_RATE_SAMPLES;
+
+	WalSample oldestSample = entry->samples[oldest];
+	WalSample newestSample = entry->samples[newest];
+
+	LWLockRelease(&WalRateControl->lock);
+
+	/* TimestampTz is in microseconds */
+	double elapsedSeconds =
+		(double) (newestSample.time - oldestSample.time) / 1000000.0;
+
+	if (elapsedSeconds <= 0)
+	{
+		return false;
+	}
+
+	*bytesPerSecond =
+		(double) (newestSample.lsn - oldestSample.lsn) / elapsedSeconds;
+
+	return true;
+}
+
+
+/*
+ * PredictCatchUpTime computes how many seconds the given node needs to reach
+ * the target LSN, when the target is itself moving forward at targetRate
+ * bytes per second. A node that is not closing the gap is predicted to never
+ * catch up, and then seconds is set to infinity.
+ *
+ * It returns false when the rate of the node is unknown.
+ */
+bool
+PredictCatchUpTime(AutoFailoverNode *node, XLogRecPtr targetLSN,
+				   double targetRate, double *seconds)
+{
+	double rate = 0;
+
+	if (node->reportedLSN >= targetLSN)
+	{
+		*seconds = 0;
+		return true;
+	}
+
+	if (!GetWalRate(node->nodeId, &rate))
+	{
+		return false;
+	}
+
+	double closingRate = rate - targetRate;
+	XLogRecPtr lag = targetLSN - node->reportedLSN;
+
+	*seconds = closingRate > 0 ? (double) lag / closingRate : INFINITY;
+
+	return true;
+}
+
+
+/*
+ * CatchUpTimeExceeds returns true when the given node is predicted to need
+ * more than maxTimeMs milliseconds to catch up with the target node. When the
+ * target node is writing, it's a primary node and we take into account its
+ * WAL generation rate.
+ *
+ * When maxTimeMs is zero, or when we lack the samples to compute a
+ * prediction, we return false: the prediction is then not used.
+ */
+bool
+CatchUpTimeExceeds(AutoFailoverNode *node, AutoFailoverNode *targetNode,
+				   bool targetIsWriting, int maxTimeMs)
+{
+	double targetRate = 0;
+	double seconds = 0;
+
+	if (maxTimeMs <= 0 || node == NULL || targetNode == NULL)
+	{
+		return false;
+	}
+
+	if (targetIsWriting && !GetWalRate(targetNode->nodeId, &targetRate))
+	{
+		return false;
+	}
+
+	if (!PredictCatchUpTime(node, targetNode->reportedLSN, targetRate, &seconds))
+	{
+		return false;
+	}
+
+	return seconds * 1000.0 > (double) maxTimeMs;
+}
+
+
+/*
+ * BuildWalRateKey prepares the hash key for the given node.
+ */
+static void
+BuildWalRateKey(Oid databaseId, int64 nodeId, WalRateKey *key)
+{
+	memset(key, 0, sizeof(WalRateKey));
+
+	key->dboid = databaseId;
+	key->nodeId = nodeId;
+}
+
+
+/*
+ * wal_rates returns, for each node of the given formation, the rate at which
+ * it has been making WAL progress recently, in bytes per second, and for the
+ * standby nodes the predicted time to catch up with the primary node of their
+ * group, in seconds.
+ */
+Datum
+wal_rates(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+
+	checkPgAutoFailoverVersion();
+
+	/* stuff done only on the first call of the function */
+	if (SRF_IS_FIRSTCALL())
+	{
+		text *formationIdText = PG_GETARG_TEXT_P(0);
+		char *formationId = text_to_cstring(formationIdText);
+		List *resultList = NIL;
+		ListCell *nodeCell = NULL;
+
+		/* create a function context for cross-call persistence */
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		MemoryContext oldcontext =
+			MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		List *nodesList = AllAutoFailoverNodes(formationId);
+
+		foreach(nodeCell, nodesList)
+		{
+			AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+			AutoFailoverNode *primaryNode = NULL;
+			ListCell *otherNodeCell = NULL;
+			double primaryRate = 0;
+
+			WalRateResult *result = palloc0(sizeof(WalRateResult));
+
+			result->nodeId = node->nodeId;
+			result->hasRate = GetWalRate(node->nodeId, &(result->rate));
+
+			foreach(otherNodeCell, nodesList)
+			{
+				AutoFailoverNode *otherNode =
+					(AutoFailoverNode *) lfirst(otherNodeCell);
+
+				if (otherNode->groupId == node->groupId &&
+					otherNode->nodeId != node->nodeId &&
+					IsInPrimaryState(otherNode))
+				{
+					primaryNode = otherNode;
+					break;
+				}
+			}
+
+			if (primaryNode != NULL &&
+				!IsInPrimaryState(node) &&
+				GetWalRate(primaryNode->nodeId, &primaryRate))
+			{
+				result->hasCatchUpTime =
+					PredictCatchUpTime(node,
+									   primaryNode->reportedLSN,
+									   primaryRate,
+									   &(result->catchUpTime));
+			}
+
+			resultList = lappend(resultList, result);
+		}
+
+		funcctx->user_fctx = resultList;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	/* stuff done on every call of the function */
+	funcctx = SRF_PERCALL_SETUP();
+
+	List *resultList = (List *) funcctx->user_fctx;
+
+	if (resultList != NIL)
+	{
+		TupleDesc resultDescriptor = NULL;
+		Datum values[WAL_RATES_COLUMNS];
+		bool isNulls[WAL_RATES_COLUMNS];
+
+		WalRateResult *result = (WalRateResult *) linitial(resultList);
+
+		memset(values, 0, sizeof(values));
+		memset(isNulls, false, sizeof(isNulls));
+
+		values[0] = Int64GetDatum(result->nodeId);
+		values[1] = Float8GetDatum(result->rate);
+		values[2] = Float8GetDatum(result->catchUpTime);
+
+		isNulls[1] = !result->hasRate;
+		isNulls[2] = !result->hasCatchUpTime;
+
+		TypeFuncClass resultTypeClass = get_call_result_type(fcinfo, NULL,
+															 &resultDescriptor);
+		if (resultTypeClass != TYPEFUNC_COMPOSITE)
+		{
+			ereport(ERROR, (errmsg("return type must be a row type")));
+		}
+
+		HeapTuple resultTuple = heap_form_tuple(resultDescriptor, values, isNulls);
+		Datum resultDatum = HeapTupleGetDatum(resultTuple);
+
+		/* prepare next SRF call */
+		funcctx->user_fctx = list_delete_first(resultList);
+
+		SRF_RETURN_NEXT(funcctx, PointerGetDatum(resultDatum));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
@@ -0,0 +1,41 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/wal_rate.h
+ *
+ * Declarations for public functions related to the tracking of the rate at
+ * which the nodes report WAL progress.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "postgres.h"
+
+#include "access/xlogdefs.h"
+#include "utils/timestamp.h"
+
+#include "node_metadata.h"
+
+
+/* GUCs */
+extern int MaxCatchUpTimeMs;
+
+
+extern size_t WalRateShmemSize(void);
+extern void InitializeWalRate(void);
+extern void RecordWalReport(int64 nodeId, XLogRecPtr reportedLSN,
+							TimestampTz reportTime);
+extern void RemoveWalRates(Oid databaseId, int64 nodeId);
+extern bool GetWalRate(int64 nodeId, double *bytesPerSecond);
+extern bool PredictCatchUpTime(AutoFailoverNode *node,
+							   XLogRecPtr targetLSN,
+							   double targetRate,
+							   double *seconds);
+extern bool CatchUpTimeExceeds(AutoFailoverNode *node,
+							   AutoFailoverNode *targetNode,
+							   bool targetIsWriting,
+							   int maxTimeMs);
@@ -21,6 +21,32 @@ PGVERSION = os.getenv("PGVERSION", "11")
 
 NodeState = namedtuple("NodeState", "reported assigned")
 
+
+def process_tree(pid):
+    """
+    Returns the given pid and the pids of all its descendants, by scanning
+    /proc. Processes that exit while we're scanning are skipped.
+    """
+    children = {}
+
+    for entry in os.listdir("/proc"):
+        if not entry.isdigit():
+            continue
+        try:
+            with open(f"/proc/{entry}/stat") as stat:
+                # the command name is in parens and may contain spaces
+                fields = stat.read().rsplit(")", 1)[1].split()
+                children.setdefault(int(fields[1]), []).append(int(entry))
+        except (FileNotFoundError, ProcessLookupError, IndexError):
+            pass
+
+    pids = [pid]
+    for p in pids:
+        pids += children.get(p, [])
+
+    return pids
+
+
 # Append stderr output to default CalledProcessError message
 class CalledProcessError(subprocess.CalledProcessError):
     def __str__(self):
@@ -562,6 +588,54 @@ class PGNode(QueryRunner):
         if self.pg_is_running():
             self.stop_postgres()
 
+    def crash(self):
+        """
+        Simulates a machine crash by sending SIGKILL to pg_autoctl and to all
+        of its sub-processes, Postgres included, so that nothing gets a chance
+        to clean-up or to tell the monitor.
+        """
+        if not self.running():
+            return
+
+        for pid in process_tree(self.pg_autoctl.run_proc.pid):
+            try:
+                os.kill(pid, signal.SIGKILL)
+            except ProcessLookupError:
+                pass
+
+        # reap the pg_autoctl process
+        self.pg_autoctl.communicate(COMMAND_TIMEOUT)
+
+    def postmaster_pid(self):
+        """
+        Returns the pid of the Postgres postmaster from its pidfile.
+        """
+        with open(os.path.join(self.datadir, "postmaster.pid")) as pidfile:
+            return int(pidfile.readline())
+
+    def stall(self):
+        """
+        Simulates a disk stall by sending SIGSTOP to every Postgres process:
+        connections are accepted by the kernel and then hang, and pg_autoctl
+        keeps running. Returns the list of stopped pids, for resume().
+        """
+        pids = process_tree(self.postmaster_pid())
+
+        for pid in pids:
+            os.kill(pid, signal.SIGSTOP)
+
+        return pids
+
+    def resume(self, pids):
+        """
+        Resumes the processes that stall() stopped.
+        """
+        for pid in pids:
+            try:
+                os.kill(pid, signal.SIGCONT)
+            except ProcessLookupError:
+                pass
+
     def config_file_path(self):
         """
         Returns the path of the config file for this data node.
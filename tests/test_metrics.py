@@ -0,0 +1,152 @@
+import tests.pgautofailover_utils as pgautofailover
+from nose.tools import eq_
+
+import http.client
+import time
+
+cluster = None
+monitor = None
+node1 = None
+node2 = None
+
+METRICS_PORT = 9187
+
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+
+def teardown_module():
+    cluster.destroy()
+
+
+def http_request(node, method, path):
+    """
+    Sends an HTTP request to the metrics service of the given node, and
+    returns the status code and body of the response.
+    """
+    address = str(node.vnode.address)
+
+    for attempt in range(10):
+        try:
+            c = http.client.HTTPConnection(address, METRICS_PORT, timeout=5)
+            c.request(method, path)
+            r = c.getresponse()
+            body = r.read().decode("utf-8")
+            c.close()
+            return r.status, body
+
+        except ConnectionRefusedError:
+            # the metrics service might not be listening yet
+            time.sleep(1)
+
+    raise Exception("Failed to connect to the metrics service")
+
+
+def get_metric(body, name):
+    for line in body.splitlines():
+        if line.startswith(name + " "):
+            return line[len(name) + 1 :]
+    return None
+
+
+def get_count(body, name):
+    return int(get_metric(body, name + "_count"))
+
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/metrics/monitor")
+    monitor.run()
+
+
+def test_001_init_primary():
+    global node1
+    node1 = cluster.create_datanode("/tmp/metrics/node1")
+    node1.create()
+
+    node1.config_set("metrics.port", str(METRICS_PORT))
+    node1.config_set("metrics.listen_address", str(node1.vnode.address))
+
+    node1.run()
+    assert node1.wait_until_state(target_state="single")
+
+
+def test_002_metrics():
+    status, body = http_request(node1, "GET", "/metrics")
+    print(body)
+
+    eq_(status, 200)
+
+    nodeid = node1.get_nodeid()
+    info = 'pg_autoctl_keeper_info{formation="default",group="0",node_id="%d"}'
+
+    eq_(get_metric(body, info % nodeid), "1")
+    eq_(get_metric(body, 'pg_autoctl_keeper_state{state="single"}'), "1")
+    eq_(
+        get_metric(body, 'pg_autoctl_keeper_assigned_state{state="single"}'),
+        "1",
+    )
+    eq_(get_metric(body, "pg_autoctl_keeper_postgres_running"), "1")
+
+    # the keeper main loop and the node_active calls are measured
+    assert get_count(body, "pg_autoctl_keeper_loop_duration_seconds") > 0
+    assert get_count(body, "pg_autoctl_keeper_node_active_duration_seconds") > 0
+
+    # each service started once
+    for service in ["postgres", "node-active", "metrics"]:
+        starts = 'pg_autoctl_keeper_service_starts_total{service="%s"}'
+        eq_(get_metric(body, starts % service), "1")
+
+
+def test_003_metrics_follow_the_keeper():
+    status, body = http_request(node1, "GET", "/metrics")
+    eq_(status, 200)
+
+    loops = get_count(body, "pg_autoctl_keeper_loop_duration_seconds")
+
+    # the keeper main loop runs every second or so
+    time.sleep(3)
+
+    status, body = http_request(node1, "GET", "/metrics?refresh")
+    eq_(status, 200)
+
+    assert get_count(body, "pg_autoctl_keeper_loop_duration_seconds") > loops
+
+
+def test_004_errors():
+    status, body = http_request(node1, "POST", "/metrics")
+    eq_(status, 405)
+
+    status, body = http_request(node1, "GET", "/")
+    eq_(status, 404)
+
+
+def test_005_transitions():
+    global node2
+    node2 = cluster.create_datanode("/tmp/metrics/node2")
+    node2.create()
+    node2.run()
+
+    assert node2.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
+
+    # the metrics are updated at the end of the keeper main loop
+    time.sleep(2)
+
+    status, body = http_request(node1, "GET", "/metrics")
+    print(body)
+
+    eq_(status, 200)
+    eq_(get_metric(body, 'pg_autoctl_keeper_state{state="primary"}'), "1")
+
+    name = "pg_autoctl_keeper_transition_duration_seconds_count"
+    failures = "pg_autoctl_keeper_transition_failures_total"
+
+    for labels in [
+        '{from="single",to="wait_primary"}',
+        '{from="wait_primary",to="primary"}',
+    ]:
+        eq_(get_metric(body, name + labels), "1")
+        eq_(get_metric(body, failures + labels), "0")
@@ -0,0 +1,174 @@
+import tests.pgautofailover_utils as pgautofailover
+from nose.tools import eq_
+
+import http.client
+import time
+
+cluster = None
+monitor = None
+node1 = None
+node2 = None
+
+METRICS_PORT = 9188
+
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+
+def teardown_module():
+    cluster.destroy()
+
+
+def get_metrics(method="GET", path="/metrics"):
+    """
+    Sends an HTTP request to the metrics worker of the monitor, and returns
+    the status code and body of the response.
+    """
+    address = str(monitor.vnode.address)
+
+    for attempt in range(10):
+        try:
+            c = http.client.HTTPConnection(address, METRICS_PORT, timeout=5)
+            c.request(method, path)
+            r = c.getresponse()
+            body = r.read().decode("utf-8")
+            c.close()
+            return r.status, body
+
+        except ConnectionRefusedError:
+            # the metrics worker might not be listening yet
+            time.sleep(1)
+
+    raise Exception("Failed to connect to the monitor metrics worker")
+
+
+def get_metric(body, name, node=None, labels=""):
+    if node is not None:
+        name += '{formation="default",group="0",node_id="%d",node_name="%s"' % (
+            node.get_nodeid(),
+            node.get_nodename().replace("\\", "\\\\").replace('"', '\\"'),
+        )
+        name += labels + "}"
+
+    for line in body.splitlines():
+        if line.startswith(name + " "):
+            return line[len(name) + 1 :]
+    return None
+
+
+def wait_for_metric(name, node, value, timeout=30):
+    for attempt in range(timeout):
+        status, body = get_metrics()
+
+        if status == 200 and get_metric(body, name, node) == value:
+            return body
+
+        # the worker caches the metrics for a second
+        time.sleep(1)
+
+    print(body)
+    raise Exception(
+        "Metric %s of node %d is not %s" % (name, node.get_nodeid(), value)
+    )
+
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/monitor_metrics/monitor")
+    monitor.run()
+
+    # the metrics worker is registered when Postgres starts
+    monitor.alter_system_set(
+        {
+            "pgautofailover.metrics_port": str(METRICS_PORT),
+            "pgautofailover.metrics_listen_address": "'%s'"
+            % str(monitor.vnode.address),
+        }
+    )
+    monitor.restart_postgres()
+    monitor.wait_until_pg_is_running()
+
+
+def test_001_init_nodes():
+    global node1, node2
+
+    node1 = cluster.create_datanode("/tmp/monitor_metrics/node1")
+    node1.create()
+    node1.run()
+    assert node1.wait_until_state(target_state="single")
+
+    node2 = cluster.create_datanode("/tmp/monitor_metrics/node2")
+    node2.create()
+    node2.run()
+
+    assert node2.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
+
+
+def test_002_node_metrics():
+    # health checks run every few seconds
+    wait_for_metric("pg_auto_failover_node_health", node1, "1")
+    body = wait_for_metric("pg_auto_failover_node_health", node2, "1")
+    print(body)
+
+    for node, state in [(node1, "primary"), (node2, "secondary")]:
+        labels = ',reported_state="%s",goal_state="%s"' % (state, state)
+
+        eq_(get_metric(body, "pg_auto_failover_node_state", node, labels), "1")
+        eq_(get_metric(body, "pg_auto_failover_node_state_reached", node), "1")
+
+        # keepers report to the monitor every second or so
+        age = get_metric(body, "pg_auto_failover_node_report_age_seconds", node)
+        assert 0 <= float(age) < 10
+
+        # the lag is measured against the primary, so 0 for the primary
+        lag = get_metric(body, "pg_auto_failover_node_lag_bytes", node)
+        assert lag is not None and float(lag) >= 0
+
+    eq_(get_metric(body, "pg_auto_failover_node_lag_bytes", node1), "0")
+
+
+def test_003_label_escaping():
+    node2.set_metadata(name='node "b"')
+
+    # the node name is found with its double quotes escaped
+    body = wait_for_metric("pg_auto_failover_node_state_reached", node2, "1")
+
+    assert 'node_name="node \\"b\\""' in body
+    eq_(get_metric(body, "pg_auto_failover_node_health", node2), "1")
+
+
+def test_004_failover():
+    status, body = get_metrics()
+    eq_(status, 200)
+
+    # the node registrations and state changes have been logged
+    events = int(get_metric(body, "pg_auto_failover_events_total"))
+    assert events > 0
+
+    monitor.failover()
+    assert node2.wait_until_state(target_state="primary")
+    assert node1.wait_until_state(target_state="secondary")
+
+    body = wait_for_metric("pg_auto_failover_node_state_reached", node1, "1")
+
+    for node, state in [(node1, "secondary"), (node2, "primary")]:
+        labels = ',reported_state="%s",goal_state="%s"' % (state, state)
+
+        eq_(get_metric(body, "pg_auto_failover_node_state", node, labels), "1")
+
+    # the lag is now measured against node2
+    eq_(get_metric(body, "pg_auto_failover_node_lag_bytes", node2), "0")
+
+    # the failover logged more events
+    assert int(get_metric(body, "pg_auto_failover_events_total")) > events
+
+
+def test_005_errors():
+    status, body = get_metrics("POST")
+    eq_(status, 405)
+
+    status, body = get_metrics("GET", "/")
+    eq_(status, 404)
@@ -230,7 +230,12 @@ def test_013_secondary_gets_behind_primary():
     node1.pg_autoctl.sighup()  # wake up from the 10s node_active delay
     time.sleep(1)
 
-    q = "select reportedlsn from pgautofailover.node where nodeid = 1"
+    q = (
+        "select report.reportedlsn "
+        "from pgautofailover.node "
+        "left join pgautofailover.node_report as report using(nodeid) "
+        "where nodeid = 1"
+    )
     lsn1m = monitor.run_sql_query(q)[0][0]
     print("%s " % lsn1m, end="", flush=True)
 
@@ -0,0 +1,109 @@
+import tests.pgautofailover_utils as pgautofailover
+from nose.tools import eq_
+
+import time
+
+cluster = None
+monitor = None
+node1 = None
+node2 = None
+
+# a checksum of the contents of table t
+CHECKSUM_SQL = "select count(*), sum(hashtext(payload)) from t"
+
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+
+def teardown_module():
+    cluster.destroy()
+
+
+def checksum(node):
+    return node.run_sql_query(CHECKSUM_SQL)[0]
+
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/parallel_clone/monitor")
+    monitor.run()
+
+
+def test_001_init_primary():
+    global node1
+    node1 = cluster.create_datanode("/tmp/parallel_clone/node1")
+    node1.create()
+    node1.run()
+    assert node1.wait_until_state(target_state="single")
+
+    # several relation files, so that every job has something to copy
+    for i in range(8):
+        node1.run_sql_query(
+            "create table t%d as select x from generate_series(1, 10000) x" % i
+        )
+
+    node1.run_sql_query(
+        "create table t as select x, repeat(x::text, 50) as payload "
+        "from generate_series(1, 100000) as x"
+    )
+    node1.run_sql_query("checkpoint")
+
+
+def test_002_init_secondary():
+    global node2
+    node2 = cluster.create_datanode("/tmp/parallel_clone/node2")
+    node2.create()
+
+    # the clone happens in the catchingup transition, when the node runs
+    node2.config_set("replication.clone_jobs", "4")
+    node2.config_set("replication.maximum_backup_rate", "100M")
+
+    node2.run()
+
+    assert node2.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
+
+    # stopping pg_autoctl gives us its logs
+    logs = node2.logs("STDERR")
+    print(logs)
+
+    assert "with 4 jobs" in logs
+    assert "Using pg_basebackup" not in logs
+
+    node2.run()
+    assert node2.wait_until_state(target_state="secondary")
+
+
+def test_003_same_data():
+    eq_(checksum(node2), checksum(node1))
+
+    for i in range(8):
+        eq_(
+            node2.run_sql_query("select count(*) from t%d" % i)[0][0],
+            10000,
+        )
+
+
+def test_004_streaming():
+    # the cloned standby streams the WAL of the primary
+    node1.run_sql_query("insert into t values (0, 'streamed')")
+    node1.run_sql_query("checkpoint")
+
+    for attempt in range(30):
+        if checksum(node2) == checksum(node1):
+            break
+        time.sleep(1)
+
+    eq_(checksum(node2), checksum(node1))
+
+
+def test_005_failover():
+    monitor.failover()
+
+    assert node2.wait_until_state(target_state="primary")
+    assert node1.wait_until_state(target_state="secondary")
+
+    node2.run_sql_query("insert into t values (-1, 'promoted')")
+    eq_(node2.run_sql_query("select count(*) from t")[0][0], 100002)
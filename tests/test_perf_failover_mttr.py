@@ -0,0 +1,326 @@
+import tests.pgautofailover_utils as pgautofailover
+from nose import SkipTest
+
+import datetime as dt
+import json
+import math
+import os
+import os.path
+import platform
+import shutil
+import statistics
+import subprocess
+import time
+
+#
+# Failover MTTR regression tests: we run scripted failures of the primary
+# node a number of times, and measure from the monitor events how long each
+# phase of the failover took. The median and 95th percentile of the time to
+# a new primary must stay within the tolerance of the baseline found in
+# tests/perf/failover_mttr.json.
+#
+# Those tests take a while, so they only run with TEST=perf, or when given
+# explicitly with TEST=test_perf_failover_mttr.
+#
+# The baseline is recorded on the machine that runs the checks, as timings
+# from another machine mean nothing: with MTTR_RECORD=1 the measured timings
+# and a description of the environment replace the baseline file, rather
+# than being checked against it.
+#
+ITERATIONS = int(os.getenv("MTTR_ITERATIONS", "5"))
+RECORD = os.getenv("MTTR_RECORD", "") not in ("", "0")
+BASELINE = os.path.join(os.path.dirname(__file__), "perf", "failover_mttr.json")
+
+# goal states that show the monitor has noticed that the primary failed
+DETECTION_STATES = [
+    "draining",
+    "demote_timeout",
+    "stop_replication",
+    "report_lsn",
+    "prepare_promotion",
+]
+
+cluster = None
+monitor = None
+nodes = []
+timings = {}
+
+
+def setup_module():
+    global cluster
+
+    if os.getenv("TEST", "") == "":
+        raise SkipTest("failover MTTR tests only run with TEST=perf")
+
+    cluster = pgautofailover.Cluster()
+
+
+def teardown_module():
+    print_timings()
+    cluster.destroy()
+
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/perf_mttr/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+
+def test_001_init_nodes():
+    for i in range(1, 4):
+        node = cluster.create_datanode("/tmp/perf_mttr/node%d" % i)
+        node.create()
+        node.run()
+        nodes.append(node)
+
+        if i == 1:
+            assert node.wait_until_state(target_state="single")
+        else:
+            assert node.wait_until_state(target_state="secondary")
+
+    assert find_primary().wait_until_state(target_state="primary")
+
+
+def test_002_crash():
+    def fail(node):
+        node.crash()
+
+    def recover(node, state):
+        node.run()
+
+    run_scenario("crash", fail, recover)
+
+
+def test_003_ifdown():
+    def fail(node):
+        node.ifdown()
+
+    def recover(node, state):
+        node.ifup()
+
+    run_scenario("ifdown", fail, recover)
+
+
+def test_004_stall():
+    def fail(node):
+        return node.stall()
+
+    def recover(node, pids):
+        node.resume(pids)
+
+    run_scenario("stall", fail, recover)
+
+
+def test_005_check_baseline():
+    with open(BASELINE) as f:
+        baseline = json.load(f)
+
+    if RECORD:
+        record_baseline(baseline)
+        return
+
+    if not baseline["scenarios"]:
+        raise SkipTest(
+            "no recorded MTTR baseline, record one with MTTR_RECORD=1"
+        )
+
+    tolerance = baseline["tolerance"]
+    regressions = []
+
+    for name, expected in baseline["scenarios"].items():
+        if name not in timings:
+            continue
+
+        mttr = [t["promoted"] for t in timings[name]]
+        median = statistics.median(mttr)
+        p95 = percentile(mttr, 95)
+
+        if median > expected["median"] * tolerance:
+            regressions.append(
+                "%s: median MTTR is %.1fs, baseline is %.1fs"
+                % (name, median, expected["median"])
+            )
+
+        if p95 > expected["p95"] * tolerance:
+            regressions.append(
+                "%s: p95 MTTR is %.1fs, baseline is %.1fs"
+                % (name, p95, expected["p95"])
+            )
+
+    assert not regressions, "\n".join(
+        regressions
+        + ["baseline recorded with %s" % json.dumps(baseline["environment"])]
+    )
+
+
+def record_baseline(baseline):
+    """
+    Replaces the baseline file with the timings measured in this run, keeping
+    its tolerance. The samples and the environment are recorded too, so that
+    the baseline can be compared to later runs and regenerated on the same
+    kind of machine.
+    """
+    baseline["environment"] = environment()
+    baseline["scenarios"] = {}
+
+    for name, runs in timings.items():
+        mttr = [round(t["promoted"], 1) for t in runs]
+
+        if not mttr:
+            continue
+
+        baseline["scenarios"][name] = {
+            "median": statistics.median(mttr),
+            "p95": percentile(mttr, 95),
+            "samples": mttr,
+        }
+
+    with open(BASELINE, "w") as f:
+        json.dump(baseline, f, indent=4)
+        f.write("\n")
+
+    print("recorded MTTR baseline in %s:" % BASELINE)
+    print(json.dumps(baseline, indent=4))
+
+
+def environment():
+    """
+    Returns a description of what the timings depend on: the machine, the
+    versions, and the monitor settings that drive the failure detection.
+    """
+    version = subprocess.run(
+        [shutil.which("pg_autoctl"), "version", "--json"],
+        stdout=subprocess.PIPE,
+        check=True,
+    )
+    settings = monitor.run_sql_query(
+        "select name, setting from pg_settings "
+        "where name ~ '^pgautofailover\\.' order by name"
+    )
+
+    return {
+        "recorded": dt.datetime.now(dt.timezone.utc).strftime("%Y-%m-%d"),
+        "platform": platform.platform(),
+        "cpus": os.cpu_count(),
+        "pg_autoctl": json.loads(version.stdout)["pg_autoctl"],
+        "postgres": monitor.run_sql_query("show server_version")[0][0],
+        "iterations": ITERATIONS,
+        "settings": dict(settings),
+    }
+
+
+def run_scenario(name, fail, recover):
+    """
+    Runs the failure scenario ITERATIONS times, each time failing the current
+    primary node, measuring the failover, and then having the failed node
+    join again as a secondary.
+    """
+    timings[name] = []
+
+    for i in range(ITERATIONS):
+        primary = find_primary()
+        nodeid = primary.get_nodeid()
+
+        startTime = monitor.run_sql_query("select clock_timestamp()")[0][0]
+        state = fail(primary)
+
+        phases = wait_for_failover(nodeid, startTime)
+        print("%s #%d: %s" % (name, i + 1, format_phases(phases)))
+        timings[name].append(phases)
+
+        recover(primary, state)
+        assert primary.wait_until_state(target_state="secondary")
+        assert find_primary().wait_until_state(target_state="primary")
+
+
+def find_primary():
+    """
+    Returns the node that the monitor considers to be the primary.
+    """
+    result = monitor.run_sql_query(
+        "select nodeid from pgautofailover.node "
+        "where goalstate in ('primary', 'wait_primary', 'single')"
+    )
+    primaryId = result[0][0]
+
+    for node in nodes:
+        if node.get_nodeid() == primaryId:
+            return node
+
+    raise Exception("failed to find primary node %d" % primaryId)
+
+
+def wait_for_failover(failedNodeId, startTime):
+    """
+    Waits until another node than failedNodeId reports to be a primary, and
+    returns the seconds elapsed since startTime until each phase of the
+    failover: the failure was noticed, a candidate was elected, and the
+    candidate was promoted.
+    """
+    query = (
+        "select eventtime, nodeid, reportedstate::text, goalstate::text "
+        "from pgautofailover.event "
+        "where formationid = 'default' and eventtime >= %s "
+        "order by eventid"
+    )
+
+    deadline = time.monotonic() + pgautofailover.STATE_CHANGE_TIMEOUT
+
+    while time.monotonic() < deadline:
+        phases = {}
+
+        for eventTime, nodeid, reported, goal in monitor.run_sql_query(
+            query, startTime
+        ):
+            elapsed = (eventTime - startTime).total_seconds()
+
+            if "detected" not in phases and goal in DETECTION_STATES:
+                phases["detected"] = elapsed
+
+            if nodeid == failedNodeId:
+                continue
+
+            if "elected" not in phases and goal == "prepare_promotion":
+                phases["elected"] = elapsed
+
+            if reported in ("wait_primary", "primary"):
+                phases["promoted"] = elapsed
+                return phases
+
+        time.sleep(pgautofailover.POLLING_INTERVAL * 10)
+
+    raise Exception(
+        "no failover of node %d after %ds"
+        % (failedNodeId, pgautofailover.STATE_CHANGE_TIMEOUT)
+    )
+
+
+def percentile(values, p):
+    """
+    Returns the p-th percentile of values, using the nearest-rank method.
+    """
+    ordered = sorted(values)
+    rank = math.ceil(p / 100.0 * len(ordered))
+
+    return ordered[max(rank, 1) - 1]
+
+
+def format_phases(phases):
+    return ", ".join(
+        "%s %.1fs" % (phase, phases[phase])
+        for phase in ("detected", "elected", "promoted")
+        if phase in phases
+    )
+
+
+def print_timings():
+    for name, runs in timings.items():
+        if not runs:
+            continue
+
+        mttr = [t["promoted"] for t in runs]
+        print(
+            "%s: %d runs, median MTTR %.1fs, p95 %.1fs"
+            % (name, len(mttr), statistics.median(mttr), percentile(mttr, 95))
+        )
@@ -0,0 +1,113 @@
+import tests.pgautofailover_utils as pgautofailover
+from nose.tools import eq_
+
+import time
+
+cluster = None
+monitor = None
+node1 = None
+node2 = None
+blocks = 0
+
+# the buffers of table t in the shared buffers of the local Postgres instance
+BUFFERS_SQL = """
+select count(*)
+  from pg_buffercache
+ where relfilenode = pg_relation_filenode('t')
+   and reldatabase = (select oid from pg_database
+                       where datname = current_database())
+"""
+
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+
+def teardown_module():
+    cluster.destroy()
+
+
+def table_buffers(node):
+    return node.run_sql_query(BUFFERS_SQL)[0][0]
+
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/prewarm/monitor")
+    monitor.run()
+
+
+def test_001_init_primary():
+    global node1
+    node1 = cluster.create_datanode("/tmp/prewarm/node1")
+    node1.create()
+    node1.run()
+    assert node1.wait_until_state(target_state="single")
+
+    # the autoprewarm worker is off, so that the standby that we clone from
+    # node1 does not load the block list that it finds in its own PGDATA
+    node1.alter_system_set(
+        {
+            "shared_preload_libraries": "'pg_prewarm'",
+            "pg_prewarm.autoprewarm": "off",
+        }
+    )
+    node1.restart_postgres()
+    node1.wait_until_pg_is_running()
+
+    node1.run_sql_query("create extension pg_prewarm")
+    node1.run_sql_query("create extension pg_buffercache")
+    node1.run_sql_query(
+        "create table t as select x, repeat('x', 100) as payload "
+        "from generate_series(1, 100000) as x"
+    )
+    node1.run_sql_query("checkpoint")
+
+
+def test_002_init_secondary():
+    global node2
+    node2 = cluster.create_datanode("/tmp/prewarm/node2")
+    node2.create()
+    node2.run()
+
+    assert node2.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
+
+    # the table was copied by pg_basebackup, it has not been read since
+    eq_(table_buffers(node2), 0)
+
+
+def test_003_prewarm():
+    global blocks
+
+    # load the table in the shared buffers of the primary and dump them
+    eq_(node1.run_sql_query("select pg_prewarm('t') > 0")[0][0], True)
+    node1.run_sql_query("select autoprewarm_dump_now()")
+
+    blocks = table_buffers(node1)
+    assert blocks > 0
+
+    # the prewarm interval is used when pg_autoctl starts
+    node2.stop_pg_autoctl()
+    node2.config_set("prewarm.interval", "1")
+    node2.run()
+    assert node2.wait_until_state(target_state="secondary")
+
+    # the keeper loads the primary's blocks a chunk at a time
+    for attempt in range(30):
+        if table_buffers(node2) >= blocks:
+            break
+        time.sleep(1)
+
+    assert table_buffers(node2) >= blocks
+
+
+def test_004_failover():
+    monitor.failover()
+
+    assert node2.wait_until_state(target_state="primary")
+    assert node1.wait_until_state(target_state="secondary")
+
+    # the new primary did not lose its warm cache in the failover
+    assert table_buffers(node2) >= blocks
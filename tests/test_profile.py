@@ -0,0 +1,82 @@
+import tests.pgautofailover_utils as pgautofailover
+from nose.tools import eq_, raises
+
+import subprocess
+
+cluster = None
+monitor = None
+node1 = None
+
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+
+def teardown_module():
+    cluster.destroy()
+
+
+def get_calls(report, phase):
+    """
+    Returns the number of calls of the given phase in the given report, where
+    the phase names are padded to 18 characters.
+    """
+    for line in report.splitlines():
+        if line.startswith(phase + " "):
+            return int(line[18:].split()[0])
+    return None
+
+
+def profile(node, duration):
+    command = pgautofailover.PGAutoCtl(node)
+    out, err, ret = command.execute(
+        "do profile", "do", "profile", "--duration", str(duration)
+    )
+    print(out)
+    return out
+
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/profile/monitor")
+    monitor.run()
+
+
+def test_001_init_primary():
+    global node1
+    node1 = cluster.create_datanode("/tmp/profile/node1")
+    node1.create()
+    node1.run()
+    assert node1.wait_until_state(target_state="single")
+
+
+def test_002_profile():
+    report = profile(node1, 2)
+
+    assert report.startswith("pg_autoctl node-active service, pid ")
+
+    # the keeper main loop runs every second or so
+    assert get_calls(report, "loop iterations") > 0
+    assert get_calls(report, "node_active") > 0
+    assert get_calls(report, "postgres") > 0
+
+    # a single node in a stable state has nothing to do
+    eq_(get_calls(report, "transition"), 0)
+
+    assert "CPU time:" in report
+    assert "Voluntary context switches:" in report
+
+
+def test_003_profile_again():
+    # every profile starts from scratch
+    report = profile(node1, 1)
+
+    assert 0 < get_calls(report, "loop iterations") < 5
+
+
+@raises(subprocess.CalledProcessError)
+def test_004_not_running():
+    node1.stop_pg_autoctl()
+
+    profile(node1, 1)
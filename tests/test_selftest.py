@@ -0,0 +1,71 @@
+from nose.tools import eq_
+
+import os
+import shutil
+import subprocess
+
+#
+# Unit tests of pg_autoctl internal functions: the checks are implemented in
+# src/bin/pg_autoctl/cli_do_selftest.c, and each suite runs with the command
+# pg_autoctl do selftest <suite>, which doesn't need any Postgres instance.
+#
+
+
+def selftest(suite):
+    program = shutil.which("pg_autoctl")
+
+    if program is None:
+        p = subprocess.run(
+            ["pg_config", "--bindir"], text=True, capture_output=True
+        )
+        program = os.path.join(p.stdout.splitlines()[0], "pg_autoctl")
+
+    env = dict(os.environ, PG_AUTOCTL_DEBUG="1")
+    p = subprocess.run(
+        [program, "do", "selftest", suite],
+        text=True,
+        capture_output=True,
+        env=env,
+    )
+
+    print(p.stdout)
+    print(p.stderr)
+
+    eq_(p.returncode, 0)
+    eq_(p.stdout.split(), [suite, "ok"])
+
+
+def test_000_pgsetup():
+    selftest("pgsetup")
+
+
+def test_001_controlfile():
+    selftest("controlfile")
+
+
+def test_002_filetail():
+    selftest("filetail")
+
+
+def test_003_uri():
+    selftest("uri")
+
+
+def test_004_ini():
+    selftest("ini")
+
+
+def test_005_metrics():
+    selftest("metrics")
+
+
+def test_006_prewarm():
+    selftest("prewarm")
+
+
+def test_007_clone():
+    selftest("clone")
+
+
+def test_008_profile():
+    selftest("profile")